@@ -52,6 +52,7 @@ testScripts=(
   'mempool_spendcoinbase.py'
   'mempool_coinbase_spends.py'
   'mempool_tx_input_limit.py'
+  'mempool_package.py'
   'httpbasics.py'
   'zapwallettxes.py'
   'proxy_test.py'
@@ -4,8 +4,15 @@
 # file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 from test_framework.test_framework import BitcoinTestFramework
-from test_framework.util import initialize_chain_clean, start_nodes, \
-    connect_nodes_bi
+from test_framework.util import assert_equal, initialize_chain_clean, \
+    start_nodes, connect_nodes_bi
+
+from binascii import a2b_hex
+from hashlib import sha256
+
+
+def dblsha(b):
+    return sha256(sha256(b).digest()).digest()
 
 
 class GetBlockTemplateTest(BitcoinTestFramework):
@@ -61,5 +68,32 @@ class GetBlockTemplateTest(BitcoinTestFramework):
         assert('supernodes' in tmpl['coinbasetxn'])
         assert('securenodes' in tmpl['coinbasetxn'])
 
+        # Test 7: coinbaseparts only if requested
+        assert('coinbaseparts' not in tmpl)
+        assert('merklebranch' not in tmpl)
+        assert('coinbaseparts' in tmpl['capabilities'])
+
+        # Test 8: the coinbase parts and the merkle branch give the merkle root of
+        # the template. Use the other node, whose template is not cached yet,
+        # so that it includes the transaction.
+        node.sendtoaddress(node.getnewaddress(), 1)
+        self.sync_all()
+        tmpl = self.nodes[1].getblocktemplate({'capabilities': ['coinbaseparts'], 'extranoncesize': 6})
+        assert_equal(len(tmpl['transactions']), 1)
+        parts = tmpl['coinbaseparts']
+        assert_equal(parts['extranoncesize'], 6)
+        assert_equal(len(tmpl['merklebranch']), 1)
+
+        leaves = [dblsha(a2b_hex(t['data'])) for t in tmpl['transactions']]
+        for extranonce in ['000000000000', '0123456789ab']:
+            coinbase = a2b_hex(parts['coinb1'] + extranonce + parts['coinb2'])
+            root = dblsha(coinbase)
+            for h in tmpl['merklebranch']:
+                root = dblsha(root + a2b_hex(h))
+            assert_equal(root, dblsha(dblsha(coinbase) + leaves[0]))
+
+        # Only the scriptSig differs from the coinbase of the template
+        assert_equal(parts['coinb2'], tmpl['coinbasetxn']['data'][-len(parts['coinb2']):])
+
 if __name__ == '__main__':
     GetBlockTemplateTest().main()
@@ -0,0 +1,76 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test submitpackage: a chain of dependent transactions can be
+# submitted in one call, and submission stops at the first
+# transaction that is rejected.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
+from test_framework.util import assert_equal, start_node
+
+
+class MempoolPackageTest(BitcoinTestFramework):
+
+    def setup_network(self):
+        # Just need one node for this test
+        args = ["-checkmempool", "-debug=mempool"]
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, args))
+        self.is_network_split = False
+
+    def create_tx(self, from_txid, to_address, amount):
+        inputs = [{ "txid" : from_txid, "vout" : 0}]
+        outputs = { to_address : amount }
+        rawtx = self.nodes[0].createrawtransaction(inputs, outputs)
+        signresult = self.nodes[0].signrawtransaction(rawtx)
+        assert_equal(signresult["complete"], True)
+        return signresult["hex"]
+
+    def run_test(self):
+        node0_address = self.nodes[0].getnewaddress()
+
+        # A chain of three transactions, each spending the previous one
+        coinbase_txid = self.nodes[0].getblock(self.nodes[0].getblockhash(1))['tx'][0]
+        chain_raw = []
+        chain_id = []
+        parent = coinbase_txid
+        for amount in [11.4375, 11.4365, 11.4355]:
+            chain_raw.append(self.create_tx(parent, node0_address, amount))
+            parent = self.nodes[0].decoderawtransaction(chain_raw[-1])['txid']
+            chain_id.append(parent)
+
+        assert_equal(self.nodes[0].submitpackage(chain_raw), chain_id)
+        assert_equal(set(self.nodes[0].getrawmempool()), set(chain_id))
+
+        # Submitting it again is harmless
+        assert_equal(self.nodes[0].submitpackage(chain_raw), chain_id)
+
+        # A package whose second transaction double spends the first one's input
+        # only gets its first transaction in
+        coinbase_txid = self.nodes[0].getblock(self.nodes[0].getblockhash(2))['tx'][0]
+        first = self.create_tx(coinbase_txid, node0_address, 11.4375)
+        conflict = self.create_tx(coinbase_txid, node0_address, 11.4365)
+        first_id = self.nodes[0].decoderawtransaction(first)['txid']
+        conflict_id = self.nodes[0].decoderawtransaction(conflict)['txid']
+        try:
+            self.nodes[0].submitpackage([first, conflict])
+            raise AssertionError("package with a conflict was accepted")
+        except JSONRPCException as e:
+            assert("transaction 1 (%s)" % conflict_id in e.error['message'])
+        assert(first_id in self.nodes[0].getrawmempool())
+        assert(conflict_id not in self.nodes[0].getrawmempool())
+
+        # Everything accepted gets mined
+        self.nodes[0].generate(1)
+        assert_equal(set(self.nodes[0].getrawmempool()), set())
+        for txid in chain_id + [first_id]:
+            assert(self.nodes[0].gettransaction(txid)["confirmations"] > 0)
+
+
+if __name__ == '__main__':
+    MempoolPackageTest().main()
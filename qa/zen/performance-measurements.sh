@@ -180,6 +180,16 @@ case "$1" in
             listunspent)
                 zcash_rpc zcbenchmark listunspent 10
                 ;;
+            mempoolstress)
+                # Mature coinbases to fund the samples
+                zcash_rpc generate 110 > /dev/null
+                zcash_rpc_slow zcbenchmark mempoolstress 3 "${@:3}"
+                ;;
+            walletscale)
+                # Blocks for the witness caches of the synthetic wallet
+                zcash_rpc generate 101 > /dev/null
+                zcash_rpc_slow zcbenchmark walletscale 3 "${@:3}"
+                ;;
             *)
                 zcashd_stop
                 echo "Bad arguments to time."
@@ -230,6 +240,14 @@ case "$1" in
             listunspent)
                 zcash_rpc zcbenchmark listunspent 1
                 ;;
+            mempoolstress)
+                zcash_rpc generate 110 > /dev/null
+                zcash_rpc_slow zcbenchmark mempoolstress 1 "${@:3}"
+                ;;
+            walletscale)
+                zcash_rpc generate 101 > /dev/null
+                zcash_rpc_slow zcbenchmark walletscale 1 "${@:3}"
+                ;;
             *)
                 zcashd_massif_stop
                 echo "Bad arguments to memory."
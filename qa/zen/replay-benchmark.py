@@ -0,0 +1,223 @@
+#!/usr/bin/env python2
+# Copyright (c) 2020 The Zen Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+USAGE = """
+Replays a recorded segment of the chain through a fresh zend, and reports the
+blocks it connected per second, its peak RSS and where the time connecting the
+blocks went, from getblockvalidationstats. With --reorg-depth the tip is then
+invalidated that many blocks back and reconsidered, timing both.
+
+The segment is a file of blocks in the blk?????.dat format, as written by
+contrib/linearize/linearize-data.py, imported with -loadblock. A segment not
+starting at the genesis block needs --base-datadir, a stopped node's datadir
+with the blocks, undo data and chain state up to the block before it; it is
+copied, so the replay always starts from the same state.
+
+Example usage:
+
+contrib/linearize/linearize-data.py linearize.cfg
+qa/zen/replay-benchmark.py --segment bootstrap.dat --reorg-depth 100 --json
+"""
+
+RPC_PORT = 5983
+
+
+class Node(object):
+    def __init__(self, zend, zencli, datadir, args):
+        self.zencli = zencli
+        self.datadir = datadir
+        self.args = ['-datadir=' + datadir, '-rpcuser=user', '-rpcpassword=password',
+                     '-rpcport=%d' % RPC_PORT, '-showmetrics=0', '-listen=0', '-connect=0',
+                     '-dnsseed=0'] + args
+        self.process = subprocess.Popen([zend] + self.args)
+        self.rpc('-rpcwait', 'getblockcount')
+
+    def rpc(self, *args):
+        output = subprocess.check_output([self.zencli, '-datadir=' + self.datadir, '-rpcuser=user',
+                                          '-rpcpassword=password', '-rpcport=%d' % RPC_PORT,
+                                          '-rpcclienttimeout=0'] + list(args))
+        output = output.decode().strip()
+        try:
+            return json.loads(output)
+        except ValueError:
+            return output
+
+    def peak_rss(self):
+        # The high-water mark of the resident memory, in kB
+        with open('/proc/%d/status' % self.process.pid) as f:
+            for line in f:
+                if line.startswith('VmHWM:'):
+                    return int(line.split()[1])
+        return None
+
+    def stop(self):
+        self.rpc('stop')
+        self.process.wait()
+
+
+class StageTimes(object):
+    """The getblockvalidationstats of the blocks connected, each counted once"""
+
+    STAGES = ['read', 'coinsfetch', 'proofs', 'connect', 'scripts', 'undo', 'index',
+              'callbacks', 'flush', 'chainstate', 'notify', 'postprocess', 'total']
+
+    def __init__(self):
+        self.seen = set()
+        self.totals = dict((stage, 0) for stage in self.STAGES)
+        self.blocks = 0
+        self.tx = 0
+        self.inputs = 0
+
+    def collect(self, node):
+        # The node keeps the last 1000 blocks only, so this runs more often than that
+        for stats in node.rpc('getblockvalidationstats', '1000'):
+            if stats['hash'] in self.seen:
+                continue
+            self.seen.add(stats['hash'])
+            self.blocks += 1
+            self.tx += stats['tx']
+            self.inputs += stats['inputs']
+            for stage in self.STAGES:
+                self.totals[stage] += stats[stage]
+
+    def result(self):
+        mean = dict((stage, float(self.totals[stage]) / self.blocks if self.blocks else 0)
+                    for stage in self.STAGES)
+        return {'blocks': self.blocks, 'tx': self.tx, 'inputs': self.inputs,
+                'totalmicros': self.totals, 'meanmicros': mean}
+
+
+def wait_for_height(node, height, timeout, stages=None, interval=1.0):
+    """
+    Wait until the tip is at height, or has not moved for timeout seconds. Returns the
+    height reached, and when it was.
+    """
+    last, last_change = None, time.time()
+    while True:
+        count = node.rpc('getblockcount')
+        if stages is not None:
+            stages.collect(node)
+        if count != last:
+            last, last_change = count, time.time()
+        if count == height:
+            return count, last_change
+        if time.time() - last_change > timeout:
+            return count, last_change
+        time.sleep(interval)
+
+
+def run(args):
+    datadir = tempfile.mkdtemp(prefix='zen-replay-')
+    try:
+        if args.base_datadir:
+            shutil.rmtree(datadir)
+            shutil.copytree(args.base_datadir, datadir)
+        open(os.path.join(datadir, 'zen.conf'), 'a').close()
+
+        node = Node(args.zend, args.zencli, datadir,
+                    ['-loadblock=' + os.path.abspath(args.segment)] + args.zend_arg)
+        start = time.time()
+        start_height = node.rpc('getblockcount')
+        stages = StageTimes()
+        height, end = wait_for_height(node, args.height, args.idle_timeout, stages)
+        elapsed = end - start
+        replayed = height - start_height
+
+        result = {
+            'segment': args.segment,
+            'startheight': start_height,
+            'height': height,
+            'seconds': elapsed,
+            'blockspersecond': replayed / elapsed if elapsed > 0 else 0,
+            'stages': stages.result(),
+        }
+
+        if args.reorg_depth:
+            depth = min(args.reorg_depth, height)
+            fork_hash = node.rpc('getblockhash', str(height - depth + 1))
+            begin = time.time()
+            node.rpc('invalidateblock', fork_hash)
+            _, end = wait_for_height(node, height - depth, args.idle_timeout, interval=0.1)
+            disconnected = end - begin
+            begin = time.time()
+            node.rpc('reconsiderblock', fork_hash)
+            reached, end = wait_for_height(node, height, args.idle_timeout, interval=0.1)
+            reconnected = end - begin
+            result['reorg'] = {
+                'depth': depth,
+                'disconnectseconds': disconnected,
+                'reconnectseconds': reconnected,
+                'height': reached,
+            }
+
+        result['peakrsskb'] = node.peak_rss()
+        node.stop()
+        return result
+    finally:
+        if not args.keep_datadir:
+            shutil.rmtree(datadir, ignore_errors=True)
+
+
+def print_result(result):
+    print('Replayed %d blocks in %.1f s: %.2f blocks/s, peak RSS %s kB' % (
+        result['height'] - result['startheight'], result['seconds'], result['blockspersecond'],
+        result['peakrsskb']))
+    stages = result['stages']
+    print('Mean microseconds per block over %d blocks, %d transactions, %d inputs:' % (
+        stages['blocks'], stages['tx'], stages['inputs']))
+    for stage in StageTimes.STAGES:
+        print('  %-12s %12.0f' % (stage, stages['meanmicros'][stage]))
+    if 'reorg' in result:
+        reorg = result['reorg']
+        print('Reorg of %d blocks: disconnected in %.1f s, reconnected in %.1f s' % (
+            reorg['depth'], reorg['disconnectseconds'], reorg['reconnectseconds']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=USAGE, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--segment', required=True, help='the blocks to replay, in the blk?????.dat format')
+    parser.add_argument('--base-datadir', help='datadir with the chain up to the block before the segment')
+    parser.add_argument('--height', type=int, default=-1,
+                        help='height the replay ends at (default: wait until the tip stops moving)')
+    parser.add_argument('--reorg-depth', type=int, default=0, help='blocks to invalidate and reconsider after the replay')
+    parser.add_argument('--idle-timeout', type=float, default=60,
+                        help='seconds without a new tip after which the replay is over (default: 60)')
+    parser.add_argument('--min-blocks-per-second', type=float, default=0,
+                        help='fail if the replay is slower, to gate an upgrade on it')
+    parser.add_argument('--zend', default='./src/zend')
+    parser.add_argument('--zencli', default='./src/zen-cli')
+    parser.add_argument('--zend-arg', action='append', default=[], help='an option passed on to zend, e.g. -dbcache=4000')
+    parser.add_argument('--keep-datadir', action='store_true')
+    parser.add_argument('--json', action='store_true', help='print the result as JSON')
+    args = parser.parse_args()
+
+    result = run(args)
+    if args.json:
+        print(json.dumps(result, indent=2, sort_keys=True))
+    else:
+        print_result(result)
+
+    if 'reorg' in result and result['reorg']['height'] != result['height']:
+        print('The reorg did not return to height %d' % result['height'], file=sys.stderr)
+        return 1
+    if result['blockspersecond'] < args.min_blocks_per_second:
+        print('%.2f blocks/s is below %.2f' % (result['blockspersecond'], args.min_blocks_per_second), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,260 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "primitives/block.h"
+#include "pubkey.h"
+#include "script/standard.h"
+#include "undo.h"
+#include "util.h"
+
+#include <boost/scoped_ptr.hpp>
+
+static const char DB_ADDRESSINDEX = 'a';
+static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_SPENTINDEX = 'p';
+static const char DB_BEST_BLOCK = 'B';
+
+bool GetScriptAddress(const CScript& script, int& type, uint160& hashBytes)
+{
+    std::vector<std::vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    if (!Solver(script, whichType, vSolutions))
+        return false;
+
+    switch (whichType) {
+    case TX_PUBKEY:
+    case TX_PUBKEY_REPLAY: {
+        CPubKey pubKey(vSolutions[0]);
+        if (!pubKey.IsValid())
+            return false;
+        type = ADDRESS_TYPE_PUBKEYHASH;
+        hashBytes = pubKey.GetID();
+        return true;
+    }
+    case TX_PUBKEYHASH:
+    case TX_PUBKEYHASH_REPLAY:
+        type = ADDRESS_TYPE_PUBKEYHASH;
+        hashBytes = uint160(vSolutions[0]);
+        return true;
+    case TX_SCRIPTHASH:
+    case TX_SCRIPTHASH_REPLAY:
+        type = ADDRESS_TYPE_SCRIPTHASH;
+        hashBytes = uint160(vSolutions[0]);
+        return true;
+    default:
+        return false;
+    }
+}
+
+CAddressIndexDB::CAddressIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CLevelDBWrapper(GetDataDir() / "blocks" / "addressindex", nCacheSize, fMemory, fWipe, CLevelDBProfile::AddressIndex().ApplyArgs()) {
+}
+
+bool CAddressIndexDB::ReadBestBlock(uint256& hashBest) const {
+    return Read(DB_BEST_BLOCK, hashBest);
+}
+
+bool CAddressIndexDB::ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value) const {
+    return Read(std::make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool CAddressIndexDB::ReadAddressIndex(int type, const uint160& hashBytes, std::vector<std::pair<CAddressIndexKey, CAmount> >& vEntries,
+                                       int nStart, int nEnd) const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewSeekIterator());
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << DB_ADDRESSINDEX;
+    ser_writedata8(ssKey, type);
+    ssKey << hashBytes;
+    const size_t nPrefixSize = ssKey.size();
+    if (nStart > 0)
+        ser_writedata32be(ssKey, nStart);
+    pcursor->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (!slKey.starts_with(leveldb::Slice(&ssKey[0], nPrefixSize)))
+                break;
+            CDataStream ssEntry(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressIndexKey key;
+            ssEntry >> chType >> key;
+            if (nEnd > 0 && key.nHeight > nEnd)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAmount nValue;
+            ssValue >> nValue;
+            vEntries.push_back(std::make_pair(key, nValue));
+        }
+    } catch (const std::exception& e) {
+        return error("%s: deserialize error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CAddressIndexDB::ReadAddressUnspentIndex(int type, const uint160& hashBytes,
+                                              std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent) const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewSeekIterator());
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << DB_ADDRESSUNSPENTINDEX;
+    ser_writedata8(ssKey, type);
+    ssKey << hashBytes;
+    pcursor->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (!slKey.starts_with(leveldb::Slice(&ssKey[0], ssKey.size())))
+                break;
+            CDataStream ssEntry(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressUnspentKey key;
+            ssEntry >> chType >> key;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue value;
+            ssValue >> value;
+            vUnspent.push_back(std::make_pair(key, value));
+        }
+    } catch (const std::exception& e) {
+        return error("%s: deserialize error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+void CAddressIndexBatch::WriteUnspent(const CAddressUnspentKey& key, const CAddressUnspentValue& value)
+{
+    if (value.IsNull())
+        batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, key));
+    else
+        batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, key), value);
+    mapUnspent[key] = value;
+    nChanges++;
+}
+
+bool CAddressIndexBatch::ReadUnspent(const CAddressUnspentKey& key, CAddressUnspentValue& value) const
+{
+    std::map<CAddressUnspentKey, CAddressUnspentValue>::const_iterator it = mapUnspent.find(key);
+    if (it != mapUnspent.end()) {
+        value = it->second;
+        return !value.IsNull();
+    }
+    return db.Read(std::make_pair(DB_ADDRESSUNSPENTINDEX, key), value);
+}
+
+void CAddressIndexBatch::WriteSpent(const CSpentIndexKey& key, const CSpentIndexValue& value)
+{
+    if (value.IsNull())
+        batch.Erase(std::make_pair(DB_SPENTINDEX, key));
+    else
+        batch.Write(std::make_pair(DB_SPENTINDEX, key), value);
+    mapSpent[key] = value;
+    nChanges++;
+}
+
+bool CAddressIndexBatch::ReadSpent(const CSpentIndexKey& key, CSpentIndexValue& value) const
+{
+    std::map<CSpentIndexKey, CSpentIndexValue>::const_iterator it = mapSpent.find(key);
+    if (it != mapSpent.end()) {
+        value = it->second;
+        return !value.IsNull();
+    }
+    return db.Read(std::make_pair(DB_SPENTINDEX, key), value);
+}
+
+void CAddressIndexBatch::ConnectBlock(const CBlock& block, const CBlockUndo& blockundo, int nHeight)
+{
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256 txhash = tx.GetHash();
+
+        if (!tx.IsCoinBase()) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const CTxIn& txin = tx.vin[j];
+                const CTxOut& prevout = txundo.vprevout[j].txout;
+                CSpentIndexValue spent;
+                spent.txid = txhash;
+                spent.nInputIndex = j;
+                spent.nHeight = nHeight;
+                spent.nValue = prevout.nValue;
+                if (GetScriptAddress(prevout.scriptPubKey, spent.addressType, spent.addressHash)) {
+                    batch.Write(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(spent.addressType, spent.addressHash, nHeight, i, txhash, j, true)),
+                                -prevout.nValue);
+                    nChanges++;
+                    const CAddressUnspentKey unspentKey(spent.addressType, spent.addressHash, txin.prevout.hash, txin.prevout.n);
+                    CAddressUnspentValue unspent;
+                    if (ReadUnspent(unspentKey, unspent))
+                        spent.nPrevHeight = unspent.nHeight;
+                    WriteUnspent(unspentKey, CAddressUnspentValue());
+                }
+                WriteSpent(CSpentIndexKey(txin.prevout.hash, txin.prevout.n), spent);
+            }
+        }
+
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            const CTxOut& txout = tx.vout[k];
+            int type;
+            uint160 hashBytes;
+            if (!GetScriptAddress(txout.scriptPubKey, type, hashBytes))
+                continue;
+            batch.Write(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(type, hashBytes, nHeight, i, txhash, k, false)), txout.nValue);
+            nChanges++;
+            WriteUnspent(CAddressUnspentKey(type, hashBytes, txhash, k), CAddressUnspentValue(txout.nValue, txout.scriptPubKey, nHeight));
+        }
+    }
+}
+
+void CAddressIndexBatch::DisconnectBlock(const CBlock& block, const CBlockUndo& blockundo, int nHeight)
+{
+    for (unsigned int i = block.vtx.size(); i-- > 0; ) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256 txhash = tx.GetHash();
+
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            int type;
+            uint160 hashBytes;
+            if (!GetScriptAddress(tx.vout[k].scriptPubKey, type, hashBytes))
+                continue;
+            batch.Erase(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(type, hashBytes, nHeight, i, txhash, k, false)));
+            nChanges++;
+            WriteUnspent(CAddressUnspentKey(type, hashBytes, txhash, k), CAddressUnspentValue());
+        }
+
+        if (tx.IsCoinBase())
+            continue;
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        for (unsigned int j = tx.vin.size(); j-- > 0; ) {
+            const CTxIn& txin = tx.vin[j];
+            const CTxOut& prevout = txundo.vprevout[j].txout;
+            const CSpentIndexKey spentKey(txin.prevout.hash, txin.prevout.n);
+            CSpentIndexValue spent;
+            ReadSpent(spentKey, spent);
+            int type;
+            uint160 hashBytes;
+            if (GetScriptAddress(prevout.scriptPubKey, type, hashBytes)) {
+                batch.Erase(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(type, hashBytes, nHeight, i, txhash, j, true)));
+                nChanges++;
+                WriteUnspent(CAddressUnspentKey(type, hashBytes, txin.prevout.hash, txin.prevout.n),
+                             CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, spent.nPrevHeight));
+            }
+            WriteSpent(spentKey, CSpentIndexValue());
+        }
+    }
+}
+
+bool CAddressIndexBatch::Write(const uint256& hashBest)
+{
+    batch.Write(DB_BEST_BLOCK, hashBest);
+    if (!db.WriteBatch(batch))
+        return false;
+    batch.Clear();
+    mapUnspent.clear();
+    mapSpent.clear();
+    nChanges = 0;
+    return true;
+}
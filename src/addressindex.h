@@ -0,0 +1,254 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "leveldbwrapper.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * The address and spent indexes of -addressindex, as the insight API has them: the
+ * transparent outputs and inputs of every address, its unspent outputs, and the input
+ * spending each output. Heights and indexes are stored big-endian in the keys so the
+ * entries of an address come in the order of the chain.
+ */
+
+/** Types of the addresses in the index */
+enum AddressIndexType {
+    ADDRESS_TYPE_NONE = 0,
+    ADDRESS_TYPE_PUBKEYHASH = 1,
+    ADDRESS_TYPE_SCRIPTHASH = 2,
+};
+
+/** The type and hash of the address a script pays to, or false if it has none */
+bool GetScriptAddress(const CScript& script, int& type, uint160& hashBytes);
+
+/** An output paying to (fSpending false), or an input spending from (fSpending true), an address */
+struct CAddressIndexKey
+{
+    int type;
+    uint160 hashBytes;
+    int nHeight;
+    unsigned int nTxIndex;
+    uint256 txhash;
+    unsigned int nIndex;
+    bool fSpending;
+
+    CAddressIndexKey() : type(ADDRESS_TYPE_NONE), nHeight(0), nTxIndex(0), nIndex(0), fSpending(false) {}
+    CAddressIndexKey(int typeIn, const uint160& hashBytesIn, int nHeightIn, unsigned int nTxIndexIn,
+                     const uint256& txhashIn, unsigned int nIndexIn, bool fSpendingIn) :
+        type(typeIn), hashBytes(hashBytesIn), nHeight(nHeightIn), nTxIndex(nTxIndexIn), txhash(txhashIn),
+        nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return 1 + 20 + 4 + 4 + 32 + 4 + 1; }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, nHeight);
+        ser_writedata32be(s, nTxIndex);
+        txhash.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, nIndex);
+        ser_writedata8(s, fSpending);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s, nType, nVersion);
+        nHeight = ser_readdata32be(s);
+        nTxIndex = ser_readdata32be(s);
+        txhash.Unserialize(s, nType, nVersion);
+        nIndex = ser_readdata32be(s);
+        fSpending = ser_readdata8(s) != 0;
+    }
+};
+
+/** An unspent output of an address */
+struct CAddressUnspentKey
+{
+    int type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int nIndex;
+
+    CAddressUnspentKey() : type(ADDRESS_TYPE_NONE), nIndex(0) {}
+    CAddressUnspentKey(int typeIn, const uint160& hashBytesIn, const uint256& txhashIn, unsigned int nIndexIn) :
+        type(typeIn), hashBytes(hashBytesIn), txhash(txhashIn), nIndex(nIndexIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return 1 + 20 + 32 + 4; }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s, nType, nVersion);
+        txhash.Serialize(s, nType, nVersion);
+        ser_writedata32(s, nIndex);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s, nType, nVersion);
+        txhash.Unserialize(s, nType, nVersion);
+        nIndex = ser_readdata32(s);
+    }
+
+    bool operator<(const CAddressUnspentKey& other) const
+    {
+        if (type != other.type)
+            return type < other.type;
+        if (hashBytes != other.hashBytes)
+            return hashBytes < other.hashBytes;
+        if (txhash != other.txhash)
+            return txhash < other.txhash;
+        return nIndex < other.nIndex;
+    }
+};
+
+struct CAddressUnspentValue
+{
+    CAmount nValue;
+    CScript script;
+    int nHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nValue);
+        READWRITE(script);
+        READWRITE(nHeight);
+    }
+
+    CAddressUnspentValue() : nValue(-1), nHeight(0) {}
+    CAddressUnspentValue(CAmount nValueIn, const CScript& scriptIn, int nHeightIn) :
+        nValue(nValueIn), script(scriptIn), nHeight(nHeightIn) {}
+
+    bool IsNull() const { return nValue == -1; }
+};
+
+/** An output spent in the chain */
+struct CSpentIndexKey
+{
+    uint256 txid;
+    unsigned int nIndex;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(nIndex);
+    }
+
+    CSpentIndexKey() : nIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, unsigned int nIndexIn) : txid(txidIn), nIndex(nIndexIn) {}
+
+    bool operator<(const CSpentIndexKey& other) const
+    {
+        if (txid != other.txid)
+            return txid < other.txid;
+        return nIndex < other.nIndex;
+    }
+};
+
+/** The input spending an output, and what the output was */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    unsigned int nInputIndex;
+    int nHeight;
+    CAmount nValue;
+    int addressType;
+    uint160 addressHash;
+    //! Height of the output, to restore it as unspent if the block spending it is disconnected
+    int nPrevHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(nInputIndex);
+        READWRITE(nHeight);
+        READWRITE(nValue);
+        READWRITE(addressType);
+        READWRITE(addressHash);
+        READWRITE(nPrevHeight);
+    }
+
+    CSpentIndexValue() : nInputIndex(0), nHeight(-1), nValue(0), addressType(ADDRESS_TYPE_NONE), nPrevHeight(0) {}
+
+    bool IsNull() const { return nHeight == -1; }
+};
+
+/** Access to the address and spent indexes (blocks/addressindex/) */
+class CAddressIndexDB : public CLevelDBWrapper
+{
+public:
+    CAddressIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! The last block indexed
+    bool ReadBestBlock(uint256& hashBest) const;
+    bool ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value) const;
+    //! The outputs and inputs of an address, in the blocks from nStart to nEnd if nEnd is not 0
+    bool ReadAddressIndex(int type, const uint160& hashBytes, std::vector<std::pair<CAddressIndexKey, CAmount> >& vEntries,
+                          int nStart = 0, int nEnd = 0) const;
+    bool ReadAddressUnspentIndex(int type, const uint160& hashBytes,
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent) const;
+
+private:
+    CAddressIndexDB(const CAddressIndexDB&);
+    void operator=(const CAddressIndexDB&);
+};
+
+/**
+ * The changes to the indexes of a run of blocks connected and disconnected in order,
+ * written at once with the last block of the run.
+ */
+class CAddressIndexBatch
+{
+public:
+    CAddressIndexBatch(CAddressIndexDB& dbIn) : db(dbIn), nChanges(0) {}
+
+    void ConnectBlock(const CBlock& block, const CBlockUndo& blockundo, int nHeight);
+    void DisconnectBlock(const CBlock& block, const CBlockUndo& blockundo, int nHeight);
+
+    //! Number of entries written or erased so far
+    size_t GetChanges() const { return nChanges; }
+
+    bool Write(const uint256& hashBest);
+
+private:
+    CAddressIndexDB& db;
+    CLevelDBBatch batch;
+    size_t nChanges;
+    //! The entries written in this batch, null for the ones erased, which the database does not have yet
+    std::map<CAddressUnspentKey, CAddressUnspentValue> mapUnspent;
+    std::map<CSpentIndexKey, CSpentIndexValue> mapSpent;
+
+    void WriteUnspent(const CAddressUnspentKey& key, const CAddressUnspentValue& value);
+    bool ReadUnspent(const CAddressUnspentKey& key, CAddressUnspentValue& value) const;
+    void WriteSpent(const CSpentIndexKey& key, const CSpentIndexValue& value);
+    bool ReadSpent(const CSpentIndexKey& key, CSpentIndexValue& value) const;
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_ADDRMAN_H
 #define BITCOIN_ADDRMAN_H
 
+#include "hash.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -15,6 +16,7 @@
 #include <map>
 #include <set>
 #include <stdint.h>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -166,6 +168,98 @@ public:
 //! the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+/**
+ * Hasher of network addresses, keyed so that peers cannot choose addresses which collide in a hash table
+ */
+class CNetAddrHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CNetAddrHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t operator()(const CNetAddr& addr) const
+    {
+        unsigned char vch[16];
+        for (int i = 0; i < 16; i++)
+            vch[i] = addr.GetByte(15 - i);
+        return CSipHasher(k0, k1).Write(vch, sizeof(vch)).Finalize();
+    }
+};
+
+/**
+ * The slots of the "new" or "tried" buckets, holding the nId of their entry or -1.
+ * The occupied slots are also listed, so that one of them is drawn uniformly at random
+ * in constant time however sparse the table is.
+ */
+template<int BUCKET_COUNT>
+class CAddrBucketTable
+{
+private:
+    //! nId in each slot, -1 if empty
+    int vSlot[BUCKET_COUNT * ADDRMAN_BUCKET_SIZE];
+
+    //! position in vOccupied of each occupied slot
+    int vOccupiedPos[BUCKET_COUNT * ADDRMAN_BUCKET_SIZE];
+
+    //! occupied slots, in no particular order
+    std::vector<int> vOccupied;
+
+public:
+    CAddrBucketTable()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        for (int n = 0; n < BUCKET_COUNT * ADDRMAN_BUCKET_SIZE; n++)
+            vSlot[n] = -1;
+        std::vector<int>().swap(vOccupied);
+    }
+
+    //! The slots of a bucket, to be read as table[nBucket][nPos]
+    const int* operator[](int nBucket) const
+    {
+        return &vSlot[nBucket * ADDRMAN_BUCKET_SIZE];
+    }
+
+    //! Set the nId of a slot, -1 to empty it
+    void Set(int nBucket, int nPos, int nId)
+    {
+        const int nSlot = nBucket * ADDRMAN_BUCKET_SIZE + nPos;
+        if (vSlot[nSlot] == -1 && nId != -1) {
+            vOccupiedPos[nSlot] = vOccupied.size();
+            vOccupied.push_back(nSlot);
+        } else if (vSlot[nSlot] != -1 && nId == -1) {
+            const int nLast = vOccupied.back();
+            vOccupied[vOccupiedPos[nSlot]] = nLast;
+            vOccupiedPos[nLast] = vOccupiedPos[nSlot];
+            vOccupied.pop_back();
+        }
+        vSlot[nSlot] = nId;
+    }
+
+    //! Copy the nId of every slot, bucket after bucket
+    void CopySlots(std::vector<int>& vSlotsOut) const
+    {
+        vSlotsOut.assign(vSlot, vSlot + BUCKET_COUNT * ADDRMAN_BUCKET_SIZE);
+    }
+
+    //! Number of occupied slots
+    int CountOccupied() const
+    {
+        return vOccupied.size();
+    }
+
+    //! nId in the n-th occupied slot
+    int GetOccupied(int n) const
+    {
+        return vSlot[vOccupied[n]];
+    }
+};
+
 /** 
  * Stochastical (IP) address manager 
  */
@@ -175,14 +269,14 @@ private:
     //! critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
-    //! last used nId
-    int nIdCount;
+    //! table with information about all nIds, indexed by nId; unused entries have nRandomPos -1
+    std::vector<CAddrInfo> vInfo;
 
-    //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    //! unused nIds, reused before vInfo grows
+    std::vector<int> vFreeIds;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    std::unordered_map<CNetAddr, int, CNetAddrHasher> mapAddr;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -191,13 +285,13 @@ private:
     int nTried;
 
     //! list of "tried" buckets
-    int vvTried[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+    CAddrBucketTable<ADDRMAN_TRIED_BUCKET_COUNT> vvTried;
 
     //! number of (unique) "new" entries
     int nNew;
 
     //! list of "new" buckets
-    int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+    CAddrBucketTable<ADDRMAN_NEW_BUCKET_COUNT> vvNew;
 
 protected:
     //! secret key to randomize bucket select with
@@ -266,7 +360,7 @@ public:
      * as incompatible. This is necessary because it did not check the version number on
      * deserialization.
      *
-     * Notice that vvTried, mapAddr and vVector are never encoded explicitly;
+     * Notice that vvTried, mapAddr and vRandom are never encoded explicitly;
      * they are instead reconstructed from the other information.
      *
      * vvNew is serialized, but only used if ADDRMAN_UNKNOWN_BUCKET_COUNT didn't change,
@@ -281,47 +375,61 @@ public:
     template<typename Stream>
     void Serialize(Stream &s, int nType, int nVersionDummy) const
     {
-        LOCK(cs);
+        // Only a copy of the state is taken under the lock, so that encoding it (which is
+        // much slower for a large table) does not block the threads using addrman.
+        uint256 nKeyCopy;
+        int nNewCopy, nTriedCopy;
+        std::vector<CAddrInfo> vInfoCopy;
+        std::vector<int> vNewSlots;
+        {
+            LOCK(cs);
+            nKeyCopy = nKey;
+            nNewCopy = nNew;
+            nTriedCopy = nTried;
+            vInfoCopy = vInfo;
+            vvNew.CopySlots(vNewSlots);
+        }
 
         unsigned char nVersion = 1;
         s << nVersion;
         s << ((unsigned char)32);
-        s << nKey;
-        s << nNew;
-        s << nTried;
+        s << nKeyCopy;
+        s << nNewCopy;
+        s << nTriedCopy;
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        std::vector<int> vUnkIds(vInfoCopy.size(), -1);
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
-            const CAddrInfo &info = (*it).second;
+        for (size_t n = 0; n < vInfoCopy.size(); n++) {
+            const CAddrInfo &info = vInfoCopy[n];
             if (info.nRefCount) {
-                assert(nIds != nNew); // this means nNew was wrong, oh ow
+                vUnkIds[n] = nIds;
+                assert(nIds != nNewCopy); // this means nNew was wrong, oh ow
                 s << info;
                 nIds++;
             }
         }
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            const CAddrInfo &info = (*it).second;
+        for (size_t n = 0; n < vInfoCopy.size(); n++) {
+            const CAddrInfo &info = vInfoCopy[n];
             if (info.fInTried) {
-                assert(nIds != nTried); // this means nTried was wrong, oh ow
+                assert(nIds != nTriedCopy); // this means nTried was wrong, oh ow
                 s << info;
                 nIds++;
             }
         }
         for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+            const int* pSlots = &vNewSlots[bucket * ADDRMAN_BUCKET_SIZE];
             int nSize = 0;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
-                if (vvNew[bucket][i] != -1)
+                if (pSlots[i] != -1)
                     nSize++;
             }
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
-                if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
+                if (pSlots[i] != -1) {
+                    int nIndex = vUnkIds[pSlots[i]];
                     s << nIndex;
                 }
             }
@@ -358,8 +466,9 @@ public:
         }
 
         // Deserialize entries from the new table.
+        vInfo.resize(nNew);
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
+            CAddrInfo &info = vInfo[n];
             s >> info;
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
@@ -370,12 +479,11 @@ public:
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    vvNew.Set(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
         }
-        nIdCount = nNew;
 
         // Deserialize entries from the tried table.
         int nLost = 0;
@@ -385,13 +493,13 @@ public:
             int nKBucket = info.GetTriedBucket(nKey);
             int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
             if (vvTried[nKBucket][nKBucketPos] == -1) {
+                int nId = vInfo.size();
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
-                vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
-                mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
-                nIdCount++;
+                vRandom.push_back(nId);
+                vInfo.push_back(info);
+                mapAddr[info] = nId;
+                vvTried.Set(nKBucket, nKBucketPos, nId);
             } else {
                 nLost++;
             }
@@ -406,11 +514,11 @@ public:
                 int nIndex = 0;
                 s >> nIndex;
                 if (nIndex >= 0 && nIndex < nNew) {
-                    CAddrInfo &info = mapInfo[nIndex];
+                    CAddrInfo &info = vInfo[nIndex];
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        vvNew.Set(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -418,13 +526,10 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
-            if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
-                Delete(itCopy->first);
+        for (int n = 0; n < (int)vInfo.size(); n++) {
+            if (vInfo[n].nRandomPos != -1 && vInfo[n].fInTried == false && vInfo[n].nRefCount == 0) {
+                Delete(n);
                 nLostUnk++;
-            } else {
-                it++;
             }
         }
         if (nLost + nLostUnk > 0) {
@@ -442,19 +547,13 @@ public:
     void Clear()
     {
         std::vector<int>().swap(vRandom);
+        std::vector<CAddrInfo>().swap(vInfo);
+        std::vector<int>().swap(vFreeIds);
+        mapAddr.clear();
         nKey = GetRandHash();
-        for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
-            for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
-                vvNew[bucket][entry] = -1;
-            }
-        }
-        for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
-            for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
-                vvTried[bucket][entry] = -1;
-            }
-        }
+        vvNew.Clear();
+        vvTried.Clear();
 
-        nIdCount = 0;
         nTried = 0;
         nNew = 0;
     }
@@ -6,6 +6,8 @@
 #include "alert.h"
 
 #include "clientversion.h"
+#include "hash.h"
+#include "mruset.h"
 #include "net.h"
 #include "pubkey.h"
 #include "timedata.h"
@@ -26,6 +28,12 @@ using namespace std;
 map<uint256, CAlert> mapAlerts;
 CCriticalSection cs_mapAlerts;
 
+namespace {
+    CCriticalSection cs_alertSignatures;
+    mruset<uint256> setValidAlertSignatures(ALERT_SIGNATURE_CACHE_SIZE);
+    mruset<uint256> setInvalidAlertSignatures(ALERT_SIGNATURE_CACHE_SIZE);
+}
+
 void CUnsignedAlert::SetNull()
 {
     nVersion = 1;
@@ -148,8 +156,24 @@ bool CAlert::RelayTo(CNode* pnode) const
 
 bool CAlert::CheckSignature(const std::vector<unsigned char>& alertKey) const
 {
-    CPubKey key(alertKey);
-    if (!key.Verify(Hash(vchMsg.begin(), vchMsg.end()), vchSig))
+    // Every peer relays the same alerts to us, the signature is only verified the first time
+    uint256 hashSignature = (CHashWriter(SER_GETHASH, 0) << alertKey << vchMsg << vchSig).GetHash();
+    bool fCached, fValid;
+    {
+        LOCK(cs_alertSignatures);
+        fValid = setValidAlertSignatures.count(hashSignature) != 0;
+        fCached = fValid || setInvalidAlertSignatures.count(hashSignature) != 0;
+    }
+    if (!fCached) {
+        CPubKey key(alertKey);
+        fValid = key.Verify(Hash(vchMsg.begin(), vchMsg.end()), vchSig);
+        LOCK(cs_alertSignatures);
+        if (fValid)
+            setValidAlertSignatures.insert(hashSignature);
+        else
+            setInvalidAlertSignatures.insert(hashSignature);
+    }
+    if (!fValid)
         return error("CAlert::CheckSignature(): verify signature failed");
 
     // Now unserialize the data
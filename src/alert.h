@@ -21,6 +21,9 @@ class uint256;
 extern std::map<uint256, CAlert> mapAlerts;
 extern CCriticalSection cs_mapAlerts;
 
+/** The number of alert signatures remembered as valid, and as invalid, so that relayed copies aren't verified again */
+static const size_t ALERT_SIGNATURE_CACHE_SIZE = 1000;
+
 /** Alerts are for notifying old versions if they become too obsolete and
  * need to upgrade.  The message is displayed in the status bar.
  * Alert messages are broadcast as a vector of signed data.  Unserializing may
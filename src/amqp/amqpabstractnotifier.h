@@ -9,6 +9,7 @@
 
 class CBlockIndex;
 class AMQPAbstractNotifier;
+enum class MemPoolRemovalReason;
 
 typedef AMQPAbstractNotifier* (*AMQPNotifierFactory)();
 
@@ -34,6 +35,10 @@ public:
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    virtual bool NotifyBlockConnect(const CBlockIndex *pindex);
+    virtual bool NotifyBlockDisconnect(const CBlockIndex *pindex);
+    virtual bool NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence);
+    virtual bool NotifyTransactionRemoval(const CTransaction &transaction, MemPoolRemovalReason reason, uint64_t nMempoolSequence);
 
 protected:
     std::string type;
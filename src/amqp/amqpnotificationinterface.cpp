@@ -49,6 +49,7 @@ AMQPNotificationInterface* AMQPNotificationInterface::CreateWithArguments(const
     factories["pubhashtx"] = AMQPAbstractNotifier::Create<AMQPPublishHashTransactionNotifier>;
     factories["pubrawblock"] = AMQPAbstractNotifier::Create<AMQPPublishRawBlockNotifier>;
     factories["pubrawtx"] = AMQPAbstractNotifier::Create<AMQPPublishRawTransactionNotifier>;
+    factories["pubsequence"] = AMQPAbstractNotifier::Create<AMQPPublishSequenceNotifier>;
 
     for (std::map<std::string, AMQPNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i) {
         std::map<std::string, std::string>::const_iterator j = args.find("-amqp" + i->first);
@@ -134,3 +135,38 @@ void AMQPNotificationInterface::SyncTransaction(const CTransaction &tx, const CB
         }
     }
 }
+
+template <typename Function>
+void AMQPNotificationInterface::NotifyAll(const Function& notify)
+{
+    for (std::list<AMQPAbstractNotifier*>::iterator i = notifiers.begin(); i != notifiers.end(); ) {
+        AMQPAbstractNotifier *notifier = *i;
+        if (notify(notifier)) {
+            i++;
+        } else {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
+void AMQPNotificationInterface::ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added)
+{
+    NotifyAll([pindex, added](AMQPAbstractNotifier* notifier) {
+        return added ? notifier->NotifyBlockConnect(pindex) : notifier->NotifyBlockDisconnect(pindex);
+    });
+}
+
+void AMQPNotificationInterface::TransactionAddedToMempool(const CTransaction &tx, uint64_t nMempoolSequence)
+{
+    NotifyAll([&tx, nMempoolSequence](AMQPAbstractNotifier* notifier) {
+        return notifier->NotifyTransactionAcceptance(tx, nMempoolSequence);
+    });
+}
+
+void AMQPNotificationInterface::TransactionRemovedFromMempool(const CTransaction &tx, MemPoolRemovalReason reason, uint64_t nMempoolSequence)
+{
+    NotifyAll([&tx, reason, nMempoolSequence](AMQPAbstractNotifier* notifier) {
+        return notifier->NotifyTransactionRemoval(tx, reason, nMempoolSequence);
+    });
+}
@@ -26,11 +26,18 @@ protected:
     // CValidationInterface
     void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
     void UpdatedBlockTip(const CBlockIndex *pindex);
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added);
+    void TransactionAddedToMempool(const CTransaction &tx, uint64_t nMempoolSequence);
+    void TransactionRemovedFromMempool(const CTransaction &tx, MemPoolRemovalReason reason, uint64_t nMempoolSequence);
 
 private:
     AMQPNotificationInterface();
 
     std::list<AMQPAbstractNotifier*> notifiers;
+
+    //! Call notify on each notifier, shutting down and dropping the ones it fails for
+    template <typename Function>
+    void NotifyAll(const Function& notify);
 };
 
 #endif // ZCASH_AMQP_AMQPNOTIFICATIONINTERFACE_H
@@ -4,6 +4,7 @@
 
 #include "amqppublishnotifier.h"
 #include "main.h"
+#include "txmempool.h"
 #include "util.h"
 
 #include "amqpsender.h"
@@ -17,6 +18,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_SEQUENCE  = "sequence";
 
 // Invoke this method from a new thread to run the proton container event loop.
 void AMQPAbstractPublishNotifier::SpawnProtonContainer()
@@ -104,7 +106,12 @@ bool AMQPAbstractPublishNotifier::SendMessage(const char *command, const void* d
         message.subject(std::string(command));
         proton::message::property_map & props = message.properties();
         props.put("x-opt-sequence-number", sequence_);
-        handler_->publish(message);
+        if (!handler_->publish(message)) {
+            // The consumers see the gap in the sequence numbers, the notifier carries on
+            const uint64_t nDropped = handler_->dropped();
+            if ((nDropped & (nDropped - 1)) == 0)
+                LogPrintf("amqp: %s is %u messages behind, %u messages dropped\n", address, AMQP_MAX_QUEUED_MESSAGES, nDropped);
+        }
 
     } catch (proton::error_condition &e) {
         LogPrint("amqp", "amqp: error : %s\n", e.what());
@@ -152,17 +159,15 @@ bool AMQPPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("amqp", "amqp: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex)) {
-            LogPrint("amqp", "amqp: Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+    // Read without cs_main, which validation may hold waiting for the notifications
+    // queued, and through the cache the peers asking for a new tip read it from
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pindex);
+    if (!pblock) {
+        LogPrint("amqp", "amqp: Can't read block from disk");
+        return false;
     }
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *pblock;
 
     return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
 }
@@ -175,3 +180,39 @@ bool AMQPPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+bool AMQPPublishSequenceNotifier::SendSequence(const uint256& hash, char label, const uint64_t* pnMempoolSequence, const char* pszReason)
+{
+    LogPrint("amqp", "amqp: Publish sequence %s %c\n", hash.GetHex(), label);
+    std::vector<unsigned char> data(hash.begin(), hash.end());
+    std::reverse(data.begin(), data.end());
+    data.push_back(label);
+    if (pnMempoolSequence) {
+        unsigned char seq[sizeof(uint64_t)];
+        WriteLE64(seq, *pnMempoolSequence);
+        data.insert(data.end(), seq, seq + sizeof(seq));
+    }
+    if (pszReason)
+        data.insert(data.end(), pszReason, pszReason + strlen(pszReason));
+    return SendMessage(MSG_SEQUENCE, data.data(), data.size());
+}
+
+bool AMQPPublishSequenceNotifier::NotifyBlockConnect(const CBlockIndex *pindex)
+{
+    return SendSequence(pindex->GetBlockHash(), 'C');
+}
+
+bool AMQPPublishSequenceNotifier::NotifyBlockDisconnect(const CBlockIndex *pindex)
+{
+    return SendSequence(pindex->GetBlockHash(), 'D');
+}
+
+bool AMQPPublishSequenceNotifier::NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence)
+{
+    return SendSequence(transaction.GetHash(), 'A', &nMempoolSequence);
+}
+
+bool AMQPPublishSequenceNotifier::NotifyTransactionRemoval(const CTransaction &transaction, MemPoolRemovalReason reason, uint64_t nMempoolSequence)
+{
+    return SendSequence(transaction.GetHash(), 'R', &nMempoolSequence, MemPoolRemovalReasonName(reason));
+}
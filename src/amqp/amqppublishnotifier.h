@@ -53,4 +53,21 @@ public:
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
+/**
+ * Publishes each change of the active chain and of the mempool, in the order they happen,
+ * as the ZMQ sequence topic does: the reversed hash, a label 'C', 'D', 'A' or 'R', then for
+ * 'A' and 'R' the mempool sequence number, 8 bytes little endian, and for 'R' the reason.
+ */
+class AMQPPublishSequenceNotifier : public AMQPAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnect(const CBlockIndex *pindex);
+    bool NotifyBlockDisconnect(const CBlockIndex *pindex);
+    bool NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence);
+    bool NotifyTransactionRemoval(const CTransaction &transaction, MemPoolRemovalReason reason, uint64_t nMempoolSequence);
+
+private:
+    bool SendSequence(const uint256& hash, char label, const uint64_t* pnMempoolSequence = nullptr, const char* pszReason = nullptr);
+};
+
 #endif // ZCASH_AMQP_AMQPPUBLISHNOTIFIER_H
@@ -12,6 +12,9 @@
 #include <future>
 #include <iostream>
 
+//! Messages waiting for credit from the remote end, beyond which the new ones are dropped
+static const size_t AMQP_MAX_QUEUED_MESSAGES = 100000;
+
 class AMQPSender : public proton::messaging_handler {
   private:
     std::deque<proton::message> messages_; 
@@ -20,6 +23,7 @@ class AMQPSender : public proton::messaging_handler {
     proton::sender sender_;
     std::mutex lock_;
     std::atomic<bool> terminated_ = {false};
+    std::atomic<uint64_t> dropped_ = {0};
 
   public:
 
@@ -38,16 +42,27 @@ class AMQPSender : public proton::messaging_handler {
         dispatch();
     }
 
-    // Publish message by adding to queue and trying to dispatch it
-    void publish(const proton::message &m) {
-        add_message(m);
+    // Publish message by adding to queue and trying to dispatch it, false if it was dropped
+    bool publish(const proton::message &m) {
+        bool queued = add_message(m);
         dispatch();
+        return queued;
     }
 
-    // Add message to queue
-    void add_message(const proton::message &m) {
+    // Add message to queue, unless the remote end is AMQP_MAX_QUEUED_MESSAGES behind
+    bool add_message(const proton::message &m) {
         std::lock_guard<std::mutex> guard(lock_);
+        if (messages_.size() >= AMQP_MAX_QUEUED_MESSAGES) {
+            dropped_++;
+            return false;
+        }
         messages_.push_back(m);
+        return true;
+    }
+
+    // Messages dropped as the queue was full
+    uint64_t dropped() const {
+        return dropped_.load();
     }
 
     // Send messages in queue
@@ -39,7 +39,7 @@ AsyncRPCOperation::AsyncRPCOperation(const AsyncRPCOperation& o) :
         id_(o.id_), creation_time_(o.creation_time_), state_(o.state_.load()),
         start_time_(o.start_time_), end_time_(o.end_time_),
         error_code_(o.error_code_), error_message_(o.error_message_),
-        result_(o.result_)
+        result_(o.result_), phase_secs_(o.phase_secs_)
 {
 }
 
@@ -52,6 +52,7 @@ AsyncRPCOperation& AsyncRPCOperation::operator=( const AsyncRPCOperation& other
     this->error_code_ = other.error_code_;
     this->error_message_ = other.error_message_;
     this->result_ = other.result_;
+    this->phase_secs_ = other.phase_secs_;
     return *this;
 }
 
@@ -169,6 +170,15 @@ UniValue AsyncRPCOperation::getStatus() const {
         obj.pushKV("execution_secs", elapsed_seconds.count());
 
     }
+    // The time spent in each phase, while the operation runs as well
+    std::map<std::string, double> phases = getPhaseTimes();
+    if (!phases.empty()) {
+        UniValue phaseObj(UniValue::VOBJ);
+        for (const std::pair<std::string, double>& phase : phases) {
+            phaseObj.pushKV(phase.first, phase.second);
+        }
+        obj.pushKV("phase_secs", phaseObj);
+    }
     return obj;
 }
 
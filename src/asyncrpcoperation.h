@@ -101,6 +101,12 @@ public:
         return OperationStatus::SUCCESS == getState();
     }
 
+    // Seconds spent so far in each phase of main() timed by a PhaseTimer
+    std::map<std::string, double> getPhaseTimes() const {
+        std::lock_guard<std::mutex> guard(lock_);
+        return phase_secs_;
+    }
+
 protected:
     // The state_ is atomic because only it can be mutated externally.
     // For example, the user initiates a shut down of the application, which closes
@@ -115,6 +121,24 @@ protected:
     std::string error_message_;
     std::atomic<OperationStatus> state_;
     std::chrono::time_point<std::chrono::system_clock> start_time_, end_time_;  
+    std::map<std::string, double> phase_secs_;
+
+    // Counts the time until the end of its scope as spent in a phase of main(), such as
+    // "proof", adding it to the time of the other scopes of the same phase
+    class PhaseTimer {
+    public:
+        PhaseTimer(AsyncRPCOperation& operation, const std::string& phase) :
+            operation_(operation), phase_(phase), start_(std::chrono::steady_clock::now()) {}
+        ~PhaseTimer() {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+            std::lock_guard<std::mutex> guard(operation_.lock_);
+            operation_.phase_secs_[phase_] += elapsed.count();
+        }
+    private:
+        AsyncRPCOperation& operation_;
+        std::string phase_;
+        std::chrono::steady_clock::time_point start_;
+    };
 
     void start_execution_clock();
     void stop_execution_clock();
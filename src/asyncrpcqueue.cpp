@@ -15,7 +15,19 @@ shared_ptr<AsyncRPCQueue> AsyncRPCQueue::sharedInstance() {
     return q;
 }
 
-AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false) {
+AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false), max_retained_(DEFAULT_ASYNC_RPC_RETAINED_OPERATIONS) {
+}
+
+/**
+ * Return true if no operation is queued, of any priority. Call with lock_ held.
+ */
+static bool queues_empty(const std::queue<AsyncRPCOperationId>* queues) {
+    for (size_t i = 0; i < (size_t)OperationPriority::COUNT; i++) {
+        if (!queues[i].empty()) {
+            return false;
+        }
+    }
+    return true;
 }
 
 AsyncRPCQueue::~AsyncRPCQueue() {
@@ -32,26 +44,32 @@ void AsyncRPCQueue::run(size_t workerId) {
         std::shared_ptr<AsyncRPCOperation> operation;
         {
             std::unique_lock<std::mutex> guard(lock_);
-            while (operation_id_queue_.empty() && !isClosed() && !isFinishing()) {
+            while (queues_empty(operation_id_queue_) && !isClosed() && !isFinishing()) {
                 this->condition_.wait(guard);
             }
 
             // Exit if the queue is empty and we are finishing up
-            if (isFinishing() && operation_id_queue_.empty()) {
+            if (isFinishing() && queues_empty(operation_id_queue_)) {
                 break;
             }
 
             // Exit if the queue is closing.
             if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
+                for (std::queue<AsyncRPCOperationId>& queue : operation_id_queue_) {
+                    while (!queue.empty()) {
+                        queue.pop();
+                    }
                 }
                 break;
             }
 
-            // Get operation id
-            key = operation_id_queue_.front();
-            operation_id_queue_.pop();
+            // Get the id of the first operation of the highest priority
+            std::queue<AsyncRPCOperationId>* queue = operation_id_queue_;
+            while (queue->empty()) {
+                queue++;
+            }
+            key = queue->front();
+            queue->pop();
 
             // Search operation map
             AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
@@ -67,6 +85,22 @@ void AsyncRPCQueue::run(size_t workerId) {
         } else {
             operation->main();
         }
+
+        if (operation) {
+            std::lock_guard<std::mutex> guard(lock_);
+            finished_ids_.push_back(key);
+            drop_oldest_finished();
+        }
+    }
+}
+
+/**
+ * Drop the finished operations which finished first, beyond max_retained_. Call with lock_ held.
+ */
+void AsyncRPCQueue::drop_oldest_finished() {
+    while (finished_ids_.size() > max_retained_) {
+        operation_map_.erase(finished_ids_.front());
+        finished_ids_.pop_front();
     }
 }
 
@@ -81,7 +115,7 @@ void AsyncRPCQueue::run(size_t workerId) {
  *
  * Don't use std::make_shared<AsyncRPCOperation>().
  */
-void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation) {
+void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation, OperationPriority priority) {
     std::lock_guard<std::mutex> guard(lock_);
 
     // Don't add if queue is closed or finishing
@@ -91,7 +125,7 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
 
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
+    operation_id_queue_[(size_t)priority].push(id);
     this->condition_.notify_one();
 }
 
@@ -168,7 +202,40 @@ void AsyncRPCQueue::cancelAllOperations() {
  */
 size_t AsyncRPCQueue::getOperationCount() const {
     std::lock_guard<std::mutex> guard(lock_);
-    return operation_id_queue_.size();
+    size_t count = 0;
+    for (const std::queue<AsyncRPCOperationId>& queue : operation_id_queue_) {
+        count += queue.size();
+    }
+    return count;
+}
+
+/**
+ * Return the number of operations of a priority in the queue
+ */
+size_t AsyncRPCQueue::getOperationCount(OperationPriority priority) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return operation_id_queue_[(size_t)priority].size();
+}
+
+/**
+ * Set how many finished operations are kept for their results, dropping the oldest beyond
+ */
+void AsyncRPCQueue::setMaxRetainedOperations(size_t n) {
+    std::lock_guard<std::mutex> guard(lock_);
+    max_retained_ = n;
+    drop_oldest_finished();
+}
+
+/**
+ * Return the number of finished operations kept, not popped yet
+ */
+size_t AsyncRPCQueue::getRetainedOperationCount() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    size_t count = 0;
+    for (const AsyncRPCOperationId& id : finished_ids_) {
+        count += operation_map_.count(id);
+    }
+    return count;
 }
 
 /**
@@ -10,6 +10,7 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <deque>
 #include <queue>
 #include <unordered_map>
 #include <vector>
@@ -21,6 +22,17 @@
 
 typedef std::unordered_map<AsyncRPCOperationId, std::shared_ptr<AsyncRPCOperation> > AsyncRPCOperationMap; 
 
+// The operations queued are started in the order of their priority, then of their arrival
+typedef enum class operationPriorityEnum {
+    HIGH = 0,       // payments someone waits for
+    NORMAL,
+    LOW,            // bulk operations, such as sweeping coinbase utxos
+    COUNT
+} OperationPriority;
+
+// -rpcasyncretain default, finished operations kept for z_getoperationresult before the oldest are dropped
+static const size_t DEFAULT_ASYNC_RPC_RETAINED_OPERATIONS = 1000;
+
 
 class AsyncRPCQueue {
 public:
@@ -45,15 +57,21 @@ public:
     void finishAndWait(); // block thread until existing operations have finished, threads terminated
     void cancelAllOperations(); // mark all operations in the queue as cancelled
     size_t getOperationCount() const;
+    size_t getOperationCount(OperationPriority priority) const;
+    // Keep at most n finished operations, dropping the ones which finished first
+    void setMaxRetainedOperations(size_t n);
+    size_t getRetainedOperationCount() const;
     std::shared_ptr<AsyncRPCOperation> getOperationForId(AsyncRPCOperationId) const;
     std::shared_ptr<AsyncRPCOperation> popOperationForId(AsyncRPCOperationId);
-    void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
+    void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation,
+                      OperationPriority priority = OperationPriority::NORMAL);
     std::vector<AsyncRPCOperationId> getAllOperationIds() const;
 
 private:
     // addWorker() will spawn a new thread on run())
     void run(size_t workerId);
     void wait_for_worker_threads();
+    void drop_oldest_finished();
 
     // Why this is not a recursive lock: http://www.zaval.org/resources/library/butenhof1.html
     mutable std::mutex lock_;
@@ -61,7 +79,10 @@ private:
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    std::queue <AsyncRPCOperationId> operation_id_queue_[(size_t)OperationPriority::COUNT];
+    // Ids of the operations finished, the first to finish first; some may have been popped already
+    std::deque<AsyncRPCOperationId> finished_ids_;
+    size_t max_retained_;
     std::vector<std::thread> workers_;
 };
 
@@ -5,14 +5,17 @@
 #include "base58.h"
 
 #include "hash.h"
+#include "sync.h"
 #include "uint256.h"
 
 #include "version.h"
 #include "streams.h"
 
 #include <assert.h>
+#include <list>
 #include <stdint.h>
 #include <string.h>
+#include <unordered_map>
 #include <vector>
 #include <string>
 #include <boost/variant/apply_visitor.hpp>
@@ -20,6 +23,28 @@
 
 /** All alphanumeric characters except for "0", "I", "O", and "l" */
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+static const int8_t mapBase58[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6,  7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15, 16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29, 30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39, 40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54, 55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+// The conversions work on limbs of 5 base58 digits or of 4 bytes, so that each step of
+// the quadratic multiply and add handles as many digits as fit in 64 bits at once
+static const uint32_t BASE58_LIMB = 58 * 58 * 58 * 58 * 58;
 
 bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
 {
@@ -32,38 +57,51 @@ bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
         zeroes++;
         psz++;
     }
-    // Allocate enough space in big-endian base256 representation.
-    std::vector<unsigned char> b256(strlen(psz) * 733 / 1000 + 1); // log(58) / log(256), rounded up.
-    // Process the characters.
+    // Allocate enough space in little-endian 32 bits limbs for the base256 representation.
+    std::vector<uint32_t> limbs((strlen(psz) * 733 / 1000 + 1) / 4 + 1); // log(58) / log(256), rounded up.
+    size_t nLimbs = 0;
+    // Process the characters, up to 5 at once.
     while (*psz && !isspace(*psz)) {
-        // Decode base58 character
-        const char* ch = strchr(pszBase58, *psz);
-        if (ch == NULL)
-            return false;
-        // Apply "b256 = b256 * 58 + ch".
-        int carry = ch - pszBase58;
-        for (std::vector<unsigned char>::reverse_iterator it = b256.rbegin(); it != b256.rend(); it++) {
-            carry += 58 * (*it);
-            *it = carry % 256;
-            carry /= 256;
+        uint32_t nValue = 0;
+        uint32_t nMul = 1;
+        for (int i = 0; i < 5 && *psz && !isspace(*psz); i++, psz++) {
+            // Decode base58 character
+            const int8_t digit = mapBase58[(uint8_t)*psz];
+            if (digit < 0)
+                return false;
+            nValue = nValue * 58 + digit;
+            nMul *= 58;
+        }
+        // Apply "limbs = limbs * 58^n + value".
+        uint64_t carry = nValue;
+        for (size_t i = 0; i < nLimbs; i++) {
+            carry += (uint64_t)limbs[i] * nMul;
+            limbs[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            assert(nLimbs < limbs.size());
+            limbs[nLimbs++] = (uint32_t)carry;
         }
-        assert(carry == 0);
-        psz++;
     }
     // Skip trailing spaces.
     while (isspace(*psz))
         psz++;
     if (*psz != 0)
         return false;
-    // Skip leading zeroes in b256.
-    std::vector<unsigned char>::iterator it = b256.begin();
-    while (it != b256.end() && *it == 0)
-        it++;
-    // Copy result into output vector.
-    vch.reserve(zeroes + (b256.end() - it));
+    // Copy result into output vector, big-endian without the leading zeroes.
+    vch.reserve(zeroes + 4 * nLimbs);
     vch.assign(zeroes, 0x00);
-    while (it != b256.end())
-        vch.push_back(*(it++));
+    bool fLeading = true;
+    for (size_t i = nLimbs; i-- > 0; ) {
+        for (int nShift = 24; nShift >= 0; nShift -= 8) {
+            const unsigned char c = limbs[i] >> nShift;
+            if (fLeading && c == 0)
+                continue;
+            fLeading = false;
+            vch.push_back(c);
+        }
+    }
     return true;
 }
 
@@ -75,30 +113,49 @@ std::string EncodeBase58(const unsigned char* pbegin, const unsigned char* pend)
         pbegin++;
         zeroes++;
     }
-    // Allocate enough space in big-endian base58 representation.
-    std::vector<unsigned char> b58((pend - pbegin) * 138 / 100 + 1); // log(256) / log(58), rounded up.
-    // Process the bytes.
+    // Allocate enough space in little-endian limbs of 5 digits for the base58 representation.
+    std::vector<uint32_t> limbs(((pend - pbegin) * 138 / 100 + 1) / 5 + 1); // log(256) / log(58), rounded up.
+    size_t nLimbs = 0;
+    // Process the bytes, up to 4 at once.
     while (pbegin != pend) {
-        int carry = *pbegin;
-        // Apply "b58 = b58 * 256 + ch".
-        for (std::vector<unsigned char>::reverse_iterator it = b58.rbegin(); it != b58.rend(); it++) {
-            carry += 256 * (*it);
-            *it = carry % 58;
-            carry /= 58;
+        uint64_t nValue = 0;
+        uint64_t nMul = 1;
+        for (int i = 0; i < 4 && pbegin != pend; i++, pbegin++) {
+            nValue = (nValue << 8) | *pbegin;
+            nMul <<= 8;
+        }
+        // Apply "limbs = limbs * 256^n + value".
+        uint64_t carry = nValue;
+        for (size_t i = 0; i < nLimbs; i++) {
+            carry += limbs[i] * nMul;
+            limbs[i] = carry % BASE58_LIMB;
+            carry /= BASE58_LIMB;
+        }
+        while (carry != 0) {
+            assert(nLimbs < limbs.size());
+            limbs[nLimbs++] = carry % BASE58_LIMB;
+            carry /= BASE58_LIMB;
         }
-        assert(carry == 0);
-        pbegin++;
     }
-    // Skip leading zeroes in base58 result.
-    std::vector<unsigned char>::iterator it = b58.begin();
-    while (it != b58.end() && *it == 0)
-        it++;
-    // Translate the result into a string.
+    // Translate the result into a string, without the leading zeroes.
     std::string str;
-    str.reserve(zeroes + (b58.end() - it));
+    str.reserve(zeroes + 5 * nLimbs);
     str.assign(zeroes, '1');
-    while (it != b58.end())
-        str += pszBase58[*(it++)];
+    bool fLeading = true;
+    for (size_t i = nLimbs; i-- > 0; ) {
+        unsigned char digits[5];
+        uint32_t nLimb = limbs[i];
+        for (int j = 4; j >= 0; j--) {
+            digits[j] = nLimb % 58;
+            nLimb /= 58;
+        }
+        for (int j = 0; j < 5; j++) {
+            if (fLeading && digits[j] == 0)
+                continue;
+            fLeading = false;
+            str += pszBase58[digits[j]];
+        }
+    }
     return str;
 }
 
@@ -184,6 +241,57 @@ bool CBase58Data::SetString(const std::string& str, unsigned int nVersionBytes)
     return SetString(str.c_str(), nVersionBytes);
 }
 
+namespace {
+
+// The addresses decoded through SetStringCached, most recent first, with what they decode to
+CCriticalSection cs_base58Cache;
+std::list<std::pair<std::string, std::vector<unsigned char> > > lBase58Cache;
+std::unordered_map<std::string, std::list<std::pair<std::string, std::vector<unsigned char> > >::iterator> mapBase58Cache;
+
+} // anon namespace
+
+bool CBase58Data::SetStringCached(const char* psz, unsigned int nVersionBytes)
+{
+    const std::string str(psz);
+    std::vector<unsigned char> vchTemp;
+    bool fCached = false;
+    {
+        LOCK(cs_base58Cache);
+        auto it = mapBase58Cache.find(str);
+        if (it != mapBase58Cache.end()) {
+            lBase58Cache.splice(lBase58Cache.begin(), lBase58Cache, it->second);
+            vchTemp = it->second->second;
+            fCached = true;
+        }
+    }
+    if (!fCached) {
+        // Only the strings decoding are kept, the others not to evict them
+        if (!DecodeBase58Check(psz, vchTemp)) {
+            vchData.clear();
+            vchVersion.clear();
+            return false;
+        }
+        LOCK(cs_base58Cache);
+        if (mapBase58Cache.count(str) == 0) {
+            lBase58Cache.push_front(std::make_pair(str, vchTemp));
+            mapBase58Cache[str] = lBase58Cache.begin();
+            if (lBase58Cache.size() > BASE58_ADDRESS_CACHE_SIZE) {
+                mapBase58Cache.erase(lBase58Cache.back().first);
+                lBase58Cache.pop_back();
+            }
+        }
+    }
+
+    if (vchTemp.size() < nVersionBytes) {
+        vchData.clear();
+        vchVersion.clear();
+        return false;
+    }
+    vchVersion.assign(vchTemp.begin(), vchTemp.begin() + nVersionBytes);
+    vchData.assign(vchTemp.begin() + nVersionBytes, vchTemp.end());
+    return true;
+}
+
 std::string CBase58Data::ToString() const
 {
     std::vector<unsigned char> vch = vchVersion;
@@ -259,7 +367,7 @@ bool CBitcoinAddress::IsValid(const CChainParams& params) const
 
 bool CBitcoinAddress::SetString(const char* pszAddress)
 {
-    return CBase58Data::SetString(pszAddress, 2);
+    return CBase58Data::SetStringCached(pszAddress, 2);
 }
 
 bool CBitcoinAddress::SetString(const std::string& strAddress)
@@ -66,6 +66,9 @@ inline bool DecodeBase58Check(const char* psz, std::vector<unsigned char>& vchRe
  */
 inline bool DecodeBase58Check(const std::string& str, std::vector<unsigned char>& vchRet);
 
+//! The addresses kept decoded by CBase58Data::SetStringCached
+static const size_t BASE58_ADDRESS_CACHE_SIZE = 1024;
+
 /**
  * Base class for all base58-encoded data
  */
@@ -82,6 +85,8 @@ protected:
     CBase58Data();
     void SetData(const std::vector<unsigned char> &vchVersionIn, const void* pdata, size_t nSize);
     void SetData(const std::vector<unsigned char> &vchVersionIn, const unsigned char *pbegin, const unsigned char *pend);
+    //! SetString through an LRU of the strings decoded this way, so only for the public data, as addresses
+    bool SetStringCached(const char* psz, unsigned int nVersionBytes);
 
 public:
     bool SetString(const char* psz, unsigned int nVersionBytes);
@@ -114,7 +119,7 @@ protected:
 public:
     CZCPaymentAddress() {}
 
-    CZCPaymentAddress(const std::string& strAddress) { SetString(strAddress.c_str(), 2); }
+    CZCPaymentAddress(const std::string& strAddress) { SetStringCached(strAddress.c_str(), 2); }
     CZCPaymentAddress(const libzcash::PaymentAddress& addr) { Set(addr); }
 };
 
@@ -0,0 +1,170 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "tinyformat.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <regex>
+#include <vector>
+
+#include <sys/time.h>
+
+#include <univalue.h>
+
+using namespace benchmark;
+
+static double gettimedouble(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_usec * 0.000001 + tv.tv_sec;
+}
+
+State::State(std::string _name, double _maxElapsed) : name(_name), maxElapsed(_maxElapsed), count(0)
+{
+    minTime = std::numeric_limits<double>::max();
+    maxTime = 0;
+    beginTime = lastTime = 0;
+    countMask = 1;
+    countMaskInv = 1. / (countMask + 1);
+}
+
+bool State::KeepRunning()
+{
+    if (count & countMask) {
+        ++count;
+        return true;
+    }
+    double now;
+    if (count == 0) {
+        lastTime = beginTime = now = gettimedouble();
+    } else {
+        now = gettimedouble();
+        double elapsed = now - lastTime;
+        double elapsedOne = elapsed * countMaskInv;
+        if (elapsedOne < minTime) minTime = elapsedOne;
+        if (elapsedOne > maxTime) maxTime = elapsedOne;
+        if (elapsed * 128 < maxElapsed) {
+            // Much too fast a run (a 128th of maxElapsed): runs 8 times longer, and the
+            // timing restarts so as not to count the iterations of this code
+            countMask = ((countMask << 3) | 7) & ((1LL << 60) - 1);
+            countMaskInv = 1. / (countMask + 1);
+            count = 0;
+            minTime = std::numeric_limits<double>::max();
+            maxTime = 0;
+            return true;
+        }
+        if (elapsed * 16 < maxElapsed) {
+            uint64_t newCountMask = ((countMask << 1) | 1) & ((1LL << 60) - 1);
+            if ((count & newCountMask) == 0) {
+                countMask = newCountMask;
+                countMaskInv = 1. / (countMask + 1);
+            }
+        }
+    }
+    lastTime = now;
+    ++count;
+
+    if (now - beginTime < maxElapsed) return true; // Keep going
+
+    // The last iteration was not run
+    --count;
+    return false;
+}
+
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static std::map<std::string, BenchFunction> benchmarks_map;
+    return benchmarks_map;
+}
+
+BenchRunner::BenchRunner(std::string name, BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+namespace {
+
+/** The repetitions of a benchmark, sorted by the mean time of their iterations */
+struct BenchResult
+{
+    std::string name;
+    std::vector<State> vRuns;
+
+    const State& Median() const { return vRuns[vRuns.size() / 2]; }
+    //! Difference between the slowest and the fastest repetitions, relative to the median
+    double Spread() const
+    {
+        double dMedian = Median().GetAverage();
+        return dMedian > 0 ? (vRuns.back().GetAverage() - vRuns.front().GetAverage()) / dMedian : 0;
+    }
+};
+
+bool CompareAverage(const State& a, const State& b)
+{
+    return a.GetAverage() < b.GetAverage();
+}
+
+} // anon namespace
+
+bool BenchRunner::RunAll(const Options& options)
+{
+    std::regex reFilter;
+    try {
+        reFilter = std::regex(options.strFilter);
+    } catch (const std::regex_error& e) {
+        std::cerr << strprintf("Error: invalid -filter '%s': %s\n", options.strFilter, e.what());
+        return false;
+    }
+    const int nRepeat = std::max(1, options.nRepeat);
+
+    if (!options.fJSON)
+        std::cout << "#Benchmark,count,min,median,max,spread,fastest,slowest\n";
+    UniValue results(UniValue::VARR);
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it) {
+        if (!std::regex_match(it->first, reFilter))
+            continue;
+        BenchResult result;
+        result.name = it->first;
+        // The first repetition warms the caches and the lazily built state up, it isn't counted
+        for (int i = 0; i <= nRepeat; i++) {
+            State state(it->first, options.dMaxElapsed);
+            it->second(state);
+            if (i > 0)
+                result.vRuns.push_back(state);
+        }
+        std::sort(result.vRuns.begin(), result.vRuns.end(), CompareAverage);
+
+        uint64_t nCount = 0;
+        double dFastest = std::numeric_limits<double>::max(), dSlowest = 0;
+        for (const State& state : result.vRuns) {
+            nCount += state.GetCount();
+            dFastest = std::min(dFastest, state.GetMin());
+            dSlowest = std::max(dSlowest, state.GetMax());
+        }
+        if (options.fJSON) {
+            UniValue obj(UniValue::VOBJ);
+            obj.pushKV("name", result.name);
+            obj.pushKV("repetitions", (int)result.vRuns.size());
+            obj.pushKV("iterations", nCount);
+            obj.pushKV("min", result.vRuns.front().GetAverage());
+            obj.pushKV("median", result.Median().GetAverage());
+            obj.pushKV("max", result.vRuns.back().GetAverage());
+            obj.pushKV("spread", result.Spread());
+            obj.pushKV("fastest", dFastest);
+            obj.pushKV("slowest", dSlowest);
+            results.push_back(obj);
+        } else {
+            std::cout << strprintf("%s,%d,%.9f,%.9f,%.9f,%.4f,%.9f,%.9f\n", result.name, nCount,
+                result.vRuns.front().GetAverage(), result.Median().GetAverage(), result.vRuns.back().GetAverage(),
+                result.Spread(), dFastest, dSlowest);
+        }
+    }
+    if (options.fJSON)
+        std::cout << results.write(2) << "\n";
+    return true;
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+// Simple micro-benchmark framework; API mostly matches a subset of the Google Benchmark
+// framework (see https://github.com/google/benchmark)
+// Why not use the Google Benchmark framework? Because adding Yet Another Dependency
+// (that uses cmake as its build system and has lots of features we don't need) isn't
+// worth it.
+
+/*
+ * Usage:
+
+static void CODE_TO_TIME(benchmark::State& state)
+{
+    ... do any setup needed...
+    while (state.KeepRunning()) {
+       ... do stuff you want to time...
+    }
+    ... do any cleanup needed...
+}
+
+BENCHMARK(CODE_TO_TIME);
+
+ */
+
+namespace benchmark {
+
+    /**
+     * The iterations of one repetition of a benchmark. KeepRunning reads the clock
+     * once for a run of iterations, doubling the run until one takes a good fraction
+     * of the time given, so that the clock costs the iterations nothing.
+     */
+    class State {
+        std::string name;
+        double maxElapsed;
+        double beginTime;
+        double lastTime, minTime, maxTime;
+        uint64_t count;
+        uint64_t countMask;
+        double countMaskInv;
+    public:
+        State(std::string _name, double _maxElapsed);
+
+        bool KeepRunning();
+
+        //! Iterations timed, and their seconds each: the mean, and the fastest and slowest runs
+        uint64_t GetCount() const { return count; }
+        double GetAverage() const { return count ? (lastTime - beginTime) / count : 0; }
+        double GetMin() const { return minTime; }
+        double GetMax() const { return maxTime; }
+    };
+
+    typedef boost::function<void(State&)> BenchFunction;
+
+    /** What BenchRunner::RunAll runs, and how it reports them */
+    struct Options {
+        //! Regular expression the names of the benchmarks run match
+        std::string strFilter;
+        //! Repetitions of each benchmark counted, after one to warm up
+        int nRepeat;
+        //! Seconds each repetition runs for
+        double dMaxElapsed;
+        bool fJSON;
+    };
+
+    class BenchRunner
+    {
+        typedef std::map<std::string, BenchFunction> BenchmarkMap;
+        static BenchmarkMap& benchmarks();
+
+    public:
+        BenchRunner(std::string name, BenchFunction func);
+
+        /**
+         * Run the benchmarks, each nRepeat times, and print for each one the mean time
+         * of an iteration in its fastest, median and slowest repetitions, as CSV or as
+         * a JSON array of objects.
+         */
+        static bool RunAll(const Options& options);
+    };
+}
+
+// BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCOIN_BENCH_BENCH_H
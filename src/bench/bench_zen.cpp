@@ -0,0 +1,57 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "zcash/JoinSplit.hpp"
+
+#include <iostream>
+
+CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
+CWallet* pwalletMain;
+ZCJoinSplit* pzcashParams;
+
+//! -repeat default
+static const int DEFAULT_BENCH_REPEAT = 5;
+//! -time default, in milliseconds
+static const int DEFAULT_BENCH_TIME = 1000;
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::cout << "Usage: bench_zen [options]\n\n"
+                  << "Run the micro-benchmarks, and print the mean time of an iteration in seconds, of their fastest,\n"
+                  << "median and slowest repetitions, with the spread of the repetitions from the median.\n"
+                  << HelpMessageGroup("Options:")
+                  << HelpMessageOpt("-filter=<regex>", "Run the benchmarks whose names match <regex> (default: all)")
+                  << HelpMessageOpt("-repeat=<n>", strprintf("Count <n> repetitions of each benchmark, after one to warm up (default: %d)", DEFAULT_BENCH_REPEAT))
+                  << HelpMessageOpt("-time=<n>", strprintf("Run each repetition for <n> milliseconds (default: %d)", DEFAULT_BENCH_TIME))
+                  << HelpMessageOpt("-json", "Print the results as a JSON array, for regression tracking (default: CSV)");
+        return 0;
+    }
+
+    assert(init_and_check_sodium() != -1);
+    SHA256AutoDetect();
+    ECC_Start();
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::MAIN);
+
+    benchmark::Options options;
+    options.strFilter = GetArg("-filter", ".*");
+    options.nRepeat = GetArg("-repeat", DEFAULT_BENCH_REPEAT);
+    options.dMaxElapsed = GetArg("-time", DEFAULT_BENCH_TIME) * 0.001;
+    options.fJSON = GetBoolArg("-json", false);
+    bool fOk = benchmark::BenchRunner::RunAll(options);
+
+    ECC_Stop();
+    return fOk ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "coins.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/script.h"
+
+#include <assert.h>
+#include <vector>
+
+//! Transactions with unspent outputs in the caches of the benchmarks
+static const unsigned int BENCH_COINS = 10000;
+
+static std::vector<uint256> FillCoins(CCoinsViewCache& cache)
+{
+    std::vector<uint256> vTxids;
+    for (unsigned int i = 0; i < BENCH_COINS; i++) {
+        uint256 txid = GetRandHash();
+        CCoinsModifier coins = cache.ModifyCoins(txid);
+        coins->vout.resize(2);
+        coins->vout[0].nValue = i + 1;
+        coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+        coins->vout[1] = coins->vout[0];
+        coins->nHeight = 1;
+        vTxids.push_back(txid);
+    }
+    return vTxids;
+}
+
+// Looking the coins of a cache up, as ConnectBlock and the mempool do for each input
+static void CCoinsViewCacheAccess(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    const std::vector<uint256> vTxids = FillCoins(cache);
+    size_t n = 0;
+    while (state.KeepRunning()) {
+        const CCoins* coins = cache.AccessCoins(vTxids[n]);
+        assert(coins);
+        n = (n + 1) % vTxids.size();
+    }
+}
+
+// Fetching coins into a cache from the cache below it, as the view of a block does from the tip
+static void CCoinsViewCacheFetch(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache cacheTip(&base);
+    const std::vector<uint256> vTxids = FillCoins(cacheTip);
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&cacheTip);
+        for (unsigned int i = 0; i < 100; i++)
+            cache.HaveCoins(vTxids[i]);
+    }
+}
+
+// Checking the inputs of a transaction spending ten coins, and adding up their value
+static void CCoinsViewCacheHaveInputs(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    const std::vector<uint256> vTxids = FillCoins(cache);
+    CMutableTransaction mtx;
+    for (unsigned int i = 0; i < 10; i++)
+        mtx.vin.push_back(CTxIn(COutPoint(vTxids[i * 997], i % 2)));
+    mtx.vout.push_back(CTxOut(1, CScript() << OP_TRUE));
+    const CTransaction tx(mtx);
+    while (state.KeepRunning()) {
+        bool fHave = cache.HaveInputs(tx);
+        assert(fHave);
+        cache.GetValueIn(tx);
+    }
+}
+
+BENCHMARK(CCoinsViewCacheAccess);
+BENCHMARK(CCoinsViewCacheFetch);
+BENCHMARK(CCoinsViewCacheHaveInputs);
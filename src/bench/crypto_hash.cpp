@@ -0,0 +1,55 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000 * 1000;
+
+static void SHA256(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(hash);
+}
+
+static void SHA256_32b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(in.data());
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning())
+        SHA256D64(in.data(), in.data(), 1024);
+}
+
+static void CHash256_BlockHeader(benchmark::State& state)
+{
+    // The hash of a block header, its Equihash solution included
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    uint256 hash;
+    while (state.KeepRunning())
+        CHash256().Write((const unsigned char*)&ss[0], ss.size()).Finalize(hash.begin());
+}
+
+BENCHMARK(SHA256);
+BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(CHash256_BlockHeader);
@@ -0,0 +1,21 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "pow.h"
+
+#include <assert.h>
+
+static void EquihashVerify(benchmark::State& state)
+{
+    // The solution of the genesis block of the main network
+    const CBlockHeader header = Params(CBaseChainParams::MAIN).GenesisBlock().GetBlockHeader();
+    assert(CheckEquihashSolution(&header, Params(CBaseChainParams::MAIN)));
+    while (state.KeepRunning())
+        CheckEquihashSolution(&header, Params(CBaseChainParams::MAIN));
+}
+
+BENCHMARK(EquihashVerify);
@@ -0,0 +1,75 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "primitives/transaction.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+
+#include "sodium.h"
+
+//! A shielded transaction with two JoinSplits of random data, with Groth or PHGR proofs
+static CTransaction JoinSplitTransaction(bool isGroth)
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = isGroth ? GROTH_TX_VERSION : PHGR_TX_VERSION;
+    mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    mtx.vout.push_back(CTxOut(100000, CScript() << OP_TRUE));
+    for (int js = 0; js < 2; js++) {
+        JSDescription jsdesc = JSDescription::getNewInstance(isGroth);
+        jsdesc.vpub_old = 100000;
+        jsdesc.anchor = GetRandHash();
+        jsdesc.nullifiers[0] = GetRandHash();
+        jsdesc.nullifiers[1] = GetRandHash();
+        jsdesc.ephemeralKey = GetRandHash();
+        jsdesc.randomSeed = GetRandHash();
+        randombytes_buf(jsdesc.ciphertexts[0].begin(), jsdesc.ciphertexts[0].size());
+        randombytes_buf(jsdesc.ciphertexts[1].begin(), jsdesc.ciphertexts[1].size());
+        if (isGroth) {
+            libzcash::GrothProof zkproof;
+            randombytes_buf(zkproof.begin(), zkproof.size());
+            jsdesc.proof = zkproof;
+        } else {
+            jsdesc.proof = libzcash::PHGRProof::random_invalid();
+        }
+        jsdesc.macs[0] = GetRandHash();
+        jsdesc.macs[1] = GetRandHash();
+        mtx.vjoinsplit.push_back(jsdesc);
+    }
+    randombytes_buf(mtx.joinSplitPubKey.begin(), mtx.joinSplitPubKey.size());
+    randombytes_buf(&mtx.joinSplitSig[0], mtx.joinSplitSig.size());
+    return CTransaction(mtx);
+}
+
+static void Serialize(benchmark::State& state, bool isGroth)
+{
+    const CTransaction tx = JoinSplitTransaction(isGroth);
+    while (state.KeepRunning()) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << tx;
+    }
+}
+
+static void Deserialize(benchmark::State& state, bool isGroth)
+{
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << JoinSplitTransaction(isGroth);
+    while (state.KeepRunning()) {
+        CDataStream ss(ssTx);
+        CTransaction tx;
+        ss >> tx;
+    }
+}
+
+static void JoinSplitGrothSerialize(benchmark::State& state) { Serialize(state, true); }
+static void JoinSplitGrothDeserialize(benchmark::State& state) { Deserialize(state, true); }
+static void JoinSplitPHGRSerialize(benchmark::State& state) { Serialize(state, false); }
+static void JoinSplitPHGRDeserialize(benchmark::State& state) { Deserialize(state, false); }
+
+BENCHMARK(JoinSplitGrothSerialize);
+BENCHMARK(JoinSplitGrothDeserialize);
+BENCHMARK(JoinSplitPHGRSerialize);
+BENCHMARK(JoinSplitPHGRDeserialize);
@@ -0,0 +1,53 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/script.h"
+#include "txmempool.h"
+
+#include <list>
+#include <vector>
+
+//! Transactions in the chains of the benchmark
+static const int BENCH_CHAIN_LENGTH = 25;
+
+//! Chains of transactions each spending the output of the one before it
+static std::vector<CTransaction> TransactionChains(int nChains)
+{
+    std::vector<CTransaction> vtx;
+    for (int c = 0; c < nChains; c++) {
+        uint256 hashPrev = GetRandHash();
+        CAmount nValue = 10 * COIN;
+        for (int i = 0; i < BENCH_CHAIN_LENGTH; i++) {
+            CMutableTransaction mtx;
+            mtx.vin.push_back(CTxIn(COutPoint(hashPrev, 0)));
+            nValue -= 1000;
+            mtx.vout.push_back(CTxOut(nValue, CScript() << OP_TRUE));
+            vtx.push_back(CTransaction(mtx));
+            hashPrev = vtx.back().GetHash();
+        }
+    }
+    return vtx;
+}
+
+// Adding chains of transactions to the mempool, with their ancestors and descendants
+// updated, and removing them as a block confirming them does
+static void MempoolAddRemove(benchmark::State& state)
+{
+    const std::vector<CTransaction> vtx = TransactionChains(4);
+    CTxMemPool pool(CFeeRate(1000));
+    while (state.KeepRunning()) {
+        for (const CTransaction& tx : vtx)
+            pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0.0, 1), false);
+        std::list<CTransaction> removed;
+        for (const CTransaction& tx : vtx)
+            pool.remove(tx, removed, false, MemPoolRemovalReason::BLOCK);
+    }
+}
+
+BENCHMARK(MempoolAddRemove);
@@ -0,0 +1,587 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "metrics.h"
+#include "net.h"
+#include "netbase.h"
+#include "primitives/transaction.h"
+#include "protocol.h"
+#include "random.h"
+#include "streams.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+#include "version.h"
+#include "zcash/JoinSplit.hpp"
+#include "zen/tlsmanager.h"
+
+#include <atomic>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include <univalue.h>
+
+CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
+CWallet* pwalletMain;
+ZCJoinSplit* pzcashParams;
+
+//! -peers default
+static const int DEFAULT_LOAD_PEERS = 100;
+//! -threads default
+static const int DEFAULT_LOAD_THREADS = 4;
+//! -duration default, in seconds
+static const int DEFAULT_LOAD_DURATION = 60;
+//! -interval default, in milliseconds
+static const int DEFAULT_LOAD_INTERVAL = 1000;
+//! -invs default
+static const int DEFAULT_LOAD_INVS = 10;
+//! Milliseconds a peer is given to complete the version handshake
+static const int LOAD_HANDSHAKE_TIMEOUT = 10000;
+
+namespace {
+
+std::atomic<uint64_t> nConnectFailures(0);
+std::atomic<uint64_t> nHandshakeFailures(0);
+std::atomic<uint64_t> nDisconnected(0);
+std::atomic<uint64_t> nMessagesSent(0);
+std::atomic<uint64_t> nMessagesReceived(0);
+std::atomic<uint64_t> nBytesSent(0);
+std::atomic<uint64_t> nBytesReceived(0);
+//! TCP connect, TLS handshake, and version handshake up to the verack of the node
+AtomicHistogram connectLatency;
+AtomicHistogram tlsLatency;
+AtomicHistogram versionLatency;
+//! Round trips through the message handler of the node
+AtomicHistogram pingLatency;
+AtomicHistogram getdataLatency;
+
+/** A connection to the node, and the messages it has in flight */
+struct Session
+{
+    CAddress addr;
+    bool fTLS;
+    SOCKET hSocket;
+    SSL* ssl;
+    //! The message being received
+    std::unique_ptr<CNetMessage> msg;
+    //! Bytes to send, from nSendPos, and the size of a TLS write to repeat
+    std::vector<char> vSend;
+    size_t nSendPos;
+    int nWriteRetry;
+    bool fVerack;
+    int64_t nVersionSent;
+    int64_t nNextRound;
+    //! Send times of the pings and getdata requests not answered yet
+    std::map<uint64_t, int64_t> mapPings;
+    std::map<uint256, int64_t> mapGetData;
+
+    Session(const CAddress& addrIn, bool fTLSIn) :
+        addr(addrIn), fTLS(fTLSIn), hSocket(INVALID_SOCKET), ssl(NULL), nSendPos(0),
+        nWriteRetry(0), fVerack(false), nVersionSent(0), nNextRound(0) {}
+
+    bool IsOpen() const { return hSocket != INVALID_SOCKET; }
+
+    void Close()
+    {
+        if (ssl) {
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+            ssl = NULL;
+        }
+        if (hSocket != INVALID_SOCKET)
+            CloseSocket(hSocket);
+    }
+};
+
+template<typename T>
+void Push(Session& s, const char* pszCommand, const T& payload)
+{
+    CSharedMessage msg = MakeSharedMessage(pszCommand, payload);
+    s.vSend.insert(s.vSend.end(), msg->begin(), msg->end());
+    nMessagesSent++;
+}
+
+void PushEmpty(Session& s, const char* pszCommand)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    BeginSharedMessage(ss, pszCommand);
+    CSharedMessage msg = EndSharedMessage(ss);
+    s.vSend.insert(s.vSend.end(), msg->begin(), msg->end());
+    nMessagesSent++;
+}
+
+void PushVersion(Session& s)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    BeginSharedMessage(ss, "version");
+    uint64_t nNonce = GetRand(std::numeric_limits<uint64_t>::max());
+    ss << PROTOCOL_VERSION << (uint64_t)NODE_NETWORK << GetTime() << s.addr << CAddress(CService("0.0.0.0", 0))
+       << nNonce << FormatSubVersion("p2pload", CLIENT_VERSION, std::vector<std::string>()) << 0 << true;
+    CSharedMessage msg = EndSharedMessage(ss);
+    s.vSend.insert(s.vSend.end(), msg->begin(), msg->end());
+    nMessagesSent++;
+    s.nVersionSent = GetTimeMicros();
+}
+
+//! A transaction spending a random outpoint, which the node keeps as an orphan or rejects
+CTransaction RandomTransaction()
+{
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0), CScript() << OP_TRUE));
+    mtx.vout.push_back(CTxOut(1000, CScript() << OP_TRUE));
+    return mtx;
+}
+
+//! The inv, getdata, tx and ping messages a peer sends each -interval
+void PushRound(Session& s, int nInvs, bool fTx)
+{
+    const int64_t nNow = GetTimeMicros();
+    std::vector<CInv> vInv;
+    for (int i = 0; i < nInvs; i++)
+        vInv.push_back(CInv(MSG_TX, GetRandHash()));
+    if (!vInv.empty())
+        Push(s, "inv", vInv);
+
+    const uint256 hash = GetRandHash();
+    Push(s, "getdata", std::vector<CInv>(1, CInv(MSG_TX, hash)));
+    s.mapGetData[hash] = nNow;
+
+    if (fTx)
+        Push(s, "tx", RandomTransaction());
+
+    uint64_t nNonce = GetRand(std::numeric_limits<uint64_t>::max());
+    Push(s, "ping", nNonce);
+    s.mapPings[nNonce] = nNow;
+}
+
+void ProcessMessage(Session& s, CNetMessage& msg)
+{
+    nMessagesReceived++;
+    const std::string strCommand = msg.hdr.GetCommand();
+    CDataStream& vRecv = msg.vRecv;
+    const int64_t nNow = GetTimeMicros();
+    try {
+        if (strCommand == "version") {
+            PushEmpty(s, "verack");
+        } else if (strCommand == "verack") {
+            if (!s.fVerack)
+                versionLatency.add(nNow - s.nVersionSent);
+            s.fVerack = true;
+        } else if (strCommand == "ping") {
+            uint64_t nNonce = 0;
+            vRecv >> nNonce;
+            Push(s, "pong", nNonce);
+        } else if (strCommand == "pong") {
+            uint64_t nNonce = 0;
+            vRecv >> nNonce;
+            std::map<uint64_t, int64_t>::iterator it = s.mapPings.find(nNonce);
+            if (it != s.mapPings.end()) {
+                pingLatency.add(nNow - it->second);
+                s.mapPings.erase(it);
+            }
+        } else if (strCommand == "notfound") {
+            std::vector<CInv> vInv;
+            vRecv >> vInv;
+            for (const CInv& inv : vInv) {
+                std::map<uint256, int64_t>::iterator it = s.mapGetData.find(inv.hash);
+                if (it != s.mapGetData.end()) {
+                    getdataLatency.add(nNow - it->second);
+                    s.mapGetData.erase(it);
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("p2pload: malformed %s from %s: %s\n", strCommand, s.addr.ToString(), e.what());
+    }
+}
+
+bool Receive(Session& s)
+{
+    char pchBuf[0x10000];
+    while (true) {
+        int nBytes;
+        if (s.ssl) {
+            nBytes = SSL_read(s.ssl, pchBuf, sizeof(pchBuf));
+            if (nBytes <= 0) {
+                int nErr = SSL_get_error(s.ssl, nBytes);
+                return nErr == SSL_ERROR_WANT_READ || nErr == SSL_ERROR_WANT_WRITE;
+            }
+        } else {
+            nBytes = recv(s.hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+            if (nBytes == 0)
+                return false;
+            if (nBytes < 0) {
+                int nErr = WSAGetLastError();
+                return nErr == WSAEWOULDBLOCK || nErr == WSAEMSGSIZE || nErr == WSAEINTR || nErr == WSAEINPROGRESS;
+            }
+        }
+        nBytesReceived += nBytes;
+
+        const char* pch = pchBuf;
+        while (nBytes > 0) {
+            if (!s.msg)
+                s.msg.reset(new CNetMessage(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION));
+            int nHandled = s.msg->in_data ? s.msg->readData(pch, nBytes) : s.msg->readHeader(pch, nBytes);
+            if (nHandled < 0)
+                return false;
+            pch += nHandled;
+            nBytes -= nHandled;
+            if (s.msg->complete()) {
+                s.msg->vRecv.resize(s.msg->hdr.nMessageSize);
+                ProcessMessage(s, *s.msg);
+                s.msg.reset();
+            }
+        }
+    }
+}
+
+bool Send(Session& s)
+{
+    while (s.nSendPos < s.vSend.size()) {
+        int nBytes;
+        if (s.ssl) {
+            // A TLS write which wants to be retried is retried with the same size
+            int nSize = s.nWriteRetry ? s.nWriteRetry : (int)std::min<size_t>(s.vSend.size() - s.nSendPos, 0x10000);
+            nBytes = SSL_write(s.ssl, &s.vSend[s.nSendPos], nSize);
+            if (nBytes <= 0) {
+                int nErr = SSL_get_error(s.ssl, nBytes);
+                if (nErr != SSL_ERROR_WANT_READ && nErr != SSL_ERROR_WANT_WRITE)
+                    return false;
+                s.nWriteRetry = nSize;
+                return true;
+            }
+            s.nWriteRetry = 0;
+        } else {
+            nBytes = send(s.hSocket, &s.vSend[s.nSendPos], s.vSend.size() - s.nSendPos, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (nBytes < 0) {
+                int nErr = WSAGetLastError();
+                return nErr == WSAEWOULDBLOCK || nErr == WSAEMSGSIZE || nErr == WSAEINTR || nErr == WSAEINPROGRESS;
+            }
+        }
+        s.nSendPos += nBytes;
+        nBytesSent += nBytes;
+    }
+    s.vSend.clear();
+    s.nSendPos = 0;
+    return true;
+}
+
+//! Send and receive what the sessions have ready, waiting up to nTimeout milliseconds
+void Poll(std::vector<Session*>& vSessions, int nTimeout)
+{
+    std::vector<struct pollfd> vFds;
+    std::vector<Session*> vPolled;
+    bool fPending = false;
+    for (Session* s : vSessions) {
+        if (!s->IsOpen())
+            continue;
+        struct pollfd fd;
+        fd.fd = s->hSocket;
+        fd.events = POLLIN | (s->vSend.empty() ? 0 : POLLOUT);
+        fd.revents = 0;
+        vFds.push_back(fd);
+        vPolled.push_back(s);
+        // TLS may hold decrypted bytes the socket has no more data for
+        if (s->ssl && SSL_pending(s->ssl) > 0)
+            fPending = true;
+    }
+    if (vFds.empty()) {
+        MilliSleep(nTimeout);
+        return;
+    }
+    if (poll(&vFds[0], vFds.size(), fPending ? 0 : nTimeout) < 0)
+        return;
+    for (size_t i = 0; i < vFds.size(); i++) {
+        Session& s = *vPolled[i];
+        bool fOk = true;
+        if (vFds[i].revents & (POLLIN | POLLERR | POLLHUP) || (s.ssl && SSL_pending(s.ssl) > 0))
+            fOk = Receive(s);
+        if (fOk && !s.vSend.empty())
+            fOk = Send(s);
+        if (!fOk) {
+            s.Close();
+            nDisconnected++;
+        }
+    }
+}
+
+//! Connect the session, over TLS if it is one, and exchange the version messages
+void Connect(Session& s, bool fResumeTLS)
+{
+    int64_t nStart = GetTimeMicros();
+    if (!ConnectSocket(s.addr, s.hSocket, DEFAULT_CONNECT_TIMEOUT)) {
+        nConnectFailures++;
+        return;
+    }
+    connectLatency.add(GetTimeMicros() - nStart);
+
+    if (s.fTLS) {
+        if (!fResumeTLS)
+            tlsmanager.forgetClientSession(s.addr);
+        nStart = GetTimeMicros();
+        unsigned long nErr = 0;
+        s.ssl = tlsmanager.connect(s.hSocket, s.addr, nErr);
+        if (!s.ssl) {
+            s.Close();
+            nConnectFailures++;
+            return;
+        }
+        SSL_set_mode(s.ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        tlsLatency.add(GetTimeMicros() - nStart);
+    }
+
+    PushVersion(s);
+    std::vector<Session*> vSessions(1, &s);
+    const int64_t nTimeout = GetTimeMillis() + LOAD_HANDSHAKE_TIMEOUT;
+    while (s.IsOpen() && !s.fVerack && GetTimeMillis() < nTimeout)
+        Poll(vSessions, 100);
+    if (s.IsOpen() && !s.fVerack) {
+        s.Close();
+        nDisconnected++;
+    }
+    if (!s.fVerack)
+        nHandshakeFailures++;
+}
+
+void ThreadConnect(std::vector<Session*> vSessions, bool fResumeTLS)
+{
+    for (Session* s : vSessions)
+        Connect(*s, fResumeTLS);
+}
+
+void ThreadLoad(std::vector<Session*> vSessions, int64_t nEnd, int nInterval, int nInvs, bool fTx)
+{
+    // The rounds of the peers are spread over the interval
+    const int64_t nNow = GetTimeMicros();
+    for (size_t i = 0; i < vSessions.size(); i++)
+        vSessions[i]->nNextRound = nNow + (int64_t)nInterval * 1000 * i / vSessions.size();
+
+    while (GetTimeMillis() < nEnd) {
+        const int64_t nTime = GetTimeMicros();
+        for (Session* s : vSessions) {
+            if (s->IsOpen() && s->fVerack && s->nNextRound <= nTime) {
+                PushRound(*s, nInvs, fTx);
+                s->nNextRound += (int64_t)nInterval * 1000;
+            }
+        }
+        Poll(vSessions, 10);
+    }
+}
+
+/** CPU time of the threads of a process, in clock ticks, in all of them and in the ones named strName */
+struct CPUTimes
+{
+    int64_t nTotal;
+    int64_t nNamed;
+};
+
+bool ReadCPUTimes(int nPid, const std::string& strName, CPUTimes& times)
+{
+    times.nTotal = times.nNamed = 0;
+    const std::string strTasks = strprintf("/proc/%d/task", nPid);
+    DIR* dir = opendir(strTasks.c_str());
+    if (!dir)
+        return false;
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.')
+            continue;
+        FILE* file = fopen((strTasks + "/" + entry->d_name + "/stat").c_str(), "r");
+        if (!file)
+            continue;
+        char buf[1024];
+        size_t nSize = fread(buf, 1, sizeof(buf) - 1, file);
+        fclose(file);
+        buf[nSize] = 0;
+        // pid (comm) state ppid ..., utime and stime the 14th and 15th fields
+        const std::string strStat(buf);
+        size_t nOpen = strStat.find('('), nClose = strStat.rfind(')');
+        if (nOpen == std::string::npos || nClose == std::string::npos)
+            continue;
+        const std::string strComm = strStat.substr(nOpen + 1, nClose - nOpen - 1);
+        std::vector<std::string> vFields;
+        boost::split(vFields, strStat.substr(nClose + 2), boost::is_any_of(" "));
+        if (vFields.size() < 13)
+            continue;
+        const int64_t nTicks = atoi64(vFields[11]) + atoi64(vFields[12]);
+        times.nTotal += nTicks;
+        if (strComm.find(strName) != std::string::npos)
+            times.nNamed += nTicks;
+    }
+    closedir(dir);
+    return true;
+}
+
+UniValue LatencyJSON(const AtomicHistogram& histogram)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("count", (uint64_t)histogram.getCount());
+    obj.pushKV("mean", histogram.mean());
+    obj.pushKV("p50", histogram.percentile(0.5));
+    obj.pushKV("p99", histogram.percentile(0.99));
+    obj.pushKV("max", histogram.getMax());
+    return obj;
+}
+
+} // anon namespace
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (argc < 2 || mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::cout << "Usage: zen-p2pload -connect=<host[:port]> [options]\n\n"
+                  << "Open peer connections to a node, over TLS and in plain, and send them inv, getdata, tx and\n"
+                  << "ping messages. Report the rate of the handshakes, the round trips of the messages through the\n"
+                  << "message handler of the node and, with -nodepid, the CPU time of the node and its handlers.\n"
+                  << "The node needs a -maxconnections above the peers opened, and treats them as inbound peers.\n"
+                  << HelpMessageGroup("Options:")
+                  << HelpMessageOpt("-connect=<host[:port]>", "The node to load")
+                  << HelpMessageOpt("-peers=<n>", strprintf("Connections made in plain (default: %d)", DEFAULT_LOAD_PEERS))
+                  << HelpMessageOpt("-tlspeers=<n>", "Connections made over TLS (default: 0)")
+                  << HelpMessageOpt("-tlsresume", "Resume the TLS sessions after the first handshake (default: 0)")
+                  << HelpMessageOpt("-threads=<n>", strprintf("Threads the connections are shared by (default: %d)", DEFAULT_LOAD_THREADS))
+                  << HelpMessageOpt("-duration=<n>", strprintf("Seconds the messages are sent for (default: %d)", DEFAULT_LOAD_DURATION))
+                  << HelpMessageOpt("-interval=<n>", strprintf("Milliseconds between the messages of each peer (default: %d)", DEFAULT_LOAD_INTERVAL))
+                  << HelpMessageOpt("-invs=<n>", strprintf("Transactions each inv announces (default: %d)", DEFAULT_LOAD_INVS))
+                  << HelpMessageOpt("-tx", "Send a transaction of a random input with each round (default: 1)")
+                  << HelpMessageOpt("-nodepid=<pid>", "Process of the node, on the same host, to measure the CPU time of")
+                  << HelpMessageOpt("-testnet", "Use the test network")
+                  << HelpMessageOpt("-regtest", "Use the regression test network")
+                  << HelpMessageOpt("-json", "Print the results as JSON");
+        return 0;
+    }
+
+    SetupEnvironment();
+    if (!SelectParamsFromCommandLine()) {
+        std::cerr << "Error: invalid combination of -regtest and -testnet." << std::endl;
+        return 1;
+    }
+    CService addrNode;
+    if (!Lookup(GetArg("-connect", "").c_str(), addrNode, Params().GetDefaultPort())) {
+        std::cerr << "Error: invalid -connect" << std::endl;
+        return 1;
+    }
+
+    const int nPeers = GetArg("-peers", DEFAULT_LOAD_PEERS);
+    const int nTLSPeers = GetArg("-tlspeers", 0);
+    const int nThreads = std::max<int>(1, GetArg("-threads", DEFAULT_LOAD_THREADS));
+    const int64_t nDuration = GetArg("-duration", DEFAULT_LOAD_DURATION);
+    const int nInterval = std::max<int>(1, GetArg("-interval", DEFAULT_LOAD_INTERVAL));
+    const int nInvs = GetArg("-invs", DEFAULT_LOAD_INVS);
+    const bool fTx = GetBoolArg("-tx", true);
+    const bool fResumeTLS = GetBoolArg("-tlsresume", false);
+
+    if (nTLSPeers > 0) {
+        // The credentials of the connections are made in a directory of their own
+        if (!mapArgs.count("-datadir")) {
+            boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("zen-p2pload-%%%%-%%%%");
+            boost::filesystem::create_directories(pathTemp);
+            mapArgs["-datadir"] = pathTemp.string();
+        }
+        if (!tlsmanager.prepareCredentials() || !tlsmanager.initialize()) {
+            std::cerr << "Error: TLS initialization failed" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::unique_ptr<Session>> vSessions;
+    for (int i = 0; i < nPeers + nTLSPeers; i++)
+        vSessions.emplace_back(new Session(CAddress(addrNode), i >= nPeers));
+    std::vector<std::vector<Session*>> vThreadSessions(nThreads);
+    for (size_t i = 0; i < vSessions.size(); i++)
+        vThreadSessions[i % nThreads].push_back(vSessions[i].get());
+
+    // The handshakes, each thread connecting its sessions one after the other
+    int64_t nStart = GetTimeMicros();
+    {
+        boost::thread_group threads;
+        for (int t = 0; t < nThreads; t++)
+            threads.create_thread(boost::bind(&ThreadConnect, vThreadSessions[t], fResumeTLS));
+        threads.join_all();
+    }
+    const double dConnectSeconds = (GetTimeMicros() - nStart) / 1000000.0;
+    size_t nConnected = 0;
+    for (const std::unique_ptr<Session>& s : vSessions)
+        nConnected += s->fVerack;
+
+    // The traffic
+    const int nPid = GetArg("-nodepid", 0);
+    CPUTimes cpuStart, cpuEnd;
+    bool fCPU = nPid > 0 && ReadCPUTimes(nPid, "msghand", cpuStart);
+    const uint64_t nSentBefore = nMessagesSent, nReceivedBefore = nMessagesReceived;
+    nStart = GetTimeMicros();
+    {
+        const int64_t nEnd = GetTimeMillis() + nDuration * 1000;
+        boost::thread_group threads;
+        for (int t = 0; t < nThreads; t++)
+            threads.create_thread(boost::bind(&ThreadLoad, vThreadSessions[t], nEnd, nInterval, nInvs, fTx));
+        threads.join_all();
+    }
+    const double dLoadSeconds = (GetTimeMicros() - nStart) / 1000000.0;
+    fCPU = fCPU && ReadCPUTimes(nPid, "msghand", cpuEnd);
+    for (const std::unique_ptr<Session>& s : vSessions)
+        s->Close();
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("peers", (uint64_t)vSessions.size());
+    result.pushKV("connected", (uint64_t)nConnected);
+    result.pushKV("connectfailures", (uint64_t)nConnectFailures);
+    result.pushKV("handshakefailures", (uint64_t)nHandshakeFailures);
+    result.pushKV("handshakespersecond", dConnectSeconds > 0 ? nConnected / dConnectSeconds : 0.0);
+    result.pushKV("disconnected", (uint64_t)nDisconnected);
+    result.pushKV("messagessent", (uint64_t)(nMessagesSent - nSentBefore));
+    result.pushKV("messagesreceived", (uint64_t)(nMessagesReceived - nReceivedBefore));
+    result.pushKV("messagespersecond", dLoadSeconds > 0 ? (nMessagesSent - nSentBefore) / dLoadSeconds : 0.0);
+    result.pushKV("bytessent", (uint64_t)nBytesSent);
+    result.pushKV("bytesreceived", (uint64_t)nBytesReceived);
+    UniValue latencies(UniValue::VOBJ);
+    latencies.pushKV("connect", LatencyJSON(connectLatency));
+    latencies.pushKV("tls", LatencyJSON(tlsLatency));
+    latencies.pushKV("version", LatencyJSON(versionLatency));
+    latencies.pushKV("ping", LatencyJSON(pingLatency));
+    latencies.pushKV("getdata", LatencyJSON(getdataLatency));
+    result.pushKV("latency", latencies);
+    if (fCPU) {
+        const double dTick = sysconf(_SC_CLK_TCK);
+        UniValue cpu(UniValue::VOBJ);
+        cpu.pushKV("node", (cpuEnd.nTotal - cpuStart.nTotal) / dTick / dLoadSeconds);
+        cpu.pushKV("msghand", (cpuEnd.nNamed - cpuStart.nNamed) / dTick / dLoadSeconds);
+        result.pushKV("cpu", cpu);
+    }
+
+    if (GetBoolArg("-json", false)) {
+        std::cout << result.write(2) << std::endl;
+        return 0;
+    }
+    std::cout << strprintf("Connected %u of %u peers in %.2f s: %.1f handshakes/s, %u failed to connect, %u to handshake\n",
+                           nConnected, vSessions.size(), dConnectSeconds, result["handshakespersecond"].get_real(),
+                           (uint64_t)nConnectFailures, (uint64_t)nHandshakeFailures);
+    std::cout << strprintf("Sent %u messages in %.2f s: %.1f messages/s, received %u, %u peers disconnected\n",
+                           result["messagessent"].get_int64(), dLoadSeconds, result["messagespersecond"].get_real(),
+                           result["messagesreceived"].get_int64(), (uint64_t)nDisconnected);
+    std::cout << "Latency in microseconds:        count        mean         p50         p99         max\n";
+    for (const std::string& strName : latencies.getKeys()) {
+        const UniValue& latency = latencies[strName];
+        std::cout << strprintf("  %-24s %11d %11d %11d %11d %11d\n", strName, latency["count"].get_int64(), latency["mean"].get_int64(),
+                               latency["p50"].get_int64(), latency["p99"].get_int64(), latency["max"].get_int64());
+    }
+    if (fCPU) {
+        std::cout << strprintf("Node CPU: %.2f cores, message handlers %.2f cores\n",
+                               result["cpu"]["node"].get_real(), result["cpu"]["msghand"].get_real());
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "key.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/sigcache.h"
+
+#include <assert.h>
+#include <vector>
+
+//! A signature of a random hash, by a new key
+static void SignRandomHash(CPubKey& pubkey, std::vector<unsigned char>& vchSig, uint256& hash)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    pubkey = key.GetPubKey();
+    hash = GetRandHash();
+    bool fSigned = key.Sign(hash, vchSig);
+    assert(fSigned);
+}
+
+// A signature checked before, as the scripts of a block are after the mempool accepted its transactions
+static void SigCacheHit(benchmark::State& state)
+{
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash;
+    SignRandomHash(pubkey, vchSig, hash);
+    const CachingTransactionSignatureChecker checker(NULL, 0, NULL, true);
+    bool fValid = checker.VerifySignature(vchSig, pubkey, hash);
+    assert(fValid);
+    while (state.KeepRunning())
+        checker.VerifySignature(vchSig, pubkey, hash);
+}
+
+// A signature not in the cache, looked up and then verified
+static void SigCacheMiss(benchmark::State& state)
+{
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash;
+    SignRandomHash(pubkey, vchSig, hash);
+    const CachingTransactionSignatureChecker checker(NULL, 0, NULL, false);
+    while (state.KeepRunning())
+        checker.VerifySignature(vchSig, pubkey, hash);
+}
+
+BENCHMARK(SigCacheHit);
+BENCHMARK(SigCacheMiss);
@@ -0,0 +1,50 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "tinyformat.h"
+
+#include <assert.h>
+
+#include <univalue.h>
+
+//! A reply of the size of a getblock with its transactions
+static UniValue BlockReply()
+{
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("hash", std::string(64, 'a'));
+    result.pushKV("height", 500000);
+    UniValue txs(UniValue::VARR);
+    for (int i = 0; i < 1000; i++) {
+        UniValue tx(UniValue::VOBJ);
+        tx.pushKV("txid", strprintf("%064x", i));
+        tx.pushKV("size", 250 + i);
+        tx.pushKV("fee", 0.0001);
+        tx.pushKV("coinbase", i == 0);
+        txs.push_back(tx);
+    }
+    result.pushKV("tx", txs);
+    return result;
+}
+
+static void UniValueWrite(benchmark::State& state)
+{
+    const UniValue reply = BlockReply();
+    while (state.KeepRunning())
+        reply.write();
+}
+
+static void UniValueRead(benchmark::State& state)
+{
+    const std::string strReply = BlockReply().write();
+    while (state.KeepRunning()) {
+        UniValue reply;
+        bool fRead = reply.read(strReply);
+        assert(fRead);
+    }
+}
+
+BENCHMARK(UniValueWrite);
+BENCHMARK(UniValueRead);
@@ -10,6 +10,9 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <stdio.h>
 
@@ -39,6 +42,8 @@ std::string HelpMessageCli()
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcclienttimeout=<n>", strprintf(_("Timeout in seconds during HTTP requests, or 0 for no timeout. (default: %d)"), DEFAULT_HTTP_CLIENT_TIMEOUT));
+    strUsage += HelpMessageOpt("-stdin", _("Read the commands from standard input, one per line with its parameters separated by spaces, "
+                                          "and send them all on one connection"));
 
     return strUsage;
 }
@@ -111,11 +116,13 @@ static bool AppInitRPC(int argc, char* argv[])
 /** Reply structure for request_done to fill in */
 struct HTTPReply
 {
-    HTTPReply(): status(0), error(-1) {}
+    HTTPReply(struct event_base* baseIn): status(0), error(-1), base(baseIn) {}
 
     int status;
     int error;
     std::string body;
+    //! The loop to leave once the reply is in, as a kept-alive connection keeps it busy
+    struct event_base* base;
 };
 
 const char *http_errorstring(int code)
@@ -143,6 +150,7 @@ const char *http_errorstring(int code)
 static void http_request_done(struct evhttp_request *req, void *ctx)
 {
     HTTPReply *reply = static_cast<HTTPReply*>(ctx);
+    event_base_loopbreak(reply->base);
 
     if (req == NULL) {
         /* If req is NULL, it means an error occurred while connecting: the
@@ -173,19 +181,42 @@ static void http_error_cb(enum evhttp_request_error err, void *ctx)
 }
 #endif
 
-UniValue CallRPC(const string& strMethod, const UniValue& params)
+/**
+ * The connection to the server, kept alive for the calls after the first, which are
+ * spared the TCP setup. A connection the server closed meanwhile is opened again.
+ */
+class CRPCConnection
 {
-    std::string host = GetArg("-rpcconnect", "127.0.0.1");
-    int port = GetArg("-rpcport", BaseParams().RPCPort());
+public:
+    CRPCConnection() :
+        host(GetArg("-rpcconnect", "127.0.0.1")), port(GetArg("-rpcport", BaseParams().RPCPort())), nId(0) {}
 
-    // Obtain event base
-    raii_event_base base = obtain_event_base();
+    UniValue Call(const string& strMethod, const UniValue& params);
+
+private:
+    std::string host;
+    int port;
+    std::string strRPCUserColonPass;
+    raii_event_base base;
+    raii_evhttp_connection evcon;
+    int nId;
+};
 
-    // Synchronously look up hostname
-    raii_evhttp_connection evcon = obtain_evhttp_connection_base(base.get(), host, port);
-    evhttp_connection_set_timeout(evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+UniValue CRPCConnection::Call(const string& strMethod, const UniValue& params)
+{
+    if (!evcon) {
+        // Obtain event base
+        base = obtain_event_base();
 
-    HTTPReply response;
+        // Synchronously look up hostname
+        evcon = obtain_evhttp_connection_base(base.get(), host, port);
+        evhttp_connection_set_timeout(evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+    } else {
+        // Notice a close of the server since the last call
+        event_base_loop(base.get(), EVLOOP_NONBLOCK);
+    }
+
+    HTTPReply response(base.get());
     raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
     if (req == NULL)
         throw runtime_error("create http request failed");
@@ -194,28 +225,29 @@ UniValue CallRPC(const string& strMethod, const UniValue& params)
 #endif
 
     // Get credentials
-    std::string strRPCUserColonPass;
-    if (mapArgs["-rpcpassword"] == "") {
-        // Try fall back to cookie-based authentication if no password is provided
-        if (!GetAuthCookie(&strRPCUserColonPass)) {
-            throw runtime_error(strprintf(
-                _("Could not locate RPC credentials. No authentication cookie could be found,\n"
-                  "and no rpcpassword is set in the configuration file (%s)."),
-                    GetConfigFile().string().c_str()));
+    if (strRPCUserColonPass.empty()) {
+        if (mapArgs["-rpcpassword"] == "") {
+            // Try fall back to cookie-based authentication if no password is provided
+            if (!GetAuthCookie(&strRPCUserColonPass)) {
+                throw runtime_error(strprintf(
+                    _("Could not locate RPC credentials. No authentication cookie could be found,\n"
+                      "and no rpcpassword is set in the configuration file (%s)."),
+                        GetConfigFile().string().c_str()));
 
+            }
+        } else {
+            strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
         }
-    } else {
-        strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
     }
 
     struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
     assert(output_headers);
     evhttp_add_header(output_headers, "Host", host.c_str());
-    evhttp_add_header(output_headers, "Connection", "close");
+    evhttp_add_header(output_headers, "Connection", "keep-alive");
     evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
 
     // Attach request data
-    std::string strRequest = JSONRPCRequest(strMethod, params, 1);
+    std::string strRequest = JSONRPCRequest(strMethod, params, ++nId);
     struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
     assert(output_buffer);
     evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
@@ -223,13 +255,17 @@ UniValue CallRPC(const string& strMethod, const UniValue& params)
     int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
     req.release(); // ownership moved to evcon in above call
     if (r != 0) {
+        evcon.reset();
         throw CConnectionFailed("send http request failed");
     }
 
     event_base_dispatch(base.get());
 
-    if (response.status == 0)
+    if (response.status == 0) {
+        // A connection which failed is not reused, -rpcwait keeps trying a new one
+        evcon.reset();
         throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
+    }
     else if (response.status == HTTP_UNAUTHORIZED)
         throw runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
     else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
@@ -248,31 +284,20 @@ UniValue CallRPC(const string& strMethod, const UniValue& params)
     return reply;
 }
 
-int CommandLineRPC(int argc, char *argv[])
+/** Execute a command and print its result, returning the exit code for it */
+static int ExecuteCommand(CRPCConnection& connection, const string& strMethod, const std::vector<std::string>& strParams)
 {
     string strPrint;
     int nRet = 0;
     try {
-        // Skip switches
-        while (argc > 1 && IsSwitchChar(argv[1][0])) {
-            argc--;
-            argv++;
-        }
-
-        // Method
-        if (argc < 2)
-            throw runtime_error("too few parameters");
-        string strMethod = argv[1];
-
         // Parameters default to strings
-        std::vector<std::string> strParams(&argv[2], &argv[argc]);
         UniValue params = RPCConvertValues(strMethod, strParams);
 
         // Execute and handle connection failures with -rpcwait
         const bool fWait = GetBoolArg("-rpcwait", false);
         do {
             try {
-                const UniValue reply = CallRPC(strMethod, params);
+                const UniValue reply = connection.Call(strMethod, params);
 
                 // Parse reply
                 const UniValue& result = find_value(reply, "result");
@@ -332,6 +357,46 @@ int CommandLineRPC(int argc, char *argv[])
     return nRet;
 }
 
+int CommandLineRPC(int argc, char *argv[])
+{
+    // Skip switches
+    while (argc > 1 && IsSwitchChar(argv[1][0])) {
+        argc--;
+        argv++;
+    }
+
+    CRPCConnection connection;
+    if (GetBoolArg("-stdin", false)) {
+        // The commands of the lines, the exit code that of the last one which failed
+        int nRet = 0;
+        std::string strLine;
+        char buf[4096];
+        while (fgets(buf, sizeof(buf), stdin)) {
+            strLine += buf;
+            if (strLine.empty() || (strLine[strLine.size() - 1] != '\n' && !feof(stdin)))
+                continue;
+            std::vector<std::string> vArgs;
+            boost::split(vArgs, strLine, boost::is_any_of(" \t\r\n"), boost::token_compress_on);
+            strLine.clear();
+            vArgs.erase(std::remove(vArgs.begin(), vArgs.end(), std::string()), vArgs.end());
+            if (vArgs.empty())
+                continue;
+            const int nCommandRet = ExecuteCommand(connection, vArgs[0], std::vector<std::string>(vArgs.begin() + 1, vArgs.end()));
+            if (nCommandRet != 0)
+                nRet = nCommandRet;
+            fflush(stdout);
+        }
+        return nRet;
+    }
+
+    // Method
+    if (argc < 2) {
+        fprintf(stderr, "error: too few parameters\n");
+        return EXIT_FAILURE;
+    }
+    return ExecuteCommand(connection, argv[1], std::vector<std::string>(&argv[2], &argv[argc]));
+}
+
 int main(int argc, char* argv[])
 {
     SetupEnvironment();
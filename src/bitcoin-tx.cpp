@@ -20,12 +20,17 @@
 
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
 static bool fCreateBlank;
 static map<string,UniValue> registers;
 
+/** Maximum number of threads signing in -signbatch mode */
+static const int MAX_SIGN_BATCH_THREADS = 64;
+
 static bool AppInitRawTx(int argc, char* argv[])
 {
     //
@@ -48,6 +53,7 @@ static bool AppInitRawTx(int argc, char* argv[])
             _("Usage:") + "\n" +
               "  zen-tx [options] <hex-tx> [commands]  " + _("Update hex-encoded zencash transaction") + "\n" +
               "  zen-tx [options] -create [commands]   " + _("Create hex-encoded zencash transaction") + "\n" +
+              "  zen-tx [options] -signbatch[=SIGHASH-FLAGS] [register commands] < <hex-txs>  " + _("Sign hex-encoded zencash transactions, one per line") + "\n" +
               "\n";
 
         fprintf(stdout, "%s", strUsage.c_str());
@@ -58,6 +64,9 @@ static bool AppInitRawTx(int argc, char* argv[])
         strUsage += HelpMessageOpt("-json", _("Select JSON output"));
         strUsage += HelpMessageOpt("-txid", _("Output only the hex-encoded transaction id of the resultant transaction."));
         strUsage += HelpMessageOpt("-regtest", _("Enter regression test mode, which uses a special chain in which blocks can be solved instantly."));
+        strUsage += HelpMessageOpt("-signbatch=SIGHASH-FLAGS", _("Sign the transactions read from standard input, one hex-encoded transaction per line, and output them in the same order. "
+            "This requires the same JSON registers as the sign command, shared by all the transactions."));
+        strUsage += HelpMessageOpt("-signthreads=<n>", strprintf(_("Number of threads to sign with in -signbatch mode (default: number of cores, at most %d)"), MAX_SIGN_BATCH_THREADS));
         strUsage += HelpMessageOpt("-testnet", _("Use the test network"));
 
         fprintf(stdout, "%s", strUsage.c_str());
@@ -323,7 +332,7 @@ vector<unsigned char> ParseHexUO(map<string,UniValue>& o, string strKey)
     return ParseHexUV(o[strKey], strKey);
 }
 
-static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
+static int ParseSighashFlags(const string& flagStr)
 {
     int nHashType = SIGHASH_ALL;
 
@@ -331,22 +340,15 @@ static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
         if (!findSighashFlags(nHashType, flagStr))
             throw runtime_error("unknown sighash flag/sign option");
 
-    vector<CTransaction> txVariants;
-    txVariants.push_back(tx);
-
-    // mergedTx will end up with all the signatures; it
-    // starts as a clone of the raw tx:
-    CMutableTransaction mergedTx(txVariants[0]);
-    bool fComplete = true;
-    CCoinsView viewDummy;
-    CCoinsViewCache view(&viewDummy);
+    return nHashType;
+}
 
+/** The keys of the privatekeys register and the previous outputs of the prevtxs one, to sign with */
+static void ParseSigningRegisters(CBasicKeyStore& keystore, map<COutPoint, CScript>& mapPrevOuts)
+{
     if (!registers.count("privatekeys"))
         throw runtime_error("privatekeys register variable must be set.");
-    bool fGivenKeys = false;
-    CBasicKeyStore tempKeystore;
     UniValue keysObj = registers["privatekeys"];
-    fGivenKeys = true;
 
     for (size_t kidx = 0; kidx < keysObj.size(); kidx++) {
         if (!keysObj[kidx].isStr())
@@ -357,10 +359,10 @@ static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
             throw runtime_error("privatekey not valid");
 
         CKey key = vchSecret.GetKey();
-        tempKeystore.AddKey(key);
+        keystore.AddKey(key);
     }
 
-    // Add previous txouts given in the RPC call:
+    // Add previous txouts given in the registers:
     if (!registers.count("prevtxs"))
         throw runtime_error("prevtxs register variable must be set.");
     UniValue prevtxsObj = registers["prevtxs"];
@@ -384,44 +386,52 @@ static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                pair<map<COutPoint, CScript>::iterator, bool> ret = mapPrevOuts.insert(make_pair(COutPoint(txid, nOut), scriptPubKey));
+                if (!ret.second && ret.first->second != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + coins->vout[nOut].scriptPubKey.ToString() + "\nvs:\n"+
+                    err = err + ret.first->second.ToString() + "\nvs:\n"+
                         scriptPubKey.ToString();
                     throw runtime_error(err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0; // we don't know the actual output value
             }
 
             // if redeemScript given and private keys given,
-            // add redeemScript to the tempKeystore so it can be signed:
-            if (fGivenKeys && scriptPubKey.IsPayToScriptHash() &&
+            // add redeemScript to the keystore so it can be signed:
+            if (scriptPubKey.IsPayToScriptHash() &&
                 prevOut.exists("redeemScript")) {
                 UniValue v = prevOut["redeemScript"];
                 vector<unsigned char> rsData(ParseHexUV(v, "redeemScript"));
                 CScript redeemScript(rsData.begin(), rsData.end());
-                tempKeystore.AddCScript(redeemScript);
+                keystore.AddCScript(redeemScript);
             }
         }
     }
+}
 
-    const CKeyStore& keystore = tempKeystore;
+/**
+ * Sign the inputs of tx the keystore can, merging in the signatures it had. Returns whether
+ * all its inputs are signed. Reads nothing but its arguments, so transactions can be signed
+ * at once from several threads.
+ */
+static bool SignTx(CMutableTransaction& tx, const CKeyStore& keystore, const map<COutPoint, CScript>& mapPrevOuts, int nHashType)
+{
+    // mergedTx will end up with all the signatures; it
+    // starts as a clone of the raw tx:
+    const CTransaction txOrig(tx);
+    CMutableTransaction mergedTx(tx);
+    bool fComplete = true;
 
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (!coins || !coins->IsAvailable(txin.prevout.n)) {
+        map<COutPoint, CScript>::const_iterator it = mapPrevOuts.find(txin.prevout);
+        if (it == mapPrevOuts.end()) {
             fComplete = false;
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
+        const CScript& prevPubKey = it->second;
 
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
@@ -429,19 +439,28 @@ static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
             SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
 
         // ... and merge in other signatures:
-        BOOST_FOREACH(const CTransaction& txv, txVariants) {
-            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
-        }
+        txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txOrig.vin[i].scriptSig);
         if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_NONCONTEXTUAL_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&mergedTx, i)))
             fComplete = false;
     }
 
+    tx = mergedTx;
+    return fComplete;
+}
+
+static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
+{
+    int nHashType = ParseSighashFlags(flagStr);
+
+    CBasicKeyStore tempKeystore;
+    map<COutPoint, CScript> mapPrevOuts;
+    ParseSigningRegisters(tempKeystore, mapPrevOuts);
+
+    bool fComplete = SignTx(tx, tempKeystore, mapPrevOuts, nHashType);
     if (fComplete) {
         // do nothing... for now
         // perhaps store this for later optional JSON output
     }
-
-    tx = mergedTx;
 }
 
 class Secp256k1Init
@@ -547,6 +566,78 @@ static string readStdin()
     return ret;
 }
 
+/**
+ * Sign the transactions of standard input with the keys and previous outputs of the registers
+ * the arguments set, spreading them over threads: a payout batch of thousands of transactions
+ * is signed in one run, the ECDSA signatures on all the cores.
+ */
+static void SignBatch(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        string key, value;
+        size_t eqpos = arg.find('=');
+        if (eqpos == string::npos)
+            key = arg;
+        else {
+            key = arg.substr(0, eqpos);
+            value = arg.substr(eqpos + 1);
+        }
+
+        if (key == "load")
+            RegisterLoad(value);
+        else if (key == "set")
+            RegisterSet(value);
+        else
+            throw runtime_error("only register commands are allowed with -signbatch");
+    }
+
+    int nHashType = ParseSighashFlags(GetArg("-signbatch", ""));
+
+    Secp256k1Init ecc;
+    CBasicKeyStore keystore;
+    map<COutPoint, CScript> mapPrevOuts;
+    ParseSigningRegisters(keystore, mapPrevOuts);
+
+    vector<string> vLines;
+    string strInput = readStdin();
+    boost::split(vLines, strInput, boost::is_any_of("\n"));
+    vector<CMutableTransaction> vtx;
+    for (size_t i = 0; i < vLines.size(); i++) {
+        string strHexTx = boost::algorithm::trim_copy(vLines[i]);
+        if (strHexTx.empty())
+            continue;
+        CTransaction txDecodeTmp;
+        if (!DecodeHexTx(txDecodeTmp, strHexTx))
+            throw runtime_error(strprintf("invalid transaction encoding on line %u", i + 1));
+        vtx.push_back(CMutableTransaction(txDecodeTmp));
+    }
+
+    // Each thread signs every nStep-th transaction; the keystore and outputs are only read
+    vector<char> vComplete(vtx.size(), 0);
+    auto sign = [&](size_t nBegin, size_t nStep) {
+        for (size_t i = nBegin; i < vtx.size(); i += nStep)
+            vComplete[i] = SignTx(vtx[i], keystore, mapPrevOuts, nHashType);
+    };
+
+    int nThreads = GetArg("-signthreads", GetNumCores());
+    nThreads = std::max(1, std::min(std::min(nThreads, MAX_SIGN_BATCH_THREADS), (int)vtx.size()));
+    boost::thread_group threads;
+    for (int n = 1; n < nThreads; n++)
+        threads.create_thread(boost::bind<void>(sign, n, nThreads));
+    sign(0, nThreads);
+    threads.join_all();
+
+    size_t nIncomplete = 0;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        OutputTx(vtx[i]);
+        if (!vComplete[i])
+            nIncomplete++;
+    }
+    if (nIncomplete > 0)
+        throw runtime_error(strprintf("%u of %u transactions are not fully signed", nIncomplete, vtx.size()));
+}
+
 static int CommandLineRawTx(int argc, char* argv[])
 {
     string strPrint;
@@ -559,6 +650,11 @@ static int CommandLineRawTx(int argc, char* argv[])
             argv++;
         }
 
+        if (mapArgs.count("-signbatch")) {
+            SignBatch(argc, argv);
+            return nRet;
+        }
+
         CTransaction txDecodeTmp;
         int startArg;
 
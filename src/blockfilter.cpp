@@ -0,0 +1,312 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "util.h"
+#include "version.h"
+
+#include <algorithm>
+#include <ios>
+
+static const char DB_FILTER = 'f';
+static const char DB_FILTER_HEADER = 'h';
+static const char DB_BEST_BLOCK = 'B';
+
+namespace {
+
+/** Writes bits into a byte vector, the most significant first */
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBuffer(0), nOffset(0) {}
+
+    /** Write the nBits (up to 64) lowest bits of nData */
+    void Write(uint64_t nData, int nBits)
+    {
+        while (nBits > 0) {
+            const int nWrite = std::min(8 - nOffset, nBits);
+            nBuffer |= ((nData >> (nBits - nWrite)) & ((1U << nWrite) - 1)) << (8 - nOffset - nWrite);
+            nOffset += nWrite;
+            nBits -= nWrite;
+            if (nOffset == 8)
+                Flush();
+        }
+    }
+
+    /** Write the last byte started, padded with zeros */
+    void Flush()
+    {
+        if (nOffset == 0)
+            return;
+        vch.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+
+private:
+    std::vector<unsigned char>& vch;
+    uint8_t nBuffer;
+    int nOffset;
+};
+
+/** Reads the bits written by BitWriter from nPos on, throwing std::ios_base::failure past the end */
+class BitReader
+{
+public:
+    BitReader(const std::vector<unsigned char>& vchIn, size_t nPosIn) : vch(vchIn), nPos(nPosIn), nBuffer(0), nOffset(8) {}
+
+    uint64_t Read(int nBits)
+    {
+        uint64_t nData = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                if (nPos >= vch.size())
+                    throw std::ios_base::failure("end of the filter");
+                nBuffer = vch[nPos++];
+                nOffset = 0;
+            }
+            const int nRead = std::min(8 - nOffset, nBits);
+            nData = (nData << nRead) | ((nBuffer >> (8 - nOffset - nRead)) & ((1U << nRead) - 1));
+            nOffset += nRead;
+            nBits -= nRead;
+        }
+        return nData;
+    }
+
+private:
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+    uint8_t nBuffer;
+    int nOffset;
+};
+
+void GolombRiceEncode(BitWriter& writer, uint8_t nP, uint64_t nValue)
+{
+    // The quotient in unary, ones ended by a zero
+    uint64_t nQuotient = nValue >> nP;
+    while (nQuotient > 0) {
+        const int nBits = std::min<uint64_t>(nQuotient, 64);
+        writer.Write(~(uint64_t)0, nBits);
+        nQuotient -= nBits;
+    }
+    writer.Write(0, 1);
+    writer.Write(nValue, nP);
+}
+
+uint64_t GolombRiceDecode(BitReader& reader, uint8_t nP)
+{
+    uint64_t nQuotient = 0;
+    while (reader.Read(1) == 1)
+        nQuotient++;
+    return (nQuotient << nP) + reader.Read(nP);
+}
+
+/** x * n / 2^64, mapping a uniform 64 bits hash to [0, n) without a division */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)n) >> 64);
+#else
+    const uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    const uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    const uint64_t ac = x_hi * n_hi, ad = x_hi * n_lo, bc = x_lo * n_hi, bd = x_lo * n_lo;
+    const uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+void WriteElementCount(std::vector<unsigned char>& vch, uint64_t nCount)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, nCount);
+    vch.assign(ss.begin(), ss.end());
+}
+
+} // anon namespace
+
+GCSFilter::GCSFilter(const Params& paramsIn) : params(paramsIn), nN(0), nF(0)
+{
+    WriteElementCount(vchEncoded, 0);
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, const std::vector<unsigned char>& vchEncodedIn) :
+    params(paramsIn), vchEncoded(vchEncodedIn)
+{
+    CDataStream ss(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nElements = ReadCompactSize(ss);
+    if (nElements > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("too many elements in the filter");
+    nN = nElements;
+    nF = uint64_t(nN) * params.nM;
+
+    // Decode the whole filter once, to fail now rather than on a match
+    BitReader reader(vchEncoded, vchEncoded.size() - ss.size());
+    for (uint32_t i = 0; i < nN; i++)
+        GolombRiceDecode(reader, params.nP);
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, const ElementSet& elements) : params(paramsIn)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("too many elements for a filter");
+    nN = elements.size();
+    nF = uint64_t(nN) * params.nM;
+
+    WriteElementCount(vchEncoded, nN);
+    BitWriter writer(vchEncoded);
+    uint64_t nLast = 0;
+    for (uint64_t nHash : BuildHashedSet(elements)) {
+        GolombRiceEncode(writer, params.nP, nHash - nLast);
+        nLast = nHash;
+    }
+    writer.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    const uint64_t nHash = CSipHasher(params.nSipHashK0, params.nSipHashK1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(nHash, nF);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (const Element& element : elements)
+        vHashes.push_back(HashToRange(element));
+    std::sort(vHashes.begin(), vHashes.end());
+    return vHashes;
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* pHashes, size_t nHashes) const
+{
+    CDataStream ss(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    ReadCompactSize(ss);
+    BitReader reader(vchEncoded, vchEncoded.size() - ss.size());
+
+    uint64_t nValue = 0;
+    size_t nHash = 0;
+    for (uint32_t i = 0; i < nN && nHash < nHashes; i++) {
+        nValue += GolombRiceDecode(reader, params.nP);
+        // Both sorted: skip the hashes below the value, then compare
+        while (nHash < nHashes && pHashes[nHash] < nValue)
+            nHash++;
+        if (nHash < nHashes && pHashes[nHash] == nValue)
+            return true;
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    if (nN == 0)
+        return false;
+    const uint64_t nHash = HashToRange(element);
+    return MatchInternal(&nHash, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    if (nN == 0 || elements.empty())
+        return false;
+    const std::vector<uint64_t> vHashes = BuildHashedSet(elements);
+    return MatchInternal(vHashes.data(), vHashes.size());
+}
+
+bool BlockFilter::BuildParams(BlockFilterType nFilterType, const uint256& hashBlock, GCSFilter::Params& params)
+{
+    if (nFilterType != BLOCK_FILTER_BASIC)
+        return false;
+    // Keyed by the block, so a script matching by chance in a block does not in the others
+    params.nSipHashK0 = ReadLE64(hashBlock.begin());
+    params.nSipHashK1 = ReadLE64(hashBlock.begin() + 8);
+    params.nP = BASIC_FILTER_P;
+    params.nM = BASIC_FILTER_M;
+    return true;
+}
+
+BlockFilter::BlockFilter(BlockFilterType nFilterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vchFilter) :
+    nFilterType(nFilterTypeIn), hashBlock(hashBlockIn)
+{
+    GCSFilter::Params params;
+    if (!BuildParams(nFilterType, hashBlock, params))
+        throw std::invalid_argument("unknown filter type");
+    filter = GCSFilter(params, vchFilter);
+}
+
+BlockFilter::BlockFilter(BlockFilterType nFilterTypeIn, const CBlock& block, const CBlockUndo& blockUndo) :
+    nFilterType(nFilterTypeIn), hashBlock(block.GetHash())
+{
+    GCSFilter::Params params;
+    if (!BuildParams(nFilterType, hashBlock, params))
+        throw std::invalid_argument("unknown filter type");
+
+    // The scripts paid to, but those which cannot be spent, and the scripts spent
+    GCSFilter::ElementSet elements;
+    for (const CTransactionRef& ptx : block.vtx) {
+        for (const CTxOut& txout : ptx->vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+    for (const CTxUndo& txundo : blockUndo.vtxundo) {
+        for (const CTxInUndo& prevout : txundo.vprevout) {
+            const CScript& script = prevout.txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+    filter = GCSFilter(params, elements);
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vch = GetEncodedFilter();
+    return Hash(vch.begin(), vch.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& hashPrevHeader) const
+{
+    const uint256 hashFilter = GetHash();
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end());
+}
+
+CBlockFilterDB::CBlockFilterDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CLevelDBWrapper(GetDataDir() / "blockfilter", nCacheSize, fMemory, fWipe, CLevelDBProfile::BlockFilter().ApplyArgs()) {
+}
+
+bool CBlockFilterDB::ReadBestBlock(uint256& hashBest) const {
+    return Read(DB_BEST_BLOCK, hashBest);
+}
+
+bool CBlockFilterDB::ReadFilter(const uint256& hashBlock, std::vector<unsigned char>& vchFilter) const {
+    return Read(std::make_pair(DB_FILTER, hashBlock), vchFilter);
+}
+
+bool CBlockFilterDB::ReadFilterHeader(const uint256& hashBlock, CBlockFilterHeader& header) const {
+    return Read(std::make_pair(DB_FILTER_HEADER, hashBlock), header);
+}
+
+bool CBlockFilterDB::WriteFilters(const std::vector<std::pair<BlockFilter, uint256> >& vFilters, const uint256& hashBest) {
+    CLevelDBBatch batch;
+    for (const std::pair<BlockFilter, uint256>& filter : vFilters) {
+        CBlockFilterHeader header;
+        header.hashFilter = filter.first.GetHash();
+        header.header = filter.second;
+        batch.Write(std::make_pair(DB_FILTER, filter.first.GetBlockHash()), filter.first.GetEncodedFilter());
+        batch.Write(std::make_pair(DB_FILTER_HEADER, filter.first.GetBlockHash()), header);
+    }
+    batch.Write(DB_BEST_BLOCK, hashBest);
+    return WriteBatch(batch);
+}
@@ -0,0 +1,157 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "leveldbwrapper.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * Compact block filters for light clients (BIP 157/158 style).
+ *
+ * The filter of a block is a Golomb-coded set of the scripts of its outputs and of the
+ * outputs its inputs spend, built once when the block is indexed and served as is by the
+ * "getcfilters" message, so filtering costs nothing per peer. The filters are chained by
+ * their headers, the hash of a filter followed by the header of the filter before it, for
+ * clients to check them against several peers with "getcfheaders" and "getcfcheckpt".
+ */
+
+/** A Golomb-Rice coded set of byte strings, which may match elements not in it with a rate of 1/M */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    struct Params
+    {
+        //! Key of the SipHash of the elements
+        uint64_t nSipHashK0;
+        uint64_t nSipHashK1;
+        //! Bits of the remainder of the Golomb-Rice codes
+        uint8_t nP;
+        //! Inverse false positive rate
+        uint32_t nM;
+
+        Params(uint64_t nSipHashK0In = 0, uint64_t nSipHashK1In = 0, uint8_t nPIn = 0, uint32_t nMIn = 1) :
+            nSipHashK0(nSipHashK0In), nSipHashK1(nSipHashK1In), nP(nPIn), nM(nMIn) {}
+    };
+
+    /** The empty set */
+    explicit GCSFilter(const Params& paramsIn = Params());
+    /** A set as encoded, throwing std::ios_base::failure if it is malformed */
+    GCSFilter(const Params& paramsIn, const std::vector<unsigned char>& vchEncodedIn);
+    GCSFilter(const Params& paramsIn, const ElementSet& elements);
+
+    uint32_t GetN() const { return nN; }
+    const Params& GetParams() const { return params; }
+    const std::vector<unsigned char>& GetEncoded() const { return vchEncoded; }
+
+    /** Whether the element may be in the set */
+    bool Match(const Element& element) const;
+    /** Whether any of the elements may be in the set, faster than matching them one by one */
+    bool MatchAny(const ElementSet& elements) const;
+
+private:
+    Params params;
+    //! Number of elements
+    uint32_t nN;
+    //! N * M, the range the elements are hashed to
+    uint64_t nF;
+    std::vector<unsigned char> vchEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    /** Whether any of the sorted hashes is in the set */
+    bool MatchInternal(const uint64_t* pHashes, size_t nHashes) const;
+};
+
+/** The filter types, only the basic one for now */
+enum BlockFilterType {
+    BLOCK_FILTER_BASIC = 0,
+};
+
+/** Parameters of the basic filter: a false positive rate of 1/784931 with 19 bits remainders */
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+/** Maximum number of filters in a "getcfilters" request */
+static const int MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of filter hashes in a "getcfheaders" request */
+static const int MAX_GETCFHEADERS_SIZE = 2000;
+/** Interval of the headers in a "cfcheckpt" message */
+static const int CFCHECKPT_INTERVAL = 1000;
+
+/** The filter of a block */
+class BlockFilter
+{
+public:
+    BlockFilter() : nFilterType(BLOCK_FILTER_BASIC) {}
+    /** The filter as encoded, throwing std::ios_base::failure if it is malformed */
+    BlockFilter(BlockFilterType nFilterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vchFilter);
+    /** The filter built from the block and its undo data, empty for the genesis block */
+    BlockFilter(BlockFilterType nFilterTypeIn, const CBlock& block, const CBlockUndo& blockUndo);
+
+    BlockFilterType GetFilterType() const { return nFilterType; }
+    const uint256& GetBlockHash() const { return hashBlock; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    uint256 GetHash() const;
+    /** The header of the filter, chained to the header of the filter of the previous block */
+    uint256 ComputeHeader(const uint256& hashPrevHeader) const;
+
+private:
+    BlockFilterType nFilterType;
+    uint256 hashBlock;
+    GCSFilter filter;
+
+    /** The parameters of the filters of the type for the block, false for an unknown type */
+    static bool BuildParams(BlockFilterType nFilterType, const uint256& hashBlock, GCSFilter::Params& params);
+};
+
+/** The hash of a filter and its header, kept apart from the filter to serve "getcfheaders" */
+struct CBlockFilterHeader
+{
+    uint256 hashFilter;
+    uint256 header;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashFilter);
+        READWRITE(header);
+    }
+};
+
+/** Access to the basic filters of the blocks indexed by -blockfilterindex (blockfilter/), by block hash */
+class CBlockFilterDB : public CLevelDBWrapper
+{
+public:
+    CBlockFilterDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! The last block of the active chain indexed
+    bool ReadBestBlock(uint256& hashBest) const;
+    bool ReadFilter(const uint256& hashBlock, std::vector<unsigned char>& vchFilter) const;
+    bool ReadFilterHeader(const uint256& hashBlock, CBlockFilterHeader& header) const;
+    /** Write the filters of blocks and their headers, with the new last block of the active chain */
+    bool WriteFilters(const std::vector<std::pair<BlockFilter, uint256> >& vFilters, const uint256& hashBest);
+
+private:
+    CBlockFilterDB(const CBlockFilterDB&);
+    void operator=(const CBlockFilterDB&);
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -5,7 +5,9 @@
 #include "bloom.h"
 
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -13,6 +15,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 
@@ -52,40 +55,50 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
+inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const unsigned char* pDataToHash, size_t nSize) const
 {
     // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) % (vData.size() * 8);
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, pDataToHash, nSize) % (vData.size() * 8);
 }
 
-void CBloomFilter::insert(const vector<unsigned char>& vKey)
+/** The serialization of an outpoint, the key of BIP 37, without a stream */
+static void SerializeOutPoint(const COutPoint& outpoint, unsigned char (&key)[36])
+{
+    memcpy(key, outpoint.hash.begin(), 32);
+    WriteLE32(key + 32, outpoint.n);
+}
+
+void CBloomFilter::insert(const unsigned char* pKey, size_t nSize)
 {
     if (isFull)
         return;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pKey, nSize);
         // Sets bit nIndex of vData
         vData[nIndex >> 3] |= (1 << (7 & nIndex));
     }
     isEmpty = false;
 }
 
+void CBloomFilter::insert(const vector<unsigned char>& vKey)
+{
+    insert(vKey.empty() ? NULL : &vKey[0], vKey.size());
+}
+
 void CBloomFilter::insert(const COutPoint& outpoint)
 {
-    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << outpoint;
-    vector<unsigned char> data(stream.begin(), stream.end());
-    insert(data);
+    unsigned char key[36];
+    SerializeOutPoint(outpoint, key);
+    insert(key, sizeof(key));
 }
 
 void CBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(hash.begin(), hash.size());
 }
 
-bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
+bool CBloomFilter::contains(const unsigned char* pKey, size_t nSize) const
 {
     if (isFull)
         return true;
@@ -93,7 +106,7 @@ bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
         return false;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pKey, nSize);
         // Checks bit nIndex of vData
         if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
             return false;
@@ -101,18 +114,44 @@ bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
     return true;
 }
 
+bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
+{
+    return contains(vKey.empty() ? NULL : &vKey[0], vKey.size());
+}
+
 bool CBloomFilter::contains(const COutPoint& outpoint) const
 {
-    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << outpoint;
-    vector<unsigned char> data(stream.begin(), stream.end());
-    return contains(data);
+    unsigned char key[36];
+    SerializeOutPoint(outpoint, key);
+    return contains(key, sizeof(key));
 }
 
 bool CBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(hash.begin(), hash.size());
+}
+
+void CBloomFilter::insertDoubleHashed(uint64_t h1, uint64_t h2)
+{
+    const uint64_t nBits = vData.size() * 8;
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        uint64_t nIndex = (h1 + i * h2) % nBits;
+        vData[nIndex >> 3] |= (1 << (7 & nIndex));
+    }
+    isEmpty = false;
+}
+
+bool CBloomFilter::containsDoubleHashed(uint64_t h1, uint64_t h2) const
+{
+    if (isEmpty)
+        return false;
+    const uint64_t nBits = vData.size() * 8;
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        uint64_t nIndex = (h1 + i * h2) % nBits;
+        if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
+            return false;
+    }
+    return true;
 }
 
 void CBloomFilter::clear()
@@ -229,44 +268,97 @@ CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
     reset();
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+void CRollingBloomFilter::insertHashed(uint64_t h)
 {
     if (nInsertions == 0) {
         b1.clear();
     } else if (nInsertions == nBloomSize / 2) {
         b2.clear();
     }
-    b1.insert(vKey);
-    b2.insert(vKey);
+    // Double hashing over one SipHash, as CHashBloomFilter does
+    uint64_t h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+    b1.insertDoubleHashed(h1, h2);
+    b2.insertDoubleHashed(h1, h2);
     if (++nInsertions == nBloomSize) {
         nInsertions = 0;
     }
 }
 
+bool CRollingBloomFilter::containsHashed(uint64_t h) const
+{
+    uint64_t h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+    if (nInsertions < nBloomSize / 2) {
+        return b2.containsDoubleHashed(h1, h2);
+    }
+    return b1.containsDoubleHashed(h1, h2);
+}
+
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insertHashed(CSipHasher(k0, k1).Write(vKey.empty() ? NULL : &vKey[0], vKey.size()).Finalize());
+}
+
 void CRollingBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insertHashed(SipHashUint256(k0, k1, hash));
 }
 
 bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
 {
-    if (nInsertions < nBloomSize / 2) {
-        return b2.contains(vKey);
-    }
-    return b1.contains(vKey);
+    return containsHashed(CSipHasher(k0, k1).Write(vKey.empty() ? NULL : &vKey[0], vKey.size()).Finalize());
 }
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return containsHashed(SipHashUint256(k0, k1, hash));
 }
 
 void CRollingBloomFilter::reset()
 {
-    unsigned int nNewTweak = GetRand(std::numeric_limits<unsigned int>::max());
-    b1.reset(nNewTweak);
-    b2.reset(nNewTweak);
+    b1.reset(0);
+    b2.reset(0);
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
     nInsertions = 0;
 }
+
+CHashBloomFilter::CHashBloomFilter(size_t nElements, double nFPRate) :
+    nCapacity(std::max(nElements, (size_t)1)),
+    nInsertions(0)
+{
+    // Same sizing as CBloomFilter, without the protocol limits
+    nBits = std::max((uint64_t)(-1 / LN2SQUARED * nCapacity * log(nFPRate)), (uint64_t)64);
+    vBits.resize((nBits + 63) / 64);
+    nHashFuncs = std::max(std::min((unsigned int)(nBits / nCapacity * LN2), MAX_HASH_FUNCS), 1u);
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+}
+
+void CHashBloomFilter::insert(const uint256& hash)
+{
+    // Double hashing: the positions are h1 + i * h2 for the two halves of the SipHash
+    uint64_t h = SipHashUint256(k0, k1, hash);
+    uint64_t h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        uint64_t nIndex = (h1 + i * h2) % nBits;
+        vBits[nIndex >> 6] |= (uint64_t)1 << (nIndex & 63);
+    }
+    nInsertions++;
+}
+
+bool CHashBloomFilter::contains(const uint256& hash) const
+{
+    uint64_t h = SipHashUint256(k0, k1, hash);
+    uint64_t h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        uint64_t nIndex = (h1 + i * h2) % nBits;
+        if (!(vBits[nIndex >> 6] & ((uint64_t)1 << (nIndex & 63))))
+            return false;
+    }
+    return true;
+}
+
+size_t CHashBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vBits);
+}
@@ -51,7 +51,13 @@ private:
     unsigned int nTweak;
     unsigned char nFlags;
 
-    unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
+    unsigned int Hash(unsigned int nHashNum, const unsigned char* pDataToHash, size_t nSize) const;
+    void insert(const unsigned char* pKey, size_t nSize);
+    bool contains(const unsigned char* pKey, size_t nSize) const;
+
+    //! The bits at h1 + i * h2, for CRollingBloomFilter which hashes an element once for both its filters
+    void insertDoubleHashed(uint64_t h1, uint64_t h2);
+    bool containsDoubleHashed(uint64_t h1, uint64_t h2) const;
 
     // Private constructor for CRollingBloomFilter, no restrictions on size
     CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
@@ -104,6 +110,8 @@ public:
 
 /**
  * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
+ * It is never sent to peers, so rather than the BIP 37 hashes of CBloomFilter it sets
+ * the bits of an element from a single SipHash of it, by double hashing.
  * Construct it with the number of items to keep track of, and a false-positive
  * rate. Unlike CBloomFilter, by default nTweak is set to a cryptographically
  * secure random value for you. Similarly rather than clear() the method
@@ -132,7 +140,40 @@ private:
     unsigned int nBloomSize;
     unsigned int nInsertions;
     CBloomFilter b1, b2;
+    //! The SipHash key of the elements, random and changed by reset() like the tweak of CBloomFilter
+    uint64_t k0, k1;
+
+    void insertHashed(uint64_t h);
+    bool containsHashed(uint64_t h) const;
 };
 
+/**
+ * Bloom filter over hashes, of any size, kept in memory to answer that a large
+ * set stored elsewhere does not have an element without looking it up there.
+ * The bit positions come from a SipHash of the element with a random key, so
+ * that no one can pick elements that all land on the same bits.
+ */
+class CHashBloomFilter
+{
+public:
+    CHashBloomFilter(size_t nElements, double nFPRate);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+
+    //! Number of elements the filter was sized for, and inserted so far
+    size_t Capacity() const { return nCapacity; }
+    size_t Count() const { return nInsertions; }
+
+    size_t DynamicMemoryUsage() const;
+
+private:
+    std::vector<uint64_t> vBits;
+    uint64_t nBits;
+    unsigned int nHashFuncs;
+    uint64_t k0, k1;
+    size_t nCapacity;
+    size_t nInsertions;
+};
 
 #endif // BITCOIN_BLOOM_H
@@ -5,14 +5,43 @@
 
 #include "chain.h"
 
+#include "main.h"
+#include "txdb.h"
+
 #include <stdexcept>
 
 using namespace std;
 
+CBlockHeader CBlockIndex::GetBlockHeader() const
+{
+    CBlockHeader block;
+    block.nVersion       = nVersion;
+    if (pprev)
+        block.hashPrevBlock = pprev->GetBlockHash();
+    block.hashMerkleRoot = hashMerkleRoot;
+    block.hashReserved   = hashReserved;
+    block.nTime          = nTime;
+    block.nBits          = nBits;
+    block.nNonce         = nNonce;
+    block.nSolution      = GetSolution();
+    return block;
+}
+
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    if (!fSolutionTrimmed)
+        return nSolution;
+    CDiskBlockIndex dbindex;
+    if (!pblocktree->ReadDiskBlockIndex(GetBlockHash(), dbindex))
+        throw runtime_error(strprintf("%s: cannot read the block index entry of %s", __func__, GetBlockHash().ToString()));
+    return dbindex.nSolution;
+}
+
 /**
  * CChain implementation
  */
 void CChain::SetTip(CBlockIndex *pindex) {
+    pindexLocatorCache = NULL;
     if (pindex == NULL) {
         vChain.clear();
         return;
@@ -31,6 +60,10 @@ CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
 
     if (!pindex)
         pindex = Tip();
+    // The locator only depends on the ancestors of pindex, the hash check covers a reused index entry address
+    if (pindex && pindex == pindexLocatorCache && locatorCache.vHave.front() == pindex->GetBlockHash())
+        return locatorCache;
+    const CBlockIndex* pindexLocator = pindex;
     while (pindex) {
         vHave.push_back(pindex->GetBlockHash());
         // Stop when we have added the genesis block.
@@ -49,15 +82,37 @@ CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
             nStep *= 2;
     }
 
+    if (pindexLocator) {
+        pindexLocatorCache = pindexLocator;
+        locatorCache = CBlockLocator(vHave);
+    }
     return CBlockLocator(vHave);
 }
 
 const CBlockIndex *CChain::FindFork(const CBlockIndex *pindex) const {
+    if (pindex == NULL)
+        return NULL;
     if (pindex->nHeight > Height())
         pindex = pindex->GetAncestor(Height());
-    while (pindex && !Contains(pindex))
+    // Most forks are short: try the first few ancestors directly.
+    for (int i = 0; i < 8; i++) {
+        if (pindex == NULL || Contains(pindex))
+            return pindex;
         pindex = pindex->pprev;
-    return pindex;
+    }
+    if (pindex == NULL || Contains(pindex))
+        return pindex;
+    // Ancestors of pindex are in this chain up to the fork height, and not above it:
+    // binary search for that height using the skip list.
+    int nLow = -1, nHigh = pindex->nHeight;
+    while (nHigh - nLow > 1) {
+        int nMid = nLow + (nHigh - nLow) / 2;
+        if (Contains(pindex->GetAncestor(nMid)))
+            nLow = nMid;
+        else
+            nHigh = nMid;
+    }
+    return nLow < 0 ? NULL : pindex->GetAncestor(nLow);
 }
 
 /** Turn the lowest '1' bit in the binary representation of a number into a '0'. */
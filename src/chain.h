@@ -188,6 +188,12 @@ public:
     uint256 nNonce;
     std::vector<unsigned char> nSolution;
 
+    //! (memory only) Whether nSolution was dropped, see TrimSolution()
+    bool fSolutionTrimmed;
+
+    //! (memory only) Whether ConnectBlock verified the JoinSplit proofs of this block, last time it connected it
+    bool fProofsVerified;
+
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
@@ -218,6 +224,8 @@ public:
         nBits          = 0;
         nNonce         = uint256();
         nSolution.clear();
+        fSolutionTrimmed = false;
+        fProofsVerified = false;
     }
 
     CBlockIndex()
@@ -256,21 +264,21 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
+    CBlockHeader GetBlockHeader() const;
+
+    /**
+     * Drop the Equihash solution, which takes most of the memory of an entry and is
+     * only needed to serve the header, once the entry is in the block tree database.
+     * GetSolution() and GetBlockHeader() then read it from there.
+     */
+    void TrimSolution()
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        if (pprev)
-            block.hashPrevBlock = pprev->GetBlockHash();
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.hashReserved   = hashReserved;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
-        return block;
+        std::vector<unsigned char>().swap(nSolution);
+        fSolutionTrimmed = true;
     }
 
+    std::vector<unsigned char> GetSolution() const;
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -348,6 +356,10 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        if (fSolutionTrimmed) {
+            nSolution = pindex->GetSolution();
+            fSolutionTrimmed = false;
+        }
     }
 
     ADD_SERIALIZE_METHODS;
@@ -416,6 +428,10 @@ class CChain {
 private:
     std::vector<CBlockIndex*> vChain;
 
+    //! The last locator built, peers syncing from us mostly ask for the same one; guarded like the chain, by cs_main
+    mutable const CBlockIndex* pindexLocatorCache = NULL;
+    mutable CBlockLocator locatorCache;
+
 public:
     /** Returns the index entry for the genesis block of this chain, or NULL if none. */
     CBlockIndex *Genesis() const {
@@ -6,6 +6,7 @@
 #include "main.h"
 #include "crypto/equihash.h"
 
+#include "sync.h"
 #include "util.h"
 #include "utilstrencodings.h"
 
@@ -86,7 +87,7 @@ public:
         txNew.vin[0].scriptSig = CScript() << 486604799 << CScriptNum(4) << vector<unsigned char>((const unsigned char*)pszTimestamp, (const unsigned char*)pszTimestamp + strlen(pszTimestamp));
         txNew.vout[0].nValue = 0;
         txNew.vout[0].scriptPubKey = CScript() << ParseHex("04678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5f") << OP_CHECKSIG;
-        genesis.vtx.push_back(txNew);
+        genesis.vtx.push_back(MakeTransactionRef(txNew));
         genesis.hashPrevBlock.SetNull();
         genesis.hashMerkleRoot = genesis.BuildMerkleTree();
         genesis.nVersion = 4;
@@ -381,15 +382,29 @@ std::string CChainParams::GetCommunityFundAddressAtHeight(int nHeight , Fork::Co
     return ForkManager::getInstance().getCommunityFundAddress(nHeight,consensus._deprecatedGetLastCommunityRewardBlockHeight(), cfType);
 }
 
+namespace {
+// The scripts of the community fund addresses, decoded once rather than for each coinbase built or checked
+CCriticalSection cs_communityFundScripts;
+std::map<std::string, CScript> mapCommunityFundScripts;
+}
+
 // The community fund address is expected to be a multisig (P2SH) address
 CScript CChainParams::GetCommunityFundScriptAtHeight(int nHeight, Fork::CommunityFundType cfType) const {
     assert(nHeight > 0);
 
-    CBitcoinAddress address(GetCommunityFundAddressAtHeight(nHeight, cfType).c_str());
+    const std::string& strAddress = ForkManager::getInstance().getCommunityFundAddress(nHeight,
+        consensus._deprecatedGetLastCommunityRewardBlockHeight(), cfType);
+    LOCK(cs_communityFundScripts);
+    std::map<std::string, CScript>::const_iterator it = mapCommunityFundScripts.find(strAddress);
+    if (it != mapCommunityFundScripts.end())
+        return it->second;
+
+    CBitcoinAddress address(strAddress.c_str());
     assert(address.IsValid());
     assert(address.IsScript());
     CScriptID scriptID = get<CScriptID>(address.Get()); // Get() returns a boost variant
     CScript script = CScript() << OP_HASH160 << ToByteVector(scriptID) << OP_EQUAL;
+    mapCommunityFundScripts[strAddress] = script;
     return script;
 }
 
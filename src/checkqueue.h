@@ -5,7 +5,11 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "utiltime.h"
+
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -25,12 +29,27 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * The verifications are spread over a queue for each worker, the master
+  * included, which take them from their own queue and steal from the
+  * others once it is empty. A worker only contends with the thieves of its
+  * queue, and the counters of the verifications left are atomic, so that
+  * the shared mutex is only taken to sleep and wake up.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Most worker queues, the workers beyond share them
+    static const unsigned int MAX_WORKERS = 64;
+
+    struct WorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> queue;
+    };
+
+    //! Mutex to sleep and wake up on, protecting nQueues when a worker starts
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,96 +58,128 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The queues of the workers, the first one of the master.
+    //! As the order of the verifications doesn't matter, they are used as LIFOs by
+    //! their worker and FIFOs by the thieves.
+    WorkerQueue vQueues[MAX_WORKERS];
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The worker queues in use, the master's and one for each worker thread
+    std::atomic<unsigned int> nQueues;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The queue receiving the first verifications of the next batch added
+    unsigned int nNextQueue;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! Number of verifications queued, not taken by a worker yet
+    std::atomic<unsigned int> nQueued;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Verifications run, and the time in microseconds the workers and master spent on them
+    std::atomic<uint64_t> nChecked;
+    std::atomic<int64_t> nBusyTime;
+
+    /**
+     * Take a batch from the queue of the worker, else steal one from another.
+     * * Do not try to do everything at once, but aim for increasingly smaller batches so
+     *   all workers finish approximately simultaneously: half of the queue, which leaves
+     *   the other half to the thieves.
+     * * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
+     */
+    void Take(unsigned int nQueue, std::vector<T>& vChecks)
+    {
+        const unsigned int nCount = nQueues;
+        for (unsigned int i = 0; i < nCount && vChecks.empty(); i++) {
+            const bool fOwn = i == 0;
+            WorkerQueue& q = vQueues[(nQueue + i) % nCount];
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            if (q.queue.empty())
+                continue;
+            const unsigned int nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, q.queue.size() / 2));
+            vChecks.resize(nNow);
+            for (unsigned int n = 0; n < nNow; n++) {
+                // We want the lock on the mutex to be as short as possible, so swap jobs from the
+                // queue to the local batch vector instead of copying.
+                if (fOwn) {
+                    vChecks[n].swap(q.queue.back());
+                    q.queue.pop_back();
+                } else {
+                    vChecks[n].swap(q.queue.front());
+                    q.queue.pop_front();
+                }
+            }
+            // Still with the lock, so that verifications counted as queued can be found
+            nQueued -= nNow;
+        }
+        // Pass the wake up on to another worker while verifications are left for it
+        if (!vChecks.empty() && nQueued > 0)
+            condWorker.notify_one();
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        unsigned int nQueue = 0;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!fMaster)
+                nQueue = 1 + (nQueues - 1) % (MAX_WORKERS - 1);
+            if (!fMaster && nQueues < MAX_WORKERS)
+                nQueues++;
+        }
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
+            Take(nQueue, vChecks);
+            if (vChecks.empty()) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
+                // Verifications queued since the queues were searched, take them
+                while (nQueued == 0) {
+                    if (fMaster && nTodo == 0) {
                         bool fRet = fAllOk;
                         // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
+                        fAllOk = true;
                         // return the current status
                         return fRet;
                     }
-                    nIdle++;
                     cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
             }
-            // execute work
+            // execute work, unless a verification failed already
+            const int64_t nBatchStart = GetTimeMicros();
+            bool fOk = fAllOk;
             BOOST_FOREACH (T& check, vChecks)
                 if (fOk)
                     fOk = check();
+            if (!fOk)
+                fAllOk = false;
+            const unsigned int nNow = vChecks.size();
+            nBusyTime += GetTimeMicros() - nBatchStart;
+            nChecked += nNow;
             vChecks.clear();
+            if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nQueues(1), nNextQueue(0), fAllOk(true), nTodo(0), nQueued(0), nBatchSize(nBatchSizeIn), nChecked(0), nBusyTime(0) {}
 
     //! Worker thread
     void Thread()
@@ -145,26 +196,62 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        unsigned int nRuns = 0;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Spread over the worker queues, in runs of at least a batch
+            nTodo += vChecks.size();
+            nQueued += vChecks.size();
+            const unsigned int nCount = nQueues;
+            const size_t nRun = std::max<size_t>(nBatchSize, (vChecks.size() + nCount - 1) / nCount);
+            for (size_t nFirst = 0; nFirst < vChecks.size(); nFirst += nRun) {
+                WorkerQueue& q = vQueues[nNextQueue];
+                nNextQueue = (nNextQueue + 1) % nCount;
+                nRuns++;
+                boost::unique_lock<boost::mutex> lockQueue(q.mutex);
+                for (size_t n = nFirst; n < std::min(nFirst + nRun, vChecks.size()); n++) {
+                    q.queue.push_back(T());
+                    vChecks[n].swap(q.queue.back());
+                }
+            }
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
+        // A worker for each run, the ones taking their first half wake up others for the rest
+        for (unsigned int i = 0; i < nRuns; i++)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
     }
 
     ~CCheckQueue()
     {
     }
 
+    //! Threads running the verifications, the master's included
+    unsigned int GetThreadCount() const
+    {
+        return nQueues;
+    }
+
+    //! Verifications added which haven't completed yet
+    unsigned int GetPendingCount() const
+    {
+        return nTodo;
+    }
+
+    uint64_t GetCheckedCount() const
+    {
+        return nChecked;
+    }
+
+    int64_t GetBusyTime() const
+    {
+        return nBusyTime;
+    }
+
+    //! No verification is left, the workers finishing the last ones don't touch them anymore
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo == 0 && fAllOk;
     }
 
 };
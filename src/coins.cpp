@@ -4,6 +4,7 @@
 
 #include "coins.h"
 
+#include "checkqueue.h"
 #include "memusage.h"
 #include "random.h"
 #include "version.h"
@@ -211,6 +212,45 @@ bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
     return false;
 }
 
+void CCoinsViewCache::Prefetch(const std::vector<uint256> &txids, CCheckQueue<CCoinsFetch>* pqueue) {
+    std::vector<uint256> vMissing;
+    std::set<uint256> setSeen;
+    BOOST_FOREACH(const uint256 &txid, txids) {
+        if (cacheCoins.count(txid) == 0 && setSeen.insert(txid).second)
+            vMissing.push_back(txid);
+    }
+    if (vMissing.empty())
+        return;
+
+    std::vector<CCoins> vCoins(vMissing.size());
+    std::vector<char> vFound(vMissing.size(), 0);
+    std::vector<CCoinsFetch> vFetches;
+    vFetches.reserve(vMissing.size());
+    for (size_t i = 0; i < vMissing.size(); i++)
+        vFetches.push_back(CCoinsFetch(base, &vMissing[i], &vCoins[i], &vFound[i]));
+
+    if (pqueue == NULL || vFetches.size() == 1) {
+        BOOST_FOREACH(CCoinsFetch& fetch, vFetches)
+            fetch();
+    } else {
+        CCheckQueueControl<CCoinsFetch> control(pqueue);
+        control.Add(vFetches);
+        control.Wait();
+    }
+
+    // Same bookkeeping as FetchCoins
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        if (!vFound[i])
+            continue;
+        CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(vMissing[i], CCoinsCacheEntry())).first;
+        vCoins[i].swap(ret->second.coins);
+        if (ret->second.coins.IsPruned()) {
+            ret->second.flags = CCoinsCacheEntry::FRESH;
+        }
+        cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    }
+}
+
 CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
@@ -360,13 +400,52 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashAnchor, cacheAnchors, cacheNullifiers);
-    cacheCoins.clear();
+    // Swap in a new map to release the pool, which would otherwise keep counting in DynamicMemoryUsage()
+    CCoinsMap().swap(cacheCoins);
     cacheAnchors.clear();
     cacheNullifiers.clear();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+void CCoinsViewCache::ClearCache() {
+    assert(!hasModifier);
+    CCoinsMap().swap(cacheCoins);
+    cacheAnchors.clear();
+    cacheNullifiers.clear();
+    cachedCoinsUsage = 0;
+    hashBlock.SetNull();
+    hashAnchor.SetNull();
+}
+
+void CCoinsViewCache::CopyDirty(CCoinsMap &mapCoins, uint256 &hashBlockOut, uint256 &hashAnchorOut,
+                                CAnchorsMap &mapAnchors, CNullifiersMap &mapNullifiers) {
+    assert(!hasModifier);
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            // FRESH tells the base it has nothing to read back. Once written, the
+            // base has the entry, so it is not FRESH in this cache any more, and a
+            // pruned entry stays to keep hiding what the base has until then.
+            mapCoins.insert(*it);
+            it->second.flags = 0;
+        }
+    }
+    for (CAnchorsMap::iterator it = cacheAnchors.begin(); it != cacheAnchors.end(); it++) {
+        if (it->second.flags & CAnchorsCacheEntry::DIRTY) {
+            mapAnchors.insert(*it);
+            it->second.flags = 0;
+        }
+    }
+    for (CNullifiersMap::iterator it = cacheNullifiers.begin(); it != cacheNullifiers.end(); it++) {
+        if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
+            mapNullifiers.insert(*it);
+            it->second.flags = 0;
+        }
+    }
+    hashBlockOut = hashBlock;
+    hashAnchorOut = hashAnchor;
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
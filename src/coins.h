@@ -10,6 +10,7 @@
 #include "core_memusage.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
@@ -321,7 +322,9 @@ struct CNullifiersCacheEntry
     CNullifiersCacheEntry() : entered(false), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+// The entries are allocated from a pool of the map, see CPoolResource
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             pool_allocator<std::pair<const uint256, CCoinsCacheEntry> > > CCoinsMap;
 typedef boost::unordered_map<uint256, CAnchorsCacheEntry, CCoinsKeyHasher> CAnchorsMap;
 typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher> CNullifiersMap;
 
@@ -425,6 +428,39 @@ public:
 };
 
 /** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+template <typename T>
+class CCheckQueue;
+
+/**
+ * Closure reading the coins of one transaction from a view, for the workers of a
+ * check queue. The outcome is stored rather than returned, a missing entry isn't a failure.
+ */
+class CCoinsFetch
+{
+private:
+    const CCoinsView *pview;
+    const uint256 *ptxid;
+    CCoins *pcoins;
+    char *pfFound;
+
+public:
+    CCoinsFetch(): pview(NULL), ptxid(NULL), pcoins(NULL), pfFound(NULL) {}
+    CCoinsFetch(const CCoinsView *pviewIn, const uint256 *ptxidIn, CCoins *pcoinsIn, char *pfFoundIn) :
+        pview(pviewIn), ptxid(ptxidIn), pcoins(pcoinsIn), pfFound(pfFoundIn) { }
+
+    bool operator()() {
+        *pfFound = pview->GetCoins(*ptxid, *pcoins);
+        return true;
+    }
+
+    void swap(CCoinsFetch &fetch) {
+        std::swap(pview, fetch.pview);
+        std::swap(ptxid, fetch.ptxid);
+        std::swap(pcoins, fetch.pcoins);
+        std::swap(pfFound, fetch.pfFound);
+    }
+};
+
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
@@ -489,6 +525,14 @@ public:
      */
     CCoinsModifier ModifyCoins(const uint256 &txid);
 
+    /**
+     * Load the coins of the given transactions that are not cached yet from
+     * the base view, with the lookups spread over the workers of pqueue, or one
+     * after the other without a queue. With a queue, the base view must support
+     * concurrent reads (as CCoinsViewDB does), and the caller must be its only master.
+     */
+    void Prefetch(const std::vector<uint256> &txids, CCheckQueue<CCoinsFetch>* pqueue = NULL);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
@@ -496,6 +540,23 @@ public:
      */
     bool Flush();
 
+    /**
+     * Forget everything read from the base, including its best block and anchor,
+     * after the base was changed behind this cache. The cache must have nothing
+     * to write, as after Flush().
+     */
+    void ClearCache();
+
+    /**
+     * Copy the modifications applied to this cache, and its best block and anchor,
+     * to the given empty maps, and mark the entries clean but keep them cached.
+     * The copy can then be written to the base with BatchWrite() while this cache
+     * is in use. Until that write is done, this cache must not be flushed, and the
+     * copies must be written in the order they were taken.
+     */
+    void CopyDirty(CCoinsMap &mapCoins, uint256 &hashBlockOut, uint256 &hashAnchorOut,
+                   CAnchorsMap &mapAnchors, CNullifiersMap &mapNullifiers);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
@@ -0,0 +1,318 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/blake2b_batch.h"
+
+#include "crypto/common.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BLAKE2B_BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/** The blake2b_state of libsodium 1.0.18, that crypto_generichash_blake2b_state holds */
+struct SodiumBlake2bState
+{
+    uint64_t h[8];
+    uint64_t t[2];
+    uint64_t f[2];
+    uint8_t buf[2 * 128];
+    size_t buflen;
+    uint8_t last_node;
+};
+static_assert(sizeof(SodiumBlake2bState) <= sizeof(crypto_generichash_blake2b_state),
+              "libsodium BLAKE2b state layout mismatch");
+
+const uint64_t blake2b_IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+const uint8_t blake2b_sigma[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+/** Column and diagonal steps of a round, as (a, b, c, d) state word indices */
+const uint8_t blake2b_steps[8][4] = {
+    { 0, 4,  8, 12 }, { 1, 5,  9, 13 }, { 2, 6, 10, 14 }, { 3, 7, 11, 15 },
+    { 0, 5, 10, 15 }, { 1, 6, 11, 12 }, { 2, 7,  8, 13 }, { 3, 4,  9, 14 }
+};
+
+inline uint64_t rotr64(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+void Compress(uint64_t h[8], const unsigned char* block, uint64_t t0, bool fLast)
+{
+    uint64_t m[16];
+    uint64_t v[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = ReadLE64(block + 8 * i);
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = blake2b_IV[i];
+    }
+    v[12] ^= t0;
+    if (fLast)
+        v[14] = ~v[14];
+
+    for (int r = 0; r < 12; r++) {
+        for (int s = 0; s < 8; s++) {
+            uint64_t& a = v[blake2b_steps[s][0]];
+            uint64_t& b = v[blake2b_steps[s][1]];
+            uint64_t& c = v[blake2b_steps[s][2]];
+            uint64_t& d = v[blake2b_steps[s][3]];
+            a = a + b + m[blake2b_sigma[r][2 * s]];
+            d = rotr64(d ^ a, 32);
+            c = c + d;
+            b = rotr64(b ^ c, 24);
+            a = a + b + m[blake2b_sigma[r][2 * s + 1]];
+            d = rotr64(d ^ a, 16);
+            c = c + d;
+            b = rotr64(b ^ c, 63);
+        }
+    }
+
+    for (int i = 0; i < 8; i++)
+        h[i] ^= v[i] ^ v[i + 8];
+}
+
+/** Store the first outlen bytes of a chaining value, little-endian */
+void StoreHash(const uint64_t h[8], unsigned char* out, size_t outlen)
+{
+    unsigned char buf[64];
+    for (int i = 0; i < 8; i++)
+        WriteLE64(buf + 8 * i, h[i]);
+    memcpy(out, buf, outlen);
+}
+
+#ifdef BLAKE2B_BATCH_X86
+// The vector versions compress the same way, with every state word holding
+// that word of 4 (AVX2) or 8 (AVX-512) independent states. They are compiled
+// for their instruction set whatever the build flags and only called when the
+// CPU supports it.
+
+__attribute__((target("avx2")))
+inline __m256i rotr64_avx2(__m256i x, int n)
+{
+    if (n == 32)
+        return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n));
+}
+
+__attribute__((target("avx2")))
+void Compress4(const uint64_t h[8], const uint64_t m[16][4], uint64_t t0, uint64_t out[8][4])
+{
+    __m256i v[16];
+    __m256i mv[16];
+    for (int i = 0; i < 16; i++)
+        mv[i] = _mm256_loadu_si256((const __m256i*)m[i]);
+    for (int i = 0; i < 8; i++) {
+        v[i] = _mm256_set1_epi64x(h[i]);
+        v[i + 8] = _mm256_set1_epi64x(blake2b_IV[i]);
+    }
+    v[12] = _mm256_set1_epi64x(blake2b_IV[4] ^ t0);
+    v[14] = _mm256_set1_epi64x(~blake2b_IV[6]);
+
+    for (int r = 0; r < 12; r++) {
+        for (int s = 0; s < 8; s++) {
+            __m256i& a = v[blake2b_steps[s][0]];
+            __m256i& b = v[blake2b_steps[s][1]];
+            __m256i& c = v[blake2b_steps[s][2]];
+            __m256i& d = v[blake2b_steps[s][3]];
+            a = _mm256_add_epi64(_mm256_add_epi64(a, b), mv[blake2b_sigma[r][2 * s]]);
+            d = rotr64_avx2(_mm256_xor_si256(d, a), 32);
+            c = _mm256_add_epi64(c, d);
+            b = rotr64_avx2(_mm256_xor_si256(b, c), 24);
+            a = _mm256_add_epi64(_mm256_add_epi64(a, b), mv[blake2b_sigma[r][2 * s + 1]]);
+            d = rotr64_avx2(_mm256_xor_si256(d, a), 16);
+            c = _mm256_add_epi64(c, d);
+            b = rotr64_avx2(_mm256_xor_si256(b, c), 63);
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        __m256i hv = _mm256_xor_si256(_mm256_set1_epi64x(h[i]), _mm256_xor_si256(v[i], v[i + 8]));
+        _mm256_storeu_si256((__m256i*)out[i], hv);
+    }
+}
+
+__attribute__((target("avx512f")))
+void Compress8(const uint64_t h[8], const uint64_t m[16][8], uint64_t t0, uint64_t out[8][8])
+{
+    __m512i v[16];
+    __m512i mv[16];
+    for (int i = 0; i < 16; i++)
+        mv[i] = _mm512_loadu_si512((const void*)m[i]);
+    for (int i = 0; i < 8; i++) {
+        v[i] = _mm512_set1_epi64(h[i]);
+        v[i + 8] = _mm512_set1_epi64(blake2b_IV[i]);
+    }
+    v[12] = _mm512_set1_epi64(blake2b_IV[4] ^ t0);
+    v[14] = _mm512_set1_epi64(~blake2b_IV[6]);
+
+    for (int r = 0; r < 12; r++) {
+        for (int s = 0; s < 8; s++) {
+            __m512i& a = v[blake2b_steps[s][0]];
+            __m512i& b = v[blake2b_steps[s][1]];
+            __m512i& c = v[blake2b_steps[s][2]];
+            __m512i& d = v[blake2b_steps[s][3]];
+            a = _mm512_add_epi64(_mm512_add_epi64(a, b), mv[blake2b_sigma[r][2 * s]]);
+            d = _mm512_ror_epi64(_mm512_xor_si512(d, a), 32);
+            c = _mm512_add_epi64(c, d);
+            b = _mm512_ror_epi64(_mm512_xor_si512(b, c), 24);
+            a = _mm512_add_epi64(_mm512_add_epi64(a, b), mv[blake2b_sigma[r][2 * s + 1]]);
+            d = _mm512_ror_epi64(_mm512_xor_si512(d, a), 16);
+            c = _mm512_add_epi64(c, d);
+            b = _mm512_ror_epi64(_mm512_xor_si512(b, c), 63);
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        __m512i hv = _mm512_xor_si512(_mm512_set1_epi64(h[i]), _mm512_xor_si512(v[i], v[i + 8]));
+        _mm512_storeu_si512((void*)out[i], hv);
+    }
+}
+#endif // BLAKE2B_BATCH_X86
+
+size_t DetectLanes()
+{
+#ifdef BLAKE2B_BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return 8;
+    if (__builtin_cpu_supports("avx2"))
+        return 4;
+#endif
+    return 1;
+}
+
+} // anonymous namespace
+
+size_t CBlake2bBatch::Lanes()
+{
+    static const size_t nLanes = DetectLanes();
+    return nLanes;
+}
+
+CBlake2bBatch::CBlake2bBatch(const crypto_generichash_blake2b_state& base_state, size_t outlenIn) :
+    t0(0), blockLen(0), outlen(outlenIn), fValid(false)
+{
+    SodiumBlake2bState state;
+    memcpy(&state, &base_state, sizeof(state));
+    if (outlen == 0 || outlen > 64 || state.t[1] != 0 || state.f[0] != 0 || state.f[1] != 0 ||
+            state.last_node != 0 || state.buflen > sizeof(state.buf))
+        return;
+
+    memcpy(h, state.h, sizeof(h));
+    t0 = state.t[0];
+    const unsigned char* rest = state.buf;
+    size_t restLen = state.buflen;
+    if (restLen + sizeof(uint32_t) > 128) {
+        // The word needs a block of its own after a full block of buffered bytes,
+        // compressed once here. Bail out if the word would straddle two blocks.
+        if (restLen < 128 || restLen - 128 + sizeof(uint32_t) > 128)
+            return;
+        t0 += 128;
+        Compress(h, state.buf, t0, false);
+        rest += 128;
+        restLen -= 128;
+    }
+    memcpy(block, rest, restLen);
+    memset(block + restLen, 0, sizeof(block) - restLen);
+    blockLen = restLen;
+
+    // Make sure we read the state the way libsodium did
+    crypto_generichash_blake2b_state check = base_state;
+    const uint32_t word = 0;
+    unsigned char expected[64];
+    unsigned char actual[64];
+    crypto_generichash_blake2b_update(&check, (const unsigned char*)&word, sizeof(word));
+    crypto_generichash_blake2b_final(&check, expected, outlen);
+    fValid = true;
+    Finalize(&word, 1, actual);
+    fValid = memcmp(expected, actual, outlen) == 0;
+}
+
+void CBlake2bBatch::Finalize(const uint32_t* words, size_t count, unsigned char* out) const
+{
+    assert(fValid);
+    const uint64_t tLast = t0 + blockLen + sizeof(uint32_t);
+    size_t i = 0;
+
+#ifdef BLAKE2B_BATCH_X86
+    const size_t nLanes = Lanes();
+    const int wordIndex = blockLen / 8;
+    const int nWords = (blockLen % 8) > 4 ? 2 : 1;
+    if (nLanes == 8) {
+        uint64_t m[16][8];
+        uint64_t hv[8][8];
+        for (int j = 0; j < 16; j++)
+            std::fill(m[j], m[j] + 8, ReadLE64(block + 8 * j));
+        for (; i + 8 <= count; i += 8) {
+            for (size_t l = 0; l < 8; l++) {
+                unsigned char tmp[16];
+                memcpy(tmp, block + 8 * wordIndex, sizeof(tmp) - 8 * (2 - nWords));
+                WriteLE32(tmp + blockLen % 8, words[i + l]);
+                for (int j = 0; j < nWords; j++)
+                    m[wordIndex + j][l] = ReadLE64(tmp + 8 * j);
+            }
+            Compress8(h, m, tLast, hv);
+            for (size_t l = 0; l < 8; l++) {
+                uint64_t hl[8];
+                for (int j = 0; j < 8; j++)
+                    hl[j] = hv[j][l];
+                StoreHash(hl, out + (i + l) * outlen, outlen);
+            }
+        }
+    } else if (nLanes == 4) {
+        uint64_t m[16][4];
+        uint64_t hv[8][4];
+        for (int j = 0; j < 16; j++)
+            std::fill(m[j], m[j] + 4, ReadLE64(block + 8 * j));
+        for (; i + 4 <= count; i += 4) {
+            for (size_t l = 0; l < 4; l++) {
+                unsigned char tmp[16];
+                memcpy(tmp, block + 8 * wordIndex, sizeof(tmp) - 8 * (2 - nWords));
+                WriteLE32(tmp + blockLen % 8, words[i + l]);
+                for (int j = 0; j < nWords; j++)
+                    m[wordIndex + j][l] = ReadLE64(tmp + 8 * j);
+            }
+            Compress4(h, m, tLast, hv);
+            for (size_t l = 0; l < 4; l++) {
+                uint64_t hl[8];
+                for (int j = 0; j < 8; j++)
+                    hl[j] = hv[j][l];
+                StoreHash(hl, out + (i + l) * outlen, outlen);
+            }
+        }
+    }
+#endif
+
+    // Whatever is left over, one at a time
+    for (; i < count; i++) {
+        unsigned char last[128];
+        memcpy(last, block, sizeof(last));
+        WriteLE32(last + blockLen, words[i]);
+        uint64_t hl[8];
+        memcpy(hl, h, sizeof(hl));
+        Compress(hl, last, tLast, true);
+        StoreHash(hl, out + i * outlen, outlen);
+    }
+}
@@ -0,0 +1,48 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_BLAKE2B_BATCH_H
+#define BITCOIN_CRYPTO_BLAKE2B_BATCH_H
+
+#include "sodium.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Finalises many copies of one BLAKE2b state, each after absorbing a different
+ * 32-bit little-endian word, as Equihash does for every index it hashes.
+ *
+ * The chaining value and the buffered bytes are read out of the libsodium state
+ * once and the blocks shared by all the copies are compressed once. The final
+ * block is then compressed for 8 or 4 words at a time with AVX-512 or AVX2 when
+ * the CPU supports them, or one at a time otherwise.
+ *
+ * Reading the state relies on the layout of libsodium 1.0.18, which depends
+ * builds. Every batch checks its first hash against libsodium, and IsValid()
+ * is false if they differ, in which case the caller must use libsodium.
+ */
+class CBlake2bBatch
+{
+public:
+    /** Number of words Finalize() handles at once on this CPU */
+    static size_t Lanes();
+
+    CBlake2bBatch(const crypto_generichash_blake2b_state& base_state, size_t outlenIn);
+
+    bool IsValid() const { return fValid; }
+
+    /** Write the hash of base_state followed by words[i] to out + i*outlen, for i < count */
+    void Finalize(const uint32_t* words, size_t count, unsigned char* out) const;
+
+private:
+    uint64_t h[8];
+    uint64_t t0;
+    unsigned char block[128];
+    size_t blockLen;
+    size_t outlen;
+    bool fValid;
+};
+
+#endif // BITCOIN_CRYPTO_BLAKE2B_BATCH_H
@@ -17,17 +17,23 @@
 #endif
 
 #include "compat/endian.h"
+#include "crypto/blake2b_batch.h"
 #include "crypto/equihash.h"
 #include "util.h"
 
 #include <algorithm>
+#include <exception>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
 
 #include <boost/optional.hpp>
 
 EhSolverCancelledException solver_cancelled;
 
+/** Number of consecutive hash outputs the solvers generate at a time */
+static const size_t EH_HASH_BATCH = 64;
+
 template<unsigned int N, unsigned int K>
 int Equihash<N,K>::InitialiseState(eh_HashState& base_state)
 {
@@ -55,6 +61,37 @@ void GenerateHash(const eh_HashState& base_state, eh_index g,
     crypto_generichash_blake2b_final(&state, hash, hLen);
 }
 
+void GenerateHashes(const eh_HashState& base_state, const eh_index* indices, size_t count,
+                    unsigned char* hashes, size_t hLen)
+{
+    CBlake2bBatch batch(base_state, hLen);
+    if (batch.IsValid()) {
+        batch.Finalize(indices, count, hashes);
+    } else {
+        for (size_t i = 0; i < count; i++)
+            GenerateHash(base_state, indices[i], hashes + i*hLen, hLen);
+    }
+}
+
+void GenerateHashes(const eh_HashState& base_state, eh_index g, size_t count,
+                    unsigned char* hashes, size_t hLen)
+{
+    CBlake2bBatch batch(base_state, hLen);
+    eh_index indices[256];
+    for (size_t done = 0; done < count; ) {
+        size_t n = std::min(count - done, sizeof(indices)/sizeof(indices[0]));
+        for (size_t i = 0; i < n; i++)
+            indices[i] = g + done + i;
+        if (batch.IsValid()) {
+            batch.Finalize(indices, n, hashes + done*hLen);
+        } else {
+            for (size_t i = 0; i < n; i++)
+                GenerateHash(base_state, indices[i], hashes + (done+i)*hLen, hLen);
+        }
+        done += n;
+    }
+}
+
 void ExpandArray(const unsigned char* in, size_t in_len,
                  unsigned char* out, size_t out_len,
                  size_t bit_len, size_t byte_pad)
@@ -338,9 +375,11 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
     size_t lenIndices = sizeof(eh_index);
     std::vector<FullStepRow<FullWidth>> X;
     X.reserve(init_size);
-    unsigned char tmpHash[HashOutput];
+    unsigned char tmpHashes[EH_HASH_BATCH * HashOutput];
     for (eh_index g = 0; X.size() < init_size; g++) {
-        GenerateHash(base_state, g, tmpHash, HashOutput);
+        if (g % EH_HASH_BATCH == 0)
+            GenerateHashes(base_state, g, EH_HASH_BATCH, tmpHashes, HashOutput);
+        const unsigned char* tmpHash = tmpHashes + (g % EH_HASH_BATCH) * HashOutput;
         for (eh_index i = 0; i < IndicesPerHashOutput && X.size() < init_size; i++) {
             X.emplace_back(tmpHash+(i*N/8), N/8, HashLength,
                            CollisionBitLength, (g*IndicesPerHashOutput)+i);
@@ -502,7 +541,6 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
                                    const std::function<bool(EhSolverCancelCheck)> cancelled)
 {
     eh_index init_size { 1 << (CollisionBitLength + 1) };
-    eh_index recreate_size { UntruncateIndex(1, 0, CollisionBitLength + 1) };
 
     // First run the algorithm with truncated indices
 
@@ -517,9 +555,11 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         size_t lenIndices = sizeof(eh_trunc);
         std::vector<TruncatedStepRow<TruncatedWidth>> Xt;
         Xt.reserve(init_size);
-        unsigned char tmpHash[HashOutput];
+        unsigned char tmpHashes[EH_HASH_BATCH * HashOutput];
         for (eh_index g = 0; Xt.size() < init_size; g++) {
-            GenerateHash(base_state, g, tmpHash, HashOutput);
+            if (g % EH_HASH_BATCH == 0)
+                GenerateHashes(base_state, g, EH_HASH_BATCH, tmpHashes, HashOutput);
+            const unsigned char* tmpHash = tmpHashes + (g % EH_HASH_BATCH) * HashOutput;
             for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
                 Xt.emplace_back(tmpHash+(i*N/8), N/8, HashLength, CollisionBitLength,
                                 (g*IndicesPerHashOutput)+i, CollisionBitLength + 1);
@@ -633,90 +673,368 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
     LogPrint("pow", "Culling solutions\n");
     for (std::shared_ptr<eh_trunc> partialSoln : partialSolns) {
         std::set<std::vector<unsigned char>> solns;
-        size_t hashLen;
-        size_t lenIndices;
-        unsigned char tmpHash[HashOutput];
-        std::vector<boost::optional<std::vector<FullStepRow<FinalFullWidth>>>> X;
-        X.reserve(K+1);
-
-        // 3) Repeat steps 1 and 2 for each partial index
-        for (eh_index i = 0; i < soln_size; i++) {
-            // 1) Generate first list of possibilities
-            std::vector<FullStepRow<FinalFullWidth>> icv;
-            icv.reserve(recreate_size);
-            for (eh_index j = 0; j < recreate_size; j++) {
-                eh_index newIndex { UntruncateIndex(partialSoln.get()[i], j, CollisionBitLength + 1) };
-                if (j == 0 || newIndex % IndicesPerHashOutput == 0) {
-                    GenerateHash(base_state, newIndex/IndicesPerHashOutput,
-                                 tmpHash, HashOutput);
+        if (!RecreateSolutions(base_state, partialSoln.get(), solns, cancelled)) {
+            invalidCount++;
+            continue;
+        }
+        for (auto soln : solns) {
+            if (validBlock(soln))
+                return true;
+        }
+        if (cancelled(PartialEnd)) throw solver_cancelled;
+    }
+    LogPrint("pow", "- Number of invalid solutions found: %d\n", invalidCount);
+
+    return false;
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::RecreateSolutions(const eh_HashState& base_state, const eh_trunc* partialSoln,
+                                      std::set<std::vector<unsigned char>>& solns,
+                                      const std::function<bool(EhSolverCancelCheck)> cancelled)
+{
+    eh_index recreate_size { UntruncateIndex(1, 0, CollisionBitLength + 1) };
+    const eh_index soln_size { 1 << K };
+    size_t hashLen;
+    size_t lenIndices;
+    std::vector<unsigned char> hashes;
+    std::vector<boost::optional<std::vector<FullStepRow<FinalFullWidth>>>> X;
+    X.reserve(K+1);
+
+    // 3) Repeat steps 1 and 2 for each partial index
+    for (eh_index i = 0; i < soln_size; i++) {
+        // 1) Generate first list of possibilities, whose indices are consecutive
+        const eh_index firstIndex { UntruncateIndex(partialSoln[i], 0, CollisionBitLength + 1) };
+        const eh_index firstHash = firstIndex/IndicesPerHashOutput;
+        const size_t nHashes = (firstIndex + recreate_size - 1)/IndicesPerHashOutput - firstHash + 1;
+        hashes.resize(nHashes * HashOutput);
+        GenerateHashes(base_state, firstHash, nHashes, hashes.data(), HashOutput);
+
+        std::vector<FullStepRow<FinalFullWidth>> icv;
+        icv.reserve(recreate_size);
+        for (eh_index j = 0; j < recreate_size; j++) {
+            eh_index newIndex { UntruncateIndex(partialSoln[i], j, CollisionBitLength + 1) };
+            icv.emplace_back(&hashes[(newIndex/IndicesPerHashOutput - firstHash) * HashOutput] +
+                             ((newIndex % IndicesPerHashOutput) * N/8),
+                             N/8, HashLength, CollisionBitLength, newIndex);
+            if (cancelled(PartialGeneration)) throw solver_cancelled;
+        }
+        boost::optional<std::vector<FullStepRow<FinalFullWidth>>> ic = icv;
+
+        // 2a) For each pair of lists:
+        hashLen = HashLength;
+        lenIndices = sizeof(eh_index);
+        size_t rti = i;
+        for (size_t r = 0; r <= K; r++) {
+            // 2b) Until we are at the top of a subtree:
+            if (r < X.size()) {
+                if (X[r]) {
+                    // 2c) Merge the lists
+                    ic->reserve(ic->size() + X[r]->size());
+                    ic->insert(ic->end(), X[r]->begin(), X[r]->end());
+                    std::sort(ic->begin(), ic->end(), CompareSR(hashLen));
+                    if (cancelled(PartialSorting)) throw solver_cancelled;
+                    size_t lti = rti-(1<<r);
+                    CollideBranches(*ic, hashLen, lenIndices,
+                                    CollisionByteLength,
+                                    CollisionBitLength + 1,
+                                    partialSoln[lti], partialSoln[rti]);
+
+                    // 2d) Check if this has become an invalid solution
+                    if (ic->size() == 0)
+                        return false;
+
+                    X[r] = boost::none;
+                    hashLen -= CollisionByteLength;
+                    lenIndices *= 2;
+                    rti = lti;
+                } else {
+                    X[r] = *ic;
+                    break;
+                }
+            } else {
+                X.push_back(ic);
+                break;
+            }
+            if (cancelled(PartialSubtreeEnd)) throw solver_cancelled;
+        }
+        if (cancelled(PartialIndexEnd)) throw solver_cancelled;
+    }
+
+    // We are at the top of the tree
+    assert(X.size() == K+1);
+    for (FullStepRow<FinalFullWidth> row : *X[K]) {
+        auto soln = row.GetIndices(hashLen, lenIndices, CollisionBitLength);
+        assert(soln.size() == equihash_solution_size(N, K));
+        solns.insert(soln);
+    }
+    return true;
+}
+// Runs f(0), ..., f(nThreads-1) on nThreads threads, the last one being the calling
+// thread, and rethrows the first exception that escaped one of them.
+static void EhParallelFor(unsigned int nThreads, const std::function<void(unsigned int)>& f)
+{
+    std::vector<std::exception_ptr> errors(nThreads);
+    auto run = [&f, &errors](unsigned int t) {
+        try {
+            f(t);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    try {
+        for (unsigned int t = 0; t + 1 < nThreads; t++)
+            threads.emplace_back(run, t);
+    } catch (...) {
+        for (std::thread& thread : threads)
+            thread.join();
+        throw;
+    }
+    run(nThreads - 1);
+    for (std::thread& thread : threads)
+        thread.join();
+    for (std::exception_ptr& error : errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
+
+// Reorders the rows in place so that rows sharing the first nBytes bytes of their
+// hash are contiguous and in ascending order (an MSD radix pass). Returns the start
+// of every bucket followed by the end of the last one.
+template<typename Row>
+static std::vector<size_t> EhBucketSort(std::vector<Row>& rows, size_t nBytes)
+{
+    std::vector<size_t> starts((1 << (8*nBytes)) + 1, 0);
+    for (const Row& row : rows)
+        starts[row.GetPrefix(nBytes) + 1]++;
+    for (size_t b = 1; b < starts.size(); b++)
+        starts[b] += starts[b-1];
+
+    std::vector<size_t> next(starts.begin(), starts.end() - 1);
+    for (size_t b = 0; b < next.size(); b++) {
+        while (next[b] < starts[b+1]) {
+            unsigned int d = rows[next[b]].GetPrefix(nBytes);
+            if (d == b)
+                next[b]++;
+            else
+                std::swap(rows[next[b]], rows[next[d]++]);
+        }
+    }
+    return starts;
+}
+
+// Splits the buckets into nThreads contiguous ranges holding about the same number
+// of rows. Returns the first bucket of every range followed by the number of buckets.
+static std::vector<size_t> EhSplitBuckets(const std::vector<size_t>& starts, unsigned int nThreads)
+{
+    size_t nBuckets = starts.size() - 1;
+    std::vector<size_t> bounds(nThreads + 1, nBuckets);
+    bounds[0] = 0;
+    for (unsigned int t = 1; t < nThreads; t++) {
+        size_t target = starts[nBuckets] * t / nThreads;
+        bounds[t] = std::lower_bound(starts.begin() + bounds[t-1], starts.end() - 1, target) - starts.begin();
+    }
+    return bounds;
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::ParallelSolve(const eh_HashState& base_state,
+                                  const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                  const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                  unsigned int nThreads)
+{
+    nThreads = std::max(nThreads, 1u);
+    eh_index init_size { 1 << (CollisionBitLength + 1) };
+    const eh_index soln_size { 1 << K };
+    // Rows are bucketed on at most two bytes, the rest of the comparison is a sort
+    // within the bucket, which fits in the cache of the thread that owns it.
+    const size_t bucketBytes = std::min<size_t>(CollisionByteLength, 2);
+
+    // First run the algorithm with truncated indices, as OptimisedSolve does
+    std::vector<std::shared_ptr<eh_trunc>> partialSolns;
+    {
+        // 1) Generate first list, hashing in parallel
+        LogPrint("pow", "Generating first list\n");
+        size_t hashLen = HashLength;
+        size_t lenIndices = sizeof(eh_trunc);
+        const eh_index nHashes = (init_size + IndicesPerHashOutput - 1) / IndicesPerHashOutput;
+        std::vector<TruncatedStepRow<TruncatedWidth>> Xt;
+        {
+            std::vector<unsigned char> hashes(nHashes * HashOutput);
+            EhParallelFor(nThreads, [&](unsigned int t) {
+                eh_index g = nHashes * t / nThreads;
+                GenerateHashes(base_state, g, nHashes * (t+1) / nThreads - g, &hashes[g * HashOutput], HashOutput);
+            });
+            if (cancelled(ListGeneration)) throw solver_cancelled;
+
+            Xt.reserve(init_size);
+            for (eh_index g = 0; Xt.size() < init_size; g++) {
+                for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
+                    Xt.emplace_back(&hashes[g * HashOutput] + (i*N/8), N/8, HashLength, CollisionBitLength,
+                                    (g*IndicesPerHashOutput)+i, CollisionBitLength + 1);
                 }
-                icv.emplace_back(tmpHash+((newIndex % IndicesPerHashOutput) * N/8),
-                                 N/8, HashLength, CollisionBitLength, newIndex);
-                if (cancelled(PartialGeneration)) throw solver_cancelled;
             }
-            boost::optional<std::vector<FullStepRow<FinalFullWidth>>> ic = icv;
-
-            // 2a) For each pair of lists:
-            hashLen = HashLength;
-            lenIndices = sizeof(eh_index);
-            size_t rti = i;
-            for (size_t r = 0; r <= K; r++) {
-                // 2b) Until we are at the top of a subtree:
-                if (r < X.size()) {
-                    if (X[r]) {
-                        // 2c) Merge the lists
-                        ic->reserve(ic->size() + X[r]->size());
-                        ic->insert(ic->end(), X[r]->begin(), X[r]->end());
-                        std::sort(ic->begin(), ic->end(), CompareSR(hashLen));
-                        if (cancelled(PartialSorting)) throw solver_cancelled;
-                        size_t lti = rti-(1<<r);
-                        CollideBranches(*ic, hashLen, lenIndices,
-                                        CollisionByteLength,
-                                        CollisionBitLength + 1,
-                                        partialSoln.get()[lti], partialSoln.get()[rti]);
-
-                        // 2d) Check if this has become an invalid solution
-                        if (ic->size() == 0)
-                            goto invalidsolution;
-
-                        X[r] = boost::none;
-                        hashLen -= CollisionByteLength;
-                        lenIndices *= 2;
-                        rti = lti;
-                    } else {
-                        X[r] = *ic;
-                        break;
+        }
+
+        // 3) Repeat step 2 until 2n/(k+1) bits remain
+        for (int r = 1; r < K && Xt.size() > 0; r++) {
+            LogPrint("pow", "Round %d:\n", r);
+            // 2a) Sort the list: bucket the rows, then each thread sorts its own buckets
+            LogPrint("pow", "- Sorting list\n");
+            std::vector<size_t> starts = EhBucketSort(Xt, bucketBytes);
+            std::vector<size_t> bounds = EhSplitBuckets(starts, nThreads);
+            if (cancelled(ListSorting)) throw solver_cancelled;
+
+            // 2b-2d) Each thread finds the collisions within its buckets and stores
+            // the tuples in place in its own range of the table, as OptimisedSolve does
+            LogPrint("pow", "- Finding collisions\n");
+            std::vector<size_t> posFree(nThreads);
+            std::vector<std::vector<TruncatedStepRow<TruncatedWidth>>> overflow(nThreads);
+            EhParallelFor(nThreads, [&](unsigned int t) {
+                const size_t begin = starts[bounds[t]];
+                const size_t end = starts[bounds[t+1]];
+                for (size_t b = bounds[t]; b < bounds[t+1]; b++) {
+                    std::sort(Xt.begin() + starts[b], Xt.begin() + starts[b+1], CompareSR(CollisionByteLength));
+                }
+
+                size_t i = begin;
+                size_t pos = begin;
+                std::vector<TruncatedStepRow<TruncatedWidth>>& Xc = overflow[t];
+                while (i + 1 < end) {
+                    size_t j = 1;
+                    while (i+j < end &&
+                            HasCollision(Xt[i], Xt[i+j], CollisionByteLength)) {
+                        j++;
                     }
-                } else {
-                    X.push_back(ic);
-                    break;
+
+                    for (size_t l = 0; l < j - 1; l++) {
+                        for (size_t m = l + 1; m < j; m++) {
+                            // We truncated, so don't check for distinct indices here
+                            TruncatedStepRow<TruncatedWidth> Xi {Xt[i+l], Xt[i+m],
+                                                                 hashLen, lenIndices,
+                                                                 CollisionByteLength};
+                            if (!(Xi.IsZero(hashLen-CollisionByteLength) &&
+                                  IsProbablyDuplicate<soln_size>(Xi.GetTruncatedIndices(hashLen-CollisionByteLength, 2*lenIndices),
+                                                                 2*lenIndices))) {
+                                Xc.emplace_back(Xi);
+                            }
+                        }
+                    }
+
+                    while (pos < i+j && Xc.size() > 0) {
+                        Xt[pos++] = Xc.back();
+                        Xc.pop_back();
+                    }
+
+                    i += j;
+                    if (cancelled(ListColliding)) throw solver_cancelled;
+                }
+                // A final row without collision frees its slot as well
+                while (pos < end && Xc.size() > 0) {
+                    Xt[pos++] = Xc.back();
+                    Xc.pop_back();
                 }
-                if (cancelled(PartialSubtreeEnd)) throw solver_cancelled;
+                posFree[t] = pos;
+            });
+
+            // 2e-2g) Close the gaps between the ranges and add the overflow at the end
+            size_t posOut = 0;
+            for (unsigned int t = 0; t < nThreads; t++) {
+                for (size_t p = starts[bounds[t]]; p < posFree[t]; p++, posOut++) {
+                    if (p != posOut)
+                        Xt[posOut] = Xt[p];
+                }
+            }
+            Xt.erase(Xt.begin() + posOut, Xt.end());
+            for (unsigned int t = 0; t < nThreads; t++) {
+                Xt.insert(Xt.end(), overflow[t].begin(), overflow[t].end());
+                std::vector<TruncatedStepRow<TruncatedWidth>>().swap(overflow[t]);
             }
-            if (cancelled(PartialIndexEnd)) throw solver_cancelled;
+            Xt.shrink_to_fit();
+
+            hashLen -= CollisionByteLength;
+            lenIndices *= 2;
+            if (cancelled(RoundEnd)) throw solver_cancelled;
+        }
+
+        // k+1) Find a collision on last 2n(k+1) bits
+        LogPrint("pow", "Final round:\n");
+        if (Xt.size() > 1) {
+            LogPrint("pow", "- Sorting list\n");
+            std::vector<size_t> starts = EhBucketSort(Xt, std::min<size_t>(hashLen, 2));
+            std::vector<size_t> bounds = EhSplitBuckets(starts, nThreads);
+            if (cancelled(FinalSorting)) throw solver_cancelled;
+            LogPrint("pow", "- Finding collisions\n");
+            std::vector<std::vector<std::shared_ptr<eh_trunc>>> found(nThreads);
+            EhParallelFor(nThreads, [&](unsigned int t) {
+                const size_t end = starts[bounds[t+1]];
+                for (size_t b = bounds[t]; b < bounds[t+1]; b++) {
+                    std::sort(Xt.begin() + starts[b], Xt.begin() + starts[b+1], CompareSR(hashLen));
+                }
+
+                size_t i = starts[bounds[t]];
+                while (i + 1 < end) {
+                    size_t j = 1;
+                    while (i+j < end &&
+                            HasCollision(Xt[i], Xt[i+j], hashLen)) {
+                        j++;
+                    }
+
+                    for (size_t l = 0; l < j - 1; l++) {
+                        for (size_t m = l + 1; m < j; m++) {
+                            TruncatedStepRow<FinalTruncatedWidth> res(Xt[i+l], Xt[i+m],
+                                                                      hashLen, lenIndices, 0);
+                            auto soln = res.GetTruncatedIndices(hashLen, 2*lenIndices);
+                            if (!IsProbablyDuplicate<soln_size>(soln, 2*lenIndices)) {
+                                found[t].push_back(soln);
+                            }
+                        }
+                    }
+
+                    i += j;
+                    if (cancelled(FinalColliding)) throw solver_cancelled;
+                }
+            });
+            for (unsigned int t = 0; t < nThreads; t++)
+                partialSolns.insert(partialSolns.end(), found[t].begin(), found[t].end());
+        } else
+            LogPrint("pow", "- List is empty\n");
+
+    } // Ensure Xt goes out of scope and is destroyed
+
+    LogPrint("pow", "Found %d partial solutions\n", partialSolns.size());
+
+    // Recreate the indices of the partial solutions in parallel, but hand the
+    // solutions to validBlock from this thread and in order
+    LogPrint("pow", "Culling solutions\n");
+    std::vector<std::set<std::vector<unsigned char>>> solns(partialSolns.size());
+    std::vector<char> valid(partialSolns.size(), 0);
+    EhParallelFor(nThreads, [&](unsigned int t) {
+        for (size_t s = t; s < partialSolns.size(); s += nThreads) {
+            valid[s] = RecreateSolutions(base_state, partialSolns[s].get(), solns[s], cancelled);
         }
+    });
 
-        // We are at the top of the tree
-        assert(X.size() == K+1);
-        for (FullStepRow<FinalFullWidth> row : *X[K]) {
-            auto soln = row.GetIndices(hashLen, lenIndices, CollisionBitLength);
-            assert(soln.size() == equihash_solution_size(N, K));
-            solns.insert(soln);
+    int invalidCount = 0;
+    for (size_t s = 0; s < partialSolns.size(); s++) {
+        if (!valid[s]) {
+            invalidCount++;
+            continue;
         }
-        for (auto soln : solns) {
+        for (auto soln : solns[s]) {
             if (validBlock(soln))
                 return true;
         }
         if (cancelled(PartialEnd)) throw solver_cancelled;
-        continue;
-
-invalidsolution:
-        invalidCount++;
     }
     LogPrint("pow", "- Number of invalid solutions found: %d\n", invalidCount);
 
     return false;
 }
+
 #endif // ENABLE_MINING
 
 template<unsigned int N, unsigned int K>
@@ -728,43 +1046,65 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
-    std::vector<FullStepRow<FinalFullWidth>> X;
-    X.reserve(1 << K);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
-                       N/8, HashLength, CollisionBitLength, i);
+    const size_t nIndices = 1 << K;
+    std::vector<eh_index> indices = GetIndicesFromMinimal(soln, CollisionBitLength);
+    assert(indices.size() == nIndices);
+
+    {
+        std::vector<eh_index> sorted(indices);
+        std::sort(sorted.begin(), sorted.end());
+        if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+            LogPrint("pow", "Invalid solution: duplicate indices\n");
+            return false;
+        }
     }
 
-    size_t hashLen = HashLength;
-    size_t lenIndices = sizeof(eh_index);
-    while (X.size() > 1) {
-        std::vector<FullStepRow<FinalFullWidth>> Xc;
-        for (int i = 0; i < X.size(); i += 2) {
-            if (!HasCollision(X[i], X[i+1], CollisionByteLength)) {
-                LogPrint("pow", "Invalid solution: invalid collision length between StepRows\n");
-                LogPrint("pow", "X[i]   = %s\n", X[i].GetHex(hashLen));
-                LogPrint("pow", "X[i+1] = %s\n", X[i+1].GetHex(hashLen));
-                return false;
-            }
-            if (X[i+1].IndicesBefore(X[i], hashLen, lenIndices)) {
+    eh_index hashIndices[nIndices];
+    unsigned char hashes[nIndices * HashOutput];
+    for (size_t i = 0; i < nIndices; i++)
+        hashIndices[i] = indices[i]/IndicesPerHashOutput;
+    GenerateHashes(base_state, hashIndices, nIndices, hashes, HashOutput);
+
+    // Instead of building a row with the hash and the indices of every subtree,
+    // keep one expanded hash per leaf, padded to whole words, and xor the right
+    // subtree into the left one level after level. The sizes are known at compile
+    // time, so the xors are unrolled and vectorised.
+    enum : size_t { RowWords = (HashLength + 7) / 8 };
+    uint64_t rows[nIndices][RowWords];
+    for (size_t i = 0; i < nIndices; i++) {
+        memset(rows[i], 0, sizeof(rows[i]));
+        ExpandArray(hashes + i*HashOutput + (indices[i] % IndicesPerHashOutput) * N/8, N/8,
+                    (unsigned char*)rows[i], HashLength, CollisionBitLength);
+    }
+
+    for (size_t r = 0; r < K; r++) {
+        const size_t step = 1 << r;
+        for (size_t i = 0; i < nIndices; i += 2*step) {
+            // The first index of a subtree is its smallest one, and the indices are distinct
+            if (indices[i+step] < indices[i]) {
                 LogPrint("pow", "Invalid solution: Index tree incorrectly ordered\n");
                 return false;
             }
-            if (!DistinctIndices(X[i], X[i+1], hashLen, lenIndices)) {
-                LogPrint("pow", "Invalid solution: duplicate indices\n");
-                return false;
+            uint64_t* left = rows[i];
+            const uint64_t* right = rows[i+step];
+            for (size_t w = 0; w < RowWords; w++)
+                left[w] ^= right[w];
+            const unsigned char* collision = (const unsigned char*)left + r*CollisionByteLength;
+            for (size_t b = 0; b < CollisionByteLength; b++) {
+                if (collision[b] != 0) {
+                    LogPrint("pow", "Invalid solution: invalid collision length between StepRows\n");
+                    return false;
+                }
             }
-            Xc.emplace_back(X[i], X[i+1], hashLen, lenIndices, CollisionByteLength);
         }
-        X = Xc;
-        hashLen -= CollisionByteLength;
-        lenIndices *= 2;
     }
 
-    assert(X.size() == 1);
-    return X[0].IsZero(hashLen);
+    const unsigned char* rest = (const unsigned char*)rows[0] + K*CollisionByteLength;
+    for (size_t b = 0; b < HashLength - K*CollisionByteLength; b++) {
+        if (rest[b] != 0)
+            return false;
+    }
+    return true;
 }
 
 // Explicit instantiations for Equihash<96,3>
@@ -776,6 +1116,10 @@ template bool Equihash<96,3>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<96,3>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<96,3>::ParallelSolve(const eh_HashState& base_state,
+                                            const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                            const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                            unsigned int nThreads);
 #endif
 template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 
@@ -788,6 +1132,10 @@ template bool Equihash<200,9>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<200,9>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(std::vector<unsigned char>)> validBlock,
                                               const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<200,9>::ParallelSolve(const eh_HashState& base_state,
+                                             const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                             const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                             unsigned int nThreads);
 #endif
 template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 
@@ -800,6 +1148,10 @@ template bool Equihash<96,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<96,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<96,5>::ParallelSolve(const eh_HashState& base_state,
+                                            const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                            const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                            unsigned int nThreads);
 #endif
 template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 
@@ -812,5 +1164,9 @@ template bool Equihash<48,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
+template bool Equihash<48,5>::ParallelSolve(const eh_HashState& base_state,
+                                            const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                            const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                            unsigned int nThreads);
 #endif
 template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
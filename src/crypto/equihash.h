@@ -59,6 +59,13 @@ public:
 
     bool IsZero(size_t len);
     std::string GetHex(size_t len) { return HexStr(hash, hash+len); }
+    /** The first len (at most 4) bytes of the hash as a big-endian number, which orders like the rows */
+    unsigned int GetPrefix(size_t len) const {
+        unsigned int prefix = 0;
+        for (size_t i = 0; i < len; i++)
+            prefix = (prefix << 8) | hash[i];
+        return prefix;
+    }
 
     template<size_t W>
     friend bool HasCollision(StepRow<W>& a, StepRow<W>& b, int l);
@@ -167,6 +174,12 @@ private:
     BOOST_STATIC_ASSERT(N % 8 == 0);
     BOOST_STATIC_ASSERT((N/(K+1)) + 1 < 8*sizeof(eh_index));
 
+#ifdef ENABLE_MINING
+    bool RecreateSolutions(const eh_HashState& base_state, const eh_trunc* partialSoln,
+                           std::set<std::vector<unsigned char>>& solns,
+                           const std::function<bool(EhSolverCancelCheck)> cancelled);
+#endif
+
 public:
     enum : size_t { IndicesPerHashOutput=512/N };
     enum : size_t { HashOutput=IndicesPerHashOutput*N/8 };
@@ -189,6 +202,15 @@ public:
     bool OptimisedSolve(const eh_HashState& base_state,
                         const std::function<bool(std::vector<unsigned char>)> validBlock,
                         const std::function<bool(EhSolverCancelCheck)> cancelled);
+    /**
+     * Same algorithm as OptimisedSolve, with every round split over nThreads threads:
+     * the rows are bucketed in place on their leading bytes and each thread sorts and
+     * collides a contiguous range of buckets. cancelled is called from all the threads.
+     */
+    bool ParallelSolve(const eh_HashState& base_state,
+                       const std::function<bool(std::vector<unsigned char>)> validBlock,
+                       const std::function<bool(EhSolverCancelCheck)> cancelled,
+                       unsigned int nThreads);
 #endif
     bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
 };
@@ -261,6 +283,32 @@ inline bool EhOptimisedSolveUncancellable(unsigned int n, unsigned int k, const
     return EhOptimisedSolve(n, k, base_state, validBlock,
                             [](EhSolverCancelCheck pos) { return false; });
 }
+
+inline bool EhParallelSolve(unsigned int n, unsigned int k, const eh_HashState& base_state,
+                    const std::function<bool(std::vector<unsigned char>)> validBlock,
+                    const std::function<bool(EhSolverCancelCheck)> cancelled,
+                    unsigned int nThreads)
+{
+    if (n == 96 && k == 3) {
+        return Eh96_3.ParallelSolve(base_state, validBlock, cancelled, nThreads);
+    } else if (n == 200 && k == 9) {
+        return Eh200_9.ParallelSolve(base_state, validBlock, cancelled, nThreads);
+    } else if (n == 96 && k == 5) {
+        return Eh96_5.ParallelSolve(base_state, validBlock, cancelled, nThreads);
+    } else if (n == 48 && k == 5) {
+        return Eh48_5.ParallelSolve(base_state, validBlock, cancelled, nThreads);
+    } else {
+        throw std::invalid_argument("Unsupported Equihash parameters");
+    }
+}
+
+inline bool EhParallelSolveUncancellable(unsigned int n, unsigned int k, const eh_HashState& base_state,
+                    const std::function<bool(std::vector<unsigned char>)> validBlock,
+                    unsigned int nThreads)
+{
+    return EhParallelSolve(n, k, base_state, validBlock,
+                           [](EhSolverCancelCheck pos) { return false; }, nThreads);
+}
 #endif // ENABLE_MINING
 
 #define EhIsValidSolution(n, k, base_state, soln, ret)   \
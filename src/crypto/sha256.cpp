@@ -9,6 +9,12 @@
 #include <string.h>
 #include <stdexcept>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SHA256_BATCH_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -128,6 +134,369 @@ void Transform(uint32_t* s, const unsigned char* chunk)
     s[7] += h;
 }
 
+void TransformGeneric(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    for (size_t i = 0; i < blocks; i++)
+        Transform(s, chunk + 64 * i);
+}
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/** The second block of the hash of a 64-byte message: its padding and length */
+const unsigned char PAD64[64] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0
+};
+
+/** The padding and length after the 32-byte first hash of a double hash */
+const unsigned char PAD32[32] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0
+};
+
+void Compress64Generic(unsigned char* out, const unsigned char* in, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t s[8];
+        Initialize(s);
+        Transform(s, in + 64 * i);
+        for (int j = 0; j < 8; j++)
+            WriteBE32(out + 32 * i + 4 * j, s[j]);
+    }
+}
+
+/** Double hash of 64-byte messages with a transform of a single state */
+template <void TransformFn(uint32_t*, const unsigned char*, size_t)>
+void D64Single(unsigned char* out, const unsigned char* in, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t s[8];
+        Initialize(s);
+        TransformFn(s, in + 64 * i, 1);
+        TransformFn(s, PAD64, 1);
+        unsigned char block[64];
+        for (int j = 0; j < 8; j++)
+            WriteBE32(block + 4 * j, s[j]);
+        memcpy(block + 32, PAD32, 32);
+        Initialize(s);
+        TransformFn(s, block, 1);
+        for (int j = 0; j < 8; j++)
+            WriteBE32(out + 32 * i + 4 * j, s[j]);
+    }
+}
+
+#ifdef SHA256_BATCH_X86
+// The vector versions are compiled for their instruction set whatever the
+// build flags and only called when the CPU supports it. SSE2 is part of
+// x86-64, so the 4-way version needs no check.
+
+__attribute__((target("sha,sse4.1")))
+void TransformSHANI(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The state as ABEF and CDGH, the order of the SHA instructions
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)s), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(s + 4)), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (size_t b = 0; b < blocks; b++, chunk += 64) {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+        __m128i w[16];
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16 * i)), MASK);
+            } else {
+                // sigma0 of the words 15 back and the words 16 back, the words 7 back, then sigma1 of the words 2 back
+                __m128i t = _mm_add_epi32(_mm_sha256msg1_epu32(w[i - 4], w[i - 3]), _mm_alignr_epi8(w[i - 1], w[i - 2], 4));
+                w[i] = _mm_sha256msg2_epu32(t, w[i - 1]);
+            }
+            __m128i msg = _mm_add_epi32(w[i], _mm_loadu_si128((const __m128i*)(K + 4 * i)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    // Back to ABCD and EFGH
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)s, _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)(s + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+
+__attribute__((target("sha,sse4.1")))
+void Compress64SHANI(unsigned char* out, const unsigned char* in, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t s[8];
+        Initialize(s);
+        TransformSHANI(s, in + 64 * i, 1);
+        for (int j = 0; j < 8; j++)
+            WriteBE32(out + 32 * i + 4 * j, s[j]);
+    }
+}
+
+// The multi-way versions run the rounds of SHA-256 on vectors holding the same
+// word of 4 or 8 independent states, in the order of the rotating registers of
+// Transform.
+
+inline __m128i Rotr4(__m128i x, int n)
+{
+    return _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n));
+}
+
+void Rounds4(__m128i v[8], __m128i w[16])
+{
+    for (int r = 0; r < 64; r++) {
+        __m128i wr;
+        if (r < 16) {
+            wr = w[r];
+        } else {
+            __m128i w15 = w[(r - 15) & 15];
+            __m128i w2 = w[(r - 2) & 15];
+            __m128i s0 = _mm_xor_si128(_mm_xor_si128(Rotr4(w15, 7), Rotr4(w15, 18)), _mm_srli_epi32(w15, 3));
+            __m128i s1 = _mm_xor_si128(_mm_xor_si128(Rotr4(w2, 17), Rotr4(w2, 19)), _mm_srli_epi32(w2, 10));
+            wr = _mm_add_epi32(_mm_add_epi32(w[r & 15], s0), _mm_add_epi32(w[(r - 7) & 15], s1));
+            w[r & 15] = wr;
+        }
+        const __m128i a = v[(64 - r) & 7], b = v[(65 - r) & 7], c = v[(66 - r) & 7];
+        const __m128i e = v[(68 - r) & 7], f = v[(69 - r) & 7], g = v[(70 - r) & 7];
+        __m128i& d = v[(67 - r) & 7];
+        __m128i& h = v[(71 - r) & 7];
+        __m128i S1 = _mm_xor_si128(_mm_xor_si128(Rotr4(e, 6), Rotr4(e, 11)), Rotr4(e, 25));
+        __m128i ch = _mm_xor_si128(g, _mm_and_si128(e, _mm_xor_si128(f, g)));
+        __m128i t1 = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(h, S1), _mm_add_epi32(ch, wr)), _mm_set1_epi32(K[r]));
+        __m128i S0 = _mm_xor_si128(_mm_xor_si128(Rotr4(a, 2), Rotr4(a, 13)), Rotr4(a, 22));
+        __m128i maj = _mm_or_si128(_mm_and_si128(a, b), _mm_and_si128(c, _mm_or_si128(a, b)));
+        d = _mm_add_epi32(d, t1);
+        h = _mm_add_epi32(t1, _mm_add_epi32(S0, maj));
+    }
+}
+
+__attribute__((target("avx2")))
+inline __m256i Rotr8(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+__attribute__((target("avx2")))
+void Rounds8(__m256i v[8], __m256i w[16])
+{
+    for (int r = 0; r < 64; r++) {
+        __m256i wr;
+        if (r < 16) {
+            wr = w[r];
+        } else {
+            __m256i w15 = w[(r - 15) & 15];
+            __m256i w2 = w[(r - 2) & 15];
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(Rotr8(w15, 7), Rotr8(w15, 18)), _mm256_srli_epi32(w15, 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(Rotr8(w2, 17), Rotr8(w2, 19)), _mm256_srli_epi32(w2, 10));
+            wr = _mm256_add_epi32(_mm256_add_epi32(w[r & 15], s0), _mm256_add_epi32(w[(r - 7) & 15], s1));
+            w[r & 15] = wr;
+        }
+        const __m256i a = v[(64 - r) & 7], b = v[(65 - r) & 7], c = v[(66 - r) & 7];
+        const __m256i e = v[(68 - r) & 7], f = v[(69 - r) & 7], g = v[(70 - r) & 7];
+        __m256i& d = v[(67 - r) & 7];
+        __m256i& h = v[(71 - r) & 7];
+        __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(Rotr8(e, 6), Rotr8(e, 11)), Rotr8(e, 25));
+        __m256i ch = _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g)));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(h, S1), _mm256_add_epi32(ch, wr)), _mm256_set1_epi32(K[r]));
+        __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(Rotr8(a, 2), Rotr8(a, 13)), Rotr8(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        d = _mm256_add_epi32(d, t1);
+        h = _mm256_add_epi32(t1, _mm256_add_epi32(S0, maj));
+    }
+}
+
+/**
+ * Compress the words m of 4 blocks, word j of block l at m[j][l], from the
+ * states s, in the same layout, feeding the states forward.
+ */
+void TransformLanes4(uint32_t s[8][4], const uint32_t m[16][4])
+{
+    __m128i v[8], w[16], init[8];
+    for (int j = 0; j < 16; j++)
+        w[j] = _mm_loadu_si128((const __m128i*)m[j]);
+    for (int i = 0; i < 8; i++)
+        v[i] = init[i] = _mm_loadu_si128((const __m128i*)s[i]);
+    Rounds4(v, w);
+    for (int i = 0; i < 8; i++)
+        _mm_storeu_si128((__m128i*)s[i], _mm_add_epi32(v[i], init[i]));
+}
+
+__attribute__((target("avx2")))
+void TransformLanes8(uint32_t s[8][8], const uint32_t m[16][8])
+{
+    __m256i v[8], w[16], init[8];
+    for (int j = 0; j < 16; j++)
+        w[j] = _mm256_loadu_si256((const __m256i*)m[j]);
+    for (int i = 0; i < 8; i++)
+        v[i] = init[i] = _mm256_loadu_si256((const __m256i*)s[i]);
+    Rounds8(v, w);
+    for (int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i*)s[i], _mm256_add_epi32(v[i], init[i]));
+}
+
+/** The number of lanes and the transform of the 4 and 8-way versions, for the shared code below */
+struct Lanes4
+{
+    static const int N = 4;
+    static void Transform(uint32_t s[8][4], const uint32_t m[16][4]) { TransformLanes4(s, m); }
+};
+
+struct Lanes8
+{
+    static const int N = 8;
+    static void Transform(uint32_t s[8][8], const uint32_t m[16][8]) { TransformLanes8(s, m); }
+};
+
+template <typename L>
+inline void InitializeLanes(uint32_t s[8][L::N])
+{
+    uint32_t iv[8];
+    Initialize(iv);
+    for (int i = 0; i < 8; i++)
+        for (int l = 0; l < L::N; l++)
+            s[i][l] = iv[i];
+}
+
+template <typename L>
+inline void StoreLanes(unsigned char* out, const uint32_t s[8][L::N])
+{
+    for (int l = 0; l < L::N; l++)
+        for (int i = 0; i < 8; i++)
+            WriteBE32(out + 32 * l + 4 * i, s[i][l]);
+}
+
+template <typename L>
+inline void Compress64Lanes(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8][L::N], m[16][L::N];
+    for (int l = 0; l < L::N; l++)
+        for (int j = 0; j < 16; j++)
+            m[j][l] = ReadBE32(in + 64 * l + 4 * j);
+    InitializeLanes<L>(s);
+    L::Transform(s, m);
+    StoreLanes<L>(out, s);
+}
+
+template <typename L>
+inline void D64Lanes(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8][L::N], m[16][L::N];
+    for (int l = 0; l < L::N; l++)
+        for (int j = 0; j < 16; j++)
+            m[j][l] = ReadBE32(in + 64 * l + 4 * j);
+    InitializeLanes<L>(s);
+    L::Transform(s, m);
+    for (int j = 0; j < 16; j++)
+        for (int l = 0; l < L::N; l++)
+            m[j][l] = ReadBE32(PAD64 + 4 * j);
+    L::Transform(s, m);
+
+    // The second hash, of the first one
+    for (int j = 0; j < 16; j++)
+        for (int l = 0; l < L::N; l++)
+            m[j][l] = j < 8 ? s[j][l] : ReadBE32(PAD32 + 4 * (j - 8));
+    InitializeLanes<L>(s);
+    L::Transform(s, m);
+    StoreLanes<L>(out, s);
+}
+
+template <void Lanes8Fn(unsigned char*, const unsigned char*), void Lanes4Fn(unsigned char*, const unsigned char*),
+          void SingleFn(unsigned char*, const unsigned char*, size_t)>
+void MultiWay(unsigned char* out, const unsigned char* in, size_t count, bool f8way)
+{
+    size_t i = 0;
+    if (f8way) {
+        for (; i + 8 <= count; i += 8)
+            Lanes8Fn(out + 32 * i, in + 64 * i);
+    }
+    for (; i + 4 <= count; i += 4)
+        Lanes4Fn(out + 32 * i, in + 64 * i);
+    SingleFn(out + 32 * i, in + 64 * i, count - i);
+}
+
+void Compress64Lanes8(unsigned char* out, const unsigned char* in) { Compress64Lanes<Lanes8>(out, in); }
+void Compress64Lanes4(unsigned char* out, const unsigned char* in) { Compress64Lanes<Lanes4>(out, in); }
+void D64Lanes8(unsigned char* out, const unsigned char* in) { D64Lanes<Lanes8>(out, in); }
+void D64Lanes4(unsigned char* out, const unsigned char* in) { D64Lanes<Lanes4>(out, in); }
+
+void Compress64AVX2(unsigned char* out, const unsigned char* in, size_t count)
+{
+    MultiWay<Compress64Lanes8, Compress64Lanes4, Compress64Generic>(out, in, count, true);
+}
+void Compress64SSE2(unsigned char* out, const unsigned char* in, size_t count)
+{
+    MultiWay<Compress64Lanes8, Compress64Lanes4, Compress64Generic>(out, in, count, false);
+}
+void D64AVX2(unsigned char* out, const unsigned char* in, size_t count)
+{
+    MultiWay<D64Lanes8, D64Lanes4, D64Single<TransformGeneric> >(out, in, count, true);
+}
+void D64SSE2(unsigned char* out, const unsigned char* in, size_t count)
+{
+    MultiWay<D64Lanes8, D64Lanes4, D64Single<TransformGeneric> >(out, in, count, false);
+}
+
+bool CPUHasSHANI()
+{
+    unsigned int eax, ebx, ecx, edx;
+    return __builtin_cpu_supports("sse4.1") && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 29));
+}
+#endif // SHA256_BATCH_X86
+
+typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
+typedef void (*MultiType)(unsigned char*, const unsigned char*, size_t);
+
+// The implementations in use, the scalar ones until SHA256AutoDetect
+TransformType TransformBlocks = TransformGeneric;
+MultiType Compress64 = Compress64Generic;
+MultiType D64 = D64Single<TransformGeneric>;
+
+/** Check the implementations in use against the scalar ones */
+bool SelfTest()
+{
+    // Blocks of every kind the multi-way versions split a run into
+    static const size_t COUNT = 15;
+    unsigned char in[64 * COUNT];
+    for (size_t i = 0; i < sizeof(in); i++)
+        in[i] = (i * 131 + 7) & 0xff;
+
+    uint32_t s[8], expected[8];
+    Initialize(s);
+    Initialize(expected);
+    TransformBlocks(s, in, COUNT);
+    TransformGeneric(expected, in, COUNT);
+    if (memcmp(s, expected, sizeof(s)) != 0)
+        return false;
+
+    unsigned char out[32 * COUNT], outExpected[32 * COUNT];
+    Compress64(out, in, COUNT);
+    Compress64Generic(outExpected, in, COUNT);
+    if (memcmp(out, outExpected, sizeof(out)) != 0)
+        return false;
+
+    D64(out, in, COUNT);
+    D64Single<TransformGeneric>(outExpected, in, COUNT);
+    return memcmp(out, outExpected, sizeof(out)) == 0;
+}
+
 } // namespace sha256
 } // namespace
 
@@ -148,14 +517,15 @@ CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
         memcpy(buf + bufsize, data, 64 - bufsize);
         bytes += 64 - bufsize;
         data += 64 - bufsize;
-        sha256::Transform(s, buf);
+        sha256::TransformBlocks(s, buf, 1);
         bufsize = 0;
     }
-    while (end >= data + 64) {
+    if (end >= data + 64) {
         // Process full chunks directly from the source.
-        sha256::Transform(s, data);
-        bytes += 64;
-        data += 64;
+        size_t blocks = (end - data) / 64;
+        sha256::TransformBlocks(s, data, blocks);
+        bytes += 64 * blocks;
+        data += 64 * blocks;
     }
     if (end > data) {
         // Fill the buffer with what remains.
@@ -197,3 +567,43 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+std::string SHA256AutoDetect()
+{
+    std::string ret = "standard";
+#ifdef SHA256_BATCH_X86
+    __builtin_cpu_init();
+    if (sha256::CPUHasSHANI()) {
+        sha256::TransformBlocks = sha256::TransformSHANI;
+        sha256::Compress64 = sha256::Compress64SHANI;
+        sha256::D64 = sha256::D64Single<sha256::TransformSHANI>;
+        ret = "shani(1way)";
+    } else if (__builtin_cpu_supports("avx2")) {
+        sha256::Compress64 = sha256::Compress64AVX2;
+        sha256::D64 = sha256::D64AVX2;
+        ret = "standard,sse2(4way),avx2(8way)";
+    } else {
+        sha256::Compress64 = sha256::Compress64SSE2;
+        sha256::D64 = sha256::D64SSE2;
+        ret = "standard,sse2(4way)";
+    }
+#endif
+
+    if (!sha256::SelfTest()) {
+        sha256::TransformBlocks = sha256::TransformGeneric;
+        sha256::Compress64 = sha256::Compress64Generic;
+        sha256::D64 = sha256::D64Single<sha256::TransformGeneric>;
+        ret = "standard, the faster ones failing their self-test";
+    }
+    return ret;
+}
+
+void SHA256Compress64(unsigned char* out, const unsigned char* in, size_t count)
+{
+    sha256::Compress64(out, in, count);
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t count)
+{
+    sha256::D64(out, in, count);
+}
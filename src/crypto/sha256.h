@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -29,4 +30,26 @@ private:
     void FinalizeNoPadding(unsigned char hash[OUTPUT_SIZE], bool enforce_compression);
 };
 
+/**
+ * Compress each of count 64-byte blocks of in from the initial SHA-256 state,
+ * without padding, as SHA256Compress does, to the 32 bytes at out + 32*i. The
+ * blocks are compressed with the implementation SHA256AutoDetect chose.
+ */
+void SHA256Compress64(unsigned char* out, const unsigned char* in, size_t count);
+
+/**
+ * Double SHA-256 each of count 64-byte blocks of in, as Hash of the block does,
+ * to the 32 bytes at out + 32*i: the pairs of the levels of a merkle tree.
+ * out may be in, to hash a level over the one below it.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t count);
+
+/**
+ * Choose the fastest SHA-256 implementations the CPU supports, the SHA
+ * extensions or 4 and 8 blocks at a time with SSE2 and AVX2, after checking them
+ * against the standard one, and return their name. The standard implementation
+ * is used until it is called, and when the faster ones fail their check.
+ */
+std::string SHA256AutoDetect();
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -60,7 +60,7 @@ TEST(CheckBlock, BlockRejectsBadVersion) {
     CBlock block;
     // explicitly set to minimum, otherwise a preliminary check will fail
     block.nVersion = MIN_BLOCK_VERSION;
-    block.vtx.push_back(tx);
+    block.vtx.push_back(MakeTransactionRef(tx));
 
     MockCValidationState state;
 
@@ -127,7 +127,7 @@ TEST(CheckBlock, BlockRejectsNoCbh) {
     mtx_cb.vout[0].scriptPubKey = CScript() << OP_TRUE;
     mtx_cb.vout[0].nValue = 0;
 
-    block.vtx.push_back(mtx_cb);
+    block.vtx.push_back(MakeTransactionRef(mtx_cb));
 
     // build the tx with the bad script
     CMutableTransaction mtx;
@@ -147,7 +147,7 @@ TEST(CheckBlock, BlockRejectsNoCbh) {
 
     mtx.vout.push_back( CTxOut(0.5, scriptPubKey));
 
-    block.vtx.push_back(mtx);
+    block.vtx.push_back(MakeTransactionRef(mtx));
 
     MockCValidationState state;
 
@@ -201,7 +201,7 @@ protected:
     void ExpectValidBlockFromTx(const CTransaction& tx, const int height) {
         // Create a block and add the transaction to it.
         CBlock block;
-        block.vtx.push_back(tx);
+        block.vtx.push_back(MakeTransactionRef(tx));
 
         // Set the previous block index with the passed heigth
         CBlock prev;
@@ -221,7 +221,7 @@ protected:
     {
         // Create a block and add the transaction to it.
         CBlock block;
-        block.vtx.push_back(tx);
+        block.vtx.push_back(MakeTransactionRef(tx));
 
         // Set the previous block index with the passed heigth
         CBlock prev;
@@ -251,7 +251,7 @@ TEST_F(ContextualCheckBlockTest, BadCoinbaseHeight) {
     mtx.vout[0].nValue = 0;
 
     CBlock block;
-    block.vtx.push_back(mtx);
+    block.vtx.push_back(MakeTransactionRef(mtx));
 
     // Treating block as genesis (no prev blocks) should pass
     MockCValidationState state;
@@ -259,7 +259,7 @@ TEST_F(ContextualCheckBlockTest, BadCoinbaseHeight) {
 
     // Treating block as non-genesis (a prev block with height=0) should fail
     CTransaction tx2 {mtx};
-    block.vtx[0] = tx2;
+    block.vtx[0] = MakeTransactionRef(tx2);
     CBlock prev;
     CBlockIndex indexPrev {prev};
     indexPrev.nHeight = 0;
@@ -269,14 +269,14 @@ TEST_F(ContextualCheckBlockTest, BadCoinbaseHeight) {
     // Setting to an incorrect height should fail
     mtx.vin[0].scriptSig = CScript() << 2 << OP_0;
     CTransaction tx3 {mtx};
-    block.vtx[0] = tx3;
+    block.vtx[0] = MakeTransactionRef(tx3);
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-cb-height", false)).Times(1);
     EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
 
     // After correcting the scriptSig, should pass
     mtx.vin[0].scriptSig = CScript() << 1 << OP_0;
     CTransaction tx4 {mtx};
-    block.vtx[0] = tx4;
+    block.vtx[0] = MakeTransactionRef(tx4);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 }
 
@@ -351,7 +351,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
     mtx.vout[0].nValue = 0;
     CTransaction tx{mtx};
     CBlock block;
-    block.vtx.push_back(tx);
+    block.vtx.push_back(MakeTransactionRef(tx));
     block.nTime = chainsplitFork.getMinimumTime(CBaseChainParams::Network::MAIN);
 
     MockCValidationState state;
@@ -364,7 +364,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
 
     // Blocks after chain split at 110001 should redirect a part of block subsidy to community fund
     mtx.vin[0].scriptSig = CScript() << 110001 << OP_0;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     indexPrev.nHeight = 110000;
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "cb-no-community-fund", false)).Times(1);
     EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
@@ -374,7 +374,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
     CScriptID scriptID = boost::get<CScriptID>(address.Get());
     mtx.vout[0].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(scriptID) << OP_EQUAL;
     mtx.vout[0].nValue = 1.0625 * COIN;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
     CommunityFundAndRPFixFork communityFundAndRPFixFork;
@@ -386,7 +386,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
     mtx.vout[0].nValue = 1.5 * COIN;
     mtx.vin[0].scriptSig = CScript() << hardForkHeight << OP_0;
     indexPrev.nHeight = hardForkHeight - 1;
-    block.vtx[0] = CTransaction(mtx);;
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
 
@@ -415,7 +415,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
     mtx.vout[2].nValue = 1.25 * COIN;
 
     indexPrev.nHeight = hardForkHeight - 1;
-    block.vtx[0] = CTransaction(mtx);;
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
     ShieldFork shieldFork;
@@ -443,7 +443,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
     mtx.vout[2].nValue = 1.25 * COIN;
 
     indexPrev.nHeight = hardForkHeight -1;
-    block.vtx[0] = CTransaction(mtx);;
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
     //Exceed the LastCommunityRewardBlockHeight
@@ -471,7 +471,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
     mtx.vout[2].nValue = 0.625 * COIN;
 
     indexPrev.nHeight = exceedHeight -1;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
     // this is 10 block after the first halving height
@@ -500,7 +500,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
     mtx.vout[2].nValue = 1.25 * COIN;
 
     indexPrev.nHeight = exceedHeight -1;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
 
     // check that pre-halving amounts are rejected
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "cb-no-community-fund", false)).Times(1);
@@ -534,7 +534,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityReward) {
     mtx.vout[3].nValue = 0.3125 * COIN;
 
     indexPrev.nHeight = exceedHeight -1;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 }
 
@@ -561,7 +561,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAmount) {
     mtx.vout[0].nValue = 1.0624 * COIN;
     indexPrev.nHeight = 110000;
     CBlock block;
-    block.vtx.push_back(CTransaction(mtx));
+    block.vtx.push_back(MakeTransactionRef(mtx));
     block.nTime = chainplitFork.getMinimumTime(CBaseChainParams::Network::MAIN);
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "cb-no-community-fund", false)).Times(1);
     EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
@@ -574,7 +574,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAmount) {
     mtx.vout[0].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(scriptID1) << OP_EQUAL;
     mtx.vout[0].nValue = 1.0625 * COIN;
     indexPrev.nHeight = hardForkHeight - 1;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "cb-no-community-fund", false)).Times(1);
     EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
 
@@ -605,7 +605,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAmount) {
 	mtx.vout[2].nValue = 1.25 * COIN;
 
     indexPrev.nHeight = hardForkHeight - 1;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "cb-no-community-fund", false)).Times(1);
     EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
 
@@ -613,7 +613,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAmount) {
     mtx.vout[0].nValue = 1.25 * COIN;
 
     indexPrev.nHeight = hardForkHeight - 1;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
 
@@ -641,14 +641,14 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAmount) {
 	mtx.vout[2].nValue = 1.25 * COIN;
 
 	indexPrev.nHeight = hardForkHeight - 1;
-	block.vtx[0] = CTransaction(mtx);
+	block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "cb-no-community-fund", false)).Times(1);
     EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
 
     // this is the correct amount for the FOUNDATION
     mtx.vout[0].nValue = 2.5 * COIN;
 	indexPrev.nHeight = hardForkHeight - 1;
-	block.vtx[0] = CTransaction(mtx);
+	block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
 }
@@ -672,7 +672,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAddress) {
     mtx.vout[0].nValue = 1.0625 * COIN;
     indexPrev.nHeight = 139198;
     CBlock block;
-    block.vtx.push_back(CTransaction(mtx));
+    block.vtx.push_back(MakeTransactionRef(mtx));
     block.nTime = chainsplitFork.getMinimumTime(CBaseChainParams::Network::MAIN);
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "cb-no-community-fund", false)).Times(1);
     EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
@@ -683,7 +683,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAddress) {
     mtx.vout[0].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(scriptID1) << OP_EQUAL;
     mtx.vout[0].nValue = 1.5 * COIN;
     indexPrev.nHeight = 139199;
-    block.vtx[0] = CTransaction(mtx);;
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "cb-no-community-fund", false)).Times(1);
     EXPECT_FALSE(ContextualCheckBlock(block, state, &indexPrev));
 
@@ -692,7 +692,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAddress) {
     mtx.vout[0].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(scriptID3) << OP_EQUAL;
     mtx.vin[0].scriptSig = CScript() << 189200 << OP_0;
     indexPrev.nHeight = 189199;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
     // Test community reward address rotation. Addresses should change every 50000 blocks in a round-robin fashion.
@@ -700,7 +700,7 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAddress) {
     mtx.vout[0].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(scriptID4) << OP_EQUAL;
     mtx.vin[0].scriptSig = CScript() << 239200 << OP_0;
     indexPrev.nHeight = 239199;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
     // Test community reward address rotation. Addresses should change every 50000 blocks in a round-robin fashion.
@@ -708,9 +708,32 @@ TEST(ContextualCheckBlock, CoinbaseCommunityRewardAddress) {
     mtx.vout[0].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(scriptID5) << OP_EQUAL;
     mtx.vin[0].scriptSig = CScript() << 289200 << OP_0;
     indexPrev.nHeight = 289199;
-    block.vtx[0] = CTransaction(mtx);
+    block.vtx[0] = MakeTransactionRef(mtx);
     EXPECT_TRUE(ContextualCheckBlock(block, state, &indexPrev));
 
 
 }
 
+
+TEST(ContextualCheckBlock, CommunityFundOutputsCache) {
+    ShieldFork shieldFork;
+    for (CBaseChainParams::Network network : {CBaseChainParams::MAIN, CBaseChainParams::TESTNET}) {
+        SelectParams(network);
+        const int nHeight = shieldFork.getHeight(network) + 1;
+        const CAmount reward = GetBlockSubsidy(nHeight, Params().GetConsensus());
+
+        // Asked twice, the second answer from the cache, both as computed from the forks
+        for (int i = 0; i < 2; i++) {
+            std::vector<CTxOut> vOutputs = GetCommunityFundOutputs(nHeight, Params());
+            ASSERT_EQ(vOutputs.size(), 3U);
+            for (Fork::CommunityFundType cfType = Fork::CommunityFundType::FOUNDATION;
+                    cfType < Fork::CommunityFundType::ENDTYPE; cfType = Fork::CommunityFundType(cfType + 1)) {
+                EXPECT_EQ(vOutputs[cfType].nValue, ForkManager::getInstance().getCommunityFundReward(nHeight, reward, cfType));
+                CBitcoinAddress address(Params().GetCommunityFundAddressAtHeight(nHeight, cfType).c_str());
+                CScriptID scriptID = boost::get<CScriptID>(address.Get());
+                EXPECT_EQ(vOutputs[cfType].scriptPubKey, CScript() << OP_HASH160 << ToByteVector(scriptID) << OP_EQUAL);
+            }
+        }
+    }
+    SelectParams(CBaseChainParams::MAIN);
+}
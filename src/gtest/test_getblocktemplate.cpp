@@ -307,8 +307,9 @@ void TestMaxWeight(int maxWeight, std::map<int,int> expectedInputTx)
 	boost::chrono::duration<double> elapsedTime = endTime - startTime;
 
 
-	for(const CTransaction& tx: pblocktemplate->block.vtx)
+	for (const CTransactionRef& ptx : pblocktemplate->block.vtx)
 	{
+	    const CTransaction& tx = *ptx;
 
 		if(tx.IsCoinBase())
 			continue;
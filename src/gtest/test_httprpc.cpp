@@ -60,3 +60,20 @@ TEST(HTTPRPC, FailsWithBadAuth) {
     EXPECT_FALSE(HTTPReq_JSONRPC(&req, ""));
     req.CleanUp();
 }
+
+static std::string RequestMethod(const std::string& strBody)
+{
+    return JSONRPCRequestMethod(strBody.data(), strBody.data() + strBody.size());
+}
+
+TEST(HTTPRPC, FindsRequestMethod) {
+    EXPECT_EQ(RequestMethod("{\"jsonrpc\": \"1.0\", \"id\":\"curltest\", \"method\": \"getblocktemplate\", \"params\": [] }"), "getblocktemplate");
+    EXPECT_EQ(RequestMethod("{\"params\":[\"00ff\"],\"method\"\n:\n\"sendrawtransaction\"}"), "sendrawtransaction");
+    // The first one of a batch
+    EXPECT_EQ(RequestMethod("[{\"method\":\"z_getbalance\",\"id\":1},{\"method\":\"getblocktemplate\",\"id\":2}]"), "z_getbalance");
+    EXPECT_EQ(RequestMethod("{\"id\":1,\"params\":[]}"), "");
+    EXPECT_EQ(RequestMethod("{\"method\":getinfo}"), "");
+    EXPECT_EQ(RequestMethod("{\"method\":\"getinfo"), "");
+    EXPECT_EQ(RequestMethod("{\"method\":\"get info\"}"), "");
+    EXPECT_EQ(RequestMethod(""), "");
+}
@@ -10,6 +10,7 @@
 #include "streams.h"
 #include "version.h"
 #include "serialize.h"
+#include "joinsplitprover.h"
 #include "primitives/transaction.h"
 #include "zcash/JoinSplit.hpp"
 #include "zcash/Note.hpp"
@@ -613,3 +614,70 @@ TEST(joinsplit, note_class)
     ASSERT_EQ(note.r, clone.r);
     ASSERT_EQ(note.a_pk, clone.a_pk);
 }
+
+TEST(joinsplit, verify_only_does_not_prove)
+{
+    boost::filesystem::path vk_path = ZC_GetParamsDir() / "sprout-verifying.key";
+    ZCJoinSplit* js = ZCJoinSplit::Prepared(vk_path.string(), "");
+
+    SpendingKey sk = SpendingKey::random();
+    std::array<JSInput, 2> inputs = {JSInput(), JSInput()};
+    std::array<JSOutput, 2> outputs = {JSOutput(sk.address(), 0), JSOutput()};
+    uint256 ephemeralKey;
+    uint256 randomSeed;
+    uint256 joinSplitPubKey = random_uint256();
+    std::array<uint256, 2> macs;
+    std::array<uint256, 2> nullifiers;
+    std::array<uint256, 2> commitments;
+    std::array<ZCNoteEncryption::Ciphertext, 2> ciphertexts;
+    std::array<Note, 2> output_notes;
+
+    for (bool isGroth : {false, true}) {
+        EXPECT_THROW(js->prove(isGroth, inputs, outputs, output_notes, ciphertexts, ephemeralKey,
+                               joinSplitPubKey, randomSeed, macs, nullifiers, commitments,
+                               0, 0, ZCIncrementalMerkleTree().root(), true),
+                     std::runtime_error);
+    }
+
+    delete js;
+}
+
+// Proves the witness packages it is handed once they have gone through their serialization,
+// as a remote prover does
+class RoundTripProver : public ZCJoinSplitProver {
+public:
+    ZCJoinSplit& js;
+    int nProofs = 0;
+
+    RoundTripProver(ZCJoinSplit& js) : js(js) {}
+
+    SproutProof prove(const ZCJSProofWitness& witness) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << witness;
+        ZCJSProofWitness received;
+        ss >> received;
+        nProofs++;
+        return js.proveWitness(received);
+    }
+};
+
+TEST(joinsplit, prover_backends)
+{
+    CLocalJoinSplitProver local(*params, 2);
+    RoundTripProver remote(*params);
+
+    SpendingKey sk = SpendingKey::random();
+    std::array<JSInput, 2> inputs = {JSInput(), JSInput()};
+    std::array<JSOutput, 2> outputs = {JSOutput(sk.address(), 0), JSOutput()};
+    uint256 joinSplitPubKey = random_uint256();
+    uint256 rt = ZCIncrementalMerkleTree().root();
+
+    for (ZCJoinSplitProver* prover : std::vector<ZCJoinSplitProver*>{&local, &remote}) {
+        params->setProver(prover);
+        SproutProofs jsdescs = makeSproutProofs(*params, inputs, outputs, joinSplitPubKey, 0, 0, rt);
+        params->setProver(NULL);
+        ASSERT_TRUE(verifySproutProofs(*params, jsdescs, joinSplitPubKey));
+    }
+    EXPECT_EQ(remote.nProofs, 2);
+    EXPECT_EQ(local.QueueSize(), 0);
+}
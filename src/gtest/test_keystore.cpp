@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include "key.h"
 #include "keystore.h"
 #include "random.h"
 #ifdef ENABLE_WALLET
@@ -185,4 +186,37 @@ TEST(keystore_tests, store_and_retrieve_spending_key_in_encrypted_store) {
     ASSERT_EQ(1, addrs.count(addr));
     ASSERT_EQ(1, addrs.count(addr2));
 }
+
+TEST(keystore_tests, unlock_checks_many_keys_in_parallel) {
+    TestCCryptoKeyStore keyStore;
+    uint256 r {GetRandHash()};
+    CKeyingMaterial vMasterKey (r.begin(), r.end());
+
+    std::vector<CPubKey> vPubKeys;
+    for (size_t i = 0; i < 2 * WALLET_UNLOCK_PARALLEL_MIN_KEYS; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        ASSERT_TRUE(keyStore.AddKeyPubKey(key, key.GetPubKey()));
+        vPubKeys.push_back(key.GetPubKey());
+    }
+    keyStore.AddSpendingKey(libzcash::SpendingKey::random());
+    ASSERT_TRUE(keyStore.EncryptKeys(vMasterKey));
+
+    uint256 r2 {GetRandHash()};
+    CKeyingMaterial vRandomKey (r2.begin(), r2.end());
+    EXPECT_FALSE(keyStore.Unlock(vRandomKey));
+    EXPECT_TRUE(keyStore.IsLocked());
+
+    ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+    for (const CPubKey& pubkey : vPubKeys) {
+        CKey keyOut;
+        ASSERT_TRUE(keyStore.GetKey(pubkey.GetID(), keyOut));
+        EXPECT_EQ(pubkey, keyOut.GetPubKey());
+    }
+
+    // Unlocking again only checks a key of each kind
+    ASSERT_TRUE(keyStore.Lock());
+    EXPECT_FALSE(keyStore.Unlock(vRandomKey));
+    EXPECT_TRUE(keyStore.Unlock(vMasterKey));
+}
 #endif
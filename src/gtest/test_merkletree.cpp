@@ -11,6 +11,7 @@
 
 #include <stdexcept>
 
+#include "random.h"
 #include "utilstrencodings.h"
 #include "version.h"
 #include "serialize.h"
@@ -299,3 +300,94 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+TEST(merkletree, appendBatch) {
+    // Appending a batch gives the tree appending its elements one by one does,
+    // from every size of the testing tree, and fills it up when they do not fit
+    for (size_t start = 0; start <= 16; start++) {
+        for (size_t count = 0; count <= 18; count++) {
+            ZCTestingIncrementalMerkleTree tree;
+            for (size_t i = 0; i < start; i++) {
+                tree.append(GetRandHash());
+            }
+            ZCTestingIncrementalMerkleTree batchTree = tree;
+
+            std::vector<libzcash::SHA256Compress> objs;
+            for (size_t i = 0; i < count; i++) {
+                objs.push_back(GetRandHash());
+            }
+
+            bool fFull = false;
+            try {
+                BOOST_FOREACH(const libzcash::SHA256Compress& obj, objs) {
+                    tree.append(obj);
+                }
+            } catch (const std::runtime_error&) {
+                fFull = true;
+            }
+            if (fFull) {
+                ASSERT_THROW(batchTree.append(objs), std::runtime_error);
+            } else {
+                batchTree.append(objs);
+            }
+            ASSERT_TRUE(batchTree == tree);
+            ASSERT_EQ(batchTree.size(), tree.size());
+            ASSERT_TRUE(batchTree.root() == tree.root());
+        }
+    }
+
+    // The batches of a bigger tree
+    ZCIncrementalMerkleTree tree;
+    ZCIncrementalMerkleTree batchTree;
+    for (size_t count = 1; count < 300; count += 37) {
+        std::vector<libzcash::SHA256Compress> objs;
+        for (size_t i = 0; i < count; i++) {
+            objs.push_back(GetRandHash());
+            tree.append(objs.back());
+        }
+        batchTree.append(objs);
+        ASSERT_TRUE(batchTree == tree);
+    }
+}
+
+TEST(merkletree, witnessSet) {
+    // The witnesses of the set, whether added before or between the appends,
+    // and whether they have a cursor then, match the ones appended to one by one
+    for (int blocks = 1; blocks <= 8; blocks++) {
+        ZCIncrementalMerkleTree tree;
+        ZCIncrementalMerkleTree setTree;
+        std::deque<ZCIncrementalWitness> witnesses;
+        std::deque<ZCIncrementalWitness> setWitnesses;
+        uint64_t n = 0;
+
+        for (int b = 0; b < blocks; b++) {
+            libzcash::IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> set(setTree);
+            for (size_t i = 0; i < setWitnesses.size(); i++) {
+                set.add(setWitnesses[i]);
+            }
+
+            for (int i = 0; i < 37 * b + 5; i++, n++) {
+                uint256 obj = GetRandHash();
+                tree.append(obj);
+                BOOST_FOREACH(ZCIncrementalWitness& witness, witnesses) {
+                    witness.append(obj);
+                }
+                set.append(obj);
+
+                if (n % 7 == 0 || n % 11 == 3) {
+                    witnesses.push_back(tree.witness());
+                    setWitnesses.push_back(setTree.witness());
+                    set.add(setWitnesses.back());
+                }
+            }
+            set.finish();
+
+            ASSERT_TRUE(tree == setTree);
+            ASSERT_EQ(witnesses.size(), setWitnesses.size());
+            for (size_t i = 0; i < witnesses.size(); i++) {
+                ASSERT_TRUE(witnesses[i] == setWitnesses[i]);
+                ASSERT_TRUE(setWitnesses[i].root() == tree.root());
+            }
+        }
+    }
+}
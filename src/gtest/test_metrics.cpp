@@ -3,6 +3,8 @@
 #include "metrics.h"
 #include "utiltime.h"
 
+#include <libsnark/common/profiling.hpp>
+
 
 TEST(Metrics, AtomicTimer) {
     AtomicTimer t;
@@ -95,6 +97,102 @@ TEST(Metrics, GetLocalSolPS) {
     SetMockTime(0);
 }
 
+TEST(Metrics, AtomicHistogram) {
+    AtomicHistogram h;
+    EXPECT_EQ(0, h.getCount());
+    EXPECT_EQ(0, h.mean());
+    EXPECT_EQ(0, h.percentile(0.5));
+
+    // 1 to 100 microseconds
+    for (int i = 1; i <= 100; i++) {
+        h.add(i);
+    }
+    EXPECT_EQ(100, h.getCount());
+    EXPECT_EQ(5050, h.getTotal());
+    EXPECT_EQ(50, h.mean());
+    EXPECT_EQ(100, h.getMax());
+
+    // The median 50 lies in the bucket from 32 to 63
+    EXPECT_EQ(63, h.percentile(0.5));
+    // The upper bucket goes to 127 but nothing took longer than 100
+    EXPECT_EQ(100, h.percentile(0.9));
+    EXPECT_EQ(100, h.percentile(1));
+    EXPECT_EQ(1, h.percentile(0));
+
+    // Negative durations count as none
+    h.add(-5);
+    EXPECT_EQ(101, h.getCount());
+    EXPECT_EQ(100, h.getMax());
+}
+
+TEST(Metrics, SnarkPhases) {
+    ConnectSnarkMetrics();
+    uint64_t nMultiExpA = snarkPhaseLatency[SNARK_MULTIEXP_A].getCount();
+    uint64_t nProve = snarkPhaseLatency[SNARK_PROVE].getCount();
+
+    // The blocks of a phase are counted with the profiling counters inhibited
+    libsnark::enter_block("Call to r1cs_ppzksnark_prover_streaming");
+    libsnark::enter_block("Compute answer to A-query", false);
+    libsnark::enter_block("Not a phase");
+    libsnark::leave_block("Not a phase");
+    libsnark::leave_block("Compute answer to A-query", false);
+    libsnark::leave_block("Call to r1cs_ppzksnark_prover_streaming");
+
+    EXPECT_EQ(nMultiExpA + 1, snarkPhaseLatency[SNARK_MULTIEXP_A].getCount());
+    EXPECT_EQ(nProve + 1, snarkPhaseLatency[SNARK_PROVE].getCount());
+    EXPECT_STREQ("multiexpa", SnarkPhaseName(SNARK_MULTIEXP_A));
+}
+
+TEST(Metrics, PrometheusHistogram) {
+    AtomicHistogram h;
+    h.add(0);
+    h.add(3);
+    h.add(1000000);
+
+    std::string str;
+    WritePrometheusHistogram(str, "test_seconds", "stage=\"read\"", h);
+    EXPECT_NE(std::string::npos, str.find("test_seconds_bucket{stage=\"read\",le=\"0.000000\"} 1\n"));
+    // 3 lies in the bucket up to 3 microseconds
+    EXPECT_NE(std::string::npos, str.find("test_seconds_bucket{stage=\"read\",le=\"0.000003\"} 2\n"));
+    EXPECT_NE(std::string::npos, str.find("test_seconds_bucket{stage=\"read\",le=\"0.524287\"} 2\n"));
+    EXPECT_NE(std::string::npos, str.find("test_seconds_bucket{stage=\"read\",le=\"1.048575\"} 3\n"));
+    EXPECT_NE(std::string::npos, str.find("test_seconds_bucket{stage=\"read\",le=\"+Inf\"} 3\n"));
+    EXPECT_NE(std::string::npos, str.find("test_seconds_sum{stage=\"read\"} 1.000003\n"));
+    EXPECT_NE(std::string::npos, str.find("test_seconds_count{stage=\"read\"} 3\n"));
+
+    str.clear();
+    WritePrometheusHistogram(str, "test_seconds", "", h);
+    EXPECT_NE(std::string::npos, str.find("test_seconds_bucket{le=\"+Inf\"} 3\n"));
+    EXPECT_NE(std::string::npos, str.find("test_seconds_count 3\n"));
+}
+
+TEST(Metrics, RPCMethodLatency) {
+    GetRPCMethodLatency("testmethod").add(10);
+    GetRPCMethodLatency("testmethod").add(20);
+    auto latencies = GetAllRPCMethodLatencies();
+    ASSERT_EQ(1, latencies.count("testmethod"));
+    EXPECT_EQ(2, latencies["testmethod"]->getCount());
+    EXPECT_STREQ("postprocess", ConnectStageName(CONNECT_POSTPROCESS));
+}
+
+TEST(Metrics, MiningThreadMetrics) {
+    ResetMiningThreadMetrics(2);
+    auto m = GetMiningThreadMetrics(1);
+    m->solverRuns.increment();
+    EXPECT_EQ(2, GetAllMiningThreadMetrics().size());
+    EXPECT_EQ(0, GetAllMiningThreadMetrics()[0]->solverRuns.get());
+    EXPECT_EQ(1, GetAllMiningThreadMetrics()[1]->solverRuns.get());
+
+    // Unknown threads get metrics that are not listed
+    GetMiningThreadMetrics(2)->solverRuns.increment();
+    EXPECT_EQ(2, GetAllMiningThreadMetrics().size());
+
+    // Threads still running after a reset keep their metrics
+    ResetMiningThreadMetrics(0);
+    EXPECT_EQ(0, GetAllMiningThreadMetrics().size());
+    EXPECT_EQ(1, m->solverRuns.get());
+}
+
 TEST(Metrics, EstimateNetHeightInner) {
     // Ensure that the (rounded) current height is returned if the tip is current
     SetMockTime(15000);
@@ -104,6 +104,62 @@ TEST(noteencryption, api)
     }
 }
 
+TEST(noteencryption, try_decrypt_batch)
+{
+    uint256 sk_enc = ZCNoteEncryption::generate_privkey(uint252(uint256S("21035d60bc1983e37950ce4803418a8fb33ea68d5b937ca382ecbae7564d6a07")));
+    uint256 pk_enc = ZCNoteEncryption::generate_pubkey(sk_enc);
+    uint256 pk_other = ZCNoteEncryption::generate_pubkey(ZCNoteEncryption::generate_privkey(uint252()));
+    uint256 hSig = uint256S("11035d60bc1983e37950ce4803418a8fb33ea68d5b937ca382ecbae7564d6a77");
+
+    ZCNoteEncryption::Plaintext message;
+    for (size_t i = 0; i < ZC_NOTEPLAINTEXT_SIZE; i++) {
+        message[i] = (unsigned char) i;
+    }
+
+    // Two ephemeral keys, whose ciphertexts are interleaved in the batch,
+    // each with a ciphertext for this key and one for another
+    ZCNoteEncryption a(hSig), b(hSig);
+    uint256 epk_a = a.get_epk(), epk_b = b.get_epk();
+    std::vector<ZCNoteEncryption::Ciphertext> ciphertexts;
+    ciphertexts.push_back(a.encrypt(pk_enc, message));
+    ciphertexts.push_back(b.encrypt(pk_other, message));
+    ciphertexts.push_back(a.encrypt(pk_other, message));
+    ciphertexts.push_back(b.encrypt(pk_enc, message));
+
+    // An ephemeral key of low order has no secret
+    uint256 epk_zero;
+
+    std::vector<ZCNoteDecryption::BatchItem> batch = {
+        {&ciphertexts[0], &epk_a, &hSig, 0},
+        {&ciphertexts[1], &epk_b, &hSig, 0},
+        {&ciphertexts[2], &epk_a, &hSig, 1},
+        {&ciphertexts[3], &epk_b, &hSig, 1},
+        {&ciphertexts[3], &epk_b, &hSig, 0},
+        {&ciphertexts[0], &epk_zero, &hSig, 0},
+    };
+
+    ZCNoteDecryption decrypter(sk_enc);
+    std::vector<boost::optional<ZCNoteDecryption::Plaintext>> plaintexts;
+    ASSERT_EQ(decrypter.try_decrypt_batch(batch, plaintexts), 2);
+    ASSERT_EQ(plaintexts.size(), batch.size());
+    ASSERT_TRUE(plaintexts[0] && *plaintexts[0] == message);
+    ASSERT_FALSE(plaintexts[1]);
+    ASSERT_FALSE(plaintexts[2]);
+    ASSERT_TRUE(plaintexts[3] && *plaintexts[3] == message);
+    ASSERT_FALSE(plaintexts[4]);
+    ASSERT_FALSE(plaintexts[5]);
+
+    // The batch agrees with decrypt
+    for (size_t i = 0; i < batch.size() - 1; i++) {
+        if (plaintexts[i]) {
+            ASSERT_TRUE(decrypter.decrypt(*batch[i].ciphertext, *batch[i].epk, hSig, batch[i].nonce) == message);
+        } else {
+            ASSERT_THROW(decrypter.decrypt(*batch[i].ciphertext, *batch[i].epk, hSig, batch[i].nonce),
+                         libzcash::note_decryption_failed);
+        }
+    }
+}
+
 uint256 test_prf(
     unsigned char distinguisher,
     uint252 seed_x,
@@ -83,6 +83,17 @@ public:
 
         delete it;
     }
+
+    // Write an entry under the key used before the keys were encoded
+    void DebugPutLegacy(const PaymentDisclosureKey& key, const PaymentDisclosureInfo& info) {
+        ASSERT_NE(db, nullptr);
+        std::lock_guard<std::mutex> guard(lock_);
+
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << info;
+        leveldb::Status status = db->Put(writeOptions, key.ToString(), leveldb::Slice(&ssValue[0], ssValue.size()));
+        ASSERT_TRUE(status.ok());
+    }
 };
 
 
@@ -209,3 +220,54 @@ TEST(paymentdisclosure, mainnet) {
     mydb.DebugDumpAllStdout();
 #endif
 }
+
+// The outputs of a transaction are written at once and read back together, apart from the
+// outputs of the other transactions, and the entries of the old keys are still found.
+TEST(paymentdisclosure, batch) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    PaymentDisclosureDBTest mydb(pathTemp);
+
+    uint256 txid = random_uint256();
+    uint256 txidOther = random_uint256();
+    std::vector<PaymentDisclosureKeyInfo> entries;
+    for (uint64_t js = 0; js < 3; js++) {
+        for (uint8_t n = 0; n < ZC_NUM_JS_OUTPUTS; n++) {
+            PaymentDisclosureInfo info(PAYMENT_DISCLOSURE_VERSION_EXPERIMENTAL, random_uint256(), random_uint256(),
+                                       libzcash::SpendingKey::random().address());
+            entries.push_back(std::make_pair(PaymentDisclosureKey(txid, js, n), info));
+        }
+    }
+    ASSERT_TRUE(mydb.Put(entries));
+    PaymentDisclosureInfo infoOther;
+    infoOther.esk = random_uint256();
+    ASSERT_TRUE(mydb.Put(PaymentDisclosureKey(txidOther, 0, 0), infoOther));
+
+    std::vector<PaymentDisclosureKeyInfo> entries2;
+    ASSERT_TRUE(mydb.GetAll(txid, entries2));
+    ASSERT_EQ(entries.size(), entries2.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        EXPECT_EQ(entries[i].first, entries2[i].first);
+        EXPECT_EQ(entries[i].second, entries2[i].second);
+
+        PaymentDisclosureInfo info;
+        ASSERT_TRUE(mydb.Get(entries[i].first, info));
+        EXPECT_EQ(entries[i].second, info);
+    }
+
+    entries2.clear();
+    ASSERT_TRUE(mydb.GetAll(random_uint256(), entries2));
+    EXPECT_TRUE(entries2.empty());
+
+    PaymentDisclosureKey keyLegacy(random_uint256(), 1, 1);
+    PaymentDisclosureInfo infoLegacy;
+    infoLegacy.esk = random_uint256();
+    mydb.DebugPutLegacy(keyLegacy, infoLegacy);
+    PaymentDisclosureInfo info;
+    ASSERT_TRUE(mydb.Get(keyLegacy, info));
+    EXPECT_EQ(infoLegacy, info);
+}
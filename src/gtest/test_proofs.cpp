@@ -517,6 +517,56 @@ TEST(proofs, zksnark_serializes_properly)
     }
 }
 
+TEST(proofs, batch_verifier)
+{
+    auto example = libsnark::generate_r1cs_example_with_field_input<curve_Fr>(250, 4);
+    example.constraint_system.swap_AB_if_beneficial();
+    auto kp = libsnark::r1cs_ppzksnark_generator<curve_pp>(example.constraint_system);
+    auto vkprecomp = libsnark::r1cs_ppzksnark_verifier_process_vk(kp.vk);
+
+    std::vector<libsnark::r1cs_ppzksnark_proof<curve_pp>> proofs;
+    for (size_t i = 0; i < 4; i++) {
+        proofs.push_back(libsnark::r1cs_ppzksnark_prover<curve_pp>(
+            kp.pk,
+            example.primary_input,
+            example.auxiliary_input,
+            example.constraint_system
+        ));
+    }
+
+    // Valid proofs verify as a batch
+    {
+        auto verifier = ProofVerifier::Batch();
+        for (const auto& proof : proofs) {
+            ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proof));
+        }
+        std::vector<size_t> failed;
+        ASSERT_TRUE(verifier.verifyBatch(&failed));
+        ASSERT_TRUE(failed.empty());
+        // The batch is emptied by verifyBatch
+        ASSERT_TRUE(verifier.verifyBatch());
+    }
+
+    // A bad proof fails the batch and is identified
+    {
+        auto verifier = ProofVerifier::Batch();
+        auto badproof = PHGRProof::random_invalid().to_libsnark_proof<libsnark::r1cs_ppzksnark_proof<curve_pp>>();
+        ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proofs[0]));
+        ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, badproof));
+        ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proofs[1]));
+        std::vector<size_t> failed;
+        ASSERT_FALSE(verifier.verifyBatch(&failed));
+        ASSERT_EQ(failed, std::vector<size_t>{1});
+    }
+
+    // Non-batching verifiers have nothing to verify
+    {
+        auto verifier = ProofVerifier::Strict();
+        ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proofs[0]));
+        ASSERT_TRUE(verifier.verifyBatch());
+    }
+}
+
 TEST(proofs, g1_deserialization)
 {
     CompressedG1 g;
@@ -540,6 +540,30 @@ TEST_F(ReindexTestSuite, CreateNewBlockFile)
     ASSERT_TRUE(FindBlockPos(state, pos, nAddSize, nHeight++, nTime, fKnown));
 }
 
+TEST_F(ReindexTestSuite, RawBlocksAreReadAsSerializedForTheNetwork)
+{
+    CBlock aBlock = createCoinBaseOnlyBlock(uint256(), /*height*/19);
+    // Copies of the coinbase make the block compressible
+    for (int i = 0; i < 50; i++)
+        aBlock.vtx.push_back(aBlock.vtx[0]);
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << aBlock;
+    const std::vector<char> vExpected(ssBlock.begin(), ssBlock.end());
+
+    for (bool fCompress : {false, true}) {
+        CDiskRecord record(aBlock, fCompress);
+        ASSERT_EQ(record.IsCompressed(), fCompress);
+        CDiskBlockPos diskPos(12346 + fCompress, 0);
+        ASSERT_TRUE(WriteBlockToDisk(record, diskPos, Params().MessageStart()));
+
+        std::vector<char> vBlock;
+        EXPECT_TRUE(ReadRawBlockFromDisk(vBlock, diskPos, aBlock.GetHash()));
+        EXPECT_TRUE(vBlock == vExpected);
+        EXPECT_FALSE(ReadRawBlockFromDisk(vBlock, diskPos, uint256()));
+        EXPECT_FALSE(ReadRawBlockFromDisk(vBlock, CDiskBlockPos(12345, 8), aBlock.GetHash()));
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -567,7 +591,7 @@ CBlock ReindexTestSuite::createCoinBaseOnlyBlock(const uint256& prevBlockHash, u
 
     CScript coinbaseScript = CScript() << OP_DUP << OP_HASH160
             << ToByteVector(uint160()) << OP_EQUALVERIFY << OP_CHECKSIG;
-    res.vtx.push_back(createCoinbase(coinbaseScript, /*fees*/CAmount(), blockHeight));
+    res.vtx.push_back(MakeTransactionRef(createCoinbase(coinbaseScript, /*fees*/CAmount(), blockHeight)));
 
     bool fDummy = false;
     res.hashMerkleRoot = res.BuildMerkleTree(&fDummy);
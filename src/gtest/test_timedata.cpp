@@ -98,3 +98,32 @@ TEST(TimeWarning, PeersMixed)
     }
     tw.AddTimeData(GetUniqueAddr(), now - CTimeWarning::TIMEDATA_IGNORE_THRESHOLD + 1, now);
 }
+
+TEST(TimeWarning, SamplingDone)
+{
+    StrictMock<MockCTimeWarning> tw;
+    int64_t now = GetTime();
+
+    EXPECT_CALL(tw, Warn(CTimeWarning::TIMEDATA_WARNING_SAMPLES, 0)).Times(0);
+
+    for (size_t i = 0; i < CTimeWarning::TIMEDATA_MAX_SAMPLES; i++) {
+        EXPECT_EQ(tw.AddTimeData(GetUniqueAddr(), now, now), 0);
+    }
+    // The peers after the first TIMEDATA_MAX_SAMPLES are not counted, but still get their offset
+    for (size_t i = 0; i < CTimeWarning::TIMEDATA_WARNING_SAMPLES; i++) {
+        EXPECT_EQ(tw.AddTimeData(GetUniqueAddr(), now + CTimeWarning::TIMEDATA_WARNING_THRESHOLD + 1, now),
+                  CTimeWarning::TIMEDATA_WARNING_THRESHOLD + 1);
+    }
+}
+
+TEST(TimeWarning, WarnOnce)
+{
+    StrictMock<MockCTimeWarning> tw;
+    int64_t now = GetTime();
+
+    EXPECT_CALL(tw, Warn(CTimeWarning::TIMEDATA_WARNING_SAMPLES, 0)).Times(1);
+
+    for (size_t i = 0; i < 2 * CTimeWarning::TIMEDATA_WARNING_SAMPLES; i++) {
+        tw.AddTimeData(GetUniqueAddr(), now + CTimeWarning::TIMEDATA_WARNING_THRESHOLD + 1, now);
+    }
+}
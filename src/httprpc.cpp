@@ -3,6 +3,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -11,7 +12,10 @@
 #include "utilstrencodings.h"
 #include "ui_interface.h"
 
+#include <algorithm>
+
 #include <boost/algorithm/string.hpp> // boost::trim
+#include <boost/bind.hpp>
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
@@ -55,6 +59,8 @@ private:
 
 /* Pre-base64-encoded authentication token */
 static std::string strRPCUserColonPass;
+/* Its base64 encoding, which the clients send it as */
+static std::string strRPCUserColonPass64;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
 
@@ -83,10 +89,91 @@ static bool RPCAuthorized(const std::string& strAuth)
         return false;
     std::string strUserPass64 = strAuth.substr(6);
     boost::trim(strUserPass64);
+    // Spares decoding the credentials of each request, which only differently encoded
+    // ones need
+    if (TimingResistantEqual(strUserPass64, strRPCUserColonPass64))
+        return true;
     std::string strUserPass = DecodeBase64(strUserPass64);
     return TimingResistantEqual(strUserPass, strRPCUserColonPass);
 }
 
+/**
+ * The first "method" of a JSON-RPC request, found without parsing it as the event loop
+ * thread calls this. A request fooling the search only picks the lane it waits in, it
+ * is authenticated and parsed by HTTPReq_JSONRPC.
+ */
+static std::string JSONRPCRequestMethod(const char* pBegin, const char* pEnd)
+{
+    static const char KEY[] = "\"method\"";
+    const char* p = std::search(pBegin, pEnd, KEY, KEY + sizeof(KEY) - 1);
+    if (p == pEnd)
+        return "";
+    p += sizeof(KEY) - 1;
+    while (p != pEnd && isspace((unsigned char)*p))
+        p++;
+    if (p == pEnd || *p++ != ':')
+        return "";
+    while (p != pEnd && isspace((unsigned char)*p))
+        p++;
+    if (p == pEnd || *p++ != '"')
+        return "";
+    const char* pMethod = p;
+    while (p != pEnd && (isalnum((unsigned char)*p) || *p == '_'))
+        p++;
+    if (p == pEnd || *p != '"')
+        return "";
+    return std::string(pMethod, p);
+}
+
+static std::string HTTPReq_JSONRPCMethod(HTTPRequest* req)
+{
+    std::pair<const char*, size_t> body = req->PeekBody();
+    if (!body.first)
+        return "";
+    return JSONRPCRequestMethod(body.first, body.first + body.second);
+}
+
+/**
+ * Reply to a singleton request, made first at nStartTime. A method waiting for the chain
+ * parks the request, to be called again by a worker thread once it is ready.
+ */
+static bool HTTPReq_JSONRPCCall(HTTPRequest* req, const JSONRequest& jreq, int64_t nStartTime)
+{
+    try {
+        // The reply is written as the result is produced, so a large one is never
+        // held whole as a UniValue nor as a string. An error midway discards it.
+        HTTPReplyBody body;
+        {
+            JSONStreamWriter writer(boost::bind(&HTTPReplyBody::Write, &body, _1, _2));
+            writer.beginObject();
+            writer.key("result");
+            {
+                RPCParkScope scope(nStartTime);
+                tableRPC.execute(jreq.strMethod, jreq.params, writer);
+            }
+            writer.pushKV("error", NullUniValue);
+            writer.pushKV("id", jreq.id);
+            writer.endObject();
+            writer.Flush();
+        }
+        body.Write("\n", 1);
+
+        // Send reply
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, body);
+    } catch (const RPCParkedCall& call) {
+        std::shared_ptr<HTTPWorkItem> parked = ParkHTTPRequest(boost::bind(&HTTPReq_JSONRPCCall, _1, jreq, nStartTime));
+        ParkRPCCall(call, boost::bind(&ResumeHTTPRequest, parked));
+    } catch (const UniValue& objError) {
+        JSONErrorReply(req, objError, jreq.id);
+        return false;
+    } catch (const std::exception& e) {
+        JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        return false;
+    }
+    return true;
+}
+
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 {
     // JSONRPC handles only POST
@@ -126,15 +213,11 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
+            return HTTPReq_JSONRPCCall(req, jreq, GetTimeMillis());
 
-            UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
-
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
-
-        // array of requests
+        // array of requests, the calls of which wait on this thread
         } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            strReply = JSONRPCExecBatch(valRequest.get_array(), &QueueHTTPTask);
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
@@ -164,6 +247,7 @@ static bool InitRPCAuthentication()
     } else {
         strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
     }
+    strRPCUserColonPass64 = EncodeBase64(strRPCUserColonPass);
     return true;
 }
 
@@ -173,7 +257,7 @@ bool StartHTTPRPC()
     if (!InitRPCAuthentication())
         return false;
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, HTTPReq_JSONRPCMethod);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
@@ -6,11 +6,13 @@
 
 #include "chainparamsbase.h"
 #include "compat.h"
+#include "metrics.h"
 #include "util.h"
 #include "netbase.h"
 #include "rpc/protocol.h" // For HTTP status codes
 #include "sync.h"
 #include "ui_interface.h"
+#include "utilstrencodings.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,41 +37,67 @@
 #endif
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/foreach.hpp>
-#include <boost/scoped_ptr.hpp>
+
+class HTTPWorkItem;
+//! The work item running on this thread, which its handler can park
+static thread_local HTTPWorkItem* currentWorkItem = 0;
 
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
 {
 public:
-    HTTPWorkItem(HTTPRequest* req, const std::string &path, const HTTPRequestHandler& func):
-        req(req), path(path), func(func)
+    HTTPWorkItem(HTTPRequest* req, const std::string &path, const HTTPRequestHandler& func, size_t nLane):
+        req(req), path(path), func(func), nLane(nLane)
     {
     }
     void operator()()
     {
+        currentWorkItem = this;
         func(req.get(), path);
+        currentWorkItem = 0;
     }
 
-    boost::scoped_ptr<HTTPRequest> req;
-
-private:
+    std::unique_ptr<HTTPRequest> req;
     std::string path;
     HTTPRequestHandler func;
+    //! The lane of the work queue
+    size_t nLane;
 };
 
 /** Simple work queue for distributing work over multiple threads.
- * Work items are simply callable objects.
+ * Work items are simply callable objects. They wait in lanes, each with a
+ * priority and the most threads its items may occupy at once: a thread takes
+ * the oldest item of the lane of highest priority below its limit, so the
+ * items of a busy lane never hold all the threads.
  */
 template <typename WorkItem>
 class WorkQueue
 {
 private:
+    struct Lane
+    {
+        Lane(const std::string& name, int nPriority, int nThreads) :
+            name(name), nPriority(nPriority), nThreads(nThreads), nRunning(0), nRejected(0),
+            waitLatency(new AtomicHistogram())
+        {
+        }
+        std::string name;
+        int nPriority;
+        int nThreads;
+        /* The items, with the time they were queued at */
+        std::deque<std::pair<WorkItem*, int64_t> > queue;
+        int nRunning;
+        uint64_t nRejected;
+        std::shared_ptr<AtomicHistogram> waitLatency;
+    };
+
     /** Mutex protects entire object */
     CWaitableCriticalSection cs;
     CConditionVariable cond;
-    /* XXX in C++11 we can use std::unique_ptr here and avoid manual cleanup */
-    std::deque<WorkItem*> queue;
+    std::vector<Lane> lanes;
     bool running;
     size_t maxDepth;
     int numThreads;
@@ -92,6 +120,16 @@ private:
         }
     };
 
+    /** The lane a thread takes its next item from, if any */
+    Lane* NextLane()
+    {
+        Lane* next = 0;
+        BOOST_FOREACH (Lane& lane, lanes)
+            if (!lane.queue.empty() && lane.nRunning < lane.nThreads && (!next || lane.nPriority > next->nPriority))
+                next = &lane;
+        return next;
+    }
+
 public:
     WorkQueue(size_t maxDepth) : running(true),
                                  maxDepth(maxDepth),
@@ -103,19 +141,37 @@ public:
      */
     ~WorkQueue()
     {
-        while (!queue.empty()) {
-            delete queue.front();
-            queue.pop_front();
+        BOOST_FOREACH (Lane& lane, lanes) {
+            while (!lane.queue.empty()) {
+                delete lane.queue.front().first;
+                lane.queue.pop_front();
+            }
         }
     }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
+    /** Add a lane, or change the lane of the same name. Call before the threads run. */
+    size_t AddLane(const std::string& name, int nPriority, int nThreads)
     {
         boost::unique_lock<boost::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
+        for (size_t n = 0; n < lanes.size(); n++) {
+            if (lanes[n].name == name) {
+                lanes[n].nPriority = nPriority;
+                lanes[n].nThreads = nThreads;
+                return n;
+            }
+        }
+        lanes.push_back(Lane(name, nPriority, nThreads));
+        return lanes.size() - 1;
+    }
+    /** Enqueue a work item in a lane, each one holding up to maxDepth items */
+    bool Enqueue(WorkItem* item, size_t nLane = 0)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        Lane& lane = lanes[nLane];
+        if (lane.queue.size() >= maxDepth) {
+            lane.nRejected++;
             return false;
         }
-        queue.push_back(item);
+        lane.queue.push_back(std::make_pair(item, GetTimeMicros()));
         cond.notify_one();
         return true;
     }
@@ -125,17 +181,27 @@ public:
         ThreadCounter count(*this);
         while (running) {
             WorkItem* i = 0;
+            Lane* lane = 0;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
-                while (running && queue.empty())
+                while (running && !(lane = NextLane()))
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = queue.front();
-                queue.pop_front();
+                i = lane->queue.front().first;
+                lane->waitLatency->add(GetTimeMicros() - lane->queue.front().second);
+                lane->queue.pop_front();
+                lane->nRunning++;
             }
             (*i)();
             delete i;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                lane->nRunning--;
+                // The lane is below its limit again, another thread can take its next item
+                if (!lane->queue.empty())
+                    cond.notify_one();
+            }
         }
     }
     /** Interrupt and exit loops */
@@ -157,20 +223,52 @@ public:
     size_t Depth()
     {
         boost::unique_lock<boost::mutex> lock(cs);
-        return queue.size();
+        size_t depth = 0;
+        BOOST_FOREACH (const Lane& lane, lanes)
+            depth += lane.queue.size();
+        return depth;
+    }
+
+    /** The threads the lanes may occupy together */
+    int Threads()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        int threads = 0;
+        BOOST_FOREACH (const Lane& lane, lanes)
+            threads += lane.nThreads;
+        return threads;
+    }
+
+    std::vector<HTTPWorkQueueInfo> Info()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        std::vector<HTTPWorkQueueInfo> vInfo;
+        BOOST_FOREACH (const Lane& lane, lanes) {
+            HTTPWorkQueueInfo info;
+            info.name = lane.name;
+            info.nPriority = lane.nPriority;
+            info.nThreads = lane.nThreads;
+            info.nDepth = lane.queue.size();
+            info.nRunning = lane.nRunning;
+            info.nRejected = lane.nRejected;
+            info.waitLatency = lane.waitLatency;
+            vInfo.push_back(info);
+        }
+        return vInfo;
     }
 };
 
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPRequestClassifier classifier):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), classifier(classifier)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPRequestClassifier classifier;
 };
 
 /** HTTP module state */
@@ -183,6 +281,9 @@ struct evhttp* eventHTTP = 0;
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Lanes of the work queue of the methods -rpcqueue assigns, and of the methods starting with a prefix
+static std::map<std::string, size_t> mapMethodLanes;
+static std::vector<std::pair<std::string, size_t> > vMethodPrefixLanes;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -246,6 +347,62 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
     }
 }
 
+/** Define the lanes of the work queue and the methods they handle, from -rpcthreads and -rpcqueue */
+static bool InitHTTPWorkQueueLanes()
+{
+    workQueue->AddLane("default", 0, std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L));
+
+    std::vector<std::string> vQueues(DEFAULT_HTTP_QUEUES, DEFAULT_HTTP_QUEUES + ARRAYLEN(DEFAULT_HTTP_QUEUES));
+    if (mapMultiArgs.count("-rpcqueue"))
+        vQueues.insert(vQueues.end(), mapMultiArgs["-rpcqueue"].begin(), mapMultiArgs["-rpcqueue"].end());
+    BOOST_FOREACH (const std::string& strQueue, vQueues) {
+        std::vector<std::string> vParts;
+        boost::split(vParts, strQueue, boost::is_any_of(":"));
+        int nThreads, nPriority;
+        if (vParts.size() < 3 || vParts.size() > 4 || vParts[0].empty() ||
+            !ParseInt32(vParts[1], &nThreads) || nThreads < 1 || !ParseInt32(vParts[2], &nPriority)) {
+            uiInterface.ThreadSafeMessageBox(
+                strprintf("Invalid -rpcqueue=%s, expected <name>:<threads>:<priority>[:<method>,...]", strQueue),
+                "", CClientUIInterface::MSG_ERROR);
+            return false;
+        }
+        size_t nLane = workQueue->AddLane(vParts[0], nPriority, nThreads);
+        if (vParts.size() < 4)
+            continue;
+        std::vector<std::string> vMethods;
+        boost::split(vMethods, vParts[3], boost::is_any_of(","));
+        BOOST_FOREACH (const std::string& strMethod, vMethods) {
+            if (strMethod.empty())
+                continue;
+            if (strMethod[strMethod.size() - 1] == '*')
+                vMethodPrefixLanes.push_back(std::make_pair(strMethod.substr(0, strMethod.size() - 1), nLane));
+            else
+                mapMethodLanes[strMethod] = nLane;
+        }
+    }
+    BOOST_FOREACH (const HTTPWorkQueueInfo& info, workQueue->Info())
+        LogPrintf("HTTP: work queue lane %s of %d threads, priority %d\n", info.name, info.nThreads, info.nPriority);
+    return true;
+}
+
+/** The lane of the work queue of the requests calling a method */
+static size_t HTTPWorkQueueLane(const std::string& strMethod)
+{
+    std::map<std::string, size_t>::const_iterator it = mapMethodLanes.find(strMethod);
+    if (it != mapMethodLanes.end())
+        return it->second;
+    // The longest prefix matching, so z_sendmany can go apart from the other z_*
+    size_t nLane = 0, nLength = 0;
+    for (size_t i = 0; i < vMethodPrefixLanes.size(); i++) {
+        const std::string& strPrefix = vMethodPrefixLanes[i].first;
+        if (strPrefix.size() >= nLength && strMethod.compare(0, strPrefix.size(), strPrefix) == 0) {
+            nLane = vMethodPrefixLanes[i].second;
+            nLength = strPrefix.size();
+        }
+    }
+    return nLane;
+}
+
 /** HTTP request callback */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
@@ -285,9 +442,12 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
-        std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler));
+        size_t nLane = 0;
+        if (i->classifier)
+            nLane = HTTPWorkQueueLane(i->classifier(hreq.get()));
+        std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler, nLane));
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        if (workQueue->Enqueue(item.get(), nLane))
             item.release(); /* if true, queue took ownership */
         else
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
@@ -434,6 +594,13 @@ bool InitHTTPServer()
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
     workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    if (!InitHTTPWorkQueueLanes()) {
+        delete workQueue;
+        workQueue = 0;
+        evhttp_free(http);
+        event_base_free(base);
+        return false;
+    }
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -444,7 +611,7 @@ boost::thread threadHTTP;
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    int rpcThreads = workQueue->Threads();
     LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
     threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
 
@@ -561,6 +728,18 @@ std::pair<bool, std::string> HTTPRequest::GetHeader(const std::string& hdr)
         return std::make_pair(false, "");
 }
 
+std::pair<const char*, size_t> HTTPRequest::PeekBody()
+{
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return std::make_pair((const char*)NULL, 0);
+    size_t size = evbuffer_get_length(buf);
+    const char* data = (const char*)evbuffer_pullup(buf, size);
+    if (!data)
+        return std::make_pair((const char*)NULL, 0);
+    return std::make_pair(data, size);
+}
+
 std::string HTTPRequest::ReadBody()
 {
     struct evbuffer* buf = evhttp_request_get_input_buffer(req);
@@ -607,6 +786,41 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+void HTTPRequest::WriteReply(int nStatus, HTTPReplyBody& body)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_add_buffer(evb, body.evb);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+HTTPReplyBody::HTTPReplyBody() : evb(evbuffer_new())
+{
+    if (!evb)
+        throw std::runtime_error("evbuffer_new failed");
+}
+
+HTTPReplyBody::~HTTPReplyBody()
+{
+    evbuffer_free(evb);
+}
+
+void HTTPReplyBody::Write(const char* data, size_t size)
+{
+    if (evbuffer_add(evb, data, size) != 0)
+        throw std::runtime_error("evbuffer_add failed");
+}
+
+size_t HTTPReplyBody::Size() const
+{
+    return evbuffer_get_length(evb);
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -647,10 +861,54 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPRequestClassifier &classifier)
 {
     LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, classifier));
+}
+
+std::shared_ptr<HTTPWorkItem> ParkHTTPRequest(const HTTPRequestHandler& handler)
+{
+    assert(currentWorkItem && currentWorkItem->req);
+    return std::make_shared<HTTPWorkItem>(currentWorkItem->req.release(), currentWorkItem->path, handler, currentWorkItem->nLane);
+}
+
+void ResumeHTTPRequest(const std::shared_ptr<HTTPWorkItem>& parked)
+{
+    if (!parked->req)
+        return;
+    std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(parked->req.release(), parked->path, parked->func, parked->nLane));
+    if (workQueue && workQueue->Enqueue(item.get(), item->nLane))
+        item.release(); /* if true, queue took ownership */
+    else
+        item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
+}
+
+/** A task a handler shares with the other threads of its lane */
+class HTTPTaskItem : public HTTPClosure
+{
+public:
+    explicit HTTPTaskItem(const boost::function<void()>& task) : task(task) {}
+    void operator()() { task(); }
+
+private:
+    boost::function<void()> task;
+};
+
+bool QueueHTTPTask(const boost::function<void()>& task)
+{
+    std::unique_ptr<HTTPTaskItem> item(new HTTPTaskItem(task));
+    if (!workQueue || !workQueue->Enqueue(item.get(), currentWorkItem ? currentWorkItem->nLane : 0))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
+std::vector<HTTPWorkQueueInfo> GetHTTPWorkQueueInfo()
+{
+    if (!workQueue)
+        return std::vector<HTTPWorkQueueInfo>();
+    return workQueue->Info();
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
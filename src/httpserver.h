@@ -5,8 +5,10 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <memory>
 #include <string>
 #include <stdint.h>
+#include <vector>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/function.hpp>
@@ -14,9 +16,16 @@
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+//! -rpcqueue defaults: the calls of the miners and the transactions sent get threads of their own, served first
+static const char* const DEFAULT_HTTP_QUEUES[] = {
+    "mining:2:2:getblocktemplate,submitblock",
+    "transactions:1:1:sendrawtransaction",
+};
 
+struct evbuffer;
 struct evhttp_request;
 struct event_base;
+class AtomicHistogram;
 class CService;
 class HTTPRequest;
 
@@ -36,19 +45,79 @@ void StopHTTPServer();
 
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<void(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
+/** The method a request calls, run on the event loop thread to pick its -rpcqueue lane */
+typedef boost::function<std::string(HTTPRequest* req)> HTTPRequestClassifier;
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
- * be invoked.
+ * be invoked. The requests go to the default lane of the work queue
+ * without a classifier.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         const HTTPRequestClassifier &classifier = HTTPRequestClassifier());
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+class HTTPWorkItem;
+/**
+ * Take the request the handler running on this thread is handling, for handler to
+ * handle it on the work queue after ResumeHTTPRequest. The handler returns without
+ * replying, and the request holds no thread until it is resumed.
+ */
+std::shared_ptr<HTTPWorkItem> ParkHTTPRequest(const HTTPRequestHandler& handler);
+/** Queue a parked request again, from any thread */
+void ResumeHTTPRequest(const std::shared_ptr<HTTPWorkItem>& parked);
+
+/**
+ * Queue task for another thread of the lane of the request handled on this thread. False
+ * if the lane is full.
+ */
+bool QueueHTTPTask(const boost::function<void()>& task);
+
+/** A lane of the work queue, serving the requests of the methods -rpcqueue assigns to it */
+struct HTTPWorkQueueInfo
+{
+    std::string name;
+    //! The lanes of higher priority are served first
+    int nPriority;
+    //! Most threads handling the requests of the lane at once
+    int nThreads;
+    //! Requests waiting for a thread, and being handled
+    size_t nDepth;
+    int nRunning;
+    //! Requests refused as the lane held -rpcworkqueue of them
+    uint64_t nRejected;
+    //! Time the requests waited for a thread, in microseconds
+    std::shared_ptr<const AtomicHistogram> waitLatency;
+};
+
+/** The lanes of the work queue, empty before InitHTTPServer */
+std::vector<HTTPWorkQueueInfo> GetHTTPWorkQueueInfo();
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
 struct event_base* EventBase();
 
+/** Body of an HTTP reply, written in parts as it is produced and handed to
+ * HTTPRequest::WriteReply without being copied into one string.
+ */
+class HTTPReplyBody
+{
+private:
+    struct evbuffer* evb;
+    friend class HTTPRequest;
+
+    HTTPReplyBody(const HTTPReplyBody&);
+    void operator=(const HTTPReplyBody&);
+
+public:
+    HTTPReplyBody();
+    ~HTTPReplyBody();
+
+    void Write(const char* data, size_t size);
+    size_t Size() const;
+};
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -99,6 +168,12 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Request body, without consuming it.
+     * The data remains valid until ReadBody is called.
+     */
+    std::pair<const char*, size_t> PeekBody();
+
     /**
      * Write output header.
      *
@@ -115,6 +190,13 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     virtual void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Write HTTP reply with a body written beforehand, which is left empty.
+     *
+     * @note Can be called only once, as WriteReply above.
+     */
+    virtual void WriteReply(int nStatus, HTTPReplyBody& body);
 };
 
 /** Event handler closure.
@@ -9,22 +9,31 @@
 
 #include "init.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "addressindex.h"
 #include "addrman.h"
 #include "amount.h"
+#include "asyncrpcqueue.h"
 #ifdef ENABLE_MINING
 #include "base58.h"
 #endif
+#include "blockfilter.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "ioscheduler.h"
+#include "joinsplitprover.h"
 #include "key.h"
 #include "main.h"
 #include "metrics.h"
 #include "miner.h"
 #include "net.h"
+#include "notescan.h"
+#include "rpc/resultcache.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "scheduler.h"
 #include "txdb.h"
@@ -45,6 +54,7 @@
 #include <signal.h>
 #endif
 
+#include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/bind.hpp>
@@ -73,11 +83,13 @@ using namespace std;
 extern void ThreadSendAlert();
 
 ZCJoinSplit* pzcashParams = NULL;
+CScheduler* pschedulerMain = NULL;
 
 #ifdef ENABLE_WALLET
 CWallet* pwalletMain = NULL;
 #endif
-bool fFeeEstimatesInitialized = false;
+std::atomic<bool> fFeeEstimatesInitialized(false);
+static bool fDumpMempoolLater = false;
 
 #if ENABLE_ZMQ
 static CZMQNotificationInterface* pzmqNotificationInterface = NULL;
@@ -105,6 +117,8 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+/** Interval in seconds between two checkpoints of the fee estimates */
+static const int64_t FEE_ESTIMATES_DUMP_INTERVAL = 30 * 60;
 CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
 
 //////////////////////////////////////////////////////////////////////////////
@@ -164,10 +178,54 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
+static CCriticalSection cs_feeEstimatesFile;
+
+/**
+ * Write the fee estimates to a temporary file renamed over the previous one, so that
+ * a crash in the middle of a checkpoint still leaves a complete file behind
+ */
+static void DumpFeeEstimates()
+{
+    // Before the file is loaded the estimator holds less than the file
+    if (!fFeeEstimatesInitialized)
+        return;
+
+    LOCK(cs_feeEstimatesFile);
+    boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+    boost::filesystem::path est_path_tmp = GetDataDir() / (std::string(FEE_ESTIMATES_FILENAME) + ".new");
+    {
+        CAutoFile est_fileout(fopen(est_path_tmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (est_fileout.IsNull()) {
+            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path_tmp.string());
+            return;
+        }
+        if (!mempool.WriteFeeEstimates(est_fileout))
+            return;
+        FileCommit(est_fileout.Get());
+    }
+    if (!RenameOver(est_path_tmp, est_path))
+        LogPrintf("%s: Failed to rename fee estimates to %s\n", __func__, est_path.string());
+}
+
+/** Read the fee estimates saved by DumpFeeEstimates, while the node starts up */
+static void ThreadLoadFeeEstimates()
+{
+    int64_t nStart = GetTimeMillis();
+    {
+        LOCK(cs_feeEstimatesFile);
+        boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+        CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        // Allowed to fail as this file IS missing on first startup.
+        if (!est_filein.IsNull())
+            mempool.ReadFeeEstimates(est_filein);
+        fFeeEstimatesInitialized = true;
+    }
+    LogPrint("estimatefee", "Loaded fee estimates in %dms\n", GetTimeMillis() - nStart);
+}
+
 void Interrupt(boost::thread_group& threadGroup)
 {
     InterruptHTTPServer();
@@ -195,8 +253,11 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopHTTPMetrics();
     StopRPC();
     StopHTTPServer();
+    pschedulerMain = NULL;
+    StopJoinSplitProver();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(false);
@@ -212,22 +273,24 @@ void Shutdown()
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
 
-    if (fFeeEstimatesInitialized)
-    {
-        boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-        CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
-        if (!est_fileout.IsNull())
-            mempool.WriteFeeEstimates(est_fileout);
-        else
-            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
-        fFeeEstimatesInitialized = false;
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        DumpMempool();
     }
 
+    DumpFeeEstimates();
+    fFeeEstimatesInitialized = false;
+
+    StopBlockFilterIndexer();
+    StopNoteScanner();
+    StopAddressIndexer();
+    StopTxIndexer();
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
         }
+        StopUndoWriter();
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
@@ -236,6 +299,12 @@ void Shutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete paddressindex;
+        paddressindex = NULL;
+        delete pnotescandb;
+        pnotescandb = NULL;
+        delete pblockfilterdb;
+        pblockfilterdb = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -339,11 +408,17 @@ std::string HelpMessage(HelpMessageMode mode)
 
     string strUsage = HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("This help message"));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of the transparent outputs and inputs of every address and of the spent outputs, "
+        "used by the getaddress* and getspentinfo rpc calls and built in the background (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockcompression", strprintf(_("Store blocks and undo data compressed, and compress the block files written before, in the background (default: %u)"), DEFAULT_BLOCK_COMPRESSION));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain the compact filters of the blocks, built in the background, "
+        "and serve them to light clients with the getcfilters, getcfheaders and getcfcheckpt messages (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
+    strUsage += HelpMessageOpt("-compactundo", strprintf(_("Store undo data with each script spent again in a block as a reference, which older versions cannot read (default: %u)"), DEFAULT_COMPACT_UNDO));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), "zen.conf"));
     if (mode == HMM_BITCOIND)
     {
@@ -355,11 +430,26 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-disabledeprecation=<version>", strprintf(_("Disable block-height node deprecation and automatic shutdown (example: -disabledeprecation=%s)"),
         FormatVersion(CLIENT_VERSION)));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", _("If this block is in the chain assume that it and its ancestors are valid and skip their script and JoinSplit proof verification (0 to verify all, default: 0)"));
+    strUsage += HelpMessageOpt("-minimumchainwork=<hex>", _("Chain work the best header chain must have before -assumevalid skips any verification (default: 0)"));
+    strUsage += HelpMessageOpt("-blockcheckthreads=<n>", strprintf(_("Set the number of threads checking received blocks ahead of their connection (0 to %d, 0 = check them on the message handler thread, default: %d)"),
+        MAX_BLOCKCHECK_THREADS, DEFAULT_BLOCKCHECK_THREADS));
+    strUsage += HelpMessageOpt("-blockservecache=<n>", strprintf(_("Keep in memory up to <n> MiB of the blocks most recently served to peers and REST clients, 0 = disabled (default: %u)"), DEFAULT_BLOCK_SERVE_CACHE));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dboption=<db>.<key>=<n>", _("Tune the chainstate or blockindex database: blocksize (bytes), bloombits, maxopenfiles, compression (0 or 1) "
+        "or writebuffer (percent of its cache), see getdbinfo for the values in use (can be specified multiple times)"));
+    strUsage += HelpMessageOpt("-iobackgroundlimit=<n>", strprintf(_("Limit the rewrites of compressed block files and the writes of the transaction and address indexes to <n> MiB/s, "
+        "they also wait for the block writes in progress, see getioinfo (0 = unlimited, default: %d)"), DEFAULT_IO_BACKGROUND_LIMIT));
+    strUsage += HelpMessageOpt("-loadsnapshot=<file>", _("Fill an empty chainstate database from a snapshot written by dumpchainstate on startup, or once the headers up to the snapshot block are synced"));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
+    strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
-    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+    strUsage += HelpMessageOpt("-notescan", strprintf(_("Scan the blocks for the notes paid to the viewing keys watched with z_watchviewingkey, "
+        "kept without what it takes to spend them and listed by z_listwatchednotes (default: %u)"), DEFAULT_NOTESCAN));
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script, JoinSplit proof and header verification, and wallet note decryption, threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "zend.pid"));
@@ -367,12 +457,22 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-prunehotfiles=<n>", strprintf(_("With -prune, delete the <n> block files most read by peers and clients last (default: %u)"), DEFAULT_PRUNE_HOT_FILES));
+    strUsage += HelpMessageOpt("-prunekeepblocks=<n>", strprintf(_("With -prune, keep the block files holding any of the last <n> blocks (minimum and default: %u)"), MIN_BLOCKS_TO_KEEP));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
     strUsage += HelpMessageOpt("-reindexfast", _("Rebuild block chain index from current blk000??.dat files on startup, skipping expensive checks for blocks below checkpoints. It is incompatible with reindex"));
+    strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf(_("Set the number of threads running the periodic tasks of each priority, the latency-sensitive ones and the slow maintenance ones (1 to 16, default: %d)"), DEFAULT_SCHEDULER_THREADS));
     #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-prover=<host>[:<port>]", _("Compute the JoinSplit proofs on the node at <host>, through its RPC, which receives the spending keys of the notes spent: reach a prover on another host through an encrypted tunnel"));
+    strUsage += HelpMessageOpt("-proverauth=<user>:<pw>", _("RPC credentials of the -prover node"));
+    strUsage += HelpMessageOpt("-proverthreads=<n>", strprintf(_("Compute the JoinSplit proofs, of this node and of the nodes proving on it, on <n> threads in the order they are asked for, 0 = on the threads asking for them (default: %u)"), DEFAULT_PROVER_THREADS));
+    strUsage += HelpMessageOpt("-provertimeout=<n>", strprintf(_("Timeout of a proof computed by the -prover node, in seconds (default: %u)"), DEFAULT_PROVER_TIMEOUT));
+    strUsage += HelpMessageOpt("-verifyonly", strprintf(_("Only verify shielded proofs, without the Sprout proving key, which is then neither required nor mapped; shielded transactions cannot be created (default: %u)"), 0));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-validationqueue=<n>", strprintf(_("Queue up to <n> notifications for the ZeroMQ and AMQP publishers, which are sent on a thread of their own, "
+                                                         "before validation waits for them (default: %u)"), DEFAULT_VALIDATION_QUEUE_SIZE));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -380,16 +480,26 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), 86400));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s)"));
+    strUsage += HelpMessageOpt("-connectthreads=<n>", strprintf(_("Set the number of outbound connection attempts in flight at once (1 to %d, default: %d)"),
+        MAX_CONNECT_THREADS, DEFAULT_CONNECT_THREADS));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)"));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect)"));
     strUsage += HelpMessageOpt("-externalip=<ip>", _("Specify your own public address"));
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-highbandwidthrelay", strprintf(_("Push new blocks as compact blocks to whitelisted peers asking for it, right after their header and proof of work are checked and before full validation (default: %u)"), DEFAULT_HIGH_BANDWIDTH_RELAY));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect)"));
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
+    strUsage += HelpMessageOpt("-maxknowninventory=<n>", strprintf(_("Remember up to <n> inventory entries known to each peer, not to announce them again (%u to %u, default: %u)"),
+        MIN_KNOWN_INVENTORY, MAX_KNOWN_INVENTORY, DEFAULT_MAX_KNOWN_INVENTORY));
+    strUsage += HelpMessageOpt("-maxpeeruploadrate=<n>", strprintf(_("Send at most <n> KiB per second to each non-whitelisted peer, 0 = no limit (default: %u)"), DEFAULT_MAX_PEER_UPLOAD_RATE));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d). "
+        "Once it is near, historical blocks are not served anymore to non-whitelisted peers"), DEFAULT_MAX_UPLOAD_TARGET));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Set the number of threads processing peer messages, each one handling a subset of the peers (1 to %d, default: %d)"),
+        MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
@@ -436,6 +546,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat"));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), true));
+    strUsage += HelpMessageOpt("-walletstore=<store>", strprintf(_("Storage of a new wallet file, bdb (Berkeley DB) or log (append-only log); an existing one keeps its own (default: %s)"), DEFAULT_WALLET_STORE));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
         " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
@@ -447,6 +558,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubsequence=<address>", _("Enable publish the blocks connected and disconnected and the mempool acceptances and removals in <address>"));
 #endif
 
 #if ENABLE_PROTON
@@ -455,11 +567,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-amqppubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-amqppubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-amqppubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-amqppubsequence=<address>", _("Enable publish the blocks connected and disconnected and the mempool acceptances and removals in <address>"));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
     if (showDebug)
     {
+        strUsage += HelpMessageOpt("-checkblockindexincremental", strprintf("With -checkblockindex, only re-check the block tree entries changed since the previous check, as long as the tip did not lose work (default: %u)", 0));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", 1));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)", 100));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", 0));
@@ -475,6 +589,7 @@ std::string HelpMessage(HelpMessageMode mode)
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + debugCategories + ".");
     strUsage += HelpMessageOpt("-experimentalfeatures", _("Enable use of experimental features"));
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
+    strUsage += HelpMessageOpt("-lockprofile", strprintf(_("Count the time each LOCK site of the source waits for its mutex and holds it, returned by getlockprofile (default: %u)"), DEFAULT_LOCK_PROFILE));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
     strUsage += HelpMessageOpt("-logtimemicros", strprintf(_("Meaningful if -logtimestamps=1. In debug output timestamp reports microseconds (default: %u)"), 0));
@@ -482,7 +597,8 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", 50000));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxjoinsplitcachesize=<n>", strprintf("Limit size of the cache of transactions with verified JoinSplits to <n> entries (default: %u)", DEFAULT_MAX_JOINSPLIT_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying (default: %s)"),
         CURRENCY_UNIT, FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -513,6 +629,7 @@ std::string HelpMessage(HelpMessageMode mode)
         " 0  or negative values means no limit is applied. (default: %d)"
         ), DEFAULT_BLOCK_MAX_COMPLEXITY_SIZE)
     );
+    strUsage += HelpMessageOpt("-longpollfeedelta=<amt>", strprintf(_("Answer a getblocktemplate long poll as soon as transactions paying at least <amt> in fees (in %s) have entered the mempool since its template (default: 0 = only after a minute)"), CURRENCY_UNIT));
     strUsage += HelpMessageOpt("-deprecatedgetblocktemplate", (_("Disable block complexity calculation and use the previous GetBlockTemplate implementation")));
 
     strUsage += HelpMessageOpt("-cbhsafedepth=<n>",
@@ -533,7 +650,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("Mining options:"));
     strUsage += HelpMessageOpt("-gen", strprintf(_("Generate coins (default: %u)"), 0));
     strUsage += HelpMessageOpt("-genproclimit=<n>", strprintf(_("Set the number of threads for coin generation if enabled (-1 = all cores, default: %d)"), 1));
-    strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled (default: \"default\")"));
+    strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled: \"default\", \"tromp\" or \"parallel\" (default: \"default\")"));
+    strUsage += HelpMessageOpt("-equihashsolverthreads=<n>", strprintf(_("Set the number of threads of each \"parallel\" Equihash solver (0 = all cores, default: %d)"), 0));
     strUsage += HelpMessageOpt("-mineraddress=<addr>", _("Send mined coins to a specific single address"));
     strUsage += HelpMessageOpt("-minetolocalwallet", strprintf(
             _("Require that mined blocks use a coinbase address in the local wallet (default: %u)"),
@@ -548,17 +666,24 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-metricsendpoint", strprintf(_("Serve the metrics of this node to Prometheus at /metrics of the RPC port, without authentication like REST (default: %u)"), 0));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 8232, 18232));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Execute the read-only calls of a JSON-RPC batch on up to <n> RPC threads at once (default: %d)"), DEFAULT_RPC_BATCH_THREADS));
+    strUsage += HelpMessageOpt("-rpcresultcache=<n>", strprintf(_("Keep in memory up to <n> MiB of the results of getblock and getrawtransaction for the active chain, 0 = disabled (default: %u)"), DEFAULT_RPC_RESULT_CACHE));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcqueue=<name>:<threads>:<priority>[:<method>,...]", strprintf(_("Serve the RPC calls of the methods (a trailing * matching a prefix) in a queue with threads of its own, "
+        "before the calls of the queues of lower priority. The other calls go to the queue default, of priority 0 and -rpcthreads threads. "
+        "This option can be specified multiple times, a name given again changes the queue (default: %s)"), boost::algorithm::join(std::vector<std::string>(DEFAULT_HTTP_QUEUES, DEFAULT_HTTP_QUEUES + ARRAYLEN(DEFAULT_HTTP_QUEUES)), " ")));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
+    strUsage += HelpMessageOpt("-rpcasyncretain=<n>", strprintf(_("Keep the results of up to <n> finished z_sendmany and z_shieldcoinbase operations for z_getoperationresult, dropping the oldest beyond (default: %u)"), DEFAULT_ASYNC_RPC_RETAINED_OPERATIONS));
     // Disabled until we can lock notes and also tune performance of libsnark which by default uses multiple threads
     //strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads to service Async RPC calls (default: %d)"), 1));
 
@@ -644,35 +769,14 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     if (fReindex || fReindexFast)
     {
         CImportingNow imp;
-        int nFile = 0;
-        if (fReindexFast) uiInterface.InitMessage(_("Reindexing block headers from files..."));
-        while (fReindexFast)
-        {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file) break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat, headers-only...\n", (unsigned int)nFile);
-            LoadBlocksFromExternalFile(file, &pos, /*loadHeadersOnly*/true);
-            nFile++;
-        }
-        if (fReindexFast)
+        if (fReindexFast) {
+            uiInterface.InitMessage(_("Reindexing block headers from files..."));
+            ReindexBlockFiles(/*loadHeadersOnly*/true);
             LogPrintf("Headers-only reindexing finished. Going on with blocks\n");
+        }
 
-        nFile = 0;
         uiInterface.InitMessage(_("Reindexing block from files..."));
-        while (true)
-        {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file) break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadBlocksFromExternalFile(file, &pos, /*loadHeadersOnly*/false);
-            nFile++;
-        }
+        ReindexBlockFiles(/*loadHeadersOnly*/false);
 
         pblocktree->WriteReindexing(false);
         fReindex = false;
@@ -716,6 +820,12 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        // A mempool whose loading was interrupted is not saved over the file
+        fDumpMempoolLater = !fRequestShutdown;
+    }
 }
 
 void ThreadNotifyRecentlyAdded()
@@ -761,9 +871,11 @@ static void ZC_LoadParams()
     boost::filesystem::path sapling_spend = ZC_GetParamsDir() / "sapling-spend.params";
     boost::filesystem::path sapling_output = ZC_GetParamsDir() / "sapling-output.params";
     boost::filesystem::path sprout_groth16 = ZC_GetParamsDir() / "sprout-groth16.params";
+    // A node which only verifies never proves with the Sprout proving key
+    const bool fVerifyOnly = GetBoolArg("-verifyonly", false);
 
     if (!(
-        boost::filesystem::exists(pk_path) &&
+        (fVerifyOnly || boost::filesystem::exists(pk_path)) &&
         boost::filesystem::exists(vk_path) &&
         boost::filesystem::exists(sapling_spend) &&
         boost::filesystem::exists(sapling_output) &&
@@ -782,7 +894,7 @@ static void ZC_LoadParams()
     LogPrintf("Loading verifying key from %s\n", vk_path.string().c_str());
     gettimeofday(&tv_start, 0);
 
-    pzcashParams = ZCJoinSplit::Prepared(vk_path.string(), pk_path.string());
+    pzcashParams = ZCJoinSplit::Prepared(vk_path.string(), fVerifyOnly ? "" : pk_path.string());
 
     gettimeofday(&tv_end, 0);
     elapsed = float(tv_end.tv_sec-tv_start.tv_sec) + (tv_end.tv_usec-tv_start.tv_usec)/float(1000000);
@@ -823,6 +935,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", false) && !StartREST())
         return false;
+    if (GetBoolArg("-metricsendpoint", false) && !StartHTTPMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -910,6 +1024,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fLogTimestamps = GetBoolArg("-logtimestamps", true);
     fLogTimeMicros = GetBoolArg("-logtimemicros", false);
     fLogIPs = GetBoolArg("-logips", false);
+    fLockProfile = GetBoolArg("-lockprofile", DEFAULT_LOCK_PROFILE);
 
     LogPrintf("Horizen version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
 
@@ -982,6 +1097,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", false))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (mapArgs.count("-loadsnapshot"))
+            return InitError(_("Prune mode is incompatible with -loadsnapshot."));
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
+        if (GetBoolArg("-notescan", DEFAULT_NOTESCAN))
+            return InitError(_("Prune mode is incompatible with -notescan."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
 #ifdef ENABLE_WALLET
         if (!GetBoolArg("-disablewallet", false)) {
             if (SoftSetBoolArg("-disablewallet", true))
@@ -1050,7 +1173,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Checkmempool and checkblockindex default to true in regtest mode
     mempool.setSanityCheck(GetBoolArg("-checkmempool", chainparams.DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fCheckBlockIndexIncremental = GetBoolArg("-checkblockindexincremental", false);
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
+    fBlockCompression = GetBoolArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION);
+    fCompactUndo = GetBoolArg("-compactundo", DEFAULT_COMPACT_UNDO);
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    SetIOBackgroundLimit(std::max<int64_t>(0, GetArg("-iobackgroundlimit", DEFAULT_IO_BACKGROUND_LIMIT)) << 20);
+
+    hashAssumeValid = uint256S(GetArg("-assumevalid", "0"));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid scripts and proofs.\n", hashAssumeValid.GetHex());
+    nMinimumChainWork = UintToArith256(uint256S(GetArg("-minimumchainwork", "0")));
+    if (nMinimumChainWork > 0)
+        LogPrintf("Setting nMinimumChainWork=%s\n", nMinimumChainWork.GetHex());
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
@@ -1061,6 +1196,38 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nBlockCheckThreads = GetArg("-blockcheckthreads", DEFAULT_BLOCKCHECK_THREADS);
+    if (nBlockCheckThreads < 0)
+        nBlockCheckThreads = 0;
+    else if (nBlockCheckThreads > MAX_BLOCKCHECK_THREADS)
+        nBlockCheckThreads = MAX_BLOCKCHECK_THREADS;
+
+    nMessageHandlerThreads = GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS);
+    if (nMessageHandlerThreads < 1)
+        nMessageHandlerThreads = 1;
+    else if (nMessageHandlerThreads > MAX_MESSAGE_HANDLER_THREADS)
+        nMessageHandlerThreads = MAX_MESSAGE_HANDLER_THREADS;
+
+    nConnectThreads = GetArg("-connectthreads", DEFAULT_CONNECT_THREADS);
+    if (nConnectThreads < 1)
+        nConnectThreads = 1;
+    else if (nConnectThreads > MAX_CONNECT_THREADS)
+        nConnectThreads = MAX_CONNECT_THREADS;
+
+    nMaxKnownInventory = std::max(std::min(GetArg("-maxknowninventory", DEFAULT_MAX_KNOWN_INVENTORY), (int64_t)MAX_KNOWN_INVENTORY),
+                                  (int64_t)MIN_KNOWN_INVENTORY);
+
+    if (mapArgs.count("-maxuploadtarget")) {
+        int64_t nMaxUploadTarget = GetArg("-maxuploadtarget", DEFAULT_MAX_UPLOAD_TARGET);
+        if (nMaxUploadTarget < 0)
+            return InitError(_("-maxuploadtarget cannot be configured with a negative value."));
+        CNode::SetMaxOutboundTarget(nMaxUploadTarget * 1024 * 1024);
+    }
+    int64_t nMaxPeerUploadRate = GetArg("-maxpeeruploadrate", DEFAULT_MAX_PEER_UPLOAD_RATE);
+    if (nMaxPeerUploadRate < 0)
+        return InitError(_("-maxpeeruploadrate cannot be configured with a negative value."));
+    CNode::SetMaxPeerUploadRate(nMaxPeerUploadRate * 1024);
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MB) to allot for block & undo files
@@ -1076,6 +1243,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
         fPruneMode = true;
     }
+    int64_t nSignedPruneKeepBlocks = GetArg("-prunekeepblocks", MIN_BLOCKS_TO_KEEP);
+    if (nSignedPruneKeepBlocks < MIN_BLOCKS_TO_KEEP)
+        return InitError(strprintf(_("-prunekeepblocks cannot be configured below %u."), MIN_BLOCKS_TO_KEEP));
+    nPruneKeepBlocks = (unsigned int)std::min<int64_t>(nSignedPruneKeepBlocks, std::numeric_limits<int>::max());
+    nPruneHotFiles = (unsigned int)std::max<int64_t>(0, std::min<int64_t>(GetArg("-prunehotfiles", DEFAULT_PRUNE_HOT_FILES), 1000000));
 
 
 #ifdef ENABLE_WALLET
@@ -1092,6 +1264,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // a transaction spammer can cheaply fill blocks using
     // 1-satoshi-fee transactions. It should be set above the real
     // cost to you of processing a transaction.
+    if (mapArgs.count("-longpollfeedelta"))
+    {
+        CAmount n = 0;
+        if (!ParseMoney(mapArgs["-longpollfeedelta"], n) || n < 0)
+            return InitError(strprintf(_("Invalid amount for -longpollfeedelta=<amount>: '%s'"), mapArgs["-longpollfeedelta"]));
+    }
     if (mapArgs.count("-minrelaytxfee"))
     {
         CAmount n = 0;
@@ -1143,6 +1321,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", false);
 
     std::string strWalletFile = GetArg("-wallet", "wallet.dat");
+    const std::string strWalletStore = GetArg("-walletstore", DEFAULT_WALLET_STORE);
+    if (strWalletStore != "bdb" && strWalletStore != "log")
+        return InitError(strprintf(_("Unknown -walletstore: '%s'"), strWalletStore));
 #endif // ENABLE_WALLET
 
     fIsBareMultisigStd = GetBoolArg("-permitbaremultisig", true);
@@ -1164,6 +1345,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 #endif
 
+    // The mempool must be able to hold at least one full block worth of transactions
+    int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    if (nMempoolSizeMax < 0 || nMempoolSizeMax < (int64_t)MAX_BLOCK_SIZE)
+        return InitError(strprintf(_("-maxmempool must be at least %d MB"), (MAX_BLOCK_SIZE + 999999) / 1000000));
+
     // Default value of 0 for mempooltxinputlimit means no limit is applied
     if (mapArgs.count("-mempooltxinputlimit")) {
         int64_t limit = GetArg("-mempooltxinputlimit", 0);
@@ -1182,6 +1368,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
 
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1239,11 +1428,36 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadJoinSplitCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinsFetch);
+#ifdef ENABLE_WALLET
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadNoteDecryption);
+#endif
+    }
+
+    if (nBlockCheckThreads) {
+        LogPrintf("Using %u threads for checking received blocks\n", nBlockCheckThreads);
+        for (int i=0; i<nBlockCheckThreads; i++)
+            threadGroup.create_thread(&ThreadBlockPreCheck);
+        threadGroup.create_thread(&ThreadBlockConnect);
     }
 
-    // Start the lightweight task scheduler thread
-    CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    // Start the lightweight task scheduler threads, a pool for each priority so that the
+    // slow maintenance tasks do not delay the latency-sensitive ones
+    const int nSchedulerThreads = std::max(1, std::min(16, (int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS)));
+    void (CScheduler::*serviceQueue)(SchedulerPriority) = &CScheduler::serviceQueue;
+    CScheduler::Function serviceHigh = boost::bind(serviceQueue, &scheduler, SCHEDULER_PRIORITY_HIGH);
+    CScheduler::Function serviceLow = boost::bind(serviceQueue, &scheduler, SCHEDULER_PRIORITY_LOW);
+    for (int i = 0; i < nSchedulerThreads; i++) {
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler-high", serviceHigh));
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler-low", serviceLow));
+    }
+    pschedulerMain = &scheduler;
 
     // Count uptime
     MarkStartTime();
@@ -1260,9 +1474,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // want any of libsnark's profiling in production anyway.
     libsnark::inhibit_profiling_info = true;
     libsnark::inhibit_profiling_counters = true;
+    // The phases of the proofs are timed by the metrics instead
+    ConnectSnarkMetrics();
 
     // Initialize Zcash circuit parameters
     ZC_LoadParams();
+    {
+        std::string strError;
+        if (!StartJoinSplitProver(pzcashParams, strError))
+            return InitError(strError);
+    }
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1316,6 +1537,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    fHighBandwidthRelay = GetBoolArg("-highbandwidthrelay", DEFAULT_HIGH_BANDWIDTH_RELAY);
+
     if (mapArgs.count("-whitelist")) {
         BOOST_FOREACH(const std::string& net, mapMultiArgs["-whitelist"]) {
             CSubNet subnet(net);
@@ -1425,7 +1648,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     pzmqNotificationInterface = CZMQNotificationInterface::CreateWithArguments(mapArgs);
 
     if (pzmqNotificationInterface) {
-        RegisterValidationInterface(pzmqNotificationInterface);
+        RegisterValidationInterface(pzmqNotificationInterface, true);
     }
 #endif
 
@@ -1440,7 +1663,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("AMQP support requires -experimentalfeatures."));
         }
 
-        RegisterValidationInterface(pAMQPNotificationInterface);
+        RegisterValidationInterface(pAMQPNotificationInterface, true);
     }
 #endif
 
@@ -1484,13 +1707,32 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
         nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nAddressIndexCache = fAddressIndex ? nTotalCache / 8 : 0;
+    nTotalCache -= nAddressIndexCache;
+    const bool fNoteScan = GetBoolArg("-notescan", DEFAULT_NOTESCAN);
+    int64_t nNoteScanCache = fNoteScan ? std::min(nTotalCache / 32, (int64_t)(8 << 20)) : 0;
+    nTotalCache -= nNoteScanCache;
+    const bool fBlockFilterIndex = GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+    int64_t nBlockFilterCache = fBlockFilterIndex ? std::min(nTotalCache / 16, (int64_t)(64 << 20)) : 0;
+    nTotalCache -= nBlockFilterCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    if (fAddressIndex)
+        LogPrintf("* Using %.1fMiB for address index database\n", nAddressIndexCache * (1.0 / 1024 / 1024));
+    if (fNoteScan)
+        LogPrintf("* Using %.1fMiB for note scan database\n", nNoteScanCache * (1.0 / 1024 / 1024));
+    if (fBlockFilterIndex)
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nBlockFilterCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    nBlockServeCacheUsage = std::max((int64_t)0, GetArg("-blockservecache", DEFAULT_BLOCK_SERVE_CACHE)) << 20;
+    LogPrintf("* Using %.1fMiB for served blocks\n", nBlockServeCacheUsage * (1.0 / 1024 / 1024));
+    nRPCResultCacheUsage = std::max((int64_t)0, GetArg("-rpcresultcache", DEFAULT_RPC_RESULT_CACHE)) << 20;
+    if (nRPCResultCacheUsage > 0)
+        LogPrintf("* Using %.1fMiB for RPC results\n", nRPCResultCacheUsage * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1513,6 +1755,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading the coins database");
+                    break;
+                }
+
+                // A snapshot load cut short leaves records past those of the genesis block, its best block
+                if (!pcoinsdbview->ClearInterruptedSnapshot()) {
+                    strLoadError = _("Error clearing an interrupted chainstate snapshot load");
+                    break;
+                }
+
                 if (fReindex || fReindexFast) {
                     if (fReindex) pblocktree->WriteReindexing(true);
                     if (fReindexFast) pblocktree->WriteFastReindexing(true);
@@ -1526,6 +1779,25 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // A snapshot fills a chainstate holding at most the genesis block, right away if the block index
+                // has the snapshot block, or else once headers sync has brought it in
+                if (mapArgs.count("-loadsnapshot") && !fReset &&
+                    (chainActive.Tip() == NULL || chainActive.Tip()->GetBlockHash() == chainparams.GetConsensus().hashGenesisBlock)) {
+                    CChainstateSnapshotInfo info;
+                    if (!CCoinsViewDB::ReadSnapshotInfo(GetArg("-loadsnapshot", ""), info))
+                        return InitError(_("Error loading chainstate snapshot"));
+                    {
+                        LOCK(cs_main);
+                        SetSnapshotPending(GetArg("-loadsnapshot", ""), info.hashBlock);
+                        if (mapBlockIndex.count(info.hashBlock))
+                            uiInterface.InitMessage(_("Loading chainstate snapshot..."));
+                        else
+                            LogPrintf("Chainstate snapshot of block %s waits for the header of its block\n", info.hashBlock.ToString());
+                    }
+                    if (!LoadPendingSnapshot())
+                        return InitError(_("Error loading chainstate snapshot"));
+                }
+
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
@@ -1550,6 +1822,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // The background validation of a snapshot needs every block up to the snapshot block
+                CChainstateSnapshotInfo snapshotBase;
+                if (fPruneMode && pcoinsdbview->ReadSnapshotBase(snapshotBase)) {
+                    strLoadError = _("Prune mode is incompatible with a chainstate snapshot that is still being validated. Restart without -prune until it is");
+                    break;
+                }
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
                 if (fHavePruned && GetArg("-checkblocks", 288) > MIN_BLOCKS_TO_KEEP) {
                     LogPrintf("Prune: pruned datadir may not have more than %d blocks; -checkblocks=%d may fail\n",
@@ -1599,12 +1878,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
-    boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-    CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
-    // Allowed to fail as this file IS missing on first startup.
-    if (!est_filein.IsNull())
-        mempool.ReadFeeEstimates(est_filein);
-    fFeeEstimatesInitialized = true;
+    // Most nullifiers looked up are new, which the filter answers without reading the database
+    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "nullfilter",
+                                          boost::function<void()>(boost::bind(&CCoinsViewDB::LoadNullifierFilter, pcoinsdbview))));
+
+    // The estimator starts tracking right away, the saved history joins it once read
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "feeestimates", &ThreadLoadFeeEstimates));
 
 
     // ********************************************************* Step 8: load wallet
@@ -1794,6 +2073,55 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (mapArgs.count("-blocknotify"))
         uiInterface.NotifyBlockTip.connect(BlockNotifyCallback);
 
+    StartUndoWriter();
+
+    if (fTxIndex)
+        StartTxIndexer();
+
+    if (fAddressIndex) {
+        paddressindex = new CAddressIndexDB(nAddressIndexCache, false, fReindex || fReindexFast);
+        uint256 hashBest;
+        if (paddressindex->ReadBestBlock(hashBest) && LookupBlockIndex(hashBest) == NULL) {
+            LogPrintf("The last block of the address index is not in the block index, rebuilding the address index\n");
+            delete paddressindex;
+            paddressindex = new CAddressIndexDB(nAddressIndexCache, false, true);
+        }
+        StartAddressIndexer();
+    }
+
+    if (fNoteScan) {
+        // The notes are kept across reindexes, the blocks scanned being the same
+        pnotescandb = new CNoteScanDB(nNoteScanCache);
+        uint256 hashBest;
+        if (pnotescandb->ReadBestBlock(hashBest) && LookupBlockIndex(hashBest) == NULL) {
+            LogPrintf("The last block of the note scan is not in the block index, scanning from the tip\n");
+            std::vector<CNoteScanKey> vKeys;
+            pnotescandb->ReadKeys(vKeys);
+            delete pnotescandb;
+            pnotescandb = new CNoteScanDB(nNoteScanCache, false, true);
+            CNoteScanBatch batch(*pnotescandb, *pzcashParams);
+            for (CNoteScanKey& key : vKeys) {
+                key.nNextHeight = key.nStartHeight;
+                batch.WriteKey(key);
+            }
+            if (!batch.Write(uint256()))
+                return InitError(_("Failed to write to the note scan database"));
+        }
+        StartNoteScanner();
+    }
+
+    if (fBlockFilterIndex) {
+        pblockfilterdb = new CBlockFilterDB(nBlockFilterCache, false, fReindex || fReindexFast);
+        uint256 hashBest;
+        if (pblockfilterdb->ReadBestBlock(hashBest) && LookupBlockIndex(hashBest) == NULL) {
+            LogPrintf("The last block of the block filter index is not in the block index, rebuilding the block filter index\n");
+            delete pblockfilterdb;
+            pblockfilterdb = new CBlockFilterDB(nBlockFilterCache, false, true);
+        }
+        StartBlockFilterIndexer();
+        nLocalServices |= NODE_COMPACT_FILTERS;
+    }
+
     uiInterface.InitMessage(_("Activating best chain..."));
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
     CValidationState state;
@@ -1807,6 +2135,21 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+
+    // Compress the records of the block files written without -blockcompression
+    if (fBlockCompression)
+        threadGroup.create_thread(&ThreadCompressBlockFiles);
+
+    // Validate a chainstate loaded from a snapshot against the block chain, at low priority,
+    // after loading one still waiting for its block header
+    CChainstateSnapshotInfo snapshot;
+    bool fSnapshotPending;
+    {
+        LOCK(cs_main);
+        fSnapshotPending = IsSnapshotPending();
+    }
+    if (fSnapshotPending || pcoinsdbview->ReadSnapshotBase(snapshot))
+        threadGroup.create_thread(&ThreadSnapshotValidation);
     if (chainActive.Tip() == NULL) {
         LogPrintf("Waiting for genesis block to be imported...\n");
         while (!fRequestShutdown && chainActive.Tip() == NULL)
@@ -1843,7 +2186,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nPowTargetSpacing = Params().GetConsensus().nPowTargetSpacing;
     CScheduler::Function f = boost::bind(&PartitionCheck, &IsInitialBlockDownload,
                                          boost::ref(cs_main), boost::cref(pindexBestHeader), nPowTargetSpacing);
-    scheduler.scheduleEvery(f, nPowTargetSpacing);
+    scheduler.scheduleEvery(f, nPowTargetSpacing, SCHEDULER_PRIORITY_HIGH, "partitioncheck");
+
+    // Sweep the transactions which stayed too long in the mempool
+    scheduler.scheduleEvery(&ExpireMempoolTransactions, MEMPOOL_EXPIRY_SWEEP_INTERVAL, SCHEDULER_PRIORITY_HIGH, "mempoolexpiry");
+
+    // Checkpoint the fee estimates, so that an unclean exit keeps most of their history
+    scheduler.scheduleEvery(&DumpFeeEstimates, FEE_ESTIMATES_DUMP_INTERVAL, SCHEDULER_PRIORITY_LOW, "feeestimates");
 
 #ifdef ENABLE_MINING
     // Generate coins in the background
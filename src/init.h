@@ -20,6 +20,8 @@ class thread_group;
 
 extern CWallet* pwalletMain;
 extern ZCJoinSplit* pzcashParams;
+//! The scheduler of AppInit2, while it runs tasks
+extern CScheduler* pschedulerMain;
 
 void StartShutdown();
 bool ShutdownRequested();
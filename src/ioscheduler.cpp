@@ -0,0 +1,109 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ioscheduler.h"
+
+#include "utiltime.h"
+
+#include <algorithm>
+
+#include <boost/thread.hpp>
+
+namespace {
+
+boost::mutex csIO;
+//! Signalled when no critical operation is in progress any more
+boost::condition_variable condNoCritical;
+int nCriticalInProgress = 0;
+int64_t nBackgroundLimit = 0;
+//! When the rate limit lets the next rate limited operation start
+int64_t nNextThrottledMicros = 0;
+CIOClassStats vStats[IO_CLASSES];
+
+bool IsThrottled(IOClass ioClass)
+{
+    return ioClass == IO_REWRITE || ioClass == IO_INDEX;
+}
+
+} // anon namespace
+
+std::string GetIOClassName(IOClass ioClass)
+{
+    switch (ioClass) {
+    case IO_BLOCK: return "block";
+    case IO_UNDO: return "undo";
+    case IO_FLUSH: return "flush";
+    case IO_COMPACTION: return "compaction";
+    case IO_PRUNE: return "prune";
+    case IO_REWRITE: return "rewrite";
+    case IO_INDEX: return "index";
+    default: return "unknown";
+    }
+}
+
+void SetIOBackgroundLimit(int64_t nBytesPerSecond)
+{
+    boost::unique_lock<boost::mutex> lock(csIO);
+    nBackgroundLimit = nBytesPerSecond;
+}
+
+CIOClassStats GetIOClassStats(IOClass ioClass)
+{
+    boost::unique_lock<boost::mutex> lock(csIO);
+    return vStats[ioClass];
+}
+
+CIOOperation::CIOOperation(IOClass ioClassIn, size_t nBytesIn) : ioClass(ioClassIn), nBytes(nBytesIn)
+{
+    const int64_t nWaitStart = GetTimeMicros();
+    int64_t nThrottledStart = 0;
+    bool fDeferred = false;
+    {
+        boost::unique_lock<boost::mutex> lock(csIO);
+        if (ioClass == IO_BLOCK) {
+            nCriticalInProgress++;
+        } else {
+            const boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(IO_MAX_DEFER_MS);
+            while (nCriticalInProgress > 0) {
+                fDeferred = true;
+                if (!condNoCritical.timed_wait(lock, deadline))
+                    break;
+            }
+            if (IsThrottled(ioClass) && nBackgroundLimit > 0 && nBytes > 0) {
+                nThrottledStart = std::max(GetTimeMicros(), nNextThrottledMicros);
+                nNextThrottledMicros = nThrottledStart + (int64_t)(nBytes * 1000000.0 / nBackgroundLimit);
+            }
+        }
+    }
+    const int64_t nSleep = nThrottledStart - GetTimeMicros();
+    if (nSleep > 0) {
+        fDeferred = true;
+        MilliSleep(nSleep / 1000);
+    }
+    nStart = GetTimeMicros();
+
+    if (fDeferred) {
+        boost::unique_lock<boost::mutex> lock(csIO);
+        vStats[ioClass].nDeferred++;
+        vStats[ioClass].nDeferMicros += nStart - nWaitStart;
+    }
+}
+
+CIOOperation::~CIOOperation()
+{
+    const int64_t nBusy = GetTimeMicros() - nStart;
+    bool fNoCritical = false;
+    {
+        boost::unique_lock<boost::mutex> lock(csIO);
+        if (ioClass == IO_BLOCK)
+            fNoCritical = --nCriticalInProgress == 0;
+        CIOClassStats& stats = vStats[ioClass];
+        stats.nOps++;
+        stats.nBytes += nBytes;
+        stats.nBusyMicros += nBusy;
+        stats.nMaxBusyMicros = std::max(stats.nMaxBusyMicros, nBusy);
+    }
+    if (fNoCritical)
+        condNoCritical.notify_all();
+}
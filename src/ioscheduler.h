@@ -0,0 +1,87 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_IOSCHEDULER_H
+#define BITCOIN_IOSCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+/**
+ * Ordering of the disk writes of the node. The appends and syncs of the block files are
+ * latency-critical: a block is not accepted before its data is written. The other writes
+ * are background ones, which wait for no critical write to be in progress, up to
+ * IO_MAX_DEFER_MS, before starting, and for some classes are also held to the
+ * -iobackgroundlimit rate. An operation in progress is never interrupted, so the
+ * background writers keep theirs small where they can.
+ */
+enum IOClass {
+    //! Block file appends and syncs, the only critical class
+    IO_BLOCK,
+    //! Undo file syncs
+    IO_UNDO,
+    //! Writes of the block index and the chainstate
+    IO_FLUSH,
+    //! LevelDB compactions
+    IO_COMPACTION,
+    //! Removal of pruned block and undo files
+    IO_PRUNE,
+    //! Rewrites of block files with compressed records, rate limited
+    IO_REWRITE,
+    //! Writes of the transaction and address indexes, rate limited
+    IO_INDEX,
+    IO_CLASSES
+};
+
+/** Longest time a background operation waits for the critical ones */
+static const int64_t IO_MAX_DEFER_MS = 1000;
+/** -iobackgroundlimit default, in MiB/s (0 = unlimited) */
+static const int64_t DEFAULT_IO_BACKGROUND_LIMIT = 0;
+
+/** Statistics of an I/O class */
+struct CIOClassStats
+{
+    uint64_t nOps;
+    uint64_t nBytes;
+    //! Operations which waited for critical ones or for the rate limit
+    uint64_t nDeferred;
+    int64_t nDeferMicros;
+    //! Time taken by the operations themselves
+    int64_t nBusyMicros;
+    int64_t nMaxBusyMicros;
+
+    CIOClassStats() : nOps(0), nBytes(0), nDeferred(0), nDeferMicros(0), nBusyMicros(0), nMaxBusyMicros(0) {}
+};
+
+/** Name of an I/O class in statistics */
+std::string GetIOClassName(IOClass ioClass);
+
+/** Set the rate limit of the rate limited classes, in bytes per second (0 = unlimited) */
+void SetIOBackgroundLimit(int64_t nBytesPerSecond);
+
+/** Copy the statistics of ioClass */
+CIOClassStats GetIOClassStats(IOClass ioClass);
+
+/**
+ * A disk operation of some class, from construction to destruction. A background one
+ * may wait in the constructor.
+ */
+class CIOOperation
+{
+public:
+    CIOOperation(IOClass ioClassIn, size_t nBytesIn = 0);
+    ~CIOOperation();
+
+private:
+    IOClass ioClass;
+    size_t nBytes;
+    int64_t nStart;
+
+    CIOOperation(const CIOOperation&);
+    CIOOperation& operator=(const CIOOperation&);
+};
+
+#endif // BITCOIN_IOSCHEDULER_H
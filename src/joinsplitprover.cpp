@@ -0,0 +1,240 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "joinsplitprover.h"
+
+#include "chainparamsbase.h"
+#include "netbase.h"
+#include "primitives/transaction.h"
+#include "rpc/protocol.h"
+#include "streams.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "version.h"
+
+#include <stdexcept>
+
+#include <event2/buffer.h>
+#include <event2/keyvalq_struct.h>
+#include "support/events.h"
+
+#include <univalue.h>
+
+namespace {
+
+ZCJoinSplit* pparams = NULL;
+std::unique_ptr<CLocalJoinSplitProver> localProver;
+std::unique_ptr<CRemoteJoinSplitProver> remoteProver;
+
+struct HTTPReply
+{
+    HTTPReply(): status(0), error(-1) {}
+
+    int status;
+    int error;
+    std::string body;
+};
+
+void http_request_done(struct evhttp_request *req, void *ctx)
+{
+    HTTPReply *reply = static_cast<HTTPReply*>(ctx);
+
+    if (req == NULL) {
+        // An error occurred while connecting
+        reply->status = 0;
+        return;
+    }
+
+    reply->status = evhttp_request_get_response_code(req);
+
+    struct evbuffer *buf = evhttp_request_get_input_buffer(req);
+    if (buf) {
+        size_t size = evbuffer_get_length(buf);
+        const char *data = (const char*)evbuffer_pullup(buf, size);
+        if (data)
+            reply->body = std::string(data, size);
+        evbuffer_drain(buf, size);
+    }
+}
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010300
+void http_error_cb(enum evhttp_request_error err, void *ctx)
+{
+    HTTPReply *reply = static_cast<HTTPReply*>(ctx);
+    reply->error = err;
+}
+#endif
+
+} // anon namespace
+
+CLocalJoinSplitProver::CLocalJoinSplitProver(ZCJoinSplit& paramsIn, int nThreads) : params(paramsIn), fStop(false)
+{
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&CLocalJoinSplitProver::ThreadProve, this));
+}
+
+CLocalJoinSplitProver::~CLocalJoinSplitProver()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    threads.join_all();
+}
+
+libzcash::SproutProof CLocalJoinSplitProver::prove(const ZCJSProofWitness& witness)
+{
+    std::shared_ptr<Task> task = std::make_shared<Task>([this, &witness]() {
+        return params.proveWitness(witness);
+    });
+    std::future<libzcash::SproutProof> result = task->get_future();
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fStop)
+            throw std::runtime_error("the prover is shutting down");
+        queue.push_back(task);
+    }
+    cond.notify_one();
+    return result.get();
+}
+
+size_t CLocalJoinSplitProver::QueueSize() const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return queue.size();
+}
+
+void CLocalJoinSplitProver::ThreadProve()
+{
+    RenameThread("horizen-prover");
+    while (true) {
+        std::shared_ptr<Task> task;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            // The proofs queued are computed before stopping, their callers wait for them
+            while (queue.empty() && !fStop)
+                cond.wait(lock);
+            if (queue.empty())
+                return;
+            task = queue.front();
+            queue.pop_front();
+        }
+        (*task)();
+    }
+}
+
+CRemoteJoinSplitProver::CRemoteJoinSplitProver(const std::string& hostIn, int portIn, const std::string& strUserPassIn, int nTimeoutIn) :
+    host(hostIn), port(portIn), strUserPass(strUserPassIn), nTimeout(nTimeoutIn)
+{
+}
+
+libzcash::SproutProof CRemoteJoinSplitProver::prove(const ZCJSProofWitness& witness)
+{
+    CDataStream ssWitness(SER_NETWORK, PROTOCOL_VERSION);
+    ssWitness << witness;
+    UniValue params(UniValue::VARR);
+    params.push_back(HexStr(ssWitness.begin(), ssWitness.end()));
+    const std::string strRequest = JSONRPCRequest("z_provejoinsplit", params, 1);
+
+    raii_event_base base = obtain_event_base();
+    raii_evhttp_connection evcon = obtain_evhttp_connection_base(base.get(), host, port);
+    evhttp_connection_set_timeout(evcon.get(), nTimeout);
+
+    HTTPReply response;
+    raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
+    if (req == NULL)
+        throw std::runtime_error("create http request failed");
+#if LIBEVENT_VERSION_NUMBER >= 0x02010300
+    evhttp_request_set_error_cb(req.get(), http_error_cb);
+#endif
+
+    struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
+    assert(output_headers);
+    evhttp_add_header(output_headers, "Host", host.c_str());
+    evhttp_add_header(output_headers, "Connection", "close");
+    evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strUserPass)).c_str());
+
+    struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
+    assert(output_buffer);
+    evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
+
+    int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
+    req.release(); // ownership moved to evcon in above call
+    if (r != 0)
+        throw std::runtime_error("send http request to the prover failed");
+
+    event_base_dispatch(base.get());
+
+    if (response.status == 0)
+        throw std::runtime_error(strprintf("couldn't connect to the prover at %s:%d (code %d)", host, port, response.error));
+    else if (response.status == HTTP_UNAUTHORIZED)
+        throw std::runtime_error("the prover refused -proverauth");
+    else if (response.body.empty())
+        throw std::runtime_error(strprintf("the prover returned HTTP error %d", response.status));
+
+    UniValue reply;
+    if (!reply.read(response.body) || !reply.isObject())
+        throw std::runtime_error("couldn't parse the reply of the prover");
+    const UniValue& error = find_value(reply, "error");
+    if (!error.isNull()) {
+        const UniValue& message = find_value(error, "message");
+        throw std::runtime_error("the prover failed: " + (message.isStr() ? message.get_str() : error.write()));
+    }
+    const UniValue& result = find_value(reply, "result");
+    if (!result.isStr() || !IsHex(result.get_str()))
+        throw std::runtime_error("the prover returned no proof");
+
+    CDataStream ssProof(ParseHex(result.get_str()), SER_NETWORK, PROTOCOL_VERSION);
+    libzcash::SproutProof proof;
+    ::SerReadWriteSproutProof(ssProof, proof, witness.makeGrothProof, CSerActionUnserialize(), SER_NETWORK, PROTOCOL_VERSION);
+    return proof;
+}
+
+bool StartJoinSplitProver(ZCJoinSplit* params, std::string& strError)
+{
+    pparams = params;
+    const int nThreads = GetArg("-proverthreads", DEFAULT_PROVER_THREADS);
+    if (nThreads > 0) {
+        localProver.reset(new CLocalJoinSplitProver(*params, nThreads));
+        LogPrintf("Computing JoinSplit proofs on %d threads\n", nThreads);
+    }
+
+    if (mapArgs.count("-prover")) {
+        int port = BaseParams().RPCPort();
+        std::string host;
+        SplitHostPort(mapArgs["-prover"], port, host);
+        if (host.empty()) {
+            strError = strprintf("invalid -prover '%s'", mapArgs["-prover"]);
+            return false;
+        }
+        if (mapArgs["-proverauth"].find(':') == std::string::npos) {
+            strError = "-prover requires -proverauth=<user>:<password>";
+            return false;
+        }
+        remoteProver.reset(new CRemoteJoinSplitProver(host, port, mapArgs["-proverauth"],
+            GetArg("-provertimeout", DEFAULT_PROVER_TIMEOUT)));
+        params->setProver(remoteProver.get());
+        LogPrintf("Computing JoinSplit proofs on the prover at %s:%d\n", host, port);
+    } else if (localProver) {
+        params->setProver(localProver.get());
+    }
+    return true;
+}
+
+void StopJoinSplitProver()
+{
+    if (pparams)
+        pparams->setProver(NULL);
+    localProver.reset();
+    remoteProver.reset();
+    pparams = NULL;
+}
+
+libzcash::SproutProof ProveJoinSplitLocally(const ZCJSProofWitness& witness)
+{
+    if (localProver)
+        return localProver->prove(witness);
+    return pparams->proveWitness(witness);
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_JOINSPLITPROVER_H
+#define BITCOIN_JOINSPLITPROVER_H
+
+#include "zcash/JoinSplit.hpp"
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+
+#include <boost/thread.hpp>
+
+//! -proverthreads default: the proofs are computed on the threads asking for them
+static const int DEFAULT_PROVER_THREADS = 0;
+//! -provertimeout default, in seconds
+static const int DEFAULT_PROVER_TIMEOUT = 900;
+
+/**
+ * Computes the proofs of JoinSplit::prove on a pool of threads, in the order they are
+ * asked for. A proof takes over 1 GB and a core for seconds, so the pool bounds the
+ * proofs in progress however many operations ask for them.
+ */
+class CLocalJoinSplitProver : public ZCJoinSplitProver
+{
+public:
+    CLocalJoinSplitProver(ZCJoinSplit& paramsIn, int nThreads);
+    //! Waits for the proofs queued
+    ~CLocalJoinSplitProver();
+
+    libzcash::SproutProof prove(const ZCJSProofWitness& witness);
+
+    //! Proofs waiting for a thread
+    size_t QueueSize() const;
+
+private:
+    typedef std::packaged_task<libzcash::SproutProof()> Task;
+
+    ZCJoinSplit& params;
+    mutable boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<std::shared_ptr<Task>> queue;
+    bool fStop;
+    boost::thread_group threads;
+
+    void ThreadProve();
+};
+
+/**
+ * Sends the witness packages of JoinSplit::prove to the z_provejoinsplit RPC of the
+ * -prover node, authenticated with -proverauth. The packages hold spending keys and
+ * the RPC connection is not encrypted, so a prover on another host is reached through
+ * a tunnel.
+ */
+class CRemoteJoinSplitProver : public ZCJoinSplitProver
+{
+public:
+    CRemoteJoinSplitProver(const std::string& hostIn, int portIn, const std::string& strUserPassIn, int nTimeoutIn);
+
+    libzcash::SproutProof prove(const ZCJSProofWitness& witness);
+
+private:
+    std::string host;
+    int port;
+    std::string strUserPass;
+    int nTimeout;
+};
+
+/** Set up the prover of params from -prover and -proverthreads */
+bool StartJoinSplitProver(ZCJoinSplit* params, std::string& strError);
+void StopJoinSplitProver();
+
+/**
+ * Compute the proof of a witness package for another node, on the local pool if
+ * -proverthreads is set, else on the calling thread. Never forwarded to a -prover.
+ */
+libzcash::SproutProof ProveJoinSplitLocally(const ZCJSProofWitness& witness);
+
+#endif // BITCOIN_JOINSPLITPROVER_H
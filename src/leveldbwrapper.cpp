@@ -4,7 +4,9 @@
 
 #include "leveldbwrapper.h"
 
+#include "ioscheduler.h"
 #include "util.h"
+#include "utilstrencodings.h"
 
 #include <boost/filesystem.hpp>
 
@@ -27,14 +29,122 @@ void HandleError(const leveldb::Status& status)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+CLevelDBProfile CLevelDBProfile::Chainstate()
+{
+    return CLevelDBProfile("chainstate", 4096, 10, 64, false, 25);
+}
+
+CLevelDBProfile CLevelDBProfile::BlockIndex()
+{
+    // Larger blocks for the scan at startup, and little cache for the rare writes
+    return CLevelDBProfile("blockindex", 16384, 10, 64, false, 10);
+}
+
+CLevelDBProfile CLevelDBProfile::AddressIndex()
+{
+    // Larger blocks for the scans of the entries of an address
+    return CLevelDBProfile("addressindex", 16384, 10, 64, false, 25);
+}
+
+CLevelDBProfile CLevelDBProfile::NoteScan()
+{
+    return CLevelDBProfile("notescan", 4096, 10, 64, false, 25);
+}
+
+CLevelDBProfile CLevelDBProfile::BlockFilter()
+{
+    // Larger blocks for the filters, read in runs of consecutive blocks
+    return CLevelDBProfile("blockfilter", 16384, 10, 64, false, 25);
+}
+
+CLevelDBProfile CLevelDBProfile::PaymentDisclosure()
+{
+    // Written a transaction at a time and rarely read: small blocks, little cache
+    return CLevelDBProfile("paymentdisclosure", 4096, 10, 16, false, 25);
+}
+
+CLevelDBProfile& CLevelDBProfile::ApplyArgs()
+{
+    const std::string strPrefix = strName + ".";
+    for (const std::string& strOption : mapMultiArgs["-dboption"]) {
+        size_t nPos = strOption.find('=');
+        if (strOption.compare(0, strPrefix.size(), strPrefix) != 0 || nPos == std::string::npos)
+            continue;
+        const std::string strKey = strOption.substr(strPrefix.size(), nPos - strPrefix.size());
+        const int64_t nValue = atoi64(strOption.substr(nPos + 1));
+        if (strKey == "blocksize" && nValue >= 1024)
+            nBlockSize = nValue;
+        else if (strKey == "bloombits" && nValue >= 0 && nValue <= 64)
+            nBloomBits = nValue;
+        else if (strKey == "maxopenfiles" && nValue >= 16)
+            nMaxOpenFiles = nValue;
+        else if (strKey == "compression")
+            fCompression = nValue != 0;
+        else if (strKey == "writebuffer" && nValue > 0 && nValue < 50)
+            nWriteBufferPercent = nValue;
+        else
+            LogPrintf("Ignoring invalid database option -dboption=%s\n", strOption);
+    }
+    return *this;
+}
+
+namespace {
+
+/**
+ * The default environment, with the jobs of its background thread, the compactions and
+ * the writes of the memtables, run as IO_COMPACTION operations. They wait for the block
+ * file appends in progress before starting.
+ */
+class CScheduledEnv : public leveldb::EnvWrapper
+{
+public:
+    CScheduledEnv() : leveldb::EnvWrapper(leveldb::Env::Default()) {}
+
+    void Schedule(void (*function)(void*), void* arg)
+    {
+        target()->Schedule(&CScheduledEnv::Run, new CJob(function, arg));
+    }
+
+private:
+    struct CJob
+    {
+        void (*function)(void*);
+        void* arg;
+
+        CJob(void (*functionIn)(void*), void* argIn) : function(functionIn), arg(argIn) {}
+    };
+
+    static void Run(void* arg)
+    {
+        CJob* job = static_cast<CJob*>(arg);
+        {
+            CIOOperation op(IO_COMPACTION);
+            job->function(job->arg);
+        }
+        delete job;
+    }
+};
+
+//! Shared by the databases like the default environment, and never deleted either
+leveldb::Env* GetScheduledEnv()
+{
+    static leveldb::Env* env = new CScheduledEnv();
+    return env;
+}
+
+} // anon namespace
+
+leveldb::Options GetLevelDBOptions(size_t nCacheSize, const CLevelDBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.write_buffer_size = nCacheSize * profile.nWriteBufferPercent / 100;
+    // up to two write buffers may be held in memory simultaneously
+    options.block_cache = leveldb::NewLRUCache(nCacheSize - 2 * options.write_buffer_size);
+    options.block_size = profile.nBlockSize;
+    if (profile.nBloomBits > 0)
+        options.filter_policy = leveldb::NewBloomFilterPolicy(profile.nBloomBits);
+    options.compression = profile.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = profile.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,19 +153,21 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe,
+                                 const CLevelDBProfile& profileIn) : profile(profileIn)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetLevelDBOptions(nCacheSize, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
         options.env = penv;
     } else {
+        options.env = GetScheduledEnv();
         if (fWipe) {
             LogPrintf("Wiping LevelDB in %s\n", path.string());
             leveldb::Status result = leveldb::DestroyDB(path.string(), options);
@@ -63,6 +175,10 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
         }
         TryCreateDirectory(path);
         LogPrintf("Opening LevelDB in %s\n", path.string());
+        if (!profile.strName.empty())
+            LogPrintf("Using the %s profile: %u byte blocks, %d bloom bits, %d open files, compression %s, %d%% write buffers\n",
+                      profile.strName, profile.nBlockSize, profile.nBloomBits, profile.nMaxOpenFiles,
+                      profile.fCompression ? "on" : "off", profile.nWriteBufferPercent);
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
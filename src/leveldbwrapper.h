@@ -24,6 +24,53 @@ public:
 
 void HandleError(const leveldb::Status& status);
 
+/**
+ * How a database is tuned for its workload. The defaults of each database can be
+ * changed with -dboption=<name>.<key>=<value>, for the keys named after the fields.
+ */
+struct CLevelDBProfile
+{
+    //! Name of the database in -dboption and getdbinfo
+    std::string strName;
+    //! Uncompressed size of the blocks of the tables (blocksize)
+    size_t nBlockSize;
+    //! Bits per key of the Bloom filters of the tables, 0 for none (bloombits)
+    int nBloomBits;
+    //! Table files kept open (maxopenfiles)
+    int nMaxOpenFiles;
+    //! Whether the blocks are compressed, if LevelDB was built with Snappy (compression)
+    bool fCompression;
+    //! Share of the cache, in percent, for each of the up to two write buffers; the rest caches blocks (writebuffer)
+    int nWriteBufferPercent;
+
+    CLevelDBProfile(const std::string& strNameIn = "", size_t nBlockSizeIn = 4096, int nBloomBitsIn = 10,
+                    int nMaxOpenFilesIn = 64, bool fCompressionIn = false, int nWriteBufferPercentIn = 25) :
+        strName(strNameIn), nBlockSize(nBlockSizeIn), nBloomBits(nBloomBitsIn), nMaxOpenFiles(nMaxOpenFilesIn),
+        fCompression(fCompressionIn), nWriteBufferPercent(nWriteBufferPercentIn) {}
+
+    //! Point reads and writes of small records all over the key space
+    static CLevelDBProfile Chainstate();
+    //! Read in full at startup, then mostly appended to, and point reads of the transaction index
+    static CLevelDBProfile BlockIndex();
+    //! Appended to in the order of the chain, and scanned by address
+    static CLevelDBProfile AddressIndex();
+    //! Small, appended to in the order of the chain, and scanned by address
+    static CLevelDBProfile NoteScan();
+    //! Appended to in the order of the chain, and point reads of ranges of blocks
+    static CLevelDBProfile BlockFilter();
+    //! Written a transaction at a time, and point reads and scans by transaction
+    static CLevelDBProfile PaymentDisclosure();
+
+    //! Apply the -dboption settings for this database
+    CLevelDBProfile& ApplyArgs();
+};
+
+/**
+ * The options of a database tuned by the profile, with a cache of nCacheSize bytes. The
+ * caller owns the filter policy and the block cache.
+ */
+leveldb::Options GetLevelDBOptions(size_t nCacheSize, const CLevelDBProfile& profile);
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -49,6 +96,11 @@ public:
         batch.Put(slKey, slValue);
     }
 
+    void Clear()
+    {
+        batch.Clear();
+    }
+
     template <typename K>
     void Erase(const K& key)
     {
@@ -85,10 +137,22 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! tuning the options were made from
+    CLevelDBProfile profile;
+
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false,
+                    const CLevelDBProfile& profileIn = CLevelDBProfile());
     ~CLevelDBWrapper();
 
+    const CLevelDBProfile& GetProfile() const { return profile; }
+
+    //! Read one of the properties LevelDB reports, such as "leveldb.stats"
+    bool GetProperty(const std::string& strProperty, std::string& strValue) const
+    {
+        return pdb->GetProperty(strProperty, &strValue);
+    }
+
     template <typename K, typename V>
     bool Read(const K& key, V& value) const
     {
@@ -168,6 +232,12 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterator for lookups of a few nearby keys, which fill the cache like Read() does
+    leveldb::Iterator* NewSeekIterator() const
+    {
+        return pdb->NewIterator(readoptions);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
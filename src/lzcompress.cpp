@@ -0,0 +1,129 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lzcompress.h"
+
+#include "crypto/common.h"
+
+#include <algorithm>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 0xffff;
+const int HASH_BITS = 16;
+//! Literal and match lengths from this value on continue in the following bytes
+const size_t RUN_MASK = 15;
+
+void WriteLength(std::vector<char>& vOut, size_t nLength)
+{
+    while (nLength >= 255) {
+        vOut.push_back((char)255);
+        nLength -= 255;
+    }
+    vOut.push_back((char)nLength);
+}
+
+bool ReadLength(const unsigned char*& p, const unsigned char* pend, size_t& nLength)
+{
+    unsigned char ch;
+    do {
+        if (p == pend)
+            return false;
+        ch = *p++;
+        nLength += ch;
+    } while (ch == 255);
+    return true;
+}
+
+void WriteSequence(std::vector<char>& vOut, const char* pLiterals, size_t nLiterals, size_t nOffset, size_t nMatch)
+{
+    const size_t nMatchCode = nMatch - MIN_MATCH;
+    const bool fMatch = nMatch > 0;
+    unsigned char token = (std::min(nLiterals, RUN_MASK) << 4) | (fMatch ? std::min(nMatchCode, RUN_MASK) : 0);
+    vOut.push_back((char)token);
+    if (nLiterals >= RUN_MASK)
+        WriteLength(vOut, nLiterals - RUN_MASK);
+    vOut.insert(vOut.end(), pLiterals, pLiterals + nLiterals);
+    if (!fMatch)
+        return;
+    vOut.push_back((char)(nOffset & 0xff));
+    vOut.push_back((char)(nOffset >> 8));
+    if (nMatchCode >= RUN_MASK)
+        WriteLength(vOut, nMatchCode - RUN_MASK);
+}
+
+} // anon namespace
+
+void LZCompress(const char* pIn, size_t nSize, std::vector<char>& vOut)
+{
+    vOut.clear();
+    vOut.reserve(nSize / 2 + 16);
+
+    const unsigned char* p = (const unsigned char*)pIn;
+    // Position + 1 of the last sequence of 4 bytes with each hash, 0 if none
+    std::vector<uint32_t> vTable(1 << HASH_BITS, 0);
+    size_t nAnchor = 0;
+    size_t i = 0;
+    while (i + MIN_MATCH <= nSize) {
+        const uint32_t nHash = (ReadLE32(p + i) * 2654435761u) >> (32 - HASH_BITS);
+        const size_t nCandidate = vTable[nHash];
+        vTable[nHash] = i + 1;
+        if (nCandidate == 0 || i - (nCandidate - 1) > MAX_OFFSET || memcmp(p + nCandidate - 1, p + i, MIN_MATCH) != 0) {
+            i++;
+            continue;
+        }
+
+        const size_t nMatchPos = nCandidate - 1;
+        size_t nMatch = MIN_MATCH;
+        while (i + nMatch < nSize && p[nMatchPos + nMatch] == p[i + nMatch])
+            nMatch++;
+        WriteSequence(vOut, pIn + nAnchor, i - nAnchor, i - nMatchPos, nMatch);
+        i += nMatch;
+        nAnchor = i;
+    }
+    // The last token only has literals
+    WriteSequence(vOut, pIn + nAnchor, nSize - nAnchor, 0, 0);
+}
+
+bool LZDecompress(const char* pIn, size_t nSize, size_t nOutSize, std::vector<char>& vOut)
+{
+    vOut.clear();
+    vOut.reserve(nOutSize);
+
+    const unsigned char* p = (const unsigned char*)pIn;
+    const unsigned char* pend = p + nSize;
+    while (p != pend) {
+        const unsigned char token = *p++;
+
+        size_t nLiterals = token >> 4;
+        if (nLiterals == RUN_MASK && !ReadLength(p, pend, nLiterals))
+            return false;
+        if (nLiterals > (size_t)(pend - p) || nLiterals > nOutSize - vOut.size())
+            return false;
+        vOut.insert(vOut.end(), (const char*)p, (const char*)p + nLiterals);
+        p += nLiterals;
+        if (p == pend)
+            break;
+
+        if (pend - p < 2)
+            return false;
+        const size_t nOffset = ReadLE16(p);
+        p += 2;
+        size_t nMatch = token & RUN_MASK;
+        if (nMatch == RUN_MASK && !ReadLength(p, pend, nMatch))
+            return false;
+        nMatch += MIN_MATCH;
+        if (nOffset == 0 || nOffset > vOut.size() || nMatch > nOutSize - vOut.size())
+            return false;
+        // The match may overlap the bytes it produces
+        size_t nFrom = vOut.size() - nOffset;
+        for (size_t j = 0; j < nMatch; j++)
+            vOut.push_back(vOut[nFrom + j]);
+    }
+    return vOut.size() == nOutSize;
+}
@@ -0,0 +1,31 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LZCOMPRESS_H
+#define BITCOIN_LZCOMPRESS_H
+
+#include <stddef.h>
+
+#include <vector>
+
+/**
+ * A byte-oriented LZ77 codec in the spirit of the LZ4 block format, used for
+ * the records of the block and undo files.
+ *
+ * The data is a sequence of tokens, each made of a literal run and a match of at
+ * least 4 bytes up to 64 KiB back. It favours speed over ratio: hashes, scripts
+ * and the repeated parts of transactions shrink, proofs and ciphertexts do not.
+ */
+
+/** Compress nSize bytes at pIn into vOut (replacing its content) */
+void LZCompress(const char* pIn, size_t nSize, std::vector<char>& vOut);
+
+/**
+ * Decompress nSize bytes at pIn into vOut (replacing its content), which must then
+ * be nOutSize bytes long.
+ * @return false if the data is corrupt or does not decompress to nOutSize bytes
+ */
+bool LZDecompress(const char* pIn, size_t nSize, size_t nOutSize, std::vector<char>& vOut);
+
+#endif // BITCOIN_LZCOMPRESS_H
@@ -7,16 +7,24 @@
 
 #include "sodium.h"
 
+#include "addressindex.h"
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockfilter.h"
+#include "blockencodings.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "core_memusage.h"
 #include "deprecation.h"
+#include "lzcompress.h"
 #include "init.h"
+#include "ioscheduler.h"
 #include "merkleblock.h"
 #include "metrics.h"
+#include "notescan.h"
 #include "pow.h"
 #include "txdb.h"
 #include "ui_interface.h"
@@ -27,6 +35,8 @@
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
 
+#include <atomic>
+#include <future>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -41,6 +51,7 @@
 
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "support/allocators/pool.h"
 
 using namespace zen;
 
@@ -58,6 +69,7 @@ CCriticalSection cs_main;
 
 BlockSet sGlobalForkTips;
 BlockTimeMap mGlobalForkTips;
+uint64_t nGlobalTipsVersion = 0;
 
 BlockMap mapBlockIndex;
 CChain chainActive;
@@ -66,21 +78,32 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nBlockCheckThreads = 0;
 bool fExperimentalMode = false;
 bool fImporting = false;
 bool fReindex = false;
 bool fReindexFast = false;
 bool fTxIndex = false;
+bool fAddressIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
+bool fCheckBlockIndexIncremental = false;
+bool fHighBandwidthRelay = DEFAULT_HIGH_BANDWIDTH_RELAY;
 bool fCheckpointsEnabled = true;
+bool fBlockCompression = DEFAULT_BLOCK_COMPRESSION;
+bool fCompactUndo = DEFAULT_COMPACT_UNDO;
+uint256 hashAssumeValid;
+arith_uint256 nMinimumChainWork;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 //true in case we still have not reached the highest known block from server startup
 bool fIsStartupSyncing = true;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nBlockServeCacheUsage = DEFAULT_BLOCK_SERVE_CACHE << 20;
 uint64_t nPruneTarget = 0;
+unsigned int nPruneKeepBlocks = MIN_BLOCKS_TO_KEEP;
+unsigned int nPruneHotFiles = DEFAULT_PRUNE_HOT_FILES;
 bool fAlerts = DEFAULT_ALERTS;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
@@ -91,9 +114,22 @@ CTxMemPool mempool(::minRelayTxFee);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    size_t nUsage; //! Memory used by tx
 };
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);;
+map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
+//! The orphans spending each outpoint, so that an orphan is only retried when an output it spends shows up
+map<COutPoint, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+struct COrphanPeer {
+    set<uint256> setOrphans;
+    size_t nUsage;
+    COrphanPeer() : nUsage(0) {}
+};
+//! The orphans of each peer, and their memory usage, for the per-peer quota and eviction
+map<NodeId, COrphanPeer> mapOrphansByPeer GUARDED_BY(cs_main);
+//! Memory used by all the orphans
+size_t nOrphanTxUsage GUARDED_BY(cs_main) = 0;
+//! Total size of the setOrphanWork of all the peers, to skip taking cs_main when there is none
+static std::atomic<unsigned int> nOrphanWorkQueued(0);
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 /**
@@ -102,6 +138,7 @@ void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
  */
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams);
 static void CheckBlockIndex();
+static void LinkBlocks(deque<CBlockIndex*> queue, BlockSet* sForkTips);
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -110,6 +147,39 @@ const string strMessageMagic = "Zcash Signed Message:\n";
 
 // Internal stuff
 namespace {
+    /**
+     * Storage of the block index entries, in chunks of contiguous entries rather
+     * than one heap block each. The entries live as long as the block index, and
+     * are only freed all at once.
+     */
+    class CBlockIndexArena
+    {
+    private:
+        static const size_t CHUNK_SIZE = 4096;
+        std::vector<std::unique_ptr<CBlockIndex[]> > vChunks;
+        //! entries handed out from the last chunk
+        size_t nUsed;
+
+    public:
+        CBlockIndexArena() : nUsed(CHUNK_SIZE) {}
+
+        CBlockIndex* New()
+        {
+            if (nUsed == CHUNK_SIZE) {
+                vChunks.emplace_back(new CBlockIndex[CHUNK_SIZE]);
+                nUsed = 0;
+            }
+            return &vChunks.back()[nUsed++];
+        }
+
+        void Clear()
+        {
+            vChunks.clear();
+            nUsed = CHUNK_SIZE;
+        }
+    };
+
+    CBlockIndexArena blockIndexArena;
 
     struct CBlockIndexWorkComparator
     {
@@ -174,6 +244,15 @@ namespace {
       */
     multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 
+    /** The -loadsnapshot file waiting for the header of its block, protected by cs_main.
+      * Meanwhile no block past the genesis block is connected. */
+    boost::filesystem::path pathSnapshotPending;
+    uint256 hashSnapshotPending;
+    /** The block of the loaded chainstate snapshot until it is validated, protected by cs_main.
+      * Its ancestors may still be downloading: it counts one transaction per block as nChainTx
+      * so that the blocks on top of it are linked. */
+    uint256 hashSnapshotBase;
+
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
@@ -242,8 +321,33 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    typedef std::multimap<CBlockIndex*, CBlockIndex*> BlockIndexChildren;
+
+    /**
+     * Block index entries which are new or changed since the last CheckBlockIndex, the
+     * forward-pointing map of the block tree and the tip as of that call. Only maintained
+     * with -checkblockindexincremental; a NULL pindexLastChecked forces a full check.
+     */
+    set<CBlockIndex*> setBlockIndexToCheck;
+    BlockIndexChildren mapBlockIndexChildren;
+    CBlockIndex* pindexLastChecked = NULL;
 } // anon namespace
 
+/** Mark a block index entry for the next incremental CheckBlockIndex */
+void static SetBlockIndexToCheck(CBlockIndex* pindex)
+{
+    if (fCheckBlockIndex && fCheckBlockIndexIncremental)
+        setBlockIndexToCheck.insert(pindex);
+}
+
+/** Mark a block index entry for writing to disk */
+void static SetBlockIndexDirty(CBlockIndex* pindex)
+{
+    setDirtyBlockIndex.insert(pindex);
+    SetBlockIndexToCheck(pindex);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Registration of network node signals.
@@ -268,14 +372,6 @@ struct CNodeState {
     CService address;
     //! Whether we have a fully established connection.
     bool fCurrentlyConnected;
-    //! Accumulated misbehaviour score for this peer.
-    int nMisbehavior;
-    //! Whether this peer should be disconnected and banned (unless whitelisted).
-    bool fShouldBan;
-    //! String name of this peer (debugging/logging purposes).
-    std::string name;
-    //! List of asynchronously-determined block rejections to notify this peer about.
-    std::vector<CBlockReject> rejects;
     //! The best known block we know this peer has announced.
     CBlockIndex *pindexBestKnownBlock;
     //! The hash of the last unknown block this peer has announced.
@@ -289,13 +385,28 @@ struct CNodeState {
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Number of blocks which can be in flight from this peer, adapted to its throughput and round trip time.
+    int nMaxBlocksInFlight;
+    //! Average time (in microseconds) this peer takes to send each block when requests are queued, or 0 if unknown.
+    int64_t nAvgBlockServiceTime;
+    //! When the last block requested from this peer was received (in microseconds), or 0.
+    int64_t nLastBlockReceivedTime;
+    //! Minimum ping time of this peer (in microseconds), or 0 if unknown.
+    int64_t nPingRTT;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer announced "sendcmpct" and can serve compact blocks.
+    bool fSupportsCompactBlocks;
+    //! Whether this peer asked to be announced new blocks with a cmpctblock directly.
+    bool fPreferHeaderAndIDs;
+    //! The block we are reconstructing from a cmpctblock of this peer, waiting for its blocktxn.
+    std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+    uint256 hashPartialBlock;
+    //! Orphans to retry, as the transactions they spend arrived from this peer.
+    std::set<uint256> setOrphanWork;
 
     CNodeState() {
         fCurrentlyConnected = false;
-        nMisbehavior = 0;
-        fShouldBan = false;
         pindexBestKnownBlock = NULL;
         hashLastUnknownBlock.SetNull();
         pindexLastCommonBlock = NULL;
@@ -303,7 +414,14 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nMaxBlocksInFlight = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nAvgBlockServiceTime = 0;
+        nLastBlockReceivedTime = 0;
+        nPingRTT = 0;
         fPreferredDownload = false;
+        fSupportsCompactBlocks = false;
+        fPreferHeaderAndIDs = false;
+        hashPartialBlock.SetNull();
     }
 };
 
@@ -318,6 +436,38 @@ CNodeState *State(NodeId pnode) {
     return &it->second;
 }
 
+/**
+ * Per-peer state which doesn't refer to the chain, so it doesn't need cs_main. Each peer has
+ * its own lock, and the peers are held by shared pointers, so that a message handler keeps
+ * using its peer while another one disconnects.
+ */
+struct CPeer {
+    //! String name of this peer (debugging/logging purposes).
+    const std::string name;
+
+    CCriticalSection cs;
+    //! Accumulated misbehaviour score for this peer.
+    int nMisbehavior;
+    //! Whether this peer should be disconnected and banned (unless whitelisted).
+    bool fShouldBan;
+    //! List of asynchronously-determined block rejections to notify this peer about.
+    std::vector<CBlockReject> rejects;
+
+    CPeer(const std::string& nameIn) : name(nameIn), nMisbehavior(0), fShouldBan(false) {}
+};
+
+typedef std::shared_ptr<CPeer> CPeerRef;
+
+/** Guards mapPeer only, the peers themselves are guarded by their own lock. */
+CCriticalSection cs_mapPeer;
+map<NodeId, CPeerRef> mapPeer;
+
+CPeerRef GetPeer(NodeId nodeid) {
+    LOCK(cs_mapPeer);
+    map<NodeId, CPeerRef>::iterator it = mapPeer.find(nodeid);
+    return it == mapPeer.end() ? CPeerRef() : it->second;
+}
+
 bool IsStartupSyncing() {
     LOCK(cs_main);
     return fIsStartupSyncing;
@@ -347,20 +497,34 @@ int64_t GetBlockTimeout(int64_t nTime, int nValidatedQueuedBefore, const Consens
 }
 
 void InitializeNode(NodeId nodeid, const CNode *pnode) {
+    {
+        LOCK(cs_mapPeer);
+        mapPeer[nodeid] = std::make_shared<CPeer>(pnode->addrName);
+    }
     LOCK(cs_main);
     CNodeState &state = mapNodeState.insert(std::make_pair(nodeid, CNodeState())).first->second;
-    state.name = pnode->addrName;
     state.address = pnode->addr;
 }
 
 void FinalizeNode(NodeId nodeid) {
+    int nMisbehavior = 0;
+    {
+        LOCK(cs_mapPeer);
+        map<NodeId, CPeerRef>::iterator it = mapPeer.find(nodeid);
+        if (it != mapPeer.end()) {
+            LOCK(it->second->cs);
+            nMisbehavior = it->second->nMisbehavior;
+            mapPeer.erase(it);
+        }
+    }
+
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
 
     if (state->fSyncStarted)
         nSyncStarted--;
 
-    if (state->nMisbehavior == 0 && state->fCurrentlyConnected) {
+    if (nMisbehavior == 0 && state->fCurrentlyConnected) {
         AddressCurrentlyConnected(state->address);
     }
 
@@ -368,16 +532,45 @@ void FinalizeNode(NodeId nodeid) {
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    nOrphanWorkQueued -= state->setOrphanWork.size();
 
     mapNodeState.erase(nodeid);
 }
 
+/**
+ * Measure the throughput of a peer from a block it was asked for, and adapt the number of blocks
+ * requested from it at a time: twice its bandwidth-delay product (in blocks), so that the peer
+ * always has a request queued while the following ones travel. Requires cs_main.
+ */
+void UpdateBlockDownloadWindow(CNodeState* state, const QueuedBlock& queuedBlock, int64_t nNow)
+{
+    if (state->nLastBlockReceivedTime != 0 && queuedBlock.nTime + state->nPingRTT <= state->nLastBlockReceivedTime) {
+        // The request reached the peer before it finished sending the previous block, so the
+        // time since then is what it takes to send one block.
+        int64_t nServiceTime = std::max(nNow - state->nLastBlockReceivedTime, (int64_t)1);
+        state->nAvgBlockServiceTime = state->nAvgBlockServiceTime == 0 ? nServiceTime :
+                                      (7 * state->nAvgBlockServiceTime + nServiceTime) / 8;
+        if (state->nPingRTT != 0) {
+            int64_t nWindow = 2 * state->nPingRTT / state->nAvgBlockServiceTime + 2;
+            state->nMaxBlocksInFlight = std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER,
+                                                          std::min<int64_t>(nWindow, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+        }
+    } else if (state->nBlocksInFlight >= state->nMaxBlocksInFlight) {
+        // The peer went idle with a full window: more requests can travel at once
+        state->nMaxBlocksInFlight = std::min(state->nMaxBlocksInFlight + 1, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    }
+    state->nLastBlockReceivedTime = nNow;
+}
+
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
-bool MarkBlockAsReceived(const uint256& hash) {
+// nodeFrom is the peer which sent it, if the block is a response to a request.
+bool MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (nodeFrom == itInFlight->second.first)
+            UpdateBlockDownloadWindow(state, *itInFlight->second.second, GetTimeMicros());
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
@@ -459,8 +652,10 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. If nothing can be fetched because of the download window, nodeStaller is set
+ *  to the peer the window waits for, and pindexStalled to the block it waits for. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller,
+                              CBlockIndex*& pindexStalled) {
     if (count == 0)
     {
         LogPrint("forks", "%s():%d - peer has too many blocks in fligth\n", __func__, __LINE__);
@@ -499,6 +694,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex* pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -530,6 +726,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalled = pindexWaitingFor;
                     }
                     LogPrint("forks", "%s():%d - could not fetch [%s]\n", __func__, __LINE__, pindex->GetBlockHash().ToString() );
                     return;
@@ -541,6 +738,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -549,13 +747,21 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 } // anon namespace
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
+    CPeerRef peer = GetPeer(nodeid);
+    if (!peer)
+        return false;
+    {
+        LOCK(peer->cs);
+        stats.nMisbehavior = peer->nMisbehavior;
+    }
+
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
     if (state == NULL)
         return false;
-    stats.nMisbehavior = state->nMisbehavior;
     stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
     stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
+    stats.nMaxBlocksInFlight = state->nMaxBlocksInFlight;
     BOOST_FOREACH(const QueuedBlock& queue, state->vBlocksInFlight) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
@@ -583,7 +789,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
 {
-    // Find the first block the caller has in the main chain
+    // Find the first block the caller has that we know of
     BOOST_FOREACH(const uint256& hash, locator.vHave) {
         BlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
@@ -591,13 +797,29 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
             CBlockIndex* pindex = (*mi).second;
             if (chain.Contains(pindex))
                 return pindex;
+            // The caller is on a fork we know, whose ancestors it has too: the skip list finds
+            // where it leaves the chain, instead of the coarser later entries of the locator
+            const CBlockIndex* pfork = chain.FindFork(pindex);
+            if (pfork)
+                return chain[pfork->nHeight];
         }
     }
     return chain.Genesis();
 }
 
+CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    LOCK(cs_main);
+    BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+    return mi == mapBlockIndex.end() ? NULL : mi->second;
+}
+
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CAddressIndexDB *paddressindex = NULL;
+CNoteScanDB *pnotescandb = NULL;
+CBlockFilterDB *pblockfilterdb = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -615,22 +837,34 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
     unsigned int sz = tx.GetSerializeSize(SER_NETWORK, tx.nVersion);
-    if (sz > 5000)
+    if (sz > MAX_ORPHAN_TX_SIZE)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    // A single peer can't fill the orphan pool and push out the orphans of the others
+    COrphanPeer& orphanPeer = mapOrphansByPeer[peer];
+    if (orphanPeer.setOrphans.size() >= MAX_ORPHAN_TRANSACTIONS_PER_PEER)
+    {
+        LogPrint("mempool", "ignoring orphan tx %s, peer=%d already has %u orphans\n", hash.ToString(), peer,
+                 orphanPeer.setOrphans.size());
+        return false;
+    }
+
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nUsage = RecursiveDynamicUsage(tx);
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(hash);
+    orphanPeer.setOrphans.insert(hash);
+    orphanPeer.nUsage += orphan.nUsage;
+    nOrphanTxUsage += orphan.nUsage;
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u usage %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanTxUsage);
     return true;
 }
 
@@ -641,49 +875,124 @@ void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
         return;
     BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
     {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        map<COutPoint, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
         itPrev->second.erase(hash);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    map<NodeId, COrphanPeer>::iterator itPeer = mapOrphansByPeer.find(it->second.fromPeer);
+    assert(itPeer != mapOrphansByPeer.end());
+    itPeer->second.setOrphans.erase(hash);
+    itPeer->second.nUsage -= it->second.nUsage;
+    if (itPeer->second.setOrphans.empty())
+        mapOrphansByPeer.erase(itPeer);
+    nOrphanTxUsage -= it->second.nUsage;
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    map<NodeId, COrphanPeer>::iterator itPeer = mapOrphansByPeer.find(peer);
+    if (itPeer == mapOrphansByPeer.end())
+        return;
+    // EraseOrphanTx drops the entry of the peer with its last orphan
+    set<uint256> setOrphans = itPeer->second.setOrphans;
+    BOOST_FOREACH(const uint256& hash, setOrphans)
+        EraseOrphanTx(hash);
+    LogPrint("mempool", "Erased %d orphan tx from peer %d\n", setOrphans.size(), peer);
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxUsage) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
-    {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTxUsage > nMaxUsage)
+    {
+        // Evict a random orphan of the peer whose orphans use the most memory
+        map<NodeId, COrphanPeer>::iterator itPeer = mapOrphansByPeer.begin();
+        for (map<NodeId, COrphanPeer>::iterator it = mapOrphansByPeer.begin(); it != mapOrphansByPeer.end(); ++it) {
+            if (it->second.nUsage > itPeer->second.nUsage)
+                itPeer = it;
+        }
+        set<uint256>::iterator it = itPeer->second.setOrphans.lower_bound(GetRandHash());
+        if (it == itPeer->second.setOrphans.end())
+            it = itPeer->second.setOrphans.begin();
+        EraseOrphanTx(*it);
         ++nEvicted;
     }
     return nEvicted;
 }
 
+/** Queue for retrying the orphans spending the outputs of tx, just accepted from the peer of state */
+static void QueueOrphanWork(CNodeState* state, const CTransaction& tx) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    const uint256 hash = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        map<COutPoint, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(COutPoint(hash, i));
+        if (itByPrev == mapOrphanTransactionsByPrev.end())
+            continue;
+        BOOST_FOREACH(const uint256& orphanHash, itByPrev->second) {
+            if (state->setOrphanWork.insert(orphanHash).second)
+                nOrphanWorkQueued++;
+        }
+    }
+}
+
+/**
+ * Retry at most MAX_ORPHAN_WORK_BATCH of the orphans queued for a peer, so that an orphan
+ * storm is spread over several rounds of the message handler instead of stalling it.
+ */
+static void ProcessOrphanWork(CNode* pfrom) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CNodeState* nodestate = State(pfrom->GetId());
+    unsigned int nProcessed = 0;
+    while (!nodestate->setOrphanWork.empty() && nProcessed < MAX_ORPHAN_WORK_BATCH)
+    {
+        const uint256 orphanHash = *nodestate->setOrphanWork.begin();
+        nodestate->setOrphanWork.erase(nodestate->setOrphanWork.begin());
+        nOrphanWorkQueued--;
+
+        map<uint256, COrphanTx>::iterator itOrphan = mapOrphanTransactions.find(orphanHash);
+        if (itOrphan == mapOrphanTransactions.end())
+            continue;
+        nProcessed++;
+        const CTransaction orphanTx = itOrphan->second.tx;
+        const NodeId fromPeer = itOrphan->second.fromPeer;
+        bool fMissingInputs = false;
+        // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+        // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+        // anyone relaying LegitTxX banned)
+        CValidationState stateDummy;
+
+        if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs))
+        {
+            LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+            RelayTransaction(orphanTx);
+            QueueOrphanWork(nodestate, orphanTx);
+            EraseOrphanTx(orphanHash);
+        }
+        else if (!fMissingInputs)
+        {
+            int nDos = 0;
+            if (stateDummy.IsInvalid(nDos) && nDos > 0)
+            {
+                // Punish peer that gave us an invalid orphan tx
+                Misbehaving(fromPeer, nDos);
+                LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+            }
+            // Has inputs but not accepted to mempool
+            // Probably non-standard or insufficient fee/priority
+            LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+            EraseOrphanTx(orphanHash);
+            assert(recentRejects);
+            recentRejects->insert(orphanHash);
+        }
+        mempool.check(pcoinsTip);
+    }
+}
+
 
 bool IsStandardTx(const CTransaction& tx, string& reason, const int nHeight)
 {
@@ -985,6 +1294,51 @@ bool ContextualCheckTransaction(
 }
 
 
+namespace {
+
+/**
+ * Cache of the transactions whose JoinSplit proofs and joinSplitSig are known
+ * to be valid, to avoid verifying them twice for every shielded transaction
+ * (once when accepted into memory pool, and again when connected in a block).
+ * Entries are keyed by txid, which commits to both the proofs and the signature.
+ */
+class CJoinSplitValidationCache
+{
+private:
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_jscache;
+
+public:
+    bool Get(const uint256 &txid)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_jscache);
+        return setValid.count(txid) != 0;
+    }
+
+    void Set(const uint256 &txid)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxjoinsplitcachesize", DEFAULT_MAX_JOINSPLIT_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_jscache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize)
+        {
+            // Evict a random entry, as the signature cache does.
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(txid);
+    }
+};
+
+CJoinSplitValidationCache joinSplitValidationCache;
+
+} // anon namespace
+
 bool CheckTransaction(const CTransaction& tx, CValidationState &state,
                       libzcash::ProofVerifier& verifier)
 {
@@ -992,15 +1346,21 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
     if (!tx.IsCoinBase()) {
         transactionsValidated.increment();
     }
-    if (!CheckTransactionWithoutProofVerification(tx, state)) {
+
+    // JoinSplits already verified on mempool acceptance need not be verified again
+    bool fJoinSplitsVerified = !tx.vjoinsplit.empty() && joinSplitValidationCache.Get(tx.GetHash());
+
+    if (!CheckTransactionWithoutProofVerification(tx, state, !fJoinSplitsVerified)) {
         return false;
     }
 
     // Ensure that zk-SNARKs verify
-    BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
-        if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey)) {
-            return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
-                                REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    if (!fJoinSplitsVerified) {
+        BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
+            if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey)) {
+                return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
+                                    REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+            }
         }
     }
 
@@ -1020,7 +1380,30 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
     return true;
 }
 
-bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state)
+bool CheckJoinSplitsWithoutLock(const CTransaction& tx, CValidationState& state)
+{
+    if (tx.vjoinsplit.empty() || joinSplitValidationCache.Get(tx.GetHash()))
+        return true;
+
+    // Only the joinSplitSig and the proofs are cached, the rest of the context-free
+    // checks, which are cheap, run again with the contextual ones.
+    if (!CheckTransactionWithoutProofVerification(tx, state))
+        return false;
+    auto verifier = libzcash::ProofVerifier::Batch();
+    BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
+        if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey))
+            return state.DoS(100, error("%s: joinsplit does not verify", __func__),
+                             REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    }
+    if (!verifier.verifyBatch())
+        return state.DoS(100, error("%s: joinsplit does not verify", __func__),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+
+    joinSplitValidationCache.Set(tx.GetHash());
+    return true;
+}
+
+bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state, bool fCheckJoinSplitSig)
 {
     // Basic checks that don't depend on any context
     // Check transaction version
@@ -1114,27 +1497,27 @@ bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidatio
     }
 
 
+    // The nodes of the sets below come from the arena of the thread, given back with them
+    CArenaScope arenaScope;
+
     // Check for duplicate inputs
-    set<COutPoint> vInOutPoints;
+    set<COutPoint, std::less<COutPoint>, arena_allocator<COutPoint> > vInOutPoints;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        if (vInOutPoints.count(txin.prevout))
+        if (!vInOutPoints.insert(txin.prevout).second)
             return state.DoS(100, error("CheckTransaction(): duplicate inputs"),
                              REJECT_INVALID, "bad-txns-inputs-duplicate");
-        vInOutPoints.insert(txin.prevout);
     }
 
     // Check for duplicate joinsplit nullifiers in this transaction
-    set<uint256> vJoinSplitNullifiers;
+    set<uint256, std::less<uint256>, arena_allocator<uint256> > vJoinSplitNullifiers;
     BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit)
     {
         BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers)
         {
-            if (vJoinSplitNullifiers.count(nf))
+            if (!vJoinSplitNullifiers.insert(nf).second)
                 return state.DoS(100, error("CheckTransaction(): duplicate nullifiers"),
                              REJECT_INVALID, "bad-joinsplits-nullifiers-duplicate");
-
-            vJoinSplitNullifiers.insert(nf);
         }
     }
 
@@ -1156,7 +1539,7 @@ bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidatio
                 return state.DoS(10, error("CheckTransaction(): prevout is null"),
                                  REJECT_INVALID, "bad-txns-prevout-null");
 
-        if (tx.vjoinsplit.size() > 0) {
+        if (tx.vjoinsplit.size() > 0 && fCheckJoinSplitSig) {
             // Empty output script.
             CScript scriptCode;
             uint256 dataToBeSigned;
@@ -1214,8 +1597,17 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+void ExpireMempoolTransactions()
+{
+    // cs_main keeps AcceptToMemoryPool from adding a transaction whose parent is expired meanwhile
+    LOCK2(cs_main, mempool.cs);
+    int expired = mempool.Expire(GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1234,9 +1626,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     }
 
 
-    auto verifier = libzcash::ProofVerifier::Strict();
+    auto verifier = libzcash::ProofVerifier::Batch();
     if (!CheckTransaction(tx, state, verifier))
         return error("AcceptToMemoryPool: CheckTransaction failed");
+    if (!verifier.verifyBatch())
+        return state.DoS(100, error("AcceptToMemoryPool: joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    if (!tx.vjoinsplit.empty())
+        joinSplitValidationCache.Set(tx.GetHash());
 
 
     // DoS level set to 10 to be more forgiving.
@@ -1364,9 +1761,19 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx));
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx));
         unsigned int nSize = entry.GetTxSize();
 
+        // Once the mempool has been full, it takes a fee rate above that of the evicted
+        // transactions to get in, whatever the kind of transaction
+        size_t nMaxMempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+        CAmount mempoolRejectFee = pool.GetMinFee(nMaxMempool).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nFees < mempoolRejectFee) {
+            return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d",
+                                      hash.ToString(), nFees, mempoolRejectFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        }
+
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
         if (tx.vjoinsplit.size() > 0 && nFees >= ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE) {
             // In future we will we have more accurate and dynamic computation of fees for tx with joinsplits.
@@ -1436,17 +1843,151 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+
+        // Make room by evicting the lowest fee rate packages, which may be this transaction
+        pool.TrimToSize(nMaxMempool);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    }
+
+    // Wake the getblocktemplate long polls waiting for fees
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        cvBlockChange.notify_all();
+    }
+
+    return true;
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectAbsurdFee);
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<std::pair<CTransaction, int64_t> > vinfo;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vinfo.reserve(mempool.mapTx.size());
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx) {
+            vinfo.push_back(std::make_pair(e.GetTx(), e.GetTime()));
+        }
+    }
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: Failed to open %s", __func__, pathTmp.string());
+
+        file << MEMPOOL_DUMP_VERSION;
+        // The fee deltas come first, so that they apply when the transactions are accepted again
+        file << mapDeltas;
+        file << (uint64_t)vinfo.size();
+        for (size_t i = 0; i < vinfo.size(); i++) {
+            const CTransaction& tx = vinfo[i].first;
+            // Whether the JoinSplits need no verification on load
+            bool fJoinSplitsVerified = !tx.vjoinsplit.empty() && joinSplitValidationCache.Get(tx.GetHash());
+            file << tx;
+            file << vinfo[i].second;
+            file << fJoinSplitsVerified;
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+            return error("%s: Rename failed", __func__);
+    } catch (const std::exception& e) {
+        return error("%s: Failed to dump mempool: %s. Continuing anyway.", __func__, e.what());
+    }
+
+    int64_t nLast = GetTimeMicros();
+    LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (nMid - nStart) * 0.000001, (nLast - nMid) * 0.000001);
+    return true;
+}
+
+bool LoadMempool()
+{
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    int64_t nNow = GetTime();
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t expired = 0;
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION)
+            return false;
+
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it) {
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+        }
+
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            CTransaction tx;
+            int64_t nTime;
+            bool fJoinSplitsVerified;
+            file >> tx;
+            file >> nTime;
+            file >> fJoinSplitsVerified;
+
+            if (nTime + nExpiryTimeout <= nNow) {
+                ++expired;
+                continue;
+            }
+            // The proofs were verified before the dump, by this node
+            if (fJoinSplitsVerified)
+                joinSplitValidationCache.Set(tx.GetHash());
+
+            CValidationState state;
+            LOCK(cs_main);
+            if (AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime)) {
+                ++count;
+            } else if (mempool.exists(tx.GetHash())) {
+                ++skipped;
+            } else {
+                ++failed;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
     }
 
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired, %i already there\n", count, failed, expired, skipped);
     return true;
 }
 
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
+static bool FindTxIndexPos(const uint256& txid, CDiskTxPos& pos);
+
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow)
 {
-    CBlockIndex *pindexSlow = NULL;
-
-    LOCK(cs_main);
+    const CBlockIndex *pindexSlow = NULL;
 
     if (mempool.lookup(hash, txOut))
     {
@@ -1455,15 +1996,31 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 
     if (fTxIndex) {
         CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+        if (FindTxIndexPos(hash, postx)) {
+            if (postx.nPos < 4)
+                return error("%s: no block record at %s", __func__, postx.ToString());
+            CAutoFile file(OpenBlockFile(CDiskBlockPos(postx.nFile, postx.nPos - 4), true), SER_DISK, CLIENT_VERSION);
             if (file.IsNull())
                 return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
             try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
+                unsigned int nSizeField;
+                file >> nSizeField;
+                if (nSizeField & DISK_RECORD_COMPRESSED) {
+                    // The offset is into the serialization of the block, so the whole of it is needed
+                    std::vector<char> vRecord(nSizeField & ~DISK_RECORD_COMPRESSED), vRaw;
+                    file.read(vRecord.data(), vRecord.size());
+                    if (!DecompressDiskRecord(vRecord.data(), vRecord.size(), vRaw))
+                        throw std::ios_base::failure("corrupt compressed record");
+                    CMemoryReader reader(vRaw.data(), vRaw.data() + vRaw.size(), SER_DISK, CLIENT_VERSION);
+                    reader >> header;
+                    reader.ignore(postx.nTxOffset);
+                    reader >> txOut;
+                } else {
+                    file >> header;
+                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    file >> txOut;
+                }
             } catch (const std::exception& e) {
                 return error("%s: Deserialize or I/O error - %s", __func__, e.what());
             }
@@ -1476,20 +2033,25 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
+        CChainTipViewRef tip;
         {
+            LOCK(cs_main);
             CCoinsViewCache &view = *pcoinsTip;
             const CCoins* coins = view.AccessCoins(hash);
             if (coins)
                 nHeight = coins->nHeight;
+            tip = GetChainTipView();
         }
+        // The block is read from disk without holding cs_main
         if (nHeight > 0)
-            pindexSlow = chainActive[nHeight];
+            pindexSlow = (*tip)[nHeight];
     }
 
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow)) {
-            BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+            BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+                const CTransaction& tx = *ptx;
                 if (tx.GetHash() == hash) {
                     txOut = tx;
                     hashBlock = pindexSlow->GetBlockHash();
@@ -1512,45 +2074,64 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+void CDiskRecord::Init(const char* pbegin, const char* pend, bool fCompress)
+{
+    const size_t nRawSize = pend - pbegin;
+    if (fCompress) {
+        std::vector<char> vCompressed;
+        LZCompress(pbegin, nRawSize, vCompressed);
+        if (vCompressed.size() + 4 < nRawSize) {
+            vData.resize(4);
+            WriteLE32((unsigned char*)&vData[0], nRawSize);
+            vData.insert(vData.end(), vCompressed.begin(), vCompressed.end());
+            nSizeField = vData.size() | DISK_RECORD_COMPRESSED;
+            return;
+        }
+    }
+    vData.assign(pbegin, pend);
+    nSizeField = vData.size();
+}
+
+bool DecompressDiskRecord(const char* p, size_t nSize, std::vector<char>& vOut)
+{
+    if (nSize < 4)
+        return false;
+    const uint32_t nRawSize = ReadLE32((const unsigned char*)p);
+    // Undo data can outgrow its block, though not a block file
+    if (nRawSize > MAX_BLOCKFILE_SIZE)
+        return false;
+    return LZDecompress(p + 4, nSize - 4, nRawSize, vOut);
+}
+
+bool WriteBlockToDisk(const CDiskRecord& record, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
+    CIOOperation op(IO_BLOCK, 8 + record.size());
+
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
     // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(messageStart) << nSize;
+    fileout << FLATDATA(messageStart) << record.nSizeField;
 
     // Write block
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("WriteBlockToDisk: ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    fileout.write(record.vData.data(), record.size());
 
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    block.SetNull();
-
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
-    }
+    return WriteBlockToDisk(CDiskRecord(block, fBlockCompression), pos, messageStart);
+}
 
-    // Check the header
+static bool CheckBlockHeaderFromDisk(const CBlock& block, const CDiskBlockPos& pos)
+{
     if (!(CheckEquihashSolution(&block, Params()) &&
           CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus())))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
@@ -1558,21 +2139,271 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
-{
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
-        return false;
-    if (block.GetHash() != pindex->GetBlockHash())
-        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
-                pindex->ToString(), pindex->GetBlockPos().ToString());
-    return true;
-}
+namespace {
+    /** Block files mapped by ReadBlockFromDisk, most recently used first */
+    CCriticalSection cs_mappedBlockFiles;
+    std::list<std::pair<int, std::shared_ptr<const CMappedFile> > > lMappedBlockFiles;
+    /** Block files are up to MAX_BLOCKFILE_SIZE, so this bounds the address space used */
+    static const size_t MAX_MAPPED_BLOCK_FILES = 32;
 
-CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
-{
-    CAmount nSubsidy = 12.5 * COIN;
-    if (nHeight == 0)
-        return 0;
+    /** A mapping of block file nFile covering at least nMinSize bytes, or NULL */
+    std::shared_ptr<const CMappedFile> GetMappedBlockFile(int nFile, size_t nMinSize)
+    {
+        // Not worth the address space of a 32-bit process
+        if (sizeof(void*) < 8)
+            return NULL;
+
+        LOCK(cs_mappedBlockFiles);
+        for (auto it = lMappedBlockFiles.begin(); it != lMappedBlockFiles.end(); ++it) {
+            if (it->first != nFile)
+                continue;
+            if (it->second->Size() >= nMinSize) {
+                lMappedBlockFiles.splice(lMappedBlockFiles.begin(), lMappedBlockFiles, it);
+                return it->second;
+            }
+            // The file has grown since it was mapped
+            lMappedBlockFiles.erase(it);
+            break;
+        }
+
+        std::shared_ptr<const CMappedFile> pmapped = std::make_shared<CMappedFile>(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"));
+        if (!pmapped->IsValid() || pmapped->Size() < nMinSize)
+            return NULL;
+        lMappedBlockFiles.push_front(std::make_pair(nFile, pmapped));
+        if (lMappedBlockFiles.size() > MAX_MAPPED_BLOCK_FILES)
+            lMappedBlockFiles.pop_back();
+        return pmapped;
+    }
+
+    /** Drop the mapping of a block file that is deleted or truncated */
+    void ForgetMappedBlockFile(int nFile)
+    {
+        LOCK(cs_mappedBlockFiles);
+        for (auto it = lMappedBlockFiles.begin(); it != lMappedBlockFiles.end(); ++it) {
+            if (it->first == nFile) {
+                lMappedBlockFiles.erase(it);
+                return;
+            }
+        }
+    }
+
+    /** Deserialize the block at pos in place from a mapping of its file, if there is one covering it */
+    bool ReadBlockFromMappedFile(CBlock& block, const CDiskBlockPos& pos)
+    {
+        // The block is preceded by the message start and its size
+        if (pos.nPos < 8)
+            return false;
+        std::shared_ptr<const CMappedFile> pmapped = GetMappedBlockFile(pos.nFile, pos.nPos);
+        if (!pmapped)
+            return false;
+        const unsigned char* pSize = (const unsigned char*)pmapped->Data() + pos.nPos - 4;
+        if (memcmp(pSize - 4, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+            return false;
+        const unsigned int nSizeField = ReadLE32(pSize);
+        uint64_t nEnd = (uint64_t)pos.nPos + (nSizeField & ~DISK_RECORD_COMPRESSED);
+        if (nEnd > MAX_BLOCKFILE_SIZE)
+            return false;
+        if (nEnd > pmapped->Size()) {
+            pmapped = GetMappedBlockFile(pos.nFile, nEnd);
+            if (!pmapped)
+                return false;
+        }
+
+        CMemoryReader reader(pmapped->Data() + pos.nPos, pmapped->Data() + nEnd, SER_DISK, CLIENT_VERSION);
+        try {
+            ReadDiskRecord(reader, nSizeField, block);
+        }
+        catch (const std::exception&) {
+            // Let the file reader report it
+            block.SetNull();
+            return false;
+        }
+        return true;
+    }
+}
+
+/** The size of the block record at pos as stored, after its size field, or 0 if it cannot be read */
+static unsigned int ReadBlockRecordSize(const CDiskBlockPos& pos)
+{
+    if (pos.nPos < 4)
+        return 0;
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return 0;
+    unsigned int nSizeField = 0;
+    try {
+        filein >> nSizeField;
+    } catch (const std::exception&) {
+        return 0;
+    }
+    return nSizeField & ~DISK_RECORD_COMPRESSED;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    block.SetNull();
+
+    if (ReadBlockFromMappedFile(block, pos))
+        return CheckBlockHeaderFromDisk(block, pos);
+
+    // Open history file to read, at the size field heading the block
+    if (pos.nPos < 4)
+        return error("ReadBlockFromDisk: no block record at %s", pos.ToString());
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+    // Read block
+    try {
+        unsigned int nSizeField;
+        filein >> nSizeField;
+        ReadDiskRecord(filein, nSizeField, block);
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return CheckBlockHeaderFromDisk(block, pos);
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
+{
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+        return false;
+    if (block.GetHash() != pindex->GetBlockHash())
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    return true;
+}
+
+/** The bytes of the record at pos, after its size field nSizeField, from a mapping of its file if there is one */
+static bool ReadBlockRecord(const CDiskBlockPos& pos, unsigned int& nSizeField, std::vector<char>& vRecord)
+{
+    if (pos.nPos >= 8) {
+        std::shared_ptr<const CMappedFile> pmapped = GetMappedBlockFile(pos.nFile, pos.nPos);
+        if (pmapped) {
+            const unsigned char* pSize = (const unsigned char*)pmapped->Data() + pos.nPos - 4;
+            if (memcmp(pSize - 4, Params().MessageStart(), MESSAGE_START_SIZE) == 0) {
+                nSizeField = ReadLE32(pSize);
+                uint64_t nEnd = (uint64_t)pos.nPos + (nSizeField & ~DISK_RECORD_COMPRESSED);
+                if (nEnd <= MAX_BLOCKFILE_SIZE && nEnd > pmapped->Size())
+                    pmapped = GetMappedBlockFile(pos.nFile, nEnd);
+                if (nEnd <= MAX_BLOCKFILE_SIZE && pmapped) {
+                    vRecord.assign(pmapped->Data() + pos.nPos, pmapped->Data() + nEnd);
+                    return true;
+                }
+            }
+        }
+    }
+
+    if (pos.nPos < 4)
+        return false;
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+    try {
+        filein >> nSizeField;
+        if ((nSizeField & ~DISK_RECORD_COMPRESSED) > MAX_BLOCKFILE_SIZE)
+            return false;
+        vRecord.resize(nSizeField & ~DISK_RECORD_COMPRESSED);
+        filein.read(vRecord.data(), vRecord.size());
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<char>& vBlock, const CDiskBlockPos& pos, const uint256& hash)
+{
+    NoteBlockFileRead(pos.nFile);
+    unsigned int nSizeField = 0;
+    std::vector<char> vRecord;
+    if (!ReadBlockRecord(pos, nSizeField, vRecord))
+        return error("%s: no block record at %s", __func__, pos.ToString());
+    if (nSizeField & DISK_RECORD_COMPRESSED) {
+        if (!DecompressDiskRecord(vRecord.data(), vRecord.size(), vBlock))
+            return error("%s: corrupt compressed record at %s", __func__, pos.ToString());
+    } else {
+        vBlock.swap(vRecord);
+    }
+
+    // Only the header is deserialized, to check that this is the block asked for
+    CBlockHeader header;
+    CMemoryReader reader(vBlock.data(), vBlock.data() + vBlock.size(), SER_NETWORK, PROTOCOL_VERSION);
+    try {
+        reader >> header;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    if (header.GetHash() != hash)
+        return error("%s: the block at %s is not %s", __func__, pos.ToString(), hash.ToString());
+    return true;
+}
+
+namespace {
+    struct CBlockServeCacheEntry {
+        uint256 hash;
+        std::shared_ptr<const CBlock> pblock;
+        size_t nSize;
+    };
+
+    CCriticalSection cs_blockServeCache;
+    // most recently used first
+    std::list<CBlockServeCacheEntry> lBlockServeCache;
+    std::map<uint256, std::list<CBlockServeCacheEntry>::iterator> mapBlockServeCache;
+    size_t nBlockServeCacheUsed = 0;
+} // anon namespace
+
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    NoteBlockFileRead(pindex->nFile);
+    {
+        LOCK(cs_blockServeCache);
+        std::map<uint256, std::list<CBlockServeCacheEntry>::iterator>::iterator it = mapBlockServeCache.find(hash);
+        if (it != mapBlockServeCache.end())
+        {
+            lBlockServeCache.splice(lBlockServeCache.begin(), lBlockServeCache, it->second);
+            return it->second->pblock;
+        }
+    }
+
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblock, pindex))
+        return std::shared_ptr<const CBlock>();
+
+    // The memory used by a deserialized block is approximated by its serialized size
+    const size_t nSize = ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+    if (nSize > nBlockServeCacheUsage)
+        return pblock;
+
+    LOCK(cs_blockServeCache);
+    if (mapBlockServeCache.count(hash))
+        return pblock; // read meanwhile by another thread
+
+    CBlockServeCacheEntry entry;
+    entry.hash = hash;
+    entry.pblock = pblock;
+    entry.nSize = nSize;
+    lBlockServeCache.push_front(entry);
+    mapBlockServeCache[hash] = lBlockServeCache.begin();
+    nBlockServeCacheUsed += nSize;
+
+    while (nBlockServeCacheUsed > nBlockServeCacheUsage)
+    {
+        const CBlockServeCacheEntry& oldest = lBlockServeCache.back();
+        nBlockServeCacheUsed -= oldest.nSize;
+        mapBlockServeCache.erase(oldest.hash);
+        lBlockServeCache.pop_back();
+    }
+    return pblock;
+}
+
+CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+{
+    CAmount nSubsidy = 12.5 * COIN;
+    if (nHeight == 0)
+        return 0;
 
     // Mining slow start
     // The subsidy is ramped up linearly, skipping the middle payout of
@@ -1598,6 +2429,49 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
     return nSubsidy;
 }
 
+namespace {
+
+// The templates and the checks of the blocks ask for the same few heights, at the tip
+const size_t MAX_COMMUNITY_FUND_CACHE_HEIGHTS = 64;
+CCriticalSection cs_communityFundCache;
+std::map<int, std::vector<CTxOut> > mapCommunityFundCache;
+// What the cache was filled for, as the unit tests switch the network and the halving interval
+const Consensus::Params* pCommunityFundCacheParams = NULL;
+int nCommunityFundCacheHalvingInterval = 0;
+
+} // anon namespace
+
+std::vector<CTxOut> GetCommunityFundOutputs(int nHeight, const CChainParams& chainparams)
+{
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    LOCK(cs_communityFundCache);
+    if (pCommunityFundCacheParams != &consensusParams ||
+        nCommunityFundCacheHalvingInterval != consensusParams.nSubsidyHalvingInterval) {
+        mapCommunityFundCache.clear();
+        pCommunityFundCacheParams = &consensusParams;
+        nCommunityFundCacheHalvingInterval = consensusParams.nSubsidyHalvingInterval;
+    }
+
+    std::map<int, std::vector<CTxOut> >::const_iterator it = mapCommunityFundCache.find(nHeight);
+    if (it != mapCommunityFundCache.end())
+        return it->second;
+
+    std::vector<CTxOut> vOutputs;
+    const CAmount reward = GetBlockSubsidy(nHeight, consensusParams);
+    for (Fork::CommunityFundType cfType = Fork::CommunityFundType::FOUNDATION;
+            cfType < Fork::CommunityFundType::ENDTYPE; cfType = Fork::CommunityFundType(cfType + 1)) {
+        const CAmount communityReward = ForkManager::getInstance().getCommunityFundReward(nHeight, reward, cfType);
+        if (communityReward > 0)
+            vOutputs.push_back(CTxOut(communityReward, chainparams.GetCommunityFundScriptAtHeight(nHeight, cfType)));
+    }
+
+    // Dropping the lowest height, the new blocks being above
+    if (mapCommunityFundCache.size() >= MAX_COMMUNITY_FUND_CACHE_HEIGHTS)
+        mapCommunityFundCache.erase(mapCommunityFundCache.begin());
+    mapCommunityFundCache[nHeight] = vOutputs;
+    return vOutputs;
+}
+
 bool IsInitialBlockDownload()
 {
     const CChainParams& chainParams = Params();
@@ -1699,24 +2573,24 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     CheckForkWarningConditions();
 }
 
-// Requires cs_main.
 void Misbehaving(NodeId pnode, int howmuch)
 {
     if (howmuch == 0)
         return;
 
-    CNodeState *state = State(pnode);
-    if (state == NULL)
+    CPeerRef peer = GetPeer(pnode);
+    if (!peer)
         return;
 
-    state->nMisbehavior += howmuch;
+    LOCK(peer->cs);
+    peer->nMisbehavior += howmuch;
     int banscore = GetArg("-banscore", 100);
-    if (state->nMisbehavior >= banscore && state->nMisbehavior - howmuch < banscore)
+    if (peer->nMisbehavior >= banscore && peer->nMisbehavior - howmuch < banscore)
     {
-        LogPrintf("%s: %s (%d -> %d) BAN THRESHOLD EXCEEDED\n", __func__, state->name, state->nMisbehavior-howmuch, state->nMisbehavior);
-        state->fShouldBan = true;
+        LogPrintf("%s: %s (%d -> %d) BAN THRESHOLD EXCEEDED\n", __func__, peer->name, peer->nMisbehavior-howmuch, peer->nMisbehavior);
+        peer->fShouldBan = true;
     } else
-        LogPrintf("%s: %s (%d -> %d)\n", __func__, state->name, state->nMisbehavior-howmuch, state->nMisbehavior);
+        LogPrintf("%s: %s (%d -> %d)\n", __func__, peer->name, peer->nMisbehavior-howmuch, peer->nMisbehavior);
 }
 
 void static InvalidChainFound(CBlockIndex* pindexNew)
@@ -1740,16 +2614,20 @@ void static InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state
     int nDoS = 0;
     if (state.IsInvalid(nDoS)) {
         std::map<uint256, NodeId>::iterator it = mapBlockSource.find(pindex->GetBlockHash());
-        if (it != mapBlockSource.end() && State(it->second)) {
+        CPeerRef peer = it != mapBlockSource.end() ? GetPeer(it->second) : CPeerRef();
+        if (peer) {
             CBlockReject reject = {state.GetRejectCode(), state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), pindex->GetBlockHash()};
-            State(it->second)->rejects.push_back(reject);
+            {
+                LOCK(peer->cs);
+                peer->rejects.push_back(reject);
+            }
             if (nDoS > 0)
                 Misbehaving(it->second, nDoS);
         }
     }
     if (!state.CorruptionPossible()) {
         pindex->nStatus |= BLOCK_FAILED_VALID;
-        setDirtyBlockIndex.insert(pindex);
+        SetBlockIndexDirty(pindex);
         setBlockIndexCandidates.erase(pindex);
         InvalidChainFound(pindex);
     }
@@ -1797,12 +2675,20 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, chain, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, *scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, chain, cacheStore, txdata.get(), hashes), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
+bool CJoinSplitCheck::operator()() {
+    auto verifier = libzcash::ProofVerifier::Strict();
+    if (!ptx->vjoinsplit[nJoinSplit].Verify(*pzcashParams, verifier, ptx->joinSplitPubKey)) {
+        return ::error("CJoinSplitCheck(): %s:%d joinsplit does not verify", ptx->GetHash().ToString(), nJoinSplit);
+    }
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -1817,15 +2703,9 @@ bool IsCommunityFund(const CCoins *coins, int nIn)
        ForkManager::getInstance().isAfterChainsplit(coins->nHeight) &&
        coins->vout.size() > nIn)
     {
-        const Consensus::Params& consensusParams = Params().GetConsensus();
-        CAmount reward = GetBlockSubsidy(coins->nHeight, consensusParams);
-
-        for (Fork::CommunityFundType cfType=Fork::CommunityFundType::FOUNDATION; cfType < Fork::CommunityFundType::ENDTYPE; cfType = Fork::CommunityFundType(cfType + 1)) {
-            if (ForkManager::getInstance().getCommunityFundReward(coins->nHeight, reward, cfType) > 0) {
-                CScript communityScriptPubKey = Params().GetCommunityFundScriptAtHeight(coins->nHeight, cfType);
-                if (coins->vout[nIn].scriptPubKey == communityScriptPubKey)
-                    return true;
-            }
+        for (const CTxOut& communityOut : GetCommunityFundOutputs(coins->nHeight, Params())) {
+            if (coins->vout[nIn].scriptPubKey == communityOut.scriptPubKey)
+                return true;
         }
     }
 
@@ -1927,7 +2807,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, const CChain& chain, unsigned int flags, bool cacheStore, const Consensus::Params& consensusParams, std::vector<CScriptCheck> *pvChecks)
+bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, const CChain& chain, unsigned int flags, bool cacheStore, const Consensus::Params& consensusParams)
 {
     if (!tx.IsCoinBase())
     {
@@ -1935,9 +2815,6 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
             return false;
         }
 
-        if (pvChecks)
-            pvChecks->reserve(tx.vin.size());
-
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
@@ -1946,17 +2823,19 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // The parts of the signature hashes common to all the inputs, worth it from two of them
+            std::shared_ptr<const PrecomputedTransactionData> txdata;
+            if (tx.vin.size() > 1)
+                txdata = std::make_shared<PrecomputedTransactionData>(tx);
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins* coins = inputs.AccessCoins(prevout.hash);
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, &chain, flags, cacheStore);
-                if (pvChecks) {
-                    pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
-                } else if (!check()) {
+                const CScript& scriptPubKey = coins->vout[prevout.n].scriptPubKey;
+                CScriptCheck check(scriptPubKey, tx, i, &chain, flags, cacheStore, txdata);
+                if (!check()) {
                     if (check.GetScriptError() == SCRIPT_ERR_NOT_FINAL) {
                         return state.DoS(0, false, REJECT_NONSTANDARD, "non-final");
                     }
@@ -1967,8 +2846,8 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i, &chain,
-                                flags & ~STANDARD_CONTEXTUAL_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                        CScriptCheck check(scriptPubKey, tx, i, &chain,
+                                flags & ~STANDARD_CONTEXTUAL_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, txdata);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -1990,23 +2869,40 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+/**
+ * Push the script checks of the inputs of tx onto vChecks, for the outputs it spent
+ * kept in txundo. The checks reference the scripts of txundo, which is kept until
+ * they have run, rather than copies, and look the block hashes up in hashes.
+ */
+void AddScriptChecks(const CTransaction& tx, const CTxUndo& txundo, const CChain& chain, const CBlockHashSnapshot& hashes,
+                     unsigned int flags, std::vector<CScriptCheck>& vChecks)
+{
+    std::shared_ptr<const PrecomputedTransactionData> txdata;
+    if (tx.vin.size() > 1)
+        txdata = std::make_shared<PrecomputedTransactionData>(tx);
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        vChecks.emplace_back(txundo.vprevout[i].txout.scriptPubKey, tx, i, &chain, flags, false, txdata, &hashes);
+}
+
+/** Write the record of blockundo, followed by its checksum */
+bool UndoWriteToDisk(const CBlockUndo& blockundo, const CDiskRecord& record, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
+    CIOOperation op(IO_UNDO, 8 + record.size() + 32);
+
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
         return error("%s: OpenUndoFile failed", __func__);
 
     // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
+    fileout << FLATDATA(messageStart) << record.nSizeField;
 
     // Write undo data
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    fileout.write(record.vData.data(), record.size());
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
@@ -2017,33 +2913,6 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
-{
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-
-    // Read block
-    uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-    }
-
-    // Verify checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    if (hashChecksum != hasher.GetHash())
-        return error("%s: Checksum mismatch", __func__);
-
-    return true;
-}
-
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -2062,72 +2931,1204 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
     return state.Error(strMessage);
 }
 
-} // anon namespace
-
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
- * @param view The coins view to which to apply the changes.
- * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * Writes the undo data of the blocks connected in the background, in the order they were
+ * connected, so that ConnectBlock only serializes them. ConnectBlock reserves the space of
+ * each record and queues it under cs_main; until it is written, UndoReadFromDisk gets the
+ * undo data queued, and FlushBlockFile waits for the records queued before syncing the
+ * files.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+class CUndoWriter
 {
-    bool fClean = true;
+public:
+    CUndoWriter() : nQueuedBytes(0), fWriting(false), fStop(false), fFailed(false) {}
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+    void Start()
+    {
+        thread = boost::thread(&CUndoWriter::Thread, this);
     }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
-
-    return fClean;
-}
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
-{
-    assert(pindex->GetBlockHash() == view.GetBestBlock());
+    /** Write what is queued and stop the thread */
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
 
-    if (pfClean)
-        *pfClean = false;
+    /**
+     * Queue the record of pundo, of the block after hashBlock, for the space reserved at pos.
+     * @return false if a write failed
+     */
+    bool Add(const CDiskBlockPos& pos, const uint256& hashBlock, const std::shared_ptr<const CBlockUndo>& pundo,
+             const std::shared_ptr<const CDiskRecord>& precord)
+    {
+        AssertLockHeld(cs_main);
+        CQueuedUndo queued = {pos, hashBlock, pundo, precord};
+        const CDiskBlockPos posData(pos.nFile, pos.nPos + 8);
 
-    bool fClean = true;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nQueuedBytes >= UNDO_MAX_QUEUED_BYTES && !fFailed)
+            condDone.wait(lock);
+        if (fFailed)
+            return false;
+        mapPending[std::make_pair(posData.nFile, posData.nPos)] = pundo;
+        mapFilesPending[pos.nFile]++;
+        nQueuedBytes += precord->size();
+        queue.push_back(queued);
+        condWork.notify_one();
+        return true;
+    }
 
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull())
-        return error("DisconnectBlock(): no undo data available");
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
-        return error("DisconnectBlock(): failure reading undo data");
+    /** Copy the undo data of the record at pos if it is queued */
+    bool Find(const CDiskBlockPos& pos, CBlockUndo& blockundo)
+    {
+        std::shared_ptr<const CBlockUndo> pundo;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            std::map<std::pair<int, unsigned int>, std::shared_ptr<const CBlockUndo> >::const_iterator it =
+                mapPending.find(std::make_pair(pos.nFile, pos.nPos));
+            if (it == mapPending.end())
+                return false;
+            pundo = it->second;
+        }
+        blockundo = *pundo;
+        return true;
+    }
 
-    if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
-        return error("DisconnectBlock(): block and undo data inconsistent");
+    /**
+     * Wait for the records queued to be written.
+     * @return false if a write failed
+     */
+    bool Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while ((!queue.empty() || fWriting) && !fFailed)
+            condDone.wait(lock);
+        return !fFailed;
+    }
 
-    // undo transactions in reverse order
-    for (int i = block.vtx.size() - 1; i >= 0; i--) {
-        const CTransaction &tx = block.vtx[i];
-        uint256 hash = tx.GetHash();
+    /** Whether records are queued or being written in the undo file of block file nFile */
+    bool IsFilePending(int nFile)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return mapFilesPending.count(nFile) != 0;
+    }
 
-        // Check that all outputs are available and match the outputs in the block itself
-        // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
+private:
+    struct CQueuedUndo
+    {
+        CDiskBlockPos pos;
+        uint256 hashBlock;
+        std::shared_ptr<const CBlockUndo> pundo;
+        std::shared_ptr<const CDiskRecord> precord;
+    };
 
-        CCoins outsBlock(tx, pindex->nHeight);
+    boost::mutex mutex;
+    //! Signalled when records are queued or the thread has to stop
+    boost::condition_variable condWork;
+    //! Signalled when a record has been written
+    boost::condition_variable condDone;
+    std::deque<CQueuedUndo> queue;
+    size_t nQueuedBytes;
+    //! The undo data of the records queued or being written, by the position of their data
+    std::map<std::pair<int, unsigned int>, std::shared_ptr<const CBlockUndo> > mapPending;
+    //! Number of records queued or being written in the undo file of each block file
+    std::map<int, int> mapFilesPending;
+    bool fWriting;
+    bool fStop;
+    bool fFailed;
+    boost::thread thread;
+
+    void Thread()
+    {
+        RenameThread("horizen-undo");
+        const CChainParams& chainparams = Params();
+
+        while (true) {
+            CQueuedUndo queued;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queue.empty() && !fStop)
+                    condWork.wait(lock);
+                if (queue.empty())
+                    return;
+                queued = queue.front();
+                queue.pop_front();
+                fWriting = true;
+            }
+
+            CDiskBlockPos pos = queued.pos;
+            const bool fWritten = UndoWriteToDisk(*queued.pundo, *queued.precord, pos, queued.hashBlock, chainparams.MessageStart()) &&
+                                  pos.nPos == queued.pos.nPos + 8;
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                mapPending.erase(std::make_pair(pos.nFile, queued.pos.nPos + 8));
+                if (--mapFilesPending[pos.nFile] == 0)
+                    mapFilesPending.erase(pos.nFile);
+                nQueuedBytes -= queued.precord->size();
+                fWriting = false;
+                fFailed = !fWritten;
+            }
+            condDone.notify_all();
+            if (!fWritten) {
+                AbortNode("Failed to write undo data");
+                return;
+            }
+        }
+    }
+};
+
+CUndoWriter* pundowriter = NULL;
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+{
+    if (pundowriter != NULL && pundowriter->Find(pos, blockundo))
+        return true;
+
+    // Open history file to read, at the size field heading the undo data
+    if (pos.nPos < 4)
+        return error("%s: no undo record at %s", __func__, pos.ToString());
+    CAutoFile filein(OpenUndoFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed", __func__);
+
+    // Read block
+    uint256 hashChecksum;
+    try {
+        unsigned int nSizeField;
+        filein >> nSizeField;
+        ReadDiskRecord(filein, nSizeField, blockundo);
+        filein >> hashChecksum;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // Verify checksum
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << blockundo;
+    if (hashChecksum != hasher.GetHash())
+        return error("%s: Checksum mismatch", __func__);
+
+    return true;
+}
+
+/**
+ * Writes the transaction index in the background. The positions of the transactions of
+ * each connected block are queued, under cs_main, and written in batches together with
+ * the hash of the last block of the batch, from which StartTxIndexer catches up after
+ * a crash. Lookups see the queued positions.
+ */
+class CTxIndexer : public CValidationInterface
+{
+public:
+    CTxIndexer() : nQueuedTx(0), fStop(false), fFailed(false) {}
+
+    void Start()
+    {
+        thread = boost::thread(&CTxIndexer::Thread, this);
+    }
+
+    /** Write what is queued and stop the thread */
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    void Add(const CBlockIndex* pindex, const CBlock& block)
+    {
+        AssertLockHeld(cs_main);
+        CQueuedBlock queued;
+        queued.hash = pindex->GetBlockHash();
+        queued.nFile = pindex->nFile;
+        queued.vPos.reserve(block.vtx.size());
+        CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+            const CTransaction& tx = *ptx;
+            queued.vPos.push_back(std::make_pair(tx.GetHash(), pos));
+            pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nQueuedTx >= TXINDEX_MAX_QUEUED_TX && !fFailed)
+            condSpace.wait(lock);
+        typedef std::pair<uint256, CDiskTxPos> PosPair;
+        BOOST_FOREACH(const PosPair& txpos, queued.vPos)
+            mapPending[txpos.first] = txpos.second;
+        nQueuedTx += queued.vPos.size();
+        mapFilesPending[queued.nFile]++;
+        queue.push_back(CQueuedBlock());
+        queue.back().hash = queued.hash;
+        queue.back().nFile = queued.nFile;
+        queue.back().vPos.swap(queued.vPos);
+        condWork.notify_one();
+    }
+
+    /** Where a queued transaction is, or false if it has been written or is not in a connected block */
+    bool Find(const uint256& txid, CDiskTxPos& pos)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<uint256, CDiskTxPos>::const_iterator it = mapPending.find(txid);
+        if (it == mapPending.end())
+            return false;
+        pos = it->second;
+        return true;
+    }
+
+    /**
+     * The number of batches written with positions in block file nFile, to tell whether
+     * positions in it were changed between two calls, and whether some are still pending.
+     */
+    uint64_t GetFileWrites(int nFile, bool& fPending)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fPending = mapFilesPending.count(nFile) != 0;
+        std::map<int, uint64_t>::const_iterator it = mapFileWrites.find(nFile);
+        return it == mapFileWrites.end() ? 0 : it->second;
+    }
+
+protected:
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added)
+    {
+        // The transactions of the genesis block are not connected
+        if (added && pindex->pprev != NULL)
+            Add(pindex, *pblock);
+    }
+
+private:
+    struct CQueuedBlock
+    {
+        uint256 hash;
+        int nFile;
+        std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    };
+
+    boost::mutex mutex;
+    //! Signalled when blocks are queued or the thread has to stop
+    boost::condition_variable condWork;
+    //! Signalled when a batch has been written
+    boost::condition_variable condSpace;
+    std::deque<CQueuedBlock> queue;
+    size_t nQueuedTx;
+    //! The latest position of the transactions queued or being written
+    std::map<uint256, CDiskTxPos> mapPending;
+    //! Number of blocks queued or being written with each block file
+    std::map<int, int> mapFilesPending;
+    std::map<int, uint64_t> mapFileWrites;
+    bool fStop;
+    bool fFailed;
+    boost::thread thread;
+
+    void Thread()
+    {
+        RenameThread("horizen-txindex");
+
+        while (true) {
+            std::vector<std::pair<uint256, CDiskTxPos> > vBatch;
+            std::vector<int> vFiles;
+            uint256 hashBest;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queue.empty() && !fStop)
+                    condWork.wait(lock);
+                if (queue.empty())
+                    return;
+                // Everything queued while the previous batch was written goes in this one
+                while (!queue.empty()) {
+                    CQueuedBlock& queued = queue.front();
+                    vBatch.insert(vBatch.end(), queued.vPos.begin(), queued.vPos.end());
+                    vFiles.push_back(queued.nFile);
+                    hashBest = queued.hash;
+                    queue.pop_front();
+                }
+            }
+
+            bool fWritten;
+            {
+                CIOOperation op(IO_INDEX, vBatch.size() * (8 + 4 + 12));
+                fWritten = pblocktree->WriteTxIndex(vBatch, hashBest);
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                typedef std::pair<uint256, CDiskTxPos> PosPair;
+                BOOST_FOREACH(const PosPair& txpos, vBatch) {
+                    std::map<uint256, CDiskTxPos>::iterator it = mapPending.find(txpos.first);
+                    // Unless the transaction was queued again since, in another block
+                    if (it != mapPending.end() && it->second == txpos.second)
+                        mapPending.erase(it);
+                }
+                nQueuedTx -= vBatch.size();
+                BOOST_FOREACH(int nFile, vFiles) {
+                    if (--mapFilesPending[nFile] == 0)
+                        mapFilesPending.erase(nFile);
+                    mapFileWrites[nFile]++;
+                }
+                fFailed = !fWritten;
+            }
+            condSpace.notify_all();
+            if (!fWritten) {
+                AbortNode("Failed to write transaction index");
+                return;
+            }
+        }
+    }
+};
+
+CTxIndexer* ptxindexer = NULL;
+
+} // anon namespace
+
+static bool FindTxIndexPos(const uint256& txid, CDiskTxPos& pos)
+{
+    if (ptxindexer != NULL && ptxindexer->Find(txid, pos))
+        return true;
+    return pblocktree->ReadTxIndex(txid, pos);
+}
+
+void StartTxIndexer()
+{
+    LOCK(cs_main);
+    assert(ptxindexer == NULL);
+
+    // Without a last block, the index was written along with the blocks connected
+    const CBlockIndex* pindexFork = chainActive.Tip();
+    uint256 hashBest;
+    if (pblocktree->ReadTxIndexBestBlock(hashBest)) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBest);
+        pindexFork = mi == mapBlockIndex.end() ? NULL : chainActive.FindFork(mi->second);
+    }
+
+    ptxindexer = new CTxIndexer();
+    ptxindexer->Start();
+    if (chainActive.Tip() != pindexFork) {
+        LogPrintf("%s: indexing the transactions of blocks %d to %d\n", __func__,
+                  pindexFork == NULL ? 1 : pindexFork->nHeight + 1, chainActive.Height());
+        for (const CBlockIndex* pindex = pindexFork == NULL ? chainActive[1] : chainActive.Next(pindexFork);
+             pindex != NULL; pindex = chainActive.Next(pindex)) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex)) {
+                AbortNode(strprintf("Failed to read block %s for the transaction index", pindex->GetBlockHash().ToString()));
+                break;
+            }
+            ptxindexer->Add(pindex, block);
+        }
+    }
+    RegisterValidationInterface(ptxindexer);
+}
+
+void StopTxIndexer()
+{
+    if (ptxindexer == NULL)
+        return;
+    UnregisterValidationInterface(ptxindexer);
+    ptxindexer->Stop();
+    delete ptxindexer;
+    ptxindexer = NULL;
+}
+
+void StartUndoWriter()
+{
+    LOCK(cs_main);
+    assert(pundowriter == NULL);
+    pundowriter = new CUndoWriter();
+    pundowriter->Start();
+}
+
+void StopUndoWriter()
+{
+    LOCK(cs_main);
+    if (pundowriter == NULL)
+        return;
+    pundowriter->Stop();
+    delete pundowriter;
+    pundowriter = NULL;
+}
+
+namespace {
+
+/**
+ * Brings the address index up to the active chain in the background and keeps it there.
+ * The blocks past the last one indexed, or back to the fork with the active chain, are
+ * read from disk and their changes written in batches together with the last block, so
+ * an interrupted catch-up resumes where it stopped. ChainTip only wakes it up.
+ */
+class CAddressIndexer : public CValidationInterface
+{
+public:
+    CAddressIndexer() : pindexBest(NULL), nReadingFile(-1), fNotified(false), fStop(false) {}
+
+    void Start(const CBlockIndex* pindexStart)
+    {
+        pindexBest = pindexStart;
+        thread = boost::thread(&CAddressIndexer::Thread, this);
+    }
+
+    /** Write what is indexed and stop the thread */
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    /** Whether the block or undo data in block file nFile is being read, with positions taken under cs_main */
+    bool IsReading(int nFile)
+    {
+        AssertLockHeld(cs_main);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return nReadingFile == nFile;
+    }
+
+protected:
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fNotified = true;
+        }
+        condWork.notify_one();
+    }
+
+private:
+    //! The last block indexed, only used by the thread once started
+    const CBlockIndex* pindexBest;
+
+    boost::mutex mutex;
+    //! Signalled when the chain tip changes or the thread has to stop
+    boost::condition_variable condWork;
+    int nReadingFile;
+    bool fNotified;
+    bool fStop;
+    boost::thread thread;
+
+    void Thread()
+    {
+        RenameThread("horizen-addrindex");
+
+        CAddressIndexBatch batch(*paddressindex);
+        const CBlockIndex* pindexWritten = pindexBest;
+        int64_t nLastLog = GetTime();
+        while (true) {
+            const CBlockIndex* pindex = NULL;
+            bool fConnect = true;
+            CDiskBlockPos posBlock, posUndo;
+            bool fStopping;
+            {
+                LOCK(cs_main);
+                if (pindexBest != NULL && !chainActive.Contains(pindexBest)) {
+                    pindex = pindexBest;
+                    fConnect = false;
+                } else {
+                    pindex = pindexBest == NULL ? chainActive.Genesis() : chainActive.Next(pindexBest);
+                }
+                boost::unique_lock<boost::mutex> lock(mutex);
+                fStopping = fStop;
+                // The transactions of the genesis block are not connected
+                if (pindex != NULL && pindex->pprev != NULL && !fStopping) {
+                    posBlock = pindex->GetBlockPos();
+                    posUndo = pindex->GetUndoPos();
+                    nReadingFile = pindex->nFile;
+                }
+            }
+
+            if (fStopping || pindex == NULL || batch.GetChanges() >= ADDRESSINDEX_BATCH_CHANGES) {
+                if (pindexBest != pindexWritten) {
+                    bool fWritten;
+                    {
+                        CIOOperation op(IO_INDEX, batch.GetChanges() * 64);
+                        fWritten = batch.Write(pindexBest->GetBlockHash());
+                    }
+                    if (!fWritten) {
+                        AbortNode("Failed to write to the address index");
+                        return;
+                    }
+                    pindexWritten = pindexBest;
+                }
+                if (fStopping)
+                    return;
+            }
+            if (pindex == NULL) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fNotified && !fStop)
+                    condWork.wait(lock);
+                fNotified = false;
+                continue;
+            }
+
+            if (pindex->pprev != NULL) {
+                CBlock block;
+                CBlockUndo blockundo;
+                const bool fRead = ReadBlockFromDisk(block, posBlock) &&
+                                   UndoReadFromDisk(blockundo, posUndo, pindex->pprev->GetBlockHash());
+                {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    nReadingFile = -1;
+                }
+                if (!fRead) {
+                    AbortNode(strprintf("Failed to read block %s for the address index", pindex->GetBlockHash().ToString()));
+                    return;
+                }
+                if (fConnect)
+                    batch.ConnectBlock(block, blockundo, pindex->nHeight);
+                else
+                    batch.DisconnectBlock(block, blockundo, pindex->nHeight);
+            }
+            pindexBest = fConnect ? pindex : pindex->pprev;
+
+            if (GetTime() - nLastLog >= 60) {
+                LogPrintf("%s: address index at height %d\n", __func__, pindexBest->nHeight);
+                nLastLog = GetTime();
+            }
+        }
+    }
+};
+
+CAddressIndexer* paddressindexer = NULL;
+
+} // anon namespace
+
+void StartAddressIndexer()
+{
+    LOCK(cs_main);
+    assert(paddressindexer == NULL);
+
+    const CBlockIndex* pindexStart = NULL;
+    uint256 hashBest;
+    if (paddressindex->ReadBestBlock(hashBest)) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBest);
+        if (mi != mapBlockIndex.end())
+            pindexStart = mi->second;
+    }
+    if (pindexStart != chainActive.Tip())
+        LogPrintf("%s: indexing the addresses of the blocks from height %d\n", __func__, pindexStart == NULL ? 0 : pindexStart->nHeight + 1);
+
+    paddressindexer = new CAddressIndexer();
+    RegisterValidationInterface(paddressindexer);
+    paddressindexer->Start(pindexStart);
+}
+
+void StopAddressIndexer()
+{
+    if (paddressindexer == NULL)
+        return;
+    UnregisterValidationInterface(paddressindexer);
+    paddressindexer->Stop();
+    delete paddressindexer;
+    paddressindexer = NULL;
+}
+
+namespace {
+
+/**
+ * Scans the blocks of the active chain for the notes paid to the viewing keys watched by
+ * -notescan. The keys following the chain are tried on each block connected, and the
+ * blocks back to the fork with the active chain have their notes erased. When there is
+ * nothing else to do, the keys added with a start height below the tip are tried on the
+ * blocks from it on, the lowest first, until they reach the tip and follow the chain too.
+ */
+class CNoteScanner : public CValidationInterface
+{
+public:
+    CNoteScanner() : pindexBest(NULL), nScannedHeight(-1), nReadingFile(-1), fNotified(false), fStop(false) {}
+
+    void Start(const CBlockIndex* pindexStart, const std::vector<CNoteScanKey>& vKeys)
+    {
+        pindexBest = pindexStart;
+        nScannedHeight = pindexStart->nHeight;
+        for (const CNoteScanKey& key : vKeys)
+            mapKeys.insert(std::make_pair(key.vk.address(), CWatchedKey(key)));
+        thread = boost::thread(&CNoteScanner::Thread, this);
+    }
+
+    /** Write what is scanned and stop the thread */
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    bool IsReading(int nFile)
+    {
+        AssertLockHeld(cs_main);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return nReadingFile == nFile;
+    }
+
+    bool Watch(const libzcash::ViewingKey& vk, int nStartHeight)
+    {
+        const libzcash::PaymentAddress address = vk.address();
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (mapKeys.count(address))
+                return false;
+            CNoteScanKey key(vk, nStartHeight, nStartHeight <= nScannedHeight ? nStartHeight : -1);
+            mapKeys.insert(std::make_pair(address, CWatchedKey(key)));
+            vCommands.push_back(std::make_pair(address, true));
+            fNotified = true;
+        }
+        condWork.notify_one();
+        return true;
+    }
+
+    bool Unwatch(const libzcash::PaymentAddress& address)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!mapKeys.erase(address))
+                return false;
+            vCommands.push_back(std::make_pair(address, false));
+            fNotified = true;
+        }
+        condWork.notify_one();
+        return true;
+    }
+
+    int GetKeys(std::vector<CNoteScanKey>& vKeys)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (const std::pair<const libzcash::PaymentAddress, CWatchedKey>& item : mapKeys)
+            vKeys.push_back(item.second.key);
+        return nScannedHeight;
+    }
+
+protected:
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fNotified = true;
+        }
+        condWork.notify_one();
+    }
+
+private:
+    struct CWatchedKey
+    {
+        CNoteScanKey key;
+        //! Shared with the scan of a block in progress, which may outlive the key being unwatched
+        std::shared_ptr<const CNoteScanDecryptor> pdecryptor;
+
+        explicit CWatchedKey(const CNoteScanKey& keyIn) : key(keyIn), pdecryptor(std::make_shared<CNoteScanDecryptor>(keyIn.vk)) {}
+    };
+
+    //! The last block scanned for the keys following the chain, only used by the thread once started
+    const CBlockIndex* pindexBest;
+
+    boost::mutex mutex;
+    //! Signalled when the chain tip or the keys change, or the thread has to stop
+    boost::condition_variable condWork;
+    std::map<libzcash::PaymentAddress, CWatchedKey> mapKeys;
+    //! The keys watched (true) and unwatched since the last batch, in order
+    std::vector<std::pair<libzcash::PaymentAddress, bool> > vCommands;
+    int nScannedHeight;
+    int nReadingFile;
+    bool fNotified;
+    bool fStop;
+    boost::thread thread;
+
+    /** Apply the keys watched and unwatched to the batch, and write it with the keys still catching up */
+    bool WriteBatch(CNoteScanBatch& batch, bool fForce)
+    {
+        std::vector<std::pair<libzcash::PaymentAddress, bool> > vApply;
+        std::vector<CNoteScanKey> vKeys;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            vApply.swap(vCommands);
+            for (const std::pair<const libzcash::PaymentAddress, CWatchedKey>& item : mapKeys)
+                vKeys.push_back(item.second.key);
+        }
+        if (vApply.empty() && !fForce)
+            return true;
+        for (const std::pair<libzcash::PaymentAddress, bool>& command : vApply) {
+            if (!command.second)
+                batch.EraseKey(command.first);
+        }
+        for (const CNoteScanKey& key : vKeys)
+            batch.WriteKey(key);
+        CIOOperation op(IO_INDEX, batch.GetChanges() * 64);
+        return batch.Write(pindexBest->GetBlockHash());
+    }
+
+    void Thread()
+    {
+        RenameThread("horizen-notescan");
+
+        CNoteScanBatch batch(*pnotescandb, *pzcashParams);
+        const CBlockIndex* pindexWritten = pindexBest;
+        //! Whether keys caught up with blocks since the last batch
+        bool fCaughtUp = false;
+        int64_t nLastLog = GetTime();
+        while (true) {
+            const CBlockIndex* pindex = NULL;
+            bool fConnect = true;
+            bool fFollow = false;
+            std::map<libzcash::PaymentAddress, std::shared_ptr<const CNoteScanDecryptor> > mapScan;
+            CDiskBlockPos posBlock;
+            uint64_t nFirstPosition = 0;
+            bool fStopping;
+            bool fCommands;
+            {
+                LOCK(cs_main);
+                boost::unique_lock<boost::mutex> lock(mutex);
+                fStopping = fStop;
+                fCommands = !vCommands.empty();
+                if (!chainActive.Contains(pindexBest)) {
+                    pindex = pindexBest;
+                    fConnect = false;
+                } else if ((pindex = chainActive.Next(pindexBest)) != NULL) {
+                    fFollow = true;
+                    for (const std::pair<const libzcash::PaymentAddress, CWatchedKey>& item : mapKeys) {
+                        if (!item.second.key.IsCatchingUp())
+                            mapScan.insert(std::make_pair(item.first, item.second.pdecryptor));
+                    }
+                } else {
+                    int nHeight = -1;
+                    for (const std::pair<const libzcash::PaymentAddress, CWatchedKey>& item : mapKeys) {
+                        if (item.second.key.IsCatchingUp() && (nHeight < 0 || item.second.key.nNextHeight < nHeight))
+                            nHeight = item.second.key.nNextHeight;
+                    }
+                    if (nHeight >= 0) {
+                        pindex = chainActive[nHeight];
+                        for (const std::pair<const libzcash::PaymentAddress, CWatchedKey>& item : mapKeys) {
+                            if (item.second.key.nNextHeight == nHeight)
+                                mapScan.insert(std::make_pair(item.first, item.second.pdecryptor));
+                        }
+                    }
+                }
+                if (fConnect && !mapScan.empty() && !fStopping) {
+                    // The position of the first commitment of the block is the size of the tree before it
+                    ZCIncrementalMerkleTree tree;
+                    if (!pcoinsTip->GetAnchorAt(pindex->hashAnchor, tree)) {
+                        AbortNode(strprintf("Failed to get the note commitment tree before block %s", pindex->GetBlockHash().ToString()));
+                        return;
+                    }
+                    nFirstPosition = tree.size();
+                    posBlock = pindex->GetBlockPos();
+                    nReadingFile = pindex->nFile;
+                }
+            }
+
+            if (fStopping || pindex == NULL || fCommands || batch.GetChanges() >= NOTESCAN_BATCH_CHANGES) {
+                if (pindexBest != pindexWritten || fCaughtUp || fCommands || fStopping) {
+                    if (!WriteBatch(batch, pindexBest != pindexWritten || fCaughtUp)) {
+                        AbortNode("Failed to write to the note scan database");
+                        return;
+                    }
+                    pindexWritten = pindexBest;
+                    fCaughtUp = false;
+                }
+                if (fStopping)
+                    return;
+            }
+            if (pindex == NULL) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fNotified && !fStop)
+                    condWork.wait(lock);
+                fNotified = false;
+                continue;
+            }
+
+            if (!fConnect) {
+                batch.DisconnectBlock(pindex->nHeight);
+                pindexBest = pindex->pprev;
+                boost::unique_lock<boost::mutex> lock(mutex);
+                // The keys catching up scan the blocks of the new chain again
+                for (std::pair<const libzcash::PaymentAddress, CWatchedKey>& item : mapKeys) {
+                    if (item.second.key.nNextHeight > pindex->nHeight)
+                        item.second.key.nNextHeight = pindex->nHeight;
+                }
+                nScannedHeight = pindexBest->nHeight;
+                continue;
+            }
+
+            if (!mapScan.empty()) {
+                CBlock block;
+                const bool fRead = ReadBlockFromDisk(block, posBlock);
+                {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    nReadingFile = -1;
+                }
+                if (!fRead) {
+                    AbortNode(strprintf("Failed to read block %s for the note scan", pindex->GetBlockHash().ToString()));
+                    return;
+                }
+                std::vector<const CNoteScanDecryptor*> vScan;
+                for (const std::pair<const libzcash::PaymentAddress, std::shared_ptr<const CNoteScanDecryptor> >& item : mapScan)
+                    vScan.push_back(item.second.get());
+                batch.ScanBlock(block, pindex->nHeight, nFirstPosition, vScan);
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fFollow) {
+                    pindexBest = pindex;
+                    nScannedHeight = pindexBest->nHeight;
+                    // The keys watched since, from this block at most, still have to scan it
+                    for (std::pair<const libzcash::PaymentAddress, CWatchedKey>& item : mapKeys) {
+                        if (!item.second.key.IsCatchingUp() && item.second.key.nStartHeight <= pindex->nHeight && !mapScan.count(item.first))
+                            item.second.key.nNextHeight = pindex->nHeight;
+                    }
+                } else {
+                    fCaughtUp = true;
+                    for (std::pair<const libzcash::PaymentAddress, CWatchedKey>& item : mapKeys) {
+                        if (item.second.key.nNextHeight == pindex->nHeight && mapScan.count(item.first))
+                            item.second.key.nNextHeight = pindex->nHeight < pindexBest->nHeight ? pindex->nHeight + 1 : -1;
+                    }
+                }
+            }
+
+            if (GetTime() - nLastLog >= 60) {
+                LogPrintf("%s: note scan at height %d\n", __func__, pindex->nHeight);
+                nLastLog = GetTime();
+            }
+        }
+    }
+};
+
+CNoteScanner* pnotescanner = NULL;
+
+} // anon namespace
+
+void StartNoteScanner()
+{
+    LOCK(cs_main);
+    assert(pnotescanner == NULL);
+
+    const CBlockIndex* pindexStart = NULL;
+    uint256 hashBest;
+    if (pnotescandb->ReadBestBlock(hashBest)) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBest);
+        if (mi != mapBlockIndex.end())
+            pindexStart = mi->second;
+    }
+    if (pindexStart == NULL)
+        pindexStart = chainActive.Tip();
+    std::vector<CNoteScanKey> vKeys;
+    if (!pnotescandb->ReadKeys(vKeys))
+        LogPrintf("%s: failed to read the viewing keys watched\n", __func__);
+
+    pnotescanner = new CNoteScanner();
+    RegisterValidationInterface(pnotescanner);
+    pnotescanner->Start(pindexStart, vKeys);
+}
+
+void StopNoteScanner()
+{
+    if (pnotescanner == NULL)
+        return;
+    UnregisterValidationInterface(pnotescanner);
+    pnotescanner->Stop();
+    delete pnotescanner;
+    pnotescanner = NULL;
+}
+
+bool WatchViewingKey(const libzcash::ViewingKey& vk, int nStartHeight)
+{
+    return pnotescanner != NULL && pnotescanner->Watch(vk, nStartHeight);
+}
+
+bool UnwatchAddress(const libzcash::PaymentAddress& address)
+{
+    return pnotescanner != NULL && pnotescanner->Unwatch(address);
+}
+
+int GetWatchedKeys(std::vector<CNoteScanKey>& vKeys)
+{
+    return pnotescanner == NULL ? -1 : pnotescanner->GetKeys(vKeys);
+}
+
+namespace {
+
+/**
+ * Builds the basic filters of the blocks of the active chain in the background, like the
+ * address index: the blocks past the last one indexed are read from disk with their undo
+ * data, and their filters written in batches together with the last block. The filters are
+ * kept by block hash, so disconnecting a block only moves the last block back.
+ */
+class CBlockFilterIndexer : public CValidationInterface
+{
+public:
+    CBlockFilterIndexer() : pindexBest(NULL), nReadingFile(-1), fNotified(false), fStop(false) {}
+
+    void Start(const CBlockIndex* pindexStart)
+    {
+        pindexBest = pindexStart;
+        thread = boost::thread(&CBlockFilterIndexer::Thread, this);
+    }
+
+    /** Write the filters built and stop the thread */
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    bool IsReading(int nFile)
+    {
+        AssertLockHeld(cs_main);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return nReadingFile == nFile;
+    }
+
+protected:
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fNotified = true;
+        }
+        condWork.notify_one();
+    }
+
+private:
+    //! The last block indexed, only used by the thread once started
+    const CBlockIndex* pindexBest;
+
+    boost::mutex mutex;
+    //! Signalled when the chain tip changes or the thread has to stop
+    boost::condition_variable condWork;
+    int nReadingFile;
+    bool fNotified;
+    bool fStop;
+    boost::thread thread;
+
+    void Thread()
+    {
+        RenameThread("horizen-blockfilter");
+
+        //! The filters not written yet with their headers, and the headers by block
+        std::vector<std::pair<BlockFilter, uint256> > vFilters;
+        std::map<uint256, uint256> mapHeaders;
+        const CBlockIndex* pindexWritten = pindexBest;
+        int64_t nLastLog = GetTime();
+        while (true) {
+            const CBlockIndex* pindex = NULL;
+            bool fConnect = true;
+            CDiskBlockPos posBlock, posUndo;
+            bool fStopping;
+            {
+                LOCK(cs_main);
+                if (pindexBest != NULL && !chainActive.Contains(pindexBest)) {
+                    pindex = pindexBest;
+                    fConnect = false;
+                } else {
+                    pindex = pindexBest == NULL ? chainActive.Genesis() : chainActive.Next(pindexBest);
+                }
+                boost::unique_lock<boost::mutex> lock(mutex);
+                fStopping = fStop;
+                if (pindex != NULL && fConnect && !fStopping) {
+                    posBlock = pindex->GetBlockPos();
+                    posUndo = pindex->GetUndoPos();
+                    nReadingFile = pindex->nFile;
+                }
+            }
+
+            if (fStopping || pindex == NULL || vFilters.size() >= BLOCKFILTER_BATCH_SIZE) {
+                if (pindexBest != pindexWritten) {
+                    bool fWritten;
+                    {
+                        CIOOperation op(IO_INDEX, vFilters.size() * 1024);
+                        fWritten = pblockfilterdb->WriteFilters(vFilters, pindexBest->GetBlockHash());
+                    }
+                    if (!fWritten) {
+                        AbortNode("Failed to write to the block filter index");
+                        return;
+                    }
+                    vFilters.clear();
+                    mapHeaders.clear();
+                    pindexWritten = pindexBest;
+                }
+                if (fStopping)
+                    return;
+            }
+            if (pindex == NULL) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fNotified && !fStop)
+                    condWork.wait(lock);
+                fNotified = false;
+                continue;
+            }
+
+            if (!fConnect) {
+                pindexBest = pindex->pprev;
+                continue;
+            }
+
+            // The genesis block has no undo data, its transactions not being connected
+            CBlock block;
+            CBlockUndo blockundo;
+            const bool fRead = ReadBlockFromDisk(block, posBlock) &&
+                               (pindex->pprev == NULL || UndoReadFromDisk(blockundo, posUndo, pindex->pprev->GetBlockHash()));
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                nReadingFile = -1;
+            }
+            if (!fRead) {
+                AbortNode(strprintf("Failed to read block %s for the block filter index", pindex->GetBlockHash().ToString()));
+                return;
+            }
+
+            uint256 hashPrevHeader;
+            if (pindex->pprev != NULL) {
+                std::map<uint256, uint256>::const_iterator it = mapHeaders.find(pindex->pprev->GetBlockHash());
+                CBlockFilterHeader header;
+                if (it != mapHeaders.end()) {
+                    hashPrevHeader = it->second;
+                } else if (pblockfilterdb->ReadFilterHeader(pindex->pprev->GetBlockHash(), header)) {
+                    hashPrevHeader = header.header;
+                } else {
+                    AbortNode(strprintf("Failed to read the filter header of block %s", pindex->pprev->GetBlockHash().ToString()));
+                    return;
+                }
+            }
+            BlockFilter filter(BLOCK_FILTER_BASIC, block, blockundo);
+            const uint256 hashHeader = filter.ComputeHeader(hashPrevHeader);
+            mapHeaders[pindex->GetBlockHash()] = hashHeader;
+            vFilters.push_back(std::make_pair(filter, hashHeader));
+            pindexBest = pindex;
+
+            if (GetTime() - nLastLog >= 60) {
+                LogPrintf("%s: block filter index at height %d\n", __func__, pindexBest->nHeight);
+                nLastLog = GetTime();
+            }
+        }
+    }
+};
+
+CBlockFilterIndexer* pblockfilterindexer = NULL;
+
+} // anon namespace
+
+void StartBlockFilterIndexer()
+{
+    LOCK(cs_main);
+    assert(pblockfilterindexer == NULL);
+
+    const CBlockIndex* pindexStart = NULL;
+    uint256 hashBest;
+    if (pblockfilterdb->ReadBestBlock(hashBest)) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBest);
+        if (mi != mapBlockIndex.end())
+            pindexStart = mi->second;
+    }
+    if (pindexStart != chainActive.Tip())
+        LogPrintf("%s: building the filters of the blocks from height %d\n", __func__, pindexStart == NULL ? 0 : pindexStart->nHeight + 1);
+
+    pblockfilterindexer = new CBlockFilterIndexer();
+    RegisterValidationInterface(pblockfilterindexer);
+    pblockfilterindexer->Start(pindexStart);
+}
+
+void StopBlockFilterIndexer()
+{
+    if (pblockfilterindexer == NULL)
+        return;
+    UnregisterValidationInterface(pblockfilterindexer);
+    pblockfilterindexer->Stop();
+    delete pblockfilterindexer;
+    pblockfilterindexer = NULL;
+}
+
+/**
+ * Apply the undo operation of a CTxInUndo to the given chain state.
+ * @param undo The undo object.
+ * @param view The coins view to which to apply the changes.
+ * @param out The out point that corresponds to the tx input.
+ * @return True on success.
+ */
+static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+{
+    bool fClean = true;
+
+    CCoinsModifier coins = view.ModifyCoins(out.hash);
+    if (undo.nHeight != 0) {
+        // undo data contains height: this is the last output of the prevout tx being spent
+        if (!coins->IsPruned())
+            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
+        coins->Clear();
+        coins->fCoinBase = undo.fCoinBase;
+        coins->nHeight = undo.nHeight;
+        coins->nVersion = undo.nVersion;
+    } else {
+        if (coins->IsPruned())
+            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+    }
+    if (coins->IsAvailable(out.n))
+        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
+    if (coins->vout.size() < out.n+1)
+        coins->vout.resize(out.n+1);
+    coins->vout[out.n] = undo.txout;
+
+    return fClean;
+}
+
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+{
+    if (pfClean)
+        *pfClean = false;
+
+    CBlockUndo blockUndo;
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull())
+        return error("DisconnectBlock(): no undo data available");
+    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
+        return error("DisconnectBlock(): failure reading undo data");
+
+    return DisconnectBlock(block, blockUndo, state, pindex, view, pfClean);
+}
+
+bool DisconnectBlock(const CBlock& block, const CBlockUndo& blockUndo, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+{
+    assert(pindex->GetBlockHash() == view.GetBestBlock());
+
+    if (pfClean)
+        *pfClean = false;
+
+    bool fClean = true;
+
+    if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
+        return error("DisconnectBlock(): block and undo data inconsistent");
+
+    // undo transactions in reverse order
+    for (int i = block.vtx.size() - 1; i >= 0; i--) {
+        const CTransaction &tx = *block.vtx[i];
+        uint256 hash = tx.GetHash();
+
+        // Check that all outputs are available and match the outputs in the block itself
+        // exactly.
+        {
+        CCoinsModifier outs = view.ModifyCoins(hash);
+        outs->ClearUnspendable();
+
+        CCoins outsBlock(tx, pindex->nHeight);
         // The CCoins serialization does not serialize negative numbers.
         // No network rules currently depend on the version here, so an inconsistency is harmless
         // but it must be corrected before txout nversion ever influences a network rule.
@@ -2177,14 +4178,22 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
 void static FlushBlockFile(bool fFinalize = false)
 {
+    // The undo records queued are synced with the others; a failed write has aborted the node
+    if (pundowriter != NULL)
+        pundowriter->Wait();
+
     LOCK(cs_LastBlockFile);
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
+        if (fFinalize) {
+            // A mapping past the new end of the file would fault if read
+            ForgetMappedBlockFile(nLastBlockFile);
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+        }
+        CIOOperation op(IO_BLOCK);
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -2193,7 +4202,10 @@ void static FlushBlockFile(bool fFinalize = false)
     if (fileOld) {
         if (fFinalize)
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        FileCommit(fileOld);
+        {
+            CIOOperation op(IO_UNDO);
+            FileCommit(fileOld);
+        }
         fclose(fileOld);
     }
 }
@@ -2201,12 +4213,122 @@ void static FlushBlockFile(bool fFinalize = false)
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+//! Script checks of a block handed to the queue at once, rather than for each transaction
+static const unsigned int SCRIPT_CHECK_ADD_SIZE = 64;
 
 void ThreadScriptCheck() {
     RenameThread("horizen-scriptch");
     scriptcheckqueue.Thread();
 }
 
+// A proof check costs orders of magnitude more than a script check,
+// so workers grab them in small batches to keep all of them busy.
+static CCheckQueue<CJoinSplitCheck> joinsplitcheckqueue(4);
+
+void ThreadJoinSplitCheck() {
+    RenameThread("horizen-jscheck");
+    joinsplitcheckqueue.Thread();
+}
+
+/**
+ * Verify the JoinSplit proofs of the given transactions at once. This is only a head start for
+ * AcceptToMemoryPool: the transactions whose proofs and joinSplitSig pass are remembered as verified,
+ * any other is verified again, and rejected with the proper reason, by AcceptToMemoryPool.
+ */
+static void PreVerifyJoinSplits(const std::vector<const CTransaction*>& vtx)
+{
+    if (!nScriptCheckThreads)
+        return;
+    std::vector<CJoinSplitCheck> vJoinSplitChecks;
+    std::vector<const CTransaction*> vShielded;
+    BOOST_FOREACH(const CTransaction* ptx, vtx) {
+        if (ptx->vjoinsplit.empty() || joinSplitValidationCache.Get(ptx->GetHash()))
+            continue;
+        for (unsigned int js = 0; js < ptx->vjoinsplit.size(); js++)
+            vJoinSplitChecks.push_back(CJoinSplitCheck(*ptx, js));
+        vShielded.push_back(ptx);
+    }
+    if (vJoinSplitChecks.empty())
+        return;
+    CCheckQueueControl<CJoinSplitCheck> jscontrol(&joinsplitcheckqueue);
+    jscontrol.Add(vJoinSplitChecks);
+    if (jscontrol.Wait()) {
+        BOOST_FOREACH(const CTransaction* ptx, vShielded) {
+            CValidationState stateSig;
+            if (CheckTransactionWithoutProofVerification(*ptx, stateSig))
+                joinSplitValidationCache.Set(ptx->GetHash());
+        }
+    }
+}
+
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, CValidationState &state, const std::vector<CTransaction>& package,
+                               size_t& nAccepted, bool* pfMissingInputs, bool fRejectAbsurdFee)
+{
+    AssertLockHeld(cs_main);
+    nAccepted = 0;
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+
+    // Verify the JoinSplit proofs of the whole package at once
+    std::vector<const CTransaction*> vtx;
+    BOOST_FOREACH(const CTransaction& tx, package)
+        vtx.push_back(&tx);
+    PreVerifyJoinSplits(vtx);
+
+    BOOST_FOREACH(const CTransaction& tx, package) {
+        if (!pool.exists(tx.GetHash()) &&
+            !AcceptToMemoryPool(pool, state, tx, false, pfMissingInputs, fRejectAbsurdFee))
+            return false;
+        nAccepted++;
+    }
+    return true;
+}
+
+// A coins lookup is a database read, handed out in small batches like the proof checks
+static CCheckQueue<CCoinsFetch> coinsfetchqueue(4);
+
+void ThreadCoinsFetch() {
+    RenameThread("horizen-coinsfetch");
+    coinsfetchqueue.Thread();
+}
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(16);
+/** A check queue has a single master at a time: serializes the message handler threads using headercheckqueue */
+static CCriticalSection cs_headercheckqueue;
+
+void ThreadHeaderCheck() {
+    RenameThread("horizen-hdrcheck");
+    headercheckqueue.Thread();
+}
+
+template <typename T>
+static CheckQueueInfo GetCheckQueueInfo(const std::string& name, const CCheckQueue<T>& queue)
+{
+    CheckQueueInfo info;
+    info.name = name;
+    info.nThreads = queue.GetThreadCount();
+    info.nPending = queue.GetPendingCount();
+    info.nChecks = queue.GetCheckedCount();
+    info.nBusyTime = queue.GetBusyTime();
+    return info;
+}
+
+std::vector<CheckQueueInfo> GetCheckQueueInfo()
+{
+    std::vector<CheckQueueInfo> vInfo;
+    vInfo.push_back(GetCheckQueueInfo("script", scriptcheckqueue));
+    vInfo.push_back(GetCheckQueueInfo("joinsplit", joinsplitcheckqueue));
+    vInfo.push_back(GetCheckQueueInfo("header", headercheckqueue));
+    vInfo.push_back(GetCheckQueueInfo("coinsfetch", coinsfetchqueue));
+    return vInfo;
+}
+
+bool CHeaderCheck::operator()() {
+    *pfValid = CheckEquihashSolution(pheader, Params()) &&
+               CheckProofOfWork(pheader->GetHash(), pheader->nBits, Params().GetConsensus());
+    return true;
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2314,6 +4436,48 @@ public:
 // Protected by cs_main
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
+/** The validation times of the block ConnectTip connects, filled by ConnectBlock, guarded by cs_main */
+static BlockValidationStats* pBlockStatsPending = NULL;
+
+static CCriticalSection cs_blockValidationStats;
+static std::deque<BlockValidationStats> dequeBlockValidationStats;
+
+static void PushBlockValidationStats(const BlockValidationStats& stats)
+{
+    LOCK(cs_blockValidationStats);
+    dequeBlockValidationStats.push_front(stats);
+    if (dequeBlockValidationStats.size() > BLOCK_VALIDATION_STATS_SIZE)
+        dequeBlockValidationStats.pop_back();
+}
+
+std::vector<BlockValidationStats> GetBlockValidationStats(size_t nCount)
+{
+    LOCK(cs_blockValidationStats);
+    nCount = std::min(nCount, dequeBlockValidationStats.size());
+    return std::vector<BlockValidationStats>(dequeBlockValidationStats.begin(), dequeBlockValidationStats.begin() + nCount);
+}
+
+size_t BlockIndexDynamicUsage()
+{
+    AssertLockHeld(cs_main);
+    size_t nUsage = memusage::DynamicUsage(mapBlockIndex);
+    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+        nUsage += memusage::MallocUsage(sizeof(CBlockIndex)) + memusage::DynamicUsage(item.second->nSolution);
+    return nUsage;
+}
+
+size_t OrphanTxDynamicUsage()
+{
+    AssertLockHeld(cs_main);
+    size_t nUsage = nOrphanTxUsage + memusage::DynamicUsage(mapOrphanTransactions) +
+                    memusage::DynamicUsage(mapOrphanTransactionsByPrev) + memusage::DynamicUsage(mapOrphansByPeer);
+    for (const std::pair<const COutPoint, set<uint256> >& item : mapOrphanTransactionsByPrev)
+        nUsage += memusage::DynamicUsage(item.second);
+    for (const std::pair<const NodeId, COrphanPeer>& item : mapOrphansByPeer)
+        nUsage += memusage::DynamicUsage(item.second.setOrphans);
+    return nUsage;
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2334,12 +4498,48 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    auto verifier = libzcash::ProofVerifier::Strict();
+    if (fExpensiveChecks && !hashAssumeValid.IsNull()) {
+        // Scripts and proofs of ancestors of the assumed valid block are not checked,
+        // as long as that block is on the best header chain, which has at least
+        // -minimumchainwork, and buried under at least two weeks worth of work, so
+        // that a chain past it cannot easily be forged.
+        BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end() && pindexBestHeader != NULL &&
+            pindexBestHeader->GetAncestor(it->second->nHeight) == it->second &&
+            pindexBestHeader->nChainWork >= nMinimumChainWork &&
+            it->second->GetAncestor(pindex->nHeight) == pindex) {
+            fExpensiveChecks = GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2;
+        }
+    }
+
+    auto verifier = libzcash::ProofVerifier::Batch();
     auto disabledVerifier = libzcash::ProofVerifier::Disabled();
 
+    // When running with -par, JoinSplit proofs are not verified inline by CheckBlock
+    // but queued as CJoinSplitCheck jobs, which run alongside the rest of the block connection.
+    bool fParallelProofChecks = fExpensiveChecks && nScriptCheckThreads;
+
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
+    int64_t nTimeProofStart = GetTimeMicros();
+    if (!CheckBlock(block, state, (fExpensiveChecks && !fParallelProofChecks) ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
         return false;
+    if (!verifier.verifyBatch())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+
+    CCheckQueueControl<CJoinSplitCheck> jscontrol(fParallelProofChecks ? &joinsplitcheckqueue : NULL);
+    if (fParallelProofChecks) {
+        std::vector<CJoinSplitCheck> vJoinSplitChecks;
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+            const CTransaction& tx = *ptx;
+            if (tx.vjoinsplit.empty() || joinSplitValidationCache.Get(tx.GetHash()))
+                continue;
+            for (unsigned int js = 0; js < tx.vjoinsplit.size(); js++)
+                vJoinSplitChecks.push_back(CJoinSplitCheck(tx, js));
+        }
+        jscontrol.Add(vJoinSplitChecks);
+    }
+    int64_t nTimeProof = GetTimeMicros() - nTimeProofStart;
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
@@ -2361,7 +4561,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
-    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
         const CCoins* coins = view.AccessCoins(tx.GetHash());
         if (coins && !coins->IsPruned())
             return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
@@ -2379,15 +4580,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
+    // The script check threads look the block hashes up in a snapshot of the chain taken
+    // here, rather than in the chain, for the replay protection of the outputs spent
+    std::unique_ptr<CBlockHashSnapshot> phashes;
+    if (fExpensiveChecks && nScriptCheckThreads)
+        phashes.reset(new CBlockHashSnapshot(chain, getCheckBlockAtHeightSafeDepth()));
+
     CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
 
     // Construct the incremental merkle tree at the current
@@ -2407,10 +4611,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // match what we asked for.
         assert(tree.root() == old_tree_root);
     }
+    std::vector<libzcash::SHA256Compress> vNoteCommitments;
+    std::vector<CScriptCheck> vChecks;
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        const CTransaction &tx = block.vtx[i];
+        const CTransaction &tx = *block.vtx[i];
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -2439,10 +4645,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
-            std::vector<CScriptCheck> vChecks;
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, chain, flags, false, chainparams.GetConsensus(), nScriptCheckThreads ? &vChecks : NULL))
+            // The script check threads get the scripts once the inputs are spent, from the undo data
+            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks && !nScriptCheckThreads, chain, flags, false, chainparams.GetConsensus()))
                 return false;
-            control.Add(vChecks);
         }
 
         CTxUndo undoDummy;
@@ -2451,18 +4656,26 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
+        if (!tx.IsCoinBase() && fExpensiveChecks && nScriptCheckThreads) {
+            AddScriptChecks(tx, blockundo.vtxundo.back(), chain, *phashes, flags, vChecks);
+            if (vChecks.size() >= SCRIPT_CHECK_ADD_SIZE) {
+                control.Add(vChecks);
+                vChecks.clear();
+            }
+        }
+
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
             BOOST_FOREACH(const uint256 &note_commitment, joinsplit.commitments) {
-                // Insert the note commitments into our temporary tree.
-
-                tree.append(note_commitment);
+                vNoteCommitments.push_back(note_commitment);
             }
         }
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
 
+    control.Add(vChecks);
+
+    // Insert the note commitments into our temporary tree, all at once as
+    // only the tree of the whole block is kept.
+    tree.append(vNoteCommitments);
     view.PushAnchor(tree);
     if (!fJustCheck) {
         pindex->hashAnchorEnd = tree.root();
@@ -2473,12 +4686,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
-    if (block.vtx[0].GetValueOut() > blockReward)
+    if (block.vtx[0]->GetValueOut() > blockReward)
         return state.DoS(100,
                          error("ConnectBlock(): coinbase pays too much (actual=%d vs limit=%d)",
-                               block.vtx[0].GetValueOut(), blockReward),
+                               block.vtx[0]->GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
+    int64_t nTimeWaitStart = GetTimeMicros();
+    if (!jscontrol.Wait())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    int64_t nTimeProofWait = GetTimeMicros();
+    nTimeProof += nTimeProofWait - nTimeWaitStart;
     if (!control.Wait())
         return state.DoS(100, false);
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
@@ -2486,16 +4705,30 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fJustCheck)
         return true;
+    pindex->fProofsVerified = fExpensiveChecks;
+    connectStageLatency[CONNECT_INPUTS].add(nTime1 - nTimeStart);
+    connectStageLatency[CONNECT_VERIFY].add(nTime2 - nTimeStart);
 
     // Write undo information to disk
+    int64_t nTimeUndo = 0;
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
     {
         if (pindex->GetUndoPos().IsNull()) {
             CDiskBlockPos pos;
-            if (!FindUndoPos(state, pindex->nFile, pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+            std::shared_ptr<const CDiskRecord> precord = fCompactUndo ?
+                std::make_shared<const CDiskRecord>(CBlockUndoCompactor(blockundo), fBlockCompression) :
+                std::make_shared<const CDiskRecord>(blockundo, fBlockCompression);
+            if (!FindUndoPos(state, pindex->nFile, pos, precord->size() + 40))
                 return error("ConnectBlock(): FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+            if (pundowriter != NULL) {
+                // Written in the background, after the magic and the size field
+                if (!pundowriter->Add(pos, pindex->pprev->GetBlockHash(), std::make_shared<const CBlockUndo>(std::move(blockundo)), precord))
+                    return AbortNode(state, "Failed to write undo data");
+                pos.nPos += 8;
+            } else if (!UndoWriteToDisk(blockundo, *precord, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart())) {
                 return AbortNode(state, "Failed to write undo data");
+            }
+            nTimeUndo = GetTimeMicros() - nTime2;
 
             // update nUndoPos in block index
             pindex->nUndoPos = pos.nPos;
@@ -2503,26 +4736,34 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
 
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
-        setDirtyBlockIndex.insert(pindex);
+        SetBlockIndexDirty(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
+    connectStageLatency[CONNECT_INDEX].add(nTime3 - nTime2);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
     GetMainSignals().UpdatedTransaction(hashPrevBestCoinBase);
-    hashPrevBestCoinBase = block.vtx[0].GetHash();
+    hashPrevBestCoinBase = block.vtx[0]->GetHash();
 
     int64_t nTime4 = GetTimeMicros(); nTimeCallbacks += nTime4 - nTime3;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
+    connectStageLatency[CONNECT_CALLBACKS].add(nTime4 - nTime3);
+
+    if (pBlockStatsPending) {
+        pBlockStatsPending->nInputs = nInputs;
+        pBlockStatsPending->nProofTime = nTimeProof;
+        pBlockStatsPending->nConnectTime = nTime1 - nTimeStart;
+        pBlockStatsPending->nScriptTime = nTime2 - nTimeProofWait;
+        pBlockStatsPending->nUndoTime = nTimeUndo;
+        pBlockStatsPending->nIndexTime = nTime3 - nTime2;
+        pBlockStatsPending->nCallbacksTime = nTime4 - nTime3;
+    }
 
     return true;
 }
@@ -2534,11 +4775,68 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+namespace {
+
+/** The dirty part of pcoinsTip at some point, written to pcoinsdbview by a thread of its own */
+struct CCoinsWriteJob {
+    CCoinsMap mapCoins;
+    CAnchorsMap mapAnchors;
+    CNullifiersMap mapNullifiers;
+    uint256 hashBlock;
+    uint256 hashAnchor;
+};
+
+boost::thread threadCoinsWrite;
+std::atomic<bool> fCoinsWriteFailed(false);
+
+void ThreadCoinsWrite(std::shared_ptr<CCoinsWriteJob> job)
+{
+    RenameThread("horizen-coinswrite");
+    int64_t nStart = GetTimeMicros();
+    size_t nCoins = job->mapCoins.size();
+    try {
+        CIOOperation op(IO_FLUSH, 128 * nCoins);
+        if (!pcoinsdbview->BatchWrite(job->mapCoins, job->hashBlock, job->hashAnchor, job->mapAnchors, job->mapNullifiers))
+            fCoinsWriteFailed = true;
+    } catch (const std::runtime_error& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        fCoinsWriteFailed = true;
+    }
+    LogPrint("bench", "Wrote %u coins to the database in the background: %.2fms\n", nCoins, 0.001 * (GetTimeMicros() - nStart));
+}
+
+boost::thread threadUnlinkPruned;
+
+void ThreadUnlinkPrunedFiles(std::set<int> setFilesToPrune)
+{
+    RenameThread("horizen-unlink");
+    UnlinkPrunedFiles(setFilesToPrune);
+}
+
+/** Wait for the removal of the files pruned last, if it is still going on */
+void WaitForPrunedFilesUnlink()
+{
+    if (threadUnlinkPruned.joinable())
+        threadUnlinkPruned.join();
+}
+
+/** Wait for the background write of the coins, if any, and return whether it succeeded */
+bool WaitForCoinsWrite()
+{
+    if (threadCoinsWrite.joinable())
+        threadCoinsWrite.join();
+    return !fCoinsWriteFailed.exchange(false);
+}
+
+} // anon namespace
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
  * if they're too large, if it's been a while since the last write,
  * or always and in all cases if we're in prune mode and are deleting files.
+ * The periodic writes of the coins happen in the background and keep them
+ * cached, so that a flush only has what changed since to write.
  */
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK2(cs_main, cs_LastBlockFile);
@@ -2578,12 +4876,16 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCoinCacheUsage;
     // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
-    // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
+    // It's been a while since we wrote the coins. Do this in the background, keeping them cached.
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
     // Combine all conditions that result in a full cache flush.
-    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fFlushForPrune;
+    bool fBackgroundWrite = fPeriodicFlush && !fDoFullFlush;
+    // The previous background write, if any, has to land before the next write of the coins.
+    if ((fDoFullFlush || fBackgroundWrite) && !WaitForCoinsWrite())
+        return AbortNode(state, "Failed to write to coin database");
     // Write blocks and block index to disk.
-    if (fDoFullFlush || fPeriodicWrite) {
+    if (fDoFullFlush || fPeriodicWrite || fBackgroundWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
@@ -2603,13 +4905,28 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 vBlocks.push_back(*it);
                 setDirtyBlockIndex.erase(it++);
             }
-            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+            bool fWritten;
+            {
+                CIOOperation op(IO_FLUSH);
+                fWritten = pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks);
+            }
+            if (!fWritten) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            // All the entries are in the database now. Those of the best header chain that are
+            // deep enough not to be asked for often can read their solutions from there.
+            if (pindexBestHeader) {
+                CBlockIndex* pindex = pindexBestHeader->GetAncestor(pindexBestHeader->nHeight - BLOCK_INDEX_TRIM_DEPTH);
+                for (; pindex && !pindex->fSolutionTrimmed; pindex = pindex->pprev)
+                    pindex->TrimSolution();
+            }
+        }
+        // Finally remove any pruned files, in the background: nothing refers to them any more, and
+        // deleting large files can take a while on some filesystems
+        if (fFlushForPrune) {
+            WaitForPrunedFilesUnlink();
+            threadUnlinkPruned = boost::thread(&ThreadUnlinkPrunedFiles, setFilesToPrune);
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
-            UnlinkPrunedFiles(setFilesToPrune);
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2622,15 +4939,31 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        bool fFlushed;
+        {
+            CIOOperation op(IO_FLUSH, 128 * pcoinsTip->GetCacheSize());
+            fFlushed = pcoinsTip->Flush();
+        }
+        if (!fFlushed)
             return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
+    } else if (fBackgroundWrite) {
+        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            return state.Error("out of disk space");
+        // Take what changed now, with the block index written above, and write it while the cache is in use.
+        std::shared_ptr<CCoinsWriteJob> job = std::make_shared<CCoinsWriteJob>();
+        pcoinsTip->CopyDirty(job->mapCoins, job->hashBlock, job->hashAnchor, job->mapAnchors, job->mapNullifiers);
+        threadCoinsWrite = boost::thread(&ThreadCoinsWrite, job);
+        nLastFlush = nNow;
     }
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
         // Update best block in wallet (so we can detect restored wallets).
         GetMainSignals().SetBestChain(chainActive.GetLocator());
         nLastSetChain = nNow;
     }
+    // The final flush leaves no file behind to remove
+    if (mode == FLUSH_STATE_ALWAYS)
+        WaitForPrunedFilesUnlink();
     } catch (const std::runtime_error& e) {
         return AbortNode(state, std::string("System error while flushing: ") + e.what());
     }
@@ -2648,10 +4981,36 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+CChainTipView::CChainTipView(const CBlockIndex *pindexIn) :
+    pindex(pindexIn),
+    nHeight(pindexIn ? pindexIn->nHeight : -1),
+    nMedianTimePast(pindexIn ? pindexIn->GetMedianTimePast() : 0),
+    nChainWork(pindexIn ? pindexIn->nChainWork : arith_uint256())
+{
+}
+
+namespace {
+//! Only replaced under cs_main, but read and copied without it
+CChainTipViewRef chainTipView = std::make_shared<const CChainTipView>();
+}
+
+CChainTipViewRef GetChainTipView()
+{
+    return std::atomic_load(&chainTipView);
+}
+
+/** Publish a new CChainTipView after the tip of chainActive changed */
+static void PublishChainTipView()
+{
+    std::atomic_store(&chainTipView, CChainTipViewRef(std::make_shared<const CChainTipView>(chainActive.Tip())));
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
     chainActive.SetTip(pindexNew);
+    PublishChainTipView();
+    nGlobalTipsVersion++;
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -2668,7 +5027,11 @@ void static UpdateTip(CBlockIndex *pindexNew) {
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
       syncProgress, pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), pcoinsTip->GetCacheSize());
 
-    cvBlockChange.notify_all();
+    // Under csBestBlock, so that a long poll cannot miss it between its check and its wait
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        cvBlockChange.notify_all();
+    }
 
     // Check the version of the last 100 blocks to see if we need to upgrade:
     static bool fWarned = false;
@@ -2713,51 +5076,104 @@ void static UpdateTip(CBlockIndex *pindexNew) {
 }
 
 /** Disconnect chainActive's tip. */
-bool static DisconnectTip(CValidationState &state) {
-    CBlockIndex *pindexDelete = chainActive.Tip();
-    assert(pindexDelete);
-    mempool.check(pcoinsTip);
-    // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete))
-        return AbortNode(state, "Failed to read block");
-    // Apply the block atomically to the chain state.
-    uint256 anchorBeforeDisconnect = pcoinsTip->GetBestAnchor();
-    int64_t nStart = GetTimeMicros();
-    {
-        CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
-            return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
-        assert(view.Flush());
-    }
-    LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
-    uint256 anchorAfterDisconnect = pcoinsTip->GetBestAnchor();
-    // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
-        return false;
-    // Resurrect mempool transactions from the disconnected block.
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+/**
+ * What disconnecting blocks from chainActive defers until the blocks replacing them are
+ * connected: putting their transactions back in the mempool, and evicting the mempool
+ * transactions whose anchors went away with them. Until then the mempool may hold
+ * transactions spending the outputs of the blocks disconnected, and is not checked.
+ */
+struct CDisconnectedBlocks
+{
+    //! The transactions of the blocks disconnected, those of the lowest block first
+    std::deque<CTransactionRef> vtx;
+    //! The anchors of the blocks disconnected, which the chain may not have any more
+    std::set<uint256> setAnchors;
+    //! The shielded transactions of the blocks disconnected that were connected without verifying their proofs
+    std::set<uint256> setProofsUnverified;
+    unsigned int nBlocks;
+
+    CDisconnectedBlocks() : nBlocks(0) {}
+};
+
+/**
+ * Put the transactions of the blocks disconnected back in the mempool, from the lowest
+ * block, unless the chain connected since has them, and remove what no longer fits the
+ * chain from the mempool.
+ */
+static void UpdateMempoolForReorg(CDisconnectedBlocks& disconnected)
+{
+    if (disconnected.nBlocks == 0)
+        return;
+    // Those of blocks connected without proof checks, by checkpoints or -assumevalid, or before
+    // startup, are verified anew, at once
+    std::vector<const CTransaction*> vUnverified;
+    BOOST_FOREACH(const CTransactionRef& ptx, disconnected.vtx) {
+        if (disconnected.setProofsUnverified.count(ptx->GetHash()) && !pcoinsTip->HaveCoins(ptx->GetHash()))
+            vUnverified.push_back(ptx.get());
+    }
+    PreVerifyJoinSplits(vUnverified);
+    BOOST_FOREACH(const CTransactionRef& ptx, disconnected.vtx) {
+        const CTransaction& tx = *ptx;
+        // Confirmed again by the new blocks, along with what spends it
+        if (pcoinsTip->HaveCoins(tx.GetHash()))
+            continue;
+        // Otherwise, the proofs and joinSplitSig were verified when the block was connected, which
+        // the cache may have forgotten since: remember them right before accepting it
+        if (!tx.vjoinsplit.empty() && !disconnected.setProofsUnverified.count(tx.GetHash()))
+            joinSplitValidationCache.Set(tx.GetHash());
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
         if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
-            mempool.remove(tx, removed, true);
+            mempool.remove(tx, removed, true, MemPoolRemovalReason::REORG);
     }
-    if (anchorBeforeDisconnect != anchorAfterDisconnect) {
-        // The anchor may not change between block disconnects,
-        // in which case we don't want to evict from the mempool yet!
-        mempool.removeWithAnchor(anchorBeforeDisconnect);
+    ZCIncrementalMerkleTree tree;
+    BOOST_FOREACH(const uint256& anchor, disconnected.setAnchors) {
+        if (!pcoinsTip->GetAnchorAt(anchor, tree))
+            mempool.removeWithAnchor(anchor);
     }
-    mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
+    mempool.removeCoinbaseSpends(pcoinsTip, chainActive.Height() + 1);
     mempool.check(pcoinsTip);
+    disconnected = CDisconnectedBlocks();
+}
+
+/**
+ * Disconnect the tip of chainActive, whose block and undo data are given, into view,
+ * which holds the blocks disconnected above it. The mempool updates are deferred to
+ * disconnected.
+ */
+static bool DisconnectTip(CValidationState &state, const CBlock& block, const CBlockUndo& blockundo,
+                          CCoinsViewCache& view, CDisconnectedBlocks& disconnected) {
+    CBlockIndex *pindexDelete = chainActive.Tip();
+    assert(pindexDelete);
+    // Apply the block atomically to the chain state.
+    uint256 anchorBeforeDisconnect = view.GetBestAnchor();
+    int64_t nStart = GetTimeMicros();
+    if (!DisconnectBlock(block, blockundo, state, pindexDelete, view))
+        return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+    LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+    uint256 anchorAfterDisconnect = view.GetBestAnchor();
+    // The anchor may not change between block disconnects, in which case the
+    // mempool transactions using it stay
+    if (anchorBeforeDisconnect != anchorAfterDisconnect)
+        disconnected.setAnchors.insert(anchorBeforeDisconnect);
+    disconnected.vtx.insert(disconnected.vtx.begin(), block.vtx.begin(), block.vtx.end());
+    if (!pindexDelete->fProofsVerified) {
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+            if (!ptx->vjoinsplit.empty())
+                disconnected.setProofsUnverified.insert(ptx->GetHash());
+        }
+    }
+    disconnected.nBlocks++;
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
     // Get the current commitment tree
-    ZCIncrementalMerkleTree newTree;
-    assert(pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), newTree));
+    std::shared_ptr<ZCIncrementalMerkleTree> newTree = std::make_shared<ZCIncrementalMerkleTree>();
+    assert(view.GetAnchorAt(view.GetBestAnchor(), *newTree));
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
         SyncWithWallets(tx, NULL);
     }
     // Update cached incremental witnesses
@@ -2765,6 +5181,86 @@ bool static DisconnectTip(CValidationState &state) {
     return true;
 }
 
+namespace {
+
+/** The block and undo data of a block to disconnect, read ahead */
+struct CDisconnectRead
+{
+    CBlock block;
+    CBlockUndo blockundo;
+    bool fBlockRead;
+    bool fUndoRead;
+
+    CDisconnectRead() : fBlockRead(false), fUndoRead(false) {}
+};
+
+/** Read the block and undo data of pindex, with positions taken under cs_main, without it */
+std::future<std::shared_ptr<CDisconnectRead> > ReadForDisconnect(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    const CDiskBlockPos posBlock = pindex->GetBlockPos();
+    const CDiskBlockPos posUndo = pindex->GetUndoPos();
+    const uint256 hashPrev = pindex->pprev->GetBlockHash();
+    return std::async(std::launch::async, [posBlock, posUndo, hashPrev]() {
+        std::shared_ptr<CDisconnectRead> pread = std::make_shared<CDisconnectRead>();
+        pread->fBlockRead = ReadBlockFromDisk(pread->block, posBlock);
+        pread->fUndoRead = !posUndo.IsNull() && UndoReadFromDisk(pread->blockundo, posUndo, hashPrev);
+        return pread;
+    });
+}
+
+} // anon namespace
+
+/**
+ * Disconnect the blocks of chainActive above pindexFork. They are disconnected into one
+ * coins view, flushed when it outgrows a quarter of the coins cache and at the end, and
+ * the block and undo data of each are read while the block above it is disconnected.
+ */
+static bool DisconnectTipsTo(CValidationState& state, const CBlockIndex* pindexFork, CDisconnectedBlocks& disconnected)
+{
+    AssertLockHeld(cs_main);
+    if (chainActive.Tip() == NULL || chainActive.Tip() == pindexFork)
+        return true;
+    mempool.check(pcoinsTip);
+
+    std::unique_ptr<CCoinsViewCache> pview(new CCoinsViewCache(pcoinsTip));
+    std::future<std::shared_ptr<CDisconnectRead> > next = ReadForDisconnect(chainActive.Tip());
+    bool fOk = true;
+    while (chainActive.Tip() != pindexFork) {
+        const CBlockIndex* pindexDelete = chainActive.Tip();
+        std::shared_ptr<CDisconnectRead> pread = next.get();
+        if (pindexDelete->pprev != pindexFork && pindexDelete->pprev->pprev != NULL)
+            next = ReadForDisconnect(pindexDelete->pprev);
+        if (!pread->fBlockRead || pread->block.GetHash() != pindexDelete->GetBlockHash()) {
+            fOk = AbortNode(state, "Failed to read block");
+            break;
+        }
+        if (!pread->fUndoRead) {
+            fOk = error("DisconnectTip(): failure reading undo data of %s", pindexDelete->GetBlockHash().ToString());
+            break;
+        }
+        if (!DisconnectTip(state, pread->block, pread->blockundo, *pview, disconnected)) {
+            fOk = false;
+            break;
+        }
+        if (pview->DynamicMemoryUsage() > nCoinCacheUsage / 4) {
+            assert(pview->Flush());
+            pview.reset(new CCoinsViewCache(pcoinsTip));
+            if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED)) {
+                fOk = false;
+                break;
+            }
+        }
+    }
+    // What was disconnected before a failure is kept, as chainActive no longer has it
+    assert(pview->Flush());
+    pview.reset();
+    // Write the chain state to disk, if necessary.
+    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
+        return false;
+    return fOk;
+}
+
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
@@ -2775,9 +5271,10 @@ static int64_t nTimePostConnect = 0;
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
  */
-bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *pblock) {
+bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *pblock, bool fCheckMempool = true) {
     assert(pindexNew->pprev == chainActive.Tip());
-    mempool.check(pcoinsTip);
+    if (fCheckMempool)
+        mempool.check(pcoinsTip);
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
@@ -2787,15 +5284,35 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
         pblock = &block;
     }
     // Get the current commitment tree
-    ZCIncrementalMerkleTree oldTree;
-    assert(pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), oldTree));
+    std::shared_ptr<ZCIncrementalMerkleTree> oldTree = std::make_shared<ZCIncrementalMerkleTree>();
+    assert(pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), *oldTree));
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    connectStageLatency[CONNECT_READ].add(nTime2 - nTime1);
+    // Warm the coins cache with all the inputs of the block with concurrent
+    // database reads, instead of fetching them one by one while connecting.
+    {
+        std::vector<uint256> vInputTxids;
+        BOOST_FOREACH(const CTransactionRef& ptx, pblock->vtx) {
+            const CTransaction& tx = *ptx;
+            if (tx.IsCoinBase())
+                continue;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                vInputTxids.push_back(txin.prevout.hash);
+        }
+        pcoinsTip->Prefetch(vInputTxids, nScriptCheckThreads ? &coinsfetchqueue : NULL);
+    }
+    int64_t nTimePrefetch = GetTimeMicros();
+    LogPrint("bench", "  - Prefetch inputs: %.2fms\n", (nTimePrefetch - nTime2) * 0.001);
+    connectStageLatency[CONNECT_PREFETCH].add(nTimePrefetch - nTime2);
+    BlockValidationStats stats;
     {
         CCoinsViewCache view(pcoinsTip);
+        pBlockStatsPending = &stats;
         bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainActive);
+        pBlockStatsPending = NULL;
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2809,34 +5326,55 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
+    connectStageLatency[CONNECT_FLUSH].add(nTime4 - nTime3);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    connectStageLatency[CONNECT_CHAINSTATE].add(nTime5 - nTime4);
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
-    mempool.check(pcoinsTip);
+    if (fCheckMempool)
+        mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    int64_t nTimeNotify = GetTimeMicros();
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
         SyncWithWallets(tx, NULL);
     }
     // ... and about transactions that got confirmed:
-    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
+    BOOST_FOREACH(const CTransactionRef& ptx, pblock->vtx) {
+        const CTransaction& tx = *ptx;
         SyncWithWallets(tx, pblock);
     }
     // Update cached incremental witnesses
     GetMainSignals().ChainTip(pindexNew, pblock, oldTree, true);
+    nTimeNotify = GetTimeMicros() - nTimeNotify;
 
     EnforceNodeDeprecation(pindexNew->nHeight);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    connectStageLatency[CONNECT_POSTPROCESS].add(nTime6 - nTime5);
+    connectBlockLatency.add(nTime6 - nTime1);
+
+    stats.hash = pindexNew->GetBlockHash();
+    stats.nHeight = pindexNew->nHeight;
+    stats.nTx = pblock->vtx.size();
+    stats.nTime = GetTime();
+    stats.nReadTime = nTime2 - nTime1;
+    stats.nCoinsFetchTime = nTimePrefetch - nTime2;
+    stats.nFlushTime = nTime4 - nTime3;
+    stats.nChainStateTime = nTime5 - nTime4;
+    stats.nNotifyTime = nTimeNotify;
+    stats.nPostProcessTime = nTime6 - nTime5;
+    stats.nTotalTime = nTime6 - nTime1;
+    PushBlockValidationStats(stats);
     return true;
 }
 
@@ -2880,11 +5418,13 @@ static CBlockIndex* FindMostWorkChain() {
                         LogPrint("forks", "%s():%d - marking FAILED candidate idx [%s]\n", __func__, __LINE__,
                             pindexFailed->GetBlockHash().ToString());
                         pindexFailed->nStatus |= BLOCK_FAILED_CHILD;
+                        SetBlockIndexToCheck(pindexFailed);
                     } else if (fMissingData) {
                         // If we're missing data, then add back to mapBlocksUnlinked,
                         // so that if the block arrives in the future we can try adding
                         // to setBlockIndexCandidates again.
                         mapBlocksUnlinked.insert(std::make_pair(pindexFailed->pprev, pindexFailed));
+                        SetBlockIndexToCheck(pindexFailed);
                     }
                     setBlockIndexCandidates.erase(pindexFailed);
                     pindexFailed = pindexFailed->pprev;
@@ -2922,10 +5462,12 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     const CBlockIndex *pindexOldTip = chainActive.Tip();
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
-    // Disconnect active blocks which are no longer in the best chain.
-    while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state))
-            return false;
+    // Disconnect active blocks which are no longer in the best chain, putting their
+    // transactions back in the mempool once the new blocks are connected.
+    CDisconnectedBlocks disconnected;
+    if (!DisconnectTipsTo(state, pindexFork, disconnected)) {
+        UpdateMempoolForReorg(disconnected);
+        return false;
     }
 
     // Build list of new blocks to connect.
@@ -2947,7 +5489,7 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
 
     // Connect new blocks.
     BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-        if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
+        if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL, disconnected.nBlocks == 0)) {
             if (state.IsInvalid()) {
                 // The block violates a consensus rule.
                 if (!state.CorruptionPossible())
@@ -2958,6 +5500,7 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
                 break;
             } else {
                 // A system error occurred (disk space, database error, ...).
+                UpdateMempoolForReorg(disconnected);
                 return false;
             }
         } else {
@@ -2970,6 +5513,7 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
         }
     }
     }
+    UpdateMempoolForReorg(disconnected);
 
     // Callbacks/notifications for a new best chain.
     if (fInvalidFound)
@@ -3001,6 +5545,13 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
             if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip())
                 return true;
 
+            // A pending chainstate snapshot replaces what would be connected, see LoadPendingSnapshot()
+            if (!pathSnapshotPending.empty()) {
+                if (chainActive.Tip() != NULL)
+                    return true;
+                pindexMostWork = pindexMostWork->GetAncestor(0);
+            }
+
             if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL))
                 return false;
 
@@ -3040,23 +5591,345 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
                     hashNewTip.ToString());
             }
 
-            // Notify external listeners about the new tip.
-            GetMainSignals().UpdatedBlockTip(pindexNewTip);
-            uiInterface.NotifyBlockTip(hashNewTip);
-        }
-        else
+            // Notify external listeners about the new tip.
+            GetMainSignals().UpdatedBlockTip(pindexNewTip);
+            uiInterface.NotifyBlockTip(hashNewTip);
+        }
+        else
+        {
+            LogPrint("forks", "%s():%d - InitialDownload in progress: NOT pushing any inv\n", __func__, __LINE__);
+        }
+
+    } while(pindexMostWork != chainActive.Tip());
+    CheckBlockIndex();
+
+    // Write changes periodically to disk, after relay.
+    if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC)) {
+        return false;
+    }
+
+    return true;
+}
+
+void SetSnapshotPending(const boost::filesystem::path &path, const uint256 &hashBlock)
+{
+    AssertLockHeld(cs_main);
+    pathSnapshotPending = path;
+    hashSnapshotPending = hashBlock;
+}
+
+bool IsSnapshotPending()
+{
+    AssertLockHeld(cs_main);
+    return !pathSnapshotPending.empty();
+}
+
+bool LoadPendingSnapshot()
+{
+    boost::filesystem::path path;
+    uint256 hashBlock;
+    {
+        LOCK(cs_main);
+        if (pathSnapshotPending.empty())
+            return true;
+        BlockMap::iterator mi = mapBlockIndex.find(hashSnapshotPending);
+        if (mi == mapBlockIndex.end())
+            return true;
+        if (mi->second->nStatus & BLOCK_FAILED_MASK)
+            return error("%s: the block %s of the chainstate snapshot is invalid", __func__, hashSnapshotPending.ToString());
+        path = pathSnapshotPending;
+        hashBlock = hashSnapshotPending;
+        LogPrintf("Loading chainstate snapshot %s of block %s (height %d)\n", path.string(), hashBlock.ToString(), mi->second->nHeight);
+    }
+
+    // Read and written without cs_main: nothing but the genesis block is connected meanwhile,
+    // and the records only become those of the best block below
+    CChainstateSnapshotInfo info;
+    if (!pcoinsdbview->LoadSnapshot(path, info))
+        return false;
+
+    LOCK(cs_main);
+    CBlockIndex *pindexSnapshot = mapBlockIndex[hashBlock];
+    // Have any flush of the genesis block, which writes its hash as the best block, done first
+    if (chainActive.Tip() != NULL) {
+        CValidationState state;
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+            return error("%s: failed to write the chainstate", __func__);
+    }
+    if (!pcoinsdbview->ActivateSnapshot(info))
+        return error("%s: failed to write the chainstate", __func__);
+    LogPrintf("Loaded chainstate snapshot %s of block %s (%u coins, %u anchors, %u nullifiers)\n",
+        info.hashSnapshot.ToString(), info.hashBlock.ToString(), info.nCoins, info.nAnchors, info.nNullifiers);
+    pathSnapshotPending.clear();
+    hashSnapshotPending.SetNull();
+    // Both may hold what was read from the records while they were written
+    pcoinsTip->ClearCache();
+    mempool.clear();
+
+    // The snapshot block stands in for its ancestors until they are downloaded, and links the blocks on top of it
+    hashSnapshotBase = pindexSnapshot->GetBlockHash();
+    pindexSnapshot->hashAnchorEnd = info.hashAnchor;
+    if (pindexSnapshot->nChainTx == 0) {
+        pindexSnapshot->nChainTx = pindexSnapshot->nHeight + 1;
+        deque<CBlockIndex*> queue;
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindexSnapshot);
+        while (range.first != range.second) {
+            queue.push_back(range.first->second);
+            mapBlocksUnlinked.erase(range.first++);
+        }
+        LinkBlocks(queue, NULL);
+    }
+    chainActive.SetTip(pindexSnapshot);
+    PublishChainTipView();
+    PruneBlockIndexCandidates();
+    return true;
+}
+
+namespace {
+
+/**
+ * Second chainstate behind a chainstate loaded from a snapshot. It connects
+ * the ancestors of the snapshot block, from genesis on, into a coins database
+ * of its own, and once it gets to the snapshot block checks that it holds
+ * exactly what the snapshot did.
+ */
+class CBackgroundChainstate
+{
+private:
+    CChainstateSnapshotInfo snapshot;
+    CBlockIndex *pindexSnapshot;
+    //! Blocks connected so far, protected by cs_main
+    CChain chain;
+    boost::scoped_ptr<CCoinsViewDB> pdbview;
+    boost::scoped_ptr<CCoinsViewCache> pcoins;
+
+    static boost::filesystem::path GetDBPath() { return GetDataDir() / "chainstate_snapshotcheck"; }
+
+    /** Connect the next blocks, at most SNAPSHOT_VALIDATION_BATCH_SIZE of them, under a single cs_main lock.
+     *  fWaiting is set if the next block has not been downloaded yet. */
+    bool ConnectBatch(bool &fWaiting);
+    bool Finish();
+
+public:
+    CBackgroundChainstate() : pindexSnapshot(NULL) {}
+
+    bool Init(const CChainstateSnapshotInfo &snapshotIn);
+    void Run();
+
+    CBlockIndex *SnapshotTip() const { return pindexSnapshot; }
+    const CBlockIndex *Tip() const { return chain.Tip(); }
+};
+
+boost::scoped_ptr<CBackgroundChainstate> pchainstateBackground;
+
+bool CBackgroundChainstate::Init(const CChainstateSnapshotInfo &snapshotIn)
+{
+    AssertLockHeld(cs_main);
+    snapshot = snapshotIn;
+    BlockMap::iterator mi = mapBlockIndex.find(snapshot.hashBlock);
+    if (mi == mapBlockIndex.end())
+        return error("%s: snapshot block %s is not in the block index", __func__, snapshot.hashBlock.ToString());
+    pindexSnapshot = mi->second;
+
+    pdbview.reset(new CCoinsViewDB("chainstate_snapshotcheck", nCoinCacheUsage / 8));
+    pcoins.reset(new CCoinsViewCache(pdbview.get()));
+
+    // Resume from where a previous run left off
+    uint256 hashBest = pcoins->GetBestBlock();
+    if (!hashBest.IsNull()) {
+        mi = mapBlockIndex.find(hashBest);
+        if (mi == mapBlockIndex.end() || pindexSnapshot->GetAncestor(mi->second->nHeight) != mi->second)
+            return error("%s: background chainstate is at %s, which is not an ancestor of the snapshot block", __func__, hashBest.ToString());
+        chain.SetTip(mi->second);
+    }
+    return true;
+}
+
+bool CBackgroundChainstate::ConnectBatch(bool &fWaiting)
+{
+    fWaiting = false;
+    std::vector<CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        for (int nHeight = chain.Height() + 1; nHeight <= pindexSnapshot->nHeight && vIndex.size() < SNAPSHOT_VALIDATION_BATCH_SIZE; nHeight++) {
+            CBlockIndex *pindex = pindexSnapshot->GetAncestor(nHeight);
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                break;
+            vIndex.push_back(pindex);
+        }
+    }
+    if (vIndex.empty()) {
+        // The next block is still to be downloaded, see FindNextSnapshotBlocksToDownload()
+        fWaiting = true;
+        return true;
+    }
+
+    // Reading and the context-free checks don't need cs_main
+    std::vector<CBlock> vBlocks(vIndex.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        if (!ReadBlockFromDisk(vBlocks[i], vIndex[i]))
+            return error("%s: failed to read block %s from disk", __func__, vIndex[i]->GetBlockHash().ToString());
+        CValidationState state;
+        // ConnectBlock in check mode leaves the merkle root to the caller; proofs are verified there
+        auto verifier = libzcash::ProofVerifier::Disabled();
+        if (!CheckBlock(vBlocks[i], state, verifier, true, true))
+            return AbortNode(strprintf("Background validation of the chainstate snapshot failed at block %s (%s)",
+                                       vIndex[i]->GetBlockHash().ToString(), state.GetRejectReason()),
+                             _("The block chain does not lead to the loaded chainstate snapshot. Please restart with -reindex."));
+    }
+
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            CValidationState state;
+            if (!ConnectBlock(vBlocks[i], state, vIndex[i], *pcoins, chain, true))
+                return AbortNode(strprintf("Background validation of the chainstate snapshot failed at block %s (%s)",
+                                           vIndex[i]->GetBlockHash().ToString(), state.GetRejectReason()),
+                                 _("The block chain does not lead to the loaded chainstate snapshot. Please restart with -reindex."));
+            pcoins->SetBestBlock(vIndex[i]->GetBlockHash());
+            chain.SetTip(vIndex[i]);
+        }
+    }
+
+    if (pcoins->DynamicMemoryUsage() > nCoinCacheUsage / 4 && !pcoins->Flush())
+        return AbortNode("Failed to write the background chainstate");
+    return true;
+}
+
+bool CBackgroundChainstate::Finish()
+{
+    if (!pcoins->Flush())
+        return AbortNode("Failed to write the background chainstate");
+
+    CChainstateSnapshotInfo info;
+    if (!pdbview->HashSnapshot(info))
+        return error("%s: failed to hash the background chainstate", __func__);
+    if (info.hashSnapshot != snapshot.hashSnapshot)
+        return AbortNode(strprintf("Chainstate snapshot %s does not match the validated chainstate %s at block %s",
+                                   snapshot.hashSnapshot.ToString(), info.hashSnapshot.ToString(), snapshot.hashBlock.ToString()),
+                         _("The loaded chainstate snapshot is invalid. Please restart with -reindex."));
+
+    LogPrintf("Chainstate snapshot %s validated up to block %s\n", snapshot.hashSnapshot.ToString(), snapshot.hashBlock.ToString());
+    {
+        LOCK(cs_main);
+        pcoinsdbview->EraseSnapshotBase();
+        hashSnapshotBase.SetNull();
+    }
+    pcoins.reset();
+    pdbview.reset();
+    boost::filesystem::remove_all(GetDBPath());
+    return true;
+}
+
+void CBackgroundChainstate::Run()
+{
+    LogPrintf("Validating chainstate snapshot %s of block %s in the background, from height %d\n",
+              snapshot.hashSnapshot.ToString(), snapshot.hashBlock.ToString(), chain.Height() + 1);
+    try {
+        bool fWasWaiting = false;
+        while (chain.Height() < pindexSnapshot->nHeight) {
+            boost::this_thread::interruption_point();
+            bool fWaiting;
+            if (!ConnectBatch(fWaiting)) {
+                LogPrintf("Background validation of the chainstate snapshot stopped at height %d\n", chain.Height());
+                return;
+            }
+            if (fWaiting) {
+                if (!fWasWaiting)
+                    LogPrintf("Background validation of the chainstate snapshot waits for block %d to be downloaded\n", chain.Height() + 1);
+                MilliSleep(1000);
+            }
+            fWasWaiting = fWaiting;
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Keep the progress made for the next start
+        pcoins->Flush();
+        throw;
+    }
+    Finish();
+}
+
+/** Add to vBlocks, until it has at most count entries, the ancestors of the snapshot block that the
+ *  background chainstate still needs, which are not in flight and which the peer has. They lie below
+ *  the active tip, so FindNextBlocksToDownload() never asks for them. */
+void FindNextSnapshotBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks)
+{
+    AssertLockHeld(cs_main);
+    if (vBlocks.size() >= count || !pchainstateBackground || !pchainstateBackground->SnapshotTip())
+        return;
+    CBlockIndex *pindexSnapshot = pchainstateBackground->SnapshotTip();
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+    if (state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->GetAncestor(pindexSnapshot->nHeight) != pindexSnapshot)
+        return;
+
+    // Within the download window ahead of the background chainstate, in order
+    int nStart = (pchainstateBackground->Tip() ? pchainstateBackground->Tip()->nHeight : -1) + 1;
+    int nEnd = std::min<int>(pindexSnapshot->nHeight, nStart + BLOCK_DOWNLOAD_WINDOW - 1);
+    if (nStart > nEnd)
+        return;
+    std::vector<CBlockIndex*> vToFetch(nEnd - nStart + 1);
+    vToFetch.back() = pindexSnapshot->GetAncestor(nEnd);
+    for (size_t i = vToFetch.size() - 1; i > 0; i--)
+        vToFetch[i - 1] = vToFetch[i]->pprev;
+    BOOST_FOREACH(CBlockIndex* pindex, vToFetch) {
+        if (pindex->nStatus & BLOCK_HAVE_DATA || mapBlocksInFlight.count(pindex->GetBlockHash()))
+            continue;
+        vBlocks.push_back(pindex);
+        if (vBlocks.size() >= count)
+            return;
+    }
+}
+
+}
+
+void ThreadSnapshotValidation()
+{
+    RenameThread("horizen-snapcheck");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+    // A snapshot waiting for the header of its block is loaded once headers sync has brought it in
+    while (true) {
         {
-            LogPrint("forks", "%s():%d - InitialDownload in progress: NOT pushing any inv\n", __func__, __LINE__);
+            LOCK(cs_main);
+            if (!IsSnapshotPending())
+                break;
+        }
+        if (!LoadPendingSnapshot()) {
+            AbortNode("Failed to load the chainstate snapshot", _("Error loading chainstate snapshot"));
+            return;
         }
+        MilliSleep(1000);
+    }
 
-    } while(pindexMostWork != chainActive.Tip());
-    CheckBlockIndex();
+    CChainstateSnapshotInfo snapshot;
+    if (!pcoinsdbview->ReadSnapshotBase(snapshot))
+        return;
 
-    // Write changes periodically to disk, after relay.
-    if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC)) {
-        return false;
+    {
+        LOCK(cs_main);
+        pchainstateBackground.reset(new CBackgroundChainstate());
+        if (!pchainstateBackground->Init(snapshot)) {
+            LogPrintf("Background validation of the chainstate snapshot could not be started\n");
+            return;
+        }
     }
+    try {
+        pchainstateBackground->Run();
+    } catch (const boost::thread_interrupted&) {
+        LOCK(cs_main);
+        pchainstateBackground.reset();
+        throw;
+    }
+}
 
+bool GetSnapshotValidationProgress(int &nSnapshotHeight, int &nValidatedHeight)
+{
+    AssertLockHeld(cs_main);
+    if (!pchainstateBackground || !pchainstateBackground->SnapshotTip())
+        return false;
+    nSnapshotHeight = pchainstateBackground->SnapshotTip()->nHeight;
+    nValidatedHeight = pchainstateBackground->Tip() ? pchainstateBackground->Tip()->nHeight : -1;
     return true;
 }
 
@@ -3065,19 +5938,22 @@ bool InvalidateBlock(CValidationState& state, CBlockIndex *pindex) {
 
     // Mark the block itself as invalid.
     pindex->nStatus |= BLOCK_FAILED_VALID;
-    setDirtyBlockIndex.insert(pindex);
+    SetBlockIndexDirty(pindex);
     setBlockIndexCandidates.erase(pindex);
 
-    while (chainActive.Contains(pindex)) {
-        CBlockIndex *pindexWalk = chainActive.Tip();
-        pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
-        setDirtyBlockIndex.insert(pindexWalk);
-        setBlockIndexCandidates.erase(pindexWalk);
+    if (chainActive.Contains(pindex)) {
+        for (CBlockIndex *pindexWalk = chainActive.Tip(); pindexWalk != pindex->pprev; pindexWalk = pindexWalk->pprev) {
+            pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
+            SetBlockIndexDirty(pindexWalk);
+            setBlockIndexCandidates.erase(pindexWalk);
+        }
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(state)) {
+        CDisconnectedBlocks disconnected;
+        const bool fDisconnected = DisconnectTipsTo(state, pindex->pprev, disconnected);
+        UpdateMempoolForReorg(disconnected);
+        if (!fDisconnected)
             return false;
-        }
     }
 
     // The resulting new best tip may not be in setBlockIndexCandidates anymore, so
@@ -3104,7 +5980,7 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     while (it != mapBlockIndex.end()) {
         if (!it->second->IsValid() && it->second->GetAncestor(nHeight) == pindex) {
             it->second->nStatus &= ~BLOCK_FAILED_MASK;
-            setDirtyBlockIndex.insert(it->second);
+            SetBlockIndexDirty(it->second);
             if (it->second->IsValid(BLOCK_VALID_TRANSACTIONS) && it->second->nChainTx && setBlockIndexCandidates.value_comp()(chainActive.Tip(), it->second)) {
                 setBlockIndexCandidates.insert(it->second);
             }
@@ -3120,7 +5996,7 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     while (pindex != NULL) {
         if (pindex->nStatus & BLOCK_FAILED_MASK) {
             pindex->nStatus &= ~BLOCK_FAILED_MASK;
-            setDirtyBlockIndex.insert(pindex);
+            SetBlockIndexDirty(pindex);
         }
         pindex = pindex->pprev;
     }
@@ -3145,7 +6021,10 @@ bool addToGlobalForkTips(const CBlockIndex* pindex)
             __func__, __LINE__, pindex->nHeight, pindex->GetBlockHash().ToString());
     }
 
-    return mGlobalForkTips.insert(std::make_pair( pindex, (int)GetTime() )).second;
+    bool inserted = mGlobalForkTips.insert(std::make_pair( pindex, (int)GetTime() )).second;
+    if (erased || inserted)
+        nGlobalTipsVersion++;
+    return inserted;
 }
 
 bool updateGlobalForkTips(const CBlockIndex* pindex, bool lookForwardTips)
@@ -3185,6 +6064,13 @@ bool updateGlobalForkTips(const CBlockIndex* pindex, bool lookForwardTips)
                 if (!tipIndex)
                     continue;
 
+                // tips are sorted by decreasing height, none of the remaining ones can descend from pindex
+                if (tipIndex->nHeight < h)
+                {
+                    LogPrint("forks", "%s():%d - no more tips above h(%d)\n", __func__, __LINE__, h);
+                    break;
+                }
+
                 LogPrint("forks", "%s():%d - tip %s h(%d)\n",
                     __func__, __LINE__, tipIndex->GetBlockHash().ToString(), tipIndex->nHeight);
 
@@ -3194,11 +6080,8 @@ bool updateGlobalForkTips(const CBlockIndex* pindex, bool lookForwardTips)
                     continue;
                 }
  
-                const CBlockIndex* dum = tipIndex;
-                while ( dum != pindex && dum->nHeight >= h)
-                {
-                    dum = dum->pprev;
-                }
+                // use the skip list rather than walking back block by block
+                const CBlockIndex* dum = tipIndex->GetAncestor(h);
 
                 if (dum == pindex)
                 {
@@ -3232,14 +6115,13 @@ int getMostRecentGlobalForkTips(std::vector<uint256>& output)
 
     std::vector<map_pair> vTemp(begin(mGlobalForkTips), end(mGlobalForkTips));
 
-    sort(begin(vTemp), end(vTemp), [](const map_pair& a, const map_pair& b) { return a.second < b.second; });
+    // only the most recent ones are needed, no need for sorting all of them
+    size_t count = std::min(vTemp.size(), (size_t)MAX_NUM_GLOBAL_FORKS);
+    partial_sort(begin(vTemp), begin(vTemp) + count, end(vTemp), [](const map_pair& a, const map_pair& b) { return a.second > b.second; });
 
-    int count = MAX_NUM_GLOBAL_FORKS;
-    BOOST_REVERSE_FOREACH(auto const &p, vTemp)
+    for (size_t i = 0; i < count; i++)
     {
-        output.push_back(p.first->GetBlockHash() );
-        if (--count <= 0)
-            break;
+        output.push_back(vTemp[i].first->GetBlockHash() );
     }
 
     return output.size();
@@ -3254,8 +6136,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.New();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3282,21 +6164,71 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     if (pindexBestHeader == NULL || (pindexBestHeader->nChainWork < pindexNew->nChainWork && pindexNew->nChainDelay==0))
         pindexBestHeader = pindexNew;
 
-    setDirtyBlockIndex.insert(pindexNew);
+    SetBlockIndexDirty(pindexNew);
 
     addToGlobalForkTips(pindexNew);
 
     return pindexNew;
 }
 
+/** Set nChainTx, and make them candidates for the tip, for the blocks in queue and their descendants
+ *  waiting in mapBlocksUnlinked: all their ancestors have had their transactions. */
+static void LinkBlocks(deque<CBlockIndex*> queue, BlockSet* sForkTips)
+{
+    // Recursively process any descendant blocks that now may be eligible to be connected.
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        if (pindex->pprev) {
+            if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
+                pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
+            } else {
+                pindex->nChainSproutValue = boost::none;
+            }
+        } else {
+            pindex->nChainSproutValue = pindex->nSproutValue;
+        }
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        if (chainActive.Tip() == NULL || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
+            setBlockIndexCandidates.insert(pindex);
+        }
+        // we must not take 'delay' into account, otherwise when we do the relay of a block we might miss a higher tip
+        // on a fork because we will look into this container
+        if (chainActive.Tip() == NULL || !CBlockIndexRealWorkComparator()(pindex, chainActive.Tip()))
+        {
+            if (sForkTips)
+            {
+                int num = sForkTips->erase(pindex->pprev);
+                LogPrint("forks", "%s():%d - Adding idx to sForkTips: h(%d) [%s], nChainTx=%d, delay=%d, prev[%d]\n",
+                    __func__, __LINE__, pindex->nHeight, pindex->GetBlockHash().ToString(),
+                    pindex->nChainTx, pindex->nChainDelay, num);
+                sForkTips->insert(pindex);
+            }
+        }
+
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+            queue.push_back(it->second);
+            range.first++;
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+}
+
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos, BlockSet* sForkTips)
 {
     pindexNew->nTx = block.vtx.size();
-    pindexNew->nChainTx = 0;
+    if (pindexNew->GetBlockHash() != hashSnapshotBase)
+        pindexNew->nChainTx = 0;
     CAmount sproutValue = 0;
-    for (auto tx : block.vtx) {
-        for (auto js : tx.vjoinsplit) {
+    for (const CTransactionRef& ptx : block.vtx) {
+        for (auto js : ptx->vjoinsplit) {
             sproutValue += js.vpub_old;
             sproutValue -= js.vpub_new;
         }
@@ -3308,56 +6240,13 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     pindexNew->nUndoPos = 0;
     pindexNew->nStatus |= BLOCK_HAVE_DATA;
     pindexNew->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
-    setDirtyBlockIndex.insert(pindexNew);
+    SetBlockIndexDirty(pindexNew);
 
     if (pindexNew->pprev == NULL || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are BLOCK_VALID_TRANSACTIONS.
         deque<CBlockIndex*> queue;
         queue.push_back(pindexNew);
-
-        // Recursively process any descendant blocks that now may be eligible to be connected.
-        while (!queue.empty()) {
-            CBlockIndex *pindex = queue.front();
-            queue.pop_front();
-            pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
-            if (pindex->pprev) {
-                if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
-                    pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
-                } else {
-                    pindex->nChainSproutValue = boost::none;
-                }
-            } else {
-                pindex->nChainSproutValue = pindex->nSproutValue;
-            }
-            {
-                LOCK(cs_nBlockSequenceId);
-                pindex->nSequenceId = nBlockSequenceId++;
-            }
-            if (chainActive.Tip() == NULL || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
-                setBlockIndexCandidates.insert(pindex);
-            }
-            // we must not take 'delay' into account, otherwise when we do the relay of a block we might miss a higher tip
-            // on a fork because we will look into this container
-            if (chainActive.Tip() == NULL || !CBlockIndexRealWorkComparator()(pindex, chainActive.Tip()))
-            {
-                if (sForkTips)
-                {
-                    int num = sForkTips->erase(pindex->pprev);
-                    LogPrint("forks", "%s():%d - Adding idx to sForkTips: h(%d) [%s], nChainTx=%d, delay=%d, prev[%d]\n",
-                        __func__, __LINE__, pindex->nHeight, pindex->GetBlockHash().ToString(),
-                        pindex->nChainTx, pindex->nChainDelay, num);
-                    sForkTips->insert(pindex);
-                }
-            }
-
-            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
-            while (range.first != range.second) {
-                std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
-                queue.push_back(it->second);
-                range.first++;
-                mapBlocksUnlinked.erase(it);
-            }
-        }
+        LinkBlocks(queue, sForkTips);
     } else {
         if (pindexNew->pprev && pindexNew->pprev->IsValid(BLOCK_VALID_TREE)) {
             mapBlocksUnlinked.insert(std::make_pair(pindexNew->pprev, pindexNew));
@@ -3489,7 +6378,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+        uint256 hashMerkleRoot2 = block.ComputeMerkleRoot(&mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, error("CheckBlock(): hashMerkleRoot mismatch"),
                              REJECT_INVALID, "bad-txnmrklroot", true);
@@ -3512,22 +6401,23 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
                          REJECT_INVALID, "bad-blk-length");
 
     // First transaction must be coinbase, the rest must not be
-    if (block.vtx.empty() || !block.vtx[0].IsCoinBase())
+    if (block.vtx.empty() || !block.vtx[0]->IsCoinBase())
         return state.DoS(100, error("CheckBlock(): first tx is not coinbase"),
                          REJECT_INVALID, "bad-cb-missing");
     for (unsigned int i = 1; i < block.vtx.size(); i++)
-        if (block.vtx[i].IsCoinBase())
+        if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, error("CheckBlock(): more than one coinbase"),
                              REJECT_INVALID, "bad-cb-multiple");
 
     // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state, verifier))
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
+        if (!CheckTransaction(*ptx, state, verifier))
             return error("CheckBlock(): CheckTransaction failed");
 
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
     {
+        const CTransaction& tx = *ptx;
         nSigOps += GetLegacySigOpCount(tx);
     }
     if (nSigOps > MAX_BLOCK_SIGOPS)
@@ -3602,7 +6492,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
     // Check that all transactions are finalized
-    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
 
         // Check transaction contextually against consensus rules at block height
         if (!ContextualCheckTransaction(tx, state, nHeight, 100)) {
@@ -3625,10 +6516,10 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     if (nHeight > 0)
     {
         CScript expect = CScript() << nHeight;
-        if (block.vtx[0].vin[0].scriptSig.size() < expect.size() ||
-            !std::equal(expect.begin(), expect.end(), block.vtx[0].vin[0].scriptSig.begin())) {
+        if (block.vtx[0]->vin[0].scriptSig.size() < expect.size() ||
+            !std::equal(expect.begin(), expect.end(), block.vtx[0]->vin[0].scriptSig.begin())) {
             LogPrintf("%s():%d - ERROR: unexpected height in coinbase Script[%s] (exp is %s)\n",
-                __func__, __LINE__, block.vtx[0].vin[0].scriptSig.ToString(), expect.ToString());
+                __func__, __LINE__, block.vtx[0]->vin[0].scriptSig.ToString(), expect.ToString());
             return state.DoS(100, error("%s: block height mismatch in coinbase", __func__), REJECT_INVALID, "bad-cb-height");
         }
     }
@@ -3639,36 +6530,29 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
         return state.DoS(10, error("%s: post-chainsplit block received prior to scheduled time", __func__), REJECT_INVALID, "bad-cs-time");
     }
 
-    CAmount reward = GetBlockSubsidy(nHeight, consensusParams);
     // Coinbase transaction must include an output sending x.x% of
     // the block reward to a community fund script
-
-    for (Fork::CommunityFundType cfType=Fork::CommunityFundType::FOUNDATION; cfType < Fork::CommunityFundType::ENDTYPE; cfType = Fork::CommunityFundType(cfType + 1)) {
-        CAmount communityReward = ForkManager::getInstance().getCommunityFundReward(nHeight, reward, cfType);
-        if (communityReward > 0) {
-            const CScript& refScript = Params().GetCommunityFundScriptAtHeight(nHeight, cfType);
-
-            bool found = false;
-            for(const CTxOut& output: block.vtx[0].vout)
-            {
-                if ((output.scriptPubKey == refScript) && (output.nValue == communityReward)) {
-                        found = true;
-                        break;
-                }
+    for (const CTxOut& communityOut : GetCommunityFundOutputs(nHeight, Params())) {
+        bool found = false;
+        for(const CTxOut& output: block.vtx[0]->vout)
+        {
+            if ((output.scriptPubKey == communityOut.scriptPubKey) && (output.nValue == communityOut.nValue)) {
+                    found = true;
+                    break;
             }
+        }
 
-            if (!found) {
-                LogPrintf("%s():%d - ERROR: subsidy quota incorrect or missing: refScript[%s], commReward=%d, type=%d\n",
-                    __func__, __LINE__, refScript.ToString(), communityReward, cfType);
-                return state.DoS(100, error("%s: community fund missing block %d", __func__, nHeight), REJECT_INVALID, "cb-no-community-fund");
-            }
+        if (!found) {
+            LogPrintf("%s():%d - ERROR: subsidy quota incorrect or missing: refScript[%s], commReward=%d\n",
+                __func__, __LINE__, communityOut.scriptPubKey.ToString(), communityOut.nValue);
+            return state.DoS(100, error("%s: community fund missing block %d", __func__, nHeight), REJECT_INVALID, "cb-no-community-fund");
         }
     }
 
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool lookForwardTips)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool lookForwardTips, bool fCheckPOW)
 {
     dump_global_tips(10);
 
@@ -3692,7 +6576,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
     // Get prev block index
@@ -3758,7 +6642,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
     if ((!CheckBlock(block, state, verifier)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
-            setDirtyBlockIndex.insert(pindex);
+            SetBlockIndexDirty(pindex);
         }
         return false;
     }
@@ -3767,14 +6651,23 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
         CDiskBlockPos blockPos;
-        if (dbp != NULL)
+        std::unique_ptr<CDiskRecord> precord;
+        unsigned int nRecordSize = 0;
+        if (dbp != NULL) {
             blockPos = *dbp;
-        if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
+            // The record may have been stored compressed
+            nRecordSize = ReadBlockRecordSize(*dbp);
+            if (nRecordSize == 0)
+                nRecordSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        } else {
+            precord.reset(new CDiskRecord(block, fBlockCompression));
+            nRecordSize = precord->size();
+        }
+        if (!FindBlockPos(state, blockPos, nRecordSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock(): FindBlockPos failed");
         if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(*precord, blockPos, chainparams.MessageStart()))
                 AbortNode(state, "Failed to write block");
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos, sForkTips))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
@@ -3800,17 +6693,17 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
     return (nFound >= nRequired);
 }
 
-bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, bool fForceProcessing, CDiskBlockPos *dbp)
+/**
+ * Second half of ProcessNewBlock: store a block whose context-free checks have
+ * already been run (with outcome "checked") and connect it if it extends the best chain.
+ */
+static bool ProcessCheckedBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, bool fForceProcessing, CDiskBlockPos *dbp, bool checked)
 {
-    // Preliminary checks
-    auto verifier = libzcash::ProofVerifier::Disabled();
-    bool checked = CheckBlock(*pblock, state, verifier);
-
     BlockSet sForkTips;
 
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1);
         fRequested |= fForceProcessing;
         if (!checked) {
             return error("%s: CheckBlock FAILED", __func__);
@@ -3836,6 +6729,137 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, bool
     return true;
 }
 
+bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, bool fForceProcessing, CDiskBlockPos *dbp)
+{
+    // Preliminary checks
+    auto verifier = libzcash::ProofVerifier::Disabled();
+    bool checked = CheckBlock(*pblock, state, verifier);
+
+    return ProcessCheckedBlock(state, pfrom, pblock, fForceProcessing, dbp, checked);
+}
+
+/** Send a reject message for, and punish, a peer that sent us an invalid block */
+static void RejectBlock(CNode* pfrom, const CValidationState& state, const uint256& hash)
+{
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        LogPrint("forks", "%s():%d - Pushing reject, DoS[%d]\n", __func__, __LINE__, nDoS);
+        pfrom->PushMessage("reject", std::string("block"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
+namespace {
+
+/**
+ * Pipeline used with -blockcheckthreads: the message handler only deserializes
+ * received blocks, their context-free checks (CheckBlock, including Equihash
+ * and merkle root) run ahead of time on a pool of threads, and a single thread
+ * then stores and connects them under cs_main, in the order they were received.
+ */
+class CBlockPipeline
+{
+private:
+    struct Job {
+        CBlock block;
+        CNode* pfrom;
+        bool fForceProcessing;
+        CValidationState state;
+        bool fChecked;
+        bool fDone;
+
+        Job(CNode* pfromIn, bool fForceProcessingIn) :
+            pfrom(pfromIn), fForceProcessing(fForceProcessingIn), fChecked(false), fDone(false) {}
+    };
+
+    boost::mutex mutex;
+    //! Signalled when a job is queued for checking
+    boost::condition_variable condCheck;
+    //! Signalled when a job has been checked
+    boost::condition_variable condConnect;
+    //! Signalled when a job leaves the pipeline
+    boost::condition_variable condSpace;
+
+    //! All jobs in the pipeline, in the order they were received
+    std::deque<std::shared_ptr<Job> > queue;
+    //! Jobs not picked up by a check thread yet
+    std::deque<std::shared_ptr<Job> > queueUnchecked;
+
+public:
+    //! Queue a block; blocks the caller while the pipeline is full
+    void Push(CNode* pfrom, CBlock& block, bool fForceProcessing)
+    {
+        std::shared_ptr<Job> job = std::make_shared<Job>(pfrom->AddRef(), fForceProcessing);
+        job->block = std::move(block);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.size() >= MAX_BLOCKS_IN_PIPELINE)
+            condSpace.wait(lock);
+        queue.push_back(job);
+        queueUnchecked.push_back(job);
+        condCheck.notify_one();
+    }
+
+    void CheckThread()
+    {
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queueUnchecked.empty())
+                    condCheck.wait(lock);
+                job = queueUnchecked.front();
+                queueUnchecked.pop_front();
+            }
+
+            auto verifier = libzcash::ProofVerifier::Disabled();
+            bool fChecked = CheckBlock(job->block, job->state, verifier);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            job->fChecked = fChecked;
+            job->fDone = true;
+            if (job == queue.front())
+                condConnect.notify_one();
+        }
+    }
+
+    void ConnectThread()
+    {
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queue.empty() || !queue.front()->fDone)
+                    condConnect.wait(lock);
+                job = queue.front();
+                queue.pop_front();
+                condSpace.notify_one();
+            }
+
+            const uint256 hash = job->block.GetHash();
+            ProcessCheckedBlock(job->state, job->pfrom, &job->block, job->fForceProcessing, NULL, job->fChecked);
+            RejectBlock(job->pfrom, job->state, hash);
+            job->pfrom->Release();
+        }
+    }
+};
+
+CBlockPipeline blockPipeline;
+
+} // anon namespace
+
+void ThreadBlockPreCheck() {
+    RenameThread("horizen-blkcheck");
+    blockPipeline.CheckThread();
+}
+
+void ThreadBlockConnect() {
+    RenameThread("horizen-blkconn");
+    blockPipeline.ConnectThread();
+}
+
 bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex * const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -3887,7 +6911,7 @@ void PruneOneBlockFile(const int fileNumber)
             pindex->nFile = 0;
             pindex->nDataPos = 0;
             pindex->nUndoPos = 0;
-            setDirtyBlockIndex.insert(pindex);
+            SetBlockIndexDirty(pindex);
 
             // Prune from mapBlocksUnlinked -- any block we prune would have
             // to be downloaded again in order to consider its chain, at which
@@ -3903,34 +6927,349 @@ void PruneOneBlockFile(const int fileNumber)
             }
         }
     }
-
-    vinfoBlockFile[fileNumber].SetNull();
-    setDirtyFileInfo.insert(fileNumber);
+
+    vinfoBlockFile[fileNumber].SetNull();
+    setDirtyFileInfo.insert(fileNumber);
+}
+
+
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
+{
+    for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+        CDiskBlockPos pos(*it, 0);
+        ForgetMappedBlockFile(*it);
+        CIOOperation op(IO_PRUNE);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    }
+}
+
+namespace {
+
+/** Path of the rewritten copy of a block or undo file, until it replaces the file */
+boost::filesystem::path GetRewrittenBlockFilename(int nFile, const char *prefix)
+{
+    return GetBlockPosFilename(CDiskBlockPos(nFile, 0), prefix).string() + ".new";
+}
+
+/** Read the serialization stored in the record of a block or undo file opened at its size field */
+void ReadRawDiskRecord(CAutoFile& filein, std::vector<char>& vRaw)
+{
+    unsigned int nSizeField;
+    filein >> nSizeField;
+    const unsigned int nSize = nSizeField & ~DISK_RECORD_COMPRESSED;
+    if (nSize > MAX_BLOCKFILE_SIZE)
+        throw std::ios_base::failure("ReadRawDiskRecord(): record size too large");
+    std::vector<char> vRecord(nSize);
+    filein.read(vRecord.data(), vRecord.size());
+    if (!(nSizeField & DISK_RECORD_COMPRESSED))
+        vRaw.swap(vRecord);
+    else if (!DecompressDiskRecord(vRecord.data(), vRecord.size(), vRaw))
+        throw std::ios_base::failure("ReadRawDiskRecord(): corrupt compressed record");
+}
+
+/** Where the block and undo data of an entry of the block index are stored */
+struct CStoredBlock
+{
+    CBlockIndex* pindex;
+    unsigned int nDataPos;
+    unsigned int nUndoPos;
+
+    bool operator==(const CStoredBlock& other) const
+    {
+        return pindex == other.pindex && nDataPos == other.nDataPos && nUndoPos == other.nUndoPos;
+    }
+    bool operator<(const CStoredBlock& other) const { return nDataPos < other.nDataPos; }
+};
+
+std::vector<CStoredBlock> GetStoredBlocks(int nFile)
+{
+    AssertLockHeld(cs_main);
+    std::vector<CStoredBlock> vStored;
+    for (BlockMap::const_iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile == nFile && (pindex->nStatus & BLOCK_HAVE_DATA)) {
+            CStoredBlock stored = {pindex, pindex->nDataPos, (pindex->nStatus & BLOCK_HAVE_UNDO) ? pindex->nUndoPos : 0};
+            vStored.push_back(stored);
+        }
+    }
+    std::sort(vStored.begin(), vStored.end());
+    return vStored;
+}
+
+/**
+ * Rewrite block file nFile and its undo file with the records compressed. The copies are
+ * written aside, then, under cs_main, the new positions are stored and the copies renamed
+ * over the files; CompleteBlockFileRewrite finishes the renaming after a crash.
+ * @return false if the file has to be tried again later
+ */
+bool CompressBlockFile(int nFile)
+{
+    const CChainParams& chainparams = Params();
+    std::vector<CStoredBlock> vStored;
+    CBlockFileInfo info;
+    uint64_t nIndexWrites = 0;
+    bool fIndexPending = false;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        // Only files which are not written to any more
+        if (nFile >= nLastBlockFile)
+            return false;
+        info = vinfoBlockFile[nFile];
+        vStored = GetStoredBlocks(nFile);
+        if (ptxindexer != NULL) {
+            nIndexWrites = ptxindexer->GetFileWrites(nFile, fIndexPending);
+            if (fIndexPending)
+                return false;
+        }
+        if (pundowriter != NULL && pundowriter->IsFilePending(nFile))
+            return false;
+    }
+
+    const boost::filesystem::path pathBlocks = GetRewrittenBlockFilename(nFile, "blk");
+    const boost::filesystem::path pathUndo = GetRewrittenBlockFilename(nFile, "rev");
+    std::vector<unsigned int> vNewDataPos(vStored.size()), vNewUndoPos(vStored.size());
+    std::vector<std::pair<uint256, CDiskTxPos> > vTxPos;
+    unsigned int nNewSize = 0, nNewUndoSize = 0;
+    try {
+        CAutoFile fileBlocks(vStored.empty() ? NULL : fopen(pathBlocks.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        CAutoFile fileUndo(vStored.empty() ? NULL : fopen(pathUndo.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (!vStored.empty() && (fileBlocks.IsNull() || fileUndo.IsNull()))
+            return error("%s: failed to create the copies of blk%05u.dat", __func__, nFile);
+
+        std::vector<char> vRaw;
+        for (size_t i = 0; i < vStored.size(); i++) {
+            boost::this_thread::interruption_point();
+
+            const CStoredBlock& stored = vStored[i];
+            CAutoFile filein(OpenBlockFile(CDiskBlockPos(nFile, stored.nDataPos - 4), true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                throw std::ios_base::failure("cannot open the block file");
+            ReadRawDiskRecord(filein, vRaw);
+            CIOOperation op(IO_REWRITE, 8 + vRaw.size());
+            CDiskRecord record(vRaw.data(), vRaw.data() + vRaw.size(), true);
+            fileBlocks << FLATDATA(chainparams.MessageStart()) << record.nSizeField;
+            fileBlocks.write(record.vData.data(), record.size());
+            vNewDataPos[i] = nNewSize + 8;
+            nNewSize += 8 + record.size();
+
+            if (fTxIndex) {
+                // The offsets of the transactions are into the serialization, which does not change.
+                // Only the entries pointing to this copy of a transaction move with it.
+                CBlock block;
+                CMemoryReader reader(vRaw.data(), vRaw.data() + vRaw.size(), SER_DISK, CLIENT_VERSION);
+                reader >> block;
+                CDiskTxPos pos(CDiskBlockPos(nFile, vNewDataPos[i]), GetSizeOfCompactSize(block.vtx.size()));
+                BOOST_FOREACH(const CTransactionRef& ptx, block.vtx) {
+                    const CTransaction& tx = *ptx;
+                    CDiskTxPos posIndex;
+                    if (FindTxIndexPos(tx.GetHash(), posIndex) && posIndex.nFile == nFile && posIndex.nPos == stored.nDataPos)
+                        vTxPos.push_back(std::make_pair(tx.GetHash(), pos));
+                    pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+                }
+            }
+        }
+
+        // The undo records go in the order they were, which is the order the blocks were connected in
+        std::vector<size_t> vUndo;
+        for (size_t i = 0; i < vStored.size(); i++)
+            if (vStored[i].nUndoPos != 0)
+                vUndo.push_back(i);
+        std::sort(vUndo.begin(), vUndo.end(), [&vStored](size_t a, size_t b) { return vStored[a].nUndoPos < vStored[b].nUndoPos; });
+        BOOST_FOREACH(size_t i, vUndo) {
+            boost::this_thread::interruption_point();
+
+            CAutoFile filein(OpenUndoFile(CDiskBlockPos(nFile, vStored[i].nUndoPos - 4), true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                throw std::ios_base::failure("cannot open the undo file");
+            ReadRawDiskRecord(filein, vRaw);
+            uint256 hashChecksum;
+            filein >> hashChecksum;
+            CIOOperation op(IO_REWRITE, 8 + vRaw.size() + 32);
+            CDiskRecord record(vRaw.data(), vRaw.data() + vRaw.size(), true);
+            fileUndo << FLATDATA(chainparams.MessageStart()) << record.nSizeField;
+            fileUndo.write(record.vData.data(), record.size());
+            fileUndo << hashChecksum;
+            vNewUndoPos[i] = nNewUndoSize + 8;
+            nNewUndoSize += 8 + record.size() + 32;
+        }
+
+        if (!vStored.empty()) {
+            CIOOperation op(IO_REWRITE);
+            FileCommit(fileBlocks.Get());
+            FileCommit(fileUndo.Get());
+        }
+    } catch (const std::exception& e) {
+        boost::filesystem::remove(pathBlocks);
+        boost::filesystem::remove(pathUndo);
+        return error("%s: Deserialize or I/O error - %s in blk%05u.dat", __func__, e.what(), nFile);
+    }
+
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        // Give up if blocks or undo data were added, the file was pruned, or transactions in it were
+        // indexed, in the meantime
+        uint64_t nIndexWritesNow = 0;
+        if (ptxindexer != NULL)
+            nIndexWritesNow = ptxindexer->GetFileWrites(nFile, fIndexPending);
+        if (vinfoBlockFile[nFile].nSize != info.nSize || vinfoBlockFile[nFile].nUndoSize != info.nUndoSize ||
+            GetStoredBlocks(nFile) != vStored || fIndexPending || nIndexWritesNow != nIndexWrites ||
+            (paddressindexer != NULL && paddressindexer->IsReading(nFile)) ||
+            (pnotescanner != NULL && pnotescanner->IsReading(nFile)) ||
+            (pblockfilterindexer != NULL && pblockfilterindexer->IsReading(nFile))) {
+            boost::filesystem::remove(pathBlocks);
+            boost::filesystem::remove(pathUndo);
+            return false;
+        }
+
+        std::vector<const CBlockIndex*> vBlocks;
+        for (size_t i = 0; i < vStored.size(); i++) {
+            vStored[i].pindex->nDataPos = vNewDataPos[i];
+            if (vStored[i].nUndoPos != 0)
+                vStored[i].pindex->nUndoPos = vNewUndoPos[i];
+            vBlocks.push_back(vStored[i].pindex);
+        }
+        CBlockFileInfo infoNew = vinfoBlockFile[nFile];
+        infoNew.nSize = nNewSize;
+        infoNew.nUndoSize = nNewUndoSize;
+        if (vStored.empty())
+            infoNew = vinfoBlockFile[nFile];
+        if (!pblocktree->WriteCompressedBlockFile(nFile, infoNew, vBlocks, vTxPos)) {
+            for (size_t i = 0; i < vStored.size(); i++) {
+                vStored[i].pindex->nDataPos = vStored[i].nDataPos;
+                vStored[i].pindex->nUndoPos = vStored[i].nUndoPos;
+            }
+            return AbortNode("Failed to write to block index database");
+        }
+        if (!vStored.empty()) {
+            vinfoBlockFile[nFile] = infoNew;
+            ForgetMappedBlockFile(nFile);
+            if (!RenameOver(pathBlocks, GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk")) ||
+                !RenameOver(pathUndo, GetBlockPosFilename(CDiskBlockPos(nFile, 0), "rev")))
+                return AbortNode(strprintf("Failed to replace blk%05u.dat or rev%05u.dat, the next start will retry", nFile, nFile));
+        }
+    }
+
+    LogPrintf("%s: blk%05u.dat and rev%05u.dat rewritten, %u -> %u bytes\n", __func__, nFile, nFile,
+              info.nSize + info.nUndoSize, nNewSize + nNewUndoSize);
+    return true;
+}
+
+} // anon namespace
+
+/**
+ * Finish or undo the rewrite of a block file interrupted by a crash: the copies of the file
+ * which was last recorded as rewritten replace it, any other copy is left over from a rewrite
+ * which did not get as far and is removed.
+ */
+static void CompleteBlockFileRewrite()
+{
+    int nCompressed = 0;
+    pblocktree->ReadCompressedBlockFiles(nCompressed);
+    for (int nFile = 0; nFile < (int)vinfoBlockFile.size(); nFile++) {
+        const char* prefixes[] = {"blk", "rev"};
+        BOOST_FOREACH(const char* prefix, prefixes) {
+            boost::filesystem::path path = GetRewrittenBlockFilename(nFile, prefix);
+            if (!boost::filesystem::exists(path))
+                continue;
+            if (nFile == nCompressed - 1) {
+                LogPrintf("%s: completing the rewrite of %s\n", __func__, path.string());
+                RenameOver(path, GetBlockPosFilename(CDiskBlockPos(nFile, 0), prefix));
+            } else {
+                boost::filesystem::remove(path);
+            }
+        }
+    }
+}
+
+void ThreadCompressBlockFiles()
+{
+    RenameThread("horizen-blkzip");
+
+    int nFile = 0;
+    pblocktree->ReadCompressedBlockFiles(nFile);
+    while (true) {
+        // Positions are not settled while importing
+        if (!fImporting && !fReindex && !fReindexFast && CompressBlockFile(nFile)) {
+            nFile++;
+            continue;
+        }
+        MilliSleep(60 * 1000);
+    }
+}
+
+/* Calculate the block/rev files that should be deleted to remain under target*/
+namespace {
+    struct CBlockFileHeat {
+        double dReads;
+        int64_t nTime;
+    };
+
+    /** Reads of each block file for serving blocks, halving every PRUNE_HEAT_HALF_LIFE */
+    CCriticalSection cs_blockFileHeat;
+    std::map<int, CBlockFileHeat> mapBlockFileHeat;
+
+    double GetDecayedHeat(const CBlockFileHeat& heat, int64_t nNow)
+    {
+        return heat.dReads * pow(0.5, (double)(nNow - heat.nTime) / PRUNE_HEAT_HALF_LIFE);
+    }
+
+    /** The up to nPruneHotFiles hottest of the given files, if hot enough */
+    std::set<int> GetHotBlockFiles(const std::vector<int>& vFiles)
+    {
+        const int64_t nNow = GetTime();
+        std::vector<std::pair<double, int> > vHeat;
+        {
+            LOCK(cs_blockFileHeat);
+            BOOST_FOREACH(int nFile, vFiles) {
+                std::map<int, CBlockFileHeat>::const_iterator it = mapBlockFileHeat.find(nFile);
+                if (it == mapBlockFileHeat.end())
+                    continue;
+                double dHeat = GetDecayedHeat(it->second, nNow);
+                if (dHeat >= PRUNE_HOT_MIN_HEAT)
+                    vHeat.push_back(std::make_pair(dHeat, nFile));
+            }
+        }
+        std::sort(vHeat.rbegin(), vHeat.rend());
+        std::set<int> setHot;
+        for (size_t i = 0; i < vHeat.size() && i < nPruneHotFiles; i++)
+            setHot.insert(vHeat[i].second);
+        return setHot;
+    }
 }
 
-
-void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
+void NoteBlockFileRead(int nFile)
 {
-    for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
-        CDiskBlockPos pos(*it, 0);
-        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
-        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
-        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    if (!fPruneMode)
+        return;
+    const int64_t nNow = GetTime();
+    LOCK(cs_blockFileHeat);
+    std::map<int, CBlockFileHeat>::iterator it = mapBlockFileHeat.find(nFile);
+    if (it == mapBlockFileHeat.end()) {
+        CBlockFileHeat heat = {1.0, nNow};
+        mapBlockFileHeat.insert(std::make_pair(nFile, heat));
+        return;
     }
+    it->second.dReads = GetDecayedHeat(it->second, nNow) + 1.0;
+    it->second.nTime = nNow;
 }
 
-/* Calculate the block/rev files that should be deleted to remain under target*/
 void FindFilesToPrune(std::set<int>& setFilesToPrune)
 {
     LOCK2(cs_main, cs_LastBlockFile);
     if (chainActive.Tip() == NULL || nPruneTarget == 0) {
         return;
     }
-    if (chainActive.Tip()->nHeight <= Params().PruneAfterHeight()) {
+    // Init refuses -prune with a snapshot to validate, whose background chainstate reads every block below it
+    if (!hashSnapshotBase.IsNull()) {
+        return;
+    }
+    if (chainActive.Tip()->nHeight <= Params().PruneAfterHeight() || chainActive.Tip()->nHeight <= (int)nPruneKeepBlocks) {
         return;
     }
 
-    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - nPruneKeepBlocks;
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
@@ -3938,33 +7277,44 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune)
     uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
     uint64_t nBytesToPrune;
     int count=0;
+    int nHotKept = 0;
 
     if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        // don't prune files that could have a block within nPruneKeepBlocks of the main chain's tip
+        std::vector<int> vCandidates;
         for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
-            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
-
             if (vinfoBlockFile[fileNumber].nSize == 0)
                 continue;
-
-            if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
-                break;
-
-            // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep scanning
             if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
                 continue;
+            vCandidates.push_back(fileNumber);
+        }
+
+        // The files most read for serving go last, the others oldest first
+        std::set<int> setHot = GetHotBlockFiles(vCandidates);
+        for (int nPass = 0; nPass < 2; nPass++) {
+            BOOST_FOREACH(int fileNumber, vCandidates) {
+                if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
+                    break;
+                if ((setHot.count(fileNumber) != 0) != (nPass == 1))
+                    continue;
 
-            PruneOneBlockFile(fileNumber);
-            // Queue up the files for removal
-            setFilesToPrune.insert(fileNumber);
-            nCurrentUsage -= nBytesToPrune;
-            count++;
+                nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+                PruneOneBlockFile(fileNumber);
+                // Queue up the files for removal
+                setFilesToPrune.insert(fileNumber);
+                nCurrentUsage -= nBytesToPrune;
+                count++;
+            }
         }
+        BOOST_FOREACH(int fileNumber, setHot)
+            nHotKept += setFilesToPrune.count(fileNumber) == 0;
     }
 
-    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs, kept %d hot\n",
            nPruneTarget/1024/1024, nCurrentUsage/1024/1024,
            ((int64_t)nPruneTarget - (int64_t)nCurrentUsage)/1024/1024,
-           nLastBlockWeCanPrune, count);
+           nLastBlockWeCanPrune, count, nHotKept);
 }
 
 bool CheckDiskSpace(uint64_t nAdditionalBytes)
@@ -4025,9 +7375,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.New();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -4042,6 +7390,10 @@ bool static LoadBlockIndexDB()
 
     boost::this_thread::interruption_point();
 
+    CChainstateSnapshotInfo snapshot;
+    if (pcoinsdbview && pcoinsdbview->ReadSnapshotBase(snapshot))
+        hashSnapshotBase = snapshot.hashBlock;
+
     // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -4077,6 +7429,8 @@ bool static LoadBlockIndexDB()
                 pindex->nChainSproutValue = pindex->nSproutValue;
             }
         }
+        if (pindex->nChainTx == 0 && pindex->GetBlockHash() == hashSnapshotBase)
+            pindex->nChainTx = pindex->nHeight + 1;
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
@@ -4106,6 +7460,8 @@ bool static LoadBlockIndexDB()
         }
     }
 
+    CompleteBlockFileRewrite();
+
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
     set<int> setBlkDataFiles;
@@ -4161,6 +7517,7 @@ bool static LoadBlockIndexDB()
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    PublishChainTipView();
     // Set hashAnchorEnd for the end of best chain
     it->second->hashAnchorEnd = pcoinsTip->GetBestAnchor();
 
@@ -4273,11 +7630,17 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    PublishChainTipView();
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    pathSnapshotPending.clear();
+    hashSnapshotPending.SetNull();
+    hashSnapshotBase.SetNull();
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
+    mapOrphansByPeer.clear();
+    nOrphanTxUsage = 0;
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4289,17 +7652,22 @@ void UnloadBlockIndex()
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    setBlockIndexToCheck.clear();
+    mapBlockIndexChildren.clear();
+    pindexLastChecked = NULL;
     mapNodeState.clear();
+    {
+        LOCK(cs_mapPeer);
+        mapPeer.clear();
+    }
     recentRejects.reset(NULL);
     versionbitscache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
     fHavePruned = false;
 }
 
@@ -4336,12 +7704,12 @@ bool InitBlockIndex() {
     try {
         CBlock &block = const_cast<CBlock&>(Params().GenesisBlock());
         // Start new block file
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        CDiskRecord record(block, fBlockCompression);
         CDiskBlockPos blockPos;
         CValidationState state;
-        if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
+        if (!FindBlockPos(state, blockPos, record.size()+8, 0, block.GetBlockTime()))
             return error("LoadBlockIndex(): FindBlockPos failed");
-        if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+        if (!WriteBlockToDisk(record, blockPos, chainparams.MessageStart()))
             return error("LoadBlockIndex(): writing genesis block to disk failed");
         CBlockIndex *pindex = AddToBlockIndex(block);
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos, NULL))
@@ -4365,6 +7733,7 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos)
         return res;
 
     int blkSize = -1;
+    unsigned int nSizeField = 0;
 
     //locate Header
     for(uint64_t nRewind = blkdat.GetPos(); !blkdat.eof() && (blkSize == -1);)
@@ -4382,7 +7751,8 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos)
             if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
                 continue; // just first byte of magic number matches. Keep searching
 
-            blkdat >> blkSize; // read size
+            blkdat >> nSizeField; // read size
+            blkSize = nSizeField & ~DISK_RECORD_COMPRESSED;
             if (blkSize < 80 || blkSize > MAX_BLOCK_SIZE) {
                 blkSize = -1;
                 continue; // while whole magic number matches, it can't be block size. Keep searching
@@ -4402,7 +7772,7 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos)
     blkdat.SetLimit(blkStartPos + blkSize);
     blkdat.SetPos(blkStartPos);
     try {
-        blkdat >> res;
+        ReadDiskRecord(blkdat, nSizeField, res);
     } catch (const std::exception& e) {
         LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
     }
@@ -4411,15 +7781,227 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos)
     return res;
 }
 
-bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeadersOnly)
+namespace {
+
+/** Disk positions of blocks read from block files whose parent was not known yet, by parent hash */
+std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Import a block (or only its header) read from a file, then the blocks found earlier in the
+ * files which were waiting for it. pfChecked is the outcome of the context-free check of the
+ * block if it was already run, or NULL to run it now.
+ * @return false if importing must stop because of a system error
+ */
+bool ImportBlock(CBlock& loadedBlk, CDiskBlockPos *dbp, bool loadHeadersOnly, const bool* pfChecked, int& nLoaded)
 {
     const CChainParams& chainparams = Params();
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+    try
+    {
+        // detect out of order blocks, and store them for later
+        uint256 hash = loadedBlk.GetHash();
+        if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(loadedBlk.hashPrevBlock) == mapBlockIndex.end()) {
+            LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    loadedBlk.hashPrevBlock.ToString());
+            if (dbp)
+                mapBlocksUnknownParent.insert(std::make_pair(loadedBlk.hashPrevBlock, *dbp));
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0)
+        {
+            CValidationState state;
+            if (loadHeadersOnly)
+            {
+                LOCK(cs_main);
+                // A header which failed the check ahead is checked again, to report why
+                if (AcceptBlockHeader(loadedBlk, state, /*ppindex*/nullptr, /*lookForwardTips*/false, /*fCheckPOW*/!(pfChecked && *pfChecked))) //Todo: verify lookForwardTips
+                    ++nLoaded;
+            } else
+            {
+                bool fProcessed = pfChecked ? ProcessCheckedBlock(state, NULL, &loadedBlk, true, dbp, *pfChecked)
+                                            : ProcessNewBlock(state, NULL, &loadedBlk, true, dbp);
+                if (fProcessed)
+                    nLoaded++;
+            }
+
+            if (state.IsError())
+                return false;
+        } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+            LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+        }
+
+        // Breath-first process earlier encountered successors of this block
+        CBlock block;
+        deque<uint256> queue{hash};
+        do
+        {
+            uint256 head = queue.front();
+            queue.pop_front();
+            auto range = mapBlocksUnknownParent.equal_range(head);
+            while (range.first != range.second)
+            {
+                std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                if (ReadBlockFromDisk(block, it->second))
+                {
+                    CValidationState dummy;
+                    if (loadHeadersOnly)
+                    {
+                        LogPrintf("%s: Processing out of order header, child %s of %s\n", __func__, block.GetHash().ToString(),
+                                head.ToString());
+                        LOCK(cs_main);
+                        if (AcceptBlockHeader(block, dummy, /*ppindex*/nullptr, /*lookForwardTips*/false))
+                        { //Todo: verify lookForwardTips and correctness of not breaking up
+                            nLoaded++;
+                            queue.push_back(block.GetHash());
+                        }
+                    } else {
+                        LogPrintf("%s: Processing out of order block, child %s of %s\n", __func__, block.GetHash().ToString(),
+                                head.ToString());
+
+                        //Todo: verify that issue on Process Block does not cause whole stop as before
+                        if (ProcessNewBlock(dummy, NULL, &block, true, &it->second))
+                        {
+                            nLoaded++;
+                            queue.push_back(block.GetHash());
+                        }
+                    }
+                }
+                range.first++;
+                mapBlocksUnknownParent.erase(it);
+            }
+        } while (!queue.empty());
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+    }
+    return true;
+}
+
+/** The blocks of one block file, in the order they are stored, with the outcome of their context-free checks */
+struct CReindexFile
+{
+    std::vector<CBlock> vBlocks;
+    std::vector<CDiskBlockPos> vPos;
+    std::vector<bool> vChecked;
+};
+
+/**
+ * Reads the block files for a reindex on several threads, one file per thread at a time,
+ * running the context-free checks of the blocks read (those of the headers only, for the
+ * headers-only pass), and hands the files over in order. At most nMaxAhead files are read
+ * ahead of the one being imported.
+ */
+class CReindexReader
+{
+private:
+    const bool fHeadersOnly;
+    const int nMaxAhead;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! Next file to be read
+    int nNextFile;
+    //! First file not handed over yet
+    int nNextImport;
+    //! First file found missing
+    int nEndFile;
+    std::map<int, std::shared_ptr<CReindexFile> > mapFiles;
+
+    std::shared_ptr<CReindexFile> Read(int nFile)
+    {
+        CDiskBlockPos pos(nFile, 0);
+        if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
+            return NULL; // No block files left to reindex
+        FILE *file = OpenBlockFile(pos, true);
+        if (!file)
+            return NULL; // This error is logged in OpenBlockFile
+        LogPrintf("Reindexing block file blk%05u.dat%s...\n", (unsigned int)nFile, fHeadersOnly ? ", headers-only" : "");
+
+        std::shared_ptr<CReindexFile> pfile = std::make_shared<CReindexFile>();
+        // This takes over file and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(file, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        while (!blkdat.eof()) {
+            boost::this_thread::interruption_point();
+
+            CBlock block = LoadBlockFrom(blkdat, &pos);
+            if (block.IsNull())
+                continue;
+
+            CValidationState state;
+            bool fChecked;
+            if (fHeadersOnly) {
+                fChecked = CheckBlockHeader(block, state, true);
+                // Only the header is imported in this pass
+                std::vector<CTransactionRef>().swap(block.vtx);
+            } else {
+                auto verifier = libzcash::ProofVerifier::Disabled();
+                fChecked = CheckBlock(block, state, verifier);
+            }
+            pfile->vBlocks.push_back(std::move(block));
+            pfile->vPos.push_back(pos);
+            pfile->vChecked.push_back(fChecked);
+        }
+        return pfile;
+    }
+
+public:
+    CReindexReader(bool fHeadersOnlyIn, int nMaxAheadIn) :
+        fHeadersOnly(fHeadersOnlyIn), nMaxAhead(nMaxAheadIn), nNextFile(0), nNextImport(0), nEndFile(std::numeric_limits<int>::max()) {}
+
+    void Thread()
+    {
+        while (true) {
+            int nFile;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (nNextFile < nEndFile && nNextFile >= nNextImport + nMaxAhead)
+                    cond.wait(lock);
+                if (nNextFile >= nEndFile)
+                    return;
+                nFile = nNextFile++;
+            }
+
+            std::shared_ptr<CReindexFile> pfile;
+            try {
+                pfile = Read(nFile);
+            } catch (const std::runtime_error& e) {
+                AbortNode(std::string("System error: ") + e.what());
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (pfile)
+                mapFiles[nFile] = pfile;
+            else
+                nEndFile = std::min(nEndFile, nFile);
+            cond.notify_all();
+        }
+    }
+
+    /** Wait for the blocks of file nFile, which must be the next one; NULL once there are no files left */
+    std::shared_ptr<CReindexFile> Next(int nFile)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        assert(nFile == nNextImport);
+        while (nFile < nEndFile && !mapFiles.count(nFile))
+            cond.wait(lock);
+        if (nFile >= nEndFile)
+            return NULL;
+        std::shared_ptr<CReindexFile> pfile = mapFiles[nFile];
+        mapFiles.erase(nFile);
+        nNextImport++;
+        cond.notify_all();
+        return pfile;
+    }
+};
+
+} // anon namespace
+
+bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeadersOnly)
+{
     int64_t nStart = GetTimeMillis();
 
-    int nLoadedHeaders = 0;
-    int nLoadedBlocks = 0;
+    int nLoaded = 0;
 
     try
     {
@@ -4433,6 +8015,7 @@ bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeade
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
+            unsigned int nSizeField = 0;
             unsigned int nSize = 0;
             try {
                 // locate a header
@@ -4443,7 +8026,8 @@ bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeade
                 if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
                     continue; //only first byte of magic number matches. Keep searching...
                 // read size
-                blkdat >> nSize;
+                blkdat >> nSizeField;
+                nSize = nSizeField & ~DISK_RECORD_COMPRESSED;
                 if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
                     continue; //magic number matches but size can't be block one. Keep searching...
             } catch (const std::exception&) {
@@ -4459,90 +8043,249 @@ bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeade
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
                 CBlock loadedBlk;
-                blkdat >> loadedBlk;
+                ReadDiskRecord(blkdat, nSizeField, loadedBlk);
                 nRewind = blkdat.GetPos();
-                // detect out of order blocks, and store them for later
-                uint256 hash = loadedBlk.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(loadedBlk.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            loadedBlk.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(loadedBlk.hashPrevBlock, *dbp));
-                    continue;
-                }
+                if (!ImportBlock(loadedBlk, dbp, loadHeadersOnly, NULL, nLoaded))
+                    break;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0)
-                {
-                    CValidationState state;
-                    if (loadHeadersOnly)
-                    {
-                        if (AcceptBlockHeader(loadedBlk, state, /*ppindex*/nullptr, /*lookForwardTips*/false)) //Todo: verify lookForwardTips
-                            ++nLoadedHeaders;
+    if (nLoaded > 0 && !loadHeadersOnly)
+        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
 
-                        if (state.IsError())
-                            break;
-                    } else
-                    {
-                        if (ProcessNewBlock(state, NULL, &loadedBlk, true, dbp))
-                            nLoadedBlocks++;
+bool ReindexBlockFiles(bool loadHeadersOnly)
+{
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_REINDEX_THREADS));
+    // Full blocks are kept in memory until imported, headers take little room
+    CReindexReader reader(loadHeadersOnly, loadHeadersOnly ? 2 * nThreads : std::min(nThreads, MAX_REINDEX_FILES_AHEAD));
+    boost::thread_group threadGroupRead;
+    for (int i = 0; i < nThreads; i++)
+        threadGroupRead.create_thread(boost::bind(&CReindexReader::Thread, &reader));
+
+    int nLoaded = 0;
+    try {
+        for (int nFile = 0; ; nFile++) {
+            std::shared_ptr<CReindexFile> pfile = reader.Next(nFile);
+            if (!pfile)
+                break;
 
-                        if (state.IsError())
-                            break;
-                    }
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+            int64_t nStart = GetTimeMillis();
+            int nLoadedFile = 0;
+            for (size_t i = 0; i < pfile->vBlocks.size(); i++) {
+                boost::this_thread::interruption_point();
+                bool fChecked = pfile->vChecked[i];
+                if (!ImportBlock(pfile->vBlocks[i], &pfile->vPos[i], loadHeadersOnly, &fChecked, nLoadedFile))
+                    break;
+                // Free the block as soon as it is imported
+                pfile->vBlocks[i].SetNull();
+            }
+            if (nLoadedFile > 0 && !loadHeadersOnly)
+                LogPrintf("Loaded %i blocks from blk%05u.dat in %dms\n", nLoadedFile, (unsigned int)nFile, GetTimeMillis() - nStart);
+            nLoaded += nLoadedFile;
+        }
+    } catch (const boost::thread_interrupted&) {
+        threadGroupRead.interrupt_all();
+        threadGroupRead.join_all();
+        throw;
+    }
+    threadGroupRead.join_all();
 
-                // Breath-first process earlier encountered successors of this block
-                deque<uint256> queue{hash};
-                do
-                {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    auto range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second)
-                    {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(loadedBlk, it->second))
-                        {
-                            CValidationState dummy;
-                            if (loadHeadersOnly)
-                            {
-                                LogPrintf("%s: Processing out of order header, child %s of %s\n", __func__, loadedBlk.GetHash().ToString(),
-                                        head.ToString());
-                                if (AcceptBlockHeader(loadedBlk, dummy, /*ppindex*/nullptr, /*lookForwardTips*/false))
-                                { //Todo: verify lookForwardTips and correctness of not breaking up
-                                    nLoadedHeaders++;
-                                    queue.push_back(loadedBlk.GetHash());
-                                }
-                            } else {
-                                LogPrintf("%s: Processing out of order block, child %s of %s\n", __func__, loadedBlk.GetHash().ToString(),
-                                        head.ToString());
+    return nLoaded > 0;
+}
 
-                                //Todo: verify that issue on Process Block does not cause whole stop as before
-                                if (ProcessNewBlock(dummy, NULL, &loadedBlk, true, &it->second))
-                                {
-                                    nLoadedBlocks++;
-                                    queue.push_back(loadedBlk.GetHash());
-                                }
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                    }
-                } while (!queue.empty());
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+namespace {
+
+/**
+ * Oldest blocks with certain properties on the path from the genesis block
+ * to the block being checked.
+ */
+struct CBlockIndexCheckPath
+{
+    CBlockIndex* pindexFirstInvalid; // Oldest ancestor of pindex which is invalid.
+    CBlockIndex* pindexFirstMissing; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstNeverProcessed; // Oldest ancestor of pindex for which nTx == 0.
+    CBlockIndex* pindexFirstNotTreeValid; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
+    CBlockIndex* pindexFirstNotTransactionsValid; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
+    CBlockIndex* pindexFirstNotChainValid; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
+    CBlockIndex* pindexFirstNotScriptsValid; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+
+    CBlockIndexCheckPath() : pindexFirstInvalid(NULL), pindexFirstMissing(NULL), pindexFirstNeverProcessed(NULL),
+        pindexFirstNotTreeValid(NULL), pindexFirstNotTransactionsValid(NULL), pindexFirstNotChainValid(NULL),
+        pindexFirstNotScriptsValid(NULL) {}
+
+    //! Extend the path with pindex, a child of its last block
+    void Enter(CBlockIndex* pindex) {
+        if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
+        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotTransactionsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+    }
+
+    //! Remove pindex, the last block, from the path
+    void Leave(CBlockIndex* pindex) {
+        // If pindex was the first with a certain property, unset the corresponding variable.
+        if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
+        if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+        if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
+        if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
+        if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = NULL;
+        if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
+        if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
+    }
+};
+
+/** Consistency checks of a single block index entry, found at nHeight below path */
+void CheckBlockIndexEntry(CBlockIndex* pindex, int nHeight, const CBlockIndexCheckPath& path, const Consensus::Params& consensusParams)
+{
+    CBlockIndex* pindexFirstInvalid = path.pindexFirstInvalid;
+    CBlockIndex* pindexFirstMissing = path.pindexFirstMissing;
+    CBlockIndex* pindexFirstNeverProcessed = path.pindexFirstNeverProcessed;
+    CBlockIndex* pindexFirstNotTreeValid = path.pindexFirstNotTreeValid;
+    CBlockIndex* pindexFirstNotTransactionsValid = path.pindexFirstNotTransactionsValid;
+    CBlockIndex* pindexFirstNotChainValid = path.pindexFirstNotChainValid;
+    CBlockIndex* pindexFirstNotScriptsValid = path.pindexFirstNotScriptsValid;
+
+    // Begin: actual consistency checks.
+    if (pindex->pprev == NULL) {
+        // Genesis block checks.
+        assert(pindex->GetBlockHash() == consensusParams.hashGenesisBlock); // Genesis block's hash must match.
+        assert(pindex == chainActive.Genesis()); // The current active chain's genesis block must be this block.
+    }
+    if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
+    // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
+    // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
+    if (!fHavePruned) {
+        // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
+        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+        assert(pindexFirstMissing == pindexFirstNeverProcessed);
+    } else {
+        // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+        if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+    }
+    if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
+    assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+    // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+    assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
+    assert((pindexFirstNotTransactionsValid != NULL) == (pindex->nChainTx == 0));
+    assert(pindex->nHeight == nHeight); // nHeight must be consistent.
+    assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
+    assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
+    assert(pindexFirstNotTreeValid == NULL); // All mapBlockIndex entries must at least be TREE valid
+    if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TREE) assert(pindexFirstNotTreeValid == NULL); // TREE valid implies all parents are TREE valid
+    if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(pindexFirstNotChainValid == NULL); // CHAIN valid implies all parents are CHAIN valid
+    if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(pindexFirstNotScriptsValid == NULL); // SCRIPTS valid implies all parents are SCRIPTS valid
+    if (pindexFirstInvalid == NULL) {
+        // Checks for not-invalid blocks.
+        assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
+    }
+    if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+        if (pindexFirstInvalid == NULL) {
+            // If this block sorts at least as good as the current tip and
+            // is valid and we have all data for its parents, it must be in
+            // setBlockIndexCandidates.  chainActive.Tip() must also be there
+            // even if some data has been pruned.
+            if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                // LogPrintf("net","ASSERT============>%x  but  %x", pindex->phashBlock, chainActive.Tip()->phashBlock);
+                assert(setBlockIndexCandidates.count(pindex));
             }
+            // If some parent is missing, then it could be that this block was in
+            // setBlockIndexCandidates but had to be removed because of the missing data.
+            // In this case it must be in mapBlocksUnlinked -- see test below.
+        }
+    } else { // If this block sorts worse than the current tip or some ancestor's block has never been seen, it cannot be in setBlockIndexCandidates.
+        assert(setBlockIndexCandidates.count(pindex) == 0);
+    }
+    // Check whether this block is in mapBlocksUnlinked.
+    std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangeUnlinked = mapBlocksUnlinked.equal_range(pindex->pprev);
+    bool foundInUnlinked = false;
+    while (rangeUnlinked.first != rangeUnlinked.second) {
+        assert(rangeUnlinked.first->first == pindex->pprev);
+        if (rangeUnlinked.first->second == pindex) {
+            foundInUnlinked = true;
+            break;
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+        rangeUnlinked.first++;
+    }
+    if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+        // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+        assert(foundInUnlinked);
+    }
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
+    if (pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+    if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
+        // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
+        assert(fHavePruned); // We must have pruned.
+        // This block may have entered mapBlocksUnlinked if:
+        //  - it has a descendant that at some point had more work than the
+        //    tip, and
+        //  - we tried switching to that descendant but were missing
+        //    data for some intermediate block between chainActive and the
+        //    tip.
+        // So if this block is itself better than chainActive.Tip() and it wasn't in
+        // setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
+            if (pindexFirstInvalid == NULL) {
+                assert(foundInUnlinked);
+            }
+        }
+    }
+    // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
+    // End: actual consistency checks.
+}
+
+/**
+ * Check pindexRoot and all its descendants, using depth-first search. path
+ * must describe the ancestors of pindexRoot, and is left unchanged.
+ */
+size_t CheckBlockIndexSubtree(CBlockIndex* pindexRoot, CBlockIndexCheckPath& path, const BlockIndexChildren& forward,
+                              std::set<CBlockIndex*>* psetVisited, const Consensus::Params& consensusParams)
+{
+    typedef BlockIndexChildren::const_iterator ChildIter;
+    std::vector<std::pair<CBlockIndex*, ChildIter> > vStack;
+    size_t nNodes = 0;
+
+    CBlockIndex* pindex = pindexRoot;
+    const int nRootHeight = pindexRoot->pprev ? pindexRoot->pprev->nHeight + 1 : 0;
+    int nHeight = nRootHeight;
+    while (true) {
+        // Visit pindex, then descend into its first subnode.
+        nNodes++;
+        if (psetVisited)
+            psetVisited->insert(pindex);
+        path.Enter(pindex);
+        CheckBlockIndexEntry(pindex, nHeight, path, consensusParams);
+        vStack.push_back(std::make_pair(pindex, forward.lower_bound(pindex)));
+
+        // Move upwards until we reach a node of which we have not yet visited the last child.
+        pindex = NULL;
+        while (!vStack.empty()) {
+            ChildIter& itChild = vStack.back().second;
+            if (itChild != forward.end() && itChild->first == vStack.back().first) {
+                pindex = (itChild++)->second;
+                break;
+            }
+            path.Leave(vStack.back().first);
+            vStack.pop_back();
+        }
+        if (pindex == NULL)
+            break;
+        nHeight = nRootHeight + (int)vStack.size();
+        // Our parent must be the node we're coming from.
+        assert(pindex->pprev == vStack.back().first);
     }
+    return nNodes;
+}
 
-    if (nLoadedBlocks > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoadedBlocks, GetTimeMillis() - nStart);
-    return (loadHeadersOnly && (nLoadedHeaders > 0)) || (!loadHeadersOnly && (nLoadedBlocks > 0));
 }
 
 void static CheckBlockIndex()
@@ -4554,6 +8297,11 @@ void static CheckBlockIndex()
 
     LOCK(cs_main);
 
+    // Below the block of an unvalidated chainstate snapshot, the active chain may miss blocks
+    if (!hashSnapshotBase.IsNull()) {
+        return;
+    }
+
     // During a reindex, we read the genesis block and call CheckBlockIndex before ActivateBestChain,
     // so we have the genesis block in mapBlockIndex but no active chain.  (A few of the tests when
     // iterating the block tree require that chainActive has been initialized.)
@@ -4567,172 +8315,80 @@ void static CheckBlockIndex()
     if (fReindexFast && (chainActive.Height() < 0))
         return;
 
+    // In incremental mode, only the subtrees of the entries which changed since the last call are
+    // checked. That is enough as long as the tip did not lose work: entries which used to sort
+    // better than the tip and no longer do are covered by the candidate check below, and there is
+    // no way to find entries which start sorting better than it without walking the whole tree.
+    if (fCheckBlockIndexIncremental && pindexLastChecked != NULL &&
+        !CBlockIndexWorkComparator()(chainActive.Tip(), pindexLastChecked)) {
+        // The old and the new tip are re-checked as well, as their candidate status may have changed.
+        setBlockIndexToCheck.insert(pindexLastChecked);
+        setBlockIndexToCheck.insert(chainActive.Tip());
+        std::vector<CBlockIndex*> vChanged(setBlockIndexToCheck.begin(), setBlockIndexToCheck.end());
+        setBlockIndexToCheck.clear();
+        pindexLastChecked = chainActive.Tip();
+
+        // New entries are always in the changed set, which keeps the forward map complete.
+        BOOST_FOREACH(CBlockIndex* pindex, vChanged) {
+            std::pair<BlockIndexChildren::iterator, BlockIndexChildren::iterator> range = mapBlockIndexChildren.equal_range(pindex->pprev);
+            while (range.first != range.second && range.first->second != pindex)
+                range.first++;
+            if (range.first == range.second)
+                mapBlockIndexChildren.insert(std::make_pair(pindex->pprev, pindex));
+        }
+        assert(mapBlockIndexChildren.size() == mapBlockIndex.size());
+
+        // Check the subtrees from the oldest changed entry up, skipping those already covered.
+        std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
+        vSortedByHeight.reserve(vChanged.size());
+        BOOST_FOREACH(CBlockIndex* pindex, vChanged)
+            vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        std::sort(vSortedByHeight.begin(), vSortedByHeight.end());
+        std::set<CBlockIndex*> setVisited;
+        BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight) {
+            CBlockIndex* pindexRoot = item.second;
+            if (setVisited.count(pindexRoot))
+                continue;
+            std::vector<CBlockIndex*> vPath;
+            for (CBlockIndex* pindexWalk = pindexRoot->pprev; pindexWalk != NULL; pindexWalk = pindexWalk->pprev)
+                vPath.push_back(pindexWalk);
+            CBlockIndexCheckPath path;
+            BOOST_REVERSE_FOREACH(CBlockIndex* pindexWalk, vPath)
+                path.Enter(pindexWalk);
+            CheckBlockIndexSubtree(pindexRoot, path, mapBlockIndexChildren, &setVisited, consensusParams);
+        }
+
+        BOOST_FOREACH(CBlockIndex* pindex, setBlockIndexCandidates) {
+            // Blocks which sort worse than the current tip cannot be in setBlockIndexCandidates.
+            assert(!CBlockIndexWorkComparator()(pindex, chainActive.Tip()));
+        }
+        return;
+    }
+
     // Build forward-pointing map of the entire block tree.
-    std::multimap<CBlockIndex*,CBlockIndex*> forward;
+    BlockIndexChildren forward;
     for(BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it)
         forward.insert(std::make_pair(it->second->pprev, it->second));
 
     assert(forward.size() == mapBlockIndex.size()); //would fail if same CBlockIndex* is mapped to two different hashes
 
-    std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangeGenesis = forward.equal_range(NULL);
+    std::pair<BlockIndexChildren::iterator,BlockIndexChildren::iterator> rangeGenesis = forward.equal_range(NULL);
     CBlockIndex *pindex = rangeGenesis.first->second;
     rangeGenesis.first++;
     assert(rangeGenesis.first == rangeGenesis.second); // There is only one index entry with parent NULL.
 
-    // Iterate over the entire block tree, using depth-first search.
-    // Along the way, remember whether there are blocks on the path from genesis
-    // block being explored which are the first to have certain properties.
-    size_t nNodes = 0;
-    int nHeight = 0;
-    CBlockIndex* pindexFirstInvalid = NULL; // Oldest ancestor of pindex which is invalid.
-    CBlockIndex* pindexFirstMissing = NULL; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
-    CBlockIndex* pindexFirstNeverProcessed = NULL; // Oldest ancestor of pindex for which nTx == 0.
-    CBlockIndex* pindexFirstNotTreeValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
-    CBlockIndex* pindexFirstNotTransactionsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
-    CBlockIndex* pindexFirstNotChainValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
-    CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
-    while (pindex != NULL) {
-        nNodes++;
-        if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
-        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotTransactionsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
-
-        // Begin: actual consistency checks.
-        if (pindex->pprev == NULL) {
-            // Genesis block checks.
-            assert(pindex->GetBlockHash() == consensusParams.hashGenesisBlock); // Genesis block's hash must match.
-            assert(pindex == chainActive.Genesis()); // The current active chain's genesis block must be this block.
-        }
-        if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
-        // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
-        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
-            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
-            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
-            assert(pindexFirstMissing == pindexFirstNeverProcessed);
-        } else {
-            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
-            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
-        }
-        if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
-        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
-        assert((pindexFirstNotTransactionsValid != NULL) == (pindex->nChainTx == 0));
-        assert(pindex->nHeight == nHeight); // nHeight must be consistent.
-        assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
-        assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
-        assert(pindexFirstNotTreeValid == NULL); // All mapBlockIndex entries must at least be TREE valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TREE) assert(pindexFirstNotTreeValid == NULL); // TREE valid implies all parents are TREE valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(pindexFirstNotChainValid == NULL); // CHAIN valid implies all parents are CHAIN valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(pindexFirstNotScriptsValid == NULL); // SCRIPTS valid implies all parents are SCRIPTS valid
-        if (pindexFirstInvalid == NULL) {
-            // Checks for not-invalid blocks.
-            assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
-        }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
-            if (pindexFirstInvalid == NULL) {
-                // If this block sorts at least as good as the current tip and
-                // is valid and we have all data for its parents, it must be in
-                // setBlockIndexCandidates.  chainActive.Tip() must also be there
-                // even if some data has been pruned.
-                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
-                    // LogPrintf("net","ASSERT============>%x  but  %x", pindex->phashBlock, chainActive.Tip()->phashBlock);
-                    assert(setBlockIndexCandidates.count(pindex));
-                }
-                // If some parent is missing, then it could be that this block was in
-                // setBlockIndexCandidates but had to be removed because of the missing data.
-                // In this case it must be in mapBlocksUnlinked -- see test below.
-            }
-        } else { // If this block sorts worse than the current tip or some ancestor's block has never been seen, it cannot be in setBlockIndexCandidates.
-            assert(setBlockIndexCandidates.count(pindex) == 0);
-        }
-        // Check whether this block is in mapBlocksUnlinked.
-        std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangeUnlinked = mapBlocksUnlinked.equal_range(pindex->pprev);
-        bool foundInUnlinked = false;
-        while (rangeUnlinked.first != rangeUnlinked.second) {
-            assert(rangeUnlinked.first->first == pindex->pprev);
-            if (rangeUnlinked.first->second == pindex) {
-                foundInUnlinked = true;
-                break;
-            }
-            rangeUnlinked.first++;
-        }
-        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
-            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
-            assert(foundInUnlinked);
-        }
-        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
-        if (pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
-        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
-            // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
-            assert(fHavePruned); // We must have pruned.
-            // This block may have entered mapBlocksUnlinked if:
-            //  - it has a descendant that at some point had more work than the
-            //    tip, and
-            //  - we tried switching to that descendant but were missing
-            //    data for some intermediate block between chainActive and the
-            //    tip.
-            // So if this block is itself better than chainActive.Tip() and it wasn't in
-            // setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
-            if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
-                if (pindexFirstInvalid == NULL) {
-                    assert(foundInUnlinked);
-                }
-            }
-        }
-        // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
-        // End: actual consistency checks.
-
-        // Try descending into the first subnode.
-        std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> range = forward.equal_range(pindex);
-        if (range.first != range.second) {
-            // A subnode was found.
-            pindex = range.first->second;
-            nHeight++;
-            continue;
-        }
-        // This is a leaf node.
-        // Move upwards until we reach a node of which we have not yet visited the last child.
-        while (pindex) {
-            // We are going to either move to a parent or a sibling of pindex.
-            // If pindex was the first with a certain property, unset the corresponding variable.
-            if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
-            if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
-            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
-            if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
-            if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = NULL;
-            if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
-            if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
-            // Find our parent.
-            CBlockIndex* pindexPar = pindex->pprev;
-            // Find which child we just visited.
-            std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangePar = forward.equal_range(pindexPar);
-            while (rangePar.first->second != pindex) {
-                assert(rangePar.first != rangePar.second); // Our parent must have at least the node we're coming from as child.
-                rangePar.first++;
-            }
-            // Proceed to the next one.
-            rangePar.first++;
-            if (rangePar.first != rangePar.second) {
-                // Move to the sibling.
-                pindex = rangePar.first->second;
-                break;
-            } else {
-                // Move up further.
-                pindex = pindexPar;
-                nHeight--;
-                continue;
-            }
-        }
-    }
+    // Iterate over the entire block tree.
+    CBlockIndexCheckPath path;
+    size_t nNodes = CheckBlockIndexSubtree(pindex, path, forward, NULL, consensusParams);
 
     // Check that we actually traversed the entire map.
     assert(nNodes == forward.size());
+
+    if (fCheckBlockIndexIncremental) {
+        mapBlockIndexChildren.swap(forward);
+        setBlockIndexToCheck.clear();
+        pindexLastChecked = chainActive.Tip();
+    }
 }
 
 ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::DeploymentPos pos)
@@ -4849,6 +8505,38 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
+/**
+ * The "block" and "cmpctblock" messages of the most recently requested blocks. A new block
+ * is requested by most peers within a short time, it is then read from disk, serialized and
+ * checksummed once, and the same buffer is queued to every peer.
+ */
+static CCriticalSection cs_recentBlockMessages;
+static std::list<std::pair<CInv, CSharedMessage> > lRecentBlockMessages;
+static const size_t MAX_RECENT_BLOCK_MESSAGES = 4;
+
+static CSharedMessage GetRecentBlockMessage(const CInv& inv)
+{
+    LOCK(cs_recentBlockMessages);
+    for (std::list<std::pair<CInv, CSharedMessage> >::iterator it = lRecentBlockMessages.begin(); it != lRecentBlockMessages.end(); ++it)
+    {
+        if (it->first.type == inv.type && it->first.hash == inv.hash)
+        {
+            // most recently used first
+            lRecentBlockMessages.splice(lRecentBlockMessages.begin(), lRecentBlockMessages, it);
+            return lRecentBlockMessages.front().second;
+        }
+    }
+    return CSharedMessage();
+}
+
+static void AddRecentBlockMessage(const CInv& inv, const CSharedMessage& msg)
+{
+    LOCK(cs_recentBlockMessages);
+    lRecentBlockMessages.push_front(std::make_pair(inv, msg));
+    if (lRecentBlockMessages.size() > MAX_RECENT_BLOCK_MESSAGES)
+        lRecentBlockMessages.pop_back();
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -4867,7 +8555,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -4907,21 +8595,53 @@ void static ProcessGetData(CNode* pfrom)
                         }
                     }
                 }
+                // disconnect node in case we have reached the outbound limit for serving historical blocks,
+                // what is left of the upload target is kept for the recent blocks and the headers
+                if (send && !pfrom->fWhitelisted && CNode::OutboundTargetReached(true) && (
+                        (pindexBestHeader != NULL && pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE) ||
+                        inv.type == MSG_FILTERED_BLOCK))
+                {
+                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+                    pfrom->fDisconnect = true;
+                    send = false;
+                }
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                     {
-                        LogPrint("forks", "%s():%d - Pushing block [%s]\n", __func__, __LINE__, block.GetHash().ToString() );
-                        pfrom->PushMessage("block", block);
+                        // Only recent blocks are worth a compact form: the peer is unlikely
+                        // to have the transactions of older ones in its mempool.
+                        const bool fCompact = (inv.type == MSG_CMPCT_BLOCK &&
+                                               mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH);
+                        const CInv invMessage(fCompact ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash);
+
+                        CSharedMessage msg = GetRecentBlockMessage(invMessage);
+                        if (!msg)
+                        {
+                            // Send block from disk
+                            std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached((*mi).second);
+                            if (!pblock)
+                                assert(!"cannot load block from disk");
+                            if (fCompact)
+                                msg = MakeSharedMessage("cmpctblock", CBlockHeaderAndShortTxIDs(*pblock));
+                            else
+                                msg = MakeSharedMessage("block", *pblock);
+                            AddRecentBlockMessage(invMessage, msg);
+                        }
+                        if (!fCompact)
+                            LogPrint("forks", "%s():%d - Pushing block [%s]\n", __func__, __LINE__, inv.hash.ToString() );
+                        pfrom->PushSharedMessage(msg);
                     }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        // Send block from disk
+                        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached((*mi).second);
+                        if (!pblock)
+                            assert(!"cannot load block from disk");
+                        const CBlock& block = *pblock;
+
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -4935,8 +8655,15 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                            {
+                                bool fKnown;
+                                {
+                                    LOCK(pfrom->cs_inventory);
+                                    fKnown = pfrom->filterInventoryKnown.contains(pair.second);
+                                }
+                                if (!fKnown)
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
+                            }
                         }
                         // else
                             // no response
@@ -4976,11 +8703,11 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_TX) {
-                    CTransaction tx;
-                    if (mempool.lookup(inv.hash, tx)) {
+                    CTransactionRef ptx = mempool.get(inv.hash);
+                    if (ptx) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << tx;
+                        ss << *ptx;
                         pfrom->PushMessage("tx", ss);
                         pushed = true;
                     }
@@ -4993,7 +8720,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -5012,6 +8739,104 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/**
+ * With -highbandwidthrelay, push a block extending our tip to the whitelisted peers that
+ * asked for unsolicited cmpctblocks, as soon as its header and proof of work are checked.
+ * The rest of the validation only starts afterwards, so miners behind those peers learn
+ * about the block without waiting for it.
+ */
+void static RelayCompactBlockEarly(CNode* pfrom, const CBlock& block)
+{
+    if (!fHighBandwidthRelay || block.vtx.empty())
+        return;
+
+    const uint256 hash = block.GetHash();
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() == NULL || block.hashPrevBlock != chainActive.Tip()->GetBlockHash() ||
+            mapBlockIndex.count(hash))
+            return;
+    }
+
+    CValidationState state;
+    if (!CheckBlockHeader(block, state))
+        return;
+
+    // serialized once for all the peers
+    const CSharedMessage msg = MakeSharedMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+    const CInv inv(MSG_BLOCK, hash);
+
+    LOCK2(cs_main, cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        if (pnode == pfrom || !pnode->fWhitelisted || pnode->fDisconnect)
+            continue;
+        CNodeState *nodestate = State(pnode->GetId());
+        if (nodestate == NULL || !nodestate->fPreferHeaderAndIDs)
+            continue;
+        {
+            LOCK(pnode->cs_inventory);
+            if (pnode->filterInventoryKnown.contains(inv.hash))
+                continue;
+            pnode->filterInventoryKnown.insert(inv.hash);
+        }
+        LogPrint("net", "%s():%d - pushing cmpctblock %s to peer=%d before validation\n", __func__, __LINE__, hash.ToString(), pnode->id);
+        pnode->PushSharedMessage(msg);
+    }
+}
+
+/**
+ * The blocks of a compact filter request, every nInterval from the one at nStartHeight to
+ * hashStop along its chain. False, the peer disconnected or penalized, if the request is
+ * not to be served.
+ */
+static bool GetBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, uint32_t nStartHeight, const uint256& hashStop,
+                                  uint32_t nMaxBlocks, std::vector<uint256>& vHashes, int nInterval = 1)
+{
+    if (pblockfilterdb == NULL || !(nLocalServices & NODE_COMPACT_FILTERS) || nFilterType != BLOCK_FILTER_BASIC) {
+        LogPrint("net", "Peer %d requested filters of type %d, which we do not serve\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    LOCK(cs_main);
+    BlockMap::const_iterator mi = mapBlockIndex.find(hashStop);
+    if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+        LogPrint("net", "Peer %d requested filters up to a block we don't have\n", pfrom->id);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    const CBlockIndex* pindexStop = mi->second;
+    if (nStartHeight > (uint32_t)pindexStop->nHeight || pindexStop->nHeight - nStartHeight >= nMaxBlocks) {
+        Misbehaving(pfrom->GetId(), 100);
+        return error("peer %d requested the filters of %d blocks from %d to %d",
+                     pfrom->id, pindexStop->nHeight - (int)nStartHeight + 1, nStartHeight, pindexStop->nHeight);
+    }
+
+    for (int nHeight = nStartHeight; nHeight <= pindexStop->nHeight; nHeight += nInterval)
+        vHashes.push_back(pindexStop->GetAncestor(nHeight)->GetBlockHash());
+    return true;
+}
+
+/** Hand a block received from a peer, in full or rebuilt from a cmpctblock, to validation. */
+void static ProcessReceivedBlock(CNode* pfrom, CBlock& block)
+{
+    RelayCompactBlockEarly(pfrom, block);
+
+    CValidationState state;
+    // Process all blocks from whitelisted peers, even if not requested,
+    // unless we're still syncing with the network.
+    // Such an unrequested block may still be processed, subject to the
+    // conditions in AcceptBlock().
+    bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
+    if (nBlockCheckThreads) {
+        blockPipeline.Push(pfrom, block, forceProcessing);
+    } else {
+        const uint256 hash = block.GetHash();
+        ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
+        RejectBlock(pfrom, state, hash);
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
@@ -5086,7 +8911,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->fClient = !(pfrom->nServices & NODE_NETWORK);
 
         // Potentially mark this peer as a preferred download peer.
-        UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        {
+            LOCK(cs_main);
+            UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        }
 
         // Change version
         pfrom->PushMessage("verack");
@@ -5163,6 +8991,29 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // Tell the peer we can reconstruct blocks from compact blocks. Only whitelisted
+            // peers are asked to push them unsolicited, with -highbandwidthrelay; the others
+            // are sent a getdata with MSG_CMPCT_BLOCK.
+            bool fAnnounceUsingCMPCTBLOCK = fHighBandwidthRelay && pfrom->fWhitelisted;
+            uint64_t nCMPCTBLOCKVersion = 1;
+            pfrom->PushMessage("sendcmpct", fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+        }
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == 1) {
+            LOCK(cs_main);
+            CNodeState *nodestate = State(pfrom->GetId());
+            nodestate->fSupportsCompactBlocks = true;
+            nodestate->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
     }
 
 
@@ -5225,7 +9076,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             if (fReachable)
                 vAddrOk.push_back(addr);
         }
-        addrman.Add(vAddrOk, pfrom->addr, 2 * 60 * 60);
+        QueueAddresses(vAddrOk, pfrom->addr, 2 * 60 * 60);
         if (vAddr.size() < 1000)
             pfrom->fGetAddr = false;
         if (pfrom->fOneShot)
@@ -5291,8 +9142,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->PushMessage("getheaders", bl, inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        nodestate->nBlocksInFlight < nodestate->nMaxBlocksInFlight) {
+                        // Peers serving compact blocks send the block as a cmpctblock, which we
+                        // rebuild from our mempool.
+                        if (nodestate->fSupportsCompactBlocks)
+                            vToFetch.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                        else
+                            vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -5588,16 +9444,37 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "tx")
     {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify the JoinSplits before taking cs_main, so that the other message handler
+        // threads and block processing don't wait for them
+        CValidationState stateJoinSplits;
+        bool fJoinSplitsValid = CheckJoinSplitsWithoutLock(tx, stateJoinSplits);
+
         LOCK(cs_main);
 
+        if (!fJoinSplitsValid) {
+            // Rejected right away, AcceptToMemoryPool would only verify the proofs again
+            pfrom->setAskFor.erase(inv.hash);
+            mapAlreadyAskedFor.erase(inv);
+            assert(recentRejects);
+            recentRejects->insert(tx.GetHash());
+
+            int nDoS = 0;
+            stateJoinSplits.IsInvalid(nDoS);
+            LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
+                pfrom->id, pfrom->cleanSubVer, stateJoinSplits.GetRejectReason());
+            pfrom->PushMessage("reject", strCommand, stateJoinSplits.GetRejectCode(),
+                               stateJoinSplits.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+            if (nDoS > 0)
+                Misbehaving(pfrom->GetId(), nDoS);
+            return true;
+        }
+
         bool fMissingInputs = false;
         CValidationState state;
 
@@ -5608,66 +9485,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         {
             mempool.check(pcoinsTip);
             RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
 
             LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
                 pfrom->id, pfrom->cleanSubVer,
                 tx.GetHash().ToString(),
                 mempool.mapTx.size());
 
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        assert(recentRejects);
-                        recentRejects->insert(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
+            // Retry the orphan transactions that depended on this one, in batches from
+            // ProcessMessages
+            QueueOrphanWork(State(pfrom->GetId()), tx);
         }
         // TODO: currently, prohibit joinsplits from entering mapOrphans
         else if (fMissingInputs && tx.vjoinsplit.size() == 0)
@@ -5676,7 +9502,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
             // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
             unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, MAX_ORPHAN_TX_USAGE);
             if (nEvicted > 0)
                 LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
         } else {
@@ -5732,6 +9558,24 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // With -par, the proof of work of the headers not known yet is checked on the
+        // script check threads, without cs_main. Failures are left for AcceptBlockHeader
+        // to report, in order.
+        std::unique_ptr<bool[]> pfPOWValid(new bool[nCount]());
+        if (nScriptCheckThreads && nCount > 1) {
+            std::vector<CHeaderCheck> vChecks;
+            {
+                LOCK(cs_main);
+                for (unsigned int n = 0; n < nCount; n++)
+                    if (!mapBlockIndex.count(headers[n].GetHash()))
+                        vChecks.push_back(CHeaderCheck(headers[n], &pfPOWValid[n]));
+            }
+            LOCK(cs_headercheckqueue);
+            CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+            control.Add(vChecks);
+            control.Wait();
+        }
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -5751,7 +9595,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             
             bool lookForwardTips = (++cnt == MAX_HEADERS_RESULTS);
              
-            if (!AcceptBlockHeader(header, state, &pindexLast, lookForwardTips)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, lookForwardTips, !pfPOWValid[cnt - 1])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -5794,24 +9638,162 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->AddInventoryKnown(inv);
 
-        CValidationState state;
-        // Process all blocks from whitelisted peers, even if not requested,
-        // unless we're still syncing with the network.
-        // Such an unrequested block may still be processed, subject to the
-        // conditions in AcceptBlock().
-        bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            LogPrint("forks", "%s():%d - Pushing reject, DoS[%d]\n", __func__, __LINE__, nDoS);
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
-                LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+        ProcessReceivedBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex && !fReindexFast) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        const uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "%s():%d - received cmpctblock %s peer=%d\n", __func__, __LINE__, hash.ToString(), pfrom->id);
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            if (!AcceptBlockHeader(cmpctblock.header, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS)) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid header received in cmpctblock");
+                }
+                // An unsolicited cmpctblock may be ahead of the headers we know about
+                if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock))
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hash);
+                return true;
+            }
+
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+
+            if (pindex->nStatus & BLOCK_HAVE_DATA)
+                return true;
+
+            // Only reconstruct blocks we asked this peer for, or that a whitelisted peer
+            // pushed to us in high-bandwidth mode.
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId()) {
+                if (!fHighBandwidthRelay || !pfrom->fWhitelisted || itInFlight != mapBlocksInFlight.end() ||
+                    State(pfrom->GetId())->nBlocksInFlight >= State(pfrom->GetId())->nMaxBlocksInFlight) {
+                    LogPrint("net", "%s():%d - unrequested cmpctblock %s peer=%d, ignoring\n", __func__, __LINE__, hash.ToString(), pfrom->id);
+                    return true;
+                }
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+            }
+
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = std::make_shared<PartiallyDownloadedBlock>(&mempool);
+            ReadStatus status = partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(hash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid cmpctblock %s received from peer=%d", hash.ToString(), pfrom->id);
+            }
+            if (status == READ_STATUS_OK) {
+                BlockTransactionsRequest req;
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++)
+                    if (!partialBlock->IsTxAvailable(i))
+                        req.indexes.push_back(i);
+
+                if (!req.indexes.empty()) {
+                    CNodeState *nodestate = State(pfrom->GetId());
+                    nodestate->partialBlock = partialBlock;
+                    nodestate->hashPartialBlock = hash;
+                    req.blockhash = hash;
+                    pfrom->PushMessage("getblocktxn", req);
+                    return true;
+                }
+                status = partialBlock->FillBlock(block, std::vector<CTransactionRef>());
+            }
+            if (status != READ_STATUS_OK) {
+                // Short id collision or overloaded bucket: the block stays in flight and is
+                // requested in full.
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
+            }
+        }
+
+        ProcessReceivedBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Too old to be the block the peer is reconstructing: answer with the full
+            // block, through the checks of a plain getdata.
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex && !fReindexFast) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            CNodeState *nodestate = State(pfrom->GetId());
+            if (!nodestate->partialBlock || nodestate->hashPartialBlock != resp.blockhash) {
+                LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = nodestate->partialBlock->FillBlock(block, resp.txn);
+            nodestate->partialBlock.reset();
+            nodestate->hashPartialBlock.SetNull();
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer %d sent us invalid compact block/non-matching block transactions", pfrom->id);
+            }
+            if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now :(
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
             }
         }
 
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, resp.blockhash));
+        ProcessReceivedBlock(pfrom, block);
     }
 
 
@@ -5830,7 +9812,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -5846,10 +9831,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         vector<CInv> vInv;
         BOOST_FOREACH(uint256& hash, vtxid) {
             CInv inv(MSG_TX, hash);
-            CTransaction tx;
-            bool fInMemPool = mempool.lookup(hash, tx);
-            if (!fInMemPool) continue; // another thread removed since queryHashes, maybe...
-            if ((pfrom->pfilter && pfrom->pfilter->IsRelevantAndUpdate(tx)) ||
+            CTransactionRef ptx = mempool.get(hash);
+            if (!ptx) continue; // another thread removed since queryHashes, maybe...
+            if ((pfrom->pfilter && pfrom->pfilter->IsRelevantAndUpdate(*ptx)) ||
                (!pfrom->pfilter))
                 vInv.push_back(inv);
             if (vInv.size() == MAX_INV_SZ) {
@@ -5973,6 +9957,87 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "getcfilters")
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        std::vector<uint256> vHashes;
+        if (!GetBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFILTERS_SIZE, vHashes))
+            return true;
+        // The filters are built in the background: answer with those built already
+        for (const uint256& hash : vHashes) {
+            std::vector<unsigned char> vchFilter;
+            if (!pblockfilterdb->ReadFilter(hash, vchFilter)) {
+                LogPrint("net", "Peer %d requested the filter of block %s, not built yet\n", pfrom->id, hash.ToString());
+                break;
+            }
+            pfrom->PushMessage("cfilter", nFilterType, hash, vchFilter);
+        }
+    }
+
+
+    else if (strCommand == "getcfheaders")
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        std::vector<uint256> vHashes;
+        if (!GetBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFHEADERS_SIZE, vHashes))
+            return true;
+        uint256 hashPrevHeader;
+        CBlockFilterHeader header;
+        if (nStartHeight > 0) {
+            uint256 hashPrev;
+            {
+                LOCK(cs_main);
+                hashPrev = mapBlockIndex[vHashes[0]]->pprev->GetBlockHash();
+            }
+            if (!pblockfilterdb->ReadFilterHeader(hashPrev, header)) {
+                LogPrint("net", "Peer %d requested filter headers not built yet\n", pfrom->id);
+                return true;
+            }
+            hashPrevHeader = header.header;
+        }
+        std::vector<uint256> vFilterHashes;
+        for (const uint256& hash : vHashes) {
+            if (!pblockfilterdb->ReadFilterHeader(hash, header)) {
+                LogPrint("net", "Peer %d requested filter headers not built yet\n", pfrom->id);
+                return true;
+            }
+            vFilterHashes.push_back(header.hashFilter);
+        }
+        pfrom->PushMessage("cfheaders", nFilterType, hashStop, hashPrevHeader, vFilterHashes);
+    }
+
+
+    else if (strCommand == "getcfcheckpt")
+    {
+        uint8_t nFilterType;
+        uint256 hashStop;
+        vRecv >> nFilterType >> hashStop;
+
+        // The headers of every CFCHECKPT_INTERVAL blocks up to the stop block
+        std::vector<uint256> vHashes;
+        if (!GetBlockFilterRequest(pfrom, nFilterType, 0, hashStop, std::numeric_limits<uint32_t>::max(), vHashes, CFCHECKPT_INTERVAL))
+            return true;
+        std::vector<uint256> vHeaders;
+        for (size_t i = 1; i < vHashes.size(); i++) {
+            CBlockFilterHeader header;
+            if (!pblockfilterdb->ReadFilterHeader(vHashes[i], header)) {
+                LogPrint("net", "Peer %d requested filter headers not built yet\n", pfrom->id);
+                return true;
+            }
+            vHeaders.push_back(header.header);
+        }
+        pfrom->PushMessage("cfcheckpt", nFilterType, hashStop, vHeaders);
+    }
+
+
     else if (strCommand == "filterload")
     {
         CBloomFilter filter;
@@ -6082,6 +10147,20 @@ bool ProcessMessages(CNode* pfrom)
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    pfrom->fMoreWork = false;
+    if (nOrphanWorkQueued > 0) {
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (state && !state->setOrphanWork.empty()) {
+            ProcessOrphanWork(pfrom);
+            // The next messages of the peer may depend on the orphans, finish them first
+            if (!state->setOrphanWork.empty()) {
+                pfrom->fMoreWork = true;
+                return fOk;
+            }
+        }
+    }
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -6218,6 +10297,35 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             }
         }
 
+        // Banning and block rejections don't wait for cs_main
+        CPeerRef peer = GetPeer(pto->GetId());
+        if (peer) {
+            bool fShouldBan;
+            std::vector<CBlockReject> rejects;
+            {
+                LOCK(peer->cs);
+                fShouldBan = peer->fShouldBan;
+                peer->fShouldBan = false;
+                rejects.swap(peer->rejects);
+            }
+            if (fShouldBan) {
+                if (pto->fWhitelisted)
+                    LogPrintf("Warning: not punishing whitelisted peer %s!\n", pto->addr.ToString());
+                else {
+                    pto->fDisconnect = true;
+                    if (pto->addr.IsLocal())
+                        LogPrintf("Warning: not banning local peer %s!\n", pto->addr.ToString());
+                    else
+                    {
+                        CNode::Ban(pto->addr);
+                    }
+                }
+            }
+
+            BOOST_FOREACH(const CBlockReject& reject, rejects)
+                pto->PushMessage("reject", (string)"block", reject.chRejectCode, reject.strRejectReason, reject.hashBlock);
+        }
+
         TRY_LOCK(cs_main, lockMain); // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
         if (!lockMain)
             return true;
@@ -6230,8 +10338,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->addrKnown.reset();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -6246,6 +10356,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (fSendTrickle)
         {
             vector<CAddress> vAddr;
+            LOCK(pto->cs_vAddrToSend);
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
@@ -6267,24 +10378,6 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         }
 
         CNodeState &state = *State(pto->GetId());
-        if (state.fShouldBan) {
-            if (pto->fWhitelisted)
-                LogPrintf("Warning: not punishing whitelisted peer %s!\n", pto->addr.ToString());
-            else {
-                pto->fDisconnect = true;
-                if (pto->addr.IsLocal())
-                    LogPrintf("Warning: not banning local peer %s!\n", pto->addr.ToString());
-                else
-                {
-                    CNode::Ban(pto->addr);
-                }
-            }
-            state.fShouldBan = false;
-        }
-
-        BOOST_FOREACH(const CBlockReject& reject, state.rejects)
-            pto->PushMessage("reject", (string)"block", reject.chRejectCode, reject.strRejectReason, reject.hashBlock);
-        state.rejects.clear();
 
         // Start block sync
         if (pindexBestHeader == NULL)
@@ -6329,38 +10422,48 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: inventory
         //
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
+            vInv.reserve(std::min<size_t>(pto->vInventoryToSend.size() + pto->setInventoryTxToSend.size(), 1000));
+
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->filterInventoryKnown.contains(inv.hash))
                     continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+                pto->filterInventoryKnown.insert(inv.hash);
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000)
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
-
-                    if (fTrickleWait)
-                    {
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
+                    LogPrint("forks", "%s():%d - Pushing inv\n", __func__, __LINE__);
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
-
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+            }
+            pto->vInventoryToSend.clear();
+
+            // Transactions are announced in batches, at random intervals per peer: this keeps
+            // the number of inv messages low when many transactions are relayed at once, and
+            // makes it harder to tell which peer a transaction came from.
+            // Whitelisted peers get them right away.
+            int64_t nNow = GetTimeMicros();
+            bool fSendTxs = pto->fWhitelisted || pto->nNextInvSend < nNow;
+            if (pto->nNextInvSend < nNow)
+                pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+            if (fSendTxs)
+            {
+                // At most INVENTORY_BROADCAST_MAX at once, so that a burst of transactions does not
+                // flood the peer; the others stay queued for the next announcement.
+                unsigned int nRelayedTxs = 0;
+                std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin();
+                while (it != pto->setInventoryTxToSend.end() && nRelayedTxs < INVENTORY_BROADCAST_MAX)
                 {
-                    vInv.push_back(inv);
+                    const uint256 hash = *it;
+                    pto->setInventoryTxToSend.erase(it++);
+                    if (pto->filterInventoryKnown.contains(hash))
+                        continue;
+                    pto->filterInventoryKnown.insert(hash);
+                    vInv.push_back(CInv(MSG_TX, hash));
+                    nRelayedTxs++;
                     if (vInv.size() >= 1000)
                     {
                         LogPrint("forks", "%s():%d - Pushing inv\n", __func__, __LINE__);
@@ -6369,7 +10472,6 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
             }
-            pto->vInventoryToSend = vInvWait;
         }
         if (!vInv.empty())
         {
@@ -6413,10 +10515,28 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (pto->nMinPingUsecTime != std::numeric_limits<int64_t>::max())
+            state.nPingRTT = pto->nMinPingUsecTime;
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nMaxBlocksInFlight) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex* pindexStalled = NULL;
+            FindNextBlocksToDownload(pto->GetId(), state.nMaxBlocksInFlight - state.nBlocksInFlight, vToDownload, staller, pindexStalled);
+            if (vToDownload.empty() && staller != -1 && pindexStalled != NULL && state.nAvgBlockServiceTime != 0) {
+                // The download window waits for a block from another peer. If we measured this peer as
+                // faster, and the block is late compared to what this peer would need, ask this peer for
+                // it instead of waiting for the other one to be disconnected for stalling.
+                const CNodeState* stallerState = State(staller);
+                const QueuedBlock& queuedBlock = *mapBlocksInFlight[pindexStalled->GetBlockHash()].second;
+                if ((stallerState->nAvgBlockServiceTime == 0 || state.nAvgBlockServiceTime < stallerState->nAvgBlockServiceTime) &&
+                    nNow - queuedBlock.nTime > 2 * state.nAvgBlockServiceTime + state.nPingRTT) {
+                    LogPrint("net", "Requesting block %s (%d) stalled by peer=%d from faster peer=%d\n",
+                        pindexStalled->GetBlockHash().ToString(), pindexStalled->nHeight, staller, pto->id);
+                    vToDownload.push_back(pindexStalled);
+                    staller = -1;
+                }
+            }
+            FindNextSnapshotBlocksToDownload(pto->GetId(), state.nMaxBlocksInFlight - state.nBlocksInFlight, vToDownload);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
@@ -6471,15 +10591,13 @@ class CMainCleanup
 public:
     CMainCleanup() {}
     ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        // block headers, freed with blockIndexArena
         mapBlockIndex.clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapOrphansByPeer.clear();
     }
 } instance_of_cmaincleanup;
 
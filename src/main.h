@@ -13,8 +13,10 @@
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "clientversion.h"
 #include "net.h"
 #include "script/script.h"
+#include "streams.h"
 #include "sync.h"
 #include "tinyformat.h"
 #include "txmempool.h"
@@ -24,6 +26,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -35,14 +38,29 @@
 class CTransaction;
 class CCoins;
 class CCoinsViewCache;
+class CCoinsViewDB;
 class CCoinsView;
 class CBlock;
 class CBlockLocator;
+class CBlockHashSnapshot;
+class CBlockUndo;
+class CBlockFilterDB;
 class CBlockTreeDB;
+class CAddressIndexDB;
+class CNoteScanDB;
 class CScriptCheck;
+class CJoinSplitCheck;
+class CHeaderCheck;
 class CValidationState;
 
 struct CNodeStateStats;
+struct CNoteScanKey;
+struct PrecomputedTransactionData;
+
+namespace libzcash {
+class PaymentAddress;
+class ViewingKey;
+}
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = MAX_BLOCK_SIZE;
@@ -61,8 +79,26 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_STANDARD_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Interval in seconds between two sweeps of the mempool for expired transactions */
+static const int64_t MEMPOOL_EXPIRY_SWEEP_INTERVAL = 10 * 60;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Maximum number of orphan transactions kept from a single peer */
+static const unsigned int MAX_ORPHAN_TRANSACTIONS_PER_PEER = 25;
+/** Maximum serialized size of an orphan transaction */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Maximum memory used by all the orphan transactions */
+static const size_t MAX_ORPHAN_TX_USAGE = 10 * 1000 * 1000;
+/** Maximum number of orphan transactions retried for a peer in one round of its message processing */
+static const unsigned int MAX_ORPHAN_WORK_BATCH = 10;
+/** Default for -maxjoinsplitcachesize, maximum number of transactions with already verified JoinSplits kept in memory */
+static const unsigned int DEFAULT_MAX_JOINSPLIT_CACHE_SIZE = 20000;
+/** Default for -blockservecache, MiB of the blocks most recently served to peers and REST clients kept in memory */
+static const unsigned int DEFAULT_BLOCK_SERVE_CACHE = 32;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -73,8 +109,56 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Maximum number of threads running context-free checks of received blocks */
+static const int MAX_BLOCKCHECK_THREADS = 16;
+/** -blockcheckthreads default (0 = check received blocks on the message handler thread) */
+static const int DEFAULT_BLOCKCHECK_THREADS = 0;
+/** Maximum number of received blocks queued for checking and connection before the message handler waits */
+static const unsigned int MAX_BLOCKS_IN_PIPELINE = 64;
+/** Maximum number of threads reading and checking block files on reindex */
+static const int MAX_REINDEX_THREADS = 8;
+/** Maximum number of block files read ahead of the one being imported, on the full blocks reindex pass */
+static const int MAX_REINDEX_FILES_AHEAD = 4;
+/** Maximum number of transaction positions queued for the transaction index before connecting blocks waits */
+static const size_t TXINDEX_MAX_QUEUED_TX = 200000;
+/** -addressindex default */
+static const bool DEFAULT_ADDRESSINDEX = false;
+/** Number of entries changed in the address index after which they are written, when catching up */
+static const size_t ADDRESSINDEX_BATCH_CHANGES = 200000;
+/** -notescan default */
+static const bool DEFAULT_NOTESCAN = false;
+/** Number of entries changed in the note scan database after which they are written */
+static const size_t NOTESCAN_BATCH_CHANGES = 10000;
+/** -blockfilterindex default */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** Number of block filters built after which they are written, when catching up */
+static const size_t BLOCKFILTER_BATCH_SIZE = 1000;
+/** -blockcompression default */
+static const bool DEFAULT_BLOCK_COMPRESSION = false;
+/** -compactundo default */
+static const bool DEFAULT_COMPACT_UNDO = true;
+/** Maximum bytes of undo records queued for writing before connecting blocks waits */
+static const size_t UNDO_MAX_QUEUED_BYTES = 32 * 1024 * 1024;
+/** Flag of the size field heading a block or undo record, set when the record is compressed */
+static const unsigned int DISK_RECORD_COMPRESSED = 0x80000000;
+/** Number of blocks that can be requested at any given time from a single peer, until its
+ *  throughput and round trip time are measured. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the number of blocks in flight from a single peer, once adapted to the peer. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 4;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 128;
+/** Maximum depth of a block we still answer a MSG_CMPCT_BLOCK request with a cmpctblock for. */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of a block we still answer a getblocktxn request for; deeper ones are sent in full. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** -highbandwidthrelay default (push compact blocks to whitelisted peers before full validation) */
+static const bool DEFAULT_HIGH_BANDWIDTH_RELAY = false;
+/** Average delay in seconds between the transaction announcements to an inbound peer, halved for outbound peers.
+ *  The transactions accepted in the meantime are announced together. */
+static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
+/** Maximum number of transactions announced to a peer at once, 7 per second of the average interval.
+ *  The rest waits for the next announcement. */
+static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -85,10 +169,14 @@ static const unsigned int MAX_HEADERS_RESULTS = 160;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Number of blocks the validation of a chainstate snapshot connects at once, before releasing cs_main. */
+static const unsigned int SNAPSHOT_VALIDATION_BATCH_SIZE = 16;
+/** Depth below the best header from which the block index entries keep their Equihash solutions on disk only. */
+static const int BLOCK_INDEX_TRIM_DEPTH = 1000;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
-/** Time to wait (in seconds) between flushing chainstate to disk. */
-static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Time to wait (in seconds) between writing the chainstate to disk in the background. */
+static const unsigned int DATABASE_FLUSH_INTERVAL = 60 * 60;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /* Maximum number of heigths meaningful when looking for block finality */
@@ -122,14 +210,29 @@ extern bool fImporting;
 extern bool fReindex;
 extern bool fReindexFast;
 extern int nScriptCheckThreads;
+extern int nBlockCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
+/** Whether CheckBlockIndex only re-checks the parts of the block tree changed since its last call */
+extern bool fCheckBlockIndexIncremental;
+/** Whether whitelisted peers asking for it get new blocks pushed as cmpctblocks once their header and PoW are checked */
+extern bool fHighBandwidthRelay;
 extern bool fCheckpointsEnabled;
+/** Whether new block and undo records are stored compressed (-blockcompression) */
+extern bool fBlockCompression;
+/** Whether new undo records are stored in the compact format of CBlockUndoCompactor (-compactundo) */
+extern bool fCompactUndo;
+/** Block hash whose ancestors will be assumed to have valid scripts and JoinSplit proofs (null = check everything) */
+extern uint256 hashAssumeValid;
+/** Chain work the best header chain needs before -assumevalid skips any check */
+extern arith_uint256 nMinimumChainWork;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedProtectionEnabled;
 extern size_t nCoinCacheUsage;
+extern size_t nBlockServeCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -153,6 +256,8 @@ extern BlockTimeMap mGlobalForkTips;
 
 typedef std::set<const CBlockIndex*, CompareBlocksByHeight> BlockSet;
 extern BlockSet sGlobalForkTips;
+/** Incremented whenever the active tip or the set of global fork tips changes (protected by cs_main) */
+extern uint64_t nGlobalTipsVersion;
 static const int MAX_NUM_GLOBAL_FORKS = 3;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
@@ -170,6 +275,15 @@ extern bool fPruneMode;
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Number of blocks below the tip whose files are never pruned (-prunekeepblocks, at least MIN_BLOCKS_TO_KEEP) */
+extern unsigned int nPruneKeepBlocks;
+/** Number of the most read block files which pruning leaves for last (-prunehotfiles) */
+extern unsigned int nPruneHotFiles;
+static const unsigned int DEFAULT_PRUNE_HOT_FILES = 4;
+/** Half-life, in seconds, of the reads counted for each block file */
+static const int64_t PRUNE_HEAT_HALF_LIFE = 24 * 60 * 60;
+/** Decayed number of reads from which a block file counts as hot */
+static const double PRUNE_HOT_MIN_HEAT = 1.0;
 
 // Require that user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
@@ -207,8 +321,50 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
+/** Rewrite the block and undo files written before -blockcompression was set, one at a time */
+void ThreadCompressBlockFiles();
+/**
+ * Start writing the transaction index in the background from the blocks connected, after
+ * indexing those connected since the last block written to it
+ */
+void StartTxIndexer();
+/** Write the positions queued for the transaction index and stop */
+void StopTxIndexer();
+/** Start writing the undo data of the blocks connected in the background */
+void StartUndoWriter();
+/** Write the undo data queued and stop; ConnectBlock then writes it itself */
+void StopUndoWriter();
+/**
+ * Start bringing the address index up to the active chain in the background, from the
+ * last block written to it, and following the chain from then on
+ */
+void StartAddressIndexer();
+void StopAddressIndexer();
+/**
+ * Start scanning the blocks connected for the notes of the viewing keys watched, from the
+ * last block written to the note scan database or the tip
+ */
+void StartNoteScanner();
+void StopNoteScanner();
+/** Watch a viewing key, scanning the blocks from nStartHeight for it. False if it is already watched */
+bool WatchViewingKey(const libzcash::ViewingKey& vk, int nStartHeight);
+/** Stop watching the viewing key of address and forget its notes. False if it is not watched */
+bool UnwatchAddress(const libzcash::PaymentAddress& address);
+/** The viewing keys watched, and returns the height the keys following the chain are scanned to */
+int GetWatchedKeys(std::vector<CNoteScanKey>& vKeys);
+/**
+ * Start building the filters of the blocks of the active chain in the background, from the
+ * last block written to the block filter index, and following the chain from then on
+ */
+void StartBlockFilterIndexer();
+void StopBlockFilterIndexer();
 /** Import blocks from an external file, possibly headers only */
 bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeadersOnly);
+/**
+ * Import the blocks of the block files in order for a reindex, possibly headers only. The files are
+ * read and the blocks checked ahead on up to MAX_REINDEX_THREADS threads.
+ */
+bool ReindexBlockFiles(bool loadHeadersOnly);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
@@ -226,6 +382,91 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the JoinSplit proof checking thread */
+void ThreadJoinSplitCheck();
+/** Run an instance of the header proof of work checking thread */
+void ThreadHeaderCheck();
+/** Run an instance of the thread reading the coins of a block's inputs before it is connected */
+void ThreadCoinsFetch();
+
+/** The verifications run by a check queue, for the metrics endpoint */
+struct CheckQueueInfo
+{
+    std::string name;
+    //! Threads running them, the one of the master included
+    unsigned int nThreads;
+    unsigned int nPending;
+    uint64_t nChecks;
+    //! Time the threads spent running them, in microseconds
+    int64_t nBusyTime;
+};
+
+/** The script, JoinSplit proof and header proof of work check queues */
+std::vector<CheckQueueInfo> GetCheckQueueInfo();
+
+//! Blocks connected to the tip whose validation times getblockvalidationstats keeps
+static const size_t BLOCK_VALIDATION_STATS_SIZE = 1000;
+
+/** Where the time connecting a block to the tip went, in microseconds */
+struct BlockValidationStats
+{
+    uint256 hash;
+    int nHeight;
+    unsigned int nTx;
+    unsigned int nInputs;
+    //! When the block was connected, in seconds since the epoch
+    int64_t nTime;
+    int64_t nReadTime;
+    //! Reading the coins spent by the block from the database ahead of connecting it
+    int64_t nCoinsFetchTime;
+    //! Checking the block again, the JoinSplit proofs verified inline, and waiting for the ones verified in parallel
+    int64_t nProofTime;
+    //! Connecting the transactions to the coins, the script checks on the calling thread included
+    int64_t nConnectTime;
+    //! Waiting for the script checks running in parallel
+    int64_t nScriptTime;
+    int64_t nUndoTime;
+    //! Writing the block index, the undo data included
+    int64_t nIndexTime;
+    int64_t nCallbacksTime;
+    int64_t nFlushTime;
+    int64_t nChainStateTime;
+    //! Notifying the wallets and the ChainTip subscribers
+    int64_t nNotifyTime;
+    //! Updating the mempool and the tip, the notifications included
+    int64_t nPostProcessTime;
+    int64_t nTotalTime;
+
+    BlockValidationStats() : nHeight(-1), nTx(0), nInputs(0), nTime(0), nReadTime(0), nCoinsFetchTime(0), nProofTime(0),
+        nConnectTime(0), nScriptTime(0), nUndoTime(0), nIndexTime(0), nCallbacksTime(0), nFlushTime(0),
+        nChainStateTime(0), nNotifyTime(0), nPostProcessTime(0), nTotalTime(0) {}
+};
+
+/** The last nCount blocks connected to the tip of the BLOCK_VALIDATION_STATS_SIZE kept, the latest first */
+std::vector<BlockValidationStats> GetBlockValidationStats(size_t nCount);
+
+/** The memory the block index takes, the headers and their Equihash solutions included. Requires cs_main */
+size_t BlockIndexDynamicUsage();
+/** The memory the orphan transactions take, with the maps finding them by outpoint and by peer. Requires cs_main */
+size_t OrphanTxDynamicUsage();
+
+/** Run an instance of the thread performing context-free checks of received blocks */
+void ThreadBlockPreCheck();
+/** Run the thread handing pre-checked blocks to validation, in the order they were received */
+void ThreadBlockConnect();
+/** Run the background validation of a chainstate loaded from a snapshot, if it has not been validated yet,
+ *  after loading the pending snapshot if there is one */
+void ThreadSnapshotValidation();
+/** Have the chainstate filled from the given snapshot file, of the given block, as soon as the block
+ *  index has that block. Until then, no block past the genesis block is connected. Requires cs_main */
+void SetSnapshotPending(const boost::filesystem::path &path, const uint256 &hashBlock);
+/** Whether a snapshot set by SetSnapshotPending() is still to be loaded. Requires cs_main */
+bool IsSnapshotPending();
+/** Load the pending snapshot if the block index has its block by now. Only returns false on failure. Must not be
+ *  called with cs_main held, which is only taken to switch the tip */
+bool LoadPendingSnapshot();
+/** Heights of the snapshot block and of the background chainstate, if one is validating a snapshot */
+bool GetSnapshotValidationProgress(int &nSnapshotHeight, int &nValidatedHeight);
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -249,6 +490,8 @@ int getCheckBlockAtHeightMinAge();
 bool getRequireStandard();
 
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
+/** The outputs the coinbase of a block at the height must have for the community funds, cached per height */
+std::vector<CTxOut> GetCommunityFundOutputs(int nHeight, const CChainParams& chainparams);
 
 /**
  * Prune block and undo files (blk???.dat and undo???.dat) so that the disk space used is less than a user-defined target.
@@ -256,10 +499,12 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
  * space is allocated in a block or undo file, staying below the target. Changing back to unpruned requires a reindex
  * (which in this case means the blockchain must be re-downloaded.)
  *
- * Pruning functions are called from FlushStateToDisk when the global fCheckForPruning flag has been set.
+ * Pruning functions are called from FlushStateToDisk when the global fCheckForPruning flag has been set,
+ * which then unlinks the files on another thread.
  * Block and undo files are deleted in lock-step (when blk00003.dat is deleted, so is rev00003.dat.)
  * Pruning cannot take place until the longest chain is at least a certain length (100000 on mainnet, 1000 on testnet, 10 on regtest).
- * Pruning will never delete a block within a defined distance (currently 288) from the active chain's tip.
+ * Pruning will never delete a block within nPruneKeepBlocks (at least 288) of the active chain's tip.
+ * Up to nPruneHotFiles of the files read the most for serving blocks are pruned only if the others are not enough.
  * The block index is updated by unsetting HAVE_DATA and HAVE_UNDO for any blocks that were stored in the deleted files.
  * A db flag records the fact that at least some block files have been pruned.
  *
@@ -272,21 +517,52 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune);
  */
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
+/** Count a read of a block for serving it (to peers or clients), which makes its file hotter for pruning */
+void NoteBlockFileRead(int nFile);
+
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
-/** Increase a node's misbehavior score. */
+/** Increase a node's misbehavior score. Doesn't need cs_main, the score is under the lock of the peer. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Remove the transactions older than -mempoolexpiry from the mempool, run by the scheduler */
+void ExpireMempoolTransactions();
+
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectAbsurdFee=false);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee=false);
+
+/** Maximum number of transactions of a package submitted together to the memory pool */
+static const unsigned int MAX_PACKAGE_COUNT = 25;
+
+/**
+ * (try to) add an ordered package of transactions to memory pool, each one spending
+ * confirmed outputs or outputs of the transactions before it. The JoinSplit proofs of
+ * the whole package are verified up front on the -par threads. Stops at the first
+ * rejected transaction, whose reason is left in state.
+ * @param[out] nAccepted number of transactions of the package now in the memory pool
+ */
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, CValidationState &state, const std::vector<CTransaction>& package,
+                               size_t& nAccepted, bool* pfMissingInputs, bool fRejectAbsurdFee=false);
+
+/** Save the mempool to mempool.dat, with the fee deltas of PrioritiseTransaction */
+bool DumpMempool();
+
+/** Load the mempool saved by DumpMempool, through AcceptToMemoryPool */
+bool LoadMempool();
+
 /** Get the BIP9 state for a given deployment at the current tip. */
 ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::DeploymentPos pos);
 
@@ -298,6 +574,7 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nMaxBlocksInFlight;
 };
 
 struct CDiskTxPos : public CDiskBlockPos
@@ -323,6 +600,31 @@ struct CDiskTxPos : public CDiskBlockPos
         CDiskBlockPos::SetNull();
         nTxOffset = 0;
     }
+
+    friend bool operator==(const CDiskTxPos &a, const CDiskTxPos &b) {
+        return (const CDiskBlockPos&)a == (const CDiskBlockPos&)b && a.nTxOffset == b.nTxOffset;
+    }
+};
+
+/**
+ * A position in the transaction index. The transactions are keyed by the first 64 bits
+ * of their txid; nCheck holds the next 32 to tell apart the ones sharing a key.
+ */
+struct CTxIndexEntry
+{
+    uint32_t nCheck;
+    CDiskTxPos pos;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nCheck);
+        READWRITE(pos);
+    }
+
+    CTxIndexEntry() : nCheck(0) {}
+    CTxIndexEntry(uint32_t nCheckIn, const CDiskTxPos& posIn) : nCheck(nCheckIn), pos(posIn) {}
 };
 
 
@@ -366,12 +668,11 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
- * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * This does not modify the UTXO set. The scripts are checked inline if fScriptChecks is set;
+ * ConnectBlock queues them for the script check threads itself, once the inputs are spent.
  */
 bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                           const CChain& chain, unsigned int flags, bool cacheStore, const Consensus::Params& consensusParams,
-                           std::vector<CScriptCheck> *pvChecks = NULL);
+                           const CChain& chain, unsigned int flags, bool cacheStore, const Consensus::Params& consensusParams);
 
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state, int nHeight, int dosLevel,
@@ -382,7 +683,14 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 /** Context-independent validity checks */
 bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier);
-bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state);
+bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state, bool fCheckJoinSplitSig = true);
+/**
+ * Verify the JoinSplit proofs and joinSplitSig of a transaction, which needs no lock, and
+ * remember them as valid so that AcceptToMemoryPool, called afterwards under cs_main, skips
+ * them. Returns false, with the reason in state, if they don't verify: the caller rejects
+ * the transaction then, rather than have AcceptToMemoryPool verify the proofs again.
+ */
+bool CheckJoinSplitsWithoutLock(const CTransaction& tx, CValidationState& state);
 
 /** Check for standard transaction types
  * @return True if all outputs (scriptPubKeys) use only standard transaction forms
@@ -406,45 +714,169 @@ bool CheckFinalTx(const CTransaction &tx, int flags = -1);
 
 /** 
  * Closure representing one script verification
- * Note that this stores references to the spending transaction 
+ * Note that this stores references to the spending transaction and to the script
+ * spent, which must outlive it, so that queuing a check copies no script
  */
 class CScriptCheck
 {
 private:
-    CScript scriptPubKey;
+    const CScript *scriptPubKey;
     const CTransaction *ptxTo;
     unsigned int nIn;
     const CChain *chain;
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error;
+    //! Shared by the checks of the inputs of ptxTo
+    std::shared_ptr<const PrecomputedTransactionData> txdata;
+    //! The block hashes OP_CHECKBLOCKATHEIGHT compares against instead of chain, if set
+    const CBlockHashSnapshot *hashes;
 
 public:
-    CScriptCheck(): ptxTo(0), nIn(0), chain(nullptr), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, const CChain* chainIn, unsigned int nFlagsIn, bool cacheIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), chain(chainIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+    CScriptCheck(): scriptPubKey(0), ptxTo(0), nIn(0), chain(nullptr), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), hashes(nullptr) {}
+    CScriptCheck(const CScript& scriptPubKeyIn, const CTransaction& txToIn, unsigned int nInIn, const CChain* chainIn, unsigned int nFlagsIn, bool cacheIn,
+                 const std::shared_ptr<const PrecomputedTransactionData>& txdataIn = nullptr, const CBlockHashSnapshot* hashesIn = nullptr) :
+        scriptPubKey(&scriptPubKeyIn),
+        ptxTo(&txToIn), nIn(nInIn), chain(chainIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn),
+        hashes(hashesIn) { }
 
     bool operator()();
 
     void swap(CScriptCheck &check) {
-        scriptPubKey.swap(check.scriptPubKey);
+        std::swap(scriptPubKey, check.scriptPubKey);
         std::swap(ptxTo, check.ptxTo);
         std::swap(nIn, check.nIn);
         std::swap(chain, check.chain);
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
+        txdata.swap(check.txdata);
+        std::swap(hashes, check.hashes);
     }
 
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the zk-SNARK proof check of one JoinSplit description,
+ * so that the proofs of a block can be verified in parallel with its scripts.
+ */
+class CJoinSplitCheck
+{
+private:
+    const CTransaction *ptx;
+    unsigned int nJoinSplit;
+
+public:
+    CJoinSplitCheck(): ptx(0), nJoinSplit(0) {}
+    CJoinSplitCheck(const CTransaction& txIn, unsigned int nJoinSplitIn) :
+        ptx(&txIn), nJoinSplit(nJoinSplitIn) { }
+
+    bool operator()();
+
+    void swap(CJoinSplitCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(nJoinSplit, check.nJoinSplit);
+    }
+};
+
+/**
+ * Closure representing the context-free proof of work check (Equihash solution
+ * and target) of one received header. The outcome is stored rather than
+ * returned, so that failures can be reported in order by AcceptBlockHeader.
+ */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader *pheader;
+    bool *pfValid;
+
+public:
+    CHeaderCheck(): pheader(0), pfValid(0) {}
+    CHeaderCheck(const CBlockHeader& headerIn, bool* pfValidIn) :
+        pheader(&headerIn), pfValid(pfValidIn) { }
+
+    bool operator()();
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+
+/**
+ * A block or undo entry as stored after the message start and size field of its
+ * record: its serialization, or, if asked for and smaller, the size of that
+ * serialization followed by its LZCompress output.
+ */
+class CDiskRecord
+{
+private:
+    void Init(const char* pbegin, const char* pend, bool fCompress);
+
+public:
+    //! Value of the size field heading the record
+    unsigned int nSizeField;
+    std::vector<char> vData;
+
+    CDiskRecord(const char* pbegin, const char* pend, bool fCompress) { Init(pbegin, pend, fCompress); }
+
+    template <typename T>
+    CDiskRecord(const T& obj, bool fCompress)
+    {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << obj;
+        Init(&ss[0], &ss[0] + ss.size(), fCompress);
+    }
+
+    size_t size() const { return vData.size(); }
+    bool IsCompressed() const { return nSizeField & DISK_RECORD_COMPRESSED; }
+};
+
+/**
+ * The serialization stored in a compressed record, whose nSize bytes after the
+ * size field are at p.
+ * @return false if the record is corrupt
+ */
+bool DecompressDiskRecord(const char* p, size_t nSize, std::vector<char>& vOut);
+
+/**
+ * Deserialize obj from a record of a block or undo file, read from s after the
+ * size field nSizeField. Throws std::ios_base::failure if the record is corrupt.
+ */
+template <typename Stream, typename T>
+void ReadDiskRecord(Stream& s, unsigned int nSizeField, T& obj)
+{
+    if (!(nSizeField & DISK_RECORD_COMPRESSED)) {
+        s >> obj;
+        return;
+    }
+    std::vector<char> vRecord(nSizeField & ~DISK_RECORD_COMPRESSED);
+    s.read(vRecord.data(), vRecord.size());
+    std::vector<char> vRaw;
+    if (!DecompressDiskRecord(vRecord.data(), vRecord.size(), vRaw))
+        throw std::ios_base::failure("ReadDiskRecord(): corrupt compressed record");
+    CMemoryReader reader(vRaw.data(), vRaw.data() + vRaw.size(), SER_DISK, CLIENT_VERSION);
+    reader >> obj;
+}
 
 /** Functions for disk access for blocks */
+bool WriteBlockToDisk(const CDiskRecord& record, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/**
+ * Read the serialization of the block hash at pos as stored, without deserializing it, for
+ * serving it as it is. Only its header is checked. Does not require cs_main.
+ */
+bool ReadRawBlockFromDisk(std::vector<char>& vBlock, const CDiskBlockPos& pos, const uint256& hash);
+/**
+ * Read a block for serving it, through an LRU cache of the blocks read this way (nBlockServeCacheUsage
+ * bytes of serialized blocks). A new tip is requested by most peers within a second.
+ * @return NULL if the block could not be read
+ */
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex);
 CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos);
 
 /** Functions for validating blocks and updating the block tree */
@@ -454,6 +886,8 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos);
  *  will be true if no problems were found. Otherwise, the return value will be false in case
  *  of problems. Note that in any case, coins may be modified. */
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+/** Undo this block as DisconnectBlock does, with its undo data already read */
+bool DisconnectBlock(const CBlock& block, const CBlockUndo& blockUndo, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, const CChain& chain, bool fJustCheck = false);
@@ -482,7 +916,7 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
  * If dbp is non-NULL, the file is known to already reside on disk
  */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, bool fRequested, CDiskBlockPos* dbp, BlockSet* sForkTips = NULL);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, bool lookForwardTips = false);
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, bool lookForwardTips = false, bool fCheckPOW = true);
 
 
 
@@ -551,6 +985,9 @@ public:
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
+/** Find a block index entry by hash, taking cs_main only for the lookup. Returns NULL if unknown. */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
+
 /** Mark a block as invalid. */
 bool InvalidateBlock(CValidationState& state, CBlockIndex *pindex);
 
@@ -560,12 +997,62 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks. */
 extern CChain chainActive;
 
+/**
+ * Immutable summary of the tip of chainActive. A new one is published every
+ * time the tip changes, so readers can hold on to it without cs_main: the
+ * block index entries it points to are never freed while the node runs.
+ */
+struct CChainTipView
+{
+    const CBlockIndex *pindex;
+    int nHeight;
+    int64_t nMedianTimePast;
+    arith_uint256 nChainWork;
+
+    CChainTipView() : pindex(NULL), nHeight(-1), nMedianTimePast(0) {}
+    explicit CChainTipView(const CBlockIndex *pindexIn);
+
+    /** Returns the block of the chain at the given height, or NULL. */
+    const CBlockIndex *operator[](int nHeightIn) const {
+        if (pindex == NULL || nHeightIn < 0 || nHeightIn > nHeight)
+            return NULL;
+        return pindex->GetAncestor(nHeightIn);
+    }
+
+    /** Whether the given block is part of the chain ending at this tip. */
+    bool Contains(const CBlockIndex *pindexIn) const {
+        return (*this)[pindexIn->nHeight] == pindexIn;
+    }
+
+    /** Returns the successor of the given block in the chain, or NULL. */
+    const CBlockIndex *Next(const CBlockIndex *pindexIn) const {
+        return Contains(pindexIn) ? (*this)[pindexIn->nHeight + 1] : NULL;
+    }
+};
+
+typedef std::shared_ptr<const CChainTipView> CChainTipViewRef;
+
+/** The latest published view of the chainActive tip, which does not require cs_main */
+CChainTipViewRef GetChainTipView();
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the coins database underlying pcoinsTip */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** The address and spent indexes of -addressindex, NULL without it */
+extern CAddressIndexDB *paddressindex;
+
+/** The notes of the viewing keys watched by -notescan, NULL without it */
+extern CNoteScanDB *pnotescandb;
+
+/** The compact block filters of -blockfilterindex, NULL without it */
+extern CBlockFilterDB *pblockfilterdb;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -5,9 +5,15 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "support/allocators/pool.h"
+
 #include <stdlib.h>
 
+#include <algorithm>
+#include <deque>
+#include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -74,18 +80,61 @@ static inline size_t DynamicUsage(const std::vector<X>& v)
     return MallocUsage(v.capacity() * sizeof(X));
 }
 
-template<typename X>
-static inline size_t DynamicUsage(const std::set<X>& s)
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::set<X, Y>& s)
 {
     return MallocUsage(sizeof(stl_tree_node<X>)) * s.size();
 }
 
 template<typename X, typename Y>
-static inline size_t DynamicUsage(const std::map<X, Y>& m)
+static inline size_t IncrementalDynamicUsage(const std::set<X, Y>& s)
+{
+    return MallocUsage(sizeof(stl_tree_node<X>));
+}
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::map<X, Y, Z>& m)
 {
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
 }
 
+template<typename X, typename Y, typename Z>
+static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
+}
+
+template<typename X>
+struct stl_list_node
+{
+private:
+    void* next;
+    void* prev;
+    X x;
+};
+
+template<typename X>
+static inline size_t DynamicUsage(const std::list<X>& l)
+{
+    return MallocUsage(sizeof(stl_list_node<X>)) * l.size();
+}
+
+template<typename X>
+static inline size_t DynamicUsage(const std::deque<X>& d)
+{
+    // The elements are in blocks of 512 bytes, or of one element if it is larger, and a map of the blocks
+    const size_t nBlockSize = std::max<size_t>(512, sizeof(X));
+    const size_t nBlocks = d.size() * sizeof(X) / nBlockSize + 1;
+    return MallocUsage(nBlockSize) * nBlocks + MallocUsage(std::max<size_t>(8, nBlocks + 2) * sizeof(void*));
+}
+
+template<typename X>
+static inline size_t DynamicUsage(const std::shared_ptr<X>& p)
+{
+    // The object and its reference counts are one allocation with make_shared
+    return p ? MallocUsage(sizeof(X) + sizeof(void*) + 2 * sizeof(int)) : 0;
+}
+
 // Boost data structures
 
 template<typename X>
@@ -107,6 +156,13 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+// The nodes of a map with a pool_allocator use the chunks of its pool, whether in use or free
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, std::equal_to<X>, pool_allocator<std::pair<const X, Y> > >& m)
+{
+    return m.get_allocator().resource->ChunkBytes() + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif
@@ -6,15 +6,21 @@
 
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "httpserver.h"
 #include "main.h"
+#include "rpc/protocol.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utiltime.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 
+#include <libsnark/common/profiling.hpp>
+
 #include <boost/thread.hpp>
 #include <boost/thread/synchronized_value.hpp>
+#include <cmath>
+#include <map>
 #include <string>
 #ifdef WIN32
 #include <io.h>
@@ -72,6 +78,76 @@ double AtomicTimer::rate(const AtomicCounter& count)
     return duration > 0 ? (double)count.get() / duration : 0;
 }
 
+AtomicHistogram::AtomicHistogram() : count(0), total(0), max(0)
+{
+    for (size_t i = 0; i < BUCKETS; i++) {
+        buckets[i] = 0;
+    }
+}
+
+void AtomicHistogram::add(int64_t nMicros)
+{
+    if (nMicros < 0) {
+        nMicros = 0;
+    }
+    // Bucket i > 0 holds the durations from 2^(i-1) to 2^i - 1
+    size_t i = 0;
+    while (i < BUCKETS - 1 && (nMicros >> i) > 0) {
+        i++;
+    }
+    ++buckets[i];
+    ++count;
+    total += nMicros;
+    int64_t prev = max.load();
+    while (nMicros > prev && !max.compare_exchange_weak(prev, nMicros)) {
+    }
+}
+
+uint64_t AtomicHistogram::getCount() const
+{
+    return count.load();
+}
+
+int64_t AtomicHistogram::getTotal() const
+{
+    return total.load();
+}
+
+int64_t AtomicHistogram::mean() const
+{
+    uint64_t n = count.load();
+    return n > 0 ? total.load() / (int64_t)n : 0;
+}
+
+int64_t AtomicHistogram::getMax() const
+{
+    return max.load();
+}
+
+uint64_t AtomicHistogram::getBucket(size_t i) const
+{
+    return i < BUCKETS ? buckets[i].load() : 0;
+}
+
+int64_t AtomicHistogram::percentile(double fraction) const
+{
+    uint64_t n = count.load();
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>(1, std::ceil(fraction * n));
+    uint64_t seen = 0;
+    size_t i = 0;
+    for (; i < BUCKETS - 1; i++) {
+        seen += buckets[i].load();
+        if (seen >= target) {
+            break;
+        }
+    }
+    int64_t bound = i == 0 ? 0 : (((int64_t)1 << i) - 1);
+    return std::min(bound, max.load());
+}
+
 CCriticalSection cs_metrics;
 
 boost::synchronized_value<int64_t> nNodeStartTime;
@@ -81,6 +157,100 @@ AtomicCounter ehSolverRuns;
 AtomicCounter solutionTargetChecks;
 AtomicCounter minedBlocks;
 AtomicTimer miningTimer;
+AtomicHistogram createNewBlockLatency;
+AtomicHistogram getBlockTemplateLatency;
+AtomicHistogram snarkPhaseLatency[SNARK_PHASES];
+AtomicHistogram connectBlockLatency;
+AtomicHistogram connectStageLatency[CONNECT_STAGES];
+
+static std::mutex cs_rpcMethodLatency;
+static std::map<std::string, std::shared_ptr<AtomicHistogram>> mapRPCMethodLatency;
+
+const char* SnarkPhaseName(SnarkPhase phase)
+{
+    switch (phase) {
+    case SNARK_PROVE: return "prove";
+    case SNARK_WITNESS_MAP: return "witnessmap";
+    case SNARK_FFT: return "fft";
+    case SNARK_MULTIEXP_A: return "multiexpa";
+    case SNARK_MULTIEXP_B: return "multiexpb";
+    case SNARK_MULTIEXP_C: return "multiexpc";
+    case SNARK_MULTIEXP_H: return "multiexph";
+    case SNARK_MULTIEXP_K: return "multiexpk";
+    case SNARK_MILLER_LOOP: return "millerloop";
+    case SNARK_FINAL_EXPONENTIATION: return "finalexponentiation";
+    case SNARK_PHASES: break;
+    }
+    return "";
+}
+
+const char* ConnectStageName(ConnectStage stage)
+{
+    switch (stage) {
+    case CONNECT_READ: return "read";
+    case CONNECT_PREFETCH: return "prefetch";
+    case CONNECT_INPUTS: return "inputs";
+    case CONNECT_VERIFY: return "verify";
+    case CONNECT_INDEX: return "index";
+    case CONNECT_CALLBACKS: return "callbacks";
+    case CONNECT_FLUSH: return "flush";
+    case CONNECT_CHAINSTATE: return "chainstate";
+    case CONNECT_POSTPROCESS: return "postprocess";
+    case CONNECT_STAGES: break;
+    }
+    return "";
+}
+
+AtomicHistogram& GetRPCMethodLatency(const std::string& strMethod)
+{
+    std::lock_guard<std::mutex> lock(cs_rpcMethodLatency);
+    std::shared_ptr<AtomicHistogram>& histogram = mapRPCMethodLatency[strMethod];
+    if (!histogram) {
+        histogram = std::make_shared<AtomicHistogram>();
+    }
+    return *histogram;
+}
+
+std::map<std::string, std::shared_ptr<const AtomicHistogram>> GetAllRPCMethodLatencies()
+{
+    std::lock_guard<std::mutex> lock(cs_rpcMethodLatency);
+    return std::map<std::string, std::shared_ptr<const AtomicHistogram>>(mapRPCMethodLatency.begin(), mapRPCMethodLatency.end());
+}
+
+// The blocks are named by libsnark, only the outermost block of a phase is counted
+static const std::map<std::string, SnarkPhase> mapSnarkBlockPhases = {
+    {"Call to r1cs_ppzksnark_prover", SNARK_PROVE},
+    {"Call to r1cs_ppzksnark_prover_streaming", SNARK_PROVE},
+    {"Call to r1cs_to_qap_witness_map", SNARK_WITNESS_MAP},
+    {"Execute FFT", SNARK_FFT},
+    {"Execute inverse FFT", SNARK_FFT},
+    {"Execute coset FFT", SNARK_FFT},
+    {"Execute inverse coset IFFT", SNARK_FFT},
+    {"Compute answer to A-query", SNARK_MULTIEXP_A},
+    {"Compute answer to B-query", SNARK_MULTIEXP_B},
+    {"Compute answer to C-query", SNARK_MULTIEXP_C},
+    {"Compute answer to H-query", SNARK_MULTIEXP_H},
+    {"Compute answer to K-query", SNARK_MULTIEXP_K},
+    {"Call to alt_bn128_ate_miller_loop", SNARK_MILLER_LOOP},
+    {"Call to alt_bn128_ate_double_miller_loop", SNARK_MILLER_LOOP},
+    {"Call to alt_bn128_ate_multi_miller_loop", SNARK_MILLER_LOOP},
+    {"Call to alt_bn128_final_exponentiation", SNARK_FINAL_EXPONENTIATION},
+};
+
+static void SnarkBlockTime(const std::string& msg, const int64_t nsec)
+{
+    auto it = mapSnarkBlockPhases.find(msg);
+    if (it != mapSnarkBlockPhases.end()) {
+        snarkPhaseLatency[it->second].add(nsec / 1000);
+    }
+}
+
+void ConnectSnarkMetrics()
+{
+    libsnark::set_block_time_hook(SnarkBlockTime);
+}
+
+boost::synchronized_value<std::vector<std::shared_ptr<MiningThreadMetrics>>> miningThreadMetrics;
 
 boost::synchronized_value<std::list<uint256>> trackedBlocks;
 
@@ -112,6 +282,158 @@ double GetLocalSolPS()
     return miningTimer.rate(solutionTargetChecks);
 }
 
+static std::string PrometheusSeries(const std::string& strName, const std::string& strLabels)
+{
+    return strLabels.empty() ? strName : strName + "{" + strLabels + "}";
+}
+
+static void WritePrometheusFamily(std::string& strOut, const std::string& strName, const char* pszType, const char* pszHelp)
+{
+    strOut += "# HELP " + strName + " " + pszHelp + "\n";
+    strOut += "# TYPE " + strName + " " + pszType + "\n";
+}
+
+static void WritePrometheusValue(std::string& strOut, const std::string& strName, const std::string& strLabels, double value)
+{
+    strOut += strprintf("%s %.17g\n", PrometheusSeries(strName, strLabels), value);
+}
+
+void WritePrometheusHistogram(std::string& strOut, const std::string& strName, const std::string& strLabels,
+                              const AtomicHistogram& histogram)
+{
+    const std::string strBucketLabels = strLabels.empty() ? "" : strLabels + ",";
+    // The count is the sum of the buckets read, so that it matches them while durations are added
+    uint64_t nCumulative = 0;
+    for (size_t i = 0; i < AtomicHistogram::BUCKETS; i++) {
+        nCumulative += histogram.getBucket(i);
+        if (i == AtomicHistogram::BUCKETS - 1) {
+            break;
+        }
+        const int64_t nBound = i == 0 ? 0 : (((int64_t)1 << i) - 1);
+        strOut += strprintf("%s_bucket{%sle=\"%.6f\"} %u\n", strName, strBucketLabels, nBound * 0.000001, nCumulative);
+    }
+    strOut += strprintf("%s_bucket{%sle=\"+Inf\"} %u\n", strName, strBucketLabels, nCumulative);
+    strOut += strprintf("%s %.6f\n", PrometheusSeries(strName + "_sum", strLabels), histogram.getTotal() * 0.000001);
+    strOut += strprintf("%s %u\n", PrometheusSeries(strName + "_count", strLabels), nCumulative);
+}
+
+std::string GetPrometheusMetrics()
+{
+    std::string strOut;
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+    }
+    WritePrometheusFamily(strOut, "horizen_chain_height", "gauge", "Height of the tip of the active chain");
+    WritePrometheusValue(strOut, "horizen_chain_height", "", nHeight);
+
+    WritePrometheusFamily(strOut, "horizen_block_connect_seconds", "histogram", "Time to connect a block to the tip");
+    WritePrometheusHistogram(strOut, "horizen_block_connect_seconds", "", connectBlockLatency);
+    WritePrometheusFamily(strOut, "horizen_block_connect_stage_seconds", "histogram", "Time of the stages of connecting a block to the tip");
+    for (int i = 0; i < CONNECT_STAGES; i++) {
+        WritePrometheusHistogram(strOut, "horizen_block_connect_stage_seconds",
+                                 strprintf("stage=\"%s\"", ConnectStageName(ConnectStage(i))), connectStageLatency[i]);
+    }
+
+    WritePrometheusFamily(strOut, "horizen_transactions_validated_total", "counter", "Transactions validated, in blocks or for the mempool");
+    WritePrometheusValue(strOut, "horizen_transactions_validated_total", "", transactionsValidated.value.load());
+
+    WritePrometheusFamily(strOut, "horizen_mempool_transactions", "gauge", "Transactions in the mempool");
+    WritePrometheusValue(strOut, "horizen_mempool_transactions", "", mempool.size());
+    WritePrometheusFamily(strOut, "horizen_mempool_bytes", "gauge", "Serialized size of the transactions in the mempool");
+    WritePrometheusValue(strOut, "horizen_mempool_bytes", "", mempool.GetTotalTxSize());
+    WritePrometheusFamily(strOut, "horizen_mempool_usage_bytes", "gauge", "Memory used by the mempool");
+    WritePrometheusValue(strOut, "horizen_mempool_usage_bytes", "", mempool.DynamicMemoryUsage());
+
+    int nInbound = 0, nOutbound = 0;
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(const CNode* pnode, vNodes) {
+            if (pnode->fInbound) {
+                nInbound++;
+            } else {
+                nOutbound++;
+            }
+        }
+    }
+    WritePrometheusFamily(strOut, "horizen_peers", "gauge", "Peers connected");
+    WritePrometheusValue(strOut, "horizen_peers", "direction=\"inbound\"", nInbound);
+    WritePrometheusValue(strOut, "horizen_peers", "direction=\"outbound\"", nOutbound);
+
+    WritePrometheusFamily(strOut, "horizen_rpc_request_seconds", "histogram", "Time to handle the RPC calls, by method");
+    for (const auto& entry : GetAllRPCMethodLatencies()) {
+        WritePrometheusHistogram(strOut, "horizen_rpc_request_seconds", "method=\"" + entry.first + "\"", *entry.second);
+    }
+
+    const std::vector<CheckQueueInfo> vCheckQueues = GetCheckQueueInfo();
+    WritePrometheusFamily(strOut, "horizen_checkqueue_threads", "gauge", "Threads running the verifications of a check queue, ConnectBlock's included");
+    for (const CheckQueueInfo& info : vCheckQueues) {
+        WritePrometheusValue(strOut, "horizen_checkqueue_threads", "queue=\"" + info.name + "\"", info.nThreads);
+    }
+    WritePrometheusFamily(strOut, "horizen_checkqueue_pending", "gauge", "Verifications of a check queue not completed yet");
+    for (const CheckQueueInfo& info : vCheckQueues) {
+        WritePrometheusValue(strOut, "horizen_checkqueue_pending", "queue=\"" + info.name + "\"", info.nPending);
+    }
+    WritePrometheusFamily(strOut, "horizen_checkqueue_checks_total", "counter", "Verifications run by a check queue");
+    for (const CheckQueueInfo& info : vCheckQueues) {
+        WritePrometheusValue(strOut, "horizen_checkqueue_checks_total", "queue=\"" + info.name + "\"", info.nChecks);
+    }
+    WritePrometheusFamily(strOut, "horizen_checkqueue_busy_seconds_total", "counter",
+                          "Time the threads of a check queue spent running verifications, their utilisation over its rate divided by the threads");
+    for (const CheckQueueInfo& info : vCheckQueues) {
+        WritePrometheusValue(strOut, "horizen_checkqueue_busy_seconds_total", "queue=\"" + info.name + "\"", info.nBusyTime * 0.000001);
+    }
+
+    return strOut;
+}
+
+static void HTTPReq_Metrics(HTTPRequest* req, const std::string&)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests are allowed");
+        return;
+    }
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, GetPrometheusMetrics());
+}
+
+bool StartHTTPMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics);
+    return true;
+}
+
+void StopHTTPMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
+
+void ResetMiningThreadMetrics(int nThreads)
+{
+    boost::strict_lock_ptr<std::vector<std::shared_ptr<MiningThreadMetrics>>> u = miningThreadMetrics.synchronize();
+    u->clear();
+    for (int i = 0; i < nThreads; i++) {
+        u->push_back(std::make_shared<MiningThreadMetrics>());
+    }
+}
+
+std::shared_ptr<MiningThreadMetrics> GetMiningThreadMetrics(int nThread)
+{
+    boost::strict_lock_ptr<std::vector<std::shared_ptr<MiningThreadMetrics>>> u = miningThreadMetrics.synchronize();
+    if (nThread < 0 || (size_t)nThread >= u->size()) {
+        // Not counted in the per-thread metrics
+        return std::make_shared<MiningThreadMetrics>();
+    }
+    return (*u)[nThread];
+}
+
+std::vector<std::shared_ptr<MiningThreadMetrics>> GetAllMiningThreadMetrics()
+{
+    return *miningThreadMetrics;
+}
+
 int EstimateNetHeightInner(int height, int64_t tipmediantime,
                            int heightLastCheckpoint, int64_t timeLastCheckpoint,
                            int64_t genesisTime, int64_t targetSpacing)
@@ -262,6 +584,15 @@ int printStats(bool mining)
     if (mining && miningTimer.running()) {
         std::cout << "    " << _("Local solution rate") << " | " << strprintf("%.4f Sol/s", localsolps) << std::endl;
         lines++;
+        auto threadMetrics = GetAllMiningThreadMetrics();
+        if (threadMetrics.size() > 1) {
+            std::string strRates;
+            for (auto& m : threadMetrics) {
+                strRates += strprintf("%.4f ", m->timer.rate(m->targetChecks));
+            }
+            std::cout << "   " << _("Per-thread Sol rates") << " | " << strRates << "Sol/s" << std::endl;
+            lines++;
+        }
     }
     std::cout << "       " << _("Mempool TX count") << " | " << mempool_count << " TX" << std::endl;
     std::cout << std::endl;
@@ -348,6 +679,13 @@ int printMetrics(size_t cols, bool mining)
         std::cout << "- " << strprintf(_("You have completed %d Equihash solver runs."), ehSolverRuns.get()) << std::endl;
         lines++;
 
+        if (createNewBlockLatency.getCount() > 0) {
+            std::cout << "- " << strprintf(_("Building a block template took %.1f ms (median), %.1f ms (90th percentile)."),
+                                           createNewBlockLatency.percentile(0.5) / 1000.0,
+                                           createNewBlockLatency.percentile(0.9) / 1000.0) << std::endl;
+            lines++;
+        }
+
         int mined = 0;
         int orphaned = 0;
         CAmount immature {0};
@@ -5,8 +5,11 @@
 #include "uint256.h"
 
 #include <atomic>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
 struct AtomicCounter {
     std::atomic<uint64_t> value;
@@ -54,10 +57,141 @@ public:
     double rate(const AtomicCounter& count);
 };
 
+/**
+ * Distribution of durations in buckets bounded by powers of two microseconds,
+ * from which percentiles are estimated to within a factor of two.
+ */
+class AtomicHistogram {
+public:
+    static const size_t BUCKETS = 40;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<int64_t> total;
+    std::atomic<int64_t> max;
+
+public:
+    AtomicHistogram();
+
+    /**
+     * Counts a duration of nMicros microseconds.
+     */
+    void add(int64_t nMicros);
+
+    uint64_t getCount() const;
+
+    /**
+     * Sum of the durations counted.
+     */
+    int64_t getTotal() const;
+
+    int64_t mean() const;
+
+    int64_t getMax() const;
+
+    /**
+     * Durations counted in bucket i, those up to 2^i - 1 microseconds which the
+     * bucket before does not hold, the last bucket holding the longer ones too.
+     */
+    uint64_t getBucket(size_t i) const;
+
+    /**
+     * Upper bound of the bucket holding the given fraction (between 0 and 1) of
+     * the durations, no larger than the longest duration.
+     */
+    int64_t percentile(double fraction) const;
+};
+
+/**
+ * Equihash solver runs, solutions checked against the target and mining time
+ * of one mining thread.
+ */
+struct MiningThreadMetrics {
+    AtomicCounter solverRuns;
+    AtomicCounter targetChecks;
+    AtomicTimer timer;
+};
+
 extern AtomicCounter transactionsValidated;
 extern AtomicCounter ehSolverRuns;
 extern AtomicCounter solutionTargetChecks;
 extern AtomicTimer miningTimer;
+extern AtomicHistogram createNewBlockLatency;
+extern AtomicHistogram getBlockTemplateLatency;
+
+/**
+ * Phases of the JoinSplit proofs and verifications, timed by the libsnark
+ * profiling blocks running them.
+ */
+enum SnarkPhase {
+    SNARK_PROVE,
+    SNARK_WITNESS_MAP,
+    SNARK_FFT,
+    SNARK_MULTIEXP_A,
+    SNARK_MULTIEXP_B,
+    SNARK_MULTIEXP_C,
+    SNARK_MULTIEXP_H,
+    SNARK_MULTIEXP_K,
+    SNARK_MILLER_LOOP,
+    SNARK_FINAL_EXPONENTIATION,
+    SNARK_PHASES
+};
+
+extern AtomicHistogram snarkPhaseLatency[SNARK_PHASES];
+
+/** Key of a phase in the RPC and benchmark results */
+const char* SnarkPhaseName(SnarkPhase phase);
+/** Count the durations of the libsnark blocks of the phases in snarkPhaseLatency */
+void ConnectSnarkMetrics();
+
+/**
+ * Stages of connecting a block to the tip, timed as -debug=bench logs them. The
+ * inputs, verify, index and callbacks stages are those of ConnectBlock.
+ */
+enum ConnectStage {
+    CONNECT_READ,
+    CONNECT_PREFETCH,
+    CONNECT_INPUTS,
+    //! From the start of ConnectBlock until its verifications complete, the inputs included
+    CONNECT_VERIFY,
+    CONNECT_INDEX,
+    CONNECT_CALLBACKS,
+    CONNECT_FLUSH,
+    CONNECT_CHAINSTATE,
+    CONNECT_POSTPROCESS,
+    CONNECT_STAGES
+};
+
+extern AtomicHistogram connectBlockLatency;
+extern AtomicHistogram connectStageLatency[CONNECT_STAGES];
+
+/** Label of a stage in the metrics endpoint */
+const char* ConnectStageName(ConnectStage stage);
+
+/** Latency of the calls of an RPC method of the table, created on its first call */
+AtomicHistogram& GetRPCMethodLatency(const std::string& strMethod);
+std::map<std::string, std::shared_ptr<const AtomicHistogram>> GetAllRPCMethodLatencies();
+
+/**
+ * Append a histogram of microseconds in the Prometheus text format, in seconds:
+ * the cumulative buckets, the sum and the count of the series name{labels}.
+ */
+void WritePrometheusHistogram(std::string& strOut, const std::string& strName, const std::string& strLabels,
+                              const AtomicHistogram& histogram);
+
+/** The metrics of this node in the Prometheus text format, served at /metrics */
+std::string GetPrometheusMetrics();
+
+/** Serve GetPrometheusMetrics at /metrics of the HTTP server, with -metricsendpoint */
+bool StartHTTPMetrics();
+void StopHTTPMetrics();
+
+/** Replace the metrics of the mining threads by nThreads new ones */
+void ResetMiningThreadMetrics(int nThreads);
+/** Metrics of mining thread nThread, which stay valid after a reset */
+std::shared_ptr<MiningThreadMetrics> GetMiningThreadMetrics(int nThread);
+std::vector<std::shared_ptr<MiningThreadMetrics>> GetAllMiningThreadMetrics();
 
 void TrackMinedBlock(uint256 hash);
 
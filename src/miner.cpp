@@ -36,6 +36,9 @@
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #ifdef ENABLE_MINING
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #endif
 #include <mutex>
@@ -111,112 +114,185 @@ void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams,
 
 }
 
-void GetBlockTxPriorityData(const CBlock *pblock, int nHeight, int64_t nMedianTimePast, const CCoinsViewCache& view,
-                               vector<TxPriority>& vecPriority, list<COrphan>& vOrphan, map<uint256, vector<COrphan*> >& mapDependers)
+namespace {
+
+/**
+ * What CreateNewBlock works out about a mempool transaction. Nothing of it changes
+ * while the transaction stays in the mempool and the chain tip stays the same.
+ */
+struct CTemplateTxInfo
 {
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-         mi != mempool.mapTx.end(); ++mi)
+    bool fMissingInputs;
+    double dPriority;       //! before prioritisetransaction deltas
+    CAmount nFee;           //! before prioritisetransaction deltas
+    unsigned int nTxSize;
+    std::set<uint256> setDependsOn; //! in-mempool parents
+    int nInputsChecked;     //! 0 not checked yet, 1 valid, -1 invalid in a new block
+
+    CTemplateTxInfo() : fMissingInputs(false), dPriority(0), nFee(0), nTxSize(0), nInputsChecked(0) {}
+};
+
+/**
+ * Cache of CTemplateTxInfo, so that building a template only looks up coins and
+ * checks scripts for the transactions that entered the mempool since the last
+ * template on the same tip. Guarded by mempool.cs.
+ */
+class CTemplateTxCache
+{
+private:
+    uint256 hashTip;
+    int nTipHeight;
+    std::map<uint256, CTemplateTxInfo> mapInfo;
+
+public:
+    CTemplateTxCache() : nTipHeight(-1) {}
+
+    /** Forget everything on a new tip, and the transactions which left the mempool otherwise */
+    void Sync(const CBlockIndex* pindexPrev)
     {
-        const CTransaction& tx = mi->second.GetTx();
+        AssertLockHeld(mempool.cs);
+        if (hashTip != pindexPrev->GetBlockHash() || nTipHeight != pindexPrev->nHeight) {
+            mapInfo.clear();
+            hashTip = pindexPrev->GetBlockHash();
+            nTipHeight = pindexPrev->nHeight;
+            return;
+        }
+        std::map<uint256, CTemplateTxInfo>::iterator it = mapInfo.begin();
+        while (it != mapInfo.end()) {
+            if (mempool.mapTx.count(it->first))
+                ++it;
+            else
+                mapInfo.erase(it++);
+        }
+    }
 
-        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                ? nMedianTimePast
-                : pblock->GetBlockTime();
+    CTemplateTxInfo* Find(const uint256& hash)
+    {
+        std::map<uint256, CTemplateTxInfo>::iterator it = mapInfo.find(hash);
+        return it == mapInfo.end() ? NULL : &it->second;
+    }
 
-        if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff))
-            continue;
+    CTemplateTxInfo& Insert(const uint256& hash) { return mapInfo[hash]; }
 
-        COrphan* porphan = NULL;
-        double dPriority = 0;
-        CAmount nTotalIn = 0;
-        CAmount nFee = 0;
-        unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-        uint256 hash = tx.GetHash();
-        bool fMissingInputs = false;
+    size_t size() const { return mapInfo.size(); }
+};
 
-        // Detect orphan transaction and its dependencies
-        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+CTemplateTxCache templateTxCache;
+
+void ComputeTemplateTxInfo(const CTxMemPoolEntry& entry, int nHeight, const CCoinsViewCache& view, CTemplateTxInfo& info)
+{
+    const CTransaction& tx = entry.GetTx();
+    CAmount nTotalIn = 0;
+    info.nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+
+    // Detect orphan transaction and its dependencies
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        CTxMemPool::txiter parent = mempool.mapTx.find(txin.prevout.hash);
+        if (parent != mempool.mapTx.end())
         {
-            if (mempool.mapTx.count(txin.prevout.hash))
-            {
-                if (!porphan)
-                {
-                    // Use list for automatic deletion
-                    vOrphan.push_back(COrphan(&tx));
-                    porphan = &vOrphan.back();
-                }
-                mapDependers[txin.prevout.hash].push_back(porphan);
-                porphan->setDependsOn.insert(txin.prevout.hash);
-                nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-            }
+            info.setDependsOn.insert(txin.prevout.hash);
+            nTotalIn += parent->GetTx().vout[txin.prevout.n].nValue;
         }
+    }
 
-        if (!porphan)
+    if (info.setDependsOn.empty())
+    {
+        info.dPriority = entry.GetPriority(nHeight);
+        info.nFee = entry.GetFee();
+        return;
+    }
+
+    double dPriority = 0;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        // Read prev transaction
+        // Skip transactions in mempool
+        if (mempool.mapTx.count(txin.prevout.hash))
+            continue;
+        else if (!view.HaveCoins(txin.prevout.hash))
         {
-            dPriority = mi->second.GetPriority(nHeight);
-            nFee = mi->second.GetFee();
-            mempool.ApplyDeltas(hash, dPriority, nFee);
-            nTotalIn = tx.GetValueOut() - nFee;
+            // This should never happen; all transactions in the memory
+            // pool should connect to either transactions in the chain
+            // or other transactions in the memory pool.
+            LogPrintf("ERROR: mempool transaction missing input\n");
+            if (fDebug) assert("mempool transaction missing input" == 0);
+            info.fMissingInputs = true;
+            return;
         }
-        else
-        {
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                // Skip transactions in mempool
-                if (mempool.mapTx.count(txin.prevout.hash))
-                    continue;
-                else if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    LogPrintf("ERROR: mempool transaction missing input\n");
-                    if (fDebug) assert("mempool transaction missing input" == 0);
-                    fMissingInputs = true;
-                    if (porphan)
-                        vOrphan.pop_back();
-                    break;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
+        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+        assert(coins);
 
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
+        CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
+        nTotalIn += nValueIn;
 
-                int nConf = nHeight - coins->nHeight;
+        int nConf = nHeight - coins->nHeight;
 
-                dPriority += (double)nValueIn * nConf;
-            }
-            nTotalIn += tx.GetJoinSplitValueIn();
+        dPriority += (double)nValueIn * nConf;
+    }
+    nTotalIn += tx.GetJoinSplitValueIn();
+
+    // Priority is sum(valuein * age) / modified_txsize
+    info.dPriority = tx.ComputePriority(dPriority, info.nTxSize);
+    info.nFee = nTotalIn - tx.GetValueOut();
+}
+
+} // anon namespace
+
+void GetBlockTxPriorityData(const CBlock *pblock, int nHeight, int64_t nMedianTimePast, const CCoinsViewCache& view,
+                               vector<TxPriority>& vecPriority, list<COrphan>& vOrphan, map<uint256, vector<COrphan*> >& mapDependers)
+{
+    int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+            ? nMedianTimePast
+            : pblock->GetBlockTime();
 
-            if (fMissingInputs) continue;
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
+    {
+        const CTransaction& tx = mi->GetTx();
 
-            // Priority is sum(valuein * age) / modified_txsize
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-            nFee = nTotalIn - tx.GetValueOut();
+        if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff))
+            continue;
+
+        const uint256& hash = tx.GetHash();
+        CTemplateTxInfo* pinfo = templateTxCache.Find(hash);
+        if (!pinfo)
+        {
+            pinfo = &templateTxCache.Insert(hash);
+            ComputeTemplateTxInfo(*mi, nHeight, view, *pinfo);
         }
+        if (pinfo->fMissingInputs)
+            continue;
 
-        CFeeRate feeRate(nFee, nTxSize);
+        // The deltas may have changed since the info was computed
+        double dPriority = pinfo->dPriority;
+        CAmount nFee = pinfo->nFee;
+        mempool.ApplyDeltas(hash, dPriority, nFee);
+        CFeeRate feeRate(nFee, pinfo->nTxSize);
 
-        if (porphan)
+        if (!pinfo->setDependsOn.empty())
         {
+            // Use list for automatic deletion
+            vOrphan.push_back(COrphan(&tx));
+            COrphan* porphan = &vOrphan.back();
+            porphan->setDependsOn = pinfo->setDependsOn;
             porphan->dPriority = dPriority;
             porphan->feeRate = feeRate;
+            BOOST_FOREACH(const uint256& hashParent, pinfo->setDependsOn)
+                mapDependers[hashParent].push_back(porphan);
         }
         else
-            vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
+            vecPriority.push_back(TxPriority(dPriority, feeRate, &tx));
     }
 }
 
 void GetBlockTxPriorityDataOld(const CBlock *pblock, int nHeight, int64_t nMedianTimePast, const CCoinsViewCache& view,
                                vector<TxPriority>& vecPriority, list<COrphan>& vOrphan, map<uint256, vector<COrphan*> >& mapDependers)
 {
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
          mi != mempool.mapTx.end(); ++mi)
     {
-        const CTransaction& tx = mi->second.GetTx();
+        const CTransaction& tx = mi->GetTx();
 
         int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
                 ? nMedianTimePast
@@ -256,7 +332,7 @@ void GetBlockTxPriorityDataOld(const CBlock *pblock, int nHeight, int64_t nMedia
                 }
                 mapDependers[txin.prevout.hash].push_back(porphan);
                 porphan->setDependsOn.insert(txin.prevout.hash);
-                nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
+                nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
                 continue;
             }
             const CCoins* coins = view.AccessCoins(txin.prevout.hash);
@@ -288,7 +364,7 @@ void GetBlockTxPriorityDataOld(const CBlock *pblock, int nHeight, int64_t nMedia
             porphan->feeRate = feeRate;
         }
         else
-            vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
+            vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->GetTx()));
     }
 }
 
@@ -313,17 +389,12 @@ CMutableTransaction createCoinbase(const CScript &scriptPubKeyIn, CAmount fees,
     txNew.vout[0].scriptPubKey = scriptPubKeyIn;
     CAmount reward = GetBlockSubsidy(nHeight, chainparams.GetConsensus());
     txNew.vout[0].nValue = reward;
-    for (Fork::CommunityFundType cfType = Fork::CommunityFundType::FOUNDATION;
-            cfType < Fork::CommunityFundType::ENDTYPE; cfType = Fork::CommunityFundType(cfType + 1))
+    for (const CTxOut& communityOut : GetCommunityFundOutputs(nHeight, chainparams))
     {
-        CAmount vCommunityFund = ForkManager::getInstance().getCommunityFundReward(nHeight, reward, cfType);
-        if (vCommunityFund > 0)
-        {
-            // Take some reward away from miners
-            txNew.vout[0].nValue -= vCommunityFund;
-            // And give it to the community
-            txNew.vout.push_back(CTxOut(vCommunityFund, chainparams.GetCommunityFundScriptAtHeight(nHeight, cfType)));
-        }
+        // Take some reward away from miners
+        txNew.vout[0].nValue -= communityOut.nValue;
+        // And give it to the community
+        txNew.vout.push_back(communityOut);
     }
 
     txNew.vout[0].nValue += fees;
@@ -332,6 +403,7 @@ CMutableTransaction createCoinbase(const CScript &scriptPubKeyIn, CAmount fees,
 
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlockMaxComplexitySize)
 {
+    int64_t nTimeStart = GetTimeMicros();
     const CChainParams& chainparams = Params();
     // Create new block
     std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
@@ -345,7 +417,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
         pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
 
     // Add dummy coinbase tx as first transaction
-    pblock->vtx.push_back(CTransaction());
+    pblock->vtx.push_back(MakeTransactionRef());
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
@@ -383,6 +455,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
             pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
 
         CCoinsViewCache view(pcoinsTip);
+        templateTxCache.Sync(pindexPrev);
 
         // Priority order to process transactions
         list<COrphan> vOrphan; // list memory doesn't move
@@ -462,14 +535,25 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
             // Note that flags: we don't want to set mempool/IsStandard()
             // policy here, but we still have to ensure that the block we
             // create only contains transactions that are valid in new blocks.
+            // The result only depends on the transaction and the tip, so a
+            // transaction is checked once per tip.
             CValidationState state;
-            if (!ContextualCheckInputs(tx, state, view, true, chainActive, MANDATORY_SCRIPT_VERIFY_FLAGS | SCRIPT_VERIFY_CHECKBLOCKATHEIGHT, true, Params().GetConsensus()))
+            CTemplateTxInfo* pinfo = templateTxCache.Find(hash);
+            if (pinfo && pinfo->nInputsChecked < 0)
                 continue;
+            if (!pinfo || pinfo->nInputsChecked == 0)
+            {
+                bool fValid = ContextualCheckInputs(tx, state, view, true, chainActive, MANDATORY_SCRIPT_VERIFY_FLAGS | SCRIPT_VERIFY_CHECKBLOCKATHEIGHT, true, Params().GetConsensus());
+                if (pinfo)
+                    pinfo->nInputsChecked = fValid ? 1 : -1;
+                if (!fValid)
+                    continue;
+            }
 
             UpdateCoins(tx, state, view, nHeight);
 
-            // Added
-            pblock->vtx.push_back(tx);
+            // Added, sharing the transaction of the mempool
+            pblock->vtx.push_back(mempool.mapTx.find(hash)->GetSharedTx());
             pblocktemplate->vTxFees.push_back(nTxFees);
             pblocktemplate->vTxSigOps.push_back(nTxSigOps);
             nBlockSize += nTxSize;
@@ -505,8 +589,9 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
         LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+        LogPrint("bench", "CreateNewBlock(): %u mempool transactions cached for this tip\n", templateTxCache.size());
 
-        pblock->vtx[0] = createCoinbase(scriptPubKeyIn, nFees, nHeight);
+        pblock->vtx[0] = MakeTransactionRef(createCoinbase(scriptPubKeyIn, nFees, nHeight));
         pblocktemplate->vTxFees[0] = -nFees;
 
         // Randomise nonce
@@ -522,12 +607,13 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
         UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
         pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, Params().GetConsensus());
         pblock->nSolution.clear();
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(*pblock->vtx[0]);
 
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
             throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
     }
+    createNewBlockLatency.add(GetTimeMicros() - nTimeStart);
 
     return pblocktemplate.release();
 }
@@ -592,12 +678,12 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     }
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
-    pblock->vtx[0] = txCoinbase;
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+    pblock->hashMerkleRoot = pblock->ComputeMerkleRoot();
 }
 
 #ifdef ENABLE_WALLET
@@ -607,7 +693,7 @@ static bool ProcessBlockFound(CBlock* pblock)
 #endif // ENABLE_WALLET
 {
     LogPrintf("%s\n", pblock->ToString());
-    LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0].vout[0].nValue));
+    LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0]->vout[0].nValue));
 
     // Found a solution
     {
@@ -639,48 +725,45 @@ static bool ProcessBlockFound(CBlock* pblock)
     return true;
 }
 
+/**
+ * The block the mining threads work on. A single thread builds it, and every
+ * mining thread searches its own part of the nonce space of that block rather
+ * than building and searching a template of its own.
+ */
+struct CMinerJob
+{
+    std::shared_ptr<const CBlock> pblock;
+    CBlockIndex* pindexPrev = NULL;
+    uint64_t nId = 0;
+};
+
+static std::mutex csMinerJob;
+static std::condition_variable cvMinerJob;
+static CMinerJob minerJob;              // guarded by csMinerJob
+static bool fMinerJobFailed = false;    // guarded by csMinerJob
+// The id of minerJob, which the mining threads poll while solving
+static std::atomic<uint64_t> nMinerJobId(0);
 #ifdef ENABLE_WALLET
-void static BitcoinMiner(CWallet *pwallet)
-#else
-void static BitcoinMiner()
+// Guards the key paid by the block, used by the template thread and by a mining thread finding a block
+static std::mutex csMinerKey;
 #endif
-{
-    LogPrintf("HorizenMiner started\n");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    RenameThread("horizzen-miner");
-    const CChainParams& chainparams = Params();
 
 #ifdef ENABLE_WALLET
-    // Each thread has its own key
-    CReserveKey reservekey(pwallet);
+void static MinerTemplateThread(CReserveKey *preservekey)
+#else
+void static MinerTemplateThread()
 #endif
+{
+    RenameThread("horizen-miner-tpl");
+    const CChainParams& chainparams = Params();
 
-    // Each thread has its own counter
     unsigned int nExtraNonce = 0;
 
-    unsigned int n = chainparams.EquihashN();
-    unsigned int k = chainparams.EquihashK();
-
-    std::string solver = GetArg("-equihashsolver", "default");
-    assert(solver == "tromp" || solver == "default");
-    LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
-
-    std::mutex m_cs;
-    bool cancelSolver = false;
-    boost::signals2::connection c = uiInterface.NotifyBlockTip.connect(
-        [&m_cs, &cancelSolver](const uint256& hashNewTip) mutable {
-            std::lock_guard<std::mutex> lock{m_cs};
-            cancelSolver = true;
-        }
-    );
-    miningTimer.start();
-
     try {
         while (true) {
             if (chainparams.MiningRequiresPeers()) {
-                // Busy-wait for the network to come online so we don't waste time mining
+                // Busy-wait for the network to come online so we don't build templates
                 // on an obsolete chain. In regtest mode we expect to fly solo.
-                miningTimer.stop();
                 do {
                     bool fvNodesEmpty;
                     {
@@ -691,7 +774,6 @@ void static BitcoinMiner()
                         break;
                     MilliSleep(1000);
                 } while (true);
-                miningTimer.start();
             }
 
             //
@@ -701,7 +783,11 @@ void static BitcoinMiner()
             CBlockIndex* pindexPrev = chainActive.Tip();
 
 #ifdef ENABLE_WALLET
-            unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
+            unique_ptr<CBlockTemplate> pblocktemplate;
+            {
+                std::lock_guard<std::mutex> lock{csMinerKey};
+                pblocktemplate.reset(CreateNewBlockWithKey(*preservekey));
+            }
 #else
             unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey());
 #endif
@@ -713,20 +799,141 @@ void static BitcoinMiner()
                     // Should never reach here, because -mineraddress validity is checked in init.cpp
                     LogPrintf("Error in HorizenMiner: Invalid -mineraddress\n");
                 }
+                std::lock_guard<std::mutex> lock{csMinerJob};
+                fMinerJobFailed = true;
+                cvMinerJob.notify_all();
                 return;
             }
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>(pblocktemplate->block);
+            IncrementExtraNonce(pblock.get(), pindexPrev, nExtraNonce);
             LogPrintf("Running HorizenMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
                 ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
 
+            {
+                std::lock_guard<std::mutex> lock{csMinerJob};
+                minerJob.pblock = pblock;
+                minerJob.pindexPrev = pindexPrev;
+                minerJob.nId = ++nMinerJobId;
+                cvMinerJob.notify_all();
+            }
+
+            // Both new tips and accepted transactions notify cvBlockChange under csBestBlock:
+            // rebuild at once for a new tip, and for new transactions once the block is a minute old
+            boost::system_time rebuildtime = boost::get_system_time() + boost::posix_time::minutes(1);
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            while (chainActive.Tip() == pindexPrev) {
+                bool fTimedOut = boost::get_system_time() >= rebuildtime;
+                if (fTimedOut && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast)
+                    break;
+                // Removals from the mempool are not notified, they are looked for every 10 seconds
+                cvBlockChange.timed_wait(lock, fTimedOut ? boost::get_system_time() + boost::posix_time::seconds(10) : rebuildtime);
+            }
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        LogPrintf("HorizenMiner runtime error: %s\n", e.what());
+        std::lock_guard<std::mutex> lock{csMinerJob};
+        fMinerJobFailed = true;
+        cvMinerJob.notify_all();
+    }
+}
+
+/**
+ * Wait for a job other than nLastId.
+ * @return false if the template thread gave up
+ */
+static bool WaitForMinerJob(uint64_t nLastId, CMinerJob& job)
+{
+    std::unique_lock<std::mutex> lock{csMinerJob};
+    while (!fMinerJobFailed && (!minerJob.pblock || minerJob.nId == nLastId)) {
+        // std::condition_variable is not a boost interruption point
+        cvMinerJob.wait_for(lock, std::chrono::milliseconds(100));
+        boost::this_thread::interruption_point();
+    }
+    if (fMinerJobFailed)
+        return false;
+    job = minerJob;
+    return true;
+}
+
+#ifdef ENABLE_WALLET
+void static BitcoinMiner(CWallet *pwallet, CReserveKey *preservekey, int nThread)
+#else
+void static BitcoinMiner(int nThread)
+#endif
+{
+    LogPrintf("HorizenMiner started\n");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("horizzen-miner");
+    const CChainParams& chainparams = Params();
+
+    unsigned int n = chainparams.EquihashN();
+    unsigned int k = chainparams.EquihashK();
+
+    std::string solver = GetArg("-equihashsolver", "default");
+    assert(solver == "tromp" || solver == "default" || solver == "parallel");
+    LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
+    int nSolverThreads = GetArg("-equihashsolverthreads", 0);
+    if (nSolverThreads <= 0)
+        nSolverThreads = GetNumCores();
+
+    std::mutex m_cs;
+    bool cancelSolver = false;
+    boost::signals2::connection c = uiInterface.NotifyBlockTip.connect(
+        [&m_cs, &cancelSolver](const uint256& hashNewTip) mutable {
+            std::lock_guard<std::mutex> lock{m_cs};
+            cancelSolver = true;
+        }
+    );
+    std::shared_ptr<MiningThreadMetrics> threadMetrics = GetMiningThreadMetrics(nThread);
+    // Excess calls to miningTimer.stop() would count out other mining threads
+    bool fTiming = false;
+    auto setTiming = [&fTiming, &threadMetrics](bool fStart) {
+        if (fStart != fTiming) {
+            fStart ? miningTimer.start() : miningTimer.stop();
+            fStart ? threadMetrics->timer.start() : threadMetrics->timer.stop();
+        }
+        fTiming = fStart;
+    };
+
+    try {
+        uint64_t nLastJob = 0;
+        while (true) {
+            CMinerJob job;
+            setTiming(false);
+            if (!WaitForMinerJob(nLastJob, job))
+                break;
+            setTiming(true);
+            nLastJob = job.nId;
+            CBlockIndex* pindexPrev = job.pindexPrev;
+
+            // The template leaves the top 16 bits of the nonce clear for the thread number,
+            // so that the threads search disjoint nonces of the same block
+            CBlock block(*job.pblock);
+            CBlock *pblock = &block;
+            pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) | (arith_uint256(nThread) << 240));
+
             //
             // Search
             //
-            int64_t nStart = GetTime();
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
 
             while (true) {
+                if (chainparams.MiningRequiresPeers()) {
+                    // Regtest mode doesn't require peers
+                    setTiming(false);
+                    while (true) {
+                        {
+                            LOCK(cs_vNodes);
+                            if (!vNodes.empty())
+                                break;
+                        }
+                        MilliSleep(1000);
+                    }
+                    setTiming(true);
+                }
+
                 // Hash state
                 crypto_generichash_blake2b_state state;
                 EhInitialiseState(n, k, state);
@@ -752,15 +959,16 @@ void static BitcoinMiner()
 
                 std::function<bool(std::vector<unsigned char>)> validBlock =
 #ifdef ENABLE_WALLET
-                        [&pblock, &hashTarget, &pwallet, &reservekey, &m_cs, &cancelSolver, &chainparams]
+                        [&pblock, &hashTarget, &pwallet, &preservekey, &m_cs, &cancelSolver, &chainparams, &threadMetrics]
 #else
-                        [&pblock, &hashTarget, &m_cs, &cancelSolver, &chainparams]
+                        [&pblock, &hashTarget, &m_cs, &cancelSolver, &chainparams, &threadMetrics]
 #endif
                         (std::vector<unsigned char> soln) {
                     // Write the solution to the hash and compute the result.
                     LogPrint("pow", "- Checking solution against target\n");
                     pblock->nSolution = soln;
                     solutionTargetChecks.increment();
+                    threadMetrics->targetChecks.increment();
 
                     if (UintToArith256(pblock->GetHash()) > hashTarget) {
                         return false;
@@ -771,7 +979,12 @@ void static BitcoinMiner()
                     LogPrintf("HorizenMiner:\n");
                     LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", pblock->GetHash().GetHex(), hashTarget.GetHex());
 #ifdef ENABLE_WALLET
-                    if (ProcessBlockFound(pblock, *pwallet, reservekey)) {
+                    bool fProcessed;
+                    {
+                        std::lock_guard<std::mutex> lock{csMinerKey};
+                        fProcessed = ProcessBlockFound(pblock, *pwallet, *preservekey);
+                    }
+                    if (fProcessed) {
 #else
                     if (ProcessBlockFound(pblock)) {
 #endif
@@ -785,12 +998,15 @@ void static BitcoinMiner()
                     if (chainparams.MineBlocksOnDemand()) {
                         // Increment here because throwing skips the call below
                         ehSolverRuns.increment();
+                        threadMetrics->solverRuns.increment();
                         throw boost::thread_interrupted();
                     }
 
                     return true;
                 };
                 std::function<bool(EhSolverCancelCheck)> cancelled = [&m_cs, &cancelSolver](EhSolverCancelCheck pos) {
+                    if (boost::this_thread::interruption_requested())
+                        return true;
                     std::lock_guard<std::mutex> lock{m_cs};
                     return cancelSolver;
                 };
@@ -812,6 +1028,7 @@ void static BitcoinMiner()
                     }
                     eq.digitK(0);
                     ehSolverRuns.increment();
+                    threadMetrics->solverRuns.increment();
 
                     // Convert solution indices to byte array (decompress) and pass it to validBlock method.
                     for (size_t s = 0; s < eq.nsols; s++) {
@@ -831,8 +1048,11 @@ void static BitcoinMiner()
                 } else {
                     try {
                         // If we find a valid block, we rebuild
-                        bool found = EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
+                        bool found = (solver == "parallel") ?
+                            EhParallelSolve(n, k, curr_state, validBlock, cancelled, nSolverThreads) :
+                            EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
                         ehSolverRuns.increment();
+                        threadMetrics->solverRuns.increment();
                         if (found) {
                             break;
                         }
@@ -843,16 +1063,9 @@ void static BitcoinMiner()
                     }
                 }
 
-                // Check for stop or if block needs to be rebuilt
+                // Check for stop or if the template thread has built a new block
                 boost::this_thread::interruption_point();
-                // Regtest mode doesn't require peers
-                if (vNodes.empty() && chainparams.MiningRequiresPeers())
-                    break;
-                if ((UintToArith256(pblock->nNonce) & 0xffff) == 0xffff)
-                    break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                    break;
-                if (pindexPrev != chainActive.Tip())
+                if (nMinerJobId != nLastJob || pindexPrev != chainActive.Tip())
                     break;
 
                 // Update nNonce and nTime
@@ -863,19 +1076,19 @@ void static BitcoinMiner()
     }
     catch (const boost::thread_interrupted&)
     {
-        miningTimer.stop();
+        setTiming(false);
         c.disconnect();
         LogPrintf("HorizenMiner terminated\n");
         throw;
     }
     catch (const std::runtime_error &e)
     {
-        miningTimer.stop();
+        setTiming(false);
         c.disconnect();
         LogPrintf("HorizenMiner runtime error: %s\n", e.what());
         return;
     }
-    miningTimer.stop();
+    setTiming(false);
     c.disconnect();
 }
 
@@ -886,26 +1099,47 @@ void GenerateBitcoins(bool fGenerate, int nThreads)
 #endif
 {
     static boost::thread_group* minerThreads = NULL;
+#ifdef ENABLE_WALLET
+    static CReserveKey* preservekey = NULL;
+#endif
 
     if (nThreads < 0)
         nThreads = GetNumCores();
 
     if (minerThreads != NULL)
     {
+        // The threads share the job and the key, so they are all gone before these are reset
         minerThreads->interrupt_all();
+        minerThreads->join_all();
         delete minerThreads;
         minerThreads = NULL;
     }
+#ifdef ENABLE_WALLET
+    delete preservekey;
+    preservekey = NULL;
+#endif
+    {
+        std::lock_guard<std::mutex> lock{csMinerJob};
+        minerJob = CMinerJob();
+        fMinerJobFailed = false;
+    }
+    ResetMiningThreadMetrics(fGenerate ? nThreads : 0);
 
     if (nThreads == 0 || !fGenerate)
         return;
 
     minerThreads = new boost::thread_group();
+#ifdef ENABLE_WALLET
+    preservekey = new CReserveKey(pwallet);
+    minerThreads->create_thread(boost::bind(&MinerTemplateThread, preservekey));
+#else
+    minerThreads->create_thread(&MinerTemplateThread);
+#endif
     for (int i = 0; i < nThreads; i++) {
 #ifdef ENABLE_WALLET
-        minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet));
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet, preservekey, i));
 #else
-        minerThreads->create_thread(&BitcoinMiner);
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, i));
 #endif
     }
 }
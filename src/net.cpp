@@ -12,10 +12,13 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "consensus/consensus.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "socketevents.h"
 #include "ui_interface.h"
 #include "crypto/common.h"
+#include "memusage.h"
 #include "zen/utiltls.h"
 
 
@@ -91,6 +94,9 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+int nMessageHandlerThreads = DEFAULT_MESSAGE_HANDLER_THREADS;
+int nConnectThreads = DEFAULT_CONNECT_THREADS;
+unsigned int nMaxKnownInventory = DEFAULT_MAX_KNOWN_INVENTORY;
 bool fAddressesInitialized = false;
 TLSManager tlsmanager = TLSManager();
 vector<CNode*> vNodes;
@@ -115,6 +121,8 @@ CCriticalSection cs_nLastNodeId;
 static CSemaphore *semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
 
+static CRecvBufferPool recvBufferPool;
+
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
@@ -122,16 +130,27 @@ CNodeSignals& GetNodeSignals() { return g_signals; }
 // OpenSSL server and client contexts
 SSL_CTX *tls_ctx_server, *tls_ctx_client;
 
-static bool operator==(_NODE_ADDR a, _NODE_ADDR b)
-{
-    return (a.ipAddr == b.ipAddr);
-}
+// Addresses of the peers to connect to without TLS at their next connection
+static NonTLSPool poolNonTLSNodesInbound;
 
-static std::vector<NODE_ADDR> vNonTLSNodesInbound;
-static CCriticalSection cs_vNonTLSNodesInbound;
+/** Inbound connection whose TLS handshake is in progress */
+struct PendingTLSAccept
+{
+    SOCKET hSocket;
+    CAddress addr;
+    bool fWhitelisted;
+    SSL* ssl;
+    bool fWantWrite;
+    bool fStarted;
+    bool fFallback;
+    int64_t nTimeStart;
+    int64_t nId; // owner of the socket in CSocketEvents, distinct from the node ids
+};
+// Only accessed by the socket handler thread
+static std::list<PendingTLSAccept> lPendingTLSAccepts;
+static int64_t nPendingTLSAcceptsCount = 0;
 
-static std::vector<NODE_ADDR> vNonTLSNodesOutbound;
-static CCriticalSection cs_vNonTLSNodesOutbound;
+static NonTLSPool poolNonTLSNodesOutbound;
 
 
 void AddOneShot(const std::string& strDest)
@@ -353,6 +372,13 @@ uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
 
+uint64_t CNode::nMaxOutboundLimit = 0;
+uint64_t CNode::nMaxOutboundTotalBytesSentInCycle = 0;
+uint64_t CNode::nMaxOutboundTimeframe = MAX_UPLOAD_TIMEFRAME;
+uint64_t CNode::nMaxOutboundCycleStartTime = 0;
+
+int64_t CNode::nMaxPeerUploadRate = 0;
+
 CNode* FindNode(const CNetAddr& ip)
 {
     LOCK(cs_vNodes);
@@ -431,50 +457,35 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         /* TCP connection is ready. Do client side SSL. */
         if (CNode::GetTlsFallbackNonTls())
         {
+            LogPrint("tls", "%s():%d - handling connection to %s\n", __func__, __LINE__,  addrConnect.ToString());
+
+            bool bUseTLS = !poolNonTLSNodesOutbound.take(addrConnect.ToStringIP());
+            if (!bUseTLS)
+                LogPrintf ("Connection to %s will be unencrypted\n", addrConnect.ToString());
+
+            // The handshake runs without the lock, for the connections opened at once not to wait for each other
+            unsigned long err_code = 0;
+            if (bUseTLS)
             {
-                LOCK(cs_vNonTLSNodesOutbound);
-            
-                LogPrint("tls", "%s():%d - handling connection to %s\n", __func__, __LINE__,  addrConnect.ToString());
- 
-                NODE_ADDR nodeAddr(addrConnect.ToStringIP());
-            
-                bool bUseTLS = (find(vNonTLSNodesOutbound.begin(),
-                                     vNonTLSNodesOutbound.end(),
-                                     nodeAddr) == vNonTLSNodesOutbound.end());
-                unsigned long err_code = 0;
-                if (bUseTLS)
+                ssl = tlsmanager.connect(hSocket, addrConnect, err_code);
+                if (!ssl)
                 {
-                    ssl = tlsmanager.connect(hSocket, addrConnect, err_code);
-                    if (!ssl)
+                    if (err_code == TLSManager::SELECT_TIMEDOUT)
                     {
-                        if (err_code == TLSManager::SELECT_TIMEDOUT)
-                        {
-                            // can fail for timeout in select on fd, that is not a ssl error and we should not
-                            // consider this node as non TLS
-                            LogPrint("tls", "%s():%d - Connection to %s timedout\n",
-                                __func__, __LINE__, addrConnect.ToStringIP());
-                        }
-                        else
-                        {
-                            // Further reconnection will be made in non-TLS (unencrypted) mode
-                            vNonTLSNodesOutbound.push_back(NODE_ADDR(addrConnect.ToStringIP(), GetTimeMillis()));
-                            LogPrint("tls", "%s():%d - err_code %x, adding connection to %s vNonTLSNodesOutbound list (sz=%d)\n",
-                                __func__, __LINE__, err_code, addrConnect.ToStringIP(), vNonTLSNodesOutbound.size());
-                        }
-                        CloseSocket(hSocket);
-                        return NULL;
+                        // can fail for timeout in select on fd, that is not a ssl error and we should not
+                        // consider this node as non TLS
+                        LogPrint("tls", "%s():%d - Connection to %s timedout\n",
+                            __func__, __LINE__, addrConnect.ToStringIP());
                     }
-                }
-                else
-                {
-                    LogPrintf ("Connection to %s will be unencrypted\n", addrConnect.ToString());
-            
-                    vNonTLSNodesOutbound.erase(
-                            remove(
-                                    vNonTLSNodesOutbound.begin(),
-                                    vNonTLSNodesOutbound.end(),
-                                    nodeAddr),
-                            vNonTLSNodesOutbound.end());
+                    else
+                    {
+                        // Further reconnection will be made in non-TLS (unencrypted) mode
+                        poolNonTLSNodesOutbound.add(addrConnect.ToStringIP());
+                        LogPrint("tls", "%s():%d - err_code %x, adding connection to %s poolNonTLSNodesOutbound (sz=%d)\n",
+                            __func__, __LINE__, err_code, addrConnect.ToStringIP(), poolNonTLSNodesOutbound.size());
+                    }
+                    CloseSocket(hSocket);
+                    return NULL;
                 }
             }
         }
@@ -509,6 +520,10 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         // Add node
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false, ssl);
         pnode->AddRef();
+#ifdef USE_TLS
+        if (ssl && !GetPeerCertificateFingerprint(ssl, pnode->tlsCertFingerprint))
+            pnode->tlsCertFingerprint.SetNull();
+#endif
 
         {
             LOCK(cs_vNodes);
@@ -731,7 +746,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, nRecvVersion));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, nRecvVersion);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -755,7 +770,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            messageHandlerCondition.notify_all();
         }
     }
 
@@ -800,7 +815,16 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        unsigned int nSize = std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024);
+        if (nSize > vRecv.capacity()) {
+            // Move the data received so far to a pooled buffer of the next size class
+            CSerializeData vch;
+            recvBufferPool.Get(vch, nSize);
+            vch.assign(vRecv.begin(), vRecv.begin() + nDataPos);
+            vRecv.swap(vch);
+            recvBufferPool.Release(vch);
+        }
+        vRecv.resize(nSize);
     }
 
     memcpy(&vRecv[nDataPos], pch, nCopy);
@@ -817,16 +841,130 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+CNetMessage::~CNetMessage()
+{
+    CSerializeData vch;
+    vRecv.swap(vch);
+    recvBufferPool.Release(vch);
+}
+
+void CRecvBufferPool::Get(CSerializeData& vch, size_t nSize)
+{
+    vch.clear();
+
+    int nClass = 0;
+    while (nClass < NUM_SIZE_CLASSES && (MIN_BUFFER_SIZE << nClass) < nSize)
+        nClass++;
+    if (nClass == NUM_SIZE_CLASSES) {
+        vch.reserve(nSize);
+        return;
+    }
+
+    {
+        LOCK(cs);
+        if (!vFree[nClass].empty()) {
+            vch.swap(vFree[nClass].back());
+            vFree[nClass].pop_back();
+            return;
+        }
+    }
+    vch.reserve(MIN_BUFFER_SIZE << nClass);
+}
+
+void CRecvBufferPool::Release(CSerializeData& vch)
+{
+    // The largest class the buffer can serve
+    const size_t nCapacity = vch.capacity();
+    if (nCapacity < MIN_BUFFER_SIZE)
+        return;
+    int nClass = 0;
+    while (nClass + 1 < NUM_SIZE_CLASSES && (MIN_BUFFER_SIZE << (nClass + 1)) <= nCapacity)
+        nClass++;
+
+    size_t nMaxBuffers = MAX_CLASS_BYTES / (MIN_BUFFER_SIZE << nClass);
+    if (nMaxBuffers < MIN_BUFFERS_PER_CLASS)
+        nMaxBuffers = MIN_BUFFERS_PER_CLASS;
+
+    LOCK(cs);
+    if (vFree[nClass].size() < nMaxBuffers) {
+        vch.clear();
+        vFree[nClass].push_back(CSerializeData());
+        vFree[nClass].back().swap(vch);
+    }
+}
+
+size_t CRecvBufferPool::GetFreeCount()
+{
+    LOCK(cs);
+    size_t nCount = 0;
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
+        nCount += vFree[i].size();
+    return nCount;
+}
+
+size_t CRecvBufferPool::DynamicMemoryUsage()
+{
+    LOCK(cs);
+    size_t nUsage = 0;
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        nUsage += memusage::DynamicUsage(vFree[i]);
+        for (const CSerializeData& vch : vFree[i])
+            nUsage += memusage::MallocUsage(vch.capacity());
+    }
+    return nUsage;
+}
+
+NodeBufferUsage GetNodeBufferUsage()
+{
+    NodeBufferUsage usage;
+    std::set<const CSerializeData*> setShared;
+    usage.nSendUsage = 0;
+    usage.nRecvUsage = 0;
+    {
+        LOCK(cs_vNodes);
+        usage.nPeers = vNodes.size();
+        for (CNode* pnode : vNodes) {
+            {
+                LOCK(pnode->cs_vSend);
+                usage.nSendUsage += memusage::MallocUsage(pnode->ssSend.capacity()) + memusage::DynamicUsage(pnode->vSendMsg);
+                for (const CSharedMessage& msg : pnode->vSendMsg) {
+                    if (setShared.insert(msg.get()).second)
+                        usage.nSendUsage += memusage::DynamicUsage(msg) + memusage::MallocUsage(msg->capacity());
+                }
+            }
+            {
+                LOCK(pnode->cs_vRecvMsg);
+                usage.nRecvUsage += memusage::DynamicUsage(pnode->vRecvMsg);
+                for (const CNetMessage& msg : pnode->vRecvMsg)
+                    usage.nRecvUsage += memusage::MallocUsage(msg.hdrbuf.capacity()) + memusage::MallocUsage(msg.vRecv.capacity());
+            }
+        }
+    }
+    usage.nRecvPoolUsage = recvBufferPool.DynamicMemoryUsage();
+    {
+        LOCK(cs_mapRelay);
+        usage.nRelayUsage = memusage::DynamicUsage(mapRelay) + memusage::DynamicUsage(vRelayExpiration);
+        for (const std::pair<const CInv, CDataStream>& item : mapRelay)
+            usage.nRelayUsage += memusage::MallocUsage(item.second.capacity());
+    }
+    return usage;
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSharedMessage>::iterator it = pnode->vSendMsg.begin();
+    const int64_t nNow = GetTimeMicros();
 
     while (it != pnode->vSendMsg.end())
     {
-        const CSerializeData &data = *it;
+        const CSerializeData &data = **it;
         assert(data.size() > pnode->nSendOffset);
 
+        // out of upload budget (-maxpeeruploadrate), the socket thread retries later
+        if (!pnode->CanSendNow(nNow))
+            break;
+
         bool bIsSSL = false;
         int nBytes = 0, nRet = 0;
         {
@@ -857,6 +995,7 @@ void SocketSendData(CNode *pnode)
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
             pnode->nSendOffset += nBytes;
+            pnode->nSendTokens -= nBytes;
             pnode->RecordBytesSent(nBytes);
 
             if (pnode->nSendOffset == data.size())
@@ -1071,6 +1210,35 @@ static bool AttemptToEvictConnection(bool fPreferNewConnection) {
 }
 
 
+/** Add an inbound connection, whose TLS handshake (if any) is completed, to vNodes */
+static void AddInboundNode(SOCKET hSocket, const CAddress& addr, bool whitelisted, SSL* ssl)
+{
+#ifdef USE_TLS
+    // certificate validation is disabled by default    
+    if (CNode::GetTlsValidate())
+    {
+        if (ssl && !ValidatePeerCertificate(ssl))
+        {
+            LogPrintf ("TLS: ERROR: Wrong client certificate from %s. Connection will be closed.\n", addr.ToString());
+        
+            SSL_shutdown(ssl);
+            CloseSocket(hSocket);
+            SSL_free(ssl);
+            return;
+        }
+    }
+#endif // USE_TLS
+
+    CNode* pnode = new CNode(hSocket, addr, "", true, ssl);
+    pnode->AddRef();
+    pnode->fWhitelisted = whitelisted;
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(pnode);
+    }
+}
+
 static void AcceptConnection(const ListenSocket& hListenSocket) {
     struct sockaddr_storage sockaddr;
     socklen_t len = sizeof(sockaddr);
@@ -1090,6 +1258,9 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
             if (pnode->fInbound)
                 nInbound++;
     }
+#ifdef USE_TLS
+    nInbound += lPendingTLSAccepts.size();
+#endif
 
     if (hSocket == INVALID_SOCKET)
     {
@@ -1133,105 +1304,113 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
 #endif
 
 
-    SSL *ssl = NULL;
-    
     SetSocketNonBlocking(hSocket, true);
-    
+
 #ifdef USE_TLS
     /* TCP connection is ready. Do server side SSL. */
-    if (CNode::GetTlsFallbackNonTls())
+    bool bUseTLS = true;
+    bool fFallback = CNode::GetTlsFallbackNonTls();
+    if (fFallback)
     {
-        LOCK(cs_vNonTLSNodesInbound);
-    
         LogPrint("tls", "%s():%d - handling connection from %s\n", __func__, __LINE__,  addr.ToString());
 
-        NODE_ADDR nodeAddr(addr.ToStringIP());
-        
-        bool bUseTLS = (find(vNonTLSNodesInbound.begin(),
-                             vNonTLSNodesInbound.end(),
-                             nodeAddr) == vNonTLSNodesInbound.end());
-        unsigned long err_code = 0;
-        if (bUseTLS)
-        {
-            ssl = tlsmanager.accept( hSocket, addr, err_code);
-            if(!ssl)
-            {
-                if (err_code == TLSManager::SELECT_TIMEDOUT)
-                {
-                    // can fail also for timeout in select on fd, that is not a ssl error and we should not
-                    // consider this node as non TLS
-                    LogPrint("tls", "%s():%d - Connection from %s timedout\n", __func__, __LINE__, addr.ToStringIP());
-                }
-                else
-                {
-                    // Further reconnection will be made in non-TLS (unencrypted) mode
-                    vNonTLSNodesInbound.push_back(NODE_ADDR(addr.ToStringIP(), GetTimeMillis()));
-                    LogPrint("tls", "%s():%d - err_code %x, adding connection from %s vNonTLSNodesInbound list (sz=%d)\n",
-                        __func__, __LINE__, err_code, addr.ToStringIP(), vNonTLSNodesInbound.size());
-                }
-                CloseSocket(hSocket);
-                return;
-            }
-        }
-        else
-        {
+        bUseTLS = !poolNonTLSNodesInbound.take(addr.ToStringIP());
+        if (!bUseTLS)
             LogPrintf ("TLS: Connection from %s will be unencrypted\n", addr.ToStringIP());
-            
-            vNonTLSNodesInbound.erase(
-                    remove(
-                            vNonTLSNodesInbound.begin(),
-                            vNonTLSNodesInbound.end(),
-                            nodeAddr
-                    ),
-                    vNonTLSNodesInbound.end());
-        }
     }
-    else
+
+    if (bUseTLS)
     {
+        // The handshake is not waited for here, as a slow or silent peer would stall every
+        // other connection: it is carried on by ProcessPendingTLSAccepts() as the socket
+        // becomes ready.
         unsigned long err_code = 0;
-        ssl = tlsmanager.accept( hSocket, addr, err_code);
-        if(!ssl)
+        SSL* ssl = tlsmanager.prepareAccept(hSocket, addr, err_code);
+        if (!ssl)
         {
             LogPrint("tls", "%s():%d - err_code %x, failure accepting connection from %s\n",
                 __func__, __LINE__, err_code, addr.ToStringIP());
             CloseSocket(hSocket);
             return;
         }
-    }
-    
-    // certificate validation is disabled by default    
-    if (CNode::GetTlsValidate())
-    {
-        if (ssl && !ValidatePeerCertificate(ssl))
-        {
-            LogPrintf ("TLS: ERROR: Wrong client certificate from %s. Connection will be closed.\n", addr.ToString());
-        
-            SSL_shutdown(ssl);
-            CloseSocket(hSocket);
-            SSL_free(ssl);
-            return;
-        }
+
+        PendingTLSAccept pending;
+        pending.hSocket = hSocket;
+        pending.addr = addr;
+        pending.fWhitelisted = whitelisted;
+        pending.ssl = ssl;
+        pending.fWantWrite = false;
+        pending.fStarted = false;
+        pending.fFallback = fFallback;
+        pending.nTimeStart = GetTimeMillis();
+        pending.nId = -2 - nPendingTLSAcceptsCount++;
+        lPendingTLSAccepts.push_back(pending);
+        return;
     }
 #endif // USE_TLS
 
-    CNode* pnode = new CNode(hSocket, addr, "", true, ssl);
-    pnode->AddRef();
-    pnode->fWhitelisted = whitelisted;
-
-    {
-        LOCK(cs_vNodes);
-        vNodes.push_back(pnode);
-    }
+    AddInboundNode(hSocket, addr, whitelisted, NULL);
 }
 
 #if defined(USE_TLS)
-void ThreadNonTLSPoolsCleaner()
+/**
+ * Carry on the TLS handshakes of the inbound connections whose socket is ready (or that
+ * have just been accepted), and add the connections whose handshake is completed to vNodes.
+ */
+static void ProcessPendingTLSAccepts(const CSocketEvents& socketEvents)
 {
-    while (true)
+    const int64_t nNow = GetTimeMillis();
+
+    std::list<PendingTLSAccept>::iterator it = lPendingTLSAccepts.begin();
+    while (it != lPendingTLSAccepts.end())
     {
-        tlsmanager.cleanNonTLSPool(vNonTLSNodesInbound,  cs_vNonTLSNodesInbound);
-        tlsmanager.cleanNonTLSPool(vNonTLSNodesOutbound, cs_vNonTLSNodesOutbound);
-        MilliSleep(DEFAULT_CONNECT_TIMEOUT);  // sleep and sleep_for are interruption points, which will throw boost::thread_interrupted
+        PendingTLSAccept& pending = *it;
+
+        int nResult = 0;
+        unsigned long err_code = 0;
+        if (!pending.fStarted || socketEvents.Ready(pending.hSocket) != 0)
+        {
+            pending.fStarted = true;
+            nResult = tlsmanager.continueAccept(pending.ssl, pending.addr, pending.fWantWrite, err_code);
+        }
+        if (nResult == 0 && nNow - pending.nTimeStart > DEFAULT_CONNECT_TIMEOUT)
+        {
+            err_code = TLSManager::SELECT_TIMEDOUT;
+            nResult = -1;
+        }
+
+        if (nResult == 1)
+        {
+            AddInboundNode(pending.hSocket, pending.addr, pending.fWhitelisted, pending.ssl);
+        }
+        else if (nResult == -1)
+        {
+            if (err_code == TLSManager::SELECT_TIMEDOUT)
+            {
+                // can fail also for timeout on fd, that is not a ssl error and we should not
+                // consider this node as non TLS
+                LogPrint("tls", "%s():%d - Connection from %s timedout\n", __func__, __LINE__, pending.addr.ToStringIP());
+            }
+            else if (pending.fFallback)
+            {
+                // Further reconnection will be made in non-TLS (unencrypted) mode
+                poolNonTLSNodesInbound.add(pending.addr.ToStringIP());
+                LogPrint("tls", "%s():%d - err_code %x, adding connection from %s poolNonTLSNodesInbound (sz=%d)\n",
+                    __func__, __LINE__, err_code, pending.addr.ToStringIP(), poolNonTLSNodesInbound.size());
+            }
+            else
+            {
+                LogPrint("tls", "%s():%d - err_code %x, failure accepting connection from %s\n",
+                    __func__, __LINE__, err_code, pending.addr.ToStringIP());
+            }
+            SSL_free(pending.ssl);
+            CloseSocket(pending.hSocket);
+        }
+
+        if (nResult != 0)
+            it = lPendingTLSAccepts.erase(it);
+        else
+            ++it;
     }
 }
 
@@ -1241,6 +1420,7 @@ void ThreadNonTLSPoolsCleaner()
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    CSocketEvents socketEvents;
     while (true)
     {
         //
@@ -1309,27 +1489,21 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+        const int64_t nTimeout = 50; // frequency to poll pnode->vSend, in milliseconds
 
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+        socketEvents.Clear();
 
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+            socketEvents.Add(hListenSocket.socket, CSocketEvents::RECV);
+
+#if defined(USE_TLS)
+        BOOST_FOREACH(const PendingTLSAccept& pending, lPendingTLSAccepts)
+            socketEvents.Add(pending.hSocket, pending.fWantWrite ? CSocketEvents::SEND : CSocketEvents::RECV, pending.nId);
+#endif
 
         {
             LOCK(cs_vNodes);
+            const int64_t nNow = GetTimeMicros();
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 LOCK(pnode->cs_hSocket);
@@ -1337,18 +1511,16 @@ void ThreadSocketHandler()
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
                 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+                int events = 0;
 
                 // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signalling.
                 // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
+                //   or there is space left in the buffer, wait for receiving data.
                 // * (if neither of the above applies, there is certainly one message
                 //   in the receiver buffer ready to be processed).
                 // Together, that means that at least one of the following is always possible,
@@ -1357,51 +1529,42 @@ void ThreadSocketHandler()
                 // * We wait for data to be received (and disconnect after timeout).
                 // * We process a message in the buffer (message handler thread).
 
+                // A peer held back by -maxpeeruploadrate is not waited for sending, it is
+                // polled again after nTimeout.
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
+                    if (lockSend && !pnode->vSendMsg.empty() && pnode->CanSendNow(nNow))
+                        events = CSocketEvents::SEND;
                 }
-                {
+                if (events == 0) {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                     if (lockRecv && (
                         pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
                         pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
+                        events = CSocketEvents::RECV;
                 }
+                socketEvents.Add(pnode->hSocket, events, pnode->id);
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        // select() on sockets beyond FD_SETSIZE is undefined, and costs O(n) in the kernel on
+        // every call: with epoll the sockets stay registered between rounds instead.
+        socketEvents.Wait(nTimeout);
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
-
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && (socketEvents.Ready(hListenSocket.socket) & CSocketEvents::RECV))
             {
                 AcceptConnection(hListenSocket);
             }
         }
+#if defined(USE_TLS)
+        ProcessPendingTLSAccepts(socketEvents);
+#endif
 
         //
         // Service each socket
@@ -1417,7 +1580,7 @@ void ThreadSocketHandler()
         {
             boost::this_thread::interruption_point();
 
-            if (tlsmanager.threadSocketHandler(pnode,fdsetRecv,fdsetSend,fdsetError)==-1){
+            if (tlsmanager.threadSocketHandler(pnode, socketEvents) == -1){
                 continue;
             }
 
@@ -1523,6 +1686,119 @@ void DumpAddresses()
            addrman.size(), GetTimeMillis() - nStart);
 }
 
+namespace {
+    struct CPendingAddresses {
+        std::vector<CAddress> vAddr;
+        CNetAddr source;
+        int64_t nTimePenalty;
+    };
+
+    boost::mutex mutexPendingAddresses;
+    //! Signalled when addresses are queued
+    boost::condition_variable condPendingAddresses;
+    std::deque<CPendingAddresses> queuePendingAddresses;
+    size_t nPendingAddresses = 0;
+    //! Whether the addrman thread takes the queued addresses, they are added inline otherwise
+    bool fAddressThreadRunning = false;
+}
+
+void QueueAddresses(const std::vector<CAddress>& vAddr, const CNetAddr& source, int64_t nTimePenalty)
+{
+    if (vAddr.empty())
+        return;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexPendingAddresses);
+        if (fAddressThreadRunning) {
+            if (nPendingAddresses + vAddr.size() > MAX_PENDING_ADDRESSES) {
+                LogPrint("net", "dropping %u addresses from %s, %u are waiting already\n", vAddr.size(), source.ToString(), nPendingAddresses);
+                return;
+            }
+            CPendingAddresses pending;
+            pending.vAddr = vAddr;
+            pending.source = source;
+            pending.nTimePenalty = nTimePenalty;
+            queuePendingAddresses.push_back(pending);
+            nPendingAddresses += vAddr.size();
+            condPendingAddresses.notify_one();
+            return;
+        }
+    }
+    addrman.Add(vAddr, source, nTimePenalty);
+}
+
+/** Add the addresses queued so far to addrman */
+static void AddPendingAddresses(std::deque<CPendingAddresses>& queue)
+{
+    BOOST_FOREACH(const CPendingAddresses& pending, queue) {
+        addrman.Add(pending.vAddr, pending.source, pending.nTimePenalty);
+    }
+    queue.clear();
+}
+
+static void ThreadAddressIngestion()
+{
+    while (true) {
+        std::deque<CPendingAddresses> queue;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexPendingAddresses);
+            while (queuePendingAddresses.empty())
+                condPendingAddresses.wait(lock);
+            // Everything queued while the previous batch was added goes in this one
+            queue.swap(queuePendingAddresses);
+            nPendingAddresses = 0;
+        }
+        AddPendingAddresses(queue);
+    }
+}
+
+/** The outbound TLS peers which have been connected the longest, up to MAX_ANCHOR_PEERS */
+static void DumpAnchors()
+{
+    std::vector<std::pair<int64_t, CAnchorPeer> > vCandidates;
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes) {
+            if (pnode->fInbound || pnode->fOneShot || !pnode->fSuccessfullyConnected || pnode->fDisconnect ||
+                pnode->tlsCertFingerprint.IsNull() || !pnode->addr.IsRoutable())
+                continue;
+            vCandidates.push_back(std::make_pair(pnode->nTimeConnected, CAnchorPeer(pnode->addr, pnode->tlsCertFingerprint)));
+        }
+    }
+    std::sort(vCandidates.begin(), vCandidates.end(),
+              [](const std::pair<int64_t, CAnchorPeer>& a, const std::pair<int64_t, CAnchorPeer>& b) { return a.first < b.first; });
+
+    std::vector<CAnchorPeer> vAnchors;
+    for (size_t i = 0; i < vCandidates.size() && vAnchors.size() < MAX_ANCHOR_PEERS; i++)
+        vAnchors.push_back(vCandidates[i].second);
+
+    CAnchorDB adb;
+    if (adb.Write(vAnchors))
+        LogPrint("net", "Flushed %d anchor peers to anchors.dat\n", vAnchors.size());
+}
+
+/**
+ * Connect to an anchor peer, in a thread of its own so that the anchors are all dialed and
+ * their handshakes done at once. A peer which presents another certificate than the one
+ * saved is not the peer known good, and is disconnected.
+ */
+static void OpenAnchorConnection(const CAnchorPeer& anchor)
+{
+    CSemaphoreGrant grant(*semOutbound, true);
+    if (!grant)
+        return;
+    if (!OpenNetworkConnection(anchor.addr, &grant))
+        return;
+
+    LOCK(cs_vNodes);
+    CNode* pnode = FindNode((CService)anchor.addr);
+    if (pnode && pnode->tlsCertFingerprint != anchor.certFingerprint) {
+        LogPrintf("Anchor peer %s presented another certificate, disconnecting\n", anchor.addr.ToString());
+        pnode->fDisconnect = true;
+    } else if (pnode) {
+        LogPrint("net", "Connected to anchor peer %s\n", anchor.addr.ToString());
+    }
+}
+
 void static ProcessOneShot()
 {
     string strDest;
@@ -1541,11 +1817,75 @@ void static ProcessOneShot()
     }
 }
 
-void ThreadOpenConnections()
+namespace {
+
+/** The outbound connection attempts of the connectors in flight, by network group and by network */
+CCriticalSection cs_setConnecting;
+std::set<std::vector<unsigned char> > setConnectingGroups;
+int anConnecting[NET_MAX] = {};
+
+/** Holds an attempt to connect to a group in flight, for the other connectors to pick other groups */
+class CConnectAttempt
+{
+public:
+    CConnectAttempt() : fReserved(false) {}
+
+    ~CConnectAttempt()
+    {
+        if (!fReserved)
+            return;
+        LOCK(cs_setConnecting);
+        setConnectingGroups.erase(vGroup);
+        anConnecting[nNetwork]--;
+    }
+
+    //! False if another connector is connecting to the group of addr
+    bool Reserve(const CNetAddr& addr)
+    {
+        LOCK(cs_setConnecting);
+        vGroup = addr.GetGroup();
+        if (!setConnectingGroups.insert(vGroup).second)
+            return false;
+        nNetwork = addr.GetNetwork();
+        anConnecting[nNetwork]++;
+        fReserved = true;
+        return true;
+    }
+
+private:
+    bool fReserved;
+    std::vector<unsigned char> vGroup;
+    int nNetwork;
+};
+
+bool IsConnectingToGroup(const std::vector<unsigned char>& vGroup)
+{
+    LOCK(cs_setConnecting);
+    return setConnectingGroups.count(vGroup) > 0;
+}
+
+int CountConnecting(enum Network net)
+{
+    LOCK(cs_setConnecting);
+    return anConnecting[net];
+}
+
+} // anon namespace
+
+/**
+ * Open outbound connections to the addresses of the address manager. nConnectThreads
+ * connectors run this at once, each with an attempt in flight, so a peer which does not
+ * answer only holds up its connector for nConnectTimeout. Like Happy Eyeballs, the
+ * connectors first try the networks (IPv4, IPv6, Tor) no other connector is trying, so that
+ * a network which is slow or down does not hold up all of them.
+ */
+void ThreadOpenConnections(int nConnector)
 {
     // Connect to specific addresses
     if (mapArgs.count("-connect") && mapMultiArgs["-connect"].size() > 0)
     {
+        if (nConnector > 0)
+            return;
         for (int64_t nLoop = 0;; nLoop++)
         {
             ProcessOneShot();
@@ -1575,7 +1915,7 @@ void ThreadOpenConnections()
         boost::this_thread::interruption_point();
 
         // Add seed nodes if DNS seeds are all down (an infrastructure attack?).
-        if (addrman.size() == 0 && (GetTime() - nStart > 60)) {
+        if (nConnector == 0 && addrman.size() == 0 && (GetTime() - nStart > 60)) {
             static bool done = false;
             if (!done) {
                 LogPrintf("Adding fixed seed nodes as DNS doesn't seem to be available.\n");
@@ -1624,6 +1964,14 @@ void ThreadOpenConnections()
             if (IsLimited(addr))
                 continue;
 
+            // another connector is trying this group
+            if (IsConnectingToGroup(addr.GetGroup()))
+                continue;
+
+            // try the networks another connector is trying only after 20 attempts
+            if (nTries < 20 && CountConnecting(addr.GetNetwork()) > 0)
+                continue;
+
             // only consider very recently tried nodes after 30 failed attempts
             if (nANow - addr.nLastTry < 600 && nTries < 30)
                 continue;
@@ -1636,8 +1984,11 @@ void ThreadOpenConnections()
             break;
         }
 
-        if (addrConnect.IsValid())
-            OpenNetworkConnection(addrConnect, &grant);
+        if (addrConnect.IsValid()) {
+            CConnectAttempt attempt;
+            if (attempt.Reserve(addrConnect))
+                OpenNetworkConnection(addrConnect, &grant);
+        }
     }
 }
 
@@ -1743,7 +2094,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
             else
                 SplitHostPort(string(pszDest), port, strDest);
         
-            if (tlsmanager.isNonTLSAddr(strDest, vNonTLSNodesOutbound, cs_vNonTLSNodesOutbound))
+            if (poolNonTLSNodesOutbound.contains(strDest))
             {
                 // Attempt to reconnect in non-TLS mode
                 pnode = ConnectNode(addrConnect, pszDest);
@@ -1767,7 +2118,13 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+/**
+ * Process the messages of the peers in shard nShard, i.e. whose id modulo
+ * nMessageHandlerThreads is nShard. The messages of a peer are thus always processed
+ * in order by the same thread, while the different shards run concurrently; the state
+ * shared by peers is protected by cs_main and the locks of the objects involved.
+ */
+void ThreadMessageHandler(int nShard)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1776,18 +2133,22 @@ void ThreadMessageHandler()
     while (true)
     {
         vector<CNode*> vNodesCopy;
+        // The trickle node is drawn among all the peers, so that each one is picked
+        // as often as with a single message handler thread.
+        CNode* pnodeTrickle = NULL;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
+            if (!vNodes.empty())
+                pnodeTrickle = vNodes[GetRand(vNodes.size())];
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->id % nMessageHandlerThreads != nShard)
+                    continue;
+                vNodesCopy.push_back(pnode);
                 pnode->AddRef();
             }
         }
 
         // Poll the connected nodes for messages
-        CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
-            pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
 
         bool fSleep = true;
 
@@ -1806,7 +2167,7 @@ void ThreadMessageHandler()
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() || pnode->fMoreWork || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
                             fSleep = false;
                         }
@@ -2053,22 +2414,39 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Initiate outbound connections from -addnode
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "addcon", &ThreadOpenAddedConnections));
 
+    // Reconnect to the anchor peers at once, before the other outbound connections
+    if (!mapArgs.count("-connect") || mapMultiArgs["-connect"].size() == 0) {
+        std::vector<CAnchorPeer> vAnchors;
+        CAnchorDB adb;
+        if (adb.Read(vAnchors))
+            LogPrintf("Loaded %d anchor peers from anchors.dat\n", vAnchors.size());
+        BOOST_FOREACH(const CAnchorPeer& anchor, vAnchors) {
+            if (IsLimited(anchor.addr) || CNode::IsBanned(anchor.addr))
+                continue;
+            threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "anchor",
+                                                  boost::function<void()>(boost::bind(&OpenAnchorConnection, anchor))));
+        }
+    }
+
     // Initiate outbound connections
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
+    for (int i = 0; i < nConnectThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "opencon",
+                                              boost::function<void()>(boost::bind(&ThreadOpenConnections, i))));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand",
+                                              boost::function<void()>(boost::bind(&ThreadMessageHandler, i))));
 
-#if defined(USE_TLS)
-    if (CNode::GetTlsFallbackNonTls())
+    // Add the addresses peers send us
     {
-        // Clean pools of addresses for non-TLS connections
-        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "poolscleaner", &ThreadNonTLSPoolsCleaner));
+        boost::unique_lock<boost::mutex> lock(mutexPendingAddresses);
+        fAddressThreadRunning = true;
     }
-#endif
-    
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "addrman", &ThreadAddressIngestion));
+
     // Dump network addresses
-    scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL, SCHEDULER_PRIORITY_LOW, "dumpaddresses");
 }
 
 bool StopNode()
@@ -2078,8 +2456,19 @@ bool StopNode()
         for (int i=0; i<MAX_OUTBOUND_CONNECTIONS; i++)
             semOutbound->post();
 
+    // The addresses still queued are saved with the others
+    std::deque<CPendingAddresses> queue;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexPendingAddresses);
+        fAddressThreadRunning = false;
+        queue.swap(queuePendingAddresses);
+        nPendingAddresses = 0;
+    }
+    AddPendingAddresses(queue);
+
     if (fAddressesInitialized)
     {
+        DumpAnchors();
         DumpAddresses();
         fAddressesInitialized = false;
     }
@@ -2165,6 +2554,124 @@ void CNode::RecordBytesSent(uint64_t bytes)
 {
     LOCK(cs_totalBytesSent);
     nTotalBytesSent += bytes;
+
+    uint64_t now = GetTime();
+    if (nMaxOutboundCycleStartTime + nMaxOutboundTimeframe < now)
+    {
+        // timeframe expired, reset cycle
+        nMaxOutboundCycleStartTime = now;
+        nMaxOutboundTotalBytesSentInCycle = 0;
+    }
+
+    nMaxOutboundTotalBytesSentInCycle += bytes;
+}
+
+// Bytes which can be left for relaying each new block once, while the cycle lasts
+static uint64_t OutboundBlockRelayBuffer(uint64_t nTimeLeft)
+{
+    return nTimeLeft / Params().GetConsensus().nPowTargetSpacing * MAX_BLOCK_SIZE;
+}
+
+void CNode::SetMaxOutboundTarget(uint64_t limit)
+{
+    LOCK(cs_totalBytesSent);
+    uint64_t recommendedMinimum = OutboundBlockRelayBuffer(nMaxOutboundTimeframe);
+    nMaxOutboundLimit = limit;
+
+    if (limit > 0 && limit < recommendedMinimum)
+        LogPrintf("Max outbound target is very small (%s bytes) and will be overshot. Recommended minimum is %s bytes.\n", nMaxOutboundLimit, recommendedMinimum);
+}
+
+uint64_t CNode::GetMaxOutboundTarget()
+{
+    LOCK(cs_totalBytesSent);
+    return nMaxOutboundLimit;
+}
+
+uint64_t CNode::GetMaxOutboundTimeframe()
+{
+    LOCK(cs_totalBytesSent);
+    return nMaxOutboundTimeframe;
+}
+
+uint64_t CNode::GetMaxOutboundTimeLeftInCycle()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+
+    if (nMaxOutboundCycleStartTime == 0)
+        return nMaxOutboundTimeframe;
+
+    uint64_t cycleEndTime = nMaxOutboundCycleStartTime + nMaxOutboundTimeframe;
+    uint64_t now = GetTime();
+    return (cycleEndTime < now) ? 0 : cycleEndTime - now;
+}
+
+void CNode::SetMaxOutboundTimeframe(uint64_t timeframe)
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundTimeframe != timeframe)
+    {
+        // reset measure-cycle in case of changing
+        // the timeframe
+        nMaxOutboundCycleStartTime = GetTime();
+    }
+    nMaxOutboundTimeframe = timeframe;
+}
+
+bool CNode::OutboundTargetReached(bool historicalBlockServingLimit)
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return false;
+
+    if (historicalBlockServingLimit)
+    {
+        // keep a large enough buffer to at least relay each block once
+        uint64_t buffer = OutboundBlockRelayBuffer(GetMaxOutboundTimeLeftInCycle());
+        if (buffer >= nMaxOutboundLimit || nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit - buffer)
+            return true;
+    }
+    else if (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit)
+        return true;
+
+    return false;
+}
+
+uint64_t CNode::GetOutboundTargetBytesLeft()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+
+    return (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit) ? 0 : nMaxOutboundLimit - nMaxOutboundTotalBytesSentInCycle;
+}
+
+void CNode::SetMaxPeerUploadRate(int64_t nRate)
+{
+    nMaxPeerUploadRate = nRate;
+}
+
+int64_t CNode::GetMaxPeerUploadRate()
+{
+    return nMaxPeerUploadRate;
+}
+
+bool CNode::CanSendNow(int64_t nTimeMicros)
+{
+    if (nMaxPeerUploadRate == 0 || fWhitelisted)
+        return true;
+
+    // Token bucket: the peer earns nMaxPeerUploadRate bytes per second, and may save
+    // at most one second of them. A message is sent as a whole (SSL_write must be retried
+    // with the same length), which may leave the bucket in debt until it is refilled.
+    if (nTimeMicros > nSendTokensTime) {
+        double dTokens = nSendTokens + (nTimeMicros - nSendTokensTime) * 0.000001 * nMaxPeerUploadRate;
+        nSendTokens = dTokens < nMaxPeerUploadRate ? (int64_t)dTokens : nMaxPeerUploadRate;
+        nSendTokensTime = nTimeMicros;
+    }
+    return nSendTokens > 0;
 }
 
 uint64_t CNode::GetTotalBytesRecv()
@@ -2218,22 +2725,19 @@ void CNode::Fuzz(int nChance)
 // CAddrDB
 //
 
-CAddrDB::CAddrDB()
-{
-    pathAddr = GetDataDir() / "peers.dat";
-}
-
-bool CAddrDB::Write(const CAddrMan& addr)
+/** Write data, with the magic of the network and a checksum, to path through a temporary file */
+template <typename Data>
+static bool SerializeFileDB(const std::string& strPrefix, const boost::filesystem::path& path, const Data& data)
 {
     // Generate random temporary filename
     unsigned short randv = 0;
     GetRandBytes((unsigned char*)&randv, sizeof(randv));
-    std::string tmpfn = strprintf("peers.dat.%04x", randv);
+    std::string tmpfn = strprintf("%s.%04x", strPrefix, randv);
 
-    // serialize addresses, checksum data up to that point, then append csum
+    // serialize the data, checksum data up to that point, then append csum
     CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
     ssPeers << FLATDATA(Params().MessageStart());
-    ssPeers << addr;
+    ssPeers << data;
     uint256 hash = Hash(ssPeers.begin(), ssPeers.end());
     ssPeers << hash;
 
@@ -2254,23 +2758,25 @@ bool CAddrDB::Write(const CAddrMan& addr)
     FileCommit(fileout.Get());
     fileout.fclose();
 
-    // replace existing peers.dat, if any, with new peers.dat.XXXX
-    if (!RenameOver(pathTmp, pathAddr))
+    // replace the existing file, if any, with the temporary one
+    if (!RenameOver(pathTmp, path))
         return error("%s: Rename-into-place failed", __func__);
 
     return true;
 }
 
-bool CAddrDB::Read(CAddrMan& addr)
+/** Read the data SerializeFileDB wrote to path, checking its checksum and network */
+template <typename Data>
+static bool DeserializeFileDB(const boost::filesystem::path& path, Data& data)
 {
     // open input file, and associate with CAutoFile
-    FILE *file = fopen(pathAddr.string().c_str(), "rb");
+    FILE *file = fopen(path.string().c_str(), "rb");
     CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
-        return error("%s: Failed to open file %s", __func__, pathAddr.string());
+        return error("%s: Failed to open file %s", __func__, path.string());
 
     // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathAddr);
+    int fileSize = boost::filesystem::file_size(path);
     int dataSize = fileSize - sizeof(uint256);
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
@@ -2305,8 +2811,8 @@ bool CAddrDB::Read(CAddrMan& addr)
         if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
             return error("%s: Invalid network magic number", __func__);
 
-        // de-serialize address data into one CAddrMan object
-        ssPeers >> addr;
+        // de-serialize the data
+        ssPeers >> data;
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -2315,13 +2821,58 @@ bool CAddrDB::Read(CAddrMan& addr)
     return true;
 }
 
+CAddrDB::CAddrDB()
+{
+    pathAddr = GetDataDir() / "peers.dat";
+}
+
+bool CAddrDB::Write(const CAddrMan& addr)
+{
+    return SerializeFileDB("peers.dat", pathAddr, addr);
+}
+
+bool CAddrDB::Read(CAddrMan& addr)
+{
+    return DeserializeFileDB(pathAddr, addr);
+}
+
+//
+// CAnchorDB
+//
+
+CAnchorDB::CAnchorDB()
+{
+    pathAnchors = GetDataDir() / "anchors.dat";
+}
+
+bool CAnchorDB::Write(const std::vector<CAnchorPeer>& vAnchors)
+{
+    return SerializeFileDB("anchors.dat", pathAnchors, vAnchors);
+}
+
+bool CAnchorDB::Read(std::vector<CAnchorPeer>& vAnchors)
+{
+    if (!boost::filesystem::exists(pathAnchors))
+        return false;
+    bool fRead = DeserializeFileDB(pathAnchors, vAnchors);
+    if (vAnchors.size() > MAX_ANCHOR_PEERS)
+        vAnchors.resize(MAX_ANCHOR_PEERS);
+    boost::system::error_code ec;
+    boost::filesystem::remove(pathAnchors, ec);
+    return fRead;
+}
+
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds) {
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
 CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn, SSL *sslIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
     addrKnown(5000, 0.001),
-    setInventoryKnown(SendBufferSize() / 1000)
+    filterInventoryKnown(nMaxKnownInventory, 0.000001)
 {
     ssl = sslIn;
     nServices = 0;
@@ -2344,12 +2895,16 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fMoreWork = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nSendTokens = nMaxPeerUploadRate;
+    nSendTokensTime = GetTimeMicros();
     hashContinue = uint256();
     nStartingHeight = -1;
     fGetAddr = false;
+    nNextInvSend = 0;
     fRelayTxes = false;
     fSentAddr = false;
     pfilter = new CBloomFilter();
@@ -2477,6 +3032,23 @@ void CNode::AskFor(const CInv& inv)
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
+/** Fill in the size and the checksum of the message in ss, return the size of its payload */
+static unsigned int SetMessageSizeAndChecksum(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    WriteLE32((uint8_t*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    return nSize;
+}
+
 void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
@@ -2513,26 +3085,50 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
-
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    unsigned int nSize = SetMessageSizeAndChecksum(ssSend);
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    std::shared_ptr<CSerializeData> data = std::make_shared<CSerializeData>();
+    ssSend.GetAndClear(*data);
+    vSendMsg.push_back(data);
+    nSendSize += data->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
+
+void CNode::PushSharedMessage(const CSharedMessage& msg)
+{
+    LOCK(cs_vSend);
+    assert(ssSend.size() == 0);
+
+    const char* pszCommand = &(*msg)[MESSAGE_START_SIZE];
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", SanitizeString(std::string(pszCommand, strnlen(pszCommand, CMessageHeader::COMMAND_SIZE))),
+        msg->size() - CMessageHeader::HEADER_SIZE, id);
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+
+    // If write queue empty, attempt "optimistic write"
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
+
+void BeginSharedMessage(CDataStream& ss, const char* pszCommand)
+{
+    assert(ss.size() == 0);
+    ss << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+}
+
+CSharedMessage EndSharedMessage(CDataStream& ss)
+{
+    SetMessageSizeAndChecksum(ss);
+
+    std::shared_ptr<CSerializeData> data = std::make_shared<CSerializeData>();
+    ss.GetAndClear(*data);
+    return data;
+}
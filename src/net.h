@@ -10,7 +10,6 @@
 #include "compat.h"
 #include "hash.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -20,6 +19,7 @@
 #include "utilstrencodings.h"
 
 #include <deque>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -62,12 +62,46 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
+/** -msghandlerthreads default (number of threads processing peer messages) */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 1;
+/** Maximum number of threads processing peer messages */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
+/** -connectthreads default (number of outbound connection attempts in flight) */
+static const int DEFAULT_CONNECT_THREADS = 4;
+/** Maximum number of outbound connection attempts in flight */
+static const int MAX_CONNECT_THREADS = 8;
+/** -maxknowninventory default (inventory entries remembered as known to each peer, so as not to announce them) */
+static const unsigned int DEFAULT_MAX_KNOWN_INVENTORY = 50000;
+/** Bounds of -maxknowninventory: below, a peer would be announced the same inventory over and over */
+static const unsigned int MIN_KNOWN_INVENTORY = 1000;
+static const unsigned int MAX_KNOWN_INVENTORY = 1000000;
+/** -maxuploadtarget default (MiB per timeframe, 0 = no limit) */
+static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
+/** The timeframe of -maxuploadtarget (in seconds) */
+static const uint64_t MAX_UPLOAD_TIMEFRAME = 60 * 60 * 24;
+/** Blocks older than this (in seconds) are historical, they are not served anymore once the upload target is near */
+static const int64_t HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
+/** The maximum number of outbound peers saved at shutdown, to connect to first at startup */
+static const unsigned int MAX_ANCHOR_PEERS = 4;
+/** -maxpeeruploadrate default (KiB per second to each peer, 0 = no limit) */
+static const unsigned int DEFAULT_MAX_PEER_UPLOAD_RATE = 0;
+/** The maximum number of addresses from addr messages waiting to be added to addrman, more are dropped */
+static const size_t MAX_PENDING_ADDRESSES = 10000;
 
 unsigned int ReceiveFloodSize();
+
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
 unsigned int SendBufferSize();
 
 void AddOneShot(const std::string& strDest);
 void AddressCurrentlyConnected(const CService& addr);
+/**
+ * Add addresses a peer sent us to addrman. While the node runs they are queued to the
+ * "addrman" thread, which adds everything queued meanwhile at once, so that the
+ * message handler doesn't wait for addrman.
+ */
+void QueueAddresses(const std::vector<CAddress>& vAddr, const CNetAddr& source, int64_t nTimePenalty);
 CNode* FindNode(const CNetAddr& ip);
 CNode* FindNode(const CSubNet& subNet);
 CNode* FindNode(const std::string& addrName);
@@ -79,6 +113,26 @@ bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+
+/**
+ * A whole serialized message (header included). It can be queued to any number of
+ * nodes without being copied, e.g. a new block requested by most of them.
+ */
+typedef std::shared_ptr<const CSerializeData> CSharedMessage;
+
+/** Write the header of a shared message to ss, the payload is to be appended */
+void BeginSharedMessage(CDataStream& ss, const char* pszCommand);
+/** Complete the header of the message in ss and move it into a shared message */
+CSharedMessage EndSharedMessage(CDataStream& ss);
+
+template<typename T1>
+CSharedMessage MakeSharedMessage(const char* pszCommand, const T1& a1)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    BeginSharedMessage(ss, pszCommand);
+    ss << a1;
+    return EndSharedMessage(ss);
+}
 SSL_CTX* create_context(bool server_side);
 EVP_PKEY *generate_key();
 X509 *generate_x509(EVP_PKEY *pkey);
@@ -156,6 +210,12 @@ extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+/** Number of message handler threads; each one processes the peers whose id modulo this number is its own */
+extern int nMessageHandlerThreads;
+/** Number of threads opening outbound connections, each with one attempt in flight */
+extern int nConnectThreads;
+/** Size of the rolling bloom filter of the inventory known to each peer */
+extern unsigned int nMaxKnownInventory;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -209,6 +269,51 @@ public:
 
 
 
+/**
+ * Pool of receive buffers, kept by power of two size classes. The buffer of a message is
+ * given back once the message is processed, so that receiving the same kind of messages
+ * over and over (or a block after another) does not allocate and free each time.
+ */
+class CRecvBufferPool
+{
+public:
+    static const size_t MIN_BUFFER_SIZE = 1024;
+    static const int NUM_SIZE_CLASSES = 12; // up to MAX_PROTOCOL_MESSAGE_LENGTH
+    /** Memory kept free per size class, at least MIN_BUFFERS_PER_CLASS buffers are kept */
+    static const size_t MAX_CLASS_BYTES = 256 * 1024;
+    static const size_t MIN_BUFFERS_PER_CLASS = 2;
+
+    /** Make vch an empty buffer able to hold nSize bytes without reallocation */
+    void Get(CSerializeData& vch, size_t nSize);
+    /** Give back vch, which is left empty */
+    void Release(CSerializeData& vch);
+
+    /** Number of free buffers, for testing */
+    size_t GetFreeCount();
+    /** Memory the free buffers take */
+    size_t DynamicMemoryUsage();
+
+private:
+    CCriticalSection cs;
+    std::vector<CSerializeData> vFree[NUM_SIZE_CLASSES];
+};
+
+/** The memory of the messages of the peers, for getmemoryinfo */
+struct NodeBufferUsage
+{
+    size_t nPeers;
+    //! Messages being built and queued to send, each counted once however many peers it is queued for
+    size_t nSendUsage;
+    //! Messages received and being received
+    size_t nRecvUsage;
+    //! Free receive buffers kept by the pool
+    size_t nRecvPoolUsage;
+    //! Transactions kept to answer getdata, in mapRelay
+    size_t nRelayUsage;
+};
+
+NodeBufferUsage GetNodeBufferUsage();
+
 class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
@@ -230,6 +335,8 @@ public:
         nTime = 0;
     }
 
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -257,6 +364,8 @@ class CNode
 public:
     // OpenSSL
     SSL *ssl;
+    // SHA-256 of the certificate of an outbound TLS peer, null otherwise
+    uint256 tlsCertFingerprint;
 
     // socket
     uint64_t nServices;
@@ -266,12 +375,17 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSharedMessage> vSendMsg;
     CCriticalSection cs_vSend;
+    // upload rate pacing (-maxpeeruploadrate): bytes which may be sent, and when they were last refilled
+    int64_t nSendTokens;
+    int64_t nSendTokensTime;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // set by ProcessMessages when it left work queued for this peer, guarded by cs_vRecvMsg
+    bool fMoreWork;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -337,13 +451,20 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    //! Protects vAddrToSend and addrKnown, which message handler threads of other peers fill in
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
+    // Transactions to announce, in a batch once nNextInvSend is reached
+    std::set<uint256> setInventoryTxToSend;
+    // Other inventory (blocks), announced at the next SendMessages()
     std::vector<CInv> vInventoryToSend;
+    //! Protects the above, which message handler threads of other peers fill in
     CCriticalSection cs_inventory;
+    int64_t nNextInvSend;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
 
@@ -369,6 +490,15 @@ private:
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
 
+    // outbound limit & stats
+    static uint64_t nMaxOutboundTotalBytesSentInCycle;
+    static uint64_t nMaxOutboundCycleStartTime;
+    static uint64_t nMaxOutboundLimit;
+    static uint64_t nMaxOutboundTimeframe;
+
+    // bytes per second which may be sent to a non-whitelisted peer, 0 for no limit
+    static int64_t nMaxPeerUploadRate;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -419,6 +549,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -427,6 +558,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -441,7 +573,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
@@ -449,7 +581,11 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (filterInventoryKnown.contains(inv.hash))
+                return;
+            if (inv.type == MSG_TX)
+                setInventoryTxToSend.insert(inv.hash);
+            else
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -465,6 +601,9 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    /** Queue a message built by MakeSharedMessage(), which must not depend on the node's version */
+    void PushSharedMessage(const CSharedMessage& msg);
+
     void PushVersion();
 
 
@@ -663,6 +802,34 @@ public:
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
 
+    //! set the max outbound target in bytes
+    static void SetMaxOutboundTarget(uint64_t limit);
+    static uint64_t GetMaxOutboundTarget();
+
+    //! set the timeframe for the max outbound target
+    static void SetMaxOutboundTimeframe(uint64_t timeframe);
+    static uint64_t GetMaxOutboundTimeframe();
+
+    //! check if the outbound target is reached
+    // if param historicalBlockServingLimit is set true, the function will
+    // response true if the limit for serving historical blocks has been reached
+    static bool OutboundTargetReached(bool historicalBlockServingLimit);
+
+    //! response the bytes left in the current max outbound cycle
+    // in case of no limit, it will always response 0
+    static uint64_t GetOutboundTargetBytesLeft();
+
+    //! response the time in second left in the current max outbound cycle
+    // in case of no limit, it will always response 0
+    static uint64_t GetMaxOutboundTimeLeftInCycle();
+
+    //! set the upload rate limit of each non-whitelisted peer, in bytes per second (0 for no limit)
+    static void SetMaxPeerUploadRate(int64_t nRate);
+    static int64_t GetMaxPeerUploadRate();
+
+    //! whether the upload rate limit allows sending to this peer now (requires cs_vSend)
+    bool CanSendNow(int64_t nTimeMicros);
+
     // resource deallocation on cleanup, called at node shutdown
     static void NetCleanup();
 
@@ -688,4 +855,39 @@ public:
     bool Read(CAddrMan& addr);
 };
 
+/** An outbound TLS peer connected at shutdown */
+struct CAnchorPeer
+{
+    CAddress addr;
+    //! The SHA-256 of its certificate, which it must present again
+    uint256 certFingerprint;
+
+    CAnchorPeer() {}
+    CAnchorPeer(const CAddress& addrIn, const uint256& certFingerprintIn) : addr(addrIn), certFingerprint(certFingerprintIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(addr);
+        READWRITE(certFingerprint);
+    }
+};
+
+/**
+ * Access to the anchor peers (anchors.dat): the outbound peers known good at shutdown,
+ * dialed at once at startup for a restarted node to reach its peers and the tip in seconds,
+ * rather than after the DNS seeds and the guesses of the address manager.
+ */
+class CAnchorDB
+{
+private:
+    boost::filesystem::path pathAnchors;
+public:
+    CAnchorDB();
+    bool Write(const std::vector<CAnchorPeer>& vAnchors);
+    //! Read the anchors and delete the file, so that anchors which fail are not tried at every start
+    bool Read(std::vector<CAnchorPeer>& vAnchors);
+};
+
 #endif // BITCOIN_NET_H
@@ -207,5 +207,11 @@ bool SetSocketNonBlocking(SOCKET& hSocket, bool fNonBlocking);
  * Convert milliseconds to a struct timeval for e.g. select.
  */
 struct timeval MillisToTimeval(int64_t nTimeout);
+/**
+ * Wait until hSocket can be read from (or written to, with fWrite), for at most
+ * nTimeout milliseconds. Unlike select(), it is not limited to sockets below FD_SETSIZE.
+ * @return a positive value if the socket is ready, 0 on timeout, SOCKET_ERROR on error
+ */
+int WaitForSocket(SOCKET hSocket, bool fWrite, int64_t nTimeout);
 
 #endif // BITCOIN_NETBASE_H
@@ -0,0 +1,212 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notescan.h"
+
+#include "primitives/block.h"
+#include "util.h"
+#include "zcash/Note.hpp"
+
+#include <boost/scoped_ptr.hpp>
+
+static const char DB_NOTE = 'n';
+static const char DB_NOTE_HEIGHT = 'h';
+static const char DB_KEY = 'k';
+static const char DB_BEST_BLOCK = 'B';
+
+CNoteScanDB::CNoteScanDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CLevelDBWrapper(GetDataDir() / "notescan", nCacheSize, fMemory, fWipe, CLevelDBProfile::NoteScan().ApplyArgs()) {
+}
+
+bool CNoteScanDB::ReadBestBlock(uint256& hashBest) const {
+    return Read(DB_BEST_BLOCK, hashBest);
+}
+
+bool CNoteScanDB::ReadKeys(std::vector<CNoteScanKey>& vKeys) const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewSeekIterator());
+    const char chPrefix = DB_KEY;
+    pcursor->Seek(leveldb::Slice(&chPrefix, 1));
+
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (!slKey.starts_with(leveldb::Slice(&chPrefix, 1)))
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CNoteScanKey key;
+            ssValue >> key;
+            vKeys.push_back(key);
+        }
+    } catch (const std::exception& e) {
+        return error("%s: deserialize error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CNoteScanDB::ReadNotes(const libzcash::PaymentAddress& address, std::vector<std::pair<CNoteScanEntryKey, CNoteScanEntry> >& vNotes,
+                            int nStart) const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewSeekIterator());
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << DB_NOTE << address;
+    const size_t nPrefixSize = ssKey.size();
+    if (nStart > 0)
+        ser_writedata32be(ssKey, nStart);
+    pcursor->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (!slKey.starts_with(leveldb::Slice(&ssKey[0], nPrefixSize)))
+                break;
+            CDataStream ssEntry(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CNoteScanEntryKey key;
+            ssEntry >> chType >> key;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CNoteScanEntry entry;
+            ssValue >> entry;
+            vNotes.push_back(std::make_pair(key, entry));
+        }
+    } catch (const std::exception& e) {
+        return error("%s: deserialize error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+void CNoteScanBatch::WriteNote(const CNoteScanEntryKey& key, const CNoteScanEntry& entry)
+{
+    batch.Write(std::make_pair(DB_NOTE, key), entry);
+    batch.Write(std::make_pair(DB_NOTE_HEIGHT, CNoteScanHeightKey(key)), '\0');
+    mapWritten[key.nHeight].push_back(key);
+    nChanges += 2;
+}
+
+void CNoteScanBatch::EraseNote(const CNoteScanEntryKey& key)
+{
+    batch.Erase(std::make_pair(DB_NOTE, key));
+    batch.Erase(std::make_pair(DB_NOTE_HEIGHT, CNoteScanHeightKey(key)));
+    nChanges += 2;
+}
+
+size_t CNoteScanBatch::ScanBlock(const CBlock& block, int nHeight, uint64_t nFirstPosition,
+                                 const std::vector<const CNoteScanDecryptor*>& vDecryptors)
+{
+    size_t nFound = 0;
+    uint64_t nPosition = nFirstPosition;
+    std::vector<ZCNoteDecryption::BatchItem> vItems;
+    std::vector<boost::optional<ZCNoteDecryption::Plaintext> > vPlaintexts;
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
+        for (unsigned int js = 0; js < tx.vjoinsplit.size(); js++) {
+            const JSDescription& jsdesc = tx.vjoinsplit[js];
+            if (vDecryptors.empty()) {
+                nPosition += jsdesc.commitments.size();
+                continue;
+            }
+            const uint256 hSig = jsdesc.h_sig(params, tx.joinSplitPubKey);
+            vItems.clear();
+            for (unsigned char j = 0; j < jsdesc.ciphertexts.size(); j++)
+                vItems.push_back({&jsdesc.ciphertexts[j], &jsdesc.ephemeralKey, &hSig, j});
+            for (const CNoteScanDecryptor* pdecryptor : vDecryptors) {
+                if (pdecryptor->decryptor.try_decrypt_batch(vItems, vPlaintexts) == 0)
+                    continue;
+                for (unsigned char j = 0; j < vItems.size(); j++) {
+                    if (!vPlaintexts[j])
+                        continue;
+                    try {
+                        const libzcash::NotePlaintext plaintext = libzcash::NotePlaintext::deserialize(*vPlaintexts[j]);
+                        const libzcash::Note note = plaintext.note(pdecryptor->address);
+                        // Check note plaintext against note commitment
+                        if (note.cm() != jsdesc.commitments[j])
+                            continue;
+                        CNoteScanEntry entry;
+                        entry.nValue = note.value();
+                        entry.nPosition = nPosition + j;
+                        entry.cm = note.cm();
+                        const std::array<unsigned char, ZC_MEMO_SIZE>& memo = plaintext.memo();
+                        size_t nMemoSize = memo.size();
+                        while (nMemoSize > 0 && memo[nMemoSize - 1] == 0)
+                            nMemoSize--;
+                        if (!(nMemoSize == 1 && memo[0] == 0xF6))
+                            entry.vchMemo.assign(memo.begin(), memo.begin() + nMemoSize);
+                        WriteNote(CNoteScanEntryKey(pdecryptor->address, nHeight, tx.GetHash(), js, j), entry);
+                        nFound++;
+                    } catch (const std::exception& e) {
+                        LogPrintf("%s: unexpected error decoding a note of %s: %s\n", __func__, tx.GetHash().ToString(), e.what());
+                    }
+                }
+            }
+            nPosition += jsdesc.commitments.size();
+        }
+    }
+    return nFound;
+}
+
+void CNoteScanBatch::DisconnectBlock(int nHeight)
+{
+    std::map<int, std::vector<CNoteScanEntryKey> >::iterator it = mapWritten.find(nHeight);
+    if (it != mapWritten.end()) {
+        for (const CNoteScanEntryKey& key : it->second)
+            EraseNote(key);
+        mapWritten.erase(it);
+    }
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewSeekIterator());
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << DB_NOTE_HEIGHT;
+    ser_writedata32be(ssKey, nHeight);
+    pcursor->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (!slKey.starts_with(leveldb::Slice(&ssKey[0], ssKey.size())))
+            break;
+        CDataStream ssEntry(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        CNoteScanHeightKey key;
+        ssEntry >> chType >> key;
+        EraseNote(key.key);
+    }
+}
+
+void CNoteScanBatch::WriteKey(const CNoteScanKey& key)
+{
+    batch.Write(std::make_pair(DB_KEY, key.vk.address()), key);
+    nChanges++;
+}
+
+void CNoteScanBatch::EraseKey(const libzcash::PaymentAddress& address)
+{
+    batch.Erase(std::make_pair(DB_KEY, address));
+    nChanges++;
+
+    for (std::map<int, std::vector<CNoteScanEntryKey> >::iterator it = mapWritten.begin(); it != mapWritten.end(); it++) {
+        std::vector<CNoteScanEntryKey>& vKeys = it->second;
+        for (size_t i = 0; i < vKeys.size(); ) {
+            if (vKeys[i].address == address) {
+                EraseNote(vKeys[i]);
+                vKeys.erase(vKeys.begin() + i);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    std::vector<std::pair<CNoteScanEntryKey, CNoteScanEntry> > vNotes;
+    db.ReadNotes(address, vNotes);
+    for (const std::pair<CNoteScanEntryKey, CNoteScanEntry>& note : vNotes)
+        EraseNote(note.first);
+}
+
+bool CNoteScanBatch::Write(const uint256& hashBest)
+{
+    batch.Write(DB_BEST_BLOCK, hashBest);
+    if (!db.WriteBatch(batch))
+        return false;
+    batch.Clear();
+    mapWritten.clear();
+    nChanges = 0;
+    return true;
+}
@@ -0,0 +1,210 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NOTESCAN_H
+#define BITCOIN_NOTESCAN_H
+
+#include "amount.h"
+#include "leveldbwrapper.h"
+#include "serialize.h"
+#include "uint256.h"
+#include "zcash/Address.hpp"
+#include "zcash/JoinSplit.hpp"
+#include "zcash/NoteEncryption.hpp"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+class CBlock;
+
+/**
+ * The notes paid to the viewing keys watched by -notescan. The notes of a block are found
+ * by trial decryption of its JoinSplit outputs with the keys, and kept with the position
+ * of their commitment in the note commitment tree, without witnesses. Heights and indexes
+ * are stored big-endian in the keys so the notes of an address come in the order of the
+ * chain.
+ */
+
+/** A note paid to a watched address, in the block at nHeight */
+struct CNoteScanEntryKey
+{
+    libzcash::PaymentAddress address;
+    int nHeight;
+    uint256 txid;
+    unsigned int nJoinSplit;
+    unsigned char nOutput;
+
+    CNoteScanEntryKey() : nHeight(0), nJoinSplit(0), nOutput(0) {}
+    CNoteScanEntryKey(const libzcash::PaymentAddress& addressIn, int nHeightIn, const uint256& txidIn,
+                      unsigned int nJoinSplitIn, unsigned char nOutputIn) :
+        address(addressIn), nHeight(nHeightIn), txid(txidIn), nJoinSplit(nJoinSplitIn), nOutput(nOutputIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return 32 + 32 + 4 + 32 + 4 + 1; }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        address.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, nHeight);
+        txid.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, nJoinSplit);
+        ser_writedata8(s, nOutput);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        address.Unserialize(s, nType, nVersion);
+        nHeight = ser_readdata32be(s);
+        txid.Unserialize(s, nType, nVersion);
+        nJoinSplit = ser_readdata32be(s);
+        nOutput = ser_readdata8(s);
+    }
+};
+
+/** The same note, keyed by height first to find the notes of a block disconnected */
+struct CNoteScanHeightKey
+{
+    CNoteScanEntryKey key;
+
+    CNoteScanHeightKey() {}
+    explicit CNoteScanHeightKey(const CNoteScanEntryKey& keyIn) : key(keyIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return key.GetSerializeSize(nType, nVersion); }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata32be(s, key.nHeight);
+        key.address.Serialize(s, nType, nVersion);
+        key.txid.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, key.nJoinSplit);
+        ser_writedata8(s, key.nOutput);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        key.nHeight = ser_readdata32be(s);
+        key.address.Unserialize(s, nType, nVersion);
+        key.txid.Unserialize(s, nType, nVersion);
+        key.nJoinSplit = ser_readdata32be(s);
+        key.nOutput = ser_readdata8(s);
+    }
+};
+
+/** What is kept of a note found: no rho or r, so it cannot be spent from */
+struct CNoteScanEntry
+{
+    CAmount nValue;
+    //! The position of its commitment in the note commitment tree
+    uint64_t nPosition;
+    uint256 cm;
+    //! The memo without its trailing zeros, empty if it has none (0xF6)
+    std::vector<unsigned char> vchMemo;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nValue);
+        READWRITE(VARINT(nPosition));
+        READWRITE(cm);
+        READWRITE(vchMemo);
+    }
+
+    CNoteScanEntry() : nValue(0), nPosition(0) {}
+};
+
+/** A viewing key watched, and how far the blocks before it was added were scanned for it */
+struct CNoteScanKey
+{
+    libzcash::ViewingKey vk;
+    int nStartHeight;
+    //! The next block to scan for this key alone, -1 once the key follows the chain with the others
+    int nNextHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(vk);
+        READWRITE(nStartHeight);
+        READWRITE(nNextHeight);
+    }
+
+    CNoteScanKey() : nStartHeight(0), nNextHeight(-1) {}
+    CNoteScanKey(const libzcash::ViewingKey& vkIn, int nStartHeightIn, int nNextHeightIn) :
+        vk(vkIn), nStartHeight(nStartHeightIn), nNextHeight(nNextHeightIn) {}
+
+    bool IsCatchingUp() const { return nNextHeight >= 0; }
+};
+
+/** The address and decryptor of a watched viewing key */
+struct CNoteScanDecryptor
+{
+    libzcash::PaymentAddress address;
+    ZCNoteDecryption decryptor;
+
+    explicit CNoteScanDecryptor(const libzcash::ViewingKey& vk) : address(vk.address()), decryptor(vk.sk_enc) {}
+};
+
+/** Access to the notes of the watched viewing keys (notescan/) */
+class CNoteScanDB : public CLevelDBWrapper
+{
+public:
+    CNoteScanDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! The last block scanned
+    bool ReadBestBlock(uint256& hashBest) const;
+    bool ReadKeys(std::vector<CNoteScanKey>& vKeys) const;
+    //! The notes of an address, in the blocks from nStart on
+    bool ReadNotes(const libzcash::PaymentAddress& address, std::vector<std::pair<CNoteScanEntryKey, CNoteScanEntry> >& vNotes,
+                   int nStart = 0) const;
+
+private:
+    CNoteScanDB(const CNoteScanDB&);
+    void operator=(const CNoteScanDB&);
+};
+
+/**
+ * The changes to the notes and keys of a run of blocks scanned and disconnected in order,
+ * written at once with the last block of the run.
+ */
+class CNoteScanBatch
+{
+public:
+    CNoteScanBatch(CNoteScanDB& dbIn, ZCJoinSplit& paramsIn) : db(dbIn), params(paramsIn), nChanges(0) {}
+
+    /**
+     * Find the notes of the JoinSplit outputs of a block paid to the decryptors, the first
+     * commitment of which is at nFirstPosition in the tree. Returns how many it found.
+     */
+    size_t ScanBlock(const CBlock& block, int nHeight, uint64_t nFirstPosition, const std::vector<const CNoteScanDecryptor*>& vDecryptors);
+    //! Erase the notes found in the block at nHeight, for all the keys
+    void DisconnectBlock(int nHeight);
+
+    void WriteKey(const CNoteScanKey& key);
+    //! Stop watching the key of address, erasing its notes
+    void EraseKey(const libzcash::PaymentAddress& address);
+
+    //! Number of entries written or erased so far
+    size_t GetChanges() const { return nChanges; }
+
+    bool Write(const uint256& hashBest);
+
+private:
+    CNoteScanDB& db;
+    ZCJoinSplit& params;
+    CLevelDBBatch batch;
+    size_t nChanges;
+    //! The notes written in this batch, by height, which the database does not have yet
+    std::map<int, std::vector<CNoteScanEntryKey> > mapWritten;
+
+    void WriteNote(const CNoteScanEntryKey& key, const CNoteScanEntry& entry);
+    void EraseNote(const CNoteScanEntryKey& key);
+};
+
+#endif // BITCOIN_NOTESCAN_H
@@ -4,15 +4,32 @@
 
 #include "paymentdisclosuredb.h"
 
+#include "crypto/common.h"
 #include "util.h"
 #include "leveldbwrapper.h"
 
 #include <boost/filesystem.hpp>
 
+#include <leveldb/write_batch.h>
+
 using namespace std;
 
 static boost::filesystem::path emptyPath;
 
+static const char DB_PAYMENT_DISCLOSURE = 'd';
+//! Prefix, txid, JoinSplit and output
+static const size_t PAYMENT_DISCLOSURE_KEY_SIZE = 1 + 32 + 4 + 1;
+
+static std::string EncodeKey(const PaymentDisclosureKey& key)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << DB_PAYMENT_DISCLOSURE << key.hash;
+    // The JoinSplits of a transaction are far fewer than 2^32
+    ser_writedata32be(ssKey, key.js);
+    ser_writedata8(ssKey, key.n);
+    return ssKey.str();
+}
+
 /**
  * Static method to return the shared/default payment disclosure database.
  */
@@ -36,6 +53,7 @@ PaymentDisclosureDB::PaymentDisclosureDB(const boost::filesystem::path& dbPath)
     }
 
     TryCreateDirectory(path);
+    options = GetLevelDBOptions(PAYMENT_DISCLOSURE_DB_CACHE, CLevelDBProfile::PaymentDisclosure().ApplyArgs());
     options.create_if_missing = true;
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &db);
     HandleError(status); // throws exception
@@ -46,22 +64,32 @@ PaymentDisclosureDB::~PaymentDisclosureDB() {
     if (db != nullptr) {
         delete db;
     }
+    delete options.filter_policy;
+    delete options.block_cache;
 }
 
 bool PaymentDisclosureDB::Put(const PaymentDisclosureKey& key, const PaymentDisclosureInfo& info)
+{
+    return Put(std::vector<PaymentDisclosureKeyInfo>(1, std::make_pair(key, info)));
+}
+
+bool PaymentDisclosureDB::Put(const std::vector<PaymentDisclosureKeyInfo>& entries)
 {
     if (db == nullptr) {
         return false;
     }
 
-    std::lock_guard<std::mutex> guard(lock_);
+    leveldb::WriteBatch batch;
+    for (const PaymentDisclosureKeyInfo& entry : entries) {
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.reserve(ssValue.GetSerializeSize(entry.second));
+        ssValue << entry.second;
+        batch.Put(EncodeKey(entry.first), leveldb::Slice(&ssValue[0], ssValue.size()));
+    }
 
-    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-    ssValue.reserve(ssValue.GetSerializeSize(info));
-    ssValue << info;
-    leveldb::Slice slice(&ssValue[0], ssValue.size());
+    std::lock_guard<std::mutex> guard(lock_);
 
-    leveldb::Status status = db->Put(writeOptions, key.ToString(), slice);
+    leveldb::Status status = db->Write(writeOptions, &batch);
     HandleError(status);
     return true;
 }
@@ -75,7 +103,11 @@ bool PaymentDisclosureDB::Get(const PaymentDisclosureKey& key, PaymentDisclosure
     std::lock_guard<std::mutex> guard(lock_);
 
     std::string strValue;
-    leveldb::Status status = db->Get(readOptions, key.ToString(), &strValue);
+    leveldb::Status status = db->Get(readOptions, EncodeKey(key), &strValue);
+    if (status.IsNotFound()) {
+        // Written before the keys were encoded
+        status = db->Get(readOptions, key.ToString(), &strValue);
+    }
     if (!status.ok()) {
         if (status.IsNotFound())
             return false;
@@ -91,3 +123,36 @@ bool PaymentDisclosureDB::Get(const PaymentDisclosureKey& key, PaymentDisclosure
     }
     return true;
 }
+
+bool PaymentDisclosureDB::GetAll(const uint256& txid, std::vector<PaymentDisclosureKeyInfo>& entries)
+{
+    if (db == nullptr) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << DB_PAYMENT_DISCLOSURE << txid;
+    const leveldb::Slice slPrefix(&ssPrefix[0], ssPrefix.size());
+
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(readOptions));
+    for (it->Seek(slPrefix); it->Valid() && it->key().starts_with(slPrefix); it->Next()) {
+        const leveldb::Slice slKey = it->key();
+        if (slKey.size() != PAYMENT_DISCLOSURE_KEY_SIZE)
+            continue;
+        const unsigned char* pKey = (const unsigned char*)slKey.data();
+        PaymentDisclosureKeyInfo entry;
+        entry.first = PaymentDisclosureKey(txid, ReadBE32(pKey + 33), pKey[37]);
+        try {
+            const leveldb::Slice slValue = it->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> entry.second;
+        } catch (const std::exception&) {
+            return false;
+        }
+        entries.push_back(entry);
+    }
+    HandleError(it->status());
+    return true;
+}
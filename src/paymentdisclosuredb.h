@@ -12,12 +12,20 @@
 #include <mutex>
 #include <future>
 #include <memory>
+#include <vector>
 
 #include <boost/optional.hpp>
 
 #include <leveldb/db.h>
 
+//! Cache of the payment disclosure database: it is written far more than it is read
+static const size_t PAYMENT_DISCLOSURE_DB_CACHE = 1 << 20;
 
+/**
+ * The payment disclosure info of the JoinSplit outputs of the transactions sent, keyed by
+ * the txid, JoinSplit and output, big-endian so the outputs of a transaction are together.
+ * Entries written before under the JSOutPoint::ToString() keys are still found by Get.
+ */
 class PaymentDisclosureDB
 {
 protected:
@@ -35,7 +43,11 @@ public:
     ~PaymentDisclosureDB();
 
     bool Put(const PaymentDisclosureKey& key, const PaymentDisclosureInfo& info);
+    //! Write the info of the outputs of a transaction at once
+    bool Put(const std::vector<PaymentDisclosureKeyInfo>& entries);
     bool Get(const PaymentDisclosureKey& key, PaymentDisclosureInfo& info);
+    //! The info of all the outputs of a transaction, in the order of the outputs
+    bool GetAll(const uint256& txid, std::vector<PaymentDisclosureKeyInfo>& entries);
 };
 
 
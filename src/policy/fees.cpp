@@ -11,11 +11,14 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
-                                unsigned int maxConfirms, double _decay, std::string _dataTypeString)
+                                unsigned int _maxConfirms, double _decay, std::string _dataTypeString)
 {
     decay = _decay;
     dataTypeString = _dataTypeString;
+    maxConfirms = _maxConfirms;
 
     buckets.insert(buckets.end(), defaultBuckets.begin(), defaultBuckets.end());
     buckets.push_back(std::numeric_limits<double>::infinity());
@@ -24,14 +27,14 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
         bucketMap[buckets[i]] = i;
     }
 
-    confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
-        unconfTxs[i].resize(buckets.size());
-    }
+    Resize();
+}
+
+void TxConfirmStats::Resize()
+{
+    confAvg.resize(maxConfirms * buckets.size());
+    curBlockConf.resize(maxConfirms * buckets.size());
+    unconfTxs.resize(maxConfirms * buckets.size());
 
     oldUnconfTxs.resize(buckets.size());
     curBlockTxCt.resize(buckets.size());
@@ -43,17 +46,17 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
 // Zero out the data for the current block
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
+    const size_t blockIndex = Index(nBlockHeight % maxConfirms, 0);
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
+        oldUnconfTxs[j] += unconfTxs[blockIndex + j];
+        unconfTxs[blockIndex + j] = 0;
     }
+    std::fill(curBlockConf.begin(), curBlockConf.end(), 0);
+    std::fill(curBlockTxCt.begin(), curBlockTxCt.end(), 0);
+    std::fill(curBlockVal.begin(), curBlockVal.end(), 0);
 }
 
-unsigned int TxConfirmStats::FindBucketIndex(double val)
+unsigned int TxConfirmStats::FindBucketIndex(double val) const
 {
     auto it = bucketMap.lower_bound(val);
     assert(it != bucketMap.end());
@@ -66,18 +69,25 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     if (blocksToConfirm < 1)
         return;
     unsigned int bucketindex = FindBucketIndex(val);
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
+    // Only the exact count is recorded here, UpdateMovingAverages() adds it to the
+    // totals of every larger confirmation count
+    if ((unsigned int)blocksToConfirm <= maxConfirms)
+        curBlockConf[Index(blocksToConfirm - 1, bucketindex)]++;
     curBlockTxCt[bucketindex]++;
     curBlockVal[bucketindex] += val;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
+    const size_t nBuckets = buckets.size();
+
+    // A tx confirmed in Y blocks was also confirmed within any larger number of blocks
+    for (size_t k = nBuckets; k < curBlockConf.size(); k++)
+        curBlockConf[k] += curBlockConf[k - nBuckets];
+
+    for (size_t k = 0; k < confAvg.size(); k++)
+        confAvg[k] = confAvg[k] * decay + curBlockConf[k];
+    for (size_t j = 0; j < nBuckets; j++) {
         avg[j] = avg[j] * decay + curBlockVal[j];
         txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
     }
@@ -86,7 +96,7 @@ void TxConfirmStats::UpdateMovingAverages()
 // returns -1 on error conditions
 double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
                                          double successBreakPoint, bool requireGreater,
-                                         unsigned int nBlockHeight)
+                                         unsigned int nBlockHeight) const
 {
     // Counters for a bucket (or range of buckets)
     double nConf = 0; // Number of tx's confirmed within the confTarget
@@ -113,15 +123,15 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
+    unsigned int bins = maxConfirms;
 
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
+        nConf += confAvg[Index(confTarget - 1, bucket)];
         totalNum += txCtAvg[bucket];
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
+            extraNum += unconfTxs[Index((nBlockHeight - confct)%bins, bucket)];
         extraNum += oldUnconfTxs[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
@@ -182,24 +192,25 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     return median;
 }
 
-void TxConfirmStats::Write(CAutoFile& fileout)
+void TxConfirmStats::Write(CAutoFile& fileout) const
 {
     fileout << decay;
     fileout << buckets;
     fileout << avg;
     fileout << txCtAvg;
+    fileout << maxConfirms;
     fileout << confAvg;
 }
 
-void TxConfirmStats::Read(CAutoFile& filein)
+bool TxConfirmStats::Read(CAutoFile& filein, int nFileVersion)
 {
     // Read data file into temporary variables and do some very basic sanity checking
     std::vector<double> fileBuckets;
     std::vector<double> fileAvg;
-    std::vector<std::vector<double> > fileConfAvg;
+    std::vector<double> fileConfAvg;
     std::vector<double> fileTxCtAvg;
     double fileDecay;
-    size_t maxConfirms;
+    unsigned int fileMaxConfirms;
     size_t numBuckets;
 
     filein >> fileDecay;
@@ -215,50 +226,59 @@ void TxConfirmStats::Read(CAutoFile& filein)
     filein >> fileTxCtAvg;
     if (fileTxCtAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
-    filein >> fileConfAvg;
-    maxConfirms = fileConfAvg.size();
-    if (maxConfirms <= 0 || maxConfirms > 6 * 24 * 7) // one week
-        throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        if (fileConfAvg[i].size() != numBuckets)
+    if (nFileVersion >= FEE_ESTIMATES_FLAT_VERSION) {
+        filein >> fileMaxConfirms;
+        if (fileMaxConfirms <= 0 || fileMaxConfirms > 6 * 24 * 7) // one week
+            throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
+        filein >> fileConfAvg;
+        if (fileConfAvg.size() != (size_t)fileMaxConfirms * numBuckets)
             throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri conf average bucket count");
+    } else {
+        std::vector<std::vector<double> > fileConfRows;
+        filein >> fileConfRows;
+        fileMaxConfirms = fileConfRows.size();
+        if (fileMaxConfirms <= 0 || fileMaxConfirms > 6 * 24 * 7) // one week
+            throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
+        fileConfAvg.reserve((size_t)fileMaxConfirms * numBuckets);
+        for (unsigned int i = 0; i < fileMaxConfirms; i++) {
+            if (fileConfRows[i].size() != numBuckets)
+                throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri conf average bucket count");
+            fileConfAvg.insert(fileConfAvg.end(), fileConfRows[i].begin(), fileConfRows[i].end());
+        }
     }
     // Now that we've processed the entire fee estimate data file and not
     // thrown any errors, we can copy it to our data structures
+    bool fKeepUnconf = fileMaxConfirms == maxConfirms && numBuckets == buckets.size();
+    if (!fKeepUnconf) {
+        // The layout of the flat mempool counts changes, they can't be kept
+        unconfTxs.clear();
+        oldUnconfTxs.clear();
+    }
     decay = fileDecay;
     buckets = fileBuckets;
     avg = fileAvg;
-    confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
+    maxConfirms = fileMaxConfirms;
+    confAvg.swap(fileConfAvg);
     bucketMap.clear();
 
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        unconfTxs[i].resize(buckets.size());
-    }
-    oldUnconfTxs.resize(buckets.size());
+    Resize();
 
     for (unsigned int i = 0; i < buckets.size(); i++)
         bucketMap[buckets[i]] = i;
 
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
-             numBuckets, dataTypeString, maxConfirms);
+             numBuckets, dataTypeString, fileMaxConfirms);
+    return fKeepUnconf;
 }
 
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
     unsigned int bucketindex = FindBucketIndex(val);
-    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
-    unconfTxs[blockIndex][bucketindex]++;
+    unsigned int blockIndex = nBlockHeight % maxConfirms;
+    unconfTxs[Index(blockIndex, bucketindex)]++;
     LogPrint("estimatefee", "adding to %s", dataTypeString);
     return bucketindex;
 }
@@ -274,7 +294,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return;  //This can't happen because we call this with our best seen height, no entries can have higher
     }
 
-    if (blocksAgo >= (int)unconfTxs.size()) {
+    if (blocksAgo >= (int)maxConfirms) {
         if (oldUnconfTxs[bucketindex] > 0)
             oldUnconfTxs[bucketindex]--;
         else
@@ -282,9 +302,9 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
                      bucketindex);
     }
     else {
-        unsigned int blockIndex = entryHeight % unconfTxs.size();
-        if (unconfTxs[blockIndex][bucketindex] > 0)
-            unconfTxs[blockIndex][bucketindex]--;
+        unsigned int blockIndex = entryHeight % maxConfirms;
+        if (unconfTxs[Index(blockIndex, bucketindex)] > 0)
+            unconfTxs[Index(blockIndex, bucketindex)]--;
         else
             LogPrint("estimatefee", "Blockpolicy error, mempool tx removed from blockIndex=%u,bucketIndex=%u already\n",
                      blockIndex, bucketindex);
@@ -293,6 +313,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
 
 void CBlockPolicyEstimator::removeTx(uint256 hash)
 {
+    boost::unique_lock<boost::shared_mutex> lock(cs_estimator);
     std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
     if (pos == mapMemPoolTxs.end()) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s not found for removeTx\n",
@@ -351,6 +372,7 @@ bool CBlockPolicyEstimator::isPriDataPoint(const CFeeRate &fee, double pri)
 
 void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, bool fCurrentEstimate)
 {
+    boost::unique_lock<boost::shared_mutex> lock(cs_estimator);
     unsigned int txHeight = entry.GetHeight();
     uint256 hash = entry.GetTx().GetHash();
     if (mapMemPoolTxs[hash].stats != NULL) {
@@ -443,6 +465,7 @@ void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
 void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
                                          std::vector<CTxMemPoolEntry>& entries, bool fCurrentEstimate)
 {
+    boost::unique_lock<boost::shared_mutex> lock(cs_estimator);
     if (nBlockHeight <= nBestSeenHeight) {
         // Ignore side chains and re-orgs; assuming they are random
         // they don't affect the estimate.
@@ -498,8 +521,9 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
              entries.size(), mapMemPoolTxs.size());
 }
 
-CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
+CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget) const
 {
+    boost::shared_lock<boost::shared_mutex> lock(cs_estimator);
     // Return failure if trying to analyze a target we're not tracking
     if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
@@ -512,8 +536,9 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     return CFeeRate(median);
 }
 
-double CBlockPolicyEstimator::estimatePriority(int confTarget)
+double CBlockPolicyEstimator::estimatePriority(int confTarget) const
 {
+    boost::shared_lock<boost::shared_mutex> lock(cs_estimator);
     // Return failure if trying to analyze a target we're not tracking
     if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
         return -1;
@@ -521,18 +546,25 @@ double CBlockPolicyEstimator::estimatePriority(int confTarget)
     return priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
 }
 
-void CBlockPolicyEstimator::Write(CAutoFile& fileout)
+void CBlockPolicyEstimator::Write(CAutoFile& fileout) const
 {
+    boost::shared_lock<boost::shared_mutex> lock(cs_estimator);
     fileout << nBestSeenHeight;
     feeStats.Write(fileout);
     priStats.Write(fileout);
 }
 
-void CBlockPolicyEstimator::Read(CAutoFile& filein)
+void CBlockPolicyEstimator::Read(CAutoFile& filein, int nFileVersion)
 {
-    int nFileBestSeenHeight;
+    boost::unique_lock<boost::shared_mutex> lock(cs_estimator);
+    unsigned int nFileBestSeenHeight;
     filein >> nFileBestSeenHeight;
-    feeStats.Read(filein);
-    priStats.Read(filein);
-    nBestSeenHeight = nFileBestSeenHeight;
+    bool fKeepFeeUnconf = feeStats.Read(filein, nFileVersion);
+    bool fKeepPriUnconf = priStats.Read(filein, nFileVersion);
+    // The transactions tracked under a bucket layout that was replaced are no longer counted
+    for (std::map<uint256, TxStatsInfo>::iterator it = mapMemPoolTxs.begin(); it != mapMemPoolTxs.end(); ++it) {
+        if ((it->second.stats == &feeStats && !fKeepFeeUnconf) || (it->second.stats == &priStats && !fKeepPriUnconf))
+            it->second.stats = NULL;
+    }
+    nBestSeenHeight = std::max(nBestSeenHeight, nFileBestSeenHeight);
 }
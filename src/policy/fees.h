@@ -12,6 +12,8 @@
 #include <string>
 #include <vector>
 
+#include <boost/thread/shared_mutex.hpp>
+
 class CAutoFile;
 class CFeeRate;
 class CTxMemPoolEntry;
@@ -69,6 +71,12 @@ class CTxMemPoolEntry;
 /** Decay of .998 is a half-life of 346 blocks or about 2.4 days */
 static const double DEFAULT_DECAY = .998;
 
+/**
+ * Client version required to read the fee estimates written with the confirmation
+ * averages as one flat array, files written before it keep one array per confirmation count
+ */
+static const int FEE_ESTIMATES_FLAT_VERSION = 2002350;
+
 /**
  * We will instantiate two instances of this class, one to track transactions
  * that were included in a block due to fee, and one for txs included due to
@@ -79,6 +87,10 @@ static const double DEFAULT_DECAY = .998;
  *
  * The tracking of unconfirmed (mempool) transactions is completely independent of the
  * historical tracking of transactions that have been confirmed in a block.
+ *
+ * The per confirmation count statistics are kept in flat arrays with the buckets of
+ * one confirmation count stored contiguously, at index Y * buckets.size() + X, so
+ * that decaying them every block is a single pass over contiguous memory.
  */
 class TxConfirmStats
 {
@@ -86,6 +98,7 @@ private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
     std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
     std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+    unsigned int maxConfirms = 0;             // Number of confirmation counts Y tracked
 
     // For each bucket X:
     // Count the total # of txs in each bucket
@@ -96,9 +109,10 @@ private:
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
-    std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calcuate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
+    std::vector<double> confAvg; // confAvg[Index(Y, X)]
+    // and count the txs of the current block confirmed in exactly Y blocks, which are
+    // accumulated into "within Y blocks" totals when the moving averages are updated
+    std::vector<int> curBlockConf; // curBlockConf[Index(Y, X)]
 
     // Sum the total priority/fee of all txs in each bucket
     // Track the historical moving average of this total over blocks
@@ -115,13 +129,19 @@ private:
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
-    std::vector<std::vector<int> > unconfTxs;  //unconfTxs[Y][X]
+    std::vector<int> unconfTxs;  //unconfTxs[Index(Y, X)]
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    /** Position of confirmation count (0-based) Y and bucket X in the flat arrays */
+    size_t Index(unsigned int conf, unsigned int bucket) const { return (size_t)conf * buckets.size() + bucket; }
+
+    /** Size all the per bucket arrays to buckets.size() and maxConfirms */
+    void Resize();
+
 public:
     /** Find the bucket index of a given value */
-    unsigned int FindBucketIndex(double val);
+    unsigned int FindBucketIndex(double val) const;
 
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
@@ -169,19 +189,21 @@ public:
      * @param nBlockHeight the current block height
      */
     double EstimateMedianVal(int confTarget, double sufficientTxVal,
-                             double minSuccess, bool requireGreater, unsigned int nBlockHeight);
+                             double minSuccess, bool requireGreater, unsigned int nBlockHeight) const;
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() { return confAvg.size(); }
+    unsigned int GetMaxConfirms() const { return maxConfirms; }
 
-    /** Write state of estimation data to a file*/
-    void Write(CAutoFile& fileout);
+    /** Write state of estimation data to a file, in the FEE_ESTIMATES_FLAT_VERSION layout */
+    void Write(CAutoFile& fileout) const;
 
     /**
      * Read saved state of estimation data from a file and replace all internal data structures and
      * variables with this state.
+     * @param nFileVersion the client version required to read the file, which selects its layout
+     * @return whether the mempool counts were kept, they are reset when the bucket layout changes
      */
-    void Read(CAutoFile& filein);
+    bool Read(CAutoFile& filein, int nFileVersion);
 };
 
 
@@ -220,6 +242,9 @@ static const double PRI_SPACING = 2;
  *  We want to be able to estimate fees or priorities that are needed on txs to be included in
  * a certain number of blocks.  Every time a block is added to the best chain, this class records
  * stats on the transactions included in that block
+ *
+ * The estimator has its own lock, so that estimates can be queried concurrently, under a
+ * shared lock, without waiting for the mempool lock held by transaction acceptance.
  */
 class CBlockPolicyEstimator
 {
@@ -247,18 +272,24 @@ public:
     bool isPriDataPoint(const CFeeRate &fee, double pri);
 
     /** Return a fee estimate */
-    CFeeRate estimateFee(int confTarget);
+    CFeeRate estimateFee(int confTarget) const;
 
     /** Return a priority estimate */
-    double estimatePriority(int confTarget);
+    double estimatePriority(int confTarget) const;
 
     /** Write estimation data to a file */
-    void Write(CAutoFile& fileout);
+    void Write(CAutoFile& fileout) const;
 
-    /** Read estimation data from a file */
-    void Read(CAutoFile& filein);
+    /**
+     * Read estimation data from a file. The file may be read after blocks and transactions
+     * were already processed, the best seen height is then kept.
+     */
+    void Read(CAutoFile& filein, int nFileVersion);
 
 private:
+    //! Taken shared by the estimate queries and Write, exclusively by everything else
+    mutable boost::shared_mutex cs_estimator;
+
     CFeeRate minTrackedFee; //! Passed to constructor to avoid dependency on main
     double minTrackedPriority; //! Set to AllowFreeThreshold
     unsigned int nBestSeenHeight;
@@ -36,19 +36,37 @@ public:
         SetNull();
     }
 
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        READWRITE(this->nVersion);
-        nVersion = this->nVersion;
-        READWRITE(hashPrevBlock);
-        READWRITE(hashMerkleRoot);
-        READWRITE(hashReserved);
-        READWRITE(nTime);
-        READWRITE(nBits);
-        READWRITE(nNonce);
-        READWRITE(nSolution);
+    // The fields before the solution have a fixed layout, read and written at once
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return HEADER_SIZE + ::GetSerializeSize(nSolution, nType, this->nVersion);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        unsigned char buf[HEADER_SIZE];
+        WriteLE32(buf, this->nVersion);
+        memcpy(buf + 4, hashPrevBlock.begin(), 32);
+        memcpy(buf + 36, hashMerkleRoot.begin(), 32);
+        memcpy(buf + 68, hashReserved.begin(), 32);
+        WriteLE32(buf + 100, nTime);
+        WriteLE32(buf + 104, nBits);
+        memcpy(buf + 108, nNonce.begin(), 32);
+        s.write((const char*)buf, sizeof(buf));
+        ::Serialize(s, nSolution, nType, this->nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        unsigned char buf[HEADER_SIZE];
+        s.read((char*)buf, sizeof(buf));
+        this->nVersion = ReadLE32(buf);
+        memcpy(hashPrevBlock.begin(), buf + 4, 32);
+        memcpy(hashMerkleRoot.begin(), buf + 36, 32);
+        memcpy(hashReserved.begin(), buf + 68, 32);
+        nTime = ReadLE32(buf + 100);
+        nBits = ReadLE32(buf + 104);
+        memcpy(nNonce.begin(), buf + 108, 32);
+        ::Unserialize(s, nSolution, nType, this->nVersion);
     }
 
     void SetNull()
@@ -81,7 +99,7 @@ class CBlock : public CBlockHeader
 {
 public:
     // network and disk
-    std::vector<CTransaction> vtx;
+    std::vector<CTransactionRef> vtx;
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
@@ -132,6 +150,10 @@ public:
     // merkle root).
     uint256 BuildMerkleTree(bool* mutated = NULL) const;
 
+    // The merkle root and mutation of BuildMerkleTree, without keeping the tree.
+    // A tree built before is dropped, GetMerkleBranch builds it again.
+    uint256 ComputeMerkleRoot(bool* mutated = NULL) const;
+
     std::vector<uint256> GetMerkleBranch(int nIndex) const;
     static uint256 CheckMerkleBranch(uint256 hash, const std::vector<uint256>& vMerkleBranch, int nIndex);
     std::string ToString() const;
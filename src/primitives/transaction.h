@@ -7,6 +7,7 @@
 #define BITCOIN_PRIMITIVES_TRANSACTION_H
 
 #include "amount.h"
+#include "crypto/common.h"
 #include "random.h"
 #include "script/script.h"
 #include "serialize.h"
@@ -15,6 +16,7 @@
 #include "consensus/consensus.h"
 #include "util.h"
 #include <array>
+#include <memory>
 
 #include <boost/variant.hpp>
 
@@ -255,12 +257,27 @@ public:
     BaseOutPoint() { SetNull(); }
     BaseOutPoint(uint256 hashIn, uint32_t nIn) { hash = hashIn; n = nIn; }
 
-    ADD_SERIALIZE_METHODS;
+    static const size_t SERIALIZED_SIZE = 32 + 4;
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        READWRITE(hash);
-        READWRITE(n);
+    // A fixed layout, read and written at once
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return SERIALIZED_SIZE;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        unsigned char buf[SERIALIZED_SIZE];
+        memcpy(buf, hash.begin(), 32);
+        WriteLE32(buf + 32, n);
+        s.write((const char*)buf, sizeof(buf));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        unsigned char buf[SERIALIZED_SIZE];
+        s.read((char*)buf, sizeof(buf));
+        memcpy(hash.begin(), buf, 32);
+        n = ReadLE32(buf + 32);
     }
 
     void SetNull() { hash.SetNull(); n = (uint32_t) -1; }
@@ -424,7 +441,11 @@ class CTransaction
 private:
     /** Memory only. */
     const uint256 hash;
+    //! The size of the serialization, the same for all types and versions
+    const unsigned int nSerializeSize = 0;
+    //! Set the hash and size from the fields
     void UpdateHash() const;
+    unsigned int ComputeSerializeSize() const;
 
 public:
     typedef boost::array<unsigned char, 64> joinsplit_sig_t;
@@ -457,7 +478,18 @@ public:
 
     CTransaction& operator=(const CTransaction& tx);
 
-    ADD_SERIALIZE_METHODS;
+    // The methods of ADD_SERIALIZE_METHODS, with the size cached
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return nSerializeSize;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        NCONST_PTR(this)->SerializationOp(s, CSerActionSerialize(), nType, nVersion);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        SerializationOp(s, CSerActionUnserialize(), nType, nVersion);
+    }
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
@@ -564,4 +596,12 @@ struct CMutableTransaction
     uint256 GetHash() const;
 };
 
+/**
+ * A shared immutable transaction, referenced by the blocks and the mempool entries
+ * holding it instead of copied into each of them.
+ */
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+static inline CTransactionRef MakeTransactionRef() { return std::make_shared<const CTransaction>(); }
+template <typename Tx> static inline CTransactionRef MakeTransactionRef(Tx&& txIn) { return std::make_shared<const CTransaction>(std::forward<Tx>(txIn)); }
+
 #endif // BITCOIN_PRIMITIVES_TRANSACTION_H
@@ -75,6 +75,10 @@ enum {
     // Bitcoin Core does not support this but a patch set called Bitcoin XT does.
     // See BIP 64 for details on how this is implemented.
     NODE_GETUTXO = (1 << 1),
+    // NODE_COMPACT_FILTERS means the node serves the basic compact block filters of
+    // -blockfilterindex with the getcfilters, getcfheaders and getcfcheckpt messages.
+    // See BIP 157 and 158 for the messages and the filters.
+    NODE_COMPACT_FILTERS = (1 << 6),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
@@ -153,6 +157,9 @@ enum {
     // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
     // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
     MSG_FILTERED_BLOCK,
+    // MSG_CMPCT_BLOCK should only be used in getdata, asking for a cmpctblock
+    // (see blockencodings.h) from peers that announced "sendcmpct".
+    MSG_CMPCT_BLOCK,
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -12,6 +12,38 @@ namespace
 {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context* secp256k1_context_verify = NULL;
+
+/**
+ * The keys Verify parsed last on this thread. The inputs of a transaction are often
+ * signed by the same key, all of them for the payouts of a pool, and parsing a
+ * compressed key takes a square root, near a tenth of the time of the verification.
+ */
+struct CParsedPubKeys
+{
+    static const int SIZE = 8;
+    CPubKey vKey[SIZE];
+    secp256k1_pubkey vParsed[SIZE];
+    int nNext;
+
+    CParsedPubKeys() : nNext(0) {}
+};
+thread_local CParsedPubKeys parsedPubKeys;
+
+bool ParsePubKey(const CPubKey& key, secp256k1_pubkey& pubkey)
+{
+    for (int i = 0; i < CParsedPubKeys::SIZE; i++) {
+        if (parsedPubKeys.vKey[i] == key) {
+            pubkey = parsedPubKeys.vParsed[i];
+            return true;
+        }
+    }
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, key.begin(), key.size()))
+        return false;
+    parsedPubKeys.vKey[parsedPubKeys.nNext] = key;
+    parsedPubKeys.vParsed[parsedPubKeys.nNext] = pubkey;
+    parsedPubKeys.nNext = (parsedPubKeys.nNext + 1) % CParsedPubKeys::SIZE;
+    return true;
+}
 }
 
 
@@ -20,7 +52,7 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
         return false;
     secp256k1_pubkey pubkey;
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
+    if (!ParsePubKey(*this, pubkey)) {
         return false;
     }
     if (vchSig.size() == 0) {
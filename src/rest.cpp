@@ -7,6 +7,7 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -15,13 +16,16 @@
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/optional.hpp>
 
 #include <univalue.h>
 
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const size_t MAX_GETUTXOS_POSTED_OUTPOINTS = 10000; //or of 10000 posted in binary or hex
 
 enum RetFormat {
     RF_UNDEF,
@@ -60,6 +64,8 @@ extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue&
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSON(bool fVerbose, JSONWriter& writer);
+extern UniValue mempoolEntryToJSON(const CTxMemPoolEntry& e);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -137,18 +143,16 @@ static bool rest_headers(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    // The headers of the index entries never change, the chain is walked on the tip view
     std::vector<const CBlockIndex *> headers;
     headers.reserve(count);
-    {
-        LOCK(cs_main);
-        BlockMap::const_iterator it = mapBlockIndex.find(hash);
-        const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
-        while (pindex != NULL && chainActive.Contains(pindex)) {
-            headers.push_back(pindex);
-            if (headers.size() == (unsigned long)count)
-                break;
-            pindex = chainActive.Next(pindex);
-        }
+    CChainTipViewRef tip = GetChainTipView();
+    const CBlockIndex *pindex = LookupBlockIndex(hash);
+    while (pindex != NULL && tip->Contains(pindex)) {
+        headers.push_back(pindex);
+        if (headers.size() == (unsigned long)count)
+            break;
+        pindex = tip->Next(pindex);
     }
 
     CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
@@ -203,8 +207,9 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
+    // cs_main is held only for the position of the block, which is read after
     CBlockIndex* pblockindex = NULL;
+    CDiskBlockPos pos;
     {
         LOCK(cs_main);
         if (mapBlockIndex.count(hash) == 0)
@@ -213,31 +218,34 @@ static bool rest_block(HTTPRequest* req,
         pblockindex = mapBlockIndex[hash];
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
-
-        if (!ReadBlockFromDisk(block, pblockindex))
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        pos = pblockindex->GetBlockPos();
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
     switch (rf) {
-    case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
-        req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryBlock);
-        return true;
-    }
-
+    case RF_BINARY:
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
-        req->WriteHeader("Content-Type", "text/plain");
-        req->WriteReply(HTTP_OK, strHex);
+        // Served as stored, the block is not deserialized
+        std::vector<char> vBlock;
+        if (pos.IsNull() || !ReadRawBlockFromDisk(vBlock, pos, hash))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        if (rf == RF_BINARY) {
+            HTTPReplyBody body;
+            body.Write(vBlock.data(), vBlock.size());
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReply(HTTP_OK, body);
+        } else {
+            string strHex = HexStr(vBlock.begin(), vBlock.end()) + "\n";
+            req->WriteHeader("Content-Type", "text/plain");
+            req->WriteReply(HTTP_OK, strHex);
+        }
         return true;
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
+        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pblockindex);
+        if (!pblock)
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        UniValue objBlock = blockToJSON(*pblock, pblockindex, showTxDetails);
         string strJSON = objBlock.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strJSON);
@@ -319,23 +327,56 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
         return false;
     vector<string> params;
     const RetFormat rf = ParseDataFormat(params, strURIPart);
-
-    switch (rf) {
-    case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
-    }
-    default: {
+    if (rf != RF_JSON)
         return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+
+    // The reply has the sequence of the last change to the mempool it includes, from which
+    // /rest/mempool/contents/since/<sequence> gives the transactions added and removed since
+    bool fSince = false;
+    int64_t nSince = 0;
+    if (!params[0].empty()) {
+        vector<string> path;
+        boost::split(path, params[0], boost::is_any_of("/"));
+        if (path.size() != 3 || !path[0].empty() || path[1] != "since" || !ParseInt64(path[2], &nSince) || nSince < 0)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI, use /rest/mempool/contents.json or /rest/mempool/contents/since/<sequence>.json");
+        fSince = true;
+    }
+
+    // Written as it is produced, the mempool is never held whole as a UniValue
+    HTTPReplyBody body;
+    uint64_t nSequence;
+    {
+        LOCK(mempool.cs);
+        nSequence = mempool.GetChangeSequence();
+        vector<uint256> vAdded, vRemoved;
+        if (fSince && !mempool.GetChangesSince(nSince, vAdded, vRemoved))
+            return RESTERR(req, HTTP_NOT_FOUND, strprintf("Changes since %d not available, use /rest/mempool/contents.json", nSince));
+
+        JSONStreamWriter writer(boost::bind(&HTTPReplyBody::Write, &body, _1, _2));
+        if (!fSince) {
+            mempoolToJSON(true, writer);
+        } else {
+            writer.beginObject();
+            writer.key("added");
+            writer.beginObject();
+            BOOST_FOREACH(const uint256& hash, vAdded)
+                writer.pushKV(hash.GetHex(), mempoolEntryToJSON(*mempool.mapTx.find(hash)));
+            writer.endObject();
+            writer.key("removed");
+            writer.beginArray();
+            BOOST_FOREACH(const uint256& hash, vRemoved)
+                writer.push_back(hash.GetHex());
+            writer.endArray();
+            writer.endObject();
+        }
+        writer.Flush();
     }
-    }
+    body.Write("\n", 1);
 
-    // not reached
-    return true; // continue to process further HTTP reqs on this cxn
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteHeader("X-Mempool-Sequence", strprintf("%d", nSequence));
+    req->WriteReply(HTTP_OK, body);
+    return true;
 }
 
 static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
@@ -482,8 +523,9 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     }
 
     // limit max outpoints
-    if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
-        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
+    const size_t nMaxOutPoints = fInputParsed ? MAX_GETUTXOS_OUTPOINTS : MAX_GETUTXOS_POSTED_OUTPOINTS;
+    if (vOutPoints.size() > nMaxOutPoints)
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", nMaxOutPoints, vOutPoints.size()));
 
     // check spentness and form a bitmap (as well as a JSON capable human-readble string representation)
     vector<unsigned char> bitmap;
@@ -491,7 +533,11 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     std::string bitmapStringRepresentation;
     boost::dynamic_bitset<unsigned char> hits(vOutPoints.size());
     {
-        LOCK2(cs_main, mempool.cs);
+        // The mempool is only looked into with checkmempool
+        LOCK(cs_main);
+        boost::optional<CCriticalBlock> lockMempool;
+        if (fCheckMemPool)
+            lockMempool.emplace(mempool.cs, "mempool.cs", __FILE__, __LINE__);
 
         CCoinsView viewDummy;
         CCoinsViewCache view(&viewDummy);
@@ -502,22 +548,21 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         if (fCheckMemPool)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
+        outs.reserve(vOutPoints.size());
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hits[i] = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            // The coins of a transaction are fetched once for all the outpoints asked of it,
+            // and only the outpoint asked is checked against the mempool spends
+            const CCoins* coins = view.AccessCoins(vOutPoints[i].hash);
+            if (coins && coins->IsAvailable(vOutPoints[i].n) && !(fCheckMemPool && mempool.mapNextTx.count(vOutPoints[i]))) {
+                hits[i] = true;
+                // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
+                // n is valid but points to an already spent output (IsNull).
+                CCoin coin;
+                coin.nTxVer = coins->nVersion;
+                coin.nHeight = coins->nHeight;
+                coin.out = coins->vout.at(vOutPoints[i].n);
+                assert(!coin.out.IsNull());
+                outs.push_back(coin);
             }
 
             bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
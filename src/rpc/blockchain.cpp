@@ -4,15 +4,20 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "blockfilter.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "consensus/validation.h"
+#include "ioscheduler.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonwriter.h"
+#include "rpc/resultcache.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 #include "zen/delay.h"
 
@@ -100,75 +105,87 @@ static UniValue ValuePoolDesc(
 
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
+    CChainTipViewRef tip = GetChainTipView();
     UniValue result(UniValue::VOBJ);
     result.pushKV("hash", blockindex->GetBlockHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (tip->Contains(blockindex))
+        confirmations = tip->nHeight - blockindex->nHeight + 1;
     result.pushKV("confirmations", confirmations);
     result.pushKV("height", blockindex->nHeight);
     result.pushKV("version", blockindex->nVersion);
     result.pushKV("merkleroot", blockindex->hashMerkleRoot.GetHex());
     result.pushKV("time", (int64_t)blockindex->nTime);
     result.pushKV("nonce", blockindex->nNonce.GetHex());
-    result.pushKV("solution", HexStr(blockindex->nSolution));
+    result.pushKV("solution", HexStr(blockindex->GetSolution()));
     result.pushKV("bits", strprintf("%08x", blockindex->nBits));
     result.pushKV("difficulty", GetDifficulty(blockindex));
     result.pushKV("chainwork", blockindex->nChainWork.GetHex());
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    const CBlockIndex *pnext = tip->Next(blockindex);
     if (pnext)
         result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, JSONWriter& writer)
 {
-    UniValue result(UniValue::VOBJ);
-    result.pushKV("hash", block.GetHash().GetHex());
+    CChainTipViewRef tip = GetChainTipView();
+    writer.beginObject();
+    writer.pushKV("hash", block.GetHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.pushKV("confirmations", confirmations);
-    result.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
-    result.pushKV("height", blockindex->nHeight);
-    result.pushKV("version", block.nVersion);
-    result.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
-    UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+    if (tip->Contains(blockindex))
+        confirmations = tip->nHeight - blockindex->nHeight + 1;
+    writer.pushKV("confirmations", confirmations);
+    writer.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.pushKV("height", blockindex->nHeight);
+    writer.pushKV("version", block.nVersion);
+    writer.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
+    // The transactions are written one at a time, the largest part of the block
+    writer.key("tx");
+    writer.beginArray();
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
     {
+        const CTransaction& tx = *ptx;
         if(txDetails)
         {
             UniValue objTx(UniValue::VOBJ);
             TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
+            writer.push_back(objTx);
         }
         else
-            txs.push_back(tx.GetHash().GetHex());
+            writer.push_back(tx.GetHash().GetHex());
     }
-    result.pushKV("tx", txs);
-    result.pushKV("time", block.GetBlockTime());
-    result.pushKV("nonce", block.nNonce.GetHex());
-    result.pushKV("solution", HexStr(block.nSolution));
-    result.pushKV("bits", strprintf("%08x", block.nBits));
-    result.pushKV("difficulty", GetDifficulty(blockindex));
-    result.pushKV("chainwork", blockindex->nChainWork.GetHex());
-    result.pushKV("anchor", blockindex->hashAnchorEnd.GetHex());
+    writer.endArray();
+    writer.pushKV("time", block.GetBlockTime());
+    writer.pushKV("nonce", block.nNonce.GetHex());
+    writer.pushKV("solution", HexStr(block.nSolution));
+    writer.pushKV("bits", strprintf("%08x", block.nBits));
+    writer.pushKV("difficulty", GetDifficulty(blockindex));
+    writer.pushKV("chainwork", blockindex->nChainWork.GetHex());
+    writer.pushKV("anchor", blockindex->hashAnchorEnd.GetHex());
 
     UniValue valuePools(UniValue::VARR);
     valuePools.push_back(ValuePoolDesc("sprout", blockindex->nChainSproutValue, blockindex->nSproutValue));
-    result.pushKV("valuePools", valuePools);
+    writer.pushKV("valuePools", valuePools);
 
     if (blockindex->pprev)
-        result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+        writer.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    const CBlockIndex *pnext = tip->Next(blockindex);
     if (pnext)
-        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
-    return result;
+        writer.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+    writer.endObject();
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValueWriter writer;
+    blockToJSON(block, blockindex, txDetails, writer);
+    return writer.get();
 }
 
 UniValue getblockcount(const UniValue& params, bool fHelp)
@@ -184,8 +201,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainTipView()->nHeight;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -201,8 +217,7 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainTipView()->pindex->GetBlockHash().GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -218,60 +233,76 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getdifficulty", "")
         );
 
-    LOCK(cs_main);
-    return GetNetworkDifficulty();
+    return GetNetworkDifficulty(GetChainTipView()->pindex);
 }
 
-UniValue mempoolToJSON(bool fVerbose = false)
+UniValue mempoolEntryToJSON(const CTxMemPoolEntry& e)
+{
+    AssertLockHeld(mempool.cs);
+    UniValue info(UniValue::VOBJ);
+    info.pushKV("size", (int)e.GetTxSize());
+    info.pushKV("fee", ValueFromAmount(e.GetFee()));
+    info.pushKV("modifiedfee", ValueFromAmount(e.GetModifiedFee()));
+    info.pushKV("time", e.GetTime());
+    info.pushKV("height", (int)e.GetHeight());
+    info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
+    info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
+    info.pushKV("ancestorcount", e.GetCountWithAncestors());
+    info.pushKV("ancestorsize", e.GetSizeWithAncestors());
+    info.pushKV("ancestorfees", e.GetModFeesWithAncestors());
+    const CTransaction& tx = e.GetTx();
+    set<string> setDepends;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+
+    UniValue depends(UniValue::VARR);
+    BOOST_FOREACH(const string& dep, setDepends)
+    {
+        depends.push_back(dep);
+    }
+
+    info.pushKV("depends", depends);
+    return info;
+}
+
+void mempoolToJSON(bool fVerbose, JSONWriter& writer)
 {
     if (fVerbose)
     {
         LOCK(mempool.cs);
-        UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
-        {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
-            UniValue info(UniValue::VOBJ);
-            info.pushKV("size", (int)e.GetTxSize());
-            info.pushKV("fee", ValueFromAmount(e.GetFee()));
-            info.pushKV("time", e.GetTime());
-            info.pushKV("height", (int)e.GetHeight());
-            info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
-            info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            BOOST_FOREACH(const string& dep, setDepends)
-            {
-                depends.push_back(dep);
-            }
-
-            info.pushKV("depends", depends);
-            o.pushKV(hash.ToString(), info);
-        }
-        return o;
+        writer.beginObject();
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+            writer.pushKV(e.GetTx().GetHash().ToString(), mempoolEntryToJSON(e));
+        writer.endObject();
     }
     else
     {
         vector<uint256> vtxid;
         mempool.queryHashes(vtxid);
 
-        UniValue a(UniValue::VARR);
+        writer.beginArray();
         BOOST_FOREACH(const uint256& hash, vtxid)
-            a.push_back(hash.ToString());
-
-        return a;
+            writer.push_back(hash.ToString());
+        writer.endArray();
     }
 }
 
+UniValue mempoolToJSON(bool fVerbose = false)
+{
+    UniValueWriter writer;
+    mempoolToJSON(fVerbose, writer);
+    return writer.get();
+}
+
 UniValue getrawmempool(const UniValue& params, bool fHelp)
+{
+    return RPCWriteToUniValue(&getrawmempool, params, fHelp);
+}
+
+void getrawmempool(const UniValue& params, bool fHelp, JSONWriter& writer)
 {
     if (fHelp || params.size() > 1)
         throw runtime_error(
@@ -289,10 +320,14 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "  \"transactionid\" : {       (json object)\n"
             "    \"size\" : n,             (numeric) transaction size in bytes\n"
             "    \"fee\" : n,              (numeric) transaction fee in " + CURRENCY_UNIT + "\n"
+            "    \"modifiedfee\" : n,      (numeric) transaction fee with fee deltas used for mining priority\n"
             "    \"time\" : n,             (numeric) local time transaction entered pool in seconds since 1 Jan 1970 GMT\n"
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees (see above) of in-mempool ancestors (including this one), in zatoshis\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -309,7 +344,7 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
 
-    return mempoolToJSON(fVerbose);
+    mempoolToJSON(fVerbose, writer);
 }
 
 UniValue getblockhash(const UniValue& params, bool fHelp)
@@ -327,13 +362,11 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
-
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    const CBlockIndex* pblockindex = (*GetChainTipView())[nHeight];
+    if (pblockindex == NULL)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -368,8 +401,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -377,11 +408,10 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    const CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (pblockindex == NULL)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -394,6 +424,11 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
 }
 
 UniValue getblock(const UniValue& params, bool fHelp)
+{
+    return RPCWriteToUniValue(&getblock, params, fHelp);
+}
+
+void getblock(const UniValue& params, bool fHelp, JSONWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -441,8 +476,6 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "12800")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
 
     // If height is supplied, find the hash
@@ -461,10 +494,11 @@ UniValue getblock(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
         }
 
-        if (nHeight < 0 || nHeight > chainActive.Height()) {
+        const CBlockIndex* pblockindex = (*GetChainTipView())[nHeight];
+        if (pblockindex == NULL) {
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
         }
-        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
+        strHash = pblockindex->GetBlockHash().GetHex();
     }
 
     uint256 hash(uint256S(strHash));
@@ -482,15 +516,28 @@ UniValue getblock(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
     }
 
-    if (mapBlockIndex.count(hash) == 0)
+    const CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (pblockindex == NULL)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    {
+        LOCK(cs_main);
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    }
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    const std::string strCacheKey = strprintf("getblock/%d/%s", verbosity, hash.GetHex());
+    if (WriteCachedRPCResult(strCacheKey, writer))
+        return;
+    // A block is cached once it has a next block, its nextblockhash, and with the
+    // transactions of verbosity 2 only without the spent index, which changes them
+    const CBlockIndex* pindexNext = NULL;
+    if (nRPCResultCacheUsage > 0 && (verbosity < 2 || paddressindex == NULL))
+        pindexNext = GetChainTipView()->Next(pblockindex);
 
+    // The block is read and serialized without holding cs_main
+    CBlock block;
+    NoteBlockFileRead(pblockindex->nFile);
     if(!ReadBlockFromDisk(block, pblockindex))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
@@ -499,10 +546,22 @@ UniValue getblock(const UniValue& params, bool fHelp)
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        if (pindexNext)
+            CacheRPCResult(strCacheKey, std::make_shared<const UniValue>(strHex), pblockindex, pblockindex);
+        writer.push_back(strHex);
+        return;
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
+    if (!pindexNext) {
+        blockToJSON(block, pblockindex, verbosity >= 2, writer);
+        return;
+    }
+    std::shared_ptr<const UniValue> result = std::make_shared<const UniValue>(blockToJSON(block, pblockindex, verbosity >= 2));
+    // Unless the chain changed meanwhile
+    const UniValue& nextblockhash = find_value(*result, "nextblockhash");
+    if (nextblockhash.isStr() && nextblockhash.get_str() == pindexNext->GetBlockHash().GetHex())
+        CacheRPCResult(strCacheKey, result, pblockindex, pindexNext);
+    writer.push_back(*result);
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
@@ -543,6 +602,81 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumpchainstate(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumpchainstate \"filename\"\n"
+            "\nWrites a snapshot of the unspent transaction outputs, Sprout anchors and nullifiers at the current tip,\n"
+            "which can be loaded by a new node with the -loadsnapshot option. Overwriting an existing file is not permitted.\n"
+            "The snapshot is always of the tip: the chainstate at an earlier height is not kept, so it cannot be dumped.\n"
+            "A node loading the snapshot syncs the headers up to its block first, if it does not have them yet.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The filename, saved in folder set by zend -exportdir option\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",       (string) The full path of the snapshot file\n"
+            "  \"height\": n,          (numeric) The height of the snapshot block\n"
+            "  \"bestblock\": \"hex\",   (string) The hash of the snapshot block\n"
+            "  \"coins\": n,           (numeric) The number of transactions with unspent outputs\n"
+            "  \"anchors\": n,         (numeric) The number of Sprout anchors\n"
+            "  \"nullifiers\": n,      (numeric) The number of Sprout nullifiers\n"
+            "  \"hash\": \"hash\"        (string) The hash of the snapshot contents\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpchainstate", "\"snapshot\"")
+            + HelpExampleRpc("dumpchainstate", "\"snapshot\"")
+        );
+
+    boost::filesystem::path exportdir;
+    try {
+        exportdir = GetExportDir();
+    } catch (const std::runtime_error& e) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, e.what());
+    }
+    if (exportdir.empty()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot export the chainstate until the zend -exportdir option has been set");
+    }
+    std::string unclean = params[0].get_str();
+    std::string clean = SanitizeFilename(unclean);
+    if (clean.compare(unclean) != 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Filename is invalid as only alphanumeric characters are allowed.  Try '%s' instead.", clean));
+    }
+    boost::filesystem::path exportfilepath = exportdir / clean;
+    if (boost::filesystem::exists(exportfilepath)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot overwrite existing file " + exportfilepath.string());
+    }
+
+    if (!pcoinsdbview)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "No chainstate database");
+
+    FlushStateToDisk();
+
+    CAutoFile fileout(fopen(exportfilepath.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open snapshot file");
+
+    CChainstateSnapshotInfo info;
+    if (!pcoinsdbview->WriteSnapshot(fileout, info))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Failed to write the chainstate snapshot");
+    FileCommit(fileout.Get());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("path", exportfilepath.string());
+    {
+        LOCK(cs_main);
+        BlockMap::iterator it = mapBlockIndex.find(info.hashBlock);
+        ret.pushKV("height", it != mapBlockIndex.end() ? it->second->nHeight : -1);
+    }
+    ret.pushKV("bestblock", info.hashBlock.GetHex());
+    ret.pushKV("coins", (uint64_t)info.nCoins);
+    ret.pushKV("anchors", (uint64_t)info.nAnchors);
+    ret.pushKV("nullifiers", (uint64_t)info.nNullifiers);
+    ret.pushKV("hash", info.hashSnapshot.GetHex());
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -623,6 +757,222 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     return ret;
 }
 
+static UniValue DBInfoToJSON(const CLevelDBWrapper& db, bool fTables)
+{
+    const CLevelDBProfile& profile = db.GetProfile();
+    UniValue obj(UniValue::VOBJ);
+    UniValue prof(UniValue::VOBJ);
+    prof.pushKV("blocksize", (uint64_t)profile.nBlockSize);
+    prof.pushKV("bloombits", profile.nBloomBits);
+    prof.pushKV("maxopenfiles", profile.nMaxOpenFiles);
+    prof.pushKV("compression", profile.fCompression);
+    prof.pushKV("writebuffer", profile.nWriteBufferPercent);
+    obj.pushKV("profile", prof);
+
+    UniValue levels(UniValue::VARR);
+    std::string strValue;
+    for (int nLevel = 0; db.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+        levels.push_back(atoi64(strValue));
+    obj.pushKV("files", levels);
+    if (db.GetProperty("leveldb.stats", strValue))
+        obj.pushKV("stats", strValue);
+    if (fTables && db.GetProperty("leveldb.sstables", strValue))
+        obj.pushKV("sstables", strValue);
+    return obj;
+}
+
+UniValue getblockfilter(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getblockfilter \"hash\" ( \"filtertype\" )\n"
+            "\nReturns the compact filter of a block (requires -blockfilterindex).\n"
+            "\nArguments:\n"
+            "1. \"hash\"          (string, required) The block hash\n"
+            "2. \"filtertype\"    (string, optional, default=basic) The type of the filter, only basic for now\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) The filter, hex-encoded\n"
+            "  \"header\" : \"hex\"    (string) The header of the filter\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+        );
+
+    if (pblockfilterdb == NULL)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block filter index not enabled, start with -blockfilterindex");
+    if (params.size() > 1 && params[1].get_str() != "basic")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown filter type");
+
+    uint256 hash(uint256S(params[0].get_str()));
+    if (LookupBlockIndex(hash) == NULL)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    std::vector<unsigned char> vchFilter;
+    CBlockFilterHeader header;
+    if (!pblockfilterdb->ReadFilter(hash, vchFilter) || !pblockfilterdb->ReadFilterHeader(hash, header))
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not built yet for this block");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("filter", HexStr(vchFilter));
+    ret.pushKV("header", header.header.GetHex());
+    return ret;
+}
+
+UniValue getdbinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getdbinfo ( sstables )\n"
+            "\nReturns the tuning and the internal statistics of the LevelDB databases.\n"
+            "\nArguments:\n"
+            "1. sstables    (boolean, optional, default=false) Also list the table files of each database\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {          (object) The coins database, and likewise \"blockindex\" for the block index\n"
+            "    \"profile\": {           (object) The tuning in use, see -dboption\n"
+            "      \"blocksize\": n,      (numeric) Uncompressed size of the table blocks\n"
+            "      \"bloombits\": n,      (numeric) Bits per key of the Bloom filters, 0 for none\n"
+            "      \"maxopenfiles\": n,   (numeric) Table files kept open\n"
+            "      \"compression\": b,    (boolean) Whether the blocks are compressed\n"
+            "      \"writebuffer\": n     (numeric) Percent of the cache for each write buffer\n"
+            "    },\n"
+            "    \"files\": [n,...],      (array) Number of table files at each level\n"
+            "    \"stats\": \"...\",        (string) Compaction statistics as reported by LevelDB\n"
+            "    \"sstables\": \"...\"      (string, optional) The table files at each level\n"
+            "  },\n"
+            "  \"blockindex\": {...}\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbinfo", "")
+            + HelpExampleRpc("getdbinfo", "true")
+        );
+
+    bool fTables = params.size() > 0 && params[0].get_bool();
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    if (pcoinsdbview)
+        ret.pushKV(pcoinsdbview->GetDB().GetProfile().strName, DBInfoToJSON(pcoinsdbview->GetDB(), fTables));
+    if (pblocktree)
+        ret.pushKV(pblocktree->GetProfile().strName, DBInfoToJSON(*pblocktree, fTables));
+    return ret;
+}
+
+UniValue getioinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getioinfo\n"
+            "\nReturns statistics of the disk writes of each class since startup. The block writes come first,\n"
+            "the others wait for those in progress before starting.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"block\": {               (object) Block file appends and syncs, and likewise \"undo\", \"flush\" (block index\n"
+            "                            and chainstate), \"compaction\" (LevelDB), \"prune\", \"rewrite\" (compressed block\n"
+            "                            files) and \"index\" (transaction and address indexes)\n"
+            "    \"ops\": n,              (numeric) Operations done\n"
+            "    \"bytes\": n,            (numeric) Bytes written, or the estimate of them, 0 when unknown\n"
+            "    \"deferred\": n,         (numeric) Operations which waited for the block writes or for -iobackgroundlimit\n"
+            "    \"defertime\": n,        (numeric) Milliseconds they waited\n"
+            "    \"busytime\": n,         (numeric) Milliseconds taken by the operations\n"
+            "    \"maxbusytime\": n       (numeric) Milliseconds taken by the longest operation\n"
+            "  },\n"
+            "  ...\n"
+            "  \"backgroundlimit\": n     (numeric) The -iobackgroundlimit in MiB/s, 0 for none\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getioinfo", "")
+            + HelpExampleRpc("getioinfo", "")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    for (int i = 0; i < IO_CLASSES; i++) {
+        const CIOClassStats stats = GetIOClassStats((IOClass)i);
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("ops", stats.nOps);
+        obj.pushKV("bytes", stats.nBytes);
+        obj.pushKV("deferred", stats.nDeferred);
+        obj.pushKV("defertime", stats.nDeferMicros / 1000);
+        obj.pushKV("busytime", stats.nBusyMicros / 1000);
+        obj.pushKV("maxbusytime", stats.nMaxBusyMicros / 1000);
+        ret.pushKV(GetIOClassName((IOClass)i), obj);
+    }
+    ret.pushKV("backgroundlimit", std::max<int64_t>(0, GetArg("-iobackgroundlimit", DEFAULT_IO_BACKGROUND_LIMIT)));
+    return ret;
+}
+
+UniValue getblockvalidationstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getblockvalidationstats ( count )\n"
+            "\nReturns where the time connecting the last blocks to the tip went, in microseconds, the latest block first.\n"
+            "The last " + strprintf("%u", BLOCK_VALIDATION_STATS_SIZE) + " blocks connected since this node was started are kept.\n"
+            "\nArguments:\n"
+            "1. count              (numeric, optional, default=10) The blocks to return\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"hash\": \"hash\",       (string) The block hash\n"
+            "    \"height\": n,          (numeric) The block height\n"
+            "    \"tx\": n,              (numeric) The transactions of the block\n"
+            "    \"inputs\": n,          (numeric) Their inputs\n"
+            "    \"time\": n,            (numeric) When the block was connected, in seconds since epoch (Jan 1 1970 GMT)\n"
+            "    \"read\": n,            (numeric) Reading the block from disk, 0 when it was received\n"
+            "    \"coinsfetch\": n,      (numeric) Reading the coins it spends from the database ahead of connecting it\n"
+            "    \"proofs\": n,          (numeric) Checking the block again, verifying the JoinSplit proofs inline, and waiting\n"
+            "                            for those verified in parallel with -par\n"
+            "    \"connect\": n,         (numeric) Connecting the transactions to the coins, the script checks run inline included\n"
+            "    \"scripts\": n,         (numeric) Waiting for the script checks run in parallel with -par\n"
+            "    \"undo\": n,            (numeric) Writing the undo data\n"
+            "    \"index\": n,           (numeric) Writing the block index, the undo data included\n"
+            "    \"callbacks\": n,       (numeric) The notifications of ConnectBlock\n"
+            "    \"flush\": n,           (numeric) Flushing the coins to the cache of the tip\n"
+            "    \"chainstate\": n,      (numeric) Writing the chain state to disk, when it was due\n"
+            "    \"notify\": n,          (numeric) Notifying the wallets and the subscribers to the tip\n"
+            "    \"postprocess\": n,     (numeric) Updating the mempool and the tip, the notifications included\n"
+            "    \"total\": n            (numeric) The whole time\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockvalidationstats", "")
+            + HelpExampleRpc("getblockvalidationstats", "100")
+        );
+
+    int nCount = 10;
+    if (params.size() > 0)
+        nCount = params[0].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count, must be 0 or more");
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const BlockValidationStats& stats, GetBlockValidationStats(nCount)) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("hash", stats.hash.GetHex());
+        obj.pushKV("height", stats.nHeight);
+        obj.pushKV("tx", (uint64_t)stats.nTx);
+        obj.pushKV("inputs", (uint64_t)stats.nInputs);
+        obj.pushKV("time", stats.nTime);
+        obj.pushKV("read", stats.nReadTime);
+        obj.pushKV("coinsfetch", stats.nCoinsFetchTime);
+        obj.pushKV("proofs", stats.nProofTime);
+        obj.pushKV("connect", stats.nConnectTime);
+        obj.pushKV("scripts", stats.nScriptTime);
+        obj.pushKV("undo", stats.nUndoTime);
+        obj.pushKV("index", stats.nIndexTime);
+        obj.pushKV("callbacks", stats.nCallbacksTime);
+        obj.pushKV("flush", stats.nFlushTime);
+        obj.pushKV("chainstate", stats.nChainStateTime);
+        obj.pushKV("notify", stats.nNotifyTime);
+        obj.pushKV("postprocess", stats.nPostProcessTime);
+        obj.pushKV("total", stats.nTotalTime);
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 UniValue verifychain(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -717,6 +1067,10 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"commitments\": xxxxxx,    (numeric) the current number of note commitments in the commitment tree\n"
+            "  \"snapshotvalidation\": {   (object, optional) present while a chainstate loaded from a snapshot is validated in the background\n"
+            "     \"height\": xxxxxx,        (numeric) the height of the snapshot block\n"
+            "     \"validatedheight\": xxx,  (numeric) the height up to which the block chain has been validated\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -754,6 +1108,13 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.pushKV("verificationprogress",  Checkpoints::GuessVerificationProgress(Params().Checkpoints(), chainActive.Tip()));
     obj.pushKV("chainwork",             chainActive.Tip()->nChainWork.GetHex());
     obj.pushKV("pruned",                fPruneMode);
+    int nSnapshotHeight, nValidatedHeight;
+    if (GetSnapshotValidationProgress(nSnapshotHeight, nValidatedHeight)) {
+        UniValue snapshot(UniValue::VOBJ);
+        snapshot.pushKV("height",          nSnapshotHeight);
+        snapshot.pushKV("validatedheight", nValidatedHeight);
+        obj.pushKV("snapshotvalidation", snapshot);
+    }
 
     ZCIncrementalMerkleTree tree;
     pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), tree);
@@ -908,6 +1269,9 @@ UniValue mempoolInfoToJSON()
     ret.pushKV("size", (int64_t) mempool.size());
     ret.pushKV("bytes", (int64_t) mempool.GetTotalTxSize());
     ret.pushKV("usage", (int64_t) mempool.DynamicMemoryUsage());
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.pushKV("maxmempool", (int64_t) maxmempool);
+    ret.pushKV("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK()));
 
     if (Params().NetworkIDString() == "regtest") {
         ret.pushKV("fullyNotified", mempool.IsFullyNotified());
@@ -927,6 +1291,8 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -1013,29 +1379,17 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
-int64_t blocksToOvertakeTarget(const CBlockIndex* forkTip, const CBlockIndex* targetBlock)
+/**
+ * Blocks to mine on forkTip in order to revert targetBlock, a block of the main chain,
+ * given the height of the main chain block where forkTip forks from.
+ */
+static int64_t blocksToOvertakeTarget(const CBlockIndex* forkTip, int intersectionHeight, const CBlockIndex* targetBlock)
 {
-    //this function assumes forkTip and targetBlock are non-null.
-    if (!chainActive.Contains(targetBlock))
-        return LLONG_MAX;
-
     int64_t gap = 0;
     const int targetBlockHeight = targetBlock->nHeight;
     const int selectedTipHeight = forkTip->nHeight;
-    const int intersectionHeight = chainActive.FindFork(forkTip)->nHeight;
-
-    LogPrint("forks", "%s():%d - processing tip h(%d) [%s] forkBaseHeight[%d]\n",
-            __func__, __LINE__, forkTip->nHeight, forkTip->GetBlockHash().ToString(),
-            intersectionHeight);
 
-    // during a node's life, there might be many tips in the container, it is not useful
-    // keeping all of them into account for calculating the finality, just consider the most recent ones.
-    // Blocks are ordered by height, stop if we exceed a safe limit in depth, lets say the max age
-    if ((chainActive.Height() - selectedTipHeight) >= MAX_BLOCK_AGE_FOR_FINALITY) {
-        LogPrint("forks", "%s():%d - exiting loop on tips, max age reached: forkBaseHeight[%d], chain[%d]\n",
-                __func__, __LINE__, intersectionHeight, chainActive.Height());
-        gap = LLONG_MAX;
-    } else if (intersectionHeight < targetBlockHeight) {
+    if (intersectionHeight < targetBlockHeight) {
         // if the fork base is older than the input block, finality also depends on the current penalty
         // ongoing on the fork
         int64_t forkDelay = forkTip->nChainDelay;
@@ -1071,18 +1425,84 @@ int64_t blocksToOvertakeTarget(const CBlockIndex* forkTip, const CBlockIndex* ta
     return gap;
 }
 
-UniValue getblockfinalityindex(const UniValue& params, bool fHelp)
+int64_t blocksToOvertakeTarget(const CBlockIndex* forkTip, const CBlockIndex* targetBlock)
 {
-    if (fHelp || params.size() < 1 || params.size() > 2)
-        throw runtime_error(
-            "getblockfinalityindex \"hash\"\n"
-            "\nReturns the minimum number of consecutive blocks a miner should mine from now in order to revert the block of given hash\n"
-            "\nExamples:\n"
-            + HelpExampleCli("getblockfinalityindex", "\"hash\"")
-        );
-    LOCK(cs_main);
+    //this function assumes forkTip and targetBlock are non-null.
+    if (!chainActive.Contains(targetBlock))
+        return LLONG_MAX;
 
-    uint256 hash = ParseHashV(params[0], "parameter 1");
+    // during a node's life, there might be many tips in the container, it is not useful
+    // keeping all of them into account for calculating the finality, just consider the most recent ones.
+    // Blocks are ordered by height, stop if we exceed a safe limit in depth, lets say the max age.
+    // This is checked first, so that the fork base of such tips is not even looked for.
+    if ((chainActive.Height() - forkTip->nHeight) >= MAX_BLOCK_AGE_FOR_FINALITY) {
+        LogPrint("forks", "%s():%d - exiting loop on tips, max age reached: tip h(%d), chain[%d]\n",
+                __func__, __LINE__, forkTip->nHeight, chainActive.Height());
+        return LLONG_MAX;
+    }
+
+    const int intersectionHeight = chainActive.FindFork(forkTip)->nHeight;
+
+    LogPrint("forks", "%s():%d - processing tip h(%d) [%s] forkBaseHeight[%d]\n",
+            __func__, __LINE__, forkTip->nHeight, forkTip->GetBlockHash().ToString(),
+            intersectionHeight);
+
+    return blocksToOvertakeTarget(forkTip, intersectionHeight, targetBlock);
+}
+
+namespace {
+
+/**
+ * What finality indexes depend on besides the block they are asked for: the tips
+ * recent enough to be considered, with the height they fork from the main chain at.
+ * Rebuilt only when the active tip or the set of global fork tips changes, as told
+ * by nGlobalTipsVersion, and kept with the indexes computed since (protected by cs_main).
+ */
+struct CFinalityCache
+{
+    bool fValid;
+    uint64_t nTipsVersion;
+    std::vector<std::pair<const CBlockIndex*, int> > vTips;
+    std::map<uint256, int64_t> mapFinalityIndex;
+
+    CFinalityCache() : fValid(false), nTipsVersion(0) {}
+};
+
+CFinalityCache finalityCache;
+
+void UpdateFinalityCache()
+{
+    AssertLockHeld(cs_main);
+    if (finalityCache.fValid && finalityCache.nTipsVersion == nGlobalTipsVersion)
+        return;
+
+    std::set<const CBlockIndex*, CompareBlocksByHeight> setTips;
+    for(auto mapPair: mGlobalForkTips)
+    {
+        const CBlockIndex* idx = mapPair.first;
+        setTips.insert(idx);
+    }
+    setTips.insert(chainActive.Tip());
+
+    // For each tip find the stemming block on the main chain
+    // In case of main tip such a block would be the tip itself
+    finalityCache.vTips.clear();
+    for(auto selectedTip: setTips)
+    {
+        // tips are sorted by decreasing height: once one is too old, all the following ones are as well
+        if ((chainActive.Height() - selectedTip->nHeight) >= MAX_BLOCK_AGE_FOR_FINALITY)
+            break;
+        finalityCache.vTips.push_back(std::make_pair(selectedTip, chainActive.FindFork(selectedTip)->nHeight));
+    }
+    finalityCache.mapFinalityIndex.clear();
+    finalityCache.nTipsVersion = nGlobalTipsVersion;
+    finalityCache.fValid = true;
+}
+
+/** The finality index of the block of the given hash, throwing the RPC error if there is none */
+int64_t GetBlockFinalityIndex(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
 
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No such block header");
@@ -1111,30 +1531,83 @@ UniValue getblockfinalityindex(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Old block: older than 2000!");
     }
 
-    std::set<const CBlockIndex*, CompareBlocksByHeight> setTips;
-    for(auto mapPair: mGlobalForkTips)
-    {
-        const CBlockIndex* idx = mapPair.first;
-        setTips.insert(idx);
-    }
-    setTips.insert(chainActive.Tip());
-
-//    dump_global_tips();
+    UpdateFinalityCache();
+    std::map<uint256, int64_t>::const_iterator it = finalityCache.mapFinalityIndex.find(hash);
+    if (it != finalityCache.mapFinalityIndex.end())
+        return it->second;
 
-    // For each tip find the stemming block on the main chain
-    // In case of main tip such a block would be the tip itself
-    //-----------------------------------------------------------------------
     int64_t minGap = LLONG_MAX;
-    for(auto selectedTip: setTips)
+    for(auto tip: finalityCache.vTips)
     {
-        int64_t gap = blocksToOvertakeTarget(selectedTip, pTargetBlockIdx);
+        int64_t gap = blocksToOvertakeTarget(tip.first, tip.second, pTargetBlockIdx);
         minGap = std::min(minGap, gap);
     }
 
+    finalityCache.mapFinalityIndex[hash] = minGap;
     LogPrint("forks", "%s():%d - returning [%d]\n", __func__, __LINE__, minGap);
     return minGap;
 }
 
+}
+
+UniValue getblockfinalityindex(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getblockfinalityindex \"hash\"\n"
+            "\nReturns the minimum number of consecutive blocks a miner should mine from now in order to revert the block of given hash\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfinalityindex", "\"hash\"")
+        );
+    LOCK(cs_main);
+
+    uint256 hash = ParseHashV(params[0], "parameter 1");
+    return GetBlockFinalityIndex(hash);
+}
+
+UniValue getblocksfinalityindex(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getblocksfinalityindex [\"hash\",...]\n"
+            "\nReturns the finality index, as getblockfinalityindex does, of each of the blocks of given hashes\n"
+            "\nArguments:\n"
+            "1. \"hashes\"        (string, required) A json array of block hashes\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"hash\" : \"hash\",          (string) the block hash\n"
+            "    \"finalityindex\" : n,      (numeric) the finality index of the block, if it could be computed\n"
+            "    \"error\" : \"text\"          (string) why the finality index could not be computed otherwise\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblocksfinalityindex", "\"[\\\"hash\\\",...]\"")
+        );
+
+    UniValue hashes = params[0].get_array();
+    std::vector<uint256> vHashes;
+    for (size_t idx = 0; idx < hashes.size(); idx++)
+        vHashes.push_back(ParseHashV(hashes[idx], "hash"));
+
+    LOCK(cs_main);
+
+    UniValue result(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, vHashes)
+    {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("hash", hash.GetHex());
+        try {
+            entry.pushKV("finalityindex", GetBlockFinalityIndex(hash));
+        } catch (const UniValue& objError) {
+            entry.pushKV("error", find_value(objError, "message"));
+        }
+        result.push_back(entry);
+    }
+    return result;
+}
+
 UniValue getglobaltips(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -25,6 +25,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
 {
     { "stop", 0 },
     { "setmocktime", 0 },
+    { "getlockprofile", 0 },
+    { "getblockvalidationstats", 0 },
+    { "setlockprofile", 0 },
+    { "setlockprofile", 1 },
     { "getaddednodeinfo", 0 },
     { "setgenerate", 0 },
     { "setgenerate", 1 },
@@ -77,14 +81,26 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 1 },
     { "signrawtransaction", 2 },
     { "sendrawtransaction", 1 },
+    { "submitpackage", 0 },
+    { "submitpackage", 1 },
     { "fundrawtransaction", 1 },
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
+    { "getblocksfinalityindex", 0 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
     { "importprivkey", 2 },
+    { "importprivkey", 3 },
     { "importaddress", 2 },
+    { "getdbinfo", 0 },
+    { "getaddressbalance", 0 },
+    { "getaddressdeltas", 0 },
+    { "getaddresstxids", 0 },
+    { "getaddressutxos", 0 },
+    { "getspentinfo", 0 },
+    { "z_watchviewingkey", 1 },
+    { "z_listwatchednotes", 1 },
     { "verifychain", 0 },
     { "verifychain", 1 },
     { "keypoolrefill", 0 },
@@ -101,8 +117,12 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "zcrawjoinsplit", 4 },
     { "zcbenchmark", 1 },
     { "zcbenchmark", 2 },
+    { "zcbenchmark", 3 },
+    { "zcbenchmark", 4 },
+    { "zcbenchmark", 5 },
     { "getblocksubsidy", 0},
     { "z_listreceivedbyaddress", 1},
+    { "z_listreceivedbyaddress", 2},
     { "z_getbalance", 1},
     { "z_gettotalbalance", 0},
     { "z_gettotalbalance", 1},
@@ -113,6 +133,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
 	{ "z_sendmany", 4},
     { "z_shieldcoinbase", 2},
     { "z_shieldcoinbase", 3},
+    { "z_shieldcoinbase", 4},
     { "z_getoperationstatus", 0},
     { "z_getoperationresult", 0},
     { "z_importkey", 2 },
@@ -0,0 +1,146 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonwriter.h"
+
+#include <assert.h>
+
+void JSONWriter::pushKVs(const UniValue& obj)
+{
+    assert(obj.isObject());
+    for (size_t i = 0; i < obj.size(); i++)
+        pushKV(obj.getKeys()[i], obj.getValues()[i]);
+}
+
+void UniValueWriter::begin(UniValue::VType type)
+{
+    vStack.push_back(std::make_pair(strNextKey, UniValue(type)));
+}
+
+void UniValueWriter::end()
+{
+    assert(!vStack.empty());
+    std::pair<std::string, UniValue> top;
+    std::swap(top, vStack.back());
+    vStack.pop_back();
+    strNextKey = top.first;
+    push_back(top.second);
+}
+
+void UniValueWriter::beginObject()
+{
+    begin(UniValue::VOBJ);
+}
+
+void UniValueWriter::endObject()
+{
+    assert(!vStack.empty() && vStack.back().second.isObject());
+    end();
+}
+
+void UniValueWriter::beginArray()
+{
+    begin(UniValue::VARR);
+}
+
+void UniValueWriter::endArray()
+{
+    assert(!vStack.empty() && vStack.back().second.isArray());
+    end();
+}
+
+void UniValueWriter::key(const std::string& strKey)
+{
+    strNextKey = strKey;
+}
+
+void UniValueWriter::push_back(const UniValue& val)
+{
+    if (vStack.empty())
+        result = val;
+    else if (vStack.back().second.isObject())
+        vStack.back().second.pushKV(strNextKey, val);
+    else
+        vStack.back().second.push_back(val);
+}
+
+JSONStreamWriter::JSONStreamWriter(const Sink& sinkIn) : sink(sinkIn), fKey(false)
+{
+    strBuffer.reserve(JSON_STREAM_CHUNK_SIZE);
+}
+
+void JSONStreamWriter::Separate()
+{
+    if (vStack.empty())
+        return;
+    if (vStack.back().first) {
+        // Values in objects come after their keys, which have the commas
+        assert(fKey);
+        fKey = false;
+        return;
+    }
+    if (vStack.back().second)
+        strBuffer += ',';
+    vStack.back().second = true;
+}
+
+void JSONStreamWriter::Write(const std::string& str)
+{
+    strBuffer += str;
+    if (strBuffer.size() >= JSON_STREAM_CHUNK_SIZE) {
+        sink(strBuffer.data(), strBuffer.size());
+        strBuffer.clear();
+    }
+}
+
+void JSONStreamWriter::beginObject()
+{
+    Separate();
+    Write("{");
+    vStack.push_back(std::make_pair(true, false));
+}
+
+void JSONStreamWriter::endObject()
+{
+    assert(!vStack.empty() && vStack.back().first && !fKey);
+    vStack.pop_back();
+    Write("}");
+}
+
+void JSONStreamWriter::beginArray()
+{
+    Separate();
+    Write("[");
+    vStack.push_back(std::make_pair(false, false));
+}
+
+void JSONStreamWriter::endArray()
+{
+    assert(!vStack.empty() && !vStack.back().first);
+    vStack.pop_back();
+    Write("]");
+}
+
+void JSONStreamWriter::key(const std::string& strKey)
+{
+    assert(!vStack.empty() && vStack.back().first && !fKey);
+    if (vStack.back().second)
+        strBuffer += ',';
+    vStack.back().second = true;
+    Write(UniValue(strKey).write() + ":");
+    fKey = true;
+}
+
+void JSONStreamWriter::push_back(const UniValue& val)
+{
+    Separate();
+    Write(val.write());
+}
+
+void JSONStreamWriter::Flush()
+{
+    if (!strBuffer.empty())
+        sink(strBuffer.data(), strBuffer.size());
+    strBuffer.clear();
+}
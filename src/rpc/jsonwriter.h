@@ -0,0 +1,104 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONWRITER_H
+#define BITCOIN_RPC_JSONWRITER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <univalue.h>
+
+//! Size of the pieces of JSON a JSONStreamWriter hands to its sink
+static const size_t JSON_STREAM_CHUNK_SIZE = 1 << 16;
+
+/**
+ * Builder of a JSON value, called as a UniValue is built. The containers are opened and
+ * closed around their elements, so that a large value is written as it is built rather
+ * than held whole in memory: push_back and pushKV take the elements, which may be whole
+ * UniValues, and key gives the key of the container begun next in an object.
+ */
+class JSONWriter
+{
+public:
+    virtual ~JSONWriter() {}
+
+    virtual void beginObject() = 0;
+    virtual void endObject() = 0;
+    virtual void beginArray() = 0;
+    virtual void endArray() = 0;
+    //! The key of the next value, in an object
+    virtual void key(const std::string& strKey) = 0;
+    //! The next value, of the array or after its key in an object, or the whole value
+    virtual void push_back(const UniValue& val) = 0;
+
+    void pushKV(const std::string& strKey, const UniValue& val)
+    {
+        key(strKey);
+        push_back(val);
+    }
+    //! The keys and values of obj, in an object
+    void pushKVs(const UniValue& obj);
+};
+
+/** Builds the value as a UniValue, for the callers which need one */
+class UniValueWriter : public JSONWriter
+{
+public:
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const std::string& strKey);
+    void push_back(const UniValue& val);
+
+    //! The value, once all is written
+    const UniValue& get() const { return result; }
+
+private:
+    //! The containers begun, with the keys they go under in their parent
+    std::vector<std::pair<std::string, UniValue> > vStack;
+    std::string strNextKey;
+    UniValue result;
+
+    void begin(UniValue::VType type);
+    void end();
+};
+
+/**
+ * Writes the value as compact JSON, as UniValue::write does, in pieces of about
+ * JSON_STREAM_CHUNK_SIZE handed to sink. Flush hands it the last one.
+ */
+class JSONStreamWriter : public JSONWriter
+{
+public:
+    typedef boost::function<void(const char* data, size_t size)> Sink;
+
+    explicit JSONStreamWriter(const Sink& sinkIn);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const std::string& strKey);
+    void push_back(const UniValue& val);
+
+    void Flush();
+
+private:
+    Sink sink;
+    std::string strBuffer;
+    //! The containers begun, whether they are objects, and whether they have an element yet
+    std::vector<std::pair<bool, bool> > vStack;
+    bool fKey;
+
+    //! Before a value, the comma separating it from the previous element of an array
+    void Separate();
+    void Write(const std::string& str);
+};
+
+#endif // BITCOIN_RPC_JSONWRITER_H
@@ -20,6 +20,7 @@
 #include "rpc/server.h"
 #include "txmempool.h"
 #include "util.h"
+#include "utilmoneystr.h"
 #include "validationinterface.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
@@ -28,6 +29,7 @@
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
+#include <boost/optional.hpp>
 
 #include <univalue.h>
 
@@ -290,6 +292,31 @@ UniValue setgenerate(const UniValue& params, bool fHelp)
 #endif
 
 
+UniValue LatencyToJSON(const AtomicHistogram& histogram)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("count", histogram.getCount());
+    obj.pushKV("mean",  histogram.mean());
+    obj.pushKV("p50",   histogram.percentile(0.5));
+    obj.pushKV("p90",   histogram.percentile(0.9));
+    obj.pushKV("p99",   histogram.percentile(0.99));
+    obj.pushKV("max",   histogram.getMax());
+    return obj;
+}
+
+static UniValue SolverThreadsToJSON()
+{
+    UniValue arr(UniValue::VARR);
+    for (auto& m : GetAllMiningThreadMetrics()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("solverruns",   m->solverRuns.get());
+        obj.pushKV("targetchecks", m->targetChecks.get());
+        obj.pushKV("localsolps",   m->timer.rate(m->targetChecks));
+        arr.push_back(obj);
+    }
+    return arr;
+}
+
 UniValue getmininginfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -307,6 +334,23 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"genproclimit\": n          (numeric) The processor limit for generation. -1 if no generation. (see getgenerate or setgenerate calls)\n"
             "  \"localsolps\": xxx.xxxxx    (numeric) The average local solution rate in Sol/s since this node was started\n"
             "  \"networksolps\": x          (numeric) The estimated network solution rate in Sol/s\n"
+            "  \"solverthreads\": [          (array) The mining threads since generation was last turned on\n"
+            "    {\n"
+            "      \"solverruns\": n          (numeric) The number of Equihash solver runs of the thread\n"
+            "      \"targetchecks\": n        (numeric) The number of solutions the thread checked against the target\n"
+            "      \"localsolps\": xxx.xxxxx  (numeric) The average solution rate of the thread in Sol/s\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"createnewblock\": {        (json object) Time to build block templates since this node was started, in microseconds\n"
+            "    \"count\": n,               (numeric) The number of templates built\n"
+            "    \"mean\": n,                (numeric) The mean time\n"
+            "    \"p50\": n,                 (numeric) The median time, estimated to within a factor of two\n"
+            "    \"p90\": n,                 (numeric) The 90th percentile, estimated likewise\n"
+            "    \"p99\": n,                 (numeric) The 99th percentile, estimated likewise\n"
+            "    \"max\": n                  (numeric) The longest time\n"
+            "  },\n"
+            "  \"getblocktemplate\": {...}  (json object) Time to answer getblocktemplate, not counting long polling, as above\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
@@ -329,6 +373,9 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.pushKV("localsolps"  ,     getlocalsolps(params, false));
     obj.pushKV("networksolps",     getnetworksolps(params, false));
     obj.pushKV("networkhashps",    getnetworksolps(params, false));
+    obj.pushKV("solverthreads",    SolverThreadsToJSON());
+    obj.pushKV("createnewblock",   LatencyToJSON(createNewBlockLatency));
+    obj.pushKV("getblocktemplate", LatencyToJSON(getBlockTemplateLatency));
     obj.pushKV("pooledtx",         (uint64_t)mempool.size());
     obj.pushKV("testnet",          Params().TestnetToBeDeprecatedFieldRPC());
     obj.pushKV("chain",            Params().NetworkIDString());
@@ -390,6 +437,36 @@ static UniValue BIP22ValidationResult(const CValidationState& state)
     return "valid?";
 }
 
+/** Default size of the extranonce that "coinbaseparts" leaves room for */
+static const int64_t DEFAULT_COINBASE_EXTRANONCE_SIZE = 8;
+
+/**
+ * Split the serialized coinbase around an extranonce of nExtraNonceSize bytes pushed
+ * after the height in its scriptSig, so that pools can insert their own extranonce
+ * and hash the coinbase without decoding it.
+ */
+static UniValue CoinbaseParts(const CTransaction& txCoinbase, int nHeight, size_t nExtraNonceSize)
+{
+    std::vector<unsigned char> vchCoinbase[2];
+    for (int i = 0; i < 2; i++) {
+        CMutableTransaction tx(txCoinbase);
+        tx.vin[0].scriptSig = CScript() << nHeight << std::vector<unsigned char>(nExtraNonceSize, i == 0 ? 0x00 : 0xff);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << CTransaction(tx);
+        vchCoinbase[i].assign(ss.begin(), ss.end());
+    }
+    // Both serializations only differ by the extranonce bytes
+    assert(vchCoinbase[0].size() == vchCoinbase[1].size());
+    size_t nOffset = std::mismatch(vchCoinbase[0].begin(), vchCoinbase[0].end(), vchCoinbase[1].begin()).first - vchCoinbase[0].begin();
+    assert(nOffset + nExtraNonceSize <= vchCoinbase[0].size());
+
+    UniValue parts(UniValue::VOBJ);
+    parts.pushKV("coinb1", HexStr(vchCoinbase[0].begin(), vchCoinbase[0].begin() + nOffset));
+    parts.pushKV("coinb2", HexStr(vchCoinbase[0].begin() + nOffset + nExtraNonceSize, vchCoinbase[0].end()));
+    parts.pushKV("extranoncesize", (int64_t)nExtraNonceSize);
+    return parts;
+}
+
 UniValue getblocktemplate(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -404,9 +481,10 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "     {\n"
             "       \"mode\":\"template\"    (string, optional) This must be set to \"template\" or omitted\n"
             "       \"capabilities\":[       (array, optional) A list of strings\n"
-            "           \"support\"           (string) client side supported feature, 'longpoll', 'coinbasetxn', 'coinbasevalue', 'proposal', 'serverlist', 'workid'\n"
+            "           \"support\"           (string) client side supported feature, 'longpoll', 'coinbasetxn', 'coinbasevalue', 'coinbaseparts', 'proposal', 'serverlist', 'workid'\n"
             "           ,...\n"
-            "         ]\n"
+            "         ],\n"
+            "       \"extranoncesize\":n    (numeric, optional, default=" + i64tostr(DEFAULT_COINBASE_EXTRANONCE_SIZE) + ") With 'coinbaseparts', bytes left for the extranonce in the coinbase\n"
             "     }\n"
             "\n"
 
@@ -433,6 +511,12 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 //            "  },\n"
 //            "  \"coinbasevalue\" : n,               (numeric) maximum allowable input to coinbase transaction, including the generation award and transaction fees (in Satoshis)\n"
             "  \"coinbasetxn\" : { ... },           (json object) information for coinbase transaction\n"
+            "  \"coinbaseparts\" : {                (json object) with the 'coinbaseparts' capability, the coinbase with an extranonce pushed after the height\n"
+            "      \"coinb1\" : \"xxxx\",            (string) serialized coinbase before the extranonce, in hexadecimal\n"
+            "      \"coinb2\" : \"xxxx\",            (string) serialized coinbase after the extranonce, in hexadecimal\n"
+            "      \"extranoncesize\" : n          (numeric) size in bytes of the extranonce to insert between coinb1 and coinb2\n"
+            "  },\n"
+            "  \"merklebranch\" : [ \"xxxx\", ... ],  (array of string) with the 'coinbaseparts' capability, the merkle branch of the coinbase, hashes in internal byte order\n"
             "  \"target\" : \"xxxx\",               (string) The hash target\n"
             "  \"mintime\" : xxx,                   (numeric) The minimum timestamp appropriate for next block time in seconds since epoch (Jan 1 1970 GMT)\n"
             "  \"mutable\" : [                      (array of string) list of ways the block template may be changed \n"
@@ -469,9 +553,25 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     UniValue lpval = NullUniValue;
     // TODO: Re-enable coinbasevalue once a specification has been written
     bool coinbasetxn = true;
+    bool fCoinbaseParts = false;
+    int64_t nExtraNonceSize = DEFAULT_COINBASE_EXTRANONCE_SIZE;
     if (params.size() > 0)
     {
         const UniValue& oparam = params[0].get_obj();
+        const UniValue& capsval = find_value(oparam, "capabilities");
+        if (capsval.isArray()) {
+            for (size_t i = 0; i < capsval.size(); i++) {
+                if (capsval[i].isStr() && capsval[i].get_str() == "coinbaseparts")
+                    fCoinbaseParts = true;
+            }
+        }
+        const UniValue& extranonceval = find_value(oparam, "extranoncesize");
+        if (!extranonceval.isNull()) {
+            nExtraNonceSize = extranonceval.get_int64();
+            // Height and extranonce pushes must fit in the 100 bytes of a coinbase scriptSig
+            if (nExtraNonceSize < 1 || nExtraNonceSize > 64)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid extranoncesize, must be between 1 and 64");
+        }
         const UniValue& modeval = find_value(oparam, "mode");
         if (modeval.isStr())
             strMode = modeval.get_str();
@@ -525,58 +625,100 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Horizen is downloading blocks...");
 
     static unsigned int nTransactionsUpdatedLast;
+    static CAmount nTotalFeesAddedLast;
+    bool fFeesWake = false;
 
     if (!lpval.isNull())
     {
-        // Wait to respond until either the best block changes, OR a minute has passed and there are more transactions
+        // Wait to respond until either the best block changes, OR transactions paying at least
+        // -longpollfeedelta entered the mempool, OR a minute has passed and there are more transactions
         uint256 hashWatchedChain;
-        boost::system_time checktxtime;
         unsigned int nTransactionsUpdatedLastLP;
+        CAmount nTotalFeesAddedLastLP;
 
         if (lpval.isStr())
         {
-            // Format: <hashBestChain><nTransactionsUpdatedLast>
+            // Format: <hashBestChain><nTransactionsUpdatedLast>[:<nTotalFeesAddedLast>]
             std::string lpstr = lpval.get_str();
 
             hashWatchedChain.SetHex(lpstr.substr(0, 64));
             nTransactionsUpdatedLastLP = atoi64(lpstr.substr(64));
+            size_t nSep = lpstr.find(':', 64);
+            nTotalFeesAddedLastLP = nSep == std::string::npos ? mempool.GetTotalFeesAdded() : atoi64(lpstr.substr(nSep + 1));
         }
         else
         {
             // NOTE: Spec does not specify behaviour for non-string longpollid, but this makes testing easier
             hashWatchedChain = chainActive.Tip()->GetBlockHash();
             nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
+            nTotalFeesAddedLastLP = nTotalFeesAddedLast;
         }
 
+        CAmount nFeeDelta = 0;
+        if (mapArgs.count("-longpollfeedelta"))
+            ParseMoney(mapArgs["-longpollfeedelta"], nFeeDelta);
+
+        // The minute counts from the call made first, if it was parked since
+        const int64_t nCheckTxTime = RPCCallStartTime() + 60 * 1000;
+        auto fnFeesWake = [=]() {
+            return nFeeDelta > 0 && mempool.GetTotalFeesAdded() - nTotalFeesAddedLastLP >= nFeeDelta;
+        };
+        boost::optional<RPCParkedCall> park;
+
         // Release the wallet and main lock while waiting
         LEAVE_CRITICAL_SECTION(cs_main);
         {
-            checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
-
+            // Both new tips and accepted transactions notify cvBlockChange under csBestBlock
             boost::unique_lock<boost::mutex> lock(csBestBlock);
             while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
             {
-                if (!cvBlockChange.timed_wait(lock, checktxtime))
+                if (fnFeesWake())
+                {
+                    fFeesWake = true;
+                    break;
+                }
+                bool fTimedOut = GetTimeMillis() >= nCheckTxTime;
+                // Timeout: Check transactions for update
+                if (fTimedOut && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
+                    break;
+                // Removals from the mempool are not notified, they are looked for every 10 seconds
+                const int64_t nWakeTime = fTimedOut ? GetTimeMillis() + 10 * 1000 : nCheckTxTime;
+                if (RPCCanPark())
                 {
-                    // Timeout: Check transactions for update
-                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
-                        break;
-                    checktxtime += boost::posix_time::seconds(10);
+                    // Wait without holding a thread, to be called again on the same conditions
+                    park = RPCParkedCall();
+                    park->fnReady = [=]() {
+                        return chainActive.Tip()->GetBlockHash() != hashWatchedChain || fnFeesWake() ||
+                            (GetTimeMillis() >= nCheckTxTime && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP);
+                    };
+                    park->nWakeTime = nWakeTime;
+                    break;
                 }
+                cvBlockChange.timed_wait(lock, boost::posix_time::milliseconds(nWakeTime - GetTimeMillis()));
             }
         }
         ENTER_CRITICAL_SECTION(cs_main);
 
+        if (park)
+            throw *park;
+
         if (!IsRPCRunning())
             throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
+    // Long polling is not counted in getBlockTemplateLatency
+    int64_t nTimeStart = GetTimeMicros();
+
     // Update block
     static CBlockIndex* pindexPrev;
     static int64_t nStart;
     static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
+    // The transactions only change with the template, they are only serialized once for it
+    static UniValue txCoinbase;
+    static UniValue transactions;
+    static std::vector<uint256> vMerkleBranch;
+    if (pindexPrev != chainActive.Tip() || fFeesWake ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
@@ -584,6 +726,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
         // Store the pindexBest used before CreateNewBlockWithKey, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        nTotalFeesAddedLast = mempool.GetTotalFeesAdded();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
         nStart = GetTime();
 
@@ -602,62 +745,65 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
-        // Need to update only after we know CreateNewBlockWithKey succeeded
-        pindexPrev = pindexPrevNew;
-    }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
-
-    // Update nTime
-    UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
-    pblock->nNonce = uint256();
+        CBlock* pblock = &pblocktemplate->block;
+        txCoinbase = NullUniValue;
+        transactions = UniValue(UniValue::VARR);
+        map<uint256, int64_t> setTxIndex;
+        int i = 0;
+        BOOST_FOREACH(const CTransactionRef& ptx, pblock->vtx) {
+            const CTransaction& tx = *ptx;
+            uint256 txHash = tx.GetHash();
+            setTxIndex[txHash] = i++;
 
-    UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal");
+            if (tx.IsCoinBase() && !coinbasetxn)
+                continue;
 
-    UniValue txCoinbase = NullUniValue;
-    UniValue transactions(UniValue::VARR);
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
+            UniValue entry(UniValue::VOBJ);
 
-        if (tx.IsCoinBase() && !coinbasetxn)
-            continue;
+            entry.pushKV("data", EncodeHexTx(tx));
 
-        UniValue entry(UniValue::VOBJ);
+            entry.pushKV("hash", txHash.GetHex());
 
-        entry.pushKV("data", EncodeHexTx(tx));
-
-        entry.pushKV("hash", txHash.GetHex());
-
-        UniValue deps(UniValue::VARR);
-        BOOST_FOREACH (const CTxIn &in, tx.vin)
-        {
-            if (setTxIndex.count(in.prevout.hash))
-                deps.push_back(setTxIndex[in.prevout.hash]);
-        }
-        entry.pushKV("depends", deps);
-
-        int index_in_template = i - 1;
-        entry.pushKV("fee", pblocktemplate->vTxFees[index_in_template]);
-        entry.pushKV("sigops", pblocktemplate->vTxSigOps[index_in_template]);
-
-        if (tx.IsCoinBase()) {
-            // Show community reward if it is required
-            if (pblock->vtx[0].vout.size() > 1) {
-                // Correct this if GetBlockTemplate changes the order
-                entry.pushKV("communityfund", (int64_t)tx.vout[1].nValue);
-                if (pblock->vtx[0].vout.size() > 3) {
-                    entry.pushKV("securenodes", (int64_t)tx.vout[2].nValue);
-                    entry.pushKV("supernodes", (int64_t)tx.vout[3].nValue);
+            UniValue deps(UniValue::VARR);
+            BOOST_FOREACH (const CTxIn &in, tx.vin)
+            {
+                if (setTxIndex.count(in.prevout.hash))
+                    deps.push_back(setTxIndex[in.prevout.hash]);
+            }
+            entry.pushKV("depends", deps);
+
+            int index_in_template = i - 1;
+            entry.pushKV("fee", pblocktemplate->vTxFees[index_in_template]);
+            entry.pushKV("sigops", pblocktemplate->vTxSigOps[index_in_template]);
+
+            if (tx.IsCoinBase()) {
+                // Show community reward if it is required
+                if (pblock->vtx[0]->vout.size() > 1) {
+                    // Correct this if GetBlockTemplate changes the order
+                    entry.pushKV("communityfund", (int64_t)tx.vout[1].nValue);
+                    if (pblock->vtx[0]->vout.size() > 3) {
+                        entry.pushKV("securenodes", (int64_t)tx.vout[2].nValue);
+                        entry.pushKV("supernodes", (int64_t)tx.vout[3].nValue);
+                    }
                 }
+                entry.pushKV("required", true);
+                txCoinbase = entry;
+            } else {
+                transactions.push_back(entry);
             }
-            entry.pushKV("required", true);
-            txCoinbase = entry;
-        } else {
-            transactions.push_back(entry);
         }
+        vMerkleBranch = pblock->GetMerkleBranch(0);
+
+        // Need to update only after we know CreateNewBlockWithKey succeeded
+        pindexPrev = pindexPrevNew;
     }
+    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Update nTime
+    UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
+    pblock->nNonce = uint256();
+
+    UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal"); aCaps.push_back("coinbaseparts");
 
     UniValue aux(UniValue::VOBJ);
     aux.pushKV("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end()));
@@ -682,9 +828,16 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         result.pushKV("coinbasetxn", txCoinbase);
     } else {
         result.pushKV("coinbaseaux", aux);
-        result.pushKV("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue);
+        result.pushKV("coinbasevalue", (int64_t)pblock->vtx[0]->vout[0].nValue);
+    }
+    if (fCoinbaseParts) {
+        result.pushKV("coinbaseparts", CoinbaseParts(*pblock->vtx[0], pindexPrev->nHeight+1, nExtraNonceSize));
+        UniValue branch(UniValue::VARR);
+        BOOST_FOREACH(const uint256& hash, vMerkleBranch)
+            branch.push_back(HexStr(hash.begin(), hash.end()));
+        result.pushKV("merklebranch", branch);
     }
-    result.pushKV("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast));
+    result.pushKV("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast) + ":" + i64tostr(nTotalFeesAddedLast));
     result.pushKV("target", hashTarget.GetHex());
     result.pushKV("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1);
     result.pushKV("mutable", aMutable);
@@ -695,6 +848,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.pushKV("bits", strprintf("%08x", pblock->nBits));
     result.pushKV("height", (int64_t)(pindexPrev->nHeight+1));
 
+    getBlockTemplateLatency.add(GetTimeMicros() - nTimeStart);
     return result;
 }
 
@@ -3,21 +3,32 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "base58.h"
 #include "clientversion.h"
+#include "httpserver.h"
 #include "init.h"
+#include "joinsplitprover.h"
 #include "main.h"
+#include "metrics.h"
 #include "net.h"
 #include "netbase.h"
+#include "notescan.h"
 #include "rpc/server.h"
+#include "scheduler.h"
+#include "script/sigcache.h"
+#include "sync.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 #endif
 
+#include <algorithm>
 #include <stdint.h>
 
+#include <set>
+
 #include <boost/assign/list_of.hpp>
 
 #include <univalue.h>
@@ -434,6 +445,402 @@ UniValue verifymessage(const UniValue& params, bool fHelp)
     return (pubkey.GetID() == keyID);
 }
 
+UniValue z_provejoinsplit(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "z_provejoinsplit \"witness\"\n"
+            "\nCompute the proof of a JoinSplit witness package, for a node started with -prover set to this one.\n"
+            "The package holds the spending keys of the notes it spends.\n"
+            "\nArguments:\n"
+            "1. \"witness\"    (string, required) The serialized witness package, hex-encoded.\n"
+            "\nResult:\n"
+            "\"proof\"         (string) The serialized proof, hex-encoded.\n"
+        );
+
+    string strWitness = params[0].get_str();
+    if (!IsHex(strWitness))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Witness package must be hexadecimal");
+
+    ZCJSProofWitness witness;
+    try {
+        CDataStream ss(ParseHex(strWitness), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> witness;
+        if (!ss.empty())
+            throw std::ios_base::failure("extra data after the witness package");
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Witness package decode failed");
+    }
+
+    libzcash::SproutProof proof;
+    try {
+        proof = ProveJoinSplitLocally(witness);
+    } catch (const std::exception& e) {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ::SerReadWriteSproutProof(ss, proof, witness.makeGrothProof, CSerActionSerialize(), SER_NETWORK, PROTOCOL_VERSION);
+    return HexStr(ss.begin(), ss.end());
+}
+
+UniValue getsnarkmetrics(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsnarkmetrics\n"
+            "\nReturns the time spent in the phases of the JoinSplit proofs and verifications since this node was started,\n"
+            "in microseconds.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"prove\": {                (json object) The whole proofs\n"
+            "    \"count\": n,               (numeric) The number of times the phase ran\n"
+            "    \"mean\": n,                (numeric) The mean time\n"
+            "    \"p50\": n,                 (numeric) The median time, estimated to within a factor of two\n"
+            "    \"p90\": n,                 (numeric) The 90th percentile, estimated likewise\n"
+            "    \"p99\": n,                 (numeric) The 99th percentile, estimated likewise\n"
+            "    \"max\": n                  (numeric) The longest time\n"
+            "  },\n"
+            "  \"witnessmap\": {...},      (json object) The evaluations of the QAP polynomials of the proofs, as above\n"
+            "  \"fft\": {...},             (json object) The FFTs of the evaluations, as above\n"
+            "  \"multiexpa\": {...},       (json object) The multi-exponentiations of the A queries of the proofs, as above\n"
+            "  \"multiexpb\": {...},       (json object) Those of the B queries, as above\n"
+            "  \"multiexpc\": {...},       (json object) Those of the C queries, as above\n"
+            "  \"multiexph\": {...},       (json object) Those of the H queries, as above\n"
+            "  \"multiexpk\": {...},       (json object) Those of the K queries, as above\n"
+            "  \"millerloop\": {...},      (json object) The Miller loops of the pairings, as above\n"
+            "  \"finalexponentiation\": {...} (json object) The final exponentiations of the pairings, as above\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsnarkmetrics", "")
+            + HelpExampleRpc("getsnarkmetrics", "")
+        );
+
+    UniValue obj(UniValue::VOBJ);
+    for (int i = 0; i < SNARK_PHASES; i++)
+        obj.pushKV(SnarkPhaseName(SnarkPhase(i)), LatencyToJSON(snarkPhaseLatency[i]));
+    return obj;
+}
+
+UniValue getrpcqueueinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcqueueinfo\n"
+            "\nReturns the queues of the RPC calls, the methods of which -rpcqueue assigns to them, and the time the calls\n"
+            "waited in them for a thread since this node was started, in microseconds.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"name\",           (string) The name of the queue\n"
+            "    \"priority\": n,              (numeric) The queues of higher priority get the free threads first\n"
+            "    \"threads\": n,               (numeric) The most threads the calls of the queue occupy at once\n"
+            "    \"depth\": n,                 (numeric) The calls waiting for a thread\n"
+            "    \"running\": n,               (numeric) The calls being handled\n"
+            "    \"rejected\": n,              (numeric) The calls refused as -rpcworkqueue of them were waiting\n"
+            "    \"wait\": {                   (json object) The time the calls waited\n"
+            "      \"count\": n,               (numeric) The number of calls\n"
+            "      \"mean\": n,                (numeric) The mean time\n"
+            "      \"p50\": n,                 (numeric) The median time, estimated to within a factor of two\n"
+            "      \"p90\": n,                 (numeric) The 90th percentile, estimated likewise\n"
+            "      \"p99\": n,                 (numeric) The 99th percentile, estimated likewise\n"
+            "      \"max\": n                  (numeric) The longest time\n"
+            "    }\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcqueueinfo", "")
+            + HelpExampleRpc("getrpcqueueinfo", "")
+        );
+
+    UniValue arr(UniValue::VARR);
+    for (const HTTPWorkQueueInfo& info : GetHTTPWorkQueueInfo()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("name", info.name);
+        obj.pushKV("priority", info.nPriority);
+        obj.pushKV("threads", info.nThreads);
+        obj.pushKV("depth", (uint64_t)info.nDepth);
+        obj.pushKV("running", info.nRunning);
+        obj.pushKV("rejected", info.nRejected);
+        obj.pushKV("wait", LatencyToJSON(*info.waitLatency));
+        arr.push_back(obj);
+    }
+    return arr;
+}
+
+UniValue getvalidationqueueinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getvalidationqueueinfo\n"
+            "\nReturns the queue of the notifications to the ZeroMQ and AMQP publishers, which a thread of their own sends\n"
+            "after validation queues them, and the times since this node was started, in microseconds.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"depth\": n,                 (numeric) The notifications waiting to be sent\n"
+            "  \"maxdepth\": n,              (numeric) The notifications queued before validation waits for room, -validationqueue\n"
+            "  \"queued\": n,                (numeric) The notifications queued\n"
+            "  \"stalls\": n,                (numeric) The times validation waited for room\n"
+            "  \"stall\": {                  (json object) The time validation waited\n"
+            "    \"count\": n,               (numeric) The number of waits\n"
+            "    \"mean\": n,                (numeric) The mean time\n"
+            "    \"p50\": n,                 (numeric) The median time, estimated to within a factor of two\n"
+            "    \"p90\": n,                 (numeric) The 90th percentile, estimated likewise\n"
+            "    \"p99\": n,                 (numeric) The 99th percentile, estimated likewise\n"
+            "    \"max\": n                  (numeric) The longest time\n"
+            "  },\n"
+            "  \"delay\": {...}              (json object) The time from queueing the notifications to sending them, as above\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getvalidationqueueinfo", "")
+            + HelpExampleRpc("getvalidationqueueinfo", "")
+        );
+
+    const ValidationQueueInfo info = GetValidationQueueInfo();
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("depth", (uint64_t)info.nDepth);
+    obj.pushKV("maxdepth", (uint64_t)info.nMaxDepth);
+    obj.pushKV("queued", info.nQueued);
+    obj.pushKV("stalls", info.nStalls);
+    obj.pushKV("stall", LatencyToJSON(*info.stallLatency));
+    obj.pushKV("delay", LatencyToJSON(*info.delayLatency));
+    return obj;
+}
+
+UniValue getschedulerinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getschedulerinfo\n"
+            "\nReturns the periodic tasks of this node, such as the mempool expiry sweep and the peer address dumps, run on a\n"
+            "pool of -schedulerthreads threads for each priority, and their runs since this node was started, in microseconds.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queued\": n,                (numeric) The tasks waiting for their time\n"
+            "  \"tasks\": [                  (array) The tasks run, by name\n"
+            "    {\n"
+            "      \"name\": \"xxxx\",          (string) The name of the task\n"
+            "      \"priority\": \"xxxx\",      (string) The pool the task runs on, \"high\" or \"low\"\n"
+            "      \"runs\": n,              (numeric) The times the task was run\n"
+            "      \"totaltime\": n,         (numeric) The time it ran for\n"
+            "      \"maxtime\": n,           (numeric) The longest run\n"
+            "      \"maxdelay\": n           (numeric) The longest time a run started after it was due\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getschedulerinfo", "")
+            + HelpExampleRpc("getschedulerinfo", "")
+        );
+
+    CScheduler* pscheduler = pschedulerMain;
+    if (!pscheduler)
+        throw JSONRPCError(RPC_IN_WARMUP, "The scheduler is not running");
+
+    boost::chrono::system_clock::time_point first, last;
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("queued", (uint64_t)pscheduler->getQueueInfo(first, last));
+    UniValue tasks(UniValue::VARR);
+    BOOST_FOREACH(const SchedulerTaskInfo& info, pscheduler->getTaskInfo()) {
+        UniValue task(UniValue::VOBJ);
+        task.pushKV("name", info.name);
+        task.pushKV("priority", SchedulerPriorityName(info.priority));
+        task.pushKV("runs", info.nRuns);
+        task.pushKV("totaltime", info.nTotalTime);
+        task.pushKV("maxtime", info.nMaxTime);
+        task.pushKV("maxdelay", info.nMaxDelay);
+        tasks.push_back(task);
+    }
+    obj.pushKV("tasks", tasks);
+    return obj;
+}
+
+static UniValue LockTimesToJSON(const LockProfileTimes& times)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("count", times.count);
+    obj.pushKV("total", times.total);
+    obj.pushKV("mean",  times.mean());
+    obj.pushKV("p50",   times.percentile(0.5));
+    obj.pushKV("p90",   times.percentile(0.9));
+    obj.pushKV("p99",   times.percentile(0.99));
+    obj.pushKV("max",   times.max);
+    return obj;
+}
+
+static bool LockWaitGreater(const LockSiteProfile& a, const LockSiteProfile& b)
+{
+    return a.wait.total > b.wait.total;
+}
+
+UniValue getlockprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockprofile ( count )\n"
+            "\nReturns the LOCK sites of the source, the time they waited for their mutex and held it, in microseconds, and\n"
+            "the acquisitions which found it held by another thread, since they were first profiled or the profile was reset.\n"
+            "The sites count them while the profile is on, with -lockprofile or setlockprofile. A site which locks a mutex\n"
+            "the thread holds already counts the time it is held again.\n"
+            "\nArguments:\n"
+            "1. count          (numeric, optional, default=20) The sites which waited longest to return, 0 for all of them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,      (boolean) Whether the profile is on\n"
+            "  \"sites\": [                  (array) The sites, those which waited longest first\n"
+            "    {\n"
+            "      \"name\": \"xxxx\",          (string) The mutex locked, as written at the site, such as cs_main\n"
+            "      \"site\": \"file:line\",     (string) The source line of the site\n"
+            "      \"contended\": n,         (numeric) The acquisitions which waited for another thread, or failed for TRY_LOCK\n"
+            "      \"wait\": {               (json object) The time the acquisitions waited\n"
+            "        \"count\": n,           (numeric) The acquisitions\n"
+            "        \"total\": n,           (numeric) The sum of the times\n"
+            "        \"mean\": n,            (numeric) The mean time\n"
+            "        \"p50\": n,             (numeric) The median time, estimated to within a factor of two\n"
+            "        \"p90\": n,             (numeric) The 90th percentile, estimated likewise\n"
+            "        \"p99\": n,             (numeric) The 99th percentile, estimated likewise\n"
+            "        \"max\": n              (numeric) The longest time\n"
+            "      },\n"
+            "      \"hold\": {...}           (json object) The time the mutex was held, as above\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockprofile", "")
+            + HelpExampleCli("getlockprofile", "0")
+            + HelpExampleRpc("getlockprofile", "10")
+        );
+
+    int nCount = 20;
+    if (params.size() > 0)
+        nCount = params[0].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count, must be 0 or more");
+
+    std::vector<LockSiteProfile> vProfile = GetLockProfile();
+    std::sort(vProfile.begin(), vProfile.end(), LockWaitGreater);
+    if (nCount > 0 && vProfile.size() > (size_t)nCount)
+        vProfile.resize(nCount);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("enabled", fLockProfile.load());
+    UniValue sites(UniValue::VARR);
+    BOOST_FOREACH(const LockSiteProfile& profile, vProfile) {
+        UniValue site(UniValue::VOBJ);
+        site.pushKV("name", profile.name);
+        site.pushKV("site", strprintf("%s:%d", profile.file, profile.line));
+        site.pushKV("contended", profile.nContended);
+        site.pushKV("wait", LockTimesToJSON(profile.wait));
+        site.pushKV("hold", LockTimesToJSON(profile.hold));
+        sites.push_back(site);
+    }
+    obj.pushKV("sites", sites);
+    return obj;
+}
+
+UniValue setlockprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "setlockprofile enable ( reset )\n"
+            "\nTurns on or off the profile of the LOCK sites returned by getlockprofile. The profile costs two clock\n"
+            "readings for each lock taken while it is on.\n"
+            "\nArguments:\n"
+            "1. enable         (boolean, required) Whether the sites count their acquisitions\n"
+            "2. reset          (boolean, optional, default=false) Clear the times counted so far\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setlockprofile", "true true")
+            + HelpExampleRpc("setlockprofile", "false")
+        );
+
+    if (params.size() > 1 && params[1].get_bool())
+        ResetLockProfile();
+    fLockProfile = params[0].get_bool();
+    return NullUniValue;
+}
+
+UniValue getmemoryinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmemoryinfo\n"
+            "\nReturns the memory the largest structures of this node take, in bytes, estimated from their sizes as the\n"
+            "mempool limit is. The call walks the block index, the wallet and the messages of the peers, so it is not meant\n"
+            "to be polled often on a node with a large wallet.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blockindex\": n,            (numeric) The block index, mapBlockIndex, with the Equihash solutions\n"
+            "  \"coinstip\": n,              (numeric) The cache of the coins database, pcoinsTip\n"
+            "  \"coinstiplimit\": n,         (numeric) The size the coins cache is flushed at, from -dbcache\n"
+            "  \"mempool\": n,               (numeric) The mempool, its transactions and indexes\n"
+            "  \"mempoollimit\": n,          (numeric) The size the mempool is trimmed to, -maxmempool\n"
+            "  \"orphans\": n,               (numeric) The orphan transactions\n"
+            "  \"sigcache\": n,              (numeric) The signature cache, allocated at once from -maxsigcachesize\n"
+            "  \"peers\": {\n"
+            "    \"count\": n,               (numeric) The peers connected\n"
+            "    \"send\": n,                (numeric) The messages queued to send, each counted once however many peers get it\n"
+            "    \"recv\": n,                (numeric) The messages received and not processed yet\n"
+            "    \"recvpool\": n,            (numeric) The free receive buffers kept for the next messages\n"
+            "    \"relay\": n                (numeric) The transactions kept to answer getdata\n"
+            "  },\n"
+            "  \"wallet\": {                 (json object) If the wallet is enabled\n"
+            "    \"transactions\": n,        (numeric) The wallet transactions, mapWallet, witnesses included\n"
+            "    \"witnesses\": n            (numeric) The witness caches of the notes\n"
+            "  },\n"
+            "  \"total\": n                  (numeric) The sum of the structures above, the limits aside\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmemoryinfo", "")
+            + HelpExampleRpc("getmemoryinfo", "")
+        );
+
+    UniValue obj(UniValue::VOBJ);
+    size_t nTotal = 0;
+    {
+        LOCK(cs_main);
+        const size_t nBlockIndex = BlockIndexDynamicUsage();
+        const size_t nCoinsTip = pcoinsTip->DynamicMemoryUsage();
+        const size_t nMempool = mempool.DynamicMemoryUsage();
+        const size_t nOrphans = OrphanTxDynamicUsage();
+        obj.pushKV("blockindex", (uint64_t)nBlockIndex);
+        obj.pushKV("coinstip", (uint64_t)nCoinsTip);
+        obj.pushKV("coinstiplimit", (uint64_t)nCoinCacheUsage);
+        obj.pushKV("mempool", (uint64_t)nMempool);
+        obj.pushKV("mempoollimit", GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        obj.pushKV("orphans", (uint64_t)nOrphans);
+        nTotal += nBlockIndex + nCoinsTip + nMempool + nOrphans;
+    }
+    const size_t nSigCache = SignatureCacheDynamicUsage();
+    obj.pushKV("sigcache", (uint64_t)nSigCache);
+    nTotal += nSigCache;
+
+    const NodeBufferUsage usage = GetNodeBufferUsage();
+    UniValue peers(UniValue::VOBJ);
+    peers.pushKV("count", (uint64_t)usage.nPeers);
+    peers.pushKV("send", (uint64_t)usage.nSendUsage);
+    peers.pushKV("recv", (uint64_t)usage.nRecvUsage);
+    peers.pushKV("recvpool", (uint64_t)usage.nRecvPoolUsage);
+    peers.pushKV("relay", (uint64_t)usage.nRelayUsage);
+    obj.pushKV("peers", peers);
+    nTotal += usage.nSendUsage + usage.nRecvUsage + usage.nRecvPoolUsage + usage.nRelayUsage;
+
+#ifdef ENABLE_WALLET
+    if (pwalletMain) {
+        size_t nWitnessUsage;
+        const size_t nWalletUsage = pwalletMain->DynamicMemoryUsage(nWitnessUsage);
+        UniValue wallet(UniValue::VOBJ);
+        wallet.pushKV("transactions", (uint64_t)nWalletUsage);
+        wallet.pushKV("witnesses", (uint64_t)nWitnessUsage);
+        obj.pushKV("wallet", wallet);
+        nTotal += nWalletUsage;
+    }
+#endif
+
+    obj.pushKV("total", (uint64_t)nTotal);
+    return obj;
+}
+
 UniValue setmocktime(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -464,3 +871,472 @@ UniValue setmocktime(const UniValue& params, bool fHelp)
 
     return NullUniValue;
 }
+
+namespace {
+
+void CheckAddressIndex()
+{
+    if (paddressindex == NULL)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, start with -addressindex");
+}
+
+/** The addresses of a request: one address, or an object with an array of them in "addresses" */
+std::vector<std::pair<int, uint160> > ParseIndexAddresses(const UniValue& param)
+{
+    std::vector<UniValue> vValues;
+    if (param.isStr()) {
+        vValues.push_back(param);
+    } else if (param.isObject()) {
+        const UniValue& addresses = find_value(param.get_obj(), "addresses");
+        if (!addresses.isArray())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Addresses is expected to be an array");
+        vValues = addresses.getValues();
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an address or an object with addresses");
+    }
+
+    std::vector<std::pair<int, uint160> > vAddresses;
+    BOOST_FOREACH(const UniValue& value, vValues) {
+        CBitcoinAddress address(value.get_str());
+        CKeyID keyID;
+        if (!address.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + value.get_str());
+        if (address.GetKeyID(keyID))
+            vAddresses.push_back(std::make_pair((int)ADDRESS_TYPE_PUBKEYHASH, uint160(keyID)));
+        else
+            vAddresses.push_back(std::make_pair((int)ADDRESS_TYPE_SCRIPTHASH, uint160(boost::get<CScriptID>(address.Get()))));
+    }
+    return vAddresses;
+}
+
+std::string IndexAddressToString(int type, const uint160& hashBytes)
+{
+    if (type == ADDRESS_TYPE_SCRIPTHASH)
+        return CBitcoinAddress(CScriptID(hashBytes)).ToString();
+    return CBitcoinAddress(CKeyID(hashBytes)).ToString();
+}
+
+/** The entries of the addresses of a request, in the blocks from "start" to "end" if the object has them */
+std::vector<std::pair<CAddressIndexKey, CAmount> > ReadIndexEntries(const UniValue& param)
+{
+    int nStart = 0, nEnd = 0;
+    if (param.isObject()) {
+        const UniValue& start = find_value(param.get_obj(), "start");
+        const UniValue& end = find_value(param.get_obj(), "end");
+        if (start.isNum() && end.isNum()) {
+            nStart = start.get_int();
+            nEnd = end.get_int();
+            if (nStart <= 0 || nEnd < nStart)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Start and end are expected to be heights, start not above end");
+        }
+    }
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vEntries;
+    typedef std::pair<int, uint160> AddressPair;
+    BOOST_FOREACH(const AddressPair& address, ParseIndexAddresses(param)) {
+        if (!paddressindex->ReadAddressIndex(address.first, address.second, vEntries, nStart, nEnd))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+    }
+    return vEntries;
+}
+
+} // anon namespace
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance {\"addresses\": [\"address\", ...]}\n"
+            "\nReturns the balance of addresses, as of the last block of the address index (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"\n"
+            "    [\n"
+            "      \"address\"  (string) The transparent address\n"
+            "      ,...\n"
+            "    ]\n"
+            "}\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\"  (numeric) The current balance in zatoshis\n"
+            "  \"received\"  (numeric) The total amount received in zatoshis, including change\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"znXWB3XGptd5T3bbVWFXDm5BSEvFT2xW7Ld\"]}'")
+            + HelpExampleRpc("getaddressbalance", "{\"addresses\": [\"znXWB3XGptd5T3bbVWFXDm5BSEvFT2xW7Ld\"]}")
+        );
+
+    CheckAddressIndex();
+    CAmount nBalance = 0, nReceived = 0;
+    typedef std::pair<CAddressIndexKey, CAmount> EntryPair;
+    BOOST_FOREACH(const EntryPair& entry, ReadIndexEntries(params[0])) {
+        nBalance += entry.second;
+        if (entry.second > 0)
+            nReceived += entry.second;
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("balance", nBalance);
+    result.pushKV("received", nReceived);
+    return result;
+}
+
+UniValue getaddresstxids(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids {\"addresses\": [\"address\", ...], \"start\": n, \"end\": n}\n"
+            "\nReturns the txids of the transactions paying to or spending from addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"\n"
+            "    [\n"
+            "      \"address\"  (string) The transparent address\n"
+            "      ,...\n"
+            "    ]\n"
+            "  \"start\" (numeric, optional) The height of the first block\n"
+            "  \"end\" (numeric, optional) The height of the last block\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"transactionid\"  (string) The transaction id, in the order of the chain\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"znXWB3XGptd5T3bbVWFXDm5BSEvFT2xW7Ld\"]}'")
+            + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"znXWB3XGptd5T3bbVWFXDm5BSEvFT2xW7Ld\"]}")
+        );
+
+    CheckAddressIndex();
+    // Ordered by height and position in the block, which the entries of several addresses are not
+    std::set<std::pair<std::pair<int, unsigned int>, uint256> > setTxids;
+    typedef std::pair<CAddressIndexKey, CAmount> EntryPair;
+    BOOST_FOREACH(const EntryPair& entry, ReadIndexEntries(params[0]))
+        setTxids.insert(std::make_pair(std::make_pair(entry.first.nHeight, entry.first.nTxIndex), entry.first.txhash));
+
+    UniValue result(UniValue::VARR);
+    typedef std::pair<std::pair<int, unsigned int>, uint256> TxidPair;
+    BOOST_FOREACH(const TxidPair& txid, setTxids)
+        result.push_back(txid.second.GetHex());
+    return result;
+}
+
+UniValue getaddressdeltas(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressdeltas {\"addresses\": [\"address\", ...], \"start\": n, \"end\": n}\n"
+            "\nReturns the outputs paying to and the inputs spending from addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"\n"
+            "    [\n"
+            "      \"address\"  (string) The transparent address\n"
+            "      ,...\n"
+            "    ]\n"
+            "  \"start\" (numeric, optional) The height of the first block\n"
+            "  \"end\" (numeric, optional) The height of the last block\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"satoshis\"  (numeric) The amount in zatoshis, negative for inputs\n"
+            "    \"txid\"  (string) The transaction id\n"
+            "    \"index\"  (numeric) The index of the output or input\n"
+            "    \"blockindex\"  (numeric) The position of the transaction in the block\n"
+            "    \"height\"  (numeric) The height of the block\n"
+            "    \"address\"  (string) The address\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"znXWB3XGptd5T3bbVWFXDm5BSEvFT2xW7Ld\"]}'")
+            + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"znXWB3XGptd5T3bbVWFXDm5BSEvFT2xW7Ld\"]}")
+        );
+
+    CheckAddressIndex();
+    UniValue result(UniValue::VARR);
+    typedef std::pair<CAddressIndexKey, CAmount> EntryPair;
+    BOOST_FOREACH(const EntryPair& entry, ReadIndexEntries(params[0])) {
+        UniValue delta(UniValue::VOBJ);
+        delta.pushKV("satoshis", entry.second);
+        delta.pushKV("txid", entry.first.txhash.GetHex());
+        delta.pushKV("index", (int)entry.first.nIndex);
+        delta.pushKV("blockindex", (int)entry.first.nTxIndex);
+        delta.pushKV("height", entry.first.nHeight);
+        delta.pushKV("address", IndexAddressToString(entry.first.type, entry.first.hashBytes));
+        result.push_back(delta);
+    }
+    return result;
+}
+
+UniValue getaddressutxos(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos {\"addresses\": [\"address\", ...]}\n"
+            "\nReturns the unspent outputs of addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"\n"
+            "    [\n"
+            "      \"address\"  (string) The transparent address\n"
+            "      ,...\n"
+            "    ]\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"  (string) The address\n"
+            "    \"txid\"  (string) The transaction id\n"
+            "    \"outputIndex\"  (numeric) The index of the output\n"
+            "    \"script\"  (string) The script, hex-encoded\n"
+            "    \"satoshis\"  (numeric) The amount of the output in zatoshis\n"
+            "    \"height\"  (numeric) The height of the block of the output\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"znXWB3XGptd5T3bbVWFXDm5BSEvFT2xW7Ld\"]}'")
+            + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"znXWB3XGptd5T3bbVWFXDm5BSEvFT2xW7Ld\"]}")
+        );
+
+    CheckAddressIndex();
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    typedef std::pair<int, uint160> AddressPair;
+    BOOST_FOREACH(const AddressPair& address, ParseIndexAddresses(params[0])) {
+        if (!paddressindex->ReadAddressUnspentIndex(address.first, address.second, vUnspent))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+    }
+
+    UniValue result(UniValue::VARR);
+    typedef std::pair<CAddressUnspentKey, CAddressUnspentValue> UnspentPair;
+    BOOST_FOREACH(const UnspentPair& unspent, vUnspent) {
+        UniValue output(UniValue::VOBJ);
+        output.pushKV("address", IndexAddressToString(unspent.first.type, unspent.first.hashBytes));
+        output.pushKV("txid", unspent.first.txhash.GetHex());
+        output.pushKV("outputIndex", (int)unspent.first.nIndex);
+        output.pushKV("script", HexStr(unspent.second.script.begin(), unspent.second.script.end()));
+        output.pushKV("satoshis", unspent.second.nValue);
+        output.pushKV("height", unspent.second.nHeight);
+        result.push_back(output);
+    }
+    return result;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !params[0].isObject())
+        throw runtime_error(
+            "getspentinfo {\"txid\": \"txid\", \"index\": n}\n"
+            "\nReturns the input spending an output (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"txid\" (string) The transaction id of the output\n"
+            "  \"index\" (numeric) The index of the output\n"
+            "}\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\"  (string) The transaction id of the input\n"
+            "  \"index\"  (numeric) The index of the input\n"
+            "  \"height\"  (numeric) The height of the block of the input\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'")
+            + HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}")
+        );
+
+    CheckAddressIndex();
+    const UniValue& txid = find_value(params[0].get_obj(), "txid");
+    const UniValue& index = find_value(params[0].get_obj(), "index");
+    if (!txid.isStr() || !index.isNum())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid txid or index");
+
+    CSpentIndexValue spent;
+    if (!paddressindex->ReadSpentIndex(CSpentIndexKey(ParseHashV(txid, "txid"), index.get_int()), spent))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("txid", spent.txid.GetHex());
+    result.pushKV("index", (int)spent.nInputIndex);
+    result.pushKV("height", spent.nHeight);
+    return result;
+}
+
+namespace {
+
+void CheckNoteScan()
+{
+    if (pnotescandb == NULL)
+        throw JSONRPCError(RPC_MISC_ERROR, "Note scan not enabled, start with -notescan");
+}
+
+libzcash::PaymentAddress ParseWatchedAddress(const UniValue& param)
+{
+    CZCPaymentAddress address(param.get_str());
+    try {
+        return address.Get();
+    } catch (const std::runtime_error&) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid zaddr");
+    }
+}
+
+} // anon namespace
+
+UniValue z_watchviewingkey(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "z_watchviewingkey \"vkey\" ( startheight )\n"
+            "\nScans the blocks for the notes paid to the address of a viewing key, without adding it to a wallet\n"
+            "(requires -notescan). The blocks from startheight are scanned in the background, then those connected.\n"
+            "\nArguments:\n"
+            "1. \"vkey\"             (string, required) The viewing key (see z_exportviewingkey)\n"
+            "2. startheight        (numeric, optional, default=the tip) The height of the first block scanned\n"
+            "\nResult:\n"
+            "\"zaddr\"               (string) The address watched\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_watchviewingkey", "\"vkey\" 200000")
+            + HelpExampleRpc("z_watchviewingkey", "\"vkey\", 200000")
+        );
+
+    CheckNoteScan();
+    CZCViewingKey viewingkey(params[0].get_str());
+    libzcash::ViewingKey vk;
+    try {
+        vk = viewingkey.Get();
+    } catch (const std::runtime_error&) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid viewing key");
+    }
+
+    int nStartHeight;
+    {
+        LOCK(cs_main);
+        nStartHeight = chainActive.Height();
+    }
+    if (params.size() > 1) {
+        nStartHeight = params[1].get_int();
+        if (nStartHeight < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Start height is expected to be a height");
+    }
+
+    if (!WatchViewingKey(vk, nStartHeight))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "The address of the viewing key is already watched");
+    return CZCPaymentAddress(vk.address()).ToString();
+}
+
+UniValue z_unwatchaddress(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "z_unwatchaddress \"zaddr\"\n"
+            "\nStops scanning the blocks for the notes of an address watched with z_watchviewingkey, and forgets\n"
+            "the notes found (requires -notescan).\n"
+            "\nArguments:\n"
+            "1. \"zaddr\"            (string, required) The address\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_unwatchaddress", "\"zaddr\"")
+            + HelpExampleRpc("z_unwatchaddress", "\"zaddr\"")
+        );
+
+    CheckNoteScan();
+    if (!UnwatchAddress(ParseWatchedAddress(params[0])))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "The address is not watched");
+    return NullUniValue;
+}
+
+UniValue z_listwatchedaddresses(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "z_listwatchedaddresses\n"
+            "\nReturns the addresses watched with z_watchviewingkey, and how far their blocks are scanned\n"
+            "(requires -notescan).\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\": \"zaddr\",  (string) The address\n"
+            "    \"startheight\": n,     (numeric) The height of the first block scanned for it\n"
+            "    \"height\": n           (numeric) The height of the last block scanned for it\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_listwatchedaddresses", "")
+            + HelpExampleRpc("z_listwatchedaddresses", "")
+        );
+
+    CheckNoteScan();
+    std::vector<CNoteScanKey> vKeys;
+    const int nHeight = GetWatchedKeys(vKeys);
+
+    UniValue result(UniValue::VARR);
+    BOOST_FOREACH(const CNoteScanKey& key, vKeys) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("address", CZCPaymentAddress(key.vk.address()).ToString());
+        obj.pushKV("startheight", key.nStartHeight);
+        obj.pushKV("height", key.IsCatchingUp() ? key.nNextHeight - 1 : nHeight);
+        result.push_back(obj);
+    }
+    return result;
+}
+
+UniValue z_listwatchednotes(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "z_listwatchednotes \"zaddr\" ( minheight )\n"
+            "\nReturns the notes paid to an address watched with z_watchviewingkey, in the order of the chain\n"
+            "(requires -notescan). Whether they are spent is not known.\n"
+            "\nArguments:\n"
+            "1. \"zaddr\"            (string, required) The address\n"
+            "2. minheight          (numeric, optional, default=0) The height of the first block listed\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\": \"hash\",      (string) The transaction id\n"
+            "    \"jsindex\": n,         (numeric) The index of the JoinSplit in the transaction\n"
+            "    \"jsoutindex\": n,      (numeric) The index of the output in the JoinSplit\n"
+            "    \"amount\": x.xxx,      (numeric) The value of the note in " + CURRENCY_UNIT + "\n"
+            "    \"height\": n,          (numeric) The height of the block\n"
+            "    \"confirmations\": n,   (numeric) The number of confirmations\n"
+            "    \"position\": n,        (numeric) The position of the note commitment in the tree\n"
+            "    \"memo\": \"hex\"         (string) The memo without its trailing zeros, empty if it has none\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_listwatchednotes", "\"zaddr\" 200000")
+            + HelpExampleRpc("z_listwatchednotes", "\"zaddr\", 200000")
+        );
+
+    CheckNoteScan();
+    const libzcash::PaymentAddress address = ParseWatchedAddress(params[0]);
+    int nMinHeight = 0;
+    if (params.size() > 1) {
+        nMinHeight = params[1].get_int();
+        if (nMinHeight < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Minimum height is expected to be a height");
+    }
+
+    std::vector<std::pair<CNoteScanEntryKey, CNoteScanEntry> > vNotes;
+    if (!pnotescandb->ReadNotes(address, vNotes, nMinHeight))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the note scan database");
+
+    LOCK(cs_main);
+    UniValue result(UniValue::VARR);
+    typedef std::pair<CNoteScanEntryKey, CNoteScanEntry> NotePair;
+    BOOST_FOREACH(const NotePair& note, vNotes) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("txid", note.first.txid.GetHex());
+        obj.pushKV("jsindex", (int)note.first.nJoinSplit);
+        obj.pushKV("jsoutindex", (int)note.first.nOutput);
+        obj.pushKV("amount", ValueFromAmount(note.second.nValue));
+        obj.pushKV("height", note.first.nHeight);
+        obj.pushKV("confirmations", std::max(0, chainActive.Height() - note.first.nHeight + 1));
+        obj.pushKV("position", (uint64_t)note.second.nPosition);
+        obj.pushKV("memo", HexStr(note.second.vchMemo));
+        result.push_back(obj);
+    }
+    return result;
+}
@@ -3,6 +3,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "base58.h"
 #include "consensus/validation.h"
 #include "core_io.h"
@@ -12,6 +13,8 @@
 #include "merkleblock.h"
 #include "net.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonwriter.h"
+#include "rpc/resultcache.h"
 #include "rpc/server.h"
 #include "script/script.h"
 #include "script/script_error.h"
@@ -125,6 +128,16 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
         else {
             in.pushKV("txid", txin.prevout.hash.GetHex());
             in.pushKV("vout", (int64_t)txin.prevout.n);
+            // What the output spent was, which the spent index has
+            CSpentIndexValue spent;
+            if (paddressindex != NULL && paddressindex->ReadSpentIndex(CSpentIndexKey(txin.prevout.hash, txin.prevout.n), spent)) {
+                in.pushKV("value", ValueFromAmount(spent.nValue));
+                in.pushKV("valueZat", spent.nValue);
+                if (spent.addressType == ADDRESS_TYPE_PUBKEYHASH)
+                    in.pushKV("address", CBitcoinAddress(CKeyID(spent.addressHash)).ToString());
+                else if (spent.addressType == ADDRESS_TYPE_SCRIPTHASH)
+                    in.pushKV("address", CBitcoinAddress(CScriptID(spent.addressHash)).ToString());
+            }
             UniValue o(UniValue::VOBJ);
             o.pushKV("asm", txin.scriptSig.ToString());
             o.pushKV("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
@@ -144,6 +157,12 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
         UniValue o(UniValue::VOBJ);
         ScriptPubKeyToJSON(txout.scriptPubKey, o, true);
         out.pushKV("scriptPubKey", o);
+        CSpentIndexValue spent;
+        if (paddressindex != NULL && paddressindex->ReadSpentIndex(CSpentIndexKey(tx.GetHash(), i), spent)) {
+            out.pushKV("spentTxId", spent.txid.GetHex());
+            out.pushKV("spentIndex", (int)spent.nInputIndex);
+            out.pushKV("spentHeight", spent.nHeight);
+        }
         vout.push_back(out);
     }
     entry.pushKV("vout", vout);
@@ -153,11 +172,11 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 
     if (!hashBlock.IsNull()) {
         entry.pushKV("blockhash", hashBlock.GetHex());
-        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-        if (mi != mapBlockIndex.end() && (*mi).second) {
-            CBlockIndex* pindex = (*mi).second;
-            if (chainActive.Contains(pindex)) {
-                entry.pushKV("confirmations", 1 + chainActive.Height() - pindex->nHeight);
+        const CBlockIndex* pindex = LookupBlockIndex(hashBlock);
+        if (pindex) {
+            CChainTipViewRef tip = GetChainTipView();
+            if (tip->Contains(pindex)) {
+                entry.pushKV("confirmations", 1 + tip->nHeight - pindex->nHeight);
                 entry.pushKV("time", pindex->GetBlockTime());
                 entry.pushKV("blocktime", pindex->GetBlockTime());
             }
@@ -218,6 +237,9 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             "           ,...\n"
             "         ]\n"
             "       }\n"
+            "       \"spentTxId\" : \"id\",       (string, with -addressindex) The transaction id of the input spending the output, if spent\n"
+            "       \"spentIndex\" : n,            (numeric, with -addressindex) The index of that input\n"
+            "       \"spentHeight\" : n            (numeric, with -addressindex) The height of its block\n"
             "     }\n"
             "     ,...\n"
             "  ],\n"
@@ -259,7 +281,6 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleCli("getrawtransaction", "\"mytxid\" 1")
             + HelpExampleRpc("getrawtransaction", "\"mytxid\", 1")
         );
-    LOCK(cs_main);
 
     uint256 hash = ParseHashV(params[0], "parameter 1");
 
@@ -267,19 +288,41 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
+    const std::string strCacheKey = strprintf("getrawtransaction/%d/%s", fVerbose, hash.GetHex());
+    {
+        UniValueWriter writer;
+        if (WriteCachedRPCResult(strCacheKey, writer))
+            return writer.get();
+    }
+
     CTransaction tx;
     uint256 hashBlock;
     if (!GetTransaction(hash, tx, hashBlock, true))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
 
+    // A transaction of the active chain is cached, verbose only without the spent index,
+    // which changes its outputs
+    const CBlockIndex* pindex = NULL;
+    if (nRPCResultCacheUsage > 0 && !hashBlock.IsNull() && (!fVerbose || paddressindex == NULL)) {
+        pindex = LookupBlockIndex(hashBlock);
+        if (pindex && !GetChainTipView()->Contains(pindex))
+            pindex = NULL;
+    }
+
     string strHex = EncodeHexTx(tx);
 
-    if (!fVerbose)
+    if (!fVerbose) {
+        if (pindex)
+            CacheRPCResult(strCacheKey, std::make_shared<const UniValue>(strHex), pindex, pindex);
         return strHex;
+    }
 
     UniValue result(UniValue::VOBJ);
     result.pushKV("hex", strHex);
     TxToJSON(tx, hashBlock, result);
+    const UniValue& confirmations = find_value(result, "confirmations");
+    if (pindex && confirmations.isNum() && confirmations.get_int() > 0)
+        CacheRPCResult(strCacheKey, std::make_shared<const UniValue>(result), pindex, pindex);
     return result;
 }
 
@@ -351,8 +394,8 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     unsigned int ntxFound = 0;
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-        if (setTxids.count(tx.GetHash()))
+    BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
+        if (setTxids.count(ptx->GetHash()))
             ntxFound++;
     if (ntxFound != setTxids.size())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "(Not all) transactions not found in specified block");
@@ -887,7 +930,6 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleRpc("sendrawtransaction", "\"signedhex\"")
         );
 
-    LOCK(cs_main);
     RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VBOOL));
 
     // parse hex string from parameter
@@ -900,6 +942,15 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fOverrideFees = params[1].get_bool();
 
+    // Verify the proofs before taking cs_main
+    {
+        CValidationState state;
+        if (!CheckJoinSplitsWithoutLock(tx, state))
+            throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
+    }
+
+    LOCK(cs_main);
+
     CCoinsViewCache &view = *pcoinsTip;
     const CCoins* existingCoins = view.AccessCoins(hashTx);
     bool fHaveMempool = mempool.exists(hashTx);
@@ -925,3 +976,82 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
 
     return hashTx.GetHex();
 }
+
+UniValue submitpackage(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "submitpackage [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits an ordered package of raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "Each transaction may spend outputs of the transactions before it in the package. The package is\n"
+            "validated as a whole while holding the validation lock once, with the JoinSplit proofs of all the\n"
+            "transactions checked in parallel. Submission stops at the first rejected transaction; the ones\n"
+            "before it stay in the memory pool and are relayed.\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The hex strings of the raw transactions, parents first (at most "
+            + strprintf("%u", MAX_PACKAGE_COUNT) + ")\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                   (json array of string)\n"
+            "  \"hex\"           (string) The transaction hash in hex\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("submitpackage", "\"[\\\"signedhex1\\\",\\\"signedhex2\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("submitpackage", "[\"signedhex1\",\"signedhex2\"]")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+
+    const UniValue& hexstrings = params[0].get_array();
+    if (hexstrings.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, empty package");
+    if (hexstrings.size() > MAX_PACKAGE_COUNT)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, package has more than %u transactions", MAX_PACKAGE_COUNT));
+
+    // Decode everything before taking the lock
+    std::vector<CTransaction> package(hexstrings.size());
+    std::set<uint256> setHashes;
+    for (size_t i = 0; i < hexstrings.size(); i++) {
+        if (!hexstrings[i].isStr() || !DecodeHexTx(package[i], hexstrings[i].get_str()))
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed for transaction %u", i));
+        if (!setHashes.insert(package[i].GetHash()).second)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, duplicated transaction " + package[i].GetHash().GetHex());
+    }
+
+    bool fOverrideFees = false;
+    if (params.size() > 1)
+        fOverrideFees = params[1].get_bool();
+
+    LOCK(cs_main);
+
+    BOOST_FOREACH(const CTransaction& tx, package) {
+        const CCoins* existingCoins = pcoinsTip->AccessCoins(tx.GetHash());
+        if (existingCoins && existingCoins->nHeight < 1000000000)
+            throw JSONRPCError(RPC_TRANSACTION_ALREADY_IN_CHAIN, "transaction " + tx.GetHash().GetHex() + " already in block chain");
+    }
+
+    // push to local node and sync with wallets
+    CValidationState state;
+    bool fMissingInputs;
+    size_t nAccepted;
+    bool fAccepted = AcceptPackageToMemoryPool(mempool, state, package, nAccepted, &fMissingInputs, !fOverrideFees);
+
+    UniValue result(UniValue::VARR);
+    for (size_t i = 0; i < nAccepted; i++) {
+        RelayTransaction(package[i]);
+        result.push_back(package[i].GetHash().GetHex());
+    }
+
+    if (!fAccepted) {
+        std::string strPrefix = strprintf("transaction %u (%s): ", nAccepted, package[nAccepted].GetHash().GetHex());
+        if (state.IsInvalid())
+            throw JSONRPCError(RPC_TRANSACTION_REJECTED, strPrefix + strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
+        if (fMissingInputs)
+            throw JSONRPCError(RPC_TRANSACTION_ERROR, strPrefix + "Missing inputs");
+        throw JSONRPCError(RPC_TRANSACTION_ERROR, strPrefix + state.GetRejectReason());
+    }
+
+    return result;
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/resultcache.h"
+
+#include "main.h"
+#include "rpc/jsonwriter.h"
+#include "sync.h"
+
+#include <list>
+#include <map>
+
+size_t nRPCResultCacheUsage = DEFAULT_RPC_RESULT_CACHE << 20;
+
+namespace {
+    struct CRPCResultCacheEntry {
+        std::string strKey;
+        std::shared_ptr<const UniValue> result;
+        const CBlockIndex* pindex;
+        const CBlockIndex* pindexLast;
+        size_t nSize;
+    };
+
+    CCriticalSection cs_rpcResultCache;
+    // most recently used first
+    std::list<CRPCResultCacheEntry> lRPCResultCache;
+    std::map<std::string, std::list<CRPCResultCacheEntry>::iterator> mapRPCResultCache;
+    size_t nRPCResultCacheUsed = 0;
+
+    void EraseRPCResult(std::list<CRPCResultCacheEntry>::iterator it)
+    {
+        nRPCResultCacheUsed -= it->nSize;
+        mapRPCResultCache.erase(it->strKey);
+        lRPCResultCache.erase(it);
+    }
+} // anon namespace
+
+bool WriteCachedRPCResult(const std::string& strKey, JSONWriter& writer)
+{
+    if (nRPCResultCacheUsage == 0)
+        return false;
+
+    std::shared_ptr<const UniValue> result;
+    const CBlockIndex* pindex;
+    CChainTipViewRef tip = GetChainTipView();
+    {
+        LOCK(cs_rpcResultCache);
+        std::map<std::string, std::list<CRPCResultCacheEntry>::iterator>::iterator it = mapRPCResultCache.find(strKey);
+        if (it == mapRPCResultCache.end())
+            return false;
+        if (!tip->Contains(it->second->pindexLast)) {
+            EraseRPCResult(it->second);
+            return false;
+        }
+        lRPCResultCache.splice(lRPCResultCache.begin(), lRPCResultCache, it->second);
+        result = it->second->result;
+        pindex = it->second->pindex;
+    }
+
+    // The result is written as it is kept, but for its confirmations
+    const int nConfirmations = tip->nHeight - pindex->nHeight + 1;
+    if (!result->isObject()) {
+        writer.push_back(*result);
+        return true;
+    }
+    writer.beginObject();
+    for (size_t i = 0; i < result->size(); i++) {
+        const std::string& strName = result->getKeys()[i];
+        if (strName == "confirmations")
+            writer.pushKV(strName, nConfirmations);
+        else
+            writer.pushKV(strName, result->getValues()[i]);
+    }
+    writer.endObject();
+    return true;
+}
+
+void CacheRPCResult(const std::string& strKey, const std::shared_ptr<const UniValue>& result,
+                    const CBlockIndex* pindex, const CBlockIndex* pindexLast)
+{
+    if (nRPCResultCacheUsage == 0)
+        return;
+
+    const size_t nSize = strKey.size() + result->write().size();
+    if (nSize > nRPCResultCacheUsage)
+        return;
+
+    LOCK(cs_rpcResultCache);
+    std::map<std::string, std::list<CRPCResultCacheEntry>::iterator>::iterator it = mapRPCResultCache.find(strKey);
+    if (it != mapRPCResultCache.end())
+        EraseRPCResult(it->second); // computed meanwhile by another thread, maybe on another chain
+
+    CRPCResultCacheEntry entry;
+    entry.strKey = strKey;
+    entry.result = result;
+    entry.pindex = pindex;
+    entry.pindexLast = pindexLast;
+    entry.nSize = nSize;
+    lRPCResultCache.push_front(entry);
+    mapRPCResultCache[strKey] = lRPCResultCache.begin();
+    nRPCResultCacheUsed += nSize;
+
+    while (nRPCResultCacheUsed > nRPCResultCacheUsage)
+        EraseRPCResult(--lRPCResultCache.end());
+}
@@ -0,0 +1,39 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_RESULTCACHE_H
+#define BITCOIN_RPC_RESULTCACHE_H
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+#include <univalue.h>
+
+class CBlockIndex;
+class JSONWriter;
+
+//! -rpcresultcache default, MiB of results kept: none, the cache is opt-in
+static const unsigned int DEFAULT_RPC_RESULT_CACHE = 0;
+
+//! Bytes of JSON the result cache holds, 0 if disabled
+extern size_t nRPCResultCacheUsage;
+
+/**
+ * Results of the RPCs on the blocks of the active chain and their transactions, which
+ * hold while the blocks stay on it but for their "confirmations". A result is kept with
+ * the block its confirmations count from and the block which must still be on the active
+ * chain for it to hold, which is the block after it for a result with "nextblockhash".
+ * A result whose block left the active chain is dropped when asked for, so a
+ * reorganization of any depth is followed. The cache is an LRU of nRPCResultCacheUsage
+ * bytes, counted by the size of the results in JSON.
+ */
+
+//! Write the result cached under strKey with its confirmations of now, if it still holds
+bool WriteCachedRPCResult(const std::string& strKey, JSONWriter& writer);
+//! Keep result under strKey, with the confirmations of pindex while pindexLast is on the active chain
+void CacheRPCResult(const std::string& strKey, const std::shared_ptr<const UniValue>& result,
+                    const CBlockIndex* pindex, const CBlockIndex* pindexLast);
+
+#endif // BITCOIN_RPC_RESULTCACHE_H
@@ -7,14 +7,20 @@
 
 #include "base58.h"
 #include "init.h"
+#include "main.h" // For csBestBlock and cvBlockChange
+#include "metrics.h"
 #include "random.h"
+#include "rpc/jsonwriter.h"
 #include "sync.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "asyncrpcqueue.h"
 
+#include <atomic>
+#include <list>
 #include <memory>
+#include <set>
 
 #include <univalue.h>
 
@@ -41,6 +47,13 @@ static std::vector<RPCTimerInterface*> timerInterfaces;
  * @note Can be changed to std::unique_ptr when C++11 */
 static std::map<std::string, boost::shared_ptr<RPCTimerBase> > deadlineTimers;
 
+//! Start time of the call on this thread when it can be parked, else 0
+static thread_local int64_t nParkableCallStartTime = 0;
+//! Calls parked and the functions resuming them, under csBestBlock
+static std::list<std::pair<RPCParkedCall, boost::function<void()> > > listParkedCalls;
+static bool fStopParkedCalls = false;
+static boost::thread threadParkedCalls;
+
 static struct CRPCSignals
 {
     boost::signals2::signal<void ()> Started;
@@ -280,19 +293,25 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
     { "blockchain",         "getblockcount",          &getblockcount,          true  },
-    { "blockchain",         "getblock",               &getblock,               true  },
+    { "blockchain",         "getblock",               &getblock,               true, &getblock },
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockfinalityindex",  &getblockfinalityindex,  true  },
+    { "blockchain",         "getblocksfinalityindex", &getblocksfinalityindex, true  },
     { "blockchain",         "getglobaltips",          &getglobaltips,          true  },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true, &getrawmempool },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumpchainstate",         &dumpchainstate,         true  },
+    { "blockchain",         "getdbinfo",              &getdbinfo,              true  },
+    { "blockchain",         "getioinfo",              &getioinfo,              true  },
+    { "blockchain",         "getblockvalidationstats", &getblockvalidationstats, true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
 
     /* Mining */
@@ -318,11 +337,25 @@ static const CRPCCommand vRPCCommands[] =
     { "rawtransactions",    "decodescript",           &decodescript,           true  },
     { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true  },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
+    { "rawtransactions",    "submitpackage",          &submitpackage,          false },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
 #ifdef ENABLE_WALLET
     { "rawtransactions",    "fundrawtransaction",     &fundrawtransaction,     false },
 #endif
 
+    /* Address index */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      true  },
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       true  },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        true  },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        true  },
+    { "addressindex",       "getspentinfo",           &getspentinfo,           true  },
+
+    /* Note scan */
+    { "notescan",           "z_listwatchedaddresses", &z_listwatchedaddresses, true  },
+    { "notescan",           "z_listwatchednotes",     &z_listwatchednotes,     true  },
+    { "notescan",           "z_unwatchaddress",       &z_unwatchaddress,       true  },
+    { "notescan",           "z_watchviewingkey",      &z_watchviewingkey,      true  },
+
     /* Utility functions */
     { "util",               "createmultisig",         &createmultisig,         true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
@@ -330,6 +363,14 @@ static const CRPCCommand vRPCCommands[] =
     { "util",               "estimatefee",            &estimatefee,            true  },
     { "util",               "estimatepriority",       &estimatepriority,       true  },
     { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
+    { "util",               "z_provejoinsplit",       &z_provejoinsplit,       true  },
+    { "util",               "getsnarkmetrics",        &getsnarkmetrics,        true  },
+    { "util",               "getrpcqueueinfo",        &getrpcqueueinfo,        true  },
+    { "util",               "getvalidationqueueinfo", &getvalidationqueueinfo, true  },
+    { "util",               "getschedulerinfo",       &getschedulerinfo,       true  },
+    { "util",               "getlockprofile",         &getlockprofile,         true  },
+    { "util",               "setlockprofile",         &setlockprofile,         true  },
+    { "util",               "getmemoryinfo",          &getmemoryinfo,          true  },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        true  },
@@ -368,7 +409,7 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false },
     { "wallet",             "listsinceblock",         &listsinceblock,         false },
     { "wallet",             "listtransactions",       &listtransactions,       false },
-    { "wallet",             "listunspent",            &listunspent,            false },
+    { "wallet",             "listunspent",            &listunspent,            false, &listunspent },
     { "wallet",             "lockunspent",            &lockunspent,            true  },
     { "wallet",             "move",                   &movecmd,                false },
     { "wallet",             "sendfrom",               &sendfrom,               false },
@@ -429,13 +470,80 @@ const CRPCCommand *CRPCTable::operator[](const std::string &name) const
     return (*it).second;
 }
 
+RPCParkScope::RPCParkScope(int64_t nStartTimeIn) : nStartTimePrev(nParkableCallStartTime)
+{
+    nParkableCallStartTime = nStartTimeIn;
+}
+
+RPCParkScope::~RPCParkScope()
+{
+    nParkableCallStartTime = nStartTimePrev;
+}
+
+bool RPCCanPark()
+{
+    return nParkableCallStartTime != 0;
+}
+
+int64_t RPCCallStartTime()
+{
+    return nParkableCallStartTime ? nParkableCallStartTime : GetTimeMillis();
+}
+
+void ParkRPCCall(const RPCParkedCall& call, const boost::function<void()>& resume)
+{
+    boost::unique_lock<boost::mutex> lock(csBestBlock);
+    if (fStopParkedCalls) {
+        lock.unlock();
+        resume();
+        return;
+    }
+    listParkedCalls.push_back(std::make_pair(call, resume));
+    // Have fnReady checked, in case what it waits for happened since the call checked it
+    cvBlockChange.notify_all();
+}
+
+/**
+ * Resume the parked calls once ready or due. One thread waits for them all so that
+ * the long polls hold no RPC thread.
+ */
+static void ThreadParkedRPCCalls()
+{
+    RenameThread("horizen-rpcpark");
+    boost::unique_lock<boost::mutex> lock(csBestBlock);
+    while (true) {
+        const bool fStop = fStopParkedCalls || !IsRPCRunning();
+        const int64_t nNow = GetTimeMillis();
+        int64_t nNextWake = nNow + 60 * 1000;
+        for (auto it = listParkedCalls.begin(); it != listParkedCalls.end(); ) {
+            if (fStop || nNow >= it->first.nWakeTime || it->first.fnReady()) {
+                it->second();
+                it = listParkedCalls.erase(it);
+            } else {
+                nNextWake = std::min(nNextWake, it->first.nWakeTime);
+                ++it;
+            }
+        }
+        if (fStopParkedCalls)
+            break;
+        cvBlockChange.timed_wait(lock, boost::posix_time::milliseconds(nNextWake - nNow));
+    }
+}
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
     fRPCRunning = true;
     g_rpcSignals.Started();
 
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        fStopParkedCalls = false;
+    }
+    threadParkedCalls = boost::thread(&ThreadParkedRPCCalls);
+
     // Launch one async rpc worker.  The ability to launch multiple workers is not recommended at present and thus the option is disabled.
+    getAsyncRPCQueue()->setMaxRetainedOperations(std::max<int64_t>(1, GetArg("-rpcasyncretain", DEFAULT_ASYNC_RPC_RETAINED_OPERATIONS)));
     getAsyncRPCQueue()->addWorker();
 /*
     int n = GetArg("-rpcasyncthreads", 1);
@@ -465,6 +573,16 @@ void StopRPC()
     deadlineTimers.clear();
     g_rpcSignals.Stopped();
 
+    // Resume the parked calls, failing as RPC is not running
+    if (threadParkedCalls.joinable()) {
+        {
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            fStopParkedCalls = true;
+            cvBlockChange.notify_all();
+        }
+        threadParkedCalls.join();
+    }
+
     // Tells async queue to cancel all operations and shutdown.
     LogPrintf("%s: waiting for async rpc workers to stop\n", __func__);
     getAsyncRPCQueue()->closeAndWait();
@@ -550,15 +668,118 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+//! The methods which change nothing, whose calls in a batch may run at once
+static const char* const vParallelBatchMethods[] = {
+    "getbestblockhash", "getblockcount", "getblock", "getblockhash", "getblockheader",
+    "getdifficulty", "getmempoolinfo", "getrawmempool", "gettxout", "gettxoutproof",
+    "verifytxoutproof", "createrawtransaction", "decoderawtransaction", "decodescript",
+    "getrawtransaction", "getaddressbalance", "getaddressdeltas", "getaddresstxids",
+    "getaddressutxos", "getspentinfo", "createmultisig", "validateaddress", "verifymessage",
+    "estimatefee", "estimatepriority", "z_validateaddress",
+};
+
+static bool IsParallelBatchRequest(const UniValue& req)
+{
+    static const std::set<std::string> setMethods(vParallelBatchMethods, vParallelBatchMethods + ARRAYLEN(vParallelBatchMethods));
+    if (!req.isObject())
+        return false;
+    const UniValue& method = find_value(req, "method");
+    return method.isStr() && setMethods.count(method.get_str());
+}
+
+namespace {
+
+/** A run of read-only requests of a batch, whose requests the threads take in turn */
+struct BatchRun
 {
-    UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    const UniValue* vReq;
+    std::vector<UniValue>* vReply;
+    std::atomic<size_t> nNext;
+    size_t nEnd;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    size_t nLeft;
+
+    BatchRun(const UniValue* vReqIn, std::vector<UniValue>* vReplyIn, size_t nBegin, size_t nEndIn) :
+        vReq(vReqIn), vReply(vReplyIn), nNext(nBegin), nEnd(nEndIn), nLeft(nEndIn - nBegin) {}
+
+    /** Execute requests until none is left to take. A thread coming late takes none,
+     *  and does not touch the batch, which may be gone. */
+    void Work()
+    {
+        while (true) {
+            const size_t i = nNext++;
+            if (i >= nEnd)
+                return;
+            (*vReply)[i] = JSONRPCExecOne((*vReq)[i]);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (--nLeft == 0)
+                cond.notify_all();
+        }
+    }
+
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nLeft > 0)
+            cond.wait(lock);
+    }
+};
+
+} // anon namespace
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCTaskQueue& queueTask)
+{
+    const size_t nThreads = std::max<int64_t>(1, GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS));
+    std::vector<UniValue> vReply(vReq.size());
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx;
+        while (nEnd < vReq.size() && IsParallelBatchRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx < 2 || nThreads < 2 || !queueTask) {
+            // The other requests run in order on this thread, each after the ones before it
+            nEnd = std::max(nEnd, reqIdx + 1);
+            for (; reqIdx < nEnd; reqIdx++)
+                vReply[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            continue;
+        }
 
+        // This thread works through the run too, so it completes even if no task runs
+        std::shared_ptr<BatchRun> run = std::make_shared<BatchRun>(&vReq, &vReply, reqIdx, nEnd);
+        for (size_t i = 1; i < std::min(nThreads, nEnd - reqIdx); i++) {
+            if (!queueTask(boost::bind(&BatchRun::Work, run)))
+                break;
+        }
+        run->Work();
+        run->Wait();
+        reqIdx = nEnd;
+    }
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const UniValue& reply, vReply)
+        ret.push_back(reply);
     return ret.write() + "\n";
 }
 
+namespace {
+
+/** Counts the time of a call in the latency of its method, whether it returns or throws */
+class RPCLatencyTimer
+{
+    AtomicHistogram& histogram;
+    int64_t nStart;
+
+public:
+    explicit RPCLatencyTimer(const std::string& strMethod) : histogram(GetRPCMethodLatency(strMethod)), nStart(GetTimeMicros()) {}
+    ~RPCLatencyTimer()
+    {
+        histogram.add(GetTimeMicros() - nStart);
+    }
+};
+
+} // anon namespace
+
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
 {
     // Return immediately if in warmup
@@ -575,6 +796,7 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    RPCLatencyTimer timer(pcmd->name);
     try
     {
         // Execute
@@ -588,6 +810,46 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+void CRPCTable::execute(const std::string &strMethod, const UniValue &params, JSONWriter& writer) const
+{
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    // Find method
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    if (!pcmd)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+
+    g_rpcSignals.PreCommand(*pcmd);
+
+    RPCLatencyTimer timer(pcmd->name);
+    try
+    {
+        // Execute
+        if (pcmd->writer)
+            pcmd->writer(params, false, writer);
+        else
+            writer.push_back(pcmd->actor(params, false));
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+}
+
+UniValue RPCWriteToUniValue(rpcwritefn_type fn, const UniValue& params, bool fHelp)
+{
+    UniValueWriter writer;
+    fn(params, fHelp, writer);
+    return writer.get();
+}
+
 std::string HelpExampleCli(const std::string& methodname, const std::string& args)
 {
     return "> zen-cli " + methodname + " " + args + "\n";
@@ -20,7 +20,12 @@
 #include <univalue.h>
 
 class AsyncRPCQueue;
+class AtomicHistogram;
+//! -rpcbatchthreads default, the threads executing the read-only requests of a batch at once
+static const int DEFAULT_RPC_BATCH_THREADS = 4;
+
 class CRPCCommand;
+class JSONWriter;
 class uint256;
 
 namespace RPCServer
@@ -48,6 +53,38 @@ public:
 /** Query whether RPC is running */
 bool IsRPCRunning();
 
+/**
+ * Thrown by an RPC method while RPCCanPark(), to be called again with the same
+ * parameters once fnReady returns true or at nWakeTime (in milliseconds),
+ * instead of waiting on its thread. fnReady is called under csBestBlock each
+ * time cvBlockChange is notified, so it must not take cs_main.
+ */
+struct RPCParkedCall
+{
+    boost::function<bool()> fnReady;
+    int64_t nWakeTime;
+};
+
+/** Calls which can park, made by the HTTP server, with the time the call was first made */
+class RPCParkScope
+{
+public:
+    explicit RPCParkScope(int64_t nStartTimeIn);
+    ~RPCParkScope();
+private:
+    int64_t nStartTimePrev;
+};
+
+/** The RPC call on this thread is in an RPCParkScope */
+bool RPCCanPark();
+/** The time the RPC call on this thread was first made, before it was parked, in milliseconds */
+int64_t RPCCallStartTime();
+/**
+ * Call resume once the parked call is ready or due, or the RPC server stops, from the
+ * thread waiting for all the parked calls.
+ */
+void ParkRPCCall(const RPCParkedCall& call, const boost::function<void()>& resume);
+
 /** Get the async queue*/
 std::shared_ptr<AsyncRPCQueue> getAsyncRPCQueue();
 
@@ -118,6 +155,8 @@ void RPCUnregisterTimerInterface(RPCTimerInterface *iface);
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
+//! A method writing its result as it goes, see JSONWriter
+typedef void(*rpcwritefn_type)(const UniValue& params, bool fHelp, JSONWriter& writer);
 
 class CRPCCommand
 {
@@ -126,6 +165,8 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    //! Optional, writing the result of actor without building it whole
+    rpcwritefn_type writer;
 };
 
 /**
@@ -148,8 +189,18 @@ public:
      * @throws an exception (UniValue) when an error happens.
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
+
+    /**
+     * Execute a method, writing its result to writer. The methods which have a
+     * writer write the result as they build it, the others write it whole.
+     * @throws an exception (UniValue) when an error happens, after writing part of the result.
+     */
+    void execute(const std::string &method, const UniValue &params, JSONWriter& writer) const;
 };
 
+/** The result of a method written by fn, as a UniValue */
+UniValue RPCWriteToUniValue(rpcwritefn_type fn, const UniValue& params, bool fHelp);
+
 extern const CRPCTable tableRPC;
 
 /**
@@ -166,6 +217,7 @@ extern CAmount AmountFromValue(const UniValue& value);
 extern UniValue ValueFromAmount(const CAmount& amount);
 extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
 extern double GetNetworkDifficulty(const CBlockIndex* blockindex = NULL);
+extern UniValue LatencyToJSON(const AtomicHistogram& histogram); // in rpc/mining.cpp
 extern int64_t blocksToOvertakeTarget(const CBlockIndex* forkTip, const CBlockIndex* targetBlock);
 extern std::string HelpRequiringPassphrase();
 extern std::string HelpExampleCli(const std::string& methodname, const std::string& args);
@@ -240,6 +292,15 @@ extern UniValue getwalletinfo(const UniValue& params, bool fHelp);
 extern UniValue getblockchaininfo(const UniValue& params, bool fHelp);
 extern UniValue getnetworkinfo(const UniValue& params, bool fHelp);
 extern UniValue setmocktime(const UniValue& params, bool fHelp);
+extern UniValue getaddressbalance(const UniValue& params, bool fHelp);
+extern UniValue getaddressdeltas(const UniValue& params, bool fHelp);
+extern UniValue getaddresstxids(const UniValue& params, bool fHelp);
+extern UniValue getaddressutxos(const UniValue& params, bool fHelp);
+extern UniValue getspentinfo(const UniValue& params, bool fHelp);
+extern UniValue z_watchviewingkey(const UniValue& params, bool fHelp);
+extern UniValue z_unwatchaddress(const UniValue& params, bool fHelp);
+extern UniValue z_listwatchedaddresses(const UniValue& params, bool fHelp);
+extern UniValue z_listwatchednotes(const UniValue& params, bool fHelp);
 extern UniValue resendwallettransactions(const UniValue& params, bool fHelp);
 extern UniValue zc_benchmark(const UniValue& params, bool fHelp);
 extern UniValue zc_raw_keygen(const UniValue& params, bool fHelp);
@@ -249,6 +310,7 @@ extern UniValue zc_sample_joinsplit(const UniValue& params, bool fHelp);
 
 extern UniValue getrawtransaction(const UniValue& params, bool fHelp); // in rcprawtransaction.cpp
 extern UniValue listunspent(const UniValue& params, bool fHelp);
+extern void listunspent(const UniValue& params, bool fHelp, JSONWriter& writer);
 extern UniValue lockunspent(const UniValue& params, bool fHelp);
 extern UniValue listlockunspent(const UniValue& params, bool fHelp);
 extern UniValue createrawtransaction(const UniValue& params, bool fHelp);
@@ -257,6 +319,7 @@ extern UniValue decodescript(const UniValue& params, bool fHelp);
 extern UniValue fundrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue signrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue sendrawtransaction(const UniValue& params, bool fHelp);
+extern UniValue submitpackage(const UniValue& params, bool fHelp);
 extern UniValue gettxoutproof(const UniValue& params, bool fHelp);
 extern UniValue verifytxoutproof(const UniValue& params, bool fHelp);
 
@@ -266,12 +329,20 @@ extern UniValue getdifficulty(const UniValue& params, bool fHelp);
 extern UniValue settxfee(const UniValue& params, bool fHelp);
 extern UniValue getmempoolinfo(const UniValue& params, bool fHelp);
 extern UniValue getrawmempool(const UniValue& params, bool fHelp);
+extern void getrawmempool(const UniValue& params, bool fHelp, JSONWriter& writer);
 extern UniValue getblockhash(const UniValue& params, bool fHelp);
+extern UniValue getblockfilter(const UniValue& params, bool fHelp);
 extern UniValue getblockheader(const UniValue& params, bool fHelp);
 extern UniValue getblock(const UniValue& params, bool fHelp);
+extern void getblock(const UniValue& params, bool fHelp, JSONWriter& writer);
 extern UniValue getblockfinalityindex(const UniValue& params, bool fHelp);
+extern UniValue getblocksfinalityindex(const UniValue& params, bool fHelp);
 extern UniValue getglobaltips(const UniValue& params, bool fHelp);
 extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp);
+extern UniValue dumpchainstate(const UniValue& params, bool fHelp);
+extern UniValue getdbinfo(const UniValue& params, bool fHelp);
+extern UniValue getioinfo(const UniValue& params, bool fHelp);
+extern UniValue getblockvalidationstats(const UniValue& params, bool fHelp);
 extern UniValue gettxout(const UniValue& params, bool fHelp);
 extern UniValue verifychain(const UniValue& params, bool fHelp);
 extern UniValue getchaintips(const UniValue& params, bool fHelp);
@@ -297,6 +368,14 @@ extern UniValue z_getoperationstatus(const UniValue& params, bool fHelp); // in
 extern UniValue z_getoperationresult(const UniValue& params, bool fHelp); // in rpcwallet.cpp
 extern UniValue z_listoperationids(const UniValue& params, bool fHelp); // in rpcwallet.cpp
 extern UniValue z_validateaddress(const UniValue& params, bool fHelp); // in rpcmisc.cpp
+extern UniValue z_provejoinsplit(const UniValue& params, bool fHelp); // in rpcmisc.cpp
+extern UniValue getsnarkmetrics(const UniValue& params, bool fHelp); // in rpcmisc.cpp
+extern UniValue getrpcqueueinfo(const UniValue& params, bool fHelp); // in rpcmisc.cpp
+extern UniValue getvalidationqueueinfo(const UniValue& params, bool fHelp); // in rpcmisc.cpp
+extern UniValue getschedulerinfo(const UniValue& params, bool fHelp); // in rpcmisc.cpp
+extern UniValue getlockprofile(const UniValue& params, bool fHelp); // in rpcmisc.cpp
+extern UniValue setlockprofile(const UniValue& params, bool fHelp); // in rpcmisc.cpp
+extern UniValue getmemoryinfo(const UniValue& params, bool fHelp); // in rpcmisc.cpp
 extern UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp); // in rpcdisclosure.cpp
 extern UniValue z_validatepaymentdisclosure(const UniValue &params, bool fHelp); // in rpcdisclosure.cpp
 
@@ -307,6 +386,16 @@ extern UniValue dbg_log(const UniValue &params, bool fHelp); // print a line in
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+/**
+ * Queues a task for another RPC thread, returning false if it can't be queued. The task
+ * may also never run, if the server stops first.
+ */
+typedef boost::function<bool(const boost::function<void()>& task)> RPCTaskQueue;
+/**
+ * Execute a batch of requests, the runs of read-only ones on up to -rpcbatchthreads
+ * threads at once, helped by the tasks given to queueTask. The replies are in the
+ * order of the requests.
+ */
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCTaskQueue& queueTask = RPCTaskQueue());
 
 #endif // BITCOIN_RPCSERVER_H
@@ -5,7 +5,9 @@
 #include "scheduler.h"
 
 #include "reverselock.h"
+#include "utiltime.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <utility>
@@ -20,7 +22,35 @@ CScheduler::~CScheduler()
 }
 
 
+const char* SchedulerPriorityName(SchedulerPriority priority)
+{
+    switch (priority) {
+    case SCHEDULER_PRIORITY_HIGH: return "high";
+    case SCHEDULER_PRIORITY_LOW: return "low";
+    default: return "unknown";
+    }
+}
+
+bool CScheduler::empty() const
+{
+    for (int i = 0; i < SCHEDULER_PRIORITY_COUNT; i++) {
+        if (!taskQueue[i].empty())
+            return false;
+    }
+    return true;
+}
+
 void CScheduler::serviceQueue()
+{
+    servicePriorities(0, SCHEDULER_PRIORITY_COUNT - 1);
+}
+
+void CScheduler::serviceQueue(SchedulerPriority priority)
+{
+    servicePriorities(priority, priority);
+}
+
+void CScheduler::servicePriorities(int nFirst, int nLast)
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
     ++nThreadsServicingQueue;
@@ -30,35 +60,61 @@ void CScheduler::serviceQueue()
     // is called.
     while (!shouldStop()) {
         try {
-            while (!shouldStop() && taskQueue.empty()) {
-                // Wait until there is something to do.
-                newTaskScheduled.wait(lock);
-            }
-
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.wait_until<>(lock, taskQueue.begin()->first) != boost::cv_status::timeout) {
-                // Keep waiting until timeout
+            // Wait until a task of the priorities serviced is due, taking the one of
+            // the highest priority when several are
+            TaskQueue* queue = NULL;
+            while (!shouldStop()) {
+                const boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+                boost::chrono::system_clock::time_point next = boost::chrono::system_clock::time_point::max();
+                for (int i = nFirst; i <= nLast && !queue; i++) {
+                    if (taskQueue[i].empty())
+                        continue;
+                    if (taskQueue[i].begin()->first <= now)
+                        queue = &taskQueue[i];
+                    else
+                        next = std::min(next, taskQueue[i].begin()->first);
+                }
+                if (queue)
+                    break;
+                if (next == boost::chrono::system_clock::time_point::max()) {
+                    newTaskScheduled.wait(lock);
+                } else {
+                    // Some boost versions have a conflicting overload of wait_until that returns void.
+                    // Explicitly use a template here to avoid hitting that overload.
+                    newTaskScheduled.wait_until<>(lock, next);
+                }
             }
-
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+            if (!queue)
                 continue;
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
-
+            const boost::chrono::system_clock::time_point due = queue->begin()->first;
+            const SchedulerPriority priority = (SchedulerPriority)(queue - taskQueue);
+            Task task = queue->begin()->second;
+            queue->erase(queue->begin());
+            // The threads of the other priorities wait for no task when draining
+            if (shouldStop())
+                newTaskScheduled.notify_all();
+
+            const int64_t nDelay = boost::chrono::duration_cast<boost::chrono::microseconds>(
+                boost::chrono::system_clock::now() - due).count();
+            const int64_t nTimeStart = GetTimeMicros();
             {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                task.f();
             }
+            const int64_t nTime = GetTimeMicros() - nTimeStart;
+
+            SchedulerTaskInfo& info = mapTaskInfo[std::make_pair(priority, task.name)];
+            if (info.nRuns == 0) {
+                info.name = task.name;
+                info.priority = priority;
+            }
+            info.nRuns++;
+            info.nTotalTime += nTime;
+            info.nMaxTime = std::max(info.nMaxTime, nTime);
+            info.nMaxDelay = std::max(info.nMaxDelay, nDelay);
         } catch (...) {
             --nThreadsServicingQueue;
             throw;
@@ -79,39 +135,62 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t,
+                          SchedulerPriority priority, const std::string& name)
 {
+    assert(priority >= 0 && priority < SCHEDULER_PRIORITY_COUNT);
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        Task task;
+        task.f = f;
+        task.name = name;
+        taskQueue[priority].insert(std::make_pair(t, task));
     }
-    newTaskScheduled.notify_one();
+    // The threads waiting may service other priorities only
+    newTaskScheduled.notify_all();
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds,
+                                 SchedulerPriority priority, const std::string& name)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), priority, name);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds,
+                   SchedulerPriority priority, const std::string& name)
 {
     f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds, priority, name), deltaSeconds, priority, name);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds,
+                               SchedulerPriority priority, const std::string& name)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds, priority, name), deltaSeconds, priority, name);
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
                              boost::chrono::system_clock::time_point &last) const
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
-    size_t result = taskQueue.size();
-    if (!taskQueue.empty()) {
-        first = taskQueue.begin()->first;
-        last = taskQueue.rbegin()->first;
+    size_t result = 0;
+    for (int i = 0; i < SCHEDULER_PRIORITY_COUNT; i++) {
+        if (taskQueue[i].empty())
+            continue;
+        if (result == 0 || taskQueue[i].begin()->first < first)
+            first = taskQueue[i].begin()->first;
+        if (result == 0 || taskQueue[i].rbegin()->first > last)
+            last = taskQueue[i].rbegin()->first;
+        result += taskQueue[i].size();
     }
     return result;
 }
+
+std::vector<SchedulerTaskInfo> CScheduler::getTaskInfo() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::vector<SchedulerTaskInfo> vInfo;
+    for (const auto& entry : mapTaskInfo)
+        vInfo.push_back(entry.second);
+    return vInfo;
+}
@@ -14,6 +14,8 @@
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
 #include <map>
+#include <string>
+#include <vector>
 
 //
 // Simple class for background tasks that should be run
@@ -32,6 +34,35 @@
 // delete t;
 // delete s; // Must be done after thread is interrupted/joined.
 //
+// Each task has a priority, and the threads running serviceQueue(priority) only run
+// the tasks of that priority, so that a slow task delays none of another priority.
+// A thread running serviceQueue() runs the tasks of every priority, the due ones of
+// the highest priority first.
+//
+
+//! The priorities of the tasks, each with a pool of threads of its own
+enum SchedulerPriority {
+    SCHEDULER_PRIORITY_HIGH,    //! Short latency-sensitive periodic work
+    SCHEDULER_PRIORITY_LOW,     //! Maintenance which may take long, such as writing files
+    SCHEDULER_PRIORITY_COUNT
+};
+
+//! -schedulerthreads default, threads servicing the tasks of each priority
+static const int DEFAULT_SCHEDULER_THREADS = 1;
+
+const char* SchedulerPriorityName(SchedulerPriority priority);
+
+//! The runs of the tasks of a name, in microseconds
+struct SchedulerTaskInfo
+{
+    std::string name;
+    SchedulerPriority priority;
+    uint64_t nRuns;
+    int64_t nTotalTime;
+    int64_t nMaxTime;
+    //! Longest time a run started after it was due
+    int64_t nMaxDelay;
+};
 
 class CScheduler
 {
@@ -41,24 +72,30 @@ public:
 
     typedef boost::function<void(void)> Function;
 
-    // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    // Call func at/after time t, on the threads servicing priority. The runs of
+    // the tasks are counted under their name.
+    void schedule(Function f, boost::chrono::system_clock::time_point t,
+                  SchedulerPriority priority = SCHEDULER_PRIORITY_LOW, const std::string& name = "");
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    void scheduleFromNow(Function f, int64_t deltaSeconds,
+                         SchedulerPriority priority = SCHEDULER_PRIORITY_LOW, const std::string& name = "");
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    void scheduleEvery(Function f, int64_t deltaSeconds,
+                       SchedulerPriority priority = SCHEDULER_PRIORITY_LOW, const std::string& name = "");
 
     // To keep things as simple as possible, there is no unschedule.
 
     // Services the queue 'forever'. Should be run in a thread,
     // and interrupted using boost::interrupt_thread
     void serviceQueue();
+    // Services the tasks of one priority only
+    void serviceQueue(SchedulerPriority priority);
 
     // Tell any threads running serviceQueue to stop as soon as they're
     // done servicing whatever task they're currently servicing (drain=false)
@@ -70,14 +107,28 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Returns the runs of the tasks, by name
+    std::vector<SchedulerTaskInfo> getTaskInfo() const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task
+    {
+        Function f;
+        std::string name;
+    };
+    typedef std::multimap<boost::chrono::system_clock::time_point, Task> TaskQueue;
+
+    TaskQueue taskQueue[SCHEDULER_PRIORITY_COUNT];
+    std::map<std::pair<SchedulerPriority, std::string>, SchedulerTaskInfo> mapTaskInfo;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
     bool stopRequested;
     bool stopWhenEmpty;
-    bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    bool empty() const;
+    bool shouldStop() const { return stopRequested || (stopWhenEmpty && empty()); }
+    // Services the priorities from nFirst to nLast
+    void servicePriorities(int nFirst, int nLast);
 };
 
 #endif
@@ -11,6 +11,7 @@
 #include "crypto/sha256.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 #include "util.h"
 #include "main.h"
@@ -1072,6 +1073,12 @@ public:
         ::WriteCompactSize(s, nInputs);
         for (unsigned int nInput = 0; nInput < nInputs; nInput++)
              SerializeInput(s, nInput, nType, nVersion);
+        SerializeOutputs(s, nType, nVersion);
+    }
+
+    /** Serialize the outputs of txTo, its nLockTime and its JoinSplits */
+    template<typename S>
+    void SerializeOutputs(S &s, int nType, int nVersion) const {
         // Serialize vout
         unsigned int nOutputs = fHashNone ? 0 : (fHashSingle ? nIn+1 : txTo.vout.size());
         ::WriteCompactSize(s, nOutputs);
@@ -1102,7 +1109,34 @@ public:
 
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
+{
+    const CScript scriptCode;
+    CTransactionSignatureSerializer txTmp(txTo, scriptCode, NOT_AN_INPUT, SIGHASH_ALL);
+
+    CDataStream ssInputs(SER_GETHASH, 0);
+    for (unsigned int nInput = 0; nInput < txTo.vin.size(); nInput++)
+        txTmp.SerializeInput(ssInputs, nInput, SER_GETHASH, 0);
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    ::WriteCompactSize(ss, txTo.vin.size());
+    vMidstates.reserve(txTo.vin.size());
+    // With their scripts blanked, all the inputs serialize to the same size
+    const size_t nInputSize = txTo.vin.empty() ? 0 : vchInputs.size() / txTo.vin.size();
+    for (unsigned int nInput = 0; nInput < txTo.vin.size(); nInput++) {
+        vMidstates.push_back(ss);
+        ss.write((const char*)vchInputs.data() + nInput * nInputSize, nInputSize);
+    }
+
+    CDataStream ssOutputs(SER_GETHASH, 0);
+    txTmp.SerializeOutputs(ssOutputs, SER_GETHASH, 0);
+    vchOutputs.assign(ssOutputs.begin(), ssOutputs.end());
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                      const PrecomputedTransactionData* cache)
 {
     if (nIn >= txTo.vin.size() && nIn != NOT_AN_INPUT) {
         //  nIn out of range
@@ -1120,6 +1154,18 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    if (cache && nIn != NOT_AN_INPUT && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        // Continue from the inputs before nIn, the ones after it and the outputs are not serialized again
+        assert(cache->vMidstates.size() == txTo.vin.size());
+        CHashWriter ss(cache->vMidstates[nIn]);
+        txTmp.SerializeInput(ss, nIn, SER_GETHASH, 0);
+        const size_t nOffset = (nIn + 1) * (cache->vchInputs.size() / txTo.vin.size());
+        ss.write((const char*)cache->vchInputs.data() + nOffset, cache->vchInputs.size() - nOffset);
+        ss.write((const char*)cache->vchOutputs.data(), cache->vchOutputs.size());
+        ss << nHashType;
+        return ss.GetHash();
+    }
 
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
@@ -1147,7 +1193,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
 
     uint256 sighash;
     try {
-        sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+        sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, txdata);
     } catch (logic_error ex) {
         return false;
     }
@@ -1230,11 +1276,196 @@ bool CheckReplayProtectionData(const CChain* chain, int nHeight, const std::vect
     return (vchCompareTo == vchBlockHash);
 }
 
+CBlockHashSnapshot::CBlockHashSnapshot(const CChain& chain, int nSafeDepthIn) : nTipHeight(chain.Height()), nSafeDepth(nSafeDepthIn)
+{
+    // The heights CheckReplayProtectionData compares the hash of
+    const int nLowest = std::max(0, nTipHeight - nSafeDepth + 1);
+    if (nTipHeight >= nLowest)
+        vBlocks.reserve(nTipHeight - nLowest + 1);
+    for (int nHeight = nLowest; nHeight <= nTipHeight; nHeight++)
+        vBlocks.push_back(chain[nHeight]);
+}
+
+bool CBlockHashSnapshot::Check(int nHeight, const std::vector<unsigned char>& vchCompareTo) const
+{
+    if (nHeight > nTipHeight)
+        return false;
+    if (nHeight <= nTipHeight - nSafeDepth)
+        return true;
+    if (vchCompareTo.empty())
+        return false;
+
+    const uint256 blockHash = vBlocks[nHeight - (nTipHeight - (int)vBlocks.size() + 1)]->GetBlockHash();
+    return vchCompareTo == std::vector<unsigned char>(blockHash.begin(), blockHash.end());
+}
+
 bool TransactionSignatureChecker::CheckBlockHash(const int32_t nHeight, const std::vector<unsigned char>& vchCompareTo) const
 {
+    if (hashes)
+        return hashes->Check(nHeight, vchCompareTo);
     return CheckReplayProtectionData(chain, nHeight, vchCompareTo);
 }
 
+namespace {
+
+/**
+ * The standard spends are verified without the stack machine of EvalScript. A fast path
+ * only decides the spends it gets to the signature check of, whose outcome is then that
+ * of the interpreter: success, or SCRIPT_ERR_EVAL_FALSE for a signature which does not
+ * verify. Scripts it does not match, and any check failing before, are left to the
+ * interpreter so that the errors stay the same.
+ */
+enum StandardScriptResult
+{
+    STANDARD_SCRIPT_UNHANDLED,
+    STANDARD_SCRIPT_SUCCESS,
+    STANDARD_SCRIPT_FAILURE,
+};
+
+//! Read script from pc to pend as at most nMax pushes, checked as EvalScript pushes them
+bool ReadPushes(const CScript& script, CScript::const_iterator pc, CScript::const_iterator pend, unsigned int flags,
+                size_t nMax, vector<valtype>& vPushesRet)
+{
+    opcodetype opcode;
+    valtype vchPushValue;
+    while (pc < pend) {
+        if (vPushesRet.size() == nMax || !script.GetOp(pc, opcode, vchPushValue))
+            return false;
+        if (opcode > OP_PUSHDATA4 || vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if ((flags & SCRIPT_VERIFY_MINIMALDATA) && !CheckMinimalPush(vchPushValue, opcode))
+            return false;
+        vPushesRet.push_back(vchPushValue);
+    }
+    return pc == pend;
+}
+
+//! Whether scriptPubKey ends at pc, or with a "<hash> <height> OP_CHECKBLOCKATHEIGHT" which passes
+bool CheckReplayProtectionSuffix(const CScript& scriptPubKey, CScript::const_iterator pc, unsigned int flags,
+                                 const BaseSignatureChecker& checker)
+{
+    if (pc == scriptPubKey.end())
+        return true;
+    if (scriptPubKey.back() != OP_CHECKBLOCKATHEIGHT)
+        return false;
+    vector<valtype> vPushes;
+    if (!ReadPushes(scriptPubKey, pc, scriptPubKey.end() - 1, flags, 2, vPushes) || vPushes.size() != 2)
+        return false;
+    if (!(flags & SCRIPT_VERIFY_CHECKBLOCKATHEIGHT))
+        return true;
+
+    const valtype& vchBlockHash = vPushes[0];
+    const valtype& vchBlockIndex = vPushes[1];
+    if ((vchBlockIndex.size() > sizeof(int)) || (vchBlockHash.size() > 32))
+        return false;
+    const int32_t nHeight = CScriptNum(vchBlockIndex, true, 4).getint();
+    return nHeight >= 0 && checker.CheckBlockHash(nHeight, vchBlockHash);
+}
+
+//! <sig> <pubkey> spending OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG [replay protection]
+StandardScriptResult VerifyPayToPubKeyHash(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags,
+                                           const BaseSignatureChecker& checker)
+{
+    if (scriptPubKey.size() < 25 ||
+        scriptPubKey[0] != OP_DUP ||
+        scriptPubKey[1] != OP_HASH160 ||
+        scriptPubKey[2] != 20 ||
+        scriptPubKey[23] != OP_EQUALVERIFY ||
+        scriptPubKey[24] != OP_CHECKSIG)
+        return STANDARD_SCRIPT_UNHANDLED;
+
+    vector<valtype> vPushes;
+    if (!ReadPushes(scriptSig, scriptSig.begin(), scriptSig.end(), flags, 2, vPushes) || vPushes.size() != 2)
+        return STANDARD_SCRIPT_UNHANDLED;
+    const valtype& vchSig = vPushes[0];
+    const valtype& vchPubKey = vPushes[1];
+
+    const uint160 hash = Hash160(vchPubKey);
+    if (memcmp(hash.begin(), &scriptPubKey[3], 20) != 0)
+        return STANDARD_SCRIPT_UNHANDLED;
+    if (!CheckSignatureEncoding(vchSig, flags, NULL) || !CheckPubKeyEncoding(vchPubKey, flags, NULL))
+        return STANDARD_SCRIPT_UNHANDLED;
+    if (!CheckReplayProtectionSuffix(scriptPubKey, scriptPubKey.begin() + 25, flags, checker))
+        return STANDARD_SCRIPT_UNHANDLED;
+
+    return checker.CheckSig(vchSig, vchPubKey, scriptPubKey) ? STANDARD_SCRIPT_SUCCESS : STANDARD_SCRIPT_FAILURE;
+}
+
+//! OP_0 <sig>... <m <pubkey>... n OP_CHECKMULTISIG> spending OP_HASH160 <hash> OP_EQUAL [replay protection]
+StandardScriptResult VerifyPayToScriptHashMultisig(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags,
+                                                   const BaseSignatureChecker& checker)
+{
+    if (!(flags & SCRIPT_VERIFY_P2SH) || !scriptPubKey.IsPayToScriptHash())
+        return STANDARD_SCRIPT_UNHANDLED;
+
+    // The dummy, up to 16 signatures and the redeem script
+    vector<valtype> vPushes;
+    if (!ReadPushes(scriptSig, scriptSig.begin(), scriptSig.end(), flags, 18, vPushes) || vPushes.size() < 3)
+        return STANDARD_SCRIPT_UNHANDLED;
+    const valtype& vchRedeemScript = vPushes.back();
+
+    const uint160 hash = Hash160(vchRedeemScript);
+    if (memcmp(hash.begin(), &scriptPubKey[2], 20) != 0)
+        return STANDARD_SCRIPT_UNHANDLED;
+    if (!CheckReplayProtectionSuffix(scriptPubKey, scriptPubKey.begin() + 23, flags, checker))
+        return STANDARD_SCRIPT_UNHANDLED;
+
+    CScript redeemScript(vchRedeemScript.begin(), vchRedeemScript.end());
+    if (redeemScript.size() < 3 || redeemScript.back() != OP_CHECKMULTISIG)
+        return STANDARD_SCRIPT_UNHANDLED;
+    CScript::const_iterator pc = redeemScript.begin();
+    CScript::const_iterator pend = redeemScript.end() - 2;
+    opcodetype opcode;
+    if (!redeemScript.GetOp(pc, opcode) || opcode < OP_1 || opcode > OP_16)
+        return STANDARD_SCRIPT_UNHANDLED;
+    int nSigsCount = CScript::DecodeOP_N(opcode);
+    vector<valtype> vPubKeys;
+    if (!ReadPushes(redeemScript, pc, pend, flags, 16, vPubKeys))
+        return STANDARD_SCRIPT_UNHANDLED;
+    opcode = (opcodetype)*pend;
+    if (opcode < OP_1 || opcode > OP_16 || CScript::DecodeOP_N(opcode) != (int)vPubKeys.size())
+        return STANDARD_SCRIPT_UNHANDLED;
+    int nKeysCount = vPubKeys.size();
+
+    // Exactly the signatures asked for, so that CLEANSTACK holds
+    if (nSigsCount > nKeysCount || (int)vPushes.size() != nSigsCount + 2)
+        return STANDARD_SCRIPT_UNHANDLED;
+    if ((flags & SCRIPT_VERIFY_NULLDUMMY) && vPushes[0].size())
+        return STANDARD_SCRIPT_UNHANDLED;
+
+    // The signatures and keys are matched from the top of the stack, as OP_CHECKMULTISIG does
+    bool fSuccess = true;
+    while (fSuccess && nSigsCount > 0)
+    {
+        const valtype& vchSig = vPushes[nSigsCount];
+        const valtype& vchPubKey = vPubKeys[nKeysCount - 1];
+        if (!CheckSignatureEncoding(vchSig, flags, NULL) || !CheckPubKeyEncoding(vchPubKey, flags, NULL))
+            return STANDARD_SCRIPT_UNHANDLED;
+
+        if (checker.CheckSig(vchSig, vchPubKey, redeemScript))
+            nSigsCount--;
+        nKeysCount--;
+        if (nSigsCount > nKeysCount)
+            fSuccess = false;
+    }
+    return fSuccess ? STANDARD_SCRIPT_SUCCESS : STANDARD_SCRIPT_FAILURE;
+}
+
+StandardScriptResult VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags,
+                                          const BaseSignatureChecker& checker)
+{
+    try {
+        StandardScriptResult result = VerifyPayToPubKeyHash(scriptSig, scriptPubKey, flags, checker);
+        if (result == STANDARD_SCRIPT_UNHANDLED)
+            result = VerifyPayToScriptHashMultisig(scriptSig, scriptPubKey, flags, checker);
+        return result;
+    } catch (...) {
+        return STANDARD_SCRIPT_UNHANDLED;
+    }
+}
+
+} // anon namespace
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
 {
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
@@ -1243,6 +1474,15 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigne
         return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
     }
 
+    switch (VerifyStandardScript(scriptSig, scriptPubKey, flags, checker)) {
+    case STANDARD_SCRIPT_SUCCESS:
+        return set_success(serror);
+    case STANDARD_SCRIPT_FAILURE:
+        return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    case STANDARD_SCRIPT_UNHANDLED:
+        break;
+    }
+
     vector<vector<unsigned char> > stack, stackCopy;
     if (!EvalScript(stack, scriptSig, flags, checker, serror))
         // serror is set
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -14,6 +15,7 @@
 #include <string>
 #include <climits>
 
+class CBlockIndex;
 class CChain;
 class CPubKey;
 class uint256;
@@ -92,7 +94,45 @@ enum
 
 static const unsigned int CONTEXTUAL_SCRIPT_VERIFY_FLAGS = SCRIPT_VERIFY_CHECKBLOCKATHEIGHT;
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * The parts of the signature hashes of a transaction which are the same for all its inputs,
+ * computed once for the checks of its inputs. The hash of an input is computed from the
+ * hash state after the inputs before it, so that only the input itself is serialized again.
+ * Only the hash types serializing all inputs and outputs are covered, the others are rare.
+ */
+struct PrecomputedTransactionData
+{
+    //! Hash state after nVersion and the inputs before each input, their scripts blanked
+    std::vector<CHashWriter> vMidstates;
+    //! The inputs with their scripts blanked, then the outputs, nLockTime and JoinSplits, serialized
+    std::vector<unsigned char> vchInputs;
+    std::vector<unsigned char> vchOutputs;
+
+    explicit PrecomputedTransactionData(const CTransaction& txTo);
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                      const PrecomputedTransactionData* cache = NULL);
+
+/**
+ * The blocks of a chain OP_CHECKBLOCKATHEIGHT compares against, those less than the
+ * safe depth below its tip, taken from the chain at once. The script checks of a block
+ * run on other threads look the block hashes up in it rather than in the chain.
+ */
+class CBlockHashSnapshot
+{
+private:
+    int nTipHeight;
+    int nSafeDepth;
+    //! The blocks from nTipHeight - vBlocks.size() + 1 to nTipHeight
+    std::vector<const CBlockIndex*> vBlocks;
+
+public:
+    CBlockHashSnapshot(const CChain& chain, int nSafeDepthIn);
+
+    //! Whether nHeight is the height of the block vchCompareTo hashes, as CheckReplayProtectionData
+    bool Check(int nHeight, const std::vector<unsigned char>& vchCompareTo) const;
+};
 
 class BaseSignatureChecker
 {
@@ -121,12 +161,17 @@ private:
     const CTransaction* txTo;
     unsigned int nIn;
     const CChain* chain;
+    const PrecomputedTransactionData* txdata;
+    //! Looked the block hashes up in instead of chain, if set
+    const CBlockHashSnapshot* hashes;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CChain* chainIn) : txTo(txToIn), nIn(nInIn), chain(chainIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CChain* chainIn, const PrecomputedTransactionData* txdataIn = NULL,
+                                const CBlockHashSnapshot* hashesIn = NULL) :
+        txTo(txToIn), nIn(nInIn), chain(chainIn), txdata(txdataIn), hashes(hashesIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
     bool CheckBlockHash(const int32_t nHeight, const std::vector<unsigned char>& nBlockHash) const;
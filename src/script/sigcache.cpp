@@ -5,13 +5,16 @@
 
 #include "sigcache.h"
 
+#include "crypto/sha256.h"
+#include "memusage.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <string.h>
+
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 namespace {
 
@@ -19,72 +22,149 @@ namespace {
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * The entries are salted hashes of the signatures, 32 bytes whatever their size, in
+ * tables of the size of -maxsigcachesize allocated at once. The tables are split into
+ * shards of their own lock, so that the script check threads rarely wait for each
+ * other. In its shard, an entry goes in one of two buckets chosen by its hash and,
+ * when both are full, replaces one of their slots chosen by its hash too. The salt
+ * keeps where an entry goes out of reach of whoever chooses the signatures.
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const unsigned int SHARDS = 32;
+    static const unsigned int BUCKET_SLOTS = 4;
 
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    struct Shard
+    {
+        boost::shared_mutex cs;
+        //! The buckets one after the other, null for the empty slots
+        std::vector<uint256> vSlots;
+    };
+
+    uint256 nonce;
+    Shard shards[SHARDS];
+    //! Buckets in a shard, a power of two
+    size_t nBuckets;
+
+    static uint32_t Word(const uint256& entry, int i)
+    {
+        uint32_t n;
+        memcpy(&n, entry.begin() + 4 * i, 4);
+        return n;
+    }
+
+    Shard& GetShard(const uint256& entry)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return shards[Word(entry, 0) % SHARDS];
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
+    //! Index in the slots of its shard of the i-th of the two buckets of entry
+    size_t Slot(const uint256& entry, int nBucket, int i) const
+    {
+        return (Word(entry, 1 + nBucket) & (nBuckets - 1)) * BUCKET_SLOTS + i;
+    }
+
+    bool Contains(const Shard& shard, const uint256& entry) const
+    {
+        for (int nBucket = 0; nBucket < 2; nBucket++)
+            for (unsigned int i = 0; i < BUCKET_SLOTS; i++)
+                if (shard.vSlots[Slot(entry, nBucket, i)] == entry)
+                    return true;
         return false;
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+public:
+    CSignatureCache() : nonce(GetRandHash()), nBuckets(0)
+    {
+        const size_t nMaxSize = std::max<int64_t>(0, std::min<int64_t>(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE));
+        const size_t nShardSlots = (nMaxSize << 20) / SHARDS / sizeof(uint256);
+        if (nShardSlots >= BUCKET_SLOTS) {
+            nBuckets = 1;
+            while (nBuckets * 2 * BUCKET_SLOTS <= nShardSlots)
+                nBuckets *= 2;
+        }
+        for (unsigned int i = 0; i < SHARDS; i++)
+            shards[i].vSlots.resize(nBuckets * BUCKET_SLOTS);
+        LogPrintf("Using %u MiB for the signature cache, able to store %u signatures\n",
+            (nBuckets * BUCKET_SLOTS * SHARDS * sizeof(uint256)) >> 20, nBuckets * BUCKET_SLOTS * SHARDS);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+        if (!nBuckets)
+            return false;
+        Shard& shard = GetShard(entry);
+        boost::shared_lock<boost::shared_mutex> lock(shard.cs);
+        return Contains(shard, entry);
+    }
+
+    void Set(const uint256& entry)
+    {
+        if (!nBuckets)
+            return;
+        Shard& shard = GetShard(entry);
+        boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+        if (Contains(shard, entry))
+            return;
+        for (int nBucket = 0; nBucket < 2; nBucket++) {
+            for (unsigned int i = 0; i < BUCKET_SLOTS; i++) {
+                uint256& slot = shard.vSlots[Slot(entry, nBucket, i)];
+                if (slot.IsNull()) {
+                    slot = entry;
+                    return;
+                }
+            }
         }
+        // Evict an entry of the full buckets
+        const uint32_t n = Word(entry, 3) % (2 * BUCKET_SLOTS);
+        shard.vSlots[Slot(entry, n / BUCKET_SLOTS, n % BUCKET_SLOTS)] = entry;
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    size_t DynamicMemoryUsage() const
+    {
+        size_t nUsage = 0;
+        for (unsigned int i = 0; i < SHARDS; i++)
+            nUsage += memusage::DynamicUsage(shards[i].vSlots);
+        return nUsage;
     }
 };
 
+//! Made on first use, once -maxsigcachesize is known
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache;
+    return signatureCache;
+}
+
+}
+
+size_t SignatureCacheDynamicUsage()
+{
+    return GetSignatureCache().DynamicMemoryUsage();
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    if (signatureCache.Get(entry))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
     return true;
 }
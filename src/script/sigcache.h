@@ -12,13 +12,23 @@
 
 class CPubKey;
 
+//! -maxsigcachesize default, in MiB
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+//! Largest -maxsigcachesize, in MiB
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
+//! The memory the tables of the signature cache take, allocated at once
+size_t SignatureCacheDynamicUsage();
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CChain* chainIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn, chainIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CChain* chainIn, bool storeIn=true, const PrecomputedTransactionData* txdataIn = NULL,
+                                       const CBlockHashSnapshot* hashesIn = NULL) :
+        TransactionSignatureChecker(txToIn, nInIn, chainIn, txdataIn, hashesIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
@@ -9,15 +9,18 @@
 #include "compat/endian.h"
 
 #include <algorithm>
+#include <array>
 #include <assert.h>
 #include <ios>
 #include <limits>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
 #include <string.h>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -25,9 +28,34 @@
 #include <boost/optional.hpp>
 
 class CScript;
+template<unsigned int BITS> class base_blob;
 
 static const unsigned int MAX_SIZE = 0x02000000;
 
+/**
+ * Whether T is serialized as its bytes in memory, as the bytes, the opaque blobs and the arrays
+ * of them are. The arrays and vectors of such a T are then read and written at once, and sized
+ * without walking them, rather than element by element.
+ */
+template<typename T, typename Enable = void>
+struct is_serialized_as_bytes : std::false_type {};
+
+template<>
+struct is_serialized_as_bytes<unsigned char> : std::true_type {};
+
+// The blobs of uint256.h, and the classes derived from them as long as they add no member
+template<typename T>
+struct is_serialized_as_bytes<T, typename std::enable_if<std::is_base_of<base_blob<sizeof(T) * 8>, T>::value>::type>
+    : std::true_type {};
+
+template<typename T, std::size_t N>
+struct is_serialized_as_bytes<boost::array<T, N> >
+    : std::integral_constant<bool, is_serialized_as_bytes<T>::value && sizeof(boost::array<T, N>) == N * sizeof(T)> {};
+
+template<typename T, std::size_t N>
+struct is_serialized_as_bytes<std::array<T, N> >
+    : std::integral_constant<bool, is_serialized_as_bytes<T>::value && sizeof(std::array<T, N>) == N * sizeof(T)> {};
+
 /**
  * Dummy data type to identify deserializing constructors.
  *
@@ -109,6 +137,11 @@ template<typename Stream> inline void ser_writedata32(Stream &s, uint32_t obj)
     obj = htole32(obj);
     s.write((char*)&obj, 4);
 }
+template<typename Stream> inline void ser_writedata32be(Stream &s, uint32_t obj)
+{
+    obj = htobe32(obj);
+    s.write((char*)&obj, 4);
+}
 template<typename Stream> inline void ser_writedata64(Stream &s, uint64_t obj)
 {
     obj = htole64(obj);
@@ -132,6 +165,12 @@ template<typename Stream> inline uint32_t ser_readdata32(Stream &s)
     s.read((char*)&obj, 4);
     return le32toh(obj);
 }
+template<typename Stream> inline uint32_t ser_readdata32be(Stream &s)
+{
+    uint32_t obj;
+    s.read((char*)&obj, 4);
+    return be32toh(obj);
+}
 template<typename Stream> inline uint64_t ser_readdata64(Stream &s)
 {
     uint64_t obj;
@@ -390,6 +429,7 @@ I ReadVarInt(Stream& is)
 
 #define FLATDATA(obj) REF(CFlatData((char*)&(obj), (char*)&(obj) + sizeof(obj)))
 #define VARINT(obj) REF(WrapVarInt(REF(obj)))
+#define COMPACTSIZE(obj) REF(CCompactSize(REF(obj)))
 #define LIMITED_STRING(obj,n) REF(LimitedString< n >(REF(obj)))
 
 /** 
@@ -454,6 +494,28 @@ public:
     }
 };
 
+class CCompactSize
+{
+protected:
+    uint64_t &n;
+public:
+    CCompactSize(uint64_t& nIn) : n(nIn) { }
+
+    unsigned int GetSerializeSize(int, int) const {
+        return GetSizeOfCompactSize(n);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int, int) const {
+        WriteCompactSize<Stream>(s, n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int) {
+        n = ReadCompactSize<Stream>(s);
+    }
+};
+
 template<size_t Limit>
 class LimitedString
 {
@@ -504,16 +566,17 @@ template<typename Stream, typename C> void Unserialize(Stream& is, std::basic_st
 
 /**
  * vector
- * vectors of unsigned char are a special case and are intended to be serialized as a single opaque blob.
+ * vectors of the types serialized as their bytes, as unsigned char, are a special case and are intended
+ * to be serialized as a single opaque blob.
  */
-template<typename T, typename A> unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const unsigned char&);
-template<typename T, typename A, typename V> unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const V&);
+template<typename T, typename A> unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, std::true_type);
+template<typename T, typename A> unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, std::false_type);
 template<typename T, typename A> inline unsigned int GetSerializeSize(const std::vector<T, A>& v, int nType, int nVersion);
-template<typename Stream, typename T, typename A> void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, const unsigned char&);
-template<typename Stream, typename T, typename A, typename V> void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, const V&);
+template<typename Stream, typename T, typename A> void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, std::true_type);
+template<typename Stream, typename T, typename A> void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, std::false_type);
 template<typename Stream, typename T, typename A> inline void Serialize(Stream& os, const std::vector<T, A>& v, int nType, int nVersion);
-template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const unsigned char&);
-template<typename Stream, typename T, typename A, typename V> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const V&);
+template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, std::true_type);
+template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, std::false_type);
 template<typename Stream, typename T, typename A> inline void Unserialize(Stream& is, std::vector<T, A>& v, int nType, int nVersion);
 
 /**
@@ -530,8 +593,17 @@ template<typename T> unsigned int GetSerializeSize(const boost::optional<T> &ite
 template<typename Stream, typename T> void Serialize(Stream& os, const boost::optional<T>& item, int nType, int nVersion);
 template<typename Stream, typename T> void Unserialize(Stream& is, boost::optional<T>& item, int nType, int nVersion);
 
+/**
+ * shared_ptr
+ * serialized as the object it points to, which must be set
+ */
+template<typename T> unsigned int GetSerializeSize(const std::shared_ptr<const T>& p, int nType, int nVersion);
+template<typename Stream, typename T> void Serialize(Stream& os, const std::shared_ptr<const T>& p, int nType, int nVersion);
+template<typename Stream, typename T> void Unserialize(Stream& is, std::shared_ptr<const T>& p, int nType, int nVersion);
+
 /**
  * array
+ * arrays of the types serialized as their bytes are read, written and sized as a single blob, as vectors of them are.
  */
 template<typename T, std::size_t N> unsigned int GetSerializeSize(const boost::array<T, N> &item, int nType, int nVersion);
 template<typename Stream, typename T, std::size_t N> void Serialize(Stream& os, const boost::array<T, N>& item, int nType, int nVersion);
@@ -541,6 +613,13 @@ template<typename T, std::size_t N> unsigned int GetSerializeSize(const std::arr
 template<typename Stream, typename T, std::size_t N> void Serialize(Stream& os, const std::array<T, N>& item, int nType, int nVersion);
 template<typename Stream, typename T, std::size_t N> void Unserialize(Stream& is, std::array<T, N>& item, int nType, int nVersion);
 
+template<typename T> unsigned int GetSerializeSizeArray_impl(const T* item, size_t n, int nType, int nVersion, std::true_type);
+template<typename T> unsigned int GetSerializeSizeArray_impl(const T* item, size_t n, int nType, int nVersion, std::false_type);
+template<typename Stream, typename T> void SerializeArray_impl(Stream& os, const T* item, size_t n, int nType, int nVersion, std::true_type);
+template<typename Stream, typename T> void SerializeArray_impl(Stream& os, const T* item, size_t n, int nType, int nVersion, std::false_type);
+template<typename Stream, typename T> void UnserializeArray_impl(Stream& is, T* item, size_t n, int nType, int nVersion, std::true_type);
+template<typename Stream, typename T> void UnserializeArray_impl(Stream& is, T* item, size_t n, int nType, int nVersion, std::false_type);
+
 /**
  * pair
  */
@@ -633,13 +712,13 @@ void Unserialize(Stream& is, std::basic_string<C>& str, int, int)
  * vector
  */
 template<typename T, typename A>
-unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const unsigned char&)
+unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, std::true_type)
 {
     return (GetSizeOfCompactSize(v.size()) + v.size() * sizeof(T));
 }
 
-template<typename T, typename A, typename V>
-unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const V&)
+template<typename T, typename A>
+unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, std::false_type)
 {
     unsigned int nSize = GetSizeOfCompactSize(v.size());
     for (typename std::vector<T, A>::const_iterator vi = v.begin(); vi != v.end(); ++vi)
@@ -650,20 +729,20 @@ unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nV
 template<typename T, typename A>
 inline unsigned int GetSerializeSize(const std::vector<T, A>& v, int nType, int nVersion)
 {
-    return GetSerializeSize_impl(v, nType, nVersion, T());
+    return GetSerializeSize_impl(v, nType, nVersion, typename is_serialized_as_bytes<T>::type());
 }
 
 
 template<typename Stream, typename T, typename A>
-void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, const unsigned char&)
+void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, std::true_type)
 {
     WriteCompactSize(os, v.size());
     if (!v.empty())
         os.write((char*)&v[0], v.size() * sizeof(T));
 }
 
-template<typename Stream, typename T, typename A, typename V>
-void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, const V&)
+template<typename Stream, typename T, typename A>
+void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, std::false_type)
 {
     WriteCompactSize(os, v.size());
     for (typename std::vector<T, A>::const_iterator vi = v.begin(); vi != v.end(); ++vi)        
@@ -677,12 +756,12 @@ void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVers
 template<typename Stream, typename T, typename A>
 inline void Serialize(Stream& os, const std::vector<T, A>& v, int nType, int nVersion)
 {
-    Serialize_impl(os, v, nType, nVersion, T());
+    Serialize_impl(os, v, nType, nVersion, typename is_serialized_as_bytes<T>::type());
 }
 
 
 template<typename Stream, typename T, typename A>
-void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const unsigned char&)
+void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, std::true_type)
 {
     // Limit size per read so bogus size value won't cause out of memory
     v.clear();
@@ -697,8 +776,8 @@ void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion,
     }
 }
 
-template<typename Stream, typename T, typename A, typename V>
-void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const V&)
+template<typename Stream, typename T, typename A>
+void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, std::false_type)
 {
     v.clear();
     unsigned int nSize = ReadCompactSize(is);
@@ -718,7 +797,7 @@ void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion,
 template<typename Stream, typename T, typename A>
 inline void Unserialize(Stream& is, std::vector<T, A>& v, int nType, int nVersion)
 {
-    Unserialize_impl(is, v, nType, nVersion, T());
+    Unserialize_impl(is, v, nType, nVersion, typename is_serialized_as_bytes<T>::type());
 }
 
 
@@ -792,60 +871,113 @@ void Unserialize(Stream& is, boost::optional<T>& item, int nType, int nVersion)
 
 
 
+/**
+ * shared_ptr
+ */
+template<typename T>
+unsigned int GetSerializeSize(const std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    return GetSerializeSize(*p, nType, nVersion);
+}
+
+template<typename Stream, typename T>
+void Serialize(Stream& os, const std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    Serialize(os, *p, nType, nVersion);
+}
+
+template<typename Stream, typename T>
+void Unserialize(Stream& is, std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    std::shared_ptr<T> object = std::make_shared<T>();
+    Unserialize(is, *object, nType, nVersion);
+    p = object;
+}
+
+
+
 /**
  * array
  */
-template<typename T, std::size_t N>
-unsigned int GetSerializeSize(const boost::array<T, N> &item, int nType, int nVersion)
+template<typename T>
+unsigned int GetSerializeSizeArray_impl(const T* item, size_t n, int nType, int nVersion, std::true_type)
+{
+    return n * sizeof(T);
+}
+
+template<typename T>
+unsigned int GetSerializeSizeArray_impl(const T* item, size_t n, int nType, int nVersion, std::false_type)
 {
     unsigned int size = 0;
-    for (size_t i = 0; i < N; i++) {
-        size += GetSerializeSize(item[0], nType, nVersion);
+    for (size_t i = 0; i < n; i++) {
+        size += GetSerializeSize(item[i], nType, nVersion);
     }
     return size;
 }
 
-template<typename Stream, typename T, std::size_t N>
-void Serialize(Stream& os, const boost::array<T, N>& item, int nType, int nVersion)
+template<typename Stream, typename T>
+void SerializeArray_impl(Stream& os, const T* item, size_t n, int nType, int nVersion, std::true_type)
+{
+    os.write((const char*)item, n * sizeof(T));
+}
+
+template<typename Stream, typename T>
+void SerializeArray_impl(Stream& os, const T* item, size_t n, int nType, int nVersion, std::false_type)
 {
-    for (size_t i = 0; i < N; i++) {
+    for (size_t i = 0; i < n; i++) {
         Serialize(os, item[i], nType, nVersion);
     }
 }
 
-template<typename Stream, typename T, std::size_t N>
-void Unserialize(Stream& is, boost::array<T, N>& item, int nType, int nVersion)
+template<typename Stream, typename T>
+void UnserializeArray_impl(Stream& is, T* item, size_t n, int nType, int nVersion, std::true_type)
 {
-    for (size_t i = 0; i < N; i++) {
+    is.read((char*)item, n * sizeof(T));
+}
+
+template<typename Stream, typename T>
+void UnserializeArray_impl(Stream& is, T* item, size_t n, int nType, int nVersion, std::false_type)
+{
+    for (size_t i = 0; i < n; i++) {
         Unserialize(is, item[i], nType, nVersion);
     }
 }
 
+template<typename T, std::size_t N>
+unsigned int GetSerializeSize(const boost::array<T, N> &item, int nType, int nVersion)
+{
+    return GetSerializeSizeArray_impl(item.data(), N, nType, nVersion, typename is_serialized_as_bytes<T>::type());
+}
+
+template<typename Stream, typename T, std::size_t N>
+void Serialize(Stream& os, const boost::array<T, N>& item, int nType, int nVersion)
+{
+    SerializeArray_impl(os, item.data(), N, nType, nVersion, typename is_serialized_as_bytes<T>::type());
+}
+
+template<typename Stream, typename T, std::size_t N>
+void Unserialize(Stream& is, boost::array<T, N>& item, int nType, int nVersion)
+{
+    UnserializeArray_impl(is, item.data(), N, nType, nVersion, typename is_serialized_as_bytes<T>::type());
+}
+
 
 template<typename T, std::size_t N>
 unsigned int GetSerializeSize(const std::array<T, N> &item, int nType, int nVersion)
 {
-    unsigned int size = 0;
-    for (size_t i = 0; i < N; i++) {
-        size += GetSerializeSize(item[0], nType, nVersion);
-    }
-    return size;
+    return GetSerializeSizeArray_impl(item.data(), N, nType, nVersion, typename is_serialized_as_bytes<T>::type());
 }
 
 template<typename Stream, typename T, std::size_t N>
 void Serialize(Stream& os, const std::array<T, N>& item, int nType, int nVersion)
 {
-    for (size_t i = 0; i < N; i++) {
-        Serialize(os, item[i], nType, nVersion);
-    }
+    SerializeArray_impl(os, item.data(), N, nType, nVersion, typename is_serialized_as_bytes<T>::type());
 }
 
 template<typename Stream, typename T, std::size_t N>
 void Unserialize(Stream& is, std::array<T, N>& item, int nType, int nVersion)
 {
-    for (size_t i = 0; i < N; i++) {
-        Unserialize(is, item[i], nType, nVersion);
-    }
+    UnserializeArray_impl(is, item.data(), N, nType, nVersion, typename is_serialized_as_bytes<T>::type());
 }
 
 
@@ -65,7 +65,7 @@ void alt_bn128_G1::to_affine_coordinates()
         this->Y = alt_bn128_Fq::one();
         this->Z = alt_bn128_Fq::zero();
     }
-    else
+    else if (this->Z != alt_bn128_Fq::one())
     {
         alt_bn128_Fq Z_inv = Z.inverse();
         alt_bn128_Fq Z2_inv = Z_inv.squared();
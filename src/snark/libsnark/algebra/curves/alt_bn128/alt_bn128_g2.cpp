@@ -75,7 +75,7 @@ void alt_bn128_G2::to_affine_coordinates()
         this->Y = alt_bn128_Fq2::one();
         this->Z = alt_bn128_Fq2::zero();
     }
-    else
+    else if (this->Z != alt_bn128_Fq2::one())
     {
         alt_bn128_Fq2 Z_inv = Z.inverse();
         alt_bn128_Fq2 Z2_inv = Z_inv.squared();
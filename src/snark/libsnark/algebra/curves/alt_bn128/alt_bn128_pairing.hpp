@@ -7,6 +7,7 @@
 
 #ifndef ALT_BN128_PAIRING_HPP_
 #define ALT_BN128_PAIRING_HPP_
+#include <utility>
 #include <vector>
 #include "algebra/curves/alt_bn128/alt_bn128_init.hpp"
 
@@ -57,6 +58,12 @@ alt_bn128_Fq12 alt_bn128_ate_double_miller_loop(const alt_bn128_ate_G1_precomp &
                                      const alt_bn128_ate_G1_precomp &prec_P2,
                                      const alt_bn128_ate_G2_precomp &prec_Q2);
 
+/* product of the pairings of the pairs, the Miller loops sharing their squarings; the
+   precomputations are pointed to, as the G2 ones are large and usually cached */
+typedef std::vector<std::pair<const alt_bn128_ate_G1_precomp*, const alt_bn128_ate_G2_precomp*> > alt_bn128_ate_pairing_terms;
+
+alt_bn128_Fq12 alt_bn128_ate_multi_miller_loop(const alt_bn128_ate_pairing_terms &terms);
+
 alt_bn128_Fq12 alt_bn128_ate_pairing(const alt_bn128_G1& P,
                           const alt_bn128_G2 &Q);
 alt_bn128_GT alt_bn128_ate_reduced_pairing(const alt_bn128_G1 &P,
@@ -79,6 +86,13 @@ alt_bn128_Fq12 alt_bn128_double_miller_loop(const alt_bn128_G1_precomp &prec_P1,
                                  const alt_bn128_G1_precomp &prec_P2,
                                  const alt_bn128_G2_precomp &prec_Q2);
 
+typedef alt_bn128_ate_pairing_terms alt_bn128_pairing_terms;
+
+alt_bn128_Fq12 alt_bn128_multi_miller_loop(const alt_bn128_pairing_terms &terms);
+
+/* the product of the pairings of terms with a single final exponentiation */
+alt_bn128_GT alt_bn128_multi_pairing(const alt_bn128_pairing_terms &terms);
+
 alt_bn128_Fq12 alt_bn128_pairing(const alt_bn128_G1& P,
                       const alt_bn128_G2 &Q);
 
@@ -26,6 +26,7 @@ public:
     typedef alt_bn128_Fq2 Fqe_type;
     typedef alt_bn128_Fq12 Fqk_type;
     typedef alt_bn128_GT GT_type;
+    typedef alt_bn128_pairing_terms pairing_terms_type;
 
     static const bool has_affine_pairing = false;
 
@@ -39,6 +40,8 @@ public:
                                              const alt_bn128_G2_precomp &prec_Q1,
                                              const alt_bn128_G1_precomp &prec_P2,
                                              const alt_bn128_G2_precomp &prec_Q2);
+    static alt_bn128_Fq12 multi_miller_loop(const alt_bn128_pairing_terms &terms);
+    static alt_bn128_GT multi_pairing(const alt_bn128_pairing_terms &terms);
     static alt_bn128_Fq12 pairing(const alt_bn128_G1 &P,
                                   const alt_bn128_G2 &Q);
     static alt_bn128_Fq12 reduced_pairing(const alt_bn128_G1 &P,
@@ -8,6 +8,7 @@
 #ifndef CURVE_UTILS_HPP_
 #define CURVE_UTILS_HPP_
 #include <cstdint>
+#include <vector>
 
 #include "algebra/fields/bigint.hpp"
 
@@ -16,6 +17,27 @@ namespace libsnark {
 template<typename GroupT, mp_size_t m>
 GroupT scalar_mul(const GroupT &base, const bigint<m> &scalar);
 
+/**
+ * Convert the non-zero points of vec to special form with a single field
+ * inversion (Montgomery's trick), specialized by each curve.
+ */
+template<typename GroupT>
+void batch_to_special_all_non_zeros(std::vector<GroupT> &vec);
+
+/**
+ * Convert the points pointed to, which can be zero, to special form with a
+ * single field inversion, for points kept apart as those of a proof.
+ */
+template<typename GroupT>
+void batch_to_special_points(const std::vector<GroupT*> &points);
+
+/**
+ * acc + point, as a mixed addition when point is in special form: the
+ * points read from keys are, and those of the batch conversions.
+ */
+template<typename GroupT>
+GroupT add_mixed_if_special(const GroupT &acc, const GroupT &point);
+
 } // libsnark
 #include "algebra/curves/curve_utils.tcc"
 
@@ -33,5 +33,40 @@ GroupT scalar_mul(const GroupT &base, const bigint<m> &scalar)
     return result;
 }
 
+template<typename GroupT>
+void batch_to_special_points(const std::vector<GroupT*> &points)
+{
+    std::vector<GroupT> non_zero_vec;
+    non_zero_vec.reserve(points.size());
+    for (GroupT *point : points)
+    {
+        if (!point->is_zero())
+        {
+            non_zero_vec.emplace_back(*point);
+        }
+    }
+
+    batch_to_special_all_non_zeros<GroupT>(non_zero_vec);
+    auto it = non_zero_vec.begin();
+    for (GroupT *point : points)
+    {
+        if (!point->is_zero())
+        {
+            *point = *it;
+            ++it;
+        }
+        else
+        {
+            point->to_special();
+        }
+    }
+}
+
+template<typename GroupT>
+GroupT add_mixed_if_special(const GroupT &acc, const GroupT &point)
+{
+    return point.is_special() ? acc.mixed_add(point) : acc + point;
+}
+
 } // libsnark
 #endif // CURVE_UTILS_TCC_
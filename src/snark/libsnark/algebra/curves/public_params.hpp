@@ -26,6 +26,7 @@ namespace libsnark {
   Fqe_type
   Fqk_type
   GT_type
+  pairing_terms_type, a vector of pairs of pointers to a G1_precomp and a G2_precomp
 
   one should also define the following static methods:
 
@@ -59,6 +60,8 @@ namespace libsnark {
                                  const G2_precomp<EC_ppT> &prec_Q1,
                                  const G1_precomp<EC_ppT> &prec_P2,
                                  const G2_precomp<EC_ppT> &prec_Q2);
+  Fqk<EC_ppT> multi_miller_loop(const pairing_terms<EC_ppT> &terms);
+  GT<EC_ppT> multi_pairing(const pairing_terms<EC_ppT> &terms);
 
   Fqk<EC_ppT> pairing(const G1<EC_ppT> &P,
                       const G2<EC_ppT> &Q);
@@ -90,6 +93,8 @@ template<typename EC_ppT>
 using Fqk = typename EC_ppT::Fqk_type;
 template<typename EC_ppT>
 using GT = typename EC_ppT::GT_type;
+template<typename EC_ppT>
+using pairing_terms = typename EC_ppT::pairing_terms_type;
 
 template<typename EC_ppT>
 using Fr_vector = std::vector<Fr<EC_ppT> >;
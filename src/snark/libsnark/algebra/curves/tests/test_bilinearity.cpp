@@ -72,6 +72,36 @@ void double_miller_loop_test()
     EXPECT_EQ(ans_1 * ans_2, ans_12);
 }
 
+template<typename ppT>
+void multi_pairing_test()
+{
+    const G1<ppT> P1 = (Fr<ppT>::random_element()) * G1<ppT>::one();
+    const G1<ppT> P2 = (Fr<ppT>::random_element()) * G1<ppT>::one();
+    const G1<ppT> P3 = (Fr<ppT>::random_element()) * G1<ppT>::one();
+    const G2<ppT> Q1 = (Fr<ppT>::random_element()) * G2<ppT>::one();
+    const G2<ppT> Q2 = (Fr<ppT>::random_element()) * G2<ppT>::one();
+
+    const G1_precomp<ppT> prec_P1 = ppT::precompute_G1(P1);
+    const G1_precomp<ppT> prec_P2 = ppT::precompute_G1(P2);
+    const G1_precomp<ppT> prec_P3 = ppT::precompute_G1(P3);
+    const G2_precomp<ppT> prec_Q1 = ppT::precompute_G2(Q1);
+    const G2_precomp<ppT> prec_Q2 = ppT::precompute_G2(Q2);
+
+    const Fqk<ppT> ans_1 = ppT::miller_loop(prec_P1, prec_Q1);
+    const Fqk<ppT> ans_2 = ppT::miller_loop(prec_P2, prec_Q2);
+    const Fqk<ppT> ans_3 = ppT::miller_loop(prec_P3, prec_Q1);
+    const Fqk<ppT> ans_123 = ppT::multi_miller_loop({ { &prec_P1, &prec_Q1 }, { &prec_P2, &prec_Q2 }, { &prec_P3, &prec_Q1 } });
+    EXPECT_EQ(ans_1 * ans_2 * ans_3, ans_123);
+    EXPECT_EQ(ppT::double_miller_loop(prec_P1, prec_Q1, prec_P2, prec_Q2), ppT::multi_miller_loop({ { &prec_P1, &prec_Q1 }, { &prec_P2, &prec_Q2 } }));
+    EXPECT_EQ(ppT::multi_miller_loop({}), Fqk<ppT>::one());
+
+    // e(P1, Q1) * e(P2, Q1) * e(-(P1 + P2), Q1) = 1
+    const G1_precomp<ppT> prec_P12_neg = ppT::precompute_G1(-(P1 + P2));
+    EXPECT_EQ(ppT::multi_pairing({ { &prec_P1, &prec_Q1 }, { &prec_P2, &prec_Q1 }, { &prec_P12_neg, &prec_Q1 } }), GT<ppT>::one());
+    EXPECT_EQ(ppT::multi_pairing({ { &prec_P1, &prec_Q1 }, { &prec_P2, &prec_Q2 } }),
+              ppT::reduced_pairing(P1, Q1) * ppT::reduced_pairing(P2, Q2));
+}
+
 template<typename ppT>
 void affine_pairing_test()
 {
@@ -112,6 +142,7 @@ TEST(algebra, bilinearity)
     alt_bn128_pp::init_public_params();
     pairing_test<alt_bn128_pp>();
     double_miller_loop_test<alt_bn128_pp>();
+    multi_pairing_test<alt_bn128_pp>();
 
 #ifdef CURVE_BN128       // BN128 has fancy dependencies so it may be disabled
     bn128_pp::init_public_params();
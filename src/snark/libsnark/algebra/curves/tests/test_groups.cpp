@@ -9,6 +9,8 @@
 #include "algebra/curves/bn128/bn128_pp.hpp"
 #endif
 #include "algebra/curves/alt_bn128/alt_bn128_pp.hpp"
+#include "algebra/scalar_multiplication/multiexp.hpp"
+#include "algebra/scalar_multiplication/wnaf.hpp"
 #include <sstream>
 
 #include <gtest/gtest.h>
@@ -134,6 +136,37 @@ void test_output()
     }
 }
 
+template<typename GroupT>
+void test_batch_to_special_points()
+{
+    std::vector<GroupT> points = { GroupT::random_element(), GroupT::zero(), GroupT::random_element(), GroupT::one() };
+    const std::vector<GroupT> expected(points);
+    std::vector<GroupT*> pointers;
+    for (GroupT &point : points)
+    {
+        pointers.emplace_back(&point);
+    }
+
+    batch_to_special_points<GroupT>(pointers);
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        EXPECT_TRUE(points[i].is_special());
+        EXPECT_EQ(points[i], expected[i]);
+    }
+
+    // Mixed when the point added is special, general when it is not
+    const GroupT a = GroupT::random_element();
+    EXPECT_EQ(add_mixed_if_special(a, points[0]), a + expected[0]);
+    EXPECT_EQ(add_mixed_if_special(a, expected[2]), a + expected[2]);
+    EXPECT_EQ(add_mixed_if_special(a, points[1]), a);
+
+    // Already affine points are left as they are
+    GroupT b = points[2];
+    b.to_affine_coordinates();
+    EXPECT_EQ(b.X, points[2].X);
+    EXPECT_EQ(b.Y, points[2].Y);
+}
+
 TEST(algebra, groups)
 {
     alt_bn128_pp::init_public_params();
@@ -142,6 +175,8 @@ TEST(algebra, groups)
     test_group<G2<alt_bn128_pp> >();
     test_output<G2<alt_bn128_pp> >();
     test_mul_by_q<G2<alt_bn128_pp> >();
+    test_batch_to_special_points<G1<alt_bn128_pp> >();
+    test_batch_to_special_points<G2<alt_bn128_pp> >();
 
 #ifdef CURVE_BN128       // BN128 has fancy dependencies so it may be disabled
     bn128_pp::init_public_params();
@@ -151,3 +186,76 @@ TEST(algebra, groups)
     test_output<G2<bn128_pp> >();
 #endif
 }
+
+template<typename GroupT, typename FieldT>
+void test_multi_exp(const size_t size)
+{
+    std::vector<GroupT> bases;
+    std::vector<FieldT> scalars;
+    for (size_t i = 0; i < size; ++i)
+    {
+        bases.emplace_back(GroupT::random_element());
+        // Bases in special form are added to the buckets with mixed additions
+        if (i % 2 == 0)
+        {
+            bases.back().to_special();
+        }
+        // Repeated and zero scalars share buckets, or leave them empty
+        scalars.emplace_back(i % 7 == 0 ? FieldT::zero() : (i % 5 == 0 ? FieldT::one() : FieldT::random_element()));
+    }
+
+    const GroupT expected = naive_exp<GroupT, FieldT>(bases.begin(), bases.end(), scalars.begin(), scalars.end());
+    EXPECT_EQ((multi_exp<GroupT, FieldT>(bases.begin(), bases.end(), scalars.begin(), scalars.end(), 1, true)), expected);
+    for (size_t num_threads : {1, 3})
+    {
+        EXPECT_EQ((multi_exp_pippenger<GroupT, FieldT>(bases.begin(), bases.end(), scalars.begin(), scalars.end(), num_threads)), expected);
+    }
+}
+
+TEST(algebra, multi_exp)
+{
+    alt_bn128_pp::init_public_params();
+    for (size_t size : {0, 1, 31, 32, 200, 1500})
+    {
+        test_multi_exp<G1<alt_bn128_pp>, Fr<alt_bn128_pp> >(size);
+    }
+    test_multi_exp<G2<alt_bn128_pp>, Fr<alt_bn128_pp> >(1100);
+}
+
+template<typename GroupT, typename FieldT>
+void test_wnaf_multi_exp(const size_t size, const size_t window_size)
+{
+    std::vector<GroupT> bases;
+    std::vector<FieldT> scalars;
+    std::vector<std::vector<GroupT> > tables;
+    std::vector<bigint<FieldT::num_limbs> > bigint_scalars;
+    for (size_t i = 0; i < size; ++i)
+    {
+        bases.emplace_back(i == 3 ? GroupT::zero() : GroupT::random_element());
+        scalars.emplace_back(i % 7 == 0 ? FieldT::zero() : (i % 5 == 0 ? -FieldT::one() : FieldT::random_element()));
+        tables.emplace_back(wnaf_table<GroupT>(window_size, bases.back()));
+        bigint_scalars.emplace_back(scalars.back().as_bigint());
+    }
+
+    std::vector<const std::vector<GroupT>*> table_ptrs;
+    for (const std::vector<GroupT> &table : tables)
+    {
+        table_ptrs.emplace_back(&table);
+    }
+
+    const GroupT expected = naive_exp<GroupT, FieldT>(bases.begin(), bases.end(), scalars.begin(), scalars.end());
+    EXPECT_EQ((wnaf_multi_exp<GroupT, FieldT::num_limbs>(window_size, table_ptrs, bigint_scalars)), expected);
+}
+
+TEST(algebra, wnaf_multi_exp)
+{
+    alt_bn128_pp::init_public_params();
+    for (size_t size : {0, 1, 10})
+    {
+        for (size_t window_size : {2, 5, 7})
+        {
+            test_wnaf_multi_exp<G1<alt_bn128_pp>, Fr<alt_bn128_pp> >(size, window_size);
+        }
+    }
+    test_wnaf_multi_exp<G2<alt_bn128_pp>, Fr<alt_bn128_pp> >(10, 5);
+}
@@ -15,8 +15,28 @@
 #ifndef BASIC_RADIX2_DOMAIN_AUX_HPP_
 #define BASIC_RADIX2_DOMAIN_AUX_HPP_
 
+#include <cstddef>
+
 namespace libsnark {
 
+/**
+ * log2 of the blocks _basic_threaded_radix2_FFT runs the first stages of one
+ * at a time, 128 KB of 256-bit elements so that they stay in the L2 cache.
+ */
+const size_t radix2_FFT_block_log = 12;
+
+/**
+ * Size from which _basic_threaded_radix2_FFT splits each stage across threads.
+ */
+const size_t radix2_FFT_parallel_min_size = 1 << 13;
+
+/**
+ * Number of threads of _basic_threaded_radix2_FFT. 0, the default, is one
+ * per hardware thread.
+ */
+inline void set_radix2_FFT_num_threads(const size_t num_threads);
+inline size_t get_radix2_FFT_num_threads();
+
 /**
  * Compute the radix-2 FFT of the vector a over the set S={omega^{0},...,omega^{m-1}}.
  */
@@ -29,6 +49,15 @@ void _basic_radix2_FFT(std::vector<FieldT> &a, const FieldT &omega);
 template<typename FieldT>
 void _parallel_basic_radix2_FFT(std::vector<FieldT> &a, const FieldT &omega);
 
+/**
+ * A version of _basic_radix2_FFT on std::threads, the one used without MULTICORE.
+ * The stages within blocks of 2^radix2_FFT_block_log elements run block by
+ * block, and the butterflies of each later stage are split into contiguous
+ * ranges, one per thread.
+ */
+template<typename FieldT>
+void _basic_threaded_radix2_FFT(std::vector<FieldT> &a, const FieldT &omega, const size_t num_threads);
+
 /**
  * Translate the vector a to a coset defined by g.
  */
@@ -14,7 +14,10 @@
 #ifndef BASIC_RADIX2_DOMAIN_AUX_TCC_
 #define BASIC_RADIX2_DOMAIN_AUX_TCC_
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <thread>
 #ifdef MULTICORE
 #include <omp.h>
 #endif
@@ -27,9 +30,30 @@ namespace libsnark {
 #ifdef MULTICORE
 #define _basic_radix2_FFT _basic_parallel_radix2_FFT
 #else
-#define _basic_radix2_FFT _basic_serial_radix2_FFT
+#define _basic_radix2_FFT(a, omega) _basic_threaded_radix2_FFT(a, omega, get_radix2_FFT_num_threads())
 #endif
 
+inline std::atomic<size_t>& radix2_FFT_num_threads()
+{
+    static std::atomic<size_t> num_threads(0);
+    return num_threads;
+}
+
+inline void set_radix2_FFT_num_threads(const size_t num_threads)
+{
+    radix2_FFT_num_threads() = num_threads;
+}
+
+inline size_t get_radix2_FFT_num_threads()
+{
+    const size_t num_threads = radix2_FFT_num_threads();
+    if (num_threads != 0)
+    {
+        return num_threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
 /*
  Below we make use of pseudocode from [CLRS 2n Ed, pp. 864].
  Also, note that it's the caller's responsibility to multiply by 1/N.
@@ -168,6 +192,110 @@ void _basic_parallel_radix2_FFT(std::vector<FieldT> &a, const FieldT &omega)
     }
 }
 
+/* f(begin, end) on num_threads contiguous ranges splitting [0, count) */
+template<typename Func>
+void _radix2_FFT_parallel_for(const size_t num_threads, const size_t count, const Func &f)
+{
+    if (num_threads <= 1)
+    {
+        f(0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (size_t i = 1; i < num_threads; ++i)
+    {
+        threads.emplace_back(std::cref(f), count * i / num_threads, count * (i + 1) / num_threads);
+    }
+    f(0, count / num_threads);
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+template<typename FieldT>
+void _basic_threaded_radix2_FFT(std::vector<FieldT> &a, const FieldT &omega, const size_t num_threads)
+{
+    const size_t n = a.size(), logn = log2(n);
+    assert(n == (1u << logn));
+
+    const size_t threads_used = (n < radix2_FFT_parallel_min_size ? 1 : num_threads);
+
+    /* swapping in place (from Storer's book), each pair by the thread of its lower index */
+    _radix2_FFT_parallel_for(threads_used, n, [&a, logn](const size_t begin, const size_t end) {
+        for (size_t k = begin; k < end; ++k)
+        {
+            const size_t rk = bitreverse(k, logn);
+            if (k < rk)
+                std::swap(a[k], a[rk]);
+        }
+    });
+
+    /*
+      The first stages only combine elements within blocks: run them all on a
+      block before the next one, with the twiddles of stage m at m..2m-1.
+    */
+    const size_t block_log = std::min(logn, radix2_FFT_block_log);
+    const size_t block = UINT64_C(1) << block_log;
+    std::vector<FieldT> twiddles(block);
+    for (size_t m = 1; m < block; m *= 2)
+    {
+        const FieldT w_m = omega^(n/(2*m));
+        FieldT w = FieldT::one();
+        for (size_t j = 0; j < m; ++j)
+        {
+            twiddles[m + j] = w;
+            w *= w_m;
+        }
+    }
+
+    const size_t num_blocks = n / block;
+    _radix2_FFT_parallel_for(std::min(threads_used, num_blocks), num_blocks, [&a, &twiddles, block](const size_t begin, const size_t end) {
+        for (size_t b = begin; b < end; ++b)
+        {
+            FieldT *x = &a[b * block];
+            for (size_t m = 1; m < block; m *= 2)
+            {
+                for (size_t k = 0; k < block; k += 2*m)
+                {
+                    for (size_t j = 0; j < m; ++j)
+                    {
+                        const FieldT t = twiddles[m + j] * x[k+j+m];
+                        x[k+j+m] = x[k+j] - t;
+                        x[k+j] += t;
+                    }
+                }
+            }
+        }
+    });
+
+    /* the later stages, their n/2 butterflies in ranges of consecutive ones */
+    for (size_t m = block; m < n; m *= 2)
+    {
+        const FieldT w_m = omega^(n/(2*m));
+        _radix2_FFT_parallel_for(threads_used, n/2, [&a, &w_m, m](const size_t begin, const size_t end) {
+            size_t k = (begin / m) * 2*m;
+            size_t j = begin % m;
+            FieldT w = w_m^j;
+            for (size_t i = begin; i < end; ++i)
+            {
+                const FieldT t = w * a[k+j+m];
+                a[k+j+m] = a[k+j] - t;
+                a[k+j] += t;
+                w *= w_m;
+                if (++j == m)
+                {
+                    j = 0;
+                    k += 2*m;
+                    w = FieldT::one();
+                }
+            }
+        });
+    }
+}
+
 template<typename FieldT>
 void _multiply_by_coset(std::vector<FieldT> &a, const FieldT &g)
 {
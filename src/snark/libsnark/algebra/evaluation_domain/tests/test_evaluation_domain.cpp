@@ -0,0 +1,76 @@
+/**
+ *****************************************************************************
+ * @author     This file is part of libsnark, developed by SCIPR Lab
+ *             and contributors (see AUTHORS).
+ * @copyright  MIT license (see LICENSE file)
+ *****************************************************************************/
+#include <vector>
+
+#include "algebra/curves/alt_bn128/alt_bn128_pp.hpp"
+#include "algebra/evaluation_domain/evaluation_domain.hpp"
+#include "algebra/fields/field_utils.hpp"
+#include "common/profiling.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace libsnark;
+
+template<typename FieldT>
+void test_threaded_radix2_FFT()
+{
+    for (size_t logn = 0; logn <= 15; ++logn)
+    {
+        const size_t n = UINT64_C(1) << logn;
+        const FieldT omega = get_root_of_unity<FieldT>(n);
+
+        std::vector<FieldT> a(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            a[i] = FieldT::random_element();
+        }
+
+        std::vector<FieldT> expected(a);
+        _basic_serial_radix2_FFT(expected, omega);
+
+        for (size_t num_threads = 1; num_threads <= 3; ++num_threads)
+        {
+            std::vector<FieldT> b(a);
+            _basic_threaded_radix2_FFT(b, omega, num_threads);
+            EXPECT_EQ(b, expected) << "n = " << n << ", " << num_threads << " threads";
+        }
+    }
+}
+
+template<typename FieldT>
+void test_radix2_domain_roundtrip(const size_t m)
+{
+    basic_radix2_domain<FieldT> domain(m);
+    std::vector<FieldT> a(m);
+    for (size_t i = 0; i < m; ++i)
+    {
+        a[i] = FieldT::random_element();
+    }
+
+    std::vector<FieldT> b(a);
+    domain.FFT(b);
+    domain.iFFT(b);
+    EXPECT_EQ(b, a);
+
+    const FieldT g = FieldT::multiplicative_generator;
+    domain.cosetFFT(b, g);
+    domain.icosetFFT(b, g);
+    EXPECT_EQ(b, a);
+}
+
+TEST(algebra, radix2_FFT)
+{
+    start_profiling();
+    alt_bn128_pp::init_public_params();
+
+    test_threaded_radix2_FFT<alt_bn128_Fr>();
+
+    set_radix2_FFT_num_threads(2);
+    test_radix2_domain_roundtrip<alt_bn128_Fr>(1 << 14);
+    set_radix2_FFT_num_threads(0);
+    test_radix2_domain_roundtrip<alt_bn128_Fr>(1 << 14);
+}
@@ -22,6 +22,14 @@ namespace libsnark {
 template<mp_size_t n, const bigint<n>& modulus>
 void Fp_model<n,modulus>::mul_reduce(const bigint<n> &other)
 {
+#if defined(__x86_64__)
+    if (n == 4 && cpu_has_bmi2_adx())
+    { // MULX with two carry chains, on the CPUs which have it
+        mont_mul_4_limbs_adx(this->mont_repr.data, this->mont_repr.data, other.data, modulus.data, inv);
+        return;
+    }
+#endif
+
     /* stupid pre-processor tricks; beware */
 #if defined(__x86_64__) && defined(USE_ASM)
     if (n == 3)
@@ -1,7 +1,9 @@
 /** @file
  *****************************************************************************
  Assembly code snippets for F[p] finite field arithmetic, used by fp.tcc .
- Specific to x86-64, and used only if USE_ASM is defined.
+ Specific to x86-64, and used only if USE_ASM is defined, except for the
+ 4-limb Montgomery multiplication with MULX/ADCX/ADOX, which fp.tcc selects
+ at runtime on the CPUs with BMI2 and ADX.
  On other architectures or without USE_ASM, fp.tcc uses a portable
  C++ implementation instead.
  *****************************************************************************
@@ -13,6 +15,10 @@
 #ifndef FP_AUX_TCC_
 #define FP_AUX_TCC_
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
 namespace libsnark {
 
 #define STR_HELPER(x) #x
@@ -385,5 +391,82 @@ namespace libsnark {
          : [modprime] "r" (inv_), [res] "r" (res_), [mod] "r" (mod_) \
          : "%rax", "%rdx", "cc", "memory")
 
+#if defined(__x86_64__)
+/*
+  Whether the CPU has MULX (BMI2) and ADCX/ADOX (ADX), checked once.
+*/
+inline bool cpu_has_bmi2_adx()
+{
+    static const bool supported = []() {
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, NULL) < 7)
+        {
+            return false;
+        }
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        return (ebx & bit_BMI2) != 0 && (ebx & bit_ADX) != 0;
+    }();
+    return supported;
+}
+
+/*
+  t[0..5] += x * y[0..3], with the carries of the low halves of the products
+  on OF (ADOX) and those of the high halves on CF (ADCX), so that the two
+  chains run interleaved.
+*/
+inline void mulx_addmul_4(mp_limb_t &t0, mp_limb_t &t1, mp_limb_t &t2, mp_limb_t &t3, mp_limb_t &t4, mp_limb_t &t5,
+                          const mp_limb_t x, const mp_limb_t *y)
+{
+    mp_limb_t lo, hi, zero;
+    __asm__
+        ("xorl   %k[zero], %k[zero]          \n\t" // also clears CF and OF
+         "mulxq  0(%[y]), %[lo], %[hi]       \n\t"
+         "adoxq  %[lo], %[t0]                \n\t"
+         "adcxq  %[hi], %[t1]                \n\t"
+         "mulxq  8(%[y]), %[lo], %[hi]       \n\t"
+         "adoxq  %[lo], %[t1]                \n\t"
+         "adcxq  %[hi], %[t2]                \n\t"
+         "mulxq  16(%[y]), %[lo], %[hi]      \n\t"
+         "adoxq  %[lo], %[t2]                \n\t"
+         "adcxq  %[hi], %[t3]                \n\t"
+         "mulxq  24(%[y]), %[lo], %[hi]      \n\t"
+         "adoxq  %[lo], %[t3]                \n\t"
+         "adcxq  %[hi], %[t4]                \n\t"
+         "adcxq  %[zero], %[t5]              \n\t"
+         "adoxq  %[zero], %[t4]              \n\t"
+         "adoxq  %[zero], %[t5]              \n\t"
+         : [t0] "+&r" (t0), [t1] "+&r" (t1), [t2] "+&r" (t2), [t3] "+&r" (t3), [t4] "+&r" (t4), [t5] "+&r" (t5),
+           [lo] "=&r" (lo), [hi] "=&r" (hi), [zero] "=&r" (zero)
+         : "d" (x), [y] "r" (y), "m" (*(const mp_limb_t (*)[4]) y)
+         : "cc");
+}
+
+/*
+  res = a * b * 2^-256 mod m, for a, b < m, with the "CIOS method" of
+  Koc, Acar and Kaliski, "Analyzing and comparing Montgomery multiplication
+  algorithms", IEEE Micro '96. Requires BMI2 and ADX; res may alias a or b.
+*/
+inline void mont_mul_4_limbs_adx(mp_limb_t *res, const mp_limb_t *a, const mp_limb_t *b, const mp_limb_t *m, const mp_limb_t inv)
+{
+    mp_limb_t t0 = 0, t1 = 0, t2 = 0, t3 = 0, t4 = 0, t5 = 0;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        mulx_addmul_4(t0, t1, t2, t3, t4, t5, a[i], b);
+        // t0 + u * m[0] is 0 mod 2^64, so the sum is shifted by a limb
+        const mp_limb_t u = t0 * inv;
+        mulx_addmul_4(t0, t1, t2, t3, t4, t5, u, m);
+        t0 = t1; t1 = t2; t2 = t3; t3 = t4; t4 = t5; t5 = 0;
+    }
+
+    mp_limb_t t[4] = {t0, t1, t2, t3};
+    // t < 2m
+    if (t4 != 0 || mpn_cmp(t, m, 4) >= 0)
+    {
+        mpn_sub_n(t, t, m, 4);
+    }
+    mpn_copyi(res, t, 4);
+}
+#endif
+
 } // libsnark
 #endif // FP_AUX_TCC_
@@ -176,12 +176,57 @@ void test_Fp4_tom_cook()
     }
 }
 
+#if defined(__x86_64__)
+template<typename FieldT>
+void test_mont_mul_4_limbs_adx()
+{
+    if (!cpu_has_bmi2_adx())
+    {
+        return;
+    }
+
+    mpz_t p, r_inv, x, y, expected;
+    mpz_inits(p, r_inv, x, y, expected, NULL);
+    FieldT::mod.to_mpz(p);
+    mpz_setbit(r_inv, 64 * 4);
+    mpz_invert(r_inv, r_inv, p);
+
+    std::vector<FieldT> values = {FieldT::zero(), FieldT::one(), -FieldT::one()};
+    for (size_t i = 0; i < 100; ++i)
+    {
+        values.emplace_back(FieldT::random_element());
+    }
+    for (const FieldT &a : values)
+    {
+        for (const FieldT &b : values)
+        {
+            // x * y / R mod p, on the Montgomery representations
+            a.mont_repr.to_mpz(x);
+            b.mont_repr.to_mpz(y);
+            mpz_mul(expected, x, y);
+            mpz_mul(expected, expected, r_inv);
+            mpz_mod(expected, expected, p);
+
+            bigint<4> result;
+            mont_mul_4_limbs_adx(result.data, a.mont_repr.data, b.mont_repr.data, FieldT::mod.data, FieldT::inv);
+            EXPECT_EQ(result, bigint<4>(expected));
+        }
+    }
+
+    mpz_clears(p, r_inv, x, y, expected, NULL);
+}
+#endif
+
 TEST(algebra, fields)
 {
     alt_bn128_pp::init_public_params();
     test_field<alt_bn128_Fq6>();
     test_Frobenius<alt_bn128_Fq6>();
     test_all_fields<alt_bn128_pp>();
+#if defined(__x86_64__)
+    test_mont_mul_4_limbs_adx<alt_bn128_Fq>();
+    test_mont_mul_4_limbs_adx<alt_bn128_Fr>();
+#endif
 
 #ifdef CURVE_BN128       // BN128 has fancy dependencies so it may be disabled
     bn128_pp::init_public_params();
@@ -44,8 +44,10 @@ struct knowledge_commitment {
     knowledge_commitment<T1,T2>& operator=(const knowledge_commitment<T1,T2> &other) = default;
     knowledge_commitment<T1,T2>& operator=(knowledge_commitment<T1,T2> &&other) = default;
     knowledge_commitment<T1,T2> operator+(const knowledge_commitment<T1, T2> &other) const;
+    knowledge_commitment<T1,T2> mixed_add(const knowledge_commitment<T1, T2> &other) const;
 
     bool is_zero() const;
+    bool is_special() const;
     bool operator==(const knowledge_commitment<T1,T2> &other) const;
     bool operator!=(const knowledge_commitment<T1,T2> &other) const;
 
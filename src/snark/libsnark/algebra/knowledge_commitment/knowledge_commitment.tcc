@@ -43,12 +43,25 @@ knowledge_commitment<T1,T2> knowledge_commitment<T1,T2>::operator+(const knowled
                                        this->h + other.h);
 }
 
+template<typename T1, typename T2>
+knowledge_commitment<T1,T2> knowledge_commitment<T1,T2>::mixed_add(const knowledge_commitment<T1,T2> &other) const
+{
+    return knowledge_commitment<T1,T2>(this->g.mixed_add(other.g),
+                                       this->h.mixed_add(other.h));
+}
+
 template<typename T1, typename T2>
 bool knowledge_commitment<T1,T2>::is_zero() const
 {
     return (g.is_zero() && h.is_zero());
 }
 
+template<typename T1, typename T2>
+bool knowledge_commitment<T1,T2>::is_special() const
+{
+    return (g.is_special() && h.is_special());
+}
+
 template<typename T1, typename T2>
 bool knowledge_commitment<T1,T2>::operator==(const knowledge_commitment<T1,T2> &other) const
 {
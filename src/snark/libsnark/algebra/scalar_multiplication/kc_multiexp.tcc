@@ -8,6 +8,8 @@
 #ifndef KC_MULTIEXP_TCC_
 #define KC_MULTIEXP_TCC_
 
+#include "algebra/curves/curve_utils.hpp"
+
 namespace libsnark {
 
 template<typename T1, typename T2, mp_size_t n>
@@ -65,8 +67,8 @@ knowledge_commitment<T1, T2> kc_multi_exp_with_mixed_addition(const knowledge_co
             acc.g = acc.g.mixed_add(value_it->g);
             acc.h = acc.h.mixed_add(value_it->h);
 #else
-            acc.g = acc.g + value_it->g;
-            acc.h = acc.h + value_it->h;
+            acc.g = add_mixed_if_special(acc.g, value_it->g);
+            acc.h = add_mixed_if_special(acc.h, value_it->h);
 #endif
             ++num_add;
         }
@@ -12,8 +12,24 @@
 #ifndef MULTIEXP_HPP_
 #define MULTIEXP_HPP_
 
+#include <cstddef>
+
 namespace libsnark {
 
+/**
+ * Inputs from which multi_exp uses the bucket method instead of Bos-Coster,
+ * and from which it splits the buckets of the windows across threads.
+ */
+const size_t multi_exp_pippenger_min_size = 32;
+const size_t multi_exp_parallel_min_size = 1024;
+
+/**
+ * Number of threads of the parallel multi-exponentiations. 0, the default,
+ * is one per hardware thread.
+ */
+inline void set_multi_exp_num_threads(const size_t num_threads);
+inline size_t get_multi_exp_num_threads();
+
 /**
  * Naive multi-exponentiation individually multiplies each base by the
  * corresponding scalar and adds up the results.
@@ -46,6 +62,22 @@ T multi_exp(typename std::vector<T>::const_iterator vec_start,
             const bool use_multiexp=false);
 
 
+/**
+ * Multi-exponentiation with the bucket method of Pippenger [1], as described in [2].
+ * Each scalar is split into windows of c bits; in each window, the bases are added
+ * into the bucket of their digit, and the buckets are summed with running sums.
+ * The windows are independent, and are computed on up to num_threads threads.
+ *
+ * [1] = Pippenger, "On the evaluation of powers and related problems", FOCS '76
+ * [2] = Bernstein, Doumen, Lange, and Oosterwijk, "Faster batch forgery identification", INDOCRYPT '12
+ */
+template<typename T, typename FieldT>
+T multi_exp_pippenger(typename std::vector<T>::const_iterator vec_start,
+                      typename std::vector<T>::const_iterator vec_end,
+                      typename std::vector<FieldT>::const_iterator scalar_start,
+                      typename std::vector<FieldT>::const_iterator scalar_end,
+                      const size_t num_threads);
+
 /**
  * A variant of multi_exp that takes advantage of the method mixed_add (instead of the operator '+').
  */
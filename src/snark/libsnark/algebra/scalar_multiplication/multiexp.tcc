@@ -17,15 +17,39 @@
 #include "algebra/fields/fp_aux.tcc"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <thread>
 #include <type_traits>
 
 #include "common/profiling.hpp"
 #include "common/utils.hpp"
+#include "algebra/curves/curve_utils.hpp"
 #include "algebra/scalar_multiplication/wnaf.hpp"
 
 namespace libsnark {
 
+inline std::atomic<size_t>& multi_exp_num_threads()
+{
+    static std::atomic<size_t> num_threads(0);
+    return num_threads;
+}
+
+inline void set_multi_exp_num_threads(const size_t num_threads)
+{
+    multi_exp_num_threads() = num_threads;
+}
+
+inline size_t get_multi_exp_num_threads()
+{
+    const size_t num_threads = multi_exp_num_threads();
+    if (num_threads != 0)
+    {
+        return num_threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
 template<mp_size_t n>
 class ordered_exponent {
 // to use std::push_heap and friends later
@@ -266,6 +290,120 @@ T multi_exp_inner(typename std::vector<T>::const_iterator vec_start,
     return opt_result;
 }
 
+template<typename T, typename FieldT>
+T multi_exp_pippenger(typename std::vector<T>::const_iterator vec_start,
+                      typename std::vector<T>::const_iterator vec_end,
+                      typename std::vector<FieldT>::const_iterator scalar_start,
+                      typename std::vector<FieldT>::const_iterator scalar_end,
+                      const size_t num_threads)
+{
+    const mp_size_t n = std::remove_reference<decltype(*scalar_start)>::type::num_limbs;
+
+    const size_t length = vec_end - vec_start;
+    assert(length == (size_t)(scalar_end - scalar_start));
+    if (length == 0)
+    {
+        return T::zero();
+    }
+
+    std::vector<bigint<n> > exponents;
+    exponents.reserve(length);
+    size_t num_bits = 0;
+    for (auto scalar_it = scalar_start; scalar_it != scalar_end; ++scalar_it)
+    {
+        exponents.emplace_back(scalar_it->as_bigint());
+        num_bits = std::max(num_bits, exponents.back().num_bits());
+    }
+    if (num_bits == 0)
+    {
+        return T::zero();
+    }
+
+    // About log2(length) - 2 bits per window balances the additions to the
+    // buckets, one per base and window, with the 2^c of the running sums
+    size_t c = 3;
+    while (c < 16 && (UINT64_C(1) << (c + 3)) <= length)
+    {
+        ++c;
+    }
+    const size_t num_windows = (num_bits + c - 1) / c;
+    std::vector<T> window_sums(num_windows, T::zero());
+
+    const auto compute_window = [&](const size_t w) {
+        std::vector<T> buckets((UINT64_C(1) << c) - 1, T::zero());
+        const size_t first_bit = w * c;
+        const size_t limb = first_bit / GMP_NUMB_BITS;
+        const size_t shift = first_bit % GMP_NUMB_BITS;
+        const mp_limb_t mask = (UINT64_C(1) << c) - 1;
+        for (size_t i = 0; i < length; ++i)
+        {
+            mp_limb_t digit = exponents[i].data[limb] >> shift;
+            if (shift + c > GMP_NUMB_BITS && limb + 1 < (size_t)n)
+            {
+                digit |= exponents[i].data[limb + 1] << (GMP_NUMB_BITS - shift);
+            }
+            digit &= mask;
+            if (digit != 0)
+            {
+                buckets[digit - 1] = add_mixed_if_special(buckets[digit - 1], *(vec_start + i));
+            }
+        }
+
+        // sum_j j * buckets[j-1] = sum_j (buckets[j-1] + ... + buckets[top])
+        T running_sum = T::zero();
+        T window_sum = T::zero();
+        for (size_t j = buckets.size(); j-- > 0; )
+        {
+            running_sum = running_sum + buckets[j];
+            window_sum = window_sum + running_sum;
+        }
+        window_sums[w] = window_sum;
+    };
+
+    const size_t threads_used = (length < multi_exp_parallel_min_size ? 1 : std::min(num_threads, num_windows));
+    if (threads_used <= 1)
+    {
+        for (size_t w = 0; w < num_windows; ++w)
+        {
+            compute_window(w);
+        }
+    }
+    else
+    {
+        // Each thread takes the next window left
+        std::atomic<size_t> next_window(0);
+        const auto worker = [&]() {
+            for (size_t w = next_window++; w < num_windows; w = next_window++)
+            {
+                compute_window(w);
+            }
+        };
+        std::vector<std::thread> threads;
+        threads.reserve(threads_used - 1);
+        for (size_t i = 1; i < threads_used; ++i)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    T result = window_sums[num_windows - 1];
+    for (size_t w = num_windows - 1; w-- > 0; )
+    {
+        for (size_t b = 0; b < c; ++b)
+        {
+            result = result + result;
+        }
+        result = result + window_sums[w];
+    }
+
+    return result;
+}
+
 template<typename T, typename FieldT>
 T multi_exp(typename std::vector<T>::const_iterator vec_start,
             typename std::vector<T>::const_iterator vec_end,
@@ -275,6 +413,12 @@ T multi_exp(typename std::vector<T>::const_iterator vec_start,
             const bool use_multiexp)
 {
     const size_t total = vec_end - vec_start;
+    if (use_multiexp && total >= multi_exp_pippenger_min_size)
+    {
+        return multi_exp_pippenger<T, FieldT>(vec_start, vec_end, scalar_start, scalar_end,
+                                              std::max(chunks, get_multi_exp_num_threads()));
+    }
+
     if (total < chunks)
     {
         return naive_exp<T, FieldT>(vec_start, vec_end, scalar_start, scalar_end);
@@ -357,7 +501,7 @@ T multi_exp_with_mixed_addition(typename std::vector<T>::const_iterator vec_star
 #ifdef USE_MIXED_ADDITION
             acc = acc.mixed_add(*value_it);
 #else
-            acc = acc + (*value_it);
+            acc = add_mixed_if_special(acc, *value_it);
 #endif
             ++num_add;
         }
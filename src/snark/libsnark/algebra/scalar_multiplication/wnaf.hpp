@@ -32,6 +32,24 @@ T fixed_window_wnaf_exp(const size_t window_size, const T &base, const bigint<n>
 template<typename T, mp_size_t n>
 T opt_window_wnaf_exp(const T &base, const bigint<n> &scalar, const size_t scalar_bits);
 
+/**
+ * The odd multiples base, 3 * base, ..., (2^window_size - 1) * base which wNAF
+ * exponentiation adds, in special form, computed once for a base multiplied by
+ * many scalars.
+ */
+template<typename T>
+std::vector<T> wnaf_table(const size_t window_size, const T &base);
+
+/**
+ * In additive notation, compute sum_i scalars[i] * base_i from the wnaf_table
+ * of each base_i, computed with the given window size. All the terms share the
+ * same doublings.
+ */
+template<typename T, mp_size_t n>
+T wnaf_multi_exp(const size_t window_size,
+                 const std::vector<const std::vector<T>*> &tables,
+                 const std::vector<bigint<n> > &scalars);
+
 } // libsnark
 
 #include "algebra/scalar_multiplication/wnaf.tcc"
@@ -14,6 +14,8 @@
 #ifndef WNAF_TCC_
 #define WNAF_TCC_
 
+#include "algebra/curves/curve_utils.hpp"
+
 namespace libsnark {
 
 template<mp_size_t n>
@@ -118,6 +120,74 @@ T opt_window_wnaf_exp(const T &base, const bigint<n> &scalar, const size_t scala
     }
 }
 
+template<typename T>
+std::vector<T> wnaf_table(const size_t window_size, const T &base)
+{
+    std::vector<T> table(UINT64_C(1)<<(window_size-1));
+    T tmp = base;
+    T dbl = base.dbl();
+    for (size_t i = 0; i < UINT64_C(1)<<(window_size-1); ++i)
+    {
+        table[i] = tmp;
+        tmp = tmp + dbl;
+    }
+
+    if (!base.is_zero())
+    {
+        // the odd multiples of a point of prime order are not zero
+        batch_to_special_all_non_zeros<T>(table);
+    }
+
+    return table;
+}
+
+template<typename T, mp_size_t n>
+T wnaf_multi_exp(const size_t window_size,
+                 const std::vector<const std::vector<T>*> &tables,
+                 const std::vector<bigint<n> > &scalars)
+{
+    assert(tables.size() == scalars.size());
+
+    std::vector<std::vector<int64_t> > nafs;
+    nafs.reserve(scalars.size());
+    size_t length = 0;
+    for (const bigint<n> &scalar : scalars)
+    {
+        nafs.emplace_back(find_wnaf(window_size, scalar));
+        length = std::max(length, nafs.back().size());
+    }
+
+    T res = T::zero();
+    bool found_nonzero = false;
+    for (int64_t i = length-1; i >= 0; --i)
+    {
+        if (found_nonzero)
+        {
+            res = res.dbl();
+        }
+
+        for (size_t j = 0; j < nafs.size(); ++j)
+        {
+            const int64_t digit = ((size_t) i < nafs[j].size() ? nafs[j][i] : 0);
+            if (digit != 0)
+            {
+                found_nonzero = true;
+                const std::vector<T> &table = *tables[j];
+                if (digit > 0)
+                {
+                    res = add_mixed_if_special(res, table[digit/2]);
+                }
+                else
+                {
+                    res = add_mixed_if_special(res, -table[(-digit)/2]);
+                }
+            }
+        }
+    }
+
+    return res;
+}
+
 } // libsnark
 
 #endif // WNAF_TCC_
@@ -12,6 +12,7 @@
  *****************************************************************************/
 
 #include "common/profiling.hpp"
+#include <atomic>
 #include <cassert>
 #include <stdexcept>
 #include <chrono>
@@ -73,6 +74,10 @@ static size_t indentation = 0;
 
 static std::vector<std::string> block_names;
 
+static std::atomic<block_time_hook> time_hook(nullptr);
+// enter times of the blocks open on this thread, for time_hook
+static thread_local std::vector<int64_t> hook_enter_times;
+
 static std::list<std::pair<std::string, int64_t*> > op_data_points = {
 #ifdef PROFILE_OP_COUNTS
     std::make_pair("Fradd", &Fr<default_ec_pp>::add_cnt),
@@ -240,8 +245,18 @@ void op_profiling_enter(const std::string &msg)
     }
 }
 
+void set_block_time_hook(block_time_hook hook)
+{
+    time_hook = hook;
+}
+
 void enter_block(const std::string &msg, const bool indent)
 {
+    if (time_hook.load() != nullptr)
+    {
+        hook_enter_times.emplace_back(get_nsec_time());
+    }
+
     if (inhibit_profiling_counters)
     {
         return;
@@ -279,6 +294,14 @@ void enter_block(const std::string &msg, const bool indent)
 
 void leave_block(const std::string &msg, const bool indent)
 {
+    const block_time_hook hook = time_hook.load();
+    if (hook != nullptr && !hook_enter_times.empty())
+    {
+        const int64_t nsec = get_nsec_time() - hook_enter_times.back();
+        hook_enter_times.pop_back();
+        hook(msg, nsec);
+    }
+
     if (inhibit_profiling_counters)
     {
         return;
@@ -15,6 +15,7 @@
 #define PROFILING_HPP_
 
 #include <cstddef>
+#include <cstdint>
 #include <map>
 #include <string>
 #include <vector>
@@ -43,6 +44,14 @@ void print_cumulative_op_counts(const bool only_fq=false);
 void enter_block(const std::string &msg, const bool indent=true);
 void leave_block(const std::string &msg, const bool indent=true);
 
+/*
+ * Called by leave_block with the name of the block and its wall-clock time in
+ * nanoseconds, on the thread which ran it, whether or not the profiling
+ * counters are inhibited. The hook is set once, before the blocks it times.
+ */
+typedef void (*block_time_hook)(const std::string &msg, const int64_t nsec);
+void set_block_time_hook(block_time_hook hook);
+
 void print_mem(const std::string &s = "");
 void print_compilation_info();
 
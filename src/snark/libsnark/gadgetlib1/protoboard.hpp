@@ -39,6 +39,8 @@ public:
     protoboard();
 
     void clear_values();
+    /* make room for the values of num_variables variables, not counting the constant 1 */
+    void reserve_variables(const size_t num_variables);
 
     FieldT& val(const pb_variable<FieldT> &var);
     FieldT val(const pb_variable<FieldT> &var) const;
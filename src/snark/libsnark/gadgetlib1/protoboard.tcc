@@ -33,6 +33,12 @@ void protoboard<FieldT>::clear_values()
     std::fill(values.begin(), values.end(), FieldT::zero());
 }
 
+template<typename FieldT>
+void protoboard<FieldT>::reserve_variables(const size_t num_variables)
+{
+    values.reserve(num_variables);
+}
+
 template<typename FieldT>
 var_index_t protoboard<FieldT>::allocate_var_index(const std::string &annotation)
 {
@@ -242,6 +242,9 @@ public:
     G2_precomp<ppT> vk_gamma_beta_g2_precomp;
 
     accumulation_vector<G1<ppT> > encoded_IC_query;
+    /* The wNAF tables of the bases of encoded_IC_query.rest, derived from it
+       and neither serialized nor compared */
+    std::vector<std::vector<G1<ppT> > > encoded_IC_query_wnaf_tables;
 
     bool operator==(const r1cs_ppzksnark_processed_verification_key &other) const;
     friend std::ostream& operator<< <ppT>(std::ostream &out, const r1cs_ppzksnark_processed_verification_key<ppT> &pvk);
@@ -398,7 +401,7 @@ r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover(const r1cs_ppzksnark_proving_key
                                                 const r1cs_ppzksnark_constraint_system<ppT> &constraint_system);
 
 template<typename ppT>
-r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover_streaming(std::ifstream &proving_key_file,
+r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover_streaming(std::istream &proving_key_file,
                                                           const r1cs_ppzksnark_primary_input<ppT> &primary_input,
                                                           const r1cs_ppzksnark_auxiliary_input<ppT> &auxiliary_input,
                                                           const r1cs_ppzksnark_constraint_system<ppT> &constraint_system);
@@ -443,6 +446,28 @@ bool r1cs_ppzksnark_verifier_strong_IC(const r1cs_ppzksnark_verification_key<ppT
 template<typename ppT>
 r1cs_ppzksnark_processed_verification_key<ppT> r1cs_ppzksnark_verifier_process_vk(const r1cs_ppzksnark_verification_key<ppT> &vk);
 
+/**
+ * The window of the wNAF tables of the input consistency bases in a processed
+ * verification key, 2^6 multiples of each of the bases.
+ */
+const size_t r1cs_ppzksnark_IC_wnaf_window = 7;
+
+/**
+ * Compute the wNAF tables of the input consistency bases of pvk.
+ */
+template<typename ppT>
+void r1cs_ppzksnark_precompute_IC_tables(r1cs_ppzksnark_processed_verification_key<ppT> &pvk);
+
+/**
+ * The input consistency term of the verification of a proof for the primary
+ * input: the first element of pvk.encoded_IC_query plus the multi-exponentiation
+ * of the bases of the other ones by primary_input, computed from their wNAF
+ * tables.
+ */
+template<typename ppT>
+G1<ppT> r1cs_ppzksnark_accumulate_IC(const r1cs_ppzksnark_processed_verification_key<ppT> &pvk,
+                                     const r1cs_ppzksnark_primary_input<ppT> &primary_input);
+
 /**
  * A verifier algorithm for the R1CS ppzkSNARK that:
  * (1) accepts a processed verification key, and
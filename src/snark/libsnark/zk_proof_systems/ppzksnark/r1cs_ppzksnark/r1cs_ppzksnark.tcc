@@ -24,6 +24,7 @@ See r1cs_ppzksnark.hpp .
 #include "common/utils.hpp"
 #include "algebra/scalar_multiplication/multiexp.hpp"
 #include "algebra/scalar_multiplication/kc_multiexp.hpp"
+#include "algebra/scalar_multiplication/wnaf.hpp"
 #include "reductions/r1cs_to_qap/r1cs_to_qap.hpp"
 
 namespace libsnark {
@@ -165,6 +166,8 @@ std::istream& operator>>(std::istream &in, r1cs_ppzksnark_processed_verification
     in >> pvk.encoded_IC_query;
     consume_OUTPUT_NEWLINE(in);
 
+    r1cs_ppzksnark_precompute_IC_tables<ppT>(pvk);
+
     return in;
 }
 
@@ -585,7 +588,7 @@ r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover(const r1cs_ppzksnark_proving_key
 }
 
 template <typename ppT>
-r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover_streaming(std::ifstream &proving_key_file,
+r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover_streaming(std::istream &proving_key_file,
                                                           const r1cs_ppzksnark_primary_input<ppT> &primary_input,
                                                           const r1cs_ppzksnark_auxiliary_input<ppT> &auxiliary_input,
                                                           const r1cs_ppzksnark_constraint_system<ppT> &constraint_system)
@@ -670,12 +673,53 @@ r1cs_ppzksnark_processed_verification_key<ppT> r1cs_ppzksnark_verifier_process_v
     pvk.vk_gamma_beta_g2_precomp = ppT::precompute_G2(vk.gamma_beta_g2);
 
     pvk.encoded_IC_query = vk.encoded_IC_query;
+    r1cs_ppzksnark_precompute_IC_tables<ppT>(pvk);
 
     leave_block("Call to r1cs_ppzksnark_verifier_process_vk");
 
     return pvk;
 }
 
+template <typename ppT>
+void r1cs_ppzksnark_precompute_IC_tables(r1cs_ppzksnark_processed_verification_key<ppT> &pvk)
+{
+    const std::vector<G1<ppT> > &bases = pvk.encoded_IC_query.rest.values;
+
+    pvk.encoded_IC_query_wnaf_tables.clear();
+    pvk.encoded_IC_query_wnaf_tables.reserve(bases.size());
+    for (const G1<ppT> &base : bases)
+    {
+        pvk.encoded_IC_query_wnaf_tables.emplace_back(wnaf_table<G1<ppT> >(r1cs_ppzksnark_IC_wnaf_window, base));
+    }
+}
+
+template <typename ppT>
+G1<ppT> r1cs_ppzksnark_accumulate_IC(const r1cs_ppzksnark_processed_verification_key<ppT> &pvk,
+                                     const r1cs_ppzksnark_primary_input<ppT> &primary_input)
+{
+    const sparse_vector<G1<ppT> > &rest = pvk.encoded_IC_query.rest;
+    if (pvk.encoded_IC_query_wnaf_tables.size() != rest.values.size())
+    {
+        // a key filled in without r1cs_ppzksnark_precompute_IC_tables
+        return pvk.encoded_IC_query.template accumulate_chunk<Fr<ppT> >(primary_input.begin(), primary_input.end(), 0).first;
+    }
+
+    std::vector<const std::vector<G1<ppT> >*> tables;
+    std::vector<bigint<Fr<ppT>::num_limbs> > scalars;
+    tables.reserve(rest.indices.size());
+    scalars.reserve(rest.indices.size());
+    for (size_t i = 0; i < rest.indices.size(); ++i)
+    {
+        if (rest.indices[i] < primary_input.size() && !primary_input[rest.indices[i]].is_zero())
+        {
+            tables.emplace_back(&pvk.encoded_IC_query_wnaf_tables[i]);
+            scalars.emplace_back(primary_input[rest.indices[i]].as_bigint());
+        }
+    }
+
+    return pvk.encoded_IC_query.first + wnaf_multi_exp<G1<ppT>, Fr<ppT>::num_limbs>(r1cs_ppzksnark_IC_wnaf_window, tables, scalars);
+}
+
 template <typename ppT>
 bool r1cs_ppzksnark_online_verifier_weak_IC(const r1cs_ppzksnark_processed_verification_key<ppT> &pvk,
                                             const r1cs_ppzksnark_primary_input<ppT> &primary_input,
@@ -683,39 +727,44 @@ bool r1cs_ppzksnark_online_verifier_weak_IC(const r1cs_ppzksnark_processed_verif
 {
     assert(pvk.encoded_IC_query.domain_size() >= primary_input.size());
 
-    const accumulation_vector<G1<ppT> > accumulated_IC = pvk.encoded_IC_query.template accumulate_chunk<Fr<ppT> >(primary_input.begin(), primary_input.end(), 0);
-    const G1<ppT> &acc = accumulated_IC.first;
+    const G1<ppT> acc = r1cs_ppzksnark_accumulate_IC<ppT>(pvk, primary_input);
 
     if (!proof.is_well_formed())
     {
         return false;
     }
 
+    /*
+      Each check is that a product of pairings is one: e(P, Q) / e(R, S) is
+      computed as e(P, Q) * e(-R, S), the Miller loops of all the pairings of
+      a check running together, against the lines precomputed in pvk for all
+      but g^B, with a single final exponentiation.
+    */
     G1_precomp<ppT> proof_g_A_g_precomp      = ppT::precompute_G1(proof.g_A.g);
-    G1_precomp<ppT> proof_g_A_h_precomp = ppT::precompute_G1(proof.g_A.h);
-    Fqk<ppT> kc_A_1 = ppT::miller_loop(proof_g_A_g_precomp,      pvk.vk_alphaA_g2_precomp);
-    Fqk<ppT> kc_A_2 = ppT::miller_loop(proof_g_A_h_precomp, pvk.pp_G2_one_precomp);
-    GT<ppT> kc_A = ppT::final_exponentiation(kc_A_1 * kc_A_2.unitary_inverse());
+    G1_precomp<ppT> proof_g_A_h_neg_precomp  = ppT::precompute_G1(-proof.g_A.h);
+    const pairing_terms<ppT> kc_A_terms = { { &proof_g_A_g_precomp, &pvk.vk_alphaA_g2_precomp },
+                                            { &proof_g_A_h_neg_precomp, &pvk.pp_G2_one_precomp } };
+    GT<ppT> kc_A = ppT::multi_pairing(kc_A_terms);
     if (kc_A != GT<ppT>::one())
     {
         return false;
     }
 
     G2_precomp<ppT> proof_g_B_g_precomp      = ppT::precompute_G2(proof.g_B.g);
-    G1_precomp<ppT> proof_g_B_h_precomp = ppT::precompute_G1(proof.g_B.h);
-    Fqk<ppT> kc_B_1 = ppT::miller_loop(pvk.vk_alphaB_g1_precomp, proof_g_B_g_precomp);
-    Fqk<ppT> kc_B_2 = ppT::miller_loop(proof_g_B_h_precomp,    pvk.pp_G2_one_precomp);
-    GT<ppT> kc_B = ppT::final_exponentiation(kc_B_1 * kc_B_2.unitary_inverse());
+    G1_precomp<ppT> proof_g_B_h_neg_precomp  = ppT::precompute_G1(-proof.g_B.h);
+    const pairing_terms<ppT> kc_B_terms = { { &pvk.vk_alphaB_g1_precomp, &proof_g_B_g_precomp },
+                                            { &proof_g_B_h_neg_precomp, &pvk.pp_G2_one_precomp } };
+    GT<ppT> kc_B = ppT::multi_pairing(kc_B_terms);
     if (kc_B != GT<ppT>::one())
     {
         return false;
     }
 
     G1_precomp<ppT> proof_g_C_g_precomp      = ppT::precompute_G1(proof.g_C.g);
-    G1_precomp<ppT> proof_g_C_h_precomp = ppT::precompute_G1(proof.g_C.h);
-    Fqk<ppT> kc_C_1 = ppT::miller_loop(proof_g_C_g_precomp,      pvk.vk_alphaC_g2_precomp);
-    Fqk<ppT> kc_C_2 = ppT::miller_loop(proof_g_C_h_precomp, pvk.pp_G2_one_precomp);
-    GT<ppT> kc_C = ppT::final_exponentiation(kc_C_1 * kc_C_2.unitary_inverse());
+    G1_precomp<ppT> proof_g_C_h_neg_precomp  = ppT::precompute_G1(-proof.g_C.h);
+    const pairing_terms<ppT> kc_C_terms = { { &proof_g_C_g_precomp, &pvk.vk_alphaC_g2_precomp },
+                                            { &proof_g_C_h_neg_precomp, &pvk.pp_G2_one_precomp } };
+    GT<ppT> kc_C = ppT::multi_pairing(kc_C_terms);
     if (kc_C != GT<ppT>::one())
     {
         return false;
@@ -723,21 +772,24 @@ bool r1cs_ppzksnark_online_verifier_weak_IC(const r1cs_ppzksnark_processed_verif
 
     // check that g^((A+acc)*B)=g^(H*\Prod(t-\sigma)+C)
     // equivalently, via pairings, that e(g^(A+acc), g^B) = e(g^H, g^Z) + e(g^C, g^1)
-    G1_precomp<ppT> proof_g_A_g_acc_precomp = ppT::precompute_G1(proof.g_A.g + acc);
-    G1_precomp<ppT> proof_g_H_precomp       = ppT::precompute_G1(proof.g_H);
-    Fqk<ppT> QAP_1  = ppT::miller_loop(proof_g_A_g_acc_precomp,  proof_g_B_g_precomp);
-    Fqk<ppT> QAP_23  = ppT::double_miller_loop(proof_g_H_precomp, pvk.vk_rC_Z_g2_precomp, proof_g_C_g_precomp, pvk.pp_G2_one_precomp);
-    GT<ppT> QAP = ppT::final_exponentiation(QAP_1 * QAP_23.unitary_inverse());
+    G1_precomp<ppT> proof_g_A_g_acc_neg_precomp = ppT::precompute_G1(-(proof.g_A.g + acc));
+    G1_precomp<ppT> proof_g_H_precomp           = ppT::precompute_G1(proof.g_H);
+    const pairing_terms<ppT> QAP_terms = { { &proof_g_A_g_acc_neg_precomp, &proof_g_B_g_precomp },
+                                           { &proof_g_H_precomp, &pvk.vk_rC_Z_g2_precomp },
+                                           { &proof_g_C_g_precomp, &pvk.pp_G2_one_precomp } };
+    GT<ppT> QAP = ppT::multi_pairing(QAP_terms);
     if (QAP != GT<ppT>::one())
     {
         return false;
     }
 
-    G1_precomp<ppT> proof_g_K_precomp = ppT::precompute_G1(proof.g_K);
+    // check that e(g^K, g^gamma) = e(g^(A+acc+C), g^(gamma beta)) * e(g^(gamma beta), g^B)
+    G1_precomp<ppT> proof_g_K_neg_precomp = ppT::precompute_G1(-proof.g_K);
     G1_precomp<ppT> proof_g_A_g_acc_C_precomp = ppT::precompute_G1((proof.g_A.g + acc) + proof.g_C.g);
-    Fqk<ppT> K_1 = ppT::miller_loop(proof_g_K_precomp, pvk.vk_gamma_g2_precomp);
-    Fqk<ppT> K_23 = ppT::double_miller_loop(proof_g_A_g_acc_C_precomp, pvk.vk_gamma_beta_g2_precomp, pvk.vk_gamma_beta_g1_precomp, proof_g_B_g_precomp);
-    GT<ppT> K = ppT::final_exponentiation(K_1 * K_23.unitary_inverse());
+    const pairing_terms<ppT> K_terms = { { &proof_g_K_neg_precomp, &pvk.vk_gamma_g2_precomp },
+                                         { &proof_g_A_g_acc_C_precomp, &pvk.vk_gamma_beta_g2_precomp },
+                                         { &pvk.vk_gamma_beta_g1_precomp, &proof_g_B_g_precomp } };
+    GT<ppT> K = ppT::multi_pairing(K_terms);
     if (K != GT<ppT>::one())
     {
         return false;
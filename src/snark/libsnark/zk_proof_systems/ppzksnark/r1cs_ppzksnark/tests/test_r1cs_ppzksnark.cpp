@@ -36,9 +36,39 @@ void test_r1cs_ppzksnark(size_t num_constraints,
     print_header("(leave) Test R1CS ppzkSNARK");
 }
 
+template<typename ppT>
+void test_r1cs_ppzksnark_rejects_knowledge_commitments(size_t num_constraints,
+                                                      size_t input_size)
+{
+    r1cs_example<Fr<ppT> > example = generate_r1cs_example_with_binary_input<Fr<ppT> >(num_constraints, input_size);
+    example.constraint_system.swap_AB_if_beneficial();
+    r1cs_ppzksnark_keypair<ppT> keypair = r1cs_ppzksnark_generator<ppT>(example.constraint_system);
+    r1cs_ppzksnark_processed_verification_key<ppT> pvk = r1cs_ppzksnark_verifier_process_vk<ppT>(keypair.vk);
+    const r1cs_ppzksnark_proof<ppT> proof = r1cs_ppzksnark_prover<ppT>(keypair.pk, example.primary_input, example.auxiliary_input, example.constraint_system);
+    EXPECT_TRUE(r1cs_ppzksnark_online_verifier_strong_IC<ppT>(pvk, example.primary_input, proof));
+
+    // A proof with any knowledge commitment changed fails the check of that commitment
+    for (size_t i = 0; i < 6; ++i)
+    {
+        r1cs_ppzksnark_proof<ppT> changed = proof;
+        switch (i)
+        {
+        case 0: changed.g_A.g = changed.g_A.g + G1<ppT>::one(); break;
+        case 1: changed.g_A.h = changed.g_A.h + G1<ppT>::one(); break;
+        case 2: changed.g_B.g = changed.g_B.g + G2<ppT>::one(); break;
+        case 3: changed.g_B.h = changed.g_B.h + G1<ppT>::one(); break;
+        case 4: changed.g_C.g = changed.g_C.g + G1<ppT>::one(); break;
+        case 5: changed.g_C.h = changed.g_C.h + G1<ppT>::one(); break;
+        }
+        EXPECT_FALSE(r1cs_ppzksnark_online_verifier_strong_IC<ppT>(pvk, example.primary_input, changed));
+    }
+}
+
 TEST(zk_proof_systems, r1cs_ppzksnark)
 {
     start_profiling();
+    alt_bn128_pp::init_public_params();
 
     test_r1cs_ppzksnark<alt_bn128_pp>(1000, 20);
+    test_r1cs_ppzksnark_rejects_knowledge_commitments<alt_bn128_pp>(100, 10);
 }
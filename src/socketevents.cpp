@@ -0,0 +1,178 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+
+#include <algorithm>
+
+CSocketEvents::CSocketEvents()
+{
+#ifdef USE_EPOLL
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1)
+        LogPrintf("%s: epoll_create1 failed: %s\n", __func__, NetworkErrorString(errno));
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#ifdef USE_EPOLL
+    if (epollfd != -1)
+        close(epollfd);
+#endif
+}
+
+void CSocketEvents::Clear()
+{
+    for (std::unordered_map<SOCKET, Entry>::iterator it = mapSockets.begin(); it != mapSockets.end(); ++it) {
+        it->second.requested = 0;
+        it->second.ready = 0;
+        it->second.fSeen = false;
+    }
+}
+
+void CSocketEvents::Add(SOCKET hSocket, int events, int64_t nOwner)
+{
+    std::pair<std::unordered_map<SOCKET, Entry>::iterator, bool> ret = mapSockets.insert(
+        std::make_pair(hSocket, Entry{nOwner, 0, -1, 0, false}));
+    Entry& entry = ret.first->second;
+    if (entry.nOwner != nOwner) {
+        // The socket number now belongs to another connection, whose socket is not
+        // registered yet even if the previous one was
+        entry.nOwner = nOwner;
+        entry.registered = -1;
+    }
+    entry.requested |= (events & (RECV | SEND));
+    entry.fSeen = true;
+}
+
+#ifdef USE_EPOLL
+bool CSocketEvents::Wait(int64_t nTimeout)
+{
+    if (epollfd == -1) {
+        MilliSleep(nTimeout);
+        return false;
+    }
+
+    // Bring the kernel registrations in line with this round's interest
+    for (std::unordered_map<SOCKET, Entry>::iterator it = mapSockets.begin(); it != mapSockets.end(); ) {
+        Entry& entry = it->second;
+        if (!entry.fSeen) {
+            // Closed sockets are removed from the epoll set by the kernel, this only
+            // matters for sockets still open but no longer handled
+            if (entry.registered != -1)
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, it->first, NULL);
+            it = mapSockets.erase(it);
+            continue;
+        }
+        if (entry.registered != entry.requested) {
+            struct epoll_event ev;
+            ev.events = ((entry.requested & RECV) ? EPOLLIN : 0) | ((entry.requested & SEND) ? EPOLLOUT : 0);
+            ev.data.fd = it->first;
+            int op = (entry.registered == -1) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            int nRet = epoll_ctl(epollfd, op, it->first, &ev);
+            if (nRet == -1 && errno == EEXIST)
+                nRet = epoll_ctl(epollfd, EPOLL_CTL_MOD, it->first, &ev);
+            else if (nRet == -1 && errno == ENOENT)
+                nRet = epoll_ctl(epollfd, EPOLL_CTL_ADD, it->first, &ev);
+            if (nRet == -1) {
+                // e.g. the socket was closed meanwhile: report it so that the caller finds out
+                entry.registered = -1;
+                entry.ready = ERR;
+            } else {
+                entry.registered = entry.requested;
+            }
+        }
+        ++it;
+    }
+
+    vEvents.resize(std::max<size_t>(mapSockets.size(), 1));
+    int nEvents = epoll_wait(epollfd, vEvents.data(), vEvents.size(), nTimeout);
+    if (nEvents == -1) {
+        if (errno == EINTR)
+            return true;
+        LogPrintf("socket epoll error %s\n", NetworkErrorString(errno));
+        for (std::unordered_map<SOCKET, Entry>::iterator it = mapSockets.begin(); it != mapSockets.end(); ++it)
+            it->second.ready = RECV;
+        MilliSleep(nTimeout);
+        return false;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        std::unordered_map<SOCKET, Entry>::iterator it = mapSockets.find(vEvents[i].data.fd);
+        if (it == mapSockets.end())
+            continue;
+        if (vEvents[i].events & EPOLLIN)
+            it->second.ready |= RECV;
+        if (vEvents[i].events & EPOLLOUT)
+            it->second.ready |= SEND;
+        if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+            it->second.ready |= ERR;
+    }
+    return true;
+}
+#else
+bool CSocketEvents::Wait(int64_t nTimeout)
+{
+    struct timeval timeout = MillisToTimeval(nTimeout);
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (std::unordered_map<SOCKET, Entry>::iterator it = mapSockets.begin(); it != mapSockets.end(); ) {
+        if (!it->second.fSeen) {
+            it = mapSockets.erase(it);
+            continue;
+        }
+        if (it->second.requested & RECV)
+            FD_SET(it->first, &fdsetRecv);
+        if (it->second.requested & SEND)
+            FD_SET(it->first, &fdsetSend);
+        FD_SET(it->first, &fdsetError);
+        hSocketMax = std::max(hSocketMax, it->first);
+        have_fds = true;
+        ++it;
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (std::unordered_map<SOCKET, Entry>::iterator it = mapSockets.begin(); it != mapSockets.end(); ++it)
+                it->second.ready = RECV;
+        }
+        MilliSleep(nTimeout);
+        return false;
+    }
+
+    for (std::unordered_map<SOCKET, Entry>::iterator it = mapSockets.begin(); it != mapSockets.end(); ++it) {
+        if (FD_ISSET(it->first, &fdsetRecv))
+            it->second.ready |= RECV;
+        if (FD_ISSET(it->first, &fdsetSend))
+            it->second.ready |= SEND;
+        if (FD_ISSET(it->first, &fdsetError))
+            it->second.ready |= ERR;
+    }
+    return true;
+}
+#endif
+
+int CSocketEvents::Ready(SOCKET hSocket) const
+{
+    std::unordered_map<SOCKET, Entry>::const_iterator it = mapSockets.find(hSocket);
+    if (it == mapSockets.end())
+        return 0;
+    return it->second.ready;
+}
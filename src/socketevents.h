@@ -0,0 +1,80 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#include "compat.h"
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+/**
+ * Waits for readiness of the sockets of the socket handler thread.
+ *
+ * Every round the caller declares, with Add(), the events it is interested in
+ * for each socket, then calls Wait() and queries the result with Ready().
+ *
+ * With USE_EPOLL the sockets stay registered with the kernel between rounds,
+ * and only the sockets whose interest changed are updated, so the cost of
+ * waiting does not grow with the number of idle connections and there is no
+ * FD_SETSIZE limit. Otherwise select() is used.
+ */
+class CSocketEvents
+{
+public:
+    enum {
+        RECV = 1,
+        SEND = 2,
+        ERR  = 4,
+    };
+
+    CSocketEvents();
+    ~CSocketEvents();
+
+    /** Start a new round, forgetting the interest and readiness of the previous one */
+    void Clear();
+
+    /**
+     * Declare interest in events (RECV, SEND) of hSocket for this round. Errors are always
+     * reported. nOwner identifies the user of the socket (e.g. the id of a node), so that a
+     * socket number reused by the system for another connection is registered again.
+     */
+    void Add(SOCKET hSocket, int events, int64_t nOwner = -1);
+
+    /**
+     * Wait at most nTimeout milliseconds for one of the declared events.
+     * @return false on error, in which case every socket is reported ready to receive,
+     *         so that its error is found by the following recv() as with select()
+     */
+    bool Wait(int64_t nTimeout);
+
+    /** Events of hSocket found by the last Wait() */
+    int Ready(SOCKET hSocket) const;
+
+private:
+    struct Entry {
+        int64_t nOwner;
+        int requested;
+        int registered;
+        int ready;
+        bool fSeen;
+    };
+
+    std::unordered_map<SOCKET, Entry> mapSockets;
+#ifdef USE_EPOLL
+    int epollfd;
+    std::vector<struct epoll_event> vEvents;
+#endif
+
+    CSocketEvents(const CSocketEvents&);
+    CSocketEvents& operator=(const CSocketEvents&);
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
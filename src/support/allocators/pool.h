@@ -0,0 +1,330 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <stddef.h>
+
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * Memory for the nodes of a node-based container such as boost::unordered_map.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE bytes are carved out of chunks, which double
+ * in size from MIN_CHUNK_SIZE up to MAX_CHUNK_SIZE bytes, and are recycled
+ * through one free list per block size. A node then costs no malloc bookkeeping
+ * and the nodes of a container sit next to each other. The chunks only go back
+ * to the system when the resource is destroyed.
+ *
+ * Not thread-safe, like the containers using it.
+ */
+class CPoolResource
+{
+public:
+    static const size_t ALIGN = 8;
+    static const size_t MAX_BLOCK_SIZE = 256;
+    static const size_t MIN_CHUNK_SIZE = 4 * 1024;
+    static const size_t MAX_CHUNK_SIZE = 256 * 1024;
+
+    CPoolResource() : pCur(NULL), pEnd(NULL), vFree(MAX_BLOCK_SIZE / ALIGN + 1, NULL), nChunkBytes(0) {}
+
+    ~CPoolResource()
+    {
+        for (char* pChunk : vChunks)
+            ::operator delete(pChunk);
+    }
+
+    /** Whether blocks of this size and alignment come from the pool */
+    static bool Fits(size_t nBytes, size_t nAlign)
+    {
+        return nBytes <= MAX_BLOCK_SIZE && ALIGN % nAlign == 0;
+    }
+
+    void* Allocate(size_t nBytes)
+    {
+        const size_t nSize = BlockSize(nBytes);
+        FreeBlock*& pFree = vFree[nSize / ALIGN];
+        if (pFree != NULL) {
+            FreeBlock* p = pFree;
+            pFree = p->pNext;
+            return p;
+        }
+        if ((size_t)(pEnd - pCur) < nSize) {
+            // Recycle the end of the current chunk before starting a new one
+            if (pEnd != pCur)
+                Deallocate(pCur, pEnd - pCur);
+            size_t nChunkSize = MIN_CHUNK_SIZE;
+            if (!vChunks.empty())
+                nChunkSize = 2 * (size_t)(pEnd - vChunks.back()) < MAX_CHUNK_SIZE ? 2 * (size_t)(pEnd - vChunks.back()) : MAX_CHUNK_SIZE;
+            pCur = static_cast<char*>(::operator new(nChunkSize));
+            pEnd = pCur + nChunkSize;
+            vChunks.push_back(pCur);
+            nChunkBytes += nChunkSize;
+        }
+        void* p = pCur;
+        pCur += nSize;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes)
+    {
+        FreeBlock*& pFree = vFree[BlockSize(nBytes) / ALIGN];
+        FreeBlock* pBlock = new (p) FreeBlock;
+        pBlock->pNext = pFree;
+        pFree = pBlock;
+    }
+
+    /** Bytes taken from the system */
+    size_t ChunkBytes() const { return nChunkBytes; }
+
+    size_t ChunkCount() const { return vChunks.size(); }
+
+private:
+    struct FreeBlock {
+        FreeBlock* pNext;
+    };
+
+    static size_t BlockSize(size_t nBytes)
+    {
+        return (nBytes + ALIGN - 1) / ALIGN * ALIGN;
+    }
+
+    char* pCur;
+    char* pEnd;
+    std::vector<FreeBlock*> vFree;
+    std::vector<char*> vChunks;
+    size_t nChunkBytes;
+
+    CPoolResource(const CPoolResource&);
+    CPoolResource& operator=(const CPoolResource&);
+};
+
+/**
+ * Allocator taking single objects from a CPoolResource, shared by all its
+ * copies and rebinds, and anything else (such as the bucket array of a hash
+ * table) from the heap. A default-constructed allocator gets a new resource,
+ * so every container has its own pool, freed with the container.
+ */
+template <typename T>
+struct pool_allocator : public std::allocator<T> {
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+
+    // Containers take the pool of the container they are assigned or swapped with
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    std::shared_ptr<CPoolResource> resource;
+
+    pool_allocator() : resource(std::make_shared<CPoolResource>()) {}
+    pool_allocator(const pool_allocator& a) : base(a), resource(a.resource) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& a) : base(a), resource(a.resource)
+    {
+    }
+    ~pool_allocator() {}
+    template <typename _Other>
+    struct rebind {
+        typedef pool_allocator<_Other> other;
+    };
+
+    T* allocate(std::size_t n, const void* hint = 0)
+    {
+        if (n == 1 && CPoolResource::Fits(sizeof(T), alignof(T)))
+            return static_cast<T*>(resource->Allocate(sizeof(T)));
+        return std::allocator<T>::allocate(n, hint);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (n == 1 && CPoolResource::Fits(sizeof(T), alignof(T)))
+            resource->Deallocate(p, sizeof(T));
+        else
+            std::allocator<T>::deallocate(p, n);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const pool_allocator<T>& a, const pool_allocator<U>& b)
+{
+    return a.resource == b.resource;
+}
+
+template <typename T, typename U>
+bool operator!=(const pool_allocator<T>& a, const pool_allocator<U>& b)
+{
+    return a.resource != b.resource;
+}
+
+/**
+ * Memory for the temporaries of a validation step, such as the sets checking a
+ * transaction for duplicate inputs. Allocating bumps a pointer through chunks
+ * of CHUNK_SIZE bytes and freeing does nothing; a CArenaScope gives back all the
+ * arena handed out since it was opened, and the chunks are kept for the next
+ * step, so a step taking no more than the previous one costs no malloc at all.
+ *
+ * One per thread, see ThreadArena(), and not thread-safe.
+ */
+class CArenaResource
+{
+public:
+    static const size_t ALIGN = 16;
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    static const size_t MAX_BLOCK_SIZE = CHUNK_SIZE / 8;
+
+    /** The position of the arena, to rewind it to */
+    struct Mark {
+        size_t nChunksUsed;
+        char* pCur;
+    };
+
+    CArenaResource() : pCur(NULL), pEnd(NULL), nChunksUsed(0) {}
+
+    ~CArenaResource()
+    {
+        for (char* pChunk : vChunks)
+            ::operator delete(pChunk);
+    }
+
+    /** Whether blocks of this size and alignment come from the arena */
+    static bool Fits(size_t nBytes, size_t nAlign)
+    {
+        return nBytes <= MAX_BLOCK_SIZE && ALIGN % nAlign == 0;
+    }
+
+    void* Allocate(size_t nBytes)
+    {
+        const size_t nSize = (nBytes + ALIGN - 1) / ALIGN * ALIGN;
+        if ((size_t)(pEnd - pCur) < nSize) {
+            if (nChunksUsed == vChunks.size())
+                vChunks.push_back(static_cast<char*>(::operator new(CHUNK_SIZE)));
+            pCur = vChunks[nChunksUsed++];
+            pEnd = pCur + CHUNK_SIZE;
+        }
+        void* p = pCur;
+        pCur += nSize;
+        return p;
+    }
+
+    Mark GetMark() const
+    {
+        Mark mark = {nChunksUsed, pCur};
+        return mark;
+    }
+
+    /** Give back everything allocated since the mark was taken */
+    void Rewind(const Mark& mark)
+    {
+        nChunksUsed = mark.nChunksUsed;
+        pCur = mark.pCur;
+        pEnd = nChunksUsed > 0 ? vChunks[nChunksUsed - 1] + CHUNK_SIZE : NULL;
+    }
+
+    /** Bytes taken from the system */
+    size_t ChunkBytes() const { return vChunks.size() * CHUNK_SIZE; }
+
+    /** Bytes handed out, including the ends of the chunks skipped */
+    size_t UsedBytes() const { return nChunksUsed > 0 ? (nChunksUsed - 1) * CHUNK_SIZE + (CHUNK_SIZE - (size_t)(pEnd - pCur)) : 0; }
+
+private:
+    char* pCur;
+    char* pEnd;
+    std::vector<char*> vChunks;
+    size_t nChunksUsed;
+
+    CArenaResource(const CArenaResource&);
+    CArenaResource& operator=(const CArenaResource&);
+};
+
+/** The arena of the calling thread */
+inline CArenaResource& ThreadArena()
+{
+    static thread_local CArenaResource arena;
+    return arena;
+}
+
+/**
+ * Gives back the arena of the thread taken while it was alive. The containers
+ * using arena_allocator are declared after it, so that they are gone first, and
+ * none opened before it may grow while it is alive.
+ */
+class CArenaScope
+{
+public:
+    CArenaScope() : arena(ThreadArena()), mark(arena.GetMark()) {}
+    ~CArenaScope() { arena.Rewind(mark); }
+
+private:
+    CArenaResource& arena;
+    const CArenaResource::Mark mark;
+
+    CArenaScope(const CArenaScope&);
+    CArenaScope& operator=(const CArenaScope&);
+};
+
+/**
+ * Allocator taking blocks of up to CArenaResource::MAX_BLOCK_SIZE bytes from the
+ * arena of the thread, and larger ones from the heap. For the containers living
+ * within a CArenaScope, on the thread that opened it.
+ */
+template <typename T>
+struct arena_allocator : public std::allocator<T> {
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+
+    arena_allocator() {}
+    arena_allocator(const arena_allocator& a) : base(a) {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& a) : base(a)
+    {
+    }
+    ~arena_allocator() {}
+    template <typename _Other>
+    struct rebind {
+        typedef arena_allocator<_Other> other;
+    };
+
+    T* allocate(std::size_t n, const void* hint = 0)
+    {
+        if (CArenaResource::Fits(n * sizeof(T), alignof(T)))
+            return static_cast<T*>(ThreadArena().Allocate(n * sizeof(T)));
+        return std::allocator<T>::allocate(n, hint);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (!CArenaResource::Fits(n * sizeof(T), alignof(T)))
+            std::allocator<T>::deallocate(p, n);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const arena_allocator<T>&, const arena_allocator<U>&)
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const arena_allocator<T>&, const arena_allocator<U>&)
+{
+    return false;
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -7,11 +7,189 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
 #include <stdio.h>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
+std::atomic<bool> fLockProfile(DEFAULT_LOCK_PROFILE);
+
+//! Slots of the table of the lock sites, a few times the LOCKs of the source
+static const size_t LOCK_PROFILE_SITES = 2048;
+
+namespace {
+
+struct AtomicLockTimes {
+    std::atomic<uint64_t> buckets[LockProfileTimes::BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<int64_t> total;
+    std::atomic<int64_t> max;
+
+    void add(int64_t nMicros)
+    {
+        if (nMicros < 0)
+            nMicros = 0;
+        // Bucket i > 0 holds the durations from 2^(i-1) to 2^i - 1
+        size_t i = 0;
+        while (i < LockProfileTimes::BUCKETS - 1 && (nMicros >> i) > 0)
+            i++;
+        buckets[i].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(nMicros, std::memory_order_relaxed);
+        int64_t prev = max.load(std::memory_order_relaxed);
+        while (nMicros > prev && !max.compare_exchange_weak(prev, nMicros, std::memory_order_relaxed)) {
+        }
+    }
+
+    void addTo(LockProfileTimes& times) const
+    {
+        for (size_t i = 0; i < LockProfileTimes::BUCKETS; i++)
+            times.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+        times.count += count.load(std::memory_order_relaxed);
+        times.total += total.load(std::memory_order_relaxed);
+        times.max = std::max(times.max, max.load(std::memory_order_relaxed));
+    }
+
+    void reset()
+    {
+        for (size_t i = 0; i < LockProfileTimes::BUCKETS; i++)
+            buckets[i].store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+};
+
+} // anon namespace
+
+/**
+ * A slot of the table of the lock sites, found by the address of the file name and
+ * the line of the site. A thread claims a free slot by setting its file, and the
+ * slot is used once its line is set after, so the table needs no mutex.
+ */
+class CLockSite
+{
+public:
+    std::atomic<const char*> file;
+    std::atomic<int> line;
+    const char* name;
+    std::atomic<uint64_t> nContended;
+    AtomicLockTimes wait;
+    AtomicLockTimes hold;
+};
+
+// Zero-initialized before any static constructor runs, so the locks of those are profiled too
+static CLockSite lockSites[LOCK_PROFILE_SITES];
+
+CLockSite* GetLockSite(const char* pszName, const char* pszFile, int nLine)
+{
+    const size_t nHash = (reinterpret_cast<uintptr_t>(pszFile) >> 3) * 31 + nLine;
+    for (size_t n = 0; n < LOCK_PROFILE_SITES; n++) {
+        CLockSite& site = lockSites[(nHash + n) % LOCK_PROFILE_SITES];
+        const char* file = site.file.load(std::memory_order_acquire);
+        if (file == NULL) {
+            if (site.file.compare_exchange_strong(file, pszFile, std::memory_order_acq_rel)) {
+                site.name = pszName;
+                site.line.store(nLine, std::memory_order_release);
+                return &site;
+            }
+        }
+        if (file != pszFile)
+            continue;
+        int line;
+        while ((line = site.line.load(std::memory_order_acquire)) == 0)
+            boost::this_thread::yield();
+        if (line == nLine)
+            return &site;
+    }
+    return NULL;
+}
+
+int64_t LockProfileMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void CountLockWait(CLockSite* site, bool fContended, int64_t nMicros)
+{
+    if (fContended)
+        site->nContended.fetch_add(1, std::memory_order_relaxed);
+    site->wait.add(nMicros);
+}
+
+void CountLockHold(CLockSite* site, int64_t nMicros)
+{
+    site->hold.add(nMicros);
+}
+
+std::vector<LockSiteProfile> GetLockProfile()
+{
+    // The file names of a header are different strings in each file including it
+    std::map<std::pair<std::string, int>, LockSiteProfile> mapSites;
+    for (size_t n = 0; n < LOCK_PROFILE_SITES; n++) {
+        const CLockSite& site = lockSites[n];
+        const int line = site.line.load(std::memory_order_acquire);
+        if (line == 0)
+            continue;
+        const std::string file = site.file.load(std::memory_order_relaxed);
+        auto it = mapSites.find(std::make_pair(file, line));
+        if (it == mapSites.end()) {
+            LockSiteProfile profile;
+            memset(&profile.wait, 0, sizeof(profile.wait));
+            memset(&profile.hold, 0, sizeof(profile.hold));
+            profile.name = site.name;
+            profile.file = file;
+            profile.line = line;
+            profile.nContended = 0;
+            it = mapSites.insert(std::make_pair(std::make_pair(file, line), profile)).first;
+        }
+        it->second.nContended += site.nContended.load(std::memory_order_relaxed);
+        site.wait.addTo(it->second.wait);
+        site.hold.addTo(it->second.hold);
+    }
+    std::vector<LockSiteProfile> vProfile;
+    for (const auto& entry : mapSites)
+        if (entry.second.wait.count > 0)
+            vProfile.push_back(entry.second);
+    return vProfile;
+}
+
+void ResetLockProfile()
+{
+    for (size_t n = 0; n < LOCK_PROFILE_SITES; n++) {
+        lockSites[n].nContended.store(0, std::memory_order_relaxed);
+        lockSites[n].wait.reset();
+        lockSites[n].hold.reset();
+    }
+}
+
+int64_t LockProfileTimes::mean() const
+{
+    return count > 0 ? total / (int64_t)count : 0;
+}
+
+int64_t LockProfileTimes::percentile(double fraction) const
+{
+    if (count == 0)
+        return 0;
+    uint64_t target = std::max<uint64_t>(1, std::ceil(fraction * count));
+    uint64_t seen = 0;
+    size_t i = 0;
+    for (; i < BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen >= target)
+            break;
+    }
+    int64_t bound = i == 0 ? 0 : (((int64_t)1 << i) - 1);
+    return std::min(bound, max);
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
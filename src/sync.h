@@ -8,6 +8,11 @@
 
 #include "threadsafety.h"
 
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -99,16 +104,85 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+//! -lockprofile default
+static const bool DEFAULT_LOCK_PROFILE = false;
+
+/**
+ * Whether the LOCK and TRY_LOCK sites count the time they wait for their mutex and
+ * hold it, set from -lockprofile and the setlockprofile RPC. While it is off, a lock
+ * costs one more relaxed load.
+ */
+extern std::atomic<bool> fLockProfile;
+
+class CLockSite;
+
+/** Durations counted by the lock profile, in microseconds, in buckets of powers of two */
+struct LockProfileTimes {
+    static const size_t BUCKETS = 32;
+    uint64_t buckets[BUCKETS];
+    uint64_t count;
+    int64_t total;
+    int64_t max;
+
+    int64_t mean() const;
+    //! Upper bound of the bucket holding the given fraction of the durations, no larger than max
+    int64_t percentile(double fraction) const;
+};
+
+/** The acquisitions of a lock site since it was first profiled or the profile was reset */
+struct LockSiteProfile {
+    std::string name;
+    std::string file;
+    int line;
+    //! Acquisitions which found the mutex held by another thread, or failed tries of TRY_LOCK
+    uint64_t nContended;
+    LockProfileTimes wait;
+    LockProfileTimes hold;
+};
+
+//! The profile of a lock site, NULL once the table of the sites is full
+CLockSite* GetLockSite(const char* pszName, const char* pszFile, int nLine);
+int64_t LockProfileMicros();
+void CountLockWait(CLockSite* site, bool fContended, int64_t nMicros);
+void CountLockHold(CLockSite* site, int64_t nMicros);
+//! The sites profiled, those of a header included by several files merged
+std::vector<LockSiteProfile> GetLockProfile();
+void ResetLockProfile();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    //! Set while the lock is held with the profile on
+    CLockSite* site;
+    int64_t nLockedTime;
+
+    void EnterProfiled(const char* pszName, const char* pszFile, int nLine)
+    {
+        site = GetLockSite(pszName, pszFile, nLine);
+        if (!site) {
+            lock.lock();
+            return;
+        }
+        const bool fContended = !lock.try_lock();
+        int64_t nWaitStart = 0;
+        if (fContended) {
+            nWaitStart = LockProfileMicros();
+            lock.lock();
+        }
+        nLockedTime = LockProfileMicros();
+        CountLockWait(site, fContended, fContended ? nLockedTime - nWaitStart : 0);
+    }
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (fLockProfile.load(std::memory_order_relaxed)) {
+            EnterProfiled(pszName, pszFile, nLine);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -123,13 +197,23 @@ private:
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()), true);
         lock.try_lock();
+        if (fLockProfile.load(std::memory_order_relaxed)) {
+            site = GetLockSite(pszName, pszFile, nLine);
+            if (site) {
+                CountLockWait(site, !lock.owns_lock(), 0);
+                if (lock.owns_lock())
+                    nLockedTime = LockProfileMicros();
+                else
+                    site = NULL;
+            }
+        }
         if (!lock.owns_lock())
             LeaveCritical();
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), site(NULL), nLockedTime(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -137,7 +221,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : site(NULL), nLockedTime(0)
     {
         if (!pmutexIn) return;
 
@@ -150,6 +234,8 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
+        if (site && lock.owns_lock())
+            CountLockHold(site, LockProfileMicros() - nLockedTime);
         if (lock.owns_lock())
             LeaveCritical();
     }
@@ -24,17 +24,19 @@
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 // Tests this internal-to-main.cpp method:
 extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxUsage);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    size_t nUsage;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern std::map<COutPoint, std::set<uint256> > mapOrphanTransactionsByPrev;
 
 CService ip(uint32_t i)
 {
@@ -107,6 +109,49 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(DoS_banning_without_cs_main)
+{
+    CNode::ClearBanned();
+    CAddress addr(ip(0xa0b0c001));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    dummyNode.nVersion = 1;
+
+    // Another thread holds cs_main: the peer is still scored and banned
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fLocked = false, fDone = false;
+    boost::thread holder([&] {
+        LOCK(cs_main);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fLocked = true;
+        cond.notify_all();
+        while (!fDone)
+            cond.wait(lock);
+    });
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fLocked)
+            cond.wait(lock);
+    }
+
+    Misbehaving(dummyNode.GetId(), 60);
+    Misbehaving(dummyNode.GetId(), 40);
+    SendMessages(&dummyNode, false);
+    BOOST_CHECK(CNode::IsBanned(addr));
+    BOOST_CHECK(dummyNode.fDisconnect);
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fDone = true;
+        cond.notify_all();
+    }
+    holder.join();
+
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(dummyNode.GetId(), stats));
+    BOOST_CHECK_EQUAL(stats.nMisbehavior, 100);
+}
+
 CTransaction RandomOrphan()
 {
     std::map<uint256, COrphanTx>::iterator it;
@@ -188,11 +233,56 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, MAX_ORPHAN_TX_USAGE);
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, MAX_ORPHAN_TX_USAGE);
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    LimitOrphanTxSize(0, MAX_ORPHAN_TX_USAGE);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+}
+
+static size_t CountOrphansFrom(NodeId peer)
+{
+    size_t nCount = 0;
+    for (std::map<uint256, COrphanTx>::const_iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+        nCount += it->second.fromPeer == peer;
+    return nCount;
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphansPerPeer)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1*CENT;
+
+    // A peer can't have more than its quota of orphans
+    for (unsigned int i = 0; i < MAX_ORPHAN_TRANSACTIONS_PER_PEER + 5; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        BOOST_CHECK_EQUAL(AddOrphanTx(tx, 1), i < MAX_ORPHAN_TRANSACTIONS_PER_PEER);
+    }
+    BOOST_CHECK_EQUAL(CountOrphansFrom(1), MAX_ORPHAN_TRANSACTIONS_PER_PEER);
+
+    // Orphans are indexed by the outpoints they spend
+    BOOST_CHECK(mapOrphanTransactionsByPrev.count(CTransaction(tx).vin[0].prevout));
+
+    // Other peers still get theirs in
+    for (NodeId peer = 2; peer < 5; peer++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        BOOST_CHECK(AddOrphanTx(tx, peer));
+    }
+
+    // Eviction hits the peer using the most memory first
+    LimitOrphanTxSize(mapOrphanTransactions.size() - 10, MAX_ORPHAN_TX_USAGE);
+    BOOST_CHECK_EQUAL(CountOrphansFrom(1), MAX_ORPHAN_TRANSACTIONS_PER_PEER - 10);
+    for (NodeId peer = 2; peer < 5; peer++)
+        BOOST_CHECK_EQUAL(CountOrphansFrom(peer), 1U);
+
+    // And the memory limit is enforced as well as the count
+    LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS_PER_PEER * 10, 0);
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
 }
@@ -0,0 +1,90 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "primitives/block.h"
+#include "script/standard.h"
+#include "undo.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(connect_disconnect)
+{
+    CAddressIndexDB db(1 << 20, true);
+    uint160 hashKey, hashScript;
+    hashKey.SetHex("1111111111111111111111111111111111111111");
+    hashScript.SetHex("2222222222222222222222222222222222222222");
+
+    // A coinbase paying to a key at height 10
+    CBlock block1;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.push_back(CTxOut(5000, GetScriptForDestination(CKeyID(hashKey))));
+    block1.vtx.push_back(MakeTransactionRef(coinbase));
+    CBlockUndo undo1;
+
+    // Spent at height 11 to a script, the undo data holding the output spent
+    CBlock block2;
+    CMutableTransaction coinbase2 = coinbase;
+    coinbase2.vout[0].scriptPubKey = CScript() << OP_RETURN;
+    block2.vtx.push_back(MakeTransactionRef(coinbase2));
+    CMutableTransaction spend;
+    spend.vin.push_back(CTxIn(COutPoint(block1.vtx[0]->GetHash(), 0)));
+    spend.vout.push_back(CTxOut(4000, GetScriptForDestination(CScriptID(hashScript))));
+    block2.vtx.push_back(MakeTransactionRef(spend));
+    CBlockUndo undo2;
+    undo2.vtxundo.resize(1);
+    undo2.vtxundo[0].vprevout.push_back(CTxInUndo(block1.vtx[0]->vout[0]));
+
+    CAddressIndexBatch batch(db);
+    batch.ConnectBlock(block1, undo1, 10);
+    batch.ConnectBlock(block2, undo2, 11);
+    BOOST_CHECK(batch.Write(uint256S("11")));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vEntries;
+    BOOST_CHECK(db.ReadAddressIndex(ADDRESS_TYPE_PUBKEYHASH, hashKey, vEntries));
+    BOOST_CHECK_EQUAL(vEntries.size(), 2U);
+    BOOST_CHECK(vEntries[0].first.nHeight == 10 && vEntries[0].second == 5000 && !vEntries[0].first.fSpending);
+    BOOST_CHECK(vEntries[1].first.nHeight == 11 && vEntries[1].second == -5000 && vEntries[1].first.fSpending);
+
+    vEntries.clear();
+    BOOST_CHECK(db.ReadAddressIndex(ADDRESS_TYPE_PUBKEYHASH, hashKey, vEntries, 11, 11));
+    BOOST_CHECK_EQUAL(vEntries.size(), 1U);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(ADDRESS_TYPE_PUBKEYHASH, hashKey, vUnspent));
+    BOOST_CHECK(vUnspent.empty());
+    BOOST_CHECK(db.ReadAddressUnspentIndex(ADDRESS_TYPE_SCRIPTHASH, hashScript, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+
+    CSpentIndexValue spent;
+    BOOST_CHECK(db.ReadSpentIndex(CSpentIndexKey(block1.vtx[0]->GetHash(), 0), spent));
+    BOOST_CHECK(spent.txid == block2.vtx[1]->GetHash() && spent.nHeight == 11 && spent.nPrevHeight == 10);
+    BOOST_CHECK(spent.addressType == ADDRESS_TYPE_PUBKEYHASH && spent.addressHash == hashKey);
+
+    // Disconnecting the spend makes the output unspent again, at its height
+    batch.DisconnectBlock(block2, undo2, 11);
+    BOOST_CHECK(batch.Write(uint256S("10")));
+
+    vEntries.clear();
+    BOOST_CHECK(db.ReadAddressIndex(ADDRESS_TYPE_PUBKEYHASH, hashKey, vEntries));
+    BOOST_CHECK_EQUAL(vEntries.size(), 1U);
+    vUnspent.clear();
+    BOOST_CHECK(db.ReadAddressUnspentIndex(ADDRESS_TYPE_PUBKEYHASH, hashKey, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].second.nValue == 5000 && vUnspent[0].second.nHeight == 10);
+    vUnspent.clear();
+    BOOST_CHECK(db.ReadAddressUnspentIndex(ADDRESS_TYPE_SCRIPTHASH, hashScript, vUnspent));
+    BOOST_CHECK(vUnspent.empty());
+    BOOST_CHECK(!db.ReadSpentIndex(CSpentIndexKey(block1.vtx[0]->GetHash(), 0), spent));
+
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadBestBlock(hashBest) && hashBest == uint256S("10"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,8 @@
 
 #include "hash.h"
 #include "random.h"
+#include "streams.h"
+#include "clientversion.h"
 
 using namespace std;
 
@@ -180,9 +182,9 @@ BOOST_AUTO_TEST_CASE(addrman_select)
     BOOST_CHECK(addrman.size() == 7);
 
     // Test 12: Select pulls from new and tried regardless of port number.
-    BOOST_CHECK(addrman.Select().ToString() == "250.4.6.6:8333");
-    BOOST_CHECK(addrman.Select().ToString() == "250.3.2.2:9999");
-    BOOST_CHECK(addrman.Select().ToString() == "250.3.3.3:9999");
+    BOOST_CHECK(addrman.Select().ToString() == "250.4.4.4:8333");
+    BOOST_CHECK(addrman.Select().ToString() == "250.4.5.5:7777");
+    BOOST_CHECK(addrman.Select().ToString() == "250.3.1.1:8333");
     BOOST_CHECK(addrman.Select().ToString() == "250.4.4.4:8333");
 }
 
@@ -329,6 +331,74 @@ BOOST_AUTO_TEST_CASE(addrman_delete)
     BOOST_CHECK(addrman.size() == 0);
     CAddrInfo* info2 = addrman.Find(addr1);
     BOOST_CHECK(info2 == NULL);
+
+    // Test 21b: The id of a deleted entry is reused.
+    CAddress addr2 = CAddress(CService("250.1.2.2", 8333));
+    int nId2;
+    addrman.Create(addr2, source1, &nId2);
+    BOOST_CHECK_EQUAL(nId2, nId);
+    BOOST_CHECK(addrman.Find(addr2) != NULL);
+    BOOST_CHECK(addrman.Find(addr1) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_select_sparse)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    // A single new and a single tried address, in tables of 65536 and 16384 slots,
+    // are both selected without trouble.
+    CService addr1 = CService("250.1.1.1", 8333);
+    CService addr2 = CService("250.2.2.2", 8333);
+    addrman.Add(CAddress(addr1), CService("252.2.2.2", 8333));
+    addrman.Add(CAddress(addr2), CService("252.2.2.2", 8333));
+    addrman.Good(CAddress(addr2));
+
+    bool fNew = false, fTried = false;
+    for (int i = 0; i < 100; i++) {
+        CAddrInfo addr = addrman.Select();
+        fNew |= (addr == addr1);
+        fTried |= (addr == addr2);
+    }
+    BOOST_CHECK(fNew && fTried);
+
+    BOOST_CHECK(addrman.Select(true) == addr1);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_serialize)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    CNetAddr source = CNetAddr("252.2.2.2");
+    for (unsigned int i = 1; i < 64; i++) {
+        CService addr = CService("250.1.1." + boost::to_string(i));
+        addrman.Add(CAddress(addr), source);
+        if (i % 4 == 0)
+            addrman.Good(CAddress(addr));
+    }
+    BOOST_CHECK(addrman.size() > 0);
+
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    ssPeers << addrman;
+
+    CAddrManTest addrman2;
+    ssPeers >> addrman2;
+    BOOST_CHECK_EQUAL(addrman2.size(), addrman.size());
+    for (unsigned int i = 1; i < 64; i++) {
+        CNetAddr addr = CNetAddr("250.1.1." + boost::to_string(i));
+        BOOST_CHECK((addrman.Find(addr) == NULL) == (addrman2.Find(addr) == NULL));
+    }
+
+    // Serializing the restored table gives the same data
+    CDataStream ssPeers1(SER_DISK, CLIENT_VERSION), ssPeers2(SER_DISK, CLIENT_VERSION);
+    ssPeers1 << addrman;
+    ssPeers2 << addrman2;
+    BOOST_CHECK(ssPeers2.str() == ssPeers1.str());
 }
 
 BOOST_AUTO_TEST_CASE(addrman_getaddr)
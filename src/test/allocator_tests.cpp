@@ -4,10 +4,14 @@
 
 #include "util.h"
 
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_bitcoin.h"
 
+#include <set>
+
 #include <boost/test/unit_test.hpp>
+#include <boost/unordered_map.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
 
@@ -117,4 +121,82 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(pool_allocator_reuse)
+{
+    CPoolResource pool;
+    void* a = pool.Allocate(20);
+    void* b = pool.Allocate(24);
+    // Sizes are rounded up to the alignment, and blocks are laid out one after the other
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 24);
+    BOOST_CHECK_EQUAL(pool.ChunkCount(), 1);
+    BOOST_CHECK_EQUAL(pool.ChunkBytes(), 1 * CPoolResource::MIN_CHUNK_SIZE);
+
+    // Freed blocks are handed out again for the same size only
+    pool.Deallocate(a, 20);
+    BOOST_CHECK(pool.Allocate(40) != a);
+    BOOST_CHECK(pool.Allocate(17) == a);
+
+    // Chunks double in size
+    for (size_t i = 0; i < CPoolResource::MIN_CHUNK_SIZE / 8; i++)
+        pool.Allocate(8);
+    BOOST_CHECK_EQUAL(pool.ChunkCount(), 2);
+    BOOST_CHECK_EQUAL(pool.ChunkBytes(), 3 * CPoolResource::MIN_CHUNK_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map)
+{
+    typedef boost::unordered_map<uint64_t, std::string, boost::hash<uint64_t>, std::equal_to<uint64_t>,
+                                 pool_allocator<std::pair<const uint64_t, std::string> > > PoolMap;
+    PoolMap m;
+    for (uint64_t i = 0; i < 10000; i++)
+        m[i] = std::string(i % 50, 'x');
+    for (uint64_t i = 0; i < 10000; i += 2)
+        m.erase(i);
+    BOOST_CHECK_EQUAL(m.size(), 5000);
+    for (uint64_t i = 1; i < 10000; i += 2)
+        BOOST_CHECK_EQUAL(m[i], std::string(i % 50, 'x'));
+
+    // The nodes of the map come from its own pool, which goes along with it
+    size_t nChunkBytes = m.get_allocator().resource->ChunkBytes();
+    BOOST_CHECK(nChunkBytes > 0);
+    PoolMap other;
+    BOOST_CHECK(m.get_allocator() != other.get_allocator());
+    other.swap(m);
+    BOOST_CHECK(m.empty());
+    BOOST_CHECK_EQUAL(other.size(), 5000);
+    BOOST_CHECK_EQUAL(other.get_allocator().resource->ChunkBytes(), nChunkBytes);
+    BOOST_CHECK_EQUAL(m.get_allocator().resource->ChunkBytes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(arena_allocator_scope)
+{
+    typedef std::set<uint64_t, std::less<uint64_t>, arena_allocator<uint64_t> > ArenaSet;
+    CArenaResource& arena = ThreadArena();
+    const size_t nUsed = arena.UsedBytes();
+    size_t nChunkBytes;
+    {
+        CArenaScope scope;
+        ArenaSet s;
+        for (uint64_t i = 0; i < 10000; i++)
+            s.insert(i);
+        BOOST_CHECK_EQUAL(s.size(), 10000);
+        BOOST_CHECK(arena.UsedBytes() > nUsed + 10000 * sizeof(uint64_t));
+        nChunkBytes = arena.ChunkBytes();
+    }
+    // The scope gives the arena back, and the chunks are used again
+    BOOST_CHECK_EQUAL(arena.UsedBytes(), nUsed);
+    {
+        CArenaScope scope;
+        ArenaSet s;
+        for (uint64_t i = 0; i < 10000; i++)
+            s.insert(i);
+        BOOST_CHECK_EQUAL(arena.ChunkBytes(), nChunkBytes);
+    }
+
+    // Blocks too large for the arena come from the heap
+    CArenaScope scope;
+    std::vector<char, arena_allocator<char> > v(CArenaResource::MAX_BLOCK_SIZE + 1);
+    BOOST_CHECK_EQUAL(arena.UsedBytes(), nUsed);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -117,6 +117,39 @@ public:
     }
 };
 
+// Goal: check that the addresses decode the same from the cache, until evicted
+BOOST_AUTO_TEST_CASE(base58_address_cache)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    std::vector<std::string> vAddresses;
+    for (size_t i = 0; i < BASE58_ADDRESS_CACHE_SIZE + 2; i++) {
+        uint160 id;
+        *id.begin() = i & 0xff;
+        *(id.begin() + 1) = i >> 8;
+        vAddresses.push_back(CBitcoinAddress(CKeyID(id)).ToString());
+    }
+    // Decoded then from the cache, the first ones evicted by the last ones
+    for (int nPass = 0; nPass < 2; nPass++) {
+        for (size_t i = 0; i < vAddresses.size(); i++) {
+            CBitcoinAddress addr(vAddresses[i]);
+            BOOST_CHECK(addr.IsValid());
+            BOOST_CHECK(addr.IsPubKey());
+            BOOST_CHECK_EQUAL(addr.ToString(), vAddresses[i]);
+        }
+    }
+
+    // The strings failing to decode fail each time, and do not spoil the valid ones
+    std::string strBad = vAddresses[0];
+    strBad[5] = (strBad[5] == 'a') ? 'b' : 'a';
+    for (int nPass = 0; nPass < 2; nPass++) {
+        CBitcoinAddress addr;
+        BOOST_CHECK(!addr.SetString(strBad));
+        BOOST_CHECK(!addr.IsValid());
+        BOOST_CHECK(addr.SetString(vAddresses[0]));
+        BOOST_CHECK(addr.IsValid());
+    }
+}
+
 // Goal: check that parsed keys match test payload
 BOOST_AUTO_TEST_CASE(base58_keys_valid_parse)
 {
@@ -0,0 +1,107 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "crypto/common.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/standard.h"
+#include "undo.h"
+#include "utilstrencodings.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_match)
+{
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; i++) {
+        GCSFilter::Element element1(32), element2(32);
+        GetRandBytes(element1.data(), element1.size());
+        GetRandBytes(element2.data(), element2.size());
+        included.insert(element1);
+        excluded.insert(element2);
+    }
+
+    const GCSFilter::Params params(0, 0, 10, 1 << 10);
+    GCSFilter filter(params, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100U);
+    for (const GCSFilter::Element& element : included) {
+        BOOST_CHECK(filter.Match(element));
+        GCSFilter::ElementSet elements = excluded;
+        elements.insert(element);
+        BOOST_CHECK(filter.MatchAny(elements));
+    }
+
+    // Decoded as encoded, and rejected once truncated
+    GCSFilter decoded(params, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 100U);
+    for (const GCSFilter::Element& element : included)
+        BOOST_CHECK(decoded.Match(element));
+    std::vector<unsigned char> vchTruncated(filter.GetEncoded().begin(), filter.GetEncoded().begin() + filter.GetEncoded().size() / 2);
+    BOOST_CHECK_THROW(GCSFilter(params, vchTruncated), std::ios_base::failure);
+
+    GCSFilter empty(params, GCSFilter::ElementSet());
+    BOOST_CHECK(!empty.Match(*included.begin()));
+    BOOST_CHECK_EQUAL(empty.GetEncoded().size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_bip158_vector)
+{
+    // The basic filter of the genesis block of the Bitcoin testnet, from BIP 158
+    const uint256 hashBlock = uint256S("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943");
+    GCSFilter::ElementSet elements;
+    elements.insert(ParseHex("4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f355"
+                             "04e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac"));
+    GCSFilter filter(GCSFilter::Params(ReadLE64(hashBlock.begin()), ReadLE64(hashBlock.begin() + 8), BASIC_FILTER_P, BASIC_FILTER_M), elements);
+    BOOST_CHECK_EQUAL(HexStr(filter.GetEncoded()), "019dfca8");
+
+    BlockFilter blockFilter(BLOCK_FILTER_BASIC, hashBlock, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(blockFilter.ComputeHeader(uint256()).GetHex(), "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750");
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic)
+{
+    uint160 hashIncluded, hashSpent, hashExcluded;
+    hashIncluded.SetHex("1111111111111111111111111111111111111111");
+    hashSpent.SetHex("2222222222222222222222222222222222222222");
+    hashExcluded.SetHex("3333333333333333333333333333333333333333");
+    const CScript scriptIncluded = GetScriptForDestination(CKeyID(hashIncluded));
+    const CScript scriptSpent = GetScriptForDestination(CScriptID(hashSpent));
+    const CScript scriptExcluded = GetScriptForDestination(CKeyID(hashExcluded));
+
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.push_back(CTxOut(5000, scriptIncluded));
+    coinbase.vout.push_back(CTxOut(0, CScript() << OP_RETURN << ParseHex("00112233")));
+    coinbase.vout.push_back(CTxOut(0, CScript()));
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    CMutableTransaction spend;
+    spend.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    spend.vout.push_back(CTxOut(4000, scriptIncluded));
+    block.vtx.push_back(MakeTransactionRef(spend));
+    CBlockUndo blockUndo;
+    blockUndo.vtxundo.resize(1);
+    blockUndo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(4500, scriptSpent)));
+
+    BlockFilter filter(BLOCK_FILTER_BASIC, block, blockUndo);
+    BOOST_CHECK(filter.GetBlockHash() == block.GetHash());
+    // The two outputs to the same script count once, the unspendable outputs not at all
+    BOOST_CHECK_EQUAL(filter.GetFilter().GetN(), 2U);
+    BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(scriptIncluded.begin(), scriptIncluded.end())));
+    BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(scriptSpent.begin(), scriptSpent.end())));
+    BOOST_CHECK(!filter.GetFilter().Match(GCSFilter::Element(scriptExcluded.begin(), scriptExcluded.end())));
+
+    BlockFilter decoded(BLOCK_FILTER_BASIC, block.GetHash(), filter.GetEncodedFilter());
+    BOOST_CHECK(decoded.GetHash() == filter.GetHash());
+    const uint256 hashPrevHeader = GetRandHash();
+    BOOST_CHECK(decoded.ComputeHeader(hashPrevHeader) == filter.ComputeHeader(hashPrevHeader));
+    BOOST_CHECK(filter.ComputeHeader(hashPrevHeader) != filter.ComputeHeader(uint256()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -438,6 +438,33 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_p2pubkey_only)
     BOOST_CHECK(!filter.contains(COutPoint(uint256S("0x02981fa052f0481dbc5868f4fc2166035a10f27a03cfd2de67326471df5bc041"), 0)));
 }
 
+BOOST_AUTO_TEST_CASE(bloom_overloads_match_serialized)
+{
+    // The outpoint and hash overloads must set the bits of their serialization as a key
+    COutPoint outpoint(uint256S("0x90c122d70786e899529d71dbeba91ba216982fb6ba58f3bdaab65e73b7e9260b"), 7);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << outpoint;
+    vector<unsigned char> vOutPoint(stream.begin(), stream.end());
+    uint256 hash = uint256S("0xb5d0e5b1e3ad5cc8e2ef4bf8fe4b9e32c4a2f5cdc5c0f8d2b2a1b8a9f8c2d3e4");
+    vector<unsigned char> vHash(hash.begin(), hash.end());
+
+    CBloomFilter filter1(10, 0.000001, 12345, BLOOM_UPDATE_ALL);
+    filter1.insert(outpoint);
+    filter1.insert(hash);
+    CBloomFilter filter2(10, 0.000001, 12345, BLOOM_UPDATE_ALL);
+    filter2.insert(vOutPoint);
+    filter2.insert(vHash);
+
+    CDataStream stream1(SER_NETWORK, PROTOCOL_VERSION), stream2(SER_NETWORK, PROTOCOL_VERSION);
+    stream1 << filter1;
+    stream2 << filter2;
+    BOOST_CHECK(stream1.str() == stream2.str());
+    BOOST_CHECK(filter2.contains(outpoint));
+    BOOST_CHECK(filter2.contains(hash));
+    BOOST_CHECK(filter1.contains(vOutPoint));
+    BOOST_CHECK(filter1.contains(vHash));
+}
+
 BOOST_AUTO_TEST_CASE(merkle_block_4_test_update_none)
 {
     // Random real block (000000000000b731f2eef9e8c63173adfb07e41bd53eb0ef0a6b720d6cb6dea4)
@@ -537,4 +564,31 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(hash_bloom)
+{
+    // 10000 hashes, 1% false positive:
+    CHashBloomFilter filter(10000, 0.01);
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 10000; i++) {
+        hashes.push_back(GetRandHash());
+        filter.insert(hashes.back());
+    }
+    BOOST_CHECK_EQUAL(filter.Count(), 10000U);
+    BOOST_CHECK_EQUAL(filter.Capacity(), 10000U);
+    BOOST_CHECK(filter.DynamicMemoryUsage() >= 10000 * 9 / 8);
+
+    // No false negatives
+    for (const uint256& hash : hashes)
+        BOOST_CHECK(filter.contains(hash));
+
+    // About 100 false positives out of 10000 random hashes
+    unsigned int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (filter.contains(GetRandHash()))
+            ++nHits;
+    }
+    BOOST_TEST_MESSAGE("HashBloomFilter got " << nHits << " false positives (~100 expected)");
+    BOOST_CHECK(nHits < 175);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "checkqueue.h"
 #include "random.h"
 #include "script/standard.h"
 #include "uint256.h"
@@ -10,13 +11,16 @@
 #include "test/test_bitcoin.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "txdb.h"
 #include "undo.h"
 #include "pubkey.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
 
 namespace
@@ -150,6 +154,29 @@ public:
 
 };
 
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB("coins_tests", 1 << 20, true) {}
+
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins)
+    {
+        db.Write(std::make_pair('c', txid), coins);
+        fLegacyCoins = true;
+    }
+
+    size_t CountRecords(char chType)
+    {
+        size_t nCount = 0;
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+            if (pcursor->key()[0] == chType)
+                nCount++;
+        }
+        return nCount;
+    }
+};
+
 }
 
 uint256 appendRandomCommitment(ZCIncrementalMerkleTree &tree)
@@ -770,6 +797,246 @@ BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewTest base;
+    std::vector<uint256> txids;
+    {
+        CCoinsViewCacheTest cache(&base);
+        for (unsigned int i = 0; i < 100; i++) {
+            uint256 txid = GetRandHash();
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i + 1;
+            coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+            txids.push_back(txid);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewCacheTest cache(&base);
+    std::vector<uint256> request(txids);
+    // Duplicates and unknown txids are fine
+    request.push_back(txids[0]);
+    request.push_back(GetRandHash());
+    CCheckQueue<CCoinsFetch> queue(4);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CCoinsFetch>::Thread, &queue));
+    cache.Prefetch(request, &queue);
+    threads.interrupt_all();
+    threads.join_all();
+
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), txids.size());
+    cache.SelfTest();
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        const CCoins* coins = cache.AccessCoins(txids[i]);
+        BOOST_CHECK(coins != NULL && coins->vout[0].nValue == i + 1);
+    }
+
+    // Nothing left to fetch
+    cache.Prefetch(request);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), txids.size());
+}
+
+BOOST_AUTO_TEST_CASE(coins_copy_dirty)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    uint256 txidOld = GetRandHash(), txidNew = GetRandHash();
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txidOld);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 1;
+    }
+    BOOST_CHECK(cache.Flush());
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txidOld);
+        coins->Clear();
+    }
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txidNew);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 2;
+    }
+    uint256 hashBlock = GetRandHash();
+    cache.SetBestBlock(hashBlock);
+
+    CCoinsMap mapCoins;
+    CAnchorsMap mapAnchors;
+    CNullifiersMap mapNullifiers;
+    uint256 hashBlockCopy, hashAnchorCopy;
+    cache.CopyDirty(mapCoins, hashBlockCopy, hashAnchorCopy, mapAnchors, mapNullifiers);
+    BOOST_CHECK_EQUAL(mapCoins.size(), 2);
+    BOOST_CHECK(hashBlockCopy == hashBlock);
+    BOOST_CHECK(hashAnchorCopy == cache.GetBestAnchor());
+
+    // The entries stay cached and are clean, so a second copy is empty
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2);
+    cache.SelfTest();
+    BOOST_CHECK(cache.AccessCoins(txidNew)->vout[0].nValue == 2);
+    BOOST_CHECK(!cache.HaveCoins(txidOld));
+    CCoinsMap mapCoinsAgain;
+    cache.CopyDirty(mapCoinsAgain, hashBlockCopy, hashAnchorCopy, mapAnchors, mapNullifiers);
+    BOOST_CHECK(mapCoinsAgain.empty());
+
+    // Writing the copy brings the base up to date
+    BOOST_CHECK(base.BatchWrite(mapCoins, hashBlock, hashAnchorCopy, mapAnchors, mapNullifiers));
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+    CCoins coinsOld;
+    BOOST_CHECK(!base.GetCoins(txidOld, coinsOld) || coinsOld.IsPruned());
+    BOOST_CHECK(base.HaveCoins(txidNew));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(base.HaveCoins(txidNew));
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_per_output, TestingSetup)
+{
+    CCoinsViewDBTest db;
+    uint256 txid = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 100;
+    coins.vout.resize(300);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = i + 1;
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    {
+        CCoinsViewCache cache(&db);
+        *cache.ModifyCoins(txid) = coins;
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(db.CountRecords('C'), 300);
+
+    // Spending an output only erases its own record
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Spend(5);
+        BOOST_CHECK(cache.Flush());
+    }
+    coins.Spend(5);
+    CCoins read;
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+    BOOST_CHECK_EQUAL(db.CountRecords('C'), 299);
+    BOOST_CHECK(!db.HaveCoins(GetRandHash()));
+
+    // Coins stored a record per transaction are read, rewritten and upgraded
+    uint256 txidLegacy = GetRandHash();
+    uint256 txidLegacy2 = GetRandHash();
+    db.WriteLegacyCoins(txidLegacy, coins);
+    db.WriteLegacyCoins(txidLegacy2, coins);
+    BOOST_CHECK(db.HaveCoins(txidLegacy));
+    BOOST_CHECK(db.GetCoins(txidLegacy, read));
+    BOOST_CHECK(read == coins);
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txidLegacy)->Spend(0);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(db.CountRecords('c'), 1);
+    BOOST_CHECK_EQUAL(db.CountRecords('C'), 299 + 298);
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK_EQUAL(db.CountRecords('c'), 0);
+    BOOST_CHECK_EQUAL(db.CountRecords('C'), 299 + 298 + 299);
+    BOOST_CHECK(db.GetCoins(txidLegacy2, read));
+    BOOST_CHECK(read == coins);
+
+    // Spending everything leaves nothing behind
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Clear();
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK_EQUAL(db.CountRecords('C'), 298 + 299);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_anchor_cache, TestingSetup)
+{
+    CCoinsViewDBTest db;
+    ZCIncrementalMerkleTree tree;
+    std::vector<uint256> roots;
+    // More anchors than the database keeps deserialized
+    for (unsigned int i = 0; i < 150; i++) {
+        CCoinsViewCache cache(&db);
+        tree.append(GetRandHash());
+        cache.PushAnchor(tree);
+        BOOST_CHECK(cache.Flush());
+        roots.push_back(tree.root());
+    }
+    for (const uint256& rt : roots) {
+        ZCIncrementalMerkleTree read;
+        BOOST_CHECK(db.GetAnchorAt(rt, read));
+        BOOST_CHECK(read.root() == rt);
+    }
+
+    // A removed anchor is not served from the cache
+    {
+        CCoinsViewCache cache(&db);
+        cache.PopAnchor(roots[roots.size() - 2]);
+        BOOST_CHECK(cache.Flush());
+    }
+    ZCIncrementalMerkleTree read;
+    BOOST_CHECK(!db.GetAnchorAt(roots.back(), read));
+    BOOST_CHECK(db.GetBestAnchor() == roots[roots.size() - 2]);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_snapshot_nullifiers, TestingSetup)
+{
+    CCoinsViewDB source("coins_tests_source", 1 << 20, true);
+    uint256 txid = GetRandHash();
+    uint256 nf = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    {
+        CCoinsViewCache cache(&source);
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->nVersion = 1;
+            coins->nHeight = 100;
+            coins->vout.resize(2);
+            coins->vout[1].nValue = 1;
+            coins->vout[1].scriptPubKey = CScript() << OP_TRUE;
+        }
+        cache.SetNullifier(nf, true);
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    boost::filesystem::path path = pathTemp / "snapshot.dat";
+    CChainstateSnapshotInfo info;
+    {
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(source.WriteSnapshot(fileout, info));
+    }
+    BOOST_CHECK_EQUAL(info.nNullifiers, 1);
+
+    // The filter is already loaded, as it is by the time headers sync brings in the snapshot block
+    CCoinsViewDB db("coins_tests_snapshot", 1 << 20, true);
+    db.LoadNullifierFilter();
+    BOOST_CHECK(!db.GetNullifier(nf));
+    BOOST_CHECK(db.LoadSnapshot(path, info));
+    BOOST_CHECK(db.GetNullifier(nf));
+    BOOST_CHECK(db.GetBestBlock().IsNull());
+    BOOST_CHECK(db.ActivateSnapshot(info));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    BOOST_CHECK(db.GetNullifier(nf));
+    BOOST_CHECK(!db.GetNullifier(GetRandHash()));
+    BOOST_CHECK(db.HaveCoins(txid));
+    BOOST_CHECK(db.ClearInterruptedSnapshot());
+    BOOST_CHECK(db.HaveCoins(txid));
+
+    // A load that did not get to ActivateSnapshot is cleared, and can be done again
+    CCoinsViewDB interrupted("coins_tests_interrupted", 1 << 20, true);
+    BOOST_CHECK(interrupted.LoadSnapshot(path, info));
+    BOOST_CHECK(interrupted.ClearInterruptedSnapshot());
+    BOOST_CHECK(!interrupted.HaveCoins(txid));
+    BOOST_CHECK(!interrupted.GetNullifier(nf));
+    BOOST_CHECK(interrupted.LoadSnapshot(path, info));
+    BOOST_CHECK(interrupted.ActivateSnapshot(info));
+    BOOST_CHECK(interrupted.GetNullifier(nf));
+}
+
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
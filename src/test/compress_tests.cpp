@@ -3,6 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "compressor.h"
+#include "lzcompress.h"
+#include "main.h"
+#include "random.h"
+#include "undo.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
@@ -62,4 +66,93 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+BOOST_AUTO_TEST_CASE(lz_roundtrip)
+{
+    for (int i = 0; i < 200; i++) {
+        // Random bytes, a small alphabet, and runs copied from a few bytes back
+        std::vector<char> vIn(insecure_rand() % 20000);
+        for (size_t j = 0; j < vIn.size(); j++) {
+            switch (i % 3) {
+            case 0: vIn[j] = insecure_rand(); break;
+            case 1: vIn[j] = insecure_rand() % 4; break;
+            default: vIn[j] = (j > 8 && insecure_rand() % 8) ? vIn[j - 1 - insecure_rand() % 8] : (char)insecure_rand();
+            }
+        }
+        std::vector<char> vCompressed, vOut;
+        LZCompress(vIn.data(), vIn.size(), vCompressed);
+        BOOST_CHECK(LZDecompress(vCompressed.data(), vCompressed.size(), vIn.size(), vOut));
+        BOOST_CHECK(vOut == vIn);
+        if (i % 3 == 1 && vIn.size() > 100)
+            BOOST_CHECK(vCompressed.size() < vIn.size() / 2);
+
+        // The expected size is enforced, and corrupt data stays within bounds
+        BOOST_CHECK(!LZDecompress(vCompressed.data(), vCompressed.size(), vIn.size() + 1, vOut));
+        if (!vCompressed.empty()) {
+            vCompressed[insecure_rand() % vCompressed.size()] ^= 1 + insecure_rand() % 255;
+            LZDecompress(vCompressed.data(), vCompressed.size(), vIn.size(), vOut);
+            BOOST_CHECK(vOut.size() <= vIn.size());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(disk_record)
+{
+    std::vector<uint256> vHashes(100, GetRandHash());
+    for (int i = 0; i < 2; i++) {
+        CDiskRecord record(vHashes, i == 1);
+        BOOST_CHECK_EQUAL(record.IsCompressed(), i == 1);
+        BOOST_CHECK_EQUAL(record.nSizeField & ~DISK_RECORD_COMPRESSED, record.size());
+        if (record.IsCompressed())
+            BOOST_CHECK(record.size() < ::GetSerializeSize(vHashes, SER_DISK, CLIENT_VERSION));
+
+        CMemoryReader reader(record.vData.data(), record.vData.data() + record.size(), SER_DISK, CLIENT_VERSION);
+        std::vector<uint256> vRead;
+        ReadDiskRecord(reader, record.nSizeField, vRead);
+        BOOST_CHECK(vRead == vHashes);
+    }
+
+    // Data which does not compress is stored as it is
+    uint256 hash = GetRandHash();
+    BOOST_CHECK(!CDiskRecord(hash, true).IsCompressed());
+}
+
+BOOST_AUTO_TEST_CASE(compact_undo)
+{
+    CBlockUndo blockundo;
+    blockundo.old_tree_root = GetRandHash();
+    std::vector<unsigned char> vchKeyID = ToByteVector(GetRandHash());
+    vchKeyID.resize(20);
+    const CScript scriptPool = CScript() << OP_DUP << OP_HASH160 << vchKeyID << OP_EQUALVERIFY << OP_CHECKSIG;
+    for (int i = 0; i < 100; i++) {
+        blockundo.vtxundo.push_back(CTxUndo());
+        std::vector<CTxInUndo>& vprevout = blockundo.vtxundo.back().vprevout;
+        // The payouts of a pool spent again and again, and scripts seen once
+        vprevout.push_back(CTxInUndo(CTxOut(i * COIN, scriptPool), i % 2 == 0, i % 2 == 0 ? 1000 + i : 0, 1));
+        vprevout.push_back(CTxInUndo(CTxOut(i, CScript() << OP_RETURN << ToByteVector(GetRandHash()))));
+    }
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION);
+    ssLegacy << blockundo;
+    const std::string strLegacy = ssLegacy.str();
+    CDataStream ssCompact(SER_DISK, CLIENT_VERSION);
+    ssCompact << CBlockUndoCompactor(blockundo);
+    BOOST_CHECK(ssCompact.size() < ssLegacy.size());
+    BOOST_CHECK_EQUAL(ssCompact.size(), CBlockUndoCompactor(blockundo).GetSerializeSize(SER_DISK, CLIENT_VERSION));
+
+    // Both formats read back to the same undo data, whose legacy serialization the checksums cover
+    for (CDataStream* ss : {&ssLegacy, &ssCompact}) {
+        CBlockUndo read;
+        *ss >> read;
+        BOOST_CHECK(ss->empty());
+        CDataStream ssRead(SER_DISK, CLIENT_VERSION);
+        ssRead << read;
+        BOOST_CHECK(ssRead.str() == strLegacy);
+    }
+
+    // A reference to a script not stored yet is corrupt
+    CDataStream ssBad(SER_DISK, CLIENT_VERSION);
+    ssBad << UNDO_COMPACT_MARKER << VARINT(1) << VARINT(1) << VARINT(0) << VARINT(0) << VARINT(1);
+    CBlockUndo read;
+    BOOST_CHECK_THROW(ssBad >> read, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,8 @@
 #endif
 
 #include "arith_uint256.h"
+#include "crypto/blake2b_batch.h"
+#include "crypto/common.h"
 #include "crypto/sha256.h"
 #include "crypto/equihash.h"
 #include "test/test_bitcoin.h"
@@ -82,6 +84,19 @@ void TestEquihashSolvers(unsigned int n, unsigned int k, const std::string &I, c
     BOOST_TEST_MESSAGE(strm.str());
     BOOST_CHECK(retOpt == solns);
     BOOST_CHECK(retOpt == ret);
+
+    // And so should the parallel solver, whatever the number of threads
+    for (unsigned int nThreads : {1, 3}) {
+        std::set<std::vector<uint32_t>> retPar;
+        std::function<bool(std::vector<unsigned char>)> validBlockPar =
+                [&retPar, cBitLen](std::vector<unsigned char> soln) {
+            retPar.insert(GetIndicesFromMinimal(soln, cBitLen));
+            return false;
+        };
+        EhParallelSolveUncancellable(n, k, state, validBlockPar, nThreads);
+        BOOST_TEST_MESSAGE("[Parallel, " << nThreads << " threads] Number of solutions: " << retPar.size());
+        BOOST_CHECK(retPar == solns);
+    }
 }
 #endif
 
@@ -199,4 +214,41 @@ BOOST_AUTO_TEST_CASE(validator_testvectors) {
                 false);
 }
 
+BOOST_AUTO_TEST_CASE(blake2b_batch) {
+    // Every length of buffered input, on both sides of the block boundaries
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = "ZcashPoW";
+    std::vector<unsigned char> input(300);
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = i * 7 + 3;
+    std::vector<uint32_t> words(37);
+    for (size_t i = 0; i < words.size(); i++)
+        words[i] = i * 2654435761u;
+
+    for (size_t len = 0; len <= input.size(); len++) {
+        for (size_t outlen : {1, 50, 64}) {
+            crypto_generichash_blake2b_state state;
+            crypto_generichash_blake2b_init_salt_personal(&state, NULL, 0, outlen, NULL, personalization);
+            crypto_generichash_blake2b_update(&state, input.data(), len);
+
+            CBlake2bBatch batch(state, outlen);
+            // Only a word that would be split over two blocks is not handled
+            BOOST_CHECK_EQUAL(batch.IsValid(), len % 128 < 125 && len != 256);
+            if (!batch.IsValid())
+                continue;
+
+            std::vector<unsigned char> hashes(words.size() * outlen);
+            batch.Finalize(words.data(), words.size(), hashes.data());
+            for (size_t i = 0; i < words.size(); i++) {
+                crypto_generichash_blake2b_state copy = state;
+                unsigned char le[4];
+                WriteLE32(le, words[i]);
+                crypto_generichash_blake2b_update(&copy, le, sizeof(le));
+                std::vector<unsigned char> expected(outlen);
+                crypto_generichash_blake2b_final(&copy, expected.data(), outlen);
+                BOOST_CHECK(std::equal(expected.begin(), expected.end(), hashes.begin() + i * outlen));
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,55 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ioscheduler.h"
+#include "utiltime.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(ioscheduler_tests, BasicTestingSetup)
+
+static void PruneOperation()
+{
+    CIOOperation op(IO_PRUNE);
+}
+
+BOOST_AUTO_TEST_CASE(background_waits_for_block_writes)
+{
+    const CIOClassStats before = GetIOClassStats(IO_PRUNE);
+    {
+        CIOOperation op(IO_PRUNE, 100);
+    }
+    CIOClassStats after = GetIOClassStats(IO_PRUNE);
+    BOOST_CHECK_EQUAL(after.nOps, before.nOps + 1);
+    BOOST_CHECK_EQUAL(after.nBytes, before.nBytes + 100);
+    BOOST_CHECK_EQUAL(after.nDeferred, before.nDeferred);
+
+    // A background operation starts once the block write is done
+    boost::scoped_ptr<CIOOperation> block(new CIOOperation(IO_BLOCK));
+    boost::thread thread(&PruneOperation);
+    MilliSleep(50);
+    BOOST_CHECK_EQUAL(GetIOClassStats(IO_PRUNE).nOps, after.nOps);
+    block.reset();
+    thread.join();
+    const CIOClassStats deferred = GetIOClassStats(IO_PRUNE);
+    BOOST_CHECK_EQUAL(deferred.nOps, after.nOps + 1);
+    BOOST_CHECK_EQUAL(deferred.nDeferred, after.nDeferred + 1);
+    BOOST_CHECK(deferred.nDeferMicros - after.nDeferMicros >= 40000);
+}
+
+BOOST_AUTO_TEST_CASE(rate_limit)
+{
+    SetIOBackgroundLimit(1 << 20);
+    const int64_t nStart = GetTimeMillis();
+    for (int i = 0; i < 3; i++)
+        CIOOperation op(IO_INDEX, 100 << 10);
+    // Each operation after the first waits for the time the one before takes at 1 MiB/s
+    BOOST_CHECK(GetTimeMillis() - nStart >= 150);
+    SetIOBackgroundLimit(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -193,6 +193,23 @@ BOOST_AUTO_TEST_CASE(key_test1)
 }
 */
 
+// More keys than Verify keeps parsed, compressed and not, each checked against the others
+BOOST_AUTO_TEST_CASE(key_verify_parsed_keys)
+{
+    std::vector<CKey> keys(20);
+    for (size_t i = 0; i < keys.size(); i++)
+        keys[i].MakeNewKey(i % 3 != 0);
+    const uint256 hash = GetRandHash();
+    for (int nRound = 0; nRound < 3; nRound++) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            std::vector<unsigned char> vchSig;
+            BOOST_CHECK(keys[i].Sign(hash, vchSig));
+            for (size_t j = 0; j < keys.size(); j++)
+                BOOST_CHECK_EQUAL(keys[j].GetPubKey().Verify(hash, vchSig), i == j);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(zc_address_test)
 {
     for (size_t i = 0; i < 1000; i++) {
@@ -101,4 +101,24 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(block_index_trim_solution)
+{
+    FlushStateToDisk();
+    LOCK(cs_main);
+    const CBlockIndex* pgenesis = chainActive.Genesis();
+    BOOST_REQUIRE(pgenesis != NULL && !pgenesis->nSolution.empty());
+
+    // A trimmed entry reads its solution back from the block tree database
+    CBlockIndex index(*pgenesis);
+    index.TrimSolution();
+    BOOST_CHECK(index.nSolution.empty());
+    BOOST_CHECK(index.GetSolution() == pgenesis->nSolution);
+    BOOST_CHECK(index.GetBlockHeader().GetHash() == pgenesis->GetBlockHash());
+
+    // and writes it back in full
+    CDiskBlockIndex diskindex(&index);
+    BOOST_CHECK(!diskindex.fSolutionTrimmed);
+    BOOST_CHECK(diskindex.nSolution == pgenesis->nSolution);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 #include "main.h"
 #include "txmempool.h"
 #include "util.h"
+#include "validationinterface.h"
 
 #include "test/test_bitcoin.h"
 
@@ -101,4 +102,336 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    std::list<CTransaction> removed;
+
+    // Three unrelated transactions of the same size paying different fees
+    CMutableTransaction tx[3];
+    CAmount fees[3] = { 2000LL, 10000LL, 5000LL };
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.n = i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], fees[i], i, 0.0, 1));
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // Highest fee rate first
+    std::vector<uint256> sortedOrder;
+    sortedOrder.push_back(tx[1].GetHash());
+    sortedOrder.push_back(tx[2].GetHash());
+    sortedOrder.push_back(tx[0].GetHash());
+    {
+        int i = 0;
+        CTxMemPool::indexed_transaction_set::index<modified_feerate>::type::iterator it = pool.mapTx.get<modified_feerate>().begin();
+        for (; it != pool.mapTx.get<modified_feerate>().end(); ++it, ++i)
+            BOOST_CHECK_EQUAL(it->GetTx().GetHash().ToString(), sortedOrder[i].ToString());
+    }
+
+    // Oldest first
+    {
+        int i = 0;
+        CTxMemPool::indexed_transaction_set::index<entry_time>::type::iterator it = pool.mapTx.get<entry_time>().begin();
+        for (; it != pool.mapTx.get<entry_time>().end(); ++it, ++i)
+            BOOST_CHECK_EQUAL(it->GetTx().GetHash().ToString(), tx[i].GetHash().ToString());
+    }
+
+    // A fee delta moves the transaction in the fee rate index
+    pool.PrioritiseTransaction(tx[0].GetHash(), tx[0].GetHash().ToString(), 0.0, 20000LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.get<modified_feerate>().begin()->GetTx().GetHash().ToString(), tx[0].GetHash().ToString());
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx[0].GetHash())->GetModifiedFee(), 22000LL);
+
+    // A child paying a high fee for a low fee parent
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = tx[2].GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    CTxMemPoolEntry childEntry(txChild, 40000LL, 3, 0.0, 1);
+    pool.addUnchecked(txChild.GetHash(), childEntry);
+
+    CTxMemPool::txiter childIt = pool.mapTx.find(txChild.GetHash());
+    CTxMemPool::txiter parentIt = pool.mapTx.find(tx[2].GetHash());
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetSizeWithAncestors(), childIt->GetTxSize() + parentIt->GetTxSize());
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 45000LL);
+    BOOST_CHECK(pool.GetMemPoolParents(childIt).count(parentIt));
+    BOOST_CHECK(pool.GetMemPoolChildren(parentIt).count(childIt));
+
+    CTxMemPool::setEntries setAncestors;
+    pool.CalculateMemPoolAncestors(childEntry, setAncestors);
+    BOOST_CHECK_EQUAL(setAncestors.size(), 1);
+    CTxMemPool::setEntries setDescendants;
+    pool.CalculateDescendants(parentIt, setDescendants);
+    BOOST_CHECK_EQUAL(setDescendants.size(), 2);
+
+    // The package of parent and child has the best ancestor fee rate
+    BOOST_CHECK_EQUAL(pool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash().ToString(), txChild.GetHash().ToString());
+
+    // Prioritising the parent is reflected in the ancestor fees of the child
+    pool.PrioritiseTransaction(tx[2].GetHash(), tx[2].GetHash().ToString(), 0.0, 1000LL);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 46000LL);
+
+    // Mining the parent leaves the child on its own
+    pool.remove(tx[2], removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetSizeWithAncestors(), childIt->GetTxSize());
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 40000LL);
+    BOOST_CHECK(pool.GetMemPoolParents(childIt).empty());
+    removed.clear();
+
+    // Adding the parent back (as after a reorg) links the child again
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], fees[2], 2, 0.0, 1));
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 46000LL);
+
+    pool.remove(tx[2], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    std::list<CTransaction> removed;
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 1000LL, 0, 0.0, 1));
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 10000LL, 0, 0.0, 1));
+
+    // A child paying for its parent
+    CMutableTransaction tx3;
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_2;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 20000LL, 0, 0.0, 1));
+
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHash());
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it2->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(it2->GetSizeWithDescendants(), it2->GetTxSize() + it3->GetTxSize());
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithDescendants(), 30000LL);
+    BOOST_CHECK_EQUAL(it3->GetCountWithDescendants(), 1);
+    size_t nSize1 = pool.mapTx.find(tx1.GetHash())->GetTxSize();
+    size_t nSize2 = it2->GetTxSize();
+    size_t nSize3 = it3->GetTxSize();
+
+    // Nothing to evict below the limit
+    BOOST_CHECK(pool.GetMinFee(1).GetFeePerK() == 0);
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // The lowest fee rate goes first, and the minimum fee rises to its fee rate
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    CFeeRate expected(1000LL, nSize1);
+    expected += CFeeRate(1000);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), expected.GetFeePerK());
+
+    // Prioritising the child raises the descendant fees of the parent
+    pool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), 0.0, 5000LL);
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithDescendants(), 35000LL);
+
+    // Evicting the parent evicts the child as well
+    pool.TrimToSize(1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    CFeeRate expectedPackage(35000LL, nSize2 + nSize3);
+    expectedPackage += CFeeRate(1000);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), expectedPackage.GetFeePerK());
+
+    // The minimum fee only decays once a block has been seen
+    int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), expectedPackage.GetFeePerK());
+
+    std::vector<CTransactionRef> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts, false);
+    SetMockTime(nStartTime + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), llround(expectedPackage.GetFeePerK() / 2.0));
+
+    // ... and drops to zero below half the minimum relay fee
+    SetMockTime(nStartTime + 20 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolExpireTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.n = i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    // The third transaction, the youngest, spends the first, the oldest
+    tx[2].vin[0].prevout = COutPoint(tx[0].GetHash(), 0);
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 1000LL, 100, 0.0, 1));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 1000LL, 200, 0.0, 1));
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 1000LL, 300, 0.0, 1));
+
+    BOOST_CHECK_EQUAL(pool.Expire(100), 0);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // The child goes with its expired parent
+    BOOST_CHECK_EQUAL(pool.Expire(150), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(tx[1].GetHash()));
+
+    BOOST_CHECK_EQUAL(pool.Expire(1000), 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolChangesSinceTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.n = i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    std::vector<uint256> vAdded, vRemoved;
+    BOOST_CHECK_EQUAL(pool.GetChangeSequence(), 0);
+    BOOST_CHECK(pool.GetChangesSince(0, vAdded, vRemoved));
+    BOOST_CHECK(vAdded.empty() && vRemoved.empty());
+
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 1000LL, 0, 0.0, 1));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 1000LL, 0, 0.0, 1));
+    const uint64_t nSequence = pool.GetChangeSequence();
+    BOOST_CHECK_EQUAL(nSequence, 2);
+
+    // A transaction added and removed since is only reported removed
+    std::list<CTransaction> removed;
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 1000LL, 0, 0.0, 1));
+    pool.remove(tx[2], removed);
+    pool.remove(tx[0], removed);
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 1000LL, 0, 0.0, 1));
+    pool.remove(tx[1], removed);
+    BOOST_CHECK(pool.GetChangesSince(nSequence, vAdded, vRemoved));
+    BOOST_CHECK(vAdded == std::vector<uint256>(1, tx[0].GetHash()));
+    BOOST_CHECK_EQUAL(vRemoved.size(), 2);
+    BOOST_CHECK(std::count(vRemoved.begin(), vRemoved.end(), tx[1].GetHash()));
+    BOOST_CHECK(std::count(vRemoved.begin(), vRemoved.end(), tx[2].GetHash()));
+
+    BOOST_CHECK(pool.GetChangesSince(pool.GetChangeSequence(), vAdded, vRemoved));
+    BOOST_CHECK(vAdded.empty() && vRemoved.empty());
+    BOOST_CHECK(!pool.GetChangesSince(pool.GetChangeSequence() + 1, vAdded, vRemoved));
+
+    // The changes before a clear are no longer complete
+    pool.clear();
+    BOOST_CHECK(!pool.GetChangesSince(nSequence, vAdded, vRemoved));
+    BOOST_CHECK(pool.GetChangesSince(pool.GetChangeSequence(), vAdded, vRemoved));
+}
+
+class MempoolEventRecorder : public CValidationInterface
+{
+public:
+    std::vector<std::pair<uint256, uint64_t> > vAdded;
+    std::vector<std::pair<uint256, MemPoolRemovalReason> > vRemoved;
+    uint64_t nLastSequence = 0;
+
+protected:
+    void TransactionAddedToMempool(const CTransaction &tx, uint64_t nMempoolSequence)
+    {
+        vAdded.push_back(std::make_pair(tx.GetHash(), nMempoolSequence));
+        nLastSequence = nMempoolSequence;
+    }
+
+    void TransactionRemovedFromMempool(const CTransaction &tx, MemPoolRemovalReason reason, uint64_t nMempoolSequence)
+    {
+        vRemoved.push_back(std::make_pair(tx.GetHash(), reason));
+        nLastSequence = nMempoolSequence;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(MempoolNotificationsTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    MempoolEventRecorder recorder;
+    RegisterValidationInterface(&recorder);
+
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.n = i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    // The second transaction spends the first
+    tx[1].vin[0].prevout = COutPoint(tx[0].GetHash(), 0);
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 1000LL, 100, 0.0, 1));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 1000LL, 200, 0.0, 1));
+    BOOST_CHECK_EQUAL(recorder.vAdded.size(), 2);
+    BOOST_CHECK(recorder.vAdded[0].first == tx[0].GetHash());
+    BOOST_CHECK_EQUAL(recorder.vAdded[1].second, pool.GetChangeSequence());
+
+    // A block including the first conflicts with nothing, its child stays
+    std::vector<CTransactionRef> vtx(1, MakeTransactionRef(tx[0]));
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts, false);
+    BOOST_CHECK_EQUAL(recorder.vRemoved.size(), 1);
+    BOOST_CHECK(recorder.vRemoved[0].first == tx[0].GetHash());
+    BOOST_CHECK(recorder.vRemoved[0].second == MemPoolRemovalReason::BLOCK);
+
+    // A transaction of a block spending the same output removes the other as a conflict
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 1000LL, 300, 0.0, 1));
+    CMutableTransaction txDoubleSpend = tx[2];
+    txDoubleSpend.vout[0].nValue = 9 * COIN;
+    vtx.assign(1, MakeTransactionRef(txDoubleSpend));
+    pool.removeForBlock(vtx, 2, conflicts, false);
+    BOOST_CHECK_EQUAL(recorder.vRemoved.size(), 2);
+    BOOST_CHECK(recorder.vRemoved[1].first == tx[2].GetHash());
+    BOOST_CHECK(recorder.vRemoved[1].second == MemPoolRemovalReason::CONFLICT);
+
+    BOOST_CHECK_EQUAL(pool.Expire(1000), 1);
+    BOOST_CHECK(recorder.vRemoved.back().first == tx[1].GetHash());
+    BOOST_CHECK(recorder.vRemoved.back().second == MemPoolRemovalReason::EXPIRY);
+    BOOST_CHECK_EQUAL(recorder.nLastSequence, pool.GetChangeSequence());
+    BOOST_CHECK_EQUAL(MemPoolRemovalReasonName(MemPoolRemovalReason::EXPIRY), std::string("expiry"));
+
+    UnregisterValidationInterface(&recorder);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -331,6 +331,15 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     hash = tx.GetHash();
     mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey));
+    // A second template on the same tip, from what the first one cached, has the same transactions
+    {
+        CBlockTemplate* pblocktemplate2;
+        BOOST_CHECK(pblocktemplate2 = CreateNewBlock(scriptPubKey));
+        BOOST_CHECK_EQUAL(pblocktemplate2->block.vtx.size(), pblocktemplate->block.vtx.size());
+        for (size_t i = 1; i < pblocktemplate->block.vtx.size() && i < pblocktemplate2->block.vtx.size(); i++)
+            BOOST_CHECK(pblocktemplate2->block.vtx[i]->GetHash() == pblocktemplate->block.vtx[i]->GetHash());
+        delete pblocktemplate2;
+    }
     delete pblocktemplate;
     mempool.clear();
 
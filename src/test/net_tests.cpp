@@ -0,0 +1,265 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addrman.h"
+#include "chainparams.h"
+#include "net.h"
+#include "protocol.h"
+#include "test/test_bitcoin.h"
+#include "zen/tlsmanager.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(shared_message)
+{
+    std::vector<CInv> vInv;
+    for (int i = 0; i < 10; i++)
+        vInv.push_back(CInv(MSG_BLOCK, uint256S(strprintf("%x", i + 1))));
+
+    // The sockets are invalid, so the messages stay queued
+    CAddress addr(CService("10.0.0.1", 8233));
+    CNode node1(INVALID_SOCKET, addr, "", true);
+    CNode node2(INVALID_SOCKET, addr, "", true);
+
+    CSharedMessage msg = MakeSharedMessage("inv", vInv);
+    node1.PushMessage("inv", vInv);
+    node1.PushSharedMessage(msg);
+    node2.PushSharedMessage(msg);
+
+    // Same bytes as a message built for the node itself
+    BOOST_CHECK_EQUAL(node1.vSendMsg.size(), 2U);
+    BOOST_CHECK(*node1.vSendMsg[0] == *node1.vSendMsg[1]);
+    BOOST_CHECK_EQUAL(node1.nSendSize, 2 * msg->size());
+
+    // and a single buffer for every node
+    BOOST_CHECK_EQUAL(node2.vSendMsg.size(), 1U);
+    BOOST_CHECK(node2.vSendMsg[0] == msg);
+    BOOST_CHECK(node1.vSendMsg[1] == msg);
+    BOOST_CHECK_EQUAL(msg.use_count(), 3);
+
+    CMessageHeader hdr(Params().MessageStart());
+    CDataStream ss(msg->begin(), msg->begin() + CMessageHeader::HEADER_SIZE, SER_NETWORK, PROTOCOL_VERSION);
+    ss >> hdr;
+    BOOST_CHECK(hdr.IsValid(Params().MessageStart()));
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "inv");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, msg->size() - CMessageHeader::HEADER_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_pool)
+{
+    CRecvBufferPool pool;
+    CSerializeData vch;
+
+    pool.Get(vch, 3000);
+    BOOST_CHECK(vch.empty());
+    BOOST_CHECK_EQUAL(vch.capacity(), 4096U);
+    const char* pBuffer = vch.data();
+
+    // a released buffer serves the requests of its size class and smaller ones
+    pool.Release(vch);
+    BOOST_CHECK(vch.empty());
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 1U);
+    pool.Get(vch, 4096);
+    BOOST_CHECK(vch.data() == pBuffer);
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 0U);
+    pool.Release(vch);
+    pool.Get(vch, 5000);
+    BOOST_CHECK(vch.data() != pBuffer);
+    BOOST_CHECK_EQUAL(vch.capacity(), 8192U);
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 1U);
+    pool.Release(vch);
+
+    // the free buffers of a size class are bounded
+    std::vector<CSerializeData> vBuffers(10);
+    for (size_t i = 0; i < vBuffers.size(); i++)
+        pool.Get(vBuffers[i], MAX_PROTOCOL_MESSAGE_LENGTH);
+    for (size_t i = 0; i < vBuffers.size(); i++)
+        pool.Release(vBuffers[i]);
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 2U + 2U);
+
+    // nor are tiny buffers kept
+    CSerializeData vchSmall(10);
+    pool.Release(vchSmall);
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 2U + 2U);
+}
+
+BOOST_AUTO_TEST_CASE(poisson_next_send)
+{
+    const int64_t nNow = 1000000000;
+    int64_t nTotal = 0;
+    for (int i = 0; i < 1000; i++) {
+        int64_t nNext = PoissonNextSend(nNow, 5);
+        BOOST_CHECK(nNext >= nNow);
+        nTotal += nNext - nNow;
+    }
+    // the average of 1000 exponentially distributed delays is within 20% of the mean but
+    // with a negligible probability
+    BOOST_CHECK(nTotal / 1000 > 4000000 && nTotal / 1000 < 6000000);
+}
+
+BOOST_AUTO_TEST_CASE(inventory_batching)
+{
+    CAddress addr(CService("10.0.0.1", 8233));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    CInv invTx(MSG_TX, uint256S("1"));
+    CInv invBlock(MSG_BLOCK, uint256S("2"));
+
+    node.PushInventory(invTx);
+    node.PushInventory(invTx);
+    node.PushInventory(invBlock);
+    BOOST_CHECK_EQUAL(node.setInventoryTxToSend.size(), 1U);
+    BOOST_CHECK_EQUAL(node.vInventoryToSend.size(), 1U);
+
+    // inventory known to the peer is not announced again
+    node.AddInventoryKnown(CInv(MSG_TX, uint256S("3")));
+    node.PushInventory(CInv(MSG_TX, uint256S("3")));
+    BOOST_CHECK_EQUAL(node.setInventoryTxToSend.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(inventory_known_size)
+{
+    unsigned int nMaxKnownInventoryOrig = nMaxKnownInventory;
+    nMaxKnownInventory = MIN_KNOWN_INVENTORY;
+    CAddress addr(CService("10.0.0.1", 8233));
+    CNode node(INVALID_SOCKET, addr, "", true);
+
+    // the last nMaxKnownInventory entries are remembered
+    for (unsigned int i = 0; i < MIN_KNOWN_INVENTORY; i++)
+        node.AddInventoryKnown(CInv(MSG_TX, uint256S(strprintf("%x", i + 1))));
+    for (unsigned int i = 0; i < MIN_KNOWN_INVENTORY; i++)
+        node.PushInventory(CInv(MSG_TX, uint256S(strprintf("%x", i + 1))));
+    BOOST_CHECK(node.setInventoryTxToSend.empty());
+
+    // and older ones are forgotten, so the filter does not grow with the traffic
+    for (unsigned int i = MIN_KNOWN_INVENTORY; i < 5 * MIN_KNOWN_INVENTORY; i++)
+        node.AddInventoryKnown(CInv(MSG_TX, uint256S(strprintf("%x", i + 1))));
+    node.PushInventory(CInv(MSG_TX, uint256S("1")));
+    BOOST_CHECK_EQUAL(node.setInventoryTxToSend.size(), 1U);
+
+    nMaxKnownInventory = nMaxKnownInventoryOrig;
+}
+
+BOOST_AUTO_TEST_CASE(upload_target)
+{
+    // 20 blocks of 2 MB are kept for relaying the new blocks of the next 3000 seconds
+    CNode::SetMaxOutboundTimeframe(3000);
+    CNode::SetMaxOutboundTarget(100 * 1000 * 1000);
+    BOOST_CHECK(!CNode::OutboundTargetReached(false));
+    BOOST_CHECK(!CNode::OutboundTargetReached(true));
+
+    CNode::RecordBytesSent(70 * 1000 * 1000);
+    BOOST_CHECK(!CNode::OutboundTargetReached(false));
+    BOOST_CHECK(CNode::OutboundTargetReached(true));
+    BOOST_CHECK_EQUAL(CNode::GetOutboundTargetBytesLeft(), 30U * 1000 * 1000);
+
+    CNode::RecordBytesSent(30 * 1000 * 1000);
+    BOOST_CHECK(CNode::OutboundTargetReached(false));
+    BOOST_CHECK_EQUAL(CNode::GetOutboundTargetBytesLeft(), 0U);
+    BOOST_CHECK(CNode::GetMaxOutboundTimeLeftInCycle() <= 3000);
+
+    CNode::SetMaxOutboundTarget(0);
+    CNode::SetMaxOutboundTimeframe(MAX_UPLOAD_TIMEFRAME);
+    BOOST_CHECK(!CNode::OutboundTargetReached(true));
+}
+
+BOOST_AUTO_TEST_CASE(peer_upload_rate)
+{
+    CNode::SetMaxPeerUploadRate(1000);
+    CAddress addr(CService("10.0.0.1", 8233));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    int64_t nNow = node.nSendTokensTime;
+
+    // a full message is sent even beyond the tokens left, which leaves a debt
+    BOOST_CHECK(node.CanSendNow(nNow));
+    node.nSendTokens -= 3500;
+    BOOST_CHECK(!node.CanSendNow(nNow));
+    BOOST_CHECK(!node.CanSendNow(nNow + 2000000));
+    BOOST_CHECK(node.CanSendNow(nNow + 2600000));
+
+    // at most one second of sending is saved
+    BOOST_CHECK(node.CanSendNow(nNow + 60000000));
+    BOOST_CHECK_EQUAL(node.nSendTokens, 1000);
+
+    // whitelisted peers are not limited
+    node.fWhitelisted = true;
+    node.nSendTokens = -1000000;
+    BOOST_CHECK(node.CanSendNow(nNow + 60000000));
+
+    CNode::SetMaxPeerUploadRate(0);
+    node.fWhitelisted = false;
+    BOOST_CHECK(node.CanSendNow(nNow + 60000000));
+}
+
+BOOST_FIXTURE_TEST_CASE(anchor_db, TestingSetup)
+{
+    std::vector<CAnchorPeer> vAnchors;
+    for (int i = 0; i < 6; i++) {
+        uint256 fingerprint;
+        fingerprint.begin()[0] = i + 1;
+        vAnchors.push_back(CAnchorPeer(CAddress(CService(strprintf("1.2.3.%d", i + 1), 9033), NODE_NETWORK), fingerprint));
+    }
+
+    CAnchorDB adb;
+    std::vector<CAnchorPeer> vRead;
+    BOOST_CHECK(!adb.Read(vRead));
+    BOOST_CHECK(adb.Write(vAnchors));
+
+    // At most MAX_ANCHOR_PEERS are read back, in order, and the file is then gone
+    BOOST_CHECK(adb.Read(vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), MAX_ANCHOR_PEERS);
+    for (size_t i = 0; i < vRead.size(); i++) {
+        BOOST_CHECK(vRead[i].addr == vAnchors[i].addr);
+        BOOST_CHECK(vRead[i].certFingerprint == vAnchors[i].certFingerprint);
+    }
+    vRead.clear();
+    BOOST_CHECK(!adb.Read(vRead));
+    BOOST_CHECK(vRead.empty());
+}
+
+BOOST_AUTO_TEST_CASE(non_tls_pool)
+{
+    zen::NonTLSPool pool;
+    const int64_t nNow = 1000000;
+    BOOST_CHECK(!pool.contains("1.2.3.4", nNow));
+
+    pool.add("1.2.3.4", nNow);
+    pool.add("1.2.3.5", nNow + 1000);
+    BOOST_CHECK(pool.contains("1.2.3.4", nNow + 1));
+    BOOST_CHECK_EQUAL(pool.size(nNow + 1000), 2U);
+
+    // Added again, the address lasts from the last addition
+    pool.add("1.2.3.4", nNow + 2000);
+    BOOST_CHECK(pool.contains("1.2.3.4", nNow + zen::NonTLSPool::TTL_MSEC + 1));
+    BOOST_CHECK(!pool.contains("1.2.3.5", nNow + zen::NonTLSPool::TTL_MSEC + 1000));
+    BOOST_CHECK(!pool.contains("1.2.3.4", nNow + zen::NonTLSPool::TTL_MSEC + 2000));
+    BOOST_CHECK_EQUAL(pool.size(nNow + zen::NonTLSPool::TTL_MSEC + 2000), 0U);
+
+    // Taken once only
+    pool.add("1.2.3.6", nNow);
+    BOOST_CHECK(pool.take("1.2.3.6", nNow));
+    BOOST_CHECK(!pool.take("1.2.3.6", nNow));
+    BOOST_CHECK(!pool.contains("1.2.3.6", nNow));
+}
+
+BOOST_AUTO_TEST_CASE(queue_addresses)
+{
+    addrman.Clear();
+    CAddress addr(CService("250.1.1.1", 8333));
+    addr.nTime = GetTime();
+    CNetAddr source("252.2.2.2");
+
+    QueueAddresses(std::vector<CAddress>(), source, 0);
+    BOOST_CHECK_EQUAL(addrman.size(), 0);
+
+    // Without the addrman thread, the addresses are added right away
+    QueueAddresses(std::vector<CAddress>(1, addr), source, 2 * 60 * 60);
+    BOOST_CHECK_EQUAL(addrman.size(), 1);
+    addrman.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,109 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notescan.h"
+#include "init.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "zcash/Note.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(notescan_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(scan_disconnect_erase)
+{
+    CNoteScanDB db(1 << 20, true);
+    const libzcash::SpendingKey sk = libzcash::SpendingKey::random();
+    const libzcash::PaymentAddress address = sk.address();
+    const libzcash::SpendingKey skOther = libzcash::SpendingKey::random();
+    const libzcash::PaymentAddress other = skOther.address();
+
+    // A JoinSplit paying the address with its first output and another address with its second
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    mtx.joinSplitPubKey = GetRandHash();
+    JSDescription jsdesc;
+    jsdesc.randomSeed = GetRandHash();
+    jsdesc.nullifiers[0] = GetRandHash();
+    jsdesc.nullifiers[1] = GetRandHash();
+    ZCNoteEncryption encryptor(jsdesc.h_sig(*pzcashParams, mtx.joinSplitPubKey));
+    libzcash::Note note(address.a_pk, 1000, GetRandHash(), GetRandHash());
+    std::array<unsigned char, ZC_MEMO_SIZE> memo = {{0xF6}};
+    memo[0] = 'a';
+    jsdesc.ciphertexts[0] = libzcash::NotePlaintext(note, memo).encrypt(encryptor, address.pk_enc);
+    jsdesc.commitments[0] = note.cm();
+    libzcash::Note noteOther(other.a_pk, 2000, GetRandHash(), GetRandHash());
+    memo.fill(0);
+    memo[0] = 0xF6;
+    jsdesc.ciphertexts[1] = libzcash::NotePlaintext(noteOther, memo).encrypt(encryptor, other.pk_enc);
+    jsdesc.commitments[1] = noteOther.cm();
+    jsdesc.ephemeralKey = encryptor.get_epk();
+    mtx.vjoinsplit.push_back(jsdesc);
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(mtx));
+
+    const CNoteScanDecryptor decryptor(sk.viewing_key());
+    std::vector<const CNoteScanDecryptor*> vDecryptors(1, &decryptor);
+    CNoteScanBatch batch(db, *pzcashParams);
+    batch.WriteKey(CNoteScanKey(sk.viewing_key(), 10, -1));
+    BOOST_CHECK_EQUAL(batch.ScanBlock(block, 10, 5, vDecryptors), 1U);
+    BOOST_CHECK(batch.Write(uint256S("10")));
+
+    std::vector<CNoteScanKey> vKeys;
+    BOOST_CHECK(db.ReadKeys(vKeys));
+    BOOST_CHECK_EQUAL(vKeys.size(), 1U);
+    BOOST_CHECK(vKeys[0].vk == sk.viewing_key() && vKeys[0].nStartHeight == 10 && !vKeys[0].IsCatchingUp());
+
+    std::vector<std::pair<CNoteScanEntryKey, CNoteScanEntry> > vNotes;
+    BOOST_CHECK(db.ReadNotes(address, vNotes));
+    BOOST_CHECK_EQUAL(vNotes.size(), 1U);
+    BOOST_CHECK(vNotes[0].first.nHeight == 10 && vNotes[0].first.txid == block.vtx[0]->GetHash());
+    BOOST_CHECK(vNotes[0].first.nJoinSplit == 0 && vNotes[0].first.nOutput == 0);
+    BOOST_CHECK(vNotes[0].second.nValue == 1000 && vNotes[0].second.nPosition == 5 && vNotes[0].second.cm == note.cm());
+    BOOST_CHECK(vNotes[0].second.vchMemo == std::vector<unsigned char>(1, 'a'));
+    vNotes.clear();
+    BOOST_CHECK(db.ReadNotes(address, vNotes, 11));
+    BOOST_CHECK(vNotes.empty());
+    BOOST_CHECK(db.ReadNotes(other, vNotes));
+    BOOST_CHECK(vNotes.empty());
+
+    // The note of the other address is found with its key, without a memo
+    const CNoteScanDecryptor decryptorOther(skOther.viewing_key());
+    BOOST_CHECK_EQUAL(batch.ScanBlock(block, 10, 5, std::vector<const CNoteScanDecryptor*>(1, &decryptorOther)), 1U);
+    BOOST_CHECK(db.ReadNotes(other, vNotes));
+    BOOST_CHECK(vNotes.empty());
+    BOOST_CHECK(batch.Write(uint256S("10")));
+    BOOST_CHECK(db.ReadNotes(other, vNotes));
+    BOOST_CHECK_EQUAL(vNotes.size(), 1U);
+    BOOST_CHECK(vNotes[0].first.nOutput == 1 && vNotes[0].second.nPosition == 6 && vNotes[0].second.vchMemo.empty());
+
+    // Disconnecting the block erases its notes, written or not
+    BOOST_CHECK_EQUAL(batch.ScanBlock(block, 11, 7, vDecryptors), 1U);
+    batch.DisconnectBlock(11);
+    batch.DisconnectBlock(10);
+    BOOST_CHECK(batch.Write(uint256S("9")));
+    vNotes.clear();
+    BOOST_CHECK(db.ReadNotes(address, vNotes));
+    BOOST_CHECK(db.ReadNotes(other, vNotes));
+    BOOST_CHECK(vNotes.empty());
+
+    // Unwatching the key erases it and its notes
+    BOOST_CHECK_EQUAL(batch.ScanBlock(block, 10, 5, vDecryptors), 1U);
+    BOOST_CHECK(batch.Write(uint256S("10")));
+    BOOST_CHECK_EQUAL(batch.ScanBlock(block, 11, 7, vDecryptors), 1U);
+    batch.EraseKey(address);
+    BOOST_CHECK(batch.Write(uint256S("11")));
+    BOOST_CHECK(db.ReadNotes(address, vNotes));
+    BOOST_CHECK(vNotes.empty());
+    vKeys.clear();
+    BOOST_CHECK(db.ReadKeys(vKeys));
+    BOOST_CHECK(vKeys.empty());
+
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadBestBlock(hashBest) && hashBest == uint256S("11"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
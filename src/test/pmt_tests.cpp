@@ -44,14 +44,15 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
         for (unsigned int j=0; j<nTx; j++) {
             CMutableTransaction tx;
             tx.nLockTime = j; // actual transaction data doesn't matter; just make the nLockTime's unique
-            block.vtx.push_back(CTransaction(tx));
+            block.vtx.push_back(MakeTransactionRef(tx));
         }
 
         // calculate actual merkle root and height
         uint256 merkleRoot1 = block.BuildMerkleTree();
+        BOOST_CHECK(block.ComputeMerkleRoot() == merkleRoot1);
         std::vector<uint256> vTxid(nTx, uint256());
         for (unsigned int j=0; j<nTx; j++)
-            vTxid[j] = block.vtx[j].GetHash();
+            vTxid[j] = block.vtx[j]->GetHash();
         int nHeight = 1, nTx_ = nTx;
         while (nTx_ > 1) {
             nTx_ = (nTx_+1)/2;
@@ -124,4 +125,26 @@ BOOST_AUTO_TEST_CASE(pmt_malleability)
     BOOST_CHECK(tree.ExtractMatches(vTxid).IsNull());
 }
 
+BOOST_AUTO_TEST_CASE(pmt_compute_root_mutated)
+{
+    // The transactions 4 and 5 repeated, the example of CVE-2012-2459
+    CBlock block;
+    for (unsigned int j = 0; j < 6; j++) {
+        CMutableTransaction tx;
+        tx.nLockTime = j;
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+    bool fMutated = true;
+    uint256 root = block.ComputeMerkleRoot(&fMutated);
+    BOOST_CHECK(!fMutated);
+
+    block.vtx.push_back(block.vtx[4]);
+    block.vtx.push_back(block.vtx[5]);
+    BOOST_CHECK(block.ComputeMerkleRoot(&fMutated) == root);
+    BOOST_CHECK(fMutated);
+    bool fMutatedTree = false;
+    BOOST_CHECK(block.BuildMerkleTree(&fMutatedTree) == root);
+    BOOST_CHECK(fMutatedTree);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
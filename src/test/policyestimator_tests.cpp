@@ -2,13 +2,16 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "policy/fees.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
 
 #include "test/test_bitcoin.h"
 
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(policyestimator_tests, BasicTestingSetup)
@@ -52,7 +55,7 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     CFeeRate baseRate(basefee, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
 
     // Create a fake block
-    std::vector<CTransaction> block;
+    std::vector<CTransactionRef> block;
     int blocknum = 0;
 
     // Loop through 200 blocks
@@ -73,9 +76,9 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
             // 9/10 blocks add 2nd highest and so on until ...
             // 1/10 blocks add lowest fee/pri transactions
             while (txHashes[9-h].size()) {
-                CTransaction btx;
-                if (mpool.lookup(txHashes[9-h].back(), btx))
-                    block.push_back(btx);
+                CTransactionRef ptx = mpool.get(txHashes[9-h].back());
+                if (ptx)
+                    block.push_back(ptx);
                 txHashes[9-h].pop_back();
             }
         }
@@ -148,9 +151,9 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     // Estimates should still not be below original
     for (int j = 0; j < 10; j++) {
         while(txHashes[j].size()) {
-            CTransaction btx;
-            if (mpool.lookup(txHashes[j].back(), btx))
-                block.push_back(btx);
+            CTransactionRef ptx = mpool.get(txHashes[j].back());
+            if (ptx)
+                block.push_back(ptx);
             txHashes[j].pop_back();
         }
     }
@@ -169,9 +172,9 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
                 tx.vin[0].prevout.n = 10000*blocknum+100*j+k;
                 uint256 hash = tx.GetHash();
                 mpool.addUnchecked(hash, CTxMemPoolEntry(tx, feeV[k/4][j], GetTime(), priV[k/4][j], blocknum, mpool.HasNoInputsOf(tx)));
-                CTransaction btx;
-                if (mpool.lookup(hash, btx))
-                    block.push_back(btx);
+                CTransactionRef ptx = mpool.get(hash);
+                if (ptx)
+                    block.push_back(ptx);
             }
         }
         mpool.removeForBlock(block, ++blocknum, dummyConflicted);
@@ -184,6 +187,118 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
 }
 
 
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesPersistence)
+{
+    CTxMemPool mpool(CFeeRate(1000));
+    std::list<CTransaction> dummyConflicted;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0LL;
+
+    // Transactions paying j+1 times the base fee are mined after 10-j blocks
+    std::vector<uint256> txHashes[10];
+    for (int blocknum = 0; blocknum < 100; blocknum++) {
+        for (int j = 0; j < 10; j++) {
+            tx.vin[0].prevout.n = 100*blocknum+j;
+            uint256 hash = tx.GetHash();
+            mpool.addUnchecked(hash, CTxMemPoolEntry(tx, 2000 * (j+1), GetTime(), 0, blocknum, mpool.HasNoInputsOf(tx)));
+            txHashes[j].push_back(hash);
+        }
+        std::vector<CTransactionRef> block;
+        for (int j = 0; j < 10; j++) {
+            if (txHashes[j].size() > (size_t)(9 - j)) {
+                CTransactionRef ptx = mpool.get(txHashes[j].front());
+                if (ptx)
+                    block.push_back(ptx);
+                txHashes[j].erase(txHashes[j].begin());
+            }
+        }
+        mpool.removeForBlock(block, blocknum + 1, dummyConflicted);
+    }
+
+    // The mempool counts are not saved, empty the pool so that both estimators see the same data
+    for (int j = 0; j < 10; j++) {
+        for (const uint256& hash : txHashes[j]) {
+            CTransaction rtx;
+            if (mpool.lookup(hash, rtx))
+                mpool.remove(rtx, dummyConflicted);
+        }
+    }
+
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    {
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(mpool.WriteFeeEstimates(fileout));
+    }
+
+    CTxMemPool mpoolRead(CFeeRate(1000));
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(mpoolRead.ReadFeeEstimates(filein));
+    }
+    boost::filesystem::remove(path);
+
+    bool fAnyEstimate = false;
+    for (unsigned int i = 1; i <= MAX_BLOCK_CONFIRMS; i++) {
+        BOOST_CHECK(mpoolRead.estimateFee(i) == mpool.estimateFee(i));
+        BOOST_CHECK_EQUAL(mpoolRead.estimatePriority(i), mpool.estimatePriority(i));
+        fAnyEstimate |= !(mpool.estimateFee(i) == CFeeRate(0));
+    }
+    BOOST_CHECK(fAnyEstimate);
+}
+
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimates_LegacyFile)
+{
+    // A file of the layout before FEE_ESTIMATES_FLAT_VERSION, keeping one array per confirmation count
+    std::vector<double> buckets {1000, 5000, INF_FEERATE};
+    std::vector<double> avg {0, 30000, 0};
+    std::vector<double> txCtAvg {0, 10, 0};
+    std::vector<std::vector<double> > confAvg {{0, 10, 0}, {0, 10, 0}};
+
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    {
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        fileout << 109900 << CLIENT_VERSION;
+        fileout << (unsigned int)100;
+        for (int i = 0; i < 2; i++)
+            fileout << .5 << buckets << avg << txCtAvg << confAvg;
+    }
+
+    CTxMemPool mpoolLegacy(CFeeRate(1000));
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(mpoolLegacy.ReadFeeEstimates(filein));
+    }
+    BOOST_CHECK(mpoolLegacy.estimateFee(1) == CFeeRate(3000));
+    BOOST_CHECK_EQUAL(mpoolLegacy.estimatePriority(2), 3000);
+    BOOST_CHECK(mpoolLegacy.estimateFee(3) == CFeeRate(0));
+
+    // Written again in the flat layout, which reads back to the same estimates
+    {
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(mpoolLegacy.WriteFeeEstimates(fileout));
+    }
+    CTxMemPool mpoolFlat(CFeeRate(1000));
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        int nVersionRequired;
+        filein >> nVersionRequired;
+        BOOST_CHECK_EQUAL(nVersionRequired, FEE_ESTIMATES_FLAT_VERSION);
+    }
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(mpoolFlat.ReadFeeEstimates(filein));
+    }
+    boost::filesystem::remove(path);
+
+    for (int i = 1; i <= 3; i++) {
+        BOOST_CHECK(mpoolFlat.estimateFee(i) == mpoolLegacy.estimateFee(i));
+        BOOST_CHECK_EQUAL(mpoolFlat.estimatePriority(i), mpoolLegacy.estimatePriority(i));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TxConfirmStats_FindBucketIndex)
 {
     std::vector<double> buckets {0.0, 3.5, 42.0};
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "rpc/client.h"
 
@@ -11,7 +12,9 @@
 #include "test/test_bitcoin.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
@@ -295,4 +298,153 @@ BOOST_AUTO_TEST_CASE(rpc_ban)
     BOOST_CHECK_EQUAL(adr.get_str(), "2001:4d48:ac57:400:cacf:e9ff:fe1d:9c63/ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff");
 }
 
+static void WriteValue(JSONWriter& writer, const UniValue& val)
+{
+    if (val.isObject()) {
+        writer.beginObject();
+        for (size_t i = 0; i < val.size(); i++) {
+            writer.key(val.getKeys()[i]);
+            WriteValue(writer, val.getValues()[i]);
+        }
+        writer.endObject();
+    } else if (val.isArray()) {
+        writer.beginArray();
+        for (size_t i = 0; i < val.size(); i++)
+            WriteValue(writer, val[i]);
+        writer.endArray();
+    } else
+        writer.push_back(val);
+}
+
+static void AppendString(std::string& str, const char* data, size_t size)
+{
+    str.append(data, size);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_writers)
+{
+    UniValue val;
+    BOOST_CHECK(val.read("{\"a\":[1,\"x\",{},[],[{\"b\":null}]],\"c\":{\"d\":true,\"e\":[2.5]},\"f\":\"\\u0001\"}"));
+    UniValue big(UniValue::VARR);
+    for (int i = 0; i < 20000; i++)
+        big.push_back(strprintf("element%d", i));
+    UniValue scalar("top");
+
+    for (const UniValue& v : {val, big, scalar}) {
+        UniValueWriter writerValue;
+        WriteValue(writerValue, v);
+        BOOST_CHECK_EQUAL(writerValue.get().write(), v.write());
+
+        // The stream hands out pieces as they fill, which join into the compact JSON
+        std::string str;
+        size_t nPieces = 0;
+        JSONStreamWriter writerStream([&](const char* data, size_t size) { AppendString(str, data, size); nPieces++; });
+        WriteValue(writerStream, v);
+        writerStream.Flush();
+        BOOST_CHECK_EQUAL(str, v.write());
+        BOOST_CHECK(nPieces >= 1 && nPieces <= v.write().size() / JSON_STREAM_CHUNK_SIZE + 1);
+    }
+
+    // Whole values mix with the ones written in parts
+    std::string str;
+    JSONStreamWriter writer(boost::bind(&AppendString, boost::ref(str), _1, _2));
+    writer.beginObject();
+    writer.pushKV("obj", val);
+    writer.key("arr");
+    writer.beginArray();
+    writer.push_back(val["c"]);
+    writer.push_back(1);
+    writer.endArray();
+    writer.pushKVs(val["c"]);
+    writer.endObject();
+    writer.Flush();
+    UniValue expected(UniValue::VOBJ);
+    expected.pushKV("obj", val);
+    UniValue arr(UniValue::VARR);
+    arr.push_back(val["c"]);
+    arr.push_back(1);
+    expected.pushKV("arr", arr);
+    expected.pushKVs(val["c"]);
+    BOOST_CHECK_EQUAL(str, expected.write());
+}
+
+static bool QueueTaskOnThread(boost::thread_group& threads, const boost::function<void()>& task)
+{
+    threads.create_thread(task);
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    // Runs of read-only calls, split by calls which run in order
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 40; i++) {
+        UniValue params(UniValue::VARR);
+        params.push_back(strprintf("%02x", 0x51 + i % 16));
+        UniValue req(UniValue::VOBJ);
+        req.pushKV("method", i % 13 == 12 ? "nosuchmethod" : "decodescript");
+        req.pushKV("params", params);
+        req.pushKV("id", i);
+        batch.push_back(req);
+    }
+    const std::string strSequential = JSONRPCExecBatch(batch);
+
+    boost::thread_group threads;
+    const std::string strParallel = JSONRPCExecBatch(batch, boost::bind(&QueueTaskOnThread, boost::ref(threads), _1));
+    threads.join_all();
+    BOOST_CHECK_EQUAL(strParallel, strSequential);
+
+    UniValue replies;
+    BOOST_CHECK(replies.read(strParallel));
+    BOOST_CHECK_EQUAL(replies.size(), 40);
+    for (size_t i = 0; i < replies.size(); i++) {
+        BOOST_CHECK_EQUAL(find_value(replies[i], "id").get_int(), (int)i);
+        BOOST_CHECK_EQUAL(find_value(replies[i], "error").isNull(), i % 13 != 12);
+    }
+
+    // The batch thread executes the run alone when no task can be queued
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(batch, [](const boost::function<void()>&) { return false; }), strSequential);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_getblockvalidationstats)
+{
+    BOOST_CHECK_EQUAL(CallRPC("getblockvalidationstats 0").size(), 0);
+    BOOST_CHECK_THROW(CallRPC("getblockvalidationstats -1"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("getblockvalidationstats 1 2"), runtime_error);
+
+    // The blocks connected by the setup, the genesis block at least
+    UniValue result = CallRPC("getblockvalidationstats");
+    BOOST_CHECK(result.isArray());
+    BOOST_CHECK(result.size() <= 10);
+    for (size_t i = 0; i < result.size(); i++) {
+        const UniValue& stats = result[i];
+        BOOST_CHECK(find_value(stats, "total").get_int64() >= find_value(stats, "postprocess").get_int64());
+        BOOST_CHECK(find_value(stats, "postprocess").get_int64() >= find_value(stats, "notify").get_int64());
+        BOOST_CHECK(find_value(stats, "index").get_int64() >= find_value(stats, "undo").get_int64());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_getmemoryinfo)
+{
+    BOOST_CHECK_THROW(CallRPC("getmemoryinfo 1"), runtime_error);
+
+    UniValue result = CallRPC("getmemoryinfo");
+    // The setup connected the genesis block at least
+    BOOST_CHECK(find_value(result, "blockindex").get_int64() > 0);
+    BOOST_CHECK(find_value(result, "coinstiplimit").get_int64() >= 0);
+    BOOST_CHECK_EQUAL(find_value(find_value(result, "peers"), "count").get_int64(), 0);
+
+    int64_t nSum = 0;
+    for (const char* pszField : {"blockindex", "coinstip", "mempool", "orphans", "sigcache"})
+        nSum += find_value(result, pszField).get_int64();
+    for (const char* pszField : {"send", "recv", "recvpool", "relay"})
+        nSum += find_value(find_value(result, "peers"), pszField).get_int64();
+    const UniValue& wallet = find_value(result, "wallet");
+    if (!wallet.isNull()) {
+        BOOST_CHECK(find_value(wallet, "transactions").get_int64() >= find_value(wallet, "witnesses").get_int64());
+        nSum += find_value(wallet, "transactions").get_int64();
+    }
+    BOOST_CHECK_EQUAL(find_value(result, "total").get_int64(), nSum);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -823,6 +823,58 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_cancel)
     BOOST_CHECK(ids.size()==0);
 }
 
+static std::mutex gOrderLock;
+static std::vector<AsyncRPCOperationId> gOrder;
+
+class OrderOperation : public AsyncRPCOperation {
+public:
+    virtual void main() {
+        set_state(OperationStatus::EXECUTING);
+        {
+            PhaseTimer timer(*this, "record");
+            std::lock_guard<std::mutex> guard(gOrderLock);
+            gOrder.push_back(getId());
+        }
+        set_result(UniValue(UniValue::VSTR, "done"));
+        set_state(OperationStatus::SUCCESS);
+    }
+};
+
+// This tests the operations starting by priority, and the oldest results being dropped
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_priority_retention)
+{
+    gOrder.clear();
+
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    std::shared_ptr<AsyncRPCOperation> opLow(new OrderOperation());
+    std::shared_ptr<AsyncRPCOperation> opNormal(new OrderOperation());
+    std::shared_ptr<AsyncRPCOperation> opHigh(new OrderOperation());
+    q->addOperation(opLow, OperationPriority::LOW);
+    q->addOperation(opNormal);
+    q->addOperation(opHigh, OperationPriority::HIGH);
+    BOOST_CHECK_EQUAL(q->getOperationCount(), 3);
+    BOOST_CHECK_EQUAL(q->getOperationCount(OperationPriority::HIGH), 1);
+
+    q->setMaxRetainedOperations(2);
+    q->addWorker();
+    q->finishAndWait();
+
+    BOOST_CHECK_EQUAL(gOrder.size(), 3);
+    BOOST_CHECK(gOrder[0] == opHigh->getId());
+    BOOST_CHECK(gOrder[1] == opNormal->getId());
+    BOOST_CHECK(gOrder[2] == opLow->getId());
+
+    // The first to finish is dropped
+    BOOST_CHECK_EQUAL(q->getRetainedOperationCount(), 2);
+    BOOST_CHECK(!q->getOperationForId(opHigh->getId()));
+    BOOST_CHECK(q->popOperationForId(opLow->getId()));
+    BOOST_CHECK_EQUAL(q->getRetainedOperationCount(), 1);
+
+    UniValue phases = find_value(opLow->getStatus(), "phase_secs");
+    BOOST_CHECK(phases.isObject());
+    BOOST_CHECK(find_value(phases, "record").isNum());
+}
+
 // This tests z_getoperationstatus, z_getoperationresult, z_listoperationids
 BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
 {
@@ -1369,6 +1421,13 @@ BOOST_AUTO_TEST_CASE(rpc_z_shieldcoinbase_parameters)
         BOOST_CHECK( find_error(objError, "Empty inputs"));
     }
 
+    try {
+        std::vector<std::vector<ShieldCoinbaseUTXO> > batches = { { ShieldCoinbaseUTXO{uint256(),0,0} }, {} };
+        std::shared_ptr<AsyncRPCOperation> operation(new AsyncRPCOperation_shieldcoinbase(mtx, testnetzaddr, batches, 1));
+    } catch (const UniValue& objError) {
+        BOOST_CHECK( find_error(objError, "Empty inputs"));
+    }
+
     // Testnet payment addresses begin with 'zt'.  This test detects an incorrect prefix.
     try {
         std::vector<ShieldCoinbaseUTXO> inputs = { ShieldCoinbaseUTXO{uint256(),0,0} };
@@ -1420,6 +1479,24 @@ BOOST_AUTO_TEST_CASE(rpc_z_shieldcoinbase_internals)
         BOOST_CHECK( msg.find("Insufficient coinbase funds") != string::npos);
     }
 
+    // A bulk shielding goes on with the other transactions when one fails
+    {
+        std::vector<std::vector<ShieldCoinbaseUTXO> > batches = {
+            { ShieldCoinbaseUTXO{uint256(),0,0} }, { ShieldCoinbaseUTXO{uint256(),1,0} } };
+        std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_shieldcoinbase(mtx, zaddr, batches) );
+        operation->main();
+        BOOST_CHECK(operation->isFailed());
+        std::string msg = operation->getErrorMessage();
+        BOOST_CHECK( msg.find("2 of 2 transactions failed") != string::npos);
+        BOOST_CHECK( msg.find("Insufficient coinbase funds") != string::npos);
+
+        UniValue txs = find_value(operation->getStatus(), "transactions");
+        BOOST_CHECK_EQUAL(txs.size(), 2);
+        for (size_t i = 0; i < txs.size(); i++) {
+            BOOST_CHECK_EQUAL(find_value(txs[i], "status").get_str(), "failed");
+        }
+    }
+
     // Test the perform_joinsplit methods.
     {
         // Dummy input so the operation object can be instantiated.
@@ -109,4 +109,65 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void BlockingTask(boost::mutex& mutex, boost::condition_variable& cond, bool& fRelease)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!fRelease)
+        cond.wait(lock);
+}
+
+static void CountingTask(boost::mutex& mutex, boost::condition_variable& cond, int& counter)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        counter++;
+    }
+    cond.notify_all();
+}
+
+BOOST_AUTO_TEST_CASE(priorities)
+{
+    CScheduler scheduler;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fRelease = false;
+    int counter = 0;
+
+    boost::thread_group threads;
+    void (CScheduler::*serviceQueue)(SchedulerPriority) = &CScheduler::serviceQueue;
+    threads.create_thread(boost::bind(serviceQueue, &scheduler, SCHEDULER_PRIORITY_HIGH));
+    threads.create_thread(boost::bind(serviceQueue, &scheduler, SCHEDULER_PRIORITY_LOW));
+
+    // A low priority task blocking its pool delays none of the high priority ones
+    scheduler.scheduleFromNow(boost::bind(&BlockingTask, boost::ref(mutex), boost::ref(cond), boost::ref(fRelease)), 0,
+                              SCHEDULER_PRIORITY_LOW, "blocking");
+    for (int i = 0; i < 3; i++)
+        scheduler.scheduleFromNow(boost::bind(&CountingTask, boost::ref(mutex), boost::ref(cond), boost::ref(counter)), 0,
+                                  SCHEDULER_PRIORITY_HIGH, "counting");
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (counter < 3)
+            cond.wait(lock);
+        fRelease = true;
+    }
+    cond.notify_all();
+
+    scheduler.stop(true);
+    threads.join_all();
+
+    std::vector<SchedulerTaskInfo> vInfo = scheduler.getTaskInfo();
+    BOOST_CHECK_EQUAL(vInfo.size(), 2);
+    BOOST_FOREACH(const SchedulerTaskInfo& info, vInfo) {
+        if (info.name == "counting") {
+            BOOST_CHECK_EQUAL(info.priority, SCHEDULER_PRIORITY_HIGH);
+            BOOST_CHECK_EQUAL(info.nRuns, 3);
+        } else {
+            BOOST_CHECK_EQUAL(info.name, "blocking");
+            BOOST_CHECK_EQUAL(info.priority, SCHEDULER_PRIORITY_LOW);
+            BOOST_CHECK_EQUAL(info.nRuns, 1);
+        }
+        BOOST_CHECK(info.nMaxTime <= info.nTotalTime);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,8 @@
 #include "data/script_invalid.json.h"
 #include "data/script_valid.json.h"
 
+#include "arith_uint256.h"
+#include "chain.h"
 #include "core_io.h"
 #include "key.h"
 #include "keystore.h"
@@ -12,6 +14,7 @@
 #include "script/script.h"
 #include "script/script_error.h"
 #include "script/sign.h"
+#include "script/standard.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
@@ -933,6 +936,98 @@ BOOST_AUTO_TEST_CASE(script_combineSigs)
     BOOST_CHECK(combined == partial3c);
 }
 
+// VerifyScript of a spend without CLEANSTACK evaluated on the stack machine, as it was before its fast paths
+static bool EvalSpend(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* err)
+{
+    std::vector<std::vector<unsigned char> > stack, stackCopy;
+    if (!EvalScript(stack, scriptSig, flags, checker, err))
+        return false;
+    stackCopy = stack;
+    if (!EvalScript(stack, scriptPubKey, flags, checker, err))
+        return false;
+    if (stack.empty() || stack.back() != std::vector<unsigned char>(1, 1)) {
+        *err = SCRIPT_ERR_EVAL_FALSE;
+        return false;
+    }
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash()) {
+        CScript redeemScript(stackCopy.back().begin(), stackCopy.back().end());
+        stackCopy.pop_back();
+        if (!EvalScript(stackCopy, redeemScript, flags, checker, err))
+            return false;
+        if (stackCopy.empty() || stackCopy.back() != std::vector<unsigned char>(1, 1)) {
+            *err = SCRIPT_ERR_EVAL_FALSE;
+            return false;
+        }
+    }
+    *err = SCRIPT_ERR_OK;
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_fast_paths)
+{
+    CKey key1, key2, key3;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    key3.MakeNewKey(true);
+    std::vector<CPubKey> pubkeys;
+    pubkeys.push_back(key1.GetPubKey());
+    pubkeys.push_back(key2.GetPubKey());
+    pubkeys.push_back(key3.GetPubKey());
+    CScript multisig = GetScriptForMultisig(2, pubkeys);
+
+    const unsigned int vFlags[] = {
+        flags,
+        STANDARD_CONTEXTUAL_SCRIPT_VERIFY_FLAGS & ~SCRIPT_VERIFY_CHECKBLOCKATHEIGHT,
+        STANDARD_CONTEXTUAL_SCRIPT_VERIFY_FLAGS,
+    };
+    CScript replayProtection;
+    replayProtection << ToByteVector(GetRandHash()) << 100 << OP_CHECKBLOCKATHEIGHT;
+
+    for (const CScript& suffix : {CScript(), replayProtection}) {
+        CScript scriptPubKeyPKH = GetScriptForDestination(key1.GetPubKey().GetID(), false) + suffix;
+        CScript scriptPubKeySH = GetScriptForDestination(CScriptID(multisig), false) + suffix;
+        CMutableTransaction txToPKH = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKeyPKH));
+        CMutableTransaction txToSH = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKeySH));
+        CMutableTransaction txOther = txToPKH;
+        txOther.vout[0].nValue = 2;
+
+        std::vector<std::pair<CScript, CScript> > spends;
+        for (const CMutableTransaction& tx : {txToPKH, txOther}) {
+            std::vector<unsigned char> vchSig;
+            BOOST_CHECK(key1.Sign(SignatureHash(scriptPubKeyPKH, tx, 0, SIGHASH_ALL), vchSig));
+            vchSig.push_back((unsigned char)SIGHASH_ALL);
+            spends.push_back(std::make_pair(CScript() << vchSig << ToByteVector(key1.GetPubKey()), scriptPubKeyPKH));
+            spends.push_back(std::make_pair(CScript() << vchSig << ToByteVector(key2.GetPubKey()), scriptPubKeyPKH));
+        }
+        std::vector<CKey> keys;
+        keys.push_back(key1);
+        keys.push_back(key3);
+        spends.push_back(std::make_pair(sign_multisig(multisig, keys, txToSH) << ToByteVector(multisig), scriptPubKeySH));
+        std::swap(keys[0], keys[1]);
+        spends.push_back(std::make_pair(sign_multisig(multisig, keys, txToSH) << ToByteVector(multisig), scriptPubKeySH));
+        keys.pop_back();
+        spends.push_back(std::make_pair(sign_multisig(multisig, keys, txToSH) << ToByteVector(multisig), scriptPubKeySH));
+
+        // A valid spend of each, then spends failing in the signature check or before it
+        const bool vExpected[] = {true, false, false, false, true, false, false};
+        for (size_t i = 0; i < spends.size(); i++) {
+            const CMutableTransaction& txTo = i < 4 ? txToPKH : txToSH;
+            MutableTransactionSignatureChecker checker(&txTo, 0);
+            for (unsigned int nFlags : vFlags) {
+                ScriptError err, errEval;
+                bool fResult = VerifyScript(spends[i].first, spends[i].second, nFlags, checker, &err);
+                BOOST_CHECK_EQUAL(fResult, EvalSpend(spends[i].first, spends[i].second, nFlags, checker, &errEval));
+                BOOST_CHECK_MESSAGE(err == errEval, ScriptErrorString(err));
+                // Without a chain, the replay protection never passes
+                if (suffix.empty() || !(nFlags & SCRIPT_VERIFY_CHECKBLOCKATHEIGHT))
+                    BOOST_CHECK_EQUAL(fResult, vExpected[i]);
+                else
+                    BOOST_CHECK(!fResult);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(script_standard_push)
 {
     ScriptError err;
@@ -965,4 +1060,35 @@ BOOST_AUTO_TEST_CASE(script_IsPushOnly_on_invalid_scripts)
     BOOST_CHECK(!CScript(direct, direct+sizeof(direct)).IsPushOnly());
 }
 
+BOOST_AUTO_TEST_CASE(script_block_hash_snapshot)
+{
+    // A chain of 100 blocks, whose hashes are their heights
+    std::vector<uint256> vHash(100);
+    std::vector<CBlockIndex> vIndex(100);
+    for (int i = 0; i < 100; i++) {
+        vHash[i] = ArithToUint256(arith_uint256(i + 1));
+        vIndex[i].phashBlock = &vHash[i];
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i > 0 ? &vIndex[i - 1] : NULL;
+    }
+    CChain chain;
+    chain.SetTip(&vIndex.back());
+
+    // The snapshot answers as the chain, for blocks deeper and shallower than the safe depth
+    for (int nSafeDepth : {10, getCheckBlockAtHeightSafeDepth()}) {
+        CBlockHashSnapshot hashes(chain, nSafeDepth);
+        for (int nHeight = 0; nHeight <= 101; nHeight++) {
+            const uint256 hash = ArithToUint256(arith_uint256(nHeight + 1));
+            const std::vector<unsigned char> vchHash(hash.begin(), hash.end());
+            const std::vector<unsigned char> vchOther(32, 0xab);
+            BOOST_CHECK_EQUAL(hashes.Check(nHeight, vchHash), nHeight <= 99);
+            BOOST_CHECK_EQUAL(hashes.Check(nHeight, vchOther), nHeight <= 99 - nSafeDepth);
+            if (nSafeDepth == getCheckBlockAtHeightSafeDepth()) {
+                BOOST_CHECK_EQUAL(hashes.Check(nHeight, vchHash), CheckReplayProtectionData(&chain, nHeight, vchHash));
+                BOOST_CHECK_EQUAL(hashes.Check(nHeight, vchOther), CheckReplayProtectionData(&chain, nHeight, vchOther));
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "primitives/block.h"
 #include "serialize.h"
 #include "streams.h"
 #include "hash.h"
@@ -85,6 +86,77 @@ BOOST_AUTO_TEST_CASE(boost_arrays)
     BOOST_CHECK_EQUAL(GetSerializeSize(test, 0, 0), 8);
 }
 
+BOOST_AUTO_TEST_CASE(byte_arrays)
+{
+    // Written at once, as the bytes in order without a size
+    check_ser_rep<boost::array<unsigned char, 3>>({{0x01, 0x02, 0xff}}, {0x01, 0x02, 0xff});
+    check_ser_rep<std::array<unsigned char, 3>>({{0x01, 0x02, 0xff}}, {0x01, 0x02, 0xff});
+    check_ser_rep<std::array<int16_t, 2>>({{1, -1}}, {0x01, 0x00, 0xff, 0xff});
+
+    std::array<unsigned char, 4> truncated;
+    CDataStream ss(SER_DISK, 0);
+    ss.write("\x01\x02\x03", 3);
+    BOOST_CHECK_THROW(ss >> truncated, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blob_arrays)
+{
+    BOOST_CHECK(is_serialized_as_bytes<uint256>::value);
+    BOOST_CHECK((is_serialized_as_bytes<std::array<boost::array<unsigned char, 5>, 2> >::value));
+    BOOST_CHECK((!is_serialized_as_bytes<std::array<int16_t, 2> >::value));
+
+    // The arrays and vectors of blobs, written at once, as the blobs one after the other
+    std::array<uint256, 2> arr = {{uint256S("01"), uint256S("02")}};
+    std::vector<uint256> vec(arr.begin(), arr.end());
+    CDataStream ss(SER_DISK, 0), ssExpected(SER_DISK, 0);
+    ss << arr << vec;
+    ssExpected << arr[0] << arr[1] << COMPACTSIZE(vec.size()) << vec[0] << vec[1];
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), HexStr(ssExpected.begin(), ssExpected.end()));
+    BOOST_CHECK_EQUAL(GetSerializeSize(arr, SER_DISK, 0), 64U);
+    BOOST_CHECK_EQUAL(GetSerializeSize(vec, SER_DISK, 0), 65U);
+
+    std::array<uint256, 2> arrRead;
+    std::vector<uint256> vecRead;
+    ss >> arrRead >> vecRead;
+    BOOST_CHECK(arrRead == arr);
+    BOOST_CHECK(vecRead == vec);
+}
+
+BOOST_AUTO_TEST_CASE(fixed_layouts)
+{
+    // Written at once, as the fields one after the other
+    COutPoint outpoint(uint256S("0102"), 0x11223344);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION), ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ssExpected << outpoint.hash << outpoint.n;
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), HexStr(ssExpected.begin(), ssExpected.end()));
+    BOOST_CHECK_EQUAL(GetSerializeSize(outpoint, SER_NETWORK, PROTOCOL_VERSION), ssExpected.size());
+    COutPoint outpointRead;
+    ss >> outpointRead;
+    BOOST_CHECK(outpointRead == outpoint);
+
+    CBlockHeader header;
+    header.nVersion = -2;
+    header.hashPrevBlock = uint256S("01");
+    header.hashMerkleRoot = uint256S("02");
+    header.hashReserved = uint256S("03");
+    header.nTime = 0x01020304;
+    header.nBits = 0xa0b0c0d0;
+    header.nNonce = uint256S("04");
+    header.nSolution = {0x05, 0x06, 0x07};
+    ss.clear();
+    ssExpected.clear();
+    ss << header;
+    ssExpected << header.nVersion << header.hashPrevBlock << header.hashMerkleRoot << header.hashReserved
+               << header.nTime << header.nBits << header.nNonce << header.nSolution;
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), HexStr(ssExpected.begin(), ssExpected.end()));
+    BOOST_CHECK_EQUAL(GetSerializeSize(header, SER_NETWORK, PROTOCOL_VERSION), ssExpected.size());
+    CBlockHeader headerRead;
+    ss >> headerRead;
+    BOOST_CHECK(headerRead.GetHash() == header.GetHash());
+    BOOST_CHECK_EQUAL(headerRead.nVersion, -2);
+}
+
 BOOST_AUTO_TEST_CASE(sizes)
 {
     BOOST_CHECK_EQUAL(sizeof(char), GetSerializeSize(char(0), 0));
@@ -346,4 +418,25 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(memory_reader)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << (uint32_t)42 << std::string("abc") << VARINT(300);
+    std::vector<char> data(ss.begin(), ss.end());
+
+    CMemoryReader reader(&data[0], &data[0] + data.size(), SER_DISK, 0);
+    uint32_t n;
+    std::string str;
+    int nVarInt;
+    reader >> n >> str >> VARINT(nVarInt);
+    BOOST_CHECK_EQUAL(n, 42);
+    BOOST_CHECK_EQUAL(str, "abc");
+    BOOST_CHECK_EQUAL(nVarInt, 300);
+    BOOST_CHECK_EQUAL(reader.size(), 0);
+
+    // Reading past the end throws rather than running off the buffer
+    CMemoryReader truncated(&data[0], &data[0] + 2, SER_DISK, 0);
+    BOOST_CHECK_THROW(truncated >> n, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,8 +1,11 @@
 #include "test/test_bitcoin.h"
 #include "crypto/sha256.h"
+#include "hash.h"
 #include "uint256.h"
 
 #include <stdexcept>
+#include <string.h>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -83,4 +86,42 @@ BOOST_AUTO_TEST_CASE(compression)
     }
 }
 
+BOOST_AUTO_TEST_CASE(compression_batch)
+{
+    // Every number of blocks, to cover the blocks left over by the vector versions
+    for (size_t count = 0; count <= 20; count++) {
+        std::vector<unsigned char> blocks(64 * count);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            blocks[i] = (i * 131 + count) & 0xff;
+        }
+        std::vector<unsigned char> digests(32 * count);
+        SHA256Compress64(digests.data(), blocks.data(), count);
+
+        for (size_t i = 0; i < count; i++) {
+            CSHA256 hasher;
+            hasher.Write(&blocks[64 * i], 64);
+            uint256 expected;
+            hasher.FinalizeNoPadding(expected.begin());
+            BOOST_CHECK(memcmp(&digests[32 * i], expected.begin(), 32) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(double_hash_batch)
+{
+    for (size_t count = 0; count <= 20; count++) {
+        std::vector<unsigned char> blocks(64 * count);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            blocks[i] = (i * 97 + count) & 0xff;
+        }
+        std::vector<unsigned char> digests(32 * count);
+        SHA256D64(digests.data(), blocks.data(), count);
+
+        for (size_t i = 0; i < count; i++) {
+            uint256 expected = Hash(blocks.begin() + 64 * i, blocks.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(&digests[32 * i], expected.begin(), 32) == 0);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
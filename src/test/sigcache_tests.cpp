@@ -0,0 +1,44 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sigcache_keyed_by_hash_signature_and_key)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    const CPubKey pubkey = key.GetPubKey();
+
+    CTransaction tx;
+    CachingTransactionSignatureChecker checker(&tx, 0, nullptr, true);
+    CachingTransactionSignatureChecker checkerNoStore(&tx, 0, nullptr, false);
+    for (int i = 0; i < 100; i++) {
+        const uint256 hash = GetRandHash();
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+
+        BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+        BOOST_CHECK(checker.VerifySignature(vchSig, pubkey, hash));
+        BOOST_CHECK(checker.VerifySignature(vchSig, pubkey, hash));
+        BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+
+        // The signature stored is valid only for its hash and key
+        BOOST_CHECK(!checker.VerifySignature(vchSig, pubkey, GetRandHash()));
+        BOOST_CHECK(!checker.VerifySignature(vchSig, keyOther.GetPubKey(), hash));
+        std::vector<unsigned char> vchSigBad(vchSig);
+        vchSigBad[vchSigBad.size() - 1] ^= 1;
+        BOOST_CHECK(!checker.VerifySignature(vchSigBad, pubkey, hash));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -100,4 +100,124 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(findfork_test)
+{
+    // A main chain of 10000 blocks, with forks of various lengths off it.
+    std::vector<CBlockIndex> vBlocksMain(10000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].BuildSkip();
+    }
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+
+    for (int n=0; n < 100; n++) {
+        int nForkHeight = insecure_rand() % vBlocksMain.size();
+        int nLength = 1 + insecure_rand() % (n < 50 ? 10 : 20000);
+        std::vector<CBlockIndex> vBlocksSide(nLength);
+        for (int i=0; i<nLength; i++) {
+            vBlocksSide[i].nHeight = nForkHeight + 1 + i;
+            vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[nForkHeight];
+            vBlocksSide[i].BuildSkip();
+        }
+        BOOST_CHECK(chain.FindFork(&vBlocksSide.back()) == &vBlocksMain[nForkHeight]);
+        BOOST_CHECK(chain.FindFork(&vBlocksSide[insecure_rand() % nLength]) == &vBlocksMain[nForkHeight]);
+    }
+
+    // Blocks of the chain are their own fork point, and unrelated trees have none.
+    BOOST_CHECK(chain.FindFork(&vBlocksMain[1234]) == &vBlocksMain[1234]);
+    CBlockIndex unrelated;
+    unrelated.nHeight = 0;
+    BOOST_CHECK(chain.FindFork(&unrelated) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(locator_fork_test)
+{
+    // A main chain of 1000 blocks, and a fork off it at height 700 whose tip we don't know.
+    std::vector<uint256> vHashMain(1000);
+    std::vector<CBlockIndex> vBlocksMain(1000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vHashMain[i] = ArithToUint256(i);
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].phashBlock = &vHashMain[i];
+        vBlocksMain[i].BuildSkip();
+    }
+    std::vector<uint256> vHashSide(50);
+    std::vector<CBlockIndex> vBlocksSide(50);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vHashSide[i] = ArithToUint256(i + 701 + (arith_uint256(1) << 128));
+        vBlocksSide[i].nHeight = i + 701;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[700];
+        vBlocksSide[i].phashBlock = &vHashSide[i];
+        vBlocksSide[i].BuildSkip();
+    }
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+
+    // Repeated locators come from the cache, and match the ones built after the tip moved.
+    CBlockLocator locatorSide = chain.GetLocator(&vBlocksSide.back());
+    BOOST_CHECK(chain.GetLocator(&vBlocksSide.back()).vHave == locatorSide.vHave);
+    BOOST_CHECK(chain.GetLocator().vHave.front() == vHashMain.back());
+    chain.SetTip(&vBlocksMain[900]);
+    BOOST_CHECK(chain.GetLocator(&vBlocksSide.back()).vHave == locatorSide.vHave);
+    BOOST_CHECK(chain.GetLocator().vHave.front() == vHashMain[900]);
+
+    for (unsigned int i=0; i<vBlocksMain.size(); i++)
+        mapBlockIndex[vHashMain[i]] = &vBlocksMain[i];
+    for (unsigned int i=0; i<vBlocksSide.size() - 1; i++)
+        mapBlockIndex[vHashSide[i]] = &vBlocksSide[i];
+
+    // The known part of the fork leads to the fork point, not to a coarser locator entry.
+    BOOST_CHECK(FindForkInGlobalIndex(chain, locatorSide) == &vBlocksMain[700]);
+    BOOST_CHECK(FindForkInGlobalIndex(chain, chain.GetLocator(&vBlocksMain[850])) == &vBlocksMain[850]);
+    CBlockLocator locatorUnknown;
+    locatorUnknown.vHave.push_back(vHashSide.back());
+    BOOST_CHECK(FindForkInGlobalIndex(chain, locatorUnknown) == &vBlocksMain[0]);
+
+    for (unsigned int i=0; i<vBlocksMain.size(); i++)
+        mapBlockIndex.erase(vHashMain[i]);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++)
+        mapBlockIndex.erase(vHashSide[i]);
+}
+
+BOOST_AUTO_TEST_CASE(chaintipview_test)
+{
+    // A main chain of 1000 blocks, and a fork off it at height 500.
+    std::vector<CBlockIndex> vBlocksMain(1000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].nTime = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].BuildSkip();
+    }
+    std::vector<CBlockIndex> vBlocksSide(100);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vBlocksSide[i].nHeight = i + 501;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[500];
+        vBlocksSide[i].BuildSkip();
+    }
+
+    CChainTipView empty;
+    BOOST_CHECK_EQUAL(empty.nHeight, -1);
+    BOOST_CHECK(empty[0] == NULL);
+    BOOST_CHECK(!empty.Contains(&vBlocksMain[0]));
+
+    CChainTipView tip(&vBlocksMain[999]);
+    BOOST_CHECK_EQUAL(tip.nHeight, 999);
+    BOOST_CHECK_EQUAL(tip.nMedianTimePast, vBlocksMain[999].GetMedianTimePast());
+    BOOST_CHECK(tip[-1] == NULL);
+    BOOST_CHECK(tip[1000] == NULL);
+    for (int i=0; i < 1000; i++) {
+        int n = insecure_rand() % 1000;
+        BOOST_CHECK(tip[n] == &vBlocksMain[n]);
+        BOOST_CHECK(tip.Contains(&vBlocksMain[n]));
+        BOOST_CHECK(tip.Next(&vBlocksMain[n]) == (n < 999 ? &vBlocksMain[n + 1] : NULL));
+    }
+    BOOST_CHECK(!tip.Contains(&vBlocksSide[0]));
+    BOOST_CHECK(tip.Next(&vBlocksSide[0]) == NULL);
+    BOOST_CHECK(tip.Next(&vBlocksMain[500]) == &vBlocksMain[501]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,113 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sync.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sync_tests, BasicTestingSetup)
+
+static CCriticalSection cs_profiled;
+
+static const LockSiteProfile* FindSite(const std::vector<LockSiteProfile>& vProfile, const std::string& name)
+{
+    for (const LockSiteProfile& profile : vProfile)
+        if (profile.name == name)
+            return &profile;
+    return NULL;
+}
+
+static void HoldProfiled(boost::mutex* mutexStarted, boost::condition_variable* condStarted, bool* fStarted)
+{
+    LOCK(cs_profiled);
+    {
+        boost::unique_lock<boost::mutex> lock(*mutexStarted);
+        *fStarted = true;
+    }
+    condStarted->notify_one();
+    MilliSleep(50);
+}
+
+BOOST_AUTO_TEST_CASE(lock_profile)
+{
+    ResetLockProfile();
+    BOOST_CHECK(!fLockProfile);
+    {
+        LOCK(cs_profiled);
+    }
+    BOOST_CHECK(FindSite(GetLockProfile(), "cs_profiled") == NULL);
+
+    fLockProfile = true;
+    {
+        LOCK(cs_profiled);
+        {
+            // Recursive, as the mutex is held by this thread already
+            LOCK(cs_profiled);
+        }
+    }
+
+    // Wait for a thread holding the mutex, then take it
+    boost::mutex mutexStarted;
+    boost::condition_variable condStarted;
+    bool fStarted = false;
+    boost::thread thread(HoldProfiled, &mutexStarted, &condStarted, &fStarted);
+    {
+        boost::unique_lock<boost::mutex> lock(mutexStarted);
+        while (!fStarted)
+            condStarted.wait(lock);
+    }
+    {
+        LOCK(cs_profiled);
+    }
+    thread.join();
+
+    // A failed try is counted as contended
+    {
+        LOCK(cs_profiled);
+        boost::thread threadTry([] {
+            TRY_LOCK(cs_profiled, lockTry);
+        });
+        threadTry.join();
+    }
+    fLockProfile = false;
+
+    std::vector<LockSiteProfile> vProfile = GetLockProfile();
+    uint64_t nLocks = 0, nContended = 0;
+    int64_t nMaxWait = 0, nMaxHold = 0;
+    for (const LockSiteProfile& profile : vProfile) {
+        if (profile.name != "cs_profiled")
+            continue;
+        BOOST_CHECK_EQUAL(profile.file, __FILE__);
+        nLocks += profile.wait.count;
+        nContended += profile.nContended;
+        nMaxWait = std::max(nMaxWait, profile.wait.max);
+        nMaxHold = std::max(nMaxHold, profile.hold.max);
+    }
+    BOOST_CHECK_EQUAL(nLocks, 6);
+    BOOST_CHECK_EQUAL(nContended, 2);
+    BOOST_CHECK(nMaxWait >= 10000);
+    BOOST_CHECK(nMaxHold >= 40000);
+
+    ResetLockProfile();
+    BOOST_CHECK(FindSite(GetLockProfile(), "cs_profiled") == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(lock_profile_percentile)
+{
+    LockProfileTimes times;
+    memset(&times, 0, sizeof(times));
+    BOOST_CHECK_EQUAL(times.percentile(0.5), 0);
+    times.buckets[0] = 1;
+    times.buckets[4] = 3;
+    times.count = 4;
+    times.total = 40;
+    times.max = 12;
+    BOOST_CHECK_EQUAL(times.mean(), 10);
+    BOOST_CHECK_EQUAL(times.percentile(0.25), 0);
+    BOOST_CHECK_EQUAL(times.percentile(0.5), 12);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -273,6 +273,31 @@ BOOST_AUTO_TEST_CASE(basic_transaction_tests)
     BOOST_CHECK_MESSAGE(!CheckTransaction(tx, state, verifier) || !state.IsValid(), "Transaction with duplicate txins should be invalid.");
 }
 
+BOOST_AUTO_TEST_CASE(serialize_size_cached)
+{
+    CMutableTransaction mtx;
+    BOOST_CHECK_EQUAL(::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION),
+                      ::GetSerializeSize(mtx, SER_NETWORK, PROTOCOL_VERSION));
+
+    mtx.vin.resize(2);
+    mtx.vin[0].scriptSig = CScript() << OP_1 << std::vector<unsigned char>(100, 0x42);
+    mtx.vout.resize(3);
+    mtx.vout[2].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(300, 0x11);
+    CTransaction tx(mtx);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << tx;
+    BOOST_CHECK_EQUAL(::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), ss.size());
+    BOOST_CHECK_EQUAL(::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION), ss.size());
+
+    // Deserialized and assigned transactions keep the size of their fields
+    CTransaction txRead;
+    ss >> txRead;
+    BOOST_CHECK_EQUAL(::GetSerializeSize(txRead, SER_NETWORK, PROTOCOL_VERSION), ::GetSerializeSize(mtx, SER_NETWORK, PROTOCOL_VERSION));
+    CTransaction txAssigned;
+    txAssigned = tx;
+    BOOST_CHECK_EQUAL(::GetSerializeSize(txAssigned, SER_NETWORK, PROTOCOL_VERSION), ::GetSerializeSize(mtx, SER_NETWORK, PROTOCOL_VERSION));
+}
+
 //
 // Helper: create two dummy transactions, each with
 // two outputs.  The first has 11 and 50 CENT outputs
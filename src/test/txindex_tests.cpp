@@ -0,0 +1,51 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "txdb.h"
+#include "uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txindex_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(short_keys)
+{
+    // Two txids sharing their short key, and one sharing its check bytes too but not its key
+    uint256 txid1 = uint256S("000000000000000000000000000000000000000011111111aaaaaaaaaaaaaaaa");
+    uint256 txid2 = uint256S("000000000000000000000000000000000000000022222222aaaaaaaaaaaaaaaa");
+    uint256 txid3 = uint256S("000000000000000000000000000000000000000011111111bbbbbbbbbbbbbbbb");
+    BOOST_CHECK_EQUAL(txid1.GetCheapHash(), txid2.GetCheapHash());
+
+    CDiskTxPos pos1(CDiskBlockPos(1, 100), 10), pos2(CDiskBlockPos(2, 200), 20), pos3(CDiskBlockPos(3, 300), 30);
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    vPos.push_back(std::make_pair(txid1, pos1));
+    vPos.push_back(std::make_pair(txid3, pos3));
+    BOOST_CHECK(pblocktree->WriteTxIndex(vPos, uint256S("1")));
+
+    // The second transaction of the key is merged with what is stored
+    vPos.clear();
+    vPos.push_back(std::make_pair(txid2, pos2));
+    BOOST_CHECK(pblocktree->WriteTxIndex(vPos, uint256S("2")));
+
+    CDiskTxPos pos;
+    BOOST_CHECK(pblocktree->ReadTxIndex(txid1, pos) && pos == pos1);
+    BOOST_CHECK(pblocktree->ReadTxIndex(txid2, pos) && pos == pos2);
+    BOOST_CHECK(pblocktree->ReadTxIndex(txid3, pos) && pos == pos3);
+    BOOST_CHECK(!pblocktree->ReadTxIndex(uint256S("000000000000000000000000000000000000000033333333aaaaaaaaaaaaaaaa"), pos));
+
+    // A transaction indexed again moves
+    vPos.clear();
+    vPos.push_back(std::make_pair(txid1, pos3));
+    BOOST_CHECK(pblocktree->WriteTxIndex(vPos, uint256S("3")));
+    BOOST_CHECK(pblocktree->ReadTxIndex(txid1, pos) && pos == pos3);
+    BOOST_CHECK(pblocktree->ReadTxIndex(txid2, pos) && pos == pos2);
+
+    uint256 hashBest;
+    BOOST_CHECK(pblocktree->ReadTxIndexBestBlock(hashBest));
+    BOOST_CHECK(hashBest == uint256S("3"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
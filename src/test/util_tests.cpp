@@ -86,6 +86,44 @@ BOOST_AUTO_TEST_CASE(util_HexStr)
         "04 67 8a fd b0");
 }
 
+BOOST_AUTO_TEST_CASE(util_HexEncodeDecode)
+{
+    // Lengths around those converted at once, the digits in both cases
+    for (size_t len = 0; len <= sizeof(ParseHex_expected); len++) {
+        std::string hex(2 * len, '\0');
+        HexEncode(ParseHex_expected, len, &hex[0]);
+        // As encoded byte by byte, with the spaces
+        std::string expected = HexStr(ParseHex_expected, ParseHex_expected + len, true);
+        expected.erase(std::remove(expected.begin(), expected.end(), ' '), expected.end());
+        BOOST_CHECK_EQUAL(hex, expected);
+        std::vector<unsigned char> decoded(len);
+        BOOST_CHECK(HexDecode(hex.c_str(), len, decoded.data()));
+        BOOST_CHECK(std::equal(decoded.begin(), decoded.end(), ParseHex_expected));
+        std::transform(hex.begin(), hex.end(), hex.begin(), ::toupper);
+        BOOST_CHECK(HexDecode(hex.c_str(), len, decoded.data()));
+        BOOST_CHECK(std::equal(decoded.begin(), decoded.end(), ParseHex_expected));
+        BOOST_CHECK(ParseHex(hex) == decoded);
+    }
+
+    // A non digit anywhere fails the decoding, and ends the parsing
+    const std::string hex = HexStr(ParseHex_expected, ParseHex_expected + sizeof(ParseHex_expected));
+    for (size_t i = 0; i < hex.size(); i++) {
+        for (char c : {'g', 'G', '/', ':', '@', '`', '\x80'}) {
+            std::string bad = hex;
+            bad[i] = c;
+            std::vector<unsigned char> decoded(sizeof(ParseHex_expected));
+            BOOST_CHECK(!HexDecode(bad.c_str(), decoded.size(), decoded.data()));
+            BOOST_CHECK_EQUAL(ParseHex(bad).size(), i / 2);
+        }
+    }
+
+    // The spaces between the bytes, anywhere in the runs converted at once
+    std::string spaced = hex;
+    spaced.insert(34, " ");
+    spaced.insert(2, "\t ");
+    BOOST_CHECK(ParseHex(spaced) == std::vector<unsigned char>(ParseHex_expected, ParseHex_expected + sizeof(ParseHex_expected)));
+}
+
 
 BOOST_AUTO_TEST_CASE(util_DateTimeStrFormat)
 {
@@ -0,0 +1,82 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "validationinterface.h"
+
+#include "chain.h"
+#include "metrics.h"
+#include "primitives/transaction.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, BasicTestingSetup)
+
+namespace {
+
+/** Records the notifications, from the thread delivering them */
+class CRecordingSubscriber : public CValidationInterface
+{
+public:
+    std::vector<int> vNotifications;
+    bool fBlock;
+    boost::thread::id threadId;
+
+    CRecordingSubscriber() : fBlock(false) {}
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex)
+    {
+        threadId = boost::this_thread::get_id();
+        vNotifications.push_back(pindex->nHeight);
+    }
+
+    void SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+    {
+        fBlock = fBlock || pblock != NULL;
+        vNotifications.push_back(-(int)tx.nLockTime);
+    }
+};
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(validationqueue_delivers_in_order)
+{
+    CRecordingSubscriber subscriber;
+    RegisterValidationInterface(&subscriber, true);
+    const uint64_t nQueued = GetValidationQueueInfo().nQueued;
+
+    std::vector<CBlockIndex> vIndex(100);
+    std::vector<int> vExpected;
+    CBlock block;
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vIndex[i].nHeight = i + 1;
+        CMutableTransaction mtx;
+        mtx.nLockTime = i + 1;
+        GetMainSignals().SyncTransaction(CTransaction(mtx), &block);
+        GetMainSignals().UpdatedBlockTip(&vIndex[i]);
+        vExpected.push_back(-(int)(i + 1));
+        vExpected.push_back(i + 1);
+    }
+
+    // Unregistering waits for the notifications queued
+    UnregisterValidationInterface(&subscriber);
+    BOOST_CHECK(subscriber.vNotifications == vExpected);
+    BOOST_CHECK(!subscriber.fBlock);
+    BOOST_CHECK(subscriber.threadId != boost::this_thread::get_id());
+
+    const ValidationQueueInfo info = GetValidationQueueInfo();
+    BOOST_CHECK_EQUAL(info.nQueued, nQueued + 200);
+    BOOST_CHECK_EQUAL(info.nDepth, 0U);
+    BOOST_CHECK(info.delayLatency->getCount() >= 200);
+
+    // No more notifications once unregistered
+    GetMainSignals().UpdatedBlockTip(&vIndex[0]);
+    BOOST_CHECK_EQUAL(GetValidationQueueInfo().nQueued, nQueued + 200);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
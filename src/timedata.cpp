@@ -26,9 +26,12 @@ int64_t CTimeWarning::AddTimeData(const CNetAddr& ip, int64_t nTime, int64_t now
 		return 0;
 	}
 	int64_t nTimeOffset = nTime - now;
+	if (fSamplingDone.load(std::memory_order_acquire)) {
+		return nTimeOffset;
+	}
 	LOCK(cs);
 	// Ignore duplicate IPs.
-	if (setKnown.size() == TIMEDATA_MAX_SAMPLES || !setKnown.insert(ip).second) {
+	if (fSamplingDone || !setKnown.insert(ip).second) {
 		return nTimeOffset;
 	}
 	LogPrintf("Added time data, samples %d, offset %+d (%+d minutes)\n", setKnown.size(), nTimeOffset, nTimeOffset/60);
@@ -45,6 +48,11 @@ int64_t CTimeWarning::AddTimeData(const CNetAddr& ip, int64_t nTime, int64_t now
 		Warn(nPeersAhead, nPeersBehind);
 	}
 
+	if (setKnown.size() == TIMEDATA_MAX_SAMPLES || nPeersBehind + nPeersAhead == TIMEDATA_WARNING_SAMPLES) {
+		setKnown.clear();
+		fSamplingDone.store(true, std::memory_order_release);
+	}
+
 	return nTimeOffset;
 }
 
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_TIMEDATA_H
 #define BITCOIN_TIMEDATA_H
 
+#include <atomic>
 #include <set>
 #include <stdint.h>
 #include "netbase.h"
@@ -17,6 +18,8 @@ private:
 	std::set<CNetAddr> setKnown;
 	size_t nPeersAhead;
 	size_t nPeersBehind;
+	//! Set once no further sample can change the warning, later peers skip the lock
+	std::atomic<bool> fSamplingDone;
 
 public:
 	static const size_t TIMEDATA_WARNING_SAMPLES = 8;
@@ -25,7 +28,7 @@ public:
 	static const int64_t TIMEDATA_WARNING_THRESHOLD = 10 * 60;
 	static const int64_t TIMEDATA_IGNORE_THRESHOLD = 10 * 24 * 60 * 60;
 
-	CTimeWarning() : nPeersBehind(0), nPeersAhead(0) {}
+	CTimeWarning() : nPeersAhead(0), nPeersBehind(0), fSamplingDone(false) {}
 	virtual ~CTimeWarning() {}
 
 	int64_t AddTimeData(const CNetAddr& ip, int64_t nTime, int64_t now);
@@ -6,13 +6,18 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "crypto/common.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
 
 #include <stdint.h>
 
+#include <algorithm>
+
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -20,8 +25,11 @@ using namespace std;
 static const char DB_ANCHOR = 'A';
 static const char DB_NULLIFIER = 's';
 static const char DB_COINS = 'c';
+static const char DB_COIN = 'C';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_TXINDEX_SHORT = 'T';
+static const char DB_TXINDEX_BEST = 'I';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
@@ -30,6 +38,15 @@ static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_FAST_REINDEX_FLAG = 'S';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SNAPSHOT_BASE = 'V';
+static const char DB_SNAPSHOT_LOADING = 'W';
+static const char DB_COMPRESSED_FILES = 'Z';
+
+//! The nullifier filter has room for twice the nullifiers stored when it is built, and at least this many
+static const size_t NULLIFIER_FILTER_MIN_ELEMENTS = 1000000;
+static const double NULLIFIER_FILTER_FP_RATE = 0.001;
+//! Number of anchor trees kept deserialized. JoinSplits almost always refer to recent anchors.
+static const size_t ANCHOR_CACHE_SIZE = 100;
 
 
 void static BatchWriteAnchor(CLevelDBBatch &batch,
@@ -51,11 +68,115 @@ void static BatchWriteNullifier(CLevelDBBatch &batch, const uint256 &nf, const b
         batch.Write(make_pair(DB_NULLIFIER, nf), true);
 }
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
-    if (coins.IsPruned())
-        batch.Erase(make_pair(DB_COINS, hash));
-    else
-        batch.Write(make_pair(DB_COINS, hash), coins);
+namespace {
+
+/**
+ * Key of one unspent output: its txid and position. The outputs of a transaction
+ * sort next to each other and in order, as VARINT preserves the order of numbers.
+ */
+struct CCoinKey
+{
+    uint256 hash;
+    uint32_t n;
+
+    CCoinKey() : n(0) {}
+    CCoinKey(const uint256 &hashIn, uint32_t nIn) : hash(hashIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = DB_COIN;
+        READWRITE(chType);
+        READWRITE(hash);
+        READWRITE(VARINT(n));
+    }
+};
+
+/** Prefix of the keys of the outputs of a transaction */
+std::pair<char, uint256> CoinKeyPrefix(const uint256 &hash)
+{
+    return std::make_pair(DB_COIN, hash);
+}
+
+/** Value of one unspent output: the output and the metadata of its CCoins */
+struct CCoinOutput
+{
+    int nVersion;
+    bool fCoinBase;
+    int nHeight;
+    CTxOut out;
+
+    CCoinOutput() : nVersion(0), fCoinBase(false), nHeight(0) {}
+    CCoinOutput(const CCoins &coins, uint32_t n) :
+        nVersion(coins.nVersion), fCoinBase(coins.fCoinBase), nHeight(coins.nHeight), out(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(this->nVersion));
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 2;
+            fCoinBase = nCode & 1;
+        }
+        READWRITE(REF(CTxOutCompressor(out)));
+    }
+};
+
+/**
+ * Read the outputs of hash from the cursor into coins, starting at the cursor
+ * position and leaving it after the last of them.
+ * @return false if there are none
+ */
+bool ReadCoinOutputs(leveldb::Iterator *pcursor, const uint256 &hash, CCoins &coins)
+{
+    coins.Clear();
+    bool fFound = false;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        CCoinKey key;
+        if (slKey.size() < 33 || slKey[0] != DB_COIN)
+            break;
+        ssKey >> key;
+        if (key.hash != hash)
+            break;
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        CCoinOutput output;
+        ssValue >> output;
+        coins.nVersion = output.nVersion;
+        coins.fCoinBase = output.fCoinBase;
+        coins.nHeight = output.nHeight;
+        if (coins.vout.size() <= key.n)
+            coins.vout.resize(key.n + 1);
+        coins.vout[key.n] = output.out;
+        fFound = true;
+    }
+    return fFound;
+}
+
+/**
+ * Bring the outputs of hash in the database, which are those of stored, to
+ * those of coins, only writing and erasing the outputs that differ.
+ */
+void BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins, const CCoins &stored)
+{
+    bool fSameMetadata = coins.nVersion == stored.nVersion && coins.fCoinBase == stored.fCoinBase &&
+                         coins.nHeight == stored.nHeight;
+    for (uint32_t i = 0; i < std::max(coins.vout.size(), stored.vout.size()); i++) {
+        if (!coins.IsAvailable(i)) {
+            if (stored.IsAvailable(i))
+                batch.Erase(CCoinKey(hash, i));
+        } else if (!fSameMetadata || !stored.IsAvailable(i) || coins.vout[i] != stored.vout[i]) {
+            batch.Write(CCoinKey(hash, i), CCoinOutput(coins, i));
+        }
+    }
+}
+
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
@@ -66,12 +187,146 @@ void static BatchWriteHashBestAnchor(CLevelDBBatch &batch, const uint256 &hash)
     batch.Write(DB_BEST_ANCHOR, hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) :
+    db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe, CLevelDBProfile::Chainstate().ApplyArgs()), fNullifierFilterReady(false), nAnchorCacheGeneration(0) {
+    fLegacyCoins = HaveLegacyCoins();
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, CLevelDBProfile::Chainstate().ApplyArgs()), fNullifierFilterReady(false), nAnchorCacheGeneration(0) {
+    fLegacyCoins = HaveLegacyCoins();
 }
 
+bool CCoinsViewDB::HaveLegacyCoins() const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(std::string(1, DB_COINS));
+    return pcursor->Valid() && pcursor->key().size() > 0 && pcursor->key()[0] == DB_COINS;
+}
+
+bool CCoinsViewDB::Upgrade() {
+    if (!fLegacyCoins)
+        return true;
+
+    uiInterface.InitMessage(_("Upgrading the coins database..."));
+    LogPrintf("Upgrading the coins database to one record per unspent output...\n");
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::string(1, DB_COINS));
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+    uint64_t nUpgraded = 0;
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() == 0 || slKey[0] != DB_COINS)
+                break;
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 txid;
+            ssKey >> chType >> txid;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+
+            // Each record moves in a single batch, so an interrupted upgrade carries on at the next start
+            BatchWriteCoins(batch, txid, coins, CCoins());
+            batch.Erase(make_pair(DB_COINS, txid));
+            nUpgraded++;
+            if (++nBatch >= 10000) {
+                if (!db.WriteBatch(batch))
+                    return error("%s: failed to write to the coins database", __func__);
+                batch = CLevelDBBatch();
+                nBatch = 0;
+                if (ShutdownRequested()) {
+                    LogPrintf("Coins database upgrade interrupted after %u transactions\n", nUpgraded);
+                    return true;
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (!db.WriteBatch(batch))
+        return error("%s: failed to write to the coins database", __func__);
+    fLegacyCoins = false;
+    LogPrintf("Upgraded the coins of %u transactions\n", nUpgraded);
+    return true;
+}
+
+void CCoinsViewDB::LoadNullifierFilter() {
+    int64_t nStart = GetTimeMillis();
+    size_t nNullifiers = 0;
+    {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        for (pcursor->Seek(std::string(1, DB_NULLIFIER)); pcursor->Valid(); pcursor->Next()) {
+            if (pcursor->key().size() == 0 || pcursor->key()[0] != DB_NULLIFIER)
+                break;
+            if (++nNullifiers % 10000 == 0)
+                boost::this_thread::interruption_point();
+        }
+    }
+    {
+        LOCK(csNullifierFilter);
+        pnullifierFilter.reset(new CHashBloomFilter(std::max(2 * nNullifiers, NULLIFIER_FILTER_MIN_ELEMENTS), NULLIFIER_FILTER_FP_RATE));
+        fNullifierFilterReady = false;
+    }
+
+    // BatchWrite adds to the filter from now on, and the cursor sees what was written before
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    std::vector<uint256> vNullifiers;
+    vNullifiers.reserve(10000);
+    nNullifiers = 0;
+    for (pcursor->Seek(std::string(1, DB_NULLIFIER)); ; pcursor->Next()) {
+        bool fEnd = !pcursor->Valid() || pcursor->key().size() == 0 || pcursor->key()[0] != DB_NULLIFIER;
+        if (!fEnd) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 nf;
+            ssKey >> chType >> nf;
+            vNullifiers.push_back(nf);
+        }
+        if (fEnd || vNullifiers.size() >= 10000) {
+            LOCK(csNullifierFilter);
+            for (const uint256& nf : vNullifiers)
+                pnullifierFilter->insert(nf);
+            nNullifiers += vNullifiers.size();
+            vNullifiers.clear();
+            if (fEnd) {
+                fNullifierFilterReady = true;
+                break;
+            }
+        }
+        if (vNullifiers.empty())
+            boost::this_thread::interruption_point();
+    }
+    LogPrintf("Loaded the filter of %u nullifiers in %dms\n", nNullifiers, GetTimeMillis() - nStart);
+}
+
+void CCoinsViewDB::CacheAnchor(const uint256 &rt, const std::shared_ptr<const ZCIncrementalMerkleTree> &ptree) const {
+    LOCK(csAnchorCache);
+    std::map<uint256, AnchorCacheList::iterator>::iterator it = mapAnchorCache.find(rt);
+    if (it != mapAnchorCache.end()) {
+        it->second->second = ptree;
+        lAnchorCache.splice(lAnchorCache.begin(), lAnchorCache, it->second);
+        return;
+    }
+    lAnchorCache.push_front(std::make_pair(rt, ptree));
+    mapAnchorCache[rt] = lAnchorCache.begin();
+    if (lAnchorCache.size() > ANCHOR_CACHE_SIZE) {
+        mapAnchorCache.erase(lAnchorCache.back().first);
+        lAnchorCache.pop_back();
+    }
+}
+
+void CCoinsViewDB::UncacheAnchor(const uint256 &rt) {
+    LOCK(csAnchorCache);
+    std::map<uint256, AnchorCacheList::iterator>::iterator it = mapAnchorCache.find(rt);
+    if (it != mapAnchorCache.end()) {
+        lAnchorCache.erase(it->second);
+        mapAnchorCache.erase(it);
+    }
+}
 
 bool CCoinsViewDB::GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const {
     if (rt == ZCIncrementalMerkleTree::empty_root()) {
@@ -80,12 +335,37 @@ bool CCoinsViewDB::GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree)
         return true;
     }
 
-    bool read = db.Read(make_pair(DB_ANCHOR, rt), tree);
+    uint64_t nGeneration;
+    {
+        LOCK(csAnchorCache);
+        std::map<uint256, AnchorCacheList::iterator>::iterator it = mapAnchorCache.find(rt);
+        if (it != mapAnchorCache.end()) {
+            lAnchorCache.splice(lAnchorCache.begin(), lAnchorCache, it->second);
+            tree = *it->second->second;
+            return true;
+        }
+        nGeneration = nAnchorCacheGeneration;
+    }
 
-    return read;
+    std::shared_ptr<ZCIncrementalMerkleTree> ptree = std::make_shared<ZCIncrementalMerkleTree>();
+    if (!db.Read(make_pair(DB_ANCHOR, rt), *ptree))
+        return false;
+    tree = *ptree;
+    {
+        // Unless a batch was written meanwhile, which may have changed the tree
+        LOCK(csAnchorCache);
+        if (nGeneration == nAnchorCacheGeneration)
+            CacheAnchor(rt, ptree);
+    }
+    return true;
 }
 
 bool CCoinsViewDB::GetNullifier(const uint256 &nf) const {
+    {
+        LOCK(csNullifierFilter);
+        if (fNullifierFilterReady && !pnullifierFilter->contains(nf))
+            return false;
+    }
     bool spent = false;
     bool read = db.Read(make_pair(DB_NULLIFIER, nf), spent);
 
@@ -93,11 +373,27 @@ bool CCoinsViewDB::GetNullifier(const uint256 &nf) const {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewSeekIterator());
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << CoinKeyPrefix(txid);
+    pcursor->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+    try {
+        if (ReadCoinOutputs(pcursor.get(), txid, coins))
+            return true;
+    } catch (const std::exception& e) {
+        return error("%s: deserialize error - %s", __func__, e.what());
+    }
+    return fLegacyCoins && db.Read(make_pair(DB_COINS, txid), coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewSeekIterator());
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << CoinKeyPrefix(txid);
+    pcursor->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+    if (pcursor->Valid() && pcursor->key().starts_with(leveldb::Slice(&ssKey[0], ssKey.size())))
+        return true;
+    return fLegacyCoins && db.Exists(make_pair(DB_COINS, txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -124,7 +420,19 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            // Only the outputs that changed are written, which are found by reading
+            // those in the database, unless it is known not to have any
+            CCoins stored;
+            if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+                if (fLegacyCoins && db.Read(make_pair(DB_COINS, it->first), stored)) {
+                    // Not upgraded yet, so none of its outputs have a record of their own
+                    batch.Erase(make_pair(DB_COINS, it->first));
+                    stored.Clear();
+                } else {
+                    GetCoins(it->first, stored);
+                }
+            }
+            BatchWriteCoins(batch, it->first, it->second.coins, stored);
             changed++;
         }
         count++;
@@ -132,23 +440,39 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
         mapCoins.erase(itOld);
     }
 
+    // The anchors just written are those the next JoinSplits refer to, they go in the
+    // cache once they are in the database
+    std::vector<std::pair<uint256, std::shared_ptr<const ZCIncrementalMerkleTree> > > vAnchorsWritten;
     for (CAnchorsMap::iterator it = mapAnchors.begin(); it != mapAnchors.end();) {
         if (it->second.flags & CAnchorsCacheEntry::DIRTY) {
             BatchWriteAnchor(batch, it->first, it->second.tree, it->second.entered);
+            std::shared_ptr<const ZCIncrementalMerkleTree> ptree;
+            if (it->second.entered)
+                ptree = std::make_shared<ZCIncrementalMerkleTree>(it->second.tree);
+            vAnchorsWritten.push_back(std::make_pair(it->first, ptree));
             // TODO: changed++?
         }
         CAnchorsMap::iterator itOld = it++;
         mapAnchors.erase(itOld);
     }
 
+    // Into the filter before the database, so that it never misses a stored nullifier.
+    // Those erased stay in it, which only costs a lookup. As long as LoadNullifierFilter
+    // has not created the filter, the lock is held until the batch is written: the
+    // database it reads once it has created the filter then has these nullifiers.
+    std::unique_ptr<CCriticalBlock> plockNullifierFilter(new CCriticalBlock(csNullifierFilter, "csNullifierFilter", __FILE__, __LINE__));
     for (CNullifiersMap::iterator it = mapNullifiers.begin(); it != mapNullifiers.end();) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
             BatchWriteNullifier(batch, it->first, it->second.entered);
+            if (it->second.entered && pnullifierFilter)
+                pnullifierFilter->insert(it->first);
             // TODO: changed++?
         }
         CNullifiersMap::iterator itOld = it++;
         mapNullifiers.erase(itOld);
     }
+    if (pnullifierFilter)
+        plockNullifierFilter.reset();
 
     if (!hashBlock.IsNull())
         BatchWriteHashBestChain(batch, hashBlock);
@@ -156,10 +480,28 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
         BatchWriteHashBestAnchor(batch, hashAnchor);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    {
+        // The trees GetAnchorAt reads from now on may be replaced by this batch
+        LOCK(csAnchorCache);
+        nAnchorCacheGeneration++;
+    }
+    bool fWritten = db.WriteBatch(batch);
+    plockNullifierFilter.reset();
+    LOCK(csAnchorCache);
+    if (fWritten) {
+        for (size_t i = 0; i < vAnchorsWritten.size(); i++) {
+            if (vAnchorsWritten[i].second)
+                CacheAnchor(vAnchorsWritten[i].first, vAnchorsWritten[i].second);
+            else
+                UncacheAnchor(vAnchorsWritten[i].first);
+        }
+    }
+    nAnchorCacheGeneration++;
+    return fWritten;
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, CLevelDBProfile::BlockIndex().ApplyArgs()) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -211,31 +553,39 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == DB_COINS) {
+            CCoins coins;
+            uint256 txhash;
+            if (chType == DB_COIN) {
+                // Gather the outputs of the transaction, leaving the cursor after them
+                ssKey >> txhash;
+                ReadCoinOutputs(pcursor.get(), txhash, coins);
+            } else if (chType == DB_COINS) {
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
                 ssValue >> coins;
-                uint256 txhash;
                 ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+                pcursor->Next();
+            } else {
+                pcursor->Next();
+                continue;
+            }
+            ss << txhash;
+            ss << VARINT(coins.nVersion);
+            ss << (coins.fCoinBase ? 'c' : 'n');
+            ss << VARINT(coins.nHeight);
+            stats.nTransactions++;
+            for (unsigned int i=0; i<coins.vout.size(); i++) {
+                const CTxOut &out = coins.vout[i];
+                if (!out.IsNull()) {
+                    stats.nTransactionOutputs++;
+                    ss << VARINT(i+1);
+                    ss << out;
+                    nTotalAmount += out.nValue;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
             }
-            pcursor->Next();
+            // As large as the record of the whole transaction before the upgrade to one record per output
+            stats.nSerializedSize += 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+            ss << VARINT(0);
         } catch (const std::exception& e) {
             return error("%s: Deserialize or I/O error - %s", __func__, e.what());
         }
@@ -249,6 +599,329 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
+namespace {
+
+//! Record types of a chainstate snapshot file, terminated by SNAPSHOT_END and the hash of what precedes it
+static const char SNAPSHOT_END = 0;
+
+/** Serializes objects both to a snapshot file, if any, and to its running hash */
+class CSnapshotWriter
+{
+private:
+    CAutoFile *pfile;
+    CHashWriter hasher;
+
+public:
+    CSnapshotWriter(CAutoFile *pfileIn) : pfile(pfileIn), hasher(SER_DISK, CLIENT_VERSION) {}
+
+    template<typename T>
+    CSnapshotWriter& operator<<(const T& obj) {
+        if (pfile)
+            *pfile << obj;
+        hasher << obj;
+        return *this;
+    }
+
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+/** Deserializes objects from a snapshot file, hashing them as they are read */
+class CSnapshotReader
+{
+private:
+    CAutoFile &file;
+    CHashWriter hasher;
+
+public:
+    CSnapshotReader(CAutoFile &fileIn) : file(fileIn), hasher(SER_DISK, CLIENT_VERSION) {}
+
+    template<typename T>
+    CSnapshotReader& operator>>(T& obj) {
+        file >> obj;
+        hasher << obj;
+        return *this;
+    }
+
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+/**
+ * Read a snapshot file from the start, handing each record to the given
+ * callback, and check the hash at its end.
+ */
+bool ReadSnapshotHeader(CSnapshotReader &reader, CChainstateSnapshotInfo &info)
+{
+    CMessageHeader::MessageStartChars pchMessageStart;
+    int nVersion;
+    reader >> FLATDATA(pchMessageStart) >> nVersion;
+    if (memcmp(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart)) != 0)
+        return error("%s: snapshot is for a different network", __func__);
+    if (nVersion != CHAINSTATE_SNAPSHOT_VERSION)
+        return error("%s: unsupported snapshot version %d", __func__, nVersion);
+    reader >> info.hashBlock >> info.hashAnchor;
+    return true;
+}
+
+template<typename Callback>
+bool ReadSnapshot(const boost::filesystem::path &path, CChainstateSnapshotInfo &info, Callback callback)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: failed to open %s", __func__, path.string());
+
+    info = CChainstateSnapshotInfo();
+    try {
+        CSnapshotReader reader(filein);
+        if (!ReadSnapshotHeader(reader, info))
+            return false;
+
+        while (true) {
+            boost::this_thread::interruption_point();
+            char chType;
+            reader >> chType;
+            if (chType == SNAPSHOT_END)
+                break;
+            uint256 key;
+            reader >> key;
+            if (chType == DB_COINS) {
+                CCoins coins;
+                reader >> coins;
+                info.nCoins++;
+                callback(chType, key, &coins, (ZCIncrementalMerkleTree*)NULL);
+            } else if (chType == DB_ANCHOR) {
+                ZCIncrementalMerkleTree tree;
+                reader >> tree;
+                info.nAnchors++;
+                callback(chType, key, (CCoins*)NULL, &tree);
+            } else if (chType == DB_NULLIFIER) {
+                info.nNullifiers++;
+                callback(chType, key, (CCoins*)NULL, (ZCIncrementalMerkleTree*)NULL);
+            } else {
+                return error("%s: unknown record type %d", __func__, chType);
+            }
+        }
+
+        info.hashSnapshot = reader.GetHash();
+        uint256 hashExpected;
+        filein >> hashExpected;
+        if (hashExpected != info.hashSnapshot)
+            return error("%s: snapshot hash mismatch (%s, expected %s)", __func__, info.hashSnapshot.ToString(), hashExpected.ToString());
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+}
+
+bool CCoinsViewDB::WriteSnapshot(CAutoFile &fileout, CChainstateSnapshotInfo &info) const {
+    return StreamSnapshot(&fileout, info);
+}
+
+bool CCoinsViewDB::HashSnapshot(CChainstateSnapshotInfo &info) const {
+    return StreamSnapshot(NULL, info);
+}
+
+bool CCoinsViewDB::StreamSnapshot(CAutoFile *pfileout, CChainstateSnapshotInfo &info) const {
+    // The iterator reads from an implicit snapshot of the database, so the
+    // best block and anchor below are consistent with the records.
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+
+    info = CChainstateSnapshotInfo();
+    info.hashAnchor = ZCIncrementalMerkleTree::empty_root();
+    try {
+        for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            if (chType == DB_BEST_BLOCK && ssKey.empty())
+                ssValue >> info.hashBlock;
+            else if (chType == DB_BEST_ANCHOR && ssKey.empty())
+                ssValue >> info.hashAnchor;
+        }
+
+        CSnapshotWriter writer(pfileout);
+        writer << FLATDATA(Params().MessageStart()) << CHAINSTATE_SNAPSHOT_VERSION;
+        writer << info.hashBlock << info.hashAnchor;
+
+        pcursor->SeekToFirst();
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != DB_COIN && chType != DB_COINS && chType != DB_ANCHOR && chType != DB_NULLIFIER) {
+                pcursor->Next();
+                continue;
+            }
+            uint256 key;
+            ssKey >> key;
+            if (chType == DB_COIN) {
+                // The file keeps a record per transaction, in the same order as before the upgrade
+                CCoins coins;
+                ReadCoinOutputs(pcursor.get(), key, coins);
+                writer << DB_COINS << key << coins;
+                info.nCoins++;
+                continue;
+            }
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            writer << chType << key;
+            if (chType == DB_COINS) {
+                CCoins coins;
+                ssValue >> coins;
+                writer << coins;
+                info.nCoins++;
+            } else if (chType == DB_ANCHOR) {
+                ZCIncrementalMerkleTree tree;
+                ssValue >> tree;
+                writer << tree;
+                info.nAnchors++;
+            } else {
+                info.nNullifiers++;
+            }
+            pcursor->Next();
+        }
+
+        writer << SNAPSHOT_END;
+        info.hashSnapshot = writer.GetHash();
+        if (pfileout)
+            *pfileout << info.hashSnapshot;
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CCoinsViewDB::ReadSnapshotInfo(const boost::filesystem::path &path, CChainstateSnapshotInfo &info) {
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: failed to open %s", __func__, path.string());
+
+    info = CChainstateSnapshotInfo();
+    try {
+        CSnapshotReader reader(filein);
+        return ReadSnapshotHeader(reader, info);
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+}
+
+bool CCoinsViewDB::LoadSnapshot(const boost::filesystem::path &path, CChainstateSnapshotInfo &info) {
+    // The genesis block adds nothing to the chainstate, its records are all overwritten
+    uint256 hashBest = GetBestBlock();
+    if (!hashBest.IsNull() && hashBest != Params().GetConsensus().hashGenesisBlock)
+        return error("%s: the chainstate database is not empty", __func__);
+
+    // First pass: only check the integrity of the file.
+    if (!ReadSnapshot(path, info, [](char, const uint256&, CCoins*, ZCIncrementalMerkleTree*) {}))
+        return false;
+
+    // Second pass: write it, in batches. The marker goes first, so that a
+    // load interrupted before ActivateSnapshot is cleared on the next start.
+    if (!db.Write(DB_SNAPSHOT_LOADING, info.hashBlock, true))
+        return error("%s: failed to write to the database", __func__);
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+    std::vector<uint256> vNullifiers;
+    bool fWriteOk = true;
+    auto writeBatch = [&]() {
+        // As in BatchWrite, the filter cannot be created between adding the
+        // nullifiers to it and writing them.
+        LOCK(csNullifierFilter);
+        if (pnullifierFilter) {
+            for (const uint256& nf : vNullifiers)
+                pnullifierFilter->insert(nf);
+        }
+        vNullifiers.clear();
+        fWriteOk = fWriteOk && db.WriteBatch(batch);
+        batch = CLevelDBBatch();
+        nBatch = 0;
+    };
+    CChainstateSnapshotInfo infoCheck;
+    if (!ReadSnapshot(path, infoCheck, [&](char chType, const uint256& key, CCoins* pcoins, ZCIncrementalMerkleTree* ptree) {
+            if (chType == DB_COINS)
+                BatchWriteCoins(batch, key, *pcoins, CCoins());
+            else if (chType == DB_ANCHOR)
+                BatchWriteAnchor(batch, key, *ptree, true);
+            else {
+                BatchWriteNullifier(batch, key, true);
+                vNullifiers.push_back(key);
+            }
+            if (++nBatch >= 10000)
+                writeBatch();
+        }))
+        return false;
+    writeBatch();
+    if (!fWriteOk || infoCheck.hashSnapshot != info.hashSnapshot)
+        return error("%s: failed to write snapshot to the database", __func__);
+    return true;
+}
+
+bool CCoinsViewDB::ActivateSnapshot(const CChainstateSnapshotInfo &info) {
+    // Remember the snapshot until a background validation has confirmed it
+    CLevelDBBatch batch;
+    batch.Write(DB_SNAPSHOT_BASE, info);
+    batch.Erase(DB_SNAPSHOT_LOADING);
+    BatchWriteHashBestAnchor(batch, info.hashAnchor);
+    BatchWriteHashBestChain(batch, info.hashBlock);
+    return db.WriteBatch(batch, true);
+}
+
+bool CCoinsViewDB::ClearInterruptedSnapshot() {
+    uint256 hashBlock;
+    if (!db.Read(DB_SNAPSHOT_LOADING, hashBlock))
+        return true;
+    LogPrintf("Clearing the chainstate snapshot of block %s, whose load was interrupted\n", hashBlock.ToString());
+
+    // Only the genesis block had been connected, and it adds none of these records
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+    try {
+        for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() == 0)
+                continue;
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            if (slKey[0] == DB_COIN) {
+                CCoinKey key;
+                ssKey >> key;
+                batch.Erase(key);
+            } else if (slKey[0] == DB_COINS || slKey[0] == DB_ANCHOR || slKey[0] == DB_NULLIFIER) {
+                char chType;
+                uint256 key;
+                ssKey >> chType >> key;
+                batch.Erase(make_pair(chType, key));
+            } else {
+                continue;
+            }
+            if (++nBatch >= 10000) {
+                if (!db.WriteBatch(batch))
+                    return error("%s: failed to write to the database", __func__);
+                batch = CLevelDBBatch();
+                nBatch = 0;
+            }
+        }
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+    batch.Erase(DB_SNAPSHOT_LOADING);
+    return db.WriteBatch(batch, true);
+}
+
+bool CCoinsViewDB::ReadSnapshotBase(CChainstateSnapshotInfo &info) const {
+    return db.Read(DB_SNAPSHOT_BASE, info);
+}
+
+bool CCoinsViewDB::EraseSnapshotBase() {
+    return db.Erase(DB_SNAPSHOT_BASE, true);
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CLevelDBBatch batch;
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -261,17 +934,66 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
+namespace {
+
+//! The bytes of a txid after the 64 bits of its short key, telling apart the transactions sharing a key
+uint32_t GetTxIndexCheck(const uint256 &txid) {
+    return ReadLE32(txid.begin() + 8);
+}
+
+} // anon namespace
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+    std::vector<CTxIndexEntry> vEntries;
+    if (Read(make_pair(DB_TXINDEX_SHORT, txid.GetCheapHash()), vEntries)) {
+        const uint32_t nCheck = GetTxIndexCheck(txid);
+        BOOST_FOREACH(const CTxIndexEntry& entry, vEntries) {
+            if (entry.nCheck == nCheck) {
+                pos = entry.pos;
+                return true;
+            }
+        }
+    }
+    // Entries written before the short keys
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+void CBlockTreeDB::BatchWriteTxIndex(CLevelDBBatch &batch, const std::vector<std::pair<uint256, CDiskTxPos> > &vect) {
+    // The entries of each short key, with what the database has for the keys not seen before in the list
+    std::map<uint64_t, std::vector<CTxIndexEntry> > mapEntries;
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        const uint64_t nKey = it->first.GetCheapHash();
+        std::map<uint64_t, std::vector<CTxIndexEntry> >::iterator mi = mapEntries.find(nKey);
+        if (mi == mapEntries.end()) {
+            mi = mapEntries.insert(std::make_pair(nKey, std::vector<CTxIndexEntry>())).first;
+            if (!Read(make_pair(DB_TXINDEX_SHORT, nKey), mi->second))
+                mi->second.clear();
+        }
+        const uint32_t nCheck = GetTxIndexCheck(it->first);
+        std::vector<CTxIndexEntry>::iterator ei = mi->second.begin();
+        while (ei != mi->second.end() && ei->nCheck != nCheck)
+            ei++;
+        if (ei == mi->second.end())
+            mi->second.push_back(CTxIndexEntry(nCheck, it->second));
+        else
+            ei->pos = it->second;
+    }
+    for (std::map<uint64_t, std::vector<CTxIndexEntry> >::const_iterator mi = mapEntries.begin(); mi != mapEntries.end(); mi++)
+        batch.Write(make_pair(DB_TXINDEX_SHORT, mi->first), mi->second);
+}
+
+bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect, const uint256 &hashBest) {
+    LOCK(cs_txindex);
     CLevelDBBatch batch;
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
+    BatchWriteTxIndex(batch, vect);
+    batch.Write(DB_TXINDEX_BEST, hashBest);
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadTxIndexBestBlock(uint256 &hashBest) {
+    return Read(DB_TXINDEX_BEST, hashBest);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -284,6 +1006,59 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &dbindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, hash), dbindex);
+}
+
+bool CBlockTreeDB::ReadCompressedBlockFiles(int &nFiles) {
+    return Read(DB_COMPRESSED_FILES, nFiles);
+}
+
+bool CBlockTreeDB::WriteCompressedBlockFile(int nFile, const CBlockFileInfo &info, const std::vector<const CBlockIndex*> &blockinfo,
+                                            const std::vector<std::pair<uint256, CDiskTxPos> > &vTxPos) {
+    LOCK(cs_txindex);
+    CLevelDBBatch batch;
+    batch.Write(make_pair(DB_BLOCK_FILES, nFile), info);
+    for (std::vector<const CBlockIndex*>::const_iterator it = blockinfo.begin(); it != blockinfo.end(); it++)
+        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+    BatchWriteTxIndex(batch, vTxPos);
+    batch.Write(DB_COMPRESSED_FILES, nFile + 1);
+    return WriteBatch(batch, true);
+}
+
+namespace {
+
+/** A block index record read from the database, and what decoding it found */
+struct CBlockIndexRecord
+{
+    std::string strValue;
+    CDiskBlockIndex diskindex;
+    uint256 hash;
+    std::string strError;
+};
+
+/** Deserialize and hash the records i, i + nStride, ... of vRecords, and check their proof of work */
+void DecodeBlockIndexRecords(std::vector<CBlockIndexRecord> &vRecords, size_t nFirst, size_t nStride)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    for (size_t i = nFirst; i < vRecords.size(); i += nStride) {
+        CBlockIndexRecord &record = vRecords[i];
+        try {
+            CDataStream ssValue(record.strValue.data(), record.strValue.data() + record.strValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> record.diskindex;
+        } catch (const std::exception& e) {
+            record.strError = strprintf("Deserialize error - %s", e.what());
+            continue;
+        }
+        record.hash = record.diskindex.GetBlockHash();
+        if (!CheckProofOfWork(record.hash, record.diskindex.nBits, consensus))
+            record.strError = strprintf("CheckProofOfWork failed: %s", record.hash.ToString());
+        std::string().swap(record.strValue);
+    }
+}
+
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -292,48 +1067,64 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     ssKeySet << make_pair(DB_BLOCK_INDEX, uint256());
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
+    // Hashing the headers, which come with their Equihash solutions, takes most of the time.
+    // The records are read in batches, decoded and hashed by several threads, then inserted in order.
+    const size_t nThreads = std::max(1, std::min(GetNumCores(), 8));
+    const size_t nBatchSize = 4096;
+    std::vector<CBlockIndexRecord> vRecords;
+    bool fEnd = false;
+    while (!fEnd) {
         boost::this_thread::interruption_point();
+        vRecords.clear();
         try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == DB_BLOCK_INDEX) {
+            for (; pcursor->Valid() && vRecords.size() < nBatchSize; pcursor->Next()) {
+                leveldb::Slice slKey = pcursor->key();
+                if (slKey.size() == 0 || slKey[0] != DB_BLOCK_INDEX)
+                    break; // finished loading block index
                 leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashAnchor     = diskindex.hashAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-                pindexNew->nSproutValue   = diskindex.nSproutValue;
-                pindexNew->hashReserved   = diskindex.hashReserved;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+                vRecords.push_back(CBlockIndexRecord());
+                vRecords.back().strValue.assign(slValue.data(), slValue.size());
             }
         } catch (const std::exception& e) {
-            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            return error("%s: I/O error - %s", __func__, e.what());
+        }
+        fEnd = vRecords.size() < nBatchSize;
+
+        if (nThreads > 1 && vRecords.size() > nThreads) {
+            boost::thread_group decoders;
+            for (size_t i = 1; i < nThreads; i++)
+                decoders.create_thread(boost::bind(&DecodeBlockIndexRecords, boost::ref(vRecords), i, nThreads));
+            DecodeBlockIndexRecords(vRecords, 0, nThreads);
+            decoders.join_all();
+        } else {
+            DecodeBlockIndexRecords(vRecords, 0, 1);
+        }
+
+        // Load mapBlockIndex
+        for (CBlockIndexRecord &record : vRecords) {
+            if (!record.strError.empty())
+                return error("LoadBlockIndex(): %s", record.strError);
+            CDiskBlockIndex &diskindex = record.diskindex;
+
+            // Construct block index object
+            CBlockIndex* pindexNew = InsertBlockIndex(record.hash);
+            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->hashAnchor     = diskindex.hashAnchor;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            // The solution is read back from the database when the header is needed
+            pindexNew->TrimSolution();
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+            pindexNew->nSproutValue   = diskindex.nSproutValue;
+            pindexNew->hashReserved   = diskindex.hashReserved;
         }
     }
 
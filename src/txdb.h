@@ -6,16 +6,21 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "bloom.h"
 #include "coins.h"
 #include "leveldbwrapper.h"
+#include "sync.h"
 
+#include <list>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 class CBlockFileInfo;
 class CBlockIndex;
+class CDiskBlockIndex;
 struct CDiskTxPos;
 class uint256;
 
@@ -26,13 +31,62 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
+//! Version of the chainstate snapshot files written by CCoinsViewDB::WriteSnapshot
+static const int CHAINSTATE_SNAPSHOT_VERSION = 1;
+
+/** Summary of a chainstate snapshot file */
+struct CChainstateSnapshotInfo
+{
+    uint256 hashBlock;
+    uint256 hashAnchor;
+    uint64_t nCoins;
+    uint64_t nAnchors;
+    uint64_t nNullifiers;
+    uint256 hashSnapshot;
+
+    CChainstateSnapshotInfo() : nCoins(0), nAnchors(0), nNullifiers(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(hashAnchor);
+        READWRITE(nCoins);
+        READWRITE(nAnchors);
+        READWRITE(nNullifiers);
+        READWRITE(hashSnapshot);
+    }
+};
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
-    CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    //! Whether some coins may still be stored a record per transaction, as before Upgrade()
+    bool fLegacyCoins;
+
+    //! Filter over the stored nullifiers, used once fNullifierFilterReady is set
+    mutable CCriticalSection csNullifierFilter;
+    std::unique_ptr<CHashBloomFilter> pnullifierFilter;
+    bool fNullifierFilterReady;
+
+    //! The trees of the anchors last read or written, most recently used first
+    typedef std::list<std::pair<uint256, std::shared_ptr<const ZCIncrementalMerkleTree> > > AnchorCacheList;
+    mutable CCriticalSection csAnchorCache;
+    mutable AnchorCacheList lAnchorCache;
+    mutable std::map<uint256, AnchorCacheList::iterator> mapAnchorCache;
+    //! Changed by every BatchWrite before and after its commit: a tree read from the database meanwhile may be stale
+    uint64_t nAnchorCacheGeneration;
+
+    void CacheAnchor(const uint256 &rt, const std::shared_ptr<const ZCIncrementalMerkleTree> &ptree) const;
+    void UncacheAnchor(const uint256 &rt);
+
+    bool StreamSnapshot(CAutoFile *pfileout, CChainstateSnapshotInfo &info) const;
+    bool HaveLegacyCoins() const;
 public:
+    CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const;
@@ -47,6 +101,54 @@ public:
                     CAnchorsMap &mapAnchors,
                     CNullifiersMap &mapNullifiers);
     bool GetStats(CCoinsStats &stats) const;
+
+    const CLevelDBWrapper& GetDB() const { return db; }
+
+    /**
+     * Move the coins stored a record per transaction to a record per unspent output,
+     * so that spending an output does not rewrite the others. The database stays
+     * usable while only part of it is upgraded, and a shutdown stops the upgrade,
+     * which then carries on at the next start.
+     */
+    bool Upgrade();
+
+    /**
+     * Build the filter over the stored nullifiers, which then answers that one is
+     * not stored without reading the database. Meant to run on a thread of its
+     * own while the database is in use; the nullifiers written in the meantime
+     * make it to the filter too.
+     */
+    void LoadNullifierFilter();
+
+    /**
+     * Stream a consistent copy of the coins, anchors and nullifiers to a
+     * snapshot file, followed by a hash of its contents.
+     */
+    bool WriteSnapshot(CAutoFile &fileout, CChainstateSnapshotInfo &info) const;
+
+    /**
+     * Fill an empty database, or one holding only the genesis block, from a
+     * snapshot file written by WriteSnapshot. The whole file is hashed and
+     * checked before anything is written. The records are not those of the
+     * best block until ActivateSnapshot is called.
+     */
+    bool LoadSnapshot(const boost::filesystem::path &path, CChainstateSnapshotInfo &info);
+
+    //! Make the snapshot block, filled in by LoadSnapshot, the best block of the database
+    bool ActivateSnapshot(const CChainstateSnapshotInfo &info);
+
+    //! Erase what a LoadSnapshot not followed by ActivateSnapshot has written, if anything
+    bool ClearInterruptedSnapshot();
+
+    //! Read the block and anchor a snapshot file is of, without checking the rest of it
+    static bool ReadSnapshotInfo(const boost::filesystem::path &path, CChainstateSnapshotInfo &info);
+
+    //! Compute what WriteSnapshot would report, without writing a file
+    bool HashSnapshot(CChainstateSnapshotInfo &info) const;
+
+    //! The snapshot this database was loaded from, as long as it has not been validated
+    bool ReadSnapshotBase(CChainstateSnapshotInfo &info) const;
+    bool EraseSnapshotBase();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -66,10 +168,25 @@ public:
     bool WriteFastReindexing(bool fReindexFast);
     bool ReadFastReindexing(bool &fReindexFast);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    //! Write transaction positions, and the last block they come from, without syncing
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list, const uint256 &hashBest);
+    //! The last block whose transactions were written to the index
+    bool ReadTxIndexBestBlock(uint256 &hashBest);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
+    bool ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &dbindex);
+    //! Number of leading block files rewritten with compressed records
+    bool ReadCompressedBlockFiles(int &nFiles);
+    //! Record, synchronously, the rewrite of block file nFile: its info, the new positions of its blocks and transactions
+    bool WriteCompressedBlockFile(int nFile, const CBlockFileInfo &info, const std::vector<const CBlockIndex*> &blockinfo,
+                                  const std::vector<std::pair<uint256, CDiskTxPos> > &vTxPos);
+private:
+    //! Serializes the merges of the entries of short keys, read and written back
+    CCriticalSection cs_txindex;
+
+    //! Add the entries of the short keys of the transactions in list, merged with those stored, to batch
+    void BatchWriteTxIndex(CLevelDBBatch &batch, const std::vector<std::pair<uint256, CDiskTxPos> > &list);
 };
 
 #endif // BITCOIN_TXDB_H
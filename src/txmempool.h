@@ -6,13 +6,21 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <atomic>
+#include <deque>
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/unordered_map.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -29,14 +37,23 @@ inline bool AllowFree(double dPriority)
 
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+//! Additions and removals of transactions the pool keeps for CTxMemPool::GetChangesSince
+static const size_t MEMPOOL_CHANGE_LOG_SIZE = 100000;
 
 /**
  * CTxMemPool stores these:
+ *
+ * Each entry also tracks the transactions it depends on in the mempool (its in-mempool ancestors,
+ * including itself): their number, their total size and their total modified fee. A transaction
+ * can only be mined together with its ancestors, so this is what it is worth to a block.
+ *
+ * The same is tracked for the in-mempool descendants, which have to leave the mempool with the
+ * transaction when it is evicted.
  */
 class CTxMemPoolEntry
 {
 private:
-    CTransaction tx;
+    CTransactionRef tx;
     CAmount nFee; //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize; //! ... and avoid recomputing tx size
     size_t nModSize; //! ... and modified size for priority
@@ -45,14 +62,29 @@ private:
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
+    int64_t feeDelta; //! Fee added with prioritisetransaction, for the mining order
+
+    // Information about the in-mempool ancestors of this transaction, itself included
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    // Information about the in-mempool descendants of this transaction, itself included
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
 
 public:
+    CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
+                    int64_t _nTime, double _dPriority, unsigned int _nHeight, bool poolHasNoInputsOf = false);
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                     int64_t _nTime, double _dPriority, unsigned int _nHeight, bool poolHasNoInputsOf = false);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
-    const CTransaction& GetTx() const { return this->tx; }
+    const CTransaction& GetTx() const { return *this->tx; }
+    //! The transaction shared with the blocks built from the mempool
+    CTransactionRef GetSharedTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
@@ -60,8 +92,159 @@ public:
     unsigned int GetHeight() const { return nHeight; }
     bool WasClearAtEntry() const { return hadNoDependencies; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
+
+    // Adjusts the ancestor state, for a change of the ancestors of this transaction
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    // Adjusts the descendant state, for a change of the descendants of this transaction
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    // Updates the fee delta used for mining priority score, and the modified fees with ancestors
+    void UpdateFeeDelta(int64_t feeDelta);
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+};
+
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+};
+
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+};
+
+struct update_fee_delta
+{
+    update_fee_delta(int64_t _feeDelta) : feeDelta(_feeDelta) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    int64_t feeDelta;
+};
+
+// extracts a TxMemPoolEntry's transaction hash
+struct mempoolentry_txid
+{
+    typedef uint256 result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+/** Sort by the fee rate of the transaction alone (with its fee delta), highest first */
+class CompareTxMemPoolEntryByModifiedFeeRate
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
+        double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
+        if (f1 == f2) {
+            return b.GetTx().GetHash() < a.GetTx().GetHash();
+        }
+        return f1 > f2;
+    }
+};
+
+/** Sort by the fee rate of the transaction with all its in-mempool ancestors, highest first */
+class CompareTxMemPoolEntryByAncestorFeeRate
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetModFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2) {
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return f1 > f2;
+    }
+};
+
+/**
+ * Sort by the higher of the fee rate of the transaction alone and the fee rate of the
+ * transaction with all its in-mempool descendants, lowest first: the first entry and its
+ * descendants are what the mempool loses least by evicting.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+
+        if (f1 == f2) {
+            return a.GetTime() >= b.GetTime();
+        }
+        return f1 < f2;
+    }
+
+    // Whether the descendant fee rate of the entry is higher than its own
+    bool UseDescendantScore(const CTxMemPoolEntry &a) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
 };
 
+/** Sort by the time of entry in the mempool, oldest first */
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+// Multi_index tag names
+struct modified_feerate {};
+struct ancestor_score {};
+struct entry_time {};
+struct descendant_score {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -78,6 +261,34 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+/** Salted hasher of outpoints, the CCoinsKeyHasher of mapNextTx */
+class COutPointHasher
+{
+private:
+    uint256 salt;
+
+public:
+    COutPointHasher();
+
+    size_t operator()(const COutPoint& outpoint) const {
+        return outpoint.hash.GetHash(salt) ^ (outpoint.n * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
+/** Why a transaction left the mempool, told with TransactionRemovedFromMempool */
+enum class MemPoolRemovalReason {
+    UNKNOWN,     //! Removed for a reason the caller did not give
+    EXPIRY,      //! Older than -mempoolexpiry
+    SIZELIMIT,   //! Evicted to keep the pool within -maxmempool
+    REORG,       //! No longer valid after a block was disconnected
+    BLOCK,       //! Included in a block
+    CONFLICT,    //! Spending an output or nullifier a transaction of a block spends
+    ANCHOR,      //! Its JoinSplits use a Sprout anchor a disconnected block created
+};
+
+//! Name of a reason, in the notifications
+const char* MemPoolRemovalReasonName(MemPoolRemovalReason reason);
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -92,7 +303,7 @@ class CTxMemPool
 {
 private:
     bool fSanityCheck; //! Normally false, true if -checkmempool or -regtest
-    unsigned int nTransactionsUpdated;
+    std::atomic<unsigned int> nTransactionsUpdated; //! readable without cs, by long polls waiting under csBestBlock
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
@@ -102,11 +313,103 @@ private:
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
 
+    //! The transactions of the last changes to the pool, up to change nChangeSequence
+    std::deque<uint256> dequeChanges;
+    uint64_t nChangeSequence = 0;
+    void LogChange(const uint256& hash);
+
+    std::atomic<int64_t> nTotalFeesAdded; //! fees of all the transactions ever added
+
+    CFeeRate minReasonableRelayFee;
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    /** Raise the rolling minimum fee to the fee rate of a package evicted for lack of room */
+    void trackPackageRemoved(const CFeeRate& rate);
+
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // by txid
+            boost::multi_index::hashed_unique<mempoolentry_txid, CCoinsKeyHasher>,
+            // by fee rate of the transaction alone
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<modified_feerate>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByModifiedFeeRate
+            >,
+            // by entry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime
+            >,
+            // by fee rate with the in-mempool ancestors
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFeeRate
+            >,
+            // by the fee rate the mempool loses by evicting the entry and its descendants
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore
+            >
+        >
+    > indexed_transaction_set;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
-    std::map<COutPoint, CInPoint> mapNextTx;
-    std::map<uint256, const CTransaction*> mapNullifiers;
+    indexed_transaction_set mapTx;
+
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+    const setEntries & GetMemPoolParents(txiter entry) const;
+    const setEntries & GetMemPoolChildren(txiter entry) const;
+
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+
+    /** Set the ancestor state of an entry from its in-mempool ancestors */
+    void UpdateEntryForAncestors(txiter it, const setEntries &setAncestors);
+    /** Set the descendant state of an entry from its in-mempool descendants */
+    void UpdateEntryForDescendants(txiter it);
+    /** Remove the links of the entries to be removed, subtract them from the descendant state of
+     *  their ancestors, and from the ancestor state of their descendants which stay (unless
+     *  updateDescendants is false: they all go) */
+    void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants);
+    /** Remove a set of transactions from the mempool */
+    void RemoveStaged(const setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason);
+    /** Remove one transaction, whose links were updated by UpdateForRemoveFromMempool */
+    void removeUnchecked(txiter entry, MemPoolRemovalReason reason);
+
+public:
+    // Looked up for every input and nullifier of every transaction offered to the pool,
+    // hashed with a random salt so that lookups can't be made slow on purpose
+    typedef boost::unordered_map<COutPoint, CInPoint, COutPointHasher> NextTxMap;
+    typedef boost::unordered_map<uint256, const CTransaction*, CCoinsKeyHasher> NullifiersMap;
+    NextTxMap mapNextTx;
+    NullifiersMap mapNullifiers;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
@@ -122,16 +425,29 @@ public:
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate = true);
-    void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
+
+    /**
+     * Collect the in-mempool ancestors of entry (not including entry itself) into setAncestors.
+     * With fSearchForParents the parents are found from the inputs of the transaction, for an
+     * entry not in the mempool yet; otherwise the links of the entry in the mempool are used.
+     */
+    void CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, bool fSearchForParents = true) const;
+
+    /** Add the in-mempool descendants of it, and it, to setDescendants */
+    void CalculateDescendants(txiter it, setEntries &setDescendants) const;
+    void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false,
+                MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
     void removeWithAnchor(const uint256 &invalidRoot);
     void removeCoinbaseSpends(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
-    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
+    void removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight,
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
+    /** Sum of the fees of all the transactions ever added, readable without cs */
+    CAmount GetTotalFeesAdded() const { return nTotalFeesAdded; }
     void AddTransactionsUpdated(unsigned int n);
     /**
      * Check that none of this transactions inputs are in the mempool, and thus
@@ -144,7 +460,34 @@ public:
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /**
+     * The minimum fee rate to get into the mempool, which may itself not be enough to
+     * get in when the mempool is full. It rises to the fee rate of the packages evicted
+     * by TrimToSize and halves every ROLLING_FEE_HALFLIFE once a block has been connected
+     * (faster while the mempool is well below sizelimit).
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Evict the transactions with the lowest descendant score, with their descendants,
+     * until the dynamic memory usage of the mempool is at most sizelimit.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    /** Remove the transactions which entered the mempool before time, with their descendants.
+     *  Returns the number of transactions removed. */
+    int Expire(int64_t time);
+
     void NotifyRecentlyAdded();
+
+    /** The number of changes to the transactions of the pool so far */
+    uint64_t GetChangeSequence() const;
+    /**
+     * The transactions in the pool added since change nSequence, and the ones removed,
+     * each once whatever its changes. False if the pool no longer has the changes since
+     * then, as the log of the last MEMPOOL_CHANGE_LOG_SIZE ones was passed or cleared.
+     */
+    bool GetChangesSince(uint64_t nSequence, std::vector<uint256>& vAdded, std::vector<uint256>& vRemoved) const;
     bool IsFullyNotified();
 
     unsigned long size()
@@ -166,6 +509,8 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+    //! The transaction hash in the mempool without copying it, or NULL
+    CTransactionRef get(const uint256& hash) const;
 
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
@@ -10,6 +10,10 @@
 #include "primitives/transaction.h"
 #include "serialize.h"
 
+#include <map>
+
+#include <boost/foreach.hpp>
+
 /** Undo information for a CTxIn
  *
  *  Contains the prevout's CTxOut being spent, and if this was the
@@ -68,19 +72,165 @@ public:
     }
 };
 
-/** Undo information for a CBlock */
+/**
+ * First byte of the compact serialization of a CBlockUndo. The legacy one starts with
+ * the number of transactions as a CompactSize, which never starts with it below 2^32.
+ */
+static const unsigned char UNDO_COMPACT_MARKER = 0xff;
+
+/** Undo information for a CBlock
+ *
+ *  Serialized in the legacy format, which the checksums of the undo files cover
+ *  whatever the format stored. Unserializes from either format.
+ */
 class CBlockUndo
 {
 public:
     std::vector<CTxUndo> vtxundo; // for all but the coinbase
     uint256 old_tree_root;
 
-    ADD_SERIALIZE_METHODS;
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return ::GetSerializeSize(vtxundo, nType, nVersion) + ::GetSerializeSize(old_tree_root, nType, nVersion);
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        READWRITE(vtxundo);
-        READWRITE(old_tree_root);
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        ::Serialize(s, vtxundo, nType, nVersion);
+        ::Serialize(s, old_tree_root, nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned char chFirst = 0;
+        ::Unserialize(s, chFirst, nType, nVersion);
+        if (chFirst == UNDO_COMPACT_MARKER) {
+            UnserializeCompact(s, nType, nVersion);
+            return;
+        }
+
+        // The rest of the CompactSize of the legacy format
+        uint64_t nTx = chFirst;
+        if (chFirst == 253) {
+            uint16_t n = 0;
+            ::Unserialize(s, n, nType, nVersion);
+            nTx = n;
+        } else if (chFirst == 254) {
+            uint32_t n = 0;
+            ::Unserialize(s, n, nType, nVersion);
+            nTx = n;
+        }
+        if (nTx > MAX_SIZE)
+            throw std::ios_base::failure("CBlockUndo::Unserialize(): size too large");
+        vtxundo.clear();
+        for (uint64_t i = 0; i < nTx; i++) {
+            vtxundo.push_back(CTxUndo());
+            ::Unserialize(s, vtxundo.back(), nType, nVersion);
+        }
+        ::Unserialize(s, old_tree_root, nType, nVersion);
+    }
+
+    /**
+     * The compact format, after its marker: the counts as VARINTs and each output spent as
+     * in CTxInUndo, except that a script spent before in the block is stored as its index
+     * among the scripts stored, plus one, and a new one as 0 followed by the script.
+     */
+    template<typename Stream>
+    void SerializeCompact(Stream &s, int nType, int nVersion) const {
+        std::map<CScript, uint64_t> mapScripts;
+        uint64_t nTx = vtxundo.size();
+        ::Serialize(s, VARINT(nTx), nType, nVersion);
+        BOOST_FOREACH(const CTxUndo& txundo, vtxundo) {
+            uint64_t nIn = txundo.vprevout.size();
+            ::Serialize(s, VARINT(nIn), nType, nVersion);
+            BOOST_FOREACH(const CTxInUndo& undo, txundo.vprevout) {
+                unsigned int nCode = undo.nHeight * 2 + (undo.fCoinBase ? 1 : 0);
+                ::Serialize(s, VARINT(nCode), nType, nVersion);
+                if (undo.nHeight > 0)
+                    ::Serialize(s, VARINT(undo.nVersion), nType, nVersion);
+                uint64_t nValue = CTxOutCompressor::CompressAmount(undo.txout.nValue);
+                ::Serialize(s, VARINT(nValue), nType, nVersion);
+                std::map<CScript, uint64_t>::const_iterator it = mapScripts.find(undo.txout.scriptPubKey);
+                uint64_t nScript = it == mapScripts.end() ? 0 : it->second + 1;
+                ::Serialize(s, VARINT(nScript), nType, nVersion);
+                if (it == mapScripts.end()) {
+                    const uint64_t nIndex = mapScripts.size();
+                    mapScripts[undo.txout.scriptPubKey] = nIndex;
+                    ::Serialize(s, CScriptCompressor(REF(undo.txout.scriptPubKey)), nType, nVersion);
+                }
+            }
+        }
+        ::Serialize(s, old_tree_root, nType, nVersion);
+    }
+
+    template<typename Stream>
+    void UnserializeCompact(Stream &s, int nType, int nVersion) {
+        // Where the scripts stored are, as the transaction and input indexes
+        std::vector<std::pair<uint64_t, uint64_t> > vScripts;
+        uint64_t nTx = 0;
+        ::Unserialize(s, VARINT(nTx), nType, nVersion);
+        if (nTx > MAX_SIZE)
+            throw std::ios_base::failure("CBlockUndo::UnserializeCompact(): size too large");
+        vtxundo.clear();
+        for (uint64_t i = 0; i < nTx; i++) {
+            vtxundo.push_back(CTxUndo());
+            std::vector<CTxInUndo>& vprevout = vtxundo.back().vprevout;
+            uint64_t nIn = 0;
+            ::Unserialize(s, VARINT(nIn), nType, nVersion);
+            if (nIn > MAX_SIZE)
+                throw std::ios_base::failure("CBlockUndo::UnserializeCompact(): size too large");
+            for (uint64_t j = 0; j < nIn; j++) {
+                vprevout.push_back(CTxInUndo());
+                CTxInUndo& undo = vprevout.back();
+                unsigned int nCode = 0;
+                ::Unserialize(s, VARINT(nCode), nType, nVersion);
+                undo.nHeight = nCode / 2;
+                undo.fCoinBase = nCode & 1;
+                if (undo.nHeight > 0)
+                    ::Unserialize(s, VARINT(undo.nVersion), nType, nVersion);
+                uint64_t nValue = 0;
+                ::Unserialize(s, VARINT(nValue), nType, nVersion);
+                undo.txout.nValue = CTxOutCompressor::DecompressAmount(nValue);
+                uint64_t nScript = 0;
+                ::Unserialize(s, VARINT(nScript), nType, nVersion);
+                if (nScript == 0) {
+                    ::Unserialize(s, REF(CScriptCompressor(undo.txout.scriptPubKey)), nType, nVersion);
+                    vScripts.push_back(std::make_pair(i, j));
+                } else if (nScript <= vScripts.size()) {
+                    const std::pair<uint64_t, uint64_t>& where = vScripts[nScript - 1];
+                    undo.txout.scriptPubKey = vtxundo[where.first].vprevout[where.second].txout.scriptPubKey;
+                } else {
+                    throw std::ios_base::failure("CBlockUndo::UnserializeCompact(): unknown script");
+                }
+            }
+        }
+        ::Unserialize(s, old_tree_root, nType, nVersion);
+    }
+};
+
+/** The compact serialization of a CBlockUndo, see CBlockUndo::SerializeCompact() */
+class CBlockUndoCompactor
+{
+private:
+    CBlockUndo &undo;
+
+public:
+    CBlockUndoCompactor(CBlockUndo &undoIn) : undo(undoIn) { }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        ::Serialize(s, UNDO_COMPACT_MARKER, nType, nVersion);
+        undo.SerializeCompact(s, nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        ::Unserialize(s, undo, nType, nVersion);
     }
 };
 
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://opensource.org/licenses/mit-license.php.
 
+#include <stdint.h>
 #include <string.h>
 #include <vector>
 #include <stdio.h>
@@ -48,6 +49,42 @@ static const char *hatoui(const char *first, const char *last,
     return first;
 }
 
+// Bytes of a 64-bit word, each one set to ch
+#define WORD_BYTES(ch) (0x0101010101010101ULL * (ch))
+
+// Whether a word of string chars has one which ends a plain run: a quote, a
+// backslash, a control char or a non-ASCII byte
+static inline bool word_ends_run(uint64_t w)
+{
+    const uint64_t quote = w ^ WORD_BYTES('"');
+    const uint64_t backslash = w ^ WORD_BYTES('\\');
+    const uint64_t zeroes = ((quote - WORD_BYTES(0x01)) & ~quote) |
+                            ((backslash - WORD_BYTES(0x01)) & ~backslash) |
+                            (w - WORD_BYTES(0x20));
+    return ((zeroes | w) & WORD_BYTES(0x80)) != 0;
+}
+
+static inline bool char_ends_run(unsigned char ch)
+{
+    return ch == '"' || ch == '\\' || ch < 0x20 || ch >= 0x80;
+}
+
+// The end of the run of plain ASCII chars of a string from raw, scanned a word
+// at a time: hex payloads are long runs
+static const char *scan_string_run(const char *raw, const char *end)
+{
+    while (end - raw >= 8) {
+        uint64_t w;
+        memcpy(&w, raw, 8);
+        if (word_ends_run(w))
+            break;
+        raw += 8;
+    }
+    while (raw < end && !char_ends_run(*raw))
+        raw++;
+    return raw;
+}
+
 enum jtokentype getJsonToken(std::string& tokenVal, unsigned int& consumed,
                             const char *raw, const char *end)
 {
@@ -120,8 +157,6 @@ enum jtokentype getJsonToken(std::string& tokenVal, unsigned int& consumed,
     case '8':
     case '9': {
         // part 1: int
-        std::string numStr;
-
         const char *first = raw;
 
         const char *firstDigit = first;
@@ -130,49 +165,38 @@ enum jtokentype getJsonToken(std::string& tokenVal, unsigned int& consumed,
         if ((*firstDigit == '0') && json_isdigit(firstDigit[1]))
             return JTOK_ERR;
 
-        numStr += *raw;                       // copy first char
-        raw++;
+        raw++;                                // first char
 
         if ((*first == '-') && (raw < end) && (!json_isdigit(*raw)))
             return JTOK_ERR;
 
-        while (raw < end && json_isdigit(*raw)) {  // copy digits
-            numStr += *raw;
+        while (raw < end && json_isdigit(*raw))    // digits
             raw++;
-        }
 
         // part 2: frac
         if (raw < end && *raw == '.') {
-            numStr += *raw;                   // copy .
-            raw++;
+            raw++;                            // .
 
             if (raw >= end || !json_isdigit(*raw))
                 return JTOK_ERR;
-            while (raw < end && json_isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while (raw < end && json_isdigit(*raw)) // digits
                 raw++;
-            }
         }
 
         // part 3: exp
         if (raw < end && (*raw == 'e' || *raw == 'E')) {
-            numStr += *raw;                   // copy E
-            raw++;
+            raw++;                            // E
 
-            if (raw < end && (*raw == '-' || *raw == '+')) { // copy +/-
-                numStr += *raw;
+            if (raw < end && (*raw == '-' || *raw == '+')) // +/-
                 raw++;
-            }
 
             if (raw >= end || !json_isdigit(*raw))
                 return JTOK_ERR;
-            while (raw < end && json_isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while (raw < end && json_isdigit(*raw)) // digits
                 raw++;
-            }
         }
 
-        tokenVal = numStr;
+        tokenVal.assign(first, raw);
         consumed = (raw - rawStart);
         return JTOK_NUMBER;
         }
@@ -180,10 +204,15 @@ enum jtokentype getJsonToken(std::string& tokenVal, unsigned int& consumed,
     case '"': {
         raw++;                                // skip "
 
-        std::string valStr;
-        JSONUTF8StringFilter writer(valStr);
+        JSONUTF8StringFilter writer(tokenVal);
 
         while (true) {
+            const char *run = scan_string_run(raw, end);
+            if (run != raw) {
+                writer.append_ascii(raw, run);
+                raw = run;
+            }
+
             if (raw >= end || (unsigned char)*raw < 0x20)
                 return JTOK_ERR;
 
@@ -234,7 +263,6 @@ enum jtokentype getJsonToken(std::string& tokenVal, unsigned int& consumed,
 
         if (!writer.finalize())
             return JTOK_ERR;
-        tokenVal = valStr;
         consumed = (raw - rawStart);
         return JTOK_STRING;
         }
@@ -323,9 +351,8 @@ bool UniValue::read(const char *raw, size_t size)
                     setArray();
                 stack.push_back(this);
             } else {
-                UniValue tmpVal(utyp);
                 UniValue *top = stack.back();
-                top->values.push_back(tmpVal);
+                top->values.push_back(UniValue(utyp));
 
                 UniValue *newTop = &(top->values.back());
                 stack.push_back(newTop);
@@ -412,33 +439,41 @@ bool UniValue::read(const char *raw, size_t size)
             }
 
         case JTOK_NUMBER: {
-            UniValue tmpVal(VNUM, tokenVal);
-            if (!stack.size()) {
-                *this = tmpVal;
-                break;
+            UniValue *top = this;
+            if (stack.size()) {
+                top = stack.back();
+                top->values.push_back(UniValue());
+                top = &top->values.back();
             }
-
-            UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
+            top->typ = VNUM;
+            top->val.swap(tokenVal);
+            if (!stack.size())
+                break;
 
             setExpect(NOT_VALUE);
             break;
             }
 
         case JTOK_STRING: {
+            // The token is moved into place rather than copied, as it may
+            // be a large hex payload
             if (expect(OBJ_NAME)) {
                 UniValue *top = stack.back();
-                top->keys.push_back(tokenVal);
+                top->keys.push_back(std::string());
+                top->keys.back().swap(tokenVal);
                 clearExpect(OBJ_NAME);
                 setExpect(COLON);
             } else {
-                UniValue tmpVal(VSTR, tokenVal);
-                if (!stack.size()) {
-                    *this = tmpVal;
-                    break;
+                UniValue *top = this;
+                if (stack.size()) {
+                    top = stack.back();
+                    top->values.push_back(UniValue());
+                    top = &top->values.back();
                 }
-                UniValue *top = stack.back();
-                top->values.push_back(tmpVal);
+                top->typ = VSTR;
+                top->val.swap(tokenVal);
+                if (!stack.size())
+                    break;
             }
 
             setExpect(NOT_VALUE);
@@ -398,6 +398,39 @@ BOOST_AUTO_TEST_CASE(univalue_readwrite)
     BOOST_CHECK(!v.read("{} 42"));
 }
 
+BOOST_AUTO_TEST_CASE(univalue_readstrings)
+{
+    // Long strings are scanned a word at a time, the chars which end a run may
+    // be anywhere in a word
+    UniValue v;
+    for (size_t pos = 0; pos < 20; pos++) {
+        std::string prefix(pos, 'a');
+        std::string suffix(19 - pos, 'b');
+
+        BOOST_CHECK(v.read("[\"" + prefix + "\\n" + suffix + "\"]"));
+        BOOST_CHECK_EQUAL(v[0].getValStr(), prefix + "\n" + suffix);
+        BOOST_CHECK(v.read("[\"" + prefix + "\\u00e9" + suffix + "\"]"));
+        BOOST_CHECK_EQUAL(v[0].getValStr(), prefix + "\xc3\xa9" + suffix);
+        BOOST_CHECK(v.read("[\"" + prefix + "\xc3\xa9" + suffix + "\"]"));
+        BOOST_CHECK_EQUAL(v[0].getValStr(), prefix + "\xc3\xa9" + suffix);
+        BOOST_CHECK(v.read("{\"" + prefix + suffix + "\":\"" + prefix + "\"}"));
+        BOOST_CHECK_EQUAL(v[prefix + suffix].getValStr(), prefix);
+
+        BOOST_CHECK(!v.read("[\"" + prefix + "\t" + suffix + "\"]"));
+        BOOST_CHECK(!v.read("[\"" + prefix + "\xc3" + suffix + "\"]"));
+        BOOST_CHECK(!v.read("[\"" + prefix + "\xff" + suffix + "\"]"));
+        BOOST_CHECK(!v.read("[\"" + prefix + suffix));
+    }
+
+    std::string hex(100001, 'f');
+    BOOST_CHECK(v.read("\"" + hex + "\""));
+    BOOST_CHECK(v.isStr());
+    BOOST_CHECK_EQUAL(v.getValStr(), hex);
+    BOOST_CHECK(v.read("-12.5e+3"));
+    BOOST_CHECK(v.isNum());
+    BOOST_CHECK_EQUAL(v.getValStr(), "-12.5e+3");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 int main (int argc, char *argv[])
@@ -408,6 +441,7 @@ int main (int argc, char *argv[])
     univalue_array();
     univalue_object();
     univalue_readwrite();
+    univalue_readstrings();
     return 0;
 }
 
@@ -37,6 +37,7 @@
 
 #include <algorithm>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 
@@ -730,6 +731,32 @@ int RaiseFileDescriptorLimit(int nMinFD) {
 #endif
 }
 
+CMappedFile::CMappedFile(const boost::filesystem::path& path) : pData(NULL), nSize(0)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            pData = static_cast<const char*>(p);
+            nSize = st.st_size;
+        }
+    }
+    close(fd);
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    if (pData)
+        munmap(const_cast<char*>(pData), nSize);
+#endif
+}
+
 /**
  * this function tries to make a particular range of a file allocated (corresponding to disk space)
  * it is advisory, and the range specified in the arguments will never contain live data
@@ -120,6 +120,29 @@ void FileCommit(FILE *fileout);
 bool TruncateFile(FILE *file, unsigned int length);
 int RaiseFileDescriptorLimit(int nMinFD);
 void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length);
+
+/**
+ * Read-only memory mapping of a whole file, to read parts of it in place rather
+ * than through stdio buffers. Not supported on Windows, where IsValid() is false.
+ */
+class CMappedFile
+{
+public:
+    explicit CMappedFile(const boost::filesystem::path& path);
+    ~CMappedFile();
+
+    bool IsValid() const { return pData != NULL; }
+    const char* Data() const { return pData; }
+    size_t Size() const { return nSize; }
+
+private:
+    const char* pData;
+    size_t nSize;
+
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+};
+
 bool RenameOver(boost::filesystem::path src, boost::filesystem::path dest);
 bool TryCreateDirectory(const boost::filesystem::path& p);
 boost::filesystem::path GetDefaultDataDir();
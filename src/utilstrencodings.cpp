@@ -12,6 +12,11 @@
 #include <errno.h>
 #include <limits>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HEX_X86 1
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 string SanitizeString(const string& str)
@@ -79,24 +84,185 @@ bool IsHex(const string& str)
     return (str.size() > 0) && (str.size()%2 == 0);
 }
 
+namespace {
+
+const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                          '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+void HexEncodeScalar(const unsigned char* pch, size_t len, char* psz)
+{
+    for (size_t i = 0; i < len; i++) {
+        psz[2 * i] = hexmap[pch[i] >> 4];
+        psz[2 * i + 1] = hexmap[pch[i] & 15];
+    }
+}
+
+/** Decode the pairs of hex digits at psz, up to nMaxBytes of them, until one is not a pair of hex digits */
+size_t HexDecodeRunScalar(const char* psz, size_t nMaxBytes, unsigned char* pch)
+{
+    size_t i = 0;
+    for (; i < nMaxBytes; i++) {
+        const signed char hi = HexDigit(psz[2 * i]);
+        const signed char lo = HexDigit(psz[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            break;
+        pch[i] = (hi << 4) | lo;
+    }
+    return i;
+}
+
+#ifdef HEX_X86
+// The vector versions convert 16 (SSSE3) or 32 (AVX2) bytes at once. They are
+// compiled for their instruction set whatever the build flags and only called
+// when the CPU supports it.
+
+__attribute__((target("ssse3")))
+void HexEncodeSSSE3(const unsigned char* pch, size_t len, char* psz)
+{
+    const __m128i digits = _mm_loadu_si128((const __m128i*)hexmap);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(pch + i));
+        const __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        const __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, mask));
+        _mm_storeu_si128((__m128i*)(psz + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(psz + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    HexEncodeScalar(pch + i, len - i, psz + 2 * i);
+}
+
+__attribute__((target("avx2")))
+void HexEncodeAVX2(const unsigned char* pch, size_t len, char* psz)
+{
+    const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hexmap));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(pch + i));
+        const __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        const __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(v, mask));
+        // Interleaved within each lane: bytes 0-7 and 16-23, then 8-15 and 24-31
+        const __m256i first = _mm256_unpacklo_epi8(hi, lo);
+        const __m256i second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*)(psz + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i*)(psz + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    HexEncodeSSSE3(pch + i, len - i, psz + 2 * i);
+}
+
+/** The nibbles of 16 hex digits, and in valid whether they all are */
+__attribute__((target("ssse3")))
+inline __m128i HexNibblesSSSE3(__m128i v, bool& valid)
+{
+    // Signed compares, the bytes from 0x80 up failing both ranges
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    const __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    valid = _mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) == 0xffff;
+    return _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+                        _mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+__attribute__((target("ssse3")))
+size_t HexDecodeRunSSSE3(const char* psz, size_t nMaxBytes, unsigned char* pch)
+{
+    // Each pair of nibbles to hi * 16 + lo in 16 bits
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; i + 8 <= nMaxBytes; i += 8) {
+        bool valid;
+        const __m128i nibbles = HexNibblesSSSE3(_mm_loadu_si128((const __m128i*)(psz + 2 * i)), valid);
+        if (!valid)
+            break;
+        const __m128i bytes = _mm_maddubs_epi16(nibbles, weights);
+        _mm_storel_epi64((__m128i*)(pch + i), _mm_packus_epi16(bytes, bytes));
+    }
+    return i + HexDecodeRunScalar(psz + 2 * i, nMaxBytes - i, pch + i);
+}
+
+__attribute__((target("avx2")))
+size_t HexDecodeRunAVX2(const char* psz, size_t nMaxBytes, unsigned char* pch)
+{
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; i + 16 <= nMaxBytes; i += 16) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(psz + 2 * i));
+        const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        const __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        const __m256i isLetter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+        if (_mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter)) != -1)
+            break;
+        const __m256i nibbles = _mm256_or_si256(_mm256_and_si256(isDigit, _mm256_sub_epi8(v, _mm256_set1_epi8('0'))),
+                                                _mm256_and_si256(isLetter, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+        const __m256i bytes = _mm256_maddubs_epi16(nibbles, weights);
+        // Packed within each lane, the 8 bytes of each lane in its first half
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(bytes, bytes), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(pch + i), _mm256_castsi256_si128(packed));
+    }
+    return i + HexDecodeRunSSSE3(psz + 2 * i, nMaxBytes - i, pch + i);
+}
+
+bool HasSSSE3()
+{
+    static const bool fSupported = __builtin_cpu_supports("ssse3");
+    return fSupported;
+}
+
+bool HasAVX2()
+{
+    static const bool fSupported = __builtin_cpu_supports("avx2");
+    return fSupported;
+}
+#endif // HEX_X86
+
+size_t HexDecodeRun(const char* psz, size_t nMaxBytes, unsigned char* pch)
+{
+#ifdef HEX_X86
+    if (HasAVX2())
+        return HexDecodeRunAVX2(psz, nMaxBytes, pch);
+    if (HasSSSE3())
+        return HexDecodeRunSSSE3(psz, nMaxBytes, pch);
+#endif
+    return HexDecodeRunScalar(psz, nMaxBytes, pch);
+}
+
+} // anon namespace
+
+void HexEncode(const unsigned char* pch, size_t len, char* psz)
+{
+#ifdef HEX_X86
+    if (HasAVX2())
+        return HexEncodeAVX2(pch, len, psz);
+    if (HasSSSE3())
+        return HexEncodeSSSE3(pch, len, psz);
+#endif
+    HexEncodeScalar(pch, len, psz);
+}
+
+bool HexDecode(const char* psz, size_t len, unsigned char* pch)
+{
+    return HexDecodeRun(psz, len, pch) == len;
+}
+
 vector<unsigned char> ParseHex(const char* psz)
 {
-    // convert hex dump to vector
-    vector<unsigned char> vch;
+    // convert hex dump to vector, the runs of digits between the spaces at once
+    const char* pszEnd = psz + strlen(psz);
+    vector<unsigned char> vch((pszEnd - psz) / 2);
+    size_t nSize = 0;
     while (true)
     {
         while (isspace(*psz))
             psz++;
-        signed char c = HexDigit(*psz++);
-        if (c == (signed char)-1)
-            break;
-        unsigned char n = (c << 4);
-        c = HexDigit(*psz++);
-        if (c == (signed char)-1)
+        const size_t nRun = HexDecodeRun(psz, (pszEnd - psz) / 2, vch.data() + nSize);
+        nSize += nRun;
+        psz += 2 * nRun;
+        // Stopped by the end, a space or anything else but a pair of hex digits
+        if (!isspace(*psz))
             break;
-        n |= c;
-        vch.push_back(n);
     }
+    vch.resize(nSize);
     return vch;
 }
 
@@ -28,6 +28,10 @@ std::vector<unsigned char> ParseHex(const char* psz);
 std::vector<unsigned char> ParseHex(const std::string& str);
 signed char HexDigit(char c);
 bool IsHex(const std::string& str);
+/** Write the 2 * len hex digits of the len bytes at pch to psz, without a terminating null */
+void HexEncode(const unsigned char* pch, size_t len, char* psz);
+/** Read the len bytes of the 2 * len hex digits at psz to pch, failing on anything but a hex digit */
+bool HexDecode(const char* psz, size_t len, unsigned char* pch);
 std::vector<unsigned char> DecodeBase64(const char* p, bool* pfInvalid = NULL);
 std::string DecodeBase64(const std::string& str);
 std::string EncodeBase64(const unsigned char* pch, size_t len);
@@ -68,6 +72,23 @@ template<typename T>
 std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
 {
     std::string rv;
+    if (!fSpaces)
+    {
+        // Encoded in chunks, at once whatever the iterators
+        rv.resize((itend-itbegin)*2);
+        unsigned char buf[256];
+        size_t nPos = 0;
+        for (T it = itbegin; it < itend; )
+        {
+            size_t n = 0;
+            for (; n < sizeof(buf) && it < itend; ++it)
+                buf[n++] = (unsigned char)(*it);
+            HexEncode(buf, n, &rv[nPos]);
+            nPos += 2 * n;
+        }
+        return rv;
+    }
+
     static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
     rv.reserve((itend-itbegin)*3);
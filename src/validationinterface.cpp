@@ -5,6 +5,20 @@
 
 #include "validationinterface.h"
 
+#include "metrics.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <deque>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
 static CMainSignals g_signals;
 
 CMainSignals& GetMainSignals()
@@ -12,7 +26,235 @@ CMainSignals& GetMainSignals()
     return g_signals;
 }
 
-void RegisterValidationInterface(CValidationInterface* pwalletIn) {
+/**
+ * The notifications to the asynchronous subscribers, delivered in order by a thread of
+ * its own. Validation waits for room once nMaxSize are queued, so that the queue stays
+ * bounded when the subscribers fall behind.
+ */
+class CValidationQueue
+{
+public:
+    CValidationQueue() : nMaxSize(DEFAULT_VALIDATION_QUEUE_SIZE), nQueued(0), nDelivered(0), nStalls(0), fRunning(false), fStop(false),
+        stallLatency(std::make_shared<AtomicHistogram>()), delayLatency(std::make_shared<AtomicHistogram>()) {}
+
+    ~CValidationQueue()
+    {
+        Stop();
+    }
+
+    void Start()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fRunning)
+            return;
+        nMaxSize = std::max<int64_t>(1, GetArg("-validationqueue", DEFAULT_VALIDATION_QUEUE_SIZE));
+        fRunning = true;
+        fStop = false;
+        thread = boost::thread(&CValidationQueue::Thread, this);
+    }
+
+    //! Deliver what is queued and stop the thread
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    void Push(const boost::function<void()>& fn)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!fRunning)
+                return; // stopped, the subscribers are being unregistered
+            if (queue.size() >= nMaxSize) {
+                const int64_t nTimeStart = GetTimeMicros();
+                nStalls++;
+                while (queue.size() >= nMaxSize)
+                    condDone.wait(lock);
+                stallLatency->add(GetTimeMicros() - nTimeStart);
+            }
+            queue.push_back(std::make_pair(GetTimeMicros(), fn));
+            nQueued++;
+        }
+        condWork.notify_one();
+    }
+
+    //! Wait for the notifications queued so far to be delivered
+    void SyncWith()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        const uint64_t nTarget = nQueued;
+        while (nDelivered < nTarget && fRunning)
+            condDone.wait(lock);
+    }
+
+    ValidationQueueInfo Info()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        ValidationQueueInfo info;
+        info.nDepth = queue.size();
+        info.nMaxDepth = nMaxSize;
+        info.nQueued = nQueued;
+        info.nStalls = nStalls;
+        info.stallLatency = stallLatency;
+        info.delayLatency = delayLatency;
+        return info;
+    }
+
+    static void UpdatedBlockTip(CValidationInterface* p, const CBlockIndex *pindex);
+    static void SyncTransaction(CValidationInterface* p, const CTransaction &tx, const CBlock *pblock);
+    static void EraseFromWallet(CValidationInterface* p, const uint256 &hash);
+    static void SetBestChain(CValidationInterface* p, const CBlockLocator &locator);
+    static void UpdatedTransaction(CValidationInterface* p, const uint256 &hash);
+    static void Inventory(CValidationInterface* p, const uint256 &hash);
+    static void ResendWalletTransactions(CValidationInterface* p, int64_t nBestBlockTime);
+    static void ChainTip(CValidationInterface* p, const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added);
+    static void TransactionAddedToMempool(CValidationInterface* p, const CTransaction &tx, uint64_t nMempoolSequence);
+    static void TransactionRemovedFromMempool(CValidationInterface* p, const CTransaction &tx, MemPoolRemovalReason reason, uint64_t nMempoolSequence);
+
+private:
+    boost::mutex mutex;
+    //! Signalled when notifications are queued or the thread has to stop
+    boost::condition_variable condWork;
+    //! Signalled when a notification has been delivered
+    boost::condition_variable condDone;
+    //! The notifications, with the time they were queued at
+    std::deque<std::pair<int64_t, boost::function<void()> > > queue;
+    size_t nMaxSize;
+    uint64_t nQueued;
+    uint64_t nDelivered;
+    uint64_t nStalls;
+    bool fRunning;
+    bool fStop;
+    std::shared_ptr<AtomicHistogram> stallLatency;
+    std::shared_ptr<AtomicHistogram> delayLatency;
+    boost::thread thread;
+
+    void Thread()
+    {
+        RenameThread("horizen-notify");
+
+        while (true) {
+            std::pair<int64_t, boost::function<void()> > item;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queue.empty() && !fStop)
+                    condWork.wait(lock);
+                if (queue.empty())
+                    break;
+                std::swap(item, queue.front());
+                queue.pop_front();
+            }
+
+            delayLatency->add(GetTimeMicros() - item.first);
+            try {
+                item.second();
+            } catch (const std::exception& e) {
+                PrintExceptionContinue(&e, "CValidationQueue::Thread()");
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                nDelivered++;
+            }
+            condDone.notify_all();
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fRunning = false;
+        }
+        condDone.notify_all();
+    }
+};
+
+static CValidationQueue validationQueue;
+//! The subscribers registered with fAsync
+static std::set<CValidationInterface*> setAsyncSubscribers;
+static boost::mutex csAsyncSubscribers;
+
+void CValidationQueue::UpdatedBlockTip(CValidationInterface* p, const CBlockIndex *pindex)
+{
+    validationQueue.Push([p, pindex]() { p->UpdatedBlockTip(pindex); });
+}
+
+void CValidationQueue::SyncTransaction(CValidationInterface* p, const CTransaction &tx, const CBlock *pblock)
+{
+    std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+    validationQueue.Push([p, ptx]() { p->SyncTransaction(*ptx, NULL); });
+}
+
+void CValidationQueue::EraseFromWallet(CValidationInterface* p, const uint256 &hash)
+{
+    validationQueue.Push([p, hash]() { p->EraseFromWallet(hash); });
+}
+
+void CValidationQueue::SetBestChain(CValidationInterface* p, const CBlockLocator &locator)
+{
+    validationQueue.Push([p, locator]() { p->SetBestChain(locator); });
+}
+
+void CValidationQueue::UpdatedTransaction(CValidationInterface* p, const uint256 &hash)
+{
+    validationQueue.Push([p, hash]() { p->UpdatedTransaction(hash); });
+}
+
+void CValidationQueue::Inventory(CValidationInterface* p, const uint256 &hash)
+{
+    validationQueue.Push([p, hash]() { p->Inventory(hash); });
+}
+
+void CValidationQueue::ResendWalletTransactions(CValidationInterface* p, int64_t nBestBlockTime)
+{
+    validationQueue.Push([p, nBestBlockTime]() { p->ResendWalletTransactions(nBestBlockTime); });
+}
+
+void CValidationQueue::ChainTip(CValidationInterface* p, const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added)
+{
+    validationQueue.Push([p, pindex, tree, added]() { p->ChainTip(pindex, NULL, tree, added); });
+}
+
+void CValidationQueue::TransactionAddedToMempool(CValidationInterface* p, const CTransaction &tx, uint64_t nMempoolSequence)
+{
+    std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+    validationQueue.Push([p, ptx, nMempoolSequence]() { p->TransactionAddedToMempool(*ptx, nMempoolSequence); });
+}
+
+void CValidationQueue::TransactionRemovedFromMempool(CValidationInterface* p, const CTransaction &tx, MemPoolRemovalReason reason, uint64_t nMempoolSequence)
+{
+    std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+    validationQueue.Push([p, ptx, reason, nMempoolSequence]() { p->TransactionRemovedFromMempool(*ptx, reason, nMempoolSequence); });
+}
+
+ValidationQueueInfo GetValidationQueueInfo()
+{
+    return validationQueue.Info();
+}
+
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fAsync) {
+    if (fAsync) {
+        {
+            boost::unique_lock<boost::mutex> lock(csAsyncSubscribers);
+            setAsyncSubscribers.insert(pwalletIn);
+        }
+        validationQueue.Start();
+        g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationQueue::UpdatedBlockTip, pwalletIn, _1));
+        g_signals.SyncTransaction.connect(boost::bind(&CValidationQueue::SyncTransaction, pwalletIn, _1, _2));
+        g_signals.EraseTransaction.connect(boost::bind(&CValidationQueue::EraseFromWallet, pwalletIn, _1));
+        g_signals.UpdatedTransaction.connect(boost::bind(&CValidationQueue::UpdatedTransaction, pwalletIn, _1));
+        g_signals.SetBestChain.connect(boost::bind(&CValidationQueue::SetBestChain, pwalletIn, _1));
+        g_signals.Inventory.connect(boost::bind(&CValidationQueue::Inventory, pwalletIn, _1));
+        g_signals.Broadcast.connect(boost::bind(&CValidationQueue::ResendWalletTransactions, pwalletIn, _1));
+        g_signals.ChainTip.connect(boost::bind(&CValidationQueue::ChainTip, pwalletIn, _1, _2, _3, _4));
+        g_signals.TransactionAddedToMempool.connect(boost::bind(&CValidationQueue::TransactionAddedToMempool, pwalletIn, _1, _2));
+        g_signals.TransactionRemovedFromMempool.connect(boost::bind(&CValidationQueue::TransactionRemovedFromMempool, pwalletIn, _1, _2, _3));
+        return;
+    }
     g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
     g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
@@ -22,9 +264,33 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
     g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    g_signals.TransactionAddedToMempool.connect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pwalletIn, _1, _2));
+    g_signals.TransactionRemovedFromMempool.connect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1, _2, _3));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
+    bool fAsync;
+    {
+        boost::unique_lock<boost::mutex> lock(csAsyncSubscribers);
+        fAsync = setAsyncSubscribers.erase(pwalletIn) != 0;
+    }
+    if (fAsync) {
+        g_signals.TransactionRemovedFromMempool.disconnect(boost::bind(&CValidationQueue::TransactionRemovedFromMempool, pwalletIn, _1, _2, _3));
+        g_signals.TransactionAddedToMempool.disconnect(boost::bind(&CValidationQueue::TransactionAddedToMempool, pwalletIn, _1, _2));
+        g_signals.ChainTip.disconnect(boost::bind(&CValidationQueue::ChainTip, pwalletIn, _1, _2, _3, _4));
+        g_signals.Broadcast.disconnect(boost::bind(&CValidationQueue::ResendWalletTransactions, pwalletIn, _1));
+        g_signals.Inventory.disconnect(boost::bind(&CValidationQueue::Inventory, pwalletIn, _1));
+        g_signals.SetBestChain.disconnect(boost::bind(&CValidationQueue::SetBestChain, pwalletIn, _1));
+        g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationQueue::UpdatedTransaction, pwalletIn, _1));
+        g_signals.EraseTransaction.disconnect(boost::bind(&CValidationQueue::EraseFromWallet, pwalletIn, _1));
+        g_signals.SyncTransaction.disconnect(boost::bind(&CValidationQueue::SyncTransaction, pwalletIn, _1, _2));
+        g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationQueue::UpdatedBlockTip, pwalletIn, _1));
+        // The subscriber may be deleted once its notifications queued are delivered
+        validationQueue.SyncWith();
+        return;
+    }
+    g_signals.TransactionRemovedFromMempool.disconnect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1, _2, _3));
+    g_signals.TransactionAddedToMempool.disconnect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pwalletIn, _1, _2));
     g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
     g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
@@ -37,6 +303,8 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
 }
 
 void UnregisterAllValidationInterfaces() {
+    g_signals.TransactionRemovedFromMempool.disconnect_all_slots();
+    g_signals.TransactionAddedToMempool.disconnect_all_slots();
     g_signals.BlockChecked.disconnect_all_slots();
     g_signals.Broadcast.disconnect_all_slots();
     g_signals.Inventory.disconnect_all_slots();
@@ -46,6 +314,9 @@ void UnregisterAllValidationInterfaces() {
     g_signals.EraseTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
+    validationQueue.Stop();
+    boost::unique_lock<boost::mutex> lock(csAsyncSubscribers);
+    setAsyncSubscribers.clear();
 }
 
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock) {
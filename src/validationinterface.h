@@ -6,10 +6,15 @@
 #ifndef BITCOIN_VALIDATIONINTERFACE_H
 #define BITCOIN_VALIDATIONINTERFACE_H
 
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
 #include <boost/signals2/signal.hpp>
 
 #include "zcash/IncrementalMerkleTree.hpp"
 
+class AtomicHistogram;
 class CBlock;
 class CBlockIndex;
 struct CBlockLocator;
@@ -17,11 +22,21 @@ class CTransaction;
 class CValidationInterface;
 class CValidationState;
 class uint256;
+enum class MemPoolRemovalReason;
+
+//! -validationqueue default, notifications for the asynchronous subscribers queued before validation waits for them
+static const unsigned int DEFAULT_VALIDATION_QUEUE_SIZE = 10000;
 
 // These functions dispatch to one or all registered wallets
 
-/** Register a wallet to receive updates from core */
-void RegisterValidationInterface(CValidationInterface* pwalletIn);
+/**
+ * Register a wallet to receive updates from core. With fAsync, they are queued for a
+ * background thread which delivers them to the asynchronous subscribers in the order they
+ * came, so that their work is off the validation path. Such a subscriber gets no
+ * BlockChecked, which is about a block only the caller holds, and gets ChainTip and the
+ * transactions of SyncTransaction without the block they are in.
+ */
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fAsync = false);
 /** Unregister a wallet from core */
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
@@ -29,20 +44,39 @@ void UnregisterAllValidationInterfaces();
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
 
+/** The queue of the notifications to the asynchronous subscribers */
+struct ValidationQueueInfo
+{
+    //! Notifications queued, and the most it holds before validation waits for room
+    size_t nDepth;
+    size_t nMaxDepth;
+    uint64_t nQueued;
+    //! Times validation waited for room, and how long in microseconds
+    uint64_t nStalls;
+    std::shared_ptr<const AtomicHistogram> stallLatency;
+    //! Time from queueing to delivery, in microseconds
+    std::shared_ptr<const AtomicHistogram> delayLatency;
+};
+
+ValidationQueueInfo GetValidationQueueInfo();
+
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {}
     virtual void EraseFromWallet(const uint256 &hash) {}
-    virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, ZCIncrementalMerkleTree tree, bool added) {}
+    virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
     virtual void ResendWalletTransactions(int64_t nBestBlockTime) {}
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
-    friend void ::RegisterValidationInterface(CValidationInterface*);
+    virtual void TransactionAddedToMempool(const CTransaction &tx, uint64_t nMempoolSequence) {}
+    virtual void TransactionRemovedFromMempool(const CTransaction &tx, MemPoolRemovalReason reason, uint64_t nMempoolSequence) {}
+    friend void ::RegisterValidationInterface(CValidationInterface*, bool);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
+    friend class CValidationQueue;
 };
 
 struct CMainSignals {
@@ -54,8 +88,9 @@ struct CMainSignals {
     boost::signals2::signal<void (const uint256 &)> EraseTransaction;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
-    /** Notifies listeners of a change to the tip of the active block chain. */
-    boost::signals2::signal<void (const CBlockIndex *, const CBlock *, ZCIncrementalMerkleTree, bool)> ChainTip;
+    /** Notifies listeners of a change to the tip of the active block chain, with the tree of the
+     *  commitments before the block connected or after the one disconnected. */
+    boost::signals2::signal<void (const CBlockIndex *, const CBlock *, const ZCIncrementalMerkleTreeRef&, bool)> ChainTip;
     /** Notifies listeners of a new active block chain. */
     boost::signals2::signal<void (const CBlockLocator &)> SetBestChain;
     /** Notifies listeners about an inventory item being seen on the network. */
@@ -64,6 +99,11 @@ struct CMainSignals {
     boost::signals2::signal<void (int64_t nBestBlockTime)> Broadcast;
     /** Notifies listeners of a block validation result */
     boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
+    /** Notifies listeners of a transaction accepted to the mempool, with the mempool sequence
+     *  number of the change (see CTxMemPool::GetChangeSequence). Called under mempool.cs. */
+    boost::signals2::signal<void (const CTransaction &, uint64_t)> TransactionAddedToMempool;
+    /** Notifies listeners of a transaction leaving the mempool, why, and the sequence number of the change */
+    boost::signals2::signal<void (const CTransaction &, MemPoolRemovalReason, uint64_t)> TransactionRemovedFromMempool;
 };
 
 CMainSignals& GetMainSignals();
@@ -22,6 +22,8 @@
 #include "miner.h"
 
 #include <array>
+#include <atomic>
+#include <exception>
 #include <iostream>
 #include <chrono>
 #include <thread>
@@ -181,13 +183,14 @@ void AsyncRPCOperation_sendmany::main() {
     if (success && paymentDisclosureMode && paymentDisclosureData_.size()>0) {
         uint256 txidhash = tx_.GetHash();
         std::shared_ptr<PaymentDisclosureDB> db = PaymentDisclosureDB::sharedInstance();
-        for (PaymentDisclosureKeyInfo p : paymentDisclosureData_) {
+        for (PaymentDisclosureKeyInfo& p : paymentDisclosureData_) {
             p.first.hash = txidhash;
-            if (!db->Put(p.first, p.second)) {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Error writing entry to database for key %s\n", getId(), p.first.ToString());
-            } else {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Successfully added entry to database for key %s\n", getId(), p.first.ToString());
-            }
+        }
+        // One write for all the outputs of the transaction
+        if (!db->Put(paymentDisclosureData_)) {
+            LogPrint("paymentdisclosure", "%s: Payment Disclosure: Error writing %d entries to database for txid %s\n", getId(), paymentDisclosureData_.size(), txidhash.ToString());
+        } else {
+            LogPrint("paymentdisclosure", "%s: Payment Disclosure: Successfully added %d entries to database for txid %s\n", getId(), paymentDisclosureData_.size(), txidhash.ToString());
         }
     }
     // !!! Payment disclosure END
@@ -208,6 +211,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
 
     // When spending coinbase utxos, you can only specify a single zaddr as the change must go somewhere
     // and if there are multiple zaddrs, we don't know where to send it.
+    std::unique_ptr<PhaseTimer> selectionTimer(new PhaseTimer(*this, "note_selection"));
     if (isfromtaddr_) {
         if (isSingleZaddrOutput) {
             bool b = find_utxos(true);
@@ -229,6 +233,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     if (isfromzaddr_ && !find_unspent_notes()) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient funds, no unspent notes found for zaddr from address.");
     }
+    selectionTimer.reset();
 
     CAmount t_inputs_total = 0;
     for (SendManyInputUTXO & t : t_inputs_) {
@@ -394,6 +399,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     // change upon arrival of new blocks which contain joinsplit transactions.  This is likely
     // to happen as creating a chained joinsplit transaction can take longer than the block interval.
     if (z_inputs_.size() > 0) {
+        PhaseTimer timer(*this, "witness");
         LOCK2(cs_main, pwalletMain->cs_wallet);
         for (auto t : z_inputs_) {
             JSOutPoint jso = std::get<0>(t);
@@ -441,7 +447,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
 
         // Create joinsplits, where each output represents a zaddr recipient.
-        UniValue obj(UniValue::VOBJ);
+        std::vector<AsyncJoinSplitInfo> infos;
         while (zOutputsDeque.size() > 0) {
             AsyncJoinSplitInfo info;
             info.vpub_old = 0;
@@ -464,8 +470,9 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 // Funds are removed from the value pool and enter the private pool
                 info.vpub_old += value;
             }
-            obj = perform_joinsplit(info);
+            infos.push_back(info);
         }
+        UniValue obj = perform_joinsplits(infos);
         sign_send_raw_transaction(obj);
         return true;
     }
@@ -763,7 +770,9 @@ void AsyncRPCOperation_sendmany::sign_send_raw_transaction(UniValue obj)
 
     UniValue params = UniValue(UniValue::VARR);
     params.push_back(rawtxn);
+    std::unique_ptr<PhaseTimer> signTimer(new PhaseTimer(*this, "sign"));
     UniValue signResultValue = signrawtransaction(params, false);
+    signTimer.reset();
     UniValue signResultObject = signResultValue.get_obj();
     UniValue completeValue = find_value(signResultObject, "complete");
     bool complete = completeValue.get_bool();
@@ -783,7 +792,9 @@ void AsyncRPCOperation_sendmany::sign_send_raw_transaction(UniValue obj)
         params.clear();
         params.setArray();
         params.push_back(signedtxn);
+        std::unique_ptr<PhaseTimer> broadcastTimer(new PhaseTimer(*this, "broadcast"));
         UniValue sendResultValue = sendrawtransaction(params, false);
+        broadcastTimer.reset();
         if (sendResultValue.isNull()) {
             throw JSONRPCError(RPC_WALLET_ERROR, "Send raw transaction did not return an error or a txid.");
         }
@@ -910,16 +921,75 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(AsyncJoinSplitInfo & info
     std::vector<boost::optional < ZCIncrementalWitness>> witnesses;
     uint256 anchor;
     {
+        PhaseTimer timer(*this, "witness");
         LOCK(cs_main);
         pwalletMain->GetNoteWitnesses(outPoints, witnesses, anchor);
     }
     return perform_joinsplit(info, witnesses, anchor);
 }
 
+UniValue AsyncRPCOperation_sendmany::perform_joinsplits(std::vector<AsyncJoinSplitInfo> & infos) {
+    uint256 anchor;
+    {
+        LOCK(cs_main);
+        anchor = pcoinsTip->GetBestAnchor();    // As there are no inputs, ask the wallet for the best anchor
+    }
+
+    // The joinsplits spend no notes of each other, so their proofs are independent
+    const size_t js_first = tx_.vjoinsplit.size();
+    std::vector<AsyncJoinSplitProof> proofs(infos.size());
+    std::vector<std::exception_ptr> errors(infos.size());
+    std::atomic<size_t> next(0);
+    auto prove = [&]() {
+        for (size_t i = next++; i < infos.size(); i = next++) {
+            try {
+                proofs[i] = prove_joinsplit(infos[i], std::vector<boost::optional < ZCIncrementalWitness>>(), anchor, js_first + i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    {
+        PhaseTimer timer(*this, "proof");
+        std::vector<std::thread> threads;
+        const size_t nThreads = std::min(infos.size(), MAX_JOINSPLIT_PROOF_THREADS);
+        for (size_t i = 1; i < nThreads; i++) {
+            threads.push_back(std::thread(prove));
+        }
+        prove();
+        for (std::thread & t : threads) {
+            t.join();
+        }
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    for (size_t i = 0; i < infos.size(); i++) {
+        if (errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+        obj = add_joinsplit(proofs[i]);
+    }
+    return obj;
+}
+
 UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         AsyncJoinSplitInfo & info,
         std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
         uint256 anchor)
+{
+    AsyncJoinSplitProof proof;
+    {
+        PhaseTimer timer(*this, "proof");
+        proof = prove_joinsplit(info, witnesses, anchor, tx_.vjoinsplit.size());
+    }
+    return add_joinsplit(proof);
+}
+
+AsyncJoinSplitProof AsyncRPCOperation_sendmany::prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
+        uint256 anchor,
+        size_t js_index) const
 {
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
@@ -949,11 +1019,9 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         throw runtime_error("unsupported joinsplit input/output counts");
     }
 
-    CMutableTransaction mtx(tx_);
-
     LogPrint("zrpcunsafe", "%s: creating joinsplit at index %d (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
             getId(),
-            tx_.vjoinsplit.size(),
+            js_index,
             FormatMoney(info.vpub_old), FormatMoney(info.vpub_new),
             FormatMoney(info.vjsin[0].note.value()), FormatMoney(info.vjsin[1].note.value()),
             FormatMoney(info.vjsout[0].value), FormatMoney(info.vjsout[1].value)
@@ -962,39 +1030,38 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     // Generate the proof, this can take over a minute.
     std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> inputs
             {info.vjsin[0], info.vjsin[1]};
-    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs
-            {info.vjsout[0], info.vjsout[1]};
-        #ifdef __APPLE__
-        std::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
-        std::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
-        #else
-        std::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
-        std::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
-        #endif
-
-    uint256 esk; // payment disclosure - secret
-
-    JSDescription jsdesc = JSDescription::Randomized(
-			mtx.nVersion == GROTH_TX_VERSION,
+    AsyncJoinSplitProof proof;
+    proof.outputs = {info.vjsout[0], info.vjsout[1]};
+
+    // esk is the payment disclosure secret
+    proof.jsdesc = JSDescription::Randomized(
+			tx_.nVersion == GROTH_TX_VERSION,
             *pzcashParams,
             joinSplitPubKey_,
             anchor,
             inputs,
-            outputs,
-            inputMap,
-            outputMap,
+            proof.outputs,
+            proof.inputMap,
+            proof.outputMap,
             info.vpub_old,
             info.vpub_new,
             !this->testmode,
-            &esk); // parameter expects pointer to esk, so pass in address
+            &proof.esk); // parameter expects pointer to esk, so pass in address
     {
         auto verifier = libzcash::ProofVerifier::Strict();
-        if (!(jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
+        if (!(proof.jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
             throw std::runtime_error("error verifying joinsplit");
         }
     }
 
-    mtx.vjoinsplit.push_back(jsdesc);
+    return proof;
+}
+
+UniValue AsyncRPCOperation_sendmany::add_joinsplit(const AsyncJoinSplitProof & proof)
+{
+    CMutableTransaction mtx(tx_);
+
+    mtx.vjoinsplit.push_back(proof.jsdesc);
 
     // Empty output script.
     CScript scriptCode;
@@ -1030,18 +1097,18 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     {
         CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
         ss2 << ((unsigned char) 0x00);
-        ss2 << jsdesc.ephemeralKey;
-        ss2 << jsdesc.ciphertexts[0];
-        ss2 << jsdesc.h_sig(*pzcashParams, joinSplitPubKey_);
+        ss2 << proof.jsdesc.ephemeralKey;
+        ss2 << proof.jsdesc.ciphertexts[0];
+        ss2 << proof.jsdesc.h_sig(*pzcashParams, joinSplitPubKey_);
 
         encryptedNote1 = HexStr(ss2.begin(), ss2.end());
     }
     {
         CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
         ss2 << ((unsigned char) 0x01);
-        ss2 << jsdesc.ephemeralKey;
-        ss2 << jsdesc.ciphertexts[1];
-        ss2 << jsdesc.h_sig(*pzcashParams, joinSplitPubKey_);
+        ss2 << proof.jsdesc.ephemeralKey;
+        ss2 << proof.jsdesc.ciphertexts[1];
+        ss2 << proof.jsdesc.h_sig(*pzcashParams, joinSplitPubKey_);
 
         encryptedNote2 = HexStr(ss2.begin(), ss2.end());
     }
@@ -1049,10 +1116,10 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     UniValue arrInputMap(UniValue::VARR);
     UniValue arrOutputMap(UniValue::VARR);
     for (size_t i = 0; i < ZC_NUM_JS_INPUTS; i++) {
-        arrInputMap.push_back(inputMap[i]);
+        arrInputMap.push_back(proof.inputMap[i]);
     }
     for (size_t i = 0; i < ZC_NUM_JS_OUTPUTS; i++) {
-        arrOutputMap.push_back(outputMap[i]);
+        arrOutputMap.push_back(proof.outputMap[i]);
     }
 
 
@@ -1064,12 +1131,12 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     size_t js_index = tx_.vjoinsplit.size() - 1;
     uint256 placeholder;
     for (int i = 0; i < ZC_NUM_JS_OUTPUTS; i++) {
-        uint8_t mapped_index = outputMap[i];
+        uint8_t mapped_index = proof.outputMap[i];
         // placeholder for txid will be filled in later when tx has been finalized and signed.
         PaymentDisclosureKey pdKey = {placeholder, js_index, mapped_index};
-        JSOutput output = outputs[mapped_index];
+        JSOutput output = proof.outputs[mapped_index];
         libzcash::PaymentAddress zaddr = output.addr;  // randomized output
-        PaymentDisclosureInfo pdInfo = {PAYMENT_DISCLOSURE_VERSION_EXPERIMENTAL, esk, joinSplitPrivKey, zaddr};
+        PaymentDisclosureInfo pdInfo = {PAYMENT_DISCLOSURE_VERSION_EXPERIMENTAL, proof.esk, joinSplitPrivKey, zaddr};
         paymentDisclosureData_.push_back(PaymentDisclosureKeyInfo(pdKey, pdInfo));
 
         CZCPaymentAddress address(zaddr);
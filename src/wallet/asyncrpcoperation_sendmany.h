@@ -14,6 +14,7 @@
 #include "wallet.h"
 #include "paymentdisclosure.h"
 
+#include <array>
 #include <unordered_map>
 #include <tuple>
 
@@ -43,6 +44,24 @@ struct AsyncJoinSplitInfo
     CAmount vpub_new = 0;
 };
 
+// The proof of a joinsplit, generated apart from the transaction it goes into.
+struct AsyncJoinSplitProof
+{
+    JSDescription jsdesc;
+    std::array<JSOutput, ZC_NUM_JS_OUTPUTS> outputs;
+#ifdef __APPLE__
+    std::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
+    std::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
+#else
+    std::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
+    std::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
+#endif
+    uint256 esk; // payment disclosure - secret
+};
+
+// Threads generating the proofs of the joinsplits of an operation which spend no notes
+static const size_t MAX_JOINSPLIT_PROOF_THREADS = 4;
+
 // A struct to help us track the witness and anchor for a given JSOutPoint
 struct WitnessAnchorData {
 	boost::optional<ZCIncrementalWitness> witness;
@@ -115,6 +134,19 @@ private:
         std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
         uint256 anchor);
 
+    // JoinSplits without any input notes to spend, whose proofs are generated in parallel
+    UniValue perform_joinsplits(std::vector<AsyncJoinSplitInfo> & infos);
+
+    // Generate the proof of a joinsplit at js_index, without adding it to the transaction
+    AsyncJoinSplitProof prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
+        uint256 anchor,
+        size_t js_index) const;
+
+    // Add a joinsplit to the transaction and sign it again
+    UniValue add_joinsplit(const AsyncJoinSplitProof & proof);
+
     void sign_send_raw_transaction(UniValue obj);     // throws exception if there was an error
 
     // payment disclosure!
@@ -179,6 +211,10 @@ public:
         return delegate->perform_joinsplit(info, witnesses, anchor);
     }
 
+    UniValue perform_joinsplits(std::vector<AsyncJoinSplitInfo> &infos) {
+        return delegate->perform_joinsplits(infos);
+    }
+
     void sign_send_raw_transaction(UniValue obj) {
         delegate->sign_send_raw_transaction(obj);
     }
@@ -19,7 +19,9 @@
 #include "zcash/IncrementalMerkleTree.hpp"
 #include "sodium.h"
 #include "miner.h"
+#include "support/cleanse.h"
 
+#include <algorithm>
 #include <array>
 #include <iostream>
 #include <chrono>
@@ -53,17 +55,39 @@ AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
         std::string toAddress,
         CAmount fee,
         UniValue contextInfo) :
-        tx_(contextualTx), inputs_(inputs), fee_(fee), contextinfo_(contextInfo)
+        tx_(contextualTx), inputs_(inputs), batches_(1, inputs), fee_(fee), contextinfo_(contextInfo)
 {
-    assert(contextualTx.nVersion >= PHGR_TX_VERSION || contextualTx.nVersion == GROTH_TX_VERSION);  // transaction format version must support vjoinsplit
+    init(toAddress);
+}
+
+AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
+        CMutableTransaction contextualTx,
+        std::string toAddress,
+        std::vector<std::vector<ShieldCoinbaseUTXO> > batches,
+        CAmount fee,
+        UniValue contextInfo) :
+        tx_(contextualTx), batches_(batches), fee_(fee), contextinfo_(contextInfo)
+{
+    for (const std::vector<ShieldCoinbaseUTXO>& batch : batches_) {
+        inputs_.insert(inputs_.end(), batch.begin(), batch.end());
+    }
+    init(toAddress);
+}
 
-    if (fee < 0 || fee > MAX_MONEY) {
+void AsyncRPCOperation_shieldcoinbase::init(const std::string& toAddress)
+{
+    assert(tx_.nVersion >= PHGR_TX_VERSION || tx_.nVersion == GROTH_TX_VERSION);  // transaction format version must support vjoinsplit
+
+    if (fee_ < 0 || fee_ > MAX_MONEY) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Fee is out of range");
     }
 
-    if (inputs.size() == 0) {
+    if (batches_.empty() || std::any_of(batches_.begin(), batches_.end(),
+            [](const std::vector<ShieldCoinbaseUTXO>& batch) { return batch.empty(); })) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Empty inputs");
     }
+    txStates_.assign(batches_.size(), ShieldCoinbaseTxState::QUEUED);
+    txids_.assign(batches_.size(), "");
 
     //  Check the destination address is valid for this network i.e. not testnet being used on mainnet
     CZCPaymentAddress address(toAddress);
@@ -75,7 +99,7 @@ AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
 
     // Log the context info
     if (LogAcceptCategory("zrpcunsafe")) {
-        LogPrint("zrpcunsafe", "%s: z_shieldcoinbase initialized (context=%s)\n", getId(), contextInfo.write());
+        LogPrint("zrpcunsafe", "%s: z_shieldcoinbase initialized (context=%s)\n", getId(), contextinfo_.write());
     } else {
         LogPrint("zrpc", "%s: z_shieldcoinbase initialized\n", getId());
     }
@@ -144,7 +168,9 @@ void AsyncRPCOperation_shieldcoinbase::main() {
     }
 
     std::string s = strprintf("%s: z_shieldcoinbase finished (status=%s", getId(), getStateAsString());
-    if (success) {
+    if (success && batches_.size() > 1) {
+        s += strprintf(", transactions=%d)\n", batches_.size());
+    } else if (success) {
         s += strprintf(", txid=%s)\n", tx_.GetHash().ToString());
     } else {
         s += strprintf(", error=%s)\n", getErrorMessage());
@@ -156,10 +182,18 @@ void AsyncRPCOperation_shieldcoinbase::main() {
 
 
 bool AsyncRPCOperation_shieldcoinbase::main_impl() {
+    if (batches_.size() > 1) {
+        return shield_batches();
+    }
+    set_result(shield_batch(inputs_, tx_));
+    return true;
+}
+
+UniValue AsyncRPCOperation_shieldcoinbase::shield_batch(const std::vector<ShieldCoinbaseUTXO>& inputs, CTransaction& tx) {
 
     CAmount minersFee = fee_;
 
-    size_t numInputs = inputs_.size();
+    size_t numInputs = inputs.size();
 
     // Check mempooltxinputlimit to avoid creating a transaction which the local mempool rejects
     size_t limit = (size_t)GetArg("-mempooltxinputlimit", 0);
@@ -170,7 +204,7 @@ bool AsyncRPCOperation_shieldcoinbase::main_impl() {
     }
 
     CAmount targetAmount = 0;
-    for (ShieldCoinbaseUTXO & utxo : inputs_) {
+    for (const ShieldCoinbaseUTXO & utxo : inputs) {
         targetAmount += utxo.amount;
     }
 
@@ -185,18 +219,20 @@ bool AsyncRPCOperation_shieldcoinbase::main_impl() {
             getId(), FormatMoney(targetAmount), FormatMoney(sendAmount), FormatMoney(minersFee));
 
     // update the transaction with these inputs
-    CMutableTransaction rawTx(tx_);
-    for (ShieldCoinbaseUTXO & t : inputs_) {
+    CMutableTransaction rawTx(tx);
+    for (const ShieldCoinbaseUTXO & t : inputs) {
         CTxIn in(COutPoint(t.txid, t.vout));
         rawTx.vin.push_back(in);
     }
-    tx_ = CTransaction(rawTx);
+    tx = CTransaction(rawTx);
 
     // Prepare raw transaction to handle JoinSplits
-    CMutableTransaction mtx(tx_);
-	crypto_sign_keypair(joinSplitPubKey_.begin(), joinSplitPrivKey_);
-    mtx.joinSplitPubKey = joinSplitPubKey_;
-    tx_ = CTransaction(mtx);
+    uint256 joinSplitPubKey;
+    unsigned char joinSplitPrivKey[crypto_sign_SECRETKEYBYTES];
+    CMutableTransaction mtx(tx);
+    crypto_sign_keypair(joinSplitPubKey.begin(), joinSplitPrivKey);
+    mtx.joinSplitPubKey = joinSplitPubKey;
+    tx = CTransaction(mtx);
 
     // Create joinsplit
     UniValue obj(UniValue::VOBJ);
@@ -205,18 +241,110 @@ bool AsyncRPCOperation_shieldcoinbase::main_impl() {
     info.vpub_new = 0;
     JSOutput jso = JSOutput(tozaddr_, sendAmount);
     info.vjsout.push_back(jso);
-    obj = perform_joinsplit(info);
+    try {
+        PhaseTimer timer(*this, "proof");
+        obj = perform_joinsplit(info, tx, joinSplitPubKey, joinSplitPrivKey);
+    } catch (...) {
+        memory_cleanse(joinSplitPrivKey, sizeof(joinSplitPrivKey));
+        throw;
+    }
+    memory_cleanse(joinSplitPrivKey, sizeof(joinSplitPrivKey));
+
+    return sign_send_raw_transaction(obj, tx);
+}
 
-    sign_send_raw_transaction(obj);
+/**
+ * Shield the batches in parallel. Each thread takes the next batch, generates its proof
+ * and signs and sends it, so the proofs of the next transactions are generated while the
+ * previous ones are sent. A batch which fails does not stop the others.
+ */
+bool AsyncRPCOperation_shieldcoinbase::shield_batches() {
+    std::mutex csNext;
+    size_t nNext = 0;
+    std::vector<std::string> vErrors(batches_.size());
+
+    auto worker = [&]() {
+        while (true) {
+            size_t i;
+            {
+                std::lock_guard<std::mutex> guard(csNext);
+                if (nNext == batches_.size()) {
+                    return;
+                }
+                i = nNext++;
+            }
+
+            set_tx_state(i, ShieldCoinbaseTxState::PROVING);
+            try {
+                CTransaction tx(tx_);
+                UniValue o = shield_batch(batches_[i], tx);
+                set_tx_state(i, ShieldCoinbaseTxState::SENT, find_value(o, "txid").get_str());
+            } catch (const UniValue& objError) {
+                vErrors[i] = find_value(objError, "message").get_str();
+                set_tx_state(i, ShieldCoinbaseTxState::FAILED);
+            } catch (const std::exception& e) {
+                vErrors[i] = e.what();
+                set_tx_state(i, ShieldCoinbaseTxState::FAILED);
+            }
+        }
+    };
+
+    const size_t numThreads = std::min(batches_.size(), (size_t)std::max(1, std::min(GetNumCores(), SHIELD_COINBASE_MAX_PROOF_THREADS)));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < numThreads; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    size_t numFailed = 0;
+    std::string firstError;
+    for (const std::string& error : vErrors) {
+        if (!error.empty()) {
+            if (numFailed++ == 0) {
+                firstError = error;
+            }
+        }
+    }
+    if (numFailed > 0) {
+        throw JSONRPCError(RPC_WALLET_ERROR, strprintf("%d of %d transactions failed, the first one with: %s",
+            numFailed, batches_.size(), firstError));
+    }
+
+    UniValue arrTxids(UniValue::VARR);
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (const std::string& txid : txids_) {
+            arrTxids.push_back(txid);
+        }
+    }
+    UniValue o(UniValue::VOBJ);
+    o.pushKV("txids", arrTxids);
+    set_result(o);
     return true;
 }
 
+void AsyncRPCOperation_shieldcoinbase::set_tx_state(size_t i, ShieldCoinbaseTxState state, const std::string& txid) {
+    std::lock_guard<std::mutex> guard(lock_);
+    txStates_[i] = state;
+    if (!txid.empty()) {
+        txids_[i] = txid;
+    }
+}
+
 
 /**
  * Sign and send a raw transaction.
  * Raw transaction as hex string should be in object field "rawtxn"
  */
 void AsyncRPCOperation_shieldcoinbase::sign_send_raw_transaction(UniValue obj)
+{
+    set_result(sign_send_raw_transaction(obj, tx_));
+}
+
+UniValue AsyncRPCOperation_shieldcoinbase::sign_send_raw_transaction(UniValue obj, CTransaction& tx)
 {
     // Sign the raw transaction
     UniValue rawtxnValue = find_value(obj, "rawtxn");
@@ -227,7 +355,9 @@ void AsyncRPCOperation_shieldcoinbase::sign_send_raw_transaction(UniValue obj)
 
     UniValue params = UniValue(UniValue::VARR);
     params.push_back(rawtxn);
+    std::unique_ptr<PhaseTimer> signTimer(new PhaseTimer(*this, "sign"));
     UniValue signResultValue = signrawtransaction(params, false);
+    signTimer.reset();
     UniValue signResultObject = signResultValue.get_obj();
     UniValue completeValue = find_value(signResultObject, "complete");
     bool complete = completeValue.get_bool();
@@ -243,43 +373,45 @@ void AsyncRPCOperation_shieldcoinbase::sign_send_raw_transaction(UniValue obj)
     std::string signedtxn = hexValue.get_str();
 
     // Send the signed transaction
+    UniValue o(UniValue::VOBJ);
     if (!testmode) {
         params.clear();
         params.setArray();
         params.push_back(signedtxn);
+        std::unique_ptr<PhaseTimer> broadcastTimer(new PhaseTimer(*this, "broadcast"));
         UniValue sendResultValue = sendrawtransaction(params, false);
+        broadcastTimer.reset();
         if (sendResultValue.isNull()) {
             throw JSONRPCError(RPC_WALLET_ERROR, "Send raw transaction did not return an error or a txid.");
         }
 
         std::string txid = sendResultValue.get_str();
 
-        UniValue o(UniValue::VOBJ);
         o.pushKV("txid", txid);
-        set_result(o);
     } else {
         // Test mode does not send the transaction to the network.
 
         CDataStream stream(ParseHex(signedtxn), SER_NETWORK, PROTOCOL_VERSION);
-        CTransaction tx;
-        stream >> tx;
+        CTransaction txSigned;
+        stream >> txSigned;
 
-        UniValue o(UniValue::VOBJ);
         o.pushKV("test", 1);
-        o.pushKV("txid", tx.GetHash().ToString());
+        o.pushKV("txid", txSigned.GetHash().ToString());
         o.pushKV("hex", signedtxn);
-        set_result(o);
     }
 
     // Keep the signed transaction so we can hash to the same txid
     CDataStream stream(ParseHex(signedtxn), SER_NETWORK, PROTOCOL_VERSION);
-    CTransaction tx;
     stream >> tx;
-    tx_ = tx;
+    return o;
 }
 
 
 UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInfo & info) {
+    return perform_joinsplit(info, tx_, joinSplitPubKey_, joinSplitPrivKey_);
+}
+
+UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInfo & info, CTransaction& tx, const uint256& joinSplitPubKey, const unsigned char* joinSplitPrivKey) {
     uint256 anchor = pcoinsTip->GetBestAnchor();
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
@@ -298,11 +430,11 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
         throw runtime_error("unsupported joinsplit input/output counts");
     }
 
-    CMutableTransaction mtx(tx_);
+    CMutableTransaction mtx(tx);
 
     LogPrint("zrpcunsafe", "%s: creating joinsplit at index %d (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
             getId(),
-            tx_.vjoinsplit.size(),
+            tx.vjoinsplit.size(),
             FormatMoney(info.vpub_old), FormatMoney(info.vpub_new),
             FormatMoney(info.vjsin[0].note.value()), FormatMoney(info.vjsin[1].note.value()),
             FormatMoney(info.vjsout[0].value), FormatMoney(info.vjsout[1].value)
@@ -326,7 +458,7 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
     JSDescription jsdesc = JSDescription::Randomized(
 			mtx.nVersion == GROTH_TX_VERSION,
             *pzcashParams,
-            joinSplitPubKey_,
+            joinSplitPubKey,
             anchor,
             inputs,
             outputs,
@@ -338,7 +470,7 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
             &esk);  // parameter expects pointer to esk, so pass in address
     {
         auto verifier = libzcash::ProofVerifier::Strict();
-        if (!(jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
+        if (!(jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey))) {
             throw std::runtime_error("error verifying joinsplit");
         }
     }
@@ -353,7 +485,7 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
     // Add the signature
     if (!(crypto_sign_detached(&mtx.joinSplitSig[0], NULL,
             dataToBeSigned.begin(), 32,
-            joinSplitPrivKey_
+            joinSplitPrivKey
             ) == 0))
     {
         throw std::runtime_error("crypto_sign_detached failed");
@@ -369,7 +501,7 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
     }
 
     CTransaction rawTx(mtx);
-    tx_ = rawTx;
+    tx = rawTx;
 
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << rawTx;
@@ -381,7 +513,7 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
         ss2 << ((unsigned char) 0x00);
         ss2 << jsdesc.ephemeralKey;
         ss2 << jsdesc.ciphertexts[0];
-        ss2 << jsdesc.h_sig(*pzcashParams, joinSplitPubKey_);
+        ss2 << jsdesc.h_sig(*pzcashParams, joinSplitPubKey);
 
         encryptedNote1 = HexStr(ss2.begin(), ss2.end());
     }
@@ -390,7 +522,7 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
         ss2 << ((unsigned char) 0x01);
         ss2 << jsdesc.ephemeralKey;
         ss2 << jsdesc.ciphertexts[1];
-        ss2 << jsdesc.h_sig(*pzcashParams, joinSplitPubKey_);
+        ss2 << jsdesc.h_sig(*pzcashParams, joinSplitPubKey);
 
         encryptedNote2 = HexStr(ss2.begin(), ss2.end());
     }
@@ -418,13 +550,36 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
  */
 UniValue AsyncRPCOperation_shieldcoinbase::getStatus() const {
     UniValue v = AsyncRPCOperation::getStatus();
-    if (contextinfo_.isNull()) {
+    if (contextinfo_.isNull() && batches_.size() == 1) {
         return v;
     }
 
     UniValue obj = v.get_obj();
-    obj.pushKV("method", "z_shieldcoinbase");
-    obj.pushKV("params", contextinfo_ );
+    if (!contextinfo_.isNull()) {
+        obj.pushKV("method", "z_shieldcoinbase");
+        obj.pushKV("params", contextinfo_ );
+    }
+
+    // The progress of each transaction of a bulk shielding
+    if (batches_.size() > 1) {
+        UniValue arrTxs(UniValue::VARR);
+        std::lock_guard<std::mutex> guard(lock_);
+        for (size_t i = 0; i < batches_.size(); i++) {
+            UniValue txObj(UniValue::VOBJ);
+            switch (txStates_[i]) {
+            case ShieldCoinbaseTxState::QUEUED: txObj.pushKV("status", "queued"); break;
+            case ShieldCoinbaseTxState::PROVING: txObj.pushKV("status", "proving"); break;
+            case ShieldCoinbaseTxState::SENT: txObj.pushKV("status", "sent"); break;
+            case ShieldCoinbaseTxState::FAILED: txObj.pushKV("status", "failed"); break;
+            }
+            txObj.pushKV("utxos", (int64_t)batches_[i].size());
+            if (!txids_[i].empty()) {
+                txObj.pushKV("txid", txids_[i]);
+            }
+            arrTxs.push_back(txObj);
+        }
+        obj.pushKV("transactions", arrTxs);
+    }
     return obj;
 }
 
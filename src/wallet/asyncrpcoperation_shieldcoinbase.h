@@ -20,6 +20,8 @@
 
 // Default transaction fee if caller does not specify one.
 #define SHIELD_COINBASE_DEFAULT_MINERS_FEE   10000
+// Most transactions of a bulk shielding whose proofs are generated at once, each proof taking a lot of memory
+#define SHIELD_COINBASE_MAX_PROOF_THREADS    4
 
 using namespace libzcash;
 
@@ -38,9 +40,19 @@ struct ShieldCoinbaseJSInfo
     CAmount vpub_new = 0;
 };
 
+// State of a transaction of a bulk shielding, shown by getStatus()
+enum class ShieldCoinbaseTxState {
+    QUEUED,
+    PROVING,
+    SENT,
+    FAILED
+};
+
 class AsyncRPCOperation_shieldcoinbase : public AsyncRPCOperation {
 public:
     AsyncRPCOperation_shieldcoinbase(CMutableTransaction contextualTx, std::vector<ShieldCoinbaseUTXO> inputs, std::string toAddress, CAmount fee = SHIELD_COINBASE_DEFAULT_MINERS_FEE, UniValue contextInfo = NullUniValue);
+    // Bulk shielding, one transaction per batch of inputs, each paying the fee
+    AsyncRPCOperation_shieldcoinbase(CMutableTransaction contextualTx, std::string toAddress, std::vector<std::vector<ShieldCoinbaseUTXO> > batches, CAmount fee = SHIELD_COINBASE_DEFAULT_MINERS_FEE, UniValue contextInfo = NullUniValue);
     virtual ~AsyncRPCOperation_shieldcoinbase();
 
     // We don't want to be copied or moved around
@@ -67,15 +79,32 @@ private:
     unsigned char joinSplitPrivKey_[crypto_sign_SECRETKEYBYTES];
 
     std::vector<ShieldCoinbaseUTXO> inputs_;
+    // The inputs of each transaction, only one batch unless shielding in bulk
+    std::vector<std::vector<ShieldCoinbaseUTXO> > batches_;
+    // State and txid of each transaction, guarded by lock_
+    std::vector<ShieldCoinbaseTxState> txStates_;
+    std::vector<std::string> txids_;
 
     CTransaction tx_;
 
+    void init(const std::string& toAddress);
+
     bool main_impl();
 
+    // Shield the batch in tx, with a JoinSplit key pair of its own, returns the result of sending it
+    UniValue shield_batch(const std::vector<ShieldCoinbaseUTXO>& inputs, CTransaction& tx);
+
+    // Shield the batches from several threads, one transaction at a time each
+    bool shield_batches();
+
+    void set_tx_state(size_t i, ShieldCoinbaseTxState state, const std::string& txid = "");
+
     // JoinSplit without any input notes to spend
     UniValue perform_joinsplit(ShieldCoinbaseJSInfo &);
+    UniValue perform_joinsplit(ShieldCoinbaseJSInfo &, CTransaction& tx, const uint256& joinSplitPubKey, const unsigned char* joinSplitPrivKey);
 
     void sign_send_raw_transaction(UniValue obj);     // throws exception if there was an error
+    UniValue sign_send_raw_transaction(UniValue obj, CTransaction& tx);
 
     void lock_utxos();
 
@@ -10,7 +10,9 @@
 
 #include <string>
 #include <vector>
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 #include <openssl/aes.h>
 #include <openssl/evp.h>
 
@@ -150,6 +152,76 @@ static bool DecryptSpendingKey(const CKeyingMaterial& vMasterKey,
     return sk.address() == address;
 }
 
+namespace {
+
+/**
+ * Check that every crypted key decrypts with vMasterKey, on WALLET_UNLOCK_CHECK_THREADS
+ * threads if there are many, each taking every WALLET_UNLOCK_CHECK_THREADS-th key. They
+ * all stop at the first key which fails.
+ */
+class CUnlockCheck
+{
+public:
+    CUnlockCheck(const CKeyingMaterial& vMasterKeyIn, const CryptedKeyMap& mapCryptedKeys,
+                 const CryptedSpendingKeyMap& mapCryptedSpendingKeys) :
+        vMasterKey(vMasterKeyIn), fFail(false), fPass(false)
+    {
+        for (CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin(); mi != mapCryptedKeys.end(); ++mi)
+            vKeys.push_back(&mi->second);
+        for (CryptedSpendingKeyMap::const_iterator mi = mapCryptedSpendingKeys.begin(); mi != mapCryptedSpendingKeys.end(); ++mi)
+            vSpendingKeys.push_back(&*mi);
+    }
+
+    void Run()
+    {
+        const size_t nKeys = vKeys.size() + vSpendingKeys.size();
+        unsigned int nThreads = 1;
+        if (nKeys >= WALLET_UNLOCK_PARALLEL_MIN_KEYS)
+            nThreads = std::max(1u, std::min(WALLET_UNLOCK_CHECK_THREADS, boost::thread::hardware_concurrency()));
+        boost::thread_group threads;
+        for (unsigned int i = 1; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CUnlockCheck::Check, this, i, nThreads));
+        Check(0, nThreads);
+        threads.join_all();
+    }
+
+    bool AnyFailed() const { return fFail; }
+    bool AnyPassed() const { return fPass; }
+
+private:
+    const CKeyingMaterial& vMasterKey;
+    std::vector<const std::pair<CPubKey, std::vector<unsigned char> >*> vKeys;
+    std::vector<const std::pair<const libzcash::PaymentAddress, std::vector<unsigned char> >*> vSpendingKeys;
+    boost::atomic<bool> fFail;
+    boost::atomic<bool> fPass;
+
+    void Check(size_t nFirst, size_t nStep)
+    {
+        const size_t nKeys = vKeys.size() + vSpendingKeys.size();
+        for (size_t i = nFirst; i < nKeys && !fFail; i += nStep)
+        {
+            bool fOk;
+            if (i < vKeys.size())
+            {
+                CKey key;
+                fOk = DecryptKey(vMasterKey, vKeys[i]->second, vKeys[i]->first, key);
+            }
+            else
+            {
+                libzcash::SpendingKey sk;
+                const std::pair<const libzcash::PaymentAddress, std::vector<unsigned char> >& item = *vSpendingKeys[i - vKeys.size()];
+                fOk = DecryptSpendingKey(vMasterKey, item.second, item.first, sk);
+            }
+            if (fOk)
+                fPass = true;
+            else
+                fFail = true;
+        }
+    }
+};
+
+} // anon namespace
+
 bool CCryptoKeyStore::SetCrypted()
 {
     LOCK2(cs_KeyStore, cs_SpendingKeyStore);
@@ -184,35 +256,35 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 
         bool keyPass = false;
         bool keyFail = false;
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
+        if (fDecryptionThoroughlyChecked)
         {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
+            // All the keys were checked on a previous unlock, one of each kind tells the
+            // passphrase is right
+            CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
+            if (mi != mapCryptedKeys.end())
             {
-                keyFail = true;
-                break;
+                CKey key;
+                if (DecryptKey(vMasterKeyIn, (*mi).second.second, (*mi).second.first, key))
+                    keyPass = true;
+                else
+                    keyFail = true;
             }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
-        CryptedSpendingKeyMap::const_iterator skmi = mapCryptedSpendingKeys.begin();
-        for (; skmi != mapCryptedSpendingKeys.end(); ++skmi)
-        {
-            const libzcash::PaymentAddress &address = (*skmi).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*skmi).second;
-            libzcash::SpendingKey sk;
-            if (!DecryptSpendingKey(vMasterKeyIn, vchCryptedSecret, address, sk))
+            CryptedSpendingKeyMap::const_iterator skmi = mapCryptedSpendingKeys.begin();
+            if (!keyFail && skmi != mapCryptedSpendingKeys.end())
             {
-                keyFail = true;
-                break;
+                libzcash::SpendingKey sk;
+                if (DecryptSpendingKey(vMasterKeyIn, (*skmi).second, (*skmi).first, sk))
+                    keyPass = true;
+                else
+                    keyFail = true;
             }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
+        }
+        else
+        {
+            CUnlockCheck check(vMasterKeyIn, mapCryptedKeys, mapCryptedSpendingKeys);
+            check.Run();
+            keyPass = check.AnyPassed();
+            keyFail = check.AnyFailed();
         }
         if (keyPass && keyFail)
         {
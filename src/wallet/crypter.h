@@ -13,6 +13,10 @@
 
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
+//! Threads checking the keys on the first unlock
+const unsigned int WALLET_UNLOCK_CHECK_THREADS = 4;
+//! Keys from which the first unlock checks them on several threads
+const size_t WALLET_UNLOCK_PARALLEL_MIN_KEYS = 64;
 
 /**
  * Private key encryption is done based on a CMasterKey,
@@ -224,7 +224,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL), plog(NULL), fLogTxn(false)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -233,6 +233,18 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
         return;
 
     bool fCreate = strchr(pszMode, 'c') != NULL;
+    if (!bitdb.IsMock())
+        plog = GetWalletLog(strFilename, fCreate);
+    if (plog) {
+        strFile = strFilename;
+        if (fCreate && !Exists(string("version"))) {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -285,8 +297,12 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
 void CDB::Flush()
 {
-    if (activeTxn)
+    if (activeTxn || fLogTxn)
+        return;
+    if (plog) {
+        plog->Sync();
         return;
+    }
 
     // Flush database activity from memory pool to disk log
     unsigned int nMinutes = 0;
@@ -298,6 +314,14 @@ void CDB::Flush()
 
 void CDB::Close()
 {
+    if (plog) {
+        fLogTxn = false;
+        mapLogTxn.clear();
+        if (fFlushOnClose)
+            Flush();
+        plog = NULL;
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
@@ -314,6 +338,70 @@ void CDB::Close()
     }
 }
 
+bool CDB::ReadLog(const CDataStream& ssKey, CSerializeData& vchValue) const
+{
+    const CSerializeData vchKey(ssKey.begin(), ssKey.end());
+    if (fLogTxn) {
+        CWalletLog::Writes::const_iterator it = mapLogTxn.find(vchKey);
+        if (it != mapLogTxn.end()) {
+            if (!it->second)
+                return false;
+            vchValue = *it->second;
+            return true;
+        }
+    }
+    return plog->Read(vchKey, vchValue);
+}
+
+bool CDB::WriteLog(const CDataStream& ssKey, const CDataStream* pssValue)
+{
+    CWalletLog::Writes writes;
+    CWalletLog::Writes& target = fLogTxn ? mapLogTxn : writes;
+    const CSerializeData vchKey(ssKey.begin(), ssKey.end());
+    if (pssValue)
+        target[vchKey] = CSerializeData(pssValue->begin(), pssValue->end());
+    else
+        target[vchKey] = boost::none;
+    // The writes outside of a transaction are each one of their own
+    return fLogTxn || plog->Commit(writes);
+}
+
+int CDB::ReadLogAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    CSerializeData vchFrom;
+    bool fInclusive;
+    if (fFlags == DB_SET_RANGE) {
+        vchFrom.assign(ssKey.begin(), ssKey.end());
+        fInclusive = true;
+    } else if (fFlags == DB_NEXT) {
+        vchFrom = pcursor->vchKey;
+        fInclusive = !pcursor->fStarted;
+    } else {
+        return EINVAL;
+    }
+
+    CSerializeData vchKey, vchValue;
+    if (!plog->Next(vchFrom, fInclusive, vchKey, vchValue))
+        return DB_NOTFOUND;
+    pcursor->vchKey = vchKey;
+    pcursor->fStarted = true;
+
+    ssKey.SetType(SER_DISK);
+    ssKey.clear();
+    ssKey.write(vchKey.data(), vchKey.size());
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write(vchValue.data(), vchValue.size());
+    return 0;
+}
+
+void CDBCursor::close()
+{
+    if (pdbc)
+        pdbc->close();
+    delete this;
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -339,6 +427,13 @@ bool CDBEnv::RemoveDb(const string& strFile)
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    // A wallet log is rewritten by its compaction, which also drops pszSkip
+    if (!bitdb.IsMock()) {
+        CWalletLog* plogRewrite = GetWalletLog(strFile, false);
+        if (plogRewrite)
+            return plogRewrite->Compact(pszSkip);
+    }
+
     while (true) {
         {
             LOCK(bitdb.cs_db);
@@ -366,7 +461,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -426,6 +521,7 @@ void CDBEnv::Flush(bool fShutdown)
     int64_t nStart = GetTimeMillis();
     // Flush log data to the actual data file on all files that are not in use
     LogPrint("db", "CDBEnv::Flush: Flush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " database not started");
+    FlushWalletLogs(fShutdown);
     if (!fDbEnvInit)
         return;
     {
@@ -9,6 +9,7 @@
 #include "clientversion.h"
 #include "streams.h"
 #include "sync.h"
+#include "wallet/walletlog.h"
 
 #include <map>
 #include <string>
@@ -84,14 +85,36 @@ public:
 
 extern CDBEnv bitdb;
 
+/** A cursor of a CDB, over its Berkeley database or its wallet log */
+class CDBCursor
+{
+public:
+    Dbc* pdbc;
+    //! The key a wallet log cursor is at, once it has read one
+    CSerializeData vchKey;
+    bool fStarted;
+
+    explicit CDBCursor(Dbc* pdbcIn) : pdbc(pdbcIn), fStarted(false) {}
+
+    //! Close the cursor and free it, as Dbc::close does
+    void close();
+
+private:
+    ~CDBCursor() {}
+};
 
-/** RAII class that provides access to a Berkeley database */
+
+/** RAII class that provides access to a Berkeley database, or to a wallet log */
 class CDB
 {
 protected:
     Db* pdb;
     std::string strFile;
     DbTxn* activeTxn;
+    //! The wallet log, with the writes of its active transaction
+    CWalletLog* plog;
+    bool fLogTxn;
+    CWalletLog::Writes mapLogTxn;
     bool fReadOnly;
     bool fFlushOnClose;
 
@@ -106,17 +129,35 @@ private:
     CDB(const CDB&);
     void operator=(const CDB&);
 
+    bool ReadLog(const CDataStream& ssKey, CSerializeData& vchValue) const;
+    //! Write the value to the key, or erase it without pssValue
+    bool WriteLog(const CDataStream& ssKey, const CDataStream* pssValue);
+    int ReadLogAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags);
+
 protected:
     template <typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog) {
+            CSerializeData vchValue;
+            if (!ReadLog(ssKey, vchValue))
+                return false;
+            try {
+                CDataStream ssValue(vchValue.begin(), vchValue.end(), SER_DISK, CLIENT_VERSION);
+                ssValue >> value;
+            } catch (const std::exception&) {
+                return false;
+            }
+            return true;
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
@@ -144,7 +185,7 @@ protected:
     template <typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite = true)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -153,12 +194,19 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Value
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+
+        if (plog) {
+            CSerializeData vchValue;
+            if (!fOverwrite && ReadLog(ssKey, vchValue))
+                return false;
+            return WriteLog(ssKey, &ssValue);
+        }
+        Dbt datKey(&ssKey[0], ssKey.size());
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
@@ -173,7 +221,7 @@ protected:
     template <typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -182,6 +230,9 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog)
+            return WriteLog(ssKey, NULL);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
@@ -195,13 +246,18 @@ protected:
     template <typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog) {
+            CSerializeData vchValue;
+            return ReadLog(ssKey, vchValue);
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
@@ -212,19 +268,25 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
+    CDBCursor* GetCursor()
     {
+        if (plog)
+            return new CDBCursor(NULL);
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
             return NULL;
-        return pcursor;
+        return new CDBCursor(pcursor);
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
+    //! A wallet log cursor only reads with DB_NEXT and DB_SET_RANGE, and sees the committed writes
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
     {
+        if (!pcursor->pdbc)
+            return ReadLogAtCursor(pcursor, ssKey, ssValue, fFlags);
+
         // Read at cursor
         Dbt datKey;
         if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
@@ -238,7 +300,7 @@ protected:
         }
         datKey.set_flags(DB_DBT_MALLOC);
         datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
+        int ret = pcursor->pdbc->get(&datKey, &datValue, fFlags);
         if (ret != 0)
             return ret;
         else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
@@ -263,6 +325,12 @@ protected:
 public:
     bool TxnBegin()
     {
+        if (plog) {
+            if (fLogTxn)
+                return false;
+            fLogTxn = true;
+            return true;
+        }
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -274,6 +342,14 @@ public:
 
     bool TxnCommit()
     {
+        if (plog) {
+            if (!fLogTxn)
+                return false;
+            fLogTxn = false;
+            bool ret = plog->Commit(mapLogTxn);
+            mapLogTxn.clear();
+            return ret;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -283,6 +359,13 @@ public:
 
     bool TxnAbort()
     {
+        if (plog) {
+            if (!fLogTxn)
+                return false;
+            fLogTxn = false;
+            mapLogTxn.clear();
+            return true;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->abort();
@@ -30,6 +30,10 @@ public:
     MOCK_METHOD0(TxnAbort, bool());
 
     MOCK_METHOD2(WriteTx, bool(uint256 hash, const CWalletTx& wtx));
+    MOCK_METHOD3(WriteNoteWitness, bool(const JSOutPoint& jsoutpt, int nHeight, const ZCIncrementalWitness& witness));
+    MOCK_METHOD2(EraseNoteWitness, bool(const JSOutPoint& jsoutpt, int nHeight));
+    MOCK_METHOD2(WriteNoteWitnessHeight, bool(const JSOutPoint& jsoutpt, int nHeight));
+    MOCK_METHOD1(EraseNoteWitnessHeight, bool(const JSOutPoint& jsoutpt));
     MOCK_METHOD1(WriteWitnessCacheSize, bool(int64_t nWitnessCacheSize));
     MOCK_METHOD1(WriteBestBlock, bool(const CBlockLocator& loc));
 };
@@ -102,7 +106,7 @@ JSOutPoint CreateValidBlock(TestWallet& wallet,
     wtx.SetNoteData(noteData);
     wallet.AddToWallet(wtx, true, NULL);
 
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     wallet.IncrementNoteWitnesses(&index, &block, tree);
 
     return jsoutpt;
@@ -170,7 +174,7 @@ TEST(wallet_tests, find_unspent_notes) {
     // Fake-mine the transaction
     EXPECT_EQ(-1, chainActive.Height());
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -204,7 +208,7 @@ TEST(wallet_tests, find_unspent_notes) {
     // Fake-mine a spend transaction
     EXPECT_EQ(0, chainActive.Height());
     CBlock block2;
-    block2.vtx.push_back(wtx2);
+    block2.vtx.push_back(MakeTransactionRef(wtx2));
     block2.hashMerkleRoot = block2.BuildMerkleTree();
     block2.hashPrevBlock = blockHash;
     auto blockHash2 = block2.GetHash();
@@ -259,7 +263,7 @@ TEST(wallet_tests, find_unspent_notes) {
     // Fake-mine the new transaction
     EXPECT_EQ(1, chainActive.Height());
     CBlock block3;
-    block3.vtx.push_back(wtx3);
+    block3.vtx.push_back(MakeTransactionRef(wtx3));
     block3.hashMerkleRoot = block3.BuildMerkleTree();
     block3.hashPrevBlock = blockHash2;
     auto blockHash3 = block3.GetHash();
@@ -297,6 +301,179 @@ TEST(wallet_tests, find_unspent_notes) {
     mapBlockIndex.erase(blockHash3);
 }
 
+TEST(wallet_tests, received_notes_pages) {
+    SelectParams(CBaseChainParams::TESTNET);
+    CWallet wallet;
+    auto sk = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+
+    std::vector<uint256> vTxids;
+    for (int i = 0; i < 3; i++) {
+        auto wtx = GetValidReceive(sk, 10, true);
+        auto note = GetNote(sk, wtx, 0, 1);
+        mapNoteData_t noteData;
+        noteData[JSOutPoint {wtx.GetHash(), 0, 1}] = CNoteData {sk.address(), note.nullifier(sk)};
+        wtx.SetNoteData(noteData);
+        wtx.nOrderPos = i;
+        wallet.AddToWallet(wtx, true, NULL);
+        vTxids.push_back(wtx.GetHash());
+    }
+
+    std::vector<CNotePlaintextEntry> entries;
+    EXPECT_TRUE(wallet.GetReceivedNotesPage(entries, sk.address(), -1, -1, uint256()));
+    ASSERT_EQ(3, entries.size());
+    for (int i = 0; i < 3; i++)
+        EXPECT_EQ(vTxids[i], entries[i].jsop.hash);
+    entries.clear();
+
+    // The newest two, then the remaining one before the oldest of these
+    EXPECT_TRUE(wallet.GetReceivedNotesPage(entries, sk.address(), -1, 2, uint256()));
+    ASSERT_EQ(2, entries.size());
+    EXPECT_EQ(vTxids[1], entries[0].jsop.hash);
+    EXPECT_EQ(vTxids[2], entries[1].jsop.hash);
+    entries.clear();
+    EXPECT_TRUE(wallet.GetReceivedNotesPage(entries, sk.address(), -1, 2, vTxids[1]));
+    ASSERT_EQ(1, entries.size());
+    EXPECT_EQ(vTxids[0], entries[0].jsop.hash);
+    entries.clear();
+
+    // Unconfirmed notes are left out with minconf 0, a txid not in the wallet is refused
+    EXPECT_TRUE(wallet.GetReceivedNotesPage(entries, sk.address(), 0, -1, uint256()));
+    EXPECT_EQ(0, entries.size());
+    EXPECT_FALSE(wallet.GetReceivedNotesPage(entries, sk.address(), -1, -1, GetRandHash()));
+}
+
+TEST(wallet_tests, find_unspent_notes_after_spend_disconnected) {
+    SelectParams(CBaseChainParams::TESTNET);
+    CWallet wallet;
+    auto sk = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+
+    auto wtx = GetValidReceive(sk, 10, true);
+    auto note = GetNote(sk, wtx, 0, 1);
+    auto nullifier = note.nullifier(sk);
+
+    mapNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    CNoteData nd {sk.address(), nullifier};
+    noteData[jsoutpt] = nd;
+    wtx.SetNoteData(noteData);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    // Builds the note index
+    std::vector<CNotePlaintextEntry> entries;
+    wallet.GetFilteredNotes(entries, "", -1);
+    EXPECT_EQ(1, entries.size());
+    EXPECT_EQ(jsoutpt, entries[0].jsop);
+    entries.clear();
+
+    // Fake-mine a spend transaction
+    auto wtx2 = GetValidSpend(sk, note, 5);
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(wtx2));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+    wtx2.SetMerkleBranch(block);
+    wallet.AddToWallet(wtx2, true, NULL);
+
+    wallet.GetFilteredNotes(entries, "", -1);
+    EXPECT_EQ(0, entries.size());
+    entries.clear();
+    wallet.GetFilteredNotes(entries, "", -1, false);
+    EXPECT_EQ(1, entries.size());
+    entries.clear();
+
+    // Disconnect the block, which syncs its transactions to the wallet again
+    chainActive.SetTip(NULL);
+    wallet.AddToWallet(wtx2, true, NULL);
+
+    // The note is unspent again
+    wallet.GetFilteredNotes(entries, "", -1);
+    EXPECT_EQ(1, entries.size());
+    entries.clear();
+
+    // Tear down
+    mapBlockIndex.erase(blockHash);
+}
+
+TEST(wallet_tests, available_coins_follow_confirmed_spends) {
+    SelectParams(CBaseChainParams::TESTNET);
+    CWallet wallet;
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKeyPubKey(key, key.GetPubKey());
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 10;
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    mtx.vout[1].nValue = 20;
+    mtx.vout[1].scriptPubKey = GetScriptForDestination(otherKey.GetPubKey().GetID());
+    CWalletTx wtx {&wallet, mtx};
+
+    // Fake-mine the transaction
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(wtx));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+    wtx.SetMerkleBranch(block);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    // Only the output paying to our key is available, and it builds the coin index
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins, false);
+    ASSERT_EQ(1, vCoins.size());
+    EXPECT_EQ(wtx.GetHash(), vCoins[0].tx->GetHash());
+    EXPECT_EQ(0, vCoins[0].i);
+    EXPECT_EQ(10, wallet.GetBalance());
+
+    // Fake-mine a spend of it
+    CMutableTransaction mtx2;
+    mtx2.vin.resize(1);
+    mtx2.vin[0].prevout = COutPoint(wtx.GetHash(), 0);
+    mtx2.vout.resize(1);
+    mtx2.vout[0].nValue = 5;
+    mtx2.vout[0].scriptPubKey = GetScriptForDestination(otherKey.GetPubKey().GetID());
+    CWalletTx wtx2 {&wallet, mtx2};
+    CBlock block2;
+    block2.vtx.push_back(MakeTransactionRef(wtx2));
+    block2.hashMerkleRoot = block2.BuildMerkleTree();
+    block2.hashPrevBlock = blockHash;
+    auto blockHash2 = block2.GetHash();
+    CBlockIndex fakeIndex2 {block2};
+    mapBlockIndex.insert(std::make_pair(blockHash2, &fakeIndex2));
+    fakeIndex2.nHeight = 1;
+    chainActive.SetTip(&fakeIndex2);
+    wallet.SyncTransaction(wtx2, &block2);
+
+    wallet.AvailableCoins(vCoins, false);
+    EXPECT_EQ(0, vCoins.size());
+    EXPECT_EQ(0, wallet.GetBalance());
+
+    // Disconnect the spend, which syncs it to the wallet again
+    chainActive.SetTip(&fakeIndex);
+    wallet.SyncTransaction(wtx2, NULL);
+
+    wallet.AvailableCoins(vCoins, false);
+    EXPECT_EQ(1, vCoins.size());
+    EXPECT_EQ(10, wallet.GetBalance());
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+    mapBlockIndex.erase(blockHash2);
+}
+
 
 TEST(wallet_tests, set_note_addrs_in_cwallettx) {
     auto sk = libzcash::SpendingKey::random();
@@ -404,6 +581,38 @@ TEST(wallet_tests, FindMyNotes) {
     EXPECT_EQ(nd, noteMap[jsoutpt]);
 }
 
+TEST(wallet_tests, FindMyNotesInBatch) {
+    CWallet wallet;
+
+    // More decryptors than a batch, the ones opening the notes in different batches
+    std::vector<libzcash::SpendingKey> vKeys;
+    for (size_t i = 0; i < NOTE_DECRYPTION_BATCH_SIZE + 4; i++) {
+        vKeys.push_back(libzcash::SpendingKey::random());
+        wallet.AddSpendingKey(vKeys.back());
+    }
+    auto sk = libzcash::SpendingKey::random();
+
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(GetValidReceive(vKeys.front(), 10, true)));
+    vtx.push_back(MakeTransactionRef(GetValidReceive(sk, 10, true)));
+    vtx.push_back(MakeTransactionRef(GetValidReceive(vKeys.back(), 10, true)));
+
+    std::vector<mapNoteData_t> vNoteData;
+    wallet.FindMyNotes(vtx, vNoteData);
+    ASSERT_EQ(3, vNoteData.size());
+    EXPECT_EQ(2, vNoteData[0].size());
+    EXPECT_EQ(0, vNoteData[1].size());
+    EXPECT_EQ(2, vNoteData[2].size());
+    for (size_t i = 0; i < vtx.size(); i++) {
+        EXPECT_TRUE(vNoteData[i] == wallet.FindMyNotes(*vtx[i]));
+    }
+
+    JSOutPoint jsoutpt {vtx[2]->GetHash(), 0, 1};
+    CNoteData nd {vKeys.back().address(), GetNote(vKeys.back(), *vtx[2], 0, 1).nullifier(vKeys.back())};
+    EXPECT_EQ(1, vNoteData[2].count(jsoutpt));
+    EXPECT_EQ(nd, vNoteData[2][jsoutpt]);
+}
+
 TEST(wallet_tests, FindMyNotesInEncryptedWallet) {
     TestWallet wallet;
     uint256 r {GetRandHash()};
@@ -487,7 +696,7 @@ TEST(wallet_tests, nullifier_is_spent) {
     // Fake-mine the transaction
     EXPECT_EQ(-1, chainActive.Height());
     CBlock block;
-    block.vtx.push_back(wtx2);
+    block.vtx.push_back(MakeTransactionRef(wtx2));
     block.hashMerkleRoot = block.BuildMerkleTree();
     auto blockHash = block.GetHash();
     CBlockIndex fakeIndex {block};
@@ -505,6 +714,46 @@ TEST(wallet_tests, nullifier_is_spent) {
     mapBlockIndex.erase(blockHash);
 }
 
+TEST(wallet_tests, read_view_takes_depths_against_published_tip) {
+    CWallet wallet;
+
+    auto sk = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+
+    auto wtx = GetValidReceive(sk, 10, true);
+    auto note = GetNote(sk, wtx, 0, 1);
+    auto nullifier = note.nullifier(sk);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    // Fake-mine the spend, without publishing the new tip
+    auto wtx2 = GetValidSpend(sk, note, 5);
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(wtx2));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+
+    wtx2.SetMerkleBranch(block);
+    wallet.AddToWallet(wtx2, true, NULL);
+    EXPECT_TRUE(wallet.IsSpent(nullifier));
+
+    {
+        CWalletReadView view;
+        ASSERT_NE(nullptr, CWalletReadView::Current());
+        EXPECT_FALSE(CWalletReadView::Current()->Contains(&fakeIndex));
+        EXPECT_FALSE(wallet.IsSpent(nullifier));
+        EXPECT_TRUE(view.IsComplete());
+    }
+    EXPECT_EQ(nullptr, CWalletReadView::Current());
+    EXPECT_TRUE(wallet.IsSpent(nullifier));
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+}
+
 TEST(wallet_tests, navigate_from_nullifier_to_note) {
     CWallet wallet;
 
@@ -595,7 +844,7 @@ TEST(wallet_tests, cached_witnesses_empty_chain) {
     EXPECT_FALSE((bool) witnesses[1]);
 
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     CBlockIndex index(block);
     ZCIncrementalMerkleTree tree;
     wallet.IncrementNoteWitnesses(&index, &block, tree);
@@ -653,7 +902,7 @@ TEST(wallet_tests, cached_witnesses_chain_tip) {
         // Second block
         CBlock block2;
         block2.hashPrevBlock = block1.GetHash();
-        block2.vtx.push_back(wtx);
+        block2.vtx.push_back(MakeTransactionRef(wtx));
         CBlockIndex index2(block2);
         index2.nHeight = 2;
         ZCIncrementalMerkleTree tree2 {tree};
@@ -891,15 +1140,17 @@ TEST(wallet_tests, WriteWitnessCache) {
     wallet.AddSpendingKey(sk);
 
     auto wtx = GetValidReceive(sk, 10, true);
-    auto note = GetNote(sk, wtx, 0, 1);
-    auto nullifier = note.nullifier(sk);
 
+    // The tx is written again once its nullifier is cached, and the note
+    // witnesses once the cache is cleared
     mapNoteData_t noteData;
     JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
-    CNoteData nd {sk.address(), nullifier};
+    CNoteData nd {sk.address()};
     noteData[jsoutpt] = nd;
     wtx.SetNoteData(noteData);
     wallet.AddToWallet(wtx, true, NULL);
+    EXPECT_TRUE(wallet.UpdateNullifierNoteMap());
+    wallet.ClearNoteWitnessCache();
 
     // TxnBegin fails
     EXPECT_CALL(walletdb, TxnBegin())
@@ -924,6 +1175,22 @@ TEST(wallet_tests, WriteWitnessCache) {
     EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
         .WillRepeatedly(Return(true));
 
+    // WriteNoteWitnessHeight fails
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, -1))
+        .WillOnce(Return(false));
+    EXPECT_CALL(walletdb, TxnAbort())
+        .Times(1);
+    wallet.SetBestChain(walletdb, loc);
+
+    // WriteNoteWitnessHeight throws
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, -1))
+        .WillOnce(ThrowLogicError());
+    EXPECT_CALL(walletdb, TxnAbort())
+        .Times(1);
+    wallet.SetBestChain(walletdb, loc);
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, -1))
+        .WillRepeatedly(Return(true));
+
     // WriteWitnessCacheSize fails
     EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
         .WillOnce(Return(false));
@@ -965,6 +1232,13 @@ TEST(wallet_tests, WriteWitnessCache) {
 
     // Everything succeeds
     wallet.SetBestChain(walletdb, loc);
+
+    // Nothing changed since
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(::testing::_, ::testing::_))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
 }
 
 TEST(wallet_tests, UpdateNullifierNoteMap) {
@@ -1121,14 +1395,16 @@ TEST(wallet_tests, SetBestChainIgnoresTxsWithoutShieldedData) {
     CWalletTx wtxSproutTransparent {nullptr, mtx};
     wallet.AddToWallet(wtxSproutTransparent, true, nullptr);
 
+    // Only the witnesses of the Sprout notes are written, not the txs
+    wallet.ClearNoteWitnessCache();
     EXPECT_CALL(walletdb, TxnBegin())
         .WillOnce(Return(true));
-    EXPECT_CALL(walletdb, WriteTx(wtxTransparent.GetHash(), wtxTransparent))
-        .Times(0);
-    EXPECT_CALL(walletdb, WriteTx(wtxSprout.GetHash(), wtxSprout))
-        .Times(1).WillOnce(Return(true));
-    EXPECT_CALL(walletdb, WriteTx(wtxSproutTransparent.GetHash(), wtxSproutTransparent))
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
         .Times(0);
+    for (const mapNoteData_t::value_type& item : noteMap) {
+        EXPECT_CALL(walletdb, WriteNoteWitnessHeight(item.first, -1))
+            .WillOnce(Return(true));
+    }
     EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
         .WillOnce(Return(true));
     EXPECT_CALL(walletdb, WriteBestBlock(loc))
@@ -185,6 +185,34 @@ TEST(wallet_zkeys_tests, write_zkey_direct_to_db) {
     ASSERT_EQ(m.nCreateTime, now);
 }
 
+/**
+ * This test covers the serialization of CKeyMetadata with and without
+ * a birth height
+ */
+TEST(wallet_zkeys_tests, KeyMetadataBirthHeight) {
+    CKeyMetadata meta(1500000000);
+    EXPECT_EQ(-1, meta.nBirthHeight);
+    meta.nBirthHeight = 300000;
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << meta;
+    CKeyMetadata metaOut;
+    ss >> metaOut;
+    EXPECT_EQ(CKeyMetadata::CURRENT_VERSION, metaOut.nVersion);
+    EXPECT_EQ(1500000000, metaOut.nCreateTime);
+    EXPECT_EQ(300000, metaOut.nBirthHeight);
+
+    // Metadata written before birth heights has none
+    meta.nVersion = CKeyMetadata::VERSION_BASIC;
+    ss << meta;
+    EXPECT_EQ(sizeof(int) + sizeof(int64_t), ss.size());
+    CKeyMetadata metaBasic;
+    ss >> metaBasic;
+    EXPECT_EQ(CKeyMetadata::VERSION_BASIC, metaBasic.nVersion);
+    EXPECT_EQ(1500000000, metaBasic.nCreateTime);
+    EXPECT_EQ(-1, metaBasic.nBirthHeight);
+}
+
 /**
  * This test covers methods on CWalletDB
  * WriteViewingKey()
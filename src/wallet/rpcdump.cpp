@@ -73,19 +73,66 @@ std::string DecodeDumpString(const std::string &str) {
     return ret.str();
 }
 
+/**
+ * Metadata of a key imported with the height of the first block which may pay to it,
+ * created at the time of that block so that rescans start there
+ */
+static CKeyMetadata BirthHeightMetadata(int nBirthHeight)
+{
+    CKeyMetadata meta(chainActive[nBirthHeight]->GetBlockTime());
+    meta.nBirthHeight = nBirthHeight;
+    return meta;
+}
+
+static int ParseBirthHeight(const UniValue& value)
+{
+    int nBirthHeight = value.get_int();
+    if (nBirthHeight < 0 || nBirthHeight > chainActive.Height())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+    return nBirthHeight;
+}
+
+/** The birth height of a key in a dump, after its time, if it is known */
+static std::string EncodeDumpBirthHeight(const CKeyMetadata& meta)
+{
+    if (meta.nBirthHeight < 0)
+        return "";
+    return strprintf(" birthheight=%d", meta.nBirthHeight);
+}
+
+/**
+ * The metadata of a key from its line in a dump: the time, or the time of the block
+ * at its birth height if there is one in the active chain
+ */
+static CKeyMetadata DecodeDumpMetadata(const std::vector<std::string>& vstr)
+{
+    for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
+        if (boost::algorithm::starts_with(vstr[nStr], "#"))
+            break;
+        if (boost::algorithm::starts_with(vstr[nStr], "birthheight=")) {
+            int32_t nBirthHeight;
+            if (ParseInt32(vstr[nStr].substr(12), &nBirthHeight) && nBirthHeight >= 0 && nBirthHeight <= chainActive.Height())
+                return BirthHeightMetadata(nBirthHeight);
+        }
+    }
+    return CKeyMetadata(DecodeDumpTime(vstr[1]));
+}
+
 UniValue importprivkey(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() < 1 || params.size() > 3)
+    if (fHelp || params.size() < 1 || params.size() > 4)
         throw runtime_error(
-            "importprivkey \"horizenprivkey\" ( \"label\" rescan )\n"
+            "importprivkey \"horizenprivkey\" ( \"label\" rescan birthHeight )\n"
             "\nAdds a private key (as returned by dumpprivkey) to your wallet.\n"
             "\nArguments:\n"
             "1. \"horizenprivkey\"   (string, required) The private key (see dumpprivkey)\n"
             "2. \"label\"            (string, optional, default=\"\") An optional label\n"
             "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions\n"
+            "4. birthHeight          (numeric, optional) Height of the first block which may pay to the key, recorded with it;\n"
+            "                        the rescan starts there instead of at the genesis block\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
             "\nDump a private key\n"
@@ -94,57 +141,78 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
             + HelpExampleCli("importprivkey", "\"mykey\"") +
             "\nImport using a label and without rescan\n"
             + HelpExampleCli("importprivkey", "\"mykey\" \"testing\" false") +
+            "\nImport a key first paid to at block 300000, rescanning from there\n"
+            + HelpExampleCli("importprivkey", "\"mykey\" \"testing\" true 300000") +
             "\nAs a JSON-RPC call\n"
             + HelpExampleRpc("importprivkey", "\"mykey\", \"testing\", false")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CKeyID vchAddress;
+    CBlockIndex* pindexRescan = NULL;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+        EnsureWalletIsUnlocked();
 
-    string strSecret = params[0].get_str();
-    string strLabel = "";
-    if (params.size() > 1)
-        strLabel = params[1].get_str();
+        string strSecret = params[0].get_str();
+        string strLabel = "";
+        if (params.size() > 1)
+            strLabel = params[1].get_str();
 
-    // Whether to perform rescan after import
-    bool fRescan = true;
-    if (params.size() > 2)
-        fRescan = params[2].get_bool();
+        // Whether to perform rescan after import
+        bool fRescan = true;
+        if (params.size() > 2)
+            fRescan = params[2].get_bool();
 
-    CBitcoinSecret vchSecret;
-    bool fGood = vchSecret.SetString(strSecret);
+        // Height of the first block which may pay to the key
+        int nBirthHeight = 0;
+        bool fBirthHeight = params.size() > 3;
+        if (fBirthHeight)
+            nBirthHeight = ParseBirthHeight(params[3]);
 
-    if (!fGood) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
+        CBitcoinSecret vchSecret;
+        bool fGood = vchSecret.SetString(strSecret);
 
-    CKey key = vchSecret.GetKey();
-    if (!key.IsValid()) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Private key outside allowed range");
+        if (!fGood) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
 
-    CPubKey pubkey = key.GetPubKey();
-    assert(key.VerifyPubKey(pubkey));
-    CKeyID vchAddress = pubkey.GetID();
-    {
-        pwalletMain->MarkDirty();
-        pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
+        CKey key = vchSecret.GetKey();
+        if (!key.IsValid()) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Private key outside allowed range");
 
-        // Don't throw error in case a key is already there
-        if (pwalletMain->HaveKey(vchAddress)) {
-            return CBitcoinAddress(vchAddress).ToString();
-        }
+        CPubKey pubkey = key.GetPubKey();
+        assert(key.VerifyPubKey(pubkey));
+        vchAddress = pubkey.GetID();
+        {
+            pwalletMain->MarkDirty();
+            pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
+
+            // Don't throw error in case a key is already there
+            if (pwalletMain->HaveKey(vchAddress)) {
+                return CBitcoinAddress(vchAddress).ToString();
+            }
 
-        pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = 1;
+            if (fBirthHeight)
+                pwalletMain->mapKeyMetadata[vchAddress] = BirthHeightMetadata(nBirthHeight);
+            else
+                pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = 1;
 
-        if (!pwalletMain->AddKeyPubKey(key, pubkey))
-            throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
+            if (!pwalletMain->AddKeyPubKey(key, pubkey))
+                throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
 
-        // whenever a key is imported, we need to scan the whole chain
-        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+            // whenever a key is imported without its birth, we need to scan the whole chain
+            const int64_t nCreateTime = pwalletMain->mapKeyMetadata[vchAddress].nCreateTime;
+            if (!pwalletMain->nTimeFirstKey || nCreateTime < pwalletMain->nTimeFirstKey)
+                pwalletMain->nTimeFirstKey = nCreateTime; // 0 would be considered 'no value'
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+            if (fRescan) {
+                pindexRescan = chainActive[nBirthHeight];
+            }
         }
     }
 
+    // The rescan takes the locks itself, releasing cs_main between its batches of blocks
+    if (pindexRescan)
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+
     return CBitcoinAddress(vchAddress).ToString();
 }
 
@@ -171,53 +239,61 @@ UniValue importaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("importaddress", "\"myaddress\", \"testing\", false")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexRescan = NULL;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    CScript script;
+        CScript script;
 
-    CBitcoinAddress address(params[0].get_str());
-    if (address.IsValid()) {
-        script = GetScriptForDestination(address.Get(), false);
-    } else if (IsHex(params[0].get_str())) {
-        std::vector<unsigned char> data(ParseHex(params[0].get_str()));
-        script = CScript(data.begin(), data.end());
-    } else {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Horizen address or script");
-    }
+        CBitcoinAddress address(params[0].get_str());
+        if (address.IsValid()) {
+            script = GetScriptForDestination(address.Get(), false);
+        } else if (IsHex(params[0].get_str())) {
+            std::vector<unsigned char> data(ParseHex(params[0].get_str()));
+            script = CScript(data.begin(), data.end());
+        } else {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Horizen address or script");
+        }
 
-    string strLabel = "";
-    if (params.size() > 1)
-        strLabel = params[1].get_str();
+        string strLabel = "";
+        if (params.size() > 1)
+            strLabel = params[1].get_str();
 
-    // Whether to perform rescan after import
-    bool fRescan = true;
-    if (params.size() > 2)
-        fRescan = params[2].get_bool();
+        // Whether to perform rescan after import
+        bool fRescan = true;
+        if (params.size() > 2)
+            fRescan = params[2].get_bool();
 
-    {
-        if (::IsMine(*pwalletMain, script) == ISMINE_SPENDABLE)
-            throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this address or script");
+        {
+            if (::IsMine(*pwalletMain, script) == ISMINE_SPENDABLE)
+                throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this address or script");
 
-        // add to address book or update label
-        if (address.IsValid())
-            pwalletMain->SetAddressBook(address.Get(), strLabel, "receive");
+            // add to address book or update label
+            if (address.IsValid())
+                pwalletMain->SetAddressBook(address.Get(), strLabel, "receive");
 
-        // Don't throw error in case an address is already there
-        if (pwalletMain->HaveWatchOnly(script))
-            return NullUniValue;
+            // Don't throw error in case an address is already there
+            if (pwalletMain->HaveWatchOnly(script))
+                return NullUniValue;
 
-        pwalletMain->MarkDirty();
+            pwalletMain->MarkDirty();
 
-        if (!pwalletMain->AddWatchOnly(script))
-            throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
+            if (!pwalletMain->AddWatchOnly(script))
+                throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
 
-        if (fRescan)
-        {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-            pwalletMain->ReacceptWalletTransactions();
+            if (fRescan)
+            {
+                pindexRescan = chainActive.Genesis();
+            }
         }
     }
 
+    // The rescan takes the locks itself, releasing cs_main between its batches of blocks
+    if (pindexRescan) {
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+        pwalletMain->ReacceptWalletTransactions();
+    }
+
     return NullUniValue;
 }
 
@@ -308,15 +384,15 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
                     LogPrint("zrpc", "Skipping import of zaddr %s (key already present)\n", CZCPaymentAddress(addr).ToString());
                     continue;
                 }
-                int64_t nTime = DecodeDumpTime(vstr[1]);
+                CKeyMetadata meta = DecodeDumpMetadata(vstr);
                 LogPrint("zrpc", "Importing zaddr %s...\n", CZCPaymentAddress(addr).ToString());
+                pwalletMain->mapZKeyMetadata[addr] = meta;
                 if (!pwalletMain->AddZKey(key)) {
                     // Something went wrong
                     fGood = false;
                     continue;
                 }
-                // Successfully imported zaddr.  Now import the metadata.
-                pwalletMain->mapZKeyMetadata[addr].nCreateTime = nTime;
+                nTimeBegin = std::min(nTimeBegin, meta.nCreateTime);
                 continue;
             }
             catch (const std::runtime_error &e) {
@@ -336,7 +412,7 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
             LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
             continue;
         }
-        int64_t nTime = DecodeDumpTime(vstr[1]);
+        CKeyMetadata meta = DecodeDumpMetadata(vstr);
         std::string strLabel;
         bool fLabel = true;
         for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
@@ -352,14 +428,14 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
             }
         }
         LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
+        pwalletMain->mapKeyMetadata[keyid] = meta;
         if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
             fGood = false;
             continue;
         }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
         if (fLabel)
             pwalletMain->SetAddressBook(keyid, strLabel, "receive");
-        nTimeBegin = std::min(nTimeBegin, nTime);
+        nTimeBegin = std::min(nTimeBegin, meta.nCreateTime);
     }
     file.close();
     pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
@@ -514,7 +590,7 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
     file << "\n";
     for (std::vector<std::pair<int64_t, CKeyID> >::const_iterator it = vKeyBirth.begin(); it != vKeyBirth.end(); it++) {
         const CKeyID &keyid = it->second;
-        std::string strTime = EncodeDumpTime(it->first);
+        std::string strTime = EncodeDumpTime(it->first) + EncodeDumpBirthHeight(pwalletMain->mapKeyMetadata[keyid]);
         std::string strAddr = CBitcoinAddress(keyid).ToString();
         CKey key;
         if (pwalletMain->GetKey(keyid, key)) {
@@ -538,7 +614,8 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
         for (auto addr : addresses ) {
             libzcash::SpendingKey key;
             if (pwalletMain->GetSpendingKey(addr, key)) {
-                std::string strTime = EncodeDumpTime(pwalletMain->mapZKeyMetadata[addr].nCreateTime);
+                const CKeyMetadata& meta = pwalletMain->mapZKeyMetadata[addr];
+                std::string strTime = EncodeDumpTime(meta.nCreateTime) + EncodeDumpBirthHeight(meta);
                 file << strprintf("%s %s # zaddr=%s\n", CZCSpendingKey(key).ToString(), strTime, CZCPaymentAddress(addr).ToString());
             }
         }
@@ -564,7 +641,8 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
             "\nArguments:\n"
             "1. \"zkey\"             (string, required) The zkey (see z_exportkey)\n"
             "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
-            "3. startHeight        (numeric, optional, default=0) Block height to start rescan from\n"
+            "3. startHeight        (numeric, optional, default=0) Block height to start rescan from, recorded as the birth\n"
+            "                      height of the key if it is new\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
             "\nExport a zkey\n"
@@ -579,72 +657,82 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_importkey", "\"mykey\", \"no\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
-    // Whether to perform rescan after import
-    bool fRescan = true;
-    bool fIgnoreExistingKey = true;
-    if (params.size() > 1) {
-        auto rescan = params[1].get_str();
-        if (rescan.compare("whenkeyisnew") != 0) {
-            fIgnoreExistingKey = false;
-            if (rescan.compare("yes") == 0) {
-                fRescan = true;
-            } else if (rescan.compare("no") == 0) {
-                fRescan = false;
-            } else {
-                // Handle older API
-                UniValue jVal;
-                if (!jVal.read(std::string("[")+rescan+std::string("]")) ||
-                    !jVal.isArray() || jVal.size()!=1 || !jVal[0].isBool()) {
-                    throw JSONRPCError(
-                        RPC_INVALID_PARAMETER,
-                        "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+    CBlockIndex* pindexRescan = NULL;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
+        // Whether to perform rescan after import
+        bool fRescan = true;
+        bool fIgnoreExistingKey = true;
+        if (params.size() > 1) {
+            auto rescan = params[1].get_str();
+            if (rescan.compare("whenkeyisnew") != 0) {
+                fIgnoreExistingKey = false;
+                if (rescan.compare("yes") == 0) {
+                    fRescan = true;
+                } else if (rescan.compare("no") == 0) {
+                    fRescan = false;
+                } else {
+                    // Handle older API
+                    UniValue jVal;
+                    if (!jVal.read(std::string("[")+rescan+std::string("]")) ||
+                        !jVal.isArray() || jVal.size()!=1 || !jVal[0].isBool()) {
+                        throw JSONRPCError(
+                            RPC_INVALID_PARAMETER,
+                            "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+                    }
+                    fRescan = jVal[0].getBool();
                 }
-                fRescan = jVal[0].getBool();
             }
         }
-    }
 
-    // Height to rescan from
-    int nRescanHeight = 0;
-    if (params.size() > 2)
-        nRescanHeight = params[2].get_int();
-    if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
-    }
+        // Height to rescan from, and birth height of a new key
+        int nRescanHeight = 0;
+        bool fBirthHeight = params.size() > 2;
+        if (fBirthHeight)
+            nRescanHeight = ParseBirthHeight(params[2]);
 
-    string strSecret = params[0].get_str();
-    CZCSpendingKey spendingkey(strSecret);
-    auto key = spendingkey.Get();
-    auto addr = key.address();
+        string strSecret = params[0].get_str();
+        CZCSpendingKey spendingkey(strSecret);
+        auto key = spendingkey.Get();
+        auto addr = key.address();
 
-    {
-        // Don't throw error in case a key is already there
-        if (pwalletMain->HaveSpendingKey(addr)) {
-            if (fIgnoreExistingKey) {
-                return NullUniValue;
-            }
-        } else {
-            pwalletMain->MarkDirty();
+        {
+            // Don't throw error in case a key is already there
+            if (pwalletMain->HaveSpendingKey(addr)) {
+                if (fIgnoreExistingKey) {
+                    return NullUniValue;
+                }
+            } else {
+                pwalletMain->MarkDirty();
 
-            if (!pwalletMain-> AddZKey(key))
-                throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
+                if (fBirthHeight)
+                    pwalletMain->mapZKeyMetadata[addr] = BirthHeightMetadata(nRescanHeight);
+                else
+                    pwalletMain->mapZKeyMetadata[addr].nCreateTime = 1;
 
-            pwalletMain->mapZKeyMetadata[addr].nCreateTime = 1;
-        }
+                if (!pwalletMain-> AddZKey(key))
+                    throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
+            }
 
-        // whenever a key is imported, we need to scan the whole chain
-        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+            // whenever a key is imported without its birth, we need to scan the whole chain
+            const int64_t nCreateTime = pwalletMain->mapZKeyMetadata[addr].nCreateTime;
+            if (!pwalletMain->nTimeFirstKey || nCreateTime < pwalletMain->nTimeFirstKey)
+                pwalletMain->nTimeFirstKey = std::max(nCreateTime, (int64_t)1); // 0 would be considered 'no value'
 
-        // We want to scan for transactions and notes
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+            // We want to scan for transactions and notes
+            if (fRescan) {
+                pindexRescan = chainActive[nRescanHeight];
+            }
         }
     }
 
+    // The rescan takes the locks itself, releasing cs_main between its batches of blocks
+    if (pindexRescan)
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+
     return NullUniValue;
 }
 
@@ -675,65 +763,72 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_importviewingkey", "\"vkey\", \"no\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
-    // Whether to perform rescan after import
-    bool fRescan = true;
-    bool fIgnoreExistingKey = true;
-    if (params.size() > 1) {
-        auto rescan = params[1].get_str();
-        if (rescan.compare("whenkeyisnew") != 0) {
-            fIgnoreExistingKey = false;
-            if (rescan.compare("no") == 0) {
-                fRescan = false;
-            } else if (rescan.compare("yes") != 0) {
-                throw JSONRPCError(
-                    RPC_INVALID_PARAMETER,
-                    "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+    CBlockIndex* pindexRescan = NULL;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
+        // Whether to perform rescan after import
+        bool fRescan = true;
+        bool fIgnoreExistingKey = true;
+        if (params.size() > 1) {
+            auto rescan = params[1].get_str();
+            if (rescan.compare("whenkeyisnew") != 0) {
+                fIgnoreExistingKey = false;
+                if (rescan.compare("no") == 0) {
+                    fRescan = false;
+                } else if (rescan.compare("yes") != 0) {
+                    throw JSONRPCError(
+                        RPC_INVALID_PARAMETER,
+                        "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+                }
             }
         }
-    }
-
-    // Height to rescan from
-    int nRescanHeight = 0;
-    if (params.size() > 2) {
-        nRescanHeight = params[2].get_int();
-    }
-    if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
-    }
 
-    string strVKey = params[0].get_str();
-    CZCViewingKey viewingkey(strVKey);
-    auto vkey = viewingkey.Get();
-    auto addr = vkey.address();
-
-    {
-        if (pwalletMain->HaveSpendingKey(addr)) {
-            throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this viewing key");
+        // Height to rescan from
+        int nRescanHeight = 0;
+        if (params.size() > 2) {
+            nRescanHeight = params[2].get_int();
+        }
+        if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
         }
 
-        // Don't throw error in case a viewing key is already there
-        if (pwalletMain->HaveViewingKey(addr)) {
-            if (fIgnoreExistingKey) {
-                return NullUniValue;
+        string strVKey = params[0].get_str();
+        CZCViewingKey viewingkey(strVKey);
+        auto vkey = viewingkey.Get();
+        auto addr = vkey.address();
+
+        {
+            if (pwalletMain->HaveSpendingKey(addr)) {
+                throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this viewing key");
             }
-        } else {
-            pwalletMain->MarkDirty();
 
-            if (!pwalletMain->AddViewingKey(vkey)) {
-                throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
+            // Don't throw error in case a viewing key is already there
+            if (pwalletMain->HaveViewingKey(addr)) {
+                if (fIgnoreExistingKey) {
+                    return NullUniValue;
+                }
+            } else {
+                pwalletMain->MarkDirty();
+
+                if (!pwalletMain->AddViewingKey(vkey)) {
+                    throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
+                }
             }
-        }
 
-        // We want to scan for transactions and notes
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+            // We want to scan for transactions and notes
+            if (fRescan) {
+                pindexRescan = chainActive[nRescanHeight];
+            }
         }
     }
 
+    // The rescan takes the locks itself, releasing cs_main between its batches of blocks
+    if (pindexRescan)
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+
     return NullUniValue;
 }
 
@@ -8,8 +8,10 @@
 #include "core_io.h"
 #include "init.h"
 #include "main.h"
+#include "metrics.h"
 #include "net.h"
 #include "netbase.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "timedata.h"
 #include "util.h"
@@ -73,9 +75,30 @@ void EnsureWalletIsUnlocked()
         throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Error: Please enter the wallet passphrase with walletpassphrase first.");
 }
 
+/**
+ * Run a read-only query of the wallet under cs_wallet alone, with the depths taken against
+ * the published chain tip, so it neither waits for nor holds up the processing of blocks
+ * and transactions on cs_main. The query is run again under both locks if it needed a
+ * block which could not be looked up without cs_main.
+ */
+template <typename Query>
+static UniValue RunWalletReadQuery(Query query)
+{
+    {
+        CWalletReadView view;
+        LOCK(pwalletMain->cs_wallet);
+        UniValue ret = query();
+        if (view.IsComplete())
+            return ret;
+    }
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    return query();
+}
+
 void WalletTxToJSON(const CWalletTx& wtx, UniValue& entry)
 {
-    int confirms = wtx.GetDepthInMainChain();
+    const CBlockIndex* pindex = NULL;
+    int confirms = wtx.GetDepthInMainChain(pindex);
     entry.pushKV("confirmations", confirms);
     if (wtx.IsCoinBase())
         entry.pushKV("generated", true);
@@ -83,7 +106,7 @@ void WalletTxToJSON(const CWalletTx& wtx, UniValue& entry)
     {
         entry.pushKV("blockhash", wtx.hashBlock.GetHex());
         entry.pushKV("blockindex", wtx.nIndex);
-        entry.pushKV("blocktime", mapBlockIndex[wtx.hashBlock]->GetBlockTime());
+        entry.pushKV("blocktime", pindex->GetBlockTime());
     }
     uint256 hash = wtx.GetHash();
     entry.pushKV("txid", hash.GetHex());
@@ -1451,9 +1474,9 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() > 5)
+    if (fHelp || params.size() > 6)
         throw runtime_error(
-            "listtransactions ( \"account\" count from includeWatchonly)\n"
+            "listtransactions ( \"account\" count from includeWatchonly \"address\" \"beforetxid\")\n"
             "\nReturns up to 'count' most recent transactions skipping the first 'from' transactions for address 'address'.\n"
             "\nArguments:\n"
             "1. \"account\"    (string, optional) DEPRECATED. The account name. Should be \"*\".\n"
@@ -1461,6 +1484,8 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
             "3. from           (numeric, optional, default=0) The number of transactions to skip\n"
             "4. includeWatchonly (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')\n"
             "5. address (string, optional) Include only transactions involving this address\n"
+            "6. \"beforetxid\"  (string, optional) Only list the transactions before this one, the oldest transaction listed\n"
+            "                 by the previous page. A page listed so ends on a whole transaction, which can take it over count\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -1501,12 +1526,12 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
             + HelpExampleCli("listtransactions", "") +
             "\nList transactions 100 to 120\n"
             + HelpExampleCli("listtransactions", "\"*\" 20 100") +
+            "\nList the 20 transactions before the one with txid \"mytxid\"\n"
+            + HelpExampleCli("listtransactions", "\"*\" 20 0 false \"*\" \"mytxid\"") +
             "\nAs a json rpc call\n"
             + HelpExampleRpc("listtransactions", "\"*\", 20, 100")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     string strAccount("*");
     if (params.size() > 0)
         strAccount=params[0].get_str();
@@ -1540,56 +1565,66 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
                 scriptPubKey = GetScriptForDestination(baddress.Get(), false);
         }
     }
-
-
-    UniValue ret(UniValue::VARR);
-    const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
-    // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
-    {
-        CWalletTx *const pwtx = (*it).second.first;
-        if (pwtx != nullptr){
-            if(baddress.IsValid()) {
-                for(const CTxOut& txout : pwtx->vout) {
-                    auto res = std::search(txout.scriptPubKey.begin(), txout.scriptPubKey.end(), scriptPubKey.begin(), scriptPubKey.end());
-                    if (res == txout.scriptPubKey.begin()) {
-                        ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-                        break;
+    uint256 txidBefore;
+    if (params.size() > 5)
+        txidBefore = ParseHashV(params[5], "beforetxid");
+
+    return RunWalletReadQuery([&]() -> UniValue {
+        UniValue ret(UniValue::VARR);
+        const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
+        CWallet::TxItems::const_reverse_iterator itStart = txOrdered.rbegin();
+        if (!txidBefore.IsNull()) {
+            std::map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(txidBefore);
+            if (mi == pwalletMain->mapWallet.end())
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
+            itStart = CWallet::TxItems::const_reverse_iterator(txOrdered.lower_bound(mi->second.nOrderPos));
+        }
+        // iterate backwards until we have nCount items to return:
+        for (CWallet::TxItems::const_reverse_iterator it = itStart; it != txOrdered.rend(); ++it)
+        {
+            CWalletTx *const pwtx = (*it).second.first;
+            if (pwtx != nullptr){
+                if(baddress.IsValid()) {
+                    for(const CTxOut& txout : pwtx->vout) {
+                        auto res = std::search(txout.scriptPubKey.begin(), txout.scriptPubKey.end(), scriptPubKey.begin(), scriptPubKey.end());
+                        if (res == txout.scriptPubKey.begin()) {
+                            ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+                            break;
+                        }
                     }
                 }
+                else {
+                    ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+                }
             }
-            else {
-                ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-            }
-        }
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != nullptr)
-            AcentryToJSON(*pacentry, strAccount, ret);
+            CAccountingEntry *const pacentry = (*it).second.second;
+            if (pacentry != nullptr)
+                AcentryToJSON(*pacentry, strAccount, ret);
 
-        if ((int)ret.size() >= (nCount+nFrom)) break;
-    }
+            if ((int)ret.size() >= (nCount+nFrom)) break;
+        }
 
-    //getting all the specific Txes requested by nCount and nFrom
-    if (nFrom > (int)ret.size())
-        nFrom = ret.size();
-    if ((nFrom + nCount) > (int)ret.size())
-        nCount = ret.size() - nFrom;
+        //getting all the specific Txes requested by nCount and nFrom
+        const int nFromRet = std::min(nFrom, (int)ret.size());
+        // a page before a transaction keeps all the entries of its oldest one
+        const int nCountRet = txidBefore.IsNull() ? std::min(nCount, (int)ret.size() - nFromRet) : (int)ret.size() - nFromRet;
 
-    vector<UniValue> arrTmp = ret.getValues();
-    vector<UniValue>::iterator first = arrTmp.begin();
-    std::advance(first, nFrom);
-    vector<UniValue>::iterator last = arrTmp.begin();
-    std::advance(last, nFrom+nCount);
+        vector<UniValue> arrTmp = ret.getValues();
+        vector<UniValue>::iterator first = arrTmp.begin();
+        std::advance(first, nFromRet);
+        vector<UniValue>::iterator last = arrTmp.begin();
+        std::advance(last, nFromRet+nCountRet);
 
-    if (last != arrTmp.end()) arrTmp.erase(last, arrTmp.end());
-    if (first != arrTmp.begin()) arrTmp.erase(arrTmp.begin(), first);
+        if (last != arrTmp.end()) arrTmp.erase(last, arrTmp.end());
+        if (first != arrTmp.begin()) arrTmp.erase(arrTmp.begin(), first);
 
-    std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
+        std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
 
-    ret.clear();
-    ret.setArray();
-    ret.push_backV(arrTmp);
-    return ret;
+        ret.clear();
+        ret.setArray();
+        ret.push_backV(arrTmp);
+        return ret;
+    });
 }
 
 UniValue listaccounts(const UniValue& params, bool fHelp)
@@ -1814,8 +1849,6 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
             + HelpExampleRpc("gettransaction", "\"1075db55d416d3ca199f55b6084e2115b9345e16c5cf302fc80e9d5fbf5d48d\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     uint256 hash;
     hash.SetHex(params[0].get_str());
 
@@ -1824,30 +1857,32 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
         if(params[1].get_bool())
             filter = filter | ISMINE_WATCH_ONLY;
 
-    UniValue entry(UniValue::VOBJ);
-    if (!pwalletMain->mapWallet.count(hash))
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    return RunWalletReadQuery([&]() -> UniValue {
+        UniValue entry(UniValue::VOBJ);
+        if (!pwalletMain->mapWallet.count(hash))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
+        const CWalletTx& wtx = pwalletMain->mapWallet[hash];
 
-    CAmount nCredit = wtx.GetCredit(filter);
-    CAmount nDebit = wtx.GetDebit(filter);
-    CAmount nNet = nCredit - nDebit;
-    CAmount nFee = (wtx.IsFromMe(filter) ? wtx.GetValueOut() - nDebit : 0);
+        CAmount nCredit = wtx.GetCredit(filter);
+        CAmount nDebit = wtx.GetDebit(filter);
+        CAmount nNet = nCredit - nDebit;
+        CAmount nFee = (wtx.IsFromMe(filter) ? wtx.GetValueOut() - nDebit : 0);
 
-    entry.pushKV("amount", ValueFromAmount(nNet - nFee));
-    if (wtx.IsFromMe(filter))
-        entry.pushKV("fee", ValueFromAmount(nFee));
+        entry.pushKV("amount", ValueFromAmount(nNet - nFee));
+        if (wtx.IsFromMe(filter))
+            entry.pushKV("fee", ValueFromAmount(nFee));
 
-    WalletTxToJSON(wtx, entry);
+        WalletTxToJSON(wtx, entry);
 
-    UniValue details(UniValue::VARR);
-    ListTransactions(wtx, "*", 0, false, details, filter);
-    entry.pushKV("details", details);
+        UniValue details(UniValue::VARR);
+        ListTransactions(wtx, "*", 0, false, details, filter);
+        entry.pushKV("details", details);
 
-    string strHex = EncodeHexTx(static_cast<CTransaction>(wtx));
-    entry.pushKV("hex", strHex);
+        string strHex = EncodeHexTx(static_cast<CTransaction>(wtx));
+        entry.pushKV("hex", strHex);
 
-    return entry;
+        return entry;
+    });
 }
 
 
@@ -2382,8 +2417,15 @@ UniValue resendwallettransactions(const UniValue& params, bool fHelp)
 
 UniValue listunspent(const UniValue& params, bool fHelp)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
-        return NullUniValue;
+    return RPCWriteToUniValue(&listunspent, params, fHelp);
+}
+
+void listunspent(const UniValue& params, bool fHelp, JSONWriter& writer)
+{
+    if (!EnsureWalletIsAvailable(fHelp)) {
+        writer.push_back(NullUniValue);
+        return;
+    }
 
     if (fHelp || params.size() > 3)
         throw runtime_error(
@@ -2446,7 +2488,7 @@ UniValue listunspent(const UniValue& params, bool fHelp)
         }
     }
 
-    UniValue results(UniValue::VARR);
+    writer.beginArray();
     vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
     LOCK2(cs_main, pwalletMain->cs_wallet);
@@ -2489,10 +2531,9 @@ UniValue listunspent(const UniValue& params, bool fHelp)
         entry.pushKV("amount",ValueFromAmount(nValue));
         entry.pushKV("confirmations",out.nDepth);
         entry.pushKV("spendable", out.fSpendable);
-        results.push_back(entry);
+        writer.push_back(entry);
     }
-
-    return results;
+    writer.endArray();
 }
 
 UniValue fundrawtransaction(const UniValue& params, bool fHelp)
@@ -2596,11 +2637,49 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             "zcbenchmark benchmarktype samplecount\n"
             "\n"
             "Runs a benchmark of the selected type samplecount times,\n"
-            "returning the running times of each sample.\n"
+            "returning the running times of each sample, and the time in\n"
+            "microseconds its JoinSplit proofs and verifications spent in each\n"
+            "phase of getsnarkmetrics if they ran.\n"
+            "\n"
+            "zcbenchmark mempoolstress samplecount ntxs ( njoinsplits threads ), in\n"
+            "regtest, accepts ntxs transactions in chains and njoinsplits shielding\n"
+            "transactions to the mempool on threads threads while a block is mined\n"
+            "each second, and returns the acceptance of each sample in \"mempool\".\n"
+            "The wallet funds them from its mature coinbases.\n"
+            "\n"
+            "zcbenchmark walletscale samplecount ntxs nnotes naddrs ( witnesses ), in\n"
+            "regtest, loads a wallet of ntxs transparent transactions and nnotes\n"
+            "notes across naddrs z-addresses with witness caches witnesses blocks\n"
+            "deep (default 100), and returns the times of its operations in\n"
+            "\"wallet\". The wallet is written to the datadir once for each chain tip.\n"
             "\n"
             "Output: [\n"
             "  {\n"
-            "    \"runningtime\": runningtime\n"
+            "    \"runningtime\": runningtime,\n"
+            "    \"phases\": { \"phase\": microseconds, ... },\n"
+            "    \"mempool\": {\n"
+            "      \"accepted\": n,          (numeric) The transactions accepted\n"
+            "      \"rejected\": n,          (numeric) The transactions rejected\n"
+            "      \"acceptspersecond\": n,  (numeric) The transactions accepted per second of runningtime\n"
+            "      \"lockwait\": n,          (numeric) The microseconds the threads waited for cs_main\n"
+            "      \"meanlockwait\": n,      (numeric) The microseconds waited for cs_main per transaction\n"
+            "      \"blocks\": n,            (numeric) The blocks mined meanwhile\n"
+            "      \"mempoolusage\": n,      (numeric) The largest memory usage of the mempool, in bytes\n"
+            "      \"rss\": n,               (numeric) The resident memory of the node at the end, in kB\n"
+            "      \"peakrss\": n            (numeric) The largest resident memory of the node, in kB\n"
+            "    },\n"
+            "    \"wallet\": {\n"
+            "      \"transactions\": n,      (numeric) The transactions of the wallet\n"
+            "      \"notes\": n,             (numeric) The notes GetFilteredNotes found\n"
+            "      \"coins\": n,             (numeric) The outputs AvailableCoins found\n"
+            "      \"plannednotes\": n,      (numeric) The notes selected to send half the notes of an address\n"
+            "      \"load\": n,              (numeric) The seconds loading the wallet took\n"
+            "      \"getfilterednotes\": n,  (numeric) The seconds listing the notes of all the addresses took\n"
+            "      \"availablecoins\": n,    (numeric) The seconds listing the transparent outputs took\n"
+            "      \"sendmanyplan\": n,      (numeric) The seconds selecting the notes and their witnesses took\n"
+            "      \"rescan\": n,            (numeric) The seconds rescanning the active chain took\n"
+            "      \"incnotewitnesses\": n   (numeric) The seconds witnessing a block of new notes took\n"
+            "    }\n"
             "  },\n"
             "  {\n"
             "    \"runningtime\": runningtime\n"
@@ -2615,16 +2694,23 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
 
 
 
-    LOCK(cs_main);
-
     std::string benchmarktype = params[0].get_str();
     int samplecount = params[1].get_int();
 
+    // mempoolstress mines blocks on another thread while it runs, and walletscale rescans,
+    // so they take cs_main as they need it
+    std::unique_ptr<CCriticalBlock> lockMain;
+    if (benchmarktype != "mempoolstress" && benchmarktype != "walletscale")
+        lockMain.reset(new CCriticalBlock(cs_main, "cs_main", __FILE__, __LINE__));
+
     if (samplecount <= 0) {
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid samplecount");
     }
 
     std::vector<double> sample_times;
+    std::vector<UniValue> sample_phases;
+    std::vector<UniValue> sample_mempool;
+    std::vector<UniValue> sample_wallet;
 
     JSDescription samplejoinsplit = JSDescription::getNewInstance(shieldedTxVersion == GROTH_TX_VERSION);
 
@@ -2635,6 +2721,10 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
     }
 
     for (int i = 0; i < samplecount; i++) {
+        int64_t nPhaseTotals[SNARK_PHASES];
+        for (int j = 0; j < SNARK_PHASES; j++)
+            nPhaseTotals[j] = snarkPhaseLatency[j].getTotal();
+
         if (benchmarktype == "sleep") {
             sample_times.push_back(benchmark_sleep());
         } else if (benchmarktype == "parameterloading") {
@@ -2660,6 +2750,30 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
                 std::vector<double> vals = benchmark_solve_equihash_threaded(nThreads);
                 sample_times.insert(sample_times.end(), vals.begin(), vals.end());
             }
+        } else if (benchmarktype == "solveequihashparallel") {
+            int nThreads = params.size() < 3 ? GetNumCores() : params[2].get_int();
+            sample_times.push_back(benchmark_solve_equihash_parallel(nThreads));
+        } else if (benchmarktype == "mempoolstress") {
+            if (Params().NetworkIDString() != "regtest") {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
+            }
+            if (params.size() < 3) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "mempoolstress needs ntxs");
+            }
+            int nTxs = params[2].get_int();
+            int nJoinSplits = params.size() > 3 ? params[3].get_int() : 0;
+            int nThreads = params.size() > 4 ? params[4].get_int() : 1;
+            if (nTxs < 0 || nJoinSplits < 0 || nTxs + nJoinSplits == 0 || nThreads <= 0) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid ntxs, njoinsplits or threads");
+            }
+            UniValue stats(UniValue::VOBJ);
+            try {
+                sample_times.push_back(benchmark_mempool_stress(nTxs, nJoinSplits, nThreads, shieldedTxVersion, stats));
+            } catch (const std::runtime_error& e) {
+                throw JSONRPCError(RPC_WALLET_ERROR, e.what());
+            }
+            sample_mempool.resize(sample_times.size());
+            sample_mempool.back() = stats;
 #endif
         } else if (benchmarktype == "verifyequihash") {
             sample_times.push_back(benchmark_verify_equihash());
@@ -2689,15 +2803,57 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_loadwallet());
         } else if (benchmarktype == "listunspent") {
             sample_times.push_back(benchmark_listunspent());
+        } else if (benchmarktype == "walletscale") {
+            if (Params().NetworkIDString() != "regtest") {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
+            }
+            if (params.size() < 5) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "walletscale needs ntxs, nnotes and naddrs");
+            }
+            int nTxs = params[2].get_int();
+            int nNotes = params[3].get_int();
+            int nAddrs = params[4].get_int();
+            int nWitnesses = params.size() > 5 ? params[5].get_int() : WITNESS_CACHE_SIZE;
+            if (nTxs < 0 || nNotes < 0 || nAddrs <= 0) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid ntxs, nnotes or naddrs");
+            }
+            if (nWitnesses <= 0 || nWitnesses > (int)WITNESS_CACHE_SIZE || nWitnesses > chainActive.Height()) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("witnesses must be between 1 and %d, and at most the height of the chain", WITNESS_CACHE_SIZE));
+            }
+            UniValue stats(UniValue::VOBJ);
+            try {
+                sample_times.push_back(benchmark_wallet_scale(nTxs, nNotes, nAddrs, nWitnesses, stats));
+            } catch (const std::runtime_error& e) {
+                throw JSONRPCError(RPC_WALLET_ERROR, e.what());
+            }
+            sample_wallet.resize(sample_times.size());
+            sample_wallet.back() = stats;
         } else {
             throw JSONRPCError(RPC_TYPE_ERROR, "Invalid benchmarktype");
         }
+
+        // The samples of a threaded benchmark share the phases of their run
+        UniValue phases(UniValue::VOBJ);
+        for (int j = 0; j < SNARK_PHASES; j++) {
+            int64_t nMicros = snarkPhaseLatency[j].getTotal() - nPhaseTotals[j];
+            if (nMicros > 0)
+                phases.pushKV(SnarkPhaseName(SnarkPhase(j)), nMicros);
+        }
+        sample_phases.resize(sample_times.size(), phases);
+        sample_mempool.resize(sample_times.size());
+        sample_wallet.resize(sample_times.size());
     }
 
     UniValue results(UniValue::VARR);
-    for (auto time : sample_times) {
+    for (size_t i = 0; i < sample_times.size(); i++) {
         UniValue result(UniValue::VOBJ);
-        result.pushKV("runningtime", time);
+        result.pushKV("runningtime", sample_times[i]);
+        if (!sample_phases[i].empty())
+            result.pushKV("phases", sample_phases[i]);
+        if (!sample_mempool[i].isNull())
+            result.pushKV("mempool", sample_mempool[i]);
+        if (!sample_wallet[i].isNull())
+            result.pushKV("wallet", sample_wallet[i]);
         results.push_back(result);
     }
 
@@ -3134,14 +3290,18 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size()==0 || params.size() >2)
+    if (fHelp || params.size()==0 || params.size() >4)
         throw runtime_error(
-            "z_listreceivedbyaddress \"address\" ( minconf )\n"
+            "z_listreceivedbyaddress \"address\" ( minconf count \"beforetxid\" )\n"
             "\nReturn a list of amounts received by a zaddr belonging to the node’s wallet.\n"
             "\nArguments:\n"
             "1. \"address\"      (string) The private address.\n"
             "2. minconf          (numeric, optional, default=1) Only include transactions confirmed at least this many times.\n"
-            "\nResult:\n"
+            "3. count            (numeric, optional, default=all) The number of notes to return, those of the newest transactions.\n"
+            "                    A page ends on a whole transaction, which can take it over count.\n"
+            "4. \"beforetxid\"     (string, optional) Only return the notes of the transactions before this one, the oldest\n"
+            "                    transaction returned by the previous page.\n"
+            "\nResult (oldest first):\n"
             "{\n"
             "  \"txid\": xxxxx,     (string) the transaction id\n"
             "  \"amount\": xxxxx,   (numeric) the amount of value in the note\n"
@@ -3152,8 +3312,6 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_listreceivedbyaddress", "\"ztfaW34Gj9FrnGUEf833ywDVL62NWXBM81u6EQnM6VR45eYnXhwztecW1SjxA7JrmAXKJhxhj3vDNEpVCQoSvVoSpmbhtjf\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     int nMinDepth = 1;
     if (params.size() > 1) {
         nMinDepth = params[1].get_int();
@@ -3161,6 +3319,15 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
     if (nMinDepth < 0) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Minimum number of confirmations cannot be less than 0");
     }
+    int nCount = -1;
+    if (params.size() > 2) {
+        nCount = params[2].get_int();
+        if (nCount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    }
+    uint256 txidBefore;
+    if (params.size() > 3)
+        txidBefore = ParseHashV(params[3], "beforetxid");
 
     // Check that the from address is valid.
     auto fromaddress = params[0].get_str();
@@ -3173,23 +3340,25 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid zaddr.");
     }
 
-    if (!(pwalletMain->HaveSpendingKey(zaddr) || pwalletMain->HaveViewingKey(zaddr))) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "From address does not belong to this node, zaddr spending key or viewing key not found.");
-    }
-
+    return RunWalletReadQuery([&]() -> UniValue {
+        if (!(pwalletMain->HaveSpendingKey(zaddr) || pwalletMain->HaveViewingKey(zaddr))) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "From address does not belong to this node, zaddr spending key or viewing key not found.");
+        }
 
-    UniValue result(UniValue::VARR);
-    std::vector<CNotePlaintextEntry> entries;
-    pwalletMain->GetFilteredNotes(entries, fromaddress, nMinDepth, false, false);
-    for (CNotePlaintextEntry & entry : entries) {
-        UniValue obj(UniValue::VOBJ);
-        obj.pushKV("txid",entry.jsop.hash.ToString());
-        obj.pushKV("amount", ValueFromAmount(CAmount(entry.plaintext.value())));
-        std::string data(entry.plaintext.memo().begin(), entry.plaintext.memo().end());
-        obj.pushKV("memo", HexStr(data));
-        result.push_back(obj);
-    }
-    return result;
+        UniValue result(UniValue::VARR);
+        std::vector<CNotePlaintextEntry> entries;
+        if (!pwalletMain->GetReceivedNotesPage(entries, zaddr, nMinDepth, nCount, txidBefore))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
+        for (CNotePlaintextEntry & entry : entries) {
+            UniValue obj(UniValue::VOBJ);
+            obj.pushKV("txid",entry.jsop.hash.ToString());
+            obj.pushKV("amount", ValueFromAmount(CAmount(entry.plaintext.value())));
+            std::string data(entry.plaintext.memo().begin(), entry.plaintext.memo().end());
+            obj.pushKV("memo", HexStr(data));
+            result.push_back(obj);
+        }
+        return result;
+    });
 }
 
 
@@ -3633,7 +3802,8 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
     std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_sendmany(contextualTx, fromaddress, taddrRecipients, zaddrRecipients, nMinDepth, nFee, contextInfo, sendChangeToSource) );
-    q->addOperation(operation);
+    // Payments go ahead of the bulk shielding queued
+    q->addOperation(operation, OperationPriority::HIGH);
     AsyncRPCOperationId operationId = operation->getId();
     return operationId;
 }
@@ -3659,9 +3829,9 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() < 2 || params.size() > 4)
+    if (fHelp || params.size() < 2 || params.size() > 5)
         throw runtime_error(
-            "z_shieldcoinbase \"fromaddress\" \"tozaddress\" ( fee ) ( limit )\n"
+            "z_shieldcoinbase \"fromaddress\" \"tozaddress\" ( fee ) ( limit ) ( maxtxs )\n"
             "\nShield transparent coinbase funds by sending to a shielded zaddr.  This is an asynchronous operation and utxos"
             "\nselected for shielding will be locked.  If there is an error, they are unlocked.  The RPC call `listlockunspent`"
             "\ncan be used to return a list of locked utxos.  The number of coinbase utxos selected for shielding can be limited"
@@ -3676,6 +3846,9 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
             + strprintf("%s", FormatMoney(SHIELD_COINBASE_DEFAULT_MINERS_FEE)) + ") The fee amount to attach to this transaction.\n"
             "4. limit                 (numeric, optional, default="
             + strprintf("%d", SHIELD_COINBASE_DEFAULT_LIMIT) + ") Limit on the maximum number of utxos to shield.  Set to 0 to use node option -mempooltxinputlimit.\n"
+            "5. maxtxs                (numeric, optional, default=1) Shield in bulk, in up to this many transactions of up to limit utxos,\n"
+            "                         each paying the fee.  Their proofs are generated in parallel, and z_getoperationstatus shows the\n"
+            "                         progress of each one.\n"
             "\nResult:\n"
             "{\n"
             "  \"operationid\": xxx          (string) An operationid to pass to z_getoperationstatus to get the result of the operation.\n"
@@ -3683,6 +3856,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
             "  \"shieldedValue\": xxx        (numeric) Value of coinbase utxos being shielded.\n"
             "  \"remainingUTXOs\": xxx       (numeric) Number of coinbase utxos still available for shielding.\n"
             "  \"remainingValue\": xxx       (numeric) Value of coinbase utxos still available for shielding.\n"
+            "  \"shieldingTransactions\": xxx (numeric) Number of transactions shielding them.\n"
             "}\n"
         );
 
@@ -3726,11 +3900,20 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         }
     }
 
-    // Prepare to get coinbase utxos
-    std::vector<ShieldCoinbaseUTXO> inputs;
-    CAmount shieldedValue = 0;
+    int nMaxTxs = 1;
+    if (params.size() > 4) {
+        nMaxTxs = params[4].get_int();
+        if (nMaxTxs < 1) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Maximum number of transactions must be at least 1");
+        }
+    }
+
+    // Prepare to get coinbase utxos, in one batch per transaction
+    std::vector<std::vector<ShieldCoinbaseUTXO> > batches(1);
+    std::vector<CAmount> batchValues(1, 0);
     CAmount remainingValue = 0;
-    size_t estimatedTxSize = 2000;  // 1802 joinsplit description + tx overhead + wiggle room
+    const size_t baseTxSize = 2000;  // 1802 joinsplit description + tx overhead + wiggle room
+    size_t estimatedTxSize = baseTxSize;
     size_t utxoCounter = 0;
     bool maxedOutFlag = false;
     size_t mempoolLimit = (nLimit != 0) ? nLimit : (size_t)GetArg("-mempooltxinputlimit", 0);
@@ -3771,14 +3954,22 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
             CBitcoinAddress ba(address);
             size_t increase = (ba.IsScript()) ? CTXIN_SPEND_P2SH_SIZE : CTXIN_SPEND_DUST_SIZE;
             if (estimatedTxSize + increase >= MAX_TX_SIZE ||
-                (mempoolLimit > 0 && utxoCounter > mempoolLimit))
+                (mempoolLimit > 0 && batches.back().size() >= mempoolLimit))
             {
-                maxedOutFlag = true;
-            } else {
+                // The transaction is full, the next one of a bulk shielding takes the utxo
+                if ((int)batches.size() < nMaxTxs) {
+                    batches.push_back(std::vector<ShieldCoinbaseUTXO>());
+                    batchValues.push_back(0);
+                    estimatedTxSize = baseTxSize;
+                } else {
+                    maxedOutFlag = true;
+                }
+            }
+            if (!maxedOutFlag) {
                 estimatedTxSize += increase;
                 ShieldCoinbaseUTXO utxo = {out.tx->GetHash(), out.i, nValue};
-                inputs.push_back(utxo);
-                shieldedValue += nValue;
+                batches.back().push_back(utxo);
+                batchValues.back() += nValue;
             }
         }
 
@@ -3787,22 +3978,36 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         }
     }
 
-    size_t numUtxos = inputs.size();
+    // The last transaction of a bulk shielding is left for later if it cannot pay its own fee
+    if (batches.size() > 1 && batchValues.back() < 2 * nFee) {
+        remainingValue += batchValues.back();
+        batches.pop_back();
+        batchValues.pop_back();
+    }
+
+    size_t numUtxos = 0;
+    CAmount shieldedValue = 0;
+    for (size_t i = 0; i < batches.size(); i++) {
+        numUtxos += batches[i].size();
+        shieldedValue += batchValues[i];
+    }
 
     if (numUtxos == 0) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any coinbase funds to shield.");
     }
 
-    if (shieldedValue < nFee) {
-        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
-            strprintf("Insufficient coinbase funds, have %s, which is less than miners fee %s",
-            FormatMoney(shieldedValue), FormatMoney(nFee)));
-    }
+    for (const CAmount& batchValue : batchValues) {
+        if (batchValue < nFee) {
+            throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
+                strprintf("Insufficient coinbase funds, have %s, which is less than miners fee %s",
+                FormatMoney(batchValue), FormatMoney(nFee)));
+        }
 
-    // Check that the user specified fee is sane (if too high, it can result in error -25 absurd fee)
-    CAmount netAmount = shieldedValue - nFee;
-    if (nFee > netAmount) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Fee %s is greater than the net amount to be shielded %s", FormatMoney(nFee), FormatMoney(netAmount)));
+        // Check that the user specified fee is sane (if too high, it can result in error -25 absurd fee)
+        CAmount netAmount = batchValue - nFee;
+        if (nFee > netAmount) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Fee %s is greater than the net amount to be shielded %s", FormatMoney(nFee), FormatMoney(netAmount)));
+        }
     }
 
     // Keep record of parameters in context object
@@ -3810,6 +4015,9 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     contextInfo.pushKV("fromaddress", params[0]);
     contextInfo.pushKV("toaddress", params[1]);
     contextInfo.pushKV("fee", ValueFromAmount(nFee));
+    if (nMaxTxs > 1) {
+        contextInfo.pushKV("maxtxs", nMaxTxs);
+    }
 
     const int shieldedTxVersion = ForkManager::getInstance().getShieldedTxVersion(chainActive.Height() + 1);
     LogPrintf("z_shieldcoinbase shieldedTxVersion (Forkmanager): %d\n", shieldedTxVersion);
@@ -3821,8 +4029,8 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
 
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_shieldcoinbase(contextualTx, inputs, destaddress, nFee, contextInfo) );
-    q->addOperation(operation);
+    std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_shieldcoinbase(contextualTx, destaddress, batches, nFee, contextInfo) );
+    q->addOperation(operation, OperationPriority::LOW);
     AsyncRPCOperationId operationId = operation->getId();
 
     // Return continuation information
@@ -3831,6 +4039,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     o.pushKV("remainingValue", ValueFromAmount(remainingValue));
     o.pushKV("shieldingUTXOs", numUtxos);
     o.pushKV("shieldingValue", ValueFromAmount(shieldedValue));
+    o.pushKV("shieldingTransactions", (int64_t)batches.size());
     o.pushKV("opid", operationId);
     return o;
 }
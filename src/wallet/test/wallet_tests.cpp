@@ -23,6 +23,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_FIXTURE_TEST_SUITE(wallet_tests, TestingSetup)
@@ -307,4 +309,120 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_bnb_tests)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+    add_coin(1 * CENT); add_coin(2 * CENT); add_coin(3 * CENT); add_coin(4 * CENT);
+
+    // An exact match, whatever the order of the coins
+    BOOST_CHECK(wallet.SelectCoinsBnB(CCoinSelectionParams(6 * CENT, 0, 0), 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 6 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // No combination within the cost of change
+    BOOST_CHECK(!wallet.SelectCoinsBnB(CCoinSelectionParams(11 * CENT, 0, 0), 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK(!wallet.SelectCoinsBnB(CCoinSelectionParams(5 * CENT / 2, 0, CENT / 4), 1, 6, vCoins, setCoinsRet, nValueRet));
+
+    // The least excess within the cost of change
+    BOOST_CHECK(wallet.SelectCoinsBnB(CCoinSelectionParams(5 * CENT / 2, 0, CENT), 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 3 * CENT);
+
+    // The fee of each input counts against its value
+    BOOST_CHECK(wallet.SelectCoinsBnB(CCoinSelectionParams(6 * CENT, CENT / 2, 0), 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // Coins worth no more than their fee are left out
+    BOOST_CHECK(wallet.SelectCoinsBnB(CCoinSelectionParams(6 * CENT, CENT, 0), 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 9 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 3U);
+    BOOST_CHECK(!wallet.SelectCoinsBnB(CCoinSelectionParams(7 * CENT, CENT, 0), 1, 6, vCoins, setCoinsRet, nValueRet));
+
+    // Unconfirmed coins are left out
+    empty_wallet();
+    add_coin(6 * CENT, 0);
+    BOOST_CHECK(!wallet.SelectCoinsBnB(CCoinSelectionParams(6 * CENT, 0, 0), 1, 6, vCoins, setCoinsRet, nValueRet));
+
+    // Many coins of the same value are searched quickly
+    empty_wallet();
+    for (int i = 0; i < 1000; i++)
+        add_coin(5 * CENT);
+    add_coin(3 * CENT);
+    BOOST_CHECK(wallet.SelectCoinsBnB(CCoinSelectionParams(103 * CENT, 0, 0), 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 103 * CENT);
+
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(keypool_topup_batches)
+{
+    LOCK(pwalletMain->cs_wallet);
+    mapArgs["-keypool"] = "250";
+
+    // The keys are written in several transactions
+    BOOST_CHECK(pwalletMain->NewKeyPool());
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 250U);
+    BOOST_CHECK(pwalletMain->TopUpKeyPool());
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 251U);
+
+    // A reserved key is replaced before the next one is
+    int64_t nIndex;
+    CKeyPool keypool;
+    pwalletMain->ReserveKeyFromKeyPool(nIndex, keypool);
+    BOOST_CHECK(nIndex != -1);
+    BOOST_CHECK(pwalletMain->HaveKey(keypool.vchPubKey.GetID()));
+    pwalletMain->KeepKey(nIndex);
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 250U);
+    pwalletMain->ReserveKeyFromKeyPool(nIndex, keypool);
+    pwalletMain->KeepKey(nIndex);
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 250U);
+
+    // The keys are in the database once the transactions are committed
+    CKeyPool keypoolRead;
+    BOOST_CHECK(CWalletDB(pwalletMain->strWalletFile).ReadPool(nIndex + 1, keypoolRead));
+    BOOST_CHECK(pwalletMain->HaveKey(keypoolRead.vchPubKey.GetID()));
+
+    mapArgs.erase("-keypool");
+}
+
+BOOST_AUTO_TEST_CASE(walletdb_batch_commits)
+{
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    CKey key;
+    key.MakeNewKey(true);
+    const CKeyPool keypool(key.GetPubKey());
+    const int64_t nFirst = 1000000;
+    const int64_t nWrites = WALLET_BATCH_MAX_WRITES + 10;
+    CKeyPool keypoolRead;
+
+    // The writes span several transactions
+    {
+        CWalletDBBatch batch(walletdb);
+        for (int64_t i = 0; i < nWrites; i++)
+            BOOST_CHECK(batch.Prepare() && walletdb.WritePool(nFirst + i, keypool));
+        BOOST_CHECK(batch.Commit());
+    }
+    for (int64_t i = 0; i < nWrites; i++)
+        BOOST_CHECK(walletdb.ReadPool(nFirst + i, keypoolRead));
+    BOOST_CHECK(keypoolRead.vchPubKey == key.GetPubKey());
+
+    // The writes of the transaction left uncommitted are aborted, not the ones before
+    {
+        CWalletDBBatch batch(walletdb);
+        for (int64_t i = 0; i < (int64_t)WALLET_BATCH_MAX_WRITES + 1; i++)
+            BOOST_CHECK(batch.Prepare() && walletdb.ErasePool(nFirst + i));
+    }
+    BOOST_CHECK(!walletdb.ReadPool(nFirst, keypoolRead));
+    BOOST_CHECK(!walletdb.ReadPool(nFirst + WALLET_BATCH_MAX_WRITES - 1, keypoolRead));
+    BOOST_CHECK(walletdb.ReadPool(nFirst + WALLET_BATCH_MAX_WRITES, keypoolRead));
+
+    for (int64_t i = WALLET_BATCH_MAX_WRITES; i < nWrites; i++)
+        walletdb.ErasePool(nFirst + i);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,127 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/walletlog.h"
+
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(walletlog_tests, TestingSetup)
+
+static CSerializeData Data(const std::string& str)
+{
+    return CSerializeData(str.begin(), str.end());
+}
+
+static std::string ReadString(const CWalletLog& log, const std::string& strKey)
+{
+    CSerializeData value;
+    if (!log.Read(Data(strKey), value))
+        return "";
+    return std::string(value.begin(), value.end());
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_commit_and_replay)
+{
+    const boost::filesystem::path path = pathTemp / "wallet.log";
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(!log.Open(false));
+        BOOST_CHECK(log.Open(true));
+        CWalletLog::Writes writes;
+        writes[Data("a")] = Data("1");
+        writes[Data("b")] = Data("2");
+        writes[Data("\xff")] = Data("3");
+        BOOST_CHECK(log.Commit(writes));
+        writes.clear();
+        writes[Data("a")] = boost::none;
+        writes[Data("b")] = Data("4");
+        BOOST_CHECK(log.Commit(writes));
+    }
+
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open(false));
+    BOOST_CHECK_EQUAL(ReadString(log, "a"), "");
+    BOOST_CHECK_EQUAL(ReadString(log, "b"), "4");
+
+    // The keys come in the order of their bytes, unsigned
+    CSerializeData key, value;
+    BOOST_CHECK(log.Next(CSerializeData(), true, key, value));
+    BOOST_CHECK(key == Data("b"));
+    BOOST_CHECK(log.Next(key, false, key, value));
+    BOOST_CHECK(key == Data("\xff"));
+    BOOST_CHECK(!log.Next(key, false, key, value));
+    BOOST_CHECK(IsWalletLogFile(path));
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_drops_torn_record)
+{
+    const boost::filesystem::path path = pathTemp / "torn.log";
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(log.Open(true));
+        CWalletLog::Writes writes;
+        writes[Data("key")] = Data("value");
+        BOOST_CHECK(log.Commit(writes));
+    }
+    const uint64_t nSize = boost::filesystem::file_size(path);
+
+    // Half a record, as a crash leaves it
+    FILE* file = fopen(path.string().c_str(), "ab");
+    const unsigned char partial[] = {0x20, 0, 0, 0, 0x12, 0x34};
+    fwrite(partial, 1, sizeof(partial), file);
+    fclose(file);
+
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open(false));
+    BOOST_CHECK_EQUAL(ReadString(log, "key"), "value");
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), nSize);
+
+    // The log is appended to after the records it kept
+    CWalletLog::Writes writes;
+    writes[Data("other")] = Data("value2");
+    BOOST_CHECK(log.Commit(writes));
+    log.Close();
+    BOOST_CHECK(log.Open(false));
+    BOOST_CHECK_EQUAL(ReadString(log, "other"), "value2");
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_compaction)
+{
+    const boost::filesystem::path path = pathTemp / "compact.log";
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open(true));
+    const std::string strValue(1000, 'x');
+    for (int i = 0; i < 2000; i++) {
+        CWalletLog::Writes writes;
+        writes[Data(strprintf("key%d", i % 10))] = Data(strValue);
+        writes[Data("\x04poolx")] = Data("pool");
+        BOOST_CHECK(log.Commit(writes));
+    }
+    BOOST_CHECK(log.NeedsCompaction());
+    const uint64_t nSize = boost::filesystem::file_size(path);
+
+    BOOST_CHECK(log.Compact("\x04pool"));
+    BOOST_CHECK(!log.NeedsCompaction());
+    BOOST_CHECK(boost::filesystem::file_size(path) < nSize / 100);
+    BOOST_CHECK_EQUAL(ReadString(log, "\x04poolx"), "");
+
+    // A snapshot is a log with the same entries
+    const boost::filesystem::path pathSnapshot = pathTemp / "snapshot.log";
+    BOOST_CHECK(log.Snapshot(pathSnapshot));
+    log.Close();
+    for (const boost::filesystem::path& p : {path, pathSnapshot}) {
+        CWalletLog logRead(p);
+        BOOST_CHECK(logRead.Open(false));
+        for (int i = 0; i < 10; i++)
+            BOOST_CHECK_EQUAL(ReadString(logRead, strprintf("key%d", i)), strValue);
+        BOOST_CHECK_EQUAL(ReadString(logRead, "\x04poolx"), "");
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,8 +7,10 @@
 
 #include "base58.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
 #include "init.h"
 #include "main.h"
 #include "net.h"
@@ -26,6 +28,7 @@ using namespace zen;
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -166,6 +169,10 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
+        if (pwalletdbKeyPool)
+            return pwalletdbKeyPool->WriteKey(pubkey,
+                                              secret.GetPrivKey(),
+                                              mapKeyMetadata[pubkey.GetID()]);
         return CWalletDB(strWalletFile).WriteKey(pubkey,
                                                  secret.GetPrivKey(),
                                                  mapKeyMetadata[pubkey.GetID()]);
@@ -186,6 +193,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
             return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
                                                         vchCryptedSecret,
                                                         mapKeyMetadata[vchPubKey.GetID()]);
+        else if (pwalletdbKeyPool)
+            return pwalletdbKeyPool->WriteCryptedKey(vchPubKey,
+                                                     vchCryptedSecret,
+                                                     mapKeyMetadata[vchPubKey.GetID()]);
         else
             return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
                                                             vchCryptedSecret,
@@ -406,22 +417,53 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 }
 
 void CWallet::ChainTip(const CBlockIndex *pindex, const CBlock *pblock,
-                       ZCIncrementalMerkleTree tree, bool added)
+                       const ZCIncrementalMerkleTreeRef& tree, bool added)
 {
     if (added) {
-        IncrementNoteWitnesses(pindex, pblock, tree);
+        // The witnesses are incremented with the tree, on a copy of it
+        ZCIncrementalMerkleTree treeNext(*tree);
+        IncrementNoteWitnesses(pindex, pblock, treeNext);
     } else {
         DecrementNoteWitnesses(pindex);
     }
+    LOCK(cs_wallet);
+    WriteBlockTxs();
 }
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
     LOCK(cs_wallet);
+    // The best block is only written after the transactions found up to it
+    WriteBlockTxs();
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
 }
 
+void CWallet::WriteBlockTxs()
+{
+    AssertLockHeld(cs_wallet);
+    if (setBlockTxsToWrite.empty())
+        return;
+
+    CWalletDB walletdb(strWalletFile, "r+", false);
+    CWalletDBBatch batch(walletdb);
+    for (const uint256& hash : setBlockTxsToWrite) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            continue;
+        if (!batch.Prepare() || !walletdb.WriteTx(hash, mi->second)) {
+            // Kept to be written again with the next block
+            LogPrintf("WriteBlockTxs(): Failed to write CWalletTx %s\n", hash.ToString());
+            return;
+        }
+    }
+    if (!batch.Prepare() || !walletdb.WriteOrderPosNext(nOrderPosNext) || !batch.Commit()) {
+        LogPrintf("WriteBlockTxs(): Couldn't commit the transactions of the block\n");
+        return;
+    }
+    setBlockTxsToWrite.clear();
+}
+
 bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn, bool fExplicit)
 {
     LOCK(cs_wallet); // nWalletVersion
@@ -500,6 +542,12 @@ set<uint256> CWallet::GetConflicts(const uint256& txid) const
 
 void CWallet::Flush(bool shutdown)
 {
+    if (shutdown)
+        StopKeyPoolThread();
+    {
+        LOCK(cs_wallet);
+        WriteBlockTxs();
+    }
     bitdb.Flush(shutdown);
 }
 
@@ -524,6 +572,14 @@ bool CWallet::Verify(const string& walletFile, string& warningString, string& er
             return true;
         }
     }
+    // A wallet log recovers from a crash by itself when it is opened
+    if (IsWalletLogFile(GetDataDir() / walletFile))
+    {
+        if (GetBoolArg("-salvagewallet", false))
+            warningString += _("Warning: -salvagewallet only applies to Berkeley DB wallets.");
+        return true;
+    }
+
     if (GetBoolArg("-salvagewallet", false))
     {
         // Recover readable keypairs:
@@ -666,17 +722,98 @@ void CWallet::ClearNoteWitnessCache()
         for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
+            MarkNoteWitnessesDirty(item.first, std::numeric_limits<int>::min());
         }
     }
     nWitnessCacheSize = 0;
 }
 
+void CWallet::MarkNoteWitnessesDirty(const JSOutPoint& jsoutpt, int nHeight)
+{
+    AssertLockHeld(cs_wallet);
+    CNoteWitnessState& state = mapNoteWitnessState[jsoutpt];
+    state.nDirtyFrom = std::min(state.nDirtyFrom, nHeight);
+}
+
+void CWallet::LoadNoteWitnesses(std::map<JSOutPoint, std::map<int, ZCIncrementalWitness> >& mapWitnesses,
+                                std::map<JSOutPoint, int>& mapHeights)
+{
+    AssertLockHeld(cs_wallet);
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
+            CNoteData& nd = item.second;
+            std::map<JSOutPoint, int>::iterator it = mapHeights.find(item.first);
+            if (it == mapHeights.end()) {
+                if (!nd.witnesses.empty() || nd.witnessHeight != -1) {
+                    MarkNoteWitnessesDirty(item.first, std::numeric_limits<int>::min());
+                    setNoteTxsToWrite.insert(wtxItem.first);
+                }
+                continue;
+            }
+            nd.witnessHeight = it->second;
+            nd.witnesses.clear();
+            mapHeights.erase(it);
+
+            std::map<int, ZCIncrementalWitness>& mapNote = mapWitnesses[item.first];
+            for (int nHeight = nd.witnessHeight; ; nHeight--) {
+                std::map<int, ZCIncrementalWitness>::const_iterator wi = mapNote.find(nHeight);
+                if (wi == mapNote.end())
+                    break;
+                nd.witnesses.push_back(wi->second);
+            }
+            if (!mapNote.empty()) {
+                CNoteWitnessState& state = mapNoteWitnessState[item.first];
+                state.nBottom = mapNote.begin()->first;
+                state.nTop = mapNote.rbegin()->first;
+                // Records left apart from the cache are erased with the next write
+                if (mapNote.size() != nd.witnesses.size())
+                    MarkNoteWitnessesDirty(item.first, state.nTop + 1);
+            }
+            mapWitnesses.erase(item.first);
+        }
+    }
+
+    // Records of notes the wallet does not have any more
+    for (const std::pair<const JSOutPoint, int>& item : mapHeights)
+        MarkNoteWitnessesDirty(item.first, std::numeric_limits<int>::min());
+    for (const std::pair<const JSOutPoint, std::map<int, ZCIncrementalWitness> >& item : mapWitnesses) {
+        CNoteWitnessState& state = mapNoteWitnessState[item.first];
+        if (!item.second.empty()) {
+            state.nBottom = item.second.begin()->first;
+            state.nTop = item.second.rbegin()->first;
+        }
+        MarkNoteWitnessesDirty(item.first, std::numeric_limits<int>::min());
+    }
+}
+
 void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                      const CBlock* pblockIn,
                                      ZCIncrementalMerkleTree& tree)
 {
     {
         LOCK(cs_wallet);
+        const CBlock* pblock {pblockIn};
+        CBlock block;
+        if (!pblock) {
+            ReadBlockFromDisk(block, pindex);
+            pblock = &block;
+        }
+
+        // Our notes in this block, which are witnessed from their commitment on
+        std::set<JSOutPoint> setBlockNotes;
+        for (const CTransactionRef& ptx : pblock->vtx) {
+            const CTransaction& tx = *ptx;
+            std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(tx.GetHash());
+            if (mi == mapWallet.end())
+                continue;
+            for (const mapNoteData_t::value_type& item : mi->second.mapNoteData) {
+                if (item.second.witnessHeight < pindex->nHeight)
+                    setBlockNotes.insert(item.first);
+            }
+        }
+
+        // The witnesses of the previous block get the commitments of this one together
+        libzcash::IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> witnesses(tree);
         for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
             for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
                 CNoteData* nd = &(item.second);
@@ -699,6 +836,10 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                     if (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
                         nd->witnesses.pop_back();
                     }
+                    // The cache of a note of this block is replaced below
+                    if (nd->witnesses.size() > 0 && !setBlockNotes.count(item.first)) {
+                        witnesses.add(nd->witnesses.front());
+                    }
                 }
             }
         }
@@ -706,69 +847,47 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
             nWitnessCacheSize += 1;
         }
 
-        const CBlock* pblock {pblockIn};
-        CBlock block;
-        if (!pblock) {
-            ReadBlockFromDisk(block, pindex);
-            pblock = &block;
-        }
-
-        for (const CTransaction& tx : pblock->vtx) {
+        for (const CTransactionRef& ptx : pblock->vtx) {
+            const CTransaction& tx = *ptx;
             auto hash = tx.GetHash();
-            bool txIsOurs = mapWallet.count(hash);
             for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
                 const JSDescription& jsdesc = tx.vjoinsplit[i];
                 for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
-                    const uint256& note_commitment = jsdesc.commitments[j];
-                    tree.append(note_commitment);
-
-                    // Increment existing witnesses
-                    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                        for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                            CNoteData* nd = &(item.second);
-                            if (nd->witnessHeight < pindex->nHeight &&
-                                    nd->witnesses.size() > 0) {
-                                // Check the validity of the cache
-                                // See earlier comment about validity.
-                                assert(nWitnessCacheSize >= nd->witnesses.size());
-                                nd->witnesses.front().append(note_commitment);
-                            }
-                        }
-                    }
+                    // Increment existing witnesses, and the tree
+                    witnesses.append(jsdesc.commitments[j]);
 
                     // If this is our note, witness it
-                    if (txIsOurs) {
-                        JSOutPoint jsoutpt {hash, i, j};
-                        if (mapWallet[hash].mapNoteData.count(jsoutpt) &&
-                                mapWallet[hash].mapNoteData[jsoutpt].witnessHeight < pindex->nHeight) {
-                            CNoteData* nd = &(mapWallet[hash].mapNoteData[jsoutpt]);
-                            if (nd->witnesses.size() > 0) {
-                                // We think this can happen because we write out the
-                                // witness cache state after every block increment or
-                                // decrement, but the block index itself is written in
-                                // batches. So if the node crashes in between these two
-                                // operations, it is possible for IncrementNoteWitnesses
-                                // to be called again on previously-cached blocks. This
-                                // doesn't affect existing cached notes because of the
-                                // CNoteData::witnessHeight checks. See #1378 for details.
-                                LogPrintf("Inconsistent witness cache state found for %s\n- Cache size: %d\n- Top (height %d): %s\n- New (height %d): %s\n",
-                                          jsoutpt.ToString(), nd->witnesses.size(),
-                                          nd->witnessHeight,
-                                          nd->witnesses.front().root().GetHex(),
-                                          pindex->nHeight,
-                                          tree.witness().root().GetHex());
-                                nd->witnesses.clear();
-                            }
-                            nd->witnesses.push_front(tree.witness());
-                            // Set height to one less than pindex so it gets incremented
-                            nd->witnessHeight = pindex->nHeight - 1;
-                            // Check the validity of the cache
-                            assert(nWitnessCacheSize >= nd->witnesses.size());
+                    JSOutPoint jsoutpt {hash, i, j};
+                    if (setBlockNotes.count(jsoutpt)) {
+                        CNoteData* nd = &(mapWallet[hash].mapNoteData[jsoutpt]);
+                        if (nd->witnesses.size() > 0) {
+                            // We think this can happen because we write out the
+                            // witness cache state after every block increment or
+                            // decrement, but the block index itself is written in
+                            // batches. So if the node crashes in between these two
+                            // operations, it is possible for IncrementNoteWitnesses
+                            // to be called again on previously-cached blocks. This
+                            // doesn't affect existing cached notes because of the
+                            // CNoteData::witnessHeight checks. See #1378 for details.
+                            LogPrintf("Inconsistent witness cache state found for %s\n- Cache size: %d\n- Top (height %d): %s\n- New (height %d): %s\n",
+                                      jsoutpt.ToString(), nd->witnesses.size(),
+                                      nd->witnessHeight,
+                                      nd->witnesses.front().root().GetHex(),
+                                      pindex->nHeight,
+                                      tree.witness().root().GetHex());
+                            nd->witnesses.clear();
                         }
+                        nd->witnesses.push_front(tree.witness());
+                        witnesses.add(nd->witnesses.front());
+                        // Set height to one less than pindex so it gets incremented
+                        nd->witnessHeight = pindex->nHeight - 1;
+                        // Check the validity of the cache
+                        assert(nWitnessCacheSize >= nd->witnesses.size());
                     }
                 }
             }
         }
+        witnesses.finish();
 
         // Update witness heights
         for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
@@ -776,6 +895,7 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                 CNoteData* nd = &(item.second);
                 if (nd->witnessHeight < pindex->nHeight) {
                     nd->witnessHeight = pindex->nHeight;
+                    MarkNoteWitnessesDirty(item.first, pindex->nHeight);
                     // Check the validity of the cache
                     // See earlier comment about validity.
                     assert(nWitnessCacheSize >= nd->witnesses.size());
@@ -812,6 +932,7 @@ void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
                     // pindex is the block being removed, so the new witness cache
                     // height is one below it.
                     nd->witnessHeight = pindex->nHeight - 1;
+                    MarkNoteWitnessesDirty(item.first, pindex->nHeight);
                 }
             }
         }
@@ -952,6 +1073,9 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        // Which outputs are ours may have changed
+        fCoinIndexBuilt = false;
+        nWalletTxChanges++;
     }
 }
 
@@ -981,6 +1105,8 @@ bool CWallet::UpdateNullifierNoteMap()
                             dec,
                             hSig,
                             item.first.n);
+                        if (item.second.nullifier)
+                            setNoteTxsToWrite.insert(wtxItem.first);
                     }
                 }
             }
@@ -1002,10 +1128,27 @@ void CWallet::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
                 mapNullifiersToNotes[*item.second.nullifier] = item.first;
             }
         }
+        MarkNoteIndexPending(wtx);
+    }
+}
+
+void CWallet::MarkNoteIndexPending(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fNoteIndexBuilt)
+        return;
+    for (const mapNoteData_t::value_type& item : wtx.mapNoteData)
+        setNoteIndexPending.insert(item.first);
+    for (const JSDescription& jsdesc : wtx.vjoinsplit) {
+        for (const uint256& nullifier : jsdesc.nullifiers) {
+            std::map<uint256, JSOutPoint>::const_iterator it = mapNullifiersToNotes.find(nullifier);
+            if (it != mapNullifiersToNotes.end())
+                setNoteIndexPending.insert(it->second);
+        }
     }
 }
 
-bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
+bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb, bool fDeferWrite)
 {
     uint256 hash = wtxIn.GetHash();
 
@@ -1017,6 +1160,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
         AddToSpends(hash);
+        MarkCoinIndexPending(wtx);
     }
     else
     {
@@ -1030,7 +1174,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         if (fInsertedNew)
         {
             wtx.nTimeReceived = GetTime();
-            wtx.nOrderPos = IncOrderPosNext(pwalletdb);
+            // nOrderPosNext is written with the deferred transactions
+            wtx.nOrderPos = fDeferWrite ? nOrderPosNext++ : IncOrderPosNext(pwalletdb);
             wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
 
             wtx.nTimeSmart = wtx.nTimeReceived;
@@ -1109,12 +1254,16 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
         // Write to disk
-        if (fInsertedNew || fUpdated)
-            if (!wtx.WriteToDisk(pwalletdb))
+        if (fInsertedNew || fUpdated) {
+            if (fDeferWrite)
+                setBlockTxsToWrite.insert(hash);
+            else if (!wtx.WriteToDisk(pwalletdb))
                 return false;
+        }
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        MarkCoinIndexPending(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1169,8 +1318,16 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto noteData = FindMyNotes(tx);
-        if (fExisted || IsMine(tx) || IsFromMe(tx) || noteData.size() > 0)
+        auto noteData = pblock ? FindMyNotes(tx, *pblock) : FindMyNotes(tx);
+        return AddToWalletIfInvolvingMe(tx, pblock, noteData, fExisted || IsMine(tx));
+    }
+}
+
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const mapNoteData_t& noteData, bool fRelevant)
+{
+    {
+        AssertLockHeld(cs_wallet);
+        if (fRelevant || IsFromMe(tx) || noteData.size() > 0)
         {
             CWalletTx wtx(this,tx);
 
@@ -1184,6 +1341,10 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
+            // For the same reason the transactions of a block are only written at its end, all at once
+            if (pblock && fFileBacked)
+                return AddToWallet(wtx, false, NULL, true);
+
             CWalletDB walletdb(strWalletFile, "r+", false);
 
             return AddToWallet(wtx, false, &walletdb);
@@ -1227,8 +1388,13 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        if (mapWallet.erase(hash)) {
+            setBlockTxsToWrite.erase(hash);
             CWalletDB(strWalletFile).EraseTx(hash);
+            fNoteIndexBuilt = false;
+            fCoinIndexBuilt = false;
+            nWalletTxChanges++;
+        }
     }
     return;
 }
@@ -1268,6 +1434,99 @@ boost::optional<uint256> CWallet::GetNoteNullifier(const JSDescription& jsdesc,
     return ret;
 }
 
+namespace {
+
+/** A note an output of a JoinSplit opens to, and the address of the decryptor which opened it */
+struct CNoteMatch
+{
+    const libzcash::PaymentAddress* paddress;
+    libzcash::Note note;
+};
+
+/**
+ * Closure trying a range of note decryptors on the outputs of a JoinSplit. Each decryptor
+ * computes its Diffie-Hellman secret with the ephemeral key once for all the outputs.
+ * An output opens with the first decryptor of the range whose key authenticates its
+ * ciphertext and whose note has the commitment of the output; when none does, its match
+ * is left empty.
+ */
+class CNoteDecryptionCheck
+{
+private:
+    const JSDescription* pjsdesc;
+    const uint256* phSig;
+    const NoteDecryptorMap::value_type* const* pdecryptors;
+    size_t nDecryptors;
+    //! ZC_NUM_JS_OUTPUTS matches, one for each output
+    boost::optional<CNoteMatch>* pmatches;
+
+public:
+    CNoteDecryptionCheck() : pjsdesc(0), phSig(0), pdecryptors(0), nDecryptors(0), pmatches(0) {}
+    CNoteDecryptionCheck(const JSDescription& jsdescIn, const uint256& hSigIn, const NoteDecryptorMap::value_type* const* pdecryptorsIn,
+                         size_t nDecryptorsIn, boost::optional<CNoteMatch>* pmatchesIn) :
+        pjsdesc(&jsdescIn), phSig(&hSigIn), pdecryptors(pdecryptorsIn), nDecryptors(nDecryptorsIn), pmatches(pmatchesIn) {}
+
+    bool operator()()
+    {
+        std::vector<ZCNoteDecryption::BatchItem> batch;
+        std::vector<uint8_t> vOutputs;
+        std::vector<boost::optional<ZCNoteDecryption::Plaintext>> plaintexts;
+        for (size_t i = 0; i < nDecryptors; i++) {
+            const libzcash::PaymentAddress& address = pdecryptors[i]->first;
+            const ZCNoteDecryption& dec = pdecryptors[i]->second;
+            try {
+                batch.clear();
+                vOutputs.clear();
+                for (uint8_t j = 0; j < pjsdesc->ciphertexts.size(); j++) {
+                    if (pmatches[j])
+                        continue;
+                    batch.push_back({&pjsdesc->ciphertexts[j], &pjsdesc->ephemeralKey, phSig, j});
+                    vOutputs.push_back(j);
+                }
+                if (batch.empty())
+                    break;
+                if (dec.try_decrypt_batch(batch, plaintexts) == 0)
+                    continue;
+                for (size_t k = 0; k < batch.size(); k++) {
+                    if (!plaintexts[k])
+                        continue;
+                    const uint8_t j = vOutputs[k];
+                    libzcash::Note note = libzcash::NotePlaintext::deserialize(*plaintexts[k]).note(address);
+                    // Check note plaintext against note commitment
+                    if (note.cm() == pjsdesc->commitments[j])
+                        pmatches[j] = CNoteMatch {&address, note};
+                }
+            } catch (const std::exception &exc) {
+                // Unexpected failure
+                LogPrintf("FindMyNotes(): Unexpected error while testing decrypt:\n");
+                LogPrintf("%s\n", exc.what());
+            }
+        }
+        return true;
+    }
+
+    void swap(CNoteDecryptionCheck &check)
+    {
+        std::swap(pjsdesc, check.pjsdesc);
+        std::swap(phSig, check.phSig);
+        std::swap(pdecryptors, check.pdecryptors);
+        std::swap(nDecryptors, check.nDecryptors);
+        std::swap(pmatches, check.pmatches);
+    }
+};
+
+CCheckQueue<CNoteDecryptionCheck> notedecryptionqueue(8);
+/** A check queue has a single master at a time: serializes the wallets using notedecryptionqueue */
+CCriticalSection cs_notedecryptionqueue;
+
+} // anon namespace
+
+void ThreadNoteDecryption()
+{
+    RenameThread("horizen-notedec");
+    notedecryptionqueue.Thread();
+}
+
 /**
  * Finds all output notes in the given transaction that have been sent to
  * PaymentAddresses in this wallet.
@@ -1277,42 +1536,103 @@ boost::optional<uint256> CWallet::GetNoteNullifier(const JSDescription& jsdesc,
  * already have been cached in CWalletTx.mapNoteData.
  */
 mapNoteData_t CWallet::FindMyNotes(const CTransaction& tx) const
+{
+    std::vector<mapNoteData_t> vNoteData;
+    // A reference to tx not owning it, as the vector does not outlive it
+    FindMyNotes(std::vector<CTransactionRef>(1, CTransactionRef(CTransactionRef(), &tx)), vNoteData);
+    return vNoteData[0];
+}
+
+void CWallet::FindMyNotes(const std::vector<CTransactionRef>& vtx, std::vector<mapNoteData_t>& vNoteData) const
 {
     LOCK(cs_SpendingKeyStore);
-    uint256 hash = tx.GetHash();
-
-    mapNoteData_t noteData;
-    for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
-        auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
-        for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
-                try {
-                    auto address = item.first;
-                    JSOutPoint jsoutpt {hash, i, j};
-                    auto nullifier = GetNoteNullifier(
-                        tx.vjoinsplit[i],
-                        address,
-                        item.second,
-                        hSig, j);
-                    if (nullifier) {
-                        CNoteData nd {address, *nullifier};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    } else {
-                        CNoteData nd {address};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    }
-                    break;
-                } catch (const note_decryption_failed &err) {
-                    // Couldn't decrypt with this decryptor
-                } catch (const std::exception &exc) {
-                    // Unexpected failure
-                    LogPrintf("FindMyNotes(): Unexpected error while testing decrypt:\n");
-                    LogPrintf("%s\n", exc.what());
-                }
+    vNoteData.assign(vtx.size(), mapNoteData_t());
+
+    std::vector<const NoteDecryptorMap::value_type*> vDecryptors;
+    vDecryptors.reserve(mapNoteDecryptors.size());
+    for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors)
+        vDecryptors.push_back(&item);
+    if (vDecryptors.empty())
+        return;
+    const size_t nBatches = (vDecryptors.size() + NOTE_DECRYPTION_BATCH_SIZE - 1) / NOTE_DECRYPTION_BATCH_SIZE;
+
+    // The JoinSplits of all the transactions, each tried by every batch of decryptors
+    std::vector<std::pair<size_t, size_t> > vJoinSplits;
+    std::vector<uint256> vhSig;
+    for (size_t t = 0; t < vtx.size(); t++) {
+        for (size_t i = 0; i < vtx[t]->vjoinsplit.size(); i++) {
+            vJoinSplits.push_back(std::make_pair(t, i));
+            vhSig.push_back(vtx[t]->vjoinsplit[i].h_sig(*pzcashParams, vtx[t]->joinSplitPubKey));
+        }
+    }
+    if (vJoinSplits.empty())
+        return;
+
+    std::vector<boost::optional<CNoteMatch> > vMatches(vJoinSplits.size() * nBatches * ZC_NUM_JS_OUTPUTS);
+    std::vector<CNoteDecryptionCheck> vChecks;
+    vChecks.reserve(vJoinSplits.size() * nBatches);
+    for (size_t k = 0; k < vJoinSplits.size(); k++) {
+        const JSDescription& jsdesc = vtx[vJoinSplits[k].first]->vjoinsplit[vJoinSplits[k].second];
+        for (size_t b = 0; b < nBatches; b++) {
+            const size_t nFirst = b * NOTE_DECRYPTION_BATCH_SIZE;
+            vChecks.push_back(CNoteDecryptionCheck(jsdesc, vhSig[k], &vDecryptors[nFirst],
+                                                   std::min(NOTE_DECRYPTION_BATCH_SIZE, vDecryptors.size() - nFirst),
+                                                   &vMatches[(k * nBatches + b) * ZC_NUM_JS_OUTPUTS]));
+        }
+    }
+    {
+        LOCK(cs_notedecryptionqueue);
+        CCheckQueueControl<CNoteDecryptionCheck> control(&notedecryptionqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    // Each output goes to the first decryptor, in the order of the map, which opens it
+    for (size_t k = 0; k < vJoinSplits.size(); k++) {
+        const uint256 hash = vtx[vJoinSplits[k].first]->GetHash();
+        for (uint8_t j = 0; j < ZC_NUM_JS_OUTPUTS; j++) {
+            for (size_t b = 0; b < nBatches; b++) {
+                const boost::optional<CNoteMatch>& match = vMatches[(k * nBatches + b) * ZC_NUM_JS_OUTPUTS + j];
+                if (!match)
+                    continue;
+                JSOutPoint jsoutpt {hash, vJoinSplits[k].second, j};
+                CNoteData nd {*match->paddress};
+                // SpendingKeys are only available if:
+                // - We have them (this isn't a viewing key)
+                // - The wallet is unlocked
+                libzcash::SpendingKey key;
+                if (GetSpendingKey(*match->paddress, key))
+                    nd.nullifier = match->note.nullifier(key);
+                vNoteData[vJoinSplits[k].first].insert(std::make_pair(jsoutpt, nd));
+                break;
             }
         }
     }
-    return noteData;
+}
+
+mapNoteData_t CWallet::FindMyNotes(const CTransaction& tx, const CBlock& block)
+{
+    AssertLockHeld(cs_wallet);
+    if (tx.vjoinsplit.empty())
+        return mapNoteData_t();
+
+    LOCK(cs_SpendingKeyStore);
+    // Decryptors are only ever added, so a new one changes their number
+    const uint256 hashBlock = block.GetHash();
+    if (hashBlock != hashNoteDataBlock || mapNoteDecryptors.size() != nNoteDataDecryptors) {
+        std::vector<mapNoteData_t> vNoteData;
+        FindMyNotes(block.vtx, vNoteData);
+        mapBlockNoteData.clear();
+        for (size_t i = 0; i < block.vtx.size(); i++)
+            if (!vNoteData[i].empty())
+                mapBlockNoteData[block.vtx[i]->GetHash()].swap(vNoteData[i]);
+        hashNoteDataBlock = hashBlock;
+        nNoteDataDecryptors = mapNoteDecryptors.size();
+    }
+    std::map<uint256, mapNoteData_t>::const_iterator it = mapBlockNoteData.find(tx.GetHash());
+    if (it == mapBlockNoteData.end())
+        return mapNoteData_t();
+    return it->second;
 }
 
 bool CWallet::IsFromMe(const uint256& nullifier) const
@@ -1487,7 +1807,7 @@ CAmount CWallet::GetChange(const CTransaction& tx) const
     return nChange;
 }
 
-void CWalletTx::SetNoteData(mapNoteData_t &noteData)
+void CWalletTx::SetNoteData(const mapNoteData_t &noteData)
 {
     mapNoteData.clear();
     for (const std::pair<JSOutPoint, CNoteData> nd : noteData) {
@@ -1722,8 +2042,9 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
         CBlock block;
         ReadBlockFromDisk(block, pindex);
 
-        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        BOOST_FOREACH(const CTransactionRef& ptx, block.vtx)
         {
+            const CTransaction& tx = *ptx;
             BOOST_FOREACH(const JSDescription& jsdesc, tx.vjoinsplit)
             {
                 BOOST_FOREACH(const uint256 &note_commitment, jsdesc.commitments)
@@ -1772,6 +2093,82 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  */
+namespace {
+
+/**
+ * A batch of blocks of a rescan, read on RESCAN_READ_THREADS threads of its own, which
+ * also find the transactions paying to the wallet. A block which could not be read is
+ * left null.
+ */
+class CRescanBatch
+{
+public:
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<CBlock> vBlocks;
+    //! Whether each transaction of each block has an output IsMine, if fMatchScripts
+    std::vector<std::vector<bool> > vMine;
+
+    CRescanBatch(const CWallet& walletIn, const std::vector<CBlockIndex*>& vIndexIn, bool fMatchScriptsIn) :
+        vIndex(vIndexIn), vBlocks(vIndexIn.size()), vMine(vIndexIn.size()), wallet(walletIn),
+        fMatchScripts(fMatchScriptsIn), nNext(0)
+    {
+        vPos.reserve(vIndex.size());
+        for (const CBlockIndex* pindex : vIndex)
+            vPos.push_back(pindex->GetBlockPos());
+        for (int i = 0; i < RESCAN_READ_THREADS; i++)
+            threads.create_thread(boost::bind(&CRescanBatch::Read, this));
+    }
+
+    ~CRescanBatch() { threads.join_all(); }
+
+    void Wait() { threads.join_all(); }
+
+private:
+    const CWallet& wallet;
+    const bool fMatchScripts;
+    //! Positions of the blocks, taken with cs_main held
+    std::vector<CDiskBlockPos> vPos;
+    boost::mutex cs;
+    size_t nNext;
+    boost::thread_group threads;
+
+    void Read()
+    {
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (nNext == vIndex.size())
+                    return;
+                i = nNext++;
+            }
+            if (!ReadBlockFromDisk(vBlocks[i], vPos[i]) || vBlocks[i].GetHash() != vIndex[i]->GetBlockHash()) {
+                vBlocks[i].SetNull();
+                continue;
+            }
+            if (fMatchScripts) {
+                vMine[i].reserve(vBlocks[i].vtx.size());
+                for (const CTransactionRef& ptx : vBlocks[i].vtx)
+                    vMine[i].push_back(wallet.IsMine(*ptx));
+            }
+        }
+    }
+};
+
+//! The batch of blocks from pindex on, read in the background, or NULL past the tip
+CRescanBatch* StartRescanBatch(const CWallet& wallet, CBlockIndex* pindex, bool fMatchScripts)
+{
+    AssertLockHeld(cs_main);
+    std::vector<CBlockIndex*> vIndex;
+    for (; pindex && vIndex.size() < RESCAN_BATCH_SIZE; pindex = chainActive.Next(pindex))
+        vIndex.push_back(pindex);
+    if (vIndex.empty())
+        return NULL;
+    return new CRescanBatch(wallet, vIndex, fMatchScripts);
+}
+
+} // anon namespace
+
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
@@ -1779,8 +2176,10 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
+    boost::scoped_ptr<CRescanBatch> pbatch;
     {
-        LOCK2(cs_main, cs_wallet);
+        LOCK(cs_main);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
@@ -1788,20 +2187,126 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
-        {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+        pbatch.reset(StartRescanBatch(*this, pindex, true));
+    }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+    // The notes found, witnessed once all the blocks are scanned
+    std::set<JSOutPoint> setNotesFound;
+    while (pbatch) {
+        pbatch->Wait();
+
+        // Trial decryption of the JoinSplits of the whole batch at once, without the locks
+        std::vector<CTransactionRef> vtxShielded;
+        for (const CBlock& block : pbatch->vBlocks)
+            for (const CTransactionRef& ptx : block.vtx)
+                if (!ptx->vjoinsplit.empty())
+                    vtxShielded.push_back(ptx);
+        std::vector<mapNoteData_t> vNoteData;
+        FindMyNotes(vtxShielded, vNoteData);
+
+        LOCK2(cs_main, cs_wallet);
+        // The next batch is read while this one is committed, from where this one
+        // leaves the active chain if it was reorganized meanwhile
+        CBlockIndex* pindexNext = NULL;
+        size_t nBlocks = 0;
+        for (; nBlocks < pbatch->vIndex.size(); nBlocks++) {
+            if (!chainActive.Contains(pbatch->vIndex[nBlocks])) {
+                pindexNext = chainActive.Next(chainActive.FindFork(pbatch->vIndex[nBlocks]));
+                break;
+            }
+        }
+        if (nBlocks == pbatch->vIndex.size())
+            pindexNext = chainActive.Next(pbatch->vIndex.back());
+        boost::scoped_ptr<CRescanBatch> pbatchNext(StartRescanBatch(*this, pindexNext, true));
+
+        size_t nShielded = 0;
+        for (size_t b = 0; b < pbatch->vIndex.size(); b++) {
+            pindex = pbatch->vIndex[b];
+            CBlock& block = pbatch->vBlocks[b];
+            const bool fRead = !block.IsNull();
+            if (b < nBlocks) {
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+                if (!fRead)
+                    ReadBlockFromDisk(block, pindex);
+            }
+            for (size_t i = 0; i < block.vtx.size(); i++) {
+                const CTransaction& tx = *block.vtx[i];
+                const mapNoteData_t* pnoteData = NULL;
+                if (fRead && !tx.vjoinsplit.empty())
+                    pnoteData = &vNoteData[nShielded++];
+                if (b >= nBlocks)
+                    continue;
+
+                bool fAdded;
+                if (fRead) {
+                    const bool fExisted = mapWallet.count(tx.GetHash()) != 0;
+                    if (fExisted && !fUpdate)
+                        continue;
+                    fAdded = AddToWalletIfInvolvingMe(tx, &block, pnoteData ? *pnoteData : mapNoteData_t(),
+                                                      fExisted || pbatch->vMine[b][i]);
+                } else {
+                    fAdded = AddToWalletIfInvolvingMe(tx, &block, fUpdate);
+                }
+                if (fAdded) {
                     ret++;
+                    for (const mapNoteData_t::value_type& item : mapWallet[tx.GetHash()].mapNoteData)
+                        setNotesFound.insert(item.first);
+                }
             }
+        }
+
+        WriteBlockTxs();
+
+        pbatch.swap(pbatchNext);
+        if (GetTime() >= nNow + 60 && pindexNext) {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindexNext->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindexNext));
+        }
+    }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+    LOCK2(cs_main, cs_wallet);
+    // The notes found in blocks below the ones connected while cs_main was released
+    // were given the height of those by IncrementNoteWitnesses, without a witness
+    for (const JSOutPoint& jsoutpt : setNotesFound) {
+        CNoteData& nd = mapWallet[jsoutpt.hash].mapNoteData[jsoutpt];
+        if (nd.witnesses.empty() && nd.witnessHeight != -1) {
+            nd.witnessHeight = -1;
+            MarkNoteWitnessesDirty(jsoutpt, std::numeric_limits<int>::min());
+        }
+    }
+
+    // Witnesses are built from the lowest block a note behind the tip needs
+    int nWitnessFrom = chainActive.Height() + 1;
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        for (const mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
+            const CNoteData& nd = item.second;
+            if (nd.witnessHeight >= chainActive.Height())
+                continue;
+            if (nd.witnessHeight >= 0) {
+                nWitnessFrom = std::min(nWitnessFrom, nd.witnessHeight + 1);
+            } else {
+                BlockMap::const_iterator mi = mapBlockIndex.find(wtxItem.second.hashBlock);
+                if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+                    nWitnessFrom = std::min(nWitnessFrom, mi->second->nHeight);
+            }
+        }
+    }
+    if (nWitnessFrom <= chainActive.Height()) {
+        LogPrintf("Building note witnesses from block %d\n", nWitnessFrom);
+        pbatch.reset(StartRescanBatch(*this, chainActive[nWitnessFrom], false));
+    }
+    while (pbatch) {
+        pbatch->Wait();
+        boost::scoped_ptr<CRescanBatch> pbatchNext(StartRescanBatch(*this, chainActive.Next(pbatch->vIndex.back()), false));
+        for (size_t b = 0; b < pbatch->vIndex.size(); b++) {
+            pindex = pbatch->vIndex[b];
+            CBlock& block = pbatch->vBlocks[b];
+            if (block.IsNull())
+                ReadBlockFromDisk(block, pindex);
 
             ZCIncrementalMerkleTree tree;
             // This should never fail: we should always be able to get the tree
@@ -1809,14 +2314,8 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             assert(pcoinsTip->GetAnchorAt(pindex->hashAnchor, tree));
             // Increment note witness caches
             IncrementNoteWitnesses(pindex, &block, tree);
-
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
-            }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        pbatch.swap(pbatchNext);
     }
     return ret;
 }
@@ -2124,94 +2623,147 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
  */
 
 
-CAmount CWallet::GetBalance() const
+void CWallet::UpdateBalanceCache() const
 {
-    CAmount nTotal = 0;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    const unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    if (balanceCache.fValid && balanceCache.pindexTip == chainActive.Tip() &&
+        balanceCache.nMempoolUpdated == nMempoolUpdated && balanceCache.nWalletTxChanges == nWalletTxChanges)
+        return;
+
+    // Only the transactions with outputs in the coin index have credit left
+    UpdateCoinIndex();
+    std::fill(balanceCache.vBalances, balanceCache.vBalances + BALANCE_TYPES, 0);
+    const CWalletTx* pcoinLast = NULL;
+    for (const COutPoint& outpoint : setWalletCoins)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const CWalletTx* pcoin = &mapWallet.at(outpoint.hash);
+        if (pcoin == pcoinLast)
+            continue;
+        pcoinLast = pcoin;
+
+        const bool fTrusted = pcoin->IsTrusted();
+        const bool fUnconfirmed = !CheckFinalTx(*pcoin) || (!fTrusted && pcoin->GetDepthInMainChain() == 0);
+        if (fTrusted)
+        {
+            balanceCache.vBalances[BALANCE_TRUSTED] += pcoin->GetAvailableCredit();
+            balanceCache.vBalances[BALANCE_WATCHONLY] += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        if (fUnconfirmed)
         {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+            balanceCache.vBalances[BALANCE_UNCONFIRMED] += pcoin->GetAvailableCredit();
+            balanceCache.vBalances[BALANCE_UNCONFIRMED_WATCHONLY] += pcoin->GetAvailableWatchOnlyCredit();
         }
+        balanceCache.vBalances[BALANCE_IMMATURE] += pcoin->GetImmatureCredit();
+        balanceCache.vBalances[BALANCE_IMMATURE_WATCHONLY] += pcoin->GetImmatureWatchOnlyCredit();
     }
 
-    return nTotal;
+    balanceCache.fValid = true;
+    balanceCache.pindexTip = chainActive.Tip();
+    balanceCache.nMempoolUpdated = nMempoolUpdated;
+    balanceCache.nWalletTxChanges = nWalletTxChanges;
+}
+
+CAmount CWallet::GetCachedBalance(BalanceType type) const
+{
+    LOCK2(cs_main, cs_wallet);
+    UpdateBalanceCache();
+    return balanceCache.vBalances[type];
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetCachedBalance(BALANCE_TRUSTED);
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    return GetCachedBalance(BALANCE_UNCONFIRMED);
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetCachedBalance(BALANCE_IMMATURE);
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
+    return GetCachedBalance(BALANCE_WATCHONLY);
+}
+
+CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
+{
+    return GetCachedBalance(BALANCE_UNCONFIRMED_WATCHONLY);
+}
+
+CAmount CWallet::GetImmatureWatchOnlyBalance() const
+{
+    return GetCachedBalance(BALANCE_IMMATURE_WATCHONLY);
+}
+
+void CWallet::MarkCoinIndexPending(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    nWalletTxChanges++;
+    if (!fCoinIndexBuilt)
+        return;
+    setCoinIndexPending.insert(wtx.GetHash());
+    for (const CTxIn& txin : wtx.vin) {
+        if (mapWallet.count(txin.prevout.hash))
+            setCoinIndexPending.insert(txin.prevout.hash);
     }
+}
 
-    return nTotal;
+bool CWallet::IsCoinSpentInMainChain(const uint256& hash, unsigned int n) const
+{
+    std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range =
+        mapTxSpends.equal_range(COutPoint(hash, n));
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() > 0)
+            return true;
+    }
+    return false;
 }
 
-CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
+void CWallet::IndexCoins(const CWalletTx& wtx) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
+    const uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) != ISMINE_NO && !IsCoinSpentInMainChain(hash, i))
+            setWalletCoins.insert(COutPoint(hash, i));
+        else
+            setWalletCoins.erase(COutPoint(hash, i));
     }
-    return nTotal;
 }
 
-CAmount CWallet::GetImmatureWatchOnlyBalance() const
+void CWallet::UpdateCoinIndex() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (!fCoinIndexBuilt) {
+        setWalletCoins.clear();
+        setCoinIndexPending.clear();
+        for (const std::pair<const uint256, CWalletTx>& p : mapWallet)
+            IndexCoins(p.second);
+        fCoinIndexBuilt = true;
+        return;
+    }
+
+    for (const uint256& hash : setCoinIndexPending) {
+        std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            IndexCoins(it->second);
+        } else {
+            std::set<COutPoint>::iterator itCoin = setWalletCoins.lower_bound(COutPoint(hash, 0));
+            while (itCoin != setWalletCoins.end() && itCoin->hash == hash)
+                setWalletCoins.erase(itCoin++);
         }
     }
-    return nTotal;
+    setCoinIndexPending.clear();
 }
 
 /**
@@ -2223,10 +2775,17 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateCoinIndex();
+
+        // The outputs of the index come grouped by transaction, in the order of mapWallet
+        std::set<COutPoint>::const_iterator itCoin = setWalletCoins.begin();
+        while (itCoin != setWalletCoins.end())
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256 wtxid = itCoin->hash;
+            const CWalletTx* pcoin = &mapWallet.at(wtxid);
+            std::vector<unsigned int> vOutputs;
+            for (; itCoin != setWalletCoins.end() && itCoin->hash == wtxid; ++itCoin)
+                vOutputs.push_back(itCoin->n);
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -2244,11 +2803,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             if (nDepth < 0)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            for (unsigned int i : vOutputs) {
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(wtxid, i)))
                 {
                     if (pcoin->IsCoinBase())
                     {
@@ -2421,7 +2980,107 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     return true;
 }
 
-bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet,  bool& fOnlyCoinbaseCoinsRet, bool& fNeedCoinbaseCoinsRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoinsBnB(const CCoinSelectionParams& params, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
+                             set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+{
+    setCoinsRet.clear();
+    nValueRet = 0;
+
+    // The coins worth spending, by their value less the fee of spending them
+    vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
+    CAmount nAvailable = 0;
+    BOOST_FOREACH(const COutput &output, vCoins)
+    {
+        if (!output.fSpendable)
+            continue;
+
+        const CWalletTx *pcoin = output.tx;
+
+        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+            continue;
+
+        CAmount nEffective = pcoin->vout[output.i].nValue - params.nInputFee;
+        if (nEffective <= 0)
+            continue;
+        vValue.push_back(make_pair(nEffective, make_pair(pcoin, output.i)));
+        nAvailable += nEffective;
+    }
+    if (nAvailable < params.nTarget)
+        return false;
+
+    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+
+    // Depth first search, including each coin before excluding it. vSelection holds the
+    // decisions on the first coins, nAvailable the value of the coins undecided.
+    vector<bool> vSelection, vBest;
+    CAmount nValue = 0;
+    CAmount nBestExcess = std::numeric_limits<CAmount>::max();
+    const int64_t nStart = GetTimeMicros();
+    for (size_t nTries = 0; nTries < COIN_SELECTION_BNB_MAX_TRIES; nTries++)
+    {
+        if (nTries % 1000 == 999 && GetTimeMicros() - nStart > COIN_SELECTION_BNB_MAX_MICROS)
+            break;
+
+        bool fBacktrack = false;
+        if (nValue + nAvailable < params.nTarget || nValue > params.nTarget + params.nCostOfChange)
+            fBacktrack = true;
+        else if (nValue >= params.nTarget)
+        {
+            if (nValue - params.nTarget < nBestExcess)
+            {
+                vBest = vSelection;
+                nBestExcess = nValue - params.nTarget;
+                if (nBestExcess == 0)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack)
+        {
+            // Exclude the last coin included, deciding again on the ones after it
+            while (!vSelection.empty() && !vSelection.back())
+            {
+                vSelection.pop_back();
+                nAvailable += vValue[vSelection.size()].first;
+            }
+            if (vSelection.empty())
+                break;
+            vSelection.back() = false;
+            nValue -= vValue[vSelection.size() - 1].first;
+        }
+        else
+        {
+            const CAmount nNext = vValue[vSelection.size()].first;
+            nAvailable -= nNext;
+            // Including a coin of the value of the one just excluded finds the same sums again
+            if (!vSelection.empty() && !vSelection.back() && nNext == vValue[vSelection.size() - 1].first)
+                vSelection.push_back(false);
+            else
+            {
+                vSelection.push_back(true);
+                nValue += nNext;
+            }
+        }
+    }
+
+    if (vBest.empty())
+        return false;
+
+    for (unsigned int i = 0; i < vBest.size(); i++)
+        if (vBest[i])
+        {
+            setCoinsRet.insert(vValue[i].second);
+            nValueRet += vValue[i].second.first->vout[vValue[i].second.second].nValue;
+        }
+
+    LogPrint("selectcoins", "SelectCoinsBnB() %d coins, total %s, excess %s\n",
+             setCoinsRet.size(), FormatMoney(nValueRet), FormatMoney(nBestExcess));
+    return true;
+}
+
+bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet,  bool& fOnlyCoinbaseCoinsRet, bool& fNeedCoinbaseCoinsRet, const CCoinControl* coinControl,
+                          const CCoinSelectionParams* pParams, bool* pfChangelessRet) const
 {
     // If coinbase utxos can only be sent to zaddrs, exclude any coinbase utxos from coin selection.
     bool fProtectCoinbase = Params().GetConsensus().fCoinbaseMustBeProtected;
@@ -2504,10 +3163,30 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
             ++it;
     }
 
+    // The preset inputs cover their part of the target of the branch and bound selection
+    CCoinSelectionParams params;
+    if (pParams)
+    {
+        params = *pParams;
+        BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, uint32_t)& coin, setPresetCoins)
+            params.nTarget -= coin.first->vout[coin.second].nValue - params.nInputFee;
+    }
+    if (pfChangelessRet)
+        *pfChangelessRet = false;
+    auto selectMinConf = [&](int nConfMine, int nConfTheirs) {
+        if (pParams && params.nTarget > 0 && SelectCoinsBnB(params, nConfMine, nConfTheirs, vCoins, setCoinsRet, nValueRet))
+        {
+            if (pfChangelessRet)
+                *pfChangelessRet = true;
+            return true;
+        }
+        return SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, nConfMine, nConfTheirs, vCoins, setCoinsRet, nValueRet);
+    };
+
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, vCoins, setCoinsRet, nValueRet));
+        selectMinConf(1, 6) ||
+        selectMinConf(1, 1) ||
+        (bSpendZeroConfChange && selectMinConf(0, 1));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -2614,6 +3293,12 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
         LOCK2(cs_main, cs_wallet);
         {
             nFeeRet = 0;
+            // Fee model of the branch and bound selection, and the fee it fell short of so far
+            const CFeeRate feeRate(GetMinimumFee(1000, nTxConfirmTarget, mempool), 1000);
+            const CAmount nInputFee = feeRate.GetFee(COIN_SELECTION_INPUT_SIZE);
+            const CAmount nCostOfChange = nInputFee +
+                feeRate.GetFee(::GetSerializeSize(CTxOut(0, GetScriptForDestination(CKeyID())), SER_NETWORK, PROTOCOL_VERSION));
+            CAmount nBnBShortfall = 0;
             while (true)
             {
                 txNew.vin.clear();
@@ -2663,7 +3348,17 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 CAmount nValueIn = 0;
                 bool fOnlyCoinbaseCoins = false;
                 bool fNeedCoinbaseCoins = false;
-                if (!SelectCoins(nTotalValue, setCoins, nValueIn, fOnlyCoinbaseCoins, fNeedCoinbaseCoins, coinControl))
+                bool fChangeless = false;
+                // The fee subtracted from the amounts needs the change to pay it exactly
+                CCoinSelectionParams params;
+                const CCoinSelectionParams* pParams = NULL;
+                if (nSubtractFeeFromAmount == 0)
+                {
+                    unsigned int nBaseBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
+                    params = CCoinSelectionParams(nValue + feeRate.GetFee(nBaseBytes) + nBnBShortfall, nInputFee, nCostOfChange);
+                    pParams = &params;
+                }
+                if (!SelectCoins(nTotalValue, setCoins, nValueIn, fOnlyCoinbaseCoins, fNeedCoinbaseCoins, coinControl, pParams, &fChangeless))
                 {
                     if (fOnlyCoinbaseCoins && Params().GetConsensus().fCoinbaseMustBeProtected) {
                         strFailReason = _("Coinbase funds can only be sent to a zaddr");
@@ -2691,6 +3386,13 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 if (nSubtractFeeFromAmount == 0)
                     nChange -= nFeeRet;
 
+                // Coins selected to need no change leave their excess to the fee
+                if (fChangeless)
+                {
+                    nFeeRet = nValueIn - nValue;
+                    nChange = 0;
+                }
+
                 if (nChange > 0)
                 {
                     // Fill a vout to ourself
@@ -2850,6 +3552,8 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     break; // Done, enough fee included.
 
                 // Include more fee and try again.
+                if (fChangeless)
+                    nBnBShortfall += nFeeNeeded - nFeeRet;
                 nFeeRet = nFeeNeeded;
                 continue;
             }
@@ -3057,6 +3761,12 @@ bool CWallet::SetDefaultKey(const CPubKey &vchPubKey)
     return true;
 }
 
+//! Size of the keypool given by -keypool
+static unsigned int GetKeyPoolTargetSize()
+{
+    return max(GetArg("-keypool", 100), (int64_t) 0);
+}
+
 /**
  * Mark old keypool keys as used,
  * and generate all new keys 
@@ -3073,18 +3783,52 @@ bool CWallet::NewKeyPool()
         if (IsLocked())
             return false;
 
-        int64_t nKeys = max(GetArg("-keypool", 100), (int64_t)0);
-        for (int i = 0; i < nKeys; i++)
-        {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
-        }
+        unsigned int nKeys = GetKeyPoolTargetSize();
+        while (setKeyPool.size() < nKeys)
+            AddKeysToKeyPool(nKeys - setKeyPool.size());
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
     return true;
 }
 
+void CWallet::AddKeysToKeyPool(unsigned int nKeys)
+{
+    AssertLockHeld(cs_wallet);
+    nKeys = min(nKeys, KEYPOOL_WRITE_BATCH_SIZE);
+    if (nKeys == 0)
+        return;
+
+    // GenerateNewKey would write the version outside of the transaction
+    if (CanSupportFeature(FEATURE_COMPRPUBKEY))
+        SetMinVersion(FEATURE_COMPRPUBKEY);
+
+    CWalletDB walletdb(strWalletFile);
+    if (!walletdb.TxnBegin())
+        throw runtime_error("TopUpKeyPool(): could not begin a database transaction");
+
+    // The pool only gets the keys once they are committed
+    vector<int64_t> vIndexes;
+    int64_t nEnd = setKeyPool.empty() ? 1 : *(--setKeyPool.end()) + 1;
+    pwalletdbKeyPool = &walletdb;
+    try {
+        for (unsigned int i = 0; i < nKeys; i++, nEnd++) {
+            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
+                throw runtime_error("TopUpKeyPool(): writing generated key failed");
+            vIndexes.push_back(nEnd);
+        }
+    } catch (...) {
+        pwalletdbKeyPool = NULL;
+        walletdb.TxnAbort();
+        throw;
+    }
+    pwalletdbKeyPool = NULL;
+    if (!walletdb.TxnCommit())
+        throw runtime_error("TopUpKeyPool(): committing generated keys failed");
+
+    setKeyPool.insert(vIndexes.begin(), vIndexes.end());
+    LogPrintf("keypool added keys %d to %d, size=%u\n", vIndexes.front(), vIndexes.back(), setKeyPool.size());
+}
+
 bool CWallet::TopUpKeyPool(unsigned int kpSize)
 {
     {
@@ -3093,29 +3837,63 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
-
         // Top up key pool
         unsigned int nTargetSize;
         if (kpSize > 0)
             nTargetSize = kpSize;
         else
-            nTargetSize = max(GetArg("-keypool", 100), (int64_t) 0);
+            nTargetSize = GetKeyPoolTargetSize();
 
         while (setKeyPool.size() < (nTargetSize + 1))
-        {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool(): writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
-        }
+            AddKeysToKeyPool(nTargetSize + 1 - setKeyPool.size());
     }
     return true;
 }
 
+void CWallet::TopUpKeyPoolInBackground()
+{
+    AssertLockHeld(cs_wallet);
+    if (fKeyPoolThreadRunning)
+        return;
+
+    // The last thread has finished its top up, and needs cs_wallet no more
+    if (keypoolThread.joinable())
+        keypoolThread.join();
+    fKeyPoolThreadRunning = true;
+    keypoolThread = boost::thread(&CWallet::ThreadTopUpKeyPool, this);
+}
+
+void CWallet::ThreadTopUpKeyPool()
+{
+    RenameThread("horizen-keypool");
+    try {
+        while (true) {
+            boost::this_thread::interruption_point();
+            // cs_wallet is released after each batch, for the callers waiting for it
+            LOCK(cs_wallet);
+            const unsigned int nTargetSize = GetKeyPoolTargetSize() + 1;
+            if (IsLocked() || setKeyPool.size() >= nTargetSize) {
+                fKeyPoolThreadRunning = false;
+                return;
+            }
+            AddKeysToKeyPool(nTargetSize - setKeyPool.size());
+        }
+    } catch (const boost::thread_interrupted&) {
+    } catch (const std::exception& e) {
+        LogPrintf("ThreadTopUpKeyPool(): %s\n", e.what());
+    }
+    LOCK(cs_wallet);
+    fKeyPoolThreadRunning = false;
+}
+
+void CWallet::StopKeyPoolThread()
+{
+    if (!keypoolThread.joinable())
+        return;
+    keypoolThread.interrupt();
+    keypoolThread.join();
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
@@ -3123,8 +3901,15 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
     {
         LOCK(cs_wallet);
 
-        if (!IsLocked())
-            TopUpKeyPool();
+        // Only the first batch of a top up is written here, the background thread
+        // writes the rest
+        if (!IsLocked()) {
+            const unsigned int nTargetSize = GetKeyPoolTargetSize() + 1;
+            if (setKeyPool.size() < nTargetSize)
+                AddKeysToKeyPool(nTargetSize - setKeyPool.size());
+            if (setKeyPool.size() < nTargetSize)
+                TopUpKeyPoolInBackground();
+        }
 
         // Get the oldest key
         if(setKeyPool.empty())
@@ -3586,6 +4371,33 @@ CWalletKey::CWalletKey(int64_t nExpires)
     nTimeExpires = nExpires;
 }
 
+namespace {
+//! The CWalletReadView in scope on this thread
+thread_local CWalletReadView* pwalletReadView = NULL;
+}
+
+CWalletReadView::CWalletReadView() : tip(GetChainTipView()), fComplete(true)
+{
+    assert(pwalletReadView == NULL);
+    pwalletReadView = this;
+}
+
+CWalletReadView::~CWalletReadView()
+{
+    pwalletReadView = NULL;
+}
+
+const CChainTipView* CWalletReadView::Current()
+{
+    return pwalletReadView ? pwalletReadView->tip.get() : NULL;
+}
+
+void CWalletReadView::SetIncomplete()
+{
+    if (pwalletReadView)
+        pwalletReadView->fComplete = false;
+}
+
 void CMerkleTx::SetMerkleBranch(const CBlock& block)
 {
     CBlock blockTmp;
@@ -3595,7 +4407,7 @@ void CMerkleTx::SetMerkleBranch(const CBlock& block)
 
     // Locate the transaction
     for (nIndex = 0; nIndex < (int)block.vtx.size(); nIndex++)
-        if (block.vtx[nIndex] == *(CTransaction*)this)
+        if (*block.vtx[nIndex] == *(CTransaction*)this)
             break;
     if (nIndex == (int)block.vtx.size())
     {
@@ -3612,14 +4424,13 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(const CBlockIndex* &pindexRet) const
 {
     if (hashBlock.IsNull() || nIndex == -1)
         return 0;
-    AssertLockHeld(cs_main);
+    const CChainTipView* pview = CWalletReadView::Current();
+    if (pview == NULL)
+        AssertLockHeld(cs_main);
 
     // Find the block it claims to be in
-    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-    if (mi == mapBlockIndex.end())
-        return 0;
-    CBlockIndex* pindex = (*mi).second;
-    if (!pindex || !chainActive.Contains(pindex))
+    const CBlockIndex* pindex = LookupBlock();
+    if (!pindex || !(pview ? pview->Contains(pindex) : chainActive.Contains(pindex)))
         return 0;
 
     // Make sure the merkle branch connects to this block
@@ -3631,12 +4442,29 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(const CBlockIndex* &pindexRet) const
     }
 
     pindexRet = pindex;
-    return chainActive.Height() - pindex->nHeight + 1;
+    return (pview ? pview->nHeight : chainActive.Height()) - pindex->nHeight + 1;
+}
+
+const CBlockIndex* CMerkleTx::LookupBlock() const
+{
+    if (pindexBlockCache && pindexBlockCache->GetBlockHash() == hashBlock)
+        return pindexBlockCache;
+
+    // Without a read view cs_main is held already, with one it is only tried
+    TRY_LOCK(cs_main, lockMain);
+    if (!lockMain) {
+        CWalletReadView::SetIncomplete();
+        return NULL;
+    }
+    BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+    pindexBlockCache = mi == mapBlockIndex.end() ? NULL : mi->second;
+    return pindexBlockCache;
 }
 
 int CMerkleTx::GetDepthInMainChain(const CBlockIndex* &pindexRet) const
 {
-    AssertLockHeld(cs_main);
+    if (CWalletReadView::Current() == NULL)
+        AssertLockHeld(cs_main);
     int nResult = GetDepthInMainChainINTERNAL(pindexRet);
     if (nResult == 0 && !mempool.exists(GetHash()))
         return -1; // Not in chain, not in mempool
@@ -3662,6 +4490,140 @@ bool CMerkleTx::AcceptToMemoryPool(bool fLimitFree, bool fRejectAbsurdFee)
  * Find notes in the wallet filtered by payment address, min depth and ability to spend.
  * These notes are decrypted and added to the output parameter vector, outEntries.
  */
+/**
+ * Whether a wallet transaction confirmed in the active chain spends the note. A spend only
+ * in the mempool, or a conflicted one, leaves the note in the unspent notes of the index.
+ */
+bool CWallet::IsNoteSpentInMainChain(const CNoteData& nd) const
+{
+    if (!nd.nullifier)
+        return false;
+    std::pair<TxNullifiers::const_iterator, TxNullifiers::const_iterator> range =
+        mapTxNullifiers.equal_range(*nd.nullifier);
+    for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() > 0)
+            return true;
+    }
+    return false;
+}
+
+void CWallet::IndexNote(const JSOutPoint& jsop, const CWalletTx& wtx, const CNoteData& nd)
+{
+    const PaymentAddress& pa = nd.address;
+    if (!mapNotePlaintexts.count(jsop)) {
+        int i = jsop.js; // Index into CTransaction.vjoinsplit
+        int j = jsop.n; // Index into JSDescription.ciphertexts
+
+        // Get cached decryptor
+        ZCNoteDecryption decryptor;
+        if (!GetNoteDecryptor(pa, decryptor)) {
+            // Note decryptors are created when the wallet is loaded, so it should always exist
+            throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", CZCPaymentAddress(pa).ToString()));
+        }
+
+        // determine amount of funds in the note
+        auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
+        try {
+            NotePlaintext plaintext = NotePlaintext::decrypt(
+                    decryptor,
+                    wtx.vjoinsplit[i].ciphertexts[j],
+                    wtx.vjoinsplit[i].ephemeralKey,
+                    hSig,
+                    (unsigned char) j);
+
+            mapNotePlaintexts.insert(std::make_pair(jsop, plaintext));
+
+        } catch (const note_decryption_failed &err) {
+            // Couldn't decrypt with this spending key
+            throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", CZCPaymentAddress(pa).ToString()));
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", CZCPaymentAddress(pa).ToString(), exc.what()));
+        }
+    }
+
+    if (IsNoteSpentInMainChain(nd)) {
+        mapUnspentNotes[pa].erase(jsop);
+        mapSpentNotes[pa].insert(jsop);
+    } else {
+        mapSpentNotes[pa].erase(jsop);
+        mapUnspentNotes[pa].insert(jsop);
+    }
+
+    std::map<JSOutPoint, int64_t>::iterator mi = mapNoteOrderPos.find(jsop);
+    if (mi == mapNoteOrderPos.end() || mi->second != wtx.nOrderPos) {
+        if (mi != mapNoteOrderPos.end())
+            mapNotesByOrder[pa].erase(std::make_pair(mi->second, jsop));
+        mapNoteOrderPos[jsop] = wtx.nOrderPos;
+        mapNotesByOrder[pa].insert(std::make_pair(wtx.nOrderPos, jsop));
+    }
+}
+
+void CWallet::UpdateNoteIndex()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (!fNoteIndexBuilt) {
+        mapNotePlaintexts.clear();
+        mapUnspentNotes.clear();
+        mapSpentNotes.clear();
+        mapNotesByOrder.clear();
+        mapNoteOrderPos.clear();
+        setNoteIndexPending.clear();
+        for (const std::pair<const uint256, CWalletTx>& p : mapWallet) {
+            for (const mapNoteData_t::value_type& item : p.second.mapNoteData)
+                IndexNote(item.first, p.second, item.second);
+        }
+        fNoteIndexBuilt = true;
+        return;
+    }
+
+    while (!setNoteIndexPending.empty()) {
+        const JSOutPoint jsop = *setNoteIndexPending.begin();
+        std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(jsop.hash);
+        if (it != mapWallet.end() && it->second.mapNoteData.count(jsop)) {
+            IndexNote(jsop, it->second, it->second.mapNoteData.at(jsop));
+        } else {
+            // The transaction was removed, or found not to have the note after all
+            mapNotePlaintexts.erase(jsop);
+            for (std::pair<const PaymentAddress, std::set<JSOutPoint> >& p : mapUnspentNotes)
+                p.second.erase(jsop);
+            for (std::pair<const PaymentAddress, std::set<JSOutPoint> >& p : mapSpentNotes)
+                p.second.erase(jsop);
+            std::map<JSOutPoint, int64_t>::iterator mi = mapNoteOrderPos.find(jsop);
+            if (mi != mapNoteOrderPos.end()) {
+                for (std::pair<const PaymentAddress, std::set<std::pair<int64_t, JSOutPoint> > >& p : mapNotesByOrder)
+                    p.second.erase(std::make_pair(mi->second, jsop));
+                mapNoteOrderPos.erase(mi);
+            }
+        }
+        setNoteIndexPending.erase(jsop);
+    }
+}
+
+bool CWallet::PrepareNoteIndex()
+{
+    if (CWalletReadView::Current() == NULL) {
+        UpdateNoteIndex();
+        return true;
+    }
+    if (fNoteIndexBuilt && setNoteIndexPending.empty())
+        return true;
+    // The note index is only updated under cs_main
+    CWalletReadView::SetIncomplete();
+    return false;
+}
+
+/** Whether the notes of wtx are listed with minDepth, the transactions being filtered before their notes */
+static bool IsNoteTxListed(const CWalletTx& wtx, int minDepth)
+{
+    const CChainTipView* pview = CWalletReadView::Current();
+    const bool fFinal = pview ? IsFinalTx(wtx, pview->nHeight + 1, GetTime()) : CheckFinalTx(wtx);
+    return fFinal && wtx.GetBlocksToMaturity() <= 0 && wtx.GetDepthInMainChain() >= minDepth;
+}
+
 void CWallet::GetFilteredNotes(std::vector<CNotePlaintextEntry> & outEntries, std::string address, int minDepth, bool ignoreSpent, bool ignoreUnspendable)
 {
     bool fFilterAddress = false;
@@ -3671,69 +4633,104 @@ void CWallet::GetFilteredNotes(std::vector<CNotePlaintextEntry> & outEntries, st
         fFilterAddress = true;
     }
 
-    LOCK2(cs_main, cs_wallet);
+    // A query under a CWalletReadView holds cs_wallet already, without cs_main
+    CCriticalBlock lockMain(CWalletReadView::Current() ? NULL : &cs_main, "cs_main", __FILE__, __LINE__);
+    LOCK(cs_wallet);
 
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    if (!PrepareNoteIndex())
+        return;
 
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < minDepth) {
-            continue;
+    // The candidate notes, in the order of mapWallet as they were found before the index
+    std::set<JSOutPoint> setCandidates;
+    std::vector<const std::map<PaymentAddress, std::set<JSOutPoint> >*> vMaps;
+    vMaps.push_back(&mapUnspentNotes);
+    if (!ignoreSpent)
+        vMaps.push_back(&mapSpentNotes);
+    for (const std::map<PaymentAddress, std::set<JSOutPoint> >* pmap : vMaps) {
+        if (fFilterAddress) {
+            std::map<PaymentAddress, std::set<JSOutPoint> >::const_iterator it = pmap->find(filterPaymentAddress);
+            if (it != pmap->end())
+                setCandidates.insert(it->second.begin(), it->second.end());
+        } else {
+            for (const std::pair<const PaymentAddress, std::set<JSOutPoint> >& p : *pmap)
+                setCandidates.insert(p.second.begin(), p.second.end());
         }
+    }
+
+    for (const JSOutPoint& jsop : setCandidates) {
+        const CWalletTx& wtx = mapWallet.at(jsop.hash);
 
-        if (wtx.mapNoteData.size() == 0) {
+        if (!IsNoteTxListed(wtx, minDepth)) {
             continue;
         }
 
-        for (auto & pair : wtx.mapNoteData) {
-            JSOutPoint jsop = pair.first;
-            CNoteData nd = pair.second;
-            PaymentAddress pa = nd.address;
+        const CNoteData& nd = wtx.mapNoteData.at(jsop);
+        const PaymentAddress& pa = nd.address;
 
-            // skip notes which belong to a different payment address in the wallet
-            if (fFilterAddress && !(pa == filterPaymentAddress)) {
-                continue;
-            }
+        // skip note which has been spent, in the mempool as well as in the chain
+        if (ignoreSpent && nd.nullifier && IsSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSpent(*nd.nullifier)) {
-                continue;
-            }
+        // skip notes which cannot be spent
+        if (ignoreUnspendable && !HaveSpendingKey(pa)) {
+            continue;
+        }
 
-            // skip notes which cannot be spent
-            if (ignoreUnspendable && !HaveSpendingKey(pa)) {
-                continue;
-            }
+        outEntries.push_back(CNotePlaintextEntry{jsop, mapNotePlaintexts.at(jsop)});
+    }
+}
 
-            int i = jsop.js; // Index into CTransaction.vjoinsplit
-            int j = jsop.n; // Index into JSDescription.ciphertexts
+bool CWallet::GetReceivedNotesPage(std::vector<CNotePlaintextEntry>& outEntries, const PaymentAddress& address, int minDepth, int nCount, const uint256& txidBefore)
+{
+    CCriticalBlock lockMain(CWalletReadView::Current() ? NULL : &cs_main, "cs_main", __FILE__, __LINE__);
+    LOCK(cs_wallet);
 
-            // Get cached decryptor
-            ZCNoteDecryption decryptor;
-            if (!GetNoteDecryptor(pa, decryptor)) {
-                // Note decryptors are created when the wallet is loaded, so it should always exist
-                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", CZCPaymentAddress(pa).ToString()));
-            }
+    int64_t nPosBefore = std::numeric_limits<int64_t>::max();
+    if (!txidBefore.IsNull()) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txidBefore);
+        if (mi == mapWallet.end())
+            return false;
+        nPosBefore = mi->second.nOrderPos;
+    }
+    if (!PrepareNoteIndex())
+        return true;
 
-            // determine amount of funds in the note
-            auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
-            try {
-                NotePlaintext plaintext = NotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vjoinsplit[i].ciphertexts[j],
-                        wtx.vjoinsplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
-
-                outEntries.push_back(CNotePlaintextEntry{jsop, plaintext});
-
-            } catch (const note_decryption_failed &err) {
-                // Couldn't decrypt with this spending key
-                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", CZCPaymentAddress(pa).ToString()));
-            } catch (const std::exception &exc) {
-                // Unexpected failure
-                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", CZCPaymentAddress(pa).ToString(), exc.what()));
-            }
+    std::map<PaymentAddress, std::set<std::pair<int64_t, JSOutPoint> > >::const_iterator it = mapNotesByOrder.find(address);
+    if (it == mapNotesByOrder.end())
+        return true;
+    const std::set<std::pair<int64_t, JSOutPoint> >& setNotes = it->second;
+    std::vector<CNotePlaintextEntry> vPage;
+    const CWalletTx* pwtxLast = NULL;
+    std::set<std::pair<int64_t, JSOutPoint> >::const_iterator itBefore = setNotes.lower_bound(std::make_pair(nPosBefore, JSOutPoint(uint256(), 0, 0)));
+    for (std::set<std::pair<int64_t, JSOutPoint> >::const_reverse_iterator ri(itBefore); ri != setNotes.rend(); ++ri) {
+        const JSOutPoint& jsop = ri->second;
+        const CWalletTx& wtx = mapWallet.at(jsop.hash);
+        if (nCount >= 0 && (int)vPage.size() >= nCount && &wtx != pwtxLast)
+            break;
+        pwtxLast = &wtx;
+        if (IsNoteTxListed(wtx, minDepth))
+            vPage.push_back(CNotePlaintextEntry{jsop, mapNotePlaintexts.at(jsop)});
+    }
+    outEntries.insert(outEntries.end(), vPage.rbegin(), vPage.rend());
+    return true;
+}
+
+size_t CWallet::DynamicMemoryUsage(size_t& nWitnessUsage) const
+{
+    LOCK(cs_wallet);
+    size_t nUsage = memusage::DynamicUsage(mapWallet);
+    nWitnessUsage = 0;
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        const CWalletTx& wtx = wtxItem.second;
+        nUsage += RecursiveDynamicUsage(wtx) + memusage::DynamicUsage(wtx.vMerkleBranch) +
+                  memusage::DynamicUsage(wtx.mapValue) + memusage::DynamicUsage(wtx.vOrderForm) +
+                  memusage::DynamicUsage(wtx.mapNoteData);
+        for (const mapNoteData_t::value_type& item : wtx.mapNoteData) {
+            nWitnessUsage += memusage::DynamicUsage(item.second.witnesses);
+            for (const ZCIncrementalWitness& witness : item.second.witnesses)
+                nWitnessUsage += witness.DynamicMemoryUsage();
         }
     }
+    return nUsage + nWitnessUsage;
 }
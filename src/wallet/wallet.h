@@ -25,7 +25,9 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <limits>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdexcept>
 #include <stdint.h>
@@ -33,6 +35,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/thread.hpp>
+
 /**
  * Settings
  */
@@ -59,6 +63,20 @@ static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 //  Should be large enough that we can expect not to reorg beyond our cache
 //  unless there is some exceptional network disruption.
 static const unsigned int WITNESS_CACHE_SIZE = COINBASE_MATURITY;
+//! Note decryptors tried by each job of the note decryption threads
+static const size_t NOTE_DECRYPTION_BATCH_SIZE = 16;
+//! Blocks a rescan reads ahead and commits at once, releasing cs_main after each batch
+static const size_t RESCAN_BATCH_SIZE = 32;
+//! Threads reading the blocks of a rescan
+static const int RESCAN_READ_THREADS = 4;
+//! Combinations the branch and bound coin selection tries at most
+static const size_t COIN_SELECTION_BNB_MAX_TRIES = 100000;
+//! Time the branch and bound coin selection runs for at most
+static const int64_t COIN_SELECTION_BNB_MAX_MICROS = 100000;
+//! Size assumed for a signed input paying to a key hash
+static const unsigned int COIN_SELECTION_INPUT_SIZE = 148;
+//! Keys a keypool top up generates and writes in one database transaction, holding cs_wallet
+static const unsigned int KEYPOOL_WRITE_BATCH_SIZE = 100;
 
 class CBlockIndex;
 class CCoinControl;
@@ -263,6 +281,25 @@ public:
 
 typedef std::map<JSOutPoint, CNoteData> mapNoteData_t;
 
+/**
+ * The witnesses of a note as the wallet database has them. They are written apart from
+ * the transaction of the note, one record per height, so a flush only writes the
+ * records of the heights which changed.
+ */
+struct CNoteWitnessState
+{
+    //! Heights of the witnesses written, none if nTop < nBottom
+    int nBottom;
+    int nTop;
+    //! Lowest height whose witness changed since the last write, or the cache height
+    //! itself, INT_MAX if nothing did
+    int nDirtyFrom;
+
+    CNoteWitnessState() : nBottom(0), nTop(-1), nDirtyFrom(std::numeric_limits<int>::max()) { }
+
+    bool IsDirty() const { return nDirtyFrom != std::numeric_limits<int>::max(); }
+};
+
 /** Decrypted note and its location in a transaction. */
 struct CNotePlaintextEntry
 {
@@ -272,11 +309,43 @@ struct CNotePlaintextEntry
 
 
 
+struct CChainTipView;
+
+/**
+ * The chain tip a read-only query of the wallet takes the depths of the transactions
+ * against on this thread while it is in scope, instead of chainActive, so the query holds
+ * cs_wallet without cs_main. cs_main is never waited for with cs_wallet held, so a block
+ * the wallet has not looked up yet is looked up only if cs_main is free, and otherwise
+ * the view is marked incomplete and the results of the query are not to be used.
+ */
+class CWalletReadView
+{
+public:
+    CWalletReadView();
+    ~CWalletReadView();
+
+    //! The view in scope on this thread, NULL if the wallet is read under cs_main
+    static const CChainTipView* Current();
+    //! Mark the view in scope on this thread incomplete
+    static void SetIncomplete();
+
+    bool IsComplete() const { return fComplete; }
+
+private:
+    std::shared_ptr<const CChainTipView> tip;
+    bool fComplete;
+
+    CWalletReadView(const CWalletReadView&);
+    void operator=(const CWalletReadView&);
+};
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
 private:
     int GetDepthInMainChainINTERNAL(const CBlockIndex* &pindexRet) const;
+    //! The index of hashBlock, NULL if it is not known or could not be looked up
+    const CBlockIndex* LookupBlock() const;
 
 public:
     uint256 hashBlock;
@@ -285,6 +354,8 @@ public:
 
     // memory only
     mutable bool fMerkleVerified;
+    //! Index of the last block hashBlock was looked up as, read without cs_main
+    mutable const CBlockIndex* pindexBlockCache;
 
 
     CMerkleTx()
@@ -302,6 +373,7 @@ public:
         hashBlock = uint256();
         nIndex = -1;
         fMerkleVerified = false;
+        pindexBlockCache = NULL;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -487,7 +559,7 @@ public:
         MarkDirty();
     }
 
-    void SetNoteData(mapNoteData_t &noteData);
+    void SetNoteData(const mapNoteData_t &noteData);
 
     //! filter decides which addresses will count towards the debit
     CAmount GetDebit(const isminefilter& filter) const;
@@ -540,7 +612,24 @@ public:
     std::string ToString() const;
 };
 
-
+/**
+ * The fee model of the branch and bound coin selection, which looks for inputs whose
+ * values, less the fee of spending them, cover nTarget without exceeding it by more than
+ * nCostOfChange, so that the transaction needs no change output.
+ */
+struct CCoinSelectionParams
+{
+    //! Value sent with the fee of the transaction without its inputs
+    CAmount nTarget;
+    //! Fee of an input
+    CAmount nInputFee;
+    //! Fee of a change output and of spending it later, the most the excess can be
+    CAmount nCostOfChange;
+
+    CCoinSelectionParams() : nTarget(0), nInputFee(0), nCostOfChange(0) {}
+    CCoinSelectionParams(CAmount nTargetIn, CAmount nInputFeeIn, CAmount nCostOfChangeIn) :
+        nTarget(nTargetIn), nInputFee(nInputFeeIn), nCostOfChange(nCostOfChangeIn) {}
+};
 
 
 /** Private key that includes an expiration date in case it never gets used. */
@@ -658,9 +747,27 @@ private:
 class CWallet : public CCryptoKeyStore, public CValidationInterface
 {
 private:
-    bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool& fOnlyCoinbaseCoinsRet, bool& fNeedCoinbaseCoinsRet, const CCoinControl *coinControl = NULL) const;
+    /**
+     * Select coins for nTargetValue. With pParams, each number of confirmations is first
+     * tried with the branch and bound selection, and fChangelessRet tells whether it
+     * found the coins, whose excess is then left to the fee.
+     */
+    bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool& fOnlyCoinbaseCoinsRet, bool& fNeedCoinbaseCoinsRet, const CCoinControl *coinControl = NULL,
+                     const CCoinSelectionParams* pParams = NULL, bool* pfChangelessRet = NULL) const;
 
     CWalletDB *pwalletdbEncryption;
+    //! Database handle of the transaction of a keypool top up, which the generated keys are written with
+    CWalletDB *pwalletdbKeyPool;
+
+    //! Thread topping up the rest of the keypool after a key is reserved, and whether it runs (cs_wallet)
+    boost::thread keypoolThread;
+    bool fKeyPoolThreadRunning;
+
+    //! Add up to KEYPOOL_WRITE_BATCH_SIZE of nKeys new keys to the keypool, in one database transaction
+    void AddKeysToKeyPool(unsigned int nKeys);
+    void TopUpKeyPoolInBackground();
+    void ThreadTopUpKeyPool();
+    void StopKeyPoolThread();
 
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
@@ -692,6 +799,107 @@ private:
     void AddToSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * The notes found in the transactions of the last block synced, all found at once
+     * with the decryptors there were then, keyed by txid. Only the transactions with
+     * notes are in mapBlockNoteData.
+     */
+    uint256 hashNoteDataBlock;
+    size_t nNoteDataDecryptors;
+    std::map<uint256, mapNoteData_t> mapBlockNoteData;
+
+    //! The notes of a transaction of block, from the ones found for the whole block
+    mapNoteData_t FindMyNotes(const CTransaction& tx, const CBlock& block);
+
+    /**
+     * The witnesses of the notes in the wallet database, and the transactions whose
+     * note data changed apart from them, which SetBestChain writes again.
+     */
+    std::map<JSOutPoint, CNoteWitnessState> mapNoteWitnessState;
+    std::set<uint256> setNoteTxsToWrite;
+
+    //! Transactions found in blocks, which WriteBlockTxs writes together at the end of the block or rescan batch
+    std::set<uint256> setBlockTxsToWrite;
+    void WriteBlockTxs();
+
+    //! The witness of jsoutpt at nHeight and above, or its cache height, changed
+    void MarkNoteWitnessesDirty(const JSOutPoint& jsoutpt, int nHeight);
+
+    /**
+     * The notes of the wallet by payment address, split by whether a wallet transaction
+     * confirmed in the active chain spends them, with their plaintexts decrypted once.
+     * Built by the first GetFilteredNotes, which then only classifies again the notes of
+     * setNoteIndexPending: the ones of the transactions added or updated since, and the
+     * ones these spend. mapNotesByOrder has all the notes of each address by the order
+     * position of their transaction, for GetReceivedNotesPage.
+     */
+    bool fNoteIndexBuilt;
+    std::map<JSOutPoint, libzcash::NotePlaintext> mapNotePlaintexts;
+    std::map<libzcash::PaymentAddress, std::set<JSOutPoint> > mapUnspentNotes;
+    std::map<libzcash::PaymentAddress, std::set<JSOutPoint> > mapSpentNotes;
+    std::map<libzcash::PaymentAddress, std::set<std::pair<int64_t, JSOutPoint> > > mapNotesByOrder;
+    std::map<JSOutPoint, int64_t> mapNoteOrderPos;
+    std::set<JSOutPoint> setNoteIndexPending;
+
+    //! Queue the notes of wtx, and the notes it spends, to be classified again
+    void MarkNoteIndexPending(const CWalletTx& wtx);
+    //! Bring the note index up to date with mapWallet
+    void UpdateNoteIndex();
+    //! UpdateNoteIndex, or under a CWalletReadView, which cannot update it, whether it is up to date
+    bool PrepareNoteIndex();
+    void IndexNote(const JSOutPoint& jsop, const CWalletTx& wtx, const CNoteData& nd);
+    bool IsNoteSpentInMainChain(const CNoteData& nd) const;
+
+    /**
+     * The outputs of the wallet transactions which are ours and which no wallet
+     * transaction confirmed in the active chain spends, the candidates of AvailableCoins.
+     * Built by its first call, which then only classifies again the outputs of
+     * setCoinIndexPending: the transactions added or updated since, and the ones these
+     * spend from. Spends only in the mempool are still filtered with IsSpent.
+     */
+    mutable bool fCoinIndexBuilt;
+    mutable std::set<COutPoint> setWalletCoins;
+    mutable std::set<uint256> setCoinIndexPending;
+
+    //! Queue the outputs of wtx, and the outputs it spends, to be classified again
+    void MarkCoinIndexPending(const CWalletTx& wtx);
+    //! Bring the coin index up to date with mapWallet
+    void UpdateCoinIndex() const;
+    void IndexCoins(const CWalletTx& wtx) const;
+    bool IsCoinSpentInMainChain(const uint256& hash, unsigned int n) const;
+
+    /**
+     * The balances, from the transactions of the coin index, as of a tip, a state of the
+     * mempool and a number of changes to the wallet transactions. The mempool counts its
+     * updates, and nWalletTxChanges the transactions added, updated or erased, and the
+     * times the outputs which are ours may have changed.
+     */
+    enum BalanceType {
+        BALANCE_TRUSTED,
+        BALANCE_UNCONFIRMED,
+        BALANCE_IMMATURE,
+        BALANCE_WATCHONLY,
+        BALANCE_UNCONFIRMED_WATCHONLY,
+        BALANCE_IMMATURE_WATCHONLY,
+        BALANCE_TYPES
+    };
+    struct CBalanceCache
+    {
+        bool fValid;
+        const CBlockIndex* pindexTip;
+        unsigned int nMempoolUpdated;
+        uint64_t nWalletTxChanges;
+        CAmount vBalances[BALANCE_TYPES];
+
+        CBalanceCache() : fValid(false), pindexTip(NULL), nMempoolUpdated(0), nWalletTxChanges(0) {}
+    };
+    uint64_t nWalletTxChanges;
+    mutable CBalanceCache balanceCache;
+
+    //! Compute all the balances again if they may have changed
+    void UpdateBalanceCache() const;
+    CAmount GetCachedBalance(BalanceType type) const;
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -702,6 +910,15 @@ public:
 
     void ClearNoteWitnessCache();
 
+    /**
+     * Put the witnesses read from the wallet database, keyed by note then height, into
+     * the note data. Notes without a height record still have their witnesses in their
+     * transaction, as older versions wrote them, and are moved to records on the next
+     * SetBestChain.
+     */
+    void LoadNoteWitnesses(std::map<JSOutPoint, std::map<int, ZCIncrementalWitness> >& mapWitnesses,
+                           std::map<JSOutPoint, int>& mapHeights);
+
 protected:
     /**
      * pindex is the new tip being connected.
@@ -721,20 +938,64 @@ protected:
             LogPrintf("SetBestChain(): Couldn't start atomic write\n");
             return;
         }
+        // What the database has once the write is committed
+        std::vector<std::pair<JSOutPoint, CNoteWitnessState> > vWritten;
         try {
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
-                // We skip transactions for which mapSproutNoteData is empty.
-                //This covers transactions that have no Sprout
-                // (i.e. are purely transparent), as well as shielding and unshielding
-                // transactions in which we only have transparent addresses involved.
-                if (!(wtx.mapNoteData.empty())) {
-                    if (!walletdb.WriteTx(wtxItem.first, wtx)) {
-                        LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
+            // Only the transactions whose note data changed apart from the witnesses
+            for (const uint256& hash : setNoteTxsToWrite) {
+                std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+                if (mi == mapWallet.end() || mi->second.mapNoteData.empty())
+                    continue;
+                if (!walletdb.WriteTx(hash, mi->second)) {
+                    LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
+                    walletdb.TxnAbort();
+                    return;
+                }
+            }
+            for (const std::pair<const JSOutPoint, CNoteWitnessState>& item : mapNoteWitnessState) {
+                const JSOutPoint& jsoutpt = item.first;
+                const CNoteWitnessState& state = item.second;
+                if (!state.IsDirty())
+                    continue;
+                const CNoteData* nd = NULL;
+                std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(jsoutpt.hash);
+                if (mi != mapWallet.end()) {
+                    mapNoteData_t::const_iterator ni = mi->second.mapNoteData.find(jsoutpt);
+                    if (ni != mi->second.mapNoteData.end())
+                        nd = &ni->second;
+                }
+                CNoteWitnessState written;
+                if (nd) {
+                    // The witnesses go down one height at a time from the cache height
+                    int nHeight = nd->witnessHeight;
+                    for (const ZCIncrementalWitness& witness : nd->witnesses) {
+                        if (nHeight >= state.nDirtyFrom || nHeight < state.nBottom || nHeight > state.nTop) {
+                            if (!walletdb.WriteNoteWitness(jsoutpt, nHeight, witness)) {
+                                LogPrintf("SetBestChain(): Failed to write note witness, aborting atomic write\n");
+                                walletdb.TxnAbort();
+                                return;
+                            }
+                        }
+                        nHeight--;
+                    }
+                    written.nBottom = nHeight + 1;
+                    written.nTop = nd->witnessHeight;
+                }
+                for (int nHeight = state.nBottom; nHeight <= state.nTop; nHeight++) {
+                    if (nHeight >= written.nBottom && nHeight <= written.nTop)
+                        continue;
+                    if (!walletdb.EraseNoteWitness(jsoutpt, nHeight)) {
+                        LogPrintf("SetBestChain(): Failed to erase note witness, aborting atomic write\n");
                         walletdb.TxnAbort();
                         return;
-                   }
+                    }
+                }
+                if (nd ? !walletdb.WriteNoteWitnessHeight(jsoutpt, nd->witnessHeight) : !walletdb.EraseNoteWitnessHeight(jsoutpt)) {
+                    LogPrintf("SetBestChain(): Failed to write note witness height, aborting atomic write\n");
+                    walletdb.TxnAbort();
+                    return;
                 }
+                vWritten.push_back(std::make_pair(jsoutpt, written));
             }
             if (!walletdb.WriteWitnessCacheSize(nWitnessCacheSize)) {
                 LogPrintf("SetBestChain(): Failed to write nWitnessCacheSize, aborting atomic write\n");
@@ -758,6 +1019,13 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        setNoteTxsToWrite.clear();
+        for (const std::pair<JSOutPoint, CNoteWitnessState>& item : vWritten) {
+            if (item.second.nTop < item.second.nBottom && !mapWallet.count(item.first.hash))
+                mapNoteWitnessState.erase(item.first);
+            else
+                mapNoteWitnessState[item.first] = item.second;
+        }
     }
 
 private:
@@ -804,6 +1072,7 @@ public:
 
     ~CWallet()
     {
+        StopKeyPoolThread();
         delete pwalletdbEncryption;
         pwalletdbEncryption = NULL;
     }
@@ -815,12 +1084,18 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pwalletdbKeyPool = NULL;
+        fKeyPoolThreadRunning = false;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        nNoteDataDecryptors = 0;
+        fNoteIndexBuilt = false;
+        fCoinIndexBuilt = false;
+        nWalletTxChanges = 0;
     }
 
     /**
@@ -898,6 +1173,12 @@ public:
 
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false, bool fIncludeCoinBase=true, bool fIncludeCommunityFund=true) const;
     bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    /**
+     * Branch and bound search of the coins which need no change under params, by
+     * decreasing value and with the least excess found within COIN_SELECTION_BNB_MAX_TRIES
+     * and COIN_SELECTION_BNB_MAX_MICROS. nValueRet is the value of the coins, fees included.
+     */
+    bool SelectCoinsBnB(const CCoinSelectionParams& params, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
     bool IsSpent(const uint256& nullifier) const;
@@ -981,14 +1262,27 @@ public:
     void MarkDirty();
     bool UpdateNullifierNoteMap();
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
-    bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
+    /**
+     * Add wtxIn, or merge it into the transaction the wallet has. With fDeferWrite it is
+     * written by WriteBlockTxs, with the other transactions of its block, instead of
+     * through pwalletdb.
+     */
+    bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb, bool fDeferWrite = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    //! The same with the notes of tx already found, and fRelevant if the wallet has tx or one of its outputs
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const mapNoteData_t& noteData, bool fRelevant);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<boost::optional<ZCIncrementalWitness>>& witnesses,
          uint256 &final_anchor);
+    /**
+     * Add the transactions of the blocks from pindexStart on to the wallet, then build
+     * the witnesses of the notes found. The blocks are read and matched in batches of
+     * RESCAN_BATCH_SIZE, cs_main being released between batches unless the caller
+     * holds it; the witnesses are built with cs_main held.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
@@ -1030,6 +1324,11 @@ public:
         const uint256& hSig,
         uint8_t n) const;
     mapNoteData_t FindMyNotes(const CTransaction& tx) const;
+    /**
+     * The notes of each of vtx, trying the decryptors on the JoinSplits of all of them
+     * in parallel on the note decryption threads
+     */
+    void FindMyNotes(const std::vector<CTransactionRef>& vtx, std::vector<mapNoteData_t>& vNoteData) const;
     bool IsFromMe(const uint256& nullifier) const;
     void GetNoteWitnesses(
          std::vector<JSOutPoint> notes,
@@ -1048,7 +1347,7 @@ public:
     CAmount GetDebit(const CTransaction& tx, const isminefilter& filter) const;
     CAmount GetCredit(const CTransaction& tx, const isminefilter& filter) const;
     CAmount GetChange(const CTransaction& tx) const;
-    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, ZCIncrementalMerkleTree tree, bool added);
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const ZCIncrementalMerkleTreeRef& tree, bool added);
     /** Saves witness caches and best block locator to disk. */
     void SetBestChain(const CBlockLocator& loc);
 
@@ -1124,13 +1423,32 @@ public:
     /** Set whether this wallet broadcasts transactions. */
     void SetBroadcastTransactions(bool broadcast) { fBroadcastTransactions = broadcast; }
     
+    /**
+     * The memory mapWallet uses with its transactions and their note data, of which the
+     * witness caches of the notes take nWitnessUsage
+     */
+    size_t DynamicMemoryUsage(size_t& nWitnessUsage) const;
+
     /* Find notes filtered by payment address, min depth, ability to spend */
     void GetFilteredNotes(std::vector<CNotePlaintextEntry> & outEntries,
                           std::string address,
                           int minDepth=1,
                           bool ignoreSpent=true,
                           bool ignoreUnspendable=true);
-    
+
+    /**
+     * A page of the notes received by address, spent or not, with at least minDepth
+     * confirmations, oldest first. The page has the notes of the newest transactions
+     * before txidBefore (the newest ones of the wallet if null), up to nCount notes
+     * (all of them if negative) but always the notes of whole transactions, so the oldest
+     * transaction of a page is the txidBefore of the next one. False if txidBefore is
+     * not a wallet transaction.
+     */
+    bool GetReceivedNotesPage(std::vector<CNotePlaintextEntry>& outEntries,
+                              const libzcash::PaymentAddress& address,
+                              int minDepth,
+                              int nCount,
+                              const uint256& txidBefore);
 };
 
 /** A key allocated from the key pool. */
@@ -1187,4 +1505,7 @@ public:
     }
 };
 
+/** Run an instance of the note trial decryption thread */
+void ThreadNoteDecryption();
+
 #endif // BITCOIN_WALLET_WALLET_H
@@ -58,7 +58,16 @@ bool CWalletDB::ErasePurpose(const string& strPurpose)
 bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
 {
     nWalletDBUpdated++;
-    return Write(std::make_pair(std::string("tx"), hash), wtx);
+    if (wtx.mapNoteData.empty())
+        return Write(std::make_pair(std::string("tx"), hash), wtx);
+
+    // The witnesses of the notes have records of their own
+    CWalletTx wtxCopy(wtx);
+    for (mapNoteData_t::value_type& item : wtxCopy.mapNoteData) {
+        item.second.witnesses.clear();
+        item.second.witnessHeight = -1;
+    }
+    return Write(std::make_pair(std::string("tx"), hash), wtxCopy);
 }
 
 bool CWalletDB::EraseTx(uint256 hash)
@@ -67,6 +76,30 @@ bool CWalletDB::EraseTx(uint256 hash)
     return Erase(std::make_pair(std::string("tx"), hash));
 }
 
+bool CWalletDB::WriteNoteWitness(const JSOutPoint& jsoutpt, int nHeight, const ZCIncrementalWitness& witness)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("notewitness"), std::make_pair(jsoutpt, nHeight)), witness);
+}
+
+bool CWalletDB::EraseNoteWitness(const JSOutPoint& jsoutpt, int nHeight)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("notewitness"), std::make_pair(jsoutpt, nHeight)));
+}
+
+bool CWalletDB::WriteNoteWitnessHeight(const JSOutPoint& jsoutpt, int nHeight)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("notewitnessheight"), jsoutpt), nHeight);
+}
+
+bool CWalletDB::EraseNoteWitnessHeight(const JSOutPoint& jsoutpt)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("notewitnessheight"), jsoutpt));
+}
+
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
 {
     nWalletDBUpdated++;
@@ -260,7 +293,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit(): cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -387,6 +420,8 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    map<JSOutPoint, map<int, ZCIncrementalWitness> > mapNoteWitnesses;
+    map<JSOutPoint, int> mapNoteWitnessHeights;
 
     CWalletScanState() {
         nKeys = nCKeys = nKeyMeta = nZKeys = nCZKeys = nZKeyMeta = 0;
@@ -396,6 +431,118 @@ public:
     }
 };
 
+/**
+ * Read a transaction record, the type already read from ssKey. The proofs of its
+ * joinsplits are not verified again: the wallet only wrote transactions it accepted.
+ */
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, CWalletTx& wtx, bool& fUpgraded, string& strErr)
+{
+    uint256 hash;
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    auto verifier = libzcash::ProofVerifier::Disabled();
+    if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+    {
+        // Don't consider REJECT_CHECKBLOCKATHEIGHT_NOT_FOUND error code as a failure. It can appear because a tx
+        // is a pre-chainsplit tx, so it is perfectly fine in this case.
+        if (state.GetRejectCode() != REJECT_CHECKBLOCKATHEIGHT_NOT_FOUND)
+            return false;
+    }
+
+    // Undo serialize changes in 31600
+    fUpgraded = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void AddLoadedWalletTx(CWallet* pwallet, const CWalletTx& wtx, bool fUpgraded, CWalletScanState& wss)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(wtx.GetHash());
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+}
+
+namespace {
+
+/**
+ * Transaction records of the wallet, read in the order of the database and parsed on
+ * WALLET_LOAD_THREADS threads, as checking them costs much more than reading them.
+ */
+class CWalletTxRecords
+{
+public:
+    struct Record
+    {
+        CDataStream ssKey;
+        CDataStream ssValue;
+        CWalletTx wtx;
+        bool fOk;
+        bool fUpgraded;
+        string strErr;
+
+        Record(const CDataStream& ssKeyIn, const CDataStream& ssValueIn) :
+            ssKey(ssKeyIn), ssValue(ssValueIn), fOk(false), fUpgraded(false) {}
+    };
+    std::vector<Record> vRecords;
+
+    //! Parse the records added so far
+    void Parse()
+    {
+        nNext = 0;
+        boost::thread_group threads;
+        for (int i = 0; i < WALLET_LOAD_THREADS; i++)
+            threads.create_thread(boost::bind(&CWalletTxRecords::ParseNext, this));
+        threads.join_all();
+    }
+
+private:
+    boost::mutex cs;
+    size_t nNext;
+
+    void ParseNext()
+    {
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (nNext == vRecords.size())
+                    return;
+                i = nNext++;
+            }
+            Record& record = vRecords[i];
+            try {
+                record.fOk = ReadWalletTx(record.ssKey, record.ssValue, record.wtx, record.fUpgraded, record.strErr);
+            } catch (...) {
+                record.fOk = false;
+            }
+        }
+    }
+};
+
+} // anon namespace
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -419,44 +566,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "tx")
         {
-            uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            auto verifier = libzcash::ProofVerifier::Strict();
-            if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
-            {
-                // Don't consider REJECT_CHECKBLOCKATHEIGHT_NOT_FOUND error code as a failure. It can appear because a tx
-                // is a pre-chainsplit tx, so it is perfectly fine in this case.
-                if (state.GetRejectCode() != REJECT_CHECKBLOCKATHEIGHT_NOT_FOUND)
-                    return false;
-            }
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            bool fUpgraded;
+            if (!ReadWalletTx(ssKey, ssValue, wtx, fUpgraded, strErr))
+                return false;
+            AddLoadedWalletTx(pwallet, wtx, fUpgraded, wss);
         }
         else if (strType == "acentry")
         {
@@ -713,6 +827,19 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nWitnessCacheSize;
         }
+        else if (strType == "notewitness")
+        {
+            JSOutPoint jsoutpt;
+            int nHeight;
+            ssKey >> jsoutpt >> nHeight;
+            ssValue >> wss.mapNoteWitnesses[jsoutpt][nHeight];
+        }
+        else if (strType == "notewitnessheight")
+        {
+            JSOutPoint jsoutpt;
+            ssKey >> jsoutpt;
+            ssValue >> wss.mapNoteWitnessHeights[jsoutpt];
+        }
     } catch (...)
     {
         return false;
@@ -746,29 +873,64 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
             return DB_CORRUPT;
         }
 
+        CWalletTxRecords txRecords;
         while (true)
         {
             // Read next record
             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
             int ret = ReadAtCursor(pcursor, ssKey, ssValue);
-            if (ret == DB_NOTFOUND)
-                break;
-            else if (ret != 0)
+            if (ret != 0 && ret != DB_NOTFOUND)
             {
                 LogPrintf("Error reading next record from wallet database\n");
                 return DB_CORRUPT;
             }
 
-            // Try to be tolerant of single corrupt records:
+            // Add the transactions parsed in a batch, in their order
+            if (ret == DB_NOTFOUND || txRecords.vRecords.size() == WALLET_LOAD_TX_BATCH_SIZE)
+            {
+                txRecords.Parse();
+                for (CWalletTxRecords::Record& record : txRecords.vRecords)
+                {
+                    if (record.fOk)
+                        AddLoadedWalletTx(pwallet, record.wtx, record.fUpgraded, wss);
+                    else
+                    {
+                        // Rescan if there is a bad transaction record:
+                        fNoncriticalErrors = true;
+                        SoftSetBoolArg("-rescan", true);
+                    }
+                    if (!record.strErr.empty())
+                        LogPrintf("%s\n", record.strErr);
+                }
+                txRecords.vRecords.clear();
+            }
+            if (ret == DB_NOTFOUND)
+                break;
+
             string strType, strErr;
+            try {
+                CDataStream ssType(ssKey);
+                ssType >> strType;
+            } catch (const std::exception&) {
+                strType.clear();
+            }
+            if (strType == "tx")
+            {
+                txRecords.vRecords.push_back(CWalletTxRecords::Record(ssKey, ssValue));
+                txRecords.vRecords.back().ssKey >> strType;
+                continue;
+            }
+
+            // Try to be tolerant of single corrupt records:
+            strType.clear();
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
             {
                 // losing keys is considered a catastrophic error, anything else
@@ -816,6 +978,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if ((wss.nKeys + wss.nCKeys) != wss.nKeyMeta)
         pwallet->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
+    {
+        LOCK(pwallet->cs_wallet);
+        pwallet->LoadNoteWitnesses(wss.mapNoteWitnesses, wss.mapNoteWitnessHeights);
+    }
+
     BOOST_FOREACH(uint256 hash, wss.vWalletUpgrade)
         WriteTx(hash, pwallet->mapWallet[hash]);
 
@@ -855,7 +1022,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -921,6 +1088,34 @@ DBErrors CWalletDB::ZapWalletTx(CWallet* pwallet, vector<CWalletTx>& vWtx)
     return DB_LOAD_OK;
 }
 
+CWalletDBBatch::~CWalletDBBatch()
+{
+    if (fActive)
+        walletdb.TxnAbort();
+}
+
+bool CWalletDBBatch::Prepare()
+{
+    if (fActive && nWrites >= WALLET_BATCH_MAX_WRITES && !Commit())
+        return false;
+    if (!fActive) {
+        if (!walletdb.TxnBegin())
+            return false;
+        fActive = true;
+    }
+    nWrites++;
+    return true;
+}
+
+bool CWalletDBBatch::Commit()
+{
+    if (!fActive)
+        return true;
+    fActive = false;
+    nWrites = 0;
+    return walletdb.TxnCommit();
+}
+
 void ThreadFlushWalletDB(const string& strFile)
 {
     // Make this thread recognisable as the wallet flushing thread
@@ -948,6 +1143,15 @@ void ThreadFlushWalletDB(const string& strFile)
 
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2)
         {
+            // A wallet log is synced, and compacted if it needs it, while it is in use
+            if (GetWalletLog(strFile, false))
+            {
+                boost::this_thread::interruption_point();
+                nLastFlushed = nWalletDBUpdated;
+                FlushWalletLogs(false);
+                continue;
+            }
+
             TRY_LOCK(bitdb.cs_db,lockDb);
             if (lockDb)
             {
@@ -987,6 +1191,19 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+
+    // A wallet log is backed up by writing its entries to a compacted log of their own
+    if (CWalletLog* plog = GetWalletLog(wallet.strWalletFile, false))
+    {
+        boost::filesystem::path pathDest(strDest);
+        if (boost::filesystem::is_directory(pathDest))
+            pathDest /= wallet.strWalletFile;
+        if (!plog->Snapshot(pathDest))
+            return false;
+        LogPrintf("copied wallet.dat to %s\n", pathDest.string());
+        return true;
+    }
+
     while (true)
     {
         {
@@ -11,6 +11,7 @@
 #include "key.h"
 #include "keystore.h"
 #include "zcash/Address.hpp"
+#include "zcash/IncrementalMerkleTree.hpp"
 
 #include <list>
 #include <stdint.h>
@@ -20,6 +21,7 @@
 
 class CAccount;
 class CAccountingEntry;
+class JSOutPoint;
 struct CBlockLocator;
 class CKeyPool;
 class CMasterKey;
@@ -29,6 +31,13 @@ class CWalletTx;
 class uint160;
 class uint256;
 
+//! Threads parsing the transaction records of the wallet on load
+static const int WALLET_LOAD_THREADS = 4;
+//! Transaction records of the wallet parsed at once on load
+static const size_t WALLET_LOAD_TX_BATCH_SIZE = 1024;
+//! Writes a CWalletDBBatch commits in one transaction at most
+static const size_t WALLET_BATCH_MAX_WRITES = 1000;
+
 /** Error statuses for the wallet database */
 enum DBErrors
 {
@@ -43,9 +52,12 @@ enum DBErrors
 class CKeyMetadata
 {
 public:
-    static const int CURRENT_VERSION=1;
+    static const int VERSION_BASIC=1;
+    static const int VERSION_WITH_BIRTHHEIGHT=2;
+    static const int CURRENT_VERSION=VERSION_WITH_BIRTHHEIGHT;
     int nVersion;
     int64_t nCreateTime; // 0 means unknown
+    int nBirthHeight; // first block which may pay to the key, -1 means unknown
 
     CKeyMetadata()
     {
@@ -55,6 +67,7 @@ public:
     {
         nVersion = CKeyMetadata::CURRENT_VERSION;
         nCreateTime = nCreateTime_;
+        nBirthHeight = -1;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -64,12 +77,15 @@ public:
         READWRITE(this->nVersion);
         nVersion = this->nVersion;
         READWRITE(nCreateTime);
+        if (this->nVersion >= VERSION_WITH_BIRTHHEIGHT)
+            READWRITE(nBirthHeight);
     }
 
     void SetNull()
     {
         nVersion = CKeyMetadata::CURRENT_VERSION;
         nCreateTime = 0;
+        nBirthHeight = -1;
     }
 };
 
@@ -90,6 +106,13 @@ public:
     bool WriteTx(uint256 hash, const CWalletTx& wtx);
     bool EraseTx(uint256 hash);
 
+    /// The witness cache of a note, apart from its transaction: one witness per height
+    /// and the height of the cache
+    bool WriteNoteWitness(const JSOutPoint& jsoutpt, int nHeight, const ZCIncrementalWitness& witness);
+    bool EraseNoteWitness(const JSOutPoint& jsoutpt, int nHeight);
+    bool WriteNoteWitnessHeight(const JSOutPoint& jsoutpt, int nHeight);
+    bool EraseNoteWitnessHeight(const JSOutPoint& jsoutpt);
+
     bool WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata &keyMeta);
     bool WriteCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret, const CKeyMetadata &keyMeta);
     bool WriteMasterKey(unsigned int nID, const CMasterKey& kMasterKey);
@@ -152,6 +175,32 @@ private:
     bool WriteAccountingEntry(const uint64_t nAccEntryNum, const CAccountingEntry& acentry);
 };
 
+/**
+ * Writes through a wallet database handle grouped in transactions, each committed at
+ * once, instead of each write being a transaction of its own. A transaction is
+ * committed by Commit, or once it has WALLET_BATCH_MAX_WRITES writes so it does not
+ * outgrow the locks of the environment. Writes left uncommitted when the batch is
+ * destroyed are aborted.
+ */
+class CWalletDBBatch
+{
+public:
+    CWalletDBBatch(CWalletDB& walletdbIn) : walletdb(walletdbIn), nWrites(0), fActive(false) {}
+    ~CWalletDBBatch();
+
+    //! Make the next write part of the batch, committing the ones before if the transaction is full
+    bool Prepare();
+    bool Commit();
+
+private:
+    CWalletDB& walletdb;
+    size_t nWrites;
+    bool fActive;
+
+    CWalletDBBatch(const CWalletDBBatch&);
+    void operator=(const CWalletDBBatch&);
+};
+
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
 void ThreadFlushWalletDB(const std::string& strFile);
 
@@ -0,0 +1,422 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/walletlog.h"
+
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+namespace {
+
+const unsigned char WALLET_LOG_MAGIC[8] = {'z', 'e', 'n', 'w', 'l', 'o', 'g', 1};
+//! Size and checksum of a record
+const size_t RECORD_HEADER_SIZE = 8;
+
+enum {
+    ENTRY_ERASE = 0,
+    ENTRY_WRITE = 1,
+};
+
+uint64_t EntrySize(const CSerializeData& key, const CSerializeData& value)
+{
+    return 1 + GetSizeOfCompactSize(key.size()) + key.size() + GetSizeOfCompactSize(value.size()) + value.size();
+}
+
+//! Append the record of the entries serialized in ssPayload
+bool WriteRecord(FILE* file, const CDataStream& ssPayload)
+{
+    unsigned char header[RECORD_HEADER_SIZE];
+    WriteLE32(header, ssPayload.size());
+    const uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    memcpy(header + 4, hash.begin(), 4);
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+        return false;
+    if (!ssPayload.empty() && fwrite(&ssPayload[0], 1, ssPayload.size(), file) != ssPayload.size())
+        return false;
+    return fflush(file) == 0;
+}
+
+CCriticalSection cs_walletlogs;
+//! The wallet logs opened, NULL for the files which are Berkeley databases
+std::map<std::string, CWalletLog*> mapWalletLogs;
+
+} // anon namespace
+
+CWalletLog::CWalletLog(const boost::filesystem::path& pathIn) :
+    path(pathIn), file(NULL), nLogSize(0), nLiveSize(0), fUnsynced(false)
+{
+}
+
+CWalletLog::~CWalletLog()
+{
+    Close();
+}
+
+bool CWalletLog::Open(bool fCreate)
+{
+    LOCK(cs);
+    if (file)
+        return true;
+
+    try {
+        if (!boost::filesystem::exists(path)) {
+            if (!fCreate)
+                return false;
+            FILE* fileNew = fopen(path.string().c_str(), "wb");
+            if (!fileNew)
+                return error("%s: can't create %s", __func__, path.string());
+            const bool fWritten = fwrite(WALLET_LOG_MAGIC, 1, sizeof(WALLET_LOG_MAGIC), fileNew) == sizeof(WALLET_LOG_MAGIC);
+            if (fWritten)
+                FileCommit(fileNew);
+            fclose(fileNew);
+            if (!fWritten)
+                return error("%s: can't write %s", __func__, path.string());
+        }
+        if (!Replay())
+            return false;
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+
+    file = fopen(path.string().c_str(), "ab");
+    if (!file)
+        return error("%s: can't open %s", __func__, path.string());
+    return true;
+}
+
+void CWalletLog::Close()
+{
+    LOCK(cs);
+    if (!file)
+        return;
+    if (fUnsynced)
+        FileCommit(file);
+    fclose(file);
+    file = NULL;
+    fUnsynced = false;
+}
+
+bool CWalletLog::Replay()
+{
+    FILE* fileIn = fopen(path.string().c_str(), "rb");
+    if (!fileIn)
+        return error("%s: can't open %s", __func__, path.string());
+    unsigned char magic[sizeof(WALLET_LOG_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), fileIn) != sizeof(magic) || memcmp(magic, WALLET_LOG_MAGIC, sizeof(magic)) != 0) {
+        fclose(fileIn);
+        return error("%s: %s is not a wallet log", __func__, path.string());
+    }
+
+    mapData.clear();
+    nLiveSize = 0;
+    uint64_t nGood = sizeof(magic);
+    size_t nRecords = 0;
+    while (true) {
+        unsigned char header[RECORD_HEADER_SIZE];
+        if (fread(header, 1, sizeof(header), fileIn) != sizeof(header))
+            break;
+        const uint32_t nSize = ReadLE32(header);
+        if (nSize > WALLET_LOG_MAX_RECORD_SIZE)
+            break;
+        CDataStream ssPayload(SER_DISK, CLIENT_VERSION);
+        ssPayload.resize(nSize);
+        if (nSize > 0 && fread(&ssPayload[0], 1, nSize, fileIn) != nSize)
+            break;
+        const uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+        if (memcmp(hash.begin(), header + 4, 4) != 0)
+            break;
+
+        // The entries of a record are applied together or not at all
+        Writes writes;
+        try {
+            while (!ssPayload.empty()) {
+                unsigned char nType;
+                CSerializeData key;
+                ssPayload >> nType >> key;
+                if (nType == ENTRY_WRITE) {
+                    CSerializeData value;
+                    ssPayload >> value;
+                    writes[key] = value;
+                } else {
+                    writes[key] = boost::none;
+                }
+            }
+        } catch (const std::exception&) {
+            break;
+        }
+        Apply(writes);
+        nGood += sizeof(header) + nSize;
+        nRecords++;
+    }
+    fclose(fileIn);
+
+    // Only the last record can be torn by a crash, but a damaged file keeps its
+    // records after the first bad one in the copy
+    const uint64_t nFileSize = boost::filesystem::file_size(path);
+    if (nGood < nFileSize) {
+        const boost::filesystem::path pathBak = path.string() + strprintf(".%d.bak", GetTime());
+        LogPrintf("%s: dropping the last %u bytes of %s, which are not whole records; the file is saved as %s\n",
+                  __func__, nFileSize - nGood, path.string(), pathBak.string());
+        boost::filesystem::copy_file(path, pathBak, boost::filesystem::copy_option::overwrite_if_exists);
+        boost::filesystem::resize_file(path, nGood);
+    }
+    nLogSize = nGood;
+    fUnsynced = false;
+    LogPrintf("Read %u records of wallet log %s, %u entries\n", nRecords, path.string(), mapData.size());
+    return true;
+}
+
+void CWalletLog::Apply(const Writes& writes)
+{
+    AssertLockHeld(cs);
+    for (const Writes::value_type& item : writes) {
+        std::map<CSerializeData, CSerializeData, DataCompare>::iterator it = mapData.find(item.first);
+        if (it != mapData.end()) {
+            nLiveSize -= EntrySize(it->first, it->second);
+            mapData.erase(it);
+        }
+        if (item.second) {
+            mapData.insert(std::make_pair(item.first, *item.second));
+            nLiveSize += EntrySize(item.first, *item.second);
+        }
+    }
+}
+
+bool CWalletLog::Read(const CSerializeData& key, CSerializeData& value) const
+{
+    LOCK(cs);
+    std::map<CSerializeData, CSerializeData, DataCompare>::const_iterator it = mapData.find(key);
+    if (it == mapData.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+bool CWalletLog::Next(const CSerializeData& key, bool fInclusive, CSerializeData& keyRet, CSerializeData& valueRet) const
+{
+    LOCK(cs);
+    std::map<CSerializeData, CSerializeData, DataCompare>::const_iterator it = fInclusive ? mapData.lower_bound(key) : mapData.upper_bound(key);
+    if (it == mapData.end())
+        return false;
+    keyRet = it->first;
+    valueRet = it->second;
+    return true;
+}
+
+bool CWalletLog::Commit(const Writes& writes)
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    if (writes.empty())
+        return true;
+
+    CDataStream ssPayload(SER_DISK, CLIENT_VERSION);
+    for (const Writes::value_type& item : writes) {
+        if (item.second)
+            ssPayload << (unsigned char)ENTRY_WRITE << item.first << *item.second;
+        else
+            ssPayload << (unsigned char)ENTRY_ERASE << item.first;
+    }
+    if (ssPayload.size() > WALLET_LOG_MAX_RECORD_SIZE)
+        return error("%s: transaction of %u bytes too large", __func__, ssPayload.size());
+    if (!WriteRecord(file, ssPayload)) {
+        // A torn record would hide the ones appended after it
+        TruncateFile(file, nLogSize);
+        return error("%s: can't append to %s", __func__, path.string());
+    }
+    nLogSize += RECORD_HEADER_SIZE + ssPayload.size();
+    fUnsynced = true;
+    Apply(writes);
+    return true;
+}
+
+bool CWalletLog::Sync()
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    if (fUnsynced) {
+        FileCommit(file);
+        fUnsynced = false;
+    }
+    return true;
+}
+
+bool CWalletLog::NeedsCompaction() const
+{
+    LOCK(cs);
+    return nLogSize >= WALLET_LOG_COMPACT_MIN_SIZE && nLogSize > 2 * (sizeof(WALLET_LOG_MAGIC) + nLiveSize);
+}
+
+bool CWalletLog::WriteEntries(FILE* fileOut, const char* pszSkip, uint64_t& nSizeRet) const
+{
+    AssertLockHeld(cs);
+    if (fwrite(WALLET_LOG_MAGIC, 1, sizeof(WALLET_LOG_MAGIC), fileOut) != sizeof(WALLET_LOG_MAGIC))
+        return false;
+    nSizeRet = sizeof(WALLET_LOG_MAGIC);
+
+    const size_t nSkip = pszSkip ? strlen(pszSkip) : 0;
+    CDataStream ssPayload(SER_DISK, CLIENT_VERSION);
+    for (std::map<CSerializeData, CSerializeData, DataCompare>::const_iterator it = mapData.begin(); it != mapData.end(); ++it) {
+        if (nSkip > 0 && it->first.size() >= nSkip && memcmp(it->first.data(), pszSkip, nSkip) == 0)
+            continue;
+        ssPayload << (unsigned char)ENTRY_WRITE << it->first << it->second;
+        if (ssPayload.size() >= WALLET_LOG_COMPACT_RECORD_SIZE) {
+            if (!WriteRecord(fileOut, ssPayload))
+                return false;
+            nSizeRet += RECORD_HEADER_SIZE + ssPayload.size();
+            ssPayload.clear();
+        }
+    }
+    if (!ssPayload.empty()) {
+        if (!WriteRecord(fileOut, ssPayload))
+            return false;
+        nSizeRet += RECORD_HEADER_SIZE + ssPayload.size();
+    }
+    FileCommit(fileOut);
+    return true;
+}
+
+bool CWalletLog::Compact(const char* pszSkip)
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    const int64_t nStart = GetTimeMillis();
+
+    const boost::filesystem::path pathCompact = path.string() + ".compact";
+    FILE* fileOut = fopen(pathCompact.string().c_str(), "wb");
+    if (!fileOut)
+        return error("%s: can't create %s", __func__, pathCompact.string());
+    uint64_t nSize;
+    const bool fWritten = WriteEntries(fileOut, pszSkip, nSize);
+    fclose(fileOut);
+
+    // The compacted log replaces the old one at once
+    bool fReplaced = false;
+    try {
+        if (!fWritten) {
+            boost::filesystem::remove(pathCompact);
+            return error("%s: can't write %s", __func__, pathCompact.string());
+        }
+        if (fUnsynced)
+            FileCommit(file);
+        fclose(file);
+        file = NULL;
+        boost::filesystem::rename(pathCompact, path);
+        fReplaced = true;
+    } catch (const boost::filesystem::filesystem_error& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    if (!file)
+        file = fopen(path.string().c_str(), "ab");
+    if (!file)
+        return error("%s: can't open %s", __func__, path.string());
+    if (!fReplaced)
+        return false;
+
+    if (pszSkip) {
+        const size_t nSkip = strlen(pszSkip);
+        for (std::map<CSerializeData, CSerializeData, DataCompare>::iterator it = mapData.begin(); it != mapData.end(); ) {
+            if (it->first.size() >= nSkip && memcmp(it->first.data(), pszSkip, nSkip) == 0) {
+                nLiveSize -= EntrySize(it->first, it->second);
+                mapData.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    LogPrintf("Compacted wallet log %s from %u to %u bytes in %dms\n", path.string(), nLogSize, nSize, GetTimeMillis() - nStart);
+    nLogSize = nSize;
+    fUnsynced = false;
+    return true;
+}
+
+bool CWalletLog::Snapshot(const boost::filesystem::path& pathDest) const
+{
+    LOCK(cs);
+    // Only a whole snapshot takes the name of pathDest
+    const boost::filesystem::path pathTmp = pathDest.string() + ".tmp";
+    FILE* fileOut = fopen(pathTmp.string().c_str(), "wb");
+    if (!fileOut)
+        return error("%s: can't create %s", __func__, pathTmp.string());
+    uint64_t nSize;
+    const bool fWritten = WriteEntries(fileOut, NULL, nSize);
+    fclose(fileOut);
+    try {
+        if (!fWritten) {
+            boost::filesystem::remove(pathTmp);
+            return error("%s: can't write %s", __func__, pathTmp.string());
+        }
+        boost::filesystem::rename(pathTmp, pathDest);
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool IsWalletLogFile(const boost::filesystem::path& path)
+{
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return false;
+    unsigned char magic[sizeof(WALLET_LOG_MAGIC)];
+    const bool fLog = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, WALLET_LOG_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return fLog;
+}
+
+CWalletLog* GetWalletLog(const std::string& strFile, bool fCreate)
+{
+    LOCK(cs_walletlogs);
+    std::map<std::string, CWalletLog*>::const_iterator it = mapWalletLogs.find(strFile);
+    if (it != mapWalletLogs.end())
+        return it->second;
+
+    const boost::filesystem::path path = GetDataDir() / strFile;
+    if (boost::filesystem::exists(path)) {
+        if (!IsWalletLogFile(path)) {
+            mapWalletLogs[strFile] = NULL;
+            return NULL;
+        }
+    } else if (!fCreate || GetArg("-walletstore", DEFAULT_WALLET_STORE) != "log") {
+        return NULL;
+    }
+
+    CWalletLog* plog = new CWalletLog(path);
+    if (!plog->Open(true)) {
+        delete plog;
+        throw std::runtime_error(strprintf("GetWalletLog(): can't open wallet log %s", strFile));
+    }
+    mapWalletLogs[strFile] = plog;
+    return plog;
+}
+
+void FlushWalletLogs(bool fShutdown)
+{
+    LOCK(cs_walletlogs);
+    for (std::map<std::string, CWalletLog*>::iterator it = mapWalletLogs.begin(); it != mapWalletLogs.end(); ) {
+        CWalletLog* plog = it->second;
+        if (plog) {
+            plog->Sync();
+            if (plog->NeedsCompaction())
+                plog->Compact();
+        }
+        if (fShutdown) {
+            delete plog;
+            mapWalletLogs.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
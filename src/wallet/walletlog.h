@@ -0,0 +1,108 @@
+// Copyright (c) 2020 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_WALLETLOG_H
+#define BITCOIN_WALLET_WALLETLOG_H
+
+#include "support/allocators/zeroafterfree.h"
+#include "sync.h"
+
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/optional.hpp>
+
+//! -walletstore default, the storage of the wallet files created
+static const char* const DEFAULT_WALLET_STORE = "bdb";
+//! Size from which a wallet log is compacted once most of it is overwritten or erased records
+static const uint64_t WALLET_LOG_COMPACT_MIN_SIZE = 1 << 20;
+//! Bytes of entries a compaction writes in one record
+static const size_t WALLET_LOG_COMPACT_RECORD_SIZE = 1 << 20;
+//! Largest record a wallet log is read with
+static const uint32_t WALLET_LOG_MAX_RECORD_SIZE = 1 << 28;
+
+/**
+ * A wallet database stored as an append-only log, the alternative to Berkeley DB of
+ * -walletstore=log. The file is a header followed by records, each one the writes and
+ * erasures of a committed transaction, with its size and a checksum. A record torn by
+ * a crash fails its checksum and is dropped when the log is opened, so the log always
+ * has whole transactions. The entries are all kept in memory, as the wallet loads them
+ * all anyway, and the log is compacted by rewriting them to a new file which replaces
+ * it at once.
+ */
+class CWalletLog
+{
+public:
+    //! Keys and values, compared as Berkeley DB does
+    struct DataCompare
+    {
+        bool operator()(const CSerializeData& a, const CSerializeData& b) const
+        {
+            int c = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+            return c < 0 || (c == 0 && a.size() < b.size());
+        }
+    };
+    //! The value of each key a transaction writes, none for the ones it erases
+    typedef std::map<CSerializeData, boost::optional<CSerializeData>, DataCompare> Writes;
+
+    explicit CWalletLog(const boost::filesystem::path& pathIn);
+    ~CWalletLog();
+
+    //! Read the log, or create it with fCreate if it does not exist
+    bool Open(bool fCreate);
+    void Close();
+
+    bool Read(const CSerializeData& key, CSerializeData& value) const;
+    //! The first entry after key, or from it with fInclusive
+    bool Next(const CSerializeData& key, bool fInclusive, CSerializeData& keyRet, CSerializeData& valueRet) const;
+    //! Append the writes as one record, which a crash leaves whole or drops
+    bool Commit(const Writes& writes);
+    //! Make the records appended so far durable
+    bool Sync();
+
+    //! Most of the log is records overwritten or erased since
+    bool NeedsCompaction() const;
+    //! Rewrite the log with the entries it has, leaving out the keys starting with pszSkip
+    bool Compact(const char* pszSkip = NULL);
+    //! Write the entries to pathDest, as a compacted log of their own
+    bool Snapshot(const boost::filesystem::path& pathDest) const;
+
+private:
+    mutable CCriticalSection cs;
+    boost::filesystem::path path;
+    FILE* file;
+    std::map<CSerializeData, CSerializeData, DataCompare> mapData;
+    //! Size of the file, and of the records of a compacted log with the same entries
+    uint64_t nLogSize;
+    uint64_t nLiveSize;
+    //! Records were appended since the last sync
+    bool fUnsynced;
+
+    bool Replay();
+    void Apply(const Writes& writes);
+    bool WriteEntries(FILE* fileOut, const char* pszSkip, uint64_t& nSizeRet) const;
+
+    CWalletLog(const CWalletLog&);
+    void operator=(const CWalletLog&);
+};
+
+//! Whether the file at path is a wallet log
+bool IsWalletLogFile(const boost::filesystem::path& path);
+
+/**
+ * The log of the wallet file strFile of the data directory, opened once and kept open
+ * until FlushWalletLogs(true). A file which does not exist is created as a wallet log
+ * with fCreate if -walletstore=log. NULL if the file is a Berkeley database.
+ */
+CWalletLog* GetWalletLog(const std::string& strFile, bool fCreate);
+
+//! Sync the open wallet logs, compacting the ones which need it, and close them with fShutdown
+void FlushWalletLogs(bool fShutdown);
+
+#endif // BITCOIN_WALLET_WALLETLOG_H
@@ -1,4 +1,5 @@
 #include <stdexcept>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 
@@ -27,6 +28,18 @@ PedersenHash PedersenHash::combine(
     return res;
 }
 
+void PedersenHash::combine_pairs(
+    const std::vector<PedersenHash>& nodes,
+    std::vector<PedersenHash>& parents,
+    size_t depth
+)
+{
+    parents.resize(nodes.size() / 2);
+    for (size_t i = 0; i < parents.size(); i++) {
+        parents[i] = combine(nodes[2 * i], nodes[2 * i + 1], depth);
+    }
+}
+
 PedersenHash PedersenHash::uncommitted() {
     PedersenHash res = PedersenHash();
 
@@ -43,14 +56,29 @@ SHA256Compress SHA256Compress::combine(
 {
     SHA256Compress res = SHA256Compress();
 
-    CSHA256 hasher;
-    hasher.Write(a.begin(), 32);
-    hasher.Write(b.begin(), 32);
-    hasher.FinalizeNoPadding(res.begin());
+    unsigned char block[64];
+    memcpy(block, a.begin(), 32);
+    memcpy(block + 32, b.begin(), 32);
+    SHA256Compress64(res.begin(), block, 1);
 
     return res;
 }
 
+// The nodes of a vector are the blocks SHA256Compress64 compresses
+static_assert(sizeof(SHA256Compress) == 32, "SHA256Compress is not a 32-byte array");
+
+void SHA256Compress::combine_pairs(
+    const std::vector<SHA256Compress>& nodes,
+    std::vector<SHA256Compress>& parents,
+    size_t depth
+)
+{
+    parents.resize(nodes.size() / 2);
+    if (!parents.empty()) {
+        SHA256Compress64(parents[0].begin(), nodes[0].begin(), parents.size());
+    }
+}
+
 template <size_t Depth, typename Hash>
 class PathFiller {
 private:
@@ -165,6 +193,60 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalMerkleTree<Depth, Hash>::append(const std::vector<Hash>& objs) {
+    if (objs.empty()) {
+        return;
+    }
+    const uint64_t old_size = size();
+    if (old_size + objs.size() > (uint64_t(1) << Depth)) {
+        // Fill the tree up to the element which does not fit, as append does
+        BOOST_FOREACH(const Hash& obj, objs) {
+            append(obj);
+        }
+        return;
+    }
+    const uint64_t new_size = old_size + objs.size();
+
+    // The leaves after the last combined pair, then the new leaves. Only the
+    // last pair of leaves, or the last leaf, is kept uncombined.
+    std::vector<Hash> nodes;
+    nodes.reserve(2 + objs.size());
+    if (left) {
+        nodes.push_back(*left);
+    }
+    if (right) {
+        nodes.push_back(*right);
+    }
+    nodes.insert(nodes.end(), objs.begin(), objs.end());
+    const size_t kept = (new_size % 2 == 0) ? 2 : 1;
+    left = nodes[nodes.size() - kept];
+    right = kept == 2 ? boost::optional<Hash>(nodes.back()) : boost::none;
+    nodes.resize(nodes.size() - kept);
+
+    // Each depth, from the subtree waiting for a sibling and the new subtrees
+    // of the depth below, keeps the last subtree of an odd number of them
+    std::vector<Hash> combined;
+    for (size_t i = 0; !nodes.empty(); i++) {
+        Hash::combine_pairs(nodes, combined, i);
+        nodes.clear();
+        if (i < parents.size() && parents[i]) {
+            nodes.push_back(*parents[i]);
+        }
+        nodes.insert(nodes.end(), combined.begin(), combined.end());
+
+        if (i >= parents.size()) {
+            parents.push_back(boost::none);
+        }
+        if (nodes.size() % 2 == 1) {
+            parents[i] = nodes.back();
+            nodes.pop_back();
+        } else {
+            parents[i] = boost::none;
+        }
+    }
+}
+
 // This is for allowing the witness to determine if a subtree has filled
 // to a particular depth, or for append() to ensure we're not appending
 // to a full tree.
@@ -348,10 +430,118 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+IncrementalMerkleTree<Depth, Hash> IncrementalWitnessSet<Depth, Hash>::frontier(size_t depth) const {
+    IncrementalMerkleTree<Depth, Hash> ret;
+    ret.left = tree.left;
+    ret.right = tree.right;
+    for (size_t i = 0; i + 1 < depth && i < tree.parents.size(); i++) {
+        ret.parents.push_back(tree.parents[i]);
+    }
+    while (!ret.parents.empty() && !ret.parents.back()) {
+        ret.parents.pop_back();
+    }
+    return ret;
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitnessSet<Depth, Hash>::add(IncrementalWitness<Depth, Hash>& witness) {
+    // The element the witness has reached, from the subtrees it has filled
+    uint64_t position = witness.tree.size();
+    for (size_t k = 0; k < witness.filled.size(); k++) {
+        position += uint64_t(1) << witness.tree.next_depth(k);
+    }
+
+    Entry entry {&witness, witness.cursor_depth, 0, witness.cursor_depth};
+    if (witness.cursor) {
+        position += witness.cursor->size();
+        if (position != tree_size || !(*witness.cursor == frontier(witness.cursor_depth))) {
+            others.push_back(&witness);
+            return;
+        }
+        entry.complete_size = position - witness.cursor->size() + (uint64_t(1) << witness.cursor_depth);
+        witness.cursor = boost::none;
+        entries.push_back(entry);
+        completions.insert(std::make_pair(entry.complete_size, entries.size() - 1));
+    } else {
+        if (position != tree_size) {
+            others.push_back(&witness);
+            return;
+        }
+        entries.push_back(entry);
+        schedule(entries.size() - 1);
+    }
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitnessSet<Depth, Hash>::schedule(size_t i) {
+    Entry& entry = entries[i];
+    size_t depth = entry.witness->tree.next_depth(entry.witness->filled.size());
+    if (depth >= Depth) {
+        // The tree is full
+        entry.complete_size = 0;
+        return;
+    }
+    entry.depth = depth;
+    entry.complete_size = tree_size + (uint64_t(1) << depth);
+    completions.insert(std::make_pair(entry.complete_size, i));
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitnessSet<Depth, Hash>::append(Hash obj) {
+    tree.append(obj);
+    tree_size++;
+
+    for (size_t i = 0; i < others.size(); i++) {
+        others[i]->append(obj);
+    }
+
+    // Roots of the subtrees of each depth the new element completes
+    std::vector<Hash> roots;
+    while (!completions.empty() && completions.begin()->first == tree_size) {
+        size_t i = completions.begin()->second;
+        completions.erase(completions.begin());
+        Entry& entry = entries[i];
+        while (roots.size() <= entry.depth) {
+            if (roots.empty()) {
+                roots.push_back(tree.last());
+            } else if (roots.size() == 1) {
+                roots.push_back(Hash::combine(*tree.left, *tree.right, 0));
+            } else {
+                size_t d = roots.size() - 1;
+                roots.push_back(Hash::combine(*tree.parents[d - 1], roots[d], d));
+            }
+        }
+        entry.witness->filled.push_back(roots[entry.depth]);
+        entry.last_depth = entry.depth;
+        schedule(i);
+    }
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitnessSet<Depth, Hash>::finish() {
+    BOOST_FOREACH(Entry& entry, entries) {
+        IncrementalWitness<Depth, Hash>& witness = *entry.witness;
+        if (entry.complete_size != 0 && tree_size > entry.complete_size - (uint64_t(1) << entry.depth)) {
+            witness.cursor = frontier(entry.depth);
+            witness.cursor_depth = entry.depth;
+        } else {
+            witness.cursor = boost::none;
+            witness.cursor_depth = entry.last_depth;
+        }
+    }
+    entries.clear();
+    completions.clear();
+    others.clear();
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
+template class IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
+template class IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
+
 } // end namespace `libzcash`
@@ -3,6 +3,9 @@
 
 #include <array>
 #include <deque>
+#include <map>
+#include <memory>
+#include <vector>
 #include <boost/optional.hpp>
 #include <boost/static_assert.hpp>
 
@@ -82,10 +85,14 @@ bool operator==(const EmptyMerkleRoots<Depth, Hash>& a,
 template<size_t Depth, typename Hash>
 class IncrementalWitness;
 
+template<size_t Depth, typename Hash>
+class IncrementalWitnessSet;
+
 template<size_t Depth, typename Hash>
 class IncrementalMerkleTree {
 
 friend class IncrementalWitness<Depth, Hash>;
+friend class IncrementalWitnessSet<Depth, Hash>;
 
 public:
     BOOST_STATIC_ASSERT(Depth >= 1);
@@ -101,6 +108,9 @@ public:
     size_t size() const;
 
     void append(Hash obj);
+    // Append each of objs in turn, combining the nodes of each depth they
+    // complete together
+    void append(const std::vector<Hash>& objs);
     Hash root() const {
         return root(Depth, std::deque<Hash>());
     }
@@ -155,6 +165,7 @@ bool operator==(const IncrementalMerkleTree<Depth, Hash>& a,
 template <size_t Depth, typename Hash>
 class IncrementalWitness {
 friend class IncrementalMerkleTree<Depth, Hash>;
+friend class IncrementalWitnessSet<Depth, Hash>;
 
 public:
     // Required for Unserialize()
@@ -178,6 +189,12 @@ public:
         return tree.root(Depth, partial_path());
     }
 
+    size_t DynamicMemoryUsage() const {
+        return tree.DynamicMemoryUsage() +
+               filled.size() * 32 + // filled
+               (cursor ? cursor->DynamicMemoryUsage() : 0); // cursor
+    }
+
     void append(Hash obj);
 
     ADD_SERIALIZE_METHODS;
@@ -213,6 +230,50 @@ bool operator==(const IncrementalWitness<Depth, Hash>& a,
             a.cursor_depth == b.cursor_depth);
 }
 
+// Appends the same elements to a tree and to witnesses of elements of that
+// tree, as if each were appended to the tree and to every witness. The
+// subtree a witness is filling is the latest one of its depth in the tree,
+// so its cursor is the frontier of the tree below that depth: the witnesses
+// keep no cursor of their own meanwhile, and the root of a subtree is
+// computed once for all the witnesses it completes. A witness costs nothing
+// on the elements which complete none of its subtrees.
+template<size_t Depth, typename Hash>
+class IncrementalWitnessSet {
+public:
+    IncrementalWitnessSet(IncrementalMerkleTree<Depth, Hash>& tree) : tree(tree), tree_size(tree.size()) {}
+
+    // Track a witness of an element of the tree. It must stay at the same
+    // address until finish(), as the elements of a std::deque do.
+    void add(IncrementalWitness<Depth, Hash>& witness);
+
+    void append(Hash obj);
+
+    // Give the witnesses their cursors and stop tracking them
+    void finish();
+
+private:
+    struct Entry {
+        IncrementalWitness<Depth, Hash>* witness;
+        // The subtree the witness is filling, or fills from the next element
+        size_t depth;
+        // Size of the tree once that subtree is complete, 0 if there is none
+        uint64_t complete_size;
+        // The cursor_depth of the witness if it has no cursor
+        size_t last_depth;
+    };
+
+    IncrementalMerkleTree<Depth, Hash>& tree;
+    uint64_t tree_size;
+    std::vector<Entry> entries;
+    // Indexes of the entries by the size of the tree completing their subtree
+    std::multimap<uint64_t, size_t> completions;
+    // Witnesses not at the end of the tree, which get each element appended
+    std::vector<IncrementalWitness<Depth, Hash>*> others;
+
+    void schedule(size_t i);
+    IncrementalMerkleTree<Depth, Hash> frontier(size_t depth) const;
+};
+
 class SHA256Compress : public uint256 {
 public:
     SHA256Compress() : uint256() {}
@@ -224,6 +285,14 @@ public:
         size_t depth
     );
 
+    // Combine nodes[2*i] and nodes[2*i+1] into parents[i] for each pair of
+    // nodes, several pairs at a time where the CPU allows it
+    static void combine_pairs(
+        const std::vector<SHA256Compress>& nodes,
+        std::vector<SHA256Compress>& parents,
+        size_t depth
+    );
+
     static SHA256Compress uncommitted() {
         return SHA256Compress();
     }
@@ -240,6 +309,12 @@ public:
         size_t depth
     );
 
+    static void combine_pairs(
+        const std::vector<PedersenHash>& nodes,
+        std::vector<PedersenHash>& parents,
+        size_t depth
+    );
+
     static PedersenHash uncommitted();
 };
 
@@ -249,6 +324,8 @@ EmptyMerkleRoots<Depth, Hash> IncrementalMerkleTree<Depth, Hash>::emptyroots;
 } // end namespace `libzcash`
 
 typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> ZCIncrementalMerkleTree;
+//! A tree which does not change, shared by the ones keeping it
+typedef std::shared_ptr<const ZCIncrementalMerkleTree> ZCIncrementalMerkleTreeRef;
 typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> ZCTestingIncrementalMerkleTree;
 
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> ZCIncrementalWitness;
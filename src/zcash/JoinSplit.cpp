@@ -22,6 +22,13 @@
 #include "streams.h"
 #include "version.h"
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace libsnark;
 
 namespace libzcash {
@@ -66,6 +73,55 @@ void loadFromFile(const std::string path, T& objIn) {
     objIn = std::move(obj);
 }
 
+#ifndef WIN32
+/**
+ * A parameter file mapped read-only. Its pages are the ones of the page cache, so every
+ * process and proof proving from the file shares them, and they are only read in when a
+ * proof first uses them.
+ */
+class MappedParamFile {
+public:
+    explicit MappedParamFile(const std::string& path) : data(NULL), size(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(strprintf("could not load param file at %s", path));
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                data = static_cast<char*>(p);
+                size = st.st_size;
+                // The prover reads the key from start to end
+                madvise(p, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        if (data == NULL) {
+            throw std::runtime_error(strprintf("could not map param file at %s", path));
+        }
+    }
+    ~MappedParamFile() {
+        munmap(data, size);
+    }
+
+    char* data;
+    size_t size;
+
+private:
+    MappedParamFile(const MappedParamFile&);
+    MappedParamFile& operator=(const MappedParamFile&);
+};
+
+/** A stream of its own over a mapped file, for one proof */
+class MappedParamStreamBuf : public std::streambuf {
+public:
+    explicit MappedParamStreamBuf(const MappedParamFile& file) {
+        setg(file.data, file.data, file.data + file.size);
+    }
+};
+#endif
+
 template<size_t NumInputs, size_t NumOutputs>
 class JoinSplitCircuit : public JoinSplit<NumInputs, NumOutputs> {
 public:
@@ -74,7 +130,15 @@ public:
 
     r1cs_ppzksnark_verification_key<ppzksnark_ppT> vk;
     r1cs_ppzksnark_processed_verification_key<ppzksnark_ppT> vk_precomp;
+    // Empty on a node which only verifies
     std::string pkPath;
+#ifndef WIN32
+    // Mapped by the first proof
+    std::shared_ptr<MappedParamFile> pkFile;
+#endif
+    // Built by the first proof, with A and B swapped, and shared by all the proofs since
+    std::shared_ptr<const r1cs_constraint_system<FieldT>> constraintSystem;
+    CCriticalSection cs_constraintSystem;
 
     JoinSplitCircuit(const std::string vkPath, const std::string pkPath) : pkPath(pkPath) {
         loadFromFile(vkPath, vk);
@@ -157,6 +221,10 @@ public:
         bool computeProof,
         uint256 *out_esk // Payment disclosure
     ) {
+        if (computeProof && pkPath.empty() && !this->prover) {
+            throw std::runtime_error("proofs cannot be generated, the node was started with -verifyonly");
+        }
+
         if (vpub_old > MAX_MONEY) {
             throw std::invalid_argument("nonsensical vpub_old value");
         }
@@ -271,11 +339,43 @@ public:
             out_macs[i] = PRF_pk(inputs[i].key, i, h_sig);
         }
 
-        if (makeGrothProof) {
-            if (!computeProof) {
+        if (!computeProof) {
+            if (makeGrothProof) {
                 return GrothProof();
             }
+            return PHGRProof();
+        }
+
+        JSProofWitness<NumInputs, NumOutputs> witness;
+        witness.makeGrothProof = makeGrothProof;
+        witness.phi = phi;
+        witness.rt = rt;
+        witness.h_sig = h_sig;
+        witness.inputs = inputs;
+        witness.notes = out_notes;
+        witness.vpub_old = vpub_old;
+        witness.vpub_new = vpub_new;
+
+        if (this->prover) {
+            return this->prover->prove(witness);
+        }
+        return proveWitness(witness);
+    }
+
+    SproutProof proveWitness(const JSProofWitness<NumInputs, NumOutputs>& witness) {
+        if (pkPath.empty()) {
+            throw std::runtime_error("proofs cannot be generated, the node was started with -verifyonly");
+        }
+
+        const uint252& phi = witness.phi;
+        const uint256& rt = witness.rt;
+        const uint256& h_sig = witness.h_sig;
+        const std::array<JSInput, NumInputs>& inputs = witness.inputs;
+        const std::array<Note, NumOutputs>& out_notes = witness.notes;
+        const uint64_t vpub_old = witness.vpub_old;
+        const uint64_t vpub_new = witness.vpub_new;
 
+        if (witness.makeGrothProof) {
             GrothProof proof;
 
             CDataStream ss1(SER_NETWORK, PROTOCOL_VERSION);
@@ -320,14 +420,15 @@ public:
             return proof;
         }
 
-        if (!computeProof) {
-            return PHGRProof();
-        }
+        std::shared_ptr<const r1cs_constraint_system<FieldT>> r1cs = getConstraintSystem();
 
+        // Only the witness is generated: the gadgets allocate all their
+        // variables when they are constructed, and the constraints are the
+        // ones of r1cs.
         protoboard<FieldT> pb;
+        pb.reserve_variables(r1cs->num_variables());
         {
             joinsplit_gadget<FieldT, NumInputs, NumOutputs> g(pb);
-            g.generate_r1cs_constraints();
             g.generate_r1cs_witness(
                 phi,
                 rt,
@@ -338,34 +439,63 @@ public:
                 vpub_new
             );
         }
-
-        // The constraint system must be satisfied or there is an unimplemented
-        // or incorrect sanity check above. Or the constraint system is broken!
-        assert(pb.is_satisfied());
+        assert(pb.num_variables() == r1cs->num_variables());
 
         // TODO: These are copies, which is not strictly necessary.
         std::vector<FieldT> primary_input = pb.primary_input();
         std::vector<FieldT> aux_input = pb.auxiliary_input();
 
-        // Swap A and B if it's beneficial (less arithmetic in G2)
-        // In our circuit, we already know that it's beneficial
-        // to swap, but it takes so little time to perform this
-        // estimate that it doesn't matter if we check every time.
-        pb.constraint_system.swap_AB_if_beneficial();
+        // The constraint system must be satisfied or there is an unimplemented
+        // or incorrect sanity check in prove, the constraint system is broken,
+        // or the witness package came from a faulty client.
+        if (!r1cs->is_satisfied(primary_input, aux_input)) {
+            throw std::invalid_argument("joinsplit witness does not satisfy the circuit");
+        }
 
+#ifndef WIN32
+        std::shared_ptr<MappedParamFile> file;
+        {
+            LOCK(cs_ParamsIO);
+            if (!pkFile) {
+                pkFile = std::make_shared<MappedParamFile>(pkPath);
+            }
+            file = pkFile;
+        }
+        MappedParamStreamBuf buf(*file);
+        std::istream fh(&buf);
+#else
         std::ifstream fh(pkPath, std::ios::binary);
 
         if(!fh.is_open()) {
             throw std::runtime_error(strprintf("could not load param file at %s", pkPath));
         }
+#endif
 
         return PHGRProof(r1cs_ppzksnark_prover_streaming<ppzksnark_ppT>(
             fh,
             primary_input,
             aux_input,
-            pb.constraint_system
+            *r1cs
         ));
     }
+
+private:
+    std::shared_ptr<const r1cs_constraint_system<FieldT>> getConstraintSystem() {
+        LOCK(cs_constraintSystem);
+        if (!constraintSystem) {
+            protoboard<FieldT> pb;
+            joinsplit_gadget<FieldT, NumInputs, NumOutputs> g(pb);
+            g.generate_r1cs_constraints();
+
+            // Swap A and B if it's beneficial (less arithmetic in G2)
+            // In our circuit, we already know that it's beneficial
+            // to swap, but it takes so little time to perform this
+            // estimate that it doesn't matter if we check every time.
+            pb.constraint_system.swap_AB_if_beneficial();
+            constraintSystem = std::make_shared<const r1cs_constraint_system<FieldT>>(std::move(pb.constraint_system));
+        }
+        return constraintSystem;
+    }
 };
 
 template<size_t NumInputs, size_t NumOutputs>
@@ -37,6 +37,15 @@ public:
     uint256 nullifier() const {
         return note.nullifier(key);
     }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(witness);
+        READWRITE(note);
+        READWRITE(key);
+    }
 };
 
 class JSOutput {
@@ -51,6 +60,45 @@ public:
     Note note(const uint252& phi, const uint256& r, size_t i, const uint256& h_sig) const;
 };
 
+// The witness package of a JoinSplit proof: everything the prover needs, once
+// the notes, commitments and ciphertexts of the JoinSplit are computed. It holds
+// the spending keys of the inputs.
+template<size_t NumInputs, size_t NumOutputs>
+class JSProofWitness {
+public:
+    bool makeGrothProof = false;
+    uint252 phi;
+    uint256 rt;
+    uint256 h_sig;
+    std::array<JSInput, NumInputs> inputs;
+    std::array<Note, NumOutputs> notes;
+    uint64_t vpub_old = 0;
+    uint64_t vpub_new = 0;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(makeGrothProof);
+        READWRITE(phi);
+        READWRITE(rt);
+        READWRITE(h_sig);
+        READWRITE(inputs);
+        READWRITE(notes);
+        READWRITE(vpub_old);
+        READWRITE(vpub_new);
+    }
+};
+
+// Where the proofs of JoinSplit::prove are computed, when not on the calling thread
+template<size_t NumInputs, size_t NumOutputs>
+class JoinSplitProver {
+public:
+    virtual ~JoinSplitProver() {}
+
+    virtual SproutProof prove(const JSProofWitness<NumInputs, NumOutputs>& witness) = 0;
+};
+
 template<size_t NumInputs, size_t NumOutputs>
 class JoinSplit {
 public:
@@ -90,6 +138,15 @@ public:
         uint256 *out_esk = nullptr
     ) = 0;
 
+    // Compute the proof of a witness package, on the calling thread
+    virtual SproutProof proveWitness(const JSProofWitness<NumInputs, NumOutputs>& witness) = 0;
+
+    // Hand the proofs of prove to prover, or compute them on the calling thread
+    // again with NULL. The prover is not owned.
+    void setProver(JoinSplitProver<NumInputs, NumOutputs>* proverIn) {
+        prover = proverIn;
+    }
+
     virtual bool verify(
         const PHGRProof& proof,
         ProofVerifier& verifier,
@@ -104,12 +161,18 @@ public:
     ) = 0;
 
 protected:
-    JoinSplit() {}
+    JoinSplit() : prover(NULL) {}
+
+    JoinSplitProver<NumInputs, NumOutputs>* prover;
 };
 
 }
 
 typedef libzcash::JoinSplit<ZC_NUM_JS_INPUTS,
                             ZC_NUM_JS_OUTPUTS> ZCJoinSplit;
+typedef libzcash::JSProofWitness<ZC_NUM_JS_INPUTS,
+                                 ZC_NUM_JS_OUTPUTS> ZCJSProofWitness;
+typedef libzcash::JoinSplitProver<ZC_NUM_JS_INPUTS,
+                                  ZC_NUM_JS_OUTPUTS> ZCJoinSplitProver;
 
 #endif // ZC_JOINSPLIT_H_
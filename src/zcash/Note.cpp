@@ -61,8 +61,11 @@ NotePlaintext NotePlaintext::decrypt(const ZCNoteDecryption& decryptor,
                                      unsigned char nonce
                                     )
 {
-    auto plaintext = decryptor.decrypt(ciphertext, ephemeralKey, h_sig, nonce);
+    return deserialize(decryptor.decrypt(ciphertext, ephemeralKey, h_sig, nonce));
+}
 
+NotePlaintext NotePlaintext::deserialize(const ZCNoteDecryption::Plaintext& plaintext)
+{
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << plaintext;
 
@@ -38,6 +38,16 @@ public:
     uint256 cm() const;
 
     uint256 nullifier(const SpendingKey& a_sk) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(value_);
+        READWRITE(a_pk);
+        READWRITE(rho);
+        READWRITE(r);
+    }
 };
 
 class BaseNotePlaintext {
@@ -91,6 +101,9 @@ public:
                                  unsigned char nonce
                                 );
 
+    // The note plaintext of a decrypted ciphertext
+    static NotePlaintext deserialize(const ZCNoteDecryption::Plaintext& plaintext);
+
     ZCNoteEncryption::Ciphertext encrypt(ZCNoteEncryption& encryptor,
                                          const uint256& pk_enc
                                         ) const;
@@ -4,6 +4,8 @@
 #include <boost/static_assert.hpp>
 #include "prf.h"
 
+#include <map>
+
 #define NOTEENCRYPTION_CIPHER_KEYSIZE 32
 
 void clamp_curve25519(unsigned char key[crypto_scalarmult_SCALARBYTES])
@@ -106,6 +108,18 @@ typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt
                                           const uint256 &hSig,
                                           unsigned char nonce
                                          ) const
+{
+    NoteDecryption<MLEN>::Plaintext plaintext;
+
+    if (!try_decrypt(plaintext, ciphertext, epk, dh_secret(epk), hSig, nonce)) {
+        throw note_decryption_failed();
+    }
+
+    return plaintext;
+}
+
+template<size_t MLEN>
+uint256 NoteDecryption<MLEN>::dh_secret(const uint256 &epk) const
 {
     uint256 dhsecret;
 
@@ -113,26 +127,66 @@ typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt
         throw std::logic_error("Could not create DH secret");
     }
 
+    return dhsecret;
+}
+
+template<size_t MLEN>
+bool NoteDecryption<MLEN>::try_decrypt(NoteDecryption<MLEN>::Plaintext &plaintext,
+                                       const NoteDecryption<MLEN>::Ciphertext &ciphertext,
+                                       const uint256 &epk,
+                                       const uint256 &dhsecret,
+                                       const uint256 &hSig,
+                                       unsigned char nonce
+                                      ) const
+{
     unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
     KDF(K, dhsecret, epk, pk_enc, hSig, nonce);
 
     // The nonce is zero because we never reuse keys
     unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
 
-    NoteDecryption<MLEN>::Plaintext plaintext;
-
     // Message length is always NOTEENCRYPTION_AUTH_BYTES less than
-    // the ciphertext length.
-    if (crypto_aead_chacha20poly1305_ietf_decrypt(plaintext.begin(), NULL,
-                                             NULL,
-                                             ciphertext.begin(), NoteDecryption<MLEN>::CLEN,
-                                             NULL,
-                                             0,
-                                             cipher_nonce, K) != 0) {
-        throw note_decryption_failed();
+    // the ciphertext length. The tag is checked before the message
+    // is decrypted, so a ciphertext for another key costs one
+    // Poly1305 evaluation.
+    return crypto_aead_chacha20poly1305_ietf_decrypt(plaintext.begin(), NULL,
+                                                NULL,
+                                                ciphertext.begin(), NoteDecryption<MLEN>::CLEN,
+                                                NULL,
+                                                0,
+                                                cipher_nonce, K) == 0;
+}
+
+template<size_t MLEN>
+size_t NoteDecryption<MLEN>::try_decrypt_batch(const std::vector<NoteDecryption<MLEN>::BatchItem> &batch,
+                                               std::vector<boost::optional<NoteDecryption<MLEN>::Plaintext>> &plaintexts
+                                              ) const
+{
+    // The secret of each ephemeral key, none if it is of low order
+    std::map<uint256, boost::optional<uint256>> secrets;
+    size_t nDecrypted = 0;
+
+    plaintexts.assign(batch.size(), boost::none);
+    for (size_t i = 0; i < batch.size(); i++) {
+        const BatchItem &item = batch[i];
+        auto it = secrets.find(*item.epk);
+        if (it == secrets.end()) {
+            boost::optional<uint256> dhsecret = uint256();
+            if (crypto_scalarmult(dhsecret->begin(), sk_enc.begin(), item.epk->begin()) != 0)
+                dhsecret = boost::none;
+            it = secrets.insert(std::make_pair(*item.epk, dhsecret)).first;
+        }
+        if (!it->second)
+            continue;
+
+        Plaintext plaintext;
+        if (try_decrypt(plaintext, *item.ciphertext, *item.epk, *it->second, *item.hSig, item.nonce)) {
+            plaintexts[i] = plaintext;
+            nDecrypted++;
+        }
     }
 
-    return plaintext;
+    return nDecrypted;
 }
 
 //
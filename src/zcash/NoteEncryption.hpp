@@ -7,6 +7,7 @@ https://github.com/zcash/zips/blob/master/protocol/protocol.pdf
 #define ZC_NOTE_ENCRYPTION_H_
 
 #include <boost/array.hpp>
+#include <boost/optional.hpp>
 #include "uint256.h"
 #include "uint252.h"
 
@@ -14,6 +15,7 @@ https://github.com/zcash/zips/blob/master/protocol/protocol.pdf
 #include "zcash/Address.hpp"
 
 #include <array>
+#include <vector>
 
 namespace libzcash {
 
@@ -78,6 +80,39 @@ public:
                       unsigned char nonce
                      ) const;
 
+    // The Diffie-Hellman secret of this key with epk, the same
+    // for every ciphertext of the ephemeral key
+    uint256 dh_secret(const uint256 &epk) const;
+
+    // Like decrypt, with the secret of epk already computed, and
+    // returning false rather than throwing if the ciphertext is
+    // not authenticated by this key, which is found before any
+    // decryption happens
+    bool try_decrypt(Plaintext &plaintext,
+                     const Ciphertext &ciphertext,
+                     const uint256 &epk,
+                     const uint256 &dhsecret,
+                     const uint256 &hSig,
+                     unsigned char nonce
+                    ) const;
+
+    // A ciphertext of a batch, and what it was encrypted with
+    struct BatchItem {
+        const Ciphertext *ciphertext;
+        const uint256 *epk;
+        const uint256 *hSig;
+        unsigned char nonce;
+    };
+
+    // try_decrypt for each ciphertext of batch, computing the secret
+    // of each distinct ephemeral key once, however the ciphertexts of
+    // the key are spread. plaintexts gets the plaintext of each one
+    // this key authenticates, and none for the others or those of an
+    // ephemeral key without a secret; returns how many it decrypted
+    size_t try_decrypt_batch(const std::vector<BatchItem> &batch,
+                             std::vector<boost::optional<Plaintext>> &plaintexts
+                            ) const;
+
     friend inline bool operator==(const NoteDecryption& a, const NoteDecryption& b) {
         return a.sk_enc == b.sk_enc && a.pk_enc == b.pk_enc;
     }
@@ -13,6 +13,7 @@ typedef alt_bn128_pp curve_pp;
 typedef alt_bn128_pp::G1_type curve_G1;
 typedef alt_bn128_pp::G2_type curve_G2;
 typedef alt_bn128_pp::GT_type curve_GT;
+typedef alt_bn128_pp::Fqk_type curve_Fqk;
 typedef alt_bn128_pp::Fp_type curve_Fr;
 typedef alt_bn128_pp::Fq_type curve_Fq;
 typedef alt_bn128_pp::Fqe_type curve_Fq2;
@@ -171,8 +172,13 @@ curve_G2 CompressedG2::to_libsnark_g2() const
 }
 
 template<>
-PHGRProof::PHGRProof(const r1cs_ppzksnark_proof<curve_pp> &proof)
+PHGRProof::PHGRProof(const r1cs_ppzksnark_proof<curve_pp> &proof_in)
 {
+    // The G1 points made affine with one inversion, before being compressed
+    r1cs_ppzksnark_proof<curve_pp> proof(proof_in);
+    batch_to_special_points<curve_G1>({&proof.g_A.g, &proof.g_A.h, &proof.g_B.h,
+                                       &proof.g_C.g, &proof.g_C.h, &proof.g_K, &proof.g_H});
+
     g_A = CompressedG1(proof.g_A.g);
     g_A_prime = CompressedG1(proof.g_A.h);
     g_B = CompressedG2(proof.g_B.g);
@@ -216,6 +222,57 @@ PHGRProof PHGRProof::random_invalid()
     return p;
 }
 
+class ProofBatch {
+public:
+    // For each deferred proof, the Miller loop results whose final
+    // exponentiations must all be one for the proof to be valid.
+    std::vector<std::vector<curve_Fqk>> entries;
+};
+
+// Same pairing equations as r1cs_ppzksnark_online_verifier_weak_IC,
+// stopping short of the final exponentiations.
+static std::vector<curve_Fqk> r1cs_ppzksnark_pairing_terms(
+    const r1cs_ppzksnark_processed_verification_key<curve_pp>& pvk,
+    const r1cs_primary_input<curve_Fr>& primary_input,
+    const r1cs_ppzksnark_proof<curve_pp>& proof
+)
+{
+    const curve_G1 acc = r1cs_ppzksnark_accumulate_IC<curve_pp>(pvk, primary_input);
+
+    std::vector<curve_Fqk> terms;
+    terms.reserve(5);
+
+    // Each product of pairings in one multi Miller loop, as in r1cs_ppzksnark_online_verifier_weak_IC
+    auto proof_g_A_g_precomp = curve_pp::precompute_G1(proof.g_A.g);
+    auto proof_g_A_h_neg_precomp = curve_pp::precompute_G1(-proof.g_A.h);
+    terms.push_back(curve_pp::multi_miller_loop({ { &proof_g_A_g_precomp, &pvk.vk_alphaA_g2_precomp },
+                                                  { &proof_g_A_h_neg_precomp, &pvk.pp_G2_one_precomp } }));
+
+    auto proof_g_B_g_precomp = curve_pp::precompute_G2(proof.g_B.g);
+    auto proof_g_B_h_neg_precomp = curve_pp::precompute_G1(-proof.g_B.h);
+    terms.push_back(curve_pp::multi_miller_loop({ { &pvk.vk_alphaB_g1_precomp, &proof_g_B_g_precomp },
+                                                  { &proof_g_B_h_neg_precomp, &pvk.pp_G2_one_precomp } }));
+
+    auto proof_g_C_g_precomp = curve_pp::precompute_G1(proof.g_C.g);
+    auto proof_g_C_h_neg_precomp = curve_pp::precompute_G1(-proof.g_C.h);
+    terms.push_back(curve_pp::multi_miller_loop({ { &proof_g_C_g_precomp, &pvk.vk_alphaC_g2_precomp },
+                                                  { &proof_g_C_h_neg_precomp, &pvk.pp_G2_one_precomp } }));
+
+    auto proof_g_A_g_acc_neg_precomp = curve_pp::precompute_G1(-(proof.g_A.g + acc));
+    auto proof_g_H_precomp = curve_pp::precompute_G1(proof.g_H);
+    terms.push_back(curve_pp::multi_miller_loop({ { &proof_g_A_g_acc_neg_precomp, &proof_g_B_g_precomp },
+                                                  { &proof_g_H_precomp, &pvk.vk_rC_Z_g2_precomp },
+                                                  { &proof_g_C_g_precomp, &pvk.pp_G2_one_precomp } }));
+
+    auto proof_g_K_neg_precomp = curve_pp::precompute_G1(-proof.g_K);
+    auto proof_g_A_g_acc_C_precomp = curve_pp::precompute_G1((proof.g_A.g + acc) + proof.g_C.g);
+    terms.push_back(curve_pp::multi_miller_loop({ { &proof_g_K_neg_precomp, &pvk.vk_gamma_g2_precomp },
+                                                  { &proof_g_A_g_acc_C_precomp, &pvk.vk_gamma_beta_g2_precomp },
+                                                  { &pvk.vk_gamma_beta_g1_precomp, &proof_g_B_g_precomp } }));
+
+    return terms;
+}
+
 static std::once_flag init_public_params_once_flag;
 
 void initialize_curve_params()
@@ -233,6 +290,11 @@ ProofVerifier ProofVerifier::Disabled() {
     return ProofVerifier(false);
 }
 
+ProofVerifier ProofVerifier::Batch() {
+    initialize_curve_params();
+    return ProofVerifier(true, std::make_shared<ProofBatch>());
+}
+
 template<>
 bool ProofVerifier::check(
     const r1cs_ppzksnark_verification_key<curve_pp>& vk,
@@ -241,11 +303,20 @@ bool ProofVerifier::check(
     const r1cs_ppzksnark_proof<curve_pp>& proof
 )
 {
-    if (perform_verification) {
-        return r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(pvk, primary_input, proof);
-    } else {
+    if (!perform_verification) {
         return true;
     }
+
+    if (!batch) {
+        return r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(pvk, primary_input, proof);
+    }
+
+    // Only the pairing checks are deferred: malformed proofs are rejected right away.
+    if (pvk.encoded_IC_query.domain_size() != primary_input.size() || !proof.is_well_formed()) {
+        return false;
+    }
+    batch->entries.push_back(r1cs_ppzksnark_pairing_terms(pvk, primary_input, proof));
+    return true;
 }
 
 bool ProofVerifier::isVerificationEnabled() const
@@ -253,4 +324,43 @@ bool ProofVerifier::isVerificationEnabled() const
     return perform_verification;
 }
 
+bool ProofVerifier::verifyBatch(std::vector<size_t>* pvFailed)
+{
+    if (!batch || batch->entries.empty()) {
+        return true;
+    }
+
+    std::vector<std::vector<curve_Fqk>> entries;
+    entries.swap(batch->entries);
+
+    // Raising every term to an independent random 64-bit exponent before
+    // multiplying them together makes it infeasible for an invalid proof
+    // to cancel out against the others, so one final exponentiation
+    // checks the whole batch.
+    curve_Fqk acc = curve_Fqk::one();
+    for (const auto& entry : entries) {
+        for (const auto& term : entry) {
+            uint64_t r;
+            randombytes_buf(&r, sizeof(r));
+            acc = acc * (term ^ bigint<1>(r | 1));
+        }
+    }
+    if (curve_pp::final_exponentiation(acc) == curve_GT::one()) {
+        return true;
+    }
+
+    // Something in the batch is invalid: find out what.
+    for (size_t i = 0; i < entries.size(); i++) {
+        for (const auto& term : entries[i]) {
+            if (curve_pp::final_exponentiation(term) != curve_GT::one()) {
+                if (pvFailed) {
+                    pvFailed->push_back(i);
+                }
+                break;
+            }
+        }
+    }
+    return false;
+}
+
 }
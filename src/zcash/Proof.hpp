@@ -4,6 +4,9 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <memory>
+#include <vector>
+
 namespace libzcash {
 
 const unsigned char G1_PREFIX_MASK = 0x02;
@@ -237,11 +240,16 @@ public:
 
 void initialize_curve_params();
 
+// Pairing checks deferred by a batching ProofVerifier
+class ProofBatch;
+
 class ProofVerifier {
 private:
     bool perform_verification;
+    std::shared_ptr<ProofBatch> batch;
 
-    ProofVerifier(bool perform_verification) : perform_verification(perform_verification) { }
+    ProofVerifier(bool perform_verification, std::shared_ptr<ProofBatch> batch = nullptr) :
+        perform_verification(perform_verification), batch(batch) { }
 
 public:
     // ProofVerifier should never be copied
@@ -259,6 +267,12 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Creates a verification context that defers the pairing checks
+    // of PHGR proofs until verifyBatch() is called, so that all of
+    // them share a single randomized final exponentiation. Groth
+    // proofs are still verified one at a time by librustzcash.
+    static ProofVerifier Batch();
+
     template <typename VerificationKey,
               typename ProcessedVerificationKey,
               typename PrimaryInput,
@@ -272,6 +286,12 @@ public:
     );
 
     bool isVerificationEnabled() const;
+
+    // Verifies all the proofs deferred since the last call. If the batch
+    // does not verify, each deferred proof is checked on its own and the
+    // positions (in submission order) of the invalid ones are appended
+    // to pvFailed. Always succeeds for non-batching verifiers.
+    bool verifyBatch(std::vector<size_t>* pvFailed = nullptr);
 };
 
 }
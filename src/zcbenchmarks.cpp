@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <future>
 #include <map>
@@ -162,16 +164,13 @@ double benchmark_verify_joinsplit(const JSDescription &joinsplit)
 }
 
 #ifdef ENABLE_MINING
-double benchmark_solve_equihash()
+static void benchmark_init_equihash(unsigned int n, unsigned int k, crypto_generichash_blake2b_state& eh_state)
 {
     CBlock pblock;
     CEquihashInput I{pblock};
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << I;
 
-    unsigned int n = Params(CBaseChainParams::MAIN).EquihashN();
-    unsigned int k = Params(CBaseChainParams::MAIN).EquihashK();
-    crypto_generichash_blake2b_state eh_state;
     EhInitialiseState(n, k, eh_state);
     crypto_generichash_blake2b_update(&eh_state, (unsigned char*)&ss[0], ss.size());
 
@@ -180,15 +179,36 @@ double benchmark_solve_equihash()
     crypto_generichash_blake2b_update(&eh_state,
                                     nonce.begin(),
                                     nonce.size());
+}
+
+double benchmark_solve_equihash()
+{
+    unsigned int n = Params(CBaseChainParams::MAIN).EquihashN();
+    unsigned int k = Params(CBaseChainParams::MAIN).EquihashK();
+    crypto_generichash_blake2b_state eh_state;
+    benchmark_init_equihash(n, k, eh_state);
 
     struct timeval tv_start;
     timer_start(tv_start);
-    std::set<std::vector<unsigned int>> solns;
     EhOptimisedSolveUncancellable(n, k, eh_state,
                                   [](std::vector<unsigned char> soln) { return false; });
     return timer_stop(tv_start);
 }
 
+double benchmark_solve_equihash_parallel(int nThreads)
+{
+    unsigned int n = Params(CBaseChainParams::MAIN).EquihashN();
+    unsigned int k = Params(CBaseChainParams::MAIN).EquihashK();
+    crypto_generichash_blake2b_state eh_state;
+    benchmark_init_equihash(n, k, eh_state);
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    EhParallelSolveUncancellable(n, k, eh_state,
+                                 [](std::vector<unsigned char> soln) { return false; }, nThreads);
+    return timer_stop(tv_start);
+}
+
 std::vector<double> benchmark_solve_equihash_threaded(int nThreads)
 {
     std::vector<double> ret;
@@ -323,13 +343,13 @@ double benchmark_increment_note_witnesses(size_t nTxs)
 
         wtx.SetNoteData(noteData);
         wallet.AddToWallet(wtx, true, NULL);
-        block1.vtx.push_back(wtx);
+        block1.vtx.push_back(MakeTransactionRef(wtx));
     }
     CBlockIndex index1(block1);
     index1.nHeight = 1;
 
     // Increment to get transactions witnessed
-    wallet.ChainTip(&index1, &block1, tree, true);
+    wallet.ChainTip(&index1, &block1, std::make_shared<const ZCIncrementalMerkleTree>(tree), true);
 
     // Second block
     CBlock block2;
@@ -346,14 +366,14 @@ double benchmark_increment_note_witnesses(size_t nTxs)
 
         wtx.SetNoteData(noteData);
         wallet.AddToWallet(wtx, true, NULL);
-        block2.vtx.push_back(wtx);
+        block2.vtx.push_back(MakeTransactionRef(wtx));
     }
     CBlockIndex index2(block2);
     index2.nHeight = 2;
 
     struct timeval tv_start;
     timer_start(tv_start);
-    wallet.ChainTip(&index2, &block2, tree, true);
+    wallet.ChainTip(&index2, &block2, std::make_shared<const ZCIncrementalMerkleTree>(tree), true);
     return timer_stop(tv_start);
 }
 
@@ -475,3 +495,410 @@ double benchmark_listunspent()
     auto unspent = listunspent(params, false);
     return timer_stop(tv_start);
 }
+
+//! Transparent keys of a synthetic wallet, which its transactions pay in turn
+static const size_t SYNTHETIC_WALLET_KEYS = 1000;
+//! Notes received in the block walletscale witnesses each sample
+static const size_t WALLET_SCALE_BLOCK_NOTES = 20;
+
+/**
+ * Write a wallet of nTxs transparent transactions and nNotes notes across nAddrs
+ * z-addresses to strFile, with witness caches nWitnesses blocks deep. The transactions
+ * claim blocks of the active chain without being in them, and their JoinSplits have no
+ * proofs. The notes are received in the block nWitnesses - 1 below the tip, ordered by
+ * hash, so the commitment tree after them is rebuilt from mapWallet.
+ */
+static void write_synthetic_wallet(const std::string& strFile, size_t nTxs, size_t nNotes, size_t nAddrs, int nWitnesses)
+{
+    const int nNotesHeight = chainActive.Height() - nWitnesses + 1;
+    CWallet wallet(strFile);
+    bool fFirstRun;
+    if (wallet.LoadWallet(fFirstRun) != DB_LOAD_OK)
+        throw std::runtime_error("couldn't create " + strFile);
+
+    std::vector<CScript> vScripts;
+    std::vector<libzcash::SpendingKey> vSpendingKeys;
+    {
+        LOCK(wallet.cs_wallet);
+        for (size_t i = 0; i < std::min(nTxs, SYNTHETIC_WALLET_KEYS); i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            wallet.AddKeyPubKey(key, key.GetPubKey());
+            vScripts.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+        }
+        for (size_t i = 0; i < nAddrs; i++) {
+            vSpendingKeys.push_back(libzcash::SpendingKey::random());
+            wallet.AddZKey(vSpendingKeys.back());
+        }
+    }
+
+    for (size_t i = 0; i < nTxs; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        mtx.vout.push_back(CTxOut(COIN + i, vScripts[i % vScripts.size()]));
+        CWalletTx wtx(&wallet, mtx);
+        wtx.hashBlock = chainActive.Tip()->GetBlockHash();
+        wtx.nIndex = 0;
+        wallet.AddToWallet(wtx, false, NULL, true);
+    }
+
+    // Each receive has two notes
+    CBlock block;
+    for (size_t i = 0; i < (nNotes + 1) / 2; i++) {
+        const libzcash::SpendingKey& sk = vSpendingKeys[i % vSpendingKeys.size()];
+        CWalletTx wtx = GetValidReceive(*pzcashParams, sk, COIN + i, true);
+        mapNoteData_t noteData;
+        for (size_t n = 0; n < 2; n++) {
+            libzcash::Note note = GetNote(*pzcashParams, sk, wtx, 0, n);
+            noteData[JSOutPoint(wtx.GetHash(), 0, n)] = CNoteData(sk.address(), note.nullifier(sk));
+        }
+        wtx.SetNoteData(noteData);
+        wtx.hashBlock = chainActive[nNotesHeight]->GetBlockHash();
+        wtx.nIndex = 0;
+        wallet.AddToWallet(wtx, false, NULL, true);
+        block.vtx.push_back(MakeTransactionRef(wtx));
+    }
+    std::sort(block.vtx.begin(), block.vtx.end(), [](const CTransactionRef& a, const CTransactionRef& b) {
+        return a->GetHash() < b->GetHash();
+    });
+
+    // The witness caches grow a witness for each block connected
+    ZCIncrementalMerkleTree tree;
+    ZCIncrementalMerkleTreeRef treeBefore = std::make_shared<const ZCIncrementalMerkleTree>(tree);
+    for (int nHeight = nNotesHeight; nHeight <= chainActive.Height(); nHeight++) {
+        CBlockIndex index(block);
+        index.nHeight = nHeight;
+        wallet.ChainTip(&index, &block, treeBefore, true);
+        for (const CTransactionRef& ptx : block.vtx)
+            for (const JSDescription& jsdesc : ptx->vjoinsplit)
+                for (const uint256& commitment : jsdesc.commitments)
+                    tree.append(commitment);
+        treeBefore = std::make_shared<const ZCIncrementalMerkleTree>(tree);
+        block = CBlock();
+    }
+    wallet.SetBestChain(chainActive.GetLocator());
+}
+
+double benchmark_wallet_scale(size_t nTxs, size_t nNotes, size_t nAddrs, int nWitnesses, UniValue& stats)
+{
+    // Generated once for a chain tip and reused, as the samples don't write to it
+    const std::string strFile = strprintf("benchmark-wallet-%u-%u-%u-%d-%d.dat",
+                                          nTxs, nNotes, nAddrs, nWitnesses, chainActive.Height());
+    if (!boost::filesystem::exists(GetDataDir() / strFile)) {
+        LOCK(cs_main);
+        write_synthetic_wallet(strFile, nTxs, nNotes, nAddrs, nWitnesses);
+    }
+
+    struct timeval tv_start;
+    double total = 0;
+
+    timer_start(tv_start);
+    std::unique_ptr<CWallet> pwallet(new CWallet(strFile));
+    bool fFirstRun;
+    DBErrors nLoadWalletRet = pwallet->LoadWallet(fFirstRun);
+    double load = timer_stop(tv_start);
+    if (nLoadWalletRet != DB_LOAD_OK)
+        throw std::runtime_error("couldn't load " + strFile);
+    total += load;
+
+    // Their merkle branches don't lead to the blocks they claim
+    int nWitnessHeight = -1;
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : pwallet->mapWallet) {
+        wtxItem.second.fMerkleVerified = true;
+        for (const mapNoteData_t::value_type& item : wtxItem.second.mapNoteData)
+            nWitnessHeight = item.second.witnessHeight;
+    }
+
+    timer_start(tv_start);
+    std::vector<CNotePlaintextEntry> entries;
+    pwallet->GetFilteredNotes(entries, "");
+    double filterednotes = timer_stop(tv_start);
+    total += filterednotes;
+
+    timer_start(tv_start);
+    std::vector<COutput> vCoins;
+    pwallet->AvailableCoins(vCoins);
+    double availablecoins = timer_stop(tv_start);
+    total += availablecoins;
+
+    // A z_sendmany of half the notes of an address: its notes by value, then their witnesses
+    std::set<libzcash::PaymentAddress> setAddresses;
+    pwallet->GetPaymentAddresses(setAddresses);
+    const std::string strAddress = setAddresses.empty() ? "" : CZCPaymentAddress(*setAddresses.begin()).ToString();
+    timer_start(tv_start);
+    std::vector<CNotePlaintextEntry> addressEntries;
+    if (!strAddress.empty())
+        pwallet->GetFilteredNotes(addressEntries, strAddress);
+    std::sort(addressEntries.begin(), addressEntries.end(), [](const CNotePlaintextEntry& a, const CNotePlaintextEntry& b) {
+        return a.plaintext.value() > b.plaintext.value();
+    });
+    CAmount nTotal = 0;
+    for (const CNotePlaintextEntry& entry : addressEntries)
+        nTotal += entry.plaintext.value();
+    std::vector<JSOutPoint> vSelected;
+    CAmount nSelected = 0;
+    for (const CNotePlaintextEntry& entry : addressEntries) {
+        if (nSelected >= nTotal / 2)
+            break;
+        vSelected.push_back(entry.jsop);
+        nSelected += entry.plaintext.value();
+    }
+    std::vector<boost::optional<ZCIncrementalWitness>> vWitnesses;
+    uint256 anchor;
+    pwallet->GetNoteWitnesses(vSelected, vWitnesses, anchor);
+    double sendmanyplan = timer_stop(tv_start);
+    total += sendmanyplan;
+
+    timer_start(tv_start);
+    pwallet->ScanForWalletTransactions(chainActive.Genesis(), true);
+    double rescan = timer_stop(tv_start);
+    total += rescan;
+
+    // The next block, with notes for the addresses of the wallet
+    double incnotewitnesses = 0;
+    if (nWitnessHeight >= 0) {
+        ZCIncrementalMerkleTree tree;
+        for (const std::pair<const uint256, CWalletTx>& wtxItem : pwallet->mapWallet)
+            for (const JSDescription& jsdesc : wtxItem.second.vjoinsplit)
+                for (const uint256& commitment : jsdesc.commitments)
+                    tree.append(commitment);
+
+        CBlock block;
+        std::set<libzcash::PaymentAddress>::const_iterator it = setAddresses.begin();
+        for (size_t i = 0; i < WALLET_SCALE_BLOCK_NOTES / 2; i++) {
+            libzcash::SpendingKey sk;
+            pwallet->GetSpendingKey(*it, sk);
+            if (++it == setAddresses.end())
+                it = setAddresses.begin();
+            CWalletTx wtx = GetValidReceive(*pzcashParams, sk, COIN, true);
+            mapNoteData_t noteData;
+            for (size_t n = 0; n < 2; n++) {
+                libzcash::Note note = GetNote(*pzcashParams, sk, wtx, 0, n);
+                noteData[JSOutPoint(wtx.GetHash(), 0, n)] = CNoteData(sk.address(), note.nullifier(sk));
+            }
+            wtx.SetNoteData(noteData);
+            pwallet->AddToWallet(wtx, true, NULL);
+            block.vtx.push_back(MakeTransactionRef(wtx));
+        }
+        CBlockIndex index(block);
+        index.nHeight = nWitnessHeight + 1;
+
+        timer_start(tv_start);
+        pwallet->ChainTip(&index, &block, std::make_shared<const ZCIncrementalMerkleTree>(tree), true);
+        incnotewitnesses = timer_stop(tv_start);
+        total += incnotewitnesses;
+    }
+
+    stats.pushKV("transactions", (uint64_t)pwallet->mapWallet.size());
+    stats.pushKV("notes", (uint64_t)entries.size());
+    stats.pushKV("coins", (uint64_t)vCoins.size());
+    stats.pushKV("plannednotes", (uint64_t)vSelected.size());
+    stats.pushKV("load", load);
+    stats.pushKV("getfilterednotes", filterednotes);
+    stats.pushKV("availablecoins", availablecoins);
+    stats.pushKV("sendmanyplan", sendmanyplan);
+    stats.pushKV("rescan", rescan);
+    stats.pushKV("incnotewitnesses", incnotewitnesses);
+    return total;
+}
+
+#ifdef ENABLE_MINING
+//! Transactions of each chain of mempoolstress, each spending the one before it
+static const size_t MEMPOOL_STRESS_CHAIN_LENGTH = 25;
+//! Outputs of each transaction funding the chains and JoinSplits of mempoolstress
+static const size_t MEMPOOL_STRESS_FANOUT = 500;
+//! Fee of each transaction of mempoolstress
+static const CAmount MEMPOOL_STRESS_FEE = 1000;
+//! Milliseconds between the blocks mined while mempoolstress accepts the transactions
+static const int MEMPOOL_STRESS_BLOCK_INTERVAL = 1000;
+
+//! A field of /proc/self/status in kB, 0 where there is none
+static int64_t proc_status_kb(const std::string& strField)
+{
+    FILE* file = fopen("/proc/self/status", "r");
+    if (!file)
+        return 0;
+    int64_t nKB = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, strField.c_str(), strField.size()) == 0 && line[strField.size()] == ':') {
+            nKB = atoi64(line + strField.size() + 1);
+            break;
+        }
+    }
+    fclose(file);
+    return nKB;
+}
+
+static void mine_blocks(int nBlocks)
+{
+    UniValue params(UniValue::VARR);
+    params.push_back(nBlocks);
+    generate(params, false);
+}
+
+//! A transaction shielding the output prevout of keystore, with a JoinSplit proven for it
+static CTransaction mempool_stress_joinsplit(const CBasicKeyStore& keystore, const CScript& scriptPubKey,
+                                             const COutPoint& prevout, CAmount nValue, int shieldedTxVersion)
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = shieldedTxVersion;
+    mtx.vin.push_back(CTxIn(prevout));
+
+    unsigned char joinSplitPrivKey[crypto_sign_SECRETKEYBYTES];
+    crypto_sign_keypair(mtx.joinSplitPubKey.begin(), joinSplitPrivKey);
+
+    const CAmount nShielded = nValue - MEMPOOL_STRESS_FEE;
+    mtx.vjoinsplit.push_back(JSDescription(shieldedTxVersion == GROTH_TX_VERSION,
+                                           *pzcashParams,
+                                           mtx.joinSplitPubKey,
+                                           ZCIncrementalMerkleTree().root(),
+                                           {JSInput(), JSInput()},
+                                           {JSOutput(SpendingKey::random().address(), nShielded), JSOutput()},
+                                           nShielded,
+                                           0));
+
+    CTransaction signTx(mtx);
+    uint256 dataToBeSigned = SignatureHash(CScript(), signTx, NOT_AN_INPUT, SIGHASH_ALL);
+    assert(crypto_sign_detached(&mtx.joinSplitSig[0], NULL, dataToBeSigned.begin(), 32, joinSplitPrivKey) == 0);
+    assert(SignSignature(keystore, scriptPubKey, mtx, 0));
+    return mtx;
+}
+
+double benchmark_mempool_stress(size_t nTxs, size_t nJoinSplits, int nThreads, int shieldedTxVersion, UniValue& stats)
+{
+    // The transactions are funded from the coinbases of the wallet, and signed and proven
+    // before the time starts
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    const size_t nChains = (nTxs + MEMPOOL_STRESS_CHAIN_LENGTH - 1) / MEMPOOL_STRESS_CHAIN_LENGTH;
+    const size_t nOutputs = nChains + nJoinSplits;
+    std::vector<std::pair<COutPoint, CAmount>> vFunds;
+    std::vector<uint256> vFunding;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        std::vector<COutput> vCoins;
+        pwalletMain->AvailableCoins(vCoins, true, NULL, false, true, false);
+        for (const COutput& out : vCoins) {
+            if (vFunds.size() == nOutputs)
+                break;
+            if (!out.fSpendable)
+                continue;
+            const size_t nFanOut = std::min(MEMPOOL_STRESS_FANOUT, nOutputs - vFunds.size());
+            const CAmount nValue = (out.tx->vout[out.i].nValue - MEMPOOL_STRESS_FEE) / nFanOut;
+            if (nValue <= (CAmount)(MEMPOOL_STRESS_CHAIN_LENGTH + 1) * MEMPOOL_STRESS_FEE)
+                continue;
+            CMutableTransaction mtx;
+            mtx.vin.push_back(CTxIn(out.tx->GetHash(), out.i));
+            mtx.vout.assign(nFanOut, CTxOut(nValue, scriptPubKey));
+            if (!SignSignature(*pwalletMain, *out.tx, mtx, 0))
+                throw std::runtime_error("Couldn't sign the funding transactions, the wallet is locked");
+            CValidationState state;
+            if (!AcceptToMemoryPool(mempool, state, mtx, false, NULL))
+                throw std::runtime_error("Funding transaction rejected: " + state.GetRejectReason());
+            const uint256 hash = mtx.GetHash();
+            vFunding.push_back(hash);
+            for (size_t i = 0; i < nFanOut; i++)
+                vFunds.push_back(std::make_pair(COutPoint(hash, i), nValue));
+        }
+    }
+    if (vFunds.size() < nOutputs)
+        throw std::runtime_error(strprintf("The wallet lacks the mature coins to fund %u chains and JoinSplits, generate more blocks", nOutputs));
+    // The chains start from confirmed outputs
+    for (int i = 0; i < 10 && std::any_of(vFunding.begin(), vFunding.end(), [](const uint256& hash) { return mempool.exists(hash); }); i++)
+        mine_blocks(1);
+
+    // Each thread accepts its sequences in order, the chains and then the JoinSplits
+    std::vector<std::vector<CTransaction>> vSequences(nOutputs);
+    for (size_t c = 0; c < nChains; c++) {
+        COutPoint prevout = vFunds[c].first;
+        CAmount nValue = vFunds[c].second;
+        for (size_t i = 0; i < MEMPOOL_STRESS_CHAIN_LENGTH && c * MEMPOOL_STRESS_CHAIN_LENGTH + i < nTxs; i++) {
+            nValue -= MEMPOOL_STRESS_FEE;
+            CMutableTransaction mtx;
+            mtx.vin.push_back(CTxIn(prevout));
+            mtx.vout.push_back(CTxOut(nValue, scriptPubKey));
+            assert(SignSignature(keystore, scriptPubKey, mtx, 0));
+            vSequences[c].push_back(mtx);
+            prevout = COutPoint(mtx.GetHash(), 0);
+        }
+    }
+    for (size_t j = 0; j < nJoinSplits; j++) {
+        const std::pair<COutPoint, CAmount>& fund = vFunds[nChains + j];
+        vSequences[nChains + j].push_back(mempool_stress_joinsplit(keystore, scriptPubKey, fund.first, fund.second, shieldedTxVersion));
+    }
+
+    std::atomic<size_t> nAccepted(0), nRejected(0);
+    std::atomic<int64_t> nLockWait(0);
+    std::atomic<bool> fDone(false);
+    size_t nMaxUsage = mempool.DynamicMemoryUsage();
+    int nBlocks = 0;
+    std::string strBlockError;
+
+    // Blocks are mined and connected at an interval while the transactions are accepted,
+    // contending with them for cs_main
+    std::thread blocks([&]() {
+        int64_t nNextBlock = GetTimeMillis() + MEMPOOL_STRESS_BLOCK_INTERVAL;
+        while (!fDone) {
+            MilliSleep(50);
+            nMaxUsage = std::max(nMaxUsage, mempool.DynamicMemoryUsage());
+            if (GetTimeMillis() < nNextBlock)
+                continue;
+            try {
+                mine_blocks(1);
+                nBlocks++;
+            } catch (const UniValue& objError) {
+                strBlockError = find_value(objError, "message").get_str();
+                return;
+            }
+            nNextBlock = GetTimeMillis() + MEMPOOL_STRESS_BLOCK_INTERVAL;
+        }
+    });
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t s = t; s < vSequences.size(); s += nThreads) {
+                for (const CTransaction& tx : vSequences[s]) {
+                    const int64_t nStart = GetTimeMicros();
+                    LOCK(cs_main);
+                    nLockWait += GetTimeMicros() - nStart;
+                    CValidationState state;
+                    bool fMissingInputs = false;
+                    if (AcceptToMemoryPool(mempool, state, tx, false, &fMissingInputs))
+                        nAccepted++;
+                    else
+                        nRejected++;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    double ret = timer_stop(tv_start);
+    fDone = true;
+    blocks.join();
+    if (!strBlockError.empty())
+        throw std::runtime_error("Mining a block failed: " + strBlockError);
+    nMaxUsage = std::max(nMaxUsage, mempool.DynamicMemoryUsage());
+
+    const size_t nTotal = nAccepted + nRejected;
+    stats.pushKV("accepted", (uint64_t)nAccepted);
+    stats.pushKV("rejected", (uint64_t)nRejected);
+    stats.pushKV("acceptspersecond", ret > 0 ? nAccepted / ret : 0.0);
+    stats.pushKV("lockwait", (int64_t)nLockWait);
+    stats.pushKV("meanlockwait", nTotal ? (double)nLockWait / nTotal : 0.0);
+    stats.pushKV("blocks", nBlocks);
+    stats.pushKV("mempoolusage", (uint64_t)nMaxUsage);
+    stats.pushKV("rss", proc_status_kb("VmRSS"));
+    stats.pushKV("peakrss", proc_status_kb("VmHWM"));
+    return ret;
+}
+#endif // ENABLE_MINING
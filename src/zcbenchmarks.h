@@ -4,12 +4,15 @@
 #include <sys/time.h>
 #include <stdlib.h>
 
+class UniValue;
+
 extern double benchmark_sleep();
 extern double benchmark_parameter_loading();
 extern double benchmark_create_joinsplit();
 extern std::vector<double> benchmark_create_joinsplit_threaded(int nThreads);
 extern double benchmark_solve_equihash();
 extern std::vector<double> benchmark_solve_equihash_threaded(int nThreads);
+extern double benchmark_solve_equihash_parallel(int nThreads);
 extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
 extern double benchmark_verify_equihash();
 extern double benchmark_large_tx();
@@ -19,5 +22,19 @@ extern double benchmark_connectblock_slow();
 extern double benchmark_sendtoaddress(CAmount amount);
 extern double benchmark_loadwallet();
 extern double benchmark_listunspent();
+/**
+ * Load a synthetic wallet of nTxs transparent transactions and nNotes notes across
+ * nAddrs z-addresses with nWitnesses deep witness caches, and time the wallet
+ * operations which scale with it into stats.
+ */
+extern double benchmark_wallet_scale(size_t nTxs, size_t nNotes, size_t nAddrs, int nWitnesses, UniValue& stats);
+#ifdef ENABLE_MINING
+/**
+ * Accept nTxs transactions in chains and nJoinSplits shielding transactions to the mempool
+ * on nThreads threads, while blocks are mined, and fill stats with the accepts per second,
+ * the time waiting for cs_main and the memory used.
+ */
+extern double benchmark_mempool_stress(size_t nTxs, size_t nJoinSplits, int nThreads, int shieldedTxVersion, UniValue& stats);
+#endif
 
 #endif
@@ -11,4 +11,9 @@
 
 static const int PENALTY_THRESHOLD = 5;
 
+/**
+ * Penalty increment of newBlock over prevBlock, its parent. It only depends on the penalty
+ * already accumulated by the parent's chain (prevBlock.nChainDelay, set once when the parent
+ * entered the block index), so no walk back to the fork point is ever needed.
+ */
 int64_t GetBlockDelay (const CBlockIndex& newBlock,const CBlockIndex& prevBlock, const int activeChainHeight, bool isStartupSyncing);
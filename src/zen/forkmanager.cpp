@@ -13,6 +13,8 @@
 #include "forks/fork6_timeblockfork.h"
 #include "forks/fork7_replayprotectionfixfork.h"
 
+#include <algorithm>
+
 namespace zen {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -174,21 +176,17 @@ ForkManager::~ForkManager() {
  */
 const Fork* ForkManager::getForkAtHeight(int height) const {
     
-    if (forks.empty()) {
+    const std::vector<ForkInterval>& networkIntervals = intervals[currentNetwork];
+    if (networkIntervals.empty()) {
         printf("no registered forks! returning nullptr!\n");
         return nullptr;
     }
 
-    // Iterate through all the forks until fork height is higher than block height or there are no more forks
-    std::list<Fork*>::const_iterator lastIterator = forks.begin();
-    for (std::list<Fork*>::const_iterator iterator = forks.begin();iterator != forks.end();iterator++) {
-        if ((*iterator)->getHeight(currentNetwork) > height) {
-            break;
-        }
-        lastIterator = iterator;
-    }
-    // return the last fork before that fork
-    return *lastIterator;
+    // Find the first interval starting above the block height
+    std::vector<ForkInterval>::const_iterator next = std::upper_bound(networkIntervals.begin(), networkIntervals.end(), height,
+        [](int h, const ForkInterval& interval) { return h < interval.startHeight; });
+    // return the fork of the interval before it, or the first fork below all of them
+    return next == networkIntervals.begin() ? next->fork : (next - 1)->fork;
 }
 
 /**
@@ -200,6 +198,19 @@ void ForkManager::registerFork(Fork* fork) {
     forks.push_back(fork);
     // sort list by height in the MAIN network. We assume that forks will always keep the same relative height order regardless of the network used
     forks.sort([](Fork* fork1, Fork* fork2) { return fork1->getHeight(CBaseChainParams::Network::MAIN) < fork2->getHeight(CBaseChainParams::Network::MAIN); });
+    // rebuild the intervals of every network in that order. A fork is active from its height
+    // until a later fork in the list starts, so a fork lower than one before it is only
+    // active from the height of that one, as it was when the list was scanned
+    for (int network = 0; network < CBaseChainParams::MAX_NETWORK_TYPES; network++) {
+        std::vector<ForkInterval>& networkIntervals = intervals[network];
+        networkIntervals.clear();
+        for (const Fork* registered : forks) {
+            int startHeight = registered->getHeight(static_cast<CBaseChainParams::Network>(network));
+            if (!networkIntervals.empty())
+                startHeight = std::max(startHeight, networkIntervals.back().startHeight);
+            networkIntervals.push_back({startHeight, registered});
+        }
+    }
 }
 
 }
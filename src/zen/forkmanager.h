@@ -8,6 +8,7 @@
 #include "chainparamsbase.h"
 #include "amount.h"
 #include <list>
+#include <vector>
 #include "zen/replayprotectionlevel.h"
 #include "script/standard.h"
 #include "forks/fork.h"
@@ -112,6 +113,20 @@ private:
      * @brief forks stores the list of all forks sorted by ascending height
      */
     std::list<Fork*> forks;
+
+    /**
+     * @brief ForkInterval the fork active from startHeight on, up to the startHeight of the next interval
+     */
+    struct ForkInterval {
+        int startHeight;
+        const Fork* fork;
+    };
+
+    /**
+     * @brief intervals stores the intervals of the forks for each network, rebuilt by registerFork,
+     * so that getForkAtHeight is a search in a few contiguous entries
+     */
+    std::vector<ForkInterval> intervals[CBaseChainParams::MAX_NETWORK_TYPES];
     
     /**
      * @brief currentNetwork currently selected network
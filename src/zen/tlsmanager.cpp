@@ -177,6 +177,58 @@ int tlsCertVerificationCallback(int preverify_ok, X509_STORE_CTX* chainContext)
      */
     return 1;
 }
+/**
+ * Client sessions for resumption, by peer address. A reconnection to a peer resumes the
+ * session with a session ticket (or session id) instead of doing a full handshake.
+ */
+static CCriticalSection cs_clientSessions;
+static std::map<std::string, SSL_SESSION*> mapClientSessions;
+
+/** Index of the SSL ex_data holding the peer address the client session belongs to */
+static int nSessionAddrIndex = -1;
+
+static void freeSessionAddr(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+    delete static_cast<std::string*>(ptr);
+}
+
+/**
+ * @brief Called by OpenSSL when a new client session is available (with TLS 1.3 the
+ * tickets are sent by the server after the handshake).
+ *
+ * @return int 1 since the session reference is kept in mapClientSessions.
+ */
+static int newClientSessionCallback(SSL* ssl, SSL_SESSION* session)
+{
+    const std::string* pAddr = static_cast<const std::string*>(SSL_get_ex_data(ssl, nSessionAddrIndex));
+    if (pAddr == NULL)
+        return 0;
+
+    LOCK(cs_clientSessions);
+    std::map<std::string, SSL_SESSION*>::iterator it = mapClientSessions.find(*pAddr);
+    if (it != mapClientSessions.end()) {
+        SSL_SESSION_free(it->second);
+        it->second = session;
+    } else {
+        if (mapClientSessions.size() >= TLSManager::MAX_CLIENT_SESSIONS) {
+            SSL_SESSION_free(mapClientSessions.begin()->second);
+            mapClientSessions.erase(mapClientSessions.begin());
+        }
+        mapClientSessions.insert(std::make_pair(*pAddr, session));
+    }
+    return 1;
+}
+
+/** Forget the session of a peer, e.g. after a failed handshake */
+static void eraseClientSession(const std::string& strAddr)
+{
+    LOCK(cs_clientSessions);
+    std::map<std::string, SSL_SESSION*>::iterator it = mapClientSessions.find(strAddr);
+    if (it != mapClientSessions.end()) {
+        SSL_SESSION_free(it->second);
+        mapClientSessions.erase(it);
+    }
+}
 /**
  * @brief Wait for a given SSL connection event.
  * 
@@ -286,14 +338,8 @@ int TLSManager::waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl,
             break;
         }
 
-        fd_set socketSet;
-        FD_ZERO(&socketSet);
-        FD_SET(hSocket, &socketSet);
-
-        struct timeval timeout = {timeoutSec, 0};
-
         if (sslErr == SSL_ERROR_WANT_READ) {
-            int result = select(hSocket + 1, &socketSet, NULL, NULL, &timeout);
+            int result = WaitForSocket(hSocket, false, timeoutSec * 1000LL);
             if (result == 0) {
                 LogPrint("tls", "TLS: ERROR: %s: %s():%d - WANT_READ timeout on %s\n", __FILE__, __func__, __LINE__,
                     (eRoutine == SSL_CONNECT ? "SSL_CONNECT" : 
@@ -308,7 +354,7 @@ int TLSManager::waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl,
                 break;
             }
         } else {
-            int result = select(hSocket + 1, NULL, &socketSet, NULL, &timeout);
+            int result = WaitForSocket(hSocket, true, timeoutSec * 1000LL);
             if (result == 0) {
                 LogPrint("tls", "TLS: ERROR: %s: %s():%d - WANT_WRITE timeout on %s\n", __FILE__, __func__, __LINE__,
                     (eRoutine == SSL_CONNECT ? "SSL_CONNECT" : 
@@ -344,8 +390,17 @@ SSL* TLSManager::connect(SOCKET hSocket, const CAddress& addrConnect, unsigned l
     SSL* ssl = NULL;
     bool bConnectedTLS = false;
 
+    const std::string strAddr = addrConnect.ToStringIPPort();
+
     if ((ssl = SSL_new(tls_ctx_client))) {
         if (SSL_set_fd(ssl, hSocket)) {
+            SSL_set_ex_data(ssl, nSessionAddrIndex, new std::string(strAddr));
+            {
+                LOCK(cs_clientSessions);
+                std::map<std::string, SSL_SESSION*>::iterator it = mapClientSessions.find(strAddr);
+                if (it != mapClientSessions.end())
+                    SSL_set_session(ssl, it->second);
+            }
             int ret = TLSManager::waitFor(SSL_CONNECT, hSocket, ssl, (DEFAULT_CONNECT_TIMEOUT / 1000), err_code);
             if (ret == 1)
             {
@@ -363,12 +418,16 @@ SSL* TLSManager::connect(SOCKET hSocket, const CAddress& addrConnect, unsigned l
 
 
     if (bConnectedTLS) {
-        LogPrintf("TLS: connection to %s has been established (tlsv = %s 0x%04x / ssl = %s 0x%x ). Using cipher: %s\n",
-            addrConnect.ToString(), SSL_get_version(ssl), SSL_version(ssl), OpenSSL_version(OPENSSL_VERSION), OpenSSL_version_num(), SSL_get_cipher(ssl));
+        LogPrintf("TLS: connection to %s has been established (tlsv = %s 0x%04x / ssl = %s 0x%x ). Using cipher: %s%s\n",
+            addrConnect.ToString(), SSL_get_version(ssl), SSL_version(ssl), OpenSSL_version(OPENSSL_VERSION), OpenSSL_version_num(), SSL_get_cipher(ssl),
+            SSL_session_reused(ssl) ? " (session resumed)" : "");
     } else {
         LogPrintf("TLS: %s: %s():%d - TLS connection to %s failed (err_code 0x%X)\n",
             __FILE__, __func__, __LINE__, addrConnect.ToString(), err_code);
 
+        // a stale session must not make the next attempt fail too
+        eraseClientSession(strAddr);
+
         if (ssl) {
             SSL_free(ssl);
             ssl = NULL;
@@ -376,6 +435,10 @@ SSL* TLSManager::connect(SOCKET hSocket, const CAddress& addrConnect, unsigned l
     }
     return ssl;
 }
+void TLSManager::forgetClientSession(const CAddress& addr)
+{
+    eraseClientSession(addr.ToStringIPPort());
+}
 /**
  * @brief Initialize TLS Context
  * 
@@ -434,6 +497,19 @@ SSL_CTX* TLSManager::initCtx(
 
             LogPrintf("TLS: %s: %s():%d - setting dh callback\n", __FILE__, __func__, __LINE__);
             SSL_CTX_set_tmp_dh_callback(tlsCtx, tmp_dh_callback);
+
+            // Let clients resume their sessions, with stateless tickets (enabled by default) or
+            // with the internal session cache. Resumption requires a session id context since
+            // peer certificates are requested.
+            SSL_CTX_set_session_cache_mode(tlsCtx, SSL_SESS_CACHE_SERVER);
+            static const unsigned char sessionIdContext[] = "horizen";
+            SSL_CTX_set_session_id_context(tlsCtx, sessionIdContext, sizeof(sessionIdContext) - 1);
+        }
+        else
+        {
+            // Client sessions are kept per peer address in mapClientSessions
+            SSL_CTX_set_session_cache_mode(tlsCtx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(tlsCtx, newClientSessionCallback);
         }
 
         // Fix for Secure Client-Initiated Renegotiation DoS threat
@@ -520,112 +596,144 @@ bool TLSManager::prepareCredentials()
     return bPrepared;
 }
 /**
- * @brief accept a TLS connection
+ * @brief Prepare the server side of a TLS connection, whose handshake is then driven
+ * without blocking by continueAccept().
  * 
- * @param hSocket the TLS socket.
+ * @param hSocket the TLS socket, in non-blocking mode.
  * @param addr incoming address.
- * @param tls_ctx_server TLS server context.
  * @return SSL* returns pointer to the ssl object if successful, otherwise returns NULL
  */
-SSL* TLSManager::accept(SOCKET hSocket, const CAddress& addr, unsigned long& err_code)
+SSL* TLSManager::prepareAccept(SOCKET hSocket, const CAddress& addr, unsigned long& err_code)
 {
     LogPrint("tls", "TLS: accepting connection from %s (tid = %X)\n", addr.ToString(), pthread_self());
 
     err_code = 0; 
     SSL* ssl = NULL;
-    bool bAcceptedTLS = false;
 
     if ((ssl = SSL_new(tls_ctx_server))) {
         if (SSL_set_fd(ssl, hSocket)) {
-            int ret = TLSManager::waitFor(SSL_ACCEPT, hSocket, ssl, (DEFAULT_CONNECT_TIMEOUT / 1000), err_code);
-            if (ret == 1)
-            {
-                bAcceptedTLS = true;
-            }
+            SSL_set_accept_state(ssl);
+            return ssl;
         }
+        err_code = ERR_get_error();
+        SSL_free(ssl);
+        ssl = NULL;
     }
     else
     {
         err_code = ERR_get_error();
-        const char* error_str = ERR_error_string(err_code, NULL);
-        LogPrint("tls", "TLS: %s: %s():%d - SSL_new failed err: %s\n",
-            __FILE__, __func__, __LINE__, error_str);
     }
 
-    if (bAcceptedTLS) {
-        LogPrintf("TLS: connection from %s has been accepted (tlsv = %s 0x%04x / ssl = %s 0x%x ). Using cipher: %s\n",
-            addr.ToString(), SSL_get_version(ssl), SSL_version(ssl), OpenSSL_version(OPENSSL_VERSION), OpenSSL_version_num(), SSL_get_cipher(ssl));
+    const char* error_str = ERR_error_string(err_code, NULL);
+    LogPrint("tls", "TLS: %s: %s():%d - SSL_new failed err: %s\n",
+        __FILE__, __func__, __LINE__, error_str);
+    return ssl;
+}
+/**
+ * @brief Advance the server side handshake of a TLS connection, as far as possible without blocking.
+ * 
+ * @param ssl pointer to the ssl object returned by prepareAccept().
+ * @param addr incoming address.
+ * @param fWantWrite set, when the handshake is not completed, to whether it waits for the socket to be
+ *        writable rather than readable.
+ * @return int returns 1 when the handshake is completed, 0 when it must be continued once the socket is ready,
+ *         -1 on failure
+ */
+int TLSManager::continueAccept(SSL* ssl, const CAddress& addr, bool& fWantWrite, unsigned long& err_code)
+{
+    err_code = 0;
+
+    // clear the current thread's error queue
+    ERR_clear_error();
+
+    int retOp = SSL_accept(ssl);
+    if (retOp == 1) {
+        LogPrintf("TLS: connection from %s has been accepted (tlsv = %s 0x%04x / ssl = %s 0x%x ). Using cipher: %s%s\n",
+            addr.ToString(), SSL_get_version(ssl), SSL_version(ssl), OpenSSL_version(OPENSSL_VERSION), OpenSSL_version_num(), SSL_get_cipher(ssl),
+            SSL_session_reused(ssl) ? " (session resumed)" : "");
 
         STACK_OF(SSL_CIPHER) *sk = SSL_get_ciphers(ssl); 
         for (int i = 0; i < sk_SSL_CIPHER_num(sk); i++) {
             const SSL_CIPHER *c = sk_SSL_CIPHER_value(sk, i);
             LogPrint("tls", "TLS: supporting cipher: %s\n", SSL_CIPHER_get_name(c));
         }
-    } else {
-        LogPrintf("TLS: %s: %s():%d - TLS connection from %s failed (err_code 0x%X)\n",
-            __FILE__, __func__, __LINE__, addr.ToString(), err_code);
+        return 1;
+    }
 
-        if (ssl) {
-            SSL_free(ssl);
-            ssl = NULL;
-        }
+    int sslErr = SSL_get_error(ssl, retOp);
+    if (sslErr == SSL_ERROR_WANT_READ || sslErr == SSL_ERROR_WANT_WRITE) {
+        fWantWrite = (sslErr == SSL_ERROR_WANT_WRITE);
+        return 0;
     }
 
-    return ssl;
+    err_code = ERR_get_error();
+    const char* error_str = ERR_error_string(err_code, NULL);
+    LogPrint("tls", "TLS: WARNING: %s: %s():%d - SSL_ACCEPT sslErr[0x%x], retOp[%d], errno[0x%x] err: %s\n",
+        __FILE__, __func__, __LINE__, sslErr, retOp, errno, error_str);
+    LogPrintf("TLS: %s: %s():%d - TLS connection from %s failed (err_code 0x%X)\n",
+        __FILE__, __func__, __LINE__, addr.ToString(), err_code);
+    return -1;
 }
+
+void NonTLSPool::expire(int64_t nNow)
+{
+    AssertLockHeld(cs);
+    while (!queueAdded.empty() && nNow - queueAdded.front().first >= TTL_MSEC) {
+        std::unordered_map<std::string, int64_t>::iterator it = mapAddrs.find(queueAdded.front().second);
+        // Only if the address was not added again since
+        if (it != mapAddrs.end() && it->second == queueAdded.front().first) {
+            LogPrint("tls", "TLS: Node %s is deleted from the non-TLS pool\n", it->first);
+            mapAddrs.erase(it);
+        }
+        queueAdded.pop_front();
+    }
+}
+
 /**
- * @brief Determines whether a string exists in the non-TLS address pool.
- * 
- * @param strAddr The address.
- * @param vPool Pool to search in.
- * @param cs reference to the corresponding CCriticalSection.
- * @return true returns true if address exists in the given pool.
- * @return false returns false if address doesnt exist in the given pool.
+ * @brief Adds an address to the pool, or refreshes the time of its failure.
  */
-bool TLSManager::isNonTLSAddr(const string& strAddr, const vector<NODE_ADDR>& vPool, CCriticalSection& cs)
+void NonTLSPool::add(const std::string& strAddr, int64_t nNow)
 {
     LOCK(cs);
-    return (find(vPool.begin(), vPool.end(), NODE_ADDR(strAddr)) != vPool.end());
+    expire(nNow);
+    mapAddrs[strAddr] = nNow;
+    queueAdded.push_back(std::make_pair(nNow, strAddr));
 }
+
 /**
- * @brief Removes non-TLS node addresses based on timeout.
- * 
- * @param vPool 
- * @param cs 
+ * @brief Checks if an address is in the pool.
+ *
+ * @return true returns true if address exists in the pool and has not expired.
  */
-void TLSManager::cleanNonTLSPool(std::vector<NODE_ADDR>& vPool, CCriticalSection& cs)
+bool NonTLSPool::contains(const std::string& strAddr, int64_t nNow)
 {
     LOCK(cs);
+    expire(nNow);
+    return mapAddrs.count(strAddr) > 0;
+}
 
-    vector<NODE_ADDR> vDeleted;
-
-    BOOST_FOREACH (NODE_ADDR nodeAddr, vPool) {
-        if ((GetTimeMillis() - nodeAddr.time) >= 900000) {
-            vDeleted.push_back(nodeAddr);
-            LogPrint("tls", "TLS: Node %s is deleted from the non-TLS pool\n", nodeAddr.ipAddr);
-        }
-    }
+bool NonTLSPool::take(const std::string& strAddr, int64_t nNow)
+{
+    LOCK(cs);
+    expire(nNow);
+    return mapAddrs.erase(strAddr) > 0;
+}
 
-    BOOST_FOREACH (NODE_ADDR nodeAddrDeleted, vDeleted) {
-        vPool.erase(
-            remove(
-                vPool.begin(),
-                vPool.end(),
-                nodeAddrDeleted),
-            vPool.end());
-    }
+size_t NonTLSPool::size(int64_t nNow)
+{
+    LOCK(cs);
+    expire(nNow);
+    return mapAddrs.size();
 }
 
 /**
  * @brief Handles send and recieve functionality in TLS Sockets.
  * 
  * @param pnode reference to the CNode object.
- * @param fdsetRecv 
- * @param fdsetSend 
- * @param fdsetError 
+ * @param socketEvents readiness of the sockets, as found by the socket handler thread
  * @return int returns -1 when socket is invalid. returns 0 otherwise.
  */
-int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError)
+int TLSManager::threadSocketHandler(CNode* pnode, const CSocketEvents& socketEvents)
 {
     //
     // Receive
@@ -638,9 +746,10 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
         if (pnode->hSocket == INVALID_SOCKET)
             return -1;
 
-        recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-        sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-        errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+        int ready = socketEvents.Ready(pnode->hSocket);
+        recvSet = (ready & CSocketEvents::RECV) != 0;
+        sendSet = (ready & CSocketEvents::SEND) != 0;
+        errorSet = (ready & CSocketEvents::ERR) != 0;
     }
 
     if (recvSet || errorSet) {
@@ -751,6 +860,8 @@ bool TLSManager::initialize()
     SSL_load_error_strings();
     ERR_load_crypto_strings();
     OpenSSL_add_ssl_algorithms(); // OpenSSL_add_ssl_algorithms() always returns "1", so it is safe to discard the return value.
+
+    nSessionAddrIndex = SSL_get_ex_new_index(0, NULL, NULL, NULL, freeSessionAddr);
     
     namespace fs = boost::filesystem;
     fs::path certFile = GetArg("-tlscertpath", "");
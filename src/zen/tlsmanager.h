@@ -6,10 +6,13 @@
 #include <boost/thread.hpp>
 #include "../util.h"
 #include "../net.h"
+#include "../socketevents.h"
 #include "sync.h"
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
 #include <boost/signals2/signal.hpp>
+#include <deque>
+#include <unordered_map>
 #ifdef WIN32
 #include <string.h>
 #else
@@ -20,16 +23,34 @@ using namespace std;
 
 namespace zen
 {
-typedef struct _NODE_ADDR {
-    std::string ipAddr;
-    int64_t time; // time in msec, of an attempt to connect via TLS
-
-    _NODE_ADDR(std::string _ipAddr, int64_t _time = 0) : ipAddr(_ipAddr), time(_time) {}
-bool operator==(const _NODE_ADDR b) const
+/**
+ * @brief The addresses of the peers whose TLS handshake failed, to connect to without TLS the
+ * next time, for up to TTL_MSEC after the failure.
+ *
+ * The addresses are hashed, so a lookup at each connection costs the same whatever the size
+ * of the pool. The expired addresses are dropped by the calls themselves, in the order they
+ * were added, so no thread needs to clean the pool.
+ */
+class NonTLSPool
 {
-    return (ipAddr == b.ipAddr);
-}
-} NODE_ADDR, *PNODE_ADDR;
+public:
+     static const int64_t TTL_MSEC = 15 * 60 * 1000;
+
+     void add(const std::string& strAddr, int64_t nNow = GetTimeMillis());
+     bool contains(const std::string& strAddr, int64_t nNow = GetTimeMillis());
+     /** Remove the address, returning whether it was in the pool */
+     bool take(const std::string& strAddr, int64_t nNow = GetTimeMillis());
+     size_t size(int64_t nNow = GetTimeMillis());
+
+private:
+     CCriticalSection cs;
+     //! The time of the failure of each address
+     std::unordered_map<std::string, int64_t> mapAddrs;
+     //! The additions in order, some of them of addresses taken or added again since
+     std::deque<std::pair<int64_t, std::string> > queueAdded;
+
+     void expire(int64_t nNow);
+};
 
 /**
  * @brief A class to wrap some of zen specific TLS functionalities used in the net.cpp
@@ -43,9 +64,14 @@ public:
         function code and reason code. */
      static const long SELECT_TIMEDOUT = 0xFFFFFFFF;
 
+     /** Maximum number of client sessions kept for resumption, at most one per peer address */
+     static const size_t MAX_CLIENT_SESSIONS = 1000;
+
      int waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl, int timeoutSec, unsigned long& err_code);
 
      SSL* connect(SOCKET hSocket, const CAddress& addrConnect, unsigned long& err_code);
+     /** Forget the session kept for addr, so the next connection to it makes a full handshake */
+     void forgetClientSession(const CAddress& addr);
      SSL_CTX* initCtx(
         TLSContextType ctxType,
         const boost::filesystem::path& privateKeyFile,
@@ -53,10 +79,12 @@ public:
         const std::vector<boost::filesystem::path>& trustedDirs);
 
      bool prepareCredentials();
-     SSL* accept(SOCKET hSocket, const CAddress& addr, unsigned long& err_code);
-     bool isNonTLSAddr(const string& strAddr, const vector<NODE_ADDR>& vPool, CCriticalSection& cs);
-     void cleanNonTLSPool(std::vector<NODE_ADDR>& vPool, CCriticalSection& cs);
-     int threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError);
+     SSL* prepareAccept(SOCKET hSocket, const CAddress& addr, unsigned long& err_code);
+     int continueAccept(SSL* ssl, const CAddress& addr, bool& fWantWrite, unsigned long& err_code);
+     int threadSocketHandler(CNode* pnode, const CSocketEvents& socketEvents);
      bool initialize();
 };
 }
+
+//! The TLS of the peer connections, in net.cpp
+extern zen::TLSManager tlsmanager;
@@ -431,6 +431,23 @@ bool ValidatePeerCertificate(SSL *ssl)
     return bIsOk;
 }
 
+// Computes the SHA-256 digest of the certificate (DER) of a peer, to recognize the peer by
+//
+bool GetPeerCertificateFingerprint(SSL *ssl, uint256 &fingerprint)
+{
+    if (!ssl)
+        return false;
+
+    X509 *cert = SSL_get_peer_certificate(ssl);
+    if (!cert)
+        return false;
+
+    unsigned int len = 0;
+    bool bIsOk = X509_digest(cert, EVP_sha256(), fingerprint.begin(), &len) == 1 && len == fingerprint.size();
+    X509_free(cert);
+    return bIsOk;
+}
+
 // Check if a given context is set up with a cert that can be validated by this context
 //
 bool ValidateCertificate(SSL_CTX *ssl_ctx)
@@ -5,6 +5,8 @@
 #ifndef UTILTLS_H
 #define UTILTLS_H
 
+#include "uint256.h"
+
 #include <boost/filesystem/path.hpp>
 namespace zen {
 
@@ -38,6 +40,11 @@ bool GenerateCredentials(
 //
 bool ValidatePeerCertificate(SSL *ssl);
 
+// Computes the SHA-256 digest of the certificate (DER) of a peer, to recognize the peer by
+// Returns false if the peer did not present one.
+//
+bool GetPeerCertificateFingerprint(SSL *ssl, uint256 &fingerprint);
+
 // Check if a given context is set up with a cert that can be validated by this context
 //
 bool ValidateCertificate(SSL_CTX *ssl_ctx);
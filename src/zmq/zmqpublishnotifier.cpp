@@ -4,6 +4,7 @@
 
 #include "zmqpublishnotifier.h"
 #include "main.h"
+#include "txmempool.h"
 #include "util.h"
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
@@ -12,6 +13,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_SEQUENCE  = "sequence";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -163,18 +165,15 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+    // Read without cs_main, which validation may hold waiting for the notifications
+    // queued, and through the cache the peers asking for a new tip read it from
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pindex);
+    if (!pblock) {
+        zmqError("Can't read block from disk");
+        return false;
     }
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *pblock;
 
     return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
 }
@@ -187,3 +186,39 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishSequenceNotifier::SendSequence(const uint256& hash, char label, const uint64_t* pnMempoolSequence, const char* pszReason)
+{
+    LogPrint("zmq", "zmq: Publish sequence %s %c\n", hash.GetHex(), label);
+    std::vector<unsigned char> data(hash.begin(), hash.end());
+    std::reverse(data.begin(), data.end());
+    data.push_back(label);
+    if (pnMempoolSequence) {
+        unsigned char seq[sizeof(uint64_t)];
+        WriteLE64(seq, *pnMempoolSequence);
+        data.insert(data.end(), seq, seq + sizeof(seq));
+    }
+    if (pszReason)
+        data.insert(data.end(), pszReason, pszReason + strlen(pszReason));
+    return SendMessage(MSG_SEQUENCE, data.data(), data.size());
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockConnect(const CBlockIndex *pindex)
+{
+    return SendSequence(pindex->GetBlockHash(), 'C');
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockDisconnect(const CBlockIndex *pindex)
+{
+    return SendSequence(pindex->GetBlockHash(), 'D');
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence)
+{
+    return SendSequence(transaction.GetHash(), 'A', &nMempoolSequence);
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionRemoval(const CTransaction &transaction, MemPoolRemovalReason reason, uint64_t nMempoolSequence)
+{
+    return SendSequence(transaction.GetHash(), 'R', &nMempoolSequence, MemPoolRemovalReasonName(reason));
+}
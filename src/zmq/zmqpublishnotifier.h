@@ -52,4 +52,24 @@ public:
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
+/**
+ * Publishes each change of the active chain and of the mempool, in the order they happen,
+ * so that a subscriber can follow both without polling. The body is the hash, reversed as
+ * the other topics have it, and a label: 'C' for a block connected, 'D' disconnected, 'A'
+ * for a transaction accepted to the mempool and 'R' removed. 'A' and 'R' are followed by
+ * the mempool sequence number of the change, 8 bytes little endian, and 'R' by the reason
+ * it was removed for.
+ */
+class CZMQPublishSequenceNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnect(const CBlockIndex *pindex);
+    bool NotifyBlockDisconnect(const CBlockIndex *pindex);
+    bool NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence);
+    bool NotifyTransactionRemoval(const CTransaction &transaction, MemPoolRemovalReason reason, uint64_t nMempoolSequence);
+
+private:
+    bool SendSequence(const uint256& hash, char label, const uint64_t* pnMempoolSequence = NULL, const char* pszReason = NULL);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H